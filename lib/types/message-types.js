@@ -407,6 +407,20 @@ export type ClientDBMessageInfo = {
   +media_infos: ?$ReadOnlyArray<ClientDBMediaInfo>,
 };
 
+// Versions of the rows returned by the native database. strings is the
+// default, typed has numbers for the numeric fields.
+export const clientDBProtocolVersions = Object.freeze({
+  strings: 1,
+  typed: 2,
+});
+
+export type ClientDBTypedMessageInfo = {
+  ...ClientDBMessageInfo,
+  +type: number,
+  +future_type: ?number,
+  +time: number,
+};
+
 export type ClientDBReplaceMessageOperation = {
   +type: 'replace',
   +payload: ClientDBMessageInfo,
@@ -287,15 +287,27 @@ export type ClientDBThreadInfo = {
   +repliesCount: number,
 };
 
+export type ClientDBThreadSummary = $Diff<
+  ClientDBThreadInfo,
+  { +members: string, +roles: string },
+>;
+
 export type ClientDBReplaceThreadOperation = {
   +type: 'replace',
   +payload: ClientDBThreadInfo,
 };
 
+// Skips the write when the stored thread is the same
+export type ClientDBReplaceThreadIfChangedOperation = {
+  +type: 'replace_if_changed',
+  +payload: ClientDBThreadInfo,
+};
+
 export type ClientDBThreadStoreOperation =
   | RemoveThreadOperation
   | RemoveAllThreadsOperation
-  | ClientDBReplaceThreadOperation;
+  | ClientDBReplaceThreadOperation
+  | ClientDBReplaceThreadIfChangedOperation;
 
 export type ThreadDeletionRequest = {
   +threadID: string,
@@ -45,8 +45,9 @@ function convertThreadStoreOperationsToClientDBOperations(
 ): $ReadOnlyArray<ClientDBThreadStoreOperation> {
   return threadStoreOperations.map(threadStoreOperation => {
     if (threadStoreOperation.type === 'replace') {
+      // Most replaces of a sync leave the thread as it is
       return {
-        type: 'replace',
+        type: 'replace_if_changed',
         payload: convertRawThreadInfoToClientDBThreadInfo(
           threadStoreOperation.payload.threadInfo,
         ),
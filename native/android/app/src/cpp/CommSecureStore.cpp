@@ -1,4 +1,5 @@
 #include <Tools/CommSecureStore.h>
+#include <Tools/WorkerThread.h>
 #include <fbjni/fbjni.h>
 
 using namespace facebook::jni;
@@ -27,13 +28,21 @@ public:
 
 namespace comm {
 
-void CommSecureStore::set(const std::string key, const std::string value)
-    const {
+void CommSecureStore::setInPlatform(
+    const std::string &key,
+    const std::string &value) const {
   CommSecureStoreJavaClass::set(key, value);
 }
 
-folly::Optional<std::string> CommSecureStore::get(const std::string key) const {
-  return CommSecureStoreJavaClass::get(key);
+folly::Optional<std::string>
+CommSecureStore::getFromPlatform(const std::string &key) const {
+  // Lookups also come from native threads, e.g. the warm-up of
+  // CommCoreModule, where the app classes are only found through the class
+  // loader of the app
+  folly::Optional<std::string> value;
+  WorkerThread::runNativeAccessible(
+      [&key, &value]() { value = CommSecureStoreJavaClass::get(key); });
+  return value;
 }
 
 } // namespace comm
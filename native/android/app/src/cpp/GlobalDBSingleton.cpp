@@ -1,28 +1,53 @@
+#include <InternalModules/DraftCache.h>
 #include <InternalModules/GlobalDBSingleton.h>
 #include <InternalModules/GlobalDBSingletonJNIHelper.h>
+#include <InternalModules/MemoryPressure.h>
 
 namespace comm {
 GlobalDBSingleton GlobalDBSingleton::instance;
 
 GlobalDBSingleton::GlobalDBSingleton()
     : multithreadingEnabled(true),
-      databaseThread(std::make_unique<WorkerThread>("database")),
+      databaseThread(std::make_unique<WorkerThread>(
+          "database",
+          OverflowPolicy::Spill,
+          ThreadAttachment::Lifetime,
+          AllocationTag::Database,
+          ThreadQoS::UserInitiated)),
       tasksCancelled(false) {
 }
 
-void GlobalDBSingleton::scheduleOrRun(const taskType task) {
-  this->scheduleOrRunCommonImpl(task);
+void GlobalDBSingleton::scheduleOrRun(taskType task) {
+  this->scheduleOrRunCommonImpl(std::move(task));
 }
 
-void GlobalDBSingleton::scheduleOrRunCancellable(const taskType task) {
-  this->scheduleOrRunCancellableCommonImpl(task);
+void GlobalDBSingleton::scheduleOrRunCancellable(taskType task) {
+  this->scheduleOrRunCancellableCommonImpl(std::move(task));
 }
 
 void GlobalDBSingleton::scheduleOrRunCancellable(
-    const taskType task,
+    taskType task,
     const std::shared_ptr<facebook::react::Promise> promise,
     const std::shared_ptr<facebook::react::CallInvoker> jsInvoker) {
-  this->scheduleOrRunCancellableCommonImpl(task, promise, jsInvoker);
+  this->scheduleOrRunCancellableCommonImpl(std::move(task), promise, jsInvoker);
+}
+
+void GlobalDBSingleton::scheduleOrRunCancellableRead(
+    taskType task,
+    const std::shared_ptr<facebook::react::Promise> promise,
+    const std::shared_ptr<facebook::react::CallInvoker> jsInvoker,
+    TaskPriority priority,
+    std::shared_ptr<CancellationToken> cancellationToken) {
+  this->scheduleOrRunCancellableReadCommonImpl(
+      std::move(task), promise, jsInvoker, priority, cancellationToken);
+}
+
+void GlobalDBSingleton::scheduleOrRunCancellableBatchedWrite(
+    taskType write,
+    const std::shared_ptr<facebook::react::Promise> promise,
+    const std::shared_ptr<facebook::react::CallInvoker> jsInvoker) {
+  this->scheduleOrRunCancellableBatchedWriteCommonImpl(
+      std::move(write), promise, jsInvoker);
 }
 
 void GlobalDBSingleton::enableMultithreading() {
@@ -39,7 +64,7 @@ void GlobalDBSingletonJNIHelper::scheduleOrRun(
           globalTaskRef->run();
           globalTaskRef.release();
         };
-        facebook::jni::ThreadScope::WithClassLoader(std::move(runTask));
+        WorkerThread::runNativeAccessible(std::move(runTask));
       });
 }
 
@@ -48,6 +73,16 @@ void GlobalDBSingletonJNIHelper::enableMultithreading(
   GlobalDBSingleton::instance.enableMultithreading();
 }
 
+void GlobalDBSingletonJNIHelper::flushDraftCache(
+    facebook::jni::alias_ref<GlobalDBSingletonJNIHelper> jThis) {
+  DraftCache::instance().flush();
+}
+
+void GlobalDBSingletonJNIHelper::releaseMemory(
+    facebook::jni::alias_ref<GlobalDBSingletonJNIHelper> jThis) {
+  MemoryPressure::onMemoryWarning();
+}
+
 void GlobalDBSingletonJNIHelper::registerNatives() {
   javaClassStatic()->registerNatives({
       makeNativeMethod(
@@ -55,6 +90,10 @@ void GlobalDBSingletonJNIHelper::registerNatives() {
       makeNativeMethod(
           "enableMultithreading",
           GlobalDBSingletonJNIHelper::enableMultithreading),
+      makeNativeMethod(
+          "flushDraftCache", GlobalDBSingletonJNIHelper::flushDraftCache),
+      makeNativeMethod(
+          "releaseMemory", GlobalDBSingletonJNIHelper::releaseMemory),
   });
 }
 } // namespace comm
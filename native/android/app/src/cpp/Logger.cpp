@@ -4,8 +4,8 @@
 
 namespace comm {
 
-void Logger::log(const std::string str) {
-  __android_log_print(ANDROID_LOG_VERBOSE, "COMM", "%s", str.c_str());
+void Logger::write(const std::string &lines) {
+  __android_log_write(ANDROID_LOG_VERBOSE, "COMM", lines.c_str());
 };
 
 } // namespace comm
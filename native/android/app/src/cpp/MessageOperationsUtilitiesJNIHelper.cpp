@@ -3,14 +3,54 @@
 #include <PersistentStorageUtilities/MessageOperationsUtilities/MessageOperationsUtilitiesJNIHelper.h>
 
 namespace comm {
-void MessageOperationsUtilitiesJNIHelper::storeMessageInfos(
+facebook::jni::local_ref<JStoredMessageInfosCount::javaobject>
+JStoredMessageInfosCount::create(const StoredMessageInfosCount &count) {
+  return newInstance(
+      static_cast<jint>(count.messages),
+      static_cast<jint>(count.media),
+      static_cast<jint>(count.skippedMessages));
+}
+
+facebook::jni::local_ref<JStoredMessageInfosCount::javaobject>
+MessageOperationsUtilitiesJNIHelper::storeMessageInfos(
     facebook::jni::alias_ref<MessageOperationsUtilitiesJNIHelper> jThis,
     facebook::jni::JString sqliteFilePath,
     facebook::jni::JString rawMessageInfosString) {
   std::string sqliteFilePathCpp = sqliteFilePath.toStdString();
   std::string rawMessageInfosStringCpp = rawMessageInfosString.toStdString();
-  SQLiteQueryExecutor::initialize(sqliteFilePathCpp);
-  MessageOperationsUtilities::storeMessageInfos(rawMessageInfosStringCpp);
+  SQLiteQueryExecutor::initializeForIngestion(sqliteFilePathCpp);
+  return JStoredMessageInfosCount::create(
+      MessageOperationsUtilities::storeMessageInfos(rawMessageInfosStringCpp));
+}
+
+facebook::jni::local_ref<JStoredMessageInfosCount::javaobject>
+MessageOperationsUtilitiesJNIHelper::storeMessageInfosFromBuffers(
+    facebook::jni::alias_ref<MessageOperationsUtilitiesJNIHelper> jThis,
+    facebook::jni::JString sqliteFilePath,
+    facebook::jni::alias_ref<
+        facebook::jni::JArrayClass<facebook::jni::JByteBuffer>>
+        rawMessageInfosBuffers) {
+  std::string sqliteFilePathCpp = sqliteFilePath.toStdString();
+  // The local references keep the buffers alive until they are stored
+  std::vector<facebook::jni::local_ref<facebook::jni::JByteBuffer>> buffers;
+  std::vector<folly::StringPiece> rawMessageInfosStrings;
+  const size_t buffersCount = rawMessageInfosBuffers->size();
+  buffers.reserve(buffersCount);
+  rawMessageInfosStrings.reserve(buffersCount);
+  for (size_t i = 0; i < buffersCount; i++) {
+    buffers.push_back(rawMessageInfosBuffers->getElement(i));
+    if (!buffers.back()->isDirect()) {
+      facebook::jni::throwNewJavaException(
+          "java/lang/IllegalArgumentException",
+          "Message infos buffer is not direct");
+    }
+    rawMessageInfosStrings.emplace_back(
+        reinterpret_cast<const char *>(buffers.back()->getDirectBytes()),
+        buffers.back()->getDirectSize());
+  }
+  SQLiteQueryExecutor::initializeForIngestion(sqliteFilePathCpp);
+  return JStoredMessageInfosCount::create(
+      MessageOperationsUtilities::storeMessageInfos(rawMessageInfosStrings));
 }
 
 void MessageOperationsUtilitiesJNIHelper::registerNatives() {
@@ -18,6 +58,9 @@ void MessageOperationsUtilitiesJNIHelper::registerNatives() {
       makeNativeMethod(
           "storeMessageInfos",
           MessageOperationsUtilitiesJNIHelper::storeMessageInfos),
+      makeNativeMethod(
+          "storeMessageInfosFromBuffers",
+          MessageOperationsUtilitiesJNIHelper::storeMessageInfosFromBuffers),
   });
 }
 } // namespace comm
@@ -10,18 +10,15 @@ public:
   static auto constexpr kJavaDescriptor =
       "Lapp/comm/android/fbjni/PlatformSpecificTools;";
 
-  static comm::crypto::OlmBuffer generateSecureRandomBytes(size_t size) {
+  static void
+  generateSecureRandomBytes(comm::crypto::OlmBuffer &buffer, size_t size) {
     static const auto cls = javaClassStatic();
     static auto method =
         cls->getStaticMethod<JArrayByte(int)>("generateSecureRandomBytes");
     auto methodResult = method(cls, (int)size);
-    comm::crypto::OlmBuffer result(size);
-    std::vector<jbyte> bytes(size);
-    methodResult->getRegion(0, size, bytes.data());
-    for (size_t i = 0; i < size; ++i) {
-      result[i] = bytes[i];
-    }
-    return result;
+    // Copied straight into the buffer, so that a reused one doesn't allocate
+    buffer.resize(size);
+    methodResult->getRegion(0, size, reinterpret_cast<jbyte *>(buffer.data()));
   }
 };
 
@@ -30,7 +27,7 @@ namespace comm {
 void PlatformSpecificTools::generateSecureRandomBytes(
     crypto::OlmBuffer &buffer,
     size_t size) {
-  buffer = PlatformSpecificToolsJavaClass::generateSecureRandomBytes(size);
+  PlatformSpecificToolsJavaClass::generateSecureRandomBytes(buffer, size);
 }
 
 std::string PlatformSpecificTools::getDeviceOS() {
@@ -1,3 +1,4 @@
+#include <Tools/Logger.h>
 #include <Tools/TerminateApp.h>
 #include <fbjni/fbjni.h>
 
@@ -18,6 +19,7 @@ public:
 namespace comm {
 
 void TerminateApp::terminate() {
+  Logger::flush();
   TerminateAppJavaClass::terminate();
 }
 
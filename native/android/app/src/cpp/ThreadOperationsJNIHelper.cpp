@@ -8,15 +8,42 @@ void ThreadOperationsJNIHelper::updateSQLiteUnreadStatus(
     std::string sqliteFilePath,
     std::string threadID,
     bool unread) {
-  SQLiteQueryExecutor::initialize(sqliteFilePath);
+  SQLiteQueryExecutor::initializeForIngestion(sqliteFilePath);
   ThreadOperations::updateSQLiteUnreadStatus(threadID, unread);
 }
 
+void ThreadOperationsJNIHelper::updateSQLiteUnreadStatuses(
+    facebook::jni::alias_ref<ThreadOperationsJNIHelper> jThis,
+    std::string sqliteFilePath,
+    facebook::jni::alias_ref<facebook::jni::JArrayClass<jstring>> threadIDs,
+    facebook::jni::alias_ref<facebook::jni::JArrayBoolean> unreadStatuses) {
+  const size_t threadsCount = threadIDs->size();
+  if (unreadStatuses->size() != threadsCount) {
+    facebook::jni::throwNewJavaException(
+        "java/lang/IllegalArgumentException",
+        "Every thread needs an unread status");
+  }
+  std::unique_ptr<jboolean[]> unreadStatusesCpp =
+      unreadStatuses->getRegion(0, threadsCount);
+  std::vector<std::pair<std::string, bool>> unreadStatusesPairs;
+  unreadStatusesPairs.reserve(threadsCount);
+  for (size_t i = 0; i < threadsCount; i++) {
+    unreadStatusesPairs.emplace_back(
+        threadIDs->getElement(i)->toStdString(),
+        unreadStatusesCpp[i] == JNI_TRUE);
+  }
+  SQLiteQueryExecutor::initializeForIngestion(sqliteFilePath);
+  ThreadOperations::updateSQLiteUnreadStatuses(unreadStatusesPairs);
+}
+
 void ThreadOperationsJNIHelper::registerNatives() {
   javaClassStatic()->registerNatives({
       makeNativeMethod(
           "updateSQLiteUnreadStatus",
           ThreadOperationsJNIHelper::updateSQLiteUnreadStatus),
+      makeNativeMethod(
+          "updateSQLiteUnreadStatuses",
+          ThreadOperationsJNIHelper::updateSQLiteUnreadStatuses),
   });
 }
 } // namespace comm
@@ -0,0 +1,78 @@
+#include <Tools/Trace.h>
+
+#include <dlfcn.h>
+
+namespace comm {
+
+namespace {
+
+// ATrace is only in the NDK from API level 23, and its async sections from
+// level 29, so it is looked up when the app starts instead of being linked
+struct ATraceFunctions {
+  bool (*isEnabled)(){nullptr};
+  void (*beginSection)(const char *){nullptr};
+  void (*endSection)(){nullptr};
+  void (*beginAsyncSection)(const char *, int32_t){nullptr};
+  void (*endAsyncSection)(const char *, int32_t){nullptr};
+
+  ATraceFunctions() {
+    void *library = dlopen("libandroid.so", RTLD_NOW | RTLD_LOCAL);
+    if (library == nullptr) {
+      return;
+    }
+    this->beginSection = reinterpret_cast<void (*)(const char *)>(
+        dlsym(library, "ATrace_beginSection"));
+    this->endSection =
+        reinterpret_cast<void (*)()>(dlsym(library, "ATrace_endSection"));
+    this->beginAsyncSection = reinterpret_cast<void (*)(const char *, int32_t)>(
+        dlsym(library, "ATrace_beginAsyncSection"));
+    this->endAsyncSection = reinterpret_cast<void (*)(const char *, int32_t)>(
+        dlsym(library, "ATrace_endAsyncSection"));
+    if (this->beginSection != nullptr && this->endSection != nullptr) {
+      this->isEnabled =
+          reinterpret_cast<bool (*)()>(dlsym(library, "ATrace_isEnabled"));
+    }
+  }
+};
+
+const ATraceFunctions &atrace() {
+  static const ATraceFunctions functions;
+  return functions;
+}
+
+} // namespace
+
+bool Trace::isEnabled() {
+  const ATraceFunctions &functions = atrace();
+  return functions.isEnabled != nullptr && functions.isEnabled();
+}
+
+void Trace::beginSection(const std::string &name) {
+  const ATraceFunctions &functions = atrace();
+  if (functions.beginSection != nullptr) {
+    functions.beginSection(name.c_str());
+  }
+}
+
+void Trace::endSection() {
+  const ATraceFunctions &functions = atrace();
+  if (functions.endSection != nullptr) {
+    functions.endSection();
+  }
+}
+
+void Trace::beginAsyncSection(const std::string &name, int32_t cookie) {
+  const ATraceFunctions &functions = atrace();
+  if (functions.beginAsyncSection != nullptr) {
+    functions.beginAsyncSection(name.c_str(), cookie);
+  }
+}
+
+void Trace::endAsyncSection(const std::string &name, int32_t cookie) {
+  const ATraceFunctions &functions = atrace();
+  if (functions.endAsyncSection != nullptr) {
+    functions.endAsyncSection(name.c_str(), cookie);
+  }
+}
+
+} // namespace comm
@@ -39,6 +39,7 @@ public:
     std::string sqliteFilePath = sqliteFilePathObj->toString();
 
     comm::SQLiteQueryExecutor::initialize(sqliteFilePath);
+    nativeModule->warmUp();
   }
 
   static void registerNatives() {
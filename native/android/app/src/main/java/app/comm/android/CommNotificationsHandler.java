@@ -8,6 +8,7 @@ import app.comm.android.fbjni.CommSecureStore;
 import app.comm.android.fbjni.GlobalDBSingleton;
 import app.comm.android.fbjni.MessageOperationsUtilities;
 import app.comm.android.fbjni.NetworkModule;
+import app.comm.android.fbjni.StoredMessageInfosCount;
 import app.comm.android.fbjni.ThreadOperations;
 import com.google.firebase.messaging.RemoteMessage;
 import io.invertase.firebase.messaging.RNFirebaseMessagingService;
@@ -94,8 +95,15 @@ public class CommNotificationsHandler extends RNFirebaseMessagingService {
         this.getApplicationContext().getDatabasePath("comm.sqlite");
     if (rawMessageInfosString != null && sqliteFile.exists()) {
       GlobalDBSingleton.scheduleOrRun(() -> {
-        MessageOperationsUtilities.storeMessageInfos(
-            sqliteFile.getPath(), rawMessageInfosString);
+        StoredMessageInfosCount count =
+            MessageOperationsUtilities.storeMessageInfos(
+                sqliteFile.getPath(), rawMessageInfosString);
+        if (count.skippedMessages > 0) {
+          Log.w(
+              "COMM",
+              "Skipped " + count.skippedMessages +
+                  " messages of the notification that couldn't be stored");
+        }
       });
     } else if (rawMessageInfosString != null) {
       Log.w("COMM", "Database not existing yet. Skipping notification");
@@ -1,7 +1,9 @@
 package app.comm.android;
 
+import android.content.ComponentCallbacks2;
 import android.content.Intent;
 import android.os.Bundle;
+import app.comm.android.fbjni.GlobalDBSingleton;
 import com.facebook.react.ReactActivity;
 import com.facebook.react.ReactActivityDelegate;
 import com.facebook.react.ReactRootView;
@@ -29,6 +31,23 @@ public class MainActivity extends ReactActivity {
     setIntent(intent);
   }
 
+  @Override
+  protected void onPause() {
+    super.onPause();
+    // The app may be killed in the background before the drafts go idle
+    GlobalDBSingleton.flushDraftCache();
+  }
+
+  @Override
+  public void onTrimMemory(int level) {
+    super.onTrimMemory(level);
+    // UI_HIDDEN only means that the app went to the background
+    if (level >= ComponentCallbacks2.TRIM_MEMORY_RUNNING_LOW &&
+        level != ComponentCallbacks2.TRIM_MEMORY_UI_HIDDEN) {
+      GlobalDBSingleton.releaseMemory();
+    }
+  }
+
   /**
    * Returns the instance of the {@link ReactActivityDelegate}. There the
    * RootView is created and you can specify the renderer you wish to use - the
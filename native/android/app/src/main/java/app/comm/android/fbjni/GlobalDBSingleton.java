@@ -3,4 +3,6 @@ package app.comm.android.fbjni;
 public class GlobalDBSingleton {
   public static native void scheduleOrRun(Runnable task);
   public static native void enableMultithreading();
+  public static native void flushDraftCache();
+  public static native void releaseMemory();
 }
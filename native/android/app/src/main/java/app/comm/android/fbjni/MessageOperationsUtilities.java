@@ -1,6 +1,12 @@
 package app.comm.android.fbjni;
 
+import java.nio.ByteBuffer;
+
 public class MessageOperationsUtilities {
-  public static native void
+  public static native StoredMessageInfosCount
   storeMessageInfos(String sqliteFilePath, String rawMessageInfosString);
+  // Takes direct buffers of UTF-8 JSON, skipping the conversion of a String
+  public static native StoredMessageInfosCount storeMessageInfosFromBuffers(
+      String sqliteFilePath,
+      ByteBuffer[] rawMessageInfosBuffers);
 }
@@ -0,0 +1,15 @@
+package app.comm.android.fbjni;
+
+// Rows written by MessageOperationsUtilities, and messages it skipped because
+// they couldn't be translated
+public class StoredMessageInfosCount {
+  public final int messages;
+  public final int media;
+  public final int skippedMessages;
+
+  public StoredMessageInfosCount(int messages, int media, int skippedMessages) {
+    this.messages = messages;
+    this.media = media;
+    this.skippedMessages = skippedMessages;
+  }
+}
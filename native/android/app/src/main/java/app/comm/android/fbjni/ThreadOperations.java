@@ -5,4 +5,9 @@ public class ThreadOperations {
       String sqliteFilePath,
       String threadID,
       boolean unread);
+  // unreadStatuses[i] is the status of threadIDs[i]
+  public static native void updateSQLiteUnreadStatuses(
+      String sqliteFilePath,
+      String[] threadIDs,
+      boolean[] unreadStatuses);
 }
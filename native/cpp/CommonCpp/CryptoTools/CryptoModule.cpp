@@ -1,12 +1,76 @@
 #include "CryptoModule.h"
-#include "PlatformSpecificTools.h"
+#include "SecureRandomPool.h"
 #include "olm/session.hh"
 
+#include <algorithm>
+#include <functional>
+#include <future>
 #include <stdexcept>
+#include <thread>
 
 namespace comm {
 namespace crypto {
 
+const size_t MAX_LIVE_SESSIONS{64};
+// Pickling and unpickling sessions is independent work for every session,
+// run on a few threads once there are enough sessions to be worth it
+const size_t MAX_PICKLE_WORKERS{4};
+const size_t MIN_SESSIONS_PER_PICKLE_WORKER{16};
+
+namespace {
+
+// Calls the function for every index below count, each worker taking a
+// contiguous chunk of indexes
+void forEachInParallel(
+    size_t count,
+    const std::function<void(size_t)> &function) {
+  auto runChunk = [&function](size_t chunkBegin, size_t chunkEnd) {
+    for (size_t i = chunkBegin; i < chunkEnd; i++) {
+      function(i);
+    }
+  };
+  size_t workerCount = std::min<size_t>(
+      {std::max(std::thread::hardware_concurrency(), 1u),
+       MAX_PICKLE_WORKERS,
+       count / MIN_SESSIONS_PER_PICKLE_WORKER});
+  if (workerCount <= 1) {
+    runChunk(0, count);
+    return;
+  }
+  size_t chunkSize = (count + workerCount - 1) / workerCount;
+  std::vector<std::future<void>> workers;
+  for (size_t chunkBegin = chunkSize; chunkBegin < count;
+       chunkBegin += chunkSize) {
+    workers.push_back(std::async(
+        std::launch::async,
+        runChunk,
+        chunkBegin,
+        std::min(chunkBegin + chunkSize, count)));
+  }
+  // Every worker is waited for before anything is rethrown, as they use
+  // what the caller holds
+  std::exception_ptr error;
+  try {
+    runChunk(0, chunkSize);
+  } catch (...) {
+    error = std::current_exception();
+  }
+  for (auto &worker : workers) {
+    try {
+      worker.get();
+    } catch (...) {
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+} // namespace
+
 CryptoModule::CryptoModule(std::string id) : id{id} {
   this->createAccount();
 }
@@ -23,16 +87,103 @@ CryptoModule::CryptoModule(
   }
 }
 
+std::shared_ptr<Session>
+CryptoModule::loadSession(const std::string &targetUserId) {
+  auto it = this->sessions.find(targetUserId);
+  if (it != this->sessions.end()) {
+    this->sessionsLRU.splice(
+        this->sessionsLRU.begin(), this->sessionsLRU, it->second.lruPosition);
+    return it->second.session;
+  }
+  auto pickled = this->pickledSessions.find(targetUserId);
+  if (pickled == this->pickledSessions.end()) {
+    return nullptr;
+  }
+  std::shared_ptr<Session> session = Session::restoreFromB64(
+      this->account,
+      this->keys.identityKeys.data(),
+      this->pickleKey,
+      pickled->second);
+  this->pickledSessions.erase(pickled);
+  this->addSession(targetUserId, session);
+  return session;
+}
+
+std::shared_ptr<Session>
+CryptoModule::acquireSession(const std::string &targetUserId) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->loadSession(targetUserId);
+}
+
+void CryptoModule::markSessionChanged(const std::string &targetUserId) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->dirtySessions.insert(targetUserId);
+}
+
+bool CryptoModule::hasSession(const std::string &targetUserId) {
+  return this->sessions.count(targetUserId) ||
+      this->pickledSessions.count(targetUserId);
+}
+
+void CryptoModule::addSession(
+    const std::string &targetUserId,
+    std::shared_ptr<Session> session) {
+  this->sessionsLRU.push_front(targetUserId);
+  this->sessions.insert(make_pair(
+      targetUserId, LiveSession{session, this->sessionsLRU.begin()}));
+  this->evictSessions(MAX_LIVE_SESSIONS);
+}
+
+void CryptoModule::removeSession(const std::string &targetUserId) {
+  auto it = this->sessions.find(targetUserId);
+  if (it != this->sessions.end()) {
+    this->sessionsLRU.erase(it->second.lruPosition);
+    this->sessions.erase(it);
+  }
+  this->pickledSessions.erase(targetUserId);
+}
+
+void CryptoModule::evictSessions(size_t maxLiveSessions) {
+  if (this->pickleKey.empty() || this->sessions.size() <= maxLiveSessions) {
+    return;
+  }
+  // The most recently used session is never evicted, so that the one just
+  // loaded stays valid
+  auto position = std::prev(this->sessionsLRU.end());
+  while (this->sessions.size() > maxLiveSessions &&
+         position != this->sessionsLRU.begin()) {
+    auto current = position--;
+    auto it = this->sessions.find(*current);
+    // A session held outside of the module may still be used through it.
+    // Sessions are only handed out under the mutex, so one that nothing else
+    // holds now can't be in use.
+    if (it->second.session.use_count() > 1) {
+      continue;
+    }
+    this->pickledSessions.insert(make_pair(
+        *current, it->second.session->storeAsB64(this->pickleKey)));
+    this->sessions.erase(it);
+    this->sessionsLRU.erase(current);
+  }
+}
+
+void CryptoModule::releaseSessions() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->evictSessions(0);
+}
+
 void CryptoModule::createAccount() {
   this->accountBuffer.resize(::olm_account_size());
   this->account = ::olm_account(this->accountBuffer.data());
 
   size_t randomSize = ::olm_create_account_random_length(this->account);
   OlmBuffer randomBuffer;
-  PlatformSpecificTools::generateSecureRandomBytes(randomBuffer, randomSize);
+  SecureRandomPool::generate(randomBuffer, randomSize);
 
-  if (-1 ==
-      ::olm_create_account(this->account, randomBuffer.data(), randomSize)) {
+  const size_t result =
+      ::olm_create_account(this->account, randomBuffer.data(), randomSize);
+  SecureRandomPool::wipe(randomBuffer.data(), randomBuffer.size());
+  if (-1 == result) {
     throw std::runtime_error{"error createAccount => ::olm_create_account"};
   };
 }
@@ -61,11 +212,12 @@ void CryptoModule::generateOneTimeKeys(size_t oneTimeKeysAmount) {
     return;
   }
   OlmBuffer random;
-  PlatformSpecificTools::generateSecureRandomBytes(random, oneTimeKeysSize);
+  SecureRandomPool::generate(random, oneTimeKeysSize);
 
-  if (-1 ==
-      ::olm_account_generate_one_time_keys(
-          this->account, oneTimeKeysAmount, random.data(), random.size())) {
+  const size_t result = ::olm_account_generate_one_time_keys(
+      this->account, oneTimeKeysAmount, random.data(), random.size());
+  SecureRandomPool::wipe(random.data(), random.size());
+  if (-1 == result) {
     throw std::runtime_error{
         "error generateOneTimeKeys => ::olm_account_generate_one_time_keys"};
   }
@@ -95,15 +247,50 @@ Keys CryptoModule::keysFromStrings(
 }
 
 std::string CryptoModule::getIdentityKeys() {
+  std::lock_guard<std::mutex> lock(this->mutex);
   this->exposePublicIdentityKeys();
   return std::string{
       this->keys.identityKeys.begin(), this->keys.identityKeys.end()};
 }
 
+void CryptoModule::getIdentityKeyBuffers(
+    OlmBuffer &curve25519,
+    OlmBuffer &ed25519) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->exposePublicIdentityKeys();
+  // {"curve25519":"<key>","ed25519":"<key>"}
+  const std::uint8_t *curve25519Key =
+      this->keys.identityKeys.data() + ID_KEYS_PREFIX_OFFSET;
+  const std::uint8_t *ed25519Key =
+      curve25519Key + KEYSIZE + ID_KEYS_MIDDLE_OFFSET;
+  curve25519.assign(curve25519Key, curve25519Key + KEYSIZE);
+  ed25519.assign(ed25519Key, ed25519Key + KEYSIZE);
+}
+
+std::vector<OlmBuffer>
+CryptoModule::getOneTimeKeyBuffers(size_t oneTimeKeysAmount) {
+  const std::string oneTimeKeys = this->getOneTimeKeys(oneTimeKeysAmount);
+  // {"curve25519":{"<id>":"<key>","<id>":"<key>"}}
+  std::vector<OlmBuffer> keyBuffers;
+  keyBuffers.reserve(oneTimeKeysAmount);
+  for (size_t offset = ONE_TIME_KEYS_PREFIX_OFFSET;
+       offset + KEYSIZE <= oneTimeKeys.size();
+       offset += KEYSIZE + ONE_TIME_KEYS_MIDDLE_OFFSET) {
+    keyBuffers.emplace_back(
+        oneTimeKeys.begin() + offset, oneTimeKeys.begin() + offset + KEYSIZE);
+  }
+  return keyBuffers;
+}
+
 std::string CryptoModule::getOneTimeKeys(size_t oneTimeKeysAmount) {
-  this->generateOneTimeKeys(oneTimeKeysAmount);
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->accountChanged = true;
+  size_t unpublishedOneTimeKeys = this->countUnpublishedOneTimeKeys();
+  if (unpublishedOneTimeKeys < oneTimeKeysAmount) {
+    this->generateOneTimeKeys(oneTimeKeysAmount - unpublishedOneTimeKeys);
+  }
   size_t publishedOneTimeKeys = this->publishOneTimeKeys();
-  if (publishedOneTimeKeys != oneTimeKeysAmount) {
+  if (publishedOneTimeKeys < oneTimeKeysAmount) {
     throw std::runtime_error{
         "error generateKeys => invalid amount of one-time keys published. "
         "Expected " +
@@ -115,14 +302,51 @@ std::string CryptoModule::getOneTimeKeys(size_t oneTimeKeysAmount) {
       this->keys.oneTimeKeys.begin(), this->keys.oneTimeKeys.end()};
 }
 
+size_t CryptoModule::getUnpublishedOneTimeKeysCount() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->countUnpublishedOneTimeKeys();
+}
+
+size_t CryptoModule::countUnpublishedOneTimeKeys() {
+  OlmBuffer oneTimeKeys(::olm_account_one_time_keys_length(this->account));
+  if (-1 ==
+      ::olm_account_one_time_keys(
+          this->account, oneTimeKeys.data(), oneTimeKeys.size())) {
+    throw std::runtime_error{
+        "error getUnpublishedOneTimeKeysCount => ::olm_account_one_time_keys"};
+  }
+  // The keys are listed as {"curve25519":{"<key id>":"<key>",...}}, where
+  // ":" appears only between the ID and the value of a key
+  const std::string separator = "\":\"";
+  std::string json{oneTimeKeys.begin(), oneTimeKeys.end()};
+  size_t count = 0;
+  for (size_t position = json.find(separator); position != std::string::npos;
+       position = json.find(separator, position + separator.size())) {
+    ++count;
+  }
+  return count;
+}
+
+bool CryptoModule::pregenerateOneTimeKeys(size_t oneTimeKeysAmount) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  size_t unpublishedOneTimeKeys = this->countUnpublishedOneTimeKeys();
+  if (unpublishedOneTimeKeys >= oneTimeKeysAmount) {
+    return false;
+  }
+  this->generateOneTimeKeys(oneTimeKeysAmount - unpublishedOneTimeKeys);
+  this->accountChanged = true;
+  return true;
+}
+
 void CryptoModule::initializeInboundForReceivingSession(
     const std::string &targetUserId,
     const OlmBuffer &encryptedMessage,
     const OlmBuffer &idKeys,
     const bool overwrite) {
-  if (this->hasSessionFor(targetUserId)) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if (this->hasSession(targetUserId)) {
     if (overwrite) {
-      this->sessions.erase(this->sessions.find(targetUserId));
+      this->removeSession(targetUserId);
     } else {
       throw std::runtime_error{
           "error initializeInboundForReceivingSession => session already "
@@ -131,7 +355,9 @@ void CryptoModule::initializeInboundForReceivingSession(
   }
   std::unique_ptr<Session> newSession = Session::createSessionAsResponder(
       this->account, this->keys.identityKeys.data(), encryptedMessage, idKeys);
-  this->sessions.insert(make_pair(targetUserId, std::move(newSession)));
+  this->accountChanged = true;
+  this->dirtySessions.insert(targetUserId);
+  this->addSession(targetUserId, std::move(newSession));
 }
 
 void CryptoModule::initializeOutboundForSendingSession(
@@ -139,7 +365,8 @@ void CryptoModule::initializeOutboundForSendingSession(
     const OlmBuffer &idKeys,
     const OlmBuffer &oneTimeKeys,
     size_t keyIndex) {
-  if (this->hasSessionFor(targetUserId)) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if (this->hasSession(targetUserId)) {
     throw std::runtime_error{
         "error initializeOutboundForSendingSession => session already "
         "initialized"};
@@ -150,45 +377,65 @@ void CryptoModule::initializeOutboundForSendingSession(
       idKeys,
       oneTimeKeys,
       keyIndex);
-  this->sessions.insert(make_pair(targetUserId, std::move(newSession)));
+  this->dirtySessions.insert(targetUserId);
+  this->addSession(targetUserId, std::move(newSession));
 }
 
 bool CryptoModule::hasSessionFor(const std::string &targetUserId) {
-  return (this->sessions.find(targetUserId) != this->sessions.end());
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->hasSession(targetUserId);
 }
 
 std::shared_ptr<Session>
 CryptoModule::getSessionByUserId(const std::string &userId) {
-  return this->sessions.at(userId);
+  std::shared_ptr<Session> session = this->acquireSession(userId);
+  if (session == nullptr) {
+    throw std::out_of_range{"error getSessionByUserId => no session"};
+  }
+  return session;
 }
 
 bool CryptoModule::matchesInboundSession(
-    const std::string &targetUserId,
-    EncryptedData encryptedData,
-    const OlmBuffer &theirIdentityKey) const {
-  OlmSession *session = this->sessions.at(targetUserId)->getOlmSession();
+    Session &session,
+    const std::uint8_t *message,
+    size_t messageSize,
+    const OlmBuffer &theirIdentityKey) {
+  OlmSession *olmSession = session.getOlmSession();
   // Check that the inbound session matches the message it was created from.
-  OlmBuffer tmpEncryptedMessage(encryptedData.message);
+  // Both checks destroy the message they are given, so each gets a copy.
   if (1 !=
       ::olm_matches_inbound_session(
-          session, tmpEncryptedMessage.data(), tmpEncryptedMessage.size())) {
+          olmSession,
+          session.copyToScratchBuffer(message, messageSize),
+          messageSize)) {
     return false;
   }
 
   // Check that the inbound session matches the key this message is supposed
   // to be from.
-  tmpEncryptedMessage = OlmBuffer(encryptedData.message);
   return 1 ==
       ::olm_matches_inbound_session_from(
-             session,
+             olmSession,
              theirIdentityKey.data() + ID_KEYS_PREFIX_OFFSET,
              KEYSIZE,
-             tmpEncryptedMessage.data(),
-             tmpEncryptedMessage.size());
+             session.copyToScratchBuffer(message, messageSize),
+             messageSize);
 }
 
-Persist CryptoModule::storeAsB64(const std::string &secretKey) {
-  Persist persist;
+bool CryptoModule::matchesInboundSession(
+    const std::string &targetUserId,
+    const EncryptedData &encryptedData,
+    const OlmBuffer &theirIdentityKey) {
+  std::shared_ptr<Session> session = this->getSessionByUserId(targetUserId);
+  std::lock_guard<std::mutex> sessionLock(session->getMutex());
+  return this->matchesInboundSession(
+      *session,
+      encryptedData.message.data(),
+      encryptedData.message.size(),
+      theirIdentityKey);
+}
+
+OlmBuffer CryptoModule::pickleAccount(const std::string &secretKey) {
   size_t accountPickleLength = ::olm_pickle_account_length(this->account);
   OlmBuffer accountPickleBuffer(accountPickleLength);
   if (accountPickleLength !=
@@ -200,20 +447,109 @@ Persist CryptoModule::storeAsB64(const std::string &secretKey) {
           accountPickleLength)) {
     throw std::runtime_error{"error storeAsB64 => ::olm_pickle_account"};
   }
-  persist.account = accountPickleBuffer;
+  return accountPickleBuffer;
+}
+
+Persist CryptoModule::storeAsB64(const std::string &secretKey) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->pickleAll(secretKey);
+}
+
+Persist CryptoModule::pickleAll(const std::string &secretKey) {
+  Persist persist;
+  persist.account = this->pickleAccount(secretKey);
+
+  if (secretKey != this->pickleKey) {
+    // Sessions still pickled with the previous key have to be re-pickled.
+    // Unpickling consumes the pickle, so all of them are replaced.
+    std::vector<std::pair<const std::string, OlmBuffer> *> pickled;
+    pickled.reserve(this->pickledSessions.size());
+    for (auto &it : this->pickledSessions) {
+      pickled.push_back(&it);
+    }
+    std::vector<OlmBuffer> repickled(pickled.size());
+    forEachInParallel(pickled.size(), [&](size_t i) {
+      std::unique_ptr<Session> session = Session::restoreFromB64(
+          this->account,
+          this->keys.identityKeys.data(),
+          this->pickleKey,
+          pickled[i]->second);
+      repickled[i] = session->storeAsB64(secretKey);
+    });
+    for (size_t i = 0; i < pickled.size(); i++) {
+      pickled[i]->second = std::move(repickled[i]);
+    }
+    this->pickleKey = secretKey;
+  }
 
-  std::unordered_map<std::string, std::shared_ptr<Session>>::iterator it;
-  for (it = this->sessions.begin(); it != this->sessions.end(); ++it) {
-    OlmBuffer buffer = it->second->storeAsB64(secretKey);
-    persist.sessions.insert(make_pair(it->first, buffer));
+  std::vector<std::pair<const std::string, LiveSession> *> live;
+  live.reserve(this->sessions.size());
+  for (auto &it : this->sessions) {
+    live.push_back(&it);
+  }
+  std::vector<OlmBuffer> pickledLive(live.size());
+  forEachInParallel(live.size(), [&](size_t i) {
+    Session &session = *live[i]->second.session;
+    std::lock_guard<std::mutex> sessionLock(session.getMutex());
+    pickledLive[i] = session.storeAsB64(secretKey);
+  });
+  for (size_t i = 0; i < live.size(); i++) {
+    persist.sessions.insert(
+        make_pair(live[i]->first, std::move(pickledLive[i])));
   }
+  persist.sessions.insert(
+      this->pickledSessions.begin(), this->pickledSessions.end());
+  this->dirtySessions.clear();
+  this->accountChanged = false;
+  this->evictSessions(MAX_LIVE_SESSIONS);
+
+  return persist;
+}
 
+Persist CryptoModule::storeChangedAsB64(const std::string &secretKey) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if (secretKey != this->pickleKey) {
+    // Every pickle changes with the key
+    return this->pickleAll(secretKey);
+  }
+  Persist persist;
+  if (this->accountChanged) {
+    persist.account = this->pickleAccount(secretKey);
+  }
+  for (const std::string &targetUserId : this->dirtySessions) {
+    auto it = this->sessions.find(targetUserId);
+    if (it != this->sessions.end()) {
+      Session &session = *it->second.session;
+      std::lock_guard<std::mutex> sessionLock(session.getMutex());
+      persist.sessions.insert(
+          make_pair(targetUserId, session.storeAsB64(secretKey)));
+      continue;
+    }
+    // Evicted since it changed, or removed
+    auto pickled = this->pickledSessions.find(targetUserId);
+    if (pickled != this->pickledSessions.end()) {
+      persist.sessions.insert(*pickled);
+    }
+  }
+  this->dirtySessions.clear();
+  this->accountChanged = false;
   return persist;
 }
 
+void CryptoModule::markUnstored(const Persist &persist) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if (!persist.account.empty()) {
+    this->accountChanged = true;
+  }
+  for (const auto &it : persist.sessions) {
+    this->dirtySessions.insert(it.first);
+  }
+}
+
 void CryptoModule::restoreFromB64(
     const std::string &secretKey,
     Persist persist) {
+  std::lock_guard<std::mutex> lock(this->mutex);
   this->accountBuffer.resize(::olm_account_size());
   this->account = ::olm_account(this->accountBuffer.data());
   if (-1 ==
@@ -230,76 +566,264 @@ void CryptoModule::restoreFromB64(
         "error restoreFromB64 => ::olm_pickle_account_length"};
   }
 
-  std::unordered_map<std::string, OlmBuffer>::iterator it;
-  for (it = persist.sessions.begin(); it != persist.sessions.end(); ++it) {
-    std::unique_ptr<Session> session = session->restoreFromB64(
-        this->account, this->keys.identityKeys.data(), secretKey, it->second);
-    this->sessions.insert(make_pair(it->first, move(session)));
+  this->sessions.clear();
+  this->sessionsLRU.clear();
+  this->pickledSessions = std::move(persist.sessions);
+  this->pickleKey = secretKey;
+  this->dirtySessions.clear();
+  this->accountChanged = false;
+}
+
+void CryptoModule::encryptWithSession(
+    OlmSession *session,
+    const std::uint8_t *content,
+    size_t contentSize,
+    std::uint8_t *random,
+    size_t randomLength,
+    EncryptedData &encryptedData) {
+  encryptedData.message.resize(
+      ::olm_encrypt_message_length(session, contentSize));
+  encryptedData.messageType = ::olm_encrypt_message_type(session);
+  const size_t result = ::olm_encrypt(
+      session,
+      content,
+      contentSize,
+      random,
+      randomLength,
+      encryptedData.message.data(),
+      encryptedData.message.size());
+  // The random buffer of the session is reused for its next message
+  SecureRandomPool::wipe(random, randomLength);
+  if (-1 == result) {
+    throw std::runtime_error{"error encrypt => ::olm_encrypt"};
+  }
+}
+
+void CryptoModule::encrypt(
+    const std::string &targetUserId,
+    const std::uint8_t *content,
+    size_t contentSize,
+    EncryptedData &encryptedData) {
+  std::shared_ptr<Session> targetSession = this->acquireSession(targetUserId);
+  if (targetSession == nullptr) {
+    throw std::runtime_error{"error encrypt => uninitialized session"};
   }
+  {
+    std::lock_guard<std::mutex> sessionLock(targetSession->getMutex());
+    OlmSession *session = targetSession->getOlmSession();
+    OlmBuffer &messageRandom = targetSession->getRandomBuffer();
+    SecureRandomPool::generate(
+        messageRandom, ::olm_encrypt_random_length(session));
+    CryptoModule::encryptWithSession(
+        session,
+        content,
+        contentSize,
+        messageRandom.data(),
+        messageRandom.size(),
+        encryptedData);
+  }
+  this->markSessionChanged(targetUserId);
 }
 
 EncryptedData CryptoModule::encrypt(
     const std::string &targetUserId,
     const std::string &content) {
-  if (!this->hasSessionFor(targetUserId)) {
-    throw std::runtime_error{"error encrypt => uninitialized session"};
+  EncryptedData encryptedData;
+  this->encrypt(
+      targetUserId,
+      reinterpret_cast<const std::uint8_t *>(content.data()),
+      content.size(),
+      encryptedData);
+  return encryptedData;
+}
+
+std::vector<EncryptedData> CryptoModule::encrypt(
+    const std::vector<std::string> &targetUserIds,
+    const std::string &content) {
+  // Every session is checked before any of them is ratcheted
+  std::vector<std::shared_ptr<Session>> targetSessions;
+  targetSessions.reserve(targetUserIds.size());
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (const std::string &targetUserId : targetUserIds) {
+      if (!this->hasSession(targetUserId)) {
+        throw std::runtime_error{"error encrypt => uninitialized session"};
+      }
+    }
+    for (const std::string &targetUserId : targetUserIds) {
+      targetSessions.push_back(this->loadSession(targetUserId));
+    }
+  }
+  // The random length of a session depends on its state, so all of them
+  // are held until they are encrypted with. They are locked in the order of
+  // their addresses, so that two such calls can't wait on each other.
+  std::vector<Session *> lockOrder;
+  for (const std::shared_ptr<Session> &targetSession : targetSessions) {
+    lockOrder.push_back(targetSession.get());
+  }
+  std::sort(lockOrder.begin(), lockOrder.end());
+  lockOrder.erase(
+      std::unique(lockOrder.begin(), lockOrder.end()), lockOrder.end());
+  std::vector<std::unique_lock<std::mutex>> sessionLocks;
+  sessionLocks.reserve(lockOrder.size());
+  for (Session *session : lockOrder) {
+    sessionLocks.emplace_back(session->getMutex());
+  }
+
+  size_t randomLength = 0;
+  for (const std::shared_ptr<Session> &targetSession : targetSessions) {
+    randomLength +=
+        ::olm_encrypt_random_length(targetSession->getOlmSession());
   }
-  OlmSession *session = this->sessions.at(targetUserId)->getOlmSession();
-  OlmBuffer encryptedMessage(
-      ::olm_encrypt_message_length(session, content.size()));
   OlmBuffer messageRandom;
-  PlatformSpecificTools::generateSecureRandomBytes(
-      messageRandom, ::olm_encrypt_random_length(session));
-  size_t messageType = ::olm_encrypt_message_type(session);
-  if (-1 ==
-      ::olm_encrypt(
+  SecureRandomPool::generate(messageRandom, randomLength);
+
+  std::vector<EncryptedData> encryptedMessages(targetUserIds.size());
+  std::uint8_t *random = messageRandom.data();
+  size_t encryptedCount = 0;
+  // The sessions ratcheted before a failure still have to be stored
+  auto markEncrypted = [&]() {
+    sessionLocks.clear();
+    for (size_t i = 0; i < encryptedCount; ++i) {
+      this->markSessionChanged(targetUserIds[i]);
+    }
+  };
+  try {
+    for (; encryptedCount < targetUserIds.size(); ++encryptedCount) {
+      OlmSession *session = targetSessions[encryptedCount]->getOlmSession();
+      size_t sessionRandomLength = ::olm_encrypt_random_length(session);
+      CryptoModule::encryptWithSession(
           session,
-          (uint8_t *)content.data(),
+          reinterpret_cast<const std::uint8_t *>(content.data()),
           content.size(),
-          messageRandom.data(),
-          messageRandom.size(),
-          encryptedMessage.data(),
-          encryptedMessage.size())) {
-    throw std::runtime_error{"error encrypt => ::olm_encrypt"};
+          random,
+          sessionRandomLength,
+          encryptedMessages[encryptedCount]);
+      random += sessionRandomLength;
+    }
+  } catch (...) {
+    markEncrypted();
+    throw;
   }
-  return {encryptedMessage, messageType};
+  markEncrypted();
+  return encryptedMessages;
 }
 
-std::string CryptoModule::decrypt(
-    const std::string &targetUserId,
-    EncryptedData encryptedData,
-    const OlmBuffer &theirIdentityKey) {
-  if (!this->hasSessionFor(targetUserId)) {
-    throw std::runtime_error{"error decrypt => uninitialized session"};
-  }
-  OlmSession *session = this->sessions.at(targetUserId)->getOlmSession();
-
-  OlmBuffer tmpEncryptedMessage(encryptedData.message);
+void CryptoModule::decryptWithSession(
+    Session &session,
+    size_t messageType,
+    std::uint8_t *message,
+    size_t messageSize,
+    const OlmBuffer &theirIdentityKey,
+    std::string &decrypted) {
+  OlmSession *olmSession = session.getOlmSession();
 
-  if (encryptedData.messageType == (size_t)olm::MessageType::PRE_KEY) {
+  if (messageType == (size_t)olm::MessageType::PRE_KEY) {
     if (!this->matchesInboundSession(
-            targetUserId, encryptedData, theirIdentityKey)) {
+            session, message, messageSize, theirIdentityKey)) {
       throw std::runtime_error{"error decrypt => matchesInboundSession"};
     }
   }
 
   size_t maxSize = ::olm_decrypt_max_plaintext_length(
-      session,
-      encryptedData.messageType,
-      tmpEncryptedMessage.data(),
-      tmpEncryptedMessage.size());
-  OlmBuffer decryptedMessage(maxSize);
+      olmSession,
+      messageType,
+      session.copyToScratchBuffer(message, messageSize),
+      messageSize);
+  if (maxSize == -1) {
+    throw std::runtime_error{"error ::olm_decrypt_max_plaintext_length"};
+  }
+  decrypted.resize(maxSize);
   size_t decryptedSize = ::olm_decrypt(
-      session,
-      encryptedData.messageType,
-      encryptedData.message.data(),
-      encryptedData.message.size(),
-      decryptedMessage.data(),
-      decryptedMessage.size());
+      olmSession,
+      messageType,
+      message,
+      messageSize,
+      reinterpret_cast<std::uint8_t *>(&decrypted[0]),
+      maxSize);
   if (decryptedSize == -1) {
     throw std::runtime_error{"error ::olm_decrypt"};
   }
-  return std::string{(char *)decryptedMessage.data(), decryptedSize};
+  decrypted.resize(decryptedSize);
+}
+
+void CryptoModule::decrypt(
+    const std::string &targetUserId,
+    size_t messageType,
+    std::uint8_t *message,
+    size_t messageSize,
+    const OlmBuffer &theirIdentityKey,
+    std::string &decrypted) {
+  std::shared_ptr<Session> targetSession = this->acquireSession(targetUserId);
+  if (targetSession == nullptr) {
+    throw std::runtime_error{"error decrypt => uninitialized session"};
+  }
+  {
+    std::lock_guard<std::mutex> sessionLock(targetSession->getMutex());
+    this->decryptWithSession(
+        *targetSession,
+        messageType,
+        message,
+        messageSize,
+        theirIdentityKey,
+        decrypted);
+  }
+  this->markSessionChanged(targetUserId);
+}
+
+std::string CryptoModule::decrypt(
+    const std::string &targetUserId,
+    const EncryptedData &encryptedData,
+    const OlmBuffer &theirIdentityKey) {
+  std::shared_ptr<Session> targetSession = this->acquireSession(targetUserId);
+  if (targetSession == nullptr) {
+    throw std::runtime_error{"error decrypt => uninitialized session"};
+  }
+  std::string decrypted;
+  {
+    std::lock_guard<std::mutex> sessionLock(targetSession->getMutex());
+    this->decryptWithSession(
+        *targetSession,
+        encryptedData.messageType,
+        targetSession->copyToMessageBuffer(
+            encryptedData.message.data(), encryptedData.message.size()),
+        encryptedData.message.size(),
+        theirIdentityKey,
+        decrypted);
+  }
+  this->markSessionChanged(targetUserId);
+  return decrypted;
+}
+
+std::vector<std::string> CryptoModule::decrypt(
+    const std::string &targetUserId,
+    std::vector<EncryptedData> &encryptedMessages,
+    const OlmBuffer &theirIdentityKey) {
+  std::shared_ptr<Session> targetSession = this->acquireSession(targetUserId);
+  if (targetSession == nullptr) {
+    throw std::runtime_error{"error decrypt => uninitialized session"};
+  }
+  std::vector<std::string> decryptedMessages(encryptedMessages.size());
+  std::unique_lock<std::mutex> sessionLock(targetSession->getMutex());
+  try {
+    for (size_t i = 0; i < encryptedMessages.size(); ++i) {
+      this->decryptWithSession(
+          *targetSession,
+          encryptedMessages[i].messageType,
+          encryptedMessages[i].message.data(),
+          encryptedMessages[i].message.size(),
+          theirIdentityKey,
+          decryptedMessages[i]);
+    }
+  } catch (...) {
+    // The messages decrypted before the failure ratcheted the session
+    sessionLock.unlock();
+    this->markSessionChanged(targetUserId);
+    throw;
+  }
+  sessionLock.unlock();
+  this->markSessionChanged(targetUserId);
+  return decryptedMessages;
 }
 
 } // namespace crypto
@@ -1,8 +1,12 @@
 #pragma once
 
+#include <list>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "olm/olm.h"
 
@@ -15,16 +19,76 @@ namespace crypto {
 
 class CryptoModule {
 
+  // Guards the account and the session maps. The olm work on a session
+  // runs under the mutex of the session only, so that sessions of different
+  // targets can be used from different threads at once. When both are held,
+  // this one is taken first. The private functions below expect it to be
+  // held by the caller, apart from acquireSession and markSessionChanged.
+  std::mutex mutex;
+
   OlmAccount *account = nullptr;
   OlmBuffer accountBuffer;
 
-  std::unordered_map<std::string, std::shared_ptr<Session>> sessions = {};
+  struct LiveSession {
+    std::shared_ptr<Session> session;
+    std::list<std::string>::iterator lruPosition;
+  };
+
+  // Sessions are unpickled when they are first used after the account is
+  // restored, so that ones that are never used don't cost anything. At most
+  // MAX_LIVE_SESSIONS of them are kept unpickled, and the least recently
+  // used ones are pickled again once there are more, as long as nothing else
+  // holds them and the pickle key is known.
+  std::unordered_map<std::string, LiveSession> sessions = {};
+  std::unordered_map<std::string, OlmBuffer> pickledSessions = {};
+  // Most recently used target first
+  std::list<std::string> sessionsLRU;
+  std::string pickleKey;
+  // What changed since the last storeAsB64 or storeChangedAsB64
+  std::unordered_set<std::string> dirtySessions;
+  bool accountChanged = true;
 
   Keys keys;
 
+  // Returns nullptr if there is no session for the target
+  std::shared_ptr<Session> loadSession(const std::string &targetUserId);
+  // Takes the mutex only to load the session, which the caller then uses
+  // under its own mutex
+  std::shared_ptr<Session> acquireSession(const std::string &targetUserId);
+  // Called once the work on the session is done and its mutex is released
+  void markSessionChanged(const std::string &targetUserId);
+  bool hasSession(const std::string &targetUserId);
+  void addSession(
+      const std::string &targetUserId,
+      std::shared_ptr<Session> session);
+  void removeSession(const std::string &targetUserId);
+  void evictSessions(size_t maxLiveSessions);
+  OlmBuffer pickleAccount(const std::string &secretKey);
+  Persist pickleAll(const std::string &secretKey);
+  // The three below expect the mutex of the session instead
+  static void encryptWithSession(
+      OlmSession *session,
+      const std::uint8_t *content,
+      size_t contentSize,
+      std::uint8_t *random,
+      size_t randomLength,
+      EncryptedData &encryptedData);
+  void decryptWithSession(
+      Session &session,
+      size_t messageType,
+      std::uint8_t *message,
+      size_t messageSize,
+      const OlmBuffer &theirIdentityKey,
+      std::string &decrypted);
+  bool matchesInboundSession(
+      Session &session,
+      const std::uint8_t *message,
+      size_t messageSize,
+      const OlmBuffer &theirIdentityKey);
   void createAccount();
   void exposePublicIdentityKeys();
   void generateOneTimeKeys(size_t oneTimeKeysAmount);
+  size_t countUnpublishedOneTimeKeys();
   // returns number of published keys
   size_t publishOneTimeKeys();
 
@@ -38,7 +102,19 @@ public:
       const std::string &oneTimeKeys);
 
   std::string getIdentityKeys();
+  // The keys of getIdentityKeys and getOneTimeKeys cut out of their JSON,
+  // KEYSIZE bytes of base64 each
+  void getIdentityKeyBuffers(OlmBuffer &curve25519, OlmBuffer &ed25519);
+  std::vector<OlmBuffer> getOneTimeKeyBuffers(size_t oneTimeKeysAmount = 50);
+  // Publishes one-time keys, generating only as many as are missing from
+  // the ones generated ahead of time by pregenerateOneTimeKeys
   std::string getOneTimeKeys(size_t oneTimeKeysAmount = 50);
+  size_t getUnpublishedOneTimeKeysCount();
+  // olm publishes every unpublished key at once, so this tops the keys
+  // waiting to be published up to oneTimeKeysAmount, the size of the batch
+  // getOneTimeKeys will be asked for. Returns whether any keys were
+  // generated.
+  bool pregenerateOneTimeKeys(size_t oneTimeKeysAmount = 50);
 
   void initializeInboundForReceivingSession(
       const std::string &targetUserId,
@@ -51,20 +127,56 @@ public:
       const OlmBuffer &oneTimeKeys,
       size_t keyIndex = 0);
   bool hasSessionFor(const std::string &targetUserId);
+  // Pickles again the live sessions that nothing else holds, but the most
+  // recently used one, e.g. when memory runs low
+  void releaseSessions();
   std::shared_ptr<Session> getSessionByUserId(const std::string &userId);
   bool matchesInboundSession(
       const std::string &targetUserId,
-      EncryptedData encryptedData,
-      const OlmBuffer &theirIdentityKey) const;
+      const EncryptedData &encryptedData,
+      const OlmBuffer &theirIdentityKey);
 
   Persist storeAsB64(const std::string &secretKey);
+  // Pickles only the sessions that changed since they were last stored, and
+  // the account only if it changed, leaving it empty otherwise
+  Persist storeChangedAsB64(const std::string &secretKey);
+  // Marks what a Persist holds as changed again, for when it failed to be
+  // written, so that the next storeChangedAsB64 includes it
+  void markUnstored(const Persist &persist);
   void restoreFromB64(const std::string &secretKey, Persist persist);
 
   EncryptedData
   encrypt(const std::string &targetUserId, const std::string &content);
   std::string decrypt(
       const std::string &targetUserId,
-      EncryptedData encryptedData,
+      const EncryptedData &encryptedData,
+      const OlmBuffer &theirIdentityKey);
+  // Write into buffers of the caller, reusing the memory they already hold.
+  // olm destroys the message it decrypts, so decrypt reads it in place
+  // instead of from a copy, and leaves it unusable afterwards.
+  void encrypt(
+      const std::string &targetUserId,
+      const std::uint8_t *content,
+      size_t contentSize,
+      EncryptedData &encryptedData);
+  void decrypt(
+      const std::string &targetUserId,
+      size_t messageType,
+      std::uint8_t *message,
+      size_t messageSize,
+      const OlmBuffer &theirIdentityKey,
+      std::string &decrypted);
+  // Encrypts the same content for every target, like all devices of a
+  // user, in order. Throws before encrypting anything if any target has no
+  // session.
+  std::vector<EncryptedData> encrypt(
+      const std::vector<std::string> &targetUserIds,
+      const std::string &content);
+  // Decrypts messages from one target in the order they were sent. The
+  // messages are consumed.
+  std::vector<std::string> decrypt(
+      const std::string &targetUserId,
+      std::vector<EncryptedData> &encryptedMessages,
       const OlmBuffer &theirIdentityKey);
 };
 
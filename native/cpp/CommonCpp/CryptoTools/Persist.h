@@ -8,6 +8,8 @@
 namespace comm {
 namespace crypto {
 
+// Returned by CryptoModule::storeChangedAsB64, it holds only what changed,
+// and an empty account if the account didn't
 struct Persist {
   OlmBuffer account;
   std::unordered_map<std::string, OlmBuffer> sessions;
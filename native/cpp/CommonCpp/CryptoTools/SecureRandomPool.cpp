@@ -0,0 +1,70 @@
+#include "SecureRandomPool.h"
+#include "Tools/PlatformSpecificTools.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace comm {
+namespace crypto {
+
+namespace {
+const size_t pool_size = 4096;
+// Anything larger would use up most of the pool at once
+const size_t max_pooled_request = pool_size / 4;
+// Limits how long unused random bytes stay in memory
+const auto max_pool_age = std::chrono::minutes(1);
+
+void wipeRange(OlmBuffer &buffer, size_t from, size_t to) {
+  SecureRandomPool::wipe(buffer.data() + from, to - from);
+}
+
+struct Pool {
+  OlmBuffer bytes;
+  size_t position = 0;
+  std::chrono::steady_clock::time_point filledAt;
+
+  ~Pool() {
+    wipeRange(this->bytes, this->position, this->bytes.size());
+  }
+
+  bool isStale() const {
+    return this->position == this->bytes.size() ||
+        std::chrono::steady_clock::now() - this->filledAt > max_pool_age;
+  }
+
+  void refill() {
+    wipeRange(this->bytes, this->position, this->bytes.size());
+    PlatformSpecificTools::generateSecureRandomBytes(this->bytes, pool_size);
+    this->position = 0;
+    this->filledAt = std::chrono::steady_clock::now();
+  }
+};
+
+thread_local Pool pool;
+} // namespace
+
+void SecureRandomPool::generate(OlmBuffer &buffer, size_t size) {
+  if (size > max_pooled_request) {
+    PlatformSpecificTools::generateSecureRandomBytes(buffer, size);
+    return;
+  }
+  if (pool.isStale() || pool.bytes.size() - pool.position < size) {
+    pool.refill();
+  }
+  buffer.assign(
+      pool.bytes.begin() + pool.position,
+      pool.bytes.begin() + pool.position + size);
+  wipeRange(pool.bytes, pool.position, pool.position + size);
+  pool.position += size;
+}
+
+void SecureRandomPool::wipe(std::uint8_t *bytes, size_t size) {
+  // Through a volatile pointer, so that the writes aren't optimized out
+  volatile std::uint8_t *volatileBytes = bytes;
+  for (size_t i = 0; i < size; ++i) {
+    volatileBytes[i] = 0;
+  }
+}
+
+} // namespace crypto
+} // namespace comm
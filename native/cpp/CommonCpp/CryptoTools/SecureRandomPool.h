@@ -0,0 +1,26 @@
+#pragma once
+
+#include "Tools.h"
+
+namespace comm {
+namespace crypto {
+
+/**
+ * Random bytes for olm, read from the platform CSPRNG in bulk instead of
+ * with a platform call, which crosses into Java on Android, for every
+ * operation. Every thread draws from a pool of its own, so no locking is
+ * needed. Bytes are handed out only once and are wiped from the pool as they
+ * are, and the pool is refilled from the platform source once it is used up
+ * or gets old. Requests too large for the pool go to the platform source
+ * directly.
+ */
+class SecureRandomPool {
+public:
+  static void generate(OlmBuffer &buffer, size_t size);
+  // Zeroes random bytes once olm has used them, so that they don't stay in
+  // memory, in the buffers that are reused especially
+  static void wipe(std::uint8_t *bytes, size_t size);
+};
+
+} // namespace crypto
+} // namespace comm
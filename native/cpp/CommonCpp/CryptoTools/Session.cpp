@@ -1,5 +1,5 @@
 #include "Session.h"
-#include "PlatformSpecificTools.h"
+#include "SecureRandomPool.h"
 
 #include <stdexcept>
 
@@ -18,21 +18,22 @@ std::unique_ptr<Session> Session::createSessionAsInitializer(
   session->olmSession = ::olm_session(session->olmSessionBuffer.data());
 
   OlmBuffer randomBuffer;
-  PlatformSpecificTools::generateSecureRandomBytes(
+  SecureRandomPool::generate(
       randomBuffer,
       ::olm_create_outbound_session_random_length(session->olmSession));
 
-  if (-1 ==
-      ::olm_create_outbound_session(
-          session->olmSession,
-          session->ownerUserAccount,
-          idKeys.data() + ID_KEYS_PREFIX_OFFSET,
-          KEYSIZE,
-          oneTimeKeys.data() + ONE_TIME_KEYS_PREFIX_OFFSET +
-              (KEYSIZE + ONE_TIME_KEYS_MIDDLE_OFFSET) * keyIndex,
-          KEYSIZE,
-          randomBuffer.data(),
-          randomBuffer.size())) {
+  const size_t result = ::olm_create_outbound_session(
+      session->olmSession,
+      session->ownerUserAccount,
+      idKeys.data() + ID_KEYS_PREFIX_OFFSET,
+      KEYSIZE,
+      oneTimeKeys.data() + ONE_TIME_KEYS_PREFIX_OFFSET +
+          (KEYSIZE + ONE_TIME_KEYS_MIDDLE_OFFSET) * keyIndex,
+      KEYSIZE,
+      randomBuffer.data(),
+      randomBuffer.size());
+  SecureRandomPool::wipe(randomBuffer.data(), randomBuffer.size());
+  if (-1 == result) {
     throw std::runtime_error(
         "error createOutbound => ::olm_create_outbound_session");
   }
@@ -109,5 +110,25 @@ OlmSession *Session::getOlmSession() {
   return this->olmSession;
 }
 
+std::uint8_t *
+Session::copyToScratchBuffer(const std::uint8_t *data, size_t size) {
+  this->scratchBuffer.assign(data, data + size);
+  return this->scratchBuffer.data();
+}
+
+std::uint8_t *
+Session::copyToMessageBuffer(const std::uint8_t *data, size_t size) {
+  this->messageBuffer.assign(data, data + size);
+  return this->messageBuffer.data();
+}
+
+OlmBuffer &Session::getRandomBuffer() {
+  return this->randomBuffer;
+}
+
+std::mutex &Session::getMutex() {
+  return this->mutex;
+}
+
 } // namespace crypto
 } // namespace comm
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <mutex>
 #include <string>
 
 #include "Tools.h"
@@ -14,6 +15,14 @@ class Session {
 
   OlmSession *olmSession = nullptr;
   OlmBuffer olmSessionBuffer;
+  // Reused between messages, since olm destroys the buffers it reads them
+  // from, and messages of a session tend to be about the same size
+  OlmBuffer scratchBuffer;
+  OlmBuffer messageBuffer;
+  OlmBuffer randomBuffer;
+  // Held by whoever uses the olm session or the buffers above, as sessions
+  // of different targets are used from different threads
+  std::mutex mutex;
 
   Session(OlmAccount *account, std::uint8_t *ownerIdentityKeys)
       : ownerUserAccount(account), ownerIdentityKeys(ownerIdentityKeys) {
@@ -38,6 +47,10 @@ public:
       const std::string &secretKey,
       OlmBuffer &b64);
   OlmSession *getOlmSession();
+  std::uint8_t *copyToScratchBuffer(const std::uint8_t *data, size_t size);
+  std::uint8_t *copyToMessageBuffer(const std::uint8_t *data, size_t size);
+  OlmBuffer &getRandomBuffer();
+  std::mutex &getMutex();
 };
 
 } // namespace crypto
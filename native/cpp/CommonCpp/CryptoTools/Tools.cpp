@@ -1,5 +1,5 @@
 #include "Tools.h"
-#include "PlatformSpecificTools.h"
+#include "SecureRandomPool.h"
 
 #include <string>
 
@@ -10,11 +10,12 @@ std::string
 Tools::generateRandomString(size_t size, const std::string &availableSigns) {
   std::string result;
   OlmBuffer buff;
-  PlatformSpecificTools::generateSecureRandomBytes(buff, size);
+  SecureRandomPool::generate(buff, size);
   for (size_t i = 0; i < size; ++i) {
     std::uint8_t rand = buff[i] % availableSigns.size();
     result.push_back(availableSigns[rand]);
   }
+  SecureRandomPool::wipe(buff.data(), buff.size());
   return result;
 }
 
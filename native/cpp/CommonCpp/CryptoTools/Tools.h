@@ -8,6 +8,7 @@
 
 #define KEYSIZE 43
 #define ID_KEYS_PREFIX_OFFSET 15
+#define ID_KEYS_MIDDLE_OFFSET 13
 #define ONE_TIME_KEYS_PREFIX_OFFSET 25
 #define ONE_TIME_KEYS_MIDDLE_OFFSET 12
 
@@ -0,0 +1,202 @@
+#include "CryptoModuleBenchmark.h"
+#include "CryptoModule.h"
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+namespace comm {
+namespace crypto {
+
+namespace {
+
+const std::string PICKLE_KEY = "comm-crypto-benchmark";
+
+class Timer {
+  std::ostream &output;
+
+public:
+  explicit Timer(std::ostream &output) : output(output) {
+  }
+
+  // Runs the function once and prints the time per operation
+  void measure(
+      const std::string &name,
+      size_t operations,
+      const std::function<void()> &function) {
+    const auto start = std::chrono::steady_clock::now();
+    function();
+    const double totalMs = std::chrono::duration<double, std::milli>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+    char line[128];
+    std::snprintf(
+        line,
+        sizeof(line),
+        "%-40s %8zu ops %12.3f ms %12.3f us/op",
+        name.c_str(),
+        operations,
+        totalMs,
+        operations ? totalMs * 1000 / operations : 0);
+    this->output << line << std::endl;
+  }
+};
+
+struct Peer {
+  std::unique_ptr<CryptoModule> module;
+  Keys keys;
+};
+
+Peer createPeer(const std::string &id) {
+  Peer peer;
+  peer.module = std::make_unique<CryptoModule>(id);
+  const std::string identityKeys = peer.module->getIdentityKeys();
+  const std::string oneTimeKeys = peer.module->getOneTimeKeys(1);
+  peer.keys = CryptoModule::keysFromStrings(identityKeys, oneTimeKeys);
+  return peer;
+}
+
+// The first message of the outbound session sets up the inbound one
+void connect(Peer &sender, Peer &receiver) {
+  sender.module->initializeOutboundForSendingSession(
+      receiver.module->id,
+      receiver.keys.identityKeys,
+      receiver.keys.oneTimeKeys);
+  const EncryptedData encrypted =
+      sender.module->encrypt(receiver.module->id, "hello");
+  receiver.module->initializeInboundForReceivingSession(
+      sender.module->id, encrypted.message, sender.keys.identityKeys);
+  receiver.module->decrypt(
+      sender.module->id, encrypted, sender.keys.identityKeys);
+}
+
+void benchmarkOneTimeKeys(
+    const CryptoModuleBenchmarkOptions &options,
+    Timer &timer) {
+  CryptoModule module("one-time-keys");
+  for (size_t amount : options.oneTimeKeysAmounts) {
+    timer.measure(
+        "get_one_time_keys/" + std::to_string(amount), amount, [&]() {
+          module.getOneTimeKeys(amount);
+        });
+    timer.measure(
+        "pregenerate_one_time_keys/" + std::to_string(amount),
+        amount,
+        [&]() { module.pregenerateOneTimeKeys(amount); });
+    // Publishes the pregenerated keys, so only the publishing is timed
+    timer.measure(
+        "get_pregenerated_one_time_keys/" + std::to_string(amount),
+        amount,
+        [&]() { module.getOneTimeKeys(amount); });
+  }
+}
+
+void benchmarkMessages(
+    const CryptoModuleBenchmarkOptions &options,
+    Timer &timer) {
+  Peer alice = createPeer("alice");
+  Peer bob = createPeer("bob");
+  connect(alice, bob);
+  // Bob answers once, so that alice's messages stop carrying the keys of
+  // the pre-key message
+  const EncryptedData reply = bob.module->encrypt("alice", "reply");
+  alice.module->decrypt("bob", reply, bob.keys.identityKeys);
+
+  for (size_t size : options.messageSizes) {
+    const std::string content(size, 'c');
+    std::vector<EncryptedData> encrypted(options.messages);
+    timer.measure("encrypt/" + std::to_string(size), options.messages, [&]() {
+      for (EncryptedData &message : encrypted) {
+        alice.module->encrypt(
+            "bob",
+            reinterpret_cast<const std::uint8_t *>(content.data()),
+            content.size(),
+            message);
+      }
+    });
+    std::string decrypted;
+    timer.measure("decrypt/" + std::to_string(size), options.messages, [&]() {
+      for (EncryptedData &message : encrypted) {
+        bob.module->decrypt(
+            "alice",
+            message.messageType,
+            message.message.data(),
+            message.message.size(),
+            alice.keys.identityKeys,
+            decrypted);
+      }
+    });
+    if (decrypted != content) {
+      throw std::runtime_error("decrypted message doesn't match");
+    }
+  }
+}
+
+void benchmarkSessions(
+    const CryptoModuleBenchmarkOptions &options,
+    Timer &timer) {
+  Peer alice = createPeer("alice");
+  std::vector<Peer> peers;
+  timer.measure("create_account", options.sessions, [&]() {
+    for (size_t i = 0; i < options.sessions; i++) {
+      peers.push_back(createPeer("peer-" + std::to_string(i)));
+    }
+  });
+  timer.measure(
+      "initialize_outbound_for_sending_session", options.sessions, [&]() {
+        for (Peer &peer : peers) {
+          alice.module->initializeOutboundForSendingSession(
+              peer.module->id, peer.keys.identityKeys, peer.keys.oneTimeKeys);
+        }
+      });
+  std::vector<EncryptedData> firstMessages;
+  for (Peer &peer : peers) {
+    firstMessages.push_back(alice.module->encrypt(peer.module->id, "hello"));
+  }
+  timer.measure(
+      "initialize_inbound_for_receiving_session", options.sessions, [&]() {
+        for (size_t i = 0; i < peers.size(); i++) {
+          peers[i].module->initializeInboundForReceivingSession(
+              "alice", firstMessages[i].message, alice.keys.identityKeys);
+        }
+      });
+
+  Persist persist;
+  timer.measure("store_as_b64", options.sessions, [&]() {
+    persist = alice.module->storeAsB64(PICKLE_KEY);
+  });
+  std::unique_ptr<CryptoModule> restored;
+  timer.measure("restore_from_b64", options.sessions, [&]() {
+    restored = std::make_unique<CryptoModule>("alice");
+    restored->restoreFromB64(PICKLE_KEY, persist);
+  });
+  // Sessions are unpickled when they are first used
+  timer.measure("first_use_after_restore", options.sessions, [&]() {
+    for (Peer &peer : peers) {
+      restored->getSessionByUserId(peer.module->id);
+    }
+  });
+  if (!peers.empty()) {
+    restored->encrypt(peers[0].module->id, "changed");
+  }
+  timer.measure("store_changed_as_b64/1", 1, [&]() {
+    restored->storeChangedAsB64(PICKLE_KEY);
+  });
+}
+
+} // namespace
+
+void runCryptoModuleBenchmark(
+    const CryptoModuleBenchmarkOptions &options,
+    std::ostream &output) {
+  Timer timer(output);
+  benchmarkOneTimeKeys(options, timer);
+  benchmarkMessages(options, timer);
+  benchmarkSessions(options, timer);
+}
+
+} // namespace crypto
+} // namespace comm
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+namespace comm {
+namespace crypto {
+
+struct CryptoModuleBenchmarkOptions {
+  // Number of sessions that are created, stored and restored
+  size_t sessions = 100;
+  std::vector<size_t> messageSizes = {64, 1024, 16 * 1024, 256 * 1024};
+  // Messages encrypted and decrypted for every size
+  size_t messages = 200;
+  std::vector<size_t> oneTimeKeysAmounts = {10, 50, 100};
+};
+
+// Times CryptoModule and prints one line per operation, so that runs can be
+// compared. It only needs olm and the platform random source, so the apps
+// can call it on a device as well as the desktop runner in main.cpp.
+void runCryptoModuleBenchmark(
+    const CryptoModuleBenchmarkOptions &options,
+    std::ostream &output);
+
+} // namespace crypto
+} // namespace comm
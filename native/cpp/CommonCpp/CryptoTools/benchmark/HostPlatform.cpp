@@ -0,0 +1,24 @@
+// Host version of the platform code that comm-cryptotools depends on. The
+// apps implement it in native/ios and native/android.
+#include "Tools/PlatformSpecificTools.h"
+
+#include <fstream>
+#include <stdexcept>
+
+namespace comm {
+
+void PlatformSpecificTools::generateSecureRandomBytes(
+    crypto::OlmBuffer &buffer,
+    size_t size) {
+  static thread_local std::ifstream urandom("/dev/urandom", std::ios::binary);
+  buffer.resize(size);
+  if (!urandom.read(reinterpret_cast<char *>(buffer.data()), size)) {
+    throw std::runtime_error("can not read /dev/urandom");
+  }
+}
+
+std::string PlatformSpecificTools::getDeviceOS() {
+  return "host";
+}
+
+} // namespace comm
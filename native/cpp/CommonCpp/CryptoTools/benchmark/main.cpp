@@ -0,0 +1,54 @@
+// Desktop runner of the CryptoModule benchmark
+//
+// Usage: comm-crypto-benchmark [--sessions=N] [--messages=N]
+//   [--message-sizes=N,N,...] [--one-time-keys=N,N,...]
+#include "CryptoModuleBenchmark.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+namespace {
+
+std::vector<size_t> parseList(const std::string &value) {
+  std::vector<size_t> list;
+  std::stringstream stream(value);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    list.push_back(std::strtoull(item.c_str(), nullptr, 10));
+  }
+  return list;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  comm::crypto::CryptoModuleBenchmarkOptions options;
+  for (int i = 1; i < argc; i++) {
+    const std::string argument = argv[i];
+    const size_t separator = argument.find('=');
+    const std::string name = argument.substr(0, separator);
+    const std::string value =
+        separator == std::string::npos ? "" : argument.substr(separator + 1);
+    if (name == "--sessions") {
+      options.sessions = std::strtoull(value.c_str(), nullptr, 10);
+    } else if (name == "--messages") {
+      options.messages = std::strtoull(value.c_str(), nullptr, 10);
+    } else if (name == "--message-sizes") {
+      options.messageSizes = parseList(value);
+    } else if (name == "--one-time-keys") {
+      options.oneTimeKeysAmounts = parseList(value);
+    } else {
+      std::cerr << "Unknown option " << argument << std::endl;
+      return 1;
+    }
+  }
+  try {
+    comm::crypto::runCryptoModuleBenchmark(options, std::cout);
+  } catch (const std::exception &e) {
+    std::cerr << "Benchmark failed: " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,183 @@
+#include "BackupLogRecorder.h"
+#include "Logger.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+
+namespace comm {
+
+void BackupLogRecorder::createSession() {
+  if (sqlite3session_create(this->db, "main", &this->session) != SQLITE_OK) {
+    Logger::log(
+        "Failed to create backup log session: " +
+        std::string(sqlite3_errmsg(this->db)));
+    this->session = nullptr;
+    this->dropLogs();
+    return;
+  }
+  for (const std::string &table : BACKUP_LOG_TABLES) {
+    if (sqlite3session_attach(this->session, table.c_str()) != SQLITE_OK) {
+      Logger::log("Failed to record backup log of table " + table);
+      sqlite3session_delete(this->session);
+      this->session = nullptr;
+      this->dropLogs();
+      return;
+    }
+  }
+}
+
+void BackupLogRecorder::dropLogs() {
+  if (this->pendingLog != nullptr) {
+    sqlite3changegroup_delete(this->pendingLog);
+    this->pendingLog = nullptr;
+  }
+  this->pendingLogSize = 0;
+  this->logs.clear();
+  this->logsSize = 0;
+  this->compactionRequired = true;
+}
+
+void BackupLogRecorder::cutPendingLog() {
+  if (this->pendingLog == nullptr) {
+    return;
+  }
+  int changesetSize = 0;
+  void *changeset = nullptr;
+  int result_code = sqlite3changegroup_output(
+      this->pendingLog, &changesetSize, &changeset);
+  sqlite3changegroup_delete(this->pendingLog);
+  this->pendingLog = nullptr;
+  this->pendingLogSize = 0;
+  if (result_code != SQLITE_OK) {
+    Logger::log(
+        "Failed to output backup log, error code: " +
+        std::to_string(result_code));
+    this->dropLogs();
+    return;
+  }
+  if (changesetSize == 0) {
+    // The changes cancelled each other out, e.g. a row inserted and removed
+    sqlite3_free(changeset);
+    return;
+  }
+
+  uLongf compressedSize = compressBound(changesetSize);
+  std::string compressed(compressedSize, '\0');
+  result_code = compress2(
+      reinterpret_cast<Bytef *>(&compressed[0]),
+      &compressedSize,
+      static_cast<const Bytef *>(changeset),
+      changesetSize,
+      Z_DEFAULT_COMPRESSION);
+  sqlite3_free(changeset);
+  if (result_code != Z_OK) {
+    Logger::log(
+        "Failed to compress backup log, error code: " +
+        std::to_string(result_code));
+    this->dropLogs();
+    return;
+  }
+  if (this->logsSize + compressedSize > BACKUP_LOG_MAX_PENDING_SIZE) {
+    Logger::log("Backup logs dropped, a new compaction is required");
+    this->dropLogs();
+    return;
+  }
+
+  BackupLog log;
+  for (size_t offset = 0; offset < compressedSize;
+       offset += BACKUP_LOG_CHUNK_SIZE) {
+    log.chunks.push_back(compressed.substr(
+        offset, std::min(BACKUP_LOG_CHUNK_SIZE, compressedSize - offset)));
+  }
+  this->logsSize += compressedSize;
+  this->logs.push_back(std::move(log));
+}
+
+void BackupLogRecorder::attach(sqlite3 *db) {
+  if (this->session != nullptr) {
+    // Its connection is already closed, so it can't be deleted anymore,
+    // and what it recorded is lost
+    this->session = nullptr;
+    this->dropLogs();
+  }
+  this->db = db;
+  this->createSession();
+}
+
+void BackupLogRecorder::detach() {
+  if (this->session == nullptr) {
+    return;
+  }
+  this->record();
+  sqlite3session_delete(this->session);
+  this->session = nullptr;
+  this->db = nullptr;
+}
+
+void BackupLogRecorder::setPaused(bool paused) {
+  if (this->session == nullptr) {
+    return;
+  }
+  sqlite3session_enable(this->session, paused ? 0 : 1);
+}
+
+void BackupLogRecorder::record() {
+  if (this->session == nullptr || sqlite3session_isempty(this->session) ||
+      !sqlite3_get_autocommit(this->db)) {
+    return;
+  }
+  int changesetSize = 0;
+  void *changeset = nullptr;
+  int result_code =
+      sqlite3session_changeset(this->session, &changesetSize, &changeset);
+  // A session keeps all the changes since it was created, so a new one takes
+  // over from here
+  sqlite3session_delete(this->session);
+  this->session = nullptr;
+  if (result_code == SQLITE_OK && this->pendingLog == nullptr) {
+    result_code = sqlite3changegroup_new(&this->pendingLog);
+  }
+  if (result_code == SQLITE_OK) {
+    result_code =
+        sqlite3changegroup_add(this->pendingLog, changesetSize, changeset);
+  }
+  if (result_code == SQLITE_OK) {
+    this->pendingLogSize += changesetSize;
+  }
+  sqlite3_free(changeset);
+  if (result_code != SQLITE_OK) {
+    Logger::log(
+        "Failed to record backup log, error code: " +
+        std::to_string(result_code));
+    this->dropLogs();
+  }
+  this->createSession();
+  if (this->pendingLogSize >= BACKUP_LOG_BATCH_SIZE) {
+    this->cutPendingLog();
+  }
+}
+
+BackupLogs BackupLogRecorder::takeLogs() {
+  this->record();
+  this->cutPendingLog();
+  BackupLogs backupLogs;
+  backupLogs.compactionRequired = this->compactionRequired;
+  backupLogs.logs = std::move(this->logs);
+  this->logs.clear();
+  this->logsSize = 0;
+  this->compactionRequired = false;
+  return backupLogs;
+}
+
+void BackupLogRecorder::clear() {
+  this->dropLogs();
+}
+
+void BackupLogRecorder::restartAfterCompaction() {
+  this->record();
+  this->dropLogs();
+  this->compactionRequired = false;
+}
+
+} // namespace comm
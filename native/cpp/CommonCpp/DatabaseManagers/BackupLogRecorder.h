@@ -0,0 +1,88 @@
+#pragma once
+
+#include <sqlite3.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace comm {
+
+// Tables whose changes are sent to backup. The full-text index,
+// thread_members and thread_summary are rebuilt from messages and threads by
+// their triggers, while metadata, media_cache and outbox are specific to the
+// device.
+const std::vector<std::string> BACKUP_LOG_TABLES{
+    "archived_messages",
+    "drafts",
+    "messages",
+    "media",
+    "threads"};
+// Size of the changesets merged into a log before it is cut
+const size_t BACKUP_LOG_BATCH_SIZE = 256 * 1024;
+// Size of a SendLogRequest.logData chunk, well below the gRPC message limit
+// of the backup service
+const size_t BACKUP_LOG_CHUNK_SIZE = 1024 * 1024;
+// Size of the compressed logs kept until they are taken. Past it, the logs
+// are dropped and a new compaction has to be made instead.
+const size_t BACKUP_LOG_MAX_PENDING_SIZE = 8 * 1024 * 1024;
+
+// A zlib stream of one SQLite changeset, in the order the logs were written.
+// Applying the changesets in that order on top of the compaction they follow
+// gives the database again.
+struct BackupLog {
+  std::vector<std::string> chunks;
+};
+
+struct BackupLogs {
+  // Set if logs were dropped since the last call, see
+  // BACKUP_LOG_MAX_PENDING_SIZE
+  bool compactionRequired{false};
+  std::vector<BackupLog> logs;
+};
+
+/**
+ * Produces the incremental logs of the backup with the session extension of
+ * SQLite. A session on the writer connection records the rows changed in
+ * BACKUP_LOG_TABLES. Between transactions, record() turns what the session
+ * saw into a changeset and merges it into the pending log, where changes of
+ * the same row coalesce. Once the pending log reaches BACKUP_LOG_BATCH_SIZE
+ * it is compressed and split into chunks.
+ *
+ * Everything runs on the database thread. The session has to be detached
+ * before its connection is closed.
+ */
+class BackupLogRecorder {
+  sqlite3 *db{nullptr};
+  sqlite3_session *session{nullptr};
+  sqlite3_changegroup *pendingLog{nullptr};
+  size_t pendingLogSize{0};
+  std::vector<BackupLog> logs;
+  size_t logsSize{0};
+  bool compactionRequired{false};
+
+  void createSession();
+  void cutPendingLog();
+  void dropLogs();
+
+public:
+  // Starts recording the writes of a newly opened writer connection
+  void attach(sqlite3 *db);
+  void detach();
+  // Keeps the writes of the connection out of the logs while paused, e.g.
+  // the ones of maintenance that only change how rows are stored
+  void setPaused(bool paused);
+  // Called between transactions
+  void record();
+  // Returns the logs made so far, recording and cutting the pending one
+  // first. Called between transactions.
+  BackupLogs takeLogs();
+  // Forgets every change, e.g. once the database has been deleted. The next
+  // logs then need a new compaction.
+  void clear();
+  // Forgets the changes made so far, as a compaction that holds them was
+  // just made. Called between transactions.
+  void restartAfterCompaction();
+};
+
+} // namespace comm
@@ -0,0 +1,159 @@
+#include "BackupRestore.h"
+
+#include <cstdio>
+#include <sstream>
+#include <system_error>
+
+namespace comm {
+
+namespace {
+// Output of a single inflate call, the changeset grows by it
+const size_t LOG_INFLATE_STEP_SIZE = 64 * 1024;
+
+void throw_restore_error(const std::string &message) {
+  throw std::system_error(ECANCELED, std::generic_category(), message);
+}
+
+// The logs start from the compaction and follow each other, so conflicts
+// only come from changes that are already there and are resolved in favour
+// of the log
+int resolve_log_conflict(void *, int conflict, sqlite3_changeset_iter *) {
+  if (conflict == SQLITE_CHANGESET_DATA ||
+      conflict == SQLITE_CHANGESET_CONFLICT) {
+    return SQLITE_CHANGESET_REPLACE;
+  }
+  return SQLITE_CHANGESET_OMIT;
+}
+} // namespace
+
+BackupRestore::BackupRestore(std::string path) : path(std::move(path)) {
+  this->file.open(this->path, std::ios::binary | std::ios::trunc);
+  if (!this->file.is_open()) {
+    throw_restore_error("Failed to create backup restore file");
+  }
+}
+
+BackupRestore::~BackupRestore() {
+  if (this->logStarted) {
+    inflateEnd(&this->log);
+  }
+  this->file.close();
+  // Already gone once the compaction has taken the place of the database
+  std::remove(this->path.c_str());
+}
+
+void BackupRestore::writeCompactionChunk(const std::string &chunk) {
+  if (this->compactionFinished) {
+    throw_restore_error("Backup compaction chunk received after its logs");
+  }
+  this->file.write(chunk.data(), chunk.size());
+  if (!this->file) {
+    throw_restore_error("Failed to write backup restore file");
+  }
+}
+
+void BackupRestore::finishCompaction() {
+  if (this->compactionFinished) {
+    return;
+  }
+  this->compactionFinished = true;
+  this->file.close();
+  if (this->file.fail()) {
+    throw_restore_error("Failed to write backup restore file");
+  }
+}
+
+void BackupRestore::finishLog() {
+  inflateEnd(&this->log);
+  this->logStarted = false;
+  this->changesetsSize += this->changeset.size();
+  this->changesets.push_back(std::move(this->changeset));
+  this->changeset.clear();
+}
+
+bool BackupRestore::addLogChunk(const std::string &chunk) {
+  if (!this->compactionFinished) {
+    throw_restore_error("Backup log received before its compaction");
+  }
+  size_t offset = 0;
+  while (offset < chunk.size()) {
+    if (!this->logStarted) {
+      this->log = z_stream();
+      if (inflateInit(&this->log) != Z_OK) {
+        throw_restore_error("Failed to start decompressing backup log");
+      }
+      this->logStarted = true;
+    }
+    this->log.next_in = reinterpret_cast<Bytef *>(
+        const_cast<char *>(chunk.data() + offset));
+    this->log.avail_in = chunk.size() - offset;
+    int result_code;
+    do {
+      size_t changesetSize = this->changeset.size();
+      this->changeset.resize(changesetSize + LOG_INFLATE_STEP_SIZE);
+      this->log.next_out =
+          reinterpret_cast<Bytef *>(&this->changeset[changesetSize]);
+      this->log.avail_out = LOG_INFLATE_STEP_SIZE;
+      result_code = inflate(&this->log, Z_NO_FLUSH);
+      this->changeset.resize(
+          changesetSize + LOG_INFLATE_STEP_SIZE - this->log.avail_out);
+      if (result_code != Z_OK && result_code != Z_STREAM_END &&
+          result_code != Z_BUF_ERROR) {
+        std::ostringstream error_message;
+        error_message << "Failed to decompress backup log, error code: "
+                      << result_code;
+        throw_restore_error(error_message.str());
+      }
+    } while (result_code == Z_OK &&
+             (this->log.avail_in > 0 || this->log.avail_out == 0));
+    offset = chunk.size() - this->log.avail_in;
+    if (result_code == Z_STREAM_END) {
+      // The next log may start in the same chunk
+      this->finishLog();
+    } else if (result_code == Z_BUF_ERROR && this->log.avail_in > 0) {
+      throw_restore_error("Failed to decompress backup log");
+    }
+  }
+  return this->changesetsSize >= BACKUP_RESTORE_BATCH_SIZE;
+}
+
+void BackupRestore::applyLogs(sqlite3 *db) {
+  if (this->changesets.empty()) {
+    return;
+  }
+  if (!sqlite3_get_autocommit(db)) {
+    throw_restore_error("Backup logs applied inside of a transaction");
+  }
+  sqlite3_exec(db, "BEGIN TRANSACTION;", nullptr, nullptr, nullptr);
+  for (std::string &changeset : this->changesets) {
+    int result_code = sqlite3changeset_apply(
+        db,
+        changeset.size(),
+        &changeset[0],
+        nullptr,
+        resolve_log_conflict,
+        nullptr);
+    if (result_code != SQLITE_OK) {
+      sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+      std::ostringstream error_message;
+      error_message << "Failed to apply backup log: "
+                    << sqlite3_errstr(result_code);
+      throw_restore_error(error_message.str());
+    }
+  }
+  if (sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr) != SQLITE_OK) {
+    sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+    throw_restore_error(
+        "Failed to commit backup logs: " + std::string(sqlite3_errmsg(db)));
+  }
+  this->changesets.clear();
+  this->changesetsSize = 0;
+}
+
+void BackupRestore::finishLogs() {
+  if (this->logStarted) {
+    throw_restore_error("Backup log cut off");
+  }
+}
+
+} // namespace comm
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <sqlite3.h>
+#include <zlib.h>
+
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace comm {
+
+// Size of the decompressed changesets applied together in one transaction
+const size_t BACKUP_RESTORE_BATCH_SIZE = 4 * 1024 * 1024;
+
+/**
+ * Restores the database from a backup as PullBackup streams it, so that
+ * nothing but the log being decompressed and the batch of changesets being
+ * applied is held in memory. The compaction, a copy of the database
+ * encrypted with the key of the backup (see BackupSnapshot), is written
+ * chunk by chunk to a file next to the database, which then takes the place
+ * of the database. The logs that follow are zlib streams of changesets (see
+ * BackupLogRecorder), which are decompressed as their chunks arrive and
+ * applied in batches of BACKUP_RESTORE_BATCH_SIZE.
+ *
+ * Only used on the database thread.
+ */
+class BackupRestore {
+  const std::string path;
+  std::ofstream file;
+  bool compactionFinished{false};
+  z_stream log;
+  bool logStarted{false};
+  std::string changeset;
+  std::vector<std::string> changesets;
+  size_t changesetsSize{0};
+
+  void finishLog();
+
+public:
+  explicit BackupRestore(std::string path);
+  ~BackupRestore();
+
+  void writeCompactionChunk(const std::string &chunk);
+  // Closes the file of the compaction, which can be moved from path
+  // afterwards
+  void finishCompaction();
+  // Decompresses a chunk of a log, the chunks of every log have to come in
+  // order, one log after another
+  // - returns true once a batch is ready to be applied
+  bool addLogChunk(const std::string &chunk);
+  // Applies the changesets of the logs decompressed so far in a single
+  // transaction on the writer connection, which has to be between
+  // transactions
+  void applyLogs(sqlite3 *db);
+  // Throws if the last log was cut off
+  void finishLogs();
+
+  BackupRestore(const BackupRestore &) = delete;
+  BackupRestore &operator=(const BackupRestore &) = delete;
+};
+
+} // namespace comm
@@ -0,0 +1,95 @@
+#include "BackupSnapshot.h"
+
+#include <cstdio>
+#include <sstream>
+#include <system_error>
+
+namespace comm {
+
+BackupSnapshot::BackupSnapshot(
+    sqlite3 *source,
+    sqlite3 *destination,
+    std::string path)
+    : destination(destination), backup(nullptr), path(std::move(path)) {
+  // The copy is written once and read back, it needs no journal
+  sqlite3_exec(
+      this->destination,
+      "PRAGMA journal_mode = OFF; PRAGMA synchronous = OFF;",
+      nullptr,
+      nullptr,
+      nullptr);
+  this->backup =
+      sqlite3_backup_init(this->destination, "main", source, "main");
+  if (this->backup == nullptr) {
+    std::ostringstream error_message;
+    error_message << "Failed to start backup snapshot: "
+                  << sqlite3_errmsg(this->destination);
+    sqlite3_close(this->destination);
+    std::remove(this->path.c_str());
+    throw std::system_error(
+        ECANCELED, std::generic_category(), error_message.str());
+  }
+}
+
+BackupSnapshot::~BackupSnapshot() {
+  if (this->backup != nullptr) {
+    sqlite3_backup_finish(this->backup);
+  }
+  if (this->destination != nullptr) {
+    sqlite3_close(this->destination);
+  }
+  this->file.close();
+  std::remove(this->path.c_str());
+}
+
+bool BackupSnapshot::step() {
+  if (this->backup == nullptr) {
+    throw std::system_error(
+        ECANCELED, std::generic_category(), "Backup snapshot already complete");
+  }
+  int result_code =
+      sqlite3_backup_step(this->backup, BACKUP_SNAPSHOT_STEP_PAGES);
+  if (result_code == SQLITE_OK || result_code == SQLITE_BUSY ||
+      result_code == SQLITE_LOCKED) {
+    // Locked steps are tried again by the next one
+    return false;
+  }
+  sqlite3_backup_finish(this->backup);
+  this->backup = nullptr;
+  if (result_code != SQLITE_DONE) {
+    std::ostringstream error_message;
+    error_message << "Failed to copy backup snapshot: "
+                  << sqlite3_errstr(result_code);
+    throw std::system_error(
+        ECANCELED, std::generic_category(), error_message.str());
+  }
+  sqlite3_close(this->destination);
+  this->destination = nullptr;
+  return true;
+}
+
+std::string BackupSnapshot::readChunk() {
+  if (this->backup != nullptr || this->destination != nullptr) {
+    throw std::system_error(
+        ECANCELED,
+        std::generic_category(),
+        "Backup snapshot read before it was complete");
+  }
+  if (!this->file.is_open()) {
+    this->file.open(this->path, std::ios::binary);
+    if (!this->file.is_open()) {
+      throw std::system_error(
+          ECANCELED, std::generic_category(), "Failed to open backup snapshot");
+    }
+  }
+  std::string chunk(BACKUP_COMPACTION_CHUNK_SIZE, '\0');
+  this->file.read(&chunk[0], chunk.size());
+  chunk.resize(this->file.gcount());
+  if (this->file.bad()) {
+    throw std::system_error(
+        ECANCELED, std::generic_category(), "Failed to read backup snapshot");
+  }
+  return chunk;
+}
+
+} // namespace comm
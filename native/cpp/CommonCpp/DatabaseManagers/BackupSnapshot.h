@@ -0,0 +1,50 @@
+#pragma once
+
+#include <sqlite3.h>
+
+#include <cstddef>
+#include <fstream>
+#include <string>
+
+namespace comm {
+
+// Pages copied by one step, a few milliseconds of work on a phone
+const int BACKUP_SNAPSHOT_STEP_PAGES = 256;
+// Size of a CreateNewBackupRequest.newCompactionChunk, well below the gRPC
+// message limit of the backup service
+const size_t BACKUP_COMPACTION_CHUNK_SIZE = 1024 * 1024;
+
+/**
+ * Consistent copy of the database for a backup compaction, made with the
+ * backup API of SQLite while the database stays in use. Every step copies a
+ * bounded number of pages from the writer connection. Writes made through
+ * that connection between the steps are carried over to the copy, so the
+ * snapshot is the database as of its last step. Since SQLite backs up into a
+ * database, the copy is a file next to the database, encrypted the same way,
+ * which is then read back in chunks and removed.
+ *
+ * Only used on the database thread. It has to be destroyed before the
+ * writer connection is closed.
+ */
+class BackupSnapshot {
+  sqlite3 *destination;
+  sqlite3_backup *backup;
+  const std::string path;
+  std::ifstream file;
+
+public:
+  // Takes over the destination connection, opened on path with the key of
+  // the source
+  BackupSnapshot(sqlite3 *source, sqlite3 *destination, std::string path);
+  ~BackupSnapshot();
+  // Copies up to BACKUP_SNAPSHOT_STEP_PAGES pages and returns true once the
+  // copy is complete, which must be the last step
+  bool step();
+  // Returns the next chunk of a complete copy, an empty one after the last
+  std::string readChunk();
+
+  BackupSnapshot(const BackupSnapshot &) = delete;
+  BackupSnapshot &operator=(const BackupSnapshot &) = delete;
+};
+
+} // namespace comm
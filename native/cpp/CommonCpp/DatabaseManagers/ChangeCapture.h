@@ -0,0 +1,227 @@
+#pragma once
+
+#include <sqlite3.h>
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+namespace comm {
+
+/**
+ * Records which messages and threads are changed by writes made natively,
+ * e.g. by notification handlers, so that JS can apply the changes instead of
+ * reloading its stores. The update hook of SQLite reports inserted and
+ * updated rows by rowid. It doesn't report rows deleted through REPLACE, and
+ * the rowid of a deleted row leads nowhere, so deletes are reported with
+ * their keys by temporary triggers on the writer connection instead.
+ *
+ * Changes made in a transaction are kept once it commits and dropped if it
+ * rolls back. A rollback to a savepoint leaves its changes recorded, which
+ * is harmless since only the keys are kept: the rows are looked up when the
+ * changes are taken, and a key whose row doesn't exist is reported as
+ * removed. Writes that JS makes itself run with a Suppression, as JS already
+ * has them. Past the capacity, keys are no longer recorded and the stores
+ * have to be reloaded.
+ */
+class ChangeCapture {
+public:
+  struct Changes {
+    std::unordered_set<int64_t> messageRowIDs;
+    std::unordered_set<int64_t> threadRowIDs;
+    std::unordered_set<int64_t> mediaRowIDs;
+    std::unordered_set<std::string> messageIDs;
+    std::unordered_set<std::string> threadIDs;
+    bool overflowed{false};
+
+    size_t size() const {
+      return this->messageRowIDs.size() + this->threadRowIDs.size() +
+          this->mediaRowIDs.size() + this->messageIDs.size() +
+          this->threadIDs.size();
+    }
+
+    void merge(Changes &&other) {
+      if (this->overflowed || other.overflowed) {
+        *this = Changes();
+        this->overflowed = true;
+        return;
+      }
+      this->messageRowIDs.insert(
+          other.messageRowIDs.begin(), other.messageRowIDs.end());
+      this->threadRowIDs.insert(
+          other.threadRowIDs.begin(), other.threadRowIDs.end());
+      this->mediaRowIDs.insert(
+          other.mediaRowIDs.begin(), other.mediaRowIDs.end());
+      this->messageIDs.insert(other.messageIDs.begin(), other.messageIDs.end());
+      this->threadIDs.insert(other.threadIDs.begin(), other.threadIDs.end());
+    }
+  };
+
+  // Stops the writes of the current thread from being recorded while alive
+  class Suppression {
+    const bool previous;
+
+  public:
+    Suppression() : previous(ChangeCapture::suppressed) {
+      ChangeCapture::suppressed = true;
+    }
+    ~Suppression() {
+      ChangeCapture::suppressed = this->previous;
+    }
+
+    Suppression(const Suppression &) = delete;
+    Suppression &operator=(const Suppression &) = delete;
+  };
+
+  // Whether the writes of the current thread are kept from being recorded,
+  // for executors that record their changes without a ChangeCapture
+  static bool isSuppressed() {
+    return ChangeCapture::suppressed;
+  }
+
+private:
+  std::mutex mutex;
+  // Changes of the open transaction of the writer connection
+  Changes transaction;
+  Changes committed;
+  size_t capacity;
+  static inline thread_local bool suppressed{false};
+
+  void record(const std::function<void(Changes &)> &recordChange) {
+    if (ChangeCapture::suppressed) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->transaction.overflowed || this->committed.overflowed) {
+      return;
+    }
+    if (this->transaction.size() + this->committed.size() >= this->capacity) {
+      this->transaction = Changes();
+      this->transaction.overflowed = true;
+      return;
+    }
+    recordChange(this->transaction);
+  }
+
+  static void onUpdate(
+      void *context,
+      int operation,
+      const char *database,
+      const char *table,
+      sqlite3_int64 rowID) {
+    if (operation == SQLITE_DELETE || std::strcmp(database, "main") != 0) {
+      return;
+    }
+    ChangeCapture *capture = static_cast<ChangeCapture *>(context);
+    if (std::strcmp(table, "messages") == 0) {
+      capture->record(
+          [rowID](Changes &changes) { changes.messageRowIDs.insert(rowID); });
+    } else if (std::strcmp(table, "threads") == 0) {
+      capture->record(
+          [rowID](Changes &changes) { changes.threadRowIDs.insert(rowID); });
+    } else if (std::strcmp(table, "media") == 0) {
+      capture->record(
+          [rowID](Changes &changes) { changes.mediaRowIDs.insert(rowID); });
+    }
+  }
+
+  // comm_capture_removed(table, key), called by the delete triggers. A
+  // removed media row changes its message.
+  static void
+  onRemoved(sqlite3_context *context, int argc, sqlite3_value **argv) {
+    ChangeCapture *capture =
+        static_cast<ChangeCapture *>(sqlite3_user_data(context));
+    const char *table =
+        reinterpret_cast<const char *>(sqlite3_value_text(argv[0]));
+    const char *key =
+        reinterpret_cast<const char *>(sqlite3_value_text(argv[1]));
+    sqlite3_result_null(context);
+    if (table == nullptr || key == nullptr) {
+      return;
+    }
+    std::string keyStr(key);
+    if (std::strcmp(table, "threads") == 0) {
+      capture->record([&keyStr](Changes &changes) {
+        changes.threadIDs.insert(keyStr);
+      });
+    } else {
+      capture->record([&keyStr](Changes &changes) {
+        changes.messageIDs.insert(keyStr);
+      });
+    }
+  }
+
+  static int onCommit(void *context) {
+    ChangeCapture *capture = static_cast<ChangeCapture *>(context);
+    std::lock_guard<std::mutex> lock(capture->mutex);
+    capture->committed.merge(std::move(capture->transaction));
+    capture->transaction = Changes();
+    // Lets the commit go on
+    return 0;
+  }
+
+  static void onRollback(void *context) {
+    ChangeCapture *capture = static_cast<ChangeCapture *>(context);
+    std::lock_guard<std::mutex> lock(capture->mutex);
+    capture->transaction = Changes();
+  }
+
+public:
+  explicit ChangeCapture(size_t capacity) : capacity(capacity) {
+  }
+
+  // Installs the hooks and triggers on a newly opened writer connection
+  void attach(sqlite3 *db) {
+    sqlite3_create_function(
+        db,
+        "comm_capture_removed",
+        2,
+        SQLITE_UTF8,
+        this,
+        ChangeCapture::onRemoved,
+        nullptr,
+        nullptr);
+    sqlite3_update_hook(db, ChangeCapture::onUpdate, this);
+    sqlite3_commit_hook(db, ChangeCapture::onCommit, this);
+    sqlite3_rollback_hook(db, ChangeCapture::onRollback, this);
+    sqlite3_exec(
+        db,
+        "CREATE TEMP TRIGGER IF NOT EXISTS capture_messages_delete"
+        "  AFTER DELETE ON main.messages BEGIN"
+        "	 SELECT comm_capture_removed('messages', old.id);"
+        "END;"
+
+        "CREATE TEMP TRIGGER IF NOT EXISTS capture_media_delete"
+        "  AFTER DELETE ON main.media BEGIN"
+        "	 SELECT comm_capture_removed('media', old.container);"
+        "END;"
+
+        "CREATE TEMP TRIGGER IF NOT EXISTS capture_threads_delete"
+        "  AFTER DELETE ON main.threads BEGIN"
+        "	 SELECT comm_capture_removed('threads', old.id);"
+        "END;",
+        nullptr,
+        nullptr,
+        nullptr);
+  }
+
+  // Returns the changes committed since the last call
+  Changes take() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    Changes changes = std::move(this->committed);
+    this->committed = Changes();
+    return changes;
+  }
+
+  // Forgets every change, e.g. once the database has been deleted
+  void clear() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->transaction = Changes();
+    this->committed = Changes();
+  }
+};
+
+} // namespace comm
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace comm {
+
+/**
+ * Keeps one copy of strings that repeat across many rows, like thread, user
+ * and community IDs. Interned strings are never removed, and the pointers
+ * returned for them stay valid for the lifetime of the pool, including after
+ * it is moved.
+ */
+class StringPool {
+  std::unordered_set<std::string> strings;
+  // Reused for lookups, so that finding a string already in the pool doesn't
+  // allocate
+  std::string lookup;
+
+public:
+  StringPool() = default;
+  StringPool(const StringPool &) = delete;
+  StringPool &operator=(const StringPool &) = delete;
+  StringPool(StringPool &&) = default;
+  StringPool &operator=(StringPool &&) = default;
+
+  const std::string *intern(const char *text, size_t size) {
+    this->lookup.assign(text, size);
+    auto it = this->strings.find(this->lookup);
+    if (it == this->strings.end()) {
+      it = this->strings.insert(this->lookup).first;
+    }
+    return &*it;
+  }
+
+  size_t size() const {
+    return this->strings.size();
+  }
+};
+
+// Compact counterparts of Message, Media and Thread, used for loading whole
+// tables at once. Nullable columns are held inline instead of behind
+// unique_ptr, and columns that are mostly the same for many rows point to
+// strings interned in the pool of the store that holds the rows. They are
+// only meant to be read, so they can't be written back to the database.
+struct CompactMedia {
+  std::string id;
+  std::string uri;
+  std::string type;
+  std::string extras;
+};
+
+struct CompactMessage {
+  std::string id;
+  std::optional<std::string> local_id;
+  const std::string *thread;
+  const std::string *user;
+  int type;
+  std::optional<int> future_type;
+  std::optional<std::string> content;
+  int64_t time;
+  // Media of the message are media[media_begin, media_end) of the store
+  uint32_t media_begin{0};
+  uint32_t media_end{0};
+};
+
+struct CompactThread {
+  std::string id;
+  int type;
+  std::optional<std::string> name;
+  std::optional<std::string> description;
+  std::string color;
+  int64_t creation_time;
+  // nullptr for NULL
+  const std::string *parent_thread_id;
+  const std::string *containing_thread_id;
+  const std::string *community;
+  std::string members;
+  std::string roles;
+  std::string current_user;
+  std::optional<std::string> source_message_id;
+  int replies_count;
+};
+
+// Media of all messages are kept in one vector, ordered like the messages,
+// instead of a separate vector for every message
+struct CompactMessageStore {
+  StringPool strings;
+  std::vector<CompactMessage> messages;
+  std::vector<CompactMedia> media;
+};
+
+struct CompactThreadStore {
+  StringPool strings;
+  std::vector<CompactThread> threads;
+};
+
+} // namespace comm
@@ -0,0 +1,248 @@
+#include "ContentCompressor.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <system_error>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace comm {
+
+namespace {
+
+// Length of the substrings whose frequency is counted while training
+const size_t DICTIONARY_GRAM_SIZE = 8;
+// Header holding the size of the value
+const size_t COMPRESSED_HEADER_SIZE = 4;
+
+uint64_t hashGram(const char *gram) {
+  // FNV-1a
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < DICTIONARY_GRAM_SIZE; i++) {
+    hash ^= static_cast<unsigned char>(gram[i]);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+// Streams are reused across values, as deflate allocates a few hundred KiB
+// on init. Every thread compressing or decompressing has its own.
+class DeflateStream {
+public:
+  z_stream stream{};
+  bool initialized;
+
+  DeflateStream() {
+    this->initialized =
+        deflateInit(&this->stream, Z_DEFAULT_COMPRESSION) == Z_OK;
+  }
+  ~DeflateStream() {
+    if (this->initialized) {
+      deflateEnd(&this->stream);
+    }
+  }
+};
+
+class InflateStream {
+public:
+  z_stream stream{};
+  bool initialized;
+
+  InflateStream() {
+    this->initialized = inflateInit(&this->stream) == Z_OK;
+  }
+  ~InflateStream() {
+    if (this->initialized) {
+      inflateEnd(&this->stream);
+    }
+  }
+};
+
+void throwDecompressionError(const std::string &reason) {
+  throw std::system_error(
+      ECANCELED,
+      std::generic_category(),
+      "Failed to decompress content: " + reason);
+}
+
+} // namespace
+
+ContentCompressor &ContentCompressor::instance() {
+  static ContentCompressor compressor;
+  return compressor;
+}
+
+std::string
+ContentCompressor::trainDictionary(const std::vector<std::string> &samples) {
+  // Counts in how many samples every gram appears
+  std::unordered_map<uint64_t, size_t> gramCounts;
+  for (const std::string &sample : samples) {
+    std::unordered_set<uint64_t> sampleGrams;
+    for (size_t i = 0; i + DICTIONARY_GRAM_SIZE <= sample.size(); i++) {
+      sampleGrams.insert(hashGram(sample.data() + i));
+    }
+    for (uint64_t gram : sampleGrams) {
+      gramCounts[gram]++;
+    }
+  }
+  const size_t minCount = std::max<size_t>(2, samples.size() / 100);
+
+  // Runs of common grams are the candidate segments. A segment found in
+  // many samples, or a long one, saves the most.
+  std::unordered_map<std::string, size_t> segmentCounts;
+  for (const std::string &sample : samples) {
+    size_t runStart = 0;
+    bool inRun = false;
+    for (size_t i = 0; i + DICTIONARY_GRAM_SIZE <= sample.size() + 1; i++) {
+      const bool common = i + DICTIONARY_GRAM_SIZE <= sample.size() &&
+          gramCounts[hashGram(sample.data() + i)] >= minCount;
+      if (common && !inRun) {
+        runStart = i;
+        inRun = true;
+      } else if (!common && inRun) {
+        segmentCounts[sample.substr(
+            runStart, i - 1 - runStart + DICTIONARY_GRAM_SIZE)]++;
+        inRun = false;
+      }
+    }
+  }
+  std::vector<std::pair<std::string, size_t>> segments;
+  segments.reserve(segmentCounts.size());
+  for (auto &segmentCount : segmentCounts) {
+    segments.emplace_back(
+        segmentCount.first, segmentCount.second * segmentCount.first.size());
+  }
+  std::sort(segments.begin(), segments.end(), [](const auto &a, const auto &b) {
+    return a.second > b.second || (a.second == b.second && a.first < b.first);
+  });
+
+  std::vector<const std::string *> selected;
+  std::string covered;
+  for (const auto &segment : segments) {
+    if (covered.size() + segment.first.size() > CONTENT_DICTIONARY_MAX_SIZE) {
+      continue;
+    }
+    if (covered.find(segment.first) != std::string::npos) {
+      continue;
+    }
+    covered += segment.first;
+    selected.push_back(&segment.first);
+  }
+  std::string dictionary;
+  dictionary.reserve(covered.size());
+  for (auto it = selected.rbegin(); it != selected.rend(); it++) {
+    dictionary += **it;
+  }
+  return dictionary;
+}
+
+std::shared_ptr<const ContentCompressor::Dictionary>
+ContentCompressor::getDictionary() const {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->dictionary;
+}
+
+void ContentCompressor::setDictionary(const std::string &dictionary) {
+  std::shared_ptr<const Dictionary> newDictionary;
+  if (!dictionary.empty()) {
+    newDictionary = std::make_shared<const Dictionary>(Dictionary{
+        dictionary,
+        adler32(
+            adler32(0L, Z_NULL, 0),
+            reinterpret_cast<const Bytef *>(dictionary.data()),
+            dictionary.size())});
+  }
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->dictionary = std::move(newDictionary);
+}
+
+bool ContentCompressor::isEnabled() const {
+  return this->getDictionary() != nullptr;
+}
+
+bool ContentCompressor::compress(
+    const std::string &value,
+    std::string &compressed) const {
+  if (value.size() < CONTENT_COMPRESSION_MIN_SIZE ||
+      value.size() > UINT32_MAX) {
+    return false;
+  }
+  std::shared_ptr<const Dictionary> dictionary = this->getDictionary();
+  if (dictionary == nullptr) {
+    return false;
+  }
+  static thread_local DeflateStream deflateStream;
+  if (!deflateStream.initialized) {
+    return false;
+  }
+  z_stream &stream = deflateStream.stream;
+  deflateReset(&stream);
+  deflateSetDictionary(
+      &stream,
+      reinterpret_cast<const Bytef *>(dictionary->data.data()),
+      dictionary->data.size());
+
+  // Not worth it unless the header is saved too, so deflate gives up once
+  // the stream would be larger
+  const size_t limit = value.size() - COMPRESSED_HEADER_SIZE;
+  compressed.resize(value.size());
+  for (size_t i = 0; i < COMPRESSED_HEADER_SIZE; i++) {
+    compressed[i] = static_cast<char>((value.size() >> (8 * i)) & 0xff);
+  }
+  stream.next_in =
+      reinterpret_cast<Bytef *>(const_cast<char *>(value.data()));
+  stream.avail_in = value.size();
+  stream.next_out =
+      reinterpret_cast<Bytef *>(&compressed[COMPRESSED_HEADER_SIZE]);
+  stream.avail_out = limit;
+  if (deflate(&stream, Z_FINISH) != Z_STREAM_END) {
+    return false;
+  }
+  compressed.resize(COMPRESSED_HEADER_SIZE + stream.total_out);
+  return true;
+}
+
+void ContentCompressor::decompress(
+    const void *data,
+    size_t size,
+    std::string &value) const {
+  if (size < COMPRESSED_HEADER_SIZE) {
+    throwDecompressionError("truncated header");
+  }
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  size_t valueSize = 0;
+  for (size_t i = 0; i < COMPRESSED_HEADER_SIZE; i++) {
+    valueSize |= static_cast<size_t>(bytes[i]) << (8 * i);
+  }
+  std::shared_ptr<const Dictionary> dictionary = this->getDictionary();
+  static thread_local InflateStream inflateStream;
+  if (!inflateStream.initialized) {
+    throwDecompressionError("zlib unavailable");
+  }
+  z_stream &stream = inflateStream.stream;
+  inflateReset(&stream);
+
+  value.resize(valueSize);
+  stream.next_in = const_cast<Bytef *>(bytes + COMPRESSED_HEADER_SIZE);
+  stream.avail_in = size - COMPRESSED_HEADER_SIZE;
+  stream.next_out = reinterpret_cast<Bytef *>(&value[0]);
+  stream.avail_out = valueSize;
+  int result_code = inflate(&stream, Z_FINISH);
+  if (result_code == Z_NEED_DICT) {
+    if (dictionary == nullptr || dictionary->id != stream.adler) {
+      throwDecompressionError("unknown dictionary");
+    }
+    inflateSetDictionary(
+        &stream,
+        reinterpret_cast<const Bytef *>(dictionary->data.data()),
+        dictionary->data.size());
+    result_code = inflate(&stream, Z_FINISH);
+  }
+  if (result_code != Z_STREAM_END || stream.total_out != valueSize) {
+    throwDecompressionError("corrupted value");
+  }
+}
+
+} // namespace comm
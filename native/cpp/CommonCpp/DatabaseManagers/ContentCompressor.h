@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace comm {
+
+// Metadata entry holding the dictionary, once trained
+const std::string CONTENT_DICTIONARY_METADATA_KEY =
+    "content_compression_dictionary";
+// Shorter values gain too little to be worth a BLOB and an inflate on read
+const size_t CONTENT_COMPRESSION_MIN_SIZE = 128;
+// deflate only looks back 32KiB, the rest of a larger dictionary is unused
+const size_t CONTENT_DICTIONARY_MAX_SIZE = 32 * 1024;
+// Fewer samples don't tell the common parts of the values from the rest
+const size_t CONTENT_DICTIONARY_MIN_SAMPLES = 200;
+const size_t CONTENT_DICTIONARY_MAX_SAMPLES = 4000;
+
+/**
+ * Compresses the JSON stored in messages.content by non-text messages and in
+ * media.extras. Values of the same spec repeat the same keys and most of the
+ * same structure, which compresses poorly on its own since a single value is
+ * short. deflate is given a preset dictionary trained from samples of the
+ * stored values instead, so that the common parts cost a back-reference.
+ *
+ * A compressed value is stored as a BLOB, which keeps it apart from the TEXT
+ * of values written before the dictionary existed or not worth compressing.
+ * It holds the size of the value, as 4 bytes in little-endian order, and the
+ * zlib stream, whose header names the dictionary by its Adler-32. Text
+ * messages are never compressed, as the full-text index reads their content.
+ *
+ * The dictionary is never replaced once trained, since the values compressed
+ * with it couldn't be read anymore.
+ */
+class ContentCompressor {
+  struct Dictionary {
+    std::string data;
+    unsigned long id;
+  };
+
+  mutable std::mutex mutex;
+  std::shared_ptr<const Dictionary> dictionary;
+
+  std::shared_ptr<const Dictionary> getDictionary() const;
+
+public:
+  static ContentCompressor &instance();
+
+  // Picks the parts that the samples have most in common, the most common
+  // last, where deflate reaches them with the shortest distances
+  static std::string trainDictionary(const std::vector<std::string> &samples);
+
+  // An empty dictionary turns compression off
+  void setDictionary(const std::string &dictionary);
+  bool isEnabled() const;
+  // Returns false, leaving compressed unspecified, if the value is too short
+  // or doesn't shrink
+  bool compress(const std::string &value, std::string &compressed) const;
+  // Throws if the value is corrupted or was compressed with another
+  // dictionary
+  void decompress(const void *data, size_t size, std::string &value) const;
+};
+
+} // namespace comm
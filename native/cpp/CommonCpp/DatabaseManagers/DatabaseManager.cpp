@@ -1,13 +1,43 @@
 #include "DatabaseManager.h"
+#include "InMemoryQueryExecutor.h"
 #include "SQLiteQueryExecutor.h"
 
+#include <atomic>
+
 namespace comm {
 
+namespace {
+std::atomic<DatabaseBackend> backend{DatabaseBackend::SQLite};
+} // namespace
+
+void DatabaseManager::setBackend(DatabaseBackend newBackend) {
+  backend = newBackend;
+}
+
+DatabaseBackend DatabaseManager::getBackend() {
+  return backend;
+}
+
 const DatabaseQueryExecutor &DatabaseManager::getQueryExecutor() {
-  //  TODO: conditionally create desired type of db manager
-  //  maybe basing on some preprocessor flag
+  if (backend == DatabaseBackend::InMemory) {
+    thread_local InMemoryQueryExecutor instance;
+    return instance;
+  }
   thread_local SQLiteQueryExecutor instance;
   return instance;
 }
 
+void DatabaseManager::useReadOnlyConnection() {
+  // The in-memory store has no connections
+  if (backend == DatabaseBackend::SQLite) {
+    SQLiteQueryExecutor::useReadOnlyConnection();
+  }
+}
+
+void DatabaseManager::useReadWriteConnection() {
+  if (backend == DatabaseBackend::SQLite) {
+    SQLiteQueryExecutor::useReadWriteConnection();
+  }
+}
+
 } // namespace comm
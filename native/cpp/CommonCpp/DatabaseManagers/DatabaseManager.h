@@ -2,13 +2,30 @@
 
 #include "DatabaseQueryExecutor.h"
 // TODO: includes may be conditional if we base on the preprocessor
+#include "InMemoryQueryExecutor.h"
 #include "SQLiteQueryExecutor.h"
 
 namespace comm {
 
+enum class DatabaseBackend {
+  SQLite,
+  // Nothing outlives the process, see InMemoryQueryExecutor
+  InMemory,
+};
+
 class DatabaseManager {
 public:
+  // Has to be called before the first getQueryExecutor, on any thread, since
+  // every thread keeps the executor it got first
+  static void setBackend(DatabaseBackend backend);
+  static DatabaseBackend getBackend();
   static const DatabaseQueryExecutor &getQueryExecutor();
+  // Makes the query executor of the calling thread use a read-only
+  // connection, separate from the one used for writes
+  static void useReadOnlyConnection();
+  // Makes the query executor of the calling thread go back to the
+  // connection used for writes
+  static void useReadWriteConnection();
 };
 
 } // namespace comm
@@ -1,22 +1,85 @@
 #pragma once
 
 #include "../CryptoTools/Persist.h"
+#include "BackupLogRecorder.h"
+#include "CompactStore.h"
 #include "entities/Draft.h"
 #include "entities/Media.h"
+#include "entities/MediaCacheEntry.h"
 #include "entities/Message.h"
 #include "entities/OlmPersistAccount.h"
 #include "entities/OlmPersistSession.h"
+#include "entities/OutboxEntry.h"
 #include "entities/Thread.h"
+#include "entities/ThreadMember.h"
+#include "entities/ThreadSummary.h"
 
 #include <folly/Optional.h>
 
 #include <jsi/jsi.h>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace comm {
 
 namespace jsi = facebook::jsi;
 
+// Cost of opening the database at startup. durationUs covers everything up
+// to the database being ready, while migrationsDurationUs covers only
+// setting up or migrating the schema. encryptionDurationUs and encryptedRows
+// are set when a plaintext database was encrypted during the startup.
+struct DatabaseStartupMetrics {
+  int64_t durationUs;
+  int64_t migrationsDurationUs;
+  int databaseVersion;
+  int appliedMigrations;
+  bool upToDate;
+  int64_t encryptionDurationUs;
+  int64_t encryptedRows;
+};
+
+// The plan SQLite chooses for a statement, one detail line of EXPLAIN QUERY
+// PLAN per step, e.g. "SEARCH media USING INDEX media_idx_container
+// (container=?)". error is set if the statement can't be prepared anymore.
+struct QueryPlan {
+  std::string query;
+  std::vector<std::string> steps;
+  std::string error;
+};
+
+// Memory used by SQLite as a whole, from sqlite3_status64, and by the
+// connection of the calling thread, from sqlite3_db_status, in bytes
+struct DatabaseMemoryStats {
+  int64_t memoryUsed;
+  int64_t memoryHighwater;
+  int64_t largestAllocation;
+  // Page cache allocations that didn't fit the preallocated page cache
+  int64_t pageCacheOverflow;
+  int64_t connectionCacheUsed;
+  int64_t connectionSchemaUsed;
+  int64_t connectionStatementsUsed;
+  size_t cachedStatements;
+  size_t messageCacheSize;
+};
+
+// Changes written natively since the last getDatabaseChanges call, see
+// ChangeCapture. reloadRequired means that more changed than was tracked.
+struct DatabaseChanges {
+  bool reloadRequired{false};
+  std::vector<std::pair<Message, std::vector<Media>>> messages;
+  std::vector<std::string> removedMessageIDs;
+  std::vector<Thread> threads;
+  std::vector<std::string> removedThreadIDs;
+};
+
+// What evictMediaCache deleted. A file that couldn't be deleted keeps its
+// entry and isn't counted.
+struct MediaCacheEviction {
+  int evictedCount{0};
+  int64_t evictedBytes{0};
+};
+
 /**
  * if any initialization/cleaning up steps are required for specific
  * database managers they should appear in constructors/destructors
@@ -37,11 +100,70 @@ public:
   virtual void removeAllMessages() const = 0;
   virtual std::vector<std::pair<Message, std::vector<Media>>>
   getAllMessages() const = 0;
+  // Same as getAllMessages but in the compact layout, for loading the whole
+  // store at once
+  virtual CompactMessageStore getAllMessagesCompact() const = 0;
+  virtual std::vector<std::pair<Message, std::vector<Media>>>
+  getThreadMessagesBefore(
+      std::string threadID,
+      int64_t beforeTime,
+      std::string beforeMessageID,
+      int pageSize) const = 0;
+  // Reads the page that getThreadMessagesBefore would return into the cache
+  // of message pages ahead of a request for it, unless it's cached already,
+  // and moves the key to the one that the next page is read before. Returns
+  // false if there's no next page, or nothing was read because the cache
+  // takes up maxCacheSize bytes or more.
+  virtual bool prefetchThreadMessagesBefore(
+      const std::string &threadID,
+      int64_t &beforeTime,
+      std::string &beforeMessageID,
+      int pageSize,
+      size_t maxCacheSize) const = 0;
+  // Messages of the given threads, newest first
+  virtual std::vector<std::pair<Message, std::vector<Media>>>
+  getMessagesOfThreads(const std::vector<std::string> &threadIDs) const = 0;
+  // Messages whose thread has no row in threads, newest first
+  virtual std::vector<std::pair<Message, std::vector<Media>>>
+  getMessagesWithoutThread() const = 0;
+  // Messages of a thread sent in [fromTime, toTime), newest first. At most
+  // limit of them, unless limit is negative.
+  virtual std::vector<std::pair<Message, std::vector<Media>>>
+  getThreadMessagesInRange(
+      const std::string &threadID,
+      int64_t fromTime,
+      int64_t toTime,
+      int limit) const = 0;
+  // Messages that exist among the given IDs, in no particular order
+  virtual std::vector<std::pair<Message, std::vector<Media>>>
+  getMessagesByIDs(const std::vector<std::string> &ids) const = 0;
+  // Number of messages of every given thread, counted by thread_summary
+  virtual std::vector<int>
+  getThreadMessageCounts(const std::vector<std::string> &threadIDs) const = 0;
+  // Ranked full-text search over text messages, optionally within a thread
+  virtual std::vector<std::pair<Message, std::vector<Media>>> searchMessages(
+      std::string query,
+      folly::Optional<std::string> threadID,
+      int pageSize,
+      int offset) const = 0;
+  // Removing a message also removes its media, replacing it removes the
+  // media that it had
   virtual void removeMessages(const std::vector<std::string> &ids) const = 0;
   virtual void
   removeMessagesForThreads(const std::vector<std::string> &threadIDs) const = 0;
+  // Moves the messages older than the time to the archive, where startup
+  // reads and search leave them out. They are still read by ID and by
+  // thread, and writing one again brings it back. Returns how many moved.
+  virtual int archiveMessages(int64_t olderThan) const = 0;
   virtual void replaceMessage(const Message &message) const = 0;
+  virtual void replaceMessages(const std::vector<Message> &messages) const = 0;
   virtual void rekeyMessage(std::string from, std::string to) const = 0;
+  // Pairs of an old message ID and a new one, applied in the given order in
+  // one transaction, so that a chain of rekeys ends the same way as the
+  // single calls would
+  virtual void rekeyMessagesBatch(
+      const std::vector<std::pair<std::string, std::string>> &ids)
+      const = 0;
   virtual void removeAllMedia() const = 0;
   virtual void
   removeMediaForMessages(const std::vector<std::string> &msg_ids) const = 0;
@@ -49,14 +171,90 @@ public:
   virtual void
   removeMediaForThreads(const std::vector<std::string> &thread_ids) const = 0;
   virtual void replaceMedia(const Media &media) const = 0;
+  virtual void replaceMediaBatch(const std::vector<Media> &media) const = 0;
   virtual void rekeyMediaContainers(std::string from, std::string to) const = 0;
+  virtual void rekeyMediaContainersBatch(
+      const std::vector<std::pair<std::string, std::string>> &containers)
+      const = 0;
+  // Records the local file of a media, in place of the one it had
+  virtual void recordMediaCacheEntry(const MediaCacheEntry &entry) const = 0;
+  virtual void touchMediaCacheEntries(
+      const std::vector<std::string> &mediaIDs,
+      int64_t accessedAt) const = 0;
+  // Total size of the cached files
+  virtual int64_t getMediaCacheSize() const = 0;
+  // Deletes the cached files of removed media, then the least recently
+  // accessed ones until the cache fits the budget, in batches
+  virtual MediaCacheEviction evictMediaCache(int64_t budget) const = 0;
+  // Queues messages to be sent, in place of the entries they had
+  virtual void addToOutbox(const std::vector<OutboxEntry> &entries) const = 0;
+  // Marks the oldest entries that aren't in flight as in flight and returns
+  // them, in the order they were queued
+  virtual std::vector<OutboxEntry> takeOutboxBatch(int limit) const = 0;
+  // Stores the payloads of entries encrypted for sending, so that sending
+  // them again reuses them
+  virtual void
+  updateOutboxPayloads(const std::vector<OutboxEntry> &entries) const = 0;
+  // Puts entries in flight back in the queue, e.g. once their send failed.
+  // Without IDs, every entry in flight is.
+  virtual void
+  requeueOutboxEntries(const std::vector<std::string> &localIDs) const = 0;
+  // Removes the acknowledged entries and moves their messages and media to
+  // the IDs assigned by the server, all in one transaction
+  virtual void acknowledgeOutboxEntries(
+      const std::vector<std::pair<std::string, std::string>> &serverIDs)
+      const = 0;
   virtual std::vector<Thread> getAllThreads() const = 0;
+  // Same as getAllThreads but ordered by the time of the latest message, or
+  // thread creation if there is none, most recently active first
+  virtual std::vector<Thread> getAllThreadsByActivity() const = 0;
+  // Same as getAllThreads but leaves members and roles empty, since those
+  // JSON columns dominate load time of large communities
+  virtual std::vector<Thread> getAllThreadSummaries() const = 0;
+  // Same as getAllThreads, or getAllThreadSummaries if includeMembership is
+  // false, but in the compact layout
+  virtual CompactThreadStore
+  getAllThreadsCompact(bool includeMembership) const = 0;
+  virtual std::vector<Thread>
+  getThreadsByIDs(const std::vector<std::string> &ids) const = 0;
   virtual void removeThreads(std::vector<std::string> ids) const = 0;
   virtual void replaceThread(const Thread &thread) const = 0;
+  // Skips the write if the thread is the same as when this was last called
+  // for it, returning false. Compared by a hash of the row, see
+  // getThreadHashes.
+  virtual bool replaceThreadIfChanged(const Thread &thread) const = 0;
+  // Hashes of the threads written by replaceThreadIfChanged and unchanged
+  // since, by thread ID. A thread without a hash is written in full.
+  virtual std::vector<std::pair<std::string, int64_t>>
+  getThreadHashes() const = 0;
+  virtual void replaceThreads(const std::vector<Thread> &threads) const = 0;
   virtual void removeAllThreads() const = 0;
+  // Read from thread_members, which mirrors the members JSON of threads
+  virtual std::vector<ThreadMember>
+  getThreadMembers(std::string threadID) const = 0;
+  virtual std::vector<std::string>
+  getThreadIDsForMember(std::string userID) const = 0;
+  // Member counts in the order of threadIDs, 0 for an unknown thread
+  virtual std::vector<int>
+  getThreadMemberCounts(const std::vector<std::string> &threadIDs) const = 0;
+  // Read from thread_summary, the threads with the latest message first.
+  // Threads without messages have no summary.
+  virtual std::vector<ThreadSummary> getThreadSummariesByRecency() const = 0;
+  // Sets a single field of a JSON column (members, roles or current_user) in
+  // place for every given thread. value has to be JSON-encoded.
+  virtual void updateThreadsJSONField(
+      const std::vector<std::string> &threadIDs,
+      const std::string &column,
+      const std::string &field,
+      const std::string &value) const = 0;
   virtual void beginTransaction() const = 0;
   virtual void commitTransaction() const = 0;
   virtual void rollbackTransaction() const = 0;
+  // Savepoints nest inside a transaction, so the writes made since one was
+  // created can be undone without rolling back the whole transaction
+  virtual void createSavepoint(const std::string &name) const = 0;
+  virtual void releaseSavepoint(const std::string &name) const = 0;
+  virtual void rollbackToSavepoint(const std::string &name) const = 0;
   virtual std::vector<OlmPersistSession> getOlmPersistSessionsData() const = 0;
   virtual folly::Optional<std::string> getOlmPersistAccountData() const = 0;
   virtual void storeOlmPersistData(crypto::Persist persist) const = 0;
@@ -66,6 +264,57 @@ public:
   virtual std::string getCurrentUserID() const = 0;
   virtual void setDeviceID(std::string deviceID) const = 0;
   virtual std::string getDeviceID() const = 0;
+  // Compresses stored content, checkpoints WAL, reclaims free pages in
+  // small steps, merges the full-text index and refreshes query planner
+  // statistics, stopping once the time budget is used up. Returns false if
+  // some of the work is left for the next run.
+  virtual bool runMaintenance(int64_t timeBudgetMs) const = 0;
+  // Rebuilds the whole database file, which takes as long as reading and
+  // writing all of it, so it is only run when asked for
+  virtual void vacuumDatabase() const = 0;
+  virtual DatabaseStartupMetrics getStartupMetrics() const = 0;
+  // Opens the connection of the calling thread and reads the index pages
+  // that the first queries of the app go through, so that they are cached
+  virtual void warmUp() const = 0;
+  // Frees what the connection of the calling thread keeps cached and can
+  // rebuild: its page cache and raw statements, and messageCache on the
+  // writer connection. Called between tasks, when memory runs low.
+  virtual void releaseMemory() const = 0;
+  virtual DatabaseMemoryStats getMemoryStats() const = 0;
+  // Plans of every statement recorded by QueryProfiler, as they would run
+  // on the connection of the calling thread, so that a schema change or a
+  // sqlite_orm upgrade that stops a query from using its index shows up
+  virtual std::vector<QueryPlan> getQueryPlans() const = 0;
+  virtual DatabaseChanges getDatabaseChanges() const = 0;
+  // Both run on the database thread between transactions, see
+  // BackupLogRecorder
+  virtual void recordBackupLog() const = 0;
+  virtual BackupLogs takeBackupLogs() const = 0;
+  // Snapshot of the database for a backup compaction, see BackupSnapshot.
+  // Each call is a short task of its own on the database thread.
+  virtual void startBackupSnapshot() const = 0;
+  // Returns true once the snapshot is complete. The backup logs then start
+  // over from it.
+  virtual bool stepBackupSnapshot() const = 0;
+  // Returns the next chunk of the complete snapshot, an empty one after the
+  // last, which also removes the snapshot
+  virtual std::string readBackupSnapshotChunk() const = 0;
+  // Restore of the database from a backup as it is pulled, see
+  // BackupRestore. The compaction chunks come first, then the chunks of the
+  // logs in order. Each call is a task of its own on the database thread.
+  virtual void startBackupRestore() const = 0;
+  virtual void
+  writeBackupRestoreCompactionChunk(const std::string &chunk) const = 0;
+  // Replaces the database with the compaction, which is encrypted with the
+  // key of the backup, a hex string like the one of the database. The
+  // restored database is rekeyed with the key of this device.
+  virtual void
+  finishBackupRestoreCompaction(const std::string &encryptionKey) const = 0;
+  // Logs are applied in batches, each in a transaction of its own
+  virtual void applyBackupRestoreLogChunk(const std::string &chunk) const = 0;
+  // Applies the rest of the logs. The backup logs of this device then need
+  // a new compaction.
+  virtual void finishBackupRestore() const = 0;
 };
 
 } // namespace comm
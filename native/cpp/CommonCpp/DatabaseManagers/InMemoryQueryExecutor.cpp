@@ -0,0 +1,1797 @@
+#include "InMemoryQueryExecutor.h"
+#include "ChangeCapture.h"
+#include "Logger.h"
+#include "ThreadHash.h"
+
+#include <folly/dynamic.h>
+#include <folly/json.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <system_error>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace comm {
+
+namespace {
+
+// Same as Message, but copyable, so that the previous version of a row can
+// be kept to undo a write
+struct MessageRow {
+  std::string id;
+  std::optional<std::string> local_id;
+  std::string thread;
+  std::string user;
+  int type;
+  std::optional<int> future_type;
+  std::optional<std::string> content;
+  int64_t time;
+  // Moved to the archive by archiveMessages
+  bool archived{false};
+};
+
+// Same as Thread, see MessageRow
+struct ThreadRow {
+  std::string id;
+  int type;
+  std::optional<std::string> name;
+  std::optional<std::string> description;
+  std::string color;
+  int64_t creation_time;
+  std::optional<std::string> parent_thread_id;
+  std::optional<std::string> containing_thread_id;
+  std::optional<std::string> community;
+  std::string members;
+  std::string roles;
+  std::string current_user;
+  std::optional<std::string> source_message_id;
+  int replies_count;
+};
+
+struct MemberRow {
+  std::optional<std::string> role;
+  int is_sender;
+};
+
+struct OutboxRow {
+  OutboxEntry entry;
+  bool inFlight{false};
+};
+
+// Messages of a thread are ordered by it, the same as by
+// messages_idx_thread_time, and the outbox the same way by creation time
+using OrderKey = std::pair<int64_t, std::string>;
+
+template <typename T>
+std::unique_ptr<T> to_pointer(const std::optional<T> &value) {
+  return value ? std::make_unique<T>(*value) : nullptr;
+}
+
+template <typename T>
+std::optional<T> to_optional(const std::unique_ptr<T> &value) {
+  return value ? std::optional<T>(*value) : std::nullopt;
+}
+
+MessageRow to_row(const Message &message) {
+  return MessageRow{
+      message.id,
+      to_optional(message.local_id),
+      message.thread,
+      message.user,
+      message.type,
+      to_optional(message.future_type),
+      to_optional(message.content),
+      message.time};
+}
+
+Message to_message(const MessageRow &row) {
+  return Message{
+      row.id,
+      to_pointer(row.local_id),
+      row.thread,
+      row.user,
+      row.type,
+      to_pointer(row.future_type),
+      to_pointer(row.content),
+      row.time};
+}
+
+ThreadRow to_row(const Thread &thread) {
+  return ThreadRow{
+      thread.id,
+      thread.type,
+      to_optional(thread.name),
+      to_optional(thread.description),
+      thread.color,
+      thread.creation_time,
+      to_optional(thread.parent_thread_id),
+      to_optional(thread.containing_thread_id),
+      to_optional(thread.community),
+      thread.members,
+      thread.roles,
+      thread.current_user,
+      to_optional(thread.source_message_id),
+      thread.replies_count};
+}
+
+Thread to_thread(const ThreadRow &row, bool includeMembership) {
+  return Thread{
+      row.id,
+      row.type,
+      to_pointer(row.name),
+      to_pointer(row.description),
+      row.color,
+      row.creation_time,
+      to_pointer(row.parent_thread_id),
+      to_pointer(row.containing_thread_id),
+      to_pointer(row.community),
+      includeMembership ? row.members : "",
+      includeMembership ? row.roles : "",
+      row.current_user,
+      to_pointer(row.source_message_id),
+      row.replies_count};
+}
+
+// Text of a JSON value the way SQLite stores the result of json_extract in
+// a TEXT column
+std::optional<std::string> json_text(const folly::dynamic *value) {
+  if (value == nullptr || value->isNull()) {
+    return std::nullopt;
+  }
+  if (value->isString()) {
+    return value->getString();
+  }
+  if (value->isObject() || value->isArray()) {
+    return folly::toJson(*value);
+  }
+  return value->asString();
+}
+
+// The members JSON of a thread as thread_members rows by user ID, the same
+// as the triggers of SQLiteQueryExecutor mirror it
+std::map<std::string, MemberRow> parse_members(const std::string &members) {
+  std::map<std::string, MemberRow> rows;
+  folly::dynamic parsed;
+  try {
+    parsed = folly::parseJson(members);
+  } catch (const std::exception &) {
+    return rows;
+  }
+  if (!parsed.isArray()) {
+    return rows;
+  }
+  for (const folly::dynamic &member : parsed) {
+    if (!member.isObject()) {
+      continue;
+    }
+    std::optional<std::string> userID = json_text(member.get_ptr("id"));
+    if (!userID) {
+      continue;
+    }
+    const folly::dynamic *isSender = member.get_ptr("isSender");
+    int sender = 0;
+    if (isSender != nullptr && !isSender->isNull()) {
+      sender = isSender->isBool() ? isSender->getBool()
+                                  : static_cast<int>(isSender->asInt());
+    }
+    rows[*userID] = MemberRow{json_text(member.get_ptr("role")), sender};
+  }
+  return rows;
+}
+
+// Splits text the way the unicode61 tokenizer of messages_fts does for
+// ASCII: lowercased runs of letters and digits. Other bytes of UTF-8 are
+// kept in the tokens.
+std::vector<std::string> tokenize(const std::string &text) {
+  std::vector<std::string> tokens;
+  std::string token;
+  for (char c : text) {
+    unsigned char byte = static_cast<unsigned char>(c);
+    if (byte >= 0x80 || std::isalnum(byte)) {
+      token.push_back(static_cast<char>(std::tolower(byte)));
+    } else if (!token.empty()) {
+      tokens.push_back(std::move(token));
+      token.clear();
+    }
+  }
+  if (!token.empty()) {
+    tokens.push_back(std::move(token));
+  }
+  return tokens;
+}
+
+// Same as the FTS5 query of build_fts_query: every word of the query, the
+// last one as a prefix
+bool matches_query(
+    const std::vector<std::string> &queryTokens,
+    const std::string &content) {
+  std::vector<std::string> contentTokens = tokenize(content);
+  std::unordered_set<std::string> contentWords(
+      contentTokens.begin(), contentTokens.end());
+  for (size_t i = 0; i + 1 < queryTokens.size(); i++) {
+    if (!contentWords.count(queryTokens[i])) {
+      return false;
+    }
+  }
+  const std::string &prefix = queryTokens.back();
+  return std::any_of(
+      contentTokens.begin(),
+      contentTokens.end(),
+      [&prefix](const std::string &token) {
+        return token.compare(0, prefix.size(), prefix) == 0;
+      });
+}
+
+[[noreturn]] void throw_database_error(const std::string &message) {
+  throw std::system_error(ECANCELED, std::generic_category(), message);
+}
+
+[[noreturn]] void throw_backups_not_supported() {
+  throw std::system_error(
+      ENOTSUP,
+      std::generic_category(),
+      "Backups are not supported by the in-memory database");
+}
+
+class InMemoryStore {
+public:
+  struct Tables {
+    std::unordered_map<std::string, std::string> drafts;
+    std::unordered_map<std::string, std::string> metadata;
+    std::unordered_map<std::string, MessageRow> messages;
+    // (time, id) of the messages of every thread, archived ones included
+    std::unordered_map<std::string, std::set<OrderKey>> threadMessages;
+    std::unordered_map<std::string, Media> media;
+    // IDs of the media of every message
+    std::unordered_map<std::string, std::set<std::string>> messageMedia;
+    std::unordered_map<std::string, ThreadRow> threads;
+    // Mirrored from the members JSON of threads, like thread_members
+    std::unordered_map<std::string, std::map<std::string, MemberRow>>
+        threadMembers;
+    std::unordered_map<std::string, std::set<std::string>> memberThreads;
+    std::unordered_map<std::string, int64_t> threadHashes;
+    std::unordered_map<std::string, MediaCacheEntry> mediaCache;
+    std::unordered_map<std::string, OutboxRow> outbox;
+    // (created_at, local_id) of the entries that aren't in flight
+    std::set<OrderKey> queuedOutbox;
+    std::unordered_map<std::string, std::string> olmSessions;
+    std::unordered_map<std::string, std::string> olmAccount;
+  };
+
+  std::recursive_mutex mutex;
+  Tables tables;
+  bool transactionOpen{false};
+  // Name of every open savepoint and the size of undoLog when it was made
+  std::vector<std::pair<std::string, size_t>> savepoints;
+  // Undoes the writes of the open transaction, last one first
+  std::vector<std::function<void()>> undoLog;
+  bool undoing{false};
+  // Keys of the messages and threads written since the last
+  // getDatabaseChanges, see ChangeCapture. Looking them up is cheap in
+  // memory, so there is no capacity.
+  std::unordered_set<std::string> changedMessageIDs;
+  std::unordered_set<std::string> changedThreadIDs;
+
+  void clear() {
+    this->tables = Tables();
+    this->transactionOpen = false;
+    this->savepoints.clear();
+    this->undoLog.clear();
+    this->changedMessageIDs.clear();
+    this->changedThreadIDs.clear();
+  }
+
+  void logUndo(std::function<void()> undo) {
+    if (this->undoing ||
+        (!this->transactionOpen && this->savepoints.empty())) {
+      return;
+    }
+    this->undoLog.push_back(std::move(undo));
+  }
+
+  void undoTo(size_t size) {
+    this->undoing = true;
+    while (this->undoLog.size() > size) {
+      std::function<void()> undo = std::move(this->undoLog.back());
+      this->undoLog.pop_back();
+      undo();
+    }
+    this->undoing = false;
+  }
+
+  void endTransaction() {
+    this->transactionOpen = false;
+    this->savepoints.clear();
+    this->undoLog.clear();
+  }
+
+  void recordMessageChange(const std::string &messageID) {
+    if (!ChangeCapture::isSuppressed()) {
+      this->changedMessageIDs.insert(messageID);
+    }
+  }
+
+  void recordThreadChange(const std::string &threadID) {
+    if (!ChangeCapture::isSuppressed()) {
+      this->changedThreadIDs.insert(threadID);
+    }
+  }
+
+  // Writes or removes the value of a table without indexes
+  template <typename T>
+  void assign(
+      std::unordered_map<std::string, T> &table,
+      const std::string &key,
+      std::optional<T> value) {
+    auto it = table.find(key);
+    std::optional<T> previous;
+    if (it != table.end()) {
+      previous = std::move(it->second);
+      table.erase(it);
+    }
+    this->logUndo([this, &table, key, previous]() {
+      this->assign(table, key, previous);
+    });
+    if (value) {
+      table.emplace(key, std::move(*value));
+    }
+  }
+
+  std::optional<MessageRow> detachMessage(const std::string &id) {
+    auto it = this->tables.messages.find(id);
+    if (it == this->tables.messages.end()) {
+      return std::nullopt;
+    }
+    MessageRow row = std::move(it->second);
+    this->tables.messages.erase(it);
+    auto threadIt = this->tables.threadMessages.find(row.thread);
+    threadIt->second.erase(OrderKey(row.time, row.id));
+    if (threadIt->second.empty()) {
+      this->tables.threadMessages.erase(threadIt);
+    }
+    return row;
+  }
+
+  void restoreMessage(const std::string &id, std::optional<MessageRow> row) {
+    if (row) {
+      this->putMessage(std::move(*row));
+    } else {
+      this->eraseMessage(id);
+    }
+  }
+
+  // Media of the message is left as it is
+  void putMessage(MessageRow row) {
+    std::optional<MessageRow> previous = this->detachMessage(row.id);
+    this->logUndo([this, id = row.id, previous]() {
+      this->restoreMessage(id, previous);
+    });
+    this->recordMessageChange(row.id);
+    this->tables.threadMessages[row.thread].emplace(row.time, row.id);
+    std::string id = row.id;
+    this->tables.messages.emplace(std::move(id), std::move(row));
+  }
+
+  void eraseMessage(const std::string &id) {
+    std::optional<MessageRow> previous = this->detachMessage(id);
+    if (!previous) {
+      return;
+    }
+    this->logUndo(
+        [this, id, previous]() { this->restoreMessage(id, previous); });
+    this->recordMessageChange(id);
+  }
+
+  std::optional<Media> detachMedia(const std::string &id) {
+    auto it = this->tables.media.find(id);
+    if (it == this->tables.media.end()) {
+      return std::nullopt;
+    }
+    Media media = std::move(it->second);
+    this->tables.media.erase(it);
+    auto messageIt = this->tables.messageMedia.find(media.container);
+    messageIt->second.erase(media.id);
+    if (messageIt->second.empty()) {
+      this->tables.messageMedia.erase(messageIt);
+    }
+    return media;
+  }
+
+  void restoreMedia(const std::string &id, std::optional<Media> media) {
+    if (media) {
+      this->putMedia(std::move(*media));
+    } else {
+      this->eraseMedia(id);
+    }
+  }
+
+  void putMedia(Media media) {
+    std::optional<Media> previous = this->detachMedia(media.id);
+    this->logUndo([this, id = media.id, previous]() {
+      this->restoreMedia(id, previous);
+    });
+    if (previous) {
+      this->recordMessageChange(previous->container);
+    }
+    this->recordMessageChange(media.container);
+    this->tables.messageMedia[media.container].insert(media.id);
+    std::string id = media.id;
+    this->tables.media.emplace(std::move(id), std::move(media));
+  }
+
+  void eraseMedia(const std::string &id) {
+    std::optional<Media> previous = this->detachMedia(id);
+    if (!previous) {
+      return;
+    }
+    this->logUndo(
+        [this, id, previous]() { this->restoreMedia(id, previous); });
+    this->recordMessageChange(previous->container);
+  }
+
+  void eraseMediaOf(const std::string &messageID) {
+    auto it = this->tables.messageMedia.find(messageID);
+    if (it == this->tables.messageMedia.end()) {
+      return;
+    }
+    const std::vector<std::string> mediaIDs(
+        it->second.begin(), it->second.end());
+    for (const std::string &mediaID : mediaIDs) {
+      this->eraseMedia(mediaID);
+    }
+  }
+
+  // Removing or replacing a message removes its media, like the delete
+  // triggers of messages
+  void removeMessage(const std::string &id) {
+    this->eraseMessage(id);
+    this->eraseMediaOf(id);
+  }
+
+  void replaceMessage(MessageRow row) {
+    // Writing an archived message again only brings it back, with its media
+    auto it = this->tables.messages.find(row.id);
+    if (it == this->tables.messages.end() || !it->second.archived) {
+      this->eraseMediaOf(row.id);
+    }
+    this->putMessage(std::move(row));
+  }
+
+  std::optional<ThreadRow> detachThread(const std::string &id) {
+    auto it = this->tables.threads.find(id);
+    if (it == this->tables.threads.end()) {
+      return std::nullopt;
+    }
+    ThreadRow row = std::move(it->second);
+    this->tables.threads.erase(it);
+    auto membersIt = this->tables.threadMembers.find(id);
+    if (membersIt != this->tables.threadMembers.end()) {
+      for (const auto &member : membersIt->second) {
+        auto memberIt = this->tables.memberThreads.find(member.first);
+        memberIt->second.erase(id);
+        if (memberIt->second.empty()) {
+          this->tables.memberThreads.erase(memberIt);
+        }
+      }
+      this->tables.threadMembers.erase(membersIt);
+    }
+    return row;
+  }
+
+  void restoreThread(const std::string &id, std::optional<ThreadRow> row) {
+    if (row) {
+      this->putThread(std::move(*row));
+    } else {
+      this->eraseThread(id);
+    }
+  }
+
+  // Any write of a thread drops its hash, like the triggers of
+  // thread_hashes
+  void putThread(ThreadRow row) {
+    std::optional<ThreadRow> previous = this->detachThread(row.id);
+    this->logUndo([this, id = row.id, previous]() {
+      this->restoreThread(id, previous);
+    });
+    this->assign<int64_t>(this->tables.threadHashes, row.id, std::nullopt);
+    this->recordThreadChange(row.id);
+    std::map<std::string, MemberRow> members = parse_members(row.members);
+    for (const auto &member : members) {
+      this->tables.memberThreads[member.first].insert(row.id);
+    }
+    if (!members.empty()) {
+      this->tables.threadMembers.emplace(row.id, std::move(members));
+    }
+    std::string id = row.id;
+    this->tables.threads.emplace(std::move(id), std::move(row));
+  }
+
+  void eraseThread(const std::string &id) {
+    std::optional<ThreadRow> previous = this->detachThread(id);
+    if (!previous) {
+      return;
+    }
+    this->logUndo(
+        [this, id, previous]() { this->restoreThread(id, previous); });
+    this->assign<int64_t>(this->tables.threadHashes, id, std::nullopt);
+    this->recordThreadChange(id);
+  }
+
+  std::optional<OutboxRow> detachOutbox(const std::string &localID) {
+    auto it = this->tables.outbox.find(localID);
+    if (it == this->tables.outbox.end()) {
+      return std::nullopt;
+    }
+    OutboxRow row = std::move(it->second);
+    this->tables.outbox.erase(it);
+    this->tables.queuedOutbox.erase(
+        OrderKey(row.entry.created_at, row.entry.local_id));
+    return row;
+  }
+
+  void restoreOutbox(const std::string &localID, std::optional<OutboxRow> row) {
+    if (row) {
+      this->putOutbox(std::move(*row));
+    } else {
+      this->eraseOutbox(localID);
+    }
+  }
+
+  void putOutbox(OutboxRow row) {
+    std::optional<OutboxRow> previous = this->detachOutbox(row.entry.local_id);
+    this->logUndo([this, localID = row.entry.local_id, previous]() {
+      this->restoreOutbox(localID, previous);
+    });
+    if (!row.inFlight) {
+      this->tables.queuedOutbox.emplace(
+          row.entry.created_at, row.entry.local_id);
+    }
+    std::string localID = row.entry.local_id;
+    this->tables.outbox.emplace(std::move(localID), std::move(row));
+  }
+
+  void eraseOutbox(const std::string &localID) {
+    std::optional<OutboxRow> previous = this->detachOutbox(localID);
+    if (!previous) {
+      return;
+    }
+    this->logUndo([this, localID, previous]() {
+      this->restoreOutbox(localID, previous);
+    });
+  }
+
+  void setOutboxInFlight(const std::string &localID, bool inFlight) {
+    auto it = this->tables.outbox.find(localID);
+    if (it == this->tables.outbox.end() || it->second.inFlight == inFlight) {
+      return;
+    }
+    OutboxRow row = it->second;
+    row.inFlight = inFlight;
+    this->putOutbox(std::move(row));
+  }
+
+  // UPDATE OR REPLACE of the ID, which replaces a message that already has
+  // the new one. The media stays with the old ID.
+  void rekeyMessage(const std::string &from, const std::string &to) {
+    auto it = this->tables.messages.find(from);
+    if (it == this->tables.messages.end() || from == to) {
+      return;
+    }
+    MessageRow row = it->second;
+    this->eraseMessage(from);
+    this->removeMessage(to);
+    row.id = to;
+    this->putMessage(std::move(row));
+  }
+
+  void rekeyMediaContainer(const std::string &from, const std::string &to) {
+    auto it = this->tables.messageMedia.find(from);
+    if (it == this->tables.messageMedia.end() || from == to) {
+      return;
+    }
+    const std::vector<std::string> mediaIDs(
+        it->second.begin(), it->second.end());
+    for (const std::string &mediaID : mediaIDs) {
+      Media media = this->tables.media.at(mediaID);
+      media.container = to;
+      this->putMedia(std::move(media));
+    }
+  }
+
+  std::vector<Media> getMediaOf(const std::string &messageID) const {
+    std::vector<Media> media;
+    auto it = this->tables.messageMedia.find(messageID);
+    if (it == this->tables.messageMedia.end()) {
+      return media;
+    }
+    media.reserve(it->second.size());
+    for (const std::string &mediaID : it->second) {
+      media.push_back(this->tables.media.at(mediaID));
+    }
+    return media;
+  }
+
+  std::pair<Message, std::vector<Media>>
+  getMessageWithMedia(const MessageRow &row) const {
+    return {to_message(row), this->getMediaOf(row.id)};
+  }
+
+  // Messages of a thread from the newest before the key, newest first. At
+  // most limit of them, unless limit is negative.
+  template <typename Filter>
+  std::vector<std::pair<Message, std::vector<Media>>> getThreadPage(
+      const std::string &threadID,
+      const OrderKey &before,
+      int limit,
+      Filter filter) const {
+    std::vector<std::pair<Message, std::vector<Media>>> page;
+    auto threadIt = this->tables.threadMessages.find(threadID);
+    if (threadIt == this->tables.threadMessages.end()) {
+      return page;
+    }
+    const std::set<OrderKey> &keys = threadIt->second;
+    for (auto it = std::make_reverse_iterator(keys.lower_bound(before));
+         it != keys.rend();
+         it++) {
+      if (limit >= 0 && page.size() >= static_cast<size_t>(limit)) {
+        break;
+      }
+      if (!filter(*it)) {
+        break;
+      }
+      page.push_back(this->getMessageWithMedia(this->tables.messages.at(
+          it->second)));
+    }
+    return page;
+  }
+
+  void evictMediaCacheEntry(
+      const MediaCacheEntry &entry,
+      MediaCacheEviction &eviction) {
+    if (std::remove(entry.local_path.c_str())) {
+      int error = errno;
+      if (error != ENOENT) {
+        Logger::log(
+            "Failed to evict cached media file " + entry.local_path + ": " +
+            std::strerror(error));
+        return;
+      }
+    }
+    eviction.evictedCount++;
+    eviction.evictedBytes += entry.size;
+    this->assign<MediaCacheEntry>(
+        this->tables.mediaCache, entry.media_id, std::nullopt);
+  }
+
+  size_t getSize() const {
+    size_t size = 0;
+    for (const auto &draft : this->tables.drafts) {
+      size += draft.first.size() + draft.second.size();
+    }
+    for (const auto &message : this->tables.messages) {
+      const MessageRow &row = message.second;
+      size += sizeof(MessageRow) + 2 * row.id.size() + 2 * row.thread.size() +
+          row.user.size() + (row.local_id ? row.local_id->size() : 0) +
+          (row.content ? row.content->size() : 0) + sizeof(OrderKey);
+    }
+    for (const auto &media : this->tables.media) {
+      const Media &row = media.second;
+      size += sizeof(Media) + 2 * row.id.size() + row.container.size() +
+          row.thread.size() + row.uri.size() + row.type.size() +
+          row.extras.size();
+    }
+    for (const auto &thread : this->tables.threads) {
+      const ThreadRow &row = thread.second;
+      size += sizeof(ThreadRow) + 2 * row.id.size() + row.color.size() +
+          row.members.size() + row.roles.size() + row.current_user.size() +
+          (row.name ? row.name->size() : 0) +
+          (row.description ? row.description->size() : 0);
+    }
+    for (const auto &members : this->tables.threadMembers) {
+      for (const auto &member : members.second) {
+        size += sizeof(MemberRow) + 2 * member.first.size() +
+            2 * members.first.size();
+      }
+    }
+    for (const auto &entry : this->tables.outbox) {
+      const OutboxEntry &row = entry.second.entry;
+      size += sizeof(OutboxRow) + 2 * row.local_id.size() +
+          row.thread.size() + row.target.size() + row.payload.size();
+    }
+    for (const auto &session : this->tables.olmSessions) {
+      size += session.first.size() + session.second.size();
+    }
+    return size;
+  }
+};
+
+InMemoryStore store;
+
+// Key of the olm account in its table, which has at most one row
+const std::string OLM_ACCOUNT_KEY = "account";
+
+} // namespace
+
+std::string InMemoryQueryExecutor::getDraft(std::string key) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  auto it = store.tables.drafts.find(key);
+  return it == store.tables.drafts.end() ? "" : it->second;
+}
+
+std::unique_ptr<Thread>
+InMemoryQueryExecutor::getThread(std::string threadID) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  auto it = store.tables.threads.find(threadID);
+  if (it == store.tables.threads.end()) {
+    return nullptr;
+  }
+  return std::make_unique<Thread>(to_thread(it->second, true));
+}
+
+void InMemoryQueryExecutor::updateDraft(std::string key, std::string text)
+    const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  store.assign<std::string>(store.tables.drafts, key, std::move(text));
+}
+
+bool InMemoryQueryExecutor::moveDraft(std::string oldKey, std::string newKey)
+    const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  auto it = store.tables.drafts.find(oldKey);
+  if (it == store.tables.drafts.end()) {
+    return false;
+  }
+  std::string text = it->second;
+  store.assign<std::string>(store.tables.drafts, newKey, std::move(text));
+  if (oldKey != newKey) {
+    store.assign<std::string>(store.tables.drafts, oldKey, std::nullopt);
+  }
+  return true;
+}
+
+std::vector<Draft> InMemoryQueryExecutor::getAllDrafts() const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  std::vector<Draft> drafts;
+  drafts.reserve(store.tables.drafts.size());
+  for (const auto &draft : store.tables.drafts) {
+    drafts.push_back(Draft{draft.first, draft.second});
+  }
+  return drafts;
+}
+
+void InMemoryQueryExecutor::removeAllDrafts() const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  std::vector<std::string> keys;
+  for (const auto &draft : store.tables.drafts) {
+    keys.push_back(draft.first);
+  }
+  for (const std::string &key : keys) {
+    store.assign<std::string>(store.tables.drafts, key, std::nullopt);
+  }
+}
+
+void InMemoryQueryExecutor::removeAllMessages() const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  std::vector<std::string> ids;
+  ids.reserve(store.tables.messages.size());
+  for (const auto &message : store.tables.messages) {
+    ids.push_back(message.first);
+  }
+  for (const std::string &id : ids) {
+    store.removeMessage(id);
+  }
+}
+
+std::vector<std::pair<Message, std::vector<Media>>>
+InMemoryQueryExecutor::getAllMessages() const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  std::vector<const MessageRow *> rows;
+  rows.reserve(store.tables.messages.size());
+  for (const auto &message : store.tables.messages) {
+    if (!message.second.archived) {
+      rows.push_back(&message.second);
+    }
+  }
+  // Ordered by ID, the same as SQLiteQueryExecutor reads them
+  std::sort(
+      rows.begin(),
+      rows.end(),
+      [](const MessageRow *lhs, const MessageRow *rhs) {
+        return lhs->id < rhs->id;
+      });
+  std::vector<std::pair<Message, std::vector<Media>>> allMessages;
+  allMessages.reserve(rows.size());
+  for (const MessageRow *row : rows) {
+    allMessages.push_back(store.getMessageWithMedia(*row));
+  }
+  return allMessages;
+}
+
+CompactMessageStore InMemoryQueryExecutor::getAllMessagesCompact() const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  std::vector<const MessageRow *> rows;
+  rows.reserve(store.tables.messages.size());
+  for (const auto &message : store.tables.messages) {
+    if (!message.second.archived) {
+      rows.push_back(&message.second);
+    }
+  }
+  std::sort(
+      rows.begin(),
+      rows.end(),
+      [](const MessageRow *lhs, const MessageRow *rhs) {
+        return lhs->id < rhs->id;
+      });
+  CompactMessageStore compactStore;
+  compactStore.messages.reserve(rows.size());
+  for (const MessageRow *row : rows) {
+    CompactMessage message{
+        row->id,
+        row->local_id,
+        compactStore.strings.intern(row->thread.data(), row->thread.size()),
+        compactStore.strings.intern(row->user.data(), row->user.size()),
+        row->type,
+        row->future_type,
+        row->content,
+        row->time};
+    message.media_begin = message.media_end = compactStore.media.size();
+    auto mediaIt = store.tables.messageMedia.find(row->id);
+    if (mediaIt != store.tables.messageMedia.end()) {
+      for (const std::string &mediaID : mediaIt->second) {
+        const Media &media = store.tables.media.at(mediaID);
+        compactStore.media.push_back(
+            CompactMedia{media.id, media.uri, media.type, media.extras});
+        message.media_end++;
+      }
+    }
+    compactStore.messages.push_back(std::move(message));
+  }
+  return compactStore;
+}
+
+std::vector<std::pair<Message, std::vector<Media>>>
+InMemoryQueryExecutor::getThreadMessagesBefore(
+    std::string threadID,
+    int64_t beforeTime,
+    std::string beforeMessageID,
+    int pageSize) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  return store.getThreadPage(
+      threadID,
+      OrderKey(beforeTime, beforeMessageID),
+      pageSize,
+      [](const OrderKey &) { return true; });
+}
+
+bool InMemoryQueryExecutor::prefetchThreadMessagesBefore(
+    const std::string &threadID,
+    int64_t &beforeTime,
+    std::string &beforeMessageID,
+    int pageSize,
+    size_t maxCacheSize) const {
+  // Every page is served from memory already
+  return false;
+}
+
+std::vector<std::pair<Message, std::vector<Media>>>
+InMemoryQueryExecutor::getMessagesOfThreads(
+    const std::vector<std::string> &threadIDs) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  std::vector<const MessageRow *> rows;
+  for (const std::string &threadID : threadIDs) {
+    auto threadIt = store.tables.threadMessages.find(threadID);
+    if (threadIt == store.tables.threadMessages.end()) {
+      continue;
+    }
+    for (const OrderKey &key : threadIt->second) {
+      rows.push_back(&store.tables.messages.at(key.second));
+    }
+  }
+  std::sort(
+      rows.begin(),
+      rows.end(),
+      [](const MessageRow *a, const MessageRow *b) {
+        return a->time > b->time || (a->time == b->time && a->id > b->id);
+      });
+  std::vector<std::pair<Message, std::vector<Media>>> messages;
+  messages.reserve(rows.size());
+  for (const MessageRow *row : rows) {
+    messages.push_back(store.getMessageWithMedia(*row));
+  }
+  return messages;
+}
+
+std::vector<std::pair<Message, std::vector<Media>>>
+InMemoryQueryExecutor::getMessagesWithoutThread() const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  std::vector<std::string> threadIDs;
+  for (const auto &threadMessages : store.tables.threadMessages) {
+    if (!store.tables.threads.count(threadMessages.first)) {
+      threadIDs.push_back(threadMessages.first);
+    }
+  }
+  return this->getMessagesOfThreads(threadIDs);
+}
+
+std::vector<std::pair<Message, std::vector<Media>>>
+InMemoryQueryExecutor::getThreadMessagesInRange(
+    const std::string &threadID,
+    int64_t fromTime,
+    int64_t toTime,
+    int limit) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  // Keys of toTime sort after the empty ID, so they are left out
+  return store.getThreadPage(
+      threadID,
+      OrderKey(toTime, ""),
+      limit,
+      [fromTime](const OrderKey &key) { return key.first >= fromTime; });
+}
+
+std::vector<std::pair<Message, std::vector<Media>>>
+InMemoryQueryExecutor::getMessagesByIDs(
+    const std::vector<std::string> &ids) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  std::vector<std::pair<Message, std::vector<Media>>> messages;
+  for (const std::string &id : ids) {
+    auto it = store.tables.messages.find(id);
+    if (it != store.tables.messages.end()) {
+      messages.push_back(store.getMessageWithMedia(it->second));
+    }
+  }
+  return messages;
+}
+
+std::vector<int> InMemoryQueryExecutor::getThreadMessageCounts(
+    const std::vector<std::string> &threadIDs) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  std::vector<int> counts;
+  counts.reserve(threadIDs.size());
+  for (const std::string &threadID : threadIDs) {
+    auto it = store.tables.threadMessages.find(threadID);
+    counts.push_back(
+        it == store.tables.threadMessages.end()
+            ? 0
+            : static_cast<int>(it->second.size()));
+  }
+  return counts;
+}
+
+std::vector<std::pair<Message, std::vector<Media>>>
+InMemoryQueryExecutor::searchMessages(
+    std::string query,
+    folly::Optional<std::string> threadID,
+    int pageSize,
+    int offset) const {
+  std::vector<std::string> queryTokens = tokenize(query);
+  if (queryTokens.empty()) {
+    return {};
+  }
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  // There is no rank without the full-text index, so matches are ordered by
+  // time alone
+  std::vector<const MessageRow *> rows;
+  for (const auto &message : store.tables.messages) {
+    const MessageRow &row = message.second;
+    if (row.type == 0 && row.content &&
+        (!threadID || row.thread == *threadID) &&
+        matches_query(queryTokens, *row.content)) {
+      rows.push_back(&row);
+    }
+  }
+  std::sort(
+      rows.begin(),
+      rows.end(),
+      [](const MessageRow *a, const MessageRow *b) {
+        return a->time > b->time || (a->time == b->time && a->id > b->id);
+      });
+  std::vector<std::pair<Message, std::vector<Media>>> messages;
+  size_t begin = std::max(offset, 0);
+  size_t end = pageSize < 0
+      ? rows.size()
+      : std::min(rows.size(), begin + static_cast<size_t>(pageSize));
+  for (size_t i = begin; i < end; i++) {
+    messages.push_back(store.getMessageWithMedia(*rows[i]));
+  }
+  return messages;
+}
+
+void InMemoryQueryExecutor::removeMessages(
+    const std::vector<std::string> &ids) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  for (const std::string &id : ids) {
+    store.removeMessage(id);
+  }
+}
+
+void InMemoryQueryExecutor::removeMessagesForThreads(
+    const std::vector<std::string> &threadIDs) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  for (const std::string &threadID : threadIDs) {
+    auto threadIt = store.tables.threadMessages.find(threadID);
+    if (threadIt == store.tables.threadMessages.end()) {
+      continue;
+    }
+    std::vector<std::string> ids;
+    ids.reserve(threadIt->second.size());
+    for (const OrderKey &key : threadIt->second) {
+      ids.push_back(key.second);
+    }
+    for (const std::string &id : ids) {
+      store.removeMessage(id);
+    }
+  }
+}
+
+int InMemoryQueryExecutor::archiveMessages(int64_t olderThan) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  // Archived messages keep their place in the thread index, since they are
+  // still read by thread
+  std::vector<MessageRow> archived;
+  for (const auto &message : store.tables.messages) {
+    if (!message.second.archived && message.second.time < olderThan) {
+      archived.push_back(message.second);
+    }
+  }
+  for (MessageRow &row : archived) {
+    row.archived = true;
+    store.putMessage(std::move(row));
+  }
+  return static_cast<int>(archived.size());
+}
+
+void InMemoryQueryExecutor::replaceMessage(const Message &message) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  store.replaceMessage(to_row(message));
+}
+
+void InMemoryQueryExecutor::replaceMessages(
+    const std::vector<Message> &messages) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  for (const Message &message : messages) {
+    store.replaceMessage(to_row(message));
+  }
+}
+
+void InMemoryQueryExecutor::rekeyMessage(std::string from, std::string to)
+    const {
+  this->rekeyMessagesBatch({{from, to}});
+}
+
+void InMemoryQueryExecutor::rekeyMessagesBatch(
+    const std::vector<std::pair<std::string, std::string>> &ids) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  for (const auto &[from, to] : ids) {
+    store.rekeyMessage(from, to);
+  }
+}
+
+void InMemoryQueryExecutor::removeAllMedia() const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  std::vector<std::string> ids;
+  ids.reserve(store.tables.media.size());
+  for (const auto &media : store.tables.media) {
+    ids.push_back(media.first);
+  }
+  for (const std::string &id : ids) {
+    store.eraseMedia(id);
+  }
+}
+
+void InMemoryQueryExecutor::removeMediaForMessages(
+    const std::vector<std::string> &msg_ids) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  for (const std::string &msg_id : msg_ids) {
+    store.eraseMediaOf(msg_id);
+  }
+}
+
+void InMemoryQueryExecutor::removeMediaForMessage(std::string msg_id) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  store.eraseMediaOf(msg_id);
+}
+
+void InMemoryQueryExecutor::removeMediaForThreads(
+    const std::vector<std::string> &thread_ids) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  std::unordered_set<std::string> threadIDs(
+      thread_ids.begin(), thread_ids.end());
+  std::vector<std::string> ids;
+  for (const auto &media : store.tables.media) {
+    if (threadIDs.count(media.second.thread)) {
+      ids.push_back(media.first);
+    }
+  }
+  for (const std::string &id : ids) {
+    store.eraseMedia(id);
+  }
+}
+
+void InMemoryQueryExecutor::replaceMedia(const Media &media) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  store.putMedia(media);
+}
+
+void InMemoryQueryExecutor::replaceMediaBatch(
+    const std::vector<Media> &media) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  for (const Media &mediaItem : media) {
+    store.putMedia(mediaItem);
+  }
+}
+
+void InMemoryQueryExecutor::rekeyMediaContainers(
+    std::string from,
+    std::string to) const {
+  this->rekeyMediaContainersBatch({{from, to}});
+}
+
+void InMemoryQueryExecutor::rekeyMediaContainersBatch(
+    const std::vector<std::pair<std::string, std::string>> &containers) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  for (const auto &[from, to] : containers) {
+    store.rekeyMediaContainer(from, to);
+  }
+}
+
+void InMemoryQueryExecutor::recordMediaCacheEntry(
+    const MediaCacheEntry &entry) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  store.assign<MediaCacheEntry>(
+      store.tables.mediaCache, entry.media_id, entry);
+}
+
+void InMemoryQueryExecutor::touchMediaCacheEntries(
+    const std::vector<std::string> &mediaIDs,
+    int64_t accessedAt) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  for (const std::string &mediaID : mediaIDs) {
+    auto it = store.tables.mediaCache.find(mediaID);
+    // Entries are only ever moved forward, see SQLiteQueryExecutor
+    if (it == store.tables.mediaCache.end() ||
+        it->second.last_accessed >= accessedAt) {
+      continue;
+    }
+    MediaCacheEntry entry = it->second;
+    entry.last_accessed = accessedAt;
+    store.assign<MediaCacheEntry>(
+        store.tables.mediaCache, mediaID, std::move(entry));
+  }
+}
+
+int64_t InMemoryQueryExecutor::getMediaCacheSize() const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  int64_t size = 0;
+  for (const auto &entry : store.tables.mediaCache) {
+    size += entry.second.size;
+  }
+  return size;
+}
+
+MediaCacheEviction
+InMemoryQueryExecutor::evictMediaCache(int64_t budget) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  MediaCacheEviction eviction;
+  int64_t cacheSize = this->getMediaCacheSize();
+
+  // The files of removed media all go whatever the budget, then the least
+  // recently accessed ones until the cache fits it
+  std::vector<MediaCacheEntry> orphans;
+  std::vector<MediaCacheEntry> entries;
+  for (const auto &entry : store.tables.mediaCache) {
+    if (store.tables.media.count(entry.first)) {
+      entries.push_back(entry.second);
+    } else {
+      orphans.push_back(entry.second);
+    }
+  }
+  for (const MediaCacheEntry &entry : orphans) {
+    int64_t evictedBytes = eviction.evictedBytes;
+    store.evictMediaCacheEntry(entry, eviction);
+    cacheSize -= eviction.evictedBytes - evictedBytes;
+  }
+  std::sort(
+      entries.begin(),
+      entries.end(),
+      [](const MediaCacheEntry &lhs, const MediaCacheEntry &rhs) {
+        return lhs.last_accessed < rhs.last_accessed ||
+            (lhs.last_accessed == rhs.last_accessed &&
+             lhs.media_id < rhs.media_id);
+      });
+  for (auto it = entries.begin(); it != entries.end() && cacheSize > budget;
+       it++) {
+    int64_t evictedBytes = eviction.evictedBytes;
+    store.evictMediaCacheEntry(*it, eviction);
+    cacheSize -= eviction.evictedBytes - evictedBytes;
+  }
+  return eviction;
+}
+
+void InMemoryQueryExecutor::addToOutbox(
+    const std::vector<OutboxEntry> &entries) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  for (const OutboxEntry &entry : entries) {
+    store.putOutbox(OutboxRow{entry, false});
+  }
+}
+
+std::vector<OutboxEntry>
+InMemoryQueryExecutor::takeOutboxBatch(int limit) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  std::vector<OutboxEntry> entries;
+  for (const OrderKey &key : store.tables.queuedOutbox) {
+    if (limit >= 0 && entries.size() >= static_cast<size_t>(limit)) {
+      break;
+    }
+    entries.push_back(store.tables.outbox.at(key.second).entry);
+  }
+  for (const OutboxEntry &entry : entries) {
+    store.setOutboxInFlight(entry.local_id, true);
+  }
+  return entries;
+}
+
+void InMemoryQueryExecutor::updateOutboxPayloads(
+    const std::vector<OutboxEntry> &entries) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  for (const OutboxEntry &entry : entries) {
+    auto it = store.tables.outbox.find(entry.local_id);
+    if (it == store.tables.outbox.end()) {
+      continue;
+    }
+    OutboxRow row = it->second;
+    row.entry.payload = entry.payload;
+    row.entry.encryption_type = entry.encryption_type;
+    store.putOutbox(std::move(row));
+  }
+}
+
+void InMemoryQueryExecutor::requeueOutboxEntries(
+    const std::vector<std::string> &localIDs) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  if (!localIDs.empty()) {
+    for (const std::string &localID : localIDs) {
+      store.setOutboxInFlight(localID, false);
+    }
+    return;
+  }
+  std::vector<std::string> inFlight;
+  for (const auto &entry : store.tables.outbox) {
+    if (entry.second.inFlight) {
+      inFlight.push_back(entry.first);
+    }
+  }
+  for (const std::string &localID : inFlight) {
+    store.setOutboxInFlight(localID, false);
+  }
+}
+
+void InMemoryQueryExecutor::acknowledgeOutboxEntries(
+    const std::vector<std::pair<std::string, std::string>> &serverIDs) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  for (const auto &[localID, serverID] : serverIDs) {
+    store.rekeyMessage(localID, serverID);
+    store.rekeyMediaContainer(localID, serverID);
+    store.eraseOutbox(localID);
+  }
+}
+
+std::vector<Thread> InMemoryQueryExecutor::getAllThreads() const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  std::vector<Thread> threads;
+  threads.reserve(store.tables.threads.size());
+  for (const auto &thread : store.tables.threads) {
+    threads.push_back(to_thread(thread.second, true));
+  }
+  return threads;
+}
+
+std::vector<Thread> InMemoryQueryExecutor::getAllThreadsByActivity() const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  std::vector<Thread> threads = this->getAllThreads();
+  auto activityOf = [](const Thread &thread) {
+    auto it = store.tables.threadMessages.find(thread.id);
+    return it != store.tables.threadMessages.end()
+        ? std::max(it->second.rbegin()->first, thread.creation_time)
+        : thread.creation_time;
+  };
+  std::stable_sort(
+      threads.begin(),
+      threads.end(),
+      [&activityOf](const Thread &lhs, const Thread &rhs) {
+        return activityOf(lhs) > activityOf(rhs);
+      });
+  return threads;
+}
+
+std::vector<Thread> InMemoryQueryExecutor::getAllThreadSummaries() const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  std::vector<Thread> threadSummaries;
+  threadSummaries.reserve(store.tables.threads.size());
+  for (const auto &thread : store.tables.threads) {
+    threadSummaries.push_back(to_thread(thread.second, false));
+  }
+  return threadSummaries;
+}
+
+CompactThreadStore
+InMemoryQueryExecutor::getAllThreadsCompact(bool includeMembership) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  CompactThreadStore compactStore;
+  compactStore.threads.reserve(store.tables.threads.size());
+  auto intern = [&compactStore](const std::optional<std::string> &value) {
+    return value ? compactStore.strings.intern(value->data(), value->size())
+                 : nullptr;
+  };
+  for (const auto &thread : store.tables.threads) {
+    const ThreadRow &row = thread.second;
+    compactStore.threads.push_back(CompactThread{
+        row.id,
+        row.type,
+        row.name,
+        row.description,
+        row.color,
+        row.creation_time,
+        intern(row.parent_thread_id),
+        intern(row.containing_thread_id),
+        intern(row.community),
+        includeMembership ? row.members : "",
+        includeMembership ? row.roles : "",
+        row.current_user,
+        row.source_message_id,
+        row.replies_count});
+  }
+  return compactStore;
+}
+
+std::vector<Thread> InMemoryQueryExecutor::getThreadsByIDs(
+    const std::vector<std::string> &ids) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  std::vector<Thread> threads;
+  std::unordered_set<std::string> found;
+  for (const std::string &id : ids) {
+    auto it = store.tables.threads.find(id);
+    if (it != store.tables.threads.end() && found.insert(id).second) {
+      threads.push_back(to_thread(it->second, true));
+    }
+  }
+  return threads;
+}
+
+void InMemoryQueryExecutor::removeThreads(std::vector<std::string> ids) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  for (const std::string &id : ids) {
+    store.eraseThread(id);
+  }
+}
+
+void InMemoryQueryExecutor::replaceThread(const Thread &thread) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  store.putThread(to_row(thread));
+}
+
+bool InMemoryQueryExecutor::replaceThreadIfChanged(const Thread &thread) const {
+  int64_t hash = hash_thread(thread);
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  auto it = store.tables.threadHashes.find(thread.id);
+  if (it != store.tables.threadHashes.end() && it->second == hash) {
+    return false;
+  }
+  // The replace drops the previous hash
+  store.putThread(to_row(thread));
+  store.assign<int64_t>(store.tables.threadHashes, thread.id, hash);
+  return true;
+}
+
+std::vector<std::pair<std::string, int64_t>>
+InMemoryQueryExecutor::getThreadHashes() const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  return std::vector<std::pair<std::string, int64_t>>(
+      store.tables.threadHashes.begin(), store.tables.threadHashes.end());
+}
+
+void InMemoryQueryExecutor::replaceThreads(
+    const std::vector<Thread> &threads) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  for (const Thread &thread : threads) {
+    store.putThread(to_row(thread));
+  }
+}
+
+void InMemoryQueryExecutor::removeAllThreads() const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  std::vector<std::string> ids;
+  ids.reserve(store.tables.threads.size());
+  for (const auto &thread : store.tables.threads) {
+    ids.push_back(thread.first);
+  }
+  for (const std::string &id : ids) {
+    store.eraseThread(id);
+  }
+}
+
+std::vector<ThreadMember>
+InMemoryQueryExecutor::getThreadMembers(std::string threadID) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  std::vector<ThreadMember> members;
+  auto it = store.tables.threadMembers.find(threadID);
+  if (it == store.tables.threadMembers.end()) {
+    return members;
+  }
+  members.reserve(it->second.size());
+  for (const auto &member : it->second) {
+    members.push_back(ThreadMember{
+        threadID,
+        member.first,
+        to_pointer(member.second.role),
+        member.second.is_sender});
+  }
+  return members;
+}
+
+std::vector<std::string>
+InMemoryQueryExecutor::getThreadIDsForMember(std::string userID) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  auto it = store.tables.memberThreads.find(userID);
+  if (it == store.tables.memberThreads.end()) {
+    return {};
+  }
+  return std::vector<std::string>(it->second.begin(), it->second.end());
+}
+
+std::vector<int> InMemoryQueryExecutor::getThreadMemberCounts(
+    const std::vector<std::string> &threadIDs) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  std::vector<int> counts;
+  counts.reserve(threadIDs.size());
+  for (const std::string &threadID : threadIDs) {
+    auto it = store.tables.threadMembers.find(threadID);
+    counts.push_back(
+        it == store.tables.threadMembers.end()
+            ? 0
+            : static_cast<int>(it->second.size()));
+  }
+  return counts;
+}
+
+std::vector<ThreadSummary>
+InMemoryQueryExecutor::getThreadSummariesByRecency() const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  // Aggregated from the thread index, which has the latest message last
+  std::vector<ThreadSummary> summaries;
+  summaries.reserve(store.tables.threadMessages.size());
+  for (const auto &[threadID, keys] : store.tables.threadMessages) {
+    const OrderKey &latest = *keys.rbegin();
+    summaries.push_back(ThreadSummary{
+        threadID,
+        static_cast<int>(keys.size()),
+        std::make_unique<std::string>(latest.second),
+        latest.first,
+        store.tables.messageMedia.count(latest.second) ? 1 : 0});
+  }
+  std::sort(
+      summaries.begin(),
+      summaries.end(),
+      [](const ThreadSummary &lhs, const ThreadSummary &rhs) {
+        return lhs.last_message_time > rhs.last_message_time ||
+            (lhs.last_message_time == rhs.last_message_time &&
+             lhs.thread_id > rhs.thread_id);
+      });
+  return summaries;
+}
+
+void InMemoryQueryExecutor::updateThreadsJSONField(
+    const std::vector<std::string> &threadIDs,
+    const std::string &column,
+    const std::string &field,
+    const std::string &value) const {
+  std::string ThreadRow::*columnField;
+  if (column == "members") {
+    columnField = &ThreadRow::members;
+  } else if (column == "roles") {
+    columnField = &ThreadRow::roles;
+  } else if (column == "current_user") {
+    columnField = &ThreadRow::current_user;
+  } else {
+    throw std::system_error(
+        EINVAL,
+        std::generic_category(),
+        "Column " + column + " of threads table is not a JSON column");
+  }
+  if (threadIDs.empty()) {
+    return;
+  }
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  // Every row is updated before any is written, so that a failure leaves
+  // all of them as they were
+  std::vector<ThreadRow> updated;
+  try {
+    folly::dynamic parsedValue = folly::parseJson(value);
+    for (const std::string &threadID : threadIDs) {
+      auto it = store.tables.threads.find(threadID);
+      if (it == store.tables.threads.end()) {
+        continue;
+      }
+      ThreadRow row = it->second;
+      folly::dynamic json;
+      try {
+        json = folly::parseJson(row.*columnField);
+      } catch (const std::exception &) {
+        // Like the json_valid check of SQLiteQueryExecutor
+        Logger::log(
+            "Skipped update of " + column + " of thread " + threadID +
+            ": its JSON is malformed");
+        continue;
+      }
+      // Like json_set, a value that isn't an object is left as it is
+      if (json.isObject()) {
+        json[field] = parsedValue;
+        row.*columnField = folly::toJson(json);
+      }
+      updated.push_back(std::move(row));
+    }
+  } catch (const std::exception &e) {
+    throw_database_error(
+        "Failed to update " + column + " of threads: " + e.what());
+  }
+  for (ThreadRow &row : updated) {
+    store.putThread(std::move(row));
+  }
+}
+
+void InMemoryQueryExecutor::beginTransaction() const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  if (store.transactionOpen || !store.savepoints.empty()) {
+    throw_database_error(
+        "Failed to begin transaction: a transaction is already open");
+  }
+  store.transactionOpen = true;
+}
+
+void InMemoryQueryExecutor::commitTransaction() const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  if (!store.transactionOpen && store.savepoints.empty()) {
+    throw_database_error("Failed to commit: no transaction is open");
+  }
+  store.endTransaction();
+}
+
+void InMemoryQueryExecutor::rollbackTransaction() const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  if (!store.transactionOpen && store.savepoints.empty()) {
+    throw_database_error("Failed to roll back: no transaction is open");
+  }
+  store.undoTo(0);
+  store.endTransaction();
+}
+
+void InMemoryQueryExecutor::createSavepoint(const std::string &name) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  // Outside of a transaction, a savepoint starts one that its release
+  // commits, like in SQLite
+  store.savepoints.emplace_back(name, store.undoLog.size());
+}
+
+void InMemoryQueryExecutor::releaseSavepoint(const std::string &name) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  auto it = std::find_if(
+      store.savepoints.rbegin(),
+      store.savepoints.rend(),
+      [&name](const auto &savepoint) { return savepoint.first == name; });
+  if (it == store.savepoints.rend()) {
+    throw_database_error("Failed to release savepoint: no such savepoint");
+  }
+  // Releases the savepoints created after it as well
+  store.savepoints.erase(std::prev(it.base()), store.savepoints.end());
+  if (!store.transactionOpen && store.savepoints.empty()) {
+    store.endTransaction();
+  }
+}
+
+void InMemoryQueryExecutor::rollbackToSavepoint(const std::string &name) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  auto it = std::find_if(
+      store.savepoints.rbegin(),
+      store.savepoints.rend(),
+      [&name](const auto &savepoint) { return savepoint.first == name; });
+  if (it == store.savepoints.rend()) {
+    throw_database_error("Failed to roll back to savepoint: no such savepoint");
+  }
+  store.undoTo(it->second);
+  this->releaseSavepoint(name);
+}
+
+std::vector<OlmPersistSession>
+InMemoryQueryExecutor::getOlmPersistSessionsData() const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  std::vector<OlmPersistSession> sessions;
+  sessions.reserve(store.tables.olmSessions.size());
+  for (const auto &session : store.tables.olmSessions) {
+    sessions.push_back(OlmPersistSession{session.first, session.second});
+  }
+  return sessions;
+}
+
+folly::Optional<std::string>
+InMemoryQueryExecutor::getOlmPersistAccountData() const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  auto it = store.tables.olmAccount.find(OLM_ACCOUNT_KEY);
+  return it == store.tables.olmAccount.end()
+      ? folly::none
+      : folly::Optional<std::string>(it->second);
+}
+
+void InMemoryQueryExecutor::storeOlmPersistData(crypto::Persist persist) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  // An empty account means that only sessions changed
+  if (!persist.account.empty()) {
+    store.assign<std::string>(
+        store.tables.olmAccount,
+        OLM_ACCOUNT_KEY,
+        std::string(persist.account.begin(), persist.account.end()));
+  }
+  for (const auto &it : persist.sessions) {
+    store.assign<std::string>(
+        store.tables.olmSessions,
+        it.first,
+        std::string(it.second.begin(), it.second.end()));
+  }
+}
+
+void InMemoryQueryExecutor::setNotifyToken(std::string token) const {
+  this->setMetadata("notify_token", token);
+}
+
+void InMemoryQueryExecutor::clearNotifyToken() const {
+  this->clearMetadata("notify_token");
+}
+
+void InMemoryQueryExecutor::setCurrentUserID(std::string userID) const {
+  this->setMetadata("current_user_id", userID);
+}
+
+std::string InMemoryQueryExecutor::getCurrentUserID() const {
+  return this->getMetadata("current_user_id");
+}
+
+void InMemoryQueryExecutor::setDeviceID(std::string deviceID) const {
+  this->setMetadata("device_id", deviceID);
+}
+
+std::string InMemoryQueryExecutor::getDeviceID() const {
+  return this->getMetadata("device_id");
+}
+
+void InMemoryQueryExecutor::setMetadata(
+    std::string entry_name,
+    std::string data) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  store.assign<std::string>(
+      store.tables.metadata, entry_name, std::move(data));
+}
+
+void InMemoryQueryExecutor::clearMetadata(std::string entry_name) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  store.assign<std::string>(store.tables.metadata, entry_name, std::nullopt);
+}
+
+std::string InMemoryQueryExecutor::getMetadata(std::string entry_name) const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  auto it = store.tables.metadata.find(entry_name);
+  return it == store.tables.metadata.end() ? "" : it->second;
+}
+
+bool InMemoryQueryExecutor::runMaintenance(int64_t timeBudgetMs) const {
+  // Nothing is compressed, checkpointed or vacuumed in memory
+  return true;
+}
+
+void InMemoryQueryExecutor::vacuumDatabase() const {
+}
+
+DatabaseStartupMetrics InMemoryQueryExecutor::getStartupMetrics() const {
+  return DatabaseStartupMetrics{0, 0, 0, 0, true, 0, 0};
+}
+
+void InMemoryQueryExecutor::warmUp() const {
+}
+
+void InMemoryQueryExecutor::releaseMemory() const {
+}
+
+DatabaseMemoryStats InMemoryQueryExecutor::getMemoryStats() const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  // An estimate of what the rows and their indexes take, without the
+  // overhead of the allocator and of the hash maps
+  int64_t size = static_cast<int64_t>(store.getSize());
+  return DatabaseMemoryStats{size, size, 0, 0, 0, 0, 0, 0, 0};
+}
+
+std::vector<QueryPlan> InMemoryQueryExecutor::getQueryPlans() const {
+  return {};
+}
+
+DatabaseChanges InMemoryQueryExecutor::getDatabaseChanges() const {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  DatabaseChanges databaseChanges;
+  // A key whose row doesn't exist anymore was removed since it changed
+  for (const std::string &messageID : store.changedMessageIDs) {
+    auto it = store.tables.messages.find(messageID);
+    if (it == store.tables.messages.end()) {
+      databaseChanges.removedMessageIDs.push_back(messageID);
+    } else {
+      databaseChanges.messages.push_back(
+          store.getMessageWithMedia(it->second));
+    }
+  }
+  for (const std::string &threadID : store.changedThreadIDs) {
+    auto it = store.tables.threads.find(threadID);
+    if (it == store.tables.threads.end()) {
+      databaseChanges.removedThreadIDs.push_back(threadID);
+    } else {
+      databaseChanges.threads.push_back(to_thread(it->second, true));
+    }
+  }
+  store.changedMessageIDs.clear();
+  store.changedThreadIDs.clear();
+  return databaseChanges;
+}
+
+void InMemoryQueryExecutor::recordBackupLog() const {
+}
+
+BackupLogs InMemoryQueryExecutor::takeBackupLogs() const {
+  return BackupLogs();
+}
+
+void InMemoryQueryExecutor::startBackupSnapshot() const {
+  throw_backups_not_supported();
+}
+
+bool InMemoryQueryExecutor::stepBackupSnapshot() const {
+  throw_backups_not_supported();
+}
+
+std::string InMemoryQueryExecutor::readBackupSnapshotChunk() const {
+  throw_backups_not_supported();
+}
+
+void InMemoryQueryExecutor::startBackupRestore() const {
+  throw_backups_not_supported();
+}
+
+void InMemoryQueryExecutor::writeBackupRestoreCompactionChunk(
+    const std::string &chunk) const {
+  throw_backups_not_supported();
+}
+
+void InMemoryQueryExecutor::finishBackupRestoreCompaction(
+    const std::string &encryptionKey) const {
+  throw_backups_not_supported();
+}
+
+void InMemoryQueryExecutor::applyBackupRestoreLogChunk(
+    const std::string &chunk) const {
+  throw_backups_not_supported();
+}
+
+void InMemoryQueryExecutor::finishBackupRestore() const {
+  throw_backups_not_supported();
+}
+
+void InMemoryQueryExecutor::clearSensitiveData() {
+  std::lock_guard<std::recursive_mutex> lock(store.mutex);
+  store.clear();
+}
+
+} // namespace comm
@@ -0,0 +1,171 @@
+#pragma once
+
+#include "DatabaseQueryExecutor.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace comm {
+
+/**
+ * Keeps the database in memory instead of a SQLite file, for sessions that
+ * don't need to outlive the process, benchmarks and tests. Rows are held in
+ * hash maps by their keys, and the messages of every thread in a sorted
+ * index by (time, id), which serves pages, ranges and summaries. Derived
+ * tables, like thread_members and thread_summary, are kept by the writes the
+ * same way the triggers of SQLiteQueryExecutor keep them.
+ *
+ * All instances share one store, guarded by a single mutex, so a
+ * transaction isn't isolated from readers on other threads. Its writes are
+ * undone on rollback. Backups aren't supported.
+ */
+class InMemoryQueryExecutor : public DatabaseQueryExecutor {
+  void setMetadata(std::string entry_name, std::string data) const override;
+  void clearMetadata(std::string entry_name) const override;
+  std::string getMetadata(std::string entry_name) const override;
+
+public:
+  std::unique_ptr<Thread> getThread(std::string threadID) const override;
+  std::string getDraft(std::string key) const override;
+  void updateDraft(std::string key, std::string text) const override;
+  bool moveDraft(std::string oldKey, std::string newKey) const override;
+  std::vector<Draft> getAllDrafts() const override;
+  void removeAllDrafts() const override;
+  void removeAllMessages() const override;
+  std::vector<std::pair<Message, std::vector<Media>>>
+  getAllMessages() const override;
+  CompactMessageStore getAllMessagesCompact() const override;
+  std::vector<std::pair<Message, std::vector<Media>>> getThreadMessagesBefore(
+      std::string threadID,
+      int64_t beforeTime,
+      std::string beforeMessageID,
+      int pageSize) const override;
+  bool prefetchThreadMessagesBefore(
+      const std::string &threadID,
+      int64_t &beforeTime,
+      std::string &beforeMessageID,
+      int pageSize,
+      size_t maxCacheSize) const override;
+  std::vector<std::pair<Message, std::vector<Media>>> getMessagesOfThreads(
+      const std::vector<std::string> &threadIDs) const override;
+  std::vector<std::pair<Message, std::vector<Media>>>
+  getMessagesWithoutThread() const override;
+  std::vector<std::pair<Message, std::vector<Media>>> getThreadMessagesInRange(
+      const std::string &threadID,
+      int64_t fromTime,
+      int64_t toTime,
+      int limit) const override;
+  std::vector<std::pair<Message, std::vector<Media>>>
+  getMessagesByIDs(const std::vector<std::string> &ids) const override;
+  std::vector<int> getThreadMessageCounts(
+      const std::vector<std::string> &threadIDs) const override;
+  std::vector<std::pair<Message, std::vector<Media>>> searchMessages(
+      std::string query,
+      folly::Optional<std::string> threadID,
+      int pageSize,
+      int offset) const override;
+  void removeMessages(const std::vector<std::string> &ids) const override;
+  void removeMessagesForThreads(
+      const std::vector<std::string> &threadIDs) const override;
+  int archiveMessages(int64_t olderThan) const override;
+  void replaceMessage(const Message &message) const override;
+  void replaceMessages(const std::vector<Message> &messages) const override;
+  void rekeyMessage(std::string from, std::string to) const override;
+  void rekeyMessagesBatch(
+      const std::vector<std::pair<std::string, std::string>> &ids)
+      const override;
+  void removeAllMedia() const override;
+  void removeMediaForMessages(
+      const std::vector<std::string> &msg_ids) const override;
+  void removeMediaForMessage(std::string msg_id) const override;
+  void removeMediaForThreads(
+      const std::vector<std::string> &thread_ids) const override;
+  void replaceMedia(const Media &media) const override;
+  void replaceMediaBatch(const std::vector<Media> &media) const override;
+  void rekeyMediaContainers(std::string from, std::string to) const override;
+  void rekeyMediaContainersBatch(
+      const std::vector<std::pair<std::string, std::string>> &containers)
+      const override;
+  void recordMediaCacheEntry(const MediaCacheEntry &entry) const override;
+  void touchMediaCacheEntries(
+      const std::vector<std::string> &mediaIDs,
+      int64_t accessedAt) const override;
+  int64_t getMediaCacheSize() const override;
+  MediaCacheEviction evictMediaCache(int64_t budget) const override;
+  void addToOutbox(const std::vector<OutboxEntry> &entries) const override;
+  std::vector<OutboxEntry> takeOutboxBatch(int limit) const override;
+  void updateOutboxPayloads(
+      const std::vector<OutboxEntry> &entries) const override;
+  void requeueOutboxEntries(
+      const std::vector<std::string> &localIDs) const override;
+  void acknowledgeOutboxEntries(
+      const std::vector<std::pair<std::string, std::string>> &serverIDs)
+      const override;
+  std::vector<Thread> getAllThreads() const override;
+  std::vector<Thread> getAllThreadsByActivity() const override;
+  std::vector<Thread> getAllThreadSummaries() const override;
+  CompactThreadStore
+  getAllThreadsCompact(bool includeMembership) const override;
+  std::vector<Thread>
+  getThreadsByIDs(const std::vector<std::string> &ids) const override;
+  void removeThreads(std::vector<std::string> ids) const override;
+  void replaceThread(const Thread &thread) const override;
+  bool replaceThreadIfChanged(const Thread &thread) const override;
+  std::vector<std::pair<std::string, int64_t>>
+  getThreadHashes() const override;
+  void replaceThreads(const std::vector<Thread> &threads) const override;
+  void removeAllThreads() const override;
+  std::vector<ThreadMember>
+  getThreadMembers(std::string threadID) const override;
+  std::vector<std::string>
+  getThreadIDsForMember(std::string userID) const override;
+  std::vector<int> getThreadMemberCounts(
+      const std::vector<std::string> &threadIDs) const override;
+  std::vector<ThreadSummary> getThreadSummariesByRecency() const override;
+  void updateThreadsJSONField(
+      const std::vector<std::string> &threadIDs,
+      const std::string &column,
+      const std::string &field,
+      const std::string &value) const override;
+  void beginTransaction() const override;
+  void commitTransaction() const override;
+  void rollbackTransaction() const override;
+  void createSavepoint(const std::string &name) const override;
+  void releaseSavepoint(const std::string &name) const override;
+  void rollbackToSavepoint(const std::string &name) const override;
+  std::vector<OlmPersistSession> getOlmPersistSessionsData() const override;
+  folly::Optional<std::string> getOlmPersistAccountData() const override;
+  void storeOlmPersistData(crypto::Persist persist) const override;
+  void setNotifyToken(std::string token) const override;
+  void clearNotifyToken() const override;
+  void setCurrentUserID(std::string userID) const override;
+  std::string getCurrentUserID() const override;
+  void setDeviceID(std::string deviceID) const override;
+  std::string getDeviceID() const override;
+  bool runMaintenance(int64_t timeBudgetMs) const override;
+  void vacuumDatabase() const override;
+  DatabaseStartupMetrics getStartupMetrics() const override;
+  void warmUp() const override;
+  void releaseMemory() const override;
+  DatabaseMemoryStats getMemoryStats() const override;
+  std::vector<QueryPlan> getQueryPlans() const override;
+  DatabaseChanges getDatabaseChanges() const override;
+  void recordBackupLog() const override;
+  BackupLogs takeBackupLogs() const override;
+  void startBackupSnapshot() const override;
+  bool stepBackupSnapshot() const override;
+  std::string readBackupSnapshotChunk() const override;
+  void startBackupRestore() const override;
+  void
+  writeBackupRestoreCompactionChunk(const std::string &chunk) const override;
+  void finishBackupRestoreCompaction(
+      const std::string &encryptionKey) const override;
+  void applyBackupRestoreLogChunk(const std::string &chunk) const override;
+  void finishBackupRestore() const override;
+  // Drops everything stored, like clearSensitiveData of SQLiteQueryExecutor
+  static void clearSensitiveData();
+};
+
+} // namespace comm
@@ -0,0 +1,370 @@
+#pragma once
+
+#include "entities/Media.h"
+#include "entities/Message.h"
+
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace comm {
+
+/**
+ * Keeps recently read pages of thread messages, together with their media,
+ * so that paging back and forth through a thread doesn't query and decrypt
+ * the same rows again. For every thread the cache holds all the rows of one
+ * contiguous range of (time, id) keys, which grows as adjacent pages are
+ * read. Once the rows take up more than the capacity, threads are evicted in
+ * least recently used order.
+ *
+ * The cache is shared between the writer and the reader connections. Writes
+ * invalidate the threads they touch. A reader may not see a write until it
+ * is committed, so a page read only fills the cache if nothing was
+ * invalidated since the read started, and threads touched inside a
+ * transaction are invalidated once more when it ends.
+ */
+class MessageCache {
+public:
+  typedef std::pair<Message, std::vector<Media>> Row;
+  typedef std::pair<int64_t, std::string> Key;
+
+private:
+  struct Entry {
+    // Newest first. Every row with a key from the oldest row's one up to
+    // upper is cached, and if complete there are no older rows at all.
+    std::map<Key, Row, std::greater<Key>> rows;
+    Key upper;
+    bool complete;
+    size_t size{0};
+    std::list<std::string>::iterator lruPosition;
+  };
+
+  std::mutex mutex;
+  std::unordered_map<std::string, Entry> entries;
+  // Thread of every cached message, for writes that only know message IDs
+  std::unordered_map<std::string, std::string> messageThreads;
+  // Most recently used thread first
+  std::list<std::string> lru;
+  size_t size{0};
+  size_t capacity;
+  uint64_t generation{0};
+  std::unordered_set<std::string> transactionThreads;
+  bool transactionInvalidatesAll{false};
+
+  static size_t getRowSize(const Row &row) {
+    const Message &message = row.first;
+    size_t rowSize = sizeof(Row) + message.id.size() + message.thread.size() +
+        message.user.size();
+    if (message.local_id) {
+      rowSize += message.local_id->size();
+    }
+    if (message.content) {
+      rowSize += message.content->size();
+    }
+    for (const Media &media : row.second) {
+      rowSize += sizeof(Media) + media.id.size() + media.container.size() +
+          media.thread.size() + media.uri.size() + media.type.size() +
+          media.extras.size();
+    }
+    return rowSize;
+  }
+
+  static Row copyRow(const Row &row) {
+    const Message &message = row.first;
+    return Row(
+        Message{
+            message.id,
+            message.local_id
+                ? std::make_unique<std::string>(*message.local_id)
+                : nullptr,
+            message.thread,
+            message.user,
+            message.type,
+            message.future_type
+                ? std::make_unique<int>(*message.future_type)
+                : nullptr,
+            message.content ? std::make_unique<std::string>(*message.content)
+                            : nullptr,
+            message.time},
+        row.second);
+  }
+
+  static Key getKey(const Row &row) {
+    return Key(row.first.time, row.first.id);
+  }
+
+  void addRow(Entry &entry, const std::string &threadID, const Row &row) {
+    Key key = MessageCache::getKey(row);
+    if (entry.rows.count(key)) {
+      return;
+    }
+    size_t rowSize = MessageCache::getRowSize(row);
+    entry.rows.emplace(key, MessageCache::copyRow(row));
+    entry.size += rowSize;
+    this->size += rowSize;
+    this->messageThreads[row.first.id] = threadID;
+  }
+
+  void removeOldestRow(Entry &entry) {
+    auto oldest = std::prev(entry.rows.end());
+    size_t rowSize = MessageCache::getRowSize(oldest->second);
+    entry.size -= rowSize;
+    this->size -= rowSize;
+    this->messageThreads.erase(oldest->second.first.id);
+    entry.rows.erase(oldest);
+    entry.complete = false;
+  }
+
+  void eraseEntry(const std::string &threadID) {
+    auto it = this->entries.find(threadID);
+    if (it == this->entries.end()) {
+      return;
+    }
+    for (const auto &keyAndRow : it->second.rows) {
+      this->messageThreads.erase(keyAndRow.second.first.id);
+    }
+    this->size -= it->second.size;
+    this->lru.erase(it->second.lruPosition);
+    this->entries.erase(it);
+  }
+
+  void clearEntries() {
+    this->entries.clear();
+    this->messageThreads.clear();
+    this->lru.clear();
+    this->size = 0;
+  }
+
+  void touch(Entry &entry) {
+    this->lru.splice(this->lru.begin(), this->lru, entry.lruPosition);
+  }
+
+  void evict() {
+    while (this->size > this->capacity && this->lru.size() > 1) {
+      this->eraseEntry(this->lru.back());
+    }
+    if (this->size <= this->capacity || this->lru.empty()) {
+      return;
+    }
+    // A single thread above capacity keeps its newest rows
+    std::string threadID = this->lru.front();
+    Entry &entry = this->entries.at(threadID);
+    while (this->size > this->capacity && !entry.rows.empty()) {
+      this->removeOldestRow(entry);
+    }
+    if (entry.rows.empty()) {
+      this->eraseEntry(threadID);
+    }
+  }
+
+  void invalidate(const std::string &threadID, bool inTransaction) {
+    this->eraseEntry(threadID);
+    if (inTransaction) {
+      this->transactionThreads.insert(threadID);
+    }
+  }
+
+public:
+  MessageCache(size_t capacity) : capacity(capacity) {
+  }
+
+  // Returns the page of at most pageSize rows with keys below before, if all
+  // of them are cached
+  std::optional<std::vector<Row>>
+  get(const std::string &threadID, const Key &before, size_t pageSize) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto it = this->entries.find(threadID);
+    if (it == this->entries.end() || it->second.upper < before) {
+      return std::nullopt;
+    }
+    Entry &entry = it->second;
+    std::vector<Row> page;
+    for (auto row = entry.rows.upper_bound(before);
+         row != entry.rows.end() && page.size() < pageSize;
+         row++) {
+      page.push_back(MessageCache::copyRow(row->second));
+    }
+    if (page.size() < pageSize && !entry.complete) {
+      return std::nullopt;
+    }
+    this->touch(entry);
+    return page;
+  }
+
+  // Same as get, without copying the rows or making the thread recently
+  // used. If the page is cached, returns its number of rows and the key of
+  // its oldest one, which is where the next page starts.
+  std::optional<size_t> findPage(
+      const std::string &threadID,
+      const Key &before,
+      size_t pageSize,
+      Key &last) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto it = this->entries.find(threadID);
+    if (it == this->entries.end() || it->second.upper < before) {
+      return std::nullopt;
+    }
+    const Entry &entry = it->second;
+    size_t rowCount = 0;
+    for (auto row = entry.rows.upper_bound(before);
+         row != entry.rows.end() && rowCount < pageSize;
+         row++) {
+      last = row->first;
+      rowCount++;
+    }
+    if (rowCount < pageSize && !entry.complete) {
+      return std::nullopt;
+    }
+    return rowCount;
+  }
+
+  // Has to be read before the rows of a page are, and passed to put
+  uint64_t getGeneration() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->generation;
+  }
+
+  void put(
+      const std::string &threadID,
+      const Key &before,
+      size_t pageSize,
+      const std::vector<Row> &page,
+      uint64_t readGeneration) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (readGeneration != this->generation) {
+      return;
+    }
+    bool complete = page.size() < pageSize;
+    auto it = this->entries.find(threadID);
+    if (it != this->entries.end()) {
+      Entry &entry = it->second;
+      // The page and the cached range are merged only if together they
+      // still cover one contiguous range of keys
+      bool pageReachesEntry = complete || page.empty() ||
+          !(entry.upper < MessageCache::getKey(page.back()));
+      bool entryReachesPage = entry.complete || entry.rows.empty() ||
+          !(before < std::prev(entry.rows.end())->first);
+      if (!pageReachesEntry || !entryReachesPage) {
+        this->eraseEntry(threadID);
+        it = this->entries.end();
+      }
+    }
+    if (it == this->entries.end()) {
+      if (page.empty() && !complete) {
+        return;
+      }
+      this->lru.push_front(threadID);
+      it = this->entries.emplace(threadID, Entry{}).first;
+      it->second.upper = before;
+      it->second.complete = complete;
+      it->second.lruPosition = this->lru.begin();
+    }
+    Entry &entry = it->second;
+    if (entry.upper < before) {
+      entry.upper = before;
+    }
+    entry.complete = entry.complete || complete;
+    for (const Row &row : page) {
+      this->addRow(entry, threadID, row);
+    }
+    this->touch(entry);
+    this->evict();
+  }
+
+  void invalidateThreads(
+      const std::vector<std::string> &threadIDs,
+      bool inTransaction) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->generation++;
+    for (const std::string &threadID : threadIDs) {
+      this->invalidate(threadID, inTransaction);
+    }
+  }
+
+  // A message that isn't cached can't be part of any cached page, so
+  // removing it or its media doesn't affect the cache
+  void invalidateMessages(
+      const std::vector<std::string> &messageIDs,
+      bool inTransaction) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->generation++;
+    for (const std::string &messageID : messageIDs) {
+      auto it = this->messageThreads.find(messageID);
+      if (it != this->messageThreads.end()) {
+        this->invalidate(std::string(it->second), inTransaction);
+      }
+    }
+  }
+
+  // A new ID may move a message that wasn't cached into a cached range of
+  // keys, and its thread isn't known, so that invalidates everything
+  void invalidateRekeyedMessages(
+      const std::vector<std::pair<std::string, std::string>> &ids,
+      bool inTransaction) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->generation++;
+    for (const auto &[from, to] : ids) {
+      if (!this->messageThreads.count(from)) {
+        this->clearEntries();
+        this->transactionInvalidatesAll =
+            this->transactionInvalidatesAll || inTransaction;
+        return;
+      }
+      this->invalidate(std::string(this->messageThreads[from]), inTransaction);
+      auto it = this->messageThreads.find(to);
+      if (it != this->messageThreads.end()) {
+        this->invalidate(std::string(it->second), inTransaction);
+      }
+    }
+  }
+
+  void invalidateAll(bool inTransaction) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->generation++;
+    this->clearEntries();
+    this->transactionInvalidatesAll =
+        this->transactionInvalidatesAll || inTransaction;
+  }
+
+  // Has to be called after the writer connection commits or rolls back
+  void endTransaction() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (!this->transactionInvalidatesAll && this->transactionThreads.empty()) {
+      return;
+    }
+    this->generation++;
+    if (this->transactionInvalidatesAll) {
+      this->clearEntries();
+    } else {
+      for (const std::string &threadID : this->transactionThreads) {
+        this->eraseEntry(threadID);
+      }
+    }
+    this->transactionThreads.clear();
+    this->transactionInvalidatesAll = false;
+  }
+
+  // Approximate size of the cached rows in bytes
+  size_t getSize() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->size;
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->generation++;
+    this->clearEntries();
+    this->transactionThreads.clear();
+    this->transactionInvalidatesAll = false;
+  }
+};
+
+} // namespace comm
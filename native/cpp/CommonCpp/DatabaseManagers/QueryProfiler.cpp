@@ -0,0 +1,73 @@
+#include "QueryProfiler.h"
+#include "Logger.h"
+
+#include <algorithm>
+#include <sstream>
+
+namespace comm {
+
+std::mutex QueryProfiler::mutex;
+std::unordered_map<std::string, QueryProfile> QueryProfiler::profiles;
+
+void QueryProfiler::record(
+    const std::string &query,
+    int64_t durationUs,
+    int64_t rows) {
+  if (durationUs >= QUERY_PROFILER_SLOW_QUERY_THRESHOLD_US) {
+    // Only the template is logged, bound values may contain user data
+    std::ostringstream slow_query_message;
+    slow_query_message << "Slow query (" << durationUs << "us, " << rows
+                       << " rows): " << query;
+    Logger::log(slow_query_message.str());
+  }
+
+  std::lock_guard<std::mutex> lock(QueryProfiler::mutex);
+  auto it = QueryProfiler::profiles.find(query);
+  if (it == QueryProfiler::profiles.end()) {
+    const std::string &key =
+        QueryProfiler::profiles.size() < QUERY_PROFILER_MAX_TEMPLATES
+        ? query
+        : QUERY_PROFILER_OTHER_TEMPLATE;
+    it = QueryProfiler::profiles.emplace(key, QueryProfile{key}).first;
+  }
+
+  QueryProfile &profile = it->second;
+  profile.count++;
+  profile.totalDurationUs += durationUs;
+  profile.maxDurationUs = std::max(profile.maxDurationUs, durationUs);
+  profile.rows += rows;
+  if (durationUs >= QUERY_PROFILER_SLOW_QUERY_THRESHOLD_US) {
+    profile.slowCount++;
+  }
+  size_t bucket = std::upper_bound(
+                      QUERY_PROFILER_BUCKETS_US.begin(),
+                      QUERY_PROFILER_BUCKETS_US.end(),
+                      durationUs) -
+      QUERY_PROFILER_BUCKETS_US.begin();
+  profile.histogram[bucket]++;
+}
+
+std::vector<QueryProfile> QueryProfiler::getSnapshot() {
+  std::vector<QueryProfile> snapshot;
+  {
+    std::lock_guard<std::mutex> lock(QueryProfiler::mutex);
+    snapshot.reserve(QueryProfiler::profiles.size());
+    for (const auto &it : QueryProfiler::profiles) {
+      snapshot.push_back(it.second);
+    }
+  }
+  std::sort(
+      snapshot.begin(),
+      snapshot.end(),
+      [](const QueryProfile &a, const QueryProfile &b) {
+        return a.totalDurationUs > b.totalDurationUs;
+      });
+  return snapshot;
+}
+
+void QueryProfiler::reset() {
+  std::lock_guard<std::mutex> lock(QueryProfiler::mutex);
+  QueryProfiler::profiles.clear();
+}
+
+} // namespace comm
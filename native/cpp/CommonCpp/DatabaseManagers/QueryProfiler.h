@@ -0,0 +1,45 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace comm {
+
+// Exclusive upper bounds (in microseconds) of latency histogram buckets. The
+// last bucket of QueryProfile::histogram counts queries slower than all of
+// them.
+const std::array<int64_t, 7> QUERY_PROFILER_BUCKETS_US{
+    {100, 1000, 5000, 10000, 50000, 100000, 500000}};
+const int64_t QUERY_PROFILER_SLOW_QUERY_THRESHOLD_US = 50000;
+// Statements are aggregated by their SQL with unbound parameters. Queries
+// built at runtime (e.g. IN lists) can produce an unbounded number of
+// templates, so anything past this limit is merged into a single entry.
+const size_t QUERY_PROFILER_MAX_TEMPLATES = 256;
+const std::string QUERY_PROFILER_OTHER_TEMPLATE = "<other>";
+
+struct QueryProfile {
+  std::string query;
+  uint64_t count;
+  uint64_t slowCount;
+  int64_t totalDurationUs;
+  int64_t maxDurationUs;
+  int64_t rows;
+  std::array<uint64_t, QUERY_PROFILER_BUCKETS_US.size() + 1> histogram;
+};
+
+class QueryProfiler {
+  static std::mutex mutex;
+  static std::unordered_map<std::string, QueryProfile> profiles;
+
+public:
+  static void
+  record(const std::string &query, int64_t durationUs, int64_t rows);
+  static std::vector<QueryProfile> getSnapshot();
+  static void reset();
+};
+
+} // namespace comm
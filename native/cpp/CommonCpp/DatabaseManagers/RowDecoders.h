@@ -0,0 +1,493 @@
+#pragma once
+
+#include "CancellationToken.h"
+#include "CompactStore.h"
+#include "ContentCompressor.h"
+#include "entities/Media.h"
+#include "entities/MediaCacheEntry.h"
+#include "entities/Message.h"
+#include "entities/OutboxEntry.h"
+#include "entities/Thread.h"
+#include "entities/ThreadMember.h"
+#include "entities/ThreadSummary.h"
+
+#include <sqlite3.h>
+
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace comm {
+
+class ColumnReader {
+public:
+  static void
+  readText(sqlite3_stmt *statement, int column, std::string &value) {
+    const unsigned char *text = sqlite3_column_text(statement, column);
+    if (text == nullptr) {
+      value.clear();
+      return;
+    }
+    // sqlite3_column_bytes has to be called after sqlite3_column_text, so
+    // that it returns the size of the UTF-8 text
+    value.assign(
+        reinterpret_cast<const char *>(text),
+        sqlite3_column_bytes(statement, column));
+  }
+
+  static void readText(
+      sqlite3_stmt *statement,
+      int column,
+      std::unique_ptr<std::string> &value) {
+    if (sqlite3_column_type(statement, column) == SQLITE_NULL) {
+      value.reset();
+      return;
+    }
+    if (value == nullptr) {
+      value = std::make_unique<std::string>();
+    }
+    ColumnReader::readText(statement, column, *value);
+  }
+
+  static void
+  readInt(sqlite3_stmt *statement, int column, std::unique_ptr<int> &value) {
+    if (sqlite3_column_type(statement, column) == SQLITE_NULL) {
+      value.reset();
+      return;
+    }
+    if (value == nullptr) {
+      value = std::make_unique<int>();
+    }
+    *value = sqlite3_column_int(statement, column);
+  }
+
+  static void readText(
+      sqlite3_stmt *statement,
+      int column,
+      std::optional<std::string> &value) {
+    if (sqlite3_column_type(statement, column) == SQLITE_NULL) {
+      value.reset();
+      return;
+    }
+    if (!value) {
+      value.emplace();
+    }
+    ColumnReader::readText(statement, column, *value);
+  }
+
+  static void
+  readInt(sqlite3_stmt *statement, int column, std::optional<int> &value) {
+    if (sqlite3_column_type(statement, column) == SQLITE_NULL) {
+      value.reset();
+      return;
+    }
+    value = sqlite3_column_int(statement, column);
+  }
+
+  // For the columns that ContentCompressor may have turned into a BLOB
+  static void
+  readContent(sqlite3_stmt *statement, int column, std::string &value) {
+    if (sqlite3_column_type(statement, column) != SQLITE_BLOB) {
+      ColumnReader::readText(statement, column, value);
+      return;
+    }
+    ContentCompressor::instance().decompress(
+        sqlite3_column_blob(statement, column),
+        sqlite3_column_bytes(statement, column),
+        value);
+  }
+
+  static void readContent(
+      sqlite3_stmt *statement,
+      int column,
+      std::unique_ptr<std::string> &value) {
+    if (sqlite3_column_type(statement, column) == SQLITE_NULL) {
+      value.reset();
+      return;
+    }
+    if (value == nullptr) {
+      value = std::make_unique<std::string>();
+    }
+    ColumnReader::readContent(statement, column, *value);
+  }
+
+  static void readContent(
+      sqlite3_stmt *statement,
+      int column,
+      std::optional<std::string> &value) {
+    if (sqlite3_column_type(statement, column) == SQLITE_NULL) {
+      value.reset();
+      return;
+    }
+    if (!value) {
+      value.emplace();
+    }
+    ColumnReader::readContent(statement, column, *value);
+  }
+
+  // Sets value to nullptr for NULL
+  static void readInterned(
+      sqlite3_stmt *statement,
+      int column,
+      StringPool &strings,
+      const std::string *&value) {
+    const unsigned char *text = sqlite3_column_text(statement, column);
+    if (text == nullptr) {
+      value = nullptr;
+      return;
+    }
+    value = strings.intern(
+        reinterpret_cast<const char *>(text),
+        sqlite3_column_bytes(statement, column));
+  }
+};
+
+/**
+ * Decodes rows of raw statements straight from sqlite3_column_* into entity
+ * fields, instead of through the tuples sqlite_orm builds for every row.
+ * columns lists the columns of the table in the order decode reads them,
+ * starting at the given index, so that it can be used in a SELECT. Decoding
+ * into an entity reuses the memory its fields already hold.
+ */
+template <typename T> struct RowDecoder;
+
+template <> struct RowDecoder<Message> {
+  static constexpr const char *columns =
+      "id, local_id, thread, user, type, future_type, content, time";
+  static constexpr int columnCount = 8;
+
+  static void decode(sqlite3_stmt *statement, int first, Message &message) {
+    ColumnReader::readText(statement, first, message.id);
+    ColumnReader::readText(statement, first + 1, message.local_id);
+    ColumnReader::readText(statement, first + 2, message.thread);
+    ColumnReader::readText(statement, first + 3, message.user);
+    message.type = sqlite3_column_int(statement, first + 4);
+    ColumnReader::readInt(statement, first + 5, message.future_type);
+    ColumnReader::readContent(statement, first + 6, message.content);
+    message.time = sqlite3_column_int64(statement, first + 7);
+  }
+};
+
+template <> struct RowDecoder<Media> {
+  static constexpr const char *columns =
+      "id, container, thread, uri, type, extras";
+  static constexpr int columnCount = 6;
+
+  static void decode(sqlite3_stmt *statement, int first, Media &media) {
+    ColumnReader::readText(statement, first, media.id);
+    ColumnReader::readText(statement, first + 1, media.container);
+    ColumnReader::readText(statement, first + 2, media.thread);
+    ColumnReader::readText(statement, first + 3, media.uri);
+    ColumnReader::readText(statement, first + 4, media.type);
+    ColumnReader::readContent(statement, first + 5, media.extras);
+  }
+};
+
+template <> struct RowDecoder<Thread> {
+  static constexpr const char *columns =
+      "id, type, name, description, color, creation_time, parent_thread_id, "
+      "containing_thread_id, community, members, roles, current_user, "
+      "source_message_id, replies_count";
+  static constexpr int columnCount = 14;
+
+  static void decode(sqlite3_stmt *statement, int first, Thread &thread) {
+    ColumnReader::readText(statement, first, thread.id);
+    thread.type = sqlite3_column_int(statement, first + 1);
+    ColumnReader::readText(statement, first + 2, thread.name);
+    ColumnReader::readText(statement, first + 3, thread.description);
+    ColumnReader::readText(statement, first + 4, thread.color);
+    thread.creation_time = sqlite3_column_int64(statement, first + 5);
+    ColumnReader::readText(statement, first + 6, thread.parent_thread_id);
+    ColumnReader::readText(statement, first + 7, thread.containing_thread_id);
+    ColumnReader::readText(statement, first + 8, thread.community);
+    ColumnReader::readText(statement, first + 9, thread.members);
+    ColumnReader::readText(statement, first + 10, thread.roles);
+    ColumnReader::readText(statement, first + 11, thread.current_user);
+    ColumnReader::readText(statement, first + 12, thread.source_message_id);
+    thread.replies_count = sqlite3_column_int(statement, first + 13);
+  }
+};
+
+template <> struct RowDecoder<ThreadMember> {
+  static constexpr const char *columns =
+      "thread_id, user_id, role, is_sender";
+  static constexpr int columnCount = 4;
+
+  static void
+  decode(sqlite3_stmt *statement, int first, ThreadMember &member) {
+    ColumnReader::readText(statement, first, member.thread_id);
+    ColumnReader::readText(statement, first + 1, member.user_id);
+    ColumnReader::readText(statement, first + 2, member.role);
+    member.is_sender = sqlite3_column_int(statement, first + 3);
+  }
+};
+
+template <> struct RowDecoder<ThreadSummary> {
+  static constexpr const char *columns =
+      "thread_id, message_count, last_message_id, last_message_time, "
+      "last_message_has_media";
+  static constexpr int columnCount = 5;
+
+  static void
+  decode(sqlite3_stmt *statement, int first, ThreadSummary &summary) {
+    ColumnReader::readText(statement, first, summary.thread_id);
+    summary.message_count = sqlite3_column_int(statement, first + 1);
+    ColumnReader::readText(statement, first + 2, summary.last_message_id);
+    summary.last_message_time = sqlite3_column_int64(statement, first + 3);
+    summary.last_message_has_media = sqlite3_column_int(statement, first + 4);
+  }
+};
+
+template <> struct RowDecoder<MediaCacheEntry> {
+  static constexpr const char *columns =
+      "media_id, local_path, size, last_accessed";
+  static constexpr int columnCount = 4;
+
+  static void
+  decode(sqlite3_stmt *statement, int first, MediaCacheEntry &entry) {
+    ColumnReader::readText(statement, first, entry.media_id);
+    ColumnReader::readText(statement, first + 1, entry.local_path);
+    entry.size = sqlite3_column_int64(statement, first + 2);
+    entry.last_accessed = sqlite3_column_int64(statement, first + 3);
+  }
+};
+
+template <> struct RowDecoder<OutboxEntry> {
+  static constexpr const char *columns =
+      "local_id, thread, target, payload, encryption_type, created_at";
+  static constexpr int columnCount = 6;
+
+  static void decode(sqlite3_stmt *statement, int first, OutboxEntry &entry) {
+    ColumnReader::readText(statement, first, entry.local_id);
+    ColumnReader::readText(statement, first + 1, entry.thread);
+    ColumnReader::readText(statement, first + 2, entry.target);
+    ColumnReader::readText(statement, first + 3, entry.payload);
+    entry.encryption_type =
+        sqlite3_column_type(statement, first + 4) == SQLITE_NULL
+        ? -1
+        : sqlite3_column_int(statement, first + 4);
+    entry.created_at = sqlite3_column_int64(statement, first + 5);
+  }
+};
+
+// Compact entities intern some of their columns in the pool of their store.
+// Thread summaries select empty strings in place of members and roles.
+template <> struct RowDecoder<CompactMedia> {
+  static constexpr const char *columns = "id, uri, type, extras";
+  static constexpr int columnCount = 4;
+
+  static void decode(sqlite3_stmt *statement, int first, CompactMedia &media) {
+    ColumnReader::readText(statement, first, media.id);
+    ColumnReader::readText(statement, first + 1, media.uri);
+    ColumnReader::readText(statement, first + 2, media.type);
+    ColumnReader::readContent(statement, first + 3, media.extras);
+  }
+};
+
+template <> struct RowDecoder<CompactMessage> {
+  static constexpr const char *columns = RowDecoder<Message>::columns;
+  static constexpr int columnCount = RowDecoder<Message>::columnCount;
+
+  static void decode(
+      sqlite3_stmt *statement,
+      int first,
+      CompactMessage &message,
+      StringPool &strings) {
+    ColumnReader::readText(statement, first, message.id);
+    ColumnReader::readText(statement, first + 1, message.local_id);
+    ColumnReader::readInterned(statement, first + 2, strings, message.thread);
+    ColumnReader::readInterned(statement, first + 3, strings, message.user);
+    message.type = sqlite3_column_int(statement, first + 4);
+    ColumnReader::readInt(statement, first + 5, message.future_type);
+    ColumnReader::readContent(statement, first + 6, message.content);
+    message.time = sqlite3_column_int64(statement, first + 7);
+  }
+};
+
+template <> struct RowDecoder<CompactThread> {
+  static constexpr const char *columns = RowDecoder<Thread>::columns;
+  static constexpr const char *summaryColumns =
+      "id, type, name, description, color, creation_time, parent_thread_id, "
+      "containing_thread_id, community, '', '', current_user, "
+      "source_message_id, replies_count";
+  static constexpr int columnCount = RowDecoder<Thread>::columnCount;
+
+  static void decode(
+      sqlite3_stmt *statement,
+      int first,
+      CompactThread &thread,
+      StringPool &strings) {
+    ColumnReader::readText(statement, first, thread.id);
+    thread.type = sqlite3_column_int(statement, first + 1);
+    ColumnReader::readText(statement, first + 2, thread.name);
+    ColumnReader::readText(statement, first + 3, thread.description);
+    ColumnReader::readText(statement, first + 4, thread.color);
+    thread.creation_time = sqlite3_column_int64(statement, first + 5);
+    ColumnReader::readInterned(
+        statement, first + 6, strings, thread.parent_thread_id);
+    ColumnReader::readInterned(
+        statement, first + 7, strings, thread.containing_thread_id);
+    ColumnReader::readInterned(statement, first + 8, strings, thread.community);
+    ColumnReader::readText(statement, first + 9, thread.members);
+    ColumnReader::readText(statement, first + 10, thread.roles);
+    ColumnReader::readText(statement, first + 11, thread.current_user);
+    ColumnReader::readText(statement, first + 12, thread.source_message_id);
+    thread.replies_count = sqlite3_column_int(statement, first + 13);
+  }
+};
+
+class ColumnBinder {
+public:
+  static void
+  bindText(sqlite3_stmt *statement, int index, const std::string &value) {
+    sqlite3_bind_text(
+        statement, index, value.c_str(), value.size(), SQLITE_TRANSIENT);
+  }
+
+  static void bindText(
+      sqlite3_stmt *statement,
+      int index,
+      const std::unique_ptr<std::string> &value) {
+    if (value == nullptr) {
+      sqlite3_bind_null(statement, index);
+      return;
+    }
+    ColumnBinder::bindText(statement, index, *value);
+  }
+
+  static void bindInt(
+      sqlite3_stmt *statement,
+      int index,
+      const std::unique_ptr<int> &value) {
+    if (value == nullptr) {
+      sqlite3_bind_null(statement, index);
+      return;
+    }
+    sqlite3_bind_int(statement, index, *value);
+  }
+
+  // Binds the compressed value as a BLOB if ContentCompressor compresses
+  // it, going through the given buffer
+  static void bindContent(
+      sqlite3_stmt *statement,
+      int index,
+      const std::string &value,
+      std::string &compressed) {
+    if (!ContentCompressor::instance().compress(value, compressed)) {
+      ColumnBinder::bindText(statement, index, value);
+      return;
+    }
+    sqlite3_bind_blob(
+        statement,
+        index,
+        compressed.data(),
+        compressed.size(),
+        SQLITE_TRANSIENT);
+  }
+};
+
+/**
+ * Binds entity fields to the parameters of a REPLACE of every column, the
+ * counterpart of RowDecoder for the tables whose content may be compressed.
+ * The parameters follow the order of RowDecoder<T>::columns.
+ */
+template <typename T> struct RowEncoder;
+
+template <> struct RowEncoder<Message> {
+  static constexpr const char *replace =
+      "REPLACE INTO messages (id, local_id, thread, user, type, future_type, "
+      "content, time) VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8);";
+
+  static void encode(
+      sqlite3_stmt *statement,
+      const Message &message,
+      std::string &compressed) {
+    ColumnBinder::bindText(statement, 1, message.id);
+    ColumnBinder::bindText(statement, 2, message.local_id);
+    ColumnBinder::bindText(statement, 3, message.thread);
+    ColumnBinder::bindText(statement, 4, message.user);
+    sqlite3_bind_int(statement, 5, message.type);
+    ColumnBinder::bindInt(statement, 6, message.future_type);
+    // The full-text index reads the content of text messages
+    if (message.content != nullptr && message.type != 0) {
+      ColumnBinder::bindContent(statement, 7, *message.content, compressed);
+    } else {
+      ColumnBinder::bindText(statement, 7, message.content);
+    }
+    sqlite3_bind_int64(statement, 8, message.time);
+  }
+};
+
+template <> struct RowEncoder<Media> {
+  static constexpr const char *replace =
+      "REPLACE INTO media (id, container, thread, uri, type, extras) "
+      "VALUES (?1, ?2, ?3, ?4, ?5, ?6);";
+
+  static void
+  encode(sqlite3_stmt *statement, const Media &media, std::string &compressed) {
+    ColumnBinder::bindText(statement, 1, media.id);
+    ColumnBinder::bindText(statement, 2, media.container);
+    ColumnBinder::bindText(statement, 3, media.thread);
+    ColumnBinder::bindText(statement, 4, media.uri);
+    ColumnBinder::bindText(statement, 5, media.type);
+    ColumnBinder::bindContent(statement, 6, media.extras, compressed);
+  }
+};
+
+// Steps through all rows of a statement, decoding each into an entity
+// constructed in place at the end of rows. Any further arguments, like the
+// string pool of compact entities, are passed on to the decoder. The
+// statement is reset afterwards, so that a cached one can be reused.
+template <typename T, typename... Context>
+void decodeRows(
+    sqlite3_stmt *statement,
+    std::vector<T> &rows,
+    Context &...context) {
+  int result_code;
+  try {
+    while ((result_code = sqlite3_step(statement)) == SQLITE_ROW) {
+      rows.emplace_back();
+      RowDecoder<T>::decode(statement, 0, rows.back(), context...);
+    }
+  } catch (...) {
+    // A value that can't be decompressed
+    sqlite3_reset(statement);
+    throw;
+  }
+  if (result_code != SQLITE_DONE) {
+    std::ostringstream error_message;
+    error_message << "Failed to decode rows: "
+                  << sqlite3_errmsg(sqlite3_db_handle(statement));
+    sqlite3_reset(statement);
+    // Interrupted by the progress handler
+    CancellationToken::throwIfCancelled();
+    throw std::system_error(
+        ECANCELED, std::generic_category(), error_message.str());
+  }
+  sqlite3_reset(statement);
+}
+
+// Decodes the rows of a statement for every key bound to its first
+// parameter in turn, like an IN list without a parameter per key
+template <typename T, typename... Context>
+void decodeRowsForKeys(
+    sqlite3_stmt *statement,
+    const std::vector<std::string> &keys,
+    std::vector<T> &rows,
+    Context &...context) {
+  for (const std::string &key : keys) {
+    sqlite3_bind_text(statement, 1, key.c_str(), key.size(), SQLITE_TRANSIENT);
+    try {
+      decodeRows(statement, rows, context...);
+    } catch (...) {
+      sqlite3_clear_bindings(statement);
+      throw;
+    }
+  }
+  sqlite3_clear_bindings(statement);
+}
+
+} // namespace comm
@@ -1,18 +1,42 @@
 #include "SQLiteQueryExecutor.h"
+#include "CancellationToken.h"
 #include "CommSecureStore.h"
+#include "ContentCompressor.h"
 #include "Logger.h"
+#include "QueryProfiler.h"
+#include "RowDecoders.h"
+#include "StartupTimeline.h"
+#include "ThreadHash.h"
 #include "sqlite_orm.h"
 
 #include "entities/Metadata.h"
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
 #ifdef __ANDROID__
-#include <fbjni/fbjni.h>
+#include "WorkerThread.h"
 #endif
 
 #define ACCOUNT_ID 1
+#define BULK_KEYS_MIN_COUNT 100
+// Past it, looking the changed rows up one by one costs more than reloading
+// the stores
+#define CHANGE_CAPTURE_CAPACITY 500
+#define CONTENT_COMPRESSION_BATCH_SIZE 256
+#define ENCRYPTION_CHUNK_SIZE 1000
+#define LOW_MEMORY_DEVICE_THRESHOLD (int64_t(3) * 1024 * 1024 * 1024)
+#define MAINTENANCE_VACUUM_STEP_PAGES 256
+#define MAINTENANCE_FTS_MERGE_PAGES 64
+#define MESSAGE_CACHE_CAPACITY (4 * 1024 * 1024)
 
 namespace comm {
 
@@ -24,6 +48,12 @@ std::once_flag SQLiteQueryExecutor::initialized;
 int SQLiteQueryExecutor::sqlcipherEncryptionKeySize = 64;
 std::string SQLiteQueryExecutor::secureStoreEncryptionKeyID =
     "comm.encryptionKey";
+StatementCache SQLiteQueryExecutor::statementCache;
+MessageCache SQLiteQueryExecutor::messageCache(MESSAGE_CACHE_CAPACITY);
+ChangeCapture SQLiteQueryExecutor::changeCapture(CHANGE_CAPTURE_CAPACITY);
+BackupLogRecorder SQLiteQueryExecutor::backupLogRecorder;
+std::unique_ptr<BackupSnapshot> SQLiteQueryExecutor::backupSnapshot;
+std::unique_ptr<BackupRestore> SQLiteQueryExecutor::backupRestore;
 
 bool create_table(sqlite3 *db, std::string query, std::string tableName) {
   char *error;
@@ -308,6 +338,481 @@ bool add_not_null_constraint_to_metadata(sqlite3 *db) {
   return false;
 }
 
+bool create_messages_fts(sqlite3 *db) {
+  // Only text messages (type 0) are indexed. The index keeps no copy of the
+  // text, it points to messages by rowid through the text_messages view.
+  std::string query =
+      "CREATE VIEW IF NOT EXISTS text_messages AS"
+      "  SELECT rowid AS message_rowid, content FROM messages WHERE type = 0;"
+
+      "CREATE VIRTUAL TABLE IF NOT EXISTS messages_fts USING fts5("
+      "	 content,"
+      "	 content = 'text_messages',"
+      "	 content_rowid = 'message_rowid',"
+      "	 tokenize = 'unicode61 remove_diacritics 2'"
+      ");"
+
+      "CREATE TRIGGER IF NOT EXISTS messages_fts_insert"
+      "  AFTER INSERT ON messages WHEN new.type = 0 BEGIN"
+      "	 INSERT INTO messages_fts (rowid, content)"
+      "	   VALUES (new.rowid, new.content);"
+      "END;"
+
+      "CREATE TRIGGER IF NOT EXISTS messages_fts_delete"
+      "  AFTER DELETE ON messages WHEN old.type = 0 BEGIN"
+      "	 INSERT INTO messages_fts (messages_fts, rowid, content)"
+      "	   VALUES ('delete', old.rowid, old.content);"
+      "END;"
+
+      "CREATE TRIGGER IF NOT EXISTS messages_fts_update"
+      "  AFTER UPDATE OF type, content ON messages BEGIN"
+      "	 INSERT INTO messages_fts (messages_fts, rowid, content)"
+      "	   SELECT 'delete', old.rowid, old.content WHERE old.type = 0;"
+      "	 INSERT INTO messages_fts (rowid, content)"
+      "	   SELECT new.rowid, new.content WHERE new.type = 0;"
+      "END;"
+
+      "INSERT INTO messages_fts (messages_fts) VALUES ('rebuild');";
+
+  char *error;
+  sqlite3_exec(db, query.c_str(), nullptr, nullptr, &error);
+  if (!error) {
+    return true;
+  }
+
+  std::ostringstream stringStream;
+  stringStream << "Error creating messages full-text search index: " << error;
+  Logger::log(stringStream.str());
+
+  sqlite3_free(error);
+  return false;
+}
+
+bool cascade_message_deletes_to_media(sqlite3 *db) {
+  // Messages are deleted by thread as often as by ID, and with the trigger
+  // their media goes with them in the same statement. Media left over from
+  // deletes before the trigger existed is removed once.
+  std::string query =
+      "CREATE INDEX IF NOT EXISTS media_idx_thread"
+      "  ON media (thread);"
+
+      "CREATE TRIGGER IF NOT EXISTS messages_media_delete"
+      "  AFTER DELETE ON messages BEGIN"
+      "	 DELETE FROM media WHERE container = old.id;"
+      "END;"
+
+      "DELETE FROM media WHERE container NOT IN (SELECT id FROM messages);";
+
+  char *error;
+  sqlite3_exec(db, query.c_str(), nullptr, nullptr, &error);
+  if (!error) {
+    return true;
+  }
+
+  std::ostringstream stringStream;
+  stringStream << "Error cascading message deletes to media: " << error;
+  Logger::log(stringStream.str());
+
+  sqlite3_free(error);
+  return false;
+}
+
+bool create_thread_members_table(sqlite3 *db) {
+  // Mirrors the members JSON of threads, so that membership can be looked up
+  // without parsing it. The triggers keep it on every write of threads,
+  // including REPLACE, which doesn't fire the delete trigger, and updates of
+  // single JSON fields. Threads that already exist are mirrored once.
+  std::string mirror_members =
+      "	 DELETE FROM thread_members WHERE thread_id = new.id;"
+      "	 INSERT OR REPLACE INTO thread_members"
+      "	   (thread_id, user_id, role, is_sender)"
+      "	   SELECT new.id, json_extract(value, '$.id'),"
+      "	     json_extract(value, '$.role'),"
+      "	     coalesce(json_extract(value, '$.isSender'), 0)"
+      "	   FROM json_each(CASE WHEN json_valid(new.members)"
+      "	     THEN new.members ELSE '[]' END)"
+      "	   WHERE type = 'object' AND json_extract(value, '$.id') IS NOT NULL;";
+  std::string query =
+      "CREATE TABLE IF NOT EXISTS thread_members ("
+      "	 thread_id TEXT NOT NULL,"
+      "	 user_id TEXT NOT NULL,"
+      "	 role TEXT,"
+      "	 is_sender INTEGER NOT NULL,"
+      "	 PRIMARY KEY (thread_id, user_id)"
+      ") WITHOUT ROWID;"
+
+      "CREATE INDEX IF NOT EXISTS thread_members_idx_user"
+      "  ON thread_members (user_id);"
+
+      "CREATE TRIGGER IF NOT EXISTS thread_members_insert"
+      "  AFTER INSERT ON threads BEGIN" +
+      mirror_members +
+      "END;"
+
+      "CREATE TRIGGER IF NOT EXISTS thread_members_update"
+      "  AFTER UPDATE OF id, members ON threads BEGIN"
+      "	 DELETE FROM thread_members WHERE thread_id = old.id;" +
+      mirror_members +
+      "END;"
+
+      "CREATE TRIGGER IF NOT EXISTS thread_members_delete"
+      "  AFTER DELETE ON threads BEGIN"
+      "	 DELETE FROM thread_members WHERE thread_id = old.id;"
+      "END;"
+
+      "DELETE FROM thread_members;"
+      "INSERT OR IGNORE INTO thread_members"
+      "  (thread_id, user_id, role, is_sender)"
+      "  SELECT threads.id, json_extract(member.value, '$.id'),"
+      "    json_extract(member.value, '$.role'),"
+      "    coalesce(json_extract(member.value, '$.isSender'), 0)"
+      "  FROM threads, json_each(CASE WHEN json_valid(threads.members)"
+      "    THEN threads.members ELSE '[]' END) AS member"
+      "  WHERE member.type = 'object'"
+      "    AND json_extract(member.value, '$.id') IS NOT NULL;";
+
+  char *error;
+  sqlite3_exec(db, query.c_str(), nullptr, nullptr, &error);
+  if (!error) {
+    return true;
+  }
+
+  std::ostringstream stringStream;
+  stringStream << "Error creating thread members table: " << error;
+  Logger::log(stringStream.str());
+
+  sqlite3_free(error);
+  return false;
+}
+
+bool create_thread_summary_table(sqlite3 *db) {
+  // Aggregates the messages of every thread for the chat list, so that it
+  // doesn't have to read them. The triggers keep it on every write of
+  // messages and media, in the statement that makes the write. Rows that
+  // REPLACE overwrites go through the delete triggers, as recursive triggers
+  // are on. The latest message is looked up again by messages_idx_thread_time
+  // only when it may have been removed.
+  auto find_latest = [](const std::string &condition) {
+    return "	 UPDATE thread_summary SET (last_message_id, last_message_time,"
+           "	   last_message_has_media) = ("
+           "	   SELECT m.id, m.time,"
+           "	     EXISTS (SELECT 1 FROM media WHERE container = m.id)"
+           "	   FROM messages AS m WHERE m.thread = thread_summary.thread_id"
+           "	   ORDER BY m.time DESC, m.id DESC LIMIT 1)"
+           "	 WHERE " +
+        condition + ";";
+  };
+  auto find_media = [](const std::string &condition) {
+    return "	 UPDATE thread_summary SET last_message_has_media = EXISTS ("
+           "	   SELECT 1 FROM media"
+           "	   WHERE container = thread_summary.last_message_id)"
+           "	 WHERE " +
+        condition + ";";
+  };
+  // A conflict clause in a trigger is replaced by the one of the statement
+  // that fires it, REPLACE, so the summary is only created if missing
+  auto add_message = [](const std::string &thread) {
+    return "	 INSERT INTO thread_summary (thread_id, message_count)"
+           "	   SELECT " +
+        thread +
+        ", 0 WHERE NOT EXISTS ("
+        "	     SELECT 1 FROM thread_summary WHERE thread_id = " +
+        thread +
+        ");"
+        "	 UPDATE thread_summary SET message_count = message_count + 1"
+        "	   WHERE thread_id = " +
+        thread + ";";
+  };
+  auto remove_message = [](const std::string &thread) {
+    return "	 UPDATE thread_summary SET message_count = message_count - 1"
+           "	   WHERE thread_id = " +
+        thread +
+        ";"
+        "	 DELETE FROM thread_summary"
+        "	   WHERE thread_id = " +
+        thread + " AND message_count <= 0;";
+  };
+  const std::string removed_media =
+      "thread_id = old.thread AND last_message_id = old.container";
+  const std::string added_media =
+      "thread_id = new.thread AND last_message_id = new.container";
+
+  std::string query =
+      "CREATE TABLE IF NOT EXISTS thread_summary ("
+      "	 thread_id TEXT PRIMARY KEY NOT NULL,"
+      "	 message_count INTEGER NOT NULL,"
+      "	 last_message_id TEXT,"
+      "	 last_message_time INTEGER,"
+      "	 last_message_has_media INTEGER"
+      ") WITHOUT ROWID;"
+
+      "CREATE INDEX IF NOT EXISTS thread_summary_idx_last_message_time"
+      "  ON thread_summary (last_message_time);"
+
+      "CREATE TRIGGER IF NOT EXISTS thread_summary_message_insert"
+      "  AFTER INSERT ON messages BEGIN" +
+      add_message("new.thread") +
+      "	 UPDATE thread_summary SET last_message_id = new.id,"
+      "	   last_message_time = new.time,"
+      "	   last_message_has_media ="
+      "	     EXISTS (SELECT 1 FROM media WHERE container = new.id)"
+      "	   WHERE thread_id = new.thread AND (last_message_id IS NULL"
+      "	     OR (new.time, new.id) > (last_message_time, last_message_id));"
+      "END;"
+
+      "CREATE TRIGGER IF NOT EXISTS thread_summary_message_update"
+      "  AFTER UPDATE OF id, thread, time ON messages BEGIN" +
+      remove_message("old.thread") + add_message("new.thread") +
+      find_latest("thread_id IN (old.thread, new.thread)") +
+      "END;"
+
+      "CREATE TRIGGER IF NOT EXISTS thread_summary_message_delete"
+      "  AFTER DELETE ON messages BEGIN" +
+      remove_message("old.thread") +
+      find_latest("thread_id = old.thread AND last_message_id = old.id") +
+      "END;"
+
+      "CREATE TRIGGER IF NOT EXISTS thread_summary_media_insert"
+      "  AFTER INSERT ON media BEGIN"
+      "	 UPDATE thread_summary SET last_message_has_media = 1 WHERE " +
+      added_media +
+      ";"
+      "END;"
+
+      "CREATE TRIGGER IF NOT EXISTS thread_summary_media_update"
+      "  AFTER UPDATE OF container, thread ON media BEGIN" +
+      find_media(removed_media) + find_media(added_media) +
+      "END;"
+
+      "CREATE TRIGGER IF NOT EXISTS thread_summary_media_delete"
+      "  AFTER DELETE ON media BEGIN" +
+      find_media(removed_media) +
+      "END;"
+
+      "DELETE FROM thread_summary;"
+      "INSERT INTO thread_summary (thread_id, message_count)"
+      "  SELECT thread, count(*) FROM messages GROUP BY thread;" +
+      find_latest("1");
+
+  char *error;
+  sqlite3_exec(db, query.c_str(), nullptr, nullptr, &error);
+  if (!error) {
+    return true;
+  }
+
+  std::ostringstream stringStream;
+  stringStream << "Error creating thread summary table: " << error;
+  Logger::log(stringStream.str());
+
+  sqlite3_free(error);
+  return false;
+}
+
+bool create_thread_hashes_table(sqlite3 *db) {
+  // Hashes of the threads written by replaceThreadIfChanged. Any other
+  // write of a thread drops its hash, REPLACE included since recursive
+  // triggers are on, so a stored hash always matches its row.
+  std::string query =
+      "CREATE TABLE IF NOT EXISTS thread_hashes ("
+      "	 thread_id TEXT PRIMARY KEY NOT NULL,"
+      "	 hash INTEGER NOT NULL"
+      ") WITHOUT ROWID;"
+
+      "CREATE TRIGGER IF NOT EXISTS thread_hashes_thread_update"
+      "  AFTER UPDATE ON threads BEGIN"
+      "	 DELETE FROM thread_hashes WHERE thread_id = old.id;"
+      "END;"
+
+      "CREATE TRIGGER IF NOT EXISTS thread_hashes_thread_delete"
+      "  AFTER DELETE ON threads BEGIN"
+      "	 DELETE FROM thread_hashes WHERE thread_id = old.id;"
+      "END;";
+
+  char *error;
+  sqlite3_exec(db, query.c_str(), nullptr, nullptr, &error);
+  if (!error) {
+    return true;
+  }
+
+  std::ostringstream stringStream;
+  stringStream << "Error creating thread hashes table: " << error;
+  Logger::log(stringStream.str());
+
+  sqlite3_free(error);
+  return false;
+}
+
+bool create_archived_messages_table(sqlite3 *db) {
+  // Messages moved out of messages by archiveMessages, so that the table
+  // startup reads and most writes go through stays small. Writing a message
+  // again brings it back, along with its media. Archived messages keep their
+  // media and stay searchable through an index of their own, and their
+  // summaries are updated when they are removed.
+  std::string query =
+      "CREATE TABLE IF NOT EXISTS archived_messages ("
+      "	 id TEXT UNIQUE PRIMARY KEY NOT NULL,"
+      "	 local_id TEXT,"
+      "	 thread TEXT NOT NULL,"
+      "	 user TEXT NOT NULL,"
+      "	 type INTEGER NOT NULL,"
+      "	 future_type INTEGER,"
+      "	 content TEXT,"
+      "	 time INTEGER NOT NULL"
+      ");"
+
+      "CREATE INDEX IF NOT EXISTS archived_messages_idx_thread_time"
+      "  ON archived_messages (thread, time);"
+
+      "CREATE VIEW IF NOT EXISTS all_messages AS"
+      "  SELECT id, local_id, thread, user, type, future_type, content, time"
+      "    FROM messages"
+      "  UNION ALL"
+      "  SELECT id, local_id, thread, user, type, future_type, content, time"
+      "    FROM archived_messages;"
+
+      "CREATE TRIGGER IF NOT EXISTS archived_messages_unarchive"
+      "  AFTER INSERT ON messages BEGIN"
+      "	 DELETE FROM archived_messages WHERE id = new.id;"
+      "END;"
+
+      // A message brought back is already in messages when its archived row
+      // is deleted, and keeps its media
+      "CREATE TRIGGER IF NOT EXISTS archived_messages_media_delete"
+      "  AFTER DELETE ON archived_messages"
+      "  WHEN NOT EXISTS (SELECT 1 FROM messages WHERE id = old.id) BEGIN"
+      "	 DELETE FROM media WHERE container = old.id;"
+      "END;"
+
+      // The latest message is looked up in both tables, each by its own
+      // (thread, time) index
+      "CREATE TRIGGER IF NOT EXISTS archived_messages_summary_delete"
+      "  AFTER DELETE ON archived_messages BEGIN"
+      "	 UPDATE thread_summary SET message_count = message_count - 1"
+      "	   WHERE thread_id = old.thread;"
+      "	 DELETE FROM thread_summary"
+      "	   WHERE thread_id = old.thread AND message_count <= 0;"
+      "	 UPDATE thread_summary SET (last_message_id, last_message_time,"
+      "	   last_message_has_media) = ("
+      "	   SELECT m.id, m.time,"
+      "	     EXISTS (SELECT 1 FROM media WHERE container = m.id)"
+      "	   FROM (SELECT * FROM (SELECT id, time FROM messages"
+      "	       WHERE thread = old.thread ORDER BY time DESC, id DESC LIMIT 1)"
+      "	     UNION ALL"
+      "	     SELECT * FROM (SELECT id, time FROM archived_messages"
+      "	       WHERE thread = old.thread ORDER BY time DESC, id DESC LIMIT 1))"
+      "	     AS m"
+      "	   ORDER BY m.time DESC, m.id DESC LIMIT 1)"
+      "	 WHERE thread_id = old.thread AND last_message_id = old.id;"
+      "END;"
+
+      // Like messages_fts, for the rows of archived_messages
+      "CREATE VIEW IF NOT EXISTS archived_text_messages AS"
+      "  SELECT rowid AS message_rowid, content FROM archived_messages"
+      "    WHERE type = 0;"
+
+      "CREATE VIRTUAL TABLE IF NOT EXISTS archived_messages_fts USING fts5("
+      "	 content,"
+      "	 content = 'archived_text_messages',"
+      "	 content_rowid = 'message_rowid',"
+      "	 tokenize = 'unicode61 remove_diacritics 2'"
+      ");"
+
+      "CREATE TRIGGER IF NOT EXISTS archived_messages_fts_insert"
+      "  AFTER INSERT ON archived_messages WHEN new.type = 0 BEGIN"
+      "	 INSERT INTO archived_messages_fts (rowid, content)"
+      "	   VALUES (new.rowid, new.content);"
+      "END;"
+
+      "CREATE TRIGGER IF NOT EXISTS archived_messages_fts_delete"
+      "  AFTER DELETE ON archived_messages WHEN old.type = 0 BEGIN"
+      "	 INSERT INTO archived_messages_fts (archived_messages_fts, rowid,"
+      "	   content) VALUES ('delete', old.rowid, old.content);"
+      "END;"
+
+      "CREATE TRIGGER IF NOT EXISTS archived_messages_fts_update"
+      "  AFTER UPDATE OF type, content ON archived_messages BEGIN"
+      "	 INSERT INTO archived_messages_fts (archived_messages_fts, rowid,"
+      "	   content) SELECT 'delete', old.rowid, old.content"
+      "	   WHERE old.type = 0;"
+      "	 INSERT INTO archived_messages_fts (rowid, content)"
+      "	   SELECT new.rowid, new.content WHERE new.type = 0;"
+      "END;";
+
+  char *error;
+  sqlite3_exec(db, query.c_str(), nullptr, nullptr, &error);
+  if (!error) {
+    return true;
+  }
+
+  std::ostringstream stringStream;
+  stringStream << "Error creating archived messages table: " << error;
+  Logger::log(stringStream.str());
+
+  sqlite3_free(error);
+  return false;
+}
+
+bool create_media_cache_table(sqlite3 *db) {
+  // Local files of media, accounted for so that the cache can be kept under
+  // a budget. Entries outlive their media, whose files still have to be
+  // deleted. last_accessed is indexed for the least recently used first.
+  std::string query =
+      "CREATE TABLE IF NOT EXISTS media_cache ("
+      "	 media_id TEXT PRIMARY KEY NOT NULL,"
+      "	 local_path TEXT NOT NULL,"
+      "	 size INTEGER NOT NULL,"
+      "	 last_accessed INTEGER NOT NULL"
+      ") WITHOUT ROWID;"
+
+      "CREATE INDEX IF NOT EXISTS media_cache_idx_last_accessed"
+      "  ON media_cache (last_accessed, media_id);";
+
+  char *error;
+  sqlite3_exec(db, query.c_str(), nullptr, nullptr, &error);
+  if (!error) {
+    return true;
+  }
+
+  std::ostringstream stringStream;
+  stringStream << "Error creating media cache table: " << error;
+  Logger::log(stringStream.str());
+
+  sqlite3_free(error);
+  return false;
+}
+
+bool create_outbox_table(sqlite3 *db) {
+  // Messages sent while offline or waiting for their acknowledgement, in the
+  // order they were sent. Entries taken by a dispatch are in flight until
+  // they are acknowledged or requeued.
+  std::string query =
+      "CREATE TABLE IF NOT EXISTS outbox ("
+      "	 local_id TEXT PRIMARY KEY NOT NULL,"
+      "	 thread TEXT NOT NULL,"
+      "	 target TEXT,"
+      "	 payload TEXT NOT NULL,"
+      "	 encryption_type INTEGER,"
+      "	 in_flight INTEGER NOT NULL DEFAULT 0,"
+      "	 created_at INTEGER NOT NULL"
+      ") WITHOUT ROWID;"
+
+      "CREATE INDEX IF NOT EXISTS outbox_idx_in_flight_created_at"
+      "  ON outbox (in_flight, created_at, local_id);";
+
+  char *error;
+  sqlite3_exec(db, query.c_str(), nullptr, nullptr, &error);
+  if (!error) {
+    return true;
+  }
+
+  std::ostringstream stringStream;
+  stringStream << "Error creating outbox table: " << error;
+  Logger::log(stringStream.str());
+
+  sqlite3_free(error);
+  return false;
+}
+
 bool create_schema(sqlite3 *db) {
   char *error;
   sqlite3_exec(
@@ -372,14 +877,25 @@ bool create_schema(sqlite3 *db) {
       "CREATE INDEX IF NOT EXISTS media_idx_container"
       "  ON media (container);"
 
+      "CREATE INDEX IF NOT EXISTS media_idx_thread"
+      "  ON media (thread);"
+
       "CREATE INDEX IF NOT EXISTS messages_idx_thread_time"
-      "  ON messages (thread, time);",
+      "  ON messages (thread, time);"
+
+      "CREATE TRIGGER IF NOT EXISTS messages_media_delete"
+      "  AFTER DELETE ON messages BEGIN"
+      "	 DELETE FROM media WHERE container = old.id;"
+      "END;",
       nullptr,
       nullptr,
       &error);
 
   if (!error) {
-    return true;
+    return create_messages_fts(db) && create_thread_members_table(db) &&
+        create_thread_summary_table(db) && create_thread_hashes_table(db) &&
+        create_archived_messages_table(db) && create_media_cache_table(db) &&
+        create_outbox_table(db);
   }
 
   std::ostringstream stringStream;
@@ -390,22 +906,68 @@ bool create_schema(sqlite3 *db) {
   return false;
 }
 
-void set_encryption_key(sqlite3 *db) {
-  std::string set_encryption_key_query =
-      "PRAGMA key = \"x'" + SQLiteQueryExecutor::encryptionKey + "'\";";
+struct CipherProfile {
+  std::string name;
+  // The page size and the HMAC algorithm are part of the file format, so a
+  // database can only be read with the ones it was created with
+  int page_size;
+  std::string hmac_algorithm;
+  // Wipes memory freed by SQLCipher, for every connection of the process
+  bool memory_security;
+};
+
+// The first profile holds the defaults of SQLCipher 4.4, which every
+// database created before the profiles were introduced uses. Larger pages
+// take fewer HMAC checks and decryptions per row read, and HMAC_SHA256 is
+// cheaper than HMAC_SHA512 on mobile CPUs.
+const std::vector<CipherProfile> CIPHER_PROFILES{
+    {"sqlcipher_default", 4096, "HMAC_SHA512", true},
+    {"sha256", 4096, "HMAC_SHA256", false},
+    {"sha256_large_pages", 16384, "HMAC_SHA256", false}};
+
+// Set by setCipherProfile before the database is opened
+std::atomic<const CipherProfile *> cipher_profile{&CIPHER_PROFILES[0]};
+
+const CipherProfile &get_cipher_profile() {
+  return *cipher_profile.load();
+}
+
+void set_encryption_key(
+    sqlite3 *db,
+    const std::string &encryptionKey,
+    const CipherProfile &profile) {
+  // The cipher settings only take effect before the first page is read
+  std::stringstream set_encryption_key_query;
+  set_encryption_key_query << "PRAGMA key = \"x'" << encryptionKey << "'\";"
+                           << "PRAGMA cipher_page_size = " << profile.page_size
+                           << ";"
+                           << "PRAGMA cipher_hmac_algorithm = "
+                           << profile.hmac_algorithm << ";"
+                           << "PRAGMA cipher_memory_security = "
+                           << (profile.memory_security ? "ON" : "OFF") << ";";
 
   char *error_set_key;
   sqlite3_exec(
-      db, set_encryption_key_query.c_str(), nullptr, nullptr, &error_set_key);
+      db,
+      set_encryption_key_query.str().c_str(),
+      nullptr,
+      nullptr,
+      &error_set_key);
 
   if (error_set_key) {
     std::ostringstream error_message;
     error_message << "Failed to set encryption key: " << error_set_key;
+    sqlite3_free(error_set_key);
     throw std::system_error(
         ECANCELED, std::generic_category(), error_message.str());
   }
 }
 
+void set_encryption_key(sqlite3 *db) {
+  set_encryption_key(
+      db, SQLiteQueryExecutor::encryptionKey, get_cipher_profile());
+}
+
 int get_database_version(sqlite3 *db) {
   sqlite3_stmt *user_version_stmt;
   sqlite3_prepare_v2(
@@ -438,16 +1000,34 @@ bool set_database_version(sqlite3 *db, int db_version) {
   return false;
 }
 
+// Rows returned so far by statements that are still being stepped on this
+// thread
+thread_local std::unordered_map<sqlite3_stmt *, int64_t> traced_rows;
+
 void trace_queries(sqlite3 *db) {
   int error_code = sqlite3_trace_v2(
       db,
-      SQLITE_TRACE_PROFILE,
-      [](unsigned, void *, void *preparedStatement, void *) {
+      SQLITE_TRACE_PROFILE | SQLITE_TRACE_ROW,
+      [](unsigned type, void *, void *preparedStatement, void *duration) {
         sqlite3_stmt *statement = (sqlite3_stmt *)preparedStatement;
-        char *sql = sqlite3_expanded_sql(statement);
+        if (type == SQLITE_TRACE_ROW) {
+          traced_rows[statement]++;
+          return 0;
+        }
+
+        int64_t rows = 0;
+        auto it = traced_rows.find(statement);
+        if (it != traced_rows.end()) {
+          rows = it->second;
+          traced_rows.erase(it);
+        }
+        if (!sqlite3_stmt_readonly(statement)) {
+          rows += sqlite3_changes(sqlite3_db_handle(statement));
+        }
+        const char *sql = sqlite3_sql(statement);
         if (sql != nullptr) {
-          std::string sqlStr(sql);
-          // TODO: send logs to backup here
+          int64_t durationNs = *(sqlite3_int64 *)duration;
+          QueryProfiler::record(sql, durationNs / 1000, rows);
         }
         return 0;
       },
@@ -460,9 +1040,160 @@ void trace_queries(sqlite3 *db) {
   }
 }
 
+struct PerformanceProfile {
+  std::string name;
+  int64_t mmap_size;
+  // Negative values are in KiB, as in PRAGMA cache_size
+  int cache_size;
+  int wal_autocheckpoint;
+};
+
+const PerformanceProfile &get_performance_profile() {
+  static const PerformanceProfile profile = []() {
+    int64_t physical_memory =
+        int64_t(sysconf(_SC_PHYS_PAGES)) * sysconf(_SC_PAGE_SIZE);
+    bool low_memory_device =
+        physical_memory > 0 && physical_memory < LOW_MEMORY_DEVICE_THRESHOLD;
+#ifdef __ANDROID__
+    if (low_memory_device) {
+      return PerformanceProfile{"android_low_memory", 0, -2000, 1000};
+    }
+    return PerformanceProfile{"android", 64 * 1024 * 1024, -8000, 1000};
+#else
+    if (low_memory_device) {
+      return PerformanceProfile{
+          "ios_low_memory", 32 * 1024 * 1024, -4000, 1000};
+    }
+    return PerformanceProfile{"ios", 128 * 1024 * 1024, -16000, 2000};
+#endif
+  }();
+  return profile;
+}
+
+void apply_performance_profile(sqlite3 *db) {
+  const PerformanceProfile &profile = get_performance_profile();
+  sqlite3_stmt *journal_mode_stmt;
+  sqlite3_prepare_v2(
+      db, "PRAGMA journal_mode;", -1, &journal_mode_stmt, nullptr);
+  bool write_ahead_enabled = sqlite3_step(journal_mode_stmt) == SQLITE_ROW &&
+      std::string(reinterpret_cast<const char *>(
+          sqlite3_column_text(journal_mode_stmt, 0))) == "wal";
+  sqlite3_finalize(journal_mode_stmt);
+
+  std::stringstream profile_query;
+  profile_query << "PRAGMA mmap_size = " << profile.mmap_size << ";"
+                << "PRAGMA cache_size = " << profile.cache_size << ";"
+                << "PRAGMA temp_store = MEMORY;"
+                << "PRAGMA wal_autocheckpoint = " << profile.wal_autocheckpoint
+                << ";";
+  // NORMAL is durable only in WAL mode, where a crash can lose the most
+  // recent transactions but never corrupts the database
+  if (write_ahead_enabled) {
+    profile_query << "PRAGMA synchronous = NORMAL;";
+  }
+
+  char *error;
+  sqlite3_exec(db, profile_query.str().c_str(), nullptr, nullptr, &error);
+  if (error) {
+    std::ostringstream error_message;
+    error_message << "Failed to apply performance profile '" << profile.name
+                  << "': " << error;
+    Logger::log(error_message.str());
+    sqlite3_free(error);
+  }
+}
+
+void record_performance_profile(sqlite3 *db) {
+  // SQLite silently ignores or caps unsupported values (e.g. SQLCipher
+  // disables memory-mapped I/O for encrypted databases), so the values
+  // are read back rather than copied from the profile
+  std::stringstream effective_profile;
+  effective_profile << "{\"profile\":\"" << get_performance_profile().name
+                    << "\",\"cipher_profile\":\"" << get_cipher_profile().name
+                    << "\"";
+  for (const char *pragma :
+       {"journal_mode",
+        "synchronous",
+        "mmap_size",
+        "cache_size",
+        "temp_store",
+        "wal_autocheckpoint",
+        "cipher_page_size",
+        "cipher_hmac_algorithm",
+        "cipher_memory_security"}) {
+    sqlite3_stmt *pragma_stmt;
+    std::string pragma_query = std::string("PRAGMA ") + pragma + ";";
+    sqlite3_prepare_v2(db, pragma_query.c_str(), -1, &pragma_stmt, nullptr);
+    const char *value = nullptr;
+    if (sqlite3_step(pragma_stmt) == SQLITE_ROW) {
+      value = reinterpret_cast<const char *>(
+          sqlite3_column_text(pragma_stmt, 0));
+    }
+    effective_profile << ",\"" << pragma << "\":\""
+                      << (value ? value : "") << "\"";
+    sqlite3_finalize(pragma_stmt);
+  }
+  effective_profile << "}";
+
+  sqlite3_stmt *replace_stmt;
+  sqlite3_prepare_v2(
+      db,
+      "REPLACE INTO metadata (name, data) "
+      "VALUES ('performance_profile', ?);",
+      -1,
+      &replace_stmt,
+      nullptr);
+  std::string effective_profile_str = effective_profile.str();
+  sqlite3_bind_text(
+      replace_stmt,
+      1,
+      effective_profile_str.c_str(),
+      effective_profile_str.size(),
+      SQLITE_TRANSIENT);
+  if (sqlite3_step(replace_stmt) != SQLITE_DONE) {
+    std::ostringstream error_message;
+    error_message << "Failed to record performance profile: "
+                  << sqlite3_errmsg(db);
+    Logger::log(error_message.str());
+  }
+  sqlite3_finalize(replace_stmt);
+}
+
+// Number of virtual machine instructions between checks of the
+// cancellation token, a thread-local load
+const int CANCELLATION_CHECK_INSTRUCTIONS = 1000;
+// Entries selected, and deleted in a transaction, at a time by
+// evictMediaCache
+const int MEDIA_CACHE_EVICTION_BATCH_SIZE = 64;
+
+int interrupt_if_cancelled(void *) {
+  return CancellationToken::isCurrentCancelled();
+}
+
+// A cancelled task stops in the middle of its query, e.g. while a large
+// table is sorted, whose step then returns SQLITE_INTERRUPT
+void interrupt_cancelled_queries(sqlite3 *db) {
+  sqlite3_progress_handler(
+      db, CANCELLATION_CHECK_INSTRUCTIONS, interrupt_if_cancelled, nullptr);
+}
+
 void on_database_open(sqlite3 *db) {
   set_encryption_key(db);
+  // REPLACE removes conflicting rows without firing delete triggers unless
+  // recursive triggers are on, which would leave stale full-text entries
+  sqlite3_exec(
+      db, "PRAGMA recursive_triggers = ON;", nullptr, nullptr, nullptr);
+  apply_performance_profile(db);
+  trace_queries(db);
+  interrupt_cancelled_queries(db);
+}
+
+void on_read_only_database_open(sqlite3 *db) {
+  set_encryption_key(db);
+  sqlite3_exec(db, "PRAGMA query_only = ON;", nullptr, nullptr, nullptr);
+  apply_performance_profile(db);
   trace_queries(db);
+  interrupt_cancelled_queries(db);
 }
 
 bool file_exists(const std::string &file_path) {
@@ -487,43 +1218,864 @@ void attempt_rename_file(
   }
 }
 
-bool is_database_queryable(sqlite3 *db, bool use_encryption_key) {
+bool is_database_queryable(sqlite3 *db) {
   char *err_msg;
-  sqlite3_open(SQLiteQueryExecutor::sqliteFilePath.c_str(), &db);
   // According to SQLCipher documentation running some SELECT is the only way to
   // check for key validity
-  if (use_encryption_key) {
-    set_encryption_key(db);
-  }
   sqlite3_exec(
       db, "SELECT COUNT(*) FROM sqlite_master;", nullptr, nullptr, &err_msg);
+  if (!err_msg) {
+    return true;
+  }
+  sqlite3_free(err_msg);
+  return false;
+}
+
+bool is_database_queryable_without_key() {
+  sqlite3 *db;
+  sqlite3_open(SQLiteQueryExecutor::sqliteFilePath.c_str(), &db);
+  bool queryable = is_database_queryable(db);
   sqlite3_close(db);
-  return !err_msg;
+  return queryable;
 }
 
-void run_with_native_accessible(std::function<void()> &&task) {
-  // Some methods of SQLiteQueryExecutor are meant to be executed on
-  // auxiliary threads. In case they require access to native Java
-  // API we need to temporarily attach the thread to JVM
-  // This function attaches thread to JVM for the time
-  // lambda passed to this function will be executing.
-#ifdef __ANDROID__
-  facebook::jni::ThreadScope::WithClassLoader(std::move(task));
-#else
-  task();
-#endif
+// Returns nullptr if the database can't be read with the key and the cipher
+// settings of the profile
+sqlite3 *open_readable_database(
+    const std::string &path,
+    const std::string &encryptionKey,
+    const CipherProfile &profile) {
+  sqlite3 *db;
+  if (sqlite3_open(path.c_str(), &db) != SQLITE_OK) {
+    sqlite3_close(db);
+    return nullptr;
+  }
+  try {
+    set_encryption_key(db, encryptionKey, profile);
+  } catch (const std::system_error &) {
+    sqlite3_close(db);
+    return nullptr;
+  }
+  if (!is_database_queryable(db)) {
+    sqlite3_close(db);
+    return nullptr;
+  }
+  return db;
 }
 
-void validate_encryption() {
-  std::string temp_encrypted_db_path =
-      SQLiteQueryExecutor::sqliteFilePath + "_temp_encrypted";
+// Tries the current cipher profile first. A connection that failed to read
+// the database can't be given other settings, so each try opens its own.
+sqlite3 *open_with_any_cipher_profile(
+    const std::string &path,
+    const std::string &encryptionKey,
+    const CipherProfile *&profileFound) {
+  const CipherProfile &current_profile = get_cipher_profile();
+  sqlite3 *db = open_readable_database(path, encryptionKey, current_profile);
+  if (db != nullptr) {
+    profileFound = &current_profile;
+    return db;
+  }
+  for (const CipherProfile &profile : CIPHER_PROFILES) {
+    if (&profile == &current_profile) {
+      continue;
+    }
+    db = open_readable_database(path, encryptionKey, profile);
+    if (db != nullptr) {
+      profileFound = &profile;
+      return db;
+    }
+  }
+  profileFound = nullptr;
+  return nullptr;
+}
 
-  bool temp_encrypted_exists = file_exists(temp_encrypted_db_path);
-  bool default_location_exists =
-      file_exists(SQLiteQueryExecutor::sqliteFilePath);
+void execute_or_throw(
+    sqlite3 *db,
+    const std::string &query,
+    const char *error_message) {
+  char *error;
+  sqlite3_exec(db, query.c_str(), nullptr, nullptr, &error);
+  if (error) {
+    std::ostringstream error_stream;
+    error_stream << error_message << " Details: " << error;
+    sqlite3_free(error);
+    throw std::system_error(
+        ECANCELED, std::generic_category(), error_stream.str());
+  }
+}
 
-  if (temp_encrypted_exists && default_location_exists) {
-    Logger::log(
+std::vector<std::string> get_first_column_values(
+    sqlite3 *db,
+    const std::string &query) {
+  std::vector<std::string> values;
+  sqlite3_stmt *stmt;
+  sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr);
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    values.push_back(
+        reinterpret_cast<const char *>(sqlite3_column_text(stmt, 0)));
+  }
+  sqlite3_finalize(stmt);
+  return values;
+}
+
+int64_t get_row_count(sqlite3 *db, const std::string &table) {
+  sqlite3_stmt *stmt;
+  std::string query = "SELECT COUNT(*) FROM " + table + ";";
+  sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr);
+  sqlite3_step(stmt);
+  int64_t count = sqlite3_column_int64(stmt, 0);
+  sqlite3_finalize(stmt);
+  return count;
+}
+
+bool is_encryption_resumable(const std::string &temp_encrypted_db_path) {
+  sqlite3 *db;
+  sqlite3_open(temp_encrypted_db_path.c_str(), &db);
+  bool resumable = false;
+  try {
+    set_encryption_key(db);
+    resumable = !get_first_column_values(
+                     db,
+                     "SELECT name FROM sqlite_master WHERE type = 'table' "
+                     "AND name = 'encryption_progress';")
+                     .empty();
+  } catch (const std::system_error &e) {
+    Logger::log(e.what());
+  }
+  sqlite3_close(db);
+  return resumable;
+}
+
+// Copies the database read by db, which was created with other cipher
+// settings, into a new one with the current ones. db is left open.
+void export_database_to_cipher_profile(
+    sqlite3 *db,
+    const std::string &temp_encrypted_db_path) {
+  const CipherProfile &profile = get_cipher_profile();
+  std::stringstream attach_query;
+  attach_query << "ATTACH DATABASE '" << temp_encrypted_db_path
+               << "' AS target KEY \"x'" << SQLiteQueryExecutor::encryptionKey
+               << "'\";"
+               << "PRAGMA target.cipher_page_size = " << profile.page_size
+               << ";"
+               << "PRAGMA target.cipher_hmac_algorithm = "
+               << profile.hmac_algorithm << ";";
+  execute_or_throw(
+      db, attach_query.str(), "Failed to attach re-encrypted database.");
+  // The export copies the schema, the rows and user_version, but not the
+  // settings that the header of the file holds
+  execute_or_throw(
+      db,
+      "PRAGMA target.auto_vacuum = INCREMENTAL;"
+      "SELECT sqlcipher_export('target');"
+      "PRAGMA target.journal_mode = WAL;",
+      "Failed to export database to new cipher settings.");
+  execute_or_throw(
+      db,
+      "DETACH DATABASE target;",
+      "Failed to detach re-encrypted database.");
+}
+
+int64_t microseconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+// Time spent on encrypting the plaintext database during this launch, and
+// the rows copied, including the ones copied by an interrupted attempt. Set
+// by export_database_in_chunks and reported with the startup metrics.
+int64_t encryption_duration_us = 0;
+int64_t encrypted_rows = 0;
+
+// Copies plaintext database into encrypted one table by table in chunks of
+// ENCRYPTION_CHUNK_SIZE rows. Every chunk is committed together with the
+// rowid it reached and the rows copied so far, so if the app is killed
+// mid-way the next launch resumes from the last committed chunk instead of
+// starting over, without counting the rows of either database again.
+void export_database_in_chunks(const std::string &temp_encrypted_db_path) {
+  auto start_time = std::chrono::steady_clock::now();
+  sqlite3 *db;
+  sqlite3_open(temp_encrypted_db_path.c_str(), &db);
+  try {
+    set_encryption_key(db);
+    execute_or_throw(
+        db,
+        "ATTACH DATABASE '" + SQLiteQueryExecutor::sqliteFilePath +
+            "' AS plaintext KEY '';",
+        "Failed to attach unencrypted database.");
+
+    // Virtual tables and their shadow tables are not copied row by row,
+    // they are recreated at the end
+    std::string copied_tables_condition =
+        "t.type = 'table' AND t.name NOT LIKE 'sqlite_%' AND "
+        "t.sql IS NOT NULL AND t.sql NOT LIKE 'CREATE VIRTUAL TABLE%' AND "
+        "NOT EXISTS (SELECT 1 FROM plaintext.sqlite_master v WHERE "
+        "v.sql LIKE 'CREATE VIRTUAL TABLE%' AND "
+        "substr(t.name, 1, length(v.name) + 1) = v.name || '_')";
+    auto tables = get_first_column_values(
+        db,
+        "SELECT t.name FROM plaintext.sqlite_master t WHERE " +
+            copied_tables_condition + ";");
+
+    if (!is_encryption_resumable(temp_encrypted_db_path)) {
+      execute_or_throw(
+          db,
+          "PRAGMA auto_vacuum = INCREMENTAL;",
+          "Failed to enable incremental vacuum.");
+      execute_or_throw(
+          db, "BEGIN TRANSACTION;", "Failed to begin encryption transaction.");
+      for (const auto &sql : get_first_column_values(
+               db,
+               "SELECT t.sql FROM plaintext.sqlite_master t WHERE " +
+                   copied_tables_condition + ";")) {
+        execute_or_throw(
+            db, sql, "Failed to create table in encrypted database.");
+      }
+      execute_or_throw(
+          db,
+          "CREATE TABLE encryption_progress ("
+          "table_name TEXT PRIMARY KEY, last_rowid INTEGER, "
+          "copied_rows INTEGER NOT NULL DEFAULT 0, total_rows INTEGER);"
+          "INSERT INTO encryption_progress (table_name) "
+          "SELECT t.name FROM plaintext.sqlite_master t WHERE " +
+              copied_tables_condition + ";",
+          "Failed to create encryption progress table.");
+      for (const auto &table : tables) {
+        sqlite3_stmt *total_stmt;
+        sqlite3_prepare_v2(
+            db,
+            "UPDATE encryption_progress SET total_rows = ? "
+            "WHERE table_name = ?;",
+            -1,
+            &total_stmt,
+            nullptr);
+        sqlite3_bind_int64(
+            total_stmt, 1, get_row_count(db, "plaintext.\"" + table + "\""));
+        sqlite3_bind_text(
+            total_stmt, 2, table.c_str(), table.size(), SQLITE_TRANSIENT);
+        int total_result = sqlite3_step(total_stmt);
+        sqlite3_finalize(total_stmt);
+        if (total_result != SQLITE_DONE) {
+          throw std::system_error(
+              ECANCELED,
+              std::generic_category(),
+              "Failed to record rows of '" + table +
+                  "' to encrypt. Details: " + sqlite3_errmsg(db));
+        }
+      }
+      sqlite3_stmt *version_stmt;
+      sqlite3_prepare_v2(
+          db, "PRAGMA plaintext.user_version;", -1, &version_stmt, nullptr);
+      sqlite3_step(version_stmt);
+      int plaintext_version = sqlite3_column_int(version_stmt, 0);
+      sqlite3_finalize(version_stmt);
+      set_database_version(db, plaintext_version);
+      execute_or_throw(
+          db, "COMMIT;", "Failed to commit encryption transaction.");
+    }
+
+    sqlite3_stmt *totals_stmt;
+    sqlite3_prepare_v2(
+        db,
+        "SELECT IFNULL(SUM(total_rows), 0), IFNULL(SUM(copied_rows), 0) "
+        "FROM encryption_progress;",
+        -1,
+        &totals_stmt,
+        nullptr);
+    sqlite3_step(totals_stmt);
+    int64_t total_rows = sqlite3_column_int64(totals_stmt, 0);
+    int64_t copied_rows = sqlite3_column_int64(totals_stmt, 1);
+    sqlite3_finalize(totals_stmt);
+    int logged_percent = -1;
+
+    sqlite3_stmt *progress_stmt;
+    sqlite3_prepare_v2(
+        db,
+        "SELECT last_rowid FROM encryption_progress WHERE table_name = ?;",
+        -1,
+        &progress_stmt,
+        nullptr);
+    sqlite3_stmt *update_progress_stmt;
+    sqlite3_prepare_v2(
+        db,
+        "UPDATE encryption_progress SET last_rowid = ?, "
+        "copied_rows = copied_rows + ? WHERE table_name = ?;",
+        -1,
+        &update_progress_stmt,
+        nullptr);
+
+    for (const auto &table : tables) {
+      sqlite3_bind_text(
+          progress_stmt, 1, table.c_str(), table.size(), SQLITE_TRANSIENT);
+      sqlite3_step(progress_stmt);
+      bool started = sqlite3_column_type(progress_stmt, 0) != SQLITE_NULL;
+      int64_t last_rowid = sqlite3_column_int64(progress_stmt, 0);
+      sqlite3_reset(progress_stmt);
+
+      std::string quoted_table = "\"" + table + "\"";
+      std::stringstream bound_query;
+      bound_query << "SELECT MAX(rowid), COUNT(*) FROM (SELECT rowid FROM "
+                  << "plaintext." << quoted_table
+                  << " WHERE ?1 IS NULL OR rowid > ?1 ORDER BY rowid LIMIT "
+                  << ENCRYPTION_CHUNK_SIZE << ");";
+      std::string copy_query = "INSERT INTO main." + quoted_table +
+          " SELECT * FROM plaintext." + quoted_table +
+          " WHERE (?1 IS NULL OR rowid > ?1) AND rowid <= ?2;";
+      sqlite3_stmt *bound_stmt;
+      sqlite3_prepare_v2(
+          db, bound_query.str().c_str(), -1, &bound_stmt, nullptr);
+      sqlite3_stmt *copy_stmt;
+      sqlite3_prepare_v2(db, copy_query.c_str(), -1, &copy_stmt, nullptr);
+
+      while (true) {
+        if (started) {
+          sqlite3_bind_int64(bound_stmt, 1, last_rowid);
+        } else {
+          sqlite3_bind_null(bound_stmt, 1);
+        }
+        sqlite3_step(bound_stmt);
+        int64_t chunk_rows = sqlite3_column_int64(bound_stmt, 1);
+        int64_t chunk_end = sqlite3_column_int64(bound_stmt, 0);
+        sqlite3_reset(bound_stmt);
+        if (!chunk_rows) {
+          break;
+        }
+
+        execute_or_throw(
+            db,
+            "BEGIN TRANSACTION;",
+            "Failed to begin encryption transaction.");
+        if (started) {
+          sqlite3_bind_int64(copy_stmt, 1, last_rowid);
+        } else {
+          sqlite3_bind_null(copy_stmt, 1);
+        }
+        sqlite3_bind_int64(copy_stmt, 2, chunk_end);
+        sqlite3_bind_int64(update_progress_stmt, 1, chunk_end);
+        sqlite3_bind_int64(update_progress_stmt, 2, chunk_rows);
+        sqlite3_bind_text(
+            update_progress_stmt,
+            3,
+            table.c_str(),
+            table.size(),
+            SQLITE_TRANSIENT);
+        bool chunk_copied = sqlite3_step(copy_stmt) == SQLITE_DONE &&
+            sqlite3_step(update_progress_stmt) == SQLITE_DONE;
+        sqlite3_reset(copy_stmt);
+        sqlite3_reset(update_progress_stmt);
+        if (!chunk_copied) {
+          std::string error_message = sqlite3_errmsg(db);
+          sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+          sqlite3_finalize(bound_stmt);
+          sqlite3_finalize(copy_stmt);
+          sqlite3_finalize(progress_stmt);
+          sqlite3_finalize(update_progress_stmt);
+          throw std::system_error(
+              ECANCELED,
+              std::generic_category(),
+              "Failed to copy rows of '" + table +
+                  "' to encrypted database. Details: " + error_message);
+        }
+        execute_or_throw(
+            db, "COMMIT;", "Failed to commit encryption transaction.");
+
+        started = true;
+        last_rowid = chunk_end;
+        copied_rows += chunk_rows;
+        int percent = total_rows ? copied_rows * 100 / total_rows : 100;
+        if (percent / 10 != logged_percent / 10) {
+          std::stringstream progress;
+          progress << "Encryption progress: " << percent << "% ("
+                   << copied_rows << "/" << total_rows << " rows)"
+                   << std::endl;
+          Logger::log(progress.str());
+          logged_percent = percent;
+        }
+      }
+      sqlite3_finalize(bound_stmt);
+      sqlite3_finalize(copy_stmt);
+    }
+    sqlite3_finalize(progress_stmt);
+    sqlite3_finalize(update_progress_stmt);
+
+    // Indexes are built once all rows are in place, which is cheaper than
+    // maintaining them for every chunk. This step and removal of progress
+    // table are atomic, so a resumed attempt never sees half of the indexes.
+    execute_or_throw(
+        db, "BEGIN TRANSACTION;", "Failed to begin encryption transaction.");
+    for (const auto &sql : get_first_column_values(
+             db,
+             "SELECT sql FROM plaintext.sqlite_master WHERE sql IS NOT NULL "
+             "AND (type IN ('index', 'trigger', 'view') OR "
+             "sql LIKE 'CREATE VIRTUAL TABLE%') "
+             "ORDER BY type = 'table' DESC;")) {
+      execute_or_throw(
+          db, sql, "Failed to create index in encrypted database.");
+    }
+    // Full-text indexes are rebuilt from their content tables instead of
+    // copying them, since copied rows may have been assigned new rowids
+    for (const auto &fts_table : get_first_column_values(
+             db,
+             "SELECT name FROM plaintext.sqlite_master WHERE type = 'table' "
+             "AND sql LIKE 'CREATE VIRTUAL TABLE%USING fts5%';")) {
+      execute_or_throw(
+          db,
+          "INSERT INTO \"" + fts_table + "\" (\"" + fts_table +
+              "\") VALUES ('rebuild');",
+          "Failed to rebuild full-text index in encrypted database.");
+    }
+    // Rows copied with their rowids only move the sequence of an
+    // AUTOINCREMENT table up to the largest rowid left, while the plaintext
+    // one may be past rowids of removed rows, which must not be reused
+    if (!get_first_column_values(
+             db,
+             "SELECT name FROM plaintext.sqlite_master "
+             "WHERE name = 'sqlite_sequence';")
+             .empty()) {
+      execute_or_throw(
+          db,
+          "DELETE FROM main.sqlite_sequence;"
+          "INSERT INTO main.sqlite_sequence (name, seq) "
+          "SELECT name, seq FROM plaintext.sqlite_sequence;",
+          "Failed to copy sequences to encrypted database.");
+    }
+    execute_or_throw(
+        db,
+        "DROP TABLE encryption_progress;"
+        "COMMIT;",
+        "Failed to finish encryption transaction.");
+    execute_or_throw(
+        db,
+        "DETACH DATABASE plaintext;",
+        "Failed to detach unencrypted database.");
+    encrypted_rows = copied_rows;
+  } catch (...) {
+    sqlite3_close(db);
+    throw;
+  }
+  sqlite3_close(db);
+  encryption_duration_us = microseconds_since(start_time);
+}
+
+int64_t get_pragma_value(sqlite3 *db, const std::string &pragma) {
+  sqlite3_stmt *pragma_stmt;
+  std::string pragma_query = "PRAGMA " + pragma + ";";
+  sqlite3_prepare_v2(db, pragma_query.c_str(), -1, &pragma_stmt, nullptr);
+  sqlite3_step(pragma_stmt);
+  int64_t value = sqlite3_column_int64(pragma_stmt, 0);
+  sqlite3_finalize(pragma_stmt);
+  return value;
+}
+
+void checkpoint_database(sqlite3 *db) {
+  int log_frames;
+  int checkpointed_frames;
+  int error_code = sqlite3_wal_checkpoint_v2(
+      db,
+      nullptr,
+      SQLITE_CHECKPOINT_PASSIVE,
+      &log_frames,
+      &checkpointed_frames);
+  if (error_code != SQLITE_OK) {
+    std::ostringstream error_message;
+    error_message << "Failed to checkpoint WAL, error code: " << error_code;
+    Logger::log(error_message.str());
+    return;
+  }
+  // Once every frame is copied back, the WAL file can be truncated without
+  // waiting for readers. Otherwise it keeps its size until the next run.
+  if (log_frames > 0 && log_frames == checkpointed_frames) {
+    sqlite3_wal_checkpoint_v2(
+        db, nullptr, SQLITE_CHECKPOINT_TRUNCATE, nullptr, nullptr);
+  }
+}
+
+bool vacuum_database(
+    sqlite3 *db,
+    std::chrono::steady_clock::time_point deadline) {
+  // 0 is NONE, 1 is FULL and 2 is INCREMENTAL. Databases created before
+  // incremental vacuum was enabled only get their free pages back from a
+  // full vacuum, which doesn't fit in the budget, see vacuumDatabase.
+  if (get_pragma_value(db, "auto_vacuum") != 2) {
+    return true;
+  }
+
+  std::stringstream vacuum_query;
+  vacuum_query << "PRAGMA incremental_vacuum(" << MAINTENANCE_VACUUM_STEP_PAGES
+               << ");";
+  int64_t free_pages = get_pragma_value(db, "freelist_count");
+  while (free_pages) {
+    if (std::chrono::steady_clock::now() >= deadline) {
+      return false;
+    }
+    char *error;
+    sqlite3_exec(db, vacuum_query.str().c_str(), nullptr, nullptr, &error);
+    if (error) {
+      std::ostringstream error_message;
+      error_message << "Failed to run incremental vacuum: " << error;
+      Logger::log(error_message.str());
+      sqlite3_free(error);
+      return true;
+    }
+    // Pages can't be freed while an older snapshot still reads them, it is
+    // left to the next interval rather than retried at every idle point
+    int64_t remaining_pages = get_pragma_value(db, "freelist_count");
+    if (remaining_pages >= free_pages) {
+      return true;
+    }
+    free_pages = remaining_pages;
+  }
+  return true;
+}
+
+// FTS5 merges the segments of the full-text index a few pages at a time.
+// A merge that has nothing to do changes fewer than 2 rows.
+bool merge_fts_index(
+    sqlite3 *db,
+    std::chrono::steady_clock::time_point deadline) {
+  std::stringstream merge_query;
+  merge_query
+      << "INSERT INTO messages_fts (messages_fts, rank) VALUES ('merge', "
+      << MAINTENANCE_FTS_MERGE_PAGES << ");";
+  while (true) {
+    if (std::chrono::steady_clock::now() >= deadline) {
+      return false;
+    }
+    int changes = sqlite3_total_changes(db);
+    char *error;
+    sqlite3_exec(db, merge_query.str().c_str(), nullptr, nullptr, &error);
+    if (error) {
+      std::ostringstream error_message;
+      error_message << "Failed to merge full-text index: " << error;
+      Logger::log(error_message.str());
+      sqlite3_free(error);
+      return true;
+    }
+    if (sqlite3_total_changes(db) - changes < 2) {
+      return true;
+    }
+  }
+}
+
+void optimize_database(sqlite3 *db) {
+  sqlite3_stmt *stat_stmt;
+  sqlite3_prepare_v2(
+      db,
+      "SELECT 1 FROM sqlite_master WHERE name = 'sqlite_stat1';",
+      -1,
+      &stat_stmt,
+      nullptr);
+  bool analyzed = sqlite3_step(stat_stmt) == SQLITE_ROW;
+  sqlite3_finalize(stat_stmt);
+
+  // PRAGMA optimize only re-analyzes tables that have changed a lot since
+  // the last ANALYZE, so a full (but sampled) ANALYZE is run first
+  const char *optimize_query = analyzed
+      ? "PRAGMA optimize;"
+      : "PRAGMA analysis_limit = 400; ANALYZE;";
+  char *error;
+  sqlite3_exec(db, optimize_query, nullptr, nullptr, &error);
+  if (error) {
+    std::ostringstream error_message;
+    error_message << "Failed to optimize database: " << error;
+    Logger::log(error_message.str());
+    sqlite3_free(error);
+  }
+}
+
+std::string read_metadata(sqlite3 *db, const std::string &name) {
+  sqlite3_stmt *metadata_stmt;
+  std::string data;
+  if (sqlite3_prepare_v2(
+          db,
+          "SELECT data FROM metadata WHERE name = ?1;",
+          -1,
+          &metadata_stmt,
+          nullptr) != SQLITE_OK) {
+    return data;
+  }
+  sqlite3_bind_text(
+      metadata_stmt, 1, name.c_str(), name.size(), SQLITE_TRANSIENT);
+  if (sqlite3_step(metadata_stmt) == SQLITE_ROW) {
+    ColumnReader::readText(metadata_stmt, 0, data);
+  }
+  sqlite3_finalize(metadata_stmt);
+  return data;
+}
+
+bool write_metadata(
+    sqlite3 *db,
+    const std::string &name,
+    const std::string &data) {
+  sqlite3_stmt *metadata_stmt;
+  sqlite3_prepare_v2(
+      db,
+      "REPLACE INTO metadata (name, data) VALUES (?1, ?2);",
+      -1,
+      &metadata_stmt,
+      nullptr);
+  sqlite3_bind_text(
+      metadata_stmt, 1, name.c_str(), name.size(), SQLITE_TRANSIENT);
+  sqlite3_bind_text(
+      metadata_stmt, 2, data.c_str(), data.size(), SQLITE_TRANSIENT);
+  bool written = sqlite3_step(metadata_stmt) == SQLITE_DONE;
+  sqlite3_finalize(metadata_stmt);
+  return written;
+}
+
+void load_content_dictionary(sqlite3 *db) {
+  ContentCompressor::instance().setDictionary(
+      read_metadata(db, CONTENT_DICTIONARY_METADATA_KEY));
+}
+
+void collect_content_samples(
+    sqlite3 *db,
+    const char *query,
+    std::vector<std::string> &samples) {
+  sqlite3_stmt *sample_stmt;
+  sqlite3_prepare_v2(db, query, -1, &sample_stmt, nullptr);
+  sqlite3_bind_int(sample_stmt, 1, CONTENT_COMPRESSION_MIN_SIZE);
+  sqlite3_bind_int(sample_stmt, 2, CONTENT_DICTIONARY_MAX_SAMPLES / 2);
+  while (sqlite3_step(sample_stmt) == SQLITE_ROW) {
+    samples.emplace_back();
+    ColumnReader::readText(sample_stmt, 0, samples.back());
+  }
+  sqlite3_finalize(sample_stmt);
+}
+
+// Returns true if a dictionary was trained and stored
+bool train_content_dictionary(sqlite3 *db) {
+  // The latest values are the closest to what is written next
+  std::vector<std::string> samples;
+  collect_content_samples(
+      db,
+      "SELECT content FROM messages "
+      "WHERE type != 0 AND typeof(content) = 'text' AND length(content) >= ?1 "
+      "ORDER BY rowid DESC LIMIT ?2;",
+      samples);
+  collect_content_samples(
+      db,
+      "SELECT extras FROM media "
+      "WHERE typeof(extras) = 'text' AND length(extras) >= ?1 "
+      "ORDER BY rowid DESC LIMIT ?2;",
+      samples);
+  if (samples.size() < CONTENT_DICTIONARY_MIN_SAMPLES) {
+    return false;
+  }
+  std::string dictionary = ContentCompressor::trainDictionary(samples);
+  if (dictionary.empty() ||
+      !write_metadata(db, CONTENT_DICTIONARY_METADATA_KEY, dictionary)) {
+    return false;
+  }
+  ContentCompressor::instance().setDictionary(dictionary);
+  return true;
+}
+
+// Compresses a batch of the values written before the dictionary existed,
+// after the rowid kept in the metadata entry named cursor. VACUUM may
+// renumber rowids, in which case some values are left as they are. Returns
+// false once there is nothing left to compress. Throws if the batch can't be
+// read or written, in which case it is rolled back and the cursor stays
+// where it was.
+bool compress_content_batch(
+    sqlite3 *db,
+    const std::string &table,
+    const std::string &column,
+    const std::string &filter,
+    const std::string &cursor) {
+  std::string last_rowid = read_metadata(db, cursor);
+  int64_t after = last_rowid.empty() ? 0 : std::stoll(last_rowid);
+
+  std::vector<std::pair<int64_t, std::string>> values;
+  bool selected = false;
+  std::string select_query = "SELECT rowid, " + column + " FROM " + table +
+      " WHERE rowid > ?1" + filter + " ORDER BY rowid LIMIT ?2;";
+  sqlite3_stmt *select_stmt;
+  if (sqlite3_prepare_v2(
+          db, select_query.c_str(), -1, &select_stmt, nullptr) != SQLITE_OK) {
+    throw std::system_error(
+        ECANCELED,
+        std::generic_category(),
+        "Failed to read values of '" + table +
+            "' to compress. Details: " + sqlite3_errmsg(db));
+  }
+  sqlite3_bind_int64(select_stmt, 1, after);
+  sqlite3_bind_int(select_stmt, 2, CONTENT_COMPRESSION_BATCH_SIZE);
+  int result_code;
+  while ((result_code = sqlite3_step(select_stmt)) == SQLITE_ROW) {
+    selected = true;
+    after = sqlite3_column_int64(select_stmt, 0);
+    if (sqlite3_column_type(select_stmt, 1) == SQLITE_TEXT) {
+      values.emplace_back(after, std::string());
+      ColumnReader::readText(select_stmt, 1, values.back().second);
+    }
+  }
+  sqlite3_finalize(select_stmt);
+  if (result_code != SQLITE_DONE) {
+    throw std::system_error(
+        ECANCELED,
+        std::generic_category(),
+        "Failed to read values of '" + table +
+            "' to compress. Details: " + sqlite3_errmsg(db));
+  }
+  if (!selected) {
+    return false;
+  }
+
+  std::string update_query =
+      "UPDATE " + table + " SET " + column + " = ?1 WHERE rowid = ?2;";
+  sqlite3_stmt *update_stmt;
+  if (sqlite3_prepare_v2(
+          db, update_query.c_str(), -1, &update_stmt, nullptr) != SQLITE_OK) {
+    throw std::system_error(
+        ECANCELED,
+        std::generic_category(),
+        "Failed to compress values of '" + table +
+            "'. Details: " + sqlite3_errmsg(db));
+  }
+  try {
+    execute_or_throw(
+        db, "BEGIN TRANSACTION;", "Failed to begin compression transaction.");
+  } catch (...) {
+    sqlite3_finalize(update_stmt);
+    throw;
+  }
+  bool written = true;
+  std::string compressed;
+  for (const auto &[rowid, value] : values) {
+    if (!ContentCompressor::instance().compress(value, compressed)) {
+      continue;
+    }
+    sqlite3_bind_blob(
+        update_stmt,
+        1,
+        compressed.data(),
+        compressed.size(),
+        SQLITE_TRANSIENT);
+    sqlite3_bind_int64(update_stmt, 2, rowid);
+    written = sqlite3_step(update_stmt) == SQLITE_DONE;
+    sqlite3_reset(update_stmt);
+    if (!written) {
+      break;
+    }
+  }
+  sqlite3_finalize(update_stmt);
+  // The cursor only moves together with the values it covers
+  if (!written || !write_metadata(db, cursor, std::to_string(after))) {
+    std::string error_message = sqlite3_errmsg(db);
+    sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+    throw std::system_error(
+        ECANCELED,
+        std::generic_category(),
+        "Failed to compress values of '" + table +
+            "'. Details: " + error_message);
+  }
+  try {
+    execute_or_throw(db, "COMMIT;", "Failed to commit compression.");
+  } catch (...) {
+    sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
+    throw;
+  }
+  return true;
+}
+
+// Trains the dictionary once enough values are stored and then compresses
+// the values written before it, stopping at the deadline. Returns false if
+// some of the work is left for the next run.
+bool compress_content(
+    sqlite3 *db,
+    std::chrono::steady_clock::time_point deadline,
+    bool &trained) {
+  trained = false;
+  if (!ContentCompressor::instance().isEnabled()) {
+    trained = train_content_dictionary(db);
+    if (!trained) {
+      return true;
+    }
+  }
+  struct CompressedColumn {
+    std::string table;
+    std::string column;
+    std::string filter;
+    std::string cursor;
+  };
+  // Text messages stay as they are, the full-text index reads them
+  const std::vector<CompressedColumn> columns{
+      {"messages",
+       "content",
+       " AND type != 0",
+       "content_compression_messages_rowid"},
+      {"media", "extras", "", "content_compression_media_rowid"}};
+  for (const CompressedColumn &column : columns) {
+    while (compress_content_batch(
+        db, column.table, column.column, column.filter, column.cursor)) {
+      if (std::chrono::steady_clock::now() >= deadline) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Turns user input into an FTS5 query matching messages that contain all of
+// its words, the last one as a prefix. Every word is quoted, so that FTS5
+// operators and punctuation typed by the user are matched literally.
+std::string build_fts_query(const std::string &input) {
+  std::istringstream words(input);
+  std::ostringstream fts_query;
+  std::string word;
+  bool first = true;
+  while (words >> word) {
+    if (!first) {
+      fts_query << " ";
+    }
+    first = false;
+    fts_query << "\"";
+    for (char c : word) {
+      if (c == '"') {
+        fts_query << "\"";
+      }
+      fts_query << c;
+    }
+    fts_query << "\"";
+  }
+  if (!first) {
+    fts_query << "*";
+  }
+  return fts_query.str();
+}
+
+void run_with_native_accessible(std::function<void()> &&task) {
+  // Some methods of SQLiteQueryExecutor are meant to be executed on
+  // auxiliary threads. In case they require access to native Java
+  // API we need to temporarily attach the thread to JVM, unless it is
+  // the database thread, which stays attached.
+#ifdef __ANDROID__
+  WorkerThread::runNativeAccessible(std::move(task));
+#else
+  task();
+#endif
+}
+
+// Settles what a previous encryption attempt left behind. Returns whether a
+// database was already under the default path, in which case its key is
+// checked on the connection that opens it.
+bool recover_interrupted_encryption() {
+  std::string temp_encrypted_db_path =
+      SQLiteQueryExecutor::sqliteFilePath + "_temp_encrypted";
+
+  bool temp_encrypted_exists = file_exists(temp_encrypted_db_path);
+  bool default_location_exists =
+      file_exists(SQLiteQueryExecutor::sqliteFilePath);
+
+  if (temp_encrypted_exists && default_location_exists &&
+      is_encryption_resumable(temp_encrypted_db_path)) {
+    Logger::log(
+        "Previous encryption attempt was interrupted. Resuming encryption "
+        "process from the last committed chunk.");
+  } else if (temp_encrypted_exists && default_location_exists) {
+    Logger::log(
         "Previous encryption attempt failed. Repeating encryption process from "
         "the beginning.");
     attempt_delete_file(
@@ -537,22 +2089,53 @@ void validate_encryption() {
         temp_encrypted_db_path,
         SQLiteQueryExecutor::sqliteFilePath,
         "Failed to move encrypted database to default location.");
-    return;
+    return false;
   } else if (!default_location_exists) {
     Logger::log(
         "Database not present yet. It will be created encrypted under default "
         "path.");
-    return;
+    return false;
   }
+  return true;
+}
 
-  sqlite3 *db;
-  if (is_database_queryable(db, true)) {
-    Logger::log(
-        "Database exists under default path and it is correctly encrypted.");
+// Called once the database under the default path turned out not to be
+// readable with our key, after the connection that tried was closed
+void encrypt_or_delete_database() {
+  std::string temp_encrypted_db_path =
+      SQLiteQueryExecutor::sqliteFilePath + "_temp_encrypted";
+  const CipherProfile *previous_profile;
+  sqlite3 *db = open_with_any_cipher_profile(
+      SQLiteQueryExecutor::sqliteFilePath,
+      SQLiteQueryExecutor::encryptionKey,
+      previous_profile);
+  if (db != nullptr) {
+    std::stringstream profile_msg;
+    profile_msg << "Database is encrypted with cipher profile '"
+                << previous_profile->name << "'. Exporting it to '"
+                << get_cipher_profile().name << "'." << std::endl;
+    Logger::log(profile_msg.str());
+    try {
+      export_database_to_cipher_profile(db, temp_encrypted_db_path);
+    } catch (...) {
+      sqlite3_close(db);
+      throw;
+    }
+    // Closing the last connection checkpoints the journal into the file, so
+    // nothing is left behind for the new one
+    sqlite3_close(db);
+    attempt_delete_file(
+        SQLiteQueryExecutor::sqliteFilePath,
+        "Failed to delete database with previous cipher settings.");
+    attempt_rename_file(
+        temp_encrypted_db_path,
+        SQLiteQueryExecutor::sqliteFilePath,
+        "Failed to move re-encrypted database to default location.");
+    Logger::log("Re-encryption completed successfully.");
     return;
   }
 
-  if (!is_database_queryable(db, false)) {
+  if (!is_database_queryable_without_key()) {
     Logger::log(
         "Database exists but it is encrypted with key that was lost. "
         "Attempting database deletion. New encrypted one will be created.");
@@ -560,33 +2143,11 @@ void validate_encryption() {
         SQLiteQueryExecutor::sqliteFilePath.c_str(),
         "Failed to delete database encrypted with lost key.");
     return;
-  } else {
-    Logger::log(
-        "Database exists but it is not encrypted. Attempting encryption "
-        "process.");
-  }
-  sqlite3_open(SQLiteQueryExecutor::sqliteFilePath.c_str(), &db);
-
-  std::string createEncryptedCopySQL = "ATTACH DATABASE '" +
-      temp_encrypted_db_path +
-      "' AS encrypted_comm "
-      "KEY \"x'" +
-      SQLiteQueryExecutor::encryptionKey +
-      "'\";"
-      "SELECT sqlcipher_export('encrypted_comm');"
-      "DETACH DATABASE encrypted_comm;";
-
-  char *encryption_error;
-  sqlite3_exec(
-      db, createEncryptedCopySQL.c_str(), nullptr, nullptr, &encryption_error);
-
-  if (encryption_error) {
-    throw std::system_error(
-        ECANCELED,
-        std::generic_category(),
-        "Failed to create encrypted copy of the original database.");
   }
-  sqlite3_close(db);
+  Logger::log(
+      "Database exists but it is not encrypted. Attempting encryption "
+      "process.");
+  export_database_in_chunks(temp_encrypted_db_path);
 
   attempt_delete_file(
       SQLiteQueryExecutor::sqliteFilePath,
@@ -616,7 +2177,15 @@ std::vector<std::pair<uint, SQLiteMigration>> migrations{
      {22, {enable_write_ahead_logging_mode, false}},
      {23, {create_metadata_table, true}},
      {24, {add_not_null_constraint_to_drafts, true}},
-     {25, {add_not_null_constraint_to_metadata, true}}}};
+     {25, {add_not_null_constraint_to_metadata, true}},
+     {26, {create_messages_fts, true}},
+     {27, {cascade_message_deletes_to_media, true}},
+     {28, {create_thread_members_table, true}},
+     {29, {create_thread_summary_table, true}},
+     {30, {create_thread_hashes_table, true}},
+     {31, {create_archived_messages_table, true}},
+     {32, {create_media_cache_table, true}},
+     {33, {create_outbox_table, true}}}};
 
 enum class MigrationResult { SUCCESS, FAILURE, NOT_APPLIED };
 
@@ -672,6 +2241,11 @@ MigrationResult applyMigrationWithoutTransaction(
 }
 
 bool set_up_database(sqlite3 *db) {
+  // Has to be set before WAL is enabled and the first table is created, so
+  // it only takes effect for new databases
+  sqlite3_exec(
+      db, "PRAGMA auto_vacuum = INCREMENTAL;", nullptr, nullptr, nullptr);
+
   auto write_ahead_enabled = enable_write_ahead_logging_mode(db);
   if (!write_ahead_enabled) {
     return false;
@@ -693,13 +2267,44 @@ bool set_up_database(sqlite3 *db) {
   return true;
 }
 
-void SQLiteQueryExecutor::migrate() {
-  validate_encryption();
+// Written only by the migrate() that sets up the writer connection, executors
+// created after it return early
+DatabaseStartupMetrics startup_metrics{};
 
-  sqlite3 *db;
-  sqlite3_open(SQLiteQueryExecutor::sqliteFilePath.c_str(), &db);
-  on_database_open(db);
+// Set by initializeForIngestion and read by migrate()
+std::atomic<bool> use_ingestion_startup{false};
+
+// Processes that only write incoming messages, like headless notification
+// handling, can't afford the full startup. A database that was migrated to
+// the latest version needs no migrations, and reading its version on the
+// connection that was just validated tells it.
+bool try_ingestion_startup(
+    sqlite3 *db,
+    std::chrono::steady_clock::time_point start_time) {
+  int db_version = get_database_version(db);
+  if (db_version != migrations.back().first) {
+    return false;
+  }
+  load_content_dictionary(db);
+
+  startup_metrics = DatabaseStartupMetrics{
+      microseconds_since(start_time),
+      0,
+      db_version,
+      0,
+      true,
+      encryption_duration_us,
+      encrypted_rows};
+  std::stringstream startup_msg;
+  startup_msg << "Database ready for ingestion in "
+              << startup_metrics.durationUs / 1000.0 << "ms" << std::endl;
+  Logger::log(startup_msg.str());
+  return true;
+}
 
+void migrate_database(
+    sqlite3 *db,
+    std::chrono::steady_clock::time_point start_time) {
   std::stringstream db_path;
   db_path << "db path: " << SQLiteQueryExecutor::sqliteFilePath.c_str()
           << std::endl;
@@ -710,42 +2315,64 @@ void SQLiteQueryExecutor::migrate() {
   version_msg << "db version: " << db_version << std::endl;
   Logger::log(version_msg.str());
 
+  auto migrations_start_time = std::chrono::steady_clock::now();
+  int applied_migrations = 0;
+  bool up_to_date = db_version == migrations.back().first;
   if (db_version == 0) {
     set_up_database(db);
+    // Synchronous mode of the profile depends on WAL, which was just enabled
+    apply_performance_profile(db);
     Logger::log("Database structure created.");
+  } else if (!up_to_date) {
+    // Checking a migration costs a transaction, so it is only done when the
+    // database is known to be behind the latest one
+    for (const auto &[idx, migration] : migrations) {
+      const auto &[applyMigration, shouldBeInTransaction] = migration;
+
+      MigrationResult migrationResult;
+      if (shouldBeInTransaction) {
+        migrationResult =
+            applyMigrationWithTransaction(db, applyMigration, idx);
+      } else {
+        migrationResult =
+            applyMigrationWithoutTransaction(db, applyMigration, idx);
+      }
 
-    sqlite3_close(db);
-    return;
-  }
-
-  for (const auto &[idx, migration] : migrations) {
-    const auto &[applyMigration, shouldBeInTransaction] = migration;
-
-    MigrationResult migrationResult;
-    if (shouldBeInTransaction) {
-      migrationResult = applyMigrationWithTransaction(db, applyMigration, idx);
-    } else {
-      migrationResult =
-          applyMigrationWithoutTransaction(db, applyMigration, idx);
-    }
-
-    if (migrationResult == MigrationResult::NOT_APPLIED) {
-      continue;
-    }
+      if (migrationResult == MigrationResult::NOT_APPLIED) {
+        continue;
+      }
 
-    std::stringstream migration_msg;
-    if (migrationResult == MigrationResult::FAILURE) {
-      migration_msg << "migration " << idx << " failed." << std::endl;
-      Logger::log(migration_msg.str());
-      break;
-    }
-    if (migrationResult == MigrationResult::SUCCESS) {
-      migration_msg << "migration " << idx << " succeeded." << std::endl;
-      Logger::log(migration_msg.str());
+      std::stringstream migration_msg;
+      if (migrationResult == MigrationResult::FAILURE) {
+        migration_msg << "migration " << idx << " failed." << std::endl;
+        Logger::log(migration_msg.str());
+        break;
+      }
+      if (migrationResult == MigrationResult::SUCCESS) {
+        migration_msg << "migration " << idx << " succeeded." << std::endl;
+        Logger::log(migration_msg.str());
+        applied_migrations++;
+      }
     }
   }
-
-  sqlite3_close(db);
+  int64_t migrations_duration = microseconds_since(migrations_start_time);
+
+  record_performance_profile(db);
+  load_content_dictionary(db);
+  startup_metrics = DatabaseStartupMetrics{
+      microseconds_since(start_time),
+      migrations_duration,
+      get_database_version(db),
+      applied_migrations,
+      up_to_date,
+      encryption_duration_us,
+      encrypted_rows};
+
+  std::stringstream startup_msg;
+  startup_msg << "Database ready in " << startup_metrics.durationUs / 1000.0
+              << "ms, " << migrations_duration / 1000.0
+              << "ms spent on schema setup and migrations" << std::endl;
+  Logger::log(startup_msg.str());
 }
 
 void SQLiteQueryExecutor::assign_encryption_key() {
@@ -757,11 +2384,12 @@ void SQLiteQueryExecutor::assign_encryption_key() {
   SQLiteQueryExecutor::encryptionKey = encryptionKey;
 }
 
-auto &SQLiteQueryExecutor::getStorage() {
-  static auto storage = make_storage(
-      SQLiteQueryExecutor::sqliteFilePath,
+auto create_storage(const std::string &path) {
+  return make_storage(
+      path,
       make_index("messages_idx_thread_time", &Message::thread, &Message::time),
       make_index("media_idx_container", &Media::container),
+      make_index("media_idx_thread", &Media::thread),
       make_table(
           "drafts",
           make_column("key", &Draft::key, unique(), primary_key()),
@@ -816,54 +2444,507 @@ auto &SQLiteQueryExecutor::getStorage() {
           "metadata",
           make_column("name", &Metadata::name, unique(), primary_key()),
           make_column("data", &Metadata::data)));
-  storage.on_open = on_database_open;
-  return storage;
 }
 
-void SQLiteQueryExecutor::initialize(std::string &databasePath) {
-  std::call_once(SQLiteQueryExecutor::initialized, [&databasePath]() {
-    SQLiteQueryExecutor::sqliteFilePath = databasePath;
-    CommSecureStore commSecureStore{};
-    folly::Optional<std::string> maybeEncryptionKey =
-        commSecureStore.get(SQLiteQueryExecutor::secureStoreEncryptionKeyID);
+typedef decltype(create_storage("")) Storage;
+
+// Threads serving read-only tasks get their own connection, so that reads
+// can run in parallel with the writer connection under WAL. The connection
+// is recreated whenever the database file is replaced.
+thread_local bool use_read_only_connection = false;
+thread_local std::unique_ptr<Storage> read_only_storage;
+thread_local StatementCache read_only_statement_cache;
+thread_local int read_only_storage_generation = 0;
+std::atomic<int> storage_generation{0};
+std::mutex migration_mutex;
+
+Storage &get_read_only_storage() {
+  int generation = storage_generation.load();
+  if (read_only_storage == nullptr ||
+      read_only_storage_generation != generation) {
+    read_only_statement_cache.clear();
+    read_only_storage = std::unique_ptr<Storage>(
+        new Storage(create_storage(SQLiteQueryExecutor::sqliteFilePath)));
+    read_only_storage->on_open = on_read_only_database_open;
+    read_only_storage_generation = generation;
+  }
+  return *read_only_storage;
+}
 
-    if (file_exists(databasePath) && maybeEncryptionKey) {
-      SQLiteQueryExecutor::encryptionKey = maybeEncryptionKey.value();
-      return;
-    }
-    SQLiteQueryExecutor::assign_encryption_key();
-  });
+// The writer connection is opened by migrate(), which validates and migrates
+// the database on it, and stays open until closeDatabase
+Storage &get_writer_storage() {
+  static Storage storage = []() {
+    const StartupTimelinePhase phase("getStorage");
+    Storage storage = create_storage(SQLiteQueryExecutor::sqliteFilePath);
+    storage.on_open = [](sqlite3 *db) {
+      // Setting the key derives it, which dominates opening the connection
+      const StartupTimelinePhase phase("getStorage: open");
+      on_database_open(db);
+    };
+    return storage;
+  }();
+  return storage;
+}
+
+// sqlite_orm doesn't expose its connection, so it is taken from a cached
+// statement, which also keeps it open. The statement reads no table, so the
+// connection can be taken before the key is checked and the schema created.
+sqlite3 *get_storage_connection(Storage &storage, StatementCache &cache) {
+  using Statement = decltype(storage.prepare(select(1)));
+  Statement &statement = cache.get<Statement>(
+      [&storage]() { return storage.prepare(select(1)); });
+  return statement.con.get();
+}
+
+// Set once migrate() has set up the writer connection and reset when
+// closeDatabase closes it
+std::atomic<bool> writer_connection_ready{false};
+
+auto &SQLiteQueryExecutor::getStorage() {
+  if (use_read_only_connection) {
+    return get_read_only_storage();
+  }
+  return get_writer_storage();
+}
+
+StatementCache &SQLiteQueryExecutor::getStatementCache() {
+  if (use_read_only_connection) {
+    return read_only_statement_cache;
+  }
+  return SQLiteQueryExecutor::statementCache;
+}
+
+void SQLiteQueryExecutor::migrate() {
+  const StartupTimelinePhase phase("migrate");
+  // Every executor runs this, but the connection they share is validated and
+  // migrated once
+  if (writer_connection_ready) {
+    return;
+  }
+  auto start_time = std::chrono::steady_clock::now();
+  bool check_key;
+  {
+    const StartupTimelinePhase validationPhase("validate_encryption");
+    check_key = recover_interrupted_encryption();
+  }
+
+  // Executors of read-only threads run this too, so the writer connection is
+  // taken explicitly
+  auto open_writer_connection = []() {
+    return get_storage_connection(
+        get_writer_storage(), SQLiteQueryExecutor::statementCache);
+  };
+  sqlite3 *db = open_writer_connection();
+  if (check_key && !is_database_queryable(db)) {
+    // Only the cached statement holds the connection, so clearing the cache
+    // closes it before the file is replaced
+    SQLiteQueryExecutor::statementCache.clear();
+    {
+      const StartupTimelinePhase validationPhase("validate_encryption");
+      encrypt_or_delete_database();
+    }
+    db = open_writer_connection();
+  } else if (check_key) {
+    Logger::log(
+        "Database exists under default path and it is correctly encrypted.");
+  }
+
+  if (!use_ingestion_startup || !try_ingestion_startup(db, start_time)) {
+    migrate_database(db, start_time);
+  }
+  // The capture triggers need the tables, and writes of the migrations are
+  // neither changes for JS nor for backup. Only the writer connection is
+  // captured, the readers never write.
+  SQLiteQueryExecutor::changeCapture.attach(db);
+  SQLiteQueryExecutor::backupLogRecorder.attach(db);
+  writer_connection_ready = true;
+}
+
+void SQLiteQueryExecutor::useReadOnlyConnection() {
+  use_read_only_connection = true;
+}
+
+void SQLiteQueryExecutor::useReadWriteConnection() {
+  use_read_only_connection = false;
+}
+
+template <typename T>
+void SQLiteQueryExecutor::replaceEntity(const T &entity) {
+  auto &storage = SQLiteQueryExecutor::getStorage();
+  using Statement = decltype(storage.prepare(replace(std::cref(entity))));
+  Statement &statement =
+      SQLiteQueryExecutor::getStatementCache().get<Statement>(
+          [&]() { return storage.prepare(replace(std::cref(entity))); });
+  statement.t.obj = std::cref(entity);
+  storage.execute(statement);
+}
+
+template <typename T>
+void SQLiteQueryExecutor::replaceEntities(const std::vector<T> &entities) {
+  if (entities.empty()) {
+    return;
+  }
+  auto &storage = SQLiteQueryExecutor::getStorage();
+  using Statement = decltype(storage.prepare(replace(std::cref(entities[0]))));
+  Statement &statement =
+      SQLiteQueryExecutor::getStatementCache().get<Statement>(
+          [&]() { return storage.prepare(replace(std::cref(entities[0]))); });
+
+  // Callers such as process*StoreOperations may already have opened a
+  // transaction, in which case the rows are simply written as part of it
+  bool ownTransaction = sqlite3_get_autocommit(statement.con.get());
+  if (ownTransaction) {
+    storage.begin_transaction();
+  }
+  try {
+    for (const T &entity : entities) {
+      statement.t.obj = std::cref(entity);
+      storage.execute(statement);
+    }
+  } catch (...) {
+    if (ownTransaction) {
+      storage.rollback();
+    }
+    throw;
+  }
+  if (ownTransaction) {
+    storage.commit();
+  }
+}
+
+template <typename T>
+void SQLiteQueryExecutor::replaceRows(const T *rows, size_t count) {
+  if (count == 0) {
+    return;
+  }
+  sqlite3_stmt *statement =
+      SQLiteQueryExecutor::getRawStatement(RowEncoder<T>::replace);
+  auto &storage = SQLiteQueryExecutor::getStorage();
+  bool ownTransaction =
+      count > 1 && sqlite3_get_autocommit(sqlite3_db_handle(statement));
+  if (ownTransaction) {
+    storage.begin_transaction();
+  }
+  std::string compressed;
+  for (size_t i = 0; i < count; i++) {
+    RowEncoder<T>::encode(statement, rows[i], compressed);
+    int result_code = sqlite3_step(statement);
+    sqlite3_reset(statement);
+    if (result_code != SQLITE_DONE) {
+      std::ostringstream error_message;
+      error_message << "Failed to replace row: "
+                    << sqlite3_errmsg(sqlite3_db_handle(statement));
+      sqlite3_clear_bindings(statement);
+      if (ownTransaction) {
+        storage.rollback();
+      }
+      throw std::system_error(
+          ECANCELED, std::generic_category(), error_message.str());
+    }
+  }
+  sqlite3_clear_bindings(statement);
+  if (ownTransaction) {
+    storage.commit();
+  }
+}
+
+template <typename T, typename Id>
+std::unique_ptr<T> SQLiteQueryExecutor::getEntityPointer(const Id &id) {
+  auto &storage = SQLiteQueryExecutor::getStorage();
+  using Statement = decltype(storage.prepare(get_pointer<T>(id)));
+  Statement &statement =
+      SQLiteQueryExecutor::getStatementCache().get<Statement>(
+          [&]() { return storage.prepare(get_pointer<T>(id)); });
+  get<0>(statement) = id;
+  std::unique_ptr<T> entity = storage.execute(statement);
+  // sqlite_orm leaves the statement on the fetched row, which would keep a
+  // read transaction open on the cached connection until the next call
+  sqlite3_reset(statement.stmt);
+  return entity;
+}
+
+sqlite3 *SQLiteQueryExecutor::getConnection() {
+  return get_storage_connection(
+      SQLiteQueryExecutor::getStorage(),
+      SQLiteQueryExecutor::getStatementCache());
+}
+
+std::vector<std::pair<Message, std::vector<Media>>>
+SQLiteQueryExecutor::attachMedia(std::vector<Message> messages) {
+  std::vector<std::pair<Message, std::vector<Media>>> messagesWithMedia;
+  if (messages.empty()) {
+    return messagesWithMedia;
+  }
+
+  std::vector<std::string> messageIDs;
+  messageIDs.reserve(messages.size());
+  for (const Message &message : messages) {
+    messageIDs.push_back(message.id);
+  }
+
+  std::vector<Media> mediaRows;
+  decodeRowsForKeys(
+      SQLiteQueryExecutor::getRawStatement(
+          std::string("SELECT ") + RowDecoder<Media>::columns +
+          " FROM media WHERE container = ?1;"),
+      messageIDs,
+      mediaRows);
+  std::unordered_map<std::string, std::vector<Media>> mediaForMessages;
+  for (Media &media : mediaRows) {
+    std::string container = media.container;
+    mediaForMessages[container].push_back(std::move(media));
+  }
+
+  messagesWithMedia.reserve(messages.size());
+  for (Message &message : messages) {
+    std::vector<Media> mediaForMsg;
+    auto it = mediaForMessages.find(message.id);
+    if (it != mediaForMessages.end()) {
+      mediaForMsg = std::move(it->second);
+    }
+    messagesWithMedia.push_back(
+        std::make_pair(std::move(message), std::move(mediaForMsg)));
+  }
+  return messagesWithMedia;
+}
+
+sqlite3_stmt *SQLiteQueryExecutor::getRawStatement(const std::string &sql) {
+  sqlite3 *db = SQLiteQueryExecutor::getConnection();
+  sqlite3_stmt *statement =
+      SQLiteQueryExecutor::getStatementCache().get(db, sql);
+  if (statement == nullptr) {
+    std::ostringstream error_message;
+    error_message << "Failed to prepare statement: " << sqlite3_errmsg(db);
+    throw std::system_error(
+        ECANCELED, std::generic_category(), error_message.str());
+  }
+  return statement;
+}
+
+void SQLiteQueryExecutor::executeRawStatement(const std::string &sql) {
+  sqlite3_stmt *statement = SQLiteQueryExecutor::getRawStatement(sql);
+  int result_code = sqlite3_step(statement);
+  sqlite3_reset(statement);
+  if (result_code != SQLITE_DONE) {
+    std::ostringstream error_message;
+    error_message << "Failed to execute " << sql << ": "
+                  << sqlite3_errmsg(sqlite3_db_handle(statement));
+    throw std::system_error(
+        ECANCELED, std::generic_category(), error_message.str());
+  }
+}
+
+bool SQLiteQueryExecutor::inTransaction() {
+  return !sqlite3_get_autocommit(SQLiteQueryExecutor::getConnection());
+}
+
+void SQLiteQueryExecutor::readInTransaction(
+    const std::function<void()> &read) {
+  if (SQLiteQueryExecutor::inTransaction()) {
+    read();
+    return;
+  }
+  SQLiteQueryExecutor::executeRawStatement("BEGIN;");
+  try {
+    read();
+  } catch (...) {
+    // The error of the read is the one that is thrown
+    sqlite3_exec(
+        SQLiteQueryExecutor::getConnection(),
+        "ROLLBACK;",
+        nullptr,
+        nullptr,
+        nullptr);
+    throw;
+  }
+  SQLiteQueryExecutor::executeRawStatement("COMMIT;");
+}
+
+void SQLiteQueryExecutor::rekey(
+    const std::string &sql,
+    const std::vector<std::pair<std::string, std::string>> &ids) {
+  if (ids.empty()) {
+    return;
+  }
+  sqlite3_stmt *statement = SQLiteQueryExecutor::getRawStatement(sql);
+  auto &storage = SQLiteQueryExecutor::getStorage();
+  bool ownTransaction = ids.size() > 1 &&
+      sqlite3_get_autocommit(sqlite3_db_handle(statement));
+  if (ownTransaction) {
+    storage.begin_transaction();
+  }
+  for (const auto &[from, to] : ids) {
+    sqlite3_bind_text(statement, 1, to.c_str(), to.size(), SQLITE_TRANSIENT);
+    sqlite3_bind_text(
+        statement, 2, from.c_str(), from.size(), SQLITE_TRANSIENT);
+    int result_code = sqlite3_step(statement);
+    sqlite3_reset(statement);
+    if (result_code != SQLITE_DONE) {
+      std::ostringstream error_message;
+      error_message << "Failed to rekey " << from << " to " << to << ": "
+                    << sqlite3_errmsg(sqlite3_db_handle(statement));
+      if (ownTransaction) {
+        storage.rollback();
+      }
+      throw std::system_error(
+          ECANCELED, std::generic_category(), error_message.str());
+    }
+  }
+  sqlite3_clear_bindings(statement);
+  if (ownTransaction) {
+    storage.commit();
+  }
+}
+
+// Pages through the messages of both tiers. Each is limited on its own
+// first, in the order of its (thread, time) index, so that the page is
+// merged from at most twice its size rather than sorted from every message
+// of the thread. Bound parameter ?4 is the size of the page.
+std::string select_messages_page(const std::string &condition) {
+  auto select_tier = [&condition](const std::string &table) {
+    return std::string("SELECT * FROM (SELECT ") +
+        RowDecoder<Message>::columns + " FROM " + table + " WHERE " +
+        condition + " ORDER BY time DESC, id DESC LIMIT ?4)";
+  };
+  return std::string("SELECT ") + RowDecoder<Message>::columns + " FROM (" +
+      select_tier("messages") + " UNION ALL " +
+      select_tier("archived_messages") +
+      ") ORDER BY time DESC, id DESC LIMIT ?4;";
+}
+
+bool SQLiteQueryExecutor::hasArchivedMessages() {
+  sqlite3_stmt *statement = SQLiteQueryExecutor::getRawStatement(
+      "SELECT EXISTS (SELECT 1 FROM archived_messages);");
+  int result_code = sqlite3_step(statement);
+  bool archiveEmpty =
+      result_code == SQLITE_ROW && sqlite3_column_int(statement, 0) == 0;
+  sqlite3_reset(statement);
+  return !archiveEmpty;
+}
+
+void SQLiteQueryExecutor::removeArchivedMessages(
+    const std::string &column,
+    const std::vector<std::string> &keys) {
+  if (keys.empty() || !SQLiteQueryExecutor::hasArchivedMessages()) {
+    return;
+  }
+  SQLiteQueryExecutor::runWithBulkKeys(
+      "DELETE FROM archived_messages "
+      "WHERE " +
+          column + " IN (SELECT key FROM temp.bulk_keys);",
+      keys);
+}
+
+void SQLiteQueryExecutor::runWithBulkKeys(
+    const std::string &sql,
+    const std::vector<std::string> &keys) {
+  // An IN list takes a bound parameter per key, up to the limit of SQLite,
+  // and is sorted into an ephemeral index by every statement. The keys are
+  // inserted into an indexed temporary table instead, which the statement
+  // joins against.
+  SQLiteQueryExecutor::executeRawStatement(
+      "CREATE TEMP TABLE IF NOT EXISTS bulk_keys ("
+      "key TEXT PRIMARY KEY NOT NULL) WITHOUT ROWID;");
+  sqlite3_stmt *insert = SQLiteQueryExecutor::getRawStatement(
+      "INSERT OR IGNORE INTO temp.bulk_keys (key) VALUES (?1);");
+  auto &storage = SQLiteQueryExecutor::getStorage();
+  bool ownTransaction = sqlite3_get_autocommit(sqlite3_db_handle(insert));
+  if (ownTransaction) {
+    storage.begin_transaction();
+  }
+  try {
+    // Left over if a failed statement wasn't rolled back
+    SQLiteQueryExecutor::executeRawStatement("DELETE FROM temp.bulk_keys;");
+    for (const std::string &key : keys) {
+      sqlite3_bind_text(insert, 1, key.c_str(), key.size(), SQLITE_TRANSIENT);
+      int result_code = sqlite3_step(insert);
+      sqlite3_reset(insert);
+      if (result_code != SQLITE_DONE) {
+        std::ostringstream error_message;
+        error_message << "Failed to insert bulk key " << key << ": "
+                      << sqlite3_errmsg(sqlite3_db_handle(insert));
+        throw std::system_error(
+            ECANCELED, std::generic_category(), error_message.str());
+      }
+    }
+    sqlite3_clear_bindings(insert);
+    SQLiteQueryExecutor::executeRawStatement(sql);
+    SQLiteQueryExecutor::executeRawStatement("DELETE FROM temp.bulk_keys;");
+  } catch (...) {
+    sqlite3_clear_bindings(insert);
+    if (ownTransaction) {
+      storage.rollback();
+    }
+    throw;
+  }
+  if (ownTransaction) {
+    storage.commit();
+  }
+}
+
+void SQLiteQueryExecutor::initialize(std::string &databasePath) {
+  std::call_once(SQLiteQueryExecutor::initialized, [&databasePath]() {
+    const StartupTimelinePhase phase("SQLiteQueryExecutor::initialize");
+    SQLiteQueryExecutor::sqliteFilePath = databasePath;
+    CommSecureStore commSecureStore{};
+    folly::Optional<std::string> maybeEncryptionKey =
+        commSecureStore.get(SQLiteQueryExecutor::secureStoreEncryptionKeyID);
+
+    if (file_exists(databasePath) && maybeEncryptionKey) {
+      SQLiteQueryExecutor::encryptionKey = maybeEncryptionKey.value();
+      return;
+    }
+    SQLiteQueryExecutor::assign_encryption_key();
+  });
+}
+
+void SQLiteQueryExecutor::setCipherProfile(const std::string &name) {
+  for (const CipherProfile &profile : CIPHER_PROFILES) {
+    if (profile.name == name) {
+      cipher_profile = &profile;
+      return;
+    }
+  }
+  throw std::system_error(
+      EINVAL, std::generic_category(), "Unknown cipher profile " + name);
+}
+
+void SQLiteQueryExecutor::initializeForIngestion(std::string &databasePath) {
+  use_ingestion_startup = true;
+  SQLiteQueryExecutor::initialize(databasePath);
 }
 
 SQLiteQueryExecutor::SQLiteQueryExecutor() {
+  std::lock_guard<std::mutex> lock(migration_mutex);
   SQLiteQueryExecutor::migrate();
 }
 
 std::string SQLiteQueryExecutor::getDraft(std::string key) const {
   std::unique_ptr<Draft> draft =
-      SQLiteQueryExecutor::getStorage().get_pointer<Draft>(key);
+      SQLiteQueryExecutor::getEntityPointer<Draft>(key);
   return (draft == nullptr) ? "" : draft->text;
 }
 
 std::unique_ptr<Thread>
 SQLiteQueryExecutor::getThread(std::string threadID) const {
-  return SQLiteQueryExecutor::getStorage().get_pointer<Thread>(threadID);
+  return SQLiteQueryExecutor::getEntityPointer<Thread>(threadID);
 }
 
 void SQLiteQueryExecutor::updateDraft(std::string key, std::string text) const {
   Draft draft = {key, text};
-  SQLiteQueryExecutor::getStorage().replace(draft);
+  SQLiteQueryExecutor::replaceEntity(draft);
 }
 
 bool SQLiteQueryExecutor::moveDraft(std::string oldKey, std::string newKey)
     const {
   std::unique_ptr<Draft> draft =
-      SQLiteQueryExecutor::getStorage().get_pointer<Draft>(oldKey);
+      SQLiteQueryExecutor::getEntityPointer<Draft>(oldKey);
   if (draft == nullptr) {
     return false;
   }
   draft->key = newKey;
-  SQLiteQueryExecutor::getStorage().replace(*draft);
+  SQLiteQueryExecutor::replaceEntity(*draft);
   SQLiteQueryExecutor::getStorage().remove<Draft>(oldKey);
   return true;
 }
@@ -878,157 +2959,1354 @@ void SQLiteQueryExecutor::removeAllDrafts() const {
 
 void SQLiteQueryExecutor::removeAllMessages() const {
   SQLiteQueryExecutor::getStorage().remove_all<Message>();
+  SQLiteQueryExecutor::executeRawStatement("DELETE FROM archived_messages;");
+  SQLiteQueryExecutor::messageCache.invalidateAll(
+      SQLiteQueryExecutor::inTransaction());
 }
 
 std::vector<std::pair<Message, std::vector<Media>>>
 SQLiteQueryExecutor::getAllMessages() const {
-
-  auto rows = SQLiteQueryExecutor::getStorage().select(
-      columns(
-          &Message::id,
-          &Message::local_id,
-          &Message::thread,
-          &Message::user,
-          &Message::type,
-          &Message::future_type,
-          &Message::content,
-          &Message::time,
-          &Media::id,
-          &Media::container,
-          &Media::thread,
-          &Media::uri,
-          &Media::type,
-          &Media::extras),
-      left_join<Media>(on(c(&Message::id) == &Media::container)),
-      order_by(&Message::id));
+  // Messages and media are read in two passes, ordered by the primary key and
+  // by media_idx_container respectively, and then merged like two sorted
+  // lists. Unlike a LEFT JOIN, this doesn't repeat the message columns for
+  // every media row and needs no grouping of the joined rows. Both passes
+  // read the same snapshot, so that a write in between can't leave out the
+  // media of a message.
+  std::vector<Message> messages;
+  std::vector<Media> media;
+  SQLiteQueryExecutor::readInTransaction([&]() {
+    decodeRows(
+        SQLiteQueryExecutor::getRawStatement(
+            std::string("SELECT ") + RowDecoder<Message>::columns +
+            " FROM messages ORDER BY id;"),
+        messages);
+    decodeRows(
+        SQLiteQueryExecutor::getRawStatement(
+            std::string("SELECT ") + RowDecoder<Media>::columns +
+            " FROM media ORDER BY container;"),
+        media);
+  });
 
   std::vector<std::pair<Message, std::vector<Media>>> allMessages;
-  allMessages.reserve(rows.size());
+  allMessages.reserve(messages.size());
+  auto mediaIt = media.begin();
+  for (Message &message : messages) {
+    // Media whose message no longer exists is skipped
+    while (mediaIt != media.end() && mediaIt->container < message.id) {
+      mediaIt++;
+    }
+    auto mediaEnd = mediaIt;
+    while (mediaEnd != media.end() && mediaEnd->container == message.id) {
+      mediaEnd++;
+    }
+    allMessages.emplace_back(
+        std::move(message),
+        std::vector<Media>(
+            std::make_move_iterator(mediaIt),
+            std::make_move_iterator(mediaEnd)));
+    mediaIt = mediaEnd;
+  }
+
+  return allMessages;
+}
+
+CompactMessageStore SQLiteQueryExecutor::getAllMessagesCompact() const {
+  // Same two passes as getAllMessages, except that media rows are merged as
+  // they are stepped through, straight into the flat media vector
+  CompactMessageStore store;
+  SQLiteQueryExecutor::readInTransaction([&]() {
+    decodeRows(
+        SQLiteQueryExecutor::getRawStatement(
+            std::string("SELECT ") + RowDecoder<CompactMessage>::columns +
+            " FROM messages ORDER BY id;"),
+        store.messages,
+        store.strings);
+
+    sqlite3_stmt *statement = SQLiteQueryExecutor::getRawStatement(
+        std::string("SELECT container, ") + RowDecoder<CompactMedia>::columns +
+        " FROM media ORDER BY container;");
+    auto message = store.messages.begin();
+    std::string container;
+    int result_code;
+    while ((result_code = sqlite3_step(statement)) == SQLITE_ROW) {
+      ColumnReader::readText(statement, 0, container);
+      // Media whose message no longer exists is skipped
+      while (message != store.messages.end() && message->id < container) {
+        message++;
+      }
+      if (message == store.messages.end()) {
+        break;
+      }
+      if (message->id != container) {
+        continue;
+      }
+      if (message->media_begin == message->media_end) {
+        message->media_begin = message->media_end = store.media.size();
+      }
+      store.media.emplace_back();
+      RowDecoder<CompactMedia>::decode(statement, 1, store.media.back());
+      message->media_end++;
+    }
+    if (result_code != SQLITE_ROW && result_code != SQLITE_DONE) {
+      std::ostringstream error_message;
+      error_message << "Failed to decode media: "
+                    << sqlite3_errmsg(sqlite3_db_handle(statement));
+      sqlite3_reset(statement);
+      CancellationToken::throwIfCancelled();
+      throw std::system_error(
+          ECANCELED, std::generic_category(), error_message.str());
+    }
+    sqlite3_reset(statement);
+  });
+
+  return store;
+}
+
+std::vector<std::pair<Message, std::vector<Media>>>
+SQLiteQueryExecutor::getThreadMessagesBefore(
+    std::string threadID,
+    int64_t beforeTime,
+    std::string beforeMessageID,
+    int pageSize) const {
+  // Pages are keyed by (time, id) rather than time alone so that a page
+  // boundary between messages with equal timestamps doesn't skip any of them.
+  // Filtering by thread and time is served by messages_idx_thread_time.
+  MessageCache::Key before(beforeTime, beforeMessageID);
+  if (pageSize > 0) {
+    auto cachedPage =
+        SQLiteQueryExecutor::messageCache.get(threadID, before, pageSize);
+    if (cachedPage) {
+      return std::move(*cachedPage);
+    }
+  }
+  uint64_t cacheGeneration = SQLiteQueryExecutor::messageCache.getGeneration();
+  sqlite3_stmt *statement = SQLiteQueryExecutor::getRawStatement(
+      select_messages_page(
+          "thread = ?1 AND (time < ?2 OR (time = ?2 AND id < ?3))"));
+  sqlite3_bind_text(
+      statement, 1, threadID.c_str(), threadID.size(), SQLITE_TRANSIENT);
+  sqlite3_bind_int64(statement, 2, beforeTime);
+  sqlite3_bind_text(
+      statement,
+      3,
+      beforeMessageID.c_str(),
+      beforeMessageID.size(),
+      SQLITE_TRANSIENT);
+  sqlite3_bind_int(statement, 4, pageSize);
+  std::vector<Message> messages;
+  try {
+    decodeRows(statement, messages);
+  } catch (...) {
+    sqlite3_clear_bindings(statement);
+    throw;
+  }
+  sqlite3_clear_bindings(statement);
+
+  auto page = SQLiteQueryExecutor::attachMedia(std::move(messages));
+  if (pageSize > 0) {
+    SQLiteQueryExecutor::messageCache.put(
+        threadID, before, pageSize, page, cacheGeneration);
+  }
+  return page;
+}
+
+bool SQLiteQueryExecutor::prefetchThreadMessagesBefore(
+    const std::string &threadID,
+    int64_t &beforeTime,
+    std::string &beforeMessageID,
+    int pageSize,
+    size_t maxCacheSize) const {
+  if (pageSize <= 0) {
+    return false;
+  }
+  MessageCache::Key last;
+  auto cachedRowCount = SQLiteQueryExecutor::messageCache.findPage(
+      threadID, MessageCache::Key(beforeTime, beforeMessageID), pageSize, last);
+  if (!cachedRowCount) {
+    // The rows read ahead shouldn't evict the ones that were requested
+    if (SQLiteQueryExecutor::messageCache.getSize() >= maxCacheSize) {
+      return false;
+    }
+    auto page = this->getThreadMessagesBefore(
+        threadID, beforeTime, beforeMessageID, pageSize);
+    cachedRowCount = page.size();
+    if (!page.empty()) {
+      last = MessageCache::Key(page.back().first.time, page.back().first.id);
+    }
+  }
+  if (*cachedRowCount < static_cast<size_t>(pageSize)) {
+    return false;
+  }
+  beforeTime = last.first;
+  beforeMessageID = std::move(last.second);
+  return true;
+}
+
+std::vector<std::pair<Message, std::vector<Media>>>
+SQLiteQueryExecutor::getMessagesOfThreads(
+    const std::vector<std::string> &threadIDs) const {
+  std::vector<Message> messages;
+  decodeRowsForKeys(
+      SQLiteQueryExecutor::getRawStatement(
+          std::string("SELECT ") + RowDecoder<Message>::columns +
+          " FROM all_messages WHERE thread = ?1;"),
+      threadIDs,
+      messages);
+  std::sort(
+      messages.begin(),
+      messages.end(),
+      [](const Message &a, const Message &b) {
+        return a.time > b.time || (a.time == b.time && a.id > b.id);
+      });
+
+  return SQLiteQueryExecutor::attachMedia(std::move(messages));
+}
+
+std::vector<std::pair<Message, std::vector<Media>>>
+SQLiteQueryExecutor::getMessagesWithoutThread() const {
+  std::vector<Message> messages;
+  decodeRows(
+      SQLiteQueryExecutor::getRawStatement(
+          std::string("SELECT ") + RowDecoder<Message>::columns +
+          " FROM all_messages WHERE thread NOT IN (SELECT id FROM threads) "
+          "ORDER BY time DESC, id DESC;"),
+      messages);
+  return SQLiteQueryExecutor::attachMedia(std::move(messages));
+}
+
+std::vector<std::pair<Message, std::vector<Media>>>
+SQLiteQueryExecutor::getThreadMessagesInRange(
+    const std::string &threadID,
+    int64_t fromTime,
+    int64_t toTime,
+    int limit) const {
+  sqlite3_stmt *statement = SQLiteQueryExecutor::getRawStatement(
+      select_messages_page("thread = ?1 AND time >= ?2 AND time < ?3"));
+  sqlite3_bind_text(
+      statement, 1, threadID.c_str(), threadID.size(), SQLITE_TRANSIENT);
+  sqlite3_bind_int64(statement, 2, fromTime);
+  sqlite3_bind_int64(statement, 3, toTime);
+  sqlite3_bind_int(statement, 4, limit);
+  std::vector<Message> messages;
+  try {
+    decodeRows(statement, messages);
+  } catch (...) {
+    sqlite3_clear_bindings(statement);
+    throw;
+  }
+  sqlite3_clear_bindings(statement);
+  return SQLiteQueryExecutor::attachMedia(std::move(messages));
+}
+
+std::vector<std::pair<Message, std::vector<Media>>>
+SQLiteQueryExecutor::getMessagesByIDs(
+    const std::vector<std::string> &ids) const {
+  std::vector<Message> messages;
+  decodeRowsForKeys(
+      SQLiteQueryExecutor::getRawStatement(
+          std::string("SELECT ") + RowDecoder<Message>::columns +
+          " FROM all_messages WHERE id = ?1;"),
+      ids,
+      messages);
+  return SQLiteQueryExecutor::attachMedia(std::move(messages));
+}
+
+std::vector<int> SQLiteQueryExecutor::getThreadMessageCounts(
+    const std::vector<std::string> &threadIDs) const {
+  // A thread without messages has no summary
+  sqlite3_stmt *statement = SQLiteQueryExecutor::getRawStatement(
+      "SELECT message_count FROM thread_summary WHERE thread_id = ?1;");
+  std::vector<int> counts;
+  counts.reserve(threadIDs.size());
+  for (const std::string &threadID : threadIDs) {
+    sqlite3_bind_text(
+        statement, 1, threadID.c_str(), threadID.size(), SQLITE_TRANSIENT);
+    int result_code = sqlite3_step(statement);
+    counts.push_back(
+        result_code == SQLITE_ROW ? sqlite3_column_int(statement, 0) : 0);
+    sqlite3_reset(statement);
+    if (result_code != SQLITE_ROW && result_code != SQLITE_DONE) {
+      std::ostringstream error_message;
+      error_message << "Failed to count messages of thread " << threadID
+                    << ": " << sqlite3_errmsg(sqlite3_db_handle(statement));
+      sqlite3_clear_bindings(statement);
+      throw std::system_error(
+          ECANCELED, std::generic_category(), error_message.str());
+    }
+  }
+  sqlite3_clear_bindings(statement);
+  return counts;
+}
+
+std::vector<std::pair<Message, std::vector<Media>>>
+SQLiteQueryExecutor::searchMessages(
+    std::string query,
+    folly::Optional<std::string> threadID,
+    int pageSize,
+    int offset) const {
+  std::string ftsQuery = build_fts_query(query);
+  if (ftsQuery.empty()) {
+    return {};
+  }
+
+  // Archived messages are matched in their own index. The ranks of the two
+  // are scored apart, but with the same bm25 function and tokenizer.
+  auto search_tier = [](const std::string &table) {
+    return "SELECT m.id, m.local_id, m.thread, m.user, m.type, m.future_type, "
+           "m.content, m.time, f.rank "
+           "FROM " +
+        table + "_fts f INNER JOIN " + table +
+        " m ON m.rowid = f.rowid "
+        "WHERE " +
+        table + "_fts MATCH ?1 AND (?2 IS NULL OR m.thread = ?2)";
+  };
+  static const std::string search_query = "SELECT * FROM (" +
+      search_tier("messages") + " UNION ALL " +
+      search_tier("archived_messages") +
+      ") ORDER BY rank, time DESC LIMIT ?3 OFFSET ?4;";
+
+  sqlite3 *db = SQLiteQueryExecutor::getConnection();
+  sqlite3_stmt *search_stmt;
+  sqlite3_prepare_v2(db, search_query.c_str(), -1, &search_stmt, nullptr);
+  sqlite3_bind_text(
+      search_stmt, 1, ftsQuery.c_str(), ftsQuery.size(), SQLITE_TRANSIENT);
+  if (threadID) {
+    sqlite3_bind_text(
+        search_stmt,
+        2,
+        threadID->c_str(),
+        threadID->size(),
+        SQLITE_TRANSIENT);
+  }
+  sqlite3_bind_int(search_stmt, 3, pageSize);
+  sqlite3_bind_int(search_stmt, 4, offset);
+
+  std::vector<Message> messages;
+  int result_code;
+  while ((result_code = sqlite3_step(search_stmt)) == SQLITE_ROW) {
+    messages.emplace_back();
+    RowDecoder<Message>::decode(search_stmt, 0, messages.back());
+  }
+  sqlite3_finalize(search_stmt);
+  if (result_code != SQLITE_DONE) {
+    CancellationToken::throwIfCancelled();
+    std::ostringstream error_message;
+    error_message << "Failed to search messages: " << sqlite3_errmsg(db);
+    throw std::system_error(
+        ECANCELED, std::generic_category(), error_message.str());
+  }
+
+  return SQLiteQueryExecutor::attachMedia(std::move(messages));
+}
+
+void SQLiteQueryExecutor::removeMessages(
+    const std::vector<std::string> &ids) const {
+  if (ids.size() >= BULK_KEYS_MIN_COUNT) {
+    SQLiteQueryExecutor::runWithBulkKeys(
+        "DELETE FROM messages WHERE id IN (SELECT key FROM temp.bulk_keys);",
+        ids);
+  } else {
+    SQLiteQueryExecutor::getStorage().remove_all<Message>(
+        where(in(&Message::id, ids)));
+  }
+  SQLiteQueryExecutor::removeArchivedMessages("id", ids);
+  SQLiteQueryExecutor::messageCache.invalidateMessages(
+      ids, SQLiteQueryExecutor::inTransaction());
+}
+
+void SQLiteQueryExecutor::removeMessagesForThreads(
+    const std::vector<std::string> &threadIDs) const {
+  if (threadIDs.size() >= BULK_KEYS_MIN_COUNT) {
+    SQLiteQueryExecutor::runWithBulkKeys(
+        "DELETE FROM messages "
+        "WHERE thread IN (SELECT key FROM temp.bulk_keys);",
+        threadIDs);
+  } else {
+    SQLiteQueryExecutor::getStorage().remove_all<Message>(
+        where(in(&Message::thread, threadIDs)));
+  }
+  SQLiteQueryExecutor::removeArchivedMessages("thread", threadIDs);
+  SQLiteQueryExecutor::messageCache.invalidateThreads(
+      threadIDs, SQLiteQueryExecutor::inTransaction());
+}
+
+int SQLiteQueryExecutor::archiveMessages(int64_t olderThan) const {
+  sqlite3 *db = SQLiteQueryExecutor::getConnection();
+  // The rows only move, so the triggers reacting to messages being removed
+  // are kept from running: the media and the summaries stay as they are.
+  // The text messages move from one full-text index to the other.
+  int triggersEnabled;
+  sqlite3_db_config(db, SQLITE_DBCONFIG_ENABLE_TRIGGER, -1, &triggersEnabled);
+  bool ownTransaction = sqlite3_get_autocommit(db);
+  auto &storage = SQLiteQueryExecutor::getStorage();
+  if (ownTransaction) {
+    storage.begin_transaction();
+  }
+  sqlite3_db_config(db, SQLITE_DBCONFIG_ENABLE_TRIGGER, 0, nullptr);
+  int archivedCount = 0;
+  try {
+    const std::vector<std::string> queries{
+        "INSERT INTO messages_fts (messages_fts, rowid, content)"
+        "  SELECT 'delete', rowid, content FROM messages"
+        "  WHERE type = 0 AND time < ?1;",
+        std::string("INSERT INTO archived_messages (") +
+            RowDecoder<Message>::columns + ") SELECT " +
+            RowDecoder<Message>::columns +
+            " FROM messages WHERE time < ?1;",
+        "INSERT INTO archived_messages_fts (rowid, content)"
+        "  SELECT rowid, content FROM archived_messages"
+        "  WHERE type = 0 AND id IN (SELECT id FROM messages WHERE time < ?1);",
+        "DELETE FROM messages WHERE time < ?1;"};
+    for (const std::string &query : queries) {
+      // Not cached, the statements are expired as triggers are toggled
+      sqlite3_stmt *statement;
+      sqlite3_prepare_v2(db, query.c_str(), -1, &statement, nullptr);
+      sqlite3_bind_int64(statement, 1, olderThan);
+      int result_code = sqlite3_step(statement);
+      sqlite3_finalize(statement);
+      if (result_code != SQLITE_DONE) {
+        std::ostringstream error_message;
+        error_message << "Failed to archive messages: " << sqlite3_errmsg(db);
+        throw std::system_error(
+            ECANCELED, std::generic_category(), error_message.str());
+      }
+      archivedCount = sqlite3_changes(db);
+    }
+  } catch (...) {
+    sqlite3_db_config(
+        db, SQLITE_DBCONFIG_ENABLE_TRIGGER, triggersEnabled, nullptr);
+    if (ownTransaction) {
+      storage.rollback();
+    }
+    throw;
+  }
+  sqlite3_db_config(
+      db, SQLITE_DBCONFIG_ENABLE_TRIGGER, triggersEnabled, nullptr);
+  if (ownTransaction) {
+    storage.commit();
+  }
+  SQLiteQueryExecutor::messageCache.invalidateAll(
+      SQLiteQueryExecutor::inTransaction());
+  return archivedCount;
+}
+
+void SQLiteQueryExecutor::replaceMessage(const Message &message) const {
+  SQLiteQueryExecutor::replaceRows(&message, 1);
+  bool inTransaction = SQLiteQueryExecutor::inTransaction();
+  // The replaced row may have belonged to another thread
+  SQLiteQueryExecutor::messageCache.invalidateMessages(
+      {message.id}, inTransaction);
+  SQLiteQueryExecutor::messageCache.invalidateThreads(
+      {message.thread}, inTransaction);
+}
+
+void SQLiteQueryExecutor::replaceMessages(
+    const std::vector<Message> &messages) const {
+  SQLiteQueryExecutor::replaceRows(messages.data(), messages.size());
+  std::vector<std::string> messageIDs;
+  std::vector<std::string> threadIDs;
+  for (const Message &message : messages) {
+    messageIDs.push_back(message.id);
+    threadIDs.push_back(message.thread);
+  }
+  bool inTransaction = SQLiteQueryExecutor::inTransaction();
+  SQLiteQueryExecutor::messageCache.invalidateMessages(
+      messageIDs, inTransaction);
+  SQLiteQueryExecutor::messageCache.invalidateThreads(threadIDs, inTransaction);
+}
+
+void SQLiteQueryExecutor::rekeyMessage(std::string from, std::string to) const {
+  SQLiteQueryExecutor::rekeyMessagesBatch({{from, to}});
+}
+
+void SQLiteQueryExecutor::rekeyMessagesBatch(
+    const std::vector<std::pair<std::string, std::string>> &ids) const {
+  if (ids.empty()) {
+    return;
+  }
+  // OR REPLACE keeps the previous semantics of overwriting a message that
+  // already has the new ID
+  std::vector<std::string> queries{
+      "UPDATE OR REPLACE messages SET id = ?1 WHERE id = ?2;"};
+  if (SQLiteQueryExecutor::hasArchivedMessages()) {
+    // A message is in only one of messages and archived_messages, so a
+    // message with the new ID in the other table is removed first
+    queries = {
+        "DELETE FROM archived_messages"
+        "  WHERE id = ?1 AND EXISTS (SELECT 1 FROM messages WHERE id = ?2);",
+        "DELETE FROM messages"
+        "  WHERE id = ?1"
+        "  AND EXISTS (SELECT 1 FROM archived_messages WHERE id = ?2);",
+        "UPDATE OR REPLACE messages SET id = ?1 WHERE id = ?2;",
+        "UPDATE OR REPLACE archived_messages SET id = ?1 WHERE id = ?2;"};
+  }
+  auto &storage = SQLiteQueryExecutor::getStorage();
+  bool ownTransaction =
+      sqlite3_get_autocommit(SQLiteQueryExecutor::getConnection());
+  if (ownTransaction) {
+    storage.begin_transaction();
+  }
+  try {
+    for (const std::string &query : queries) {
+      SQLiteQueryExecutor::rekey(query, ids);
+    }
+  } catch (...) {
+    if (ownTransaction) {
+      storage.rollback();
+    }
+    throw;
+  }
+  if (ownTransaction) {
+    storage.commit();
+  }
+  SQLiteQueryExecutor::messageCache.invalidateRekeyedMessages(
+      ids, SQLiteQueryExecutor::inTransaction());
+}
+
+void SQLiteQueryExecutor::removeAllMedia() const {
+  SQLiteQueryExecutor::getStorage().remove_all<Media>();
+  SQLiteQueryExecutor::messageCache.invalidateAll(
+      SQLiteQueryExecutor::inTransaction());
+}
+
+void SQLiteQueryExecutor::removeMediaForMessages(
+    const std::vector<std::string> &msg_ids) const {
+  if (msg_ids.size() >= BULK_KEYS_MIN_COUNT) {
+    SQLiteQueryExecutor::runWithBulkKeys(
+        "DELETE FROM media "
+        "WHERE container IN (SELECT key FROM temp.bulk_keys);",
+        msg_ids);
+  } else {
+    SQLiteQueryExecutor::getStorage().remove_all<Media>(
+        where(in(&Media::container, msg_ids)));
+  }
+  SQLiteQueryExecutor::messageCache.invalidateMessages(
+      msg_ids, SQLiteQueryExecutor::inTransaction());
+}
+
+void SQLiteQueryExecutor::removeMediaForMessage(std::string msg_id) const {
+  SQLiteQueryExecutor::getStorage().remove_all<Media>(
+      where(c(&Media::container) == msg_id));
+  SQLiteQueryExecutor::messageCache.invalidateMessages(
+      {msg_id}, SQLiteQueryExecutor::inTransaction());
+}
+
+void SQLiteQueryExecutor::removeMediaForThreads(
+    const std::vector<std::string> &thread_ids) const {
+  if (thread_ids.size() >= BULK_KEYS_MIN_COUNT) {
+    SQLiteQueryExecutor::runWithBulkKeys(
+        "DELETE FROM media WHERE thread IN (SELECT key FROM temp.bulk_keys);",
+        thread_ids);
+  } else {
+    SQLiteQueryExecutor::getStorage().remove_all<Media>(
+        where(in(&Media::thread, thread_ids)));
+  }
+  SQLiteQueryExecutor::messageCache.invalidateThreads(
+      thread_ids, SQLiteQueryExecutor::inTransaction());
+}
+
+void SQLiteQueryExecutor::replaceMedia(const Media &media) const {
+  SQLiteQueryExecutor::replaceRows(&media, 1);
+  bool inTransaction = SQLiteQueryExecutor::inTransaction();
+  SQLiteQueryExecutor::messageCache.invalidateMessages(
+      {media.container}, inTransaction);
+  SQLiteQueryExecutor::messageCache.invalidateThreads(
+      {media.thread}, inTransaction);
+}
+
+void SQLiteQueryExecutor::replaceMediaBatch(
+    const std::vector<Media> &media) const {
+  SQLiteQueryExecutor::replaceRows(media.data(), media.size());
+  std::vector<std::string> containers;
+  std::vector<std::string> threadIDs;
+  for (const Media &mediaItem : media) {
+    containers.push_back(mediaItem.container);
+    threadIDs.push_back(mediaItem.thread);
+  }
+  bool inTransaction = SQLiteQueryExecutor::inTransaction();
+  SQLiteQueryExecutor::messageCache.invalidateMessages(
+      containers, inTransaction);
+  SQLiteQueryExecutor::messageCache.invalidateThreads(threadIDs, inTransaction);
+}
+
+void SQLiteQueryExecutor::rekeyMediaContainers(std::string from, std::string to)
+    const {
+  SQLiteQueryExecutor::rekeyMediaContainersBatch({{from, to}});
+}
+
+void SQLiteQueryExecutor::rekeyMediaContainersBatch(
+    const std::vector<std::pair<std::string, std::string>> &containers) const {
+  SQLiteQueryExecutor::rekey(
+      "UPDATE media SET container = ?1 WHERE container = ?2;", containers);
+  std::vector<std::string> messageIDs;
+  for (const auto &[from, to] : containers) {
+    messageIDs.push_back(from);
+    messageIDs.push_back(to);
+  }
+  SQLiteQueryExecutor::messageCache.invalidateMessages(
+      messageIDs, SQLiteQueryExecutor::inTransaction());
+}
+
+void SQLiteQueryExecutor::recordMediaCacheEntry(
+    const MediaCacheEntry &entry) const {
+  sqlite3_stmt *statement = SQLiteQueryExecutor::getRawStatement(
+      std::string("INSERT OR REPLACE INTO media_cache (") +
+      RowDecoder<MediaCacheEntry>::columns + ") VALUES (?1, ?2, ?3, ?4);");
+  sqlite3_bind_text(
+      statement,
+      1,
+      entry.media_id.c_str(),
+      entry.media_id.size(),
+      SQLITE_TRANSIENT);
+  sqlite3_bind_text(
+      statement,
+      2,
+      entry.local_path.c_str(),
+      entry.local_path.size(),
+      SQLITE_TRANSIENT);
+  sqlite3_bind_int64(statement, 3, entry.size);
+  sqlite3_bind_int64(statement, 4, entry.last_accessed);
+  int result_code = sqlite3_step(statement);
+  sqlite3_reset(statement);
+  sqlite3_clear_bindings(statement);
+  if (result_code != SQLITE_DONE) {
+    std::ostringstream error_message;
+    error_message << "Failed to record media cache entry " << entry.media_id
+                  << ": " << sqlite3_errmsg(sqlite3_db_handle(statement));
+    throw std::system_error(
+        ECANCELED, std::generic_category(), error_message.str());
+  }
+}
+
+void SQLiteQueryExecutor::touchMediaCacheEntries(
+    const std::vector<std::string> &mediaIDs,
+    int64_t accessedAt) const {
+  if (mediaIDs.empty()) {
+    return;
+  }
+  // Entries are only ever moved forward, so a view recorded late doesn't
+  // make a file look older than it is
+  sqlite3_stmt *statement = SQLiteQueryExecutor::getRawStatement(
+      "UPDATE media_cache SET last_accessed = ?2 "
+      "WHERE media_id = ?1 AND last_accessed < ?2;");
+  auto &storage = SQLiteQueryExecutor::getStorage();
+  bool ownTransaction = sqlite3_get_autocommit(sqlite3_db_handle(statement));
+  if (ownTransaction) {
+    storage.begin_transaction();
+  }
+  sqlite3_bind_int64(statement, 2, accessedAt);
+  for (const std::string &mediaID : mediaIDs) {
+    sqlite3_bind_text(
+        statement, 1, mediaID.c_str(), mediaID.size(), SQLITE_TRANSIENT);
+    int result_code = sqlite3_step(statement);
+    sqlite3_reset(statement);
+    if (result_code != SQLITE_DONE) {
+      std::ostringstream error_message;
+      error_message << "Failed to touch media cache entry " << mediaID << ": "
+                    << sqlite3_errmsg(sqlite3_db_handle(statement));
+      sqlite3_clear_bindings(statement);
+      if (ownTransaction) {
+        storage.rollback();
+      }
+      throw std::system_error(
+          ECANCELED, std::generic_category(), error_message.str());
+    }
+  }
+  sqlite3_clear_bindings(statement);
+  if (ownTransaction) {
+    storage.commit();
+  }
+}
+
+int64_t SQLiteQueryExecutor::getMediaCacheSize() const {
+  sqlite3_stmt *statement = SQLiteQueryExecutor::getRawStatement(
+      "SELECT COALESCE(SUM(size), 0) FROM media_cache;");
+  int result_code = sqlite3_step(statement);
+  int64_t size =
+      result_code == SQLITE_ROW ? sqlite3_column_int64(statement, 0) : 0;
+  sqlite3_reset(statement);
+  if (result_code != SQLITE_ROW) {
+    std::ostringstream error_message;
+    error_message << "Failed to get media cache size: "
+                  << sqlite3_errmsg(sqlite3_db_handle(statement));
+    throw std::system_error(
+        ECANCELED, std::generic_category(), error_message.str());
+  }
+  return size;
+}
+
+int64_t SQLiteQueryExecutor::evictMediaCacheEntries(
+    const std::vector<MediaCacheEntry> &entries,
+    MediaCacheEviction &eviction) {
+  std::vector<std::string> evictedIDs;
+  int64_t evictedBytes = 0;
+  for (const MediaCacheEntry &entry : entries) {
+    // A file that is already gone, e.g. deleted by an eviction that stopped
+    // before its entry was, only leaves its entry behind
+    if (std::remove(entry.local_path.c_str())) {
+      int error = errno;
+      if (error != ENOENT) {
+        Logger::log(
+            "Failed to evict cached media file " + entry.local_path + ": " +
+            std::strerror(error));
+        continue;
+      }
+    }
+    evictedIDs.push_back(entry.media_id);
+    evictedBytes += entry.size;
+  }
+  if (evictedIDs.empty()) {
+    return 0;
+  }
+  SQLiteQueryExecutor::runWithBulkKeys(
+      "DELETE FROM media_cache "
+      "WHERE media_id IN (SELECT key FROM temp.bulk_keys);",
+      evictedIDs);
+  eviction.evictedCount += static_cast<int>(evictedIDs.size());
+  eviction.evictedBytes += evictedBytes;
+  return evictedBytes;
+}
+
+MediaCacheEviction
+SQLiteQueryExecutor::evictMediaCache(int64_t budget) const {
+  MediaCacheEviction eviction;
+  int64_t cacheSize = this->getMediaCacheSize();
+
+  // Nothing shows the files of removed media anymore, so they all go
+  // whatever the budget. Entries that failed to be evicted are stepped over
+  // by the cursor instead of being selected again.
+  sqlite3_stmt *orphans = SQLiteQueryExecutor::getRawStatement(
+      std::string("SELECT ") + RowDecoder<MediaCacheEntry>::columns +
+      " FROM media_cache"
+      " WHERE media_id > ?1 AND NOT EXISTS ("
+      "SELECT 1 FROM media WHERE media.id = media_cache.media_id)"
+      " ORDER BY media_id LIMIT ?2;");
+  std::string lastID;
+  while (true) {
+    std::vector<MediaCacheEntry> entries;
+    sqlite3_bind_text(
+        orphans, 1, lastID.c_str(), lastID.size(), SQLITE_TRANSIENT);
+    sqlite3_bind_int(orphans, 2, MEDIA_CACHE_EVICTION_BATCH_SIZE);
+    decodeRows(orphans, entries);
+    sqlite3_clear_bindings(orphans);
+    if (entries.empty()) {
+      break;
+    }
+    lastID = entries.back().media_id;
+    cacheSize -= SQLiteQueryExecutor::evictMediaCacheEntries(entries, eviction);
+  }
+
+  // Served by media_cache_idx_last_accessed
+  sqlite3_stmt *oldest = SQLiteQueryExecutor::getRawStatement(
+      std::string("SELECT ") + RowDecoder<MediaCacheEntry>::columns +
+      " FROM media_cache"
+      " WHERE last_accessed >= ?1 AND (last_accessed > ?1 OR media_id > ?2)"
+      " ORDER BY last_accessed, media_id LIMIT ?3;");
+  int64_t lastAccessed = INT64_MIN;
+  lastID.clear();
+  while (cacheSize > budget) {
+    std::vector<MediaCacheEntry> entries;
+    sqlite3_bind_int64(oldest, 1, lastAccessed);
+    sqlite3_bind_text(
+        oldest, 2, lastID.c_str(), lastID.size(), SQLITE_TRANSIENT);
+    sqlite3_bind_int(oldest, 3, MEDIA_CACHE_EVICTION_BATCH_SIZE);
+    decodeRows(oldest, entries);
+    sqlite3_clear_bindings(oldest);
+    if (entries.empty()) {
+      break;
+    }
+    // No more than what gets the cache under the budget
+    int64_t excess = cacheSize - budget;
+    size_t count = 0;
+    for (int64_t selected = 0; count < entries.size() && selected < excess;
+         count++) {
+      selected += entries[count].size;
+    }
+    entries.resize(count);
+    lastAccessed = entries.back().last_accessed;
+    lastID = entries.back().media_id;
+    cacheSize -= SQLiteQueryExecutor::evictMediaCacheEntries(entries, eviction);
+  }
+  return eviction;
+}
 
-  std::string prev_msg_idx{};
-  for (auto &row : rows) {
-    auto msg_id = std::get<0>(row);
-    if (msg_id == prev_msg_idx) {
-      allMessages.back().second.push_back(Media{
-          std::get<8>(row),
-          std::move(std::get<9>(row)),
-          std::move(std::get<10>(row)),
-          std::move(std::get<11>(row)),
-          std::move(std::get<12>(row)),
-          std::move(std::get<13>(row)),
-      });
-    } else {
-      std::vector<Media> mediaForMsg;
-      if (!std::get<8>(row).empty()) {
-        mediaForMsg.push_back(Media{
-            std::get<8>(row),
-            std::move(std::get<9>(row)),
-            std::move(std::get<10>(row)),
-            std::move(std::get<11>(row)),
-            std::move(std::get<12>(row)),
-            std::move(std::get<13>(row)),
-        });
+void SQLiteQueryExecutor::addToOutbox(
+    const std::vector<OutboxEntry> &entries) const {
+  if (entries.empty()) {
+    return;
+  }
+  sqlite3_stmt *statement = SQLiteQueryExecutor::getRawStatement(
+      std::string("INSERT OR REPLACE INTO outbox (") +
+      RowDecoder<OutboxEntry>::columns +
+      ") VALUES (?1, ?2, NULLIF(?3, ''), ?4, NULLIF(?5, -1), ?6);");
+  auto &storage = SQLiteQueryExecutor::getStorage();
+  bool ownTransaction = entries.size() > 1 &&
+      sqlite3_get_autocommit(sqlite3_db_handle(statement));
+  if (ownTransaction) {
+    storage.begin_transaction();
+  }
+  for (const OutboxEntry &entry : entries) {
+    sqlite3_bind_text(
+        statement,
+        1,
+        entry.local_id.c_str(),
+        entry.local_id.size(),
+        SQLITE_TRANSIENT);
+    sqlite3_bind_text(
+        statement,
+        2,
+        entry.thread.c_str(),
+        entry.thread.size(),
+        SQLITE_TRANSIENT);
+    sqlite3_bind_text(
+        statement,
+        3,
+        entry.target.c_str(),
+        entry.target.size(),
+        SQLITE_TRANSIENT);
+    sqlite3_bind_text(
+        statement,
+        4,
+        entry.payload.c_str(),
+        entry.payload.size(),
+        SQLITE_TRANSIENT);
+    sqlite3_bind_int(statement, 5, entry.encryption_type);
+    sqlite3_bind_int64(statement, 6, entry.created_at);
+    int result_code = sqlite3_step(statement);
+    sqlite3_reset(statement);
+    if (result_code != SQLITE_DONE) {
+      std::ostringstream error_message;
+      error_message << "Failed to add " << entry.local_id
+                    << " to outbox: "
+                    << sqlite3_errmsg(sqlite3_db_handle(statement));
+      sqlite3_clear_bindings(statement);
+      if (ownTransaction) {
+        storage.rollback();
       }
-      allMessages.push_back(std::make_pair(
-          Message{
-              msg_id,
-              std::move(std::get<1>(row)),
-              std::move(std::get<2>(row)),
-              std::move(std::get<3>(row)),
-              std::get<4>(row),
-              std::move(std::get<5>(row)),
-              std::move(std::get<6>(row)),
-              std::get<7>(row)},
-          mediaForMsg));
-
-      prev_msg_idx = msg_id;
+      throw std::system_error(
+          ECANCELED, std::generic_category(), error_message.str());
     }
   }
-
-  return allMessages;
+  sqlite3_clear_bindings(statement);
+  if (ownTransaction) {
+    storage.commit();
+  }
 }
 
-void SQLiteQueryExecutor::removeMessages(
-    const std::vector<std::string> &ids) const {
-  SQLiteQueryExecutor::getStorage().remove_all<Message>(
-      where(in(&Message::id, ids)));
+std::vector<OutboxEntry> SQLiteQueryExecutor::takeOutboxBatch(int limit) const {
+  // Served by outbox_idx_in_flight_created_at
+  sqlite3_stmt *statement = SQLiteQueryExecutor::getRawStatement(
+      std::string("SELECT ") + RowDecoder<OutboxEntry>::columns +
+      " FROM outbox WHERE in_flight = 0"
+      " ORDER BY created_at, local_id LIMIT ?1;");
+  auto &storage = SQLiteQueryExecutor::getStorage();
+  bool ownTransaction = sqlite3_get_autocommit(sqlite3_db_handle(statement));
+  if (ownTransaction) {
+    storage.begin_transaction();
+  }
+  std::vector<OutboxEntry> entries;
+  try {
+    sqlite3_bind_int(statement, 1, limit);
+    decodeRows(statement, entries);
+    sqlite3_clear_bindings(statement);
+    std::vector<std::string> localIDs;
+    localIDs.reserve(entries.size());
+    for (const OutboxEntry &entry : entries) {
+      localIDs.push_back(entry.local_id);
+    }
+    if (!localIDs.empty()) {
+      SQLiteQueryExecutor::runWithBulkKeys(
+          "UPDATE outbox SET in_flight = 1 "
+          "WHERE local_id IN (SELECT key FROM temp.bulk_keys);",
+          localIDs);
+    }
+  } catch (...) {
+    sqlite3_clear_bindings(statement);
+    if (ownTransaction) {
+      storage.rollback();
+    }
+    throw;
+  }
+  if (ownTransaction) {
+    storage.commit();
+  }
+  return entries;
 }
 
-void SQLiteQueryExecutor::removeMessagesForThreads(
-    const std::vector<std::string> &threadIDs) const {
-  SQLiteQueryExecutor::getStorage().remove_all<Message>(
-      where(in(&Message::thread, threadIDs)));
+void SQLiteQueryExecutor::updateOutboxPayloads(
+    const std::vector<OutboxEntry> &entries) const {
+  if (entries.empty()) {
+    return;
+  }
+  sqlite3_stmt *statement = SQLiteQueryExecutor::getRawStatement(
+      "UPDATE outbox SET payload = ?2, encryption_type = NULLIF(?3, -1) "
+      "WHERE local_id = ?1;");
+  auto &storage = SQLiteQueryExecutor::getStorage();
+  bool ownTransaction = entries.size() > 1 &&
+      sqlite3_get_autocommit(sqlite3_db_handle(statement));
+  if (ownTransaction) {
+    storage.begin_transaction();
+  }
+  for (const OutboxEntry &entry : entries) {
+    sqlite3_bind_text(
+        statement,
+        1,
+        entry.local_id.c_str(),
+        entry.local_id.size(),
+        SQLITE_TRANSIENT);
+    sqlite3_bind_text(
+        statement,
+        2,
+        entry.payload.c_str(),
+        entry.payload.size(),
+        SQLITE_TRANSIENT);
+    sqlite3_bind_int(statement, 3, entry.encryption_type);
+    int result_code = sqlite3_step(statement);
+    sqlite3_reset(statement);
+    if (result_code != SQLITE_DONE) {
+      std::ostringstream error_message;
+      error_message << "Failed to update outbox payload of " << entry.local_id
+                    << ": " << sqlite3_errmsg(sqlite3_db_handle(statement));
+      sqlite3_clear_bindings(statement);
+      if (ownTransaction) {
+        storage.rollback();
+      }
+      throw std::system_error(
+          ECANCELED, std::generic_category(), error_message.str());
+    }
+  }
+  sqlite3_clear_bindings(statement);
+  if (ownTransaction) {
+    storage.commit();
+  }
 }
 
-void SQLiteQueryExecutor::replaceMessage(const Message &message) const {
-  SQLiteQueryExecutor::getStorage().replace(message);
+void SQLiteQueryExecutor::requeueOutboxEntries(
+    const std::vector<std::string> &localIDs) const {
+  if (localIDs.empty()) {
+    SQLiteQueryExecutor::executeRawStatement(
+        "UPDATE outbox SET in_flight = 0 WHERE in_flight = 1;");
+    return;
+  }
+  SQLiteQueryExecutor::runWithBulkKeys(
+      "UPDATE outbox SET in_flight = 0 "
+      "WHERE local_id IN (SELECT key FROM temp.bulk_keys);",
+      localIDs);
 }
 
-void SQLiteQueryExecutor::rekeyMessage(std::string from, std::string to) const {
-  auto msg = SQLiteQueryExecutor::getStorage().get<Message>(from);
-  msg.id = to;
-  SQLiteQueryExecutor::getStorage().replace(msg);
-  SQLiteQueryExecutor::getStorage().remove<Message>(from);
+void SQLiteQueryExecutor::acknowledgeOutboxEntries(
+    const std::vector<std::pair<std::string, std::string>> &serverIDs) const {
+  if (serverIDs.empty()) {
+    return;
+  }
+  std::vector<std::string> localIDs;
+  localIDs.reserve(serverIDs.size());
+  for (const auto &[localID, serverID] : serverIDs) {
+    localIDs.push_back(localID);
+  }
+  // Through the executor, so that the message cache sees the rekeys once
+  // they are committed
+  bool ownTransaction = !SQLiteQueryExecutor::inTransaction();
+  if (ownTransaction) {
+    this->beginTransaction();
+  }
+  try {
+    this->rekeyMessagesBatch(serverIDs);
+    this->rekeyMediaContainersBatch(serverIDs);
+    SQLiteQueryExecutor::runWithBulkKeys(
+        "DELETE FROM outbox "
+        "WHERE local_id IN (SELECT key FROM temp.bulk_keys);",
+        localIDs);
+  } catch (...) {
+    if (ownTransaction) {
+      this->rollbackTransaction();
+    }
+    throw;
+  }
+  if (ownTransaction) {
+    this->commitTransaction();
+  }
 }
 
-void SQLiteQueryExecutor::removeAllMedia() const {
-  SQLiteQueryExecutor::getStorage().remove_all<Media>();
-}
+std::vector<Thread> SQLiteQueryExecutor::getAllThreads() const {
+  std::vector<Thread> threads;
+  decodeRows(
+      SQLiteQueryExecutor::getRawStatement(
+          std::string("SELECT ") + RowDecoder<Thread>::columns +
+          " FROM threads;"),
+      threads);
+  return threads;
+};
 
-void SQLiteQueryExecutor::removeMediaForMessages(
-    const std::vector<std::string> &msg_ids) const {
-  SQLiteQueryExecutor::getStorage().remove_all<Media>(
-      where(in(&Media::container, msg_ids)));
-}
+std::vector<Thread> SQLiteQueryExecutor::getAllThreadsByActivity() const {
+  std::vector<Thread> threads = this->getAllThreads();
+
+  // Kept by the triggers of thread_summary
+  sqlite3_stmt *statement = SQLiteQueryExecutor::getRawStatement(
+      "SELECT thread_id, last_message_time FROM thread_summary;");
+  std::unordered_map<std::string, int64_t> lastActivity;
+  int result_code;
+  while ((result_code = sqlite3_step(statement)) == SQLITE_ROW) {
+    const char *thread =
+        reinterpret_cast<const char *>(sqlite3_column_text(statement, 0));
+    if (thread != nullptr) {
+      lastActivity[thread] = sqlite3_column_int64(statement, 1);
+    }
+  }
+  sqlite3_reset(statement);
+  if (result_code != SQLITE_DONE) {
+    std::ostringstream error_message;
+    error_message << "Failed to read threads activity: "
+                  << sqlite3_errmsg(sqlite3_db_handle(statement));
+    throw std::system_error(
+        ECANCELED, std::generic_category(), error_message.str());
+  }
 
-void SQLiteQueryExecutor::removeMediaForMessage(std::string msg_id) const {
-  SQLiteQueryExecutor::getStorage().remove_all<Media>(
-      where(c(&Media::container) == msg_id));
+  auto activityOf = [&lastActivity](const Thread &thread) {
+    auto it = lastActivity.find(thread.id);
+    return it != lastActivity.end()
+        ? std::max(it->second, thread.creation_time)
+        : thread.creation_time;
+  };
+  std::stable_sort(
+      threads.begin(),
+      threads.end(),
+      [&activityOf](const Thread &lhs, const Thread &rhs) {
+        return activityOf(lhs) > activityOf(rhs);
+      });
+  return threads;
 }
 
-void SQLiteQueryExecutor::removeMediaForThreads(
-    const std::vector<std::string> &thread_ids) const {
-  SQLiteQueryExecutor::getStorage().remove_all<Media>(
-      where(in(&Media::thread, thread_ids)));
+std::vector<Thread> SQLiteQueryExecutor::getAllThreadSummaries() const {
+  auto rows = SQLiteQueryExecutor::getStorage().select(columns(
+      &Thread::id,
+      &Thread::type,
+      &Thread::name,
+      &Thread::description,
+      &Thread::color,
+      &Thread::creation_time,
+      &Thread::parent_thread_id,
+      &Thread::containing_thread_id,
+      &Thread::community,
+      &Thread::current_user,
+      &Thread::source_message_id,
+      &Thread::replies_count));
+
+  std::vector<Thread> threadSummaries;
+  threadSummaries.reserve(rows.size());
+  for (auto &row : rows) {
+    threadSummaries.push_back(Thread{
+        std::move(std::get<0>(row)),
+        std::get<1>(row),
+        std::move(std::get<2>(row)),
+        std::move(std::get<3>(row)),
+        std::move(std::get<4>(row)),
+        std::get<5>(row),
+        std::move(std::get<6>(row)),
+        std::move(std::get<7>(row)),
+        std::move(std::get<8>(row)),
+        "",
+        "",
+        std::move(std::get<9>(row)),
+        std::move(std::get<10>(row)),
+        std::get<11>(row)});
+  }
+  return threadSummaries;
 }
 
-void SQLiteQueryExecutor::replaceMedia(const Media &media) const {
-  SQLiteQueryExecutor::getStorage().replace(media);
+CompactThreadStore
+SQLiteQueryExecutor::getAllThreadsCompact(bool includeMembership) const {
+  CompactThreadStore store;
+  decodeRows(
+      SQLiteQueryExecutor::getRawStatement(
+          std::string("SELECT ") +
+          (includeMembership ? RowDecoder<CompactThread>::columns
+                             : RowDecoder<CompactThread>::summaryColumns) +
+          " FROM threads;"),
+      store.threads,
+      store.strings);
+  return store;
 }
 
-void SQLiteQueryExecutor::rekeyMediaContainers(std::string from, std::string to)
-    const {
-  SQLiteQueryExecutor::getStorage().update_all(
-      set(c(&Media::container) = to), where(c(&Media::container) == from));
+std::vector<Thread> SQLiteQueryExecutor::getThreadsByIDs(
+    const std::vector<std::string> &ids) const {
+  // An IN list would take a bound parameter per ID, up to the limit of
+  // SQLite. Each ID is looked up once, as the IN list would.
+  std::vector<std::string> uniqueIDs;
+  std::unordered_set<std::string> seen;
+  for (const std::string &id : ids) {
+    if (seen.insert(id).second) {
+      uniqueIDs.push_back(id);
+    }
+  }
+  std::vector<Thread> threads;
+  decodeRowsForKeys(
+      SQLiteQueryExecutor::getRawStatement(
+          std::string("SELECT ") + RowDecoder<Thread>::columns +
+          " FROM threads WHERE id = ?1;"),
+      uniqueIDs,
+      threads);
+  return threads;
 }
 
-std::vector<Thread> SQLiteQueryExecutor::getAllThreads() const {
-  return SQLiteQueryExecutor::getStorage().get_all<Thread>();
-};
-
 void SQLiteQueryExecutor::removeThreads(std::vector<std::string> ids) const {
+  if (ids.size() >= BULK_KEYS_MIN_COUNT) {
+    SQLiteQueryExecutor::runWithBulkKeys(
+        "DELETE FROM threads WHERE id IN (SELECT key FROM temp.bulk_keys);",
+        ids);
+    return;
+  }
   SQLiteQueryExecutor::getStorage().remove_all<Thread>(
       where(in(&Thread::id, ids)));
 };
 
 void SQLiteQueryExecutor::replaceThread(const Thread &thread) const {
-  SQLiteQueryExecutor::getStorage().replace(thread);
+  SQLiteQueryExecutor::replaceEntity(thread);
 };
 
+bool SQLiteQueryExecutor::replaceThreadIfChanged(const Thread &thread) const {
+  int64_t hash = hash_thread(thread);
+  sqlite3_stmt *select_stmt = SQLiteQueryExecutor::getRawStatement(
+      "SELECT hash FROM thread_hashes WHERE thread_id = ?1;");
+  sqlite3_bind_text(
+      select_stmt, 1, thread.id.c_str(), thread.id.size(), SQLITE_TRANSIENT);
+  bool unchanged = sqlite3_step(select_stmt) == SQLITE_ROW &&
+      sqlite3_column_int64(select_stmt, 0) == hash;
+  sqlite3_reset(select_stmt);
+  sqlite3_clear_bindings(select_stmt);
+  if (unchanged) {
+    return false;
+  }
+
+  // The replace drops the previous hash
+  SQLiteQueryExecutor::replaceEntity(thread);
+  sqlite3_stmt *insert_stmt = SQLiteQueryExecutor::getRawStatement(
+      "INSERT INTO thread_hashes (thread_id, hash) VALUES (?1, ?2);");
+  sqlite3_bind_text(
+      insert_stmt, 1, thread.id.c_str(), thread.id.size(), SQLITE_TRANSIENT);
+  sqlite3_bind_int64(insert_stmt, 2, hash);
+  int result_code = sqlite3_step(insert_stmt);
+  sqlite3_reset(insert_stmt);
+  sqlite3_clear_bindings(insert_stmt);
+  if (result_code != SQLITE_DONE) {
+    std::ostringstream error_message;
+    error_message << "Failed to store hash of thread " << thread.id << ": "
+                  << sqlite3_errmsg(sqlite3_db_handle(insert_stmt));
+    throw std::system_error(
+        ECANCELED, std::generic_category(), error_message.str());
+  }
+  return true;
+}
+
+std::vector<std::pair<std::string, int64_t>>
+SQLiteQueryExecutor::getThreadHashes() const {
+  sqlite3_stmt *statement = SQLiteQueryExecutor::getRawStatement(
+      "SELECT thread_id, hash FROM thread_hashes;");
+  std::vector<std::pair<std::string, int64_t>> hashes;
+  int result_code;
+  while ((result_code = sqlite3_step(statement)) == SQLITE_ROW) {
+    std::string threadID;
+    ColumnReader::readText(statement, 0, threadID);
+    hashes.emplace_back(
+        std::move(threadID), sqlite3_column_int64(statement, 1));
+  }
+  if (result_code != SQLITE_DONE) {
+    std::ostringstream error_message;
+    error_message << "Failed to read thread hashes: "
+                  << sqlite3_errmsg(sqlite3_db_handle(statement));
+    sqlite3_reset(statement);
+    CancellationToken::throwIfCancelled();
+    throw std::system_error(
+        ECANCELED, std::generic_category(), error_message.str());
+  }
+  sqlite3_reset(statement);
+  return hashes;
+}
+
+void SQLiteQueryExecutor::replaceThreads(
+    const std::vector<Thread> &threads) const {
+  SQLiteQueryExecutor::replaceEntities(threads);
+}
+
 void SQLiteQueryExecutor::removeAllThreads() const {
   SQLiteQueryExecutor::getStorage().remove_all<Thread>();
 };
 
+std::vector<ThreadMember>
+SQLiteQueryExecutor::getThreadMembers(std::string threadID) const {
+  std::vector<ThreadMember> members;
+  decodeRowsForKeys(
+      SQLiteQueryExecutor::getRawStatement(
+          std::string("SELECT ") + RowDecoder<ThreadMember>::columns +
+          " FROM thread_members WHERE thread_id = ?1;"),
+      {threadID},
+      members);
+  return members;
+}
+
+std::vector<std::string>
+SQLiteQueryExecutor::getThreadIDsForMember(std::string userID) const {
+  // Served by thread_members_idx_user
+  std::vector<ThreadMember> members;
+  decodeRowsForKeys(
+      SQLiteQueryExecutor::getRawStatement(
+          std::string("SELECT ") + RowDecoder<ThreadMember>::columns +
+          " FROM thread_members WHERE user_id = ?1;"),
+      {userID},
+      members);
+  std::vector<std::string> threadIDs;
+  threadIDs.reserve(members.size());
+  for (ThreadMember &member : members) {
+    threadIDs.push_back(std::move(member.thread_id));
+  }
+  return threadIDs;
+}
+
+std::vector<int> SQLiteQueryExecutor::getThreadMemberCounts(
+    const std::vector<std::string> &threadIDs) const {
+  // The primary key keeps the members of a thread next to each other
+  sqlite3_stmt *statement = SQLiteQueryExecutor::getRawStatement(
+      "SELECT count(*) FROM thread_members WHERE thread_id = ?1;");
+  std::vector<int> counts;
+  counts.reserve(threadIDs.size());
+  for (const std::string &threadID : threadIDs) {
+    sqlite3_bind_text(
+        statement, 1, threadID.c_str(), threadID.size(), SQLITE_TRANSIENT);
+    int result_code = sqlite3_step(statement);
+    counts.push_back(
+        result_code == SQLITE_ROW ? sqlite3_column_int(statement, 0) : 0);
+    sqlite3_reset(statement);
+    if (result_code != SQLITE_ROW) {
+      std::ostringstream error_message;
+      error_message << "Failed to count members of thread " << threadID
+                    << ": " << sqlite3_errmsg(sqlite3_db_handle(statement));
+      sqlite3_clear_bindings(statement);
+      throw std::system_error(
+          ECANCELED, std::generic_category(), error_message.str());
+    }
+  }
+  sqlite3_clear_bindings(statement);
+  return counts;
+}
+
+std::vector<ThreadSummary>
+SQLiteQueryExecutor::getThreadSummariesByRecency() const {
+  // Served by thread_summary_idx_last_message_time
+  std::vector<ThreadSummary> summaries;
+  decodeRows(
+      SQLiteQueryExecutor::getRawStatement(
+          std::string("SELECT ") + RowDecoder<ThreadSummary>::columns +
+          " FROM thread_summary"
+          " ORDER BY last_message_time DESC, thread_id DESC;"),
+      summaries);
+  return summaries;
+}
+
+void SQLiteQueryExecutor::updateThreadsJSONField(
+    const std::vector<std::string> &threadIDs,
+    const std::string &column,
+    const std::string &field,
+    const std::string &value) const {
+  if (column != "members" && column != "roles" && column != "current_user") {
+    throw std::system_error(
+        EINVAL,
+        std::generic_category(),
+        "Column " + column + " of threads table is not a JSON column");
+  }
+  if (threadIDs.empty()) {
+    return;
+  }
+  // json_set rewrites only the column value, so the thread row is neither
+  // read into memory nor parsed and serialized again. A row whose JSON is
+  // malformed would fail json_set and roll back the whole batch, so it is
+  // left out and logged instead.
+  sqlite3_stmt *statement = SQLiteQueryExecutor::getRawStatement(
+      "UPDATE threads SET " + column + " = json_set(" + column +
+      ", ?1, json(?2)) WHERE id = ?3 AND json_valid(" + column + ");");
+  std::string path = "$.\"" + field + "\"";
+  sqlite3_bind_text(statement, 1, path.c_str(), path.size(), SQLITE_TRANSIENT);
+  sqlite3_bind_text(
+      statement, 2, value.c_str(), value.size(), SQLITE_TRANSIENT);
+
+  auto &storage = SQLiteQueryExecutor::getStorage();
+  bool ownTransaction = threadIDs.size() > 1 &&
+      sqlite3_get_autocommit(sqlite3_db_handle(statement));
+  if (ownTransaction) {
+    storage.begin_transaction();
+  }
+  for (const std::string &threadID : threadIDs) {
+    sqlite3_bind_text(
+        statement, 3, threadID.c_str(), threadID.size(), SQLITE_TRANSIENT);
+    int result_code = sqlite3_step(statement);
+    sqlite3_reset(statement);
+    if (result_code != SQLITE_DONE) {
+      std::ostringstream error_message;
+      error_message << "Failed to update " << column << " of thread "
+                    << threadID << ": "
+                    << sqlite3_errmsg(sqlite3_db_handle(statement));
+      sqlite3_clear_bindings(statement);
+      if (ownTransaction) {
+        storage.rollback();
+      }
+      throw std::system_error(
+          ECANCELED, std::generic_category(), error_message.str());
+    }
+    if (!sqlite3_changes(sqlite3_db_handle(statement))) {
+      logMalformedThreadJSON(threadID, column);
+    }
+  }
+  sqlite3_clear_bindings(statement);
+  if (ownTransaction) {
+    storage.commit();
+  }
+}
+
+// Only reached when a thread wasn't updated, which is also the case of a
+// thread that doesn't exist
+void SQLiteQueryExecutor::logMalformedThreadJSON(
+    const std::string &threadID,
+    const std::string &column) {
+  sqlite3_stmt *statement = SQLiteQueryExecutor::getRawStatement(
+      "SELECT json_valid(" + column + ") FROM threads WHERE id = ?1;");
+  sqlite3_bind_text(
+      statement, 1, threadID.c_str(), threadID.size(), SQLITE_TRANSIENT);
+  bool malformed = sqlite3_step(statement) == SQLITE_ROW &&
+      !sqlite3_column_int(statement, 0);
+  sqlite3_reset(statement);
+  sqlite3_clear_bindings(statement);
+  if (malformed) {
+    Logger::log(
+        "Skipped update of " + column + " of thread " + threadID +
+        ": its JSON is malformed");
+  }
+}
+
 void SQLiteQueryExecutor::beginTransaction() const {
   SQLiteQueryExecutor::getStorage().begin_transaction();
 }
 
 void SQLiteQueryExecutor::commitTransaction() const {
   SQLiteQueryExecutor::getStorage().commit();
+  SQLiteQueryExecutor::messageCache.endTransaction();
 }
 
 void SQLiteQueryExecutor::rollbackTransaction() const {
   SQLiteQueryExecutor::getStorage().rollback();
+  SQLiteQueryExecutor::messageCache.endTransaction();
+}
+
+void SQLiteQueryExecutor::createSavepoint(const std::string &name) const {
+  SQLiteQueryExecutor::executeRawStatement("SAVEPOINT " + name + ";");
+}
+
+void SQLiteQueryExecutor::releaseSavepoint(const std::string &name) const {
+  SQLiteQueryExecutor::executeRawStatement("RELEASE " + name + ";");
+}
+
+void SQLiteQueryExecutor::rollbackToSavepoint(const std::string &name) const {
+  // ROLLBACK TO keeps the savepoint open, so it is released afterwards
+  SQLiteQueryExecutor::executeRawStatement("ROLLBACK TO " + name + ";");
+  SQLiteQueryExecutor::executeRawStatement("RELEASE " + name + ";");
 }
 
 std::vector<OlmPersistSession>
@@ -1052,13 +4330,37 @@ SQLiteQueryExecutor::getOlmPersistAccountData() const {
 }
 
 void SQLiteQueryExecutor::storeOlmPersistData(crypto::Persist persist) const {
-  OlmPersistAccount persistAccount = {
-      ACCOUNT_ID, std::string(persist.account.begin(), persist.account.end())};
-  SQLiteQueryExecutor::getStorage().replace(persistAccount);
-  for (auto it = persist.sessions.begin(); it != persist.sessions.end(); it++) {
-    OlmPersistSession persistSession = {
-        it->first, std::string(it->second.begin(), it->second.end())};
-    SQLiteQueryExecutor::getStorage().replace(persistSession);
+  std::vector<OlmPersistSession> persistSessions;
+  persistSessions.reserve(persist.sessions.size());
+  for (const auto &it : persist.sessions) {
+    persistSessions.push_back(
+        {it.first, std::string(it.second.begin(), it.second.end())});
+  }
+
+  // The account and the sessions ratcheted along with it are written
+  // together, so that they can't get out of sync
+  auto &storage = SQLiteQueryExecutor::getStorage();
+  bool ownTransaction = !SQLiteQueryExecutor::inTransaction();
+  if (ownTransaction) {
+    storage.begin_transaction();
+  }
+  try {
+    // An empty account means that only sessions changed
+    if (!persist.account.empty()) {
+      OlmPersistAccount persistAccount = {
+          ACCOUNT_ID,
+          std::string(persist.account.begin(), persist.account.end())};
+      SQLiteQueryExecutor::replaceEntity(persistAccount);
+    }
+    SQLiteQueryExecutor::replaceEntities(persistSessions);
+  } catch (...) {
+    if (ownTransaction) {
+      storage.rollback();
+    }
+    throw;
+  }
+  if (ownTransaction) {
+    storage.commit();
   }
 }
 
@@ -1092,7 +4394,7 @@ void SQLiteQueryExecutor::setMetadata(std::string entry_name, std::string data)
       entry_name,
       data,
   };
-  SQLiteQueryExecutor::getStorage().replace(entry);
+  SQLiteQueryExecutor::replaceEntity(entry);
 }
 
 void SQLiteQueryExecutor::clearMetadata(std::string entry_name) const {
@@ -1101,11 +4403,459 @@ void SQLiteQueryExecutor::clearMetadata(std::string entry_name) const {
 
 std::string SQLiteQueryExecutor::getMetadata(std::string entry_name) const {
   std::unique_ptr<Metadata> entry =
-      SQLiteQueryExecutor::getStorage().get_pointer<Metadata>(entry_name);
+      SQLiteQueryExecutor::getEntityPointer<Metadata>(entry_name);
   return (entry == nullptr) ? "" : entry->data;
 }
 
+bool SQLiteQueryExecutor::runMaintenance(int64_t timeBudgetMs) const {
+  auto deadline = std::chrono::steady_clock::now() +
+      std::chrono::milliseconds(timeBudgetMs);
+
+  // Maintenance runs on the database thread, on its own connection, which is
+  // already keyed and set up. Opening one for every run would derive the key
+  // again. Its transactions can't be nested in one that is open.
+  sqlite3 *db = SQLiteQueryExecutor::getConnection();
+  if (!sqlite3_get_autocommit(db)) {
+    return false;
+  }
+
+  // Compression and merges of the full-text index go first, as the pages
+  // they free are reclaimed by vacuum. Compressed rows hold the same
+  // content, so neither JS nor the backup logs are told about them.
+  const ChangeCapture::Suppression suppression;
+  bool trained = false;
+  bool completed;
+  SQLiteQueryExecutor::backupLogRecorder.setPaused(true);
+  try {
+    completed = compress_content(db, deadline, trained);
+  } catch (...) {
+    SQLiteQueryExecutor::backupLogRecorder.setPaused(false);
+    // The batches before the one that failed are compressed
+    if (trained) {
+      SQLiteQueryExecutor::backupLogRecorder.clear();
+    }
+    throw;
+  }
+  SQLiteQueryExecutor::backupLogRecorder.setPaused(false);
+  if (trained) {
+    // The logs of the rows compressed from now on can't be read without the
+    // dictionary, which only goes to backup with a compaction
+    SQLiteQueryExecutor::backupLogRecorder.clear();
+  }
+  completed = merge_fts_index(db, deadline) && completed;
+  completed = vacuum_database(db, deadline) && completed;
+  if (completed && std::chrono::steady_clock::now() < deadline) {
+    optimize_database(db);
+  } else {
+    completed = false;
+  }
+  // Checkpoint goes last, so that pages written by vacuum do not stay in WAL
+  // until the next run
+  checkpoint_database(db);
+  return completed;
+}
+
+void SQLiteQueryExecutor::vacuumDatabase() const {
+  sqlite3 *db;
+  sqlite3_open(SQLiteQueryExecutor::sqliteFilePath.c_str(), &db);
+  on_database_open(db);
+  try {
+    // Also switches databases created before incremental vacuum was enabled
+    // to it. VACUUM may change rowids of messages, which the full-text
+    // indexes refer to, so they are rebuilt afterwards.
+    execute_or_throw(
+        db,
+        "PRAGMA auto_vacuum = INCREMENTAL; VACUUM;"
+        "INSERT INTO messages_fts (messages_fts) VALUES ('rebuild');"
+        "INSERT INTO archived_messages_fts (archived_messages_fts)"
+        "  VALUES ('rebuild');",
+        "Failed to vacuum database.");
+  } catch (...) {
+    sqlite3_close(db);
+    throw;
+  }
+  checkpoint_database(db);
+  sqlite3_close(db);
+}
+
+DatabaseStartupMetrics SQLiteQueryExecutor::getStartupMetrics() const {
+  std::lock_guard<std::mutex> lock(migration_mutex);
+  return startup_metrics;
+}
+
+// Threads whose latest messages are read by warmUp, and how many of them
+const int WARM_UP_THREADS_COUNT = 20;
+const int WARM_UP_THREAD_MESSAGES_COUNT = 20;
+
+void SQLiteQueryExecutor::warmUp() const {
+  // The recent end of thread_summary_idx_last_message_time, and the latest
+  // messages of those threads through messages_idx_thread_time, are what
+  // the thread list and the first opened thread read
+  sqlite3_stmt *statement = SQLiteQueryExecutor::getRawStatement(
+      "SELECT COUNT(m.content) FROM ("
+      "  SELECT thread_id FROM thread_summary"
+      "  ORDER BY last_message_time DESC LIMIT ?1"
+      ") AS s, messages AS m"
+      " WHERE m.rowid IN ("
+      "  SELECT rowid FROM messages WHERE thread = s.thread_id"
+      "  ORDER BY time DESC LIMIT ?2"
+      ");");
+  sqlite3_bind_int(statement, 1, WARM_UP_THREADS_COUNT);
+  sqlite3_bind_int(statement, 2, WARM_UP_THREAD_MESSAGES_COUNT);
+  int result_code = sqlite3_step(statement);
+  sqlite3_reset(statement);
+  sqlite3_clear_bindings(statement);
+  if (result_code != SQLITE_ROW) {
+    std::ostringstream error_message;
+    error_message << "Failed to warm up the database: "
+                  << sqlite3_errmsg(sqlite3_db_handle(statement));
+    throw std::system_error(
+        ECANCELED, std::generic_category(), error_message.str());
+  }
+}
+
+bool connection_opened() {
+  // A connection opened only to be released would cost more than it frees,
+  // and the writer one can't be opened before initialize
+  if (use_read_only_connection) {
+    return read_only_storage != nullptr;
+  }
+  return !SQLiteQueryExecutor::sqliteFilePath.empty();
+}
+
+void SQLiteQueryExecutor::releaseMemory() const {
+  if (!connection_opened()) {
+    return;
+  }
+  SQLiteQueryExecutor::getStatementCache().releaseRawStatements();
+  sqlite3_db_release_memory(SQLiteQueryExecutor::getConnection());
+  if (!use_read_only_connection) {
+    SQLiteQueryExecutor::messageCache.invalidateAll(
+        SQLiteQueryExecutor::inTransaction());
+  }
+}
+
+DatabaseMemoryStats SQLiteQueryExecutor::getMemoryStats() const {
+  DatabaseMemoryStats stats{};
+  sqlite3_int64 current;
+  sqlite3_int64 highwater;
+  sqlite3_status64(SQLITE_STATUS_MEMORY_USED, &current, &highwater, 0);
+  stats.memoryUsed = current;
+  stats.memoryHighwater = highwater;
+  sqlite3_status64(SQLITE_STATUS_MALLOC_SIZE, &current, &highwater, 0);
+  stats.largestAllocation = highwater;
+  sqlite3_status64(SQLITE_STATUS_PAGECACHE_OVERFLOW, &current, &highwater, 0);
+  stats.pageCacheOverflow = current;
+  stats.messageCacheSize = SQLiteQueryExecutor::messageCache.getSize();
+  if (!connection_opened()) {
+    return stats;
+  }
+
+  sqlite3 *db = SQLiteQueryExecutor::getConnection();
+  auto connectionStatus = [db](int operation) {
+    int connectionCurrent;
+    int connectionHighwater;
+    sqlite3_db_status(
+        db, operation, &connectionCurrent, &connectionHighwater, 0);
+    return static_cast<int64_t>(connectionCurrent);
+  };
+  stats.connectionCacheUsed = connectionStatus(SQLITE_DBSTATUS_CACHE_USED);
+  stats.connectionSchemaUsed = connectionStatus(SQLITE_DBSTATUS_SCHEMA_USED);
+  stats.connectionStatementsUsed = connectionStatus(SQLITE_DBSTATUS_STMT_USED);
+  stats.cachedStatements = SQLiteQueryExecutor::getStatementCache().size();
+  return stats;
+}
+
+std::vector<QueryPlan> SQLiteQueryExecutor::getQueryPlans() const {
+  sqlite3 *db = SQLiteQueryExecutor::getConnection();
+  std::vector<QueryPlan> plans;
+  for (const QueryProfile &profile : QueryProfiler::getSnapshot()) {
+    // Explaining a statement is recorded too
+    if (profile.query == QUERY_PROFILER_OTHER_TEMPLATE ||
+        profile.query.rfind("EXPLAIN ", 0) == 0) {
+      continue;
+    }
+    QueryPlan plan{profile.query, {}, ""};
+    // Not cached, every statement is only explained once
+    sqlite3_stmt *statement;
+    std::string explain = "EXPLAIN QUERY PLAN " + profile.query;
+    if (sqlite3_prepare_v2(db, explain.c_str(), -1, &statement, nullptr) !=
+        SQLITE_OK) {
+      plan.error = sqlite3_errmsg(db);
+      plans.push_back(std::move(plan));
+      continue;
+    }
+    int result_code;
+    while ((result_code = sqlite3_step(statement)) == SQLITE_ROW) {
+      // Columns are id, parent, notused and detail
+      const unsigned char *detail = sqlite3_column_text(statement, 3);
+      plan.steps.push_back(
+          detail != nullptr ? reinterpret_cast<const char *>(detail) : "");
+    }
+    if (result_code != SQLITE_DONE) {
+      plan.error = sqlite3_errmsg(db);
+    }
+    sqlite3_finalize(statement);
+    plans.push_back(std::move(plan));
+  }
+  return plans;
+}
+
+DatabaseChanges SQLiteQueryExecutor::getDatabaseChanges() const {
+  ChangeCapture::Changes changes = SQLiteQueryExecutor::changeCapture.take();
+  DatabaseChanges databaseChanges;
+  if (changes.overflowed) {
+    databaseChanges.reloadRequired = true;
+    return databaseChanges;
+  }
+
+  auto resolveRowIDs = [](const std::string &sql,
+                          const std::unordered_set<int64_t> &rowIDs,
+                          std::unordered_set<std::string> &keys) {
+    if (rowIDs.empty()) {
+      return;
+    }
+    sqlite3_stmt *statement = SQLiteQueryExecutor::getRawStatement(sql);
+    for (int64_t rowID : rowIDs) {
+      sqlite3_bind_int64(statement, 1, rowID);
+      int result_code = sqlite3_step(statement);
+      if (result_code == SQLITE_ROW) {
+        const char *key =
+            reinterpret_cast<const char *>(sqlite3_column_text(statement, 0));
+        if (key != nullptr) {
+          keys.insert(key);
+        }
+      }
+      sqlite3_reset(statement);
+      if (result_code != SQLITE_ROW && result_code != SQLITE_DONE) {
+        std::ostringstream error_message;
+        error_message << "Failed to resolve changed rows: "
+                      << sqlite3_errmsg(sqlite3_db_handle(statement));
+        throw std::system_error(
+            ECANCELED, std::generic_category(), error_message.str());
+      }
+    }
+  };
+  // A row deleted since it was changed resolves to nothing, its delete was
+  // recorded by key
+  resolveRowIDs(
+      "SELECT id FROM messages WHERE rowid = ?1;",
+      changes.messageRowIDs,
+      changes.messageIDs);
+  resolveRowIDs(
+      "SELECT container FROM media WHERE rowid = ?1;",
+      changes.mediaRowIDs,
+      changes.messageIDs);
+  resolveRowIDs(
+      "SELECT id FROM threads WHERE rowid = ?1;",
+      changes.threadRowIDs,
+      changes.threadIDs);
+
+  if (!changes.messageIDs.empty()) {
+    std::vector<std::string> messageIDs(
+        changes.messageIDs.begin(), changes.messageIDs.end());
+    std::vector<Message> messages;
+    decodeRowsForKeys(
+        SQLiteQueryExecutor::getRawStatement(
+            std::string("SELECT ") + RowDecoder<Message>::columns +
+            " FROM messages WHERE id = ?1;"),
+        messageIDs,
+        messages);
+    for (const Message &message : messages) {
+      changes.messageIDs.erase(message.id);
+    }
+    databaseChanges.messages =
+        SQLiteQueryExecutor::attachMedia(std::move(messages));
+    databaseChanges.removedMessageIDs.assign(
+        changes.messageIDs.begin(), changes.messageIDs.end());
+  }
+  if (!changes.threadIDs.empty()) {
+    std::vector<std::string> threadIDs(
+        changes.threadIDs.begin(), changes.threadIDs.end());
+    databaseChanges.threads = this->getThreadsByIDs(threadIDs);
+    for (const Thread &thread : databaseChanges.threads) {
+      changes.threadIDs.erase(thread.id);
+    }
+    databaseChanges.removedThreadIDs.assign(
+        changes.threadIDs.begin(), changes.threadIDs.end());
+  }
+  return databaseChanges;
+}
+
+void SQLiteQueryExecutor::recordBackupLog() const {
+  if (!use_read_only_connection) {
+    SQLiteQueryExecutor::backupLogRecorder.record();
+  }
+}
+
+BackupLogs SQLiteQueryExecutor::takeBackupLogs() const {
+  if (use_read_only_connection) {
+    return BackupLogs();
+  }
+  return SQLiteQueryExecutor::backupLogRecorder.takeLogs();
+}
+
+void SQLiteQueryExecutor::startBackupSnapshot() const {
+  SQLiteQueryExecutor::backupSnapshot = nullptr;
+  std::string path = SQLiteQueryExecutor::sqliteFilePath + "_backup_snapshot";
+  std::remove(path.c_str());
+  sqlite3 *destination;
+  if (sqlite3_open(path.c_str(), &destination) != SQLITE_OK) {
+    std::ostringstream error_message;
+    error_message << "Failed to open backup snapshot: "
+                  << sqlite3_errmsg(destination);
+    sqlite3_close(destination);
+    throw std::system_error(
+        ECANCELED, std::generic_category(), error_message.str());
+  }
+  try {
+    // The pages are copied as they are, so both use the same key
+    set_encryption_key(destination);
+  } catch (...) {
+    sqlite3_close(destination);
+    throw;
+  }
+  SQLiteQueryExecutor::backupSnapshot = std::make_unique<BackupSnapshot>(
+      SQLiteQueryExecutor::getConnection(), destination, path);
+}
+
+bool SQLiteQueryExecutor::stepBackupSnapshot() const {
+  if (SQLiteQueryExecutor::backupSnapshot == nullptr) {
+    throw std::system_error(
+        ECANCELED, std::generic_category(), "No backup snapshot in progress");
+  }
+  if (!SQLiteQueryExecutor::backupSnapshot->step()) {
+    return false;
+  }
+  SQLiteQueryExecutor::backupLogRecorder.restartAfterCompaction();
+  return true;
+}
+
+std::string SQLiteQueryExecutor::readBackupSnapshotChunk() const {
+  if (SQLiteQueryExecutor::backupSnapshot == nullptr) {
+    throw std::system_error(
+        ECANCELED, std::generic_category(), "No backup snapshot in progress");
+  }
+  std::string chunk = SQLiteQueryExecutor::backupSnapshot->readChunk();
+  if (chunk.empty()) {
+    SQLiteQueryExecutor::backupSnapshot = nullptr;
+  }
+  return chunk;
+}
+
+std::string backup_restore_path() {
+  return SQLiteQueryExecutor::sqliteFilePath + "_backup_restore";
+}
+
+BackupRestore &get_backup_restore(std::unique_ptr<BackupRestore> &restore) {
+  if (restore == nullptr) {
+    throw std::system_error(
+        ECANCELED, std::generic_category(), "No backup restore in progress");
+  }
+  return *restore;
+}
+
+// Checks the key of the backup against the compaction and, if the key of
+// this device is a different one, encrypts the compaction with it instead
+void rekey_backup_restore(const std::string &encryptionKey) {
+  // The compaction keeps the cipher settings of the device that made it.
+  // Settings other than the current ones are exported by migrate() once the
+  // compaction replaces the database.
+  const CipherProfile *profile;
+  sqlite3 *db = open_with_any_cipher_profile(
+      backup_restore_path(), encryptionKey, profile);
+  if (db == nullptr) {
+    throw std::system_error(
+        ECANCELED,
+        std::generic_category(),
+        "Failed to decrypt backup compaction.");
+  }
+  try {
+    if (encryptionKey != SQLiteQueryExecutor::encryptionKey) {
+      execute_or_throw(
+          db,
+          "PRAGMA rekey = \"x'" + SQLiteQueryExecutor::encryptionKey + "'\";",
+          "Failed to rekey backup compaction.");
+    }
+  } catch (...) {
+    sqlite3_close(db);
+    throw;
+  }
+  sqlite3_close(db);
+}
+
+void SQLiteQueryExecutor::startBackupRestore() const {
+  SQLiteQueryExecutor::backupRestore = nullptr;
+  SQLiteQueryExecutor::backupRestore =
+      std::make_unique<BackupRestore>(backup_restore_path());
+}
+
+void SQLiteQueryExecutor::writeBackupRestoreCompactionChunk(
+    const std::string &chunk) const {
+  get_backup_restore(SQLiteQueryExecutor::backupRestore)
+      .writeCompactionChunk(chunk);
+}
+
+void SQLiteQueryExecutor::finishBackupRestoreCompaction(
+    const std::string &encryptionKey) const {
+  get_backup_restore(SQLiteQueryExecutor::backupRestore).finishCompaction();
+  rekey_backup_restore(encryptionKey);
+  SQLiteQueryExecutor::closeDatabase();
+  // The journal of the replaced database doesn't belong to the compaction
+  for (const char *suffix : {"-wal", "-shm"}) {
+    std::string path = SQLiteQueryExecutor::sqliteFilePath + suffix;
+    if (file_exists(path)) {
+      attempt_delete_file(path, "Failed to delete database journal");
+    }
+  }
+  attempt_rename_file(
+      backup_restore_path(),
+      SQLiteQueryExecutor::sqliteFilePath,
+      "Failed to replace database with backup compaction");
+  std::lock_guard<std::mutex> lock(migration_mutex);
+  SQLiteQueryExecutor::migrate();
+}
+
+void SQLiteQueryExecutor::applyBackupRestoreLogChunk(
+    const std::string &chunk) const {
+  BackupRestore &restore =
+      get_backup_restore(SQLiteQueryExecutor::backupRestore);
+  if (restore.addLogChunk(chunk)) {
+    restore.applyLogs(SQLiteQueryExecutor::getConnection());
+  }
+}
+
+void SQLiteQueryExecutor::finishBackupRestore() const {
+  BackupRestore &restore =
+      get_backup_restore(SQLiteQueryExecutor::backupRestore);
+  restore.finishLogs();
+  restore.applyLogs(SQLiteQueryExecutor::getConnection());
+  SQLiteQueryExecutor::backupRestore = nullptr;
+  // The cached messages and the recorded changes come from the database
+  // before the logs
+  SQLiteQueryExecutor::messageCache.clear();
+  SQLiteQueryExecutor::backupLogRecorder.clear();
+}
+
+void SQLiteQueryExecutor::closeDatabase() {
+  // The snapshot and the session go before the connection that the
+  // statements keep open
+  SQLiteQueryExecutor::backupSnapshot = nullptr;
+  SQLiteQueryExecutor::backupLogRecorder.detach();
+  SQLiteQueryExecutor::backupLogRecorder.clear();
+  SQLiteQueryExecutor::statementCache.clear();
+  SQLiteQueryExecutor::messageCache.clear();
+  SQLiteQueryExecutor::changeCapture.clear();
+  ContentCompressor::instance().setDictionary("");
+  storage_generation++;
+  writer_connection_ready = false;
+}
+
 void SQLiteQueryExecutor::clearSensitiveData() {
+  // The secure store may have been cleared along with the data
+  CommSecureStore::clearCache();
+  SQLiteQueryExecutor::backupRestore = nullptr;
+  SQLiteQueryExecutor::closeDatabase();
   if (file_exists(SQLiteQueryExecutor::sqliteFilePath) &&
       std::remove(SQLiteQueryExecutor::sqliteFilePath.c_str())) {
     std::ostringstream errorStream;
@@ -1117,6 +4867,7 @@ void SQLiteQueryExecutor::clearSensitiveData() {
     SQLiteQueryExecutor::assign_encryption_key();
   };
   run_with_native_accessible(native_dependent_task);
+  std::lock_guard<std::mutex> lock(migration_mutex);
   SQLiteQueryExecutor::migrate();
 }
 
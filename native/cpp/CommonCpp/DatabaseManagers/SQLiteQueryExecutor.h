@@ -1,18 +1,70 @@
 #pragma once
 
 #include "../CryptoTools/Persist.h"
+#include "BackupLogRecorder.h"
+#include "BackupRestore.h"
+#include "BackupSnapshot.h"
+#include "ChangeCapture.h"
 #include "DatabaseQueryExecutor.h"
+#include "MessageCache.h"
+#include "StatementCache.h"
 #include "entities/Draft.h"
 
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace comm {
 
 class SQLiteQueryExecutor : public DatabaseQueryExecutor {
   static void migrate();
   static void assign_encryption_key();
+  // Closes the writer connection and drops what depends on the database
+  // file, before the file is deleted or replaced
+  static void closeDatabase();
   static auto &getStorage();
+  static StatementCache &getStatementCache();
+  template <typename T> static void replaceEntity(const T &entity);
+  template <typename T>
+  static void replaceEntities(const std::vector<T> &entities);
+  // Replaces messages and media through RowEncoder, which compresses their
+  // content
+  template <typename T> static void replaceRows(const T *rows, size_t count);
+  template <typename T, typename Id>
+  static std::unique_ptr<T> getEntityPointer(const Id &id);
+  static sqlite3 *getConnection();
+  static sqlite3_stmt *getRawStatement(const std::string &sql);
+  static void executeRawStatement(const std::string &sql);
+  static bool inTransaction();
+  // Runs the statements of read on a single snapshot of the database, which
+  // a connection outside of a transaction takes anew for every statement
+  static void readInTransaction(const std::function<void()> &read);
+  static void
+  rekey(const std::string &sql,
+        const std::vector<std::pair<std::string, std::string>> &ids);
+  // Runs a statement that selects its keys from temp.bulk_keys, filled with
+  // the given keys for the time of the statement
+  static void
+  runWithBulkKeys(const std::string &sql, const std::vector<std::string> &keys);
+  static bool hasArchivedMessages();
+  // Removes the archived messages whose column is one of the keys
+  static void removeArchivedMessages(
+      const std::string &column,
+      const std::vector<std::string> &keys);
+  // Deletes the files of the entries, then the entries whose file is gone.
+  // Returns the bytes they accounted for.
+  static int64_t evictMediaCacheEntries(
+      const std::vector<MediaCacheEntry> &entries,
+      MediaCacheEviction &eviction);
+  static std::vector<std::pair<Message, std::vector<Media>>>
+  attachMedia(std::vector<Message> messages);
+  // Logs a thread that updateThreadsJSONField left out for its JSON
+  static void logMalformedThreadJSON(
+      const std::string &threadID,
+      const std::string &column);
   void setMetadata(std::string entry_name, std::string data) const override;
   void clearMetadata(std::string entry_name) const override;
   std::string getMetadata(std::string entry_name) const override;
@@ -20,6 +72,12 @@ class SQLiteQueryExecutor : public DatabaseQueryExecutor {
   static std::once_flag initialized;
   static int sqlcipherEncryptionKeySize;
   static std::string secureStoreEncryptionKeyID;
+  static StatementCache statementCache;
+  static MessageCache messageCache;
+  static ChangeCapture changeCapture;
+  static BackupLogRecorder backupLogRecorder;
+  static std::unique_ptr<BackupSnapshot> backupSnapshot;
+  static std::unique_ptr<BackupRestore> backupRestore;
 
 public:
   static std::string sqliteFilePath;
@@ -27,6 +85,17 @@ public:
 
   SQLiteQueryExecutor();
   static void initialize(std::string &databasePath);
+  // Same as initialize, for processes that only store incoming messages. If
+  // the database is already encrypted and up to date, opening it skips
+  // encryption validation, migration checks and profile recording. The key is
+  // fetched from the secure store only once per process either way.
+  static void initializeForIngestion(std::string &databasePath);
+  // Picks the cipher settings that the database is encrypted with, by the
+  // name of a profile. Has to be called before initialize. A database
+  // encrypted with other settings is exported to these once it is opened.
+  static void setCipherProfile(const std::string &name);
+  static void useReadOnlyConnection();
+  static void useReadWriteConnection();
   std::unique_ptr<Thread> getThread(std::string threadID) const override;
   std::string getDraft(std::string key) const override;
   void updateDraft(std::string key, std::string text) const override;
@@ -36,11 +105,46 @@ public:
   void removeAllMessages() const override;
   std::vector<std::pair<Message, std::vector<Media>>>
   getAllMessages() const override;
+  CompactMessageStore getAllMessagesCompact() const override;
+  std::vector<std::pair<Message, std::vector<Media>>> getThreadMessagesBefore(
+      std::string threadID,
+      int64_t beforeTime,
+      std::string beforeMessageID,
+      int pageSize) const override;
+  bool prefetchThreadMessagesBefore(
+      const std::string &threadID,
+      int64_t &beforeTime,
+      std::string &beforeMessageID,
+      int pageSize,
+      size_t maxCacheSize) const override;
+  std::vector<std::pair<Message, std::vector<Media>>> getMessagesOfThreads(
+      const std::vector<std::string> &threadIDs) const override;
+  std::vector<std::pair<Message, std::vector<Media>>>
+  getMessagesWithoutThread() const override;
+  std::vector<std::pair<Message, std::vector<Media>>> getThreadMessagesInRange(
+      const std::string &threadID,
+      int64_t fromTime,
+      int64_t toTime,
+      int limit) const override;
+  std::vector<std::pair<Message, std::vector<Media>>>
+  getMessagesByIDs(const std::vector<std::string> &ids) const override;
+  std::vector<int> getThreadMessageCounts(
+      const std::vector<std::string> &threadIDs) const override;
+  std::vector<std::pair<Message, std::vector<Media>>> searchMessages(
+      std::string query,
+      folly::Optional<std::string> threadID,
+      int pageSize,
+      int offset) const override;
   void removeMessages(const std::vector<std::string> &ids) const override;
   void removeMessagesForThreads(
       const std::vector<std::string> &threadIDs) const override;
+  int archiveMessages(int64_t olderThan) const override;
   void replaceMessage(const Message &message) const override;
+  void replaceMessages(const std::vector<Message> &messages) const override;
   void rekeyMessage(std::string from, std::string to) const override;
+  void rekeyMessagesBatch(
+      const std::vector<std::pair<std::string, std::string>> &ids)
+      const override;
   void removeAllMedia() const override;
   void removeMediaForMessages(
       const std::vector<std::string> &msg_ids) const override;
@@ -48,14 +152,58 @@ public:
   void removeMediaForThreads(
       const std::vector<std::string> &thread_ids) const override;
   void replaceMedia(const Media &media) const override;
+  void replaceMediaBatch(const std::vector<Media> &media) const override;
   void rekeyMediaContainers(std::string from, std::string to) const override;
+  void rekeyMediaContainersBatch(
+      const std::vector<std::pair<std::string, std::string>> &containers)
+      const override;
+  void recordMediaCacheEntry(const MediaCacheEntry &entry) const override;
+  void touchMediaCacheEntries(
+      const std::vector<std::string> &mediaIDs,
+      int64_t accessedAt) const override;
+  int64_t getMediaCacheSize() const override;
+  MediaCacheEviction evictMediaCache(int64_t budget) const override;
+  void addToOutbox(const std::vector<OutboxEntry> &entries) const override;
+  std::vector<OutboxEntry> takeOutboxBatch(int limit) const override;
+  void updateOutboxPayloads(
+      const std::vector<OutboxEntry> &entries) const override;
+  void requeueOutboxEntries(
+      const std::vector<std::string> &localIDs) const override;
+  void acknowledgeOutboxEntries(
+      const std::vector<std::pair<std::string, std::string>> &serverIDs)
+      const override;
   std::vector<Thread> getAllThreads() const override;
+  std::vector<Thread> getAllThreadsByActivity() const override;
+  std::vector<Thread> getAllThreadSummaries() const override;
+  CompactThreadStore
+  getAllThreadsCompact(bool includeMembership) const override;
+  std::vector<Thread>
+  getThreadsByIDs(const std::vector<std::string> &ids) const override;
   void removeThreads(std::vector<std::string> ids) const override;
   void replaceThread(const Thread &thread) const override;
+  bool replaceThreadIfChanged(const Thread &thread) const override;
+  std::vector<std::pair<std::string, int64_t>>
+  getThreadHashes() const override;
+  void replaceThreads(const std::vector<Thread> &threads) const override;
   void removeAllThreads() const override;
+  std::vector<ThreadMember>
+  getThreadMembers(std::string threadID) const override;
+  std::vector<std::string>
+  getThreadIDsForMember(std::string userID) const override;
+  std::vector<int> getThreadMemberCounts(
+      const std::vector<std::string> &threadIDs) const override;
+  std::vector<ThreadSummary> getThreadSummariesByRecency() const override;
+  void updateThreadsJSONField(
+      const std::vector<std::string> &threadIDs,
+      const std::string &column,
+      const std::string &field,
+      const std::string &value) const override;
   void beginTransaction() const override;
   void commitTransaction() const override;
   void rollbackTransaction() const override;
+  void createSavepoint(const std::string &name) const override;
+  void releaseSavepoint(const std::string &name) const override;
+  void rollbackToSavepoint(const std::string &name) const override;
   std::vector<OlmPersistSession> getOlmPersistSessionsData() const override;
   folly::Optional<std::string> getOlmPersistAccountData() const override;
   void storeOlmPersistData(crypto::Persist persist) const override;
@@ -65,6 +213,26 @@ public:
   std::string getCurrentUserID() const override;
   void setDeviceID(std::string deviceID) const override;
   std::string getDeviceID() const override;
+  bool runMaintenance(int64_t timeBudgetMs) const override;
+  void vacuumDatabase() const override;
+  DatabaseStartupMetrics getStartupMetrics() const override;
+  void warmUp() const override;
+  void releaseMemory() const override;
+  DatabaseMemoryStats getMemoryStats() const override;
+  std::vector<QueryPlan> getQueryPlans() const override;
+  DatabaseChanges getDatabaseChanges() const override;
+  void recordBackupLog() const override;
+  BackupLogs takeBackupLogs() const override;
+  void startBackupSnapshot() const override;
+  bool stepBackupSnapshot() const override;
+  std::string readBackupSnapshotChunk() const override;
+  void startBackupRestore() const override;
+  void
+  writeBackupRestoreCompactionChunk(const std::string &chunk) const override;
+  void finishBackupRestoreCompaction(
+      const std::string &encryptionKey) const override;
+  void applyBackupRestoreLogChunk(const std::string &chunk) const override;
+  void finishBackupRestore() const override;
   static void clearSensitiveData();
 };
 
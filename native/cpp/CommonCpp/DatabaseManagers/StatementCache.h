@@ -0,0 +1,77 @@
+#pragma once
+
+#include <sqlite3.h>
+
+#include <memory>
+#include <string>
+#include <typeindex>
+#include <unordered_map>
+
+namespace comm {
+
+/**
+ * Keeps sqlite_orm prepared statements alive between calls so hot queries
+ * only rebind their parameters instead of re-preparing SQL every time.
+ * Statements are keyed by their type, which sqlite_orm derives from the
+ * shape of the query. A cached statement keeps the storage connection
+ * retained, so the cache has to be cleared before the database file is
+ * removed or replaced.
+ */
+class StatementCache {
+  std::unordered_map<std::type_index, std::shared_ptr<void>> statements;
+  std::unordered_map<std::string, std::shared_ptr<sqlite3_stmt>>
+      rawStatements;
+
+public:
+  template <typename Statement, typename PrepareFunction>
+  Statement &get(PrepareFunction &&prepare) {
+    auto it = this->statements.find(typeid(Statement));
+    if (it == this->statements.end()) {
+      // prepared_statement_t finalizes its sqlite3_stmt on destruction and
+      // must never be copied, so it is constructed in place from prepare()
+      std::shared_ptr<Statement> statement(new Statement(prepare()));
+      it = this->statements.emplace(typeid(Statement), std::move(statement))
+               .first;
+    }
+    return *std::static_pointer_cast<Statement>(it->second);
+  }
+
+  // Raw statements are meant for queries sqlite_orm can't express and are
+  // keyed by their SQL. They don't retain the connection, so they must be
+  // used on one that sqlite_orm statements from this cache keep open.
+  sqlite3_stmt *get(sqlite3 *db, const std::string &sql) {
+    auto it = this->rawStatements.find(sql);
+    if (it == this->rawStatements.end()) {
+      sqlite3_stmt *statement;
+      if (sqlite3_prepare_v2(db, sql.c_str(), -1, &statement, nullptr) !=
+          SQLITE_OK) {
+        sqlite3_finalize(statement);
+        return nullptr;
+      }
+      it = this->rawStatements
+               .emplace(
+                   sql,
+                   std::shared_ptr<sqlite3_stmt>(statement, sqlite3_finalize))
+               .first;
+    }
+    return it->second.get();
+  }
+
+  size_t size() const {
+    return this->statements.size() + this->rawStatements.size();
+  }
+
+  // Finalizes the raw statements, which are prepared again when next used.
+  // The sqlite_orm ones are kept, as they keep the connection open.
+  void releaseRawStatements() {
+    this->rawStatements.clear();
+  }
+
+  void clear() {
+    // Raw statements go first, while the connection is still retained
+    this->rawStatements.clear();
+    this->statements.clear();
+  }
+};
+
+} // namespace comm
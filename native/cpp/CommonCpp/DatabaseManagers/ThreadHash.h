@@ -0,0 +1,67 @@
+#pragma once
+
+#include "entities/Thread.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace comm {
+
+inline void hash_bytes(uint64_t &hash, const char *data, size_t size) {
+  // FNV-1a
+  for (size_t i = 0; i < size; i++) {
+    hash ^= static_cast<unsigned char>(data[i]);
+    hash *= 1099511628211ULL;
+  }
+}
+
+inline void hash_field(uint64_t &hash, const char *data, size_t size) {
+  // The size comes first so that fields can't run into each other
+  uint64_t size64 = size;
+  hash_bytes(hash, reinterpret_cast<const char *>(&size64), sizeof(size64));
+  hash_bytes(hash, data, size);
+}
+
+inline void hash_field(uint64_t &hash, const std::string &value) {
+  hash_field(hash, value.data(), value.size());
+}
+
+inline void
+hash_field(uint64_t &hash, const std::unique_ptr<std::string> &value) {
+  if (!value) {
+    // Set apart from an empty string by a size that no string has
+    uint64_t nullSize = UINT64_MAX;
+    hash_bytes(
+        hash, reinterpret_cast<const char *>(&nullSize), sizeof(nullSize));
+    return;
+  }
+  hash_field(hash, *value);
+}
+
+inline void hash_field(uint64_t &hash, int64_t value) {
+  hash_field(hash, reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+// Hash of every column of a thread row, stored by replaceThreadIfChanged to
+// tell whether a thread is written the same as it was last time
+inline int64_t hash_thread(const Thread &thread) {
+  uint64_t hash = 14695981039346656037ULL;
+  hash_field(hash, thread.id);
+  hash_field(hash, thread.type);
+  hash_field(hash, thread.name);
+  hash_field(hash, thread.description);
+  hash_field(hash, thread.color);
+  hash_field(hash, thread.creation_time);
+  hash_field(hash, thread.parent_thread_id);
+  hash_field(hash, thread.containing_thread_id);
+  hash_field(hash, thread.community);
+  hash_field(hash, thread.members);
+  hash_field(hash, thread.roles);
+  hash_field(hash, thread.current_user);
+  hash_field(hash, thread.source_message_id);
+  hash_field(hash, thread.replies_count);
+  return static_cast<int64_t>(hash);
+}
+
+} // namespace comm
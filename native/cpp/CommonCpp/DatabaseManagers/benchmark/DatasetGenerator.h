@@ -0,0 +1,113 @@
+#pragma once
+
+// Synthetic rows shaped like the ones of a real client database, shared by
+// the host benchmarks. The generator is seeded, so every run gets the same
+// rows.
+#include "entities/Draft.h"
+#include "entities/Media.h"
+#include "entities/Message.h"
+#include "entities/Thread.h"
+
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace comm {
+
+struct DatasetOptions {
+  size_t threads = 200;
+  size_t messagesPerThread = 500;
+  size_t mediaPerMessage = 1;
+  size_t contentSize = 200;
+};
+
+class DatasetGenerator {
+  std::mt19937 generator{42};
+
+public:
+  std::string randomText(size_t size) {
+    static const char characters[] =
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 ";
+    std::uniform_int_distribution<size_t> distribution(
+        0, sizeof(characters) - 2);
+    std::string text(size, ' ');
+    for (char &character : text) {
+      character = characters[distribution(this->generator)];
+    }
+    return text;
+  }
+
+  std::vector<Thread> threads(const DatasetOptions &options) {
+    std::vector<Thread> threads;
+    for (size_t i = 0; i < options.threads; i++) {
+      threads.push_back(Thread{
+          "thread-" + std::to_string(i),
+          3,
+          std::make_unique<std::string>(this->randomText(20)),
+          std::make_unique<std::string>(this->randomText(100)),
+          "4b87c1",
+          static_cast<int64_t>(1600000000000 + i),
+          nullptr,
+          nullptr,
+          nullptr,
+          R"([{"id":"256","role":"83796","permissions":{}}])",
+          R"({"83796":{"id":"83796","name":"Members","permissions":{}}})",
+          R"({"role":"83796","permissions":{},"subscription":{}})",
+          nullptr,
+          0});
+    }
+    return threads;
+  }
+
+  Message message(const DatasetOptions &options, size_t thread, size_t index) {
+    return Message{
+        std::to_string(thread * options.messagesPerThread + index),
+        nullptr,
+        "thread-" + std::to_string(thread),
+        "256",
+        0,
+        nullptr,
+        std::make_unique<std::string>(this->randomText(options.contentSize)),
+        static_cast<int64_t>(1600000000000 + index * options.threads + thread)};
+  }
+
+  std::vector<Message> messages(const DatasetOptions &options) {
+    std::vector<Message> messages;
+    for (size_t thread = 0; thread < options.threads; thread++) {
+      for (size_t i = 0; i < options.messagesPerThread; i++) {
+        messages.push_back(this->message(options, thread, i));
+      }
+    }
+    return messages;
+  }
+
+  std::vector<Media>
+  media(const DatasetOptions &options, const std::vector<Message> &messages) {
+    std::vector<Media> media;
+    for (const Message &message : messages) {
+      for (size_t i = 0; i < options.mediaPerMessage; i++) {
+        media.push_back(Media{
+            message.id + "-" + std::to_string(i),
+            message.id,
+            message.thread,
+            "https://comm.app/media/" + this->randomText(32),
+            "photo",
+            R"({"dimensions":{"width":1024,"height":768}})"});
+      }
+    }
+    return media;
+  }
+
+  // One draft per thread, as if every thread had an unsent message
+  std::vector<Draft> drafts(const DatasetOptions &options) {
+    std::vector<Draft> drafts;
+    for (size_t i = 0; i < options.threads; i++) {
+      drafts.push_back(
+          Draft{"thread-" + std::to_string(i), this->randomText(40)});
+    }
+    return drafts;
+  }
+};
+
+} // namespace comm
@@ -0,0 +1,597 @@
+// Drives GlobalDBSingleton from many producer threads the way CommCoreModule
+// does: reads on the reader threads, writes and batched writes on the
+// database thread, reads that are cancelled right after being scheduled, and
+// sync calls that block their thread until they are done. Scheduler and
+// thread pool changes are meant to be checked with it.
+//
+// Every producer owns a draft whose value is a sequence number that its
+// writes keep increasing. A read has to see at least the number of the last
+// write its producer scheduled before it, and once all calls are settled the
+// draft has to hold the number of the last write. A promise has to be
+// settled exactly once, and only cancelled reads may be rejected. Prints the
+// throughput and latency percentiles of every kind of call, the queue stats
+// of the worker threads, and exits with 1 if a check failed.
+//
+// Usage: comm-scheduler-stress [--producers=N] [--calls-per-producer=N]
+//   [--rate=CALLS_PER_SECOND_PER_PRODUCER] [--reads=WEIGHT]
+//   [--writes=WEIGHT] [--batched-writes=WEIGHT] [--cancelled-reads=WEIGHT]
+//   [--sync-reads=WEIGHT] [--sync-writes=WEIGHT] [--database-path=PATH]
+//   [--backend=sqlite|in-memory]
+#include "DatabaseManager.h"
+#include "InternalModules/GlobalDBSingleton.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace comm {
+
+// Host version of the platform code in GlobalDBSingleton.cpp of Android,
+// which also runs the database thread from the start
+GlobalDBSingleton GlobalDBSingleton::instance;
+
+GlobalDBSingleton::GlobalDBSingleton()
+    : multithreadingEnabled(true),
+      databaseThread(std::make_unique<WorkerThread>(
+          "database",
+          OverflowPolicy::Spill,
+          ThreadAttachment::Lifetime,
+          AllocationTag::Database)),
+      tasksCancelled(false) {
+}
+
+void GlobalDBSingleton::scheduleOrRun(taskType task) {
+  this->scheduleOrRunCommonImpl(std::move(task));
+}
+
+void GlobalDBSingleton::scheduleOrRunCancellable(taskType task) {
+  this->scheduleOrRunCancellableCommonImpl(std::move(task));
+}
+
+void GlobalDBSingleton::scheduleOrRunCancellable(
+    taskType task,
+    const std::shared_ptr<facebook::react::Promise> promise,
+    const std::shared_ptr<facebook::react::CallInvoker> jsInvoker) {
+  this->scheduleOrRunCancellableCommonImpl(std::move(task), promise, jsInvoker);
+}
+
+void GlobalDBSingleton::scheduleOrRunCancellableRead(
+    taskType task,
+    const std::shared_ptr<facebook::react::Promise> promise,
+    const std::shared_ptr<facebook::react::CallInvoker> jsInvoker,
+    TaskPriority priority,
+    std::shared_ptr<CancellationToken> cancellationToken) {
+  this->scheduleOrRunCancellableReadCommonImpl(
+      std::move(task), promise, jsInvoker, priority, cancellationToken);
+}
+
+void GlobalDBSingleton::scheduleOrRunCancellableBatchedWrite(
+    taskType write,
+    const std::shared_ptr<facebook::react::Promise> promise,
+    const std::shared_ptr<facebook::react::CallInvoker> jsInvoker) {
+  this->scheduleOrRunCancellableBatchedWriteCommonImpl(
+      std::move(write), promise, jsInvoker);
+}
+
+void GlobalDBSingleton::enableMultithreading() {
+  this->enableMultithreadingCommonImpl();
+}
+
+} // namespace comm
+
+namespace {
+
+using comm::GlobalDBSingleton;
+
+enum class CallKind {
+  Read,
+  Write,
+  BatchedWrite,
+  CancelledRead,
+  SyncRead,
+  SyncWrite,
+};
+
+const size_t CALL_KINDS_COUNT{6};
+const std::array<const char *, CALL_KINDS_COUNT> CALL_KIND_NAMES{
+    "read",
+    "write",
+    "batched_write",
+    "cancelled_read",
+    "sync_read",
+    "sync_write"};
+// Failures past that many are only counted
+const size_t PRINTED_FAILURES_MAX{20};
+const std::chrono::seconds SETTLE_TIMEOUT{60};
+
+struct Options {
+  size_t producers = 16;
+  size_t callsPerProducer = 2000;
+  // 0 schedules the calls as fast as possible
+  size_t rate = 0;
+  std::array<size_t, CALL_KINDS_COUNT> weights{40, 20, 20, 10, 5, 5};
+  std::string databasePath = "comm-scheduler-stress.sqlite";
+  bool inMemory = false;
+};
+
+bool parseOption(const std::string &argument, Options &options) {
+  const size_t separator = argument.find('=');
+  if (argument.compare(0, 2, "--") != 0 || separator == std::string::npos) {
+    return false;
+  }
+  const std::string name = argument.substr(2, separator - 2);
+  const std::string value = argument.substr(separator + 1);
+  if (name == "database-path") {
+    options.databasePath = value;
+    return true;
+  }
+  if (name == "backend") {
+    options.inMemory = value == "in-memory";
+    return options.inMemory || value == "sqlite";
+  }
+  const std::vector<std::pair<std::string, size_t *>> numericOptions = {
+      {"producers", &options.producers},
+      {"calls-per-producer", &options.callsPerProducer},
+      {"rate", &options.rate},
+      {"reads", &options.weights[0]},
+      {"writes", &options.weights[1]},
+      {"batched-writes", &options.weights[2]},
+      {"cancelled-reads", &options.weights[3]},
+      {"sync-reads", &options.weights[4]},
+      {"sync-writes", &options.weights[5]},
+  };
+  for (const auto &option : numericOptions) {
+    if (option.first == name) {
+      *option.second = std::strtoull(value.c_str(), nullptr, 10);
+      return true;
+    }
+  }
+  return false;
+}
+
+void removeDatabaseFiles(const std::string &path) {
+  for (const std::string &suffix : {"", "-wal", "-shm", "_temp_encrypted"}) {
+    std::remove((path + suffix).c_str());
+  }
+}
+
+// Runs the callbacks of the promises on a thread of their own, like the JS
+// thread does in the app
+class HostCallInvoker : public facebook::react::CallInvoker {
+  comm::WorkerThread jsThread{"js"};
+
+public:
+  void invokeAsync(std::function<void()> &&func) override {
+    this->jsThread.scheduleTask(std::move(func));
+  }
+
+  comm::WorkerThreadStats getStats() {
+    return this->jsThread.getStats();
+  }
+};
+
+class Results {
+  std::mutex mutex;
+  std::condition_variable settledCondition;
+  std::array<std::vector<uint64_t>, CALL_KINDS_COUNT> latenciesUs;
+  std::array<size_t, CALL_KINDS_COUNT> cancelledCalls{};
+  size_t settledCalls{0};
+  size_t failures{0};
+
+public:
+  void record(
+      CallKind kind,
+      std::chrono::steady_clock::time_point scheduledAt,
+      bool cancelled) {
+    const uint64_t latencyUs =
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - scheduledAt)
+            .count();
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      const size_t index = static_cast<size_t>(kind);
+      this->latenciesUs[index].push_back(latencyUs);
+      if (cancelled) {
+        this->cancelledCalls[index]++;
+      }
+      this->settledCalls++;
+    }
+    this->settledCondition.notify_all();
+  }
+
+  void fail(const std::string &failure) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->failures++ < PRINTED_FAILURES_MAX) {
+      std::cerr << "FAILED: " << failure << std::endl;
+    }
+  }
+
+  // Returns the number of calls that weren't settled in time
+  size_t waitForSettledCalls(size_t calls) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->settledCondition.wait_for(lock, SETTLE_TIMEOUT, [this, calls]() {
+      return this->settledCalls >= calls;
+    });
+    return calls - std::min(calls, this->settledCalls);
+  }
+
+  size_t getFailures() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->failures;
+  }
+
+  void print(double durationS) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (size_t i = 0; i < CALL_KINDS_COUNT; i++) {
+      std::vector<uint64_t> &latencies = this->latenciesUs[i];
+      if (latencies.empty()) {
+        continue;
+      }
+      std::sort(latencies.begin(), latencies.end());
+      auto percentile = [&latencies](double fraction) {
+        return static_cast<unsigned long long>(
+            latencies[static_cast<size_t>(fraction * (latencies.size() - 1))]);
+      };
+      std::printf(
+          "%-16s %8zu calls %10.1f calls/s %8zu cancelled  p50 %8llu us  "
+          "p90 %8llu us  p99 %8llu us  max %8llu us\n",
+          CALL_KIND_NAMES[i],
+          latencies.size(),
+          latencies.size() / durationS,
+          this->cancelledCalls[i],
+          percentile(0.5),
+          percentile(0.9),
+          percentile(0.99),
+          percentile(1));
+    }
+  }
+};
+
+void printThreadStats(const comm::WorkerThreadStats &stats) {
+  std::printf(
+      "%-16s %8llu scheduled %8llu completed %6llu overflowed %6llu rejected "
+      "%6zu max depth %8.1f us avg wait %8llu us max wait\n",
+      stats.name.c_str(),
+      static_cast<unsigned long long>(stats.scheduledTasks),
+      static_cast<unsigned long long>(stats.completedTasks),
+      static_cast<unsigned long long>(stats.overflowedTasks),
+      static_cast<unsigned long long>(stats.rejectedTasks),
+      stats.maxQueueDepth,
+      stats.completedTasks
+          ? static_cast<double>(stats.totalWaitUs) / stats.completedTasks
+          : 0,
+      static_cast<unsigned long long>(stats.maxWaitUs));
+}
+
+uint64_t readSequenceNumber(const std::string &key) {
+  const std::string draft =
+      comm::DatabaseManager::getQueryExecutor().getDraft(key);
+  return draft.empty() ? 0 : std::strtoull(draft.c_str(), nullptr, 10);
+}
+
+class Producer {
+  const size_t index;
+  const std::string key;
+  const Options &options;
+  Results &results;
+  const std::shared_ptr<HostCallInvoker> jsInvoker;
+  std::mt19937 generator;
+  // Only used on the thread of the producer
+  uint64_t lastScheduledWrite{0};
+  size_t asyncCalls{0};
+
+  // The promise checks that it is settled once and records the call
+  std::shared_ptr<facebook::react::Promise>
+  createPromise(CallKind kind, bool cancellable) {
+    const auto scheduledAt = std::chrono::steady_clock::now();
+    auto settled = std::make_shared<std::atomic<bool>>(false);
+    Results &results = this->results;
+    this->asyncCalls++;
+    return std::make_shared<facebook::react::Promise>(
+        [kind, cancellable, scheduledAt, settled, &results](
+            const std::string &error) {
+          if (settled->exchange(true)) {
+            results.fail(
+                std::string(CALL_KIND_NAMES[static_cast<size_t>(kind)]) +
+                " settled more than once");
+            return;
+          }
+          const bool cancelled = !error.empty() && cancellable &&
+              error.compare(
+                  0, comm::TASK_CANCELLED_FLAG.size(),
+                  comm::TASK_CANCELLED_FLAG) == 0;
+          if (!error.empty() && !cancelled) {
+            results.fail(
+                std::string(CALL_KIND_NAMES[static_cast<size_t>(kind)]) +
+                " rejected with " + error);
+          }
+          results.record(kind, scheduledAt, cancelled);
+        });
+  }
+
+  // Same as the tasks of CommCoreModule, which settle their promise on the
+  // JS thread with what the query returned
+  comm::taskType createReadTask(
+      std::shared_ptr<facebook::react::Promise> promise,
+      uint64_t expectedWrite) {
+    const std::string key = this->key;
+    Results &results = this->results;
+    const std::shared_ptr<HostCallInvoker> jsInvoker = this->jsInvoker;
+    return [key, promise, expectedWrite, &results, jsInvoker]() {
+      std::string error;
+      try {
+        const uint64_t write = readSequenceNumber(key);
+        if (write < expectedWrite) {
+          results.fail(
+              "read of " + key + " saw write " + std::to_string(write) +
+              " instead of at least " + std::to_string(expectedWrite));
+        }
+      } catch (const std::exception &e) {
+        error = e.what();
+      }
+      jsInvoker->invokeAsync([promise, error]() {
+        if (error.size()) {
+          promise->reject(error);
+        } else {
+          promise->resolve(facebook::jsi::Value::undefined());
+        }
+      });
+    };
+  }
+
+  void scheduleRead(bool cancelled) {
+    const CallKind kind = cancelled ? CallKind::CancelledRead : CallKind::Read;
+    auto promise = this->createPromise(kind, cancelled);
+    auto cancellationToken = std::make_shared<comm::CancellationToken>();
+    GlobalDBSingleton::instance.scheduleOrRunCancellableRead(
+        this->createReadTask(promise, this->lastScheduledWrite),
+        promise,
+        this->jsInvoker,
+        comm::TaskPriority::Normal,
+        cancellationToken);
+    if (cancelled) {
+      cancellationToken->cancel();
+    }
+  }
+
+  void scheduleWrite(bool batched) {
+    const std::string key = this->key;
+    const std::string value = std::to_string(++this->lastScheduledWrite);
+    auto write = [key, value]() {
+      comm::DatabaseManager::getQueryExecutor().updateDraft(key, value);
+    };
+    if (batched) {
+      GlobalDBSingleton::instance.scheduleOrRunCancellableBatchedWrite(
+          write, this->createPromise(CallKind::BatchedWrite, false),
+          this->jsInvoker);
+      return;
+    }
+    auto promise = this->createPromise(CallKind::Write, false);
+    const std::shared_ptr<HostCallInvoker> jsInvoker = this->jsInvoker;
+    GlobalDBSingleton::instance.scheduleOrRunCancellable(
+        [write, promise, jsInvoker]() {
+          std::string error;
+          try {
+            write();
+          } catch (const std::exception &e) {
+            error = e.what();
+          }
+          jsInvoker->invokeAsync([promise, error]() {
+            if (error.size()) {
+              promise->reject(error);
+            } else {
+              promise->resolve(facebook::jsi::Value::undefined());
+            }
+          });
+        },
+        promise,
+        this->jsInvoker);
+  }
+
+  // Runs the task on the database thread and waits for it, as
+  // CommCoreModule::runSyncOrThrowJSError does
+  void runSync(comm::taskType task) {
+    std::promise<void> promise;
+    GlobalDBSingleton::instance.scheduleOrRunCancellable([&promise, &task]() {
+      const comm::ChangeCapture::Suppression suppression;
+      try {
+        task();
+        promise.set_value();
+      } catch (const std::exception &e) {
+        promise.set_exception(std::make_exception_ptr(e));
+      }
+    });
+    promise.get_future().get();
+  }
+
+  void runSyncRead() {
+    const auto startedAt = std::chrono::steady_clock::now();
+    const uint64_t expectedWrite = this->lastScheduledWrite;
+    uint64_t write = 0;
+    auto read = [this, &write]() { write = readSequenceNumber(this->key); };
+    try {
+      // The read runs in place on this thread whenever it can
+      if (!GlobalDBSingleton::instance.tryRunReadInPlace(read)) {
+        this->runSync(read);
+      }
+      if (write < expectedWrite) {
+        this->results.fail(
+            "sync read of " + this->key + " saw write " +
+            std::to_string(write) + " instead of at least " +
+            std::to_string(expectedWrite));
+      }
+    } catch (const std::exception &e) {
+      this->results.fail("sync read threw " + std::string(e.what()));
+    }
+    this->results.record(CallKind::SyncRead, startedAt, false);
+  }
+
+  void runSyncWrite() {
+    const auto startedAt = std::chrono::steady_clock::now();
+    const std::string key = this->key;
+    const std::string value = std::to_string(++this->lastScheduledWrite);
+    try {
+      this->runSync([key, value]() {
+        comm::DatabaseManager::getQueryExecutor().updateDraft(key, value);
+      });
+    } catch (const std::exception &e) {
+      this->results.fail("sync write threw " + std::string(e.what()));
+    }
+    this->results.record(CallKind::SyncWrite, startedAt, false);
+  }
+
+public:
+  Producer(
+      size_t index,
+      const Options &options,
+      Results &results,
+      std::shared_ptr<HostCallInvoker> jsInvoker)
+      : index(index),
+        key("stress-" + std::to_string(index)),
+        options(options),
+        results(results),
+        jsInvoker(std::move(jsInvoker)),
+        generator(static_cast<uint32_t>(index)) {
+  }
+
+  void run() {
+    std::discrete_distribution<size_t> kinds(
+        this->options.weights.begin(), this->options.weights.end());
+    const auto startedAt = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < this->options.callsPerProducer; i++) {
+      if (this->options.rate) {
+        std::this_thread::sleep_until(
+            startedAt +
+            std::chrono::microseconds(i * 1000000 / this->options.rate));
+      }
+      switch (static_cast<CallKind>(kinds(this->generator))) {
+        case CallKind::Read:
+          this->scheduleRead(false);
+          break;
+        case CallKind::Write:
+          this->scheduleWrite(false);
+          break;
+        case CallKind::BatchedWrite:
+          this->scheduleWrite(true);
+          break;
+        case CallKind::CancelledRead:
+          this->scheduleRead(true);
+          break;
+        case CallKind::SyncRead:
+          this->runSyncRead();
+          break;
+        case CallKind::SyncWrite:
+          this->runSyncWrite();
+          break;
+      }
+    }
+  }
+
+  // Settled calls count with the sync ones
+  size_t getCalls() const {
+    return this->options.callsPerProducer;
+  }
+
+  // Called once every call is settled
+  void checkLastWrite() {
+    const uint64_t expectedWrite = this->lastScheduledWrite;
+    uint64_t write = 0;
+    this->runSync([this, &write]() { write = readSequenceNumber(this->key); });
+    if (write != expectedWrite) {
+      this->results.fail(
+          this->key + " holds write " + std::to_string(write) +
+          " instead of " + std::to_string(expectedWrite));
+    }
+  }
+};
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    if (!parseOption(argv[i], options)) {
+      std::cerr << "Unknown option " << argv[i] << std::endl;
+      return 1;
+    }
+  }
+  std::string databasePath = options.databasePath;
+  if (options.inMemory) {
+    comm::DatabaseManager::setBackend(comm::DatabaseBackend::InMemory);
+  } else {
+    removeDatabaseFiles(databasePath);
+    comm::SQLiteQueryExecutor::initialize(databasePath);
+  }
+  GlobalDBSingleton::instance.enableMultithreading();
+
+  Results results;
+  auto jsInvoker = std::make_shared<HostCallInvoker>();
+  std::vector<std::unique_ptr<Producer>> producers;
+  for (size_t i = 0; i < options.producers; i++) {
+    producers.push_back(
+        std::make_unique<Producer>(i, options, results, jsInvoker));
+  }
+
+  const auto startedAt = std::chrono::steady_clock::now();
+  std::vector<std::thread> producerThreads;
+  for (const auto &producer : producers) {
+    producerThreads.emplace_back([&producer]() { producer->run(); });
+  }
+  for (std::thread &producerThread : producerThreads) {
+    producerThread.join();
+  }
+  size_t calls = 0;
+  for (const auto &producer : producers) {
+    calls += producer->getCalls();
+  }
+  const size_t unsettledCalls = results.waitForSettledCalls(calls);
+  const double durationS = std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - startedAt)
+                               .count();
+  if (unsettledCalls) {
+    results.fail(std::to_string(unsettledCalls) + " calls never settled");
+  } else {
+    for (const auto &producer : producers) {
+      producer->checkLastWrite();
+    }
+  }
+
+  std::printf(
+      "%zu producers, %zu calls in %.3f s, %.1f calls/s\n",
+      options.producers,
+      calls,
+      durationS,
+      calls / durationS);
+  results.print(durationS);
+  std::vector<comm::WorkerThreadStats> threadsStats =
+      GlobalDBSingleton::instance.getThreadsStats();
+  for (size_t i = 0; i < threadsStats.size(); i++) {
+    if (i > 1 && threadsStats[i].name == threadsStats[1].name) {
+      continue;
+    }
+    comm::WorkerThreadStats stats = threadsStats[i];
+    for (size_t j = i + 1; i == 1 && j < threadsStats.size(); j++) {
+      comm::mergeWorkerThreadStats(stats, threadsStats[j]);
+    }
+    printThreadStats(stats);
+  }
+  printThreadStats(jsInvoker->getStats());
+
+  const size_t failures = results.getFailures();
+  std::printf("%zu failures\n", failures);
+  if (!options.inMemory) {
+    removeDatabaseFiles(databasePath);
+  }
+  return failures ? 1 : 0;
+}
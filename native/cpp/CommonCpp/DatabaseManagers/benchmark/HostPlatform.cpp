@@ -0,0 +1,79 @@
+// Host versions of the platform code that SQLiteQueryExecutor and
+// GlobalDBSingleton depend on. The apps implement these in native/ios and
+// native/android.
+#include "CommSecureStore.h"
+#include "CryptoTools/Tools.h"
+#include "Logger.h"
+#include "Trace.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+
+namespace comm {
+
+namespace {
+
+std::mutex secureStoreMutex;
+std::unordered_map<std::string, std::string> secureStore;
+
+} // namespace
+
+void CommSecureStore::setInPlatform(
+    const std::string &key,
+    const std::string &value) const {
+  std::lock_guard<std::mutex> lock(secureStoreMutex);
+  secureStore[key] = value;
+}
+
+folly::Optional<std::string>
+CommSecureStore::getFromPlatform(const std::string &key) const {
+  std::lock_guard<std::mutex> lock(secureStoreMutex);
+  auto it = secureStore.find(key);
+  if (it == secureStore.end()) {
+    return folly::none;
+  }
+  return it->second;
+}
+
+void Logger::write(const std::string &lines) {
+  if (std::getenv("COMM_BENCHMARK_VERBOSE") != nullptr) {
+    std::cerr << lines << std::endl;
+  }
+}
+
+// There is no profiler to record the sections on the host
+bool Trace::isEnabled() {
+  return false;
+}
+
+void Trace::beginSection(const std::string &name) {
+}
+
+void Trace::endSection() {
+}
+
+void Trace::beginAsyncSection(const std::string &name, int32_t cookie) {
+}
+
+void Trace::endAsyncSection(const std::string &name, int32_t cookie) {
+}
+
+namespace crypto {
+
+std::string Tools::generateRandomHexString(size_t size) {
+  static const char hexDigits[] = "0123456789ABCDEF";
+  thread_local std::random_device generator;
+  std::uniform_int_distribution<int> distribution(0, 15);
+  std::string result(size, '0');
+  for (char &digit : result) {
+    digit = hexDigits[distribution(generator)];
+  }
+  return result;
+}
+
+} // namespace crypto
+
+} // namespace comm
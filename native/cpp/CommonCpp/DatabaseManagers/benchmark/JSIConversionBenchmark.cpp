@@ -0,0 +1,229 @@
+// Times the conversions between database rows and JS values on a host
+// Hermes runtime, so that changes to them can be measured without a device.
+// Besides the time per row, every conversion is printed with the native
+// allocations it made, the bytes Hermes allocated for it, and how much the
+// JS heap grew while its result was alive. The rows are loaded from
+// InMemoryQueryExecutor, the same way CommCoreModule reads them.
+//
+// Usage: comm-jsi-benchmark [--threads=N] [--messages-per-thread=N]
+//   [--media-per-message=N] [--content-size=N] [--iterations=N]
+#include "DatasetGenerator.h"
+#include "InMemoryQueryExecutor.h"
+#include "JSIConversions.h"
+#include "MessageStoreOperations.h"
+
+#include <hermes/hermes.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::atomic<size_t> nativeAllocations{0};
+std::atomic<size_t> nativeAllocatedBytes{0};
+
+} // namespace
+
+// Counts every allocation of the process, Hermes' own included, except for
+// the JS heap which Hermes allocates in segments and reports itself
+void *operator new(size_t size) {
+  nativeAllocations++;
+  nativeAllocatedBytes += size;
+  if (void *pointer = std::malloc(size ? size : 1)) {
+    return pointer;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *pointer) noexcept {
+  std::free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept {
+  std::free(pointer);
+}
+
+namespace {
+
+namespace jsi = facebook::jsi;
+
+struct Options : comm::DatasetOptions {
+  size_t iterations = 5;
+};
+
+bool parseOption(const std::string &argument, Options &options) {
+  const size_t separator = argument.find('=');
+  if (argument.compare(0, 2, "--") != 0 || separator == std::string::npos) {
+    return false;
+  }
+  const std::string name = argument.substr(2, separator - 2);
+  const std::string value = argument.substr(separator + 1);
+  const std::vector<std::pair<std::string, size_t *>> numericOptions = {
+      {"threads", &options.threads},
+      {"messages-per-thread", &options.messagesPerThread},
+      {"media-per-message", &options.mediaPerMessage},
+      {"content-size", &options.contentSize},
+      {"iterations", &options.iterations},
+  };
+  for (const auto &option : numericOptions) {
+    if (option.first == name) {
+      *option.second = std::strtoull(value.c_str(), nullptr, 10);
+      return true;
+    }
+  }
+  return false;
+}
+
+int64_t getHeapInfo(jsi::Runtime &rt, const std::string &key) {
+  const auto heapInfo = rt.instrumentation().getHeapInfo(false);
+  auto it = heapInfo.find(key);
+  return it == heapInfo.end() ? 0 : it->second;
+}
+
+// Runs the conversion once and prints its costs per row. The value it
+// returns is kept alive until the heap has been measured.
+void measure(
+    jsi::Runtime &rt,
+    const std::string &name,
+    size_t rows,
+    const std::function<jsi::Value()> &conversion) {
+  rt.instrumentation().collectGarbage("benchmark");
+  const int64_t heapBefore = getHeapInfo(rt, "hermes_allocatedBytes");
+  const int64_t jsAllocatedBefore =
+      getHeapInfo(rt, "hermes_totalAllocatedBytes");
+  const size_t allocationsBefore = nativeAllocations.load();
+  const size_t allocatedBytesBefore = nativeAllocatedBytes.load();
+  const auto start = std::chrono::steady_clock::now();
+
+  jsi::Value result = conversion();
+
+  const double totalMs = std::chrono::duration<double, std::milli>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+  const size_t allocations = nativeAllocations.load() - allocationsBefore;
+  const size_t allocatedBytes =
+      nativeAllocatedBytes.load() - allocatedBytesBefore;
+  const int64_t jsAllocated =
+      getHeapInfo(rt, "hermes_totalAllocatedBytes") - jsAllocatedBefore;
+  const int64_t heapGrowth =
+      getHeapInfo(rt, "hermes_allocatedBytes") - heapBefore;
+  const double perRow = rows ? 1.0 / rows : 0;
+  std::printf(
+      "%-32s %10zu rows %10.3f ms %9.3f us/row %8.1f allocs/row "
+      "%9.1f B/row native %9.1f B/row js %12lld B js heap growth\n",
+      name.c_str(),
+      rows,
+      totalMs,
+      totalMs * 1000 * perRow,
+      allocations * perRow,
+      allocatedBytes * perRow,
+      jsAllocated * perRow,
+      static_cast<long long>(heapGrowth));
+}
+
+// The operations that JS sends to update every draft
+jsi::Array createUpdateDraftOperations(
+    jsi::Runtime &rt,
+    const std::vector<comm::Draft> &drafts) {
+  jsi::Array operations(rt, drafts.size());
+  for (size_t i = 0; i < drafts.size(); i++) {
+    jsi::Object payload(rt);
+    payload.setProperty(rt, "key", drafts[i].key);
+    payload.setProperty(rt, "text", drafts[i].text);
+    jsi::Object operation(rt);
+    operation.setProperty(rt, "type", "update");
+    operation.setProperty(rt, "payload", payload);
+    operations.setValueAtIndex(rt, i, operation);
+  }
+  return operations;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    if (!parseOption(argv[i], options)) {
+      std::cerr << "Unknown option " << argv[i] << std::endl;
+      return 1;
+    }
+  }
+
+  comm::DatasetGenerator generator;
+  comm::InMemoryQueryExecutor executor;
+  const std::vector<comm::Message> messages = generator.messages(options);
+  executor.replaceThreads(generator.threads(options));
+  executor.replaceMessages(messages);
+  executor.replaceMediaBatch(generator.media(options, messages));
+  for (const comm::Draft &draft : generator.drafts(options)) {
+    executor.updateDraft(draft.key, draft.text);
+  }
+  auto messagesPtr = std::make_shared<
+      std::vector<std::pair<comm::Message, std::vector<comm::Media>>>>(
+      executor.getAllMessages());
+  auto compactMessagesPtr = std::make_shared<comm::CompactMessageStore>(
+      executor.getAllMessagesCompact());
+  auto threadsPtr =
+      std::make_shared<std::vector<comm::Thread>>(executor.getAllThreads());
+  auto compactThreadsPtr = std::make_shared<comm::CompactThreadStore>(
+      executor.getAllThreadsCompact(true));
+  auto draftsPtr =
+      std::make_shared<std::vector<comm::Draft>>(executor.getAllDrafts());
+
+  std::unique_ptr<facebook::hermes::HermesRuntime> runtime =
+      facebook::hermes::makeHermesRuntime();
+  jsi::Runtime &rt = *runtime;
+
+  for (size_t i = 0; i < options.iterations; i++) {
+    measure(rt, "parse_db_messages", messagesPtr->size(), [&]() {
+      return comm::parseDBMessages(rt, messagesPtr);
+    });
+    measure(rt, "parse_db_messages_typed", messagesPtr->size(), [&]() {
+      return comm::parseDBMessages(rt, messagesPtr, comm::JSIProtocol::typed);
+    });
+    measure(
+        rt,
+        "parse_db_messages_compact",
+        compactMessagesPtr->messages.size(),
+        [&]() { return comm::parseDBMessages(rt, compactMessagesPtr); });
+    measure(rt, "parse_db_threads", threadsPtr->size(), [&]() {
+      return comm::parseDBThreads(rt, threadsPtr);
+    });
+    measure(
+        rt,
+        "parse_db_threads_compact",
+        compactThreadsPtr->threads.size(),
+        [&]() { return comm::parseDBThreads(rt, compactThreadsPtr, true); });
+    measure(rt, "parse_db_drafts", draftsPtr->size(), [&]() {
+      return comm::parseDBDrafts(rt, draftsPtr);
+    });
+  }
+
+  // The rows that JS writes back have the shape of the ones it has read
+  const jsi::Array messagePayloads = comm::parseDBMessages(rt, messagesPtr);
+  const jsi::Array draftOperations =
+      createUpdateDraftOperations(rt, *draftsPtr);
+  for (size_t i = 0; i < options.iterations; i++) {
+    measure(rt, "replace_message_operations", messagesPtr->size(), [&]() {
+      std::vector<std::unique_ptr<comm::MessageStoreOperationBase>> operations;
+      for (size_t j = 0; j < messagePayloads.size(rt); j++) {
+        operations.push_back(std::make_unique<comm::ReplaceMessageOperation>(
+            rt, messagePayloads.getValueAtIndex(rt, j).asObject(rt)));
+      }
+      return jsi::Value::undefined();
+    });
+    measure(rt, "create_draft_store_operations", draftsPtr->size(), [&]() {
+      comm::createDraftStoreOperations(rt, draftOperations);
+      return jsi::Value::undefined();
+    });
+  }
+  return 0;
+}
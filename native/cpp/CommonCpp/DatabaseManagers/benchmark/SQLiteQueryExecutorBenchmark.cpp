@@ -0,0 +1,214 @@
+// Times SQLiteQueryExecutor on a synthetic database outside of the app, so
+// that storage changes can be measured before and after. Every operation is
+// printed on its own line with a stable name, to make runs easy to compare.
+// With --backend=in-memory, InMemoryQueryExecutor runs the same operations
+// instead, as a baseline without any storage overhead. With
+// --cipher-profile, the database is encrypted with the cipher settings of
+// that profile, so that read and write throughput can be compared across
+// profiles by running once per profile on a device.
+//
+// Usage: comm-storage-benchmark [--threads=N] [--messages-per-thread=N]
+//   [--media-per-message=N] [--content-size=N] [--iterations=N]
+//   [--replaced-messages=N] [--database-path=PATH]
+//   [--backend=sqlite|in-memory] [--cipher-profile=NAME]
+#include "DatasetGenerator.h"
+#include "InMemoryQueryExecutor.h"
+#include "SQLiteQueryExecutor.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+namespace {
+
+struct Options : comm::DatasetOptions {
+  size_t iterations = 5;
+  size_t replacedMessages = 1000;
+  std::string databasePath = "comm-storage-benchmark.sqlite";
+  bool inMemory = false;
+  std::string cipherProfile = "sqlcipher_default";
+};
+
+bool parseOption(const std::string &argument, Options &options) {
+  const size_t separator = argument.find('=');
+  if (argument.compare(0, 2, "--") != 0 || separator == std::string::npos) {
+    return false;
+  }
+  const std::string name = argument.substr(2, separator - 2);
+  const std::string value = argument.substr(separator + 1);
+  if (name == "database-path") {
+    options.databasePath = value;
+    return true;
+  }
+  if (name == "cipher-profile") {
+    options.cipherProfile = value;
+    return true;
+  }
+  if (name == "backend") {
+    options.inMemory = value == "in-memory";
+    return options.inMemory || value == "sqlite";
+  }
+  const std::vector<std::pair<std::string, size_t *>> numericOptions = {
+      {"threads", &options.threads},
+      {"messages-per-thread", &options.messagesPerThread},
+      {"media-per-message", &options.mediaPerMessage},
+      {"content-size", &options.contentSize},
+      {"iterations", &options.iterations},
+      {"replaced-messages", &options.replacedMessages},
+  };
+  for (const auto &option : numericOptions) {
+    if (option.first == name) {
+      *option.second = std::strtoull(value.c_str(), nullptr, 10);
+      return true;
+    }
+  }
+  return false;
+}
+
+void removeDatabaseFiles(const std::string &path) {
+  for (const std::string &suffix : {"", "-wal", "-shm", "_temp_encrypted"}) {
+    std::remove((path + suffix).c_str());
+  }
+}
+
+// Runs the function once and prints the time per operation
+void measure(
+    const std::string &name,
+    size_t operations,
+    const std::function<void()> &function) {
+  const auto start = std::chrono::steady_clock::now();
+  function();
+  const double totalMs = std::chrono::duration<double, std::milli>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+  std::printf(
+      "%-32s %10zu ops %12.3f ms %12.3f us/op\n",
+      name.c_str(),
+      operations,
+      totalMs,
+      operations ? totalMs * 1000 / operations : 0);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    if (!parseOption(argv[i], options)) {
+      std::cerr << "Unknown option " << argv[i] << std::endl;
+      return 1;
+    }
+  }
+  std::string databasePath = options.databasePath;
+  std::unique_ptr<comm::DatabaseQueryExecutor> executorInstance;
+  if (options.inMemory) {
+    executorInstance = std::make_unique<comm::InMemoryQueryExecutor>();
+  } else {
+    removeDatabaseFiles(databasePath);
+    try {
+      comm::SQLiteQueryExecutor::setCipherProfile(options.cipherProfile);
+    } catch (const std::system_error &e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+    std::printf("cipher profile %s\n", options.cipherProfile.c_str());
+    measure("initialize", 1, [&databasePath]() {
+      comm::SQLiteQueryExecutor::initialize(databasePath);
+    });
+    // Creates the database, sets up the encryption and runs every migration
+    measure("open_new_database", 1, []() { comm::SQLiteQueryExecutor(); });
+    executorInstance = std::make_unique<comm::SQLiteQueryExecutor>();
+    const comm::DatabaseStartupMetrics metrics =
+        executorInstance->getStartupMetrics();
+    std::printf(
+        "database version %d, %d migrations applied\n",
+        metrics.databaseVersion,
+        metrics.appliedMigrations);
+  }
+  const comm::DatabaseQueryExecutor &executor = *executorInstance;
+
+  comm::DatasetGenerator generator;
+  const std::vector<comm::Thread> threads = generator.threads(options);
+  const std::vector<comm::Message> messages = generator.messages(options);
+  const std::vector<comm::Media> media = generator.media(options, messages);
+
+  measure("replace_threads", threads.size(), [&]() {
+    executor.beginTransaction();
+    executor.replaceThreads(threads);
+    executor.commitTransaction();
+  });
+  measure("replace_messages", messages.size(), [&]() {
+    executor.beginTransaction();
+    executor.replaceMessages(messages);
+    executor.commitTransaction();
+  });
+  measure("replace_media", media.size(), [&]() {
+    executor.beginTransaction();
+    executor.replaceMediaBatch(media);
+    executor.commitTransaction();
+  });
+
+  // The writer connection is set up by now, so it is only looked up
+  if (!options.inMemory) {
+    measure(
+        "open_up_to_date_database", 1, []() { comm::SQLiteQueryExecutor(); });
+  }
+
+  for (size_t i = 0; i < options.iterations; i++) {
+    measure("get_all_threads", threads.size(), [&]() {
+      executor.getAllThreads();
+    });
+  }
+  for (size_t i = 0; i < options.iterations; i++) {
+    measure("get_all_messages", messages.size(), [&]() {
+      executor.getAllMessages();
+    });
+  }
+
+  // Every message is written in its own implicit transaction, like the ones
+  // that the app receives one at a time
+  std::vector<comm::Message> replacedMessages;
+  for (size_t i = 0; i < options.replacedMessages && options.threads; i++) {
+    replacedMessages.push_back(generator.message(
+        options,
+        i % options.threads,
+        options.messagesPerThread + i / options.threads));
+  }
+  measure("replace_message_loop", replacedMessages.size(), [&]() {
+    for (const comm::Message &message : replacedMessages) {
+      executor.replaceMessage(message);
+    }
+  });
+
+  std::vector<std::string> removedThreads;
+  for (size_t i = 0; i < threads.size(); i += 10) {
+    removedThreads.push_back(threads[i].id);
+  }
+  measure("remove_messages_for_threads", removedThreads.size(), [&]() {
+    executor.removeMessagesForThreads(removedThreads);
+  });
+
+  std::printf(
+      "memory used %lld bytes\n",
+      static_cast<long long>(executor.getMemoryStats().memoryUsed));
+
+  if (options.inMemory) {
+    measure("clear_sensitive_data", 1, []() {
+      comm::InMemoryQueryExecutor::clearSensitiveData();
+    });
+    return 0;
+  }
+  // Deletes the database and sets it up again with a new encryption key
+  measure("clear_sensitive_data", 1, []() {
+    comm::SQLiteQueryExecutor::clearSensitiveData();
+  });
+
+  removeDatabaseFiles(databasePath);
+  return 0;
+}
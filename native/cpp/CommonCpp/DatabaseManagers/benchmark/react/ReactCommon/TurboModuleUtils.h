@@ -0,0 +1,51 @@
+#pragma once
+
+// Host stand-in for the parts of ReactCommon that GlobalDBSingleton uses, so
+// that it can be driven without a JS runtime. A promise reports how it was
+// settled to a callback instead of to JS.
+#include <functional>
+#include <string>
+
+namespace facebook {
+
+namespace jsi {
+
+class Value {
+public:
+  static Value undefined() {
+    return Value();
+  }
+};
+
+} // namespace jsi
+
+namespace react {
+
+class CallInvoker {
+public:
+  virtual void invokeAsync(std::function<void()> &&func) = 0;
+  virtual ~CallInvoker() {
+  }
+};
+
+class Promise {
+  // Called with an empty error once resolved
+  const std::function<void(const std::string &error)> onSettled;
+
+public:
+  explicit Promise(std::function<void(const std::string &error)> onSettled)
+      : onSettled(std::move(onSettled)) {
+  }
+
+  void resolve(const jsi::Value &) {
+    this->onSettled("");
+  }
+
+  void reject(const std::string &error) {
+    this->onSettled(error);
+  }
+};
+
+} // namespace react
+
+} // namespace facebook
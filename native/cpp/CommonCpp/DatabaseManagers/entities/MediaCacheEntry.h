@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace comm {
+
+// A row of media_cache, the local file downloaded for a media
+struct MediaCacheEntry {
+  std::string media_id;
+  std::string local_path;
+  int64_t size;
+  int64_t last_accessed;
+};
+
+} // namespace comm
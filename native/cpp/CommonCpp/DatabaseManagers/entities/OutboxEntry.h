@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace comm {
+
+// A row of outbox, a message that the server hasn't acknowledged yet
+struct OutboxEntry {
+  std::string local_id;
+  std::string thread;
+  // Peer whose session encrypts the payload, empty to send it as is
+  std::string target;
+  std::string payload;
+  // Olm message type once the payload is encrypted, -1 before
+  int encryption_type;
+  int64_t created_at;
+};
+
+} // namespace comm
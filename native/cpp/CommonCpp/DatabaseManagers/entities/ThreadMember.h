@@ -0,0 +1,16 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+namespace comm {
+
+// A row of thread_members, mirrored from the members JSON of a thread
+struct ThreadMember {
+  std::string thread_id;
+  std::string user_id;
+  std::unique_ptr<std::string> role;
+  int is_sender;
+};
+
+} // namespace comm
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace comm {
+
+// A row of thread_summary, aggregated from the messages of a thread
+struct ThreadSummary {
+  std::string thread_id;
+  int message_count;
+  std::unique_ptr<std::string> last_message_id;
+  int64_t last_message_time;
+  int last_message_has_media;
+};
+
+} // namespace comm
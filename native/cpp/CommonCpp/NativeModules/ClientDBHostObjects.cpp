@@ -0,0 +1,251 @@
+#include "ClientDBHostObjects.h"
+
+#include <cctype>
+
+namespace comm {
+
+namespace {
+jsi::Value
+optionalString(jsi::Runtime &rt, const std::unique_ptr<std::string> &value) {
+  if (!value) {
+    return jsi::Value::null();
+  }
+  return jsi::String::createFromUtf8(rt, *value);
+}
+
+jsi::Value jsiString(jsi::Runtime &rt, const std::string &value) {
+  return jsi::String::createFromUtf8(rt, value);
+}
+
+bool parseIndex(const std::string &name, size_t &index) {
+  // rejects leading zeros and lengths that could overflow
+  if (name.empty() || name.size() > 15 ||
+      (name.size() > 1 && name[0] == '0')) {
+    return false;
+  }
+  size_t result = 0;
+  for (char c : name) {
+    if (!std::isdigit(static_cast<unsigned char>(c))) {
+      return false;
+    }
+    result = result * 10 + (c - '0');
+  }
+  index = result;
+  return true;
+}
+} // namespace
+
+ClientDBRowsHostObject::ClientDBRowsHostObject(
+    size_t length,
+    std::function<jsi::Value(jsi::Runtime &, size_t)> getRow)
+    : length(length), getRow(std::move(getRow)) {
+}
+
+jsi::Value
+ClientDBRowsHostObject::get(jsi::Runtime &rt, const jsi::PropNameID &name) {
+  std::string propName = name.utf8(rt);
+  if (propName == "length") {
+    return jsi::Value(static_cast<double>(this->length));
+  }
+  size_t index;
+  if (!parseIndex(propName, index) || index >= this->length) {
+    return jsi::Value::undefined();
+  }
+  return this->getRow(rt, index);
+}
+
+std::vector<jsi::PropNameID>
+ClientDBRowsHostObject::getPropertyNames(jsi::Runtime &rt) {
+  std::vector<jsi::PropNameID> names;
+  names.push_back(jsi::PropNameID::forAscii(rt, "length"));
+  return names;
+}
+
+MessageHostObject::MessageHostObject(
+    std::shared_ptr<MessagesVector> messages,
+    size_t index)
+    : messages(std::move(messages)), index(index) {
+}
+
+jsi::Value
+MessageHostObject::get(jsi::Runtime &rt, const jsi::PropNameID &name) {
+  const auto &[message, media] = this->messages->at(this->index);
+  std::string propName = name.utf8(rt);
+  if (propName == "id") {
+    return jsiString(rt, message.id);
+  }
+  if (propName == "local_id" && message.local_id) {
+    return jsiString(rt, *message.local_id);
+  }
+  if (propName == "thread") {
+    return jsiString(rt, message.thread);
+  }
+  if (propName == "user") {
+    return jsiString(rt, message.user);
+  }
+  if (propName == "type") {
+    return jsiString(rt, std::to_string(message.type));
+  }
+  if (propName == "future_type" && message.future_type) {
+    return jsiString(rt, std::to_string(*message.future_type));
+  }
+  if (propName == "content" && message.content) {
+    return jsiString(rt, *message.content);
+  }
+  if (propName == "time") {
+    return jsiString(rt, std::to_string(message.time));
+  }
+  if (propName == "media_infos") {
+    jsi::Array jsiMediaArray = jsi::Array(rt, media.size());
+    size_t media_idx = 0;
+    for (const auto &media_info : media) {
+      auto jsiMedia = jsi::Object(rt);
+      jsiMedia.setProperty(rt, "id", media_info.id);
+      jsiMedia.setProperty(rt, "uri", media_info.uri);
+      jsiMedia.setProperty(rt, "type", media_info.type);
+      jsiMedia.setProperty(rt, "extras", media_info.extras);
+      jsiMediaArray.setValueAtIndex(rt, media_idx++, jsiMedia);
+    }
+    return std::move(jsiMediaArray);
+  }
+  return jsi::Value::undefined();
+}
+
+std::vector<jsi::PropNameID>
+MessageHostObject::getPropertyNames(jsi::Runtime &rt) {
+  const Message &message = this->messages->at(this->index).first;
+  std::vector<jsi::PropNameID> names;
+  names.push_back(jsi::PropNameID::forAscii(rt, "id"));
+  if (message.local_id) {
+    names.push_back(jsi::PropNameID::forAscii(rt, "local_id"));
+  }
+  names.push_back(jsi::PropNameID::forAscii(rt, "thread"));
+  names.push_back(jsi::PropNameID::forAscii(rt, "user"));
+  names.push_back(jsi::PropNameID::forAscii(rt, "type"));
+  if (message.future_type) {
+    names.push_back(jsi::PropNameID::forAscii(rt, "future_type"));
+  }
+  if (message.content) {
+    names.push_back(jsi::PropNameID::forAscii(rt, "content"));
+  }
+  names.push_back(jsi::PropNameID::forAscii(rt, "time"));
+  names.push_back(jsi::PropNameID::forAscii(rt, "media_infos"));
+  return names;
+}
+
+ThreadHostObject::ThreadHostObject(
+    std::shared_ptr<std::vector<Thread>> threads,
+    size_t index,
+    bool includeMembership)
+    : threads(std::move(threads)),
+      index(index),
+      includeMembership(includeMembership) {
+}
+
+jsi::Value
+ThreadHostObject::get(jsi::Runtime &rt, const jsi::PropNameID &name) {
+  const Thread &thread = this->threads->at(this->index);
+  std::string propName = name.utf8(rt);
+  if (propName == "id") {
+    return jsiString(rt, thread.id);
+  }
+  if (propName == "type") {
+    return jsi::Value(thread.type);
+  }
+  if (propName == "name") {
+    return optionalString(rt, thread.name);
+  }
+  if (propName == "description") {
+    return optionalString(rt, thread.description);
+  }
+  if (propName == "color") {
+    return jsiString(rt, thread.color);
+  }
+  if (propName == "creationTime") {
+    return jsiString(rt, std::to_string(thread.creation_time));
+  }
+  if (propName == "parentThreadID") {
+    return optionalString(rt, thread.parent_thread_id);
+  }
+  if (propName == "containingThreadID") {
+    return optionalString(rt, thread.containing_thread_id);
+  }
+  if (propName == "community") {
+    return optionalString(rt, thread.community);
+  }
+  if (this->includeMembership && propName == "members") {
+    return jsiString(rt, thread.members);
+  }
+  if (this->includeMembership && propName == "roles") {
+    return jsiString(rt, thread.roles);
+  }
+  if (propName == "currentUser") {
+    return jsiString(rt, thread.current_user);
+  }
+  if (propName == "sourceMessageID") {
+    return optionalString(rt, thread.source_message_id);
+  }
+  if (propName == "repliesCount") {
+    return jsi::Value(thread.replies_count);
+  }
+  return jsi::Value::undefined();
+}
+
+std::vector<jsi::PropNameID>
+ThreadHostObject::getPropertyNames(jsi::Runtime &rt) {
+  std::vector<std::string> propNames{
+      "id",
+      "type",
+      "name",
+      "description",
+      "color",
+      "creationTime",
+      "parentThreadID",
+      "containingThreadID",
+      "community"};
+  if (this->includeMembership) {
+    propNames.push_back("members");
+    propNames.push_back("roles");
+  }
+  propNames.push_back("currentUser");
+  propNames.push_back("sourceMessageID");
+  propNames.push_back("repliesCount");
+
+  std::vector<jsi::PropNameID> names;
+  for (const std::string &propName : propNames) {
+    names.push_back(jsi::PropNameID::forAscii(rt, propName));
+  }
+  return names;
+}
+
+jsi::Object
+createMessagesView(jsi::Runtime &rt, std::shared_ptr<MessagesVector> messages) {
+  size_t length = messages->size();
+  return jsi::Object::createFromHostObject(
+      rt,
+      std::make_shared<ClientDBRowsHostObject>(
+          length, [messages](jsi::Runtime &rt, size_t index) -> jsi::Value {
+            return jsi::Object::createFromHostObject(
+                rt, std::make_shared<MessageHostObject>(messages, index));
+          }));
+}
+
+jsi::Object createThreadsView(
+    jsi::Runtime &rt,
+    std::shared_ptr<std::vector<Thread>> threads,
+    bool includeMembership) {
+  size_t length = threads->size();
+  return jsi::Object::createFromHostObject(
+      rt,
+      std::make_shared<ClientDBRowsHostObject>(
+          length,
+          [threads, includeMembership](
+              jsi::Runtime &rt, size_t index) -> jsi::Value {
+            return jsi::Object::createFromHostObject(
+                rt,
+                std::make_shared<ThreadHostObject>(
+                    threads, index, includeMembership));
+          }));
+}
+
+} // namespace comm
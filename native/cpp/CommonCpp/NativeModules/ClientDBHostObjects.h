@@ -0,0 +1,70 @@
+#pragma once
+
+#include "../DatabaseManagers/entities/Media.h"
+#include "../DatabaseManagers/entities/Message.h"
+#include "../DatabaseManagers/entities/Thread.h"
+
+#include <jsi/jsi.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace comm {
+
+namespace jsi = facebook::jsi;
+
+using MessagesVector = std::vector<std::pair<Message, std::vector<Media>>>;
+
+// Read-only, array-like view over rows held in native memory. It exposes
+// length and index access, while each row is wrapped into a JS object only
+// when it is accessed.
+class ClientDBRowsHostObject : public jsi::HostObject {
+  size_t length;
+  std::function<jsi::Value(jsi::Runtime &, size_t)> getRow;
+
+public:
+  ClientDBRowsHostObject(
+      size_t length,
+      std::function<jsi::Value(jsi::Runtime &, size_t)> getRow);
+  jsi::Value get(jsi::Runtime &rt, const jsi::PropNameID &name) override;
+  std::vector<jsi::PropNameID> getPropertyNames(jsi::Runtime &rt) override;
+};
+
+// Row views keep the whole native vector alive and convert a field to a JSI
+// value each time it is read, using the same shape as parseDBMessages and
+// parseDBThreads.
+class MessageHostObject : public jsi::HostObject {
+  std::shared_ptr<MessagesVector> messages;
+  size_t index;
+
+public:
+  MessageHostObject(std::shared_ptr<MessagesVector> messages, size_t index);
+  jsi::Value get(jsi::Runtime &rt, const jsi::PropNameID &name) override;
+  std::vector<jsi::PropNameID> getPropertyNames(jsi::Runtime &rt) override;
+};
+
+class ThreadHostObject : public jsi::HostObject {
+  std::shared_ptr<std::vector<Thread>> threads;
+  size_t index;
+  bool includeMembership;
+
+public:
+  ThreadHostObject(
+      std::shared_ptr<std::vector<Thread>> threads,
+      size_t index,
+      bool includeMembership);
+  jsi::Value get(jsi::Runtime &rt, const jsi::PropNameID &name) override;
+  std::vector<jsi::PropNameID> getPropertyNames(jsi::Runtime &rt) override;
+};
+
+jsi::Object
+createMessagesView(jsi::Runtime &rt, std::shared_ptr<MessagesVector> messages);
+jsi::Object createThreadsView(
+    jsi::Runtime &rt,
+    std::shared_ptr<std::vector<Thread>> threads,
+    bool includeMembership = true);
+
+} // namespace comm
@@ -1,15 +1,36 @@
 #include "CommCoreModule.h"
 #include "../CryptoTools/DeviceID.h"
+#include "AllocationTracker.h"
+#include "ClientDBHostObjects.h"
 #include "DatabaseManager.h"
 #include "DraftStoreOperations.h"
+#include "InternalModules/BatchingCallInvoker.h"
+#include "InternalModules/DraftCache.h"
 #include "InternalModules/GlobalDBSingleton.h"
+#include "InternalModules/MemoryPressure.h"
+#include "InternalModules/MessagePrefetcher.h"
+#include "InternalModules/OutboxDispatcher.h"
+#include "InternalModules/TraceCallInvoker.h"
+#include "JSIConversions.h"
+#include "JSIProtocol.h"
+#include "Logger.h"
 #include "MessageStoreOperations.h"
+#include "QueryProfiler.h"
+#include "StartupTimeline.h"
 #include "ThreadStoreOperations.h"
+#include "Trace.h"
 
 #include <ReactCommon/TurboModuleUtils.h>
 #include <folly/dynamic.h>
 #include <folly/json.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
 #include <future>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace comm {
 
@@ -21,6 +42,8 @@ T CommCoreModule::runSyncOrThrowJSError(
     std::function<T()> task) {
   std::promise<T> promise;
   GlobalDBSingleton::instance.scheduleOrRunCancellable([&promise, &task]() {
+    // JS already has the changes of its own writes
+    const ChangeCapture::Suppression suppression;
     try {
       if constexpr (std::is_void<T>::value) {
         task();
@@ -36,21 +59,63 @@ T CommCoreModule::runSyncOrThrowJSError(
   // on the main thread we re-throw C++ error, catch it and
   // transform to informative JSError on the main thread
   try {
-    return promise.get_future().get();
+    std::future<T> future = promise.get_future();
+    {
+      // The JS thread is blocked, so the task and the ones ahead of it run
+      // at its QoS instead of the database thread's own
+      const ScopedQoSBoost boost(
+          GlobalDBSingleton::instance.getDatabaseThread());
+      future.wait();
+    }
+    TraceCall::beginConversion();
+    return future.get();
   } catch (const std::exception &e) {
     throw jsi::JSError(rt, e.what());
   }
 }
 
+// Reads skip both the hop to the database thread and the promise whenever
+// they can run on the JS thread's own read-only connection
+template <class T>
+T CommCoreModule::runSyncReadOrThrowJSError(
+    jsi::Runtime &rt,
+    std::function<T()> task) {
+  std::optional<T> result;
+  bool ranInPlace;
+  try {
+    ranInPlace = GlobalDBSingleton::instance.tryRunReadInPlace(
+        [&result, &task]() {
+          TraceCall::endParsing();
+          const TraceSection section(TraceCall::sectionName("in place read"));
+          result.emplace(task());
+        });
+  } catch (const std::exception &e) {
+    throw jsi::JSError(rt, e.what());
+  }
+  if (ranInPlace) {
+    TraceCall::beginConversion();
+    return std::move(*result);
+  }
+  return this->runSyncOrThrowJSError<T>(rt, std::move(task));
+}
+
 jsi::Value CommCoreModule::getDraft(jsi::Runtime &rt, jsi::String key) {
+  const TraceCall traceCall("CommCoreModule.getDraft");
   std::string keyStr = key.utf8(rt);
   return createPromiseAsJSIValue(
       rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
+        std::string cachedDraft;
+        if (DraftCache::instance().getDraft(keyStr, cachedDraft)) {
+          promise->resolve(jsi::String::createFromUtf8(innerRt, cachedDraft));
+          return;
+        }
+        uint64_t generation = DraftCache::instance().getGeneration();
         taskType job = [=, &innerRt]() {
           std::string error;
           std::string draftStr;
           try {
             draftStr = DatabaseManager::getQueryExecutor().getDraft(keyStr);
+            DraftCache::instance().fillDraft(keyStr, draftStr, generation);
           } catch (std::system_error &e) {
             error = e.what();
           }
@@ -63,8 +128,8 @@ jsi::Value CommCoreModule::getDraft(jsi::Runtime &rt, jsi::String key) {
             promise->resolve(std::move(draft));
           });
         };
-        GlobalDBSingleton::instance.scheduleOrRunCancellable(
-            job, promise, this->jsInvoker_);
+        GlobalDBSingleton::instance.scheduleOrRunCancellableRead(
+            job, promise, this->jsInvoker_, TaskPriority::Interactive);
       });
 }
 
@@ -72,27 +137,14 @@ jsi::Value CommCoreModule::updateDraft(
     jsi::Runtime &rt,
     jsi::String key,
     jsi::String text) {
+  const TraceCall traceCall("CommCoreModule.updateDraft");
   std::string keyStr = key.utf8(rt);
   std::string textStr = text.utf8(rt);
   return createPromiseAsJSIValue(
       rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
-        taskType job = [=]() {
-          std::string error;
-          try {
-            DatabaseManager::getQueryExecutor().updateDraft(keyStr, textStr);
-          } catch (std::system_error &e) {
-            error = e.what();
-          }
-          this->jsInvoker_->invokeAsync([=]() {
-            if (error.size()) {
-              promise->reject(error);
-            } else {
-              promise->resolve(true);
-            }
-          });
-        };
-        GlobalDBSingleton::instance.scheduleOrRunCancellable(
-            job, promise, this->jsInvoker_);
+        // Written once the draft is idle, see DraftCache
+        DraftCache::instance().updateDraft(keyStr, textStr);
+        promise->resolve(true);
       });
 }
 
@@ -100,15 +152,18 @@ jsi::Value CommCoreModule::moveDraft(
     jsi::Runtime &rt,
     jsi::String oldKey,
     jsi::String newKey) {
+  const TraceCall traceCall("CommCoreModule.moveDraft");
   std::string oldKeyStr = oldKey.utf8(rt);
   std::string newKeyStr = newKey.utf8(rt);
 
   return createPromiseAsJSIValue(
       rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
+        auto pendingDrafts = DraftCache::instance().takePendingDrafts();
         taskType job = [=]() {
           std::string error;
           bool result = false;
           try {
+            DraftCache::writeDrafts(pendingDrafts);
             result = DatabaseManager::getQueryExecutor().moveDraft(
                 oldKeyStr, newKeyStr);
           } catch (std::system_error &e) {
@@ -127,180 +182,865 @@ jsi::Value CommCoreModule::moveDraft(
       });
 }
 
-jsi::Array parseDBDrafts(
-    jsi::Runtime &rt,
-    std::shared_ptr<std::vector<Draft>> draftsVectorPtr) {
-  size_t numDrafts = count_if(
-      draftsVectorPtr->begin(), draftsVectorPtr->end(), [](Draft draft) {
-        return !draft.text.empty();
+// jsi values can only be released on the JS thread, while the last
+// reference to a shared value may be held by a database thread task
+template <typename T>
+std::shared_ptr<T>
+makeJSThreadReleased(T &&value, std::shared_ptr<CallInvoker> jsInvoker) {
+  return std::shared_ptr<T>(
+      new T(std::move(value)), [jsInvoker](T *pointer) {
+        jsInvoker->invokeAsync([pointer]() { delete pointer; });
       });
-  jsi::Array jsiDrafts = jsi::Array(rt, numDrafts);
+}
 
-  size_t writeIndex = 0;
-  for (Draft draft : *draftsVectorPtr) {
-    if (draft.text.empty()) {
-      continue;
+std::shared_ptr<CancellationToken>
+CommCoreModule::getCancellationToken(std::optional<double> requestID) {
+  if (!requestID) {
+    return nullptr;
+  }
+  int64_t requestIDInt = static_cast<int64_t>(*requestID);
+  std::lock_guard<std::mutex> lock(this->cancellationTokensMutex);
+  for (auto it = this->cancellationTokens.begin();
+       it != this->cancellationTokens.end();) {
+    if (it->second.expired()) {
+      it = this->cancellationTokens.erase(it);
+    } else {
+      it++;
     }
-    auto jsiDraft = jsi::Object(rt);
-    jsiDraft.setProperty(rt, "key", draft.key);
-    jsiDraft.setProperty(rt, "text", draft.text);
-    jsiDrafts.setValueAtIndex(rt, writeIndex++, jsiDraft);
   }
-  return jsiDrafts;
+  std::shared_ptr<CancellationToken> token =
+      this->cancellationTokens[requestIDInt].lock();
+  if (token == nullptr) {
+    token = std::make_shared<CancellationToken>();
+    this->cancellationTokens[requestIDInt] = token;
+  }
+  return token;
 }
 
-jsi::Array parseDBMessages(
-    jsi::Runtime &rt,
-    std::shared_ptr<std::vector<std::pair<Message, std::vector<Media>>>>
-        messagesVectorPtr) {
-  size_t numMessages = messagesVectorPtr->size();
-  jsi::Array jsiMessages = jsi::Array(rt, numMessages);
-  size_t writeIndex = 0;
-  for (const auto &[message, media] : *messagesVectorPtr) {
-    auto jsiMessage = jsi::Object(rt);
-    jsiMessage.setProperty(rt, "id", message.id);
-
-    if (message.local_id) {
-      auto local_id = message.local_id.get();
-      jsiMessage.setProperty(rt, "local_id", *local_id);
+void CommCoreModule::cancelDBRequest(jsi::Runtime &rt, double requestID) {
+  std::shared_ptr<CancellationToken> token;
+  {
+    std::lock_guard<std::mutex> lock(this->cancellationTokensMutex);
+    auto it = this->cancellationTokens.find(static_cast<int64_t>(requestID));
+    if (it == this->cancellationTokens.end()) {
+      // The requests have completed already
+      return;
     }
+    token = it->second.lock();
+    // Later requests with the same ID aren't cancelled
+    this->cancellationTokens.erase(it);
+  }
+  if (token != nullptr) {
+    token->cancel();
+  }
+}
 
-    jsiMessage.setProperty(rt, "thread", message.thread);
-    jsiMessage.setProperty(rt, "user", message.user);
-    jsiMessage.setProperty(rt, "type", std::to_string(message.type));
+void CommCoreModule::reportMessageListScroll(
+    jsi::Runtime &rt,
+    std::optional<jsi::String> threadID,
+    bool towardsOlder) {
+  std::optional<std::string> threadIDStr;
+  if (threadID) {
+    threadIDStr = threadID->utf8(rt);
+  }
+  MessagePrefetcher::instance().reportScroll(threadIDStr, towardsOlder);
+}
 
-    if (message.future_type) {
-      auto future_type = message.future_type.get();
-      jsiMessage.setProperty(rt, "future_type", std::to_string(*future_type));
-    }
+jsi::Value CommCoreModule::getClientDBStore(
+    jsi::Runtime &rt,
+    std::optional<double> protocolVersion,
+    std::optional<double> requestID) {
+  const TraceCall traceCall("CommCoreModule.getClientDBStore");
+  return this->getClientDBStoreImpl(
+      rt,
+      false,
+      false,
+      parseJSIProtocol(rt, protocolVersion),
+      this->getCancellationToken(requestID));
+}
 
-    if (message.content) {
-      auto content = message.content.get();
-      jsiMessage.setProperty(rt, "content", *content);
-    }
+jsi::Value
+CommCoreModule::getClientDBStoreWithThreadSummaries(jsi::Runtime &rt) {
+  const TraceCall traceCall(
+      "CommCoreModule.getClientDBStoreWithThreadSummaries");
+  return this->getClientDBStoreImpl(rt, true);
+}
 
-    jsiMessage.setProperty(rt, "time", std::to_string(message.time));
+jsi::Value CommCoreModule::getClientDBStoreView(jsi::Runtime &rt) {
+  const TraceCall traceCall("CommCoreModule.getClientDBStoreView");
+  return this->getClientDBStoreImpl(rt, false, true);
+}
 
-    size_t media_idx = 0;
-    jsi::Array jsiMediaArray = jsi::Array(rt, media.size());
-    for (const auto &media_info : media) {
-      auto jsiMedia = jsi::Object(rt);
-      jsiMedia.setProperty(rt, "id", media_info.id);
-      jsiMedia.setProperty(rt, "uri", media_info.uri);
-      jsiMedia.setProperty(rt, "type", media_info.type);
-      jsiMedia.setProperty(rt, "extras", media_info.extras);
+jsi::Value CommCoreModule::getClientDBStoreImpl(
+    jsi::Runtime &rt,
+    bool threadSummaries,
+    bool rowViews,
+    JSIProtocol protocol,
+    std::shared_ptr<CancellationToken> cancellationToken) {
+  return createPromiseAsJSIValue(
+      rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
+        // Drafts, messages and threads are loaded concurrently, each on its
+        // own reader connection. Every part is converted on the JS thread as
+        // soon as it is loaded and the promise resolves once all are set.
+        std::shared_ptr<CallInvoker> jsInvoker = this->jsInvoker_;
+        auto jsiClientDBStore =
+            makeJSThreadReleased(jsi::Object(innerRt), jsInvoker);
+        auto pendingParts = std::make_shared<size_t>(3);
+        auto failed = std::make_shared<bool>(false);
+
+        auto loadPart = [=, &innerRt](
+                            const std::string &name,
+                            std::function<std::function<jsi::Value(
+                                jsi::Runtime &)>()> load) {
+          taskType job = [=, &innerRt]() {
+            std::string error;
+            std::function<jsi::Value(jsi::Runtime &)> convert;
+            try {
+              const StartupTimelinePhase phase(
+                  "getClientDBStore: " + name + " load");
+              convert = load();
+            } catch (std::system_error &e) {
+              error = e.what();
+            }
+            jsInvoker->invokeAsync([=, &innerRt]() {
+              if (*failed) {
+                return;
+              }
+              if (error.size()) {
+                *failed = true;
+                promise->reject(error);
+                return;
+              }
+              const StartupTimelinePhase phase(
+                  "getClientDBStore: " + name + " conversion");
+              jsiClientDBStore->setProperty(
+                  innerRt, name.c_str(), convert(innerRt));
+              if (--*pendingParts == 0) {
+                promise->resolve(std::move(*jsiClientDBStore));
+              }
+            });
+          };
+          GlobalDBSingleton::instance.scheduleOrRunCancellableRead(
+              job,
+              promise,
+              jsInvoker,
+              TaskPriority::Normal,
+              cancellationToken);
+        };
 
-      jsiMediaArray.setValueAtIndex(rt, media_idx++, jsiMedia);
-    }
+        loadPart("drafts", []() {
+          auto draftsVectorPtr = std::make_shared<std::vector<Draft>>(
+              DatabaseManager::getQueryExecutor().getAllDrafts());
+          DraftCache::instance().overlayPendingDrafts(*draftsVectorPtr);
+          return [draftsVectorPtr](jsi::Runtime &rt) -> jsi::Value {
+            return parseDBDrafts(rt, draftsVectorPtr);
+          };
+        });
+        // Row views keep the rows alive for as long as JS holds them, while
+        // rows that are converted at once only live until then, so those are
+        // loaded in the compact layout
+        loadPart(
+            "messages",
+            [rowViews,
+             protocol]() -> std::function<jsi::Value(jsi::Runtime &)> {
+              if (!rowViews) {
+                auto store = std::make_shared<CompactMessageStore>(
+                    DatabaseManager::getQueryExecutor()
+                        .getAllMessagesCompact());
+                return [store, protocol](jsi::Runtime &rt) -> jsi::Value {
+                  return parseDBMessages(rt, store, protocol);
+                };
+              }
+              auto messagesVectorPtr = std::make_shared<
+                  std::vector<std::pair<Message, std::vector<Media>>>>(
+                  DatabaseManager::getQueryExecutor().getAllMessages());
+              return [messagesVectorPtr](jsi::Runtime &rt) -> jsi::Value {
+                return createMessagesView(rt, messagesVectorPtr);
+              };
+            });
+        loadPart(
+            "threads",
+            [threadSummaries, rowViews, protocol]()
+                -> std::function<jsi::Value(jsi::Runtime &)> {
+              if (!rowViews) {
+                auto store = std::make_shared<CompactThreadStore>(
+                    DatabaseManager::getQueryExecutor().getAllThreadsCompact(
+                        !threadSummaries));
+                return [store, threadSummaries, protocol](jsi::Runtime &rt)
+                           -> jsi::Value {
+                  return parseDBThreads(
+                      rt, store, !threadSummaries, protocol);
+                };
+              }
+              auto threadsVectorPtr = std::make_shared<std::vector<Thread>>(
+                  threadSummaries ? DatabaseManager::getQueryExecutor()
+                                        .getAllThreadSummaries()
+                                  : DatabaseManager::getQueryExecutor()
+                                        .getAllThreads());
+              return [threadsVectorPtr, threadSummaries](
+                         jsi::Runtime &rt) -> jsi::Value {
+                return createThreadsView(
+                    rt, threadsVectorPtr, !threadSummaries);
+              };
+            });
+      });
+}
+
+// Larger chunks would make a single conversion on the JS thread long
+const size_t STREAM_CHUNK_SIZE_LIMIT{10000};
 
-    jsiMessage.setProperty(rt, "media_infos", jsiMediaArray);
+jsi::Value CommCoreModule::streamClientDBStore(
+    jsi::Runtime &rt,
+    jsi::Object onChunk,
+    double chunkSize) {
+  const TraceCall traceCall("CommCoreModule.streamClientDBStore");
+  return this->streamClientDBStoreImpl(
+      rt, onChunk.asFunction(rt), chunkSize, false);
+}
 
-    jsiMessages.setValueAtIndex(rt, writeIndex++, jsiMessage);
+jsi::Value CommCoreModule::streamAllMessages(
+    jsi::Runtime &rt,
+    jsi::Object onChunk,
+    double chunkSize) {
+  const TraceCall traceCall("CommCoreModule.streamAllMessages");
+  return this->streamClientDBStoreImpl(
+      rt, onChunk.asFunction(rt), chunkSize, true);
+}
+
+jsi::Value CommCoreModule::streamClientDBStoreImpl(
+    jsi::Runtime &rt,
+    jsi::Function onChunk,
+    double requestedChunkSize,
+    bool messagesOnly) {
+  // Casting a NaN, an infinity or a negative number to size_t is undefined
+  if (!std::isfinite(requestedChunkSize) || requestedChunkSize < 1) {
+    throw jsi::JSError(
+        rt,
+        "chunkSize must be a finite number not less than 1, got " +
+            std::to_string(requestedChunkSize));
   }
+  const size_t chunkSize = static_cast<size_t>(std::min(
+      requestedChunkSize, static_cast<double>(STREAM_CHUNK_SIZE_LIMIT)));
+  auto onChunkPtr = makeJSThreadReleased(std::move(onChunk), this->jsInvoker_);
+  return createPromiseAsJSIValue(
+      rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
+        // Threads are streamed in batches of chunkSize, most recently active
+        // first, each followed by messages of that batch split into chunks.
+        // Only the current batch is kept in native memory, and chunks are
+        // converted on the JS thread one at a time.
+        std::shared_ptr<CallInvoker> jsInvoker = this->jsInvoker_;
+        auto failed = std::make_shared<std::atomic<bool>>(false);
+        auto sendChunk = [=, &innerRt](
+                             std::shared_ptr<std::vector<Draft>> drafts,
+                             std::shared_ptr<std::vector<Thread>> threads,
+                             std::shared_ptr<MessagesVector> messages) {
+          jsInvoker->invokeAsync([=, &innerRt]() {
+            if (failed->load()) {
+              return;
+            }
+            try {
+              if (messagesOnly) {
+                onChunkPtr->call(innerRt, parseDBMessages(innerRt, messages));
+                return;
+              }
+              auto jsiChunk = jsi::Object(innerRt);
+              jsiChunk.setProperty(
+                  innerRt, "messages", parseDBMessages(innerRt, messages));
+              jsiChunk.setProperty(
+                  innerRt, "threads", parseDBThreads(innerRt, threads));
+              jsiChunk.setProperty(
+                  innerRt, "drafts", parseDBDrafts(innerRt, drafts));
+              onChunkPtr->call(innerRt, jsiChunk);
+            } catch (const jsi::JSError &e) {
+              failed->store(true);
+              promise->reject(e.getMessage());
+            } catch (const std::exception &e) {
+              failed->store(true);
+              promise->reject(e.what());
+            }
+          });
+        };
+
+        taskType job = [=]() {
+          std::string error;
+          try {
+            auto drafts = std::make_shared<std::vector<Draft>>();
+            if (!messagesOnly) {
+              *drafts = DatabaseManager::getQueryExecutor().getAllDrafts();
+              DraftCache::instance().overlayPendingDrafts(*drafts);
+            }
+            std::vector<Thread> threads =
+                DatabaseManager::getQueryExecutor().getAllThreadsByActivity();
+            for (size_t begin = 0; begin < threads.size() && !failed->load();
+                 begin += chunkSize) {
+              size_t end = std::min(begin + chunkSize, threads.size());
+              auto threadsChunk = std::make_shared<std::vector<Thread>>();
+              std::vector<std::string> threadIDs;
+              for (size_t i = begin; i < end; i++) {
+                threadIDs.push_back(threads[i].id);
+                if (!messagesOnly) {
+                  threadsChunk->push_back(std::move(threads[i]));
+                }
+              }
+              MessagesVector messages =
+                  DatabaseManager::getQueryExecutor().getMessagesOfThreads(
+                      threadIDs);
+
+              size_t messagesBegin = 0;
+              do {
+                size_t messagesEnd =
+                    std::min(messagesBegin + chunkSize, messages.size());
+                auto messagesChunk = std::make_shared<MessagesVector>(
+                    std::make_move_iterator(messages.begin() + messagesBegin),
+                    std::make_move_iterator(messages.begin() + messagesEnd));
+                if (!messagesOnly || !messagesChunk->empty()) {
+                  sendChunk(drafts, threadsChunk, messagesChunk);
+                }
+                drafts = std::make_shared<std::vector<Draft>>();
+                threadsChunk = std::make_shared<std::vector<Thread>>();
+                messagesBegin = messagesEnd;
+              } while (messagesBegin < messages.size());
+            }
+            // Messages whose thread row is missing aren't read with any of
+            // the threads
+            MessagesVector orphanedMessages =
+                DatabaseManager::getQueryExecutor().getMessagesWithoutThread();
+            for (size_t begin = 0;
+                 begin < orphanedMessages.size() && !failed->load();
+                 begin += chunkSize) {
+              size_t end = std::min(begin + chunkSize, orphanedMessages.size());
+              sendChunk(
+                  drafts,
+                  std::make_shared<std::vector<Thread>>(),
+                  std::make_shared<MessagesVector>(
+                      std::make_move_iterator(orphanedMessages.begin() + begin),
+                      std::make_move_iterator(orphanedMessages.begin() + end)));
+              drafts = std::make_shared<std::vector<Draft>>();
+            }
+            if (!messagesOnly && !drafts->empty()) {
+              sendChunk(
+                  drafts,
+                  std::make_shared<std::vector<Thread>>(),
+                  std::make_shared<MessagesVector>());
+            }
+          } catch (std::system_error &e) {
+            error = e.what();
+          }
+          jsInvoker->invokeAsync([=]() {
+            if (failed->load()) {
+              return;
+            }
+            if (error.size()) {
+              promise->reject(error);
+              return;
+            }
+            promise->resolve(jsi::Value::undefined());
+          });
+        };
+        GlobalDBSingleton::instance.scheduleOrRunCancellableRead(
+            job, promise, jsInvoker);
+      });
+}
+
+jsi::Value CommCoreModule::removeAllDrafts(jsi::Runtime &rt) {
+  const TraceCall traceCall("CommCoreModule.removeAllDrafts");
+  return createPromiseAsJSIValue(
+      rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
+        // The pending updates would be removed right after being written
+        DraftCache::instance().takePendingDrafts();
+        taskType job = [=]() {
+          std::string error;
+          try {
+            DatabaseManager::getQueryExecutor().removeAllDrafts();
+          } catch (std::system_error &e) {
+            error = e.what();
+          }
+          this->jsInvoker_->invokeAsync([=]() {
+            if (error.size()) {
+              promise->reject(error);
+              return;
+            }
+            promise->resolve(jsi::Value::undefined());
+          });
+        };
+        GlobalDBSingleton::instance.scheduleOrRunCancellable(
+            job, promise, this->jsInvoker_);
+      });
+}
+
+jsi::Array CommCoreModule::getAllMessagesSync(jsi::Runtime &rt) {
+  const TraceCall traceCall("CommCoreModule.getAllMessagesSync");
+  auto messagesVector = this->runSyncReadOrThrowJSError<
+      std::vector<std::pair<Message, std::vector<Media>>>>(rt, []() {
+    return DatabaseManager::getQueryExecutor().getAllMessages();
+  });
+  auto messagesVectorPtr =
+      std::make_shared<std::vector<std::pair<Message, std::vector<Media>>>>(
+          std::move(messagesVector));
+  jsi::Array jsiMessages = parseDBMessages(rt, messagesVectorPtr);
   return jsiMessages;
 }
 
-jsi::Array parseDBThreads(
+jsi::Value CommCoreModule::getThreadMessagesBefore(
     jsi::Runtime &rt,
-    std::shared_ptr<std::vector<Thread>> threadsVectorPtr) {
-  size_t numThreads = threadsVectorPtr->size();
-  jsi::Array jsiThreads = jsi::Array(rt, numThreads);
-  size_t writeIdx = 0;
-  for (const Thread &thread : *threadsVectorPtr) {
-    jsi::Object jsiThread = jsi::Object(rt);
-    jsiThread.setProperty(rt, "id", thread.id);
-    jsiThread.setProperty(rt, "type", thread.type);
-    jsiThread.setProperty(
-        rt,
-        "name",
-        thread.name ? jsi::String::createFromUtf8(rt, *thread.name)
-                    : jsi::Value::null());
-    jsiThread.setProperty(
-        rt,
-        "description",
-        thread.description
-            ? jsi::String::createFromUtf8(rt, *thread.description)
-            : jsi::Value::null());
-    jsiThread.setProperty(rt, "color", thread.color);
-    jsiThread.setProperty(
-        rt, "creationTime", std::to_string(thread.creation_time));
-    jsiThread.setProperty(
-        rt,
-        "parentThreadID",
-        thread.parent_thread_id
-            ? jsi::String::createFromUtf8(rt, *thread.parent_thread_id)
-            : jsi::Value::null());
-    jsiThread.setProperty(
-        rt,
-        "containingThreadID",
-        thread.containing_thread_id
-            ? jsi::String::createFromUtf8(rt, *thread.containing_thread_id)
-            : jsi::Value::null());
-    jsiThread.setProperty(
-        rt,
-        "community",
-        thread.community ? jsi::String::createFromUtf8(rt, *thread.community)
-                         : jsi::Value::null());
-    jsiThread.setProperty(rt, "members", thread.members);
-    jsiThread.setProperty(rt, "roles", thread.roles);
-    jsiThread.setProperty(rt, "currentUser", thread.current_user);
-    jsiThread.setProperty(
-        rt,
-        "sourceMessageID",
-        thread.source_message_id
-            ? jsi::String::createFromUtf8(rt, *thread.source_message_id)
-            : jsi::Value::null());
-    jsiThread.setProperty(rt, "repliesCount", thread.replies_count);
+    jsi::String threadID,
+    double beforeTime,
+    jsi::String beforeMessageID,
+    double pageSize,
+    std::optional<double> protocolVersion,
+    std::optional<double> requestID) {
+  const TraceCall traceCall("CommCoreModule.getThreadMessagesBefore");
+  JSIProtocol protocol = parseJSIProtocol(rt, protocolVersion);
+  std::shared_ptr<CancellationToken> cancellationToken =
+      this->getCancellationToken(requestID);
+  std::string threadIDStr = threadID.utf8(rt);
+  std::string beforeMessageIDStr = beforeMessageID.utf8(rt);
+  int64_t beforeTimeInt = static_cast<int64_t>(beforeTime);
+  int pageSizeInt = static_cast<int>(pageSize);
+  return createPromiseAsJSIValue(
+      rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
+        taskType job = [=, &innerRt]() {
+          std::string error;
+          std::vector<std::pair<Message, std::vector<Media>>> messagesVector;
+          try {
+            messagesVector =
+                DatabaseManager::getQueryExecutor().getThreadMessagesBefore(
+                    threadIDStr,
+                    beforeTimeInt,
+                    beforeMessageIDStr,
+                    pageSizeInt);
+            const Message *oldest =
+                messagesVector.empty() ? nullptr : &messagesVector.back().first;
+            MessagePrefetcher::instance().onPageServed(
+                threadIDStr,
+                beforeTimeInt,
+                beforeMessageIDStr,
+                pageSizeInt,
+                messagesVector.size(),
+                oldest ? oldest->time : 0,
+                oldest ? oldest->id : std::string());
+          } catch (std::system_error &e) {
+            error = e.what();
+          }
+          auto messagesVectorPtr = std::make_shared<
+              std::vector<std::pair<Message, std::vector<Media>>>>(
+              std::move(messagesVector));
+          this->jsInvoker_->invokeAsync(
+              [&innerRt, messagesVectorPtr, error, promise, protocol]() {
+                if (error.size()) {
+                  promise->reject(error);
+                  return;
+                }
+                jsi::Array jsiMessages =
+                    parseDBMessages(innerRt, messagesVectorPtr, protocol);
+                promise->resolve(std::move(jsiMessages));
+              });
+        };
+        GlobalDBSingleton::instance.scheduleOrRunCancellableRead(
+            job,
+            promise,
+            this->jsInvoker_,
+            TaskPriority::Interactive,
+            cancellationToken);
+      });
+}
 
-    jsiThreads.setValueAtIndex(rt, writeIdx++, jsiThread);
+jsi::Value CommCoreModule::searchMessages(
+    jsi::Runtime &rt,
+    jsi::String query,
+    std::optional<jsi::String> threadID,
+    double pageSize,
+    double offset,
+    std::optional<double> protocolVersion,
+    std::optional<double> requestID) {
+  const TraceCall traceCall("CommCoreModule.searchMessages");
+  JSIProtocol protocol = parseJSIProtocol(rt, protocolVersion);
+  std::shared_ptr<CancellationToken> cancellationToken =
+      this->getCancellationToken(requestID);
+  std::string queryStr = query.utf8(rt);
+  folly::Optional<std::string> threadIDStr;
+  if (threadID) {
+    threadIDStr = threadID->utf8(rt);
   }
-  return jsiThreads;
+  int pageSizeInt = static_cast<int>(pageSize);
+  int offsetInt = static_cast<int>(offset);
+  return createPromiseAsJSIValue(
+      rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
+        taskType job = [=, &innerRt]() {
+          std::string error;
+          std::vector<std::pair<Message, std::vector<Media>>> messagesVector;
+          try {
+            messagesVector = DatabaseManager::getQueryExecutor().searchMessages(
+                queryStr, threadIDStr, pageSizeInt, offsetInt);
+          } catch (std::system_error &e) {
+            error = e.what();
+          }
+          auto messagesVectorPtr = std::make_shared<
+              std::vector<std::pair<Message, std::vector<Media>>>>(
+              std::move(messagesVector));
+          this->jsInvoker_->invokeAsync(
+              [&innerRt, messagesVectorPtr, error, promise, protocol]() {
+                if (error.size()) {
+                  promise->reject(error);
+                  return;
+                }
+                jsi::Array jsiMessages =
+                    parseDBMessages(innerRt, messagesVectorPtr, protocol);
+                promise->resolve(std::move(jsiMessages));
+              });
+        };
+        GlobalDBSingleton::instance.scheduleOrRunCancellableRead(
+            job,
+            promise,
+            this->jsInvoker_,
+            TaskPriority::Interactive,
+            cancellationToken);
+      });
+}
+
+// Resolves to a view over the loaded messages, which stay in native memory
+// for as long as JS holds the view
+jsi::Value loadMessagesView(
+    jsi::Runtime &rt,
+    std::shared_ptr<CallInvoker> jsInvoker,
+    std::function<MessagesVector()> load) {
+  return createPromiseAsJSIValue(
+      rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
+        taskType job = [=, &innerRt]() {
+          std::string error;
+          auto messages = std::make_shared<MessagesVector>();
+          try {
+            *messages = load();
+          } catch (std::system_error &e) {
+            error = e.what();
+          }
+          jsInvoker->invokeAsync([&innerRt, messages, error, promise]() {
+            if (error.size()) {
+              promise->reject(error);
+              return;
+            }
+            promise->resolve(createMessagesView(innerRt, messages));
+          });
+        };
+        GlobalDBSingleton::instance.scheduleOrRunCancellableRead(
+            job, promise, jsInvoker, TaskPriority::Interactive);
+      });
+}
+
+jsi::Value CommCoreModule::getThreadMessagesInRange(
+    jsi::Runtime &rt,
+    jsi::String threadID,
+    double fromTime,
+    double toTime,
+    double limit) {
+  const TraceCall traceCall("CommCoreModule.getThreadMessagesInRange");
+  std::string threadIDStr = threadID.utf8(rt);
+  int64_t fromTimeInt = static_cast<int64_t>(fromTime);
+  int64_t toTimeInt = static_cast<int64_t>(toTime);
+  int limitInt = static_cast<int>(limit);
+  return loadMessagesView(rt, this->jsInvoker_, [=]() {
+    return DatabaseManager::getQueryExecutor().getThreadMessagesInRange(
+        threadIDStr, fromTimeInt, toTimeInt, limitInt);
+  });
+}
+
+jsi::Value
+CommCoreModule::getMessagesByIDs(jsi::Runtime &rt, jsi::Array ids) {
+  const TraceCall traceCall("CommCoreModule.getMessagesByIDs");
+  std::vector<std::string> idsVector;
+  for (size_t idx = 0; idx < ids.size(rt); idx++) {
+    idsVector.push_back(ids.getValueAtIndex(rt, idx).asString(rt).utf8(rt));
+  }
+  return loadMessagesView(rt, this->jsInvoker_, [idsVector]() {
+    return DatabaseManager::getQueryExecutor().getMessagesByIDs(idsVector);
+  });
+}
+
+jsi::Value CommCoreModule::getThreadMessageCounts(
+    jsi::Runtime &rt,
+    jsi::Array threadIDs) {
+  const TraceCall traceCall("CommCoreModule.getThreadMessageCounts");
+  std::vector<std::string> threadIDsVector;
+  for (size_t idx = 0; idx < threadIDs.size(rt); idx++) {
+    threadIDsVector.push_back(
+        threadIDs.getValueAtIndex(rt, idx).asString(rt).utf8(rt));
+  }
+  return createPromiseAsJSIValue(
+      rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
+        taskType job = [=, &innerRt]() {
+          std::string error;
+          auto counts = std::make_shared<std::vector<int>>();
+          try {
+            *counts =
+                DatabaseManager::getQueryExecutor().getThreadMessageCounts(
+                    threadIDsVector);
+          } catch (std::system_error &e) {
+            error = e.what();
+          }
+          this->jsInvoker_->invokeAsync([&innerRt, counts, error, promise]() {
+            if (error.size()) {
+              promise->reject(error);
+              return;
+            }
+            jsi::Array jsiCounts = jsi::Array(innerRt, counts->size());
+            for (size_t idx = 0; idx < counts->size(); idx++) {
+              jsiCounts.setValueAtIndex(innerRt, idx, (*counts)[idx]);
+            }
+            promise->resolve(std::move(jsiCounts));
+          });
+        };
+        GlobalDBSingleton::instance.scheduleOrRunCancellableRead(
+            job, promise, this->jsInvoker_);
+      });
+}
+
+jsi::Value
+CommCoreModule::archiveMessages(jsi::Runtime &rt, double olderThan) {
+  const TraceCall traceCall("CommCoreModule.archiveMessages");
+  int64_t olderThanTime = static_cast<int64_t>(olderThan);
+  return createPromiseAsJSIValue(
+      rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
+        taskType job = [=]() {
+          std::string error;
+          int archivedCount = 0;
+          try {
+            archivedCount =
+                DatabaseManager::getQueryExecutor().archiveMessages(
+                    olderThanTime);
+          } catch (std::system_error &e) {
+            error = e.what();
+          }
+          this->jsInvoker_->invokeAsync([=]() {
+            if (error.size()) {
+              promise->reject(error);
+              return;
+            }
+            promise->resolve(archivedCount);
+          });
+        };
+        GlobalDBSingleton::instance.scheduleOrRunCancellable(
+            job, promise, this->jsInvoker_);
+      });
+}
+
+jsi::Value CommCoreModule::vacuumDatabase(jsi::Runtime &rt) {
+  const TraceCall traceCall("CommCoreModule.vacuumDatabase");
+  return createPromiseAsJSIValue(
+      rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
+        taskType job = [=]() {
+          std::string error;
+          try {
+            DatabaseManager::getQueryExecutor().vacuumDatabase();
+          } catch (std::system_error &e) {
+            error = e.what();
+          }
+          this->jsInvoker_->invokeAsync([=]() {
+            if (error.size()) {
+              promise->reject(error);
+              return;
+            }
+            promise->resolve(jsi::Value::undefined());
+          });
+        };
+        GlobalDBSingleton::instance.scheduleOrRunCancellable(
+            job, promise, this->jsInvoker_);
+      });
+}
+
+jsi::Value CommCoreModule::addToOutbox(jsi::Runtime &rt, jsi::Array entries) {
+  const TraceCall traceCall("CommCoreModule.addToOutbox");
+  std::vector<OutboxEntry> outboxEntries;
+  for (size_t idx = 0; idx < entries.size(rt); idx++) {
+    jsi::Object entry = entries.getValueAtIndex(rt, idx).asObject(rt);
+    jsi::Value target = entry.getProperty(rt, "targetUserID");
+    jsi::Value encryptionType = entry.getProperty(rt, "encryptionType");
+    outboxEntries.push_back(OutboxEntry{
+        entry.getProperty(rt, "localID").asString(rt).utf8(rt),
+        entry.getProperty(rt, "threadID").asString(rt).utf8(rt),
+        target.isString() ? target.asString(rt).utf8(rt) : std::string(),
+        entry.getProperty(rt, "payload").asString(rt).utf8(rt),
+        encryptionType.isNumber()
+            ? static_cast<int>(encryptionType.asNumber())
+            : -1,
+        std::stoll(
+            entry.getProperty(rt, "createdAt").asString(rt).utf8(rt))});
+  }
+  return createPromiseAsJSIValue(
+      rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
+        taskType job = [=]() {
+          std::string error;
+          try {
+            DatabaseManager::getQueryExecutor().addToOutbox(outboxEntries);
+          } catch (std::system_error &e) {
+            error = e.what();
+          }
+          this->jsInvoker_->invokeAsync([=]() {
+            if (error.size()) {
+              promise->reject(error);
+              return;
+            }
+            promise->resolve(jsi::Value::undefined());
+          });
+        };
+        GlobalDBSingleton::instance.scheduleOrRunCancellable(
+            job, promise, this->jsInvoker_);
+      });
+}
+
+jsi::Object
+parseOutboxBatch(jsi::Runtime &rt, const OutboxDispatcher::Batch &batch) {
+  jsi::Array jsiEntries = jsi::Array(rt, batch.entries.size());
+  for (size_t idx = 0; idx < batch.entries.size(); idx++) {
+    const OutboxEntry &entry = batch.entries[idx];
+    jsi::Object jsiEntry = jsi::Object(rt);
+    jsiEntry.setProperty(rt, "localID", entry.local_id);
+    jsiEntry.setProperty(rt, "threadID", entry.thread);
+    if (!entry.target.empty()) {
+      jsiEntry.setProperty(rt, "targetUserID", entry.target);
+    }
+    jsiEntry.setProperty(rt, "payload", entry.payload);
+    if (entry.encryption_type != -1) {
+      jsiEntry.setProperty(rt, "encryptionType", entry.encryption_type);
+    }
+    jsiEntry.setProperty(rt, "createdAt", std::to_string(entry.created_at));
+    jsiEntries.setValueAtIndex(rt, idx, jsiEntry);
+  }
+  jsi::Array jsiFailedLocalIDs = jsi::Array(rt, batch.failedLocalIDs.size());
+  for (size_t idx = 0; idx < batch.failedLocalIDs.size(); idx++) {
+    jsiFailedLocalIDs.setValueAtIndex(
+        rt, idx, jsi::String::createFromUtf8(rt, batch.failedLocalIDs[idx]));
+  }
+  jsi::Object jsiBatch = jsi::Object(rt);
+  jsiBatch.setProperty(rt, "entries", jsiEntries);
+  jsiBatch.setProperty(rt, "failedLocalIDs", jsiFailedLocalIDs);
+  return jsiBatch;
+}
+
+jsi::Value CommCoreModule::dispatchOutbox(jsi::Runtime &rt) {
+  const TraceCall traceCall("CommCoreModule.dispatchOutbox");
+  folly::Optional<std::string> storedSecretKey =
+      this->secureStore.get(this->secureStoreAccountDataKey);
+  return createPromiseAsJSIValue(
+      rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
+        auto resolve = [=, &innerRt](
+                           std::shared_ptr<OutboxDispatcher::Batch> batch,
+                           std::string error) {
+          this->jsInvoker_->invokeAsync([=, &innerRt]() {
+            if (error.size()) {
+              promise->reject(error);
+              return;
+            }
+            promise->resolve(parseOutboxBatch(innerRt, *batch));
+          });
+        };
+        // The batch is taken on the database thread, encrypted on the crypto
+        // thread, and its payloads are stored back on the database thread
+        // before it is handed to JS
+        taskType job = [=]() {
+          auto batch = std::make_shared<OutboxDispatcher::Batch>();
+          try {
+            *batch = OutboxDispatcher::take(OUTBOX_DISPATCH_BATCH_SIZE);
+          } catch (std::system_error &e) {
+            resolve(batch, e.what());
+            return;
+          }
+          bool encryptionNeeded = std::any_of(
+              batch->entries.begin(),
+              batch->entries.end(),
+              [](const OutboxEntry &entry) {
+                return !entry.target.empty() && entry.encryption_type == -1;
+              });
+          if (!encryptionNeeded) {
+            resolve(batch, "");
+            return;
+          }
+          this->cryptoThread->scheduleTask([=]() {
+            std::vector<std::string> localIDs;
+            for (const OutboxEntry &entry : batch->entries) {
+              localIDs.push_back(entry.local_id);
+            }
+            auto encryptedEntries = std::make_shared<std::vector<OutboxEntry>>(
+                OutboxDispatcher::encrypt(this->cryptoModule.get(), *batch));
+            auto persist = std::make_shared<crypto::Persist>();
+            std::string error;
+            std::unique_lock<std::mutex> persistLock(
+                this->cryptoPersistMutex, std::defer_lock);
+            if (!encryptedEntries->empty()) {
+              try {
+                persistLock.lock();
+                *persist = this->cryptoModule->storeChangedAsB64(
+                    storedSecretKey.value());
+              } catch (std::exception &e) {
+                error = e.what();
+              }
+            }
+            GlobalDBSingleton::instance.scheduleOrRunCancellable(
+                [=]() {
+                  std::string storeError = error;
+                  try {
+                    if (storeError.empty()) {
+                      OutboxDispatcher::store(
+                          *encryptedEntries, *persist, batch->failedLocalIDs);
+                    } else {
+                      // Sessions that advanced without being stored can't
+                      // encrypt what is sent
+                      DatabaseManager::getQueryExecutor().requeueOutboxEntries(
+                          localIDs);
+                    }
+                  } catch (std::system_error &e) {
+                    storeError = e.what();
+                    this->markUnstored(persist);
+                    try {
+                      DatabaseManager::getQueryExecutor().requeueOutboxEntries(
+                          localIDs);
+                    } catch (std::system_error &requeueError) {
+                      Logger::log(
+                          "Failed to requeue outbox entries: " +
+                          std::string(requeueError.what()));
+                    }
+                  }
+                  resolve(batch, storeError);
+                },
+                promise,
+                this->jsInvoker_);
+          });
+        };
+        GlobalDBSingleton::instance.scheduleOrRunCancellable(
+            job, promise, this->jsInvoker_);
+      });
 }
 
-jsi::Value CommCoreModule::getClientDBStore(jsi::Runtime &rt) {
+jsi::Value
+CommCoreModule::requeueOutbox(jsi::Runtime &rt, jsi::Array localIDs) {
+  const TraceCall traceCall("CommCoreModule.requeueOutbox");
+  std::vector<std::string> localIDsVector;
+  for (size_t idx = 0; idx < localIDs.size(rt); idx++) {
+    localIDsVector.push_back(
+        localIDs.getValueAtIndex(rt, idx).asString(rt).utf8(rt));
+  }
+  if (localIDsVector.empty()) {
+    // Requeueing without IDs would requeue every entry in flight
+    return createPromiseAsJSIValue(
+        rt, [](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
+          promise->resolve(jsi::Value::undefined());
+        });
+  }
   return createPromiseAsJSIValue(
       rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
-        taskType job = [=, &innerRt]() {
+        taskType job = [=]() {
           std::string error;
-          std::vector<Draft> draftsVector;
-          std::vector<Thread> threadsVector;
-          std::vector<std::pair<Message, std::vector<Media>>> messagesVector;
           try {
-            draftsVector = DatabaseManager::getQueryExecutor().getAllDrafts();
-            messagesVector =
-                DatabaseManager::getQueryExecutor().getAllMessages();
-            threadsVector = DatabaseManager::getQueryExecutor().getAllThreads();
+            DatabaseManager::getQueryExecutor().requeueOutboxEntries(
+                localIDsVector);
           } catch (std::system_error &e) {
             error = e.what();
           }
-          auto draftsVectorPtr =
-              std::make_shared<std::vector<Draft>>(std::move(draftsVector));
-          auto messagesVectorPtr = std::make_shared<
-              std::vector<std::pair<Message, std::vector<Media>>>>(
-              std::move(messagesVector));
-          auto threadsVectorPtr =
-              std::make_shared<std::vector<Thread>>(std::move(threadsVector));
-          this->jsInvoker_->invokeAsync([&innerRt,
-                                         draftsVectorPtr,
-                                         messagesVectorPtr,
-                                         threadsVectorPtr,
-                                         error,
-                                         promise]() {
+          this->jsInvoker_->invokeAsync([=]() {
             if (error.size()) {
               promise->reject(error);
               return;
             }
-            jsi::Array jsiDrafts = parseDBDrafts(innerRt, draftsVectorPtr);
-            jsi::Array jsiMessages =
-                parseDBMessages(innerRt, messagesVectorPtr);
-            jsi::Array jsiThreads = parseDBThreads(innerRt, threadsVectorPtr);
-
-            auto jsiClientDBStore = jsi::Object(innerRt);
-            jsiClientDBStore.setProperty(innerRt, "messages", jsiMessages);
-            jsiClientDBStore.setProperty(innerRt, "threads", jsiThreads);
-            jsiClientDBStore.setProperty(innerRt, "drafts", jsiDrafts);
-
-            promise->resolve(std::move(jsiClientDBStore));
+            promise->resolve(jsi::Value::undefined());
           });
         };
         GlobalDBSingleton::instance.scheduleOrRunCancellable(
@@ -308,13 +1048,25 @@ jsi::Value CommCoreModule::getClientDBStore(jsi::Runtime &rt) {
       });
 }
 
-jsi::Value CommCoreModule::removeAllDrafts(jsi::Runtime &rt) {
+jsi::Value CommCoreModule::acknowledgeOutbox(
+    jsi::Runtime &rt,
+    jsi::Array acknowledgements) {
+  const TraceCall traceCall("CommCoreModule.acknowledgeOutbox");
+  std::vector<std::pair<std::string, std::string>> serverIDs;
+  for (size_t idx = 0; idx < acknowledgements.size(rt); idx++) {
+    jsi::Object acknowledgement =
+        acknowledgements.getValueAtIndex(rt, idx).asObject(rt);
+    serverIDs.emplace_back(
+        acknowledgement.getProperty(rt, "localID").asString(rt).utf8(rt),
+        acknowledgement.getProperty(rt, "serverID").asString(rt).utf8(rt));
+  }
   return createPromiseAsJSIValue(
       rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
         taskType job = [=]() {
           std::string error;
           try {
-            DatabaseManager::getQueryExecutor().removeAllDrafts();
+            DatabaseManager::getQueryExecutor().acknowledgeOutboxEntries(
+                serverIDs);
           } catch (std::system_error &e) {
             error = e.what();
           }
@@ -331,51 +1083,10 @@ jsi::Value CommCoreModule::removeAllDrafts(jsi::Runtime &rt) {
       });
 }
 
-jsi::Array CommCoreModule::getAllMessagesSync(jsi::Runtime &rt) {
-  auto messagesVector = this->runSyncOrThrowJSError<
-      std::vector<std::pair<Message, std::vector<Media>>>>(rt, []() {
-    return DatabaseManager::getQueryExecutor().getAllMessages();
-  });
-  auto messagesVectorPtr =
-      std::make_shared<std::vector<std::pair<Message, std::vector<Media>>>>(
-          std::move(messagesVector));
-  jsi::Array jsiMessages = parseDBMessages(rt, messagesVectorPtr);
-  return jsiMessages;
-}
-
-const std::string UPDATE_DRAFT_OPERATION = "update";
-const std::string MOVE_DRAFT_OPERATION = "move";
-const std::string REMOVE_ALL_DRAFTS_OPERATION = "remove_all";
-
-std::vector<std::unique_ptr<DraftStoreOperationBase>>
-createDraftStoreOperations(jsi::Runtime &rt, const jsi::Array &operations) {
-  std::vector<std::unique_ptr<DraftStoreOperationBase>> draftStoreOps;
-  for (auto idx = 0; idx < operations.size(rt); idx++) {
-    auto op = operations.getValueAtIndex(rt, idx).asObject(rt);
-    auto op_type = op.getProperty(rt, "type").asString(rt).utf8(rt);
-
-    if (op_type == REMOVE_ALL_DRAFTS_OPERATION) {
-      draftStoreOps.push_back(std::make_unique<RemoveAllDraftsOperation>());
-      continue;
-    }
-
-    auto payload_obj = op.getProperty(rt, "payload").asObject(rt);
-    if (op_type == UPDATE_DRAFT_OPERATION) {
-      draftStoreOps.push_back(
-          std::make_unique<UpdateDraftOperation>(rt, payload_obj));
-    } else if (op_type == MOVE_DRAFT_OPERATION) {
-      draftStoreOps.push_back(
-          std::make_unique<MoveDraftOperation>(rt, payload_obj));
-    } else {
-      throw std::runtime_error("unsupported operation: " + op_type);
-    }
-  }
-  return draftStoreOps;
-}
-
 jsi::Value CommCoreModule::processDraftStoreOperations(
     jsi::Runtime &rt,
     jsi::Array operations) {
+  const TraceCall traceCall("CommCoreModule.processDraftStoreOperations");
   std::string createOperationsError;
   std::shared_ptr<std::vector<std::unique_ptr<DraftStoreOperationBase>>>
       draftStoreOpsPtr;
@@ -390,38 +1101,25 @@ jsi::Value CommCoreModule::processDraftStoreOperations(
 
   return createPromiseAsJSIValue(
       rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
-        taskType job = [=]() {
-          std::string error = createOperationsError;
-
-          if (!error.size()) {
-            try {
-              DatabaseManager::getQueryExecutor().beginTransaction();
-              for (const auto &operation : *draftStoreOpsPtr) {
-                operation->execute();
-              }
-              DatabaseManager::getQueryExecutor().commitTransaction();
-            } catch (std::system_error &e) {
-              error = e.what();
-              DatabaseManager::getQueryExecutor().rollbackTransaction();
-            }
+        auto pendingDrafts = DraftCache::instance().takePendingDrafts();
+        taskType write = [=]() {
+          DraftCache::writeDrafts(pendingDrafts);
+          if (createOperationsError.size()) {
+            throw std::runtime_error(createOperationsError);
+          }
+          for (const auto &operation : *draftStoreOpsPtr) {
+            operation->execute();
           }
-
-          this->jsInvoker_->invokeAsync([=]() {
-            if (error.size()) {
-              promise->reject(error);
-            } else {
-              promise->resolve(jsi::Value::undefined());
-            }
-          });
         };
-        GlobalDBSingleton::instance.scheduleOrRunCancellable(
-            job, promise, this->jsInvoker_);
+        GlobalDBSingleton::instance.scheduleOrRunCancellableBatchedWrite(
+            write, promise, this->jsInvoker_);
       });
 }
 
 const std::string REKEY_OPERATION = "rekey";
 const std::string REMOVE_OPERATION = "remove";
 const std::string REPLACE_OPERATION = "replace";
+const std::string REPLACE_IF_CHANGED_OPERATION = "replace_if_changed";
 const std::string REMOVE_MSGS_FOR_THREADS_OPERATION =
     "remove_messages_for_threads";
 const std::string REMOVE_ALL_OPERATION = "remove_all";
@@ -465,9 +1163,116 @@ createMessageStoreOperations(jsi::Runtime &rt, const jsi::Array &operations) {
   return messageStoreOps;
 }
 
+std::vector<std::unique_ptr<MessageStoreOperationBase>>
+createMessageStoreOperations(const folly::dynamic &operations) {
+  std::vector<std::unique_ptr<MessageStoreOperationBase>> messageStoreOps;
+
+  for (const auto &op : operations) {
+    auto op_type = op["type"].getString();
+
+    if (op_type == REMOVE_ALL_OPERATION) {
+      messageStoreOps.push_back(std::make_unique<RemoveAllMessagesOperation>());
+      continue;
+    }
+
+    const auto &payload = op["payload"];
+    if (op_type == REMOVE_OPERATION) {
+      messageStoreOps.push_back(
+          std::make_unique<RemoveMessagesOperation>(payload));
+
+    } else if (op_type == REMOVE_MSGS_FOR_THREADS_OPERATION) {
+      messageStoreOps.push_back(
+          std::make_unique<RemoveMessagesForThreadsOperation>(payload));
+
+    } else if (op_type == REPLACE_OPERATION) {
+      messageStoreOps.push_back(
+          std::make_unique<ReplaceMessageOperation>(payload));
+
+    } else if (op_type == REKEY_OPERATION) {
+      messageStoreOps.push_back(
+          std::make_unique<RekeyMessageOperation>(payload));
+
+    } else {
+      throw std::runtime_error("unsupported operation: " + op_type);
+    }
+  }
+
+  return messageStoreOps;
+}
+
+// Drops operations whose effects are overwritten later in the same batch, so
+// the database only does the net work
+std::vector<std::unique_ptr<MessageStoreOperationBase>>
+coalesceMessageStoreOperations(
+    std::vector<std::unique_ptr<MessageStoreOperationBase>> operations) {
+  // remove_all wipes whatever the operations before it did
+  size_t begin = 0;
+  for (size_t idx = operations.size(); idx-- > 0;) {
+    if (dynamic_cast<RemoveAllMessagesOperation *>(operations[idx].get())) {
+      begin = idx;
+      break;
+    }
+  }
+
+  // Walking backwards, a message ID is settled by the first replace or remove
+  // of it, which makes replaces and removes of that ID before it redundant.
+  // A rekey moves an earlier version of its source ID elsewhere, so the
+  // source ID is no longer settled before it.
+  std::unordered_set<std::string> settledIDs;
+  std::vector<std::unique_ptr<MessageStoreOperationBase>> kept;
+  for (size_t idx = operations.size(); idx-- > begin;) {
+    auto &operation = operations[idx];
+    if (auto replace =
+            dynamic_cast<ReplaceMessageOperation *>(operation.get())) {
+      if (!settledIDs.insert(replace->getMessageID()).second) {
+        continue;
+      }
+    } else if (
+        auto remove =
+            dynamic_cast<RemoveMessagesOperation *>(operation.get())) {
+      std::vector<std::string> ids;
+      for (const std::string &id : remove->getIDs()) {
+        if (settledIDs.insert(id).second) {
+          ids.push_back(id);
+        }
+      }
+      if (ids.empty()) {
+        continue;
+      }
+      operation = std::make_unique<RemoveMessagesOperation>(std::move(ids));
+    } else if (
+        auto rekey = dynamic_cast<RekeyMessageOperation *>(operation.get())) {
+      settledIDs.erase(rekey->getFrom());
+    }
+    kept.push_back(std::move(operation));
+  }
+  std::reverse(kept.begin(), kept.end());
+
+  // IDs of the remaining replaces and removes are now distinct between
+  // rekeys and thread-wide removals, so removes in such a span can be merged
+  // into a single one
+  std::vector<std::unique_ptr<MessageStoreOperationBase>> coalesced;
+  RemoveMessagesOperation *spanRemove = nullptr;
+  for (auto &operation : kept) {
+    if (auto remove =
+            dynamic_cast<RemoveMessagesOperation *>(operation.get())) {
+      if (spanRemove) {
+        spanRemove->addIDs(remove->getIDs());
+        continue;
+      }
+      spanRemove = remove;
+    } else if (!dynamic_cast<ReplaceMessageOperation *>(operation.get())) {
+      spanRemove = nullptr;
+    }
+    coalesced.push_back(std::move(operation));
+  }
+  return coalesced;
+}
+
 jsi::Value CommCoreModule::processMessageStoreOperations(
     jsi::Runtime &rt,
     jsi::Array operations) {
+  const TraceCall traceCall("CommCoreModule.processMessageStoreOperations");
 
   std::string createOperationsError;
   std::shared_ptr<std::vector<std::unique_ptr<MessageStoreOperationBase>>>
@@ -483,42 +1288,30 @@ jsi::Value CommCoreModule::processMessageStoreOperations(
 
   return createPromiseAsJSIValue(
       rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
-        taskType job = [=]() {
-          std::string error = createOperationsError;
-
-          if (!error.size()) {
-            try {
-              DatabaseManager::getQueryExecutor().beginTransaction();
-              for (const auto &operation : *messageStoreOpsPtr) {
-                operation->execute();
-              }
-              DatabaseManager::getQueryExecutor().commitTransaction();
-            } catch (std::system_error &e) {
-              error = e.what();
-              DatabaseManager::getQueryExecutor().rollbackTransaction();
-            }
+        taskType write = [=]() {
+          if (createOperationsError.size()) {
+            throw std::runtime_error(createOperationsError);
+          }
+          auto messageStoreOps =
+              coalesceMessageStoreOperations(std::move(*messageStoreOpsPtr));
+          for (const auto &operation : messageStoreOps) {
+            operation->execute();
           }
-
-          this->jsInvoker_->invokeAsync([=]() {
-            if (error.size()) {
-              promise->reject(error);
-            } else {
-              promise->resolve(jsi::Value::undefined());
-            }
-          });
         };
-        GlobalDBSingleton::instance.scheduleOrRunCancellable(
-            job, promise, this->jsInvoker_);
+        GlobalDBSingleton::instance.scheduleOrRunCancellableBatchedWrite(
+            write, promise, this->jsInvoker_);
       });
 }
 
 void CommCoreModule::processMessageStoreOperationsSync(
     jsi::Runtime &rt,
     jsi::Array operations) {
+  const TraceCall traceCall("CommCoreModule.processMessageStoreOperationsSync");
   std::vector<std::unique_ptr<MessageStoreOperationBase>> messageStoreOps;
 
   try {
-    messageStoreOps = createMessageStoreOperations(rt, operations);
+    messageStoreOps = coalesceMessageStoreOperations(
+        createMessageStoreOperations(rt, operations));
   } catch (const std::exception &e) {
     throw jsi::JSError(rt, e.what());
   }
@@ -537,8 +1330,29 @@ void CommCoreModule::processMessageStoreOperationsSync(
   });
 }
 
+jsi::Value CommCoreModule::processSerializedMessageStoreOperations(
+    jsi::Runtime &rt,
+    jsi::String operations) {
+  const TraceCall traceCall(
+      "CommCoreModule.processSerializedMessageStoreOperations");
+  std::string operationsJSON = operations.utf8(rt);
+  return createPromiseAsJSIValue(
+      rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
+        taskType write = [=]() {
+          auto messageStoreOps = coalesceMessageStoreOperations(
+              createMessageStoreOperations(folly::parseJson(operationsJSON)));
+          for (const auto &operation : messageStoreOps) {
+            operation->execute();
+          }
+        };
+        GlobalDBSingleton::instance.scheduleOrRunCancellableBatchedWrite(
+            write, promise, this->jsInvoker_);
+      });
+}
+
 jsi::Array CommCoreModule::getAllThreadsSync(jsi::Runtime &rt) {
-  auto threadsVector = this->runSyncOrThrowJSError<std::vector<Thread>>(
+  const TraceCall traceCall("CommCoreModule.getAllThreadsSync");
+  auto threadsVector = this->runSyncReadOrThrowJSError<std::vector<Thread>>(
       rt, []() { return DatabaseManager::getQueryExecutor().getAllThreads(); });
 
   auto threadsVectorPtr =
@@ -548,6 +1362,210 @@ jsi::Array CommCoreModule::getAllThreadsSync(jsi::Runtime &rt) {
   return jsiThreads;
 }
 
+jsi::Value CommCoreModule::getThreadsByIDs(jsi::Runtime &rt, jsi::Array ids) {
+  const TraceCall traceCall("CommCoreModule.getThreadsByIDs");
+  std::vector<std::string> threadIDs;
+  for (size_t idx = 0; idx < ids.size(rt); idx++) {
+    threadIDs.push_back(ids.getValueAtIndex(rt, idx).asString(rt).utf8(rt));
+  }
+  return createPromiseAsJSIValue(
+      rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
+        taskType job = [=, &innerRt]() {
+          std::string error;
+          std::vector<Thread> threadsVector;
+          try {
+            threadsVector =
+                DatabaseManager::getQueryExecutor().getThreadsByIDs(threadIDs);
+          } catch (std::system_error &e) {
+            error = e.what();
+          }
+          auto threadsVectorPtr =
+              std::make_shared<std::vector<Thread>>(std::move(threadsVector));
+          this->jsInvoker_->invokeAsync(
+              [&innerRt, threadsVectorPtr, error, promise]() {
+                if (error.size()) {
+                  promise->reject(error);
+                  return;
+                }
+                jsi::Array jsiThreads =
+                    parseDBThreads(innerRt, threadsVectorPtr);
+                promise->resolve(std::move(jsiThreads));
+              });
+        };
+        GlobalDBSingleton::instance.scheduleOrRunCancellableRead(
+            job, promise, this->jsInvoker_);
+      });
+}
+
+jsi::Value
+CommCoreModule::getThreadMembers(jsi::Runtime &rt, jsi::String threadID) {
+  const TraceCall traceCall("CommCoreModule.getThreadMembers");
+  std::string threadIDStr = threadID.utf8(rt);
+  return createPromiseAsJSIValue(
+      rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
+        taskType job = [=, &innerRt]() {
+          std::string error;
+          auto members = std::make_shared<std::vector<ThreadMember>>();
+          try {
+            *members = DatabaseManager::getQueryExecutor().getThreadMembers(
+                threadIDStr);
+          } catch (std::system_error &e) {
+            error = e.what();
+          }
+          this->jsInvoker_->invokeAsync([&innerRt, members, error, promise]() {
+            if (error.size()) {
+              promise->reject(error);
+              return;
+            }
+            jsi::Array jsiMembers = jsi::Array(innerRt, members->size());
+            for (size_t idx = 0; idx < members->size(); idx++) {
+              const ThreadMember &member = (*members)[idx];
+              jsi::Object jsiMember = jsi::Object(innerRt);
+              jsiMember.setProperty(innerRt, "threadID", member.thread_id);
+              jsiMember.setProperty(innerRt, "userID", member.user_id);
+              if (member.role) {
+                jsiMember.setProperty(innerRt, "role", *member.role);
+              } else {
+                jsiMember.setProperty(innerRt, "role", jsi::Value::null());
+              }
+              jsiMember.setProperty(
+                  innerRt, "isSender", member.is_sender != 0);
+              jsiMembers.setValueAtIndex(innerRt, idx, jsiMember);
+            }
+            promise->resolve(std::move(jsiMembers));
+          });
+        };
+        GlobalDBSingleton::instance.scheduleOrRunCancellableRead(
+            job, promise, this->jsInvoker_);
+      });
+}
+
+jsi::Value
+CommCoreModule::getThreadIDsForMember(jsi::Runtime &rt, jsi::String userID) {
+  const TraceCall traceCall("CommCoreModule.getThreadIDsForMember");
+  std::string userIDStr = userID.utf8(rt);
+  return createPromiseAsJSIValue(
+      rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
+        taskType job = [=, &innerRt]() {
+          std::string error;
+          auto threadIDs = std::make_shared<std::vector<std::string>>();
+          try {
+            *threadIDs =
+                DatabaseManager::getQueryExecutor().getThreadIDsForMember(
+                    userIDStr);
+          } catch (std::system_error &e) {
+            error = e.what();
+          }
+          this->jsInvoker_->invokeAsync(
+              [&innerRt, threadIDs, error, promise]() {
+                if (error.size()) {
+                  promise->reject(error);
+                  return;
+                }
+                jsi::Array jsiThreadIDs =
+                    jsi::Array(innerRt, threadIDs->size());
+                for (size_t idx = 0; idx < threadIDs->size(); idx++) {
+                  jsiThreadIDs.setValueAtIndex(
+                      innerRt,
+                      idx,
+                      jsi::String::createFromUtf8(innerRt, (*threadIDs)[idx]));
+                }
+                promise->resolve(std::move(jsiThreadIDs));
+              });
+        };
+        GlobalDBSingleton::instance.scheduleOrRunCancellableRead(
+            job, promise, this->jsInvoker_);
+      });
+}
+
+jsi::Value CommCoreModule::getThreadMemberCounts(
+    jsi::Runtime &rt,
+    jsi::Array threadIDs) {
+  const TraceCall traceCall("CommCoreModule.getThreadMemberCounts");
+  std::vector<std::string> threadIDsVector;
+  for (size_t idx = 0; idx < threadIDs.size(rt); idx++) {
+    threadIDsVector.push_back(
+        threadIDs.getValueAtIndex(rt, idx).asString(rt).utf8(rt));
+  }
+  return createPromiseAsJSIValue(
+      rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
+        taskType job = [=, &innerRt]() {
+          std::string error;
+          auto counts = std::make_shared<std::vector<int>>();
+          try {
+            *counts = DatabaseManager::getQueryExecutor().getThreadMemberCounts(
+                threadIDsVector);
+          } catch (std::system_error &e) {
+            error = e.what();
+          }
+          this->jsInvoker_->invokeAsync([&innerRt, counts, error, promise]() {
+            if (error.size()) {
+              promise->reject(error);
+              return;
+            }
+            jsi::Array jsiCounts = jsi::Array(innerRt, counts->size());
+            for (size_t idx = 0; idx < counts->size(); idx++) {
+              jsiCounts.setValueAtIndex(innerRt, idx, (*counts)[idx]);
+            }
+            promise->resolve(std::move(jsiCounts));
+          });
+        };
+        GlobalDBSingleton::instance.scheduleOrRunCancellableRead(
+            job, promise, this->jsInvoker_);
+      });
+}
+
+jsi::Value CommCoreModule::getThreadSummariesByRecency(jsi::Runtime &rt) {
+  const TraceCall traceCall("CommCoreModule.getThreadSummariesByRecency");
+  return createPromiseAsJSIValue(
+      rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
+        taskType job = [=, &innerRt]() {
+          std::string error;
+          auto summaries = std::make_shared<std::vector<ThreadSummary>>();
+          try {
+            *summaries = DatabaseManager::getQueryExecutor()
+                             .getThreadSummariesByRecency();
+          } catch (std::system_error &e) {
+            error = e.what();
+          }
+          this->jsInvoker_->invokeAsync(
+              [&innerRt, summaries, error, promise]() {
+                if (error.size()) {
+                  promise->reject(error);
+                  return;
+                }
+                jsi::Array jsiSummaries =
+                    jsi::Array(innerRt, summaries->size());
+                for (size_t idx = 0; idx < summaries->size(); idx++) {
+                  const ThreadSummary &summary = (*summaries)[idx];
+                  jsi::Object jsiSummary = jsi::Object(innerRt);
+                  jsiSummary.setProperty(
+                      innerRt, "threadID", summary.thread_id);
+                  jsiSummary.setProperty(
+                      innerRt, "messageCount", summary.message_count);
+                  jsiSummary.setProperty(
+                      innerRt,
+                      "lastMessageID",
+                      summary.last_message_id ? *summary.last_message_id
+                                              : std::string());
+                  jsiSummary.setProperty(
+                      innerRt,
+                      "lastMessageTime",
+                      std::to_string(summary.last_message_time));
+                  jsiSummary.setProperty(
+                      innerRt,
+                      "lastMessageHasMedia",
+                      summary.last_message_has_media != 0);
+                  jsiSummaries.setValueAtIndex(innerRt, idx, jsiSummary);
+                }
+                promise->resolve(std::move(jsiSummaries));
+              });
+        };
+        GlobalDBSingleton::instance.scheduleOrRunCancellableRead(
+            job, promise, this->jsInvoker_);
+      });
+}
+
 std::vector<std::unique_ptr<ThreadStoreOperationBase>>
 createThreadStoreOperations(jsi::Runtime &rt, const jsi::Array &operations) {
   std::vector<std::unique_ptr<ThreadStoreOperationBase>> threadStoreOps;
@@ -569,7 +1587,9 @@ createThreadStoreOperations(jsi::Runtime &rt, const jsi::Array &operations) {
           std::move(threadIDsToRemove)));
     } else if (opType == REMOVE_ALL_OPERATION) {
       threadStoreOps.push_back(std::make_unique<RemoveAllThreadsOperation>());
-    } else if (opType == REPLACE_OPERATION) {
+    } else if (
+        opType == REPLACE_OPERATION ||
+        opType == REPLACE_IF_CHANGED_OPERATION) {
       jsi::Object threadObj = op.getProperty(rt, "payload").asObject(rt);
       std::string threadID =
           threadObj.getProperty(rt, "id").asString(rt).utf8(rt);
@@ -587,8 +1607,8 @@ createThreadStoreOperations(jsi::Runtime &rt, const jsi::Array &operations) {
 
       std::string color =
           threadObj.getProperty(rt, "color").asString(rt).utf8(rt);
-      int64_t creationTime = std::stoll(
-          threadObj.getProperty(rt, "creationTime").asString(rt).utf8(rt));
+      int64_t creationTime =
+          parseJSINumber(rt, threadObj.getProperty(rt, "creationTime"));
 
       jsi::Value maybeParentThreadID =
           threadObj.getProperty(rt, "parentThreadID");
@@ -644,18 +1664,84 @@ createThreadStoreOperations(jsi::Runtime &rt, const jsi::Array &operations) {
           std::move(sourceMessageID),
           repliesCount};
 
-      threadStoreOps.push_back(
-          std::make_unique<ReplaceThreadOperation>(std::move(thread)));
+      if (opType == REPLACE_IF_CHANGED_OPERATION) {
+        threadStoreOps.push_back(
+            std::make_unique<ReplaceThreadIfChangedOperation>(
+                std::move(thread)));
+      } else {
+        threadStoreOps.push_back(
+            std::make_unique<ReplaceThreadOperation>(std::move(thread)));
+      }
+    } else {
+      throw std::runtime_error("unsupported operation: " + opType);
+    }
+  };
+  return threadStoreOps;
+}
+
+std::vector<std::unique_ptr<ThreadStoreOperationBase>>
+createThreadStoreOperations(const folly::dynamic &operations) {
+  std::vector<std::unique_ptr<ThreadStoreOperationBase>> threadStoreOps;
+
+  for (const auto &op : operations) {
+    std::string opType = op["type"].getString();
+
+    if (opType == REMOVE_OPERATION) {
+      std::vector<std::string> threadIDsToRemove;
+      for (const auto &threadID : op["payload"]["ids"]) {
+        threadIDsToRemove.push_back(threadID.getString());
+      }
+      threadStoreOps.push_back(std::make_unique<RemoveThreadsOperation>(
+          std::move(threadIDsToRemove)));
+    } else if (opType == REMOVE_ALL_OPERATION) {
+      threadStoreOps.push_back(std::make_unique<RemoveAllThreadsOperation>());
+    } else if (
+        opType == REPLACE_OPERATION ||
+        opType == REPLACE_IF_CHANGED_OPERATION) {
+      const auto &threadObj = op["payload"];
+      auto optionalString =
+          [&threadObj](const char *key) -> std::unique_ptr<std::string> {
+        const folly::dynamic *value = threadObj.get_ptr(key);
+        return value && value->isString()
+            ? std::make_unique<std::string>(value->getString())
+            : nullptr;
+      };
+
+      Thread thread{
+          threadObj["id"].getString(),
+          static_cast<int>(threadObj["type"].asInt()),
+          optionalString("name"),
+          optionalString("description"),
+          threadObj["color"].getString(),
+          parseJSINumber(threadObj["creationTime"]),
+          optionalString("parentThreadID"),
+          optionalString("containingThreadID"),
+          optionalString("community"),
+          threadObj["members"].getString(),
+          threadObj["roles"].getString(),
+          threadObj["currentUser"].getString(),
+          optionalString("sourceMessageID"),
+          static_cast<int>(threadObj["repliesCount"].asInt())};
+
+      if (opType == REPLACE_IF_CHANGED_OPERATION) {
+        threadStoreOps.push_back(
+            std::make_unique<ReplaceThreadIfChangedOperation>(
+                std::move(thread)));
+      } else {
+        threadStoreOps.push_back(
+            std::make_unique<ReplaceThreadOperation>(std::move(thread)));
+      }
     } else {
       throw std::runtime_error("unsupported operation: " + opType);
     }
-  };
+  }
   return threadStoreOps;
 }
 
 jsi::Value CommCoreModule::processThreadStoreOperations(
     jsi::Runtime &rt,
     jsi::Array operations) {
+  const TraceCall traceCall("CommCoreModule.processThreadStoreOperations");
   std::string operationsError;
   std::shared_ptr<std::vector<std::unique_ptr<ThreadStoreOperationBase>>>
       threadStoreOpsPtr;
@@ -669,36 +1755,23 @@ jsi::Value CommCoreModule::processThreadStoreOperations(
   }
   return createPromiseAsJSIValue(
       rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
-        taskType job = [=]() {
-          std::string error = operationsError;
-          if (!error.size()) {
-            try {
-              DatabaseManager::getQueryExecutor().beginTransaction();
-              for (const auto &operation : *threadStoreOpsPtr) {
-                operation->execute();
-              }
-              DatabaseManager::getQueryExecutor().commitTransaction();
-            } catch (std::system_error &e) {
-              error = e.what();
-              DatabaseManager::getQueryExecutor().rollbackTransaction();
-            }
+        taskType write = [=]() {
+          if (operationsError.size()) {
+            throw std::runtime_error(operationsError);
+          }
+          for (const auto &operation : *threadStoreOpsPtr) {
+            operation->execute();
           }
-          this->jsInvoker_->invokeAsync([=]() {
-            if (error.size()) {
-              promise->reject(error);
-            } else {
-              promise->resolve(jsi::Value::undefined());
-            }
-          });
         };
-        GlobalDBSingleton::instance.scheduleOrRunCancellable(
-            job, promise, this->jsInvoker_);
+        GlobalDBSingleton::instance.scheduleOrRunCancellableBatchedWrite(
+            write, promise, this->jsInvoker_);
       });
 }
 
 void CommCoreModule::processThreadStoreOperationsSync(
     jsi::Runtime &rt,
     jsi::Array operations) {
+  const TraceCall traceCall("CommCoreModule.processThreadStoreOperationsSync");
   std::vector<std::unique_ptr<ThreadStoreOperationBase>> threadStoreOps;
 
   try {
@@ -721,11 +1794,41 @@ void CommCoreModule::processThreadStoreOperationsSync(
   });
 }
 
+jsi::Value CommCoreModule::processSerializedThreadStoreOperations(
+    jsi::Runtime &rt,
+    jsi::String operations) {
+  const TraceCall traceCall(
+      "CommCoreModule.processSerializedThreadStoreOperations");
+  std::string operationsJSON = operations.utf8(rt);
+  return createPromiseAsJSIValue(
+      rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
+        taskType write = [=]() {
+          auto threadStoreOps =
+              createThreadStoreOperations(folly::parseJson(operationsJSON));
+          for (const auto &operation : threadStoreOps) {
+            operation->execute();
+          }
+        };
+        GlobalDBSingleton::instance.scheduleOrRunCancellableBatchedWrite(
+            write, promise, this->jsInvoker_);
+      });
+}
+
 jsi::Value
 CommCoreModule::initializeCryptoAccount(jsi::Runtime &rt, jsi::String userId) {
+  const TraceCall traceCall("CommCoreModule.initializeCryptoAccount");
   std::string userIdStr = userId.utf8(rt);
-  folly::Optional<std::string> storedSecretKey =
-      this->secureStore.get(this->secureStoreAccountDataKey);
+  std::optional<folly::Optional<std::string>> warmedSecretKey;
+  std::optional<crypto::Persist> warmedPersist;
+  {
+    std::lock_guard<std::mutex> lock(this->cryptoWarmUpMutex);
+    this->cryptoWarmUpTaken = true;
+    warmedSecretKey.swap(this->warmedSecretKey);
+    warmedPersist.swap(this->warmedPersist);
+  }
+  folly::Optional<std::string> storedSecretKey = warmedSecretKey.has_value()
+      ? std::move(*warmedSecretKey)
+      : this->secureStore.get(this->secureStoreAccountDataKey);
   if (!storedSecretKey.hasValue()) {
     storedSecretKey = crypto::Tools::generateRandomString(64);
     this->secureStore.set(
@@ -738,31 +1841,23 @@ CommCoreModule::initializeCryptoAccount(jsi::Runtime &rt, jsi::String userId) {
           crypto::Persist persist;
           std::string error;
           try {
-            folly::Optional<std::string> accountData =
-                DatabaseManager::getQueryExecutor().getOlmPersistAccountData();
-            if (accountData.hasValue()) {
-              persist.account =
-                  crypto::OlmBuffer(accountData->begin(), accountData->end());
-              // handle sessions data
-              std::vector<OlmPersistSession> sessionsData =
-                  DatabaseManager::getQueryExecutor()
-                      .getOlmPersistSessionsData();
-              for (OlmPersistSession &sessionsDataItem : sessionsData) {
-                crypto::OlmBuffer sessionDataBuffer(
-                    sessionsDataItem.session_data.begin(),
-                    sessionsDataItem.session_data.end());
-                persist.sessions.insert(std::make_pair(
-                    sessionsDataItem.target_user_id, sessionDataBuffer));
-              }
-            }
+            const StartupTimelinePhase phase(
+                "initializeCryptoAccount: read persist");
+            persist = warmedPersist.has_value() ? *warmedPersist
+                                                : CommCoreModule::readPersist();
           } catch (std::system_error &e) {
             error = e.what();
           }
 
           this->cryptoThread->scheduleTask([=]() {
             std::string error;
-            this->cryptoModule.reset(new crypto::CryptoModule(
-                userIdStr, storedSecretKey.value(), persist));
+            auto restoreStart = std::chrono::steady_clock::now();
+            {
+              auto cryptoModule = std::make_shared<crypto::CryptoModule>(
+                  userIdStr, storedSecretKey.value(), persist);
+              std::lock_guard<std::mutex> lock(this->cryptoModuleMutex);
+              this->cryptoModule = std::move(cryptoModule);
+            }
             if (persist.isEmpty()) {
               crypto::Persist newPersist =
                   this->cryptoModule->storeAsB64(storedSecretKey.value());
@@ -797,6 +1892,11 @@ CommCoreModule::initializeCryptoAccount(jsi::Runtime &rt, jsi::String userId) {
                 promise->resolve(jsi::Value::undefined());
               });
             }
+            StartupTimeline::record(
+                "initializeCryptoAccount: restore",
+                restoreStart,
+                std::chrono::steady_clock::now());
+            this->replenishOneTimeKeys(storedSecretKey.value());
           });
         };
         GlobalDBSingleton::instance.scheduleOrRunCancellable(
@@ -804,27 +1904,50 @@ CommCoreModule::initializeCryptoAccount(jsi::Runtime &rt, jsi::String userId) {
       });
 }
 
+crypto::Persist CommCoreModule::readPersist() {
+  crypto::Persist persist;
+  folly::Optional<std::string> accountData =
+      DatabaseManager::getQueryExecutor().getOlmPersistAccountData();
+  if (!accountData.hasValue()) {
+    return persist;
+  }
+  persist.account = crypto::OlmBuffer(accountData->begin(), accountData->end());
+  // handle sessions data
+  std::vector<OlmPersistSession> sessionsData =
+      DatabaseManager::getQueryExecutor().getOlmPersistSessionsData();
+  for (OlmPersistSession &sessionsDataItem : sessionsData) {
+    crypto::OlmBuffer sessionDataBuffer(
+        sessionsDataItem.session_data.begin(),
+        sessionsDataItem.session_data.end());
+    persist.sessions.insert(
+        std::make_pair(sessionsDataItem.target_user_id, sessionDataBuffer));
+  }
+  return persist;
+}
+
 jsi::Value CommCoreModule::getUserPublicKey(jsi::Runtime &rt) {
+  const TraceCall traceCall("CommCoreModule.getUserPublicKey");
   return createPromiseAsJSIValue(
       rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
         taskType job = [=, &innerRt]() {
           std::string error;
-          std::string result;
+          auto curve25519Key = std::make_shared<crypto::OlmBuffer>();
+          auto ed25519Key = std::make_shared<crypto::OlmBuffer>();
           if (this->cryptoModule == nullptr) {
             error = "user has not been initialized";
           } else {
-            result = this->cryptoModule->getIdentityKeys();
+            this->cryptoModule->getIdentityKeyBuffers(
+                *curve25519Key, *ed25519Key);
           }
           this->jsInvoker_->invokeAsync([=, &innerRt]() {
             if (error.size()) {
               promise->reject(error);
               return;
             }
-            folly::dynamic parsed = folly::parseJson(result);
             auto curve25519{jsi::String::createFromUtf8(
-                innerRt, parsed["curve25519"].asString())};
+                innerRt, curve25519Key->data(), curve25519Key->size())};
             auto ed25519{jsi::String::createFromUtf8(
-                innerRt, parsed["ed25519"].asString())};
+                innerRt, ed25519Key->data(), ed25519Key->size())};
 
             auto jsiClientPublicKeys = jsi::Object(innerRt);
             jsiClientPublicKeys.setProperty(innerRt, "curve25519", curve25519);
@@ -832,11 +1955,14 @@ jsi::Value CommCoreModule::getUserPublicKey(jsi::Runtime &rt) {
             promise->resolve(std::move(jsiClientPublicKeys));
           });
         };
-        this->cryptoThread->scheduleTask(job);
+        this->cryptoThread->scheduleTask(std::move(job));
       });
 }
 
 jsi::Value CommCoreModule::getUserOneTimeKeys(jsi::Runtime &rt) {
+  const TraceCall traceCall("CommCoreModule.getUserOneTimeKeys");
+  folly::Optional<std::string> storedSecretKey =
+      this->secureStore.get(this->secureStoreAccountDataKey);
   return createPromiseAsJSIValue(
       rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
         taskType job = [=, &innerRt]() {
@@ -854,23 +1980,668 @@ jsi::Value CommCoreModule::getUserOneTimeKeys(jsi::Runtime &rt) {
             }
             promise->resolve(jsi::String::createFromUtf8(innerRt, result));
           });
+          if (!error.size() && storedSecretKey.hasValue()) {
+            this->replenishOneTimeKeys(storedSecretKey.value());
+          }
+        };
+        // Keys are generated ahead of time, so only publishing them is left
+        this->cryptoThread->scheduleTask(std::move(job));
+      });
+}
+
+// The JSI of React Native 0.70 can't hand native memory to JS, so the
+// bytes are copied into an ArrayBuffer made by its JS constructor
+jsi::Object
+createArrayBuffer(jsi::Runtime &rt, const std::uint8_t *data, size_t size) {
+  jsi::Function arrayBufferConstructor =
+      rt.global().getPropertyAsFunction(rt, "ArrayBuffer");
+  jsi::Object arrayBuffer =
+      arrayBufferConstructor.callAsConstructor(rt, static_cast<double>(size))
+          .asObject(rt);
+  std::copy(data, data + size, arrayBuffer.getArrayBuffer(rt).data(rt));
+  return arrayBuffer;
+}
+
+crypto::OlmBuffer copyArrayBuffer(
+    jsi::Runtime &rt,
+    const jsi::Object &object,
+    const std::string &argumentName) {
+  if (!object.isArrayBuffer(rt)) {
+    throw jsi::JSError(rt, argumentName + " has to be an ArrayBuffer");
+  }
+  jsi::ArrayBuffer arrayBuffer = object.getArrayBuffer(rt);
+  const std::uint8_t *data = arrayBuffer.data(rt);
+  return crypto::OlmBuffer(data, data + arrayBuffer.size(rt));
+}
+
+jsi::Value CommCoreModule::getUserPublicKeyBuffers(jsi::Runtime &rt) {
+  const TraceCall traceCall("CommCoreModule.getUserPublicKeyBuffers");
+  return createPromiseAsJSIValue(
+      rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
+        taskType job = [=, &innerRt]() {
+          std::string error;
+          auto curve25519 = std::make_shared<crypto::OlmBuffer>();
+          auto ed25519 = std::make_shared<crypto::OlmBuffer>();
+          if (this->cryptoModule == nullptr) {
+            error = "user has not been initialized";
+          } else {
+            this->cryptoModule->getIdentityKeyBuffers(*curve25519, *ed25519);
+          }
+          this->jsInvoker_->invokeAsync([=, &innerRt]() {
+            if (error.size()) {
+              promise->reject(error);
+              return;
+            }
+            auto jsiClientPublicKeys = jsi::Object(innerRt);
+            jsiClientPublicKeys.setProperty(
+                innerRt,
+                "curve25519",
+                createArrayBuffer(
+                    innerRt, curve25519->data(), curve25519->size()));
+            jsiClientPublicKeys.setProperty(
+                innerRt,
+                "ed25519",
+                createArrayBuffer(innerRt, ed25519->data(), ed25519->size()));
+            promise->resolve(std::move(jsiClientPublicKeys));
+          });
+        };
+        this->cryptoThread->scheduleTask(std::move(job));
+      });
+}
+
+jsi::Value CommCoreModule::getUserOneTimeKeyBuffers(jsi::Runtime &rt) {
+  const TraceCall traceCall("CommCoreModule.getUserOneTimeKeyBuffers");
+  folly::Optional<std::string> storedSecretKey =
+      this->secureStore.get(this->secureStoreAccountDataKey);
+  return createPromiseAsJSIValue(
+      rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
+        taskType job = [=, &innerRt]() {
+          std::string error;
+          auto keys = std::make_shared<std::vector<crypto::OlmBuffer>>();
+          if (this->cryptoModule == nullptr) {
+            error = "user has not been initialized";
+          } else {
+            try {
+              *keys = this->cryptoModule->getOneTimeKeyBuffers();
+            } catch (std::runtime_error &e) {
+              error = e.what();
+            }
+          }
+          this->jsInvoker_->invokeAsync([=, &innerRt]() {
+            if (error.size()) {
+              promise->reject(error);
+              return;
+            }
+            jsi::Array jsiKeys = jsi::Array(innerRt, keys->size());
+            for (size_t idx = 0; idx < keys->size(); idx++) {
+              const crypto::OlmBuffer &key = (*keys)[idx];
+              jsiKeys.setValueAtIndex(
+                  innerRt,
+                  idx,
+                  createArrayBuffer(innerRt, key.data(), key.size()));
+            }
+            promise->resolve(std::move(jsiKeys));
+          });
+          if (!error.size() && storedSecretKey.hasValue()) {
+            this->replenishOneTimeKeys(storedSecretKey.value());
+          }
+        };
+        this->cryptoThread->scheduleTask(std::move(job));
+      });
+}
+
+jsi::Value CommCoreModule::encryptBuffer(
+    jsi::Runtime &rt,
+    jsi::String userID,
+    jsi::Object content) {
+  const TraceCall traceCall("CommCoreModule.encryptBuffer");
+  folly::Optional<std::string> storedSecretKey =
+      this->secureStore.get(this->secureStoreAccountDataKey);
+  std::string userIDStr = userID.utf8(rt);
+  auto contentBuffer = std::make_shared<crypto::OlmBuffer>(
+      copyArrayBuffer(rt, content, "content"));
+  return createPromiseAsJSIValue(
+      rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
+        taskType job = [=, &innerRt]() {
+          std::string error;
+          auto encryptedData = std::make_shared<crypto::EncryptedData>();
+          auto persist = std::make_shared<crypto::Persist>();
+          std::shared_ptr<crypto::CryptoModule> cryptoModule =
+              this->getCryptoModule();
+          std::unique_lock<std::mutex> persistLock(
+              this->cryptoPersistMutex, std::defer_lock);
+          if (cryptoModule == nullptr || !storedSecretKey.hasValue()) {
+            error = "user has not been initialized";
+          } else {
+            try {
+              cryptoModule->encrypt(
+                  userIDStr,
+                  contentBuffer->data(),
+                  contentBuffer->size(),
+                  *encryptedData);
+              persistLock.lock();
+              *persist = cryptoModule->storeChangedAsB64(
+                  storedSecretKey.value());
+            } catch (std::runtime_error &e) {
+              error = e.what();
+            }
+          }
+          this->resolveOncePersisted(persist, error, promise, [=, &innerRt]() {
+            auto jsiEncrypted = jsi::Object(innerRt);
+            jsiEncrypted.setProperty(
+                innerRt,
+                "message",
+                createArrayBuffer(
+                    innerRt,
+                    encryptedData->message.data(),
+                    encryptedData->message.size()));
+            jsiEncrypted.setProperty(
+                innerRt,
+                "messageType",
+                static_cast<double>(encryptedData->messageType));
+            return jsi::Value(std::move(jsiEncrypted));
+          });
+        };
+        this->cryptoSessionThreads->scheduleTask(userIDStr, std::move(job));
+      });
+}
+
+jsi::Value CommCoreModule::decryptBuffer(
+    jsi::Runtime &rt,
+    jsi::String userID,
+    jsi::Object message,
+    double messageType,
+    jsi::Object theirIdentityKeys) {
+  const TraceCall traceCall("CommCoreModule.decryptBuffer");
+  folly::Optional<std::string> storedSecretKey =
+      this->secureStore.get(this->secureStoreAccountDataKey);
+  std::string userIDStr = userID.utf8(rt);
+  // decrypt consumes the message, so it gets a copy of its own
+  auto messageBuffer = std::make_shared<crypto::OlmBuffer>(
+      copyArrayBuffer(rt, message, "message"));
+  auto identityKeysBuffer = std::make_shared<crypto::OlmBuffer>(
+      copyArrayBuffer(rt, theirIdentityKeys, "theirIdentityKeys"));
+  return createPromiseAsJSIValue(
+      rt, [=](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
+        taskType job = [=, &innerRt]() {
+          std::string error;
+          auto decrypted = std::make_shared<std::string>();
+          auto persist = std::make_shared<crypto::Persist>();
+          std::shared_ptr<crypto::CryptoModule> cryptoModule =
+              this->getCryptoModule();
+          std::unique_lock<std::mutex> persistLock(
+              this->cryptoPersistMutex, std::defer_lock);
+          if (cryptoModule == nullptr || !storedSecretKey.hasValue()) {
+            error = "user has not been initialized";
+          } else {
+            try {
+              cryptoModule->decrypt(
+                  userIDStr,
+                  static_cast<size_t>(messageType),
+                  messageBuffer->data(),
+                  messageBuffer->size(),
+                  *identityKeysBuffer,
+                  *decrypted);
+              persistLock.lock();
+              *persist = cryptoModule->storeChangedAsB64(
+                  storedSecretKey.value());
+            } catch (std::runtime_error &e) {
+              error = e.what();
+            }
+          }
+          this->resolveOncePersisted(persist, error, promise, [=, &innerRt]() {
+            return jsi::Value(createArrayBuffer(
+                innerRt,
+                reinterpret_cast<const std::uint8_t *>(decrypted->data()),
+                decrypted->size()));
+          });
         };
-        this->cryptoThread->scheduleTask(job);
+        this->cryptoSessionThreads->scheduleTask(userIDStr, std::move(job));
       });
 }
 
+std::shared_ptr<crypto::CryptoModule> CommCoreModule::getCryptoModule() {
+  std::lock_guard<std::mutex> lock(this->cryptoModuleMutex);
+  return this->cryptoModule;
+}
+
+void CommCoreModule::resolveOncePersisted(
+    std::shared_ptr<crypto::Persist> persist,
+    const std::string &error,
+    std::shared_ptr<Promise> promise,
+    std::function<jsi::Value()> result) {
+  if (error.size()) {
+    this->jsInvoker_->invokeAsync([=]() { promise->reject(error); });
+    return;
+  }
+  GlobalDBSingleton::instance.scheduleOrRunCancellable(
+      [=]() {
+        std::string storeError;
+        if (!persist->account.empty() || !persist->sessions.empty()) {
+          try {
+            DatabaseManager::getQueryExecutor().storeOlmPersistData(*persist);
+          } catch (std::system_error &e) {
+            storeError = e.what();
+            this->markUnstored(persist);
+          }
+        }
+        this->jsInvoker_->invokeAsync([=]() {
+          if (storeError.size()) {
+            promise->reject(storeError);
+            return;
+          }
+          promise->resolve(result());
+        });
+      },
+      promise,
+      this->jsInvoker_);
+}
+
+void CommCoreModule::replenishOneTimeKeys(const std::string &secretKey) {
+  taskType job = [=]() {
+    if (this->cryptoModule == nullptr) {
+      return;
+    }
+    crypto::Persist persist;
+    std::unique_lock<std::mutex> persistLock(
+        this->cryptoPersistMutex, std::defer_lock);
+    try {
+      this->cryptoModule->pregenerateOneTimeKeys();
+      persistLock.lock();
+      persist = this->cryptoModule->storeChangedAsB64(secretKey);
+    } catch (std::runtime_error &e) {
+      Logger::log(
+          "Failed to replenish one-time keys: " + std::string(e.what()));
+      return;
+    }
+    if (persist.account.empty() && persist.sessions.empty()) {
+      return;
+    }
+    GlobalDBSingleton::instance.scheduleOrRun([=]() {
+      try {
+        DatabaseManager::getQueryExecutor().storeOlmPersistData(persist);
+      } catch (std::system_error &e) {
+        Logger::log(
+            "Failed to persist one-time keys: " + std::string(e.what()));
+        this->markUnstored(std::make_shared<crypto::Persist>(persist));
+      }
+    });
+  };
+  this->cryptoThread->scheduleTask(std::move(job), TaskPriority::Background);
+}
+
+void CommCoreModule::markUnstored(std::shared_ptr<crypto::Persist> persist) {
+  if (persist->account.empty() && persist->sessions.empty()) {
+    return;
+  }
+  try {
+    this->cryptoThread->scheduleTask([=]() {
+      if (this->cryptoModule != nullptr) {
+        this->cryptoModule->markUnstored(*persist);
+      }
+    });
+  } catch (const std::exception &e) {
+    Logger::log(
+        "Failed to mark crypto state as unstored: " + std::string(e.what()));
+  }
+}
+
+// Sessions of different peers are independent, a few threads are enough
+// for them to stop waiting on each other
+const size_t CRYPTO_SESSION_THREADS_COUNT{4};
+
 CommCoreModule::CommCoreModule(
     std::shared_ptr<facebook::react::CallInvoker> jsInvoker)
-    : facebook::react::CommCoreModuleSchemaCxxSpecJSI(jsInvoker),
-      cryptoThread(std::make_unique<WorkerThread>("crypto")) {
+    : facebook::react::CommCoreModuleSchemaCxxSpecJSI(
+          std::make_shared<TraceCallInvoker>(
+              std::make_shared<BatchingCallInvoker>(jsInvoker))),
+      cryptoThread(std::make_unique<WorkerThread>(
+          "crypto",
+          OverflowPolicy::Spill,
+          ThreadAttachment::Lifetime,
+          AllocationTag::Crypto,
+          ThreadQoS::UserInitiated)),
+      cryptoSessionThreads(std::make_unique<ShardedWorkerThread>(
+          "crypto-session",
+          CRYPTO_SESSION_THREADS_COUNT,
+          ThreadAttachment::Lifetime,
+          AllocationTag::Crypto,
+          ThreadQoS::UserInitiated)) {
   GlobalDBSingleton::instance.enableMultithreading();
+  this->memoryPressureHandlerID = MemoryPressure::addHandler([this]() {
+    this->cryptoThread->scheduleTask(
+        [this]() {
+          if (this->cryptoModule != nullptr) {
+            this->cryptoModule->releaseSessions();
+          }
+        },
+        TaskPriority::Interactive);
+  });
+}
+
+CommCoreModule::~CommCoreModule() {
+  MemoryPressure::removeHandler(this->memoryPressureHandlerID);
+}
+
+void CommCoreModule::warmUp() {
+  GlobalDBSingleton::instance.warmUp();
+  try {
+    // Runs after the warm-up of the writer connection, once the migrations
+    // have been checked
+    GlobalDBSingleton::instance.scheduleOrRun([this]() {
+      crypto::Persist persist;
+      try {
+        persist = CommCoreModule::readPersist();
+      } catch (const std::exception &e) {
+        Logger::log(
+            "Failed to warm up crypto account: " + std::string(e.what()));
+        return;
+      }
+      std::lock_guard<std::mutex> lock(this->cryptoWarmUpMutex);
+      if (!this->cryptoWarmUpTaken) {
+        this->warmedPersist = std::move(persist);
+      }
+    });
+    this->cryptoThread->scheduleTask([this]() {
+      folly::Optional<std::string> secretKey;
+      try {
+        secretKey = this->secureStore.get(this->secureStoreAccountDataKey);
+      } catch (const std::exception &e) {
+        Logger::log(
+            "Failed to warm up account secret: " + std::string(e.what()));
+        return;
+      }
+      std::lock_guard<std::mutex> lock(this->cryptoWarmUpMutex);
+      if (!this->cryptoWarmUpTaken) {
+        this->warmedSecretKey = std::move(secretKey);
+      }
+    });
+  } catch (const std::exception &e) {
+    Logger::log("Crypto warm-up not scheduled: " + std::string(e.what()));
+  }
 }
 
 double CommCoreModule::getCodeVersion(jsi::Runtime &rt) {
+  const TraceCall traceCall("CommCoreModule.getCodeVersion");
   return this->codeVersion;
 }
 
+jsi::Array CommCoreModule::getDatabaseQueryProfile(jsi::Runtime &rt) {
+  const TraceCall traceCall("CommCoreModule.getDatabaseQueryProfile");
+  std::vector<QueryProfile> profiles = QueryProfiler::getSnapshot();
+  jsi::Array jsiProfiles = jsi::Array(rt, profiles.size());
+  size_t writeIdx = 0;
+  for (const QueryProfile &profile : profiles) {
+    jsi::Array jsiHistogram = jsi::Array(rt, profile.histogram.size());
+    for (size_t bucketIdx = 0; bucketIdx < profile.histogram.size();
+         bucketIdx++) {
+      jsiHistogram.setValueAtIndex(
+          rt, bucketIdx, static_cast<double>(profile.histogram[bucketIdx]));
+    }
+
+    jsi::Object jsiProfile = jsi::Object(rt);
+    jsiProfile.setProperty(rt, "query", profile.query);
+    jsiProfile.setProperty(rt, "count", static_cast<double>(profile.count));
+    jsiProfile.setProperty(
+        rt, "slowCount", static_cast<double>(profile.slowCount));
+    jsiProfile.setProperty(
+        rt, "totalDurationMs", profile.totalDurationUs / 1000.0);
+    jsiProfile.setProperty(rt, "maxDurationMs", profile.maxDurationUs / 1000.0);
+    jsiProfile.setProperty(rt, "rows", static_cast<double>(profile.rows));
+    jsiProfile.setProperty(rt, "histogram", jsiHistogram);
+    jsiProfiles.setValueAtIndex(rt, writeIdx++, jsiProfile);
+  }
+  return jsiProfiles;
+}
+
+jsi::Array CommCoreModule::getWorkerThreadsStats(jsi::Runtime &rt) {
+  const TraceCall traceCall("CommCoreModule.getWorkerThreadsStats");
+  std::vector<WorkerThreadStats> allThreadsStats =
+      GlobalDBSingleton::instance.getThreadsStats();
+  allThreadsStats.push_back(this->cryptoThread->getStats());
+  for (WorkerThreadStats &stats : this->cryptoSessionThreads->getStats()) {
+    allThreadsStats.push_back(std::move(stats));
+  }
+
+  // The stats are reported per name, which adds up the database readers
+  std::vector<WorkerThreadStats> threadsStats;
+  std::vector<size_t> threadsCounts;
+  for (const WorkerThreadStats &stats : allThreadsStats) {
+    auto it = std::find_if(
+        threadsStats.begin(),
+        threadsStats.end(),
+        [&stats](const WorkerThreadStats &namedStats) {
+          return namedStats.name == stats.name;
+        });
+    if (it == threadsStats.end()) {
+      threadsStats.push_back(stats);
+      threadsCounts.push_back(1);
+      continue;
+    }
+    mergeWorkerThreadStats(*it, stats);
+    threadsCounts[it - threadsStats.begin()]++;
+  }
+
+  jsi::Array jsiThreadsStats = jsi::Array(rt, threadsStats.size());
+  size_t writeIdx = 0;
+  for (const WorkerThreadStats &stats : threadsStats) {
+    jsi::Object jsiStats = jsi::Object(rt);
+    jsiStats.setProperty(rt, "name", stats.name);
+    jsiStats.setProperty(
+        rt, "threads", static_cast<double>(threadsCounts[writeIdx]));
+    jsiStats.setProperty(
+        rt, "queueDepth", static_cast<double>(stats.queueDepth));
+    jsiStats.setProperty(
+        rt, "maxQueueDepth", static_cast<double>(stats.maxQueueDepth));
+    jsiStats.setProperty(
+        rt, "scheduledTasks", static_cast<double>(stats.scheduledTasks));
+    jsiStats.setProperty(
+        rt, "overflowedTasks", static_cast<double>(stats.overflowedTasks));
+    jsiStats.setProperty(
+        rt, "rejectedTasks", static_cast<double>(stats.rejectedTasks));
+    jsiStats.setProperty(
+        rt, "completedTasks", static_cast<double>(stats.completedTasks));
+    jsiStats.setProperty(rt, "totalWaitMs", stats.totalWaitUs / 1000.0);
+    jsiStats.setProperty(rt, "maxWaitMs", stats.maxWaitUs / 1000.0);
+    jsiStats.setProperty(rt, "totalRunMs", stats.totalRunUs / 1000.0);
+    jsiStats.setProperty(rt, "maxRunMs", stats.maxRunUs / 1000.0);
+    jsiThreadsStats.setValueAtIndex(rt, writeIdx++, jsiStats);
+  }
+  return jsiThreadsStats;
+}
+
+jsi::Value CommCoreModule::getDatabaseStartupMetrics(jsi::Runtime &rt) {
+  const TraceCall traceCall("CommCoreModule.getDatabaseStartupMetrics");
+  return createPromiseAsJSIValue(
+      rt, [this](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
+        taskType job = [this, &innerRt, promise]() {
+          std::string error;
+          DatabaseStartupMetrics metrics{};
+          try {
+            metrics = DatabaseManager::getQueryExecutor().getStartupMetrics();
+          } catch (std::system_error &e) {
+            error = e.what();
+          }
+          this->jsInvoker_->invokeAsync([&innerRt, metrics, error, promise]() {
+            if (error.size()) {
+              promise->reject(error);
+              return;
+            }
+            jsi::Object jsiMetrics = jsi::Object(innerRt);
+            jsiMetrics.setProperty(
+                innerRt, "durationMs", metrics.durationUs / 1000.0);
+            jsiMetrics.setProperty(
+                innerRt,
+                "migrationsDurationMs",
+                metrics.migrationsDurationUs / 1000.0);
+            jsiMetrics.setProperty(
+                innerRt, "databaseVersion", metrics.databaseVersion);
+            jsiMetrics.setProperty(
+                innerRt, "appliedMigrations", metrics.appliedMigrations);
+            jsiMetrics.setProperty(innerRt, "upToDate", metrics.upToDate);
+            jsiMetrics.setProperty(
+                innerRt,
+                "encryptionDurationMs",
+                metrics.encryptionDurationUs / 1000.0);
+            jsiMetrics.setProperty(
+                innerRt,
+                "encryptedRows",
+                static_cast<double>(metrics.encryptedRows));
+            promise->resolve(std::move(jsiMetrics));
+          });
+        };
+        GlobalDBSingleton::instance.scheduleOrRunCancellable(
+            job, promise, this->jsInvoker_);
+      });
+}
+
+jsi::Array CommCoreModule::getStartupTimeline(jsi::Runtime &rt) {
+  const TraceCall traceCall("CommCoreModule.getStartupTimeline");
+  std::vector<StartupPhase> phases = StartupTimeline::take();
+  jsi::Array jsiPhases = jsi::Array(rt, phases.size());
+  for (size_t i = 0; i < phases.size(); i++) {
+    jsi::Object jsiPhase = jsi::Object(rt);
+    jsiPhase.setProperty(
+        rt, "name", jsi::String::createFromUtf8(rt, phases[i].name));
+    jsiPhase.setProperty(rt, "startMs", phases[i].startUs / 1000.0);
+    jsiPhase.setProperty(rt, "durationMs", phases[i].durationUs / 1000.0);
+    jsiPhases.setValueAtIndex(rt, i, jsiPhase);
+  }
+  return jsiPhases;
+}
+
+jsi::Array CommCoreModule::getAllocationSnapshot(jsi::Runtime &rt) {
+  const TraceCall traceCall("CommCoreModule.getAllocationSnapshot");
+  std::vector<AllocationStats> snapshot = AllocationTracker::snapshot();
+  jsi::Array jsiSnapshot = jsi::Array(rt, snapshot.size());
+  for (size_t i = 0; i < snapshot.size(); i++) {
+    jsi::Object jsiStats = jsi::Object(rt);
+    jsiStats.setProperty(
+        rt, "tag", jsi::String::createFromUtf8(rt, snapshot[i].tag));
+    jsiStats.setProperty(rt, "count", static_cast<double>(snapshot[i].count));
+    jsiStats.setProperty(rt, "bytes", static_cast<double>(snapshot[i].bytes));
+    jsiSnapshot.setValueAtIndex(rt, i, jsiStats);
+  }
+  return jsiSnapshot;
+}
+
+jsi::Value CommCoreModule::getDatabaseMemoryStats(jsi::Runtime &rt) {
+  const TraceCall traceCall("CommCoreModule.getDatabaseMemoryStats");
+  return createPromiseAsJSIValue(
+      rt, [this](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
+        taskType job = [this, &innerRt, promise]() {
+          std::string error;
+          DatabaseMemoryStats stats{};
+          try {
+            stats = DatabaseManager::getQueryExecutor().getMemoryStats();
+          } catch (std::system_error &e) {
+            error = e.what();
+          }
+          this->jsInvoker_->invokeAsync([&innerRt, stats, error, promise]() {
+            if (error.size()) {
+              promise->reject(error);
+              return;
+            }
+            jsi::Object jsiStats = jsi::Object(innerRt);
+            jsiStats.setProperty(
+                innerRt, "memoryUsed", static_cast<double>(stats.memoryUsed));
+            jsiStats.setProperty(
+                innerRt,
+                "memoryHighwater",
+                static_cast<double>(stats.memoryHighwater));
+            jsiStats.setProperty(
+                innerRt,
+                "largestAllocation",
+                static_cast<double>(stats.largestAllocation));
+            jsiStats.setProperty(
+                innerRt,
+                "pageCacheOverflow",
+                static_cast<double>(stats.pageCacheOverflow));
+            jsiStats.setProperty(
+                innerRt,
+                "connectionCacheUsed",
+                static_cast<double>(stats.connectionCacheUsed));
+            jsiStats.setProperty(
+                innerRt,
+                "connectionSchemaUsed",
+                static_cast<double>(stats.connectionSchemaUsed));
+            jsiStats.setProperty(
+                innerRt,
+                "connectionStatementsUsed",
+                static_cast<double>(stats.connectionStatementsUsed));
+            jsiStats.setProperty(
+                innerRt,
+                "cachedStatements",
+                static_cast<double>(stats.cachedStatements));
+            jsiStats.setProperty(
+                innerRt,
+                "messageCacheSize",
+                static_cast<double>(stats.messageCacheSize));
+            promise->resolve(std::move(jsiStats));
+          });
+        };
+        GlobalDBSingleton::instance.scheduleOrRunCancellable(
+            job, promise, this->jsInvoker_);
+      });
+}
+
+jsi::Value CommCoreModule::getDatabaseChanges(jsi::Runtime &rt) {
+  const TraceCall traceCall("CommCoreModule.getDatabaseChanges");
+  return createPromiseAsJSIValue(
+      rt, [this](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
+        taskType job = [this, &innerRt, promise]() {
+          std::string error;
+          auto changes = std::make_shared<DatabaseChanges>();
+          try {
+            *changes = DatabaseManager::getQueryExecutor().getDatabaseChanges();
+          } catch (std::system_error &e) {
+            error = e.what();
+          }
+          this->jsInvoker_->invokeAsync([&innerRt, changes, error, promise]() {
+            if (error.size()) {
+              promise->reject(error);
+              return;
+            }
+            auto parseIDs = [&innerRt](const std::vector<std::string> &ids) {
+              jsi::Array jsiIDs = jsi::Array(innerRt, ids.size());
+              for (size_t idx = 0; idx < ids.size(); idx++) {
+                jsiIDs.setValueAtIndex(
+                    innerRt,
+                    idx,
+                    jsi::String::createFromUtf8(innerRt, ids[idx]));
+              }
+              return jsiIDs;
+            };
+            auto messages = std::make_shared<
+                std::vector<std::pair<Message, std::vector<Media>>>>(
+                std::move(changes->messages));
+            auto threads = std::make_shared<std::vector<Thread>>(
+                std::move(changes->threads));
+            jsi::Object jsiChanges = jsi::Object(innerRt);
+            jsiChanges.setProperty(
+                innerRt, "reloadRequired", changes->reloadRequired);
+            jsiChanges.setProperty(
+                innerRt, "messages", parseDBMessages(innerRt, messages));
+            jsiChanges.setProperty(
+                innerRt,
+                "removedMessageIDs",
+                parseIDs(changes->removedMessageIDs));
+            jsiChanges.setProperty(
+                innerRt, "threads", parseDBThreads(innerRt, threads));
+            jsiChanges.setProperty(
+                innerRt,
+                "removedThreadIDs",
+                parseIDs(changes->removedThreadIDs));
+            promise->resolve(std::move(jsiChanges));
+          });
+        };
+        GlobalDBSingleton::instance.scheduleOrRunCancellableRead(
+            job, promise, this->jsInvoker_);
+      });
+}
+
 jsi::Value CommCoreModule::setNotifyToken(jsi::Runtime &rt, jsi::String token) {
+  const TraceCall traceCall("CommCoreModule.setNotifyToken");
   auto notifyToken{token.utf8(rt)};
   return createPromiseAsJSIValue(
       rt,
@@ -898,6 +2669,7 @@ jsi::Value CommCoreModule::setNotifyToken(jsi::Runtime &rt, jsi::String token) {
 }
 
 jsi::Value CommCoreModule::clearNotifyToken(jsi::Runtime &rt) {
+  const TraceCall traceCall("CommCoreModule.clearNotifyToken");
   return createPromiseAsJSIValue(
       rt, [this](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
         taskType job = [this, promise]() {
@@ -922,6 +2694,7 @@ jsi::Value CommCoreModule::clearNotifyToken(jsi::Runtime &rt) {
 
 jsi::Value
 CommCoreModule::setCurrentUserID(jsi::Runtime &rt, jsi::String userID) {
+  const TraceCall traceCall("CommCoreModule.setCurrentUserID");
   auto currentUserID{userID.utf8(rt)};
   return createPromiseAsJSIValue(
       rt,
@@ -948,6 +2721,7 @@ CommCoreModule::setCurrentUserID(jsi::Runtime &rt, jsi::String userID) {
 }
 
 jsi::Value CommCoreModule::getCurrentUserID(jsi::Runtime &rt) {
+  const TraceCall traceCall("CommCoreModule.getCurrentUserID");
   return createPromiseAsJSIValue(
       rt, [this](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
         taskType job = [this, &innerRt, promise]() {
@@ -966,13 +2740,14 @@ jsi::Value CommCoreModule::getCurrentUserID(jsi::Runtime &rt) {
             }
           });
         };
-        GlobalDBSingleton::instance.scheduleOrRunCancellable(
+        GlobalDBSingleton::instance.scheduleOrRunCancellableRead(
             job, promise, this->jsInvoker_);
       });
 }
 
 jsi::Value
 CommCoreModule::setDeviceID(jsi::Runtime &rt, jsi::String deviceType) {
+  const TraceCall traceCall("CommCoreModule.setDeviceID");
   std::string type = deviceType.utf8(rt);
   std::string deviceID;
   std::string deviceIDGenerationError;
@@ -1014,6 +2789,7 @@ CommCoreModule::setDeviceID(jsi::Runtime &rt, jsi::String deviceType) {
 }
 
 jsi::Value CommCoreModule::getDeviceID(jsi::Runtime &rt) {
+  const TraceCall traceCall("CommCoreModule.getDeviceID");
   return createPromiseAsJSIValue(
       rt, [this](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
         taskType job = [this, &innerRt, promise]() {
@@ -1032,15 +2808,23 @@ jsi::Value CommCoreModule::getDeviceID(jsi::Runtime &rt) {
             }
           });
         };
-        GlobalDBSingleton::instance.scheduleOrRunCancellable(
+        GlobalDBSingleton::instance.scheduleOrRunCancellableRead(
             job, promise, this->jsInvoker_);
       });
 }
 
 jsi::Value CommCoreModule::clearSensitiveData(jsi::Runtime &rt) {
+  const TraceCall traceCall("CommCoreModule.clearSensitiveData");
   return createPromiseAsJSIValue(
       rt, [this](jsi::Runtime &innerRt, std::shared_ptr<Promise> promise) {
         GlobalDBSingleton::instance.setTasksCancelled(true);
+        DraftCache::instance().takePendingDrafts();
+        {
+          std::lock_guard<std::mutex> lock(this->cryptoWarmUpMutex);
+          this->cryptoWarmUpTaken = true;
+          this->warmedSecretKey.reset();
+          this->warmedPersist.reset();
+        }
         taskType job = [this, promise]() {
           std::string error;
           try {
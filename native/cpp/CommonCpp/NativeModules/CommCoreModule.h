@@ -1,12 +1,19 @@
 #pragma once
 
 #include "../CryptoTools/CryptoModule.h"
+#include "../Tools/CancellationToken.h"
 #include "../Tools/CommSecureStore.h"
+#include "../Tools/ShardedWorkerThread.h"
 #include "../Tools/WorkerThread.h"
 #include "../_generated/commJSI.h"
+#include "JSIProtocol.h"
 #include <ReactCommon/TurboModuleUtils.h>
 #include <jsi/jsi.h>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
 
 namespace comm {
 
@@ -14,22 +21,141 @@ namespace jsi = facebook::jsi;
 
 class CommCoreModule : public facebook::react::CommCoreModuleSchemaCxxSpecJSI {
   const int codeVersion{177};
+  // Work on the account, like generating one-time keys, runs in order here
   std::unique_ptr<WorkerThread> cryptoThread;
+  // Work on the olm session of a single peer, keyed by its ID, so that
+  // sessions of different peers don't wait on each other
+  std::unique_ptr<ShardedWorkerThread> cryptoSessionThreads;
 
   CommSecureStore secureStore;
   const std::string secureStoreAccountDataKey = "cryptoAccountDataKey";
-  std::unique_ptr<crypto::CryptoModule> cryptoModule;
+  // Only replaced on cryptoThread, under cryptoModuleMutex, so that
+  // cryptoSessionThreads can take it with getCryptoModule
+  std::shared_ptr<crypto::CryptoModule> cryptoModule;
+  std::mutex cryptoModuleMutex;
+  // Held from taking a Persist until its write is scheduled, so that the
+  // writes of a session run in the order its pickles were taken, and work
+  // whose changes went out with an earlier Persist resolves after it
+  std::mutex cryptoPersistMutex;
+  // Releases the sessions of cryptoModule on memory warnings, see
+  // MemoryPressure
+  size_t memoryPressureHandlerID;
+  // Fetched by warmUp for the first initializeCryptoAccount. Once it has
+  // run, or the data is cleared, late results are dropped.
+  std::mutex cryptoWarmUpMutex;
+  bool cryptoWarmUpTaken{false};
+  std::optional<folly::Optional<std::string>> warmedSecretKey;
+  std::optional<crypto::Persist> warmedPersist;
+
+  // Tokens of the requests still running, by the request ID that JS passed.
+  // Requests that share an ID share a token, and are all cancelled by
+  // cancelDBRequest. A token is only held by the tasks of its requests.
+  std::mutex cancellationTokensMutex;
+  std::unordered_map<int64_t, std::weak_ptr<CancellationToken>>
+      cancellationTokens;
+
+  // Returns nullptr if the request has no ID
+  std::shared_ptr<CancellationToken>
+  getCancellationToken(std::optional<double> requestID);
+
+  // Reads the account and its sessions, leaving them empty if none is
+  // stored. Runs on the database thread.
+  static crypto::Persist readPersist();
+
+  // Generates the next batch of one-time keys in the background, and
+  // persists the account along with the keys published since last time
+  void replenishOneTimeKeys(const std::string &secretKey);
+  std::shared_ptr<crypto::CryptoModule> getCryptoModule();
+  // Resolves crypto work once the account and the sessions it changed are
+  // stored, so that JS never gets a message whose ratchet a restart would
+  // lose. Rejects with the error of the work instead, if it has one.
+  void resolveOncePersisted(
+      std::shared_ptr<crypto::Persist> persist,
+      const std::string &error,
+      std::shared_ptr<facebook::react::Promise> promise,
+      std::function<jsi::Value()> result);
+  // Called when a Persist taken by storeChangedAsB64 fails to be written, so
+  // that what it holds is stored along with the next one
+  void markUnstored(std::shared_ptr<crypto::Persist> persist);
 
   template <class T>
   T runSyncOrThrowJSError(jsi::Runtime &rt, std::function<T()> task);
+  template <class T>
+  T runSyncReadOrThrowJSError(jsi::Runtime &rt, std::function<T()> task);
+  jsi::Value getClientDBStoreImpl(
+      jsi::Runtime &rt,
+      bool threadSummaries,
+      bool rowViews = false,
+      JSIProtocol protocol = JSIProtocol::strings,
+      std::shared_ptr<CancellationToken> cancellationToken = nullptr);
+  jsi::Value streamClientDBStoreImpl(
+      jsi::Runtime &rt,
+      jsi::Function onChunk,
+      double requestedChunkSize,
+      bool messagesOnly);
   virtual jsi::Value getDraft(jsi::Runtime &rt, jsi::String key) override;
   virtual jsi::Value
   updateDraft(jsi::Runtime &rt, jsi::String key, jsi::String text) override;
   virtual jsi::Value
   moveDraft(jsi::Runtime &rt, jsi::String oldKey, jsi::String newKey) override;
-  virtual jsi::Value getClientDBStore(jsi::Runtime &rt) override;
+  virtual jsi::Value getClientDBStore(
+      jsi::Runtime &rt,
+      std::optional<double> protocolVersion,
+      std::optional<double> requestID) override;
+  virtual jsi::Value
+  getClientDBStoreWithThreadSummaries(jsi::Runtime &rt) override;
+  virtual jsi::Value getClientDBStoreView(jsi::Runtime &rt) override;
+  virtual jsi::Value streamClientDBStore(
+      jsi::Runtime &rt,
+      jsi::Object onChunk,
+      double chunkSize) override;
   virtual jsi::Value removeAllDrafts(jsi::Runtime &rt) override;
   virtual jsi::Array getAllMessagesSync(jsi::Runtime &rt) override;
+  virtual jsi::Value streamAllMessages(
+      jsi::Runtime &rt,
+      jsi::Object onChunk,
+      double chunkSize) override;
+  virtual jsi::Value getThreadMessagesBefore(
+      jsi::Runtime &rt,
+      jsi::String threadID,
+      double beforeTime,
+      jsi::String beforeMessageID,
+      double pageSize,
+      std::optional<double> protocolVersion,
+      std::optional<double> requestID) override;
+  virtual jsi::Value searchMessages(
+      jsi::Runtime &rt,
+      jsi::String query,
+      std::optional<jsi::String> threadID,
+      double pageSize,
+      double offset,
+      std::optional<double> protocolVersion,
+      std::optional<double> requestID) override;
+  virtual void cancelDBRequest(jsi::Runtime &rt, double requestID) override;
+  virtual void reportMessageListScroll(
+      jsi::Runtime &rt,
+      std::optional<jsi::String> threadID,
+      bool towardsOlder) override;
+  virtual jsi::Value getThreadMessagesInRange(
+      jsi::Runtime &rt,
+      jsi::String threadID,
+      double fromTime,
+      double toTime,
+      double limit) override;
+  virtual jsi::Value
+  getMessagesByIDs(jsi::Runtime &rt, jsi::Array ids) override;
+  virtual jsi::Value
+  getThreadMessageCounts(jsi::Runtime &rt, jsi::Array threadIDs) override;
+  virtual jsi::Value
+  archiveMessages(jsi::Runtime &rt, double olderThan) override;
+  virtual jsi::Value vacuumDatabase(jsi::Runtime &rt) override;
+  virtual jsi::Value
+  addToOutbox(jsi::Runtime &rt, jsi::Array entries) override;
+  virtual jsi::Value dispatchOutbox(jsi::Runtime &rt) override;
+  virtual jsi::Value
+  requeueOutbox(jsi::Runtime &rt, jsi::Array localIDs) override;
+  virtual jsi::Value
+  acknowledgeOutbox(jsi::Runtime &rt, jsi::Array acknowledgements) override;
   virtual jsi::Value
   processDraftStoreOperations(jsi::Runtime &rt, jsi::Array operations) override;
   virtual jsi::Value processMessageStoreOperations(
@@ -38,18 +164,51 @@ class CommCoreModule : public facebook::react::CommCoreModuleSchemaCxxSpecJSI {
   virtual void processMessageStoreOperationsSync(
       jsi::Runtime &rt,
       jsi::Array operations) override;
+  virtual jsi::Value processSerializedMessageStoreOperations(
+      jsi::Runtime &rt,
+      jsi::String operations) override;
   virtual jsi::Array getAllThreadsSync(jsi::Runtime &rt) override;
+  virtual jsi::Value getThreadsByIDs(jsi::Runtime &rt, jsi::Array ids) override;
+  virtual jsi::Value
+  getThreadMembers(jsi::Runtime &rt, jsi::String threadID) override;
+  virtual jsi::Value
+  getThreadIDsForMember(jsi::Runtime &rt, jsi::String userID) override;
+  virtual jsi::Value
+  getThreadMemberCounts(jsi::Runtime &rt, jsi::Array threadIDs) override;
+  virtual jsi::Value getThreadSummariesByRecency(jsi::Runtime &rt) override;
   virtual jsi::Value processThreadStoreOperations(
       jsi::Runtime &rt,
       jsi::Array operations) override;
   virtual void processThreadStoreOperationsSync(
       jsi::Runtime &rt,
       jsi::Array operations) override;
+  virtual jsi::Value processSerializedThreadStoreOperations(
+      jsi::Runtime &rt,
+      jsi::String operations) override;
   virtual jsi::Value
   initializeCryptoAccount(jsi::Runtime &rt, jsi::String userId) override;
   virtual jsi::Value getUserPublicKey(jsi::Runtime &rt) override;
   virtual jsi::Value getUserOneTimeKeys(jsi::Runtime &rt) override;
+  virtual jsi::Value getUserPublicKeyBuffers(jsi::Runtime &rt) override;
+  virtual jsi::Value getUserOneTimeKeyBuffers(jsi::Runtime &rt) override;
+  virtual jsi::Value encryptBuffer(
+      jsi::Runtime &rt,
+      jsi::String userID,
+      jsi::Object content) override;
+  virtual jsi::Value decryptBuffer(
+      jsi::Runtime &rt,
+      jsi::String userID,
+      jsi::Object message,
+      double messageType,
+      jsi::Object theirIdentityKeys) override;
   virtual double getCodeVersion(jsi::Runtime &rt) override;
+  virtual jsi::Array getDatabaseQueryProfile(jsi::Runtime &rt) override;
+  virtual jsi::Array getWorkerThreadsStats(jsi::Runtime &rt) override;
+  virtual jsi::Value getDatabaseStartupMetrics(jsi::Runtime &rt) override;
+  virtual jsi::Array getStartupTimeline(jsi::Runtime &rt) override;
+  virtual jsi::Array getAllocationSnapshot(jsi::Runtime &rt) override;
+  virtual jsi::Value getDatabaseChanges(jsi::Runtime &rt) override;
+  virtual jsi::Value getDatabaseMemoryStats(jsi::Runtime &rt) override;
   virtual jsi::Value
   setNotifyToken(jsi::Runtime &rt, jsi::String token) override;
   virtual jsi::Value clearNotifyToken(jsi::Runtime &rt) override;
@@ -63,6 +222,11 @@ class CommCoreModule : public facebook::react::CommCoreModuleSchemaCxxSpecJSI {
 
 public:
   CommCoreModule(std::shared_ptr<facebook::react::CallInvoker> jsInvoker);
+  ~CommCoreModule();
+  // Opens the database on every database thread and fetches the account
+  // secret and pickle in the background. Called once the module is
+  // installed and the database initialized.
+  void warmUp();
 };
 
 } // namespace comm
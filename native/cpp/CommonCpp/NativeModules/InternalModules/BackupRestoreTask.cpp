@@ -0,0 +1,69 @@
+#include "BackupRestoreTask.h"
+#include "../../DatabaseManagers/DatabaseManager.h"
+#include "GlobalDBSingleton.h"
+
+namespace comm {
+
+BackupRestoreTask::BackupRestoreTask(
+    std::string encryptionKey,
+    DoneCallback onDone)
+    : encryptionKey(std::move(encryptionKey)), onDone(std::move(onDone)) {
+}
+
+void BackupRestoreTask::schedule(std::function<void()> step) {
+  GlobalDBSingleton::instance.scheduleOrRun(
+      [self = this->shared_from_this(), step = std::move(step)]() {
+        if (self->failed) {
+          return;
+        }
+        try {
+          step();
+        } catch (const std::exception &e) {
+          self->failed = true;
+          self->onDone(e.what());
+        }
+      });
+}
+
+void BackupRestoreTask::finishCompaction() {
+  if (this->compactionFinished) {
+    return;
+  }
+  DatabaseManager::getQueryExecutor().finishBackupRestoreCompaction(
+      this->encryptionKey);
+  this->compactionFinished = true;
+}
+
+std::shared_ptr<BackupRestoreTask>
+BackupRestoreTask::start(std::string encryptionKey, DoneCallback onDone) {
+  std::shared_ptr<BackupRestoreTask> task(
+      new BackupRestoreTask(std::move(encryptionKey), std::move(onDone)));
+  task->schedule(
+      []() { DatabaseManager::getQueryExecutor().startBackupRestore(); });
+  return task;
+}
+
+void BackupRestoreTask::onCompactionChunk(std::string chunk) {
+  this->schedule([chunk = std::move(chunk)]() {
+    DatabaseManager::getQueryExecutor().writeBackupRestoreCompactionChunk(
+        chunk);
+  });
+}
+
+void BackupRestoreTask::onLogChunk(std::string chunk) {
+  this->schedule([this, chunk = std::move(chunk)]() {
+    this->finishCompaction();
+    DatabaseManager::getQueryExecutor().applyBackupRestoreLogChunk(chunk);
+  });
+}
+
+void BackupRestoreTask::finish() {
+  this->schedule([this]() {
+    // A backup may have no logs yet
+    this->finishCompaction();
+    DatabaseManager::getQueryExecutor().finishBackupRestore();
+    this->onDone("");
+  });
+}
+
+} // namespace comm
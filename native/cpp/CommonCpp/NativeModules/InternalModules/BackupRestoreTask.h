@@ -0,0 +1,41 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace comm {
+
+// Restores the database from a backup as PullBackupResponse streams it, see
+// BackupRestore. The chunks are handed over from any thread, in the order of
+// the stream, and each one is a background task of its own on the database
+// thread, so nothing but the chunks still waiting for it is held in memory.
+// The compaction is put in place of the database once the first log chunk,
+// or the end of the stream, arrives. onDone gets called on the database
+// thread once, at the end or with the first error, after which the rest of
+// the chunks are dropped.
+class BackupRestoreTask
+    : public std::enable_shared_from_this<BackupRestoreTask> {
+  using DoneCallback = std::function<void(const std::string &error)>;
+
+  const std::string encryptionKey;
+  const DoneCallback onDone;
+  // Only used on the database thread
+  bool compactionFinished{false};
+  bool failed{false};
+
+  BackupRestoreTask(std::string encryptionKey, DoneCallback onDone);
+  void schedule(std::function<void()> step);
+  void finishCompaction();
+
+public:
+  // The key of the backup the compaction is encrypted with, see
+  // DatabaseQueryExecutor::finishBackupRestoreCompaction
+  static std::shared_ptr<BackupRestoreTask>
+  start(std::string encryptionKey, DoneCallback onDone);
+  void onCompactionChunk(std::string chunk);
+  void onLogChunk(std::string chunk);
+  void finish();
+};
+
+} // namespace comm
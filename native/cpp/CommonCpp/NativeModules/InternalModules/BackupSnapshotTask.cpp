@@ -0,0 +1,55 @@
+#include "BackupSnapshotTask.h"
+#include "../../DatabaseManagers/DatabaseManager.h"
+#include "GlobalDBSingleton.h"
+
+namespace comm {
+
+void BackupSnapshotTask::schedule(
+    std::function<void()> step,
+    DoneCallback onDone) {
+  GlobalDBSingleton::instance.scheduleOrRun([step = std::move(step), onDone]() {
+    try {
+      step();
+    } catch (const std::exception &e) {
+      onDone(e.what());
+    }
+  });
+}
+
+void BackupSnapshotTask::copy(ChunkCallback onChunk, DoneCallback onDone) {
+  schedule(
+      [onChunk, onDone]() {
+        if (!DatabaseManager::getQueryExecutor().stepBackupSnapshot()) {
+          BackupSnapshotTask::copy(onChunk, onDone);
+          return;
+        }
+        BackupSnapshotTask::stream(onChunk, onDone);
+      },
+      onDone);
+}
+
+void BackupSnapshotTask::stream(ChunkCallback onChunk, DoneCallback onDone) {
+  schedule(
+      [onChunk, onDone]() {
+        std::string chunk =
+            DatabaseManager::getQueryExecutor().readBackupSnapshotChunk();
+        if (chunk.empty()) {
+          onDone("");
+          return;
+        }
+        onChunk(chunk);
+        BackupSnapshotTask::stream(onChunk, onDone);
+      },
+      onDone);
+}
+
+void BackupSnapshotTask::run(ChunkCallback onChunk, DoneCallback onDone) {
+  schedule(
+      [onChunk, onDone]() {
+        DatabaseManager::getQueryExecutor().startBackupSnapshot();
+        BackupSnapshotTask::copy(onChunk, onDone);
+      },
+      onDone);
+}
+
+} // namespace comm
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <functional>
+#include <string>
+
+namespace comm {
+
+// Makes a snapshot of the database for a backup compaction, see
+// BackupSnapshot. Every step is a background task of its own on the
+// database thread, so writes scheduled in the meantime go first and the
+// thread never pauses for the whole copy. onChunk gets the pieces of the
+// snapshot, meant for CreateNewBackupRequest.newCompactionChunk, and onDone
+// gets called at the end, with an error if the snapshot failed. Both are
+// called on the database thread.
+class BackupSnapshotTask {
+  using ChunkCallback = std::function<void(const std::string &chunk)>;
+  using DoneCallback = std::function<void(const std::string &error)>;
+
+  static void schedule(std::function<void()> step, DoneCallback onDone);
+  static void copy(ChunkCallback onChunk, DoneCallback onDone);
+  static void stream(ChunkCallback onChunk, DoneCallback onDone);
+
+public:
+  static void run(ChunkCallback onChunk, DoneCallback onDone);
+};
+
+} // namespace comm
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <ReactCommon/CallInvoker.h>
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace comm {
+
+// Runs the callbacks queued until the JS thread gets to them in a single
+// hop, instead of one hop per callback. Tasks that complete together, e.g.
+// the many small writes of a sync, then resolve their promises in one turn
+// of the event loop. The callbacks run in the order they were queued, and
+// those queued by a batch run in the next one.
+class BatchingCallInvoker : public facebook::react::CallInvoker {
+  // Outlives the invoker while a batch is queued
+  struct Queue {
+    std::mutex mutex;
+    std::vector<std::function<void()>> callbacks;
+    bool flushScheduled{false};
+  };
+
+  const std::shared_ptr<facebook::react::CallInvoker> jsInvoker;
+  const std::shared_ptr<Queue> queue;
+
+  static void scheduleFlush(
+      const std::shared_ptr<facebook::react::CallInvoker> &jsInvoker,
+      const std::shared_ptr<Queue> &queue) {
+    jsInvoker->invokeAsync(
+        [jsInvoker, queue]() { BatchingCallInvoker::flush(jsInvoker, queue); });
+  }
+
+  static void flush(
+      const std::shared_ptr<facebook::react::CallInvoker> &jsInvoker,
+      const std::shared_ptr<Queue> &queue) {
+    std::vector<std::function<void()>> callbacks;
+    {
+      std::lock_guard<std::mutex> lock(queue->mutex);
+      callbacks.swap(queue->callbacks);
+      queue->flushScheduled = false;
+    }
+    for (size_t i = 0; i < callbacks.size(); i++) {
+      try {
+        callbacks[i]();
+      } catch (...) {
+        // The callbacks after the one that threw still run, first in the
+        // next batch
+        bool schedule;
+        {
+          std::lock_guard<std::mutex> lock(queue->mutex);
+          queue->callbacks.insert(
+              queue->callbacks.begin(),
+              std::make_move_iterator(callbacks.begin() + i + 1),
+              std::make_move_iterator(callbacks.end()));
+          schedule = !queue->callbacks.empty() && !queue->flushScheduled;
+          queue->flushScheduled = queue->flushScheduled || schedule;
+        }
+        if (schedule) {
+          BatchingCallInvoker::scheduleFlush(jsInvoker, queue);
+        }
+        throw;
+      }
+    }
+  }
+
+public:
+  explicit BatchingCallInvoker(
+      std::shared_ptr<facebook::react::CallInvoker> jsInvoker)
+      : jsInvoker(std::move(jsInvoker)), queue(std::make_shared<Queue>()) {
+  }
+
+  void invokeAsync(std::function<void()> &&func) override {
+    {
+      std::lock_guard<std::mutex> lock(this->queue->mutex);
+      this->queue->callbacks.push_back(std::move(func));
+      if (this->queue->flushScheduled) {
+        return;
+      }
+      this->queue->flushScheduled = true;
+    }
+    BatchingCallInvoker::scheduleFlush(this->jsInvoker, this->queue);
+  }
+
+  void invokeSync(std::function<void()> &&func) override {
+    this->jsInvoker->invokeSync(std::move(func));
+  }
+};
+
+} // namespace comm
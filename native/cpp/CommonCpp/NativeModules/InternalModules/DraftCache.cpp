@@ -0,0 +1,234 @@
+#include "DraftCache.h"
+#include "../../DatabaseManagers/DatabaseManager.h"
+#include "../../Tools/Logger.h"
+#include "GlobalDBSingleton.h"
+
+#include <algorithm>
+
+namespace comm {
+
+DraftCache &DraftCache::instance() {
+  // Never destroyed, the timer thread outlives the statics
+  static DraftCache *cache = new DraftCache();
+  return *cache;
+}
+
+bool DraftCache::getDraft(const std::string &key, std::string &text) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  auto it = this->drafts.find(key);
+  if (it != this->drafts.end()) {
+    text = it->second;
+    return true;
+  }
+  auto writingIt = this->writingDrafts.find(key);
+  if (writingIt != this->writingDrafts.end()) {
+    text = writingIt->second;
+    return true;
+  }
+  return false;
+}
+
+uint64_t DraftCache::getGeneration() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->generation;
+}
+
+void DraftCache::fillDraft(
+    const std::string &key,
+    const std::string &text,
+    uint64_t readGeneration) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if (readGeneration != this->generation) {
+    return;
+  }
+  // An update made while the read ran is newer than the text read, and so
+  // is one whose write hadn't returned when the read ran
+  auto writingIt = this->writingDrafts.find(key);
+  this->drafts.emplace(
+      key,
+      writingIt != this->writingDrafts.end() ? writingIt->second : text);
+}
+
+void DraftCache::updateDraft(const std::string &key, const std::string &text) {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->drafts[key] = text;
+    this->pendingDrafts[key] =
+        PendingDraft{text, std::chrono::steady_clock::now()};
+    if (this->timerThread == nullptr) {
+      this->timerThread =
+          std::make_unique<std::thread>([this]() { this->runTimer(); });
+      this->timerThread->detach();
+    }
+  }
+  this->condition.notify_one();
+}
+
+std::vector<Draft> DraftCache::takePendingDrafts() {
+  std::vector<Draft> drafts;
+  std::lock_guard<std::mutex> lock(this->mutex);
+  drafts.reserve(this->pendingDrafts.size());
+  for (auto &pendingDraft : this->pendingDrafts) {
+    drafts.push_back(
+        Draft{pendingDraft.first, std::move(pendingDraft.second.text)});
+  }
+  this->pendingDrafts.clear();
+  this->drafts.clear();
+  this->generation++;
+  this->takeGeneration++;
+  // A write scheduled before has nothing left to write, and may never run
+  // if the tasks are cancelled
+  this->writeScheduled = false;
+  return drafts;
+}
+
+void DraftCache::writeDrafts(const std::vector<Draft> &drafts) {
+  for (const Draft &draft : drafts) {
+    DatabaseManager::getQueryExecutor().updateDraft(draft.key, draft.text);
+  }
+}
+
+void DraftCache::overlayPendingDrafts(std::vector<Draft> &drafts) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  if (this->pendingDrafts.empty() && this->writingDrafts.empty()) {
+    return;
+  }
+  std::unordered_map<std::string, size_t> indexes;
+  for (size_t i = 0; i < drafts.size(); i++) {
+    indexes.emplace(drafts[i].key, i);
+  }
+  auto overlay = [&](const std::string &key, const std::string &text) {
+    auto it = indexes.find(key);
+    if (it != indexes.end()) {
+      drafts[it->second].text = text;
+    } else {
+      indexes.emplace(key, drafts.size());
+      drafts.push_back(Draft{key, text});
+    }
+  };
+  // A pending update is newer than the one being written
+  for (const auto &writingDraft : this->writingDrafts) {
+    overlay(writingDraft.first, writingDraft.second);
+  }
+  for (const auto &pendingDraft : this->pendingDrafts) {
+    overlay(pendingDraft.first, pendingDraft.second.text);
+  }
+}
+
+void DraftCache::flush() {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->pendingDrafts.empty()) {
+      return;
+    }
+  }
+  this->scheduleWrite(false);
+}
+
+void DraftCache::releaseMemory() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  for (auto it = this->drafts.begin(); it != this->drafts.end();) {
+    // getDraft doesn't look at the database for an update that isn't
+    // written yet
+    if (this->pendingDrafts.count(it->first) ||
+        this->writingDrafts.count(it->first)) {
+      it++;
+    } else {
+      it = this->drafts.erase(it);
+    }
+  }
+  this->generation++;
+}
+
+void DraftCache::runTimer() {
+  std::unique_lock<std::mutex> lock(this->mutex);
+  while (true) {
+    if (this->pendingDrafts.empty() || this->writeScheduled) {
+      this->condition.wait(lock);
+      continue;
+    }
+    auto lastUpdate = std::min_element(
+        this->pendingDrafts.begin(),
+        this->pendingDrafts.end(),
+        [](const auto &a, const auto &b) {
+          return a.second.updatedAt < b.second.updatedAt;
+        });
+    auto idleAt = lastUpdate->second.updatedAt + DRAFT_WRITE_IDLE_DELAY;
+    if (std::chrono::steady_clock::now() < idleAt) {
+      this->condition.wait_until(lock, idleAt);
+      continue;
+    }
+    this->writeScheduled = true;
+    lock.unlock();
+    this->scheduleWrite(true);
+    lock.lock();
+  }
+}
+
+void DraftCache::scheduleWrite(bool onlyIdle) {
+  try {
+    GlobalDBSingleton::instance.scheduleOrRunCancellable(
+        [this, onlyIdle]() { this->writePendingDrafts(onlyIdle); });
+  } catch (const std::exception &e) {
+    // The tasks are cancelled while the database is cleared, the drafts go
+    // with it
+    {
+      std::lock_guard<std::mutex> lock(this->mutex);
+      this->pendingDrafts.clear();
+      this->writeScheduled = false;
+    }
+    Logger::log("Draft write not scheduled: " + std::string(e.what()));
+  }
+}
+
+void DraftCache::writePendingDrafts(bool onlyIdle) {
+  std::vector<Draft> drafts;
+  uint64_t writeTakeGeneration;
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    writeTakeGeneration = this->takeGeneration;
+    if (onlyIdle) {
+      this->writeScheduled = false;
+    }
+    const auto idleSince =
+        std::chrono::steady_clock::now() - DRAFT_WRITE_IDLE_DELAY;
+    for (auto it = this->pendingDrafts.begin();
+         it != this->pendingDrafts.end();) {
+      if (onlyIdle && it->second.updatedAt > idleSince) {
+        it++;
+        continue;
+      }
+      this->writingDrafts[it->first] = it->second.text;
+      drafts.push_back(Draft{it->first, std::move(it->second.text)});
+      it = this->pendingDrafts.erase(it);
+    }
+  }
+  this->condition.notify_one();
+  bool written = true;
+  try {
+    DraftCache::writeDrafts(drafts);
+  } catch (const std::exception &e) {
+    written = false;
+    Logger::log("Draft write failed: " + std::string(e.what()));
+  }
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    const auto now = std::chrono::steady_clock::now();
+    for (Draft &draft : drafts) {
+      auto it = this->writingDrafts.find(draft.key);
+      if (it != this->writingDrafts.end() && it->second == draft.text) {
+        this->writingDrafts.erase(it);
+      }
+      // Written again once idle, unless a newer update replaces it
+      if (!written && writeTakeGeneration == this->takeGeneration) {
+        this->pendingDrafts.emplace(
+            draft.key, PendingDraft{std::move(draft.text), now});
+      }
+    }
+  }
+  if (!written) {
+    this->condition.notify_one();
+  }
+}
+
+} // namespace comm
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "../../DatabaseManagers/entities/Draft.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace comm {
+
+const std::chrono::milliseconds DRAFT_WRITE_IDLE_DELAY{750};
+
+// Drafts are updated on every keystroke. The cache answers getDraft from
+// memory and writes the update of a draft once it has been idle for
+// DRAFT_WRITE_IDLE_DELAY, so that typing costs a single write per pause.
+// The writes run on the database thread. A task that changes drafts in the
+// database directly takes the pending updates with takePendingDrafts on the
+// JS thread, when it is scheduled, and writes them before its own changes.
+class DraftCache {
+  struct PendingDraft {
+    std::string text;
+    std::chrono::steady_clock::time_point updatedAt;
+  };
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  // Texts of the drafts known to the cache, an empty one for a draft known
+  // not to exist
+  std::unordered_map<std::string, std::string> drafts;
+  std::unordered_map<std::string, PendingDraft> pendingDrafts;
+  // Updates taken by writePendingDrafts whose write hasn't returned yet.
+  // Reads from the database don't see them until it does.
+  std::unordered_map<std::string, std::string> writingDrafts;
+  // Bumped whenever the cache forgets drafts, so that a read from the
+  // database that started before doesn't put back an outdated text
+  uint64_t generation{0};
+  // Bumped by takePendingDrafts, so that a failed write doesn't put back
+  // updates that were dropped or taken over meanwhile
+  uint64_t takeGeneration{0};
+  bool writeScheduled{false};
+  std::unique_ptr<std::thread> timerThread;
+
+  DraftCache() = default;
+  void runTimer();
+  void scheduleWrite(bool onlyIdle);
+  void writePendingDrafts(bool onlyIdle);
+
+public:
+  static DraftCache &instance();
+
+  // Returns false if the draft isn't cached
+  bool getDraft(const std::string &key, std::string &text);
+  uint64_t getGeneration();
+  // Caches a text read from the database by a read that started at the
+  // given generation
+  void fillDraft(
+      const std::string &key,
+      const std::string &text,
+      uint64_t readGeneration);
+  void updateDraft(const std::string &key, const std::string &text);
+  // Forgets every draft and returns the updates that are not written yet
+  std::vector<Draft> takePendingDrafts();
+  // Writes the updates of a takePendingDrafts call, on the database thread
+  static void writeDrafts(const std::vector<Draft> &drafts);
+  // Lays the updates that are not written yet over drafts read from the
+  // database
+  void overlayPendingDrafts(std::vector<Draft> &drafts);
+  // Writes every pending update without waiting for the idle delay, e.g.
+  // when the app goes to the background
+  void flush();
+  // Forgets the drafts that have no pending update, e.g. when memory runs
+  // low. They are read from the database again.
+  void releaseMemory();
+
+  DraftCache(const DraftCache &) = delete;
+  DraftCache &operator=(const DraftCache &) = delete;
+};
+
+} // namespace comm
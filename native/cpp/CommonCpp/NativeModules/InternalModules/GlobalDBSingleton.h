@@ -1,35 +1,279 @@
 #pragma once
 
+#include "../../DatabaseManagers/ChangeCapture.h"
+#include "../../DatabaseManagers/DatabaseManager.h"
+#include "../../Tools/CancellationToken.h"
+#include "../../Tools/Logger.h"
+#include "../../Tools/Trace.h"
 #include "../../Tools/WorkerThread.h"
 #include <ReactCommon/TurboModuleUtils.h>
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
 
 namespace comm {
 
-const std::string TASK_CANCELLED_FLAG{"TASK_CANCELLED"};
+const size_t DATABASE_READER_THREADS_COUNT{3};
+const std::chrono::minutes DATABASE_MAINTENANCE_INTERVAL{5};
+const int64_t DATABASE_MAINTENANCE_TIME_BUDGET_MS{100};
+// Maintenance that ran out of its budget resumes after this long, rather
+// than at every idle point
+const std::chrono::seconds DATABASE_MAINTENANCE_RESUME_INTERVAL{10};
+const std::chrono::milliseconds DATABASE_WRITE_BATCH_WINDOW{5};
+const size_t DATABASE_WRITE_BATCH_LIMIT{32};
+const std::string DATABASE_WRITE_BATCH_SAVEPOINT{"batched_write"};
 
 class GlobalDBSingleton {
   std::atomic<bool> multithreadingEnabled;
   std::unique_ptr<WorkerThread> databaseThread;
   std::atomic<bool> tasksCancelled;
 
+  // Every task of the database thread runs at normal priority, so that the
+  // writes, and the reads that fall back to that thread, run in the order
+  // they were scheduled in. Priorities only apply to the reader threads.
+  //
+  // Read-only tasks can run on a small pool of reader threads, each with its
+  // own database connection. To keep read-your-writes semantics, a read task
+  // waits until every write scheduled before it has completed. A write that
+  // fails to be scheduled is completed out of order, so the IDs of all
+  // pending writes are tracked.
+  std::vector<std::unique_ptr<WorkerThread>> readerThreads;
+  std::atomic<bool> readerThreadsEnabled{false};
+  std::atomic<size_t> nextReaderThread{0};
+  std::atomic<uint64_t> scheduledWrites{0};
+  std::set<uint64_t> pendingWrites;
+  std::mutex pendingWritesMutex;
+  std::condition_variable pendingWritesCondition;
+  // Held while the threads are created and while their stats are read, as
+  // the stats can be read from any thread
+  std::mutex threadsMutex;
+
+  // Maintenance runs on the database thread once it has no more queued
+  // writes. Both fields are only accessed from that thread.
+  std::chrono::steady_clock::time_point lastMaintenance{
+      std::chrono::steady_clock::now()};
+  bool maintenancePending{false};
+
+  // Batched writes scheduled within DATABASE_WRITE_BATCH_WINDOW of the first
+  // one are committed in a single transaction, each in its own savepoint so
+  // that a failing write is rolled back alone. The batch is only handed to
+  // the database thread once it closes, by the timer thread at the end of
+  // the window, or once it's full, or ahead of any other task of the
+  // database thread or read that JS waits on. The database thread never
+  // waits for the window, and the writes still run in the order they were
+  // scheduled.
+  struct BatchedWrite {
+    taskType write;
+    std::shared_ptr<facebook::react::Promise> promise;
+    std::shared_ptr<facebook::react::CallInvoker> jsInvoker;
+    uint64_t writeID;
+  };
+  struct WriteBatch {
+    std::vector<BatchedWrite> writes;
+    std::chrono::steady_clock::time_point deadline;
+  };
+  std::shared_ptr<WriteBatch> openWriteBatch;
+  std::mutex writeBatchMutex;
+  std::condition_variable writeBatchCondition;
+  std::unique_ptr<std::thread> writeBatchTimer;
+  bool writeBatchTimerStopping{false};
+
   GlobalDBSingleton();
 
-  void scheduleOrRunCommonImpl(const taskType task) {
+  uint64_t markWriteScheduled() {
+    std::lock_guard<std::mutex> lock(this->pendingWritesMutex);
+    uint64_t writeID = ++this->scheduledWrites;
+    this->pendingWrites.insert(writeID);
+    return writeID;
+  }
+
+  void markWriteCompleted(uint64_t writeID) {
+    {
+      std::lock_guard<std::mutex> lock(this->pendingWritesMutex);
+      this->pendingWrites.erase(writeID);
+    }
+    this->pendingWritesCondition.notify_all();
+  }
+
+  void waitForWritesCompletion(uint64_t writeID) {
+    std::unique_lock<std::mutex> lock(this->pendingWritesMutex);
+    this->pendingWritesCondition.wait(lock, [this, writeID]() {
+      return this->pendingWrites.empty() ||
+          *this->pendingWrites.begin() > writeID;
+    });
+  }
+
+  bool isCancelled(const std::shared_ptr<CancellationToken> &token) {
+    return this->tasksCancelled.load() ||
+        (token != nullptr && token->isCancelled());
+  }
+
+  bool hasPendingWrites() {
+    std::lock_guard<std::mutex> lock(this->pendingWritesMutex);
+    return !this->pendingWrites.empty();
+  }
+
+  void runMaintenanceIfIdle() {
+    // A write scheduled in the meantime waits for at most the time budget
+    if (this->databaseThread == nullptr || this->tasksCancelled.load() ||
+        this->hasPendingWrites()) {
+      return;
+    }
+    // Writes that came in a row end up in the same changeset
+    DatabaseManager::getQueryExecutor().recordBackupLog();
+    auto now = std::chrono::steady_clock::now();
+    if (now - this->lastMaintenance <
+        (this->maintenancePending ? DATABASE_MAINTENANCE_RESUME_INTERVAL
+                                  : DATABASE_MAINTENANCE_INTERVAL)) {
+      return;
+    }
+    this->lastMaintenance = now;
+    try {
+      this->maintenancePending =
+          !DatabaseManager::getQueryExecutor().runMaintenance(
+              DATABASE_MAINTENANCE_TIME_BUDGET_MS);
+    } catch (const std::exception &e) {
+      this->maintenancePending = false;
+      Logger::log("Database maintenance failed: " + std::string(e.what()));
+    }
+  }
+
+  // Called with writeBatchMutex held, so that a task scheduled once the
+  // batch is closed is queued behind it
+  void closeWriteBatchLocked() {
+    if (this->openWriteBatch == nullptr) {
+      return;
+    }
+    std::shared_ptr<WriteBatch> batch = this->openWriteBatch;
+    this->openWriteBatch = nullptr;
+    try {
+      this->databaseThread->scheduleTask(
+          [this, batch]() { this->runWriteBatch(batch->writes); });
+    } catch (const std::exception &e) {
+      // the batch will never run, so its writes are rejected right away
+      this->completeBatchedWrites(
+          batch->writes,
+          std::vector<std::string>(batch->writes.size(), e.what()));
+    }
+  }
+
+  void closeWriteBatch() {
+    std::lock_guard<std::mutex> lock(this->writeBatchMutex);
+    this->closeWriteBatchLocked();
+  }
+
+  void runWriteBatchTimer() {
+    std::unique_lock<std::mutex> lock(this->writeBatchMutex);
+    while (!this->writeBatchTimerStopping) {
+      if (this->openWriteBatch == nullptr) {
+        this->writeBatchCondition.wait(lock);
+        continue;
+      }
+      const auto deadline = this->openWriteBatch->deadline;
+      if (std::chrono::steady_clock::now() < deadline) {
+        this->writeBatchCondition.wait_until(lock, deadline);
+        continue;
+      }
+      this->closeWriteBatchLocked();
+    }
+  }
+
+  void completeBatchedWrites(
+      std::vector<BatchedWrite> &writes,
+      const std::vector<std::string> &errors) {
+    for (size_t i = 0; i < writes.size(); i++) {
+      this->markWriteCompleted(writes[i].writeID);
+      auto promise = writes[i].promise;
+      std::string error = errors[i];
+      writes[i].jsInvoker->invokeAsync([promise, error]() {
+        if (error.size()) {
+          promise->reject(error);
+        } else {
+          promise->resolve(facebook::jsi::Value::undefined());
+        }
+      });
+    }
+  }
+
+  void runWriteBatch(std::vector<BatchedWrite> &writes) {
+    // Batched writes come from JS, which already has their changes
+    const ChangeCapture::Suppression suppression;
+    std::vector<std::string> errors(writes.size());
+    auto &executor = DatabaseManager::getQueryExecutor();
+    try {
+      executor.beginTransaction();
+      for (size_t i = 0; i < writes.size(); i++) {
+        if (this->tasksCancelled.load()) {
+          errors[i] = TASK_CANCELLED_FLAG;
+          continue;
+        }
+        executor.createSavepoint(DATABASE_WRITE_BATCH_SAVEPOINT);
+        try {
+          writes[i].write();
+          executor.releaseSavepoint(DATABASE_WRITE_BATCH_SAVEPOINT);
+        } catch (const std::exception &e) {
+          errors[i] = e.what();
+          executor.rollbackToSavepoint(DATABASE_WRITE_BATCH_SAVEPOINT);
+        }
+      }
+      executor.commitTransaction();
+    } catch (const std::exception &e) {
+      // None of the writes were stored, so all of them are rejected
+      try {
+        executor.rollbackTransaction();
+      } catch (const std::exception &rollbackError) {
+        Logger::log(
+            "Failed to roll back batched writes: " +
+            std::string(rollbackError.what()));
+      }
+      std::fill(errors.begin(), errors.end(), std::string(e.what()));
+    }
+    this->completeBatchedWrites(writes, errors);
+    this->runMaintenanceIfIdle();
+  }
+
+  // Wrappers are passed on as concrete callables rather than taskType, so
+  // that a task reaches the worker queue inline in a single WorkerTask
+  // instead of through nested std::function allocations
+  template <typename Task> void scheduleOrRunCommonImpl(Task task) {
+    this->closeWriteBatch();
+    uint64_t writeID = this->markWriteScheduled();
+    auto trackedTask = [this, task = std::move(task), writeID]() mutable {
+      try {
+        task();
+      } catch (...) {
+        this->markWriteCompleted(writeID);
+        throw;
+      }
+      this->markWriteCompleted(writeID);
+      this->runMaintenanceIfIdle();
+    };
     if (this->databaseThread != nullptr) {
-      this->databaseThread->scheduleTask(task);
+      try {
+        this->databaseThread->scheduleTask(std::move(trackedTask));
+      } catch (...) {
+        // the write will never run, so readers must not wait for it
+        this->markWriteCompleted(writeID);
+        throw;
+      }
       return;
     }
-    task();
+    trackedTask();
   }
 
-  void scheduleOrRunCancellableCommonImpl(const taskType task) {
+  void scheduleOrRunCancellableCommonImpl(taskType task) {
     if (this->tasksCancelled.load()) {
       throw std::runtime_error(TASK_CANCELLED_FLAG);
     }
 
-    this->scheduleOrRunCommonImpl([this, task]() {
+    this->scheduleOrRunCommonImpl([this, task = std::move(task)]() {
       if (this->tasksCancelled.load()) {
         throw std::runtime_error(TASK_CANCELLED_FLAG);
       }
@@ -38,41 +282,307 @@ class GlobalDBSingleton {
   }
 
   void scheduleOrRunCancellableCommonImpl(
-      const taskType task,
+      taskType task,
       const std::shared_ptr<facebook::react::Promise> promise,
-      const std::shared_ptr<facebook::react::CallInvoker> jsInvoker) {
-    if (this->tasksCancelled.load()) {
+      const std::shared_ptr<facebook::react::CallInvoker> jsInvoker,
+      std::shared_ptr<CancellationToken> cancellationToken = nullptr) {
+    if (this->isCancelled(cancellationToken)) {
       jsInvoker->invokeAsync(
           [promise]() { promise->reject(TASK_CANCELLED_FLAG); });
       return;
     }
 
-    scheduleOrRunCommonImpl([this, task, promise, jsInvoker]() {
-      if (this->tasksCancelled.load()) {
+    scheduleOrRunCommonImpl([this,
+                             task = std::move(task),
+                             promise,
+                             jsInvoker,
+                             cancellationToken]() {
+      if (this->isCancelled(cancellationToken)) {
         jsInvoker->invokeAsync(
             [promise]() { promise->reject(TASK_CANCELLED_FLAG); });
         return;
       }
+      // Tasks with a promise come from JS, which already has the changes that
+      // they make
+      const ChangeCapture::Suppression suppression;
+      const CancellationToken::Scope cancellationScope(cancellationToken.get());
       task();
     });
   }
 
+  void scheduleOrRunCancellableReadCommonImpl(
+      taskType task,
+      const std::shared_ptr<facebook::react::Promise> promise,
+      const std::shared_ptr<facebook::react::CallInvoker> jsInvoker,
+      TaskPriority priority,
+      std::shared_ptr<CancellationToken> cancellationToken) {
+    if (!this->readerThreadsEnabled.load()) {
+      this->scheduleOrRunCancellableCommonImpl(
+          std::move(task), promise, jsInvoker, cancellationToken);
+      return;
+    }
+    if (this->isCancelled(cancellationToken)) {
+      jsInvoker->invokeAsync(
+          [promise]() { promise->reject(TASK_CANCELLED_FLAG); });
+      return;
+    }
+
+    // The read would wait for the batched writes anyway
+    this->closeWriteBatch();
+    uint64_t precedingWrite = this->scheduledWrites.load();
+    size_t readerIdx =
+        this->nextReaderThread++ % this->readerThreads.size();
+    this->readerThreads[readerIdx]->scheduleTask(
+        [this,
+         task = std::move(task),
+         promise,
+         jsInvoker,
+         precedingWrite,
+         cancellationToken]() {
+          this->waitForWritesCompletion(precedingWrite);
+          if (this->isCancelled(cancellationToken)) {
+            jsInvoker->invokeAsync(
+                [promise]() { promise->reject(TASK_CANCELLED_FLAG); });
+            return;
+          }
+          const CancellationToken::Scope cancellationScope(
+              cancellationToken.get());
+          task();
+        },
+        priority);
+  }
+
+  void scheduleOrRunCancellableBatchedWriteCommonImpl(
+      taskType write,
+      const std::shared_ptr<facebook::react::Promise> promise,
+      const std::shared_ptr<facebook::react::CallInvoker> jsInvoker) {
+    if (this->tasksCancelled.load()) {
+      jsInvoker->invokeAsync(
+          [promise]() { promise->reject(TASK_CANCELLED_FLAG); });
+      return;
+    }
+
+    // A write that joins an open batch isn't scheduled on its own
+    TraceCall::endParsing();
+    BatchedWrite batchedWrite{
+        std::move(write), promise, jsInvoker, this->markWriteScheduled()};
+    if (this->databaseThread == nullptr) {
+      std::vector<BatchedWrite> writes;
+      writes.push_back(std::move(batchedWrite));
+      this->runWriteBatch(writes);
+      return;
+    }
+
+    bool batchOpened = false;
+    {
+      std::lock_guard<std::mutex> lock(this->writeBatchMutex);
+      if (this->openWriteBatch == nullptr) {
+        this->openWriteBatch = std::make_shared<WriteBatch>();
+        this->openWriteBatch->deadline =
+            std::chrono::steady_clock::now() + DATABASE_WRITE_BATCH_WINDOW;
+        batchOpened = true;
+        if (this->writeBatchTimer == nullptr) {
+          this->writeBatchTimer = std::make_unique<std::thread>(
+              [this]() { this->runWriteBatchTimer(); });
+        }
+      }
+      this->openWriteBatch->writes.push_back(std::move(batchedWrite));
+      if (this->openWriteBatch->writes.size() >= DATABASE_WRITE_BATCH_LIMIT) {
+        this->closeWriteBatchLocked();
+      }
+    }
+    if (batchOpened) {
+      this->writeBatchCondition.notify_all();
+    }
+  }
+
+  void scheduleOnEveryConnection(
+      const std::string &name,
+      std::function<void(const DatabaseQueryExecutor &)> task,
+      TaskPriority priority) {
+    auto runTask = [name, task]() {
+      try {
+        task(DatabaseManager::getQueryExecutor());
+      } catch (const std::exception &e) {
+        Logger::log("Failed to " + name + ": " + std::string(e.what()));
+      }
+    };
+    try {
+      this->scheduleOrRun(runTask);
+      if (!this->readerThreadsEnabled.load()) {
+        return;
+      }
+      for (const auto &readerThread : this->readerThreads) {
+        readerThread->scheduleTask(runTask, priority);
+      }
+    } catch (const std::exception &e) {
+      Logger::log(
+          "Task to " + name + " not scheduled: " + std::string(e.what()));
+    }
+  }
+
   void enableMultithreadingCommonImpl() {
+    std::lock_guard<std::mutex> lock(this->threadsMutex);
     if (this->databaseThread == nullptr) {
-      this->databaseThread = std::make_unique<WorkerThread>("database");
+      this->databaseThread = std::make_unique<WorkerThread>(
+          "database",
+          OverflowPolicy::Spill,
+          ThreadAttachment::Lifetime,
+          AllocationTag::Database,
+          ThreadQoS::UserInitiated);
       this->multithreadingEnabled.store(true);
     }
+    if (this->readerThreads.empty()) {
+      for (size_t i = 0; i < DATABASE_READER_THREADS_COUNT; i++) {
+        auto readerThread = std::make_unique<WorkerThread>(
+            "database-reader",
+            OverflowPolicy::Spill,
+            ThreadAttachment::PerTask,
+            AllocationTag::Database,
+            ThreadQoS::UserInitiated);
+        readerThread->scheduleTask(
+            []() { DatabaseManager::useReadOnlyConnection(); });
+        this->readerThreads.push_back(std::move(readerThread));
+      }
+      this->readerThreadsEnabled.store(true);
+    }
   }
 
 public:
   static GlobalDBSingleton instance;
-  void scheduleOrRun(const taskType task);
-  void scheduleOrRunCancellable(const taskType task);
+  // A batch that is still open is handed to the database thread, which runs
+  // every queued task before it stops, so that each of its promises is
+  // settled. The thread is stopped here, while the members that the batch
+  // uses are still alive, and as it's already detached from databaseThread,
+  // no maintenance runs after the batch.
+  ~GlobalDBSingleton() {
+    {
+      std::lock_guard<std::mutex> lock(this->writeBatchMutex);
+      this->writeBatchTimerStopping = true;
+    }
+    this->writeBatchCondition.notify_all();
+    if (this->writeBatchTimer != nullptr) {
+      this->writeBatchTimer->join();
+    }
+    this->closeWriteBatch();
+    this->databaseThread.reset();
+  }
+  void scheduleOrRun(taskType task);
+  void scheduleOrRunCancellable(taskType task);
   void scheduleOrRunCancellable(
-      const taskType task,
+      taskType task,
+      const std::shared_ptr<facebook::react::Promise> promise,
+      const std::shared_ptr<facebook::react::CallInvoker> jsInvoker);
+  // Runs a task that only reads from the database. It may run concurrently
+  // with writes scheduled after it. Once the optional token is cancelled, a
+  // task that hasn't started is skipped, rejecting the promise with
+  // TASK_CANCELLED_FLAG, and the queries of a running one throw it.
+  void scheduleOrRunCancellableRead(
+      taskType task,
+      const std::shared_ptr<facebook::react::Promise> promise,
+      const std::shared_ptr<facebook::react::CallInvoker> jsInvoker,
+      TaskPriority priority = TaskPriority::Normal,
+      std::shared_ptr<CancellationToken> cancellationToken = nullptr);
+  // Runs a write as part of a batch of writes committed in one transaction.
+  // The promise is resolved once the batch has been committed, or rejected
+  // with the error thrown by the write, which is then rolled back alone.
+  void scheduleOrRunCancellableBatchedWrite(
+      taskType write,
       const std::shared_ptr<facebook::react::Promise> promise,
       const std::shared_ptr<facebook::react::CallInvoker> jsInvoker);
+  // Runs a read that nothing waits on, e.g. a prefetch, on a reader thread
+  // at background priority, once the writes scheduled before it complete.
+  // It's dropped without the reader threads, so that it doesn't hold up the
+  // writes, and once the token is cancelled. Errors are only logged.
+  void scheduleBackgroundRead(
+      taskType task,
+      std::shared_ptr<CancellationToken> cancellationToken) {
+    if (!this->readerThreadsEnabled.load() ||
+        this->isCancelled(cancellationToken)) {
+      return;
+    }
+    uint64_t precedingWrite = this->scheduledWrites.load();
+    size_t readerIdx =
+        this->nextReaderThread++ % this->readerThreads.size();
+    try {
+      this->readerThreads[readerIdx]->scheduleTask(
+          [this,
+           task = std::move(task),
+           precedingWrite,
+           cancellationToken]() {
+            this->waitForWritesCompletion(precedingWrite);
+            if (this->isCancelled(cancellationToken)) {
+              return;
+            }
+            const CancellationToken::Scope cancellationScope(
+                cancellationToken.get());
+            try {
+              task();
+            } catch (const std::exception &e) {
+              if (!this->isCancelled(cancellationToken)) {
+                Logger::log("Background read failed: " + std::string(e.what()));
+              }
+            }
+          },
+          TaskPriority::Background);
+    } catch (const std::exception &e) {
+      Logger::log("Background read not scheduled: " + std::string(e.what()));
+    }
+  }
   void enableMultithreading();
+  // The thread of the writes, for the callers that block on it to boost it,
+  // or nullptr while the tasks run on the thread that schedules them
+  WorkerThread *getDatabaseThread() {
+    return this->databaseThread.get();
+  }
+  std::vector<WorkerThreadStats> getThreadsStats() {
+    std::vector<WorkerThreadStats> threadsStats;
+    std::lock_guard<std::mutex> lock(this->threadsMutex);
+    if (this->databaseThread != nullptr) {
+      threadsStats.push_back(this->databaseThread->getStats());
+    }
+    for (const auto &readerThread : this->readerThreads) {
+      threadsStats.push_back(readerThread->getStats());
+    }
+    return threadsStats;
+  }
+  // Has every connection free what it keeps cached, on its own thread once
+  // the tasks queued before have run
+  void releaseMemory() {
+    this->scheduleOnEveryConnection(
+        "release memory",
+        [](const DatabaseQueryExecutor &executor) { executor.releaseMemory(); },
+        TaskPriority::Interactive);
+  }
+  // Opens every connection ahead of the first task, which also checks the
+  // migrations, and caches the index pages that the first queries read. The
+  // connections warm up in parallel, each on its own thread.
+  void warmUp() {
+    this->scheduleOnEveryConnection(
+        "warm up",
+        [](const DatabaseQueryExecutor &executor) { executor.warmUp(); },
+        TaskPriority::Normal);
+  }
+  // Runs a short read-only task on the calling thread, using a read-only
+  // connection of its own, and returns true. If a pending write could be
+  // missed by the read, or tasks are cancelled, the task isn't run and false
+  // is returned, so the caller can schedule it instead.
+  template <typename Task> bool tryRunReadInPlace(Task &&task) {
+    if (!this->readerThreadsEnabled.load() || this->tasksCancelled.load() ||
+        this->hasPendingWrites()) {
+      return false;
+    }
+    DatabaseManager::useReadOnlyConnection();
+    try {
+      const ScopedAllocationTag allocationTag(AllocationTag::Database);
+      task();
+    } catch (...) {
+      DatabaseManager::useReadWriteConnection();
+      throw;
+    }
+    DatabaseManager::useReadWriteConnection();
+    return true;
+  }
   void setTasksCancelled(bool tasksCancelled) {
     this->tasksCancelled.store(tasksCancelled);
   }
@@ -15,6 +15,10 @@ public:
       facebook::jni::alias_ref<Runnable> task);
   static void enableMultithreading(
       facebook::jni::alias_ref<GlobalDBSingletonJNIHelper> jThis);
+  static void flushDraftCache(
+      facebook::jni::alias_ref<GlobalDBSingletonJNIHelper> jThis);
+  static void releaseMemory(
+      facebook::jni::alias_ref<GlobalDBSingletonJNIHelper> jThis);
   static void registerNatives();
 };
 } // namespace comm
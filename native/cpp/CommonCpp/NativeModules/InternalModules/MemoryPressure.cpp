@@ -0,0 +1,48 @@
+#include "MemoryPressure.h"
+#include "DraftCache.h"
+#include "GlobalDBSingleton.h"
+#include "MessagePrefetcher.h"
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace comm {
+
+namespace {
+std::mutex handlersMutex;
+std::unordered_map<size_t, MemoryPressure::Handler> handlers;
+size_t nextHandlerID{0};
+} // namespace
+
+void MemoryPressure::onMemoryWarning() {
+  Logger::log("Memory warning, releasing native caches");
+  DraftCache::instance().releaseMemory();
+  MessagePrefetcher::instance().cancel();
+  GlobalDBSingleton::instance.releaseMemory();
+
+  std::vector<Handler> currentHandlers;
+  {
+    std::lock_guard<std::mutex> lock(handlersMutex);
+    for (const auto &handler : handlers) {
+      currentHandlers.push_back(handler.second);
+    }
+  }
+  for (const Handler &handler : currentHandlers) {
+    handler();
+  }
+}
+
+size_t MemoryPressure::addHandler(Handler handler) {
+  std::lock_guard<std::mutex> lock(handlersMutex);
+  size_t handlerID = nextHandlerID++;
+  handlers.emplace(handlerID, std::move(handler));
+  return handlerID;
+}
+
+void MemoryPressure::removeHandler(size_t handlerID) {
+  std::lock_guard<std::mutex> lock(handlersMutex);
+  handlers.erase(handlerID);
+}
+
+} // namespace comm
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+namespace comm {
+
+// Frees what native code keeps cached and can rebuild once the OS warns that
+// memory runs low, on iOS memory warnings and Android onTrimMemory: the page
+// caches and statements of the database connections, messageCache and the
+// drafts cached by DraftCache, and MessagePrefetcher stops reading pages
+// ahead. Refilling the caches costs far less than the app being killed in
+// the background.
+class MemoryPressure {
+public:
+  using Handler = std::function<void()>;
+
+  // Called by platform code, on any thread
+  static void onMemoryWarning();
+  // For caches of objects that come and go, e.g. the crypto sessions of
+  // CommCoreModule. A handler is called on the thread of the warning, so it
+  // schedules the work on the thread that owns the cache.
+  static size_t addHandler(Handler handler);
+  static void removeHandler(size_t handlerID);
+};
+
+} // namespace comm
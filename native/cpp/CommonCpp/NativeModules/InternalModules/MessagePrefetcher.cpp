@@ -0,0 +1,128 @@
+#include "MessagePrefetcher.h"
+#include "../../DatabaseManagers/DatabaseManager.h"
+#include "GlobalDBSingleton.h"
+
+namespace comm {
+
+MessagePrefetcher &MessagePrefetcher::instance() {
+  // Never destroyed, the prefetch tasks outlive the statics
+  static MessagePrefetcher *prefetcher = new MessagePrefetcher();
+  return *prefetcher;
+}
+
+void MessagePrefetcher::reportScroll(
+    const std::optional<std::string> &threadID,
+    bool towardsOlder) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  bool scrollChanged = !this->scrollReported ||
+      this->scrolledThreadID != threadID.value_or("") ||
+      this->scrollingOlder != (threadID && towardsOlder);
+  this->scrollReported = true;
+  this->scrolledThreadID = threadID.value_or("");
+  this->scrollingOlder = threadID && towardsOlder;
+  if (!scrollChanged) {
+    return;
+  }
+  if (!this->scrollingOlder) {
+    this->cancelPrefetch();
+    return;
+  }
+  // The pages after the one last served can be read before the next request
+  if (this->lastThreadID == this->scrolledThreadID && this->lastPageFull) {
+    this->startPrefetch();
+  }
+}
+
+void MessagePrefetcher::onPageServed(
+    const std::string &threadID,
+    int64_t beforeTime,
+    const std::string &beforeMessageID,
+    int pageSize,
+    size_t rowCount,
+    int64_t oldestTime,
+    const std::string &oldestMessageID) {
+  if (pageSize <= 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(this->mutex);
+  bool continuesLastPage = this->lastPageFull &&
+      this->lastThreadID == threadID && this->nextBeforeTime == beforeTime &&
+      this->nextBeforeMessageID == beforeMessageID;
+  this->lastThreadID = threadID;
+  this->nextBeforeTime = oldestTime;
+  this->nextBeforeMessageID = oldestMessageID;
+  this->lastPageSize = pageSize;
+  // A page that isn't full is the oldest one of the thread
+  this->lastPageFull = rowCount >= static_cast<size_t>(pageSize);
+  bool scrollingBack = this->scrollReported
+      ? this->scrollingOlder && this->scrolledThreadID == threadID
+      : continuesLastPage;
+  if (!scrollingBack || !this->lastPageFull) {
+    this->cancelPrefetch();
+    return;
+  }
+  this->startPrefetch();
+}
+
+void MessagePrefetcher::cancel() {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->cancelPrefetch();
+}
+
+void MessagePrefetcher::startPrefetch() {
+  // The pages that are read ahead already are found in the cache and
+  // skipped
+  this->cancelPrefetch();
+  this->prefetchToken = std::make_shared<CancellationToken>();
+  this->schedulePrefetch(
+      this->lastThreadID,
+      this->nextBeforeTime,
+      this->nextBeforeMessageID,
+      this->lastPageSize,
+      MESSAGE_PREFETCH_PAGES,
+      this->prefetchToken);
+}
+
+void MessagePrefetcher::cancelPrefetch() {
+  if (this->prefetchToken != nullptr) {
+    this->prefetchToken->cancel();
+    this->prefetchToken = nullptr;
+  }
+}
+
+void MessagePrefetcher::schedulePrefetch(
+    std::string threadID,
+    int64_t beforeTime,
+    std::string beforeMessageID,
+    int pageSize,
+    int pagesLeft,
+    std::shared_ptr<CancellationToken> token) {
+  GlobalDBSingleton::instance.scheduleBackgroundRead(
+      [this,
+       threadID = std::move(threadID),
+       beforeTime,
+       beforeMessageID = std::move(beforeMessageID),
+       pageSize,
+       pagesLeft,
+       token]() mutable {
+        bool hasNextPage =
+            DatabaseManager::getQueryExecutor().prefetchThreadMessagesBefore(
+                threadID,
+                beforeTime,
+                beforeMessageID,
+                pageSize,
+                MESSAGE_PREFETCH_CACHE_BUDGET);
+        if (hasNextPage && pagesLeft > 1) {
+          this->schedulePrefetch(
+              std::move(threadID),
+              beforeTime,
+              std::move(beforeMessageID),
+              pageSize,
+              pagesLeft - 1,
+              token);
+        }
+      },
+      token);
+}
+
+} // namespace comm
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "../../Tools/CancellationToken.h"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+
+namespace comm {
+
+// Pages of a thread read ahead of the one that JS last requested
+const int MESSAGE_PREFETCH_PAGES{2};
+// Nothing is read ahead once the cache of message pages takes up that many
+// bytes, half of its capacity, so that the pages read ahead don't evict the
+// ones that were requested
+const size_t MESSAGE_PREFETCH_CACHE_BUDGET{2 * 1024 * 1024};
+
+// Reads the pages of messages and media that the message list is about to
+// request from getThreadMessagesBefore into the cache of message pages, so
+// that scrolling back through a long history doesn't wait on SQLCipher. Once
+// a page is served, the next MESSAGE_PREFETCH_PAGES older ones are read on a
+// reader thread at background priority, one task per page, so that the
+// reads that JS waits on come first. That happens for the thread that JS
+// reports being scrolled towards older messages, or, before JS reports
+// anything, if the page continues the one that was served before. Reporting
+// another thread, or scrolling towards newer messages, cancels what's being
+// read ahead, and so does a memory warning.
+class MessagePrefetcher {
+  std::mutex mutex;
+  bool scrollReported{false};
+  std::string scrolledThreadID;
+  bool scrollingOlder{false};
+  // The key that the page after the one last served is read before
+  std::string lastThreadID;
+  int64_t nextBeforeTime{0};
+  std::string nextBeforeMessageID;
+  int lastPageSize{0};
+  bool lastPageFull{false};
+  std::shared_ptr<CancellationToken> prefetchToken;
+
+  MessagePrefetcher() = default;
+  void startPrefetch();
+  void cancelPrefetch();
+  void schedulePrefetch(
+      std::string threadID,
+      int64_t beforeTime,
+      std::string beforeMessageID,
+      int pageSize,
+      int pagesLeft,
+      std::shared_ptr<CancellationToken> token);
+
+public:
+  static MessagePrefetcher &instance();
+
+  // Called by JS while a message list is scrolled, with no thread once
+  // none is shown
+  void reportScroll(
+      const std::optional<std::string> &threadID,
+      bool towardsOlder);
+  // Called on the reader thread once a page has been served, with the key
+  // of its oldest row
+  void onPageServed(
+      const std::string &threadID,
+      int64_t beforeTime,
+      const std::string &beforeMessageID,
+      int pageSize,
+      size_t rowCount,
+      int64_t oldestTime,
+      const std::string &oldestMessageID);
+  void cancel();
+
+  MessagePrefetcher(const MessagePrefetcher &) = delete;
+  MessagePrefetcher &operator=(const MessagePrefetcher &) = delete;
+};
+
+} // namespace comm
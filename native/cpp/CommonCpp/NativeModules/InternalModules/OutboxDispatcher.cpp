@@ -0,0 +1,81 @@
+#include "OutboxDispatcher.h"
+#include "../../DatabaseManagers/DatabaseManager.h"
+#include "../../Tools/Logger.h"
+
+#include <mutex>
+
+namespace comm {
+
+OutboxDispatcher::Batch OutboxDispatcher::take(int batchSize) {
+  static std::once_flag requeued;
+  std::call_once(requeued, []() {
+    // Whether the server got them is unknown, so they are sent again. The
+    // server ignores local IDs it already has.
+    DatabaseManager::getQueryExecutor().requeueOutboxEntries({});
+  });
+  Batch batch;
+  batch.entries =
+      DatabaseManager::getQueryExecutor().takeOutboxBatch(batchSize);
+  return batch;
+}
+
+std::vector<OutboxEntry>
+OutboxDispatcher::encrypt(crypto::CryptoModule *cryptoModule, Batch &batch) {
+  std::vector<OutboxEntry> encryptedEntries;
+  std::vector<OutboxEntry> entries;
+  entries.reserve(batch.entries.size());
+  for (OutboxEntry &entry : batch.entries) {
+    if (entry.target.empty() || entry.encryption_type != -1) {
+      entries.push_back(std::move(entry));
+      continue;
+    }
+    if (cryptoModule == nullptr ||
+        !cryptoModule->hasSessionFor(entry.target)) {
+      batch.failedLocalIDs.push_back(entry.local_id);
+      continue;
+    }
+    try {
+      crypto::EncryptedData encryptedData =
+          cryptoModule->encrypt(entry.target, entry.payload);
+      entry.payload.assign(
+          encryptedData.message.begin(), encryptedData.message.end());
+      entry.encryption_type = static_cast<int>(encryptedData.messageType);
+    } catch (const std::exception &e) {
+      Logger::log(
+          "Failed to encrypt outbox entry " + entry.local_id + ": " +
+          e.what());
+      batch.failedLocalIDs.push_back(entry.local_id);
+      continue;
+    }
+    encryptedEntries.push_back(entry);
+    entries.push_back(std::move(entry));
+  }
+  batch.entries = std::move(entries);
+  return encryptedEntries;
+}
+
+void OutboxDispatcher::store(
+    const std::vector<OutboxEntry> &encryptedEntries,
+    const crypto::Persist &persist,
+    const std::vector<std::string> &failedLocalIDs) {
+  const DatabaseQueryExecutor &executor = DatabaseManager::getQueryExecutor();
+  executor.beginTransaction();
+  try {
+    if (!encryptedEntries.empty()) {
+      executor.updateOutboxPayloads(encryptedEntries);
+    }
+    if (!persist.account.empty() || !persist.sessions.empty()) {
+      executor.storeOlmPersistData(persist);
+    }
+    // Without IDs every entry in flight would be requeued
+    if (!failedLocalIDs.empty()) {
+      executor.requeueOutboxEntries(failedLocalIDs);
+    }
+  } catch (...) {
+    executor.rollbackTransaction();
+    throw;
+  }
+  executor.commitTransaction();
+}
+
+} // namespace comm
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "../../CryptoTools/CryptoModule.h"
+#include "../../CryptoTools/Persist.h"
+#include "../../DatabaseManagers/entities/OutboxEntry.h"
+
+#include <string>
+#include <vector>
+
+namespace comm {
+
+// Entries taken from the outbox by a single dispatch
+const int OUTBOX_DISPATCH_BATCH_SIZE{64};
+
+// Sends the messages of the outbox in batches instead of one at a time. A
+// dispatch takes the oldest queued entries on the database thread, encrypts
+// those addressed to a peer on the crypto thread, and stores the encrypted
+// payloads along with the sessions they advanced before JS sends the batch
+// in one request. Resending an entry then reuses its payload. Once the
+// server acknowledges a batch, its messages are rekeyed in bulk, see
+// acknowledgeOutboxEntries.
+class OutboxDispatcher {
+public:
+  struct Batch {
+    std::vector<OutboxEntry> entries;
+    // Requeued instead of sent, e.g. as there is no session with the peer
+    std::vector<std::string> failedLocalIDs;
+  };
+
+  // Runs on the database thread. The first dispatch of the process also
+  // requeues the entries left in flight by the previous one.
+  static Batch take(int batchSize);
+  // Runs on the crypto thread. Encrypts the payloads that need it, and
+  // moves the entries that couldn't be encrypted to failedLocalIDs. Returns
+  // the entries that were encrypted.
+  static std::vector<OutboxEntry>
+  encrypt(crypto::CryptoModule *cryptoModule, Batch &batch);
+  // Runs on the database thread, in one transaction
+  static void store(
+      const std::vector<OutboxEntry> &encryptedEntries,
+      const crypto::Persist &persist,
+      const std::vector<std::string> &failedLocalIDs);
+};
+
+} // namespace comm
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "../../Tools/AllocationTracker.h"
+#include "../../Tools/Trace.h"
+#include <ReactCommon/CallInvoker.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace comm {
+
+// Marks the time that the callbacks of a call wait for the JS thread and run
+// on it, they are mostly the conversion of its results to JS values, and
+// attributes their allocations to the conversion
+class TraceCallInvoker : public facebook::react::CallInvoker {
+  const std::shared_ptr<facebook::react::CallInvoker> jsInvoker;
+
+public:
+  explicit TraceCallInvoker(
+      std::shared_ptr<facebook::react::CallInvoker> jsInvoker)
+      : jsInvoker(std::move(jsInvoker)) {
+  }
+
+  void invokeAsync(std::function<void()> &&func) override {
+    if (AllocationTracker::isEnabled()) {
+      std::function<void()> untagged = std::move(func);
+      func = [untagged = std::move(untagged)]() {
+        const ScopedAllocationTag allocationTag(AllocationTag::JSIConversion);
+        untagged();
+      };
+    }
+    if (!Trace::isEnabled()) {
+      this->jsInvoker->invokeAsync(std::move(func));
+      return;
+    }
+    const char *callName = TraceCall::current();
+    std::string sectionName = TraceCall::sectionName("js queue");
+    int32_t cookie = Trace::nextAsyncCookie();
+    Trace::beginAsyncSection(sectionName, cookie);
+    this->jsInvoker->invokeAsync(
+        [func = std::move(func), callName, sectionName, cookie]() {
+          Trace::endAsyncSection(sectionName, cookie);
+          TraceCallScope callScope(callName);
+          TraceSection section(TraceCall::sectionName("jsi"));
+          func();
+        });
+  }
+
+  void invokeSync(std::function<void()> &&func) override {
+    this->jsInvoker->invokeSync(std::move(func));
+  }
+};
+
+} // namespace comm
@@ -0,0 +1,431 @@
+#include "JSIConversions.h"
+
+#include <algorithm>
+#include <array>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+
+namespace comm {
+
+namespace {
+
+// Fields of the rows converted to JS, named as in JSI_FIELD_NAMES
+enum class JSIField {
+  id,
+  localID,
+  thread,
+  user,
+  type,
+  futureType,
+  content,
+  time,
+  mediaInfos,
+  uri,
+  extras,
+  key,
+  text,
+  name,
+  description,
+  color,
+  creationTime,
+  parentThreadID,
+  containingThreadID,
+  community,
+  members,
+  roles,
+  currentUser,
+  sourceMessageID,
+  repliesCount,
+  count,
+};
+
+const std::array<const char *, static_cast<size_t>(JSIField::count)>
+    JSI_FIELD_NAMES{
+        "id",
+        "local_id",
+        "thread",
+        "user",
+        "type",
+        "future_type",
+        "content",
+        "time",
+        "media_infos",
+        "uri",
+        "extras",
+        "key",
+        "text",
+        "name",
+        "description",
+        "color",
+        "creationTime",
+        "parentThreadID",
+        "containingThreadID",
+        "community",
+        "members",
+        "roles",
+        "currentUser",
+        "sourceMessageID",
+        "repliesCount",
+    };
+
+// Converting a batch of rows would create a PropNameID per field of every
+// row, and the same few thread and user IDs over and over. The context
+// creates each name once, and each interned string once per distinct value,
+// and reuses them for the rest of the batch. Interned values have to
+// outlive the context.
+class JSIConversionContext {
+  jsi::Runtime &rt;
+  std::array<
+      std::optional<jsi::PropNameID>,
+      static_cast<size_t>(JSIField::count)>
+      names;
+  std::unordered_map<std::string_view, jsi::String> strings;
+
+public:
+  explicit JSIConversionContext(jsi::Runtime &rt) : rt(rt) {
+  }
+
+  const jsi::PropNameID &name(JSIField field) {
+    std::optional<jsi::PropNameID> &name =
+        this->names[static_cast<size_t>(field)];
+    if (!name) {
+      name.emplace(jsi::PropNameID::forAscii(
+          this->rt, JSI_FIELD_NAMES[static_cast<size_t>(field)]));
+    }
+    return *name;
+  }
+
+  jsi::Value intern(const std::string &value) {
+    auto it = this->strings.find(value);
+    if (it == this->strings.end()) {
+      it = this->strings
+               .emplace(value, jsi::String::createFromUtf8(this->rt, value))
+               .first;
+    }
+    return jsi::Value(this->rt, it->second);
+  }
+
+  // Takes any nullable pointer to a string, null giving null
+  template <typename T> jsi::Value internNullable(const T &value) {
+    return value ? this->intern(*value) : jsi::Value::null();
+  }
+};
+
+jsi::Object parseDBMedia(
+    jsi::Runtime &rt,
+    JSIConversionContext &context,
+    const std::string &id,
+    const std::string &uri,
+    const std::string &type,
+    const std::string &extras) {
+  auto jsiMedia = jsi::Object(rt);
+  jsiMedia.setProperty(rt, context.name(JSIField::id), id);
+  jsiMedia.setProperty(rt, context.name(JSIField::uri), uri);
+  jsiMedia.setProperty(rt, context.name(JSIField::type), context.intern(type));
+  jsiMedia.setProperty(rt, context.name(JSIField::extras), extras);
+  return jsiMedia;
+}
+
+const std::string UPDATE_DRAFT_OPERATION = "update";
+const std::string MOVE_DRAFT_OPERATION = "move";
+const std::string REMOVE_ALL_DRAFTS_OPERATION = "remove_all";
+
+} // namespace
+
+jsi::Array parseDBDrafts(
+    jsi::Runtime &rt,
+    std::shared_ptr<std::vector<Draft>> draftsVectorPtr) {
+  size_t numDrafts = count_if(
+      draftsVectorPtr->begin(), draftsVectorPtr->end(), [](Draft draft) {
+        return !draft.text.empty();
+      });
+  JSIConversionContext context(rt);
+  jsi::Array jsiDrafts = jsi::Array(rt, numDrafts);
+
+  size_t writeIndex = 0;
+  for (const Draft &draft : *draftsVectorPtr) {
+    if (draft.text.empty()) {
+      continue;
+    }
+    auto jsiDraft = jsi::Object(rt);
+    jsiDraft.setProperty(rt, context.name(JSIField::key), draft.key);
+    jsiDraft.setProperty(rt, context.name(JSIField::text), draft.text);
+    jsiDrafts.setValueAtIndex(rt, writeIndex++, jsiDraft);
+  }
+  return jsiDrafts;
+}
+
+jsi::Array parseDBMessages(
+    jsi::Runtime &rt,
+    std::shared_ptr<std::vector<std::pair<Message, std::vector<Media>>>>
+        messagesVectorPtr,
+    JSIProtocol protocol) {
+  JSIConversionContext context(rt);
+  size_t numMessages = messagesVectorPtr->size();
+  jsi::Array jsiMessages = jsi::Array(rt, numMessages);
+  size_t writeIndex = 0;
+  for (const auto &[message, media] : *messagesVectorPtr) {
+    auto jsiMessage = jsi::Object(rt);
+    jsiMessage.setProperty(rt, context.name(JSIField::id), message.id);
+
+    if (message.local_id) {
+      jsiMessage.setProperty(
+          rt, context.name(JSIField::localID), *message.local_id);
+    }
+
+    jsiMessage.setProperty(
+        rt, context.name(JSIField::thread), context.intern(message.thread));
+    jsiMessage.setProperty(
+        rt, context.name(JSIField::user), context.intern(message.user));
+    jsiMessage.setProperty(
+        rt,
+        context.name(JSIField::type),
+        toJSINumber(rt, message.type, protocol));
+
+    if (message.future_type) {
+      jsiMessage.setProperty(
+          rt,
+          context.name(JSIField::futureType),
+          toJSINumber(rt, *message.future_type, protocol));
+    }
+
+    if (message.content) {
+      jsiMessage.setProperty(
+          rt, context.name(JSIField::content), *message.content);
+    }
+
+    jsiMessage.setProperty(
+        rt,
+        context.name(JSIField::time),
+        toJSINumber(rt, message.time, protocol));
+
+    size_t media_idx = 0;
+    jsi::Array jsiMediaArray = jsi::Array(rt, media.size());
+    for (const auto &media_info : media) {
+      jsiMediaArray.setValueAtIndex(
+          rt,
+          media_idx++,
+          parseDBMedia(
+              rt,
+              context,
+              media_info.id,
+              media_info.uri,
+              media_info.type,
+              media_info.extras));
+    }
+
+    jsiMessage.setProperty(
+        rt, context.name(JSIField::mediaInfos), jsiMediaArray);
+
+    jsiMessages.setValueAtIndex(rt, writeIndex++, jsiMessage);
+  }
+  return jsiMessages;
+}
+
+jsi::Array parseDBMessages(
+    jsi::Runtime &rt,
+    std::shared_ptr<CompactMessageStore> store,
+    JSIProtocol protocol) {
+  JSIConversionContext context(rt);
+  jsi::Array jsiMessages = jsi::Array(rt, store->messages.size());
+  size_t writeIndex = 0;
+  for (const CompactMessage &message : store->messages) {
+    auto jsiMessage = jsi::Object(rt);
+    jsiMessage.setProperty(rt, context.name(JSIField::id), message.id);
+    if (message.local_id) {
+      jsiMessage.setProperty(
+          rt, context.name(JSIField::localID), *message.local_id);
+    }
+    jsiMessage.setProperty(
+        rt,
+        context.name(JSIField::thread),
+        context.internNullable(message.thread));
+    jsiMessage.setProperty(
+        rt, context.name(JSIField::user), context.internNullable(message.user));
+    jsiMessage.setProperty(
+        rt,
+        context.name(JSIField::type),
+        toJSINumber(rt, message.type, protocol));
+    if (message.future_type) {
+      jsiMessage.setProperty(
+          rt,
+          context.name(JSIField::futureType),
+          toJSINumber(rt, *message.future_type, protocol));
+    }
+    if (message.content) {
+      jsiMessage.setProperty(
+          rt, context.name(JSIField::content), *message.content);
+    }
+    jsiMessage.setProperty(
+        rt,
+        context.name(JSIField::time),
+        toJSINumber(rt, message.time, protocol));
+
+    jsi::Array jsiMediaArray =
+        jsi::Array(rt, message.media_end - message.media_begin);
+    for (uint32_t i = message.media_begin; i < message.media_end; i++) {
+      const CompactMedia &media_info = store->media[i];
+      jsiMediaArray.setValueAtIndex(
+          rt,
+          i - message.media_begin,
+          parseDBMedia(
+              rt,
+              context,
+              media_info.id,
+              media_info.uri,
+              media_info.type,
+              media_info.extras));
+    }
+    jsiMessage.setProperty(
+        rt, context.name(JSIField::mediaInfos), jsiMediaArray);
+
+    jsiMessages.setValueAtIndex(rt, writeIndex++, jsiMessage);
+  }
+  return jsiMessages;
+}
+
+jsi::Array parseDBThreads(
+    jsi::Runtime &rt,
+    std::shared_ptr<CompactThreadStore> store,
+    bool includeMembership,
+    JSIProtocol protocol) {
+  auto optionalString = [&rt](const std::optional<std::string> &value) {
+    return value ? jsi::Value(jsi::String::createFromUtf8(rt, *value))
+                 : jsi::Value::null();
+  };
+  JSIConversionContext context(rt);
+  jsi::Array jsiThreads = jsi::Array(rt, store->threads.size());
+  size_t writeIdx = 0;
+  for (const CompactThread &thread : store->threads) {
+    jsi::Object jsiThread = jsi::Object(rt);
+    jsiThread.setProperty(rt, context.name(JSIField::id), thread.id);
+    jsiThread.setProperty(rt, context.name(JSIField::type), thread.type);
+    jsiThread.setProperty(
+        rt, context.name(JSIField::name), optionalString(thread.name));
+    jsiThread.setProperty(
+        rt,
+        context.name(JSIField::description),
+        optionalString(thread.description));
+    jsiThread.setProperty(rt, context.name(JSIField::color), thread.color);
+    jsiThread.setProperty(
+        rt,
+        context.name(JSIField::creationTime),
+        toJSINumber(rt, thread.creation_time, protocol));
+    jsiThread.setProperty(
+        rt,
+        context.name(JSIField::parentThreadID),
+        context.internNullable(thread.parent_thread_id));
+    jsiThread.setProperty(
+        rt,
+        context.name(JSIField::containingThreadID),
+        context.internNullable(thread.containing_thread_id));
+    jsiThread.setProperty(
+        rt,
+        context.name(JSIField::community),
+        context.internNullable(thread.community));
+    if (includeMembership) {
+      jsiThread.setProperty(
+          rt, context.name(JSIField::members), thread.members);
+      jsiThread.setProperty(rt, context.name(JSIField::roles), thread.roles);
+    }
+    jsiThread.setProperty(
+        rt, context.name(JSIField::currentUser), thread.current_user);
+    jsiThread.setProperty(
+        rt,
+        context.name(JSIField::sourceMessageID),
+        optionalString(thread.source_message_id));
+    jsiThread.setProperty(
+        rt, context.name(JSIField::repliesCount), thread.replies_count);
+
+    jsiThreads.setValueAtIndex(rt, writeIdx++, jsiThread);
+  }
+  return jsiThreads;
+}
+
+jsi::Array parseDBThreads(
+    jsi::Runtime &rt,
+    std::shared_ptr<std::vector<Thread>> threadsVectorPtr,
+    bool includeMembership,
+    JSIProtocol protocol) {
+  auto optionalString = [&rt](const std::unique_ptr<std::string> &value) {
+    return value ? jsi::Value(jsi::String::createFromUtf8(rt, *value))
+                 : jsi::Value::null();
+  };
+  JSIConversionContext context(rt);
+  size_t numThreads = threadsVectorPtr->size();
+  jsi::Array jsiThreads = jsi::Array(rt, numThreads);
+  size_t writeIdx = 0;
+  for (const Thread &thread : *threadsVectorPtr) {
+    jsi::Object jsiThread = jsi::Object(rt);
+    jsiThread.setProperty(rt, context.name(JSIField::id), thread.id);
+    jsiThread.setProperty(rt, context.name(JSIField::type), thread.type);
+    jsiThread.setProperty(
+        rt, context.name(JSIField::name), optionalString(thread.name));
+    jsiThread.setProperty(
+        rt,
+        context.name(JSIField::description),
+        optionalString(thread.description));
+    jsiThread.setProperty(rt, context.name(JSIField::color), thread.color);
+    jsiThread.setProperty(
+        rt,
+        context.name(JSIField::creationTime),
+        toJSINumber(rt, thread.creation_time, protocol));
+    jsiThread.setProperty(
+        rt,
+        context.name(JSIField::parentThreadID),
+        context.internNullable(thread.parent_thread_id));
+    jsiThread.setProperty(
+        rt,
+        context.name(JSIField::containingThreadID),
+        context.internNullable(thread.containing_thread_id));
+    jsiThread.setProperty(
+        rt,
+        context.name(JSIField::community),
+        context.internNullable(thread.community));
+    if (includeMembership) {
+      jsiThread.setProperty(
+          rt, context.name(JSIField::members), thread.members);
+      jsiThread.setProperty(rt, context.name(JSIField::roles), thread.roles);
+    }
+    jsiThread.setProperty(
+        rt, context.name(JSIField::currentUser), thread.current_user);
+    jsiThread.setProperty(
+        rt,
+        context.name(JSIField::sourceMessageID),
+        optionalString(thread.source_message_id));
+    jsiThread.setProperty(
+        rt, context.name(JSIField::repliesCount), thread.replies_count);
+
+    jsiThreads.setValueAtIndex(rt, writeIdx++, jsiThread);
+  }
+  return jsiThreads;
+}
+
+std::vector<std::unique_ptr<DraftStoreOperationBase>>
+createDraftStoreOperations(jsi::Runtime &rt, const jsi::Array &operations) {
+  std::vector<std::unique_ptr<DraftStoreOperationBase>> draftStoreOps;
+  for (auto idx = 0; idx < operations.size(rt); idx++) {
+    auto op = operations.getValueAtIndex(rt, idx).asObject(rt);
+    auto op_type = op.getProperty(rt, "type").asString(rt).utf8(rt);
+
+    if (op_type == REMOVE_ALL_DRAFTS_OPERATION) {
+      draftStoreOps.push_back(std::make_unique<RemoveAllDraftsOperation>());
+      continue;
+    }
+
+    auto payload_obj = op.getProperty(rt, "payload").asObject(rt);
+    if (op_type == UPDATE_DRAFT_OPERATION) {
+      draftStoreOps.push_back(
+          std::make_unique<UpdateDraftOperation>(rt, payload_obj));
+    } else if (op_type == MOVE_DRAFT_OPERATION) {
+      draftStoreOps.push_back(
+          std::make_unique<MoveDraftOperation>(rt, payload_obj));
+    } else {
+      throw std::runtime_error("unsupported operation: " + op_type);
+    }
+  }
+  return draftStoreOps;
+}
+
+} // namespace comm
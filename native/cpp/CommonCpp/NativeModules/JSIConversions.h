@@ -0,0 +1,57 @@
+#pragma once
+
+#include "../DatabaseManagers/CompactStore.h"
+#include "../DatabaseManagers/entities/Draft.h"
+#include "../DatabaseManagers/entities/Media.h"
+#include "../DatabaseManagers/entities/Message.h"
+#include "../DatabaseManagers/entities/Thread.h"
+#include "DatabaseManager.h"
+#include "JSIProtocol.h"
+// Relies on the declarations above
+#include "DraftStoreOperations.h"
+
+#include <jsi/jsi.h>
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace comm {
+
+namespace jsi = facebook::jsi;
+
+// Conversions of the rows read from the database to the objects that JS
+// stores expect, and of the operations JS sends back. They run on the JS
+// thread, so they are kept apart from CommCoreModule to be measured on
+// their own.
+jsi::Array parseDBDrafts(
+    jsi::Runtime &rt,
+    std::shared_ptr<std::vector<Draft>> draftsVectorPtr);
+
+jsi::Array parseDBMessages(
+    jsi::Runtime &rt,
+    std::shared_ptr<std::vector<std::pair<Message, std::vector<Media>>>>
+        messagesVectorPtr,
+    JSIProtocol protocol = JSIProtocol::strings);
+
+jsi::Array parseDBMessages(
+    jsi::Runtime &rt,
+    std::shared_ptr<CompactMessageStore> store,
+    JSIProtocol protocol = JSIProtocol::strings);
+
+jsi::Array parseDBThreads(
+    jsi::Runtime &rt,
+    std::shared_ptr<CompactThreadStore> store,
+    bool includeMembership,
+    JSIProtocol protocol = JSIProtocol::strings);
+
+jsi::Array parseDBThreads(
+    jsi::Runtime &rt,
+    std::shared_ptr<std::vector<Thread>> threadsVectorPtr,
+    bool includeMembership = true,
+    JSIProtocol protocol = JSIProtocol::strings);
+
+std::vector<std::unique_ptr<DraftStoreOperationBase>>
+createDraftStoreOperations(jsi::Runtime &rt, const jsi::Array &operations);
+
+} // namespace comm
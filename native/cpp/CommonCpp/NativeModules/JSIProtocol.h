@@ -0,0 +1,68 @@
+#pragma once
+
+#include <folly/dynamic.h>
+#include <jsi/jsi.h>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+namespace comm {
+
+namespace jsi = facebook::jsi;
+
+// Versions of the shape of the rows crossing JSI. Reads opt into a version
+// per call, and use JSIProtocol::strings if they don't. Writes accept both
+// versions, telling them apart by the type of each value.
+enum class JSIProtocol {
+  // Numeric columns as strings, e.g. "time": "1671024000000"
+  strings = 1,
+  // Numeric columns as numbers, which spares converting them to strings and
+  // back on both sides. Times in milliseconds are far below 2^53, so they
+  // are represented exactly.
+  typed = 2,
+};
+
+inline JSIProtocol
+parseJSIProtocol(jsi::Runtime &rt, std::optional<double> version) {
+  if (!version || *version == static_cast<double>(JSIProtocol::strings)) {
+    return JSIProtocol::strings;
+  }
+  if (*version == static_cast<double>(JSIProtocol::typed)) {
+    return JSIProtocol::typed;
+  }
+  throw jsi::JSError(
+      rt, "Unsupported JSI protocol version " + std::to_string(*version));
+}
+
+inline jsi::Value
+toJSINumber(jsi::Runtime &rt, int64_t value, JSIProtocol protocol) {
+  if (protocol == JSIProtocol::typed) {
+    return jsi::Value(static_cast<double>(value));
+  }
+  return jsi::String::createFromUtf8(rt, std::to_string(value));
+}
+
+inline bool isJSINumber(const jsi::Value &value) {
+  return value.isNumber() || value.isString();
+}
+
+inline int64_t parseJSINumber(jsi::Runtime &rt, const jsi::Value &value) {
+  if (value.isNumber()) {
+    return static_cast<int64_t>(value.asNumber());
+  }
+  return std::stoll(value.asString(rt).utf8(rt));
+}
+
+inline bool isJSINumber(const folly::dynamic &value) {
+  return value.isNumber() || value.isString();
+}
+
+inline int64_t parseJSINumber(const folly::dynamic &value) {
+  if (value.isNumber()) {
+    return value.asInt();
+  }
+  return std::stoll(value.getString());
+}
+
+} // namespace comm
@@ -3,6 +3,8 @@
 #include "../DatabaseManagers/entities/Media.h"
 #include "../DatabaseManagers/entities/Message.h"
 #include "DatabaseManager.h"
+#include "JSIProtocol.h"
+#include <folly/dynamic.h>
 #include <vector>
 
 namespace comm {
@@ -23,10 +25,28 @@ public:
     }
   }
 
+  RemoveMessagesOperation(std::vector<std::string> ids)
+      : msg_ids_to_remove{std::move(ids)} {
+  }
+
+  RemoveMessagesOperation(const folly::dynamic &payload)
+      : msg_ids_to_remove{} {
+    for (const auto &id : payload["ids"]) {
+      this->msg_ids_to_remove.push_back(id.getString());
+    }
+  }
+
   virtual void execute() override {
     DatabaseManager::getQueryExecutor().removeMessages(this->msg_ids_to_remove);
-    DatabaseManager::getQueryExecutor().removeMediaForMessages(
-        this->msg_ids_to_remove);
+  }
+
+  const std::vector<std::string> &getIDs() const {
+    return this->msg_ids_to_remove;
+  }
+
+  void addIDs(const std::vector<std::string> &ids) {
+    this->msg_ids_to_remove.insert(
+        this->msg_ids_to_remove.end(), ids.begin(), ids.end());
   }
 
 private:
@@ -47,10 +67,16 @@ public:
     }
   }
 
+  RemoveMessagesForThreadsOperation(const folly::dynamic &payload)
+      : thread_ids{} {
+    for (const auto &id : payload["threadIDs"]) {
+      this->thread_ids.push_back(id.getString());
+    }
+  }
+
   virtual void execute() override {
     DatabaseManager::getQueryExecutor().removeMessagesForThreads(
         this->thread_ids);
-    DatabaseManager::getQueryExecutor().removeMediaForThreads(this->thread_ids);
   }
 
 private:
@@ -71,13 +97,13 @@ public:
 
     auto thread = payload.getProperty(rt, "thread").asString(rt).utf8(rt);
     auto user = payload.getProperty(rt, "user").asString(rt).utf8(rt);
-    auto type =
-        std::stoi(payload.getProperty(rt, "type").asString(rt).utf8(rt));
+    auto type = static_cast<int>(
+        parseJSINumber(rt, payload.getProperty(rt, "type")));
 
     auto maybe_future_type = payload.getProperty(rt, "future_type");
-    auto future_type = maybe_future_type.isString()
+    auto future_type = isJSINumber(maybe_future_type)
         ? std::make_unique<int>(
-              std::stoi(maybe_future_type.asString(rt).utf8(rt)))
+              static_cast<int>(parseJSINumber(rt, maybe_future_type)))
         : nullptr;
 
     auto maybe_content = payload.getProperty(rt, "content");
@@ -85,8 +111,7 @@ public:
         ? std::make_unique<std::string>(maybe_content.asString(rt).utf8(rt))
         : nullptr;
 
-    auto time =
-        std::stoll(payload.getProperty(rt, "time").asString(rt).utf8(rt));
+    auto time = parseJSINumber(rt, payload.getProperty(rt, "time"));
 
     this->msg = std::make_unique<Message>(Message{
         msg_id,
@@ -114,23 +139,75 @@ public:
         auto media_extras =
             media_info.getProperty(rt, "extras").asString(rt).utf8(rt);
 
-        this->media_vector.push_back(std::make_unique<Media>(Media{
-            media_id, msg_id, thread, media_uri, media_type, media_extras}));
+        this->media_vector.push_back(Media{
+            media_id, msg_id, thread, media_uri, media_type, media_extras});
+      }
+    }
+  }
+
+  ReplaceMessageOperation(const folly::dynamic &payload) : media_vector{} {
+    auto msg_id = payload["id"].getString();
+
+    auto maybe_local_id = payload.get_ptr("local_id");
+    auto local_id = maybe_local_id && maybe_local_id->isString()
+        ? std::make_unique<std::string>(maybe_local_id->getString())
+        : nullptr;
+
+    auto thread = payload["thread"].getString();
+    auto user = payload["user"].getString();
+    auto type = static_cast<int>(parseJSINumber(payload["type"]));
+
+    auto maybe_future_type = payload.get_ptr("future_type");
+    auto future_type = maybe_future_type && isJSINumber(*maybe_future_type)
+        ? std::make_unique<int>(
+              static_cast<int>(parseJSINumber(*maybe_future_type)))
+        : nullptr;
+
+    auto maybe_content = payload.get_ptr("content");
+    auto content = maybe_content && maybe_content->isString()
+        ? std::make_unique<std::string>(maybe_content->getString())
+        : nullptr;
+
+    auto time = parseJSINumber(payload["time"]);
+
+    this->msg = std::make_unique<Message>(Message{
+        msg_id,
+        std::move(local_id),
+        thread,
+        user,
+        type,
+        std::move(future_type),
+        std::move(content),
+        time});
+
+    auto media_infos = payload.get_ptr("media_infos");
+    if (media_infos && media_infos->isArray()) {
+      for (const auto &media_info : *media_infos) {
+        this->media_vector.push_back(Media{
+            media_info["id"].getString(),
+            msg_id,
+            thread,
+            media_info["uri"].getString(),
+            media_info["type"].getString(),
+            media_info["extras"].getString()});
       }
     }
   }
 
   virtual void execute() override {
+    // Replacing the message would remove the new media along with the old
     DatabaseManager::getQueryExecutor().removeMediaForMessage(msg->id);
-    for (auto &&media : this->media_vector) {
-      DatabaseManager::getQueryExecutor().replaceMedia(std::move(*media));
-    }
     DatabaseManager::getQueryExecutor().replaceMessage(std::move(*this->msg));
+    DatabaseManager::getQueryExecutor().replaceMediaBatch(this->media_vector);
+  }
+
+  const std::string &getMessageID() const {
+    return this->msg->id;
   }
 
 private:
   std::unique_ptr<Message> msg;
-  std::vector<std::unique_ptr<Media>> media_vector;
+  std::vector<Media> media_vector;
 };
 
 class RekeyMessageOperation : public MessageStoreOperationBase {
@@ -140,12 +217,21 @@ public:
     this->to = payload.getProperty(rt, "to").asString(rt).utf8(rt);
   }
 
+  RekeyMessageOperation(const folly::dynamic &payload) {
+    this->from = payload["from"].getString();
+    this->to = payload["to"].getString();
+  }
+
   virtual void execute() override {
     DatabaseManager::getQueryExecutor().rekeyMessage(this->from, this->to);
     DatabaseManager::getQueryExecutor().rekeyMediaContainers(
         this->from, this->to);
   }
 
+  const std::string &getFrom() const {
+    return this->from;
+  }
+
 private:
   std::string from;
   std::string to;
@@ -154,8 +240,9 @@ private:
 class RemoveAllMessagesOperation : public MessageStoreOperationBase {
 public:
   virtual void execute() override {
-    DatabaseManager::getQueryExecutor().removeAllMessages();
+    // Media first, so that removing the messages has none left to cascade to
     DatabaseManager::getQueryExecutor().removeAllMedia();
+    DatabaseManager::getQueryExecutor().removeAllMessages();
   }
 };
 
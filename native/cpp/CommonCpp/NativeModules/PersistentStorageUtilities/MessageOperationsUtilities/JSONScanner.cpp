@@ -0,0 +1,351 @@
+#include "JSONScanner.h"
+
+#include <cstring>
+
+namespace comm {
+
+namespace {
+// folly::parseJson's default recursion limit
+const int max_nesting_depth = 100;
+// Longer integers may not fit into int64_t, and folly doesn't parse them
+// into one
+const size_t max_integer_digits = 18;
+
+bool is_digit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+void append_utf8(std::string &value, uint32_t codePoint) {
+  if (codePoint < 0x80) {
+    value.push_back(static_cast<char>(codePoint));
+  } else if (codePoint < 0x800) {
+    value.push_back(static_cast<char>(0xC0 | (codePoint >> 6)));
+    value.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+  } else if (codePoint < 0x10000) {
+    value.push_back(static_cast<char>(0xE0 | (codePoint >> 12)));
+    value.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+    value.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+  } else {
+    value.push_back(static_cast<char>(0xF0 | (codePoint >> 18)));
+    value.push_back(static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F)));
+    value.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+    value.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+  }
+}
+} // namespace
+
+JSONScanner::JSONScanner(folly::StringPiece json)
+    : position(json.begin()), end(json.end()) {
+}
+
+bool JSONScanner::fail() {
+  this->failed = true;
+  this->position = this->end;
+  return false;
+}
+
+void JSONScanner::skipWhitespace() {
+  while (this->position != this->end &&
+         (*this->position == ' ' || *this->position == '\n' ||
+          *this->position == '\t' || *this->position == '\r')) {
+    this->position++;
+  }
+}
+
+bool JSONScanner::atEnd() {
+  this->skipWhitespace();
+  return !this->failed && this->position == this->end;
+}
+
+bool JSONScanner::beginArray() {
+  this->skipWhitespace();
+  if (this->failed || this->position == this->end ||
+      *this->position != '[') {
+    return false;
+  }
+  this->position++;
+  return true;
+}
+
+bool JSONScanner::beginObject() {
+  this->skipWhitespace();
+  if (this->failed || this->position == this->end ||
+      *this->position != '{') {
+    return false;
+  }
+  this->position++;
+  return true;
+}
+
+bool JSONScanner::nextElement(bool &first) {
+  this->skipWhitespace();
+  if (this->failed || this->position == this->end) {
+    return this->fail();
+  }
+  if (*this->position == ']') {
+    this->position++;
+    return false;
+  }
+  if (!first) {
+    if (*this->position != ',') {
+      return this->fail();
+    }
+    this->position++;
+  }
+  first = false;
+  return true;
+}
+
+bool JSONScanner::nextMember(bool &first, std::string &key) {
+  this->skipWhitespace();
+  if (this->failed || this->position == this->end) {
+    return this->fail();
+  }
+  if (*this->position == '}') {
+    this->position++;
+    return false;
+  }
+  if (!first) {
+    if (*this->position != ',') {
+      return this->fail();
+    }
+    this->position++;
+  }
+  first = false;
+  if (!this->readString(key)) {
+    return this->fail();
+  }
+  this->skipWhitespace();
+  if (this->position == this->end || *this->position != ':') {
+    return this->fail();
+  }
+  this->position++;
+  return true;
+}
+
+bool JSONScanner::readHex(uint32_t &value) {
+  if (this->end - this->position < 4) {
+    return this->fail();
+  }
+  value = 0;
+  for (int i = 0; i < 4; i++) {
+    char c = *this->position++;
+    value <<= 4;
+    if (is_digit(c)) {
+      value |= c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      value |= c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      value |= c - 'A' + 10;
+    } else {
+      return this->fail();
+    }
+  }
+  return true;
+}
+
+bool JSONScanner::readString(std::string &value) {
+  this->skipWhitespace();
+  if (this->failed || this->position == this->end ||
+      *this->position != '"') {
+    return false;
+  }
+  this->position++;
+  value.clear();
+  while (true) {
+    // Runs of plain characters are copied at once
+    const char *run = this->position;
+    while (this->position != this->end && *this->position != '"' &&
+           *this->position != '\\' &&
+           static_cast<unsigned char>(*this->position) >= 0x20) {
+      this->position++;
+    }
+    value.append(run, this->position - run);
+    if (this->position == this->end) {
+      return this->fail();
+    }
+    char c = *this->position++;
+    if (c == '"') {
+      return true;
+    }
+    if (c != '\\' || this->position == this->end) {
+      // Control characters have to be escaped
+      return this->fail();
+    }
+    char escaped = *this->position++;
+    switch (escaped) {
+      case '"':
+      case '\\':
+      case '/':
+        value.push_back(escaped);
+        break;
+      case 'b':
+        value.push_back('\b');
+        break;
+      case 'f':
+        value.push_back('\f');
+        break;
+      case 'n':
+        value.push_back('\n');
+        break;
+      case 'r':
+        value.push_back('\r');
+        break;
+      case 't':
+        value.push_back('\t');
+        break;
+      case 'u': {
+        uint32_t codePoint;
+        if (!this->readHex(codePoint)) {
+          return false;
+        }
+        if (codePoint >= 0xDC00 && codePoint <= 0xDFFF) {
+          return this->fail();
+        }
+        if (codePoint >= 0xD800 && codePoint <= 0xDBFF) {
+          uint32_t low;
+          if (this->end - this->position < 2 || this->position[0] != '\\' ||
+              this->position[1] != 'u') {
+            return this->fail();
+          }
+          this->position += 2;
+          if (!this->readHex(low)) {
+            return false;
+          }
+          if (low < 0xDC00 || low > 0xDFFF) {
+            return this->fail();
+          }
+          codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+        }
+        append_utf8(value, codePoint);
+        break;
+      }
+      default:
+        return this->fail();
+    }
+  }
+}
+
+bool JSONScanner::readInt(int64_t &value) {
+  this->skipWhitespace();
+  if (this->failed) {
+    return false;
+  }
+  const char *p = this->position;
+  bool negative = p != this->end && *p == '-';
+  if (negative) {
+    p++;
+  }
+  const char *digits = p;
+  while (p != this->end && is_digit(*p)) {
+    p++;
+  }
+  size_t length = p - digits;
+  if (length == 0 || length > max_integer_digits ||
+      (length > 1 && *digits == '0')) {
+    return false;
+  }
+  if (p != this->end && (*p == '.' || *p == 'e' || *p == 'E')) {
+    return false;
+  }
+  int64_t result = 0;
+  for (const char *digit = digits; digit != p; digit++) {
+    result = result * 10 + (*digit - '0');
+  }
+  value = negative ? -result : result;
+  this->position = p;
+  return true;
+}
+
+bool JSONScanner::skipValue() {
+  return this->skipValue(0);
+}
+
+bool JSONScanner::skipValue(int depth) {
+  this->skipWhitespace();
+  if (this->failed || this->position == this->end) {
+    return this->fail();
+  }
+  if (depth >= max_nesting_depth) {
+    return this->fail();
+  }
+  char c = *this->position;
+  if (c == '"') {
+    std::string ignored;
+    return this->readString(ignored);
+  }
+  if (c == '[') {
+    this->position++;
+    bool first = true;
+    while (this->nextElement(first)) {
+      if (!this->skipValue(depth + 1)) {
+        return false;
+      }
+    }
+    return !this->failed;
+  }
+  if (c == '{') {
+    this->position++;
+    bool first = true;
+    std::string key;
+    while (this->nextMember(first, key)) {
+      if (!this->skipValue(depth + 1)) {
+        return false;
+      }
+    }
+    return !this->failed;
+  }
+  for (const char *literal : {"true", "false", "null"}) {
+    size_t length = std::strlen(literal);
+    if (static_cast<size_t>(this->end - this->position) >= length &&
+        std::memcmp(this->position, literal, length) == 0) {
+      this->position += length;
+      return true;
+    }
+  }
+  // Numbers: -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+  const char *p = this->position;
+  if (p != this->end && *p == '-') {
+    p++;
+  }
+  const char *digits = p;
+  while (p != this->end && is_digit(*p)) {
+    p++;
+  }
+  size_t length = p - digits;
+  if (length == 0 || (length > 1 && *digits == '0')) {
+    return this->fail();
+  }
+  bool integer = true;
+  if (p != this->end && *p == '.') {
+    integer = false;
+    const char *fraction = ++p;
+    while (p != this->end && is_digit(*p)) {
+      p++;
+    }
+    if (p == fraction) {
+      return this->fail();
+    }
+  }
+  if (p != this->end && (*p == 'e' || *p == 'E')) {
+    integer = false;
+    p++;
+    if (p != this->end && (*p == '+' || *p == '-')) {
+      p++;
+    }
+    const char *exponent = p;
+    while (p != this->end && is_digit(*p)) {
+      p++;
+    }
+    if (p == exponent) {
+      return this->fail();
+    }
+  }
+  if (integer && length > max_integer_digits) {
+    return this->fail();
+  }
+  this->position = p;
+  return true;
+}
+
+} // namespace comm
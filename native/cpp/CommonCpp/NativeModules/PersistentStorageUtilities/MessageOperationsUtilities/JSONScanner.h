@@ -0,0 +1,55 @@
+#pragma once
+
+#include <folly/Range.h>
+
+#include <cstdint>
+#include <string>
+
+namespace comm {
+
+/**
+ * Forward-only reader over a JSON document, for decoding values into native
+ * types without building a folly::dynamic tree first. Reading a value of the
+ * wrong type returns false and leaves the scanner where it was, so that the
+ * caller can skip it instead. Malformed JSON also returns false and marks the
+ * scanner as failed, after which every read fails.
+ *
+ * Only what folly::parseJson accepts with its default options is accepted,
+ * and anything that folly would decode differently, like numbers that aren't
+ * plain integers, is read only by skipValue.
+ */
+class JSONScanner {
+  const char *position;
+  const char *end;
+  bool failed{false};
+
+  bool fail();
+  void skipWhitespace();
+  bool readHex(uint32_t &value);
+  bool skipValue(int depth);
+
+public:
+  explicit JSONScanner(folly::StringPiece json);
+
+  bool hasFailed() const {
+    return this->failed;
+  }
+  const char *getPosition() const {
+    return this->position;
+  }
+  // True once nothing but whitespace is left
+  bool atEnd();
+
+  bool beginArray();
+  bool beginObject();
+  // Call after every element, or after every member of an object, including
+  // the first one. Returns false once the closing bracket is consumed.
+  bool nextElement(bool &first);
+  bool nextMember(bool &first, std::string &key);
+
+  bool readString(std::string &value);
+  bool readInt(int64_t &value);
+  bool skipValue();
+};
+
+} // namespace comm
@@ -0,0 +1,155 @@
+#include "JSONWriter.h"
+
+#include <folly/Conv.h>
+
+#include <cmath>
+#include <stdexcept>
+
+namespace comm {
+
+namespace {
+const char hex_digits[] = "0123456789abcdef";
+} // namespace
+
+JSONWriter::JSONWriter(std::string &buffer) : buffer(buffer) {
+}
+
+void JSONWriter::beginValue() {
+  if (this->needsComma) {
+    this->buffer.push_back(',');
+  }
+  this->needsComma = true;
+}
+
+void JSONWriter::appendString(folly::StringPiece value) {
+  this->buffer.push_back('"');
+  const char *runStart = value.begin();
+  for (const char *position = value.begin(); position != value.end();
+       position++) {
+    const unsigned char c = static_cast<unsigned char>(*position);
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      continue;
+    }
+    this->buffer.append(runStart, position);
+    runStart = position + 1;
+    this->buffer.push_back('\\');
+    switch (c) {
+      case '"':
+      case '\\':
+        this->buffer.push_back(static_cast<char>(c));
+        break;
+      case '\b':
+        this->buffer.push_back('b');
+        break;
+      case '\f':
+        this->buffer.push_back('f');
+        break;
+      case '\n':
+        this->buffer.push_back('n');
+        break;
+      case '\r':
+        this->buffer.push_back('r');
+        break;
+      case '\t':
+        this->buffer.push_back('t');
+        break;
+      default:
+        this->buffer.append("u00");
+        this->buffer.push_back(hex_digits[c >> 4]);
+        this->buffer.push_back(hex_digits[c & 0xf]);
+    }
+  }
+  this->buffer.append(runStart, value.end());
+  this->buffer.push_back('"');
+}
+
+void JSONWriter::beginObject() {
+  this->beginValue();
+  this->buffer.push_back('{');
+  this->needsComma = false;
+}
+
+void JSONWriter::endObject() {
+  this->buffer.push_back('}');
+  this->needsComma = true;
+}
+
+void JSONWriter::beginArray() {
+  this->beginValue();
+  this->buffer.push_back('[');
+  this->needsComma = false;
+}
+
+void JSONWriter::endArray() {
+  this->buffer.push_back(']');
+  this->needsComma = true;
+}
+
+void JSONWriter::key(folly::StringPiece key) {
+  this->beginValue();
+  this->appendString(key);
+  this->buffer.push_back(':');
+  this->needsComma = false;
+}
+
+void JSONWriter::writeString(folly::StringPiece value) {
+  this->beginValue();
+  this->appendString(value);
+}
+
+void JSONWriter::writeInt(int64_t value) {
+  this->beginValue();
+  folly::toAppend(value, &this->buffer);
+}
+
+void JSONWriter::writeBool(bool value) {
+  this->beginValue();
+  this->buffer.append(value ? "true" : "false");
+}
+
+void JSONWriter::writeNull() {
+  this->beginValue();
+  this->buffer.append("null");
+}
+
+void JSONWriter::writeDynamic(const folly::dynamic &value) {
+  switch (value.type()) {
+    case folly::dynamic::NULLT:
+      this->writeNull();
+      break;
+    case folly::dynamic::BOOL:
+      this->writeBool(value.getBool());
+      break;
+    case folly::dynamic::INT64:
+      this->writeInt(value.getInt());
+      break;
+    case folly::dynamic::DOUBLE:
+      // Parsed JSON can't hold them, folly::toJson refuses them too
+      if (!std::isfinite(value.getDouble())) {
+        throw std::invalid_argument("JSON can't hold NaN or infinity");
+      }
+      this->beginValue();
+      folly::toAppend(value.getDouble(), &this->buffer);
+      break;
+    case folly::dynamic::STRING:
+      this->writeString(value.getString());
+      break;
+    case folly::dynamic::ARRAY:
+      this->beginArray();
+      for (const folly::dynamic &element : value) {
+        this->writeDynamic(element);
+      }
+      this->endArray();
+      break;
+    case folly::dynamic::OBJECT:
+      this->beginObject();
+      for (const auto &member : value.items()) {
+        this->key(member.first.getString());
+        this->writeDynamic(member.second);
+      }
+      this->endObject();
+      break;
+  }
+}
+
+} // namespace comm
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <folly/Range.h>
+#include <folly/dynamic.h>
+
+#include <cstdint>
+#include <string>
+
+namespace comm {
+
+/**
+ * Writes compact JSON straight into a string, for content that would
+ * otherwise be built as a folly::dynamic tree only to be passed to
+ * folly::toJson. The output is appended to the buffer, which the caller
+ * clears and keeps from one message to the next, so that its capacity is
+ * allocated once. Members of an object are written as a key followed by a
+ * value, commas are put in where they belong.
+ *
+ * Strings are escaped like folly::toJson does with its default options, so
+ * non-ASCII characters are written as they are.
+ */
+class JSONWriter {
+  std::string &buffer;
+  bool needsComma{false};
+
+  void beginValue();
+  void appendString(folly::StringPiece value);
+
+public:
+  explicit JSONWriter(std::string &buffer);
+
+  void beginObject();
+  void endObject();
+  void beginArray();
+  void endArray();
+  void key(folly::StringPiece key);
+
+  void writeString(folly::StringPiece value);
+  void writeInt(int64_t value);
+  void writeBool(bool value);
+  void writeNull();
+  // For the values that are taken over from the raw message as they are.
+  // Throws folly::TypeError for a key that isn't a string.
+  void writeDynamic(const folly::dynamic &value);
+};
+
+} // namespace comm
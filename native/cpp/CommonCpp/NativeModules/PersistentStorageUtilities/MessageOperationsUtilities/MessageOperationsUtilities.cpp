@@ -1,12 +1,22 @@
 #include "MessageOperationsUtilities.h"
+#include "JSONWriter.h"
 #include "Logger.h"
 #include "MessageSpecs.h"
 
 #include <folly/String.h>
 #include <folly/json.h>
+#include <algorithm>
+#include <future>
+#include <iterator>
 #include <stdexcept>
+#include <thread>
 
 namespace comm {
+
+const size_t MAX_TRANSLATION_WORKERS{4};
+// Below that, starting a thread costs more than it saves
+const size_t MIN_MESSAGES_PER_TRANSLATION_WORKER{128};
+
 ClientDBMessageInfo
 MessageOperationsUtilities::translateRawMessageInfoToClientDBMessageInfo(
     const folly::dynamic &rawMessageInfo) {
@@ -32,10 +42,27 @@ MessageOperationsUtilities::translateRawMessageInfoToClientDBMessageInfo(
         rawMessageInfo["unsupportedMessageInfo"]["type"].asInt());
   }
 
+  // Text and multimedia messages make up most of any batch, so their specs
+  // are final and called directly instead of through the vtable. The content
+  // is written into a buffer of the translating thread, so only the copy that
+  // the message keeps is allocated.
+  thread_local std::string contentBuffer;
   std::unique_ptr<std::string> content = nullptr;
-  if (messageSpecsHolder.find(messageType) != messageSpecsHolder.end()) {
-    content = messageSpecsHolder.at(messageType)
-                  ->messageContentForClientDB(rawMessageInfo);
+  MessageSpec *messageSpec = getMessageSpec(type);
+  if (messageSpec) {
+    contentBuffer.clear();
+    if (messageType == MessageType::TEXT) {
+      static_cast<TextMessageSpec *>(messageSpec)
+          ->writeContentForClientDB(rawMessageInfo, contentBuffer);
+    } else if (
+        messageType == MessageType::IMAGES ||
+        messageType == MessageType::MULTIMEDIA) {
+      static_cast<MultimediaMessageSpec *>(messageSpec)
+          ->writeContentForClientDB(rawMessageInfo, contentBuffer);
+    } else {
+      messageSpec->writeContentForClientDB(rawMessageInfo, contentBuffer);
+    }
+    content = std::make_unique<std::string>(contentBuffer);
   }
   std::vector<Media> mediaVector;
   if (messageType == MessageType::IMAGES ||
@@ -65,24 +92,242 @@ Media MessageOperationsUtilities::translateMediaToClientDBMediaInfo(
   std::string id = rawMediaInfo["id"].asString();
   std::string uri = rawMediaInfo["uri"].asString();
   std::string type = rawMediaInfo["type"].asString();
-  folly::dynamic extrasData =
-      folly::dynamic::object("dimensions", rawMediaInfo["dimensions"])(
-          "loop", (type == "video") ? rawMediaInfo["loop"] : false);
-  if (rawMediaInfo.count("localMediaSelection")) {
-    extrasData["local_media_selection"] = rawMediaInfo["localMediaSelection"];
-  }
-  std::string extras = folly::toJson(extrasData);
-  return Media{id, container, thread, uri, type, extras};
+  thread_local std::string extrasBuffer;
+  extrasBuffer.clear();
+  JSONWriter writer(extrasBuffer);
+  writer.beginObject();
+  writer.key("dimensions");
+  writer.writeDynamic(rawMediaInfo["dimensions"]);
+  writer.key("loop");
+  if (type == "video") {
+    writer.writeDynamic(rawMediaInfo["loop"]);
+  } else {
+    writer.writeBool(false);
+  }
+  auto localMediaSelection = rawMediaInfo.find("localMediaSelection");
+  if (localMediaSelection != rawMediaInfo.items().end()) {
+    writer.key("local_media_selection");
+    writer.writeDynamic(localMediaSelection->second);
+  }
+  writer.endObject();
+  return Media{
+      std::move(id),
+      container,
+      thread,
+      std::move(uri),
+      std::move(type),
+      extrasBuffer};
+}
+
+std::optional<ClientDBMessageInfo>
+MessageOperationsUtilities::tryTranslateRawMessageInfo(
+    const folly::dynamic &rawMessageInfo) {
+  try {
+    return translateRawMessageInfoToClientDBMessageInfo(rawMessageInfo);
+  } catch (const folly::TypeError &e) {
+    LOG_EVERY_MS(
+        1000,
+        "Invalid type conversion when parsing message. Details: " +
+        std::string(e.what()));
+  } catch (const std::out_of_range &e) {
+    LOG_EVERY_MS(
+        1000,
+        "Non-existing key accessed when parsing message. Details: " +
+        std::string(e.what()));
+  }
+  return std::nullopt;
+}
+
+std::optional<ClientDBMessageInfo>
+MessageOperationsUtilities::scanTextMessageInfo(JSONScanner &scanner) {
+  if (!scanner.beginObject()) {
+    scanner.skipValue();
+    return std::nullopt;
+  }
+  std::optional<std::string> id, localID, thread, user, text;
+  std::optional<int64_t> type, time;
+  // Values of a type that folly would have to convert, like a number for a
+  // string, are left to translateRawMessageInfoToClientDBMessageInfo
+  bool decodable = true;
+  bool first = true;
+  std::string key;
+  while (scanner.nextMember(first, key)) {
+    std::optional<std::string> *stringField = nullptr;
+    std::optional<int64_t> *intField = nullptr;
+    if (key == "id") {
+      stringField = &id;
+    } else if (key == "localID") {
+      stringField = &localID;
+    } else if (key == "threadID") {
+      stringField = &thread;
+    } else if (key == "creatorID") {
+      stringField = &user;
+    } else if (key == "text") {
+      stringField = &text;
+    } else if (key == "type") {
+      intField = &type;
+    } else if (key == "time") {
+      intField = &time;
+    } else {
+      scanner.skipValue();
+      continue;
+    }
+    if (stringField) {
+      std::string value;
+      if (scanner.readString(value)) {
+        *stringField = std::move(value);
+        continue;
+      }
+    } else {
+      int64_t value;
+      if (scanner.readInt(value)) {
+        *intField = value;
+        continue;
+      }
+    }
+    decodable = false;
+    scanner.skipValue();
+  }
+  if (scanner.hasFailed() || !decodable || !type ||
+      static_cast<MessageType>(*type) != MessageType::TEXT || !thread ||
+      !user || !text || !time || !(id || localID)) {
+    return std::nullopt;
+  }
+  std::string messageID = id ? *id : *localID;
+  return ClientDBMessageInfo{
+      Message{
+          std::move(messageID),
+          localID ? std::make_unique<std::string>(std::move(*localID))
+                  : nullptr,
+          std::move(*thread),
+          std::move(*user),
+          static_cast<int>(*type),
+          nullptr,
+          std::make_unique<std::string>(std::move(*text)),
+          *time},
+      std::vector<Media>{}};
+}
+
+std::optional<ClientDBMessageInfo>
+MessageOperationsUtilities::translateRawMessageInfoSpan(
+    folly::StringPiece rawMessageInfoString) {
+  // Text messages are decoded straight from the span, anything else is
+  // parsed with folly and goes through the message specs
+  JSONScanner scanner(rawMessageInfoString);
+  std::optional<ClientDBMessageInfo> clientDBMessageInfo =
+      scanTextMessageInfo(scanner);
+  if (clientDBMessageInfo) {
+    return clientDBMessageInfo;
+  }
+  folly::dynamic rawMessageInfo;
+  try {
+    rawMessageInfo = folly::parseJson(rawMessageInfoString);
+  } catch (const folly::json::parse_error &e) {
+    LOG_EVERY_MS(
+        1000,
+        "Failed to convert message into JSON object. Details: " +
+        std::string(e.what()));
+    return std::nullopt;
+  }
+  return tryTranslateRawMessageInfo(rawMessageInfo);
+}
+
+bool MessageOperationsUtilities::scanClientDBMessageInfos(
+    folly::StringPiece rawMessageInfosString,
+    std::vector<ClientDBMessageInfo> &clientDBMessageInfos,
+    size_t &skippedMessageInfos) {
+  // The payload is validated and split into the spans of its messages first,
+  // so that a malformed one is left to folly before anything is translated
+  // and errors are logged just like if it was parsed at once
+  JSONScanner scanner(rawMessageInfosString);
+  if (!scanner.beginArray()) {
+    return false;
+  }
+  std::vector<folly::StringPiece> spans;
+  bool first = true;
+  while (scanner.nextElement(first)) {
+    const char *begin = scanner.getPosition();
+    if (!scanner.skipValue()) {
+      return false;
+    }
+    spans.emplace_back(begin, scanner.getPosition());
+  }
+  if (!scanner.atEnd()) {
+    return false;
+  }
+
+  // Large batches are translated in parallel, each worker taking a
+  // contiguous chunk of spans, so that messages keep their order
+  std::vector<std::optional<ClientDBMessageInfo>> translatedMessageInfos(
+      spans.size());
+  auto translateChunk = [&spans, &translatedMessageInfos](
+                            size_t chunkBegin, size_t chunkEnd) {
+    for (size_t i = chunkBegin; i < chunkEnd; i++) {
+      translatedMessageInfos[i] = translateRawMessageInfoSpan(spans[i]);
+    }
+  };
+  size_t workerCount = std::min<size_t>(
+      {std::max(std::thread::hardware_concurrency(), 1u),
+       MAX_TRANSLATION_WORKERS,
+       spans.size() / MIN_MESSAGES_PER_TRANSLATION_WORKER});
+  if (workerCount <= 1) {
+    translateChunk(0, spans.size());
+  } else {
+    size_t chunkSize = (spans.size() + workerCount - 1) / workerCount;
+    std::vector<std::future<void>> workers;
+    for (size_t chunkBegin = chunkSize; chunkBegin < spans.size();
+         chunkBegin += chunkSize) {
+      workers.push_back(std::async(
+          std::launch::async,
+          translateChunk,
+          chunkBegin,
+          std::min(chunkBegin + chunkSize, spans.size())));
+    }
+    translateChunk(0, chunkSize);
+    // Rethrows anything a worker didn't handle, like the calling thread
+    // would have
+    for (auto &worker : workers) {
+      worker.get();
+    }
+  }
+
+  clientDBMessageInfos.reserve(translatedMessageInfos.size());
+  for (auto &translatedMessageInfo : translatedMessageInfos) {
+    if (translatedMessageInfo) {
+      clientDBMessageInfos.push_back(std::move(*translatedMessageInfo));
+    } else {
+      skippedMessageInfos++;
+    }
+  }
+  return true;
 }
 
 std::vector<ClientDBMessageInfo>
 MessageOperationsUtilities::translateStringToClientDBMessageInfos(
     std::string &rawMessageInfosString) {
+  size_t skippedMessageInfos = 0;
+  return translateStringToClientDBMessageInfos(
+      rawMessageInfosString, skippedMessageInfos);
+}
+
+std::vector<ClientDBMessageInfo>
+MessageOperationsUtilities::translateStringToClientDBMessageInfos(
+    folly::StringPiece rawMessageInfosString,
+    size_t &skippedMessageInfos) {
   std::vector<ClientDBMessageInfo> clientDBMessageInfos;
+  folly::StringPiece trimmedRawMessageInfosString =
+      folly::trimWhitespace(rawMessageInfosString);
+  if (scanClientDBMessageInfos(
+          trimmedRawMessageInfosString,
+          clientDBMessageInfos,
+          skippedMessageInfos)) {
+    return clientDBMessageInfos;
+  }
+
+  // Anything the scanner can't read is left to folly, which reports errors
   folly::dynamic rawMessageInfos;
   try {
-    rawMessageInfos =
-        folly::parseJson(folly::trimWhitespace(rawMessageInfosString));
+    rawMessageInfos = folly::parseJson(trimmedRawMessageInfosString);
   } catch (const folly::json::parse_error &e) {
     Logger::log(
         "Failed to convert message into JSON object. Details: " +
@@ -90,34 +335,92 @@ MessageOperationsUtilities::translateStringToClientDBMessageInfos(
     return clientDBMessageInfos;
   }
   for (const auto &messageInfo : rawMessageInfos) {
-    try {
-      clientDBMessageInfos.push_back(
-          translateRawMessageInfoToClientDBMessageInfo(messageInfo));
-    } catch (const folly::TypeError &e) {
-      Logger::log(
-          "Invalid type conversion when parsing message. Details: " +
-          std::string(e.what()));
-    } catch (const std::out_of_range &e) {
-      Logger::log(
-          "Non-existing key accessed when parsing message. Details: " +
-          std::string(e.what()));
+    std::optional<ClientDBMessageInfo> clientDBMessageInfo =
+        tryTranslateRawMessageInfo(messageInfo);
+    if (clientDBMessageInfo) {
+      clientDBMessageInfos.push_back(std::move(*clientDBMessageInfo));
+    } else {
+      skippedMessageInfos++;
     }
   }
 
   return clientDBMessageInfos;
 }
 
-void MessageOperationsUtilities::storeMessageInfos(
+void MessageOperationsUtilities::storeClientDBMessageInfos(
+    std::vector<ClientDBMessageInfo> &clientDBMessageInfos,
+    StoredMessageInfosCount &count) {
+  std::vector<Message> messages;
+  std::vector<Media> media;
+  messages.reserve(clientDBMessageInfos.size());
+  for (auto &clientDBMessageInfo : clientDBMessageInfos) {
+    messages.push_back(std::move(clientDBMessageInfo.first));
+    std::move(
+        clientDBMessageInfo.second.begin(),
+        clientDBMessageInfo.second.end(),
+        std::back_inserter(media));
+  }
+
+  if (!messages.empty()) {
+    // Messages and their media are written in a single transaction so that
+    // a large batch costs one commit instead of one per row. Both use
+    // statements cached by the executor, so they are prepared only once.
+    DatabaseManager::getQueryExecutor().beginTransaction();
+    try {
+      DatabaseManager::getQueryExecutor().replaceMessages(messages);
+      DatabaseManager::getQueryExecutor().replaceMediaBatch(media);
+    } catch (...) {
+      DatabaseManager::getQueryExecutor().rollbackTransaction();
+      throw;
+    }
+    DatabaseManager::getQueryExecutor().commitTransaction();
+  }
+
+  count.messages = messages.size();
+  count.media = media.size();
+  Logger::log(
+      "Stored " + std::to_string(count.messages) + " messages and " +
+      std::to_string(count.media) + " media, skipped " +
+      std::to_string(count.skippedMessages) + " messages");
+}
+
+StoredMessageInfosCount MessageOperationsUtilities::storeMessageInfos(
     std::string &rawMessageInfosString) {
+  return storeMessageInfos(folly::StringPiece(rawMessageInfosString));
+}
+
+StoredMessageInfosCount MessageOperationsUtilities::storeMessageInfos(
+    std::vector<std::string> &rawMessageInfosStrings) {
+  std::vector<folly::StringPiece> rawMessageInfosPieces(
+      rawMessageInfosStrings.begin(), rawMessageInfosStrings.end());
+  return storeMessageInfos(rawMessageInfosPieces);
+}
+
+StoredMessageInfosCount MessageOperationsUtilities::storeMessageInfos(
+    folly::StringPiece rawMessageInfosString) {
+  StoredMessageInfosCount count;
   std::vector<ClientDBMessageInfo> clientDBMessageInfos =
-      translateStringToClientDBMessageInfos(rawMessageInfosString);
-  for (const auto &clientDBMessageInfo : clientDBMessageInfos) {
-    DatabaseManager::getQueryExecutor().replaceMessage(
-        clientDBMessageInfo.first);
-    for (const auto &mediaInfo : clientDBMessageInfo.second) {
-      DatabaseManager::getQueryExecutor().replaceMedia(mediaInfo);
-    }
+      translateStringToClientDBMessageInfos(
+          rawMessageInfosString, count.skippedMessages);
+  storeClientDBMessageInfos(clientDBMessageInfos, count);
+  return count;
+}
+
+StoredMessageInfosCount MessageOperationsUtilities::storeMessageInfos(
+    const std::vector<folly::StringPiece> &rawMessageInfosStrings) {
+  StoredMessageInfosCount count;
+  std::vector<ClientDBMessageInfo> clientDBMessageInfos;
+  for (folly::StringPiece rawMessageInfosString : rawMessageInfosStrings) {
+    std::vector<ClientDBMessageInfo> batchMessageInfos =
+        translateStringToClientDBMessageInfos(
+            rawMessageInfosString, count.skippedMessages);
+    std::move(
+        batchMessageInfos.begin(),
+        batchMessageInfos.end(),
+        std::back_inserter(clientDBMessageInfos));
   }
+  storeClientDBMessageInfos(clientDBMessageInfos, count);
+  return count;
 }
 
 } // namespace comm
@@ -3,13 +3,24 @@
 #include "../../../DatabaseManagers/DatabaseManager.h"
 #include "../../../DatabaseManagers/entities/Media.h"
 #include "../../../DatabaseManagers/entities/Message.h"
+#include "JSONScanner.h"
 
 #include <folly/dynamic.h>
+#include <optional>
 #include <string>
 #include <vector>
 
 namespace comm {
 typedef std::pair<Message, std::vector<Media>> ClientDBMessageInfo;
+
+// Rows written by storeMessageInfos, and messages it skipped because they
+// couldn't be translated
+struct StoredMessageInfosCount {
+  size_t messages{0};
+  size_t media{0};
+  size_t skippedMessages{0};
+};
+
 class MessageOperationsUtilities {
   static ClientDBMessageInfo translateRawMessageInfoToClientDBMessageInfo(
       const folly::dynamic &rawMessageInfo);
@@ -17,10 +28,38 @@ class MessageOperationsUtilities {
       const folly::dynamic &rawMediaInfo,
       const std::string &container,
       const std::string &thread);
+  static std::optional<ClientDBMessageInfo>
+  tryTranslateRawMessageInfo(const folly::dynamic &rawMessageInfo);
+  static std::optional<ClientDBMessageInfo>
+  scanTextMessageInfo(JSONScanner &scanner);
+  static std::optional<ClientDBMessageInfo>
+  translateRawMessageInfoSpan(folly::StringPiece rawMessageInfoString);
+  static bool scanClientDBMessageInfos(
+      folly::StringPiece rawMessageInfosString,
+      std::vector<ClientDBMessageInfo> &clientDBMessageInfos,
+      size_t &skippedMessageInfos);
+  static std::vector<ClientDBMessageInfo> translateStringToClientDBMessageInfos(
+      folly::StringPiece rawMessageInfosString,
+      size_t &skippedMessageInfos);
+  static void storeClientDBMessageInfos(
+      std::vector<ClientDBMessageInfo> &clientDBMessageInfos,
+      StoredMessageInfosCount &count);
 
 public:
   static std::vector<ClientDBMessageInfo>
   translateStringToClientDBMessageInfos(std::string &rawMessageInfosString);
-  static void storeMessageInfos(std::string &rawMessageInfosString);
+  // Translates and writes a batch of raw message infos in one transaction
+  static StoredMessageInfosCount
+  storeMessageInfos(std::string &rawMessageInfosString);
+  // Same as above for many batches, like notifications received while the
+  // app wasn't running, still written in one transaction
+  static StoredMessageInfosCount
+  storeMessageInfos(std::vector<std::string> &rawMessageInfosStrings);
+  // Read in place, e.g. from the direct buffers of Java, so the payloads
+  // don't have to be copied into strings first
+  static StoredMessageInfosCount
+  storeMessageInfos(folly::StringPiece rawMessageInfosString);
+  static StoredMessageInfosCount storeMessageInfos(
+      const std::vector<folly::StringPiece> &rawMessageInfosStrings);
 };
 } // namespace comm
@@ -1,18 +1,41 @@
 #pragma once
 
+#include "MessageOperationsUtilities.h"
+
+#include <fbjni/ByteBuffer.h>
 #include <fbjni/fbjni.h>
 
 namespace comm {
+class JStoredMessageInfosCount
+    : public facebook::jni::JavaClass<JStoredMessageInfosCount> {
+public:
+  static auto constexpr kJavaDescriptor =
+      "Lapp/comm/android/fbjni/StoredMessageInfosCount;";
+
+  static facebook::jni::local_ref<javaobject>
+  create(const StoredMessageInfosCount &count);
+};
+
 class MessageOperationsUtilitiesJNIHelper
     : public facebook::jni::JavaClass<MessageOperationsUtilitiesJNIHelper> {
 public:
   static auto constexpr kJavaDescriptor =
       "Lapp/comm/android/fbjni/MessageOperationsUtilities;";
 
-  static void storeMessageInfos(
+  static facebook::jni::local_ref<JStoredMessageInfosCount::javaobject>
+  storeMessageInfos(
       facebook::jni::alias_ref<MessageOperationsUtilitiesJNIHelper> jThis,
       facebook::jni::JString sqliteFilePath,
       facebook::jni::JString rawMessageInfosString);
+  // Reads direct buffers of UTF-8 JSON in place, and writes them in one
+  // transaction
+  static facebook::jni::local_ref<JStoredMessageInfosCount::javaobject>
+  storeMessageInfosFromBuffers(
+      facebook::jni::alias_ref<MessageOperationsUtilitiesJNIHelper> jThis,
+      facebook::jni::JString sqliteFilePath,
+      facebook::jni::alias_ref<
+          facebook::jni::JArrayClass<facebook::jni::JByteBuffer>>
+          rawMessageInfosBuffers);
   static void registerNatives();
 };
 } // namespace comm
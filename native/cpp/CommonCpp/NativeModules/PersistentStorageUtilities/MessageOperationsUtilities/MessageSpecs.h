@@ -16,7 +16,8 @@
 #include "MessageSpecs/UnsupportedMessageSpec.h"
 #include "MessageSpecs/UpdateRelationshipMessageSpec.h"
 
-#include <map>
+#include <array>
+#include <memory>
 
 namespace comm {
 
@@ -43,51 +44,54 @@ enum class MessageType {
   REACTION,
 };
 
-const std::map<MessageType, std::unique_ptr<MessageSpec>> messageSpecsHolder =
-    []() {
-      std::map<MessageType, std::unique_ptr<MessageSpec>>
-          message_specs_initializer;
-      message_specs_initializer.insert(
-          {MessageType::TEXT, std::make_unique<TextMessageSpec>()});
-      message_specs_initializer.insert(
-          {MessageType::CREATE_THREAD,
-           std::make_unique<CreateThreadMessageSpec>()});
-      message_specs_initializer.insert(
-          {MessageType::CREATE_SUB_THREAD,
-           std::make_unique<CreateSubThreadMessageSpec>()});
-      message_specs_initializer.insert(
-          {MessageType::CHANGE_SETTINGS,
-           std::make_unique<ChangeSettingsMessageSpec>()});
-      message_specs_initializer.insert(
-          {MessageType::CHANGE_ROLE,
-           std::make_unique<ChangeRoleMessageSpec>()});
-      message_specs_initializer.insert(
-          {MessageType::CREATE_ENTRY,
-           std::make_unique<CreateEntryMessageSpec>()});
-      message_specs_initializer.insert(
-          {MessageType::EDIT_ENTRY, std::make_unique<EditEntryMessageSpec>()});
-      message_specs_initializer.insert(
-          {MessageType::DELETE_ENTRY,
-           std::make_unique<DeleteEntryMessageSpec>()});
-      message_specs_initializer.insert(
-          {MessageType::RESTORE_ENTRY,
-           std::make_unique<RestoreEntryMessageSpec>()});
-      message_specs_initializer.insert(
-          {MessageType::UNSUPPORTED,
-           std::make_unique<UnsupportedMessageSpec>()});
-      message_specs_initializer.insert(
-          {MessageType::IMAGES, std::make_unique<MultimediaMessageSpec>()});
-      message_specs_initializer.insert(
-          {MessageType::MULTIMEDIA, std::make_unique<MultimediaMessageSpec>()});
-      message_specs_initializer.insert(
-          {MessageType::UPDATE_RELATIONSHIP,
-           std::make_unique<UpdateRelationshipMessageSpec>()});
-      message_specs_initializer.insert(
-          {MessageType::CREATE_SIDEBAR,
-           std::make_unique<CreateSidebarMessageSpec>()});
-      message_specs_initializer.insert(
-          {MessageType::REACTION, std::make_unique<ReactionMessageSpec>()});
-      return message_specs_initializer;
+// MessageType values are contiguous from 0, so specs are kept in a table
+// indexed by the type. Types without a spec have no content in the database.
+const size_t MESSAGE_TYPE_COUNT =
+    static_cast<size_t>(MessageType::REACTION) + 1;
+
+const std::array<std::unique_ptr<MessageSpec>, MESSAGE_TYPE_COUNT>
+    messageSpecsHolder = []() {
+      std::array<std::unique_ptr<MessageSpec>, MESSAGE_TYPE_COUNT> specs;
+      specs[static_cast<size_t>(MessageType::TEXT)] =
+          std::make_unique<TextMessageSpec>();
+      specs[static_cast<size_t>(MessageType::CREATE_THREAD)] =
+          std::make_unique<CreateThreadMessageSpec>();
+      specs[static_cast<size_t>(MessageType::CREATE_SUB_THREAD)] =
+          std::make_unique<CreateSubThreadMessageSpec>();
+      specs[static_cast<size_t>(MessageType::CHANGE_SETTINGS)] =
+          std::make_unique<ChangeSettingsMessageSpec>();
+      specs[static_cast<size_t>(MessageType::CHANGE_ROLE)] =
+          std::make_unique<ChangeRoleMessageSpec>();
+      specs[static_cast<size_t>(MessageType::CREATE_ENTRY)] =
+          std::make_unique<CreateEntryMessageSpec>();
+      specs[static_cast<size_t>(MessageType::EDIT_ENTRY)] =
+          std::make_unique<EditEntryMessageSpec>();
+      specs[static_cast<size_t>(MessageType::DELETE_ENTRY)] =
+          std::make_unique<DeleteEntryMessageSpec>();
+      specs[static_cast<size_t>(MessageType::RESTORE_ENTRY)] =
+          std::make_unique<RestoreEntryMessageSpec>();
+      specs[static_cast<size_t>(MessageType::UNSUPPORTED)] =
+          std::make_unique<UnsupportedMessageSpec>();
+      specs[static_cast<size_t>(MessageType::IMAGES)] =
+          std::make_unique<MultimediaMessageSpec>();
+      specs[static_cast<size_t>(MessageType::MULTIMEDIA)] =
+          std::make_unique<MultimediaMessageSpec>();
+      specs[static_cast<size_t>(MessageType::UPDATE_RELATIONSHIP)] =
+          std::make_unique<UpdateRelationshipMessageSpec>();
+      specs[static_cast<size_t>(MessageType::CREATE_SIDEBAR)] =
+          std::make_unique<CreateSidebarMessageSpec>();
+      specs[static_cast<size_t>(MessageType::REACTION)] =
+          std::make_unique<ReactionMessageSpec>();
+      return specs;
     }();
 
+// Returns nullptr for types without a spec, including ones this client
+// doesn't know about
+inline MessageSpec *getMessageSpec(int type) {
+  if (type < 0 || static_cast<size_t>(type) >= MESSAGE_TYPE_COUNT) {
+    return nullptr;
+  }
+  return messageSpecsHolder[type].get();
+}
+
 } // namespace comm
@@ -4,12 +4,16 @@
 
 namespace comm {
 class ChangeRoleMessageSpec : public MessageSpec {
-  virtual std::unique_ptr<std::string>
-  messageContentForClientDB(const folly::dynamic &rawMessageInfo) override {
-    folly::dynamic changeRoleData =
-        folly::dynamic::object("userIDs", rawMessageInfo["userIDs"])(
-            "newRole", rawMessageInfo["newRole"]);
-    return std::make_unique<std::string>(folly::toJson(changeRoleData));
+  virtual void writeContentForClientDB(
+      const folly::dynamic &rawMessageInfo,
+      std::string &content) override {
+    JSONWriter writer(content);
+    writer.beginObject();
+    writer.key("userIDs");
+    writer.writeDynamic(rawMessageInfo["userIDs"]);
+    writer.key("newRole");
+    writer.writeDynamic(rawMessageInfo["newRole"]);
+    writer.endObject();
   }
 };
 } // namespace comm
@@ -4,11 +4,14 @@
 
 namespace comm {
 class ChangeSettingsMessageSpec : public MessageSpec {
-  virtual std::unique_ptr<std::string>
-  messageContentForClientDB(const folly::dynamic &rawMessageInfo) override {
-    folly::dynamic changeSettingsData = folly::dynamic::object(
-        rawMessageInfo["field"].asString(), rawMessageInfo["value"]);
-    return std::make_unique<std::string>(folly::toJson(changeSettingsData));
+  virtual void writeContentForClientDB(
+      const folly::dynamic &rawMessageInfo,
+      std::string &content) override {
+    JSONWriter writer(content);
+    writer.beginObject();
+    writer.key(rawMessageInfo["field"].asString());
+    writer.writeDynamic(rawMessageInfo["value"]);
+    writer.endObject();
   }
 };
 } // namespace comm
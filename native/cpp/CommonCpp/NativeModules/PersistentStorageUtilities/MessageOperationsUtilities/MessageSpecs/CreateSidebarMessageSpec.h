@@ -4,12 +4,25 @@
 
 namespace comm {
 class CreateSidebarMessageSpec : public MessageSpec {
-  virtual std::unique_ptr<std::string>
-  messageContentForClientDB(const folly::dynamic &rawMessageInfo) override {
-    folly::dynamic createSidebarData = rawMessageInfo["initialThreadState"];
-    createSidebarData["sourceMessageAuthorID"] =
+  virtual void writeContentForClientDB(
+      const folly::dynamic &rawMessageInfo,
+      std::string &content) override {
+    // The initial thread state with the author of the source message put in,
+    // in place of a member of the same name
+    const folly::dynamic &sourceMessageAuthorID =
         rawMessageInfo["sourceMessageAuthorID"];
-    return std::make_unique<std::string>(folly::toJson(createSidebarData));
+    JSONWriter writer(content);
+    writer.beginObject();
+    for (const auto &member : rawMessageInfo["initialThreadState"].items()) {
+      if (member.first == "sourceMessageAuthorID") {
+        continue;
+      }
+      writer.key(member.first.getString());
+      writer.writeDynamic(member.second);
+    }
+    writer.key("sourceMessageAuthorID");
+    writer.writeDynamic(sourceMessageAuthorID);
+    writer.endObject();
   }
 };
 } // namespace comm
@@ -4,10 +4,10 @@
 
 namespace comm {
 class CreateSubThreadMessageSpec : public MessageSpec {
-  virtual std::unique_ptr<std::string>
-  messageContentForClientDB(const folly::dynamic &rawMessageInfo) override {
-    return std::make_unique<std::string>(
-        rawMessageInfo["childThreadID"].asString());
+  virtual void writeContentForClientDB(
+      const folly::dynamic &rawMessageInfo,
+      std::string &content) override {
+    content.append(rawMessageInfo["childThreadID"].asString());
   }
 };
 } // namespace comm
@@ -4,10 +4,11 @@
 
 namespace comm {
 class CreateThreadMessageSpec : public MessageSpec {
-  virtual std::unique_ptr<std::string>
-  messageContentForClientDB(const folly::dynamic &rawMessageInfo) override {
-    folly::dynamic initialThreadState = rawMessageInfo["initialThreadState"];
-    return std::make_unique<std::string>(folly::toJson(initialThreadState));
+  virtual void writeContentForClientDB(
+      const folly::dynamic &rawMessageInfo,
+      std::string &content) override {
+    JSONWriter writer(content);
+    writer.writeDynamic(rawMessageInfo["initialThreadState"]);
   }
 };
 } // namespace comm
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "../JSONWriter.h"
+
 #include <folly/String.h>
 #include <folly/dynamic.h>
 #include <folly/json.h>
@@ -9,7 +11,11 @@
 namespace comm {
 class MessageSpec {
 public:
-  virtual std::unique_ptr<std::string>
-  messageContentForClientDB(const folly::dynamic &rawMessageInfo) = 0;
+  // Appends the content of the message as it is stored in the database. The
+  // caller clears the buffer and reuses it from one message to the next, the
+  // JSON contents are written into it with a JSONWriter.
+  virtual void writeContentForClientDB(
+      const folly::dynamic &rawMessageInfo,
+      std::string &content) = 0;
 };
 } // namespace comm
@@ -3,14 +3,17 @@
 #include "MessageSpec.h"
 
 namespace comm {
-class MultimediaMessageSpec : public MessageSpec {
-  virtual std::unique_ptr<std::string>
-  messageContentForClientDB(const folly::dynamic &rawMessageInfo) override {
-    folly::dynamic mediaIDs = folly::dynamic::array();
+class MultimediaMessageSpec final : public MessageSpec {
+public:
+  void writeContentForClientDB(
+      const folly::dynamic &rawMessageInfo,
+      std::string &content) override {
+    JSONWriter writer(content);
+    writer.beginArray();
     for (const auto &mediaInfo : rawMessageInfo["media"]) {
-      mediaIDs.push_back(std::stoi(mediaInfo["id"].asString()));
+      writer.writeInt(std::stoi(mediaInfo["id"].asString()));
     }
-    return std::make_unique<std::string>(folly::toJson(mediaIDs));
+    writer.endArray();
   }
 };
 } // namespace comm
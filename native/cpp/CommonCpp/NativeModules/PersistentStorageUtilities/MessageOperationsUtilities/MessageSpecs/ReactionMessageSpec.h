@@ -4,13 +4,18 @@
 
 namespace comm {
 class ReactionMessageSpec : public MessageSpec {
-  virtual std::unique_ptr<std::string>
-  messageContentForClientDB(const folly::dynamic &rawMessageInfo) override {
-    folly::dynamic reactionData = folly::dynamic::object(
-        "targetMessageID", rawMessageInfo["targetMessageID"])(
-        "reaction",
-        rawMessageInfo["reaction"])("action", rawMessageInfo["action"]);
-    return std::make_unique<std::string>(folly::toJson(reactionData));
+  virtual void writeContentForClientDB(
+      const folly::dynamic &rawMessageInfo,
+      std::string &content) override {
+    JSONWriter writer(content);
+    writer.beginObject();
+    writer.key("targetMessageID");
+    writer.writeDynamic(rawMessageInfo["targetMessageID"]);
+    writer.key("reaction");
+    writer.writeDynamic(rawMessageInfo["reaction"]);
+    writer.key("action");
+    writer.writeDynamic(rawMessageInfo["action"]);
+    writer.endObject();
   }
 };
 } // namespace comm
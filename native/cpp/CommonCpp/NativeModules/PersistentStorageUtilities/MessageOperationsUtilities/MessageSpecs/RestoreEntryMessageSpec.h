@@ -4,12 +4,18 @@
 
 namespace comm {
 class RestoreEntryMessageSpec : public MessageSpec {
-  virtual std::unique_ptr<std::string>
-  messageContentForClientDB(const folly::dynamic &rawMessageInfo) override {
-    folly::dynamic entryData =
-        folly::dynamic::object("entryID", rawMessageInfo["entryID"])(
-            "date", rawMessageInfo["date"])("text", rawMessageInfo["text"]);
-    return std::make_unique<std::string>(folly::toJson(entryData));
+  virtual void writeContentForClientDB(
+      const folly::dynamic &rawMessageInfo,
+      std::string &content) override {
+    JSONWriter writer(content);
+    writer.beginObject();
+    writer.key("entryID");
+    writer.writeDynamic(rawMessageInfo["entryID"]);
+    writer.key("date");
+    writer.writeDynamic(rawMessageInfo["date"]);
+    writer.key("text");
+    writer.writeDynamic(rawMessageInfo["text"]);
+    writer.endObject();
   }
 };
 } // namespace comm
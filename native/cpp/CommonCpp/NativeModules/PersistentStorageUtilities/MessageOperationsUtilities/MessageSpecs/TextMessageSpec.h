@@ -3,10 +3,17 @@
 #include "MessageSpec.h"
 
 namespace comm {
-class TextMessageSpec : public MessageSpec {
-  virtual std::unique_ptr<std::string>
-  messageContentForClientDB(const folly::dynamic &rawMessageInfo) override {
-    return std::make_unique<std::string>(rawMessageInfo["text"].asString());
+class TextMessageSpec final : public MessageSpec {
+public:
+  void writeContentForClientDB(
+      const folly::dynamic &rawMessageInfo,
+      std::string &content) override {
+    const folly::dynamic &text = rawMessageInfo["text"];
+    if (text.isString()) {
+      content.append(text.getString());
+    } else {
+      content.append(text.asString());
+    }
   }
 };
 } // namespace comm
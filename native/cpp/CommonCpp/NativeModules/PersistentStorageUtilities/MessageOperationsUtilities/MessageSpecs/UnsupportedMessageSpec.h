@@ -4,13 +4,18 @@
 
 namespace comm {
 class UnsupportedMessageSpec : public MessageSpec {
-  virtual std::unique_ptr<std::string>
-  messageContentForClientDB(const folly::dynamic &rawMessageInfo) override {
-    folly::dynamic unsupportedMessageData =
-        folly::dynamic::object("robotext", rawMessageInfo["robotext"])(
-            "dontPrefixCreator", rawMessageInfo["dontPrefixCreator"])(
-            "unsupportedMessageInfo", rawMessageInfo["unsupportedMessageInfo"]);
-    return std::make_unique<std::string>(folly::toJson(unsupportedMessageData));
+  virtual void writeContentForClientDB(
+      const folly::dynamic &rawMessageInfo,
+      std::string &content) override {
+    JSONWriter writer(content);
+    writer.beginObject();
+    writer.key("robotext");
+    writer.writeDynamic(rawMessageInfo["robotext"]);
+    writer.key("dontPrefixCreator");
+    writer.writeDynamic(rawMessageInfo["dontPrefixCreator"]);
+    writer.key("unsupportedMessageInfo");
+    writer.writeDynamic(rawMessageInfo["unsupportedMessageInfo"]);
+    writer.endObject();
   }
 };
 } // namespace comm
@@ -4,12 +4,16 @@
 
 namespace comm {
 class UpdateRelationshipMessageSpec : public MessageSpec {
-  virtual std::unique_ptr<std::string>
-  messageContentForClientDB(const folly::dynamic &rawMessageInfo) override {
-    folly::dynamic updateRelationshipData =
-        folly::dynamic::object("operation", rawMessageInfo["operation"])(
-            "targetID", rawMessageInfo["targetID"]);
-    return std::make_unique<std::string>(folly::toJson(updateRelationshipData));
+  virtual void writeContentForClientDB(
+      const folly::dynamic &rawMessageInfo,
+      std::string &content) override {
+    JSONWriter writer(content);
+    writer.beginObject();
+    writer.key("operation");
+    writer.writeDynamic(rawMessageInfo["operation"]);
+    writer.key("targetID");
+    writer.writeDynamic(rawMessageInfo["targetID"]);
+    writer.endObject();
   }
 };
 } // namespace comm
@@ -1,40 +1,58 @@
 #include "ThreadOperations.h"
 #include "../../../DatabaseManagers/DatabaseManager.h"
 #include "Logger.h"
-#include <folly/String.h>
-#include <folly/json.h>
 #include <stdexcept>
+#include <unordered_map>
 
 namespace comm {
 void ThreadOperations::updateSQLiteUnreadStatus(
     std::string &threadID,
     bool unread) {
-  std::unique_ptr<Thread> thread =
-      DatabaseManager::getQueryExecutor().getThread(threadID);
-  if (thread == nullptr) {
-    Logger::log(
-        "Attempted to update non-existing thread with ID:  " + threadID);
-    return;
-  }
-  folly::dynamic updatedCurrentUser;
+  ThreadOperations::updateSQLiteUnreadStatus(
+      std::vector<std::string>{threadID}, unread);
+}
+
+void ThreadOperations::updateSQLiteUnreadStatus(
+    const std::vector<std::string> &threadIDs,
+    bool unread) {
   try {
-    updatedCurrentUser = folly::parseJson(thread->current_user);
-  } catch (const folly::json::parse_error &e) {
+    DatabaseManager::getQueryExecutor().updateThreadsJSONField(
+        threadIDs, "current_user", "unread", unread ? "true" : "false");
+  } catch (const std::system_error &e) {
     Logger::log(
-        "Invalid json structure of current_user field of thread of id: " +
-        threadID + ". Details: " + std::string(e.what()));
-    return;
+        "Failed to update unread status of threads. Details: " +
+        std::string(e.what()));
+  }
+}
+
+void ThreadOperations::updateSQLiteUnreadStatuses(
+    const std::vector<std::pair<std::string, bool>> &unreadStatuses) {
+  std::unordered_map<std::string, bool> lastUnreadStatuses;
+  for (const auto &unreadStatus : unreadStatuses) {
+    lastUnreadStatuses[unreadStatus.first] = unreadStatus.second;
+  }
+  std::vector<std::string> unreadThreadIDs;
+  std::vector<std::string> readThreadIDs;
+  for (const auto &unreadStatus : lastUnreadStatuses) {
+    (unreadStatus.second ? unreadThreadIDs : readThreadIDs)
+        .push_back(unreadStatus.first);
   }
-  updatedCurrentUser["unread"] = unread;
   try {
-    thread->current_user = folly::toJson(updatedCurrentUser);
-  } catch (const folly::json::parse_error &e) {
+    DatabaseManager::getQueryExecutor().beginTransaction();
+    try {
+      DatabaseManager::getQueryExecutor().updateThreadsJSONField(
+          unreadThreadIDs, "current_user", "unread", "true");
+      DatabaseManager::getQueryExecutor().updateThreadsJSONField(
+          readThreadIDs, "current_user", "unread", "false");
+    } catch (...) {
+      DatabaseManager::getQueryExecutor().rollbackTransaction();
+      throw;
+    }
+    DatabaseManager::getQueryExecutor().commitTransaction();
+  } catch (const std::system_error &e) {
     Logger::log(
-        "Failed to serialize updated current_user JSON object. Details: " +
+        "Failed to update unread status of threads. Details: " +
         std::string(e.what()));
-    return;
   }
-
-  DatabaseManager::getQueryExecutor().replaceThread(*thread);
 }
 } // namespace comm
@@ -3,10 +3,19 @@
 #include "../../../DatabaseManagers/entities/Thread.h"
 
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace comm {
 class ThreadOperations {
 public:
   static void updateSQLiteUnreadStatus(std::string &threadID, bool unread);
+  static void updateSQLiteUnreadStatus(
+      const std::vector<std::string> &threadIDs,
+      bool unread);
+  // Sets the unread status of every thread in one transaction. A thread
+  // listed more than once takes its last status.
+  static void updateSQLiteUnreadStatuses(
+      const std::vector<std::pair<std::string, bool>> &unreadStatuses);
 };
 } // namespace comm
@@ -13,6 +13,12 @@ public:
       std::string sqliteFilePath,
       std::string threadID,
       bool unread);
+  // Takes the statuses of the threads at the same indexes
+  static void updateSQLiteUnreadStatuses(
+      facebook::jni::alias_ref<ThreadOperationsJNIHelper> jThis,
+      std::string sqliteFilePath,
+      facebook::jni::alias_ref<facebook::jni::JArrayClass<jstring>> threadIDs,
+      facebook::jni::alias_ref<facebook::jni::JArrayBoolean> unreadStatuses);
   static void registerNatives();
 };
 } // namespace comm
@@ -38,6 +38,20 @@ private:
   Thread thread;
 };
 
+// Skips the write when the stored thread hashes the same
+class ReplaceThreadIfChangedOperation : public ThreadStoreOperationBase {
+public:
+  ReplaceThreadIfChangedOperation(Thread &&thread) : thread{std::move(thread)} {
+  }
+
+  virtual void execute() override {
+    DatabaseManager::getQueryExecutor().replaceThreadIfChanged(this->thread);
+  }
+
+private:
+  Thread thread;
+};
+
 class RemoveAllThreadsOperation : public ThreadStoreOperationBase {
 public:
   virtual void execute() override {
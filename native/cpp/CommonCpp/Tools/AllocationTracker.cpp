@@ -0,0 +1,120 @@
+#include "AllocationTracker.h"
+
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace comm {
+
+namespace {
+
+const size_t ALLOCATION_SHARDS_COUNT{8};
+
+const std::array<const char *, ALLOCATION_TAGS_COUNT> TAG_NAMES{
+    "untagged",
+    "database",
+    "jsiConversion",
+    "crypto",
+};
+
+// Aligned so that the threads of different shards don't share a cache line
+struct alignas(64) AllocationShard {
+  std::array<std::atomic<uint64_t>, ALLOCATION_TAGS_COUNT> counts;
+  std::array<std::atomic<uint64_t>, ALLOCATION_TAGS_COUNT> bytes;
+};
+
+// Zero initialized before any code runs, operator new may be called by the
+// constructors of other static objects
+AllocationShard shards[ALLOCATION_SHARDS_COUNT];
+std::atomic<size_t> nextShard{0};
+thread_local AllocationTag currentTag{AllocationTag::Untagged};
+thread_local size_t currentShard{ALLOCATION_SHARDS_COUNT};
+
+} // namespace
+
+bool AllocationTracker::isEnabled() {
+#ifdef COMM_ALLOCATION_TRACKING
+  return true;
+#else
+  return false;
+#endif
+}
+
+void AllocationTracker::record(size_t size) {
+  if (currentShard == ALLOCATION_SHARDS_COUNT) {
+    currentShard = nextShard.fetch_add(1, std::memory_order_relaxed) %
+        ALLOCATION_SHARDS_COUNT;
+  }
+  AllocationShard &shard = shards[currentShard];
+  const size_t tag = static_cast<size_t>(currentTag);
+  shard.counts[tag].fetch_add(1, std::memory_order_relaxed);
+  shard.bytes[tag].fetch_add(size, std::memory_order_relaxed);
+}
+
+std::vector<AllocationStats> AllocationTracker::snapshot() {
+  std::vector<AllocationStats> snapshot;
+  snapshot.reserve(ALLOCATION_TAGS_COUNT);
+  for (size_t tag = 0; tag < ALLOCATION_TAGS_COUNT; tag++) {
+    AllocationStats stats{TAG_NAMES[tag], 0, 0};
+    for (const AllocationShard &shard : shards) {
+      stats.count += shard.counts[tag].load(std::memory_order_relaxed);
+      stats.bytes += shard.bytes[tag].load(std::memory_order_relaxed);
+    }
+    snapshot.push_back(std::move(stats));
+  }
+  return snapshot;
+}
+
+ScopedAllocationTag::ScopedAllocationTag(AllocationTag tag)
+    : previousTag(currentTag) {
+  currentTag = tag;
+}
+
+ScopedAllocationTag::~ScopedAllocationTag() {
+  currentTag = this->previousTag;
+}
+
+} // namespace comm
+
+#ifdef COMM_ALLOCATION_TRACKING
+
+void *operator new(std::size_t size) {
+  comm::AllocationTracker::record(size);
+  void *pointer = std::malloc(size ? size : 1);
+  if (pointer == nullptr) {
+    throw std::bad_alloc();
+  }
+  return pointer;
+}
+
+void *operator new[](std::size_t size) {
+  return operator new(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  comm::AllocationTracker::record(size);
+  return std::malloc(size ? size : 1);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  return operator new(size, std::nothrow);
+}
+
+void operator delete(void *pointer) noexcept {
+  std::free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept {
+  std::free(pointer);
+}
+
+void operator delete(void *pointer, std::size_t) noexcept {
+  std::free(pointer);
+}
+
+void operator delete[](void *pointer, std::size_t) noexcept {
+  std::free(pointer);
+}
+
+#endif
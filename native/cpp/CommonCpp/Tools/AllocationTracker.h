@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace comm {
+
+// The code paths that allocations are attributed to, by the tag of the thread
+// that makes them
+enum class AllocationTag : uint8_t {
+  Untagged,
+  // The tasks of the database threads and the reads that run in place, which
+  // is mostly SQLiteQueryExecutor
+  Database,
+  // The callbacks that convert the results of native calls to JS values
+  JSIConversion,
+  // The tasks of the crypto threads, which is mostly CryptoModule
+  Crypto,
+};
+
+const size_t ALLOCATION_TAGS_COUNT{4};
+
+struct AllocationStats {
+  std::string tag;
+  // Allocations since the native code was loaded and the bytes they asked
+  // for. Frees aren't counted, these measure the churn rather than the memory
+  // in use.
+  uint64_t count;
+  uint64_t bytes;
+};
+
+// Only a build with COMM_ALLOCATION_TRACKING defined replaces the global
+// operator new with one that counts, in any other the counters stay at zero
+// and a tag costs a thread local store. The counters are sharded by thread,
+// so counting costs a relaxed atomic add on a line that the thread mostly
+// has to itself.
+class AllocationTracker {
+public:
+  static bool isEnabled();
+  // Called by operator new, it must not allocate
+  static void record(size_t size);
+  // One entry per tag, in the order of AllocationTag
+  static std::vector<AllocationStats> snapshot();
+};
+
+// Attributes the allocations of the thread to the tag until it goes out of
+// scope, scopes nest
+class ScopedAllocationTag {
+  const AllocationTag previousTag;
+
+public:
+  explicit ScopedAllocationTag(AllocationTag tag);
+  ~ScopedAllocationTag();
+
+  ScopedAllocationTag(const ScopedAllocationTag &) = delete;
+  ScopedAllocationTag &operator=(const ScopedAllocationTag &) = delete;
+};
+
+} // namespace comm
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <system_error>
+
+namespace comm {
+
+const std::string TASK_CANCELLED_FLAG{"TASK_CANCELLED"};
+
+// Cancels the database work of a request that is no longer needed. A queued
+// task whose token is cancelled is skipped. A running task makes its token
+// current on its thread with a Scope, so that the queries it runs can stop
+// early, see throwIfCancelled().
+class CancellationToken {
+  std::atomic<bool> cancelled{false};
+  static inline thread_local const CancellationToken *current{nullptr};
+
+public:
+  class Scope {
+    const CancellationToken *const previous;
+
+  public:
+    explicit Scope(const CancellationToken *token)
+        : previous(CancellationToken::current) {
+      CancellationToken::current = token;
+    }
+    ~Scope() {
+      CancellationToken::current = this->previous;
+    }
+
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+  };
+
+  void cancel() {
+    this->cancelled.store(true);
+  }
+
+  bool isCancelled() const {
+    return this->cancelled.load();
+  }
+
+  // Whether the task running on this thread has been cancelled
+  static bool isCurrentCancelled() {
+    return CancellationToken::current != nullptr &&
+        CancellationToken::current->isCancelled();
+  }
+
+  static void throwIfCancelled() {
+    if (CancellationToken::isCurrentCancelled()) {
+      throw std::system_error(
+          ECANCELED, std::generic_category(), TASK_CANCELLED_FLAG);
+    }
+  }
+};
+
+} // namespace comm
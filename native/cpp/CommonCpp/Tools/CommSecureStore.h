@@ -6,10 +6,23 @@
 
 namespace comm {
 
+/**
+ * Every lookup in the secure store of the platform is a round trip into
+ * Keychain on iOS or into Java on Android, so values are cached for the
+ * lifetime of the process, missing ones included. set writes through the
+ * cache. The cache doesn't see writes from other processes, or from JS, so
+ * it has to be cleared when the values may have changed underneath, e.g.
+ * once the sensitive data has been cleared.
+ */
 class CommSecureStore {
+  // Implemented by every platform
+  void setInPlatform(const std::string &key, const std::string &value) const;
+  folly::Optional<std::string> getFromPlatform(const std::string &key) const;
+
 public:
   void set(const std::string key, const std::string value) const;
   folly::Optional<std::string> get(const std::string key) const;
+  static void clearCache();
 };
 
 } // namespace comm
@@ -0,0 +1,54 @@
+#include "CommSecureStore.h"
+
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+namespace comm {
+
+namespace {
+
+std::mutex cacheMutex;
+std::unordered_map<std::string, folly::Optional<std::string>> cache;
+// Bumped by every write and clear, so that a lookup that ran alongside them
+// doesn't cache the value it read before
+uint64_t cacheGeneration{0};
+// Keeps the order of the writes the same in the store and in the cache
+std::mutex writeMutex;
+
+} // namespace
+
+void CommSecureStore::set(const std::string key, const std::string value)
+    const {
+  std::lock_guard<std::mutex> writeLock(writeMutex);
+  this->setInPlatform(key, value);
+  std::lock_guard<std::mutex> lock(cacheMutex);
+  cache[key] = value;
+  cacheGeneration++;
+}
+
+folly::Optional<std::string> CommSecureStore::get(const std::string key) const {
+  uint64_t generation;
+  {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto it = cache.find(key);
+    if (it != cache.end()) {
+      return it->second;
+    }
+    generation = cacheGeneration;
+  }
+  folly::Optional<std::string> value = this->getFromPlatform(key);
+  std::lock_guard<std::mutex> lock(cacheMutex);
+  if (generation == cacheGeneration) {
+    cache.emplace(key, value);
+  }
+  return value;
+}
+
+void CommSecureStore::clearCache() {
+  std::lock_guard<std::mutex> lock(cacheMutex);
+  cache.clear();
+  cacheGeneration++;
+}
+
+} // namespace comm
@@ -0,0 +1,206 @@
+#include "Logger.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace comm {
+
+namespace {
+
+int64_t steadyNowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+} // namespace
+
+// Bounded queue of many producers and one consumer, after the one of Dmitry
+// Vyukov, drained by a thread of its own. A slot is claimed by moving the
+// enqueue position, its sequence tells whether it's free to write, or to
+// read once written.
+class LoggerQueue {
+  struct Slot {
+    std::atomic<size_t> sequence;
+    std::string line;
+  };
+
+  const std::unique_ptr<Slot[]> slots;
+  std::atomic<size_t> enqueuePosition{0};
+  std::atomic<size_t> dequeuePosition{0};
+  std::atomic<uint64_t> droppedCount{0};
+  // The dequeue position once the lines before it are written
+  std::atomic<size_t> writtenPosition{0};
+  // Set by the first line since the thread last woke up
+  std::atomic<bool> wakeUpPending{false};
+  std::mutex wakeUpMutex;
+  std::condition_variable wakeUpCondition;
+
+  bool tryPop(std::string &line);
+  void writeQueuedLines();
+  void run();
+
+public:
+  LoggerQueue();
+  void push(std::string line);
+  void flush();
+};
+
+LoggerQueue::LoggerQueue() : slots(new Slot[LOGGER_QUEUE_CAPACITY]) {
+  for (size_t i = 0; i < LOGGER_QUEUE_CAPACITY; i++) {
+    this->slots[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  std::thread([this]() { this->run(); }).detach();
+}
+
+void LoggerQueue::push(std::string line) {
+  size_t position = this->enqueuePosition.load(std::memory_order_relaxed);
+  Slot *slot;
+  while (true) {
+    slot = &this->slots[position & (LOGGER_QUEUE_CAPACITY - 1)];
+    const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+    const int64_t difference =
+        static_cast<int64_t>(sequence) - static_cast<int64_t>(position);
+    if (difference == 0) {
+      if (this->enqueuePosition.compare_exchange_weak(
+              position, position + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (difference < 0) {
+      this->droppedCount++;
+      return;
+    } else {
+      position = this->enqueuePosition.load(std::memory_order_relaxed);
+    }
+  }
+  slot->line = std::move(line);
+  slot->sequence.store(position + 1, std::memory_order_release);
+  if (!this->wakeUpPending.exchange(true)) {
+    // Taken so that the thread can't miss the notification between checking
+    // the flag and waiting
+    std::lock_guard<std::mutex> lock(this->wakeUpMutex);
+    this->wakeUpCondition.notify_one();
+  }
+}
+
+bool LoggerQueue::tryPop(std::string &line) {
+  const size_t position = this->dequeuePosition.load(std::memory_order_relaxed);
+  Slot &slot = this->slots[position & (LOGGER_QUEUE_CAPACITY - 1)];
+  if (slot.sequence.load(std::memory_order_acquire) != position + 1) {
+    return false;
+  }
+  line = std::move(slot.line);
+  slot.line = std::string();
+  slot.sequence.store(
+      position + LOGGER_QUEUE_CAPACITY, std::memory_order_release);
+  this->dequeuePosition.store(position + 1, std::memory_order_release);
+  return true;
+}
+
+void LoggerQueue::writeQueuedLines() {
+  std::string batch;
+  std::string line;
+  // Bounded, so that the thread gets to flushing while lines keep coming
+  for (size_t count = 0;
+       count < LOGGER_QUEUE_CAPACITY && this->tryPop(line);
+       count++) {
+    if (!batch.empty() &&
+        batch.size() + 1 + line.size() > LOGGER_BATCH_MAX_LENGTH) {
+      Logger::write(batch);
+      batch.clear();
+    }
+    if (!batch.empty()) {
+      batch += '\n';
+    }
+    batch += line;
+  }
+  const uint64_t dropped = this->droppedCount.exchange(0);
+  if (dropped > 0) {
+    if (!batch.empty()) {
+      batch += '\n';
+    }
+    batch += "Logger: dropped " + std::to_string(dropped) + " lines";
+  }
+  if (!batch.empty()) {
+    Logger::write(batch);
+  }
+  this->writtenPosition.store(
+      this->dequeuePosition.load(std::memory_order_acquire));
+}
+
+void LoggerQueue::run() {
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(this->wakeUpMutex);
+      this->wakeUpCondition.wait(
+          lock, [this]() { return this->wakeUpPending.load(); });
+    }
+    std::this_thread::sleep_for(LOGGER_BATCH_WINDOW);
+    // Cleared before draining, a line pushed meanwhile wakes the thread up
+    // again
+    this->wakeUpPending.store(false);
+    this->writeQueuedLines();
+  }
+}
+
+void LoggerQueue::flush() {
+  const size_t position = this->enqueuePosition.load(std::memory_order_acquire);
+  const auto deadline = std::chrono::steady_clock::now() + LOGGER_FLUSH_TIMEOUT;
+  while (this->writtenPosition.load() < position &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+namespace {
+
+LoggerQueue &getLoggerQueue() {
+  // Never destroyed, the thread of the queue outlives the statics
+  static LoggerQueue *queue = new LoggerQueue();
+  return *queue;
+}
+
+} // namespace
+
+void Logger::log(std::string str) {
+  getLoggerQueue().push(std::move(str));
+}
+
+void Logger::flush() {
+  getLoggerQueue().flush();
+}
+
+LogRateLimiter::LogRateLimiter(std::chrono::milliseconds interval)
+    : interval(interval) {
+}
+
+bool LogRateLimiter::tryAcquire(uint64_t &suppressed) {
+  const int64_t now = steadyNowNs();
+  int64_t nextLineAt = this->nextLineAt.load(std::memory_order_relaxed);
+  if (now < nextLineAt ||
+      !this->nextLineAt.compare_exchange_strong(
+          nextLineAt,
+          now +
+              std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  this->interval)
+                  .count(),
+          std::memory_order_relaxed)) {
+    this->suppressedCount++;
+    return false;
+  }
+  suppressed = this->suppressedCount.exchange(0);
+  return true;
+}
+
+std::string
+LogRateLimiter::withSuppressed(std::string line, uint64_t suppressed) {
+  if (suppressed == 0) {
+    return line;
+  }
+  return "(" + std::to_string(suppressed) + " similar lines suppressed) " +
+      line;
+}
+
+} // namespace comm
@@ -1,12 +1,69 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <string>
 
 namespace comm {
 
+// Lines that fit in the queue of the logger, a power of two. The ones past
+// it are dropped and counted.
+const size_t LOGGER_QUEUE_CAPACITY{1024};
+// How long the thread of the logger waits for more lines once one comes in,
+// so that a burst is written in a few calls to the platform logger
+const std::chrono::milliseconds LOGGER_BATCH_WINDOW{50};
+// Lines are joined into a batch up to that length, below what os_log and
+// logcat cut an entry at
+const size_t LOGGER_BATCH_MAX_LENGTH{1000};
+const std::chrono::milliseconds LOGGER_FLUSH_TIMEOUT{500};
+
 class Logger {
+  // Writes the lines, separated by newlines, to the platform logger. Each
+  // platform implements it, it's only called on the thread of the logger.
+  static void write(const std::string &lines);
+
+  friend class LoggerQueue;
+
+public:
+  // Queues the line and returns, the thread of the logger writes it. The
+  // queue takes no lock, and only the first line of a batch wakes the
+  // thread up.
+  static void log(std::string str);
+  // Waits until the lines queued so far are written, for a limited time,
+  // e.g. before the app is terminated
+  static void flush();
+};
+
+// Lets one line through per interval, see LOG_EVERY_MS
+class LogRateLimiter {
+  const std::chrono::steady_clock::duration interval;
+  std::atomic<int64_t> nextLineAt{0};
+  std::atomic<uint64_t> suppressedCount{0};
+
 public:
-  static void log(const std::string str);
+  explicit LogRateLimiter(std::chrono::milliseconds interval);
+  // If the line may be logged, returns true and the number of lines that
+  // were suppressed since the last one
+  bool tryAcquire(uint64_t &suppressed);
+  // Prefixes the line with the number of lines suppressed before it
+  static std::string withSuppressed(std::string line, uint64_t suppressed);
 };
 
 } // namespace comm
+
+// Like Logger::log, for the lines that may repeat for every row or message
+// of a batch. Every call site logs at most once per interval, and the next
+// line that it logs tells how many were suppressed in between. The line
+// isn't built for a suppressed one.
+#define LOG_EVERY_MS(intervalMs, line)                                   \
+  do {                                                                   \
+    static ::comm::LogRateLimiter commLogLimiter{                        \
+        std::chrono::milliseconds(intervalMs)};                          \
+    uint64_t commLogSuppressed = 0;                                      \
+    if (commLogLimiter.tryAcquire(commLogSuppressed)) {                  \
+      ::comm::Logger::log(                                               \
+          ::comm::LogRateLimiter::withSuppressed(line, commLogSuppressed)); \
+    }                                                                    \
+  } while (0)
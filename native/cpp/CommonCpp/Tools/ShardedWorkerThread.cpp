@@ -0,0 +1,60 @@
+#include "ShardedWorkerThread.h"
+
+#include <algorithm>
+#include <functional>
+
+namespace comm {
+
+ShardedWorkerThread::ShardedWorkerThread(
+    const std::string name,
+    size_t shardsCount,
+    ThreadAttachment attachment,
+    AllocationTag allocationTag,
+    ThreadQoS qos)
+    : name(name),
+      attachment(attachment),
+      allocationTag(allocationTag),
+      qos(qos),
+      shards(std::max<size_t>(shardsCount, 1)) {
+}
+
+WorkerThread &ShardedWorkerThread::getShard(const std::string &key) {
+  const size_t index = std::hash<std::string>{}(key) % this->shards.size();
+  std::lock_guard<std::mutex> lock(this->shardsMutex);
+  std::unique_ptr<WorkerThread> &shard = this->shards[index];
+  if (shard == nullptr) {
+    shard = std::make_unique<WorkerThread>(
+        this->name,
+        OverflowPolicy::Spill,
+        this->attachment,
+        this->allocationTag,
+        this->qos);
+  }
+  return *shard;
+}
+
+void ShardedWorkerThread::scheduleTask(
+    const std::string &key,
+    WorkerTask task,
+    TaskPriority priority) {
+  this->getShard(key).scheduleTask(std::move(task), priority);
+}
+
+std::vector<WorkerThreadStats> ShardedWorkerThread::getStats() {
+  std::vector<WorkerThread *> startedShards;
+  {
+    std::lock_guard<std::mutex> lock(this->shardsMutex);
+    for (const auto &shard : this->shards) {
+      if (shard != nullptr) {
+        startedShards.push_back(shard.get());
+      }
+    }
+  }
+  std::vector<WorkerThreadStats> stats;
+  for (WorkerThread *shard : startedShards) {
+    stats.push_back(shard->getStats());
+  }
+  return stats;
+}
+
+} // namespace comm
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "WorkerThread.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace comm {
+
+/**
+ * A few worker threads where tasks are routed by key, like the peer whose
+ * olm session they use. Tasks of the same key run on the same thread, in
+ * the order they were scheduled, while tasks of different keys may run in
+ * parallel. Threads are only started once a task is routed to them.
+ */
+class ShardedWorkerThread {
+  const std::string name;
+  const ThreadAttachment attachment;
+  const AllocationTag allocationTag;
+  const ThreadQoS qos;
+  std::mutex shardsMutex;
+  std::vector<std::unique_ptr<WorkerThread>> shards;
+
+  WorkerThread &getShard(const std::string &key);
+
+public:
+  ShardedWorkerThread(
+      const std::string name,
+      size_t shardsCount,
+      ThreadAttachment attachment = ThreadAttachment::PerTask,
+      AllocationTag allocationTag = AllocationTag::Untagged,
+      ThreadQoS qos = ThreadQoS::Default);
+  void scheduleTask(
+      const std::string &key,
+      WorkerTask task,
+      TaskPriority priority = TaskPriority::Normal);
+  // One entry per started thread, all under the same name
+  std::vector<WorkerThreadStats> getStats();
+};
+
+} // namespace comm
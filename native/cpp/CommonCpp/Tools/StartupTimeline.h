@@ -0,0 +1,90 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace comm {
+
+// Times in microseconds on the monotonic clock, since the native code was
+// loaded
+struct StartupPhase {
+  std::string name;
+  int64_t startUs;
+  int64_t durationUs;
+};
+
+// Phases of a launch, e.g. opening the database or restoring the crypto
+// account. Only the first run of every phase is kept, the later ones aren't
+// part of the startup.
+class StartupTimeline {
+  static inline const std::chrono::steady_clock::time_point origin =
+      std::chrono::steady_clock::now();
+  static inline std::mutex mutex;
+  static inline std::vector<StartupPhase> phases;
+  static inline std::vector<std::string> recordedNames;
+
+  static int64_t sinceOrigin(std::chrono::steady_clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               time - StartupTimeline::origin)
+        .count();
+  }
+
+public:
+  static void record(
+      const std::string &name,
+      std::chrono::steady_clock::time_point start,
+      std::chrono::steady_clock::time_point end) {
+    std::lock_guard<std::mutex> lock(StartupTimeline::mutex);
+    auto &names = StartupTimeline::recordedNames;
+    if (std::find(names.begin(), names.end(), name) != names.end()) {
+      return;
+    }
+    names.push_back(name);
+    StartupTimeline::phases.push_back(StartupPhase{
+        name,
+        StartupTimeline::sinceOrigin(start),
+        std::chrono::duration_cast<std::chrono::microseconds>(end - start)
+            .count()});
+  }
+
+  // Returns the phases recorded since the last call, in the order they
+  // started
+  static std::vector<StartupPhase> take() {
+    std::vector<StartupPhase> taken;
+    {
+      std::lock_guard<std::mutex> lock(StartupTimeline::mutex);
+      taken.swap(StartupTimeline::phases);
+    }
+    std::stable_sort(
+        taken.begin(),
+        taken.end(),
+        [](const StartupPhase &a, const StartupPhase &b) {
+          return a.startUs < b.startUs;
+        });
+    return taken;
+  }
+};
+
+// Records a phase that lasts for the scope
+class StartupTimelinePhase {
+  const std::string name;
+  const std::chrono::steady_clock::time_point start;
+
+public:
+  explicit StartupTimelinePhase(std::string name)
+      : name(std::move(name)), start(std::chrono::steady_clock::now()) {
+  }
+  ~StartupTimelinePhase() {
+    StartupTimeline::record(
+        this->name, this->start, std::chrono::steady_clock::now());
+  }
+
+  StartupTimelinePhase(const StartupTimelinePhase &) = delete;
+  StartupTimelinePhase &operator=(const StartupTimelinePhase &) = delete;
+};
+
+} // namespace comm
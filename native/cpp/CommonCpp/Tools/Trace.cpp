@@ -0,0 +1,100 @@
+#include "Trace.h"
+
+#include <atomic>
+
+namespace comm {
+
+namespace {
+
+thread_local const char *currentCallName{nullptr};
+thread_local TraceCall *currentCall{nullptr};
+std::atomic<int32_t> lastAsyncCookie{0};
+
+} // namespace
+
+int32_t Trace::nextAsyncCookie() {
+  // Wraps around, the cookies only have to differ while the sections are
+  // open
+  return ++lastAsyncCookie & INT32_MAX;
+}
+
+TraceSection::TraceSection(const std::string &name)
+    : begun(Trace::isEnabled()) {
+  if (this->begun) {
+    Trace::beginSection(name);
+  }
+}
+
+TraceSection::~TraceSection() {
+  if (this->begun) {
+    Trace::endSection();
+  }
+}
+
+TraceCall::TraceCall(const char *name)
+    : previousName(currentCallName),
+      previousCall(currentCall),
+      parsing(Trace::isEnabled()) {
+  currentCallName = name;
+  currentCall = this;
+  if (this->parsing) {
+    Trace::beginSection(name);
+    Trace::beginSection(TraceCall::sectionName("parse"));
+  }
+}
+
+TraceCall::~TraceCall() {
+  currentCallName = this->previousName;
+  currentCall = this->previousCall;
+  if (!this->parsing && !this->converting) {
+    // Tracing started in the middle of the call
+    return;
+  }
+  // The outer section and the parse or jsi one
+  Trace::endSection();
+  Trace::endSection();
+}
+
+void TraceCall::endParsing() {
+  TraceCall *call = currentCall;
+  if (call == nullptr || !call->parsing) {
+    return;
+  }
+  call->parsing = false;
+  Trace::endSection();
+  call->converting = true;
+  // Keeps the pair of sections for the destructor until the conversion
+  // starts, the gap is the wait for the result
+  Trace::beginSection(TraceCall::sectionName("wait"));
+}
+
+void TraceCall::beginConversion() {
+  TraceCall *call = currentCall;
+  if (call == nullptr || !call->converting) {
+    return;
+  }
+  Trace::endSection();
+  Trace::beginSection(TraceCall::sectionName("jsi"));
+}
+
+const char *TraceCall::current() {
+  return currentCallName;
+}
+
+std::string TraceCall::sectionName(const std::string &stage) {
+  if (currentCallName == nullptr) {
+    return stage;
+  }
+  return std::string(currentCallName) + ": " + stage;
+}
+
+TraceCallScope::TraceCallScope(const char *name)
+    : previousName(currentCallName) {
+  currentCallName = name;
+}
+
+TraceCallScope::~TraceCallScope() {
+  currentCallName = this->previousName;
+}
+
+} // namespace comm
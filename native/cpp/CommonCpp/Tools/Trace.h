@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace comm {
+
+// Markers for the platform profilers, Systrace/Perfetto on Android and
+// os_signpost in Instruments on iOS. They only cost a check while no profiler
+// records.
+class Trace {
+public:
+  static bool isEnabled();
+  // A section ends on the thread that began it, the sections of a thread nest
+  static void beginSection(const std::string &name);
+  static void endSection();
+  // An async section may end on another thread, the cookie tells apart the
+  // sections of the same name that are open at the same time
+  static void beginAsyncSection(const std::string &name, int32_t cookie);
+  static void endAsyncSection(const std::string &name, int32_t cookie);
+  static int32_t nextAsyncCookie();
+};
+
+class TraceSection {
+  bool begun;
+
+public:
+  explicit TraceSection(const std::string &name);
+  ~TraceSection();
+
+  TraceSection(const TraceSection &) = delete;
+  TraceSection &operator=(const TraceSection &) = delete;
+};
+
+// A call from JS into a native module. The work done on behalf of the call
+// is named after it, so a call breaks down into:
+// - "<call>: parse" on the JS thread, until the work leaves the thread
+// - "<call>: wait" on the JS thread, until the call returns or converts a
+//   result that it has waited for in "<call>: jsi"
+// - "<call>: <thread> queue" while it waits for a WorkerThread
+// - "<call>: <thread>" while it runs on the WorkerThread
+// - "<call>: js queue" and "<call>: jsi" while the result waits for the JS
+//   thread and is converted to JS values there
+// The name has to be a literal, it is passed between the threads.
+class TraceCall {
+  const char *const previousName;
+  TraceCall *const previousCall;
+  bool parsing;
+  bool converting{false};
+
+public:
+  explicit TraceCall(const char *name);
+  ~TraceCall();
+
+  // Ends the parse section of the call that runs on this thread
+  static void endParsing();
+  // Starts the jsi section of the call that runs on this thread, for the
+  // calls that convert the result they have waited for
+  static void beginConversion();
+  // The call that this thread works for, or nullptr
+  static const char *current();
+  // "<call>: <stage>" for the call that this thread works for
+  static std::string sectionName(const std::string &stage);
+
+  TraceCall(const TraceCall &) = delete;
+  TraceCall &operator=(const TraceCall &) = delete;
+};
+
+// Names the call that a thread works for while it runs a task of the call
+class TraceCallScope {
+  const char *const previousName;
+
+public:
+  explicit TraceCallScope(const char *name);
+  ~TraceCallScope();
+
+  TraceCallScope(const TraceCallScope &) = delete;
+  TraceCallScope &operator=(const TraceCallScope &) = delete;
+};
+
+} // namespace comm
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace comm {
+
+const size_t WORKER_TASK_INLINE_SIZE{112};
+
+template <typename F> struct IsNullableCallable : std::is_pointer<F> {};
+template <typename Signature>
+struct IsNullableCallable<std::function<Signature>> : std::true_type {};
+
+// Move-only callable that keeps callables of up to WORKER_TASK_INLINE_SIZE
+// bytes inline, so scheduling one on a worker thread doesn't allocate.
+// Bigger callables fall back to a heap allocation.
+class WorkerTask {
+  struct Operations {
+    void (*invoke)(void *storage);
+    void (*move)(void *from, void *to);
+    void (*destroy)(void *storage);
+  };
+
+  template <typename F> struct InlineOperations {
+    static void invoke(void *storage) {
+      (*static_cast<F *>(storage))();
+    }
+    static void move(void *from, void *to) {
+      new (to) F(std::move(*static_cast<F *>(from)));
+      static_cast<F *>(from)->~F();
+    }
+    static void destroy(void *storage) {
+      static_cast<F *>(storage)->~F();
+    }
+    static constexpr Operations operations{invoke, move, destroy};
+  };
+
+  template <typename F> struct HeapOperations {
+    static void invoke(void *storage) {
+      (**static_cast<F **>(storage))();
+    }
+    static void move(void *from, void *to) {
+      *static_cast<F **>(to) = *static_cast<F **>(from);
+    }
+    static void destroy(void *storage) {
+      delete *static_cast<F **>(storage);
+    }
+    static constexpr Operations operations{invoke, move, destroy};
+  };
+
+  alignas(std::max_align_t) unsigned char storage[WORKER_TASK_INLINE_SIZE];
+  const Operations *operations{nullptr};
+
+  void reset() {
+    if (this->operations != nullptr) {
+      this->operations->destroy(this->storage);
+      this->operations = nullptr;
+    }
+  }
+
+public:
+  WorkerTask() {
+  }
+
+  WorkerTask(std::nullptr_t) {
+  }
+
+  template <
+      typename Callable,
+      typename F = std::decay_t<Callable>,
+      typename = std::enable_if_t<!std::is_same<F, WorkerTask>::value>>
+  WorkerTask(Callable &&callable) {
+    if constexpr (IsNullableCallable<F>::value) {
+      if (!callable) {
+        return;
+      }
+    }
+    if constexpr (
+        sizeof(F) <= WORKER_TASK_INLINE_SIZE &&
+        alignof(F) <= alignof(std::max_align_t) &&
+        std::is_nothrow_move_constructible<F>::value) {
+      new (this->storage) F(std::forward<Callable>(callable));
+      this->operations = &InlineOperations<F>::operations;
+    } else {
+      *reinterpret_cast<F **>(this->storage) =
+          new F(std::forward<Callable>(callable));
+      this->operations = &HeapOperations<F>::operations;
+    }
+  }
+
+  WorkerTask(WorkerTask &&other) noexcept : operations(other.operations) {
+    if (this->operations != nullptr) {
+      this->operations->move(other.storage, this->storage);
+      other.operations = nullptr;
+    }
+  }
+
+  WorkerTask &operator=(WorkerTask &&other) noexcept {
+    if (this != &other) {
+      this->reset();
+      this->operations = other.operations;
+      if (this->operations != nullptr) {
+        this->operations->move(other.storage, this->storage);
+        other.operations = nullptr;
+      }
+    }
+    return *this;
+  }
+
+  WorkerTask(const WorkerTask &) = delete;
+  WorkerTask &operator=(const WorkerTask &) = delete;
+
+  ~WorkerTask() {
+    this->reset();
+  }
+
+  explicit operator bool() const {
+    return this->operations != nullptr;
+  }
+
+  void operator()() {
+    this->operations->invoke(this->storage);
+  }
+};
+
+struct QueuedWorkerTask {
+  WorkerTask task;
+  std::chrono::steady_clock::time_point scheduledAt;
+};
+
+// FIFO ring buffer of tasks. Its storage only grows, so once it has reached
+// the size of the largest burst, queueing a task doesn't allocate.
+class WorkerTaskQueue {
+  std::vector<QueuedWorkerTask> tasks;
+  size_t head{0};
+  size_t count{0};
+
+public:
+  WorkerTaskQueue(size_t initialCapacity = 16) : tasks(initialCapacity) {
+  }
+
+  bool empty() const {
+    return this->count == 0;
+  }
+
+  size_t size() const {
+    return this->count;
+  }
+
+  void
+  push(WorkerTask task, std::chrono::steady_clock::time_point scheduledAt) {
+    if (this->count == this->tasks.size()) {
+      std::vector<QueuedWorkerTask> grown(
+          std::max<size_t>(2 * this->count, 16));
+      for (size_t i = 0; i < this->count; i++) {
+        grown[i] = std::move(this->tasks[(this->head + i) % this->count]);
+      }
+      this->tasks = std::move(grown);
+      this->head = 0;
+    }
+    QueuedWorkerTask &queuedTask =
+        this->tasks[(this->head + this->count) % this->tasks.size()];
+    queuedTask.task = std::move(task);
+    queuedTask.scheduledAt = scheduledAt;
+    this->count++;
+  }
+
+  QueuedWorkerTask pop() {
+    QueuedWorkerTask queuedTask = std::move(this->tasks[this->head]);
+    this->head = (this->head + 1) % this->tasks.size();
+    this->count--;
+    return queuedTask;
+  }
+};
+
+} // namespace comm
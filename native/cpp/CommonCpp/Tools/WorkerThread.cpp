@@ -1,33 +1,339 @@
 #include "WorkerThread.h"
 #include "Logger.h"
+#include "Trace.h"
+#include <algorithm>
 #include <sstream>
 
+#ifdef __ANDROID__
+#include <fbjni/fbjni.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#ifdef __APPLE__
+#include <pthread.h>
+#include <pthread/qos.h>
+#endif
+
 namespace comm {
 
-WorkerThread::WorkerThread(const std::string name)
-    : tasks(folly::MPMCQueue<std::unique_ptr<taskType>>(100)), name(name) {
+namespace {
+
+#ifdef __ANDROID__
+// Set on the threads that are attached for their whole life
+thread_local bool lifetimeAttached = false;
+#endif
+
+#ifdef __ANDROID__
+// The nice values of android.os.Process for the classes, the lower the more
+// CPU time a thread gets
+int threadPriority(ThreadQoS qos) {
+  if (qos == ThreadQoS::UserInteractive) {
+    // THREAD_PRIORITY_DISPLAY
+    return -4;
+  }
+  if (qos == ThreadQoS::UserInitiated) {
+    // THREAD_PRIORITY_FOREGROUND
+    return -2;
+  }
+  if (qos == ThreadQoS::Utility) {
+    // THREAD_PRIORITY_BACKGROUND
+    return 10;
+  }
+  return 0;
+}
+
+// android.os.Process also moves the thread between the foreground and the
+// background thread groups, which the NDK can't. The thread has to be
+// attached.
+void setThreadPriority(pid_t tid, ThreadQoS qos) {
+  static const auto processClass =
+      facebook::jni::findClassStatic("android/os/Process");
+  static const auto setThreadPriorityMethod =
+      processClass->getStaticMethod<void(jint, jint)>("setThreadPriority");
+  setThreadPriorityMethod(processClass, tid, threadPriority(qos));
+}
+#endif
+
+#ifdef __APPLE__
+qos_class_t qosClass(ThreadQoS qos) {
+  if (qos == ThreadQoS::UserInteractive) {
+    return QOS_CLASS_USER_INTERACTIVE;
+  }
+  if (qos == ThreadQoS::UserInitiated) {
+    return QOS_CLASS_USER_INITIATED;
+  }
+  if (qos == ThreadQoS::Utility) {
+    return QOS_CLASS_UTILITY;
+  }
+  return QOS_CLASS_DEFAULT;
+}
+#endif
+
+// Runs on the thread once it starts
+void applyQoS(ThreadQoS qos) {
+  if (qos == ThreadQoS::Default) {
+    return;
+  }
+#ifdef __ANDROID__
+  WorkerThread::runNativeAccessible([qos]() {
+    try {
+      setThreadPriority(gettid(), qos);
+    } catch (const std::exception &e) {
+      Logger::log(
+          "Failed to set the thread priority: " + std::string(e.what()));
+    }
+  });
+#elif defined(__APPLE__)
+  pthread_set_qos_class_self_np(qosClass(qos), 0);
+#endif
+}
+
+uint64_t elapsedUs(
+    std::chrono::steady_clock::time_point from,
+    std::chrono::steady_clock::time_point to) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(to - from)
+      .count();
+}
+
+} // namespace
+
+void mergeWorkerThreadStats(
+    WorkerThreadStats &stats,
+    const WorkerThreadStats &otherStats) {
+  stats.queueDepth += otherStats.queueDepth;
+  stats.maxQueueDepth = std::max(stats.maxQueueDepth, otherStats.maxQueueDepth);
+  stats.scheduledTasks += otherStats.scheduledTasks;
+  stats.overflowedTasks += otherStats.overflowedTasks;
+  stats.rejectedTasks += otherStats.rejectedTasks;
+  stats.completedTasks += otherStats.completedTasks;
+  stats.totalWaitUs += otherStats.totalWaitUs;
+  stats.maxWaitUs = std::max(stats.maxWaitUs, otherStats.maxWaitUs);
+  stats.totalRunUs += otherStats.totalRunUs;
+  stats.maxRunUs = std::max(stats.maxRunUs, otherStats.maxRunUs);
+}
+
+WorkerThread::WorkerThread(
+    const std::string name,
+    OverflowPolicy overflowPolicy,
+    ThreadAttachment attachment,
+    AllocationTag allocationTag,
+    ThreadQoS qos)
+    : name(name),
+      overflowPolicy(overflowPolicy),
+      attachment(attachment),
+      allocationTag(allocationTag),
+      qos(qos) {
+  this->stats.name = name;
   auto job = [this]() {
+    applyQoS(this->qos);
     while (true) {
-      std::unique_ptr<taskType> lastTask;
-      this->tasks.blockingRead(lastTask);
-      if (lastTask == nullptr) {
+      QueuedWorkerTask lastTask = this->popTask();
+      if (!lastTask.task) {
         break;
       }
-      (*lastTask)();
+      const auto startedAt = std::chrono::steady_clock::now();
+      lastTask.task();
+      this->recordRun(startedAt, std::chrono::steady_clock::now());
     }
   };
-  this->thread = std::make_unique<std::thread>(job);
+  this->thread = std::make_unique<std::thread>([this, job]() {
+    // Everything that the tasks allocate is attributed to the thread
+    const ScopedAllocationTag allocationScope(this->allocationTag);
+    if (this->attachment != ThreadAttachment::Lifetime) {
+      job();
+      return;
+    }
+#ifdef __ANDROID__
+    // The scope attaches the thread once and caches its JNI env, which the
+    // JNI calls of the tasks then use without attaching again. The class
+    // loader of the app is kept for the lookups of the app classes.
+    facebook::jni::ThreadScope::WithClassLoader([job]() {
+      lifetimeAttached = true;
+      job();
+    });
+#else
+    job();
+#endif
+  });
 }
 
-void WorkerThread::scheduleTask(const taskType task) {
-  if (!this->tasks.write(std::make_unique<taskType>(std::move(task)))) {
-    throw std::runtime_error(
-        "Error scheduling task on the " + this->name + " worker thread");
+void WorkerThread::runNativeAccessible(taskType task) {
+#ifdef __ANDROID__
+  if (!lifetimeAttached) {
+    facebook::jni::ThreadScope::WithClassLoader(std::move(task));
+    return;
+  }
+#endif
+  task();
+}
+
+QueuedWorkerTask WorkerThread::popTask() {
+  std::unique_lock<std::mutex> lock(this->tasksMutex);
+  this->tasksCondition.wait(
+      lock, [this]() { return this->tasksCount > 0 || this->stopping; });
+  if (this->tasksCount == 0) {
+    return QueuedWorkerTask{};
+  }
+
+  // The highest nonempty class runs unless a lower one has been passed over
+  // too many times
+  size_t picked = WORKER_THREAD_PRIORITIES_COUNT;
+  for (size_t i = 0; i < WORKER_THREAD_PRIORITIES_COUNT; i++) {
+    if (this->tasks[i].empty()) {
+      continue;
+    }
+    if (picked == WORKER_THREAD_PRIORITIES_COUNT) {
+      picked = i;
+    } else if (this->passedOver[i] >= WORKER_THREAD_STARVATION_LIMIT) {
+      picked = i;
+      break;
+    }
+  }
+  for (size_t i = picked + 1; i < WORKER_THREAD_PRIORITIES_COUNT; i++) {
+    if (!this->tasks[i].empty()) {
+      this->passedOver[i]++;
+    }
+  }
+  this->passedOver[picked] = 0;
+
+  QueuedWorkerTask task = this->tasks[picked].pop();
+  this->tasksCount--;
+  this->stats.queueDepth = this->tasksCount;
+  const uint64_t waitUs =
+      elapsedUs(task.scheduledAt, std::chrono::steady_clock::now());
+  this->stats.totalWaitUs += waitUs;
+  this->stats.maxWaitUs = std::max(this->stats.maxWaitUs, waitUs);
+  if (this->tasksCount < WORKER_THREAD_QUEUE_CAPACITY) {
+    this->spaceCondition.notify_one();
+  }
+  return task;
+}
+
+void WorkerThread::recordRun(
+    std::chrono::steady_clock::time_point startedAt,
+    std::chrono::steady_clock::time_point endedAt) {
+  const uint64_t runUs = elapsedUs(startedAt, endedAt);
+  std::lock_guard<std::mutex> lock(this->tasksMutex);
+  this->stats.completedTasks++;
+  this->stats.totalRunUs += runUs;
+  this->stats.maxRunUs = std::max(this->stats.maxRunUs, runUs);
+}
+
+WorkerTask WorkerThread::traceTask(WorkerTask task) {
+  TraceCall::endParsing();
+  const char *callName = TraceCall::current();
+  std::string sectionName = TraceCall::sectionName(this->name);
+  int32_t cookie = Trace::nextAsyncCookie();
+  Trace::beginAsyncSection(sectionName + " queue", cookie);
+  return [task = std::move(task),
+          callName,
+          sectionName = std::move(sectionName),
+          cookie]() mutable {
+    Trace::endAsyncSection(sectionName + " queue", cookie);
+    TraceCallScope callScope(callName);
+    TraceSection section(sectionName);
+    task();
+  };
+}
+
+void WorkerThread::scheduleTask(WorkerTask task, TaskPriority priority) {
+  if (Trace::isEnabled()) {
+    task = this->traceTask(std::move(task));
+  }
+  {
+    std::unique_lock<std::mutex> lock(this->tasksMutex);
+    if (this->tasksCount >= WORKER_THREAD_QUEUE_CAPACITY) {
+      this->stats.overflowedTasks++;
+      if (this->overflowPolicy == OverflowPolicy::Spill &&
+          this->tasksCount == WORKER_THREAD_QUEUE_CAPACITY) {
+        Logger::log(
+            "The " + this->name +
+            " worker thread queue is full, queueing tasks above capacity");
+      }
+      if (this->overflowPolicy == OverflowPolicy::Block &&
+          !this->spaceCondition.wait_for(
+              lock, WORKER_THREAD_BLOCK_TIMEOUT, [this]() {
+                return this->tasksCount < WORKER_THREAD_QUEUE_CAPACITY;
+              })) {
+        this->stats.rejectedTasks++;
+        throw std::runtime_error(
+            "Error scheduling task on the " + this->name + " worker thread");
+      }
+    }
+    this->tasks[static_cast<size_t>(priority)].push(
+        std::move(task), std::chrono::steady_clock::now());
+    this->tasksCount++;
+    this->stats.scheduledTasks++;
+    this->stats.queueDepth = this->tasksCount;
+    this->stats.maxQueueDepth =
+        std::max(this->stats.maxQueueDepth, this->tasksCount);
+  }
+  this->tasksCondition.notify_one();
+}
+
+WorkerThreadStats WorkerThread::getStats() {
+  std::lock_guard<std::mutex> lock(this->tasksMutex);
+  return this->stats;
+}
+
+void WorkerThread::beginQoSBoost() {
+  std::lock_guard<std::mutex> lock(this->boostMutex);
+  if (this->boostsCount++ > 0 || this->qos == ThreadQoS::UserInteractive) {
+    return;
+  }
+#ifdef __ANDROID__
+  // The nice value only, the calls are too frequent for JNI and the boosted
+  // threads are in the foreground group already
+  setpriority(
+      PRIO_PROCESS,
+      pthread_gettid_np(this->thread->native_handle()),
+      threadPriority(ThreadQoS::UserInteractive));
+#elif defined(__APPLE__)
+  this->boostHandle = pthread_override_qos_class_start_np(
+      this->thread->native_handle(), QOS_CLASS_USER_INTERACTIVE, 0);
+#endif
+}
+
+void WorkerThread::endQoSBoost() {
+  std::lock_guard<std::mutex> lock(this->boostMutex);
+  if (this->boostsCount == 0 || --this->boostsCount > 0 ||
+      this->qos == ThreadQoS::UserInteractive) {
+    return;
+  }
+#ifdef __ANDROID__
+  setpriority(
+      PRIO_PROCESS,
+      pthread_gettid_np(this->thread->native_handle()),
+      threadPriority(this->qos));
+#elif defined(__APPLE__)
+  if (this->boostHandle != nullptr) {
+    pthread_override_qos_class_end_np(
+        static_cast<pthread_override_t>(this->boostHandle));
+    this->boostHandle = nullptr;
+  }
+#endif
+}
+
+ScopedQoSBoost::ScopedQoSBoost(WorkerThread *workerThread)
+    : workerThread(workerThread) {
+  if (this->workerThread != nullptr) {
+    this->workerThread->beginQoSBoost();
+  }
+}
+
+ScopedQoSBoost::~ScopedQoSBoost() {
+  if (this->workerThread != nullptr) {
+    this->workerThread->endQoSBoost();
   }
 }
 
 WorkerThread::~WorkerThread() {
-  this->tasks.blockingWrite(nullptr);
+  {
+    std::lock_guard<std::mutex> lock(this->tasksMutex);
+    this->stopping = true;
+  }
+  this->tasksCondition.notify_one();
   try {
     this->thread->join();
   } catch (const std::system_error &error) {
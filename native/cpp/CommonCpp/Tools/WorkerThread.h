@@ -1,7 +1,15 @@
 #pragma once
 
-#include <folly/MPMCQueue.h>
+#include "AllocationTracker.h"
+#include "WorkerTask.h"
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 
@@ -9,15 +17,138 @@ namespace comm {
 
 using taskType = std::function<void()>;
 
+// Tasks of a higher class run first. Tasks of different classes may run out
+// of the order they were scheduled in, so a class should only be chosen for
+// work that doesn't depend on tasks of other classes scheduled before it.
+enum class TaskPriority {
+  // user-initiated work the UI is waiting on
+  Interactive,
+  Normal,
+  // bulk work nobody is waiting on
+  Background,
+};
+
+// What scheduleTask does once the queue holds its capacity of tasks
+enum class OverflowPolicy {
+  // waits for the worker to catch up and throws if it doesn't in time
+  Block,
+  // queues the task anyway, so a burst only adds latency
+  Spill,
+};
+
+// How a thread gets access to the platform, on Android the JVM
+enum class ThreadAttachment {
+  // every task that needs it attaches and detaches, see
+  // WorkerThread::runNativeAccessible
+  PerTask,
+  // the thread stays attached for its whole life, for the threads whose tasks
+  // keep calling into the platform, like the database and crypto ones
+  Lifetime,
+};
+
+// How the platform schedules the thread against the UI and the other threads
+// of the app, the QoS classes on iOS and the nice values on Android
+enum class ThreadQoS {
+  // the UI is blocked until the work is done, like a sync JSI call
+  UserInteractive,
+  // the UI waits for the results, like the database and crypto threads
+  UserInitiated,
+  // left as the platform starts threads
+  Default,
+  // long running work nobody is waiting on
+  Utility,
+};
+
+const size_t WORKER_THREAD_PRIORITIES_COUNT{3};
+const size_t WORKER_THREAD_QUEUE_CAPACITY{100};
+const std::chrono::milliseconds WORKER_THREAD_BLOCK_TIMEOUT{1000};
+// A lower class task runs after being passed over that many times in a row
+const size_t WORKER_THREAD_STARVATION_LIMIT{8};
+
+struct WorkerThreadStats {
+  std::string name;
+  size_t queueDepth;
+  size_t maxQueueDepth;
+  uint64_t scheduledTasks;
+  // tasks queued above capacity or that had to wait for space
+  uint64_t overflowedTasks;
+  uint64_t rejectedTasks;
+  uint64_t completedTasks;
+  // from scheduling to the start of the task, and from its start to its end
+  uint64_t totalWaitUs;
+  uint64_t maxWaitUs;
+  uint64_t totalRunUs;
+  uint64_t maxRunUs;
+};
+
+// Adds up the stats of threads doing the same work, like the database
+// readers
+void mergeWorkerThreadStats(
+    WorkerThreadStats &stats,
+    const WorkerThreadStats &otherStats);
+
 class WorkerThread {
   std::unique_ptr<std::thread> thread;
-  folly::MPMCQueue<std::unique_ptr<taskType>> tasks;
+  std::array<WorkerTaskQueue, WORKER_THREAD_PRIORITIES_COUNT> tasks;
+  std::array<size_t, WORKER_THREAD_PRIORITIES_COUNT> passedOver{};
+  size_t tasksCount{0};
+  bool stopping{false};
+  std::mutex tasksMutex;
+  std::condition_variable tasksCondition;
+  std::condition_variable spaceCondition;
   const std::string name;
+  const OverflowPolicy overflowPolicy;
+  const ThreadAttachment attachment;
+  const AllocationTag allocationTag;
+  const ThreadQoS qos;
+  WorkerThreadStats stats{};
+  // Callers waiting on the thread with a ScopedQoSBoost, and the platform's
+  // handle of the boost while there are any
+  std::mutex boostMutex;
+  size_t boostsCount{0};
+  void *boostHandle{nullptr};
+
+  QueuedWorkerTask popTask();
+  void recordRun(
+      std::chrono::steady_clock::time_point startedAt,
+      std::chrono::steady_clock::time_point endedAt);
+  // Marks the time that the task waits in the queue and runs for the profiler
+  WorkerTask traceTask(WorkerTask task);
 
 public:
-  WorkerThread(const std::string name);
-  void scheduleTask(const taskType task);
+  WorkerThread(
+      const std::string name,
+      OverflowPolicy overflowPolicy = OverflowPolicy::Spill,
+      ThreadAttachment attachment = ThreadAttachment::PerTask,
+      AllocationTag allocationTag = AllocationTag::Untagged,
+      ThreadQoS qos = ThreadQoS::Default);
+  // Runs the task with access to the platform. A thread with the Lifetime
+  // attachment runs it as it is, its JNI env is already cached for the
+  // thread, any other one is attached for the time of the task.
+  static void runNativeAccessible(taskType task);
+  void
+  scheduleTask(WorkerTask task, TaskPriority priority = TaskPriority::Normal);
+  WorkerThreadStats getStats();
+  // Raise the thread to UserInteractive from the first begin until the last
+  // end, for the callers that block the UI until a task of the thread has
+  // run. See ScopedQoSBoost.
+  void beginQoSBoost();
+  void endQoSBoost();
   ~WorkerThread();
 };
 
+// Boosts the thread while a caller blocks on it, so that the task it waits
+// for and the ones queued before don't run at a lower QoS than the caller
+class ScopedQoSBoost {
+  WorkerThread *const workerThread;
+
+public:
+  // Does nothing without a thread, when tasks run on the caller's thread
+  explicit ScopedQoSBoost(WorkerThread *workerThread);
+  ~ScopedQoSBoost();
+
+  ScopedQoSBoost(const ScopedQoSBoost &) = delete;
+  ScopedQoSBoost &operator=(const ScopedQoSBoost &) = delete;
+};
+
 } // namespace comm
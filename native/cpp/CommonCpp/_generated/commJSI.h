@@ -23,19 +23,54 @@ public:
   virtual jsi::Value getDraft(jsi::Runtime &rt, jsi::String key) = 0;
   virtual jsi::Value updateDraft(jsi::Runtime &rt, jsi::String key, jsi::String text) = 0;
   virtual jsi::Value moveDraft(jsi::Runtime &rt, jsi::String oldKey, jsi::String newKey) = 0;
-  virtual jsi::Value getClientDBStore(jsi::Runtime &rt) = 0;
+  virtual jsi::Value getClientDBStore(jsi::Runtime &rt, std::optional<double> protocolVersion, std::optional<double> requestID) = 0;
+  virtual jsi::Value getClientDBStoreWithThreadSummaries(jsi::Runtime &rt) = 0;
+  virtual jsi::Value getClientDBStoreView(jsi::Runtime &rt) = 0;
+  virtual jsi::Value streamClientDBStore(jsi::Runtime &rt, jsi::Object onChunk, double chunkSize) = 0;
   virtual jsi::Value removeAllDrafts(jsi::Runtime &rt) = 0;
   virtual jsi::Array getAllMessagesSync(jsi::Runtime &rt) = 0;
+  virtual jsi::Value streamAllMessages(jsi::Runtime &rt, jsi::Object onChunk, double chunkSize) = 0;
+  virtual jsi::Value getThreadMessagesBefore(jsi::Runtime &rt, jsi::String threadID, double beforeTime, jsi::String beforeMessageID, double pageSize, std::optional<double> protocolVersion, std::optional<double> requestID) = 0;
+  virtual jsi::Value searchMessages(jsi::Runtime &rt, jsi::String query, std::optional<jsi::String> threadID, double pageSize, double offset, std::optional<double> protocolVersion, std::optional<double> requestID) = 0;
+  virtual void cancelDBRequest(jsi::Runtime &rt, double requestID) = 0;
+  virtual void reportMessageListScroll(jsi::Runtime &rt, std::optional<jsi::String> threadID, bool towardsOlder) = 0;
+  virtual jsi::Value getThreadMessagesInRange(jsi::Runtime &rt, jsi::String threadID, double fromTime, double toTime, double limit) = 0;
+  virtual jsi::Value getMessagesByIDs(jsi::Runtime &rt, jsi::Array ids) = 0;
+  virtual jsi::Value getThreadMessageCounts(jsi::Runtime &rt, jsi::Array threadIDs) = 0;
+  virtual jsi::Value archiveMessages(jsi::Runtime &rt, double olderThan) = 0;
+  virtual jsi::Value vacuumDatabase(jsi::Runtime &rt) = 0;
+  virtual jsi::Value addToOutbox(jsi::Runtime &rt, jsi::Array entries) = 0;
+  virtual jsi::Value dispatchOutbox(jsi::Runtime &rt) = 0;
+  virtual jsi::Value requeueOutbox(jsi::Runtime &rt, jsi::Array localIDs) = 0;
+  virtual jsi::Value acknowledgeOutbox(jsi::Runtime &rt, jsi::Array acknowledgements) = 0;
   virtual jsi::Value processDraftStoreOperations(jsi::Runtime &rt, jsi::Array operations) = 0;
   virtual jsi::Value processMessageStoreOperations(jsi::Runtime &rt, jsi::Array operations) = 0;
   virtual void processMessageStoreOperationsSync(jsi::Runtime &rt, jsi::Array operations) = 0;
+  virtual jsi::Value processSerializedMessageStoreOperations(jsi::Runtime &rt, jsi::String operations) = 0;
   virtual jsi::Array getAllThreadsSync(jsi::Runtime &rt) = 0;
+  virtual jsi::Value getThreadsByIDs(jsi::Runtime &rt, jsi::Array ids) = 0;
+  virtual jsi::Value getThreadMembers(jsi::Runtime &rt, jsi::String threadID) = 0;
+  virtual jsi::Value getThreadIDsForMember(jsi::Runtime &rt, jsi::String userID) = 0;
+  virtual jsi::Value getThreadMemberCounts(jsi::Runtime &rt, jsi::Array threadIDs) = 0;
+  virtual jsi::Value getThreadSummariesByRecency(jsi::Runtime &rt) = 0;
   virtual jsi::Value processThreadStoreOperations(jsi::Runtime &rt, jsi::Array operations) = 0;
   virtual void processThreadStoreOperationsSync(jsi::Runtime &rt, jsi::Array operations) = 0;
+  virtual jsi::Value processSerializedThreadStoreOperations(jsi::Runtime &rt, jsi::String operations) = 0;
   virtual jsi::Value initializeCryptoAccount(jsi::Runtime &rt, jsi::String userId) = 0;
   virtual jsi::Value getUserPublicKey(jsi::Runtime &rt) = 0;
   virtual jsi::Value getUserOneTimeKeys(jsi::Runtime &rt) = 0;
+  virtual jsi::Value getUserPublicKeyBuffers(jsi::Runtime &rt) = 0;
+  virtual jsi::Value getUserOneTimeKeyBuffers(jsi::Runtime &rt) = 0;
+  virtual jsi::Value encryptBuffer(jsi::Runtime &rt, jsi::String userID, jsi::Object content) = 0;
+  virtual jsi::Value decryptBuffer(jsi::Runtime &rt, jsi::String userID, jsi::Object message, double messageType, jsi::Object theirIdentityKeys) = 0;
   virtual double getCodeVersion(jsi::Runtime &rt) = 0;
+  virtual jsi::Array getDatabaseQueryProfile(jsi::Runtime &rt) = 0;
+  virtual jsi::Array getWorkerThreadsStats(jsi::Runtime &rt) = 0;
+  virtual jsi::Value getDatabaseStartupMetrics(jsi::Runtime &rt) = 0;
+  virtual jsi::Array getStartupTimeline(jsi::Runtime &rt) = 0;
+  virtual jsi::Array getAllocationSnapshot(jsi::Runtime &rt) = 0;
+  virtual jsi::Value getDatabaseChanges(jsi::Runtime &rt) = 0;
+  virtual jsi::Value getDatabaseMemoryStats(jsi::Runtime &rt) = 0;
   virtual jsi::Value setNotifyToken(jsi::Runtime &rt, jsi::String token) = 0;
   virtual jsi::Value clearNotifyToken(jsi::Runtime &rt) = 0;
   virtual jsi::Value setCurrentUserID(jsi::Runtime &rt, jsi::String userID) = 0;
@@ -88,13 +123,37 @@ private:
       return bridging::callFromJs<jsi::Value>(
           rt, &T::moveDraft, jsInvoker_, instance_, std::move(oldKey), std::move(newKey));
     }
-    jsi::Value getClientDBStore(jsi::Runtime &rt) override {
+    jsi::Value getClientDBStore(jsi::Runtime &rt, std::optional<double> protocolVersion, std::optional<double> requestID) override {
       static_assert(
-          bridging::getParameterCount(&T::getClientDBStore) == 1,
-          "Expected getClientDBStore(...) to have 1 parameters");
+          bridging::getParameterCount(&T::getClientDBStore) == 3,
+          "Expected getClientDBStore(...) to have 3 parameters");
 
       return bridging::callFromJs<jsi::Value>(
-          rt, &T::getClientDBStore, jsInvoker_, instance_);
+          rt, &T::getClientDBStore, jsInvoker_, instance_, std::move(protocolVersion), std::move(requestID));
+    }
+    jsi::Value getClientDBStoreWithThreadSummaries(jsi::Runtime &rt) override {
+      static_assert(
+          bridging::getParameterCount(&T::getClientDBStoreWithThreadSummaries) == 1,
+          "Expected getClientDBStoreWithThreadSummaries(...) to have 1 parameters");
+
+      return bridging::callFromJs<jsi::Value>(
+          rt, &T::getClientDBStoreWithThreadSummaries, jsInvoker_, instance_);
+    }
+    jsi::Value getClientDBStoreView(jsi::Runtime &rt) override {
+      static_assert(
+          bridging::getParameterCount(&T::getClientDBStoreView) == 1,
+          "Expected getClientDBStoreView(...) to have 1 parameters");
+
+      return bridging::callFromJs<jsi::Value>(
+          rt, &T::getClientDBStoreView, jsInvoker_, instance_);
+    }
+    jsi::Value streamClientDBStore(jsi::Runtime &rt, jsi::Object onChunk, double chunkSize) override {
+      static_assert(
+          bridging::getParameterCount(&T::streamClientDBStore) == 3,
+          "Expected streamClientDBStore(...) to have 3 parameters");
+
+      return bridging::callFromJs<jsi::Value>(
+          rt, &T::streamClientDBStore, jsInvoker_, instance_, std::move(onChunk), chunkSize);
     }
     jsi::Value removeAllDrafts(jsi::Runtime &rt) override {
       static_assert(
@@ -112,6 +171,118 @@ private:
       return bridging::callFromJs<jsi::Array>(
           rt, &T::getAllMessagesSync, jsInvoker_, instance_);
     }
+    jsi::Value streamAllMessages(jsi::Runtime &rt, jsi::Object onChunk, double chunkSize) override {
+      static_assert(
+          bridging::getParameterCount(&T::streamAllMessages) == 3,
+          "Expected streamAllMessages(...) to have 3 parameters");
+
+      return bridging::callFromJs<jsi::Value>(
+          rt, &T::streamAllMessages, jsInvoker_, instance_, std::move(onChunk), chunkSize);
+    }
+    jsi::Value getThreadMessagesBefore(jsi::Runtime &rt, jsi::String threadID, double beforeTime, jsi::String beforeMessageID, double pageSize, std::optional<double> protocolVersion, std::optional<double> requestID) override {
+      static_assert(
+          bridging::getParameterCount(&T::getThreadMessagesBefore) == 7,
+          "Expected getThreadMessagesBefore(...) to have 7 parameters");
+
+      return bridging::callFromJs<jsi::Value>(
+          rt, &T::getThreadMessagesBefore, jsInvoker_, instance_, std::move(threadID), beforeTime, std::move(beforeMessageID), pageSize, std::move(protocolVersion), std::move(requestID));
+    }
+    jsi::Value searchMessages(jsi::Runtime &rt, jsi::String query, std::optional<jsi::String> threadID, double pageSize, double offset, std::optional<double> protocolVersion, std::optional<double> requestID) override {
+      static_assert(
+          bridging::getParameterCount(&T::searchMessages) == 7,
+          "Expected searchMessages(...) to have 7 parameters");
+
+      return bridging::callFromJs<jsi::Value>(
+          rt, &T::searchMessages, jsInvoker_, instance_, std::move(query), std::move(threadID), pageSize, offset, std::move(protocolVersion), std::move(requestID));
+    }
+    void cancelDBRequest(jsi::Runtime &rt, double requestID) override {
+      static_assert(
+          bridging::getParameterCount(&T::cancelDBRequest) == 2,
+          "Expected cancelDBRequest(...) to have 2 parameters");
+
+      return bridging::callFromJs<void>(
+          rt, &T::cancelDBRequest, jsInvoker_, instance_, requestID);
+    }
+    void reportMessageListScroll(jsi::Runtime &rt, std::optional<jsi::String> threadID, bool towardsOlder) override {
+      static_assert(
+          bridging::getParameterCount(&T::reportMessageListScroll) == 3,
+          "Expected reportMessageListScroll(...) to have 3 parameters");
+
+      return bridging::callFromJs<void>(
+          rt, &T::reportMessageListScroll, jsInvoker_, instance_, std::move(threadID), towardsOlder);
+    }
+    jsi::Value getThreadMessagesInRange(jsi::Runtime &rt, jsi::String threadID, double fromTime, double toTime, double limit) override {
+      static_assert(
+          bridging::getParameterCount(&T::getThreadMessagesInRange) == 5,
+          "Expected getThreadMessagesInRange(...) to have 5 parameters");
+
+      return bridging::callFromJs<jsi::Value>(
+          rt, &T::getThreadMessagesInRange, jsInvoker_, instance_, std::move(threadID), fromTime, toTime, limit);
+    }
+    jsi::Value getMessagesByIDs(jsi::Runtime &rt, jsi::Array ids) override {
+      static_assert(
+          bridging::getParameterCount(&T::getMessagesByIDs) == 2,
+          "Expected getMessagesByIDs(...) to have 2 parameters");
+
+      return bridging::callFromJs<jsi::Value>(
+          rt, &T::getMessagesByIDs, jsInvoker_, instance_, std::move(ids));
+    }
+    jsi::Value getThreadMessageCounts(jsi::Runtime &rt, jsi::Array threadIDs) override {
+      static_assert(
+          bridging::getParameterCount(&T::getThreadMessageCounts) == 2,
+          "Expected getThreadMessageCounts(...) to have 2 parameters");
+
+      return bridging::callFromJs<jsi::Value>(
+          rt, &T::getThreadMessageCounts, jsInvoker_, instance_, std::move(threadIDs));
+    }
+    jsi::Value archiveMessages(jsi::Runtime &rt, double olderThan) override {
+      static_assert(
+          bridging::getParameterCount(&T::archiveMessages) == 2,
+          "Expected archiveMessages(...) to have 2 parameters");
+
+      return bridging::callFromJs<jsi::Value>(
+          rt, &T::archiveMessages, jsInvoker_, instance_, olderThan);
+    }
+    jsi::Value vacuumDatabase(jsi::Runtime &rt) override {
+      static_assert(
+          bridging::getParameterCount(&T::vacuumDatabase) == 1,
+          "Expected vacuumDatabase(...) to have 1 parameters");
+
+      return bridging::callFromJs<jsi::Value>(
+          rt, &T::vacuumDatabase, jsInvoker_, instance_);
+    }
+    jsi::Value addToOutbox(jsi::Runtime &rt, jsi::Array entries) override {
+      static_assert(
+          bridging::getParameterCount(&T::addToOutbox) == 2,
+          "Expected addToOutbox(...) to have 2 parameters");
+
+      return bridging::callFromJs<jsi::Value>(
+          rt, &T::addToOutbox, jsInvoker_, instance_, std::move(entries));
+    }
+    jsi::Value dispatchOutbox(jsi::Runtime &rt) override {
+      static_assert(
+          bridging::getParameterCount(&T::dispatchOutbox) == 1,
+          "Expected dispatchOutbox(...) to have 1 parameters");
+
+      return bridging::callFromJs<jsi::Value>(
+          rt, &T::dispatchOutbox, jsInvoker_, instance_);
+    }
+    jsi::Value requeueOutbox(jsi::Runtime &rt, jsi::Array localIDs) override {
+      static_assert(
+          bridging::getParameterCount(&T::requeueOutbox) == 2,
+          "Expected requeueOutbox(...) to have 2 parameters");
+
+      return bridging::callFromJs<jsi::Value>(
+          rt, &T::requeueOutbox, jsInvoker_, instance_, std::move(localIDs));
+    }
+    jsi::Value acknowledgeOutbox(jsi::Runtime &rt, jsi::Array acknowledgements) override {
+      static_assert(
+          bridging::getParameterCount(&T::acknowledgeOutbox) == 2,
+          "Expected acknowledgeOutbox(...) to have 2 parameters");
+
+      return bridging::callFromJs<jsi::Value>(
+          rt, &T::acknowledgeOutbox, jsInvoker_, instance_, std::move(acknowledgements));
+    }
     jsi::Value processDraftStoreOperations(jsi::Runtime &rt, jsi::Array operations) override {
       static_assert(
           bridging::getParameterCount(&T::processDraftStoreOperations) == 2,
@@ -136,6 +307,14 @@ private:
       return bridging::callFromJs<void>(
           rt, &T::processMessageStoreOperationsSync, jsInvoker_, instance_, std::move(operations));
     }
+    jsi::Value processSerializedMessageStoreOperations(jsi::Runtime &rt, jsi::String operations) override {
+      static_assert(
+          bridging::getParameterCount(&T::processSerializedMessageStoreOperations) == 2,
+          "Expected processSerializedMessageStoreOperations(...) to have 2 parameters");
+
+      return bridging::callFromJs<jsi::Value>(
+          rt, &T::processSerializedMessageStoreOperations, jsInvoker_, instance_, std::move(operations));
+    }
     jsi::Array getAllThreadsSync(jsi::Runtime &rt) override {
       static_assert(
           bridging::getParameterCount(&T::getAllThreadsSync) == 1,
@@ -144,6 +323,46 @@ private:
       return bridging::callFromJs<jsi::Array>(
           rt, &T::getAllThreadsSync, jsInvoker_, instance_);
     }
+    jsi::Value getThreadsByIDs(jsi::Runtime &rt, jsi::Array ids) override {
+      static_assert(
+          bridging::getParameterCount(&T::getThreadsByIDs) == 2,
+          "Expected getThreadsByIDs(...) to have 2 parameters");
+
+      return bridging::callFromJs<jsi::Value>(
+          rt, &T::getThreadsByIDs, jsInvoker_, instance_, std::move(ids));
+    }
+    jsi::Value getThreadMembers(jsi::Runtime &rt, jsi::String threadID) override {
+      static_assert(
+          bridging::getParameterCount(&T::getThreadMembers) == 2,
+          "Expected getThreadMembers(...) to have 2 parameters");
+
+      return bridging::callFromJs<jsi::Value>(
+          rt, &T::getThreadMembers, jsInvoker_, instance_, std::move(threadID));
+    }
+    jsi::Value getThreadIDsForMember(jsi::Runtime &rt, jsi::String userID) override {
+      static_assert(
+          bridging::getParameterCount(&T::getThreadIDsForMember) == 2,
+          "Expected getThreadIDsForMember(...) to have 2 parameters");
+
+      return bridging::callFromJs<jsi::Value>(
+          rt, &T::getThreadIDsForMember, jsInvoker_, instance_, std::move(userID));
+    }
+    jsi::Value getThreadMemberCounts(jsi::Runtime &rt, jsi::Array threadIDs) override {
+      static_assert(
+          bridging::getParameterCount(&T::getThreadMemberCounts) == 2,
+          "Expected getThreadMemberCounts(...) to have 2 parameters");
+
+      return bridging::callFromJs<jsi::Value>(
+          rt, &T::getThreadMemberCounts, jsInvoker_, instance_, std::move(threadIDs));
+    }
+    jsi::Value getThreadSummariesByRecency(jsi::Runtime &rt) override {
+      static_assert(
+          bridging::getParameterCount(&T::getThreadSummariesByRecency) == 1,
+          "Expected getThreadSummariesByRecency(...) to have 1 parameters");
+
+      return bridging::callFromJs<jsi::Value>(
+          rt, &T::getThreadSummariesByRecency, jsInvoker_, instance_);
+    }
     jsi::Value processThreadStoreOperations(jsi::Runtime &rt, jsi::Array operations) override {
       static_assert(
           bridging::getParameterCount(&T::processThreadStoreOperations) == 2,
@@ -160,6 +379,14 @@ private:
       return bridging::callFromJs<void>(
           rt, &T::processThreadStoreOperationsSync, jsInvoker_, instance_, std::move(operations));
     }
+    jsi::Value processSerializedThreadStoreOperations(jsi::Runtime &rt, jsi::String operations) override {
+      static_assert(
+          bridging::getParameterCount(&T::processSerializedThreadStoreOperations) == 2,
+          "Expected processSerializedThreadStoreOperations(...) to have 2 parameters");
+
+      return bridging::callFromJs<jsi::Value>(
+          rt, &T::processSerializedThreadStoreOperations, jsInvoker_, instance_, std::move(operations));
+    }
     jsi::Value initializeCryptoAccount(jsi::Runtime &rt, jsi::String userId) override {
       static_assert(
           bridging::getParameterCount(&T::initializeCryptoAccount) == 2,
@@ -184,6 +411,38 @@ private:
       return bridging::callFromJs<jsi::Value>(
           rt, &T::getUserOneTimeKeys, jsInvoker_, instance_);
     }
+    jsi::Value getUserPublicKeyBuffers(jsi::Runtime &rt) override {
+      static_assert(
+          bridging::getParameterCount(&T::getUserPublicKeyBuffers) == 1,
+          "Expected getUserPublicKeyBuffers(...) to have 1 parameters");
+
+      return bridging::callFromJs<jsi::Value>(
+          rt, &T::getUserPublicKeyBuffers, jsInvoker_, instance_);
+    }
+    jsi::Value getUserOneTimeKeyBuffers(jsi::Runtime &rt) override {
+      static_assert(
+          bridging::getParameterCount(&T::getUserOneTimeKeyBuffers) == 1,
+          "Expected getUserOneTimeKeyBuffers(...) to have 1 parameters");
+
+      return bridging::callFromJs<jsi::Value>(
+          rt, &T::getUserOneTimeKeyBuffers, jsInvoker_, instance_);
+    }
+    jsi::Value encryptBuffer(jsi::Runtime &rt, jsi::String userID, jsi::Object content) override {
+      static_assert(
+          bridging::getParameterCount(&T::encryptBuffer) == 3,
+          "Expected encryptBuffer(...) to have 3 parameters");
+
+      return bridging::callFromJs<jsi::Value>(
+          rt, &T::encryptBuffer, jsInvoker_, instance_, std::move(userID), std::move(content));
+    }
+    jsi::Value decryptBuffer(jsi::Runtime &rt, jsi::String userID, jsi::Object message, double messageType, jsi::Object theirIdentityKeys) override {
+      static_assert(
+          bridging::getParameterCount(&T::decryptBuffer) == 5,
+          "Expected decryptBuffer(...) to have 5 parameters");
+
+      return bridging::callFromJs<jsi::Value>(
+          rt, &T::decryptBuffer, jsInvoker_, instance_, std::move(userID), std::move(message), messageType, std::move(theirIdentityKeys));
+    }
     double getCodeVersion(jsi::Runtime &rt) override {
       static_assert(
           bridging::getParameterCount(&T::getCodeVersion) == 1,
@@ -192,6 +451,62 @@ private:
       return bridging::callFromJs<double>(
           rt, &T::getCodeVersion, jsInvoker_, instance_);
     }
+    jsi::Array getDatabaseQueryProfile(jsi::Runtime &rt) override {
+      static_assert(
+          bridging::getParameterCount(&T::getDatabaseQueryProfile) == 1,
+          "Expected getDatabaseQueryProfile(...) to have 1 parameters");
+
+      return bridging::callFromJs<jsi::Array>(
+          rt, &T::getDatabaseQueryProfile, jsInvoker_, instance_);
+    }
+    jsi::Array getWorkerThreadsStats(jsi::Runtime &rt) override {
+      static_assert(
+          bridging::getParameterCount(&T::getWorkerThreadsStats) == 1,
+          "Expected getWorkerThreadsStats(...) to have 1 parameters");
+
+      return bridging::callFromJs<jsi::Array>(
+          rt, &T::getWorkerThreadsStats, jsInvoker_, instance_);
+    }
+    jsi::Value getDatabaseStartupMetrics(jsi::Runtime &rt) override {
+      static_assert(
+          bridging::getParameterCount(&T::getDatabaseStartupMetrics) == 1,
+          "Expected getDatabaseStartupMetrics(...) to have 1 parameters");
+
+      return bridging::callFromJs<jsi::Value>(
+          rt, &T::getDatabaseStartupMetrics, jsInvoker_, instance_);
+    }
+    jsi::Array getStartupTimeline(jsi::Runtime &rt) override {
+      static_assert(
+          bridging::getParameterCount(&T::getStartupTimeline) == 1,
+          "Expected getStartupTimeline(...) to have 1 parameters");
+
+      return bridging::callFromJs<jsi::Array>(
+          rt, &T::getStartupTimeline, jsInvoker_, instance_);
+    }
+    jsi::Array getAllocationSnapshot(jsi::Runtime &rt) override {
+      static_assert(
+          bridging::getParameterCount(&T::getAllocationSnapshot) == 1,
+          "Expected getAllocationSnapshot(...) to have 1 parameters");
+
+      return bridging::callFromJs<jsi::Array>(
+          rt, &T::getAllocationSnapshot, jsInvoker_, instance_);
+    }
+    jsi::Value getDatabaseChanges(jsi::Runtime &rt) override {
+      static_assert(
+          bridging::getParameterCount(&T::getDatabaseChanges) == 1,
+          "Expected getDatabaseChanges(...) to have 1 parameters");
+
+      return bridging::callFromJs<jsi::Value>(
+          rt, &T::getDatabaseChanges, jsInvoker_, instance_);
+    }
+    jsi::Value getDatabaseMemoryStats(jsi::Runtime &rt) override {
+      static_assert(
+          bridging::getParameterCount(&T::getDatabaseMemoryStats) == 1,
+          "Expected getDatabaseMemoryStats(...) to have 1 parameters");
+
+      return bridging::callFromJs<jsi::Value>(
+          rt, &T::getDatabaseMemoryStats, jsInvoker_, instance_);
+    }
     jsi::Value setNotifyToken(jsi::Runtime &rt, jsi::String token) override {
       static_assert(
           bridging::getParameterCount(&T::setNotifyToken) == 2,
@@ -38,6 +38,8 @@ static NSString *const kRNConcurrentRoot = @"concurrentRoot";
 #import <reacthermes/HermesExecutorFactory.h>
 
 #import "CommCoreModule.h"
+#import "DraftCache.h"
+#import "MemoryPressure.h"
 #import "GlobalDBSingleton.h"
 #import "Logger.h"
 #import "MessageOperationsUtilities.h"
@@ -48,6 +50,7 @@ static NSString *const kRNConcurrentRoot = @"concurrentRoot";
 #import <cstdio>
 #import <stdexcept>
 #import <string>
+#import <vector>
 
 #import <ReactCommon/RCTTurboModuleManager.h>
 
@@ -229,6 +232,15 @@ NSString *const setUnreadStatusKey = @"setUnreadStatus";
   [RNNotifications didReceiveLocalNotification:notification];
 }
 
+- (void)applicationDidEnterBackground:(UIApplication *)application {
+  // The app may be killed in the background before the drafts go idle
+  comm::DraftCache::instance().flush();
+}
+
+- (void)applicationDidReceiveMemoryWarning:(UIApplication *)application {
+  comm::MemoryPressure::onMemoryWarning();
+}
+
 - (UIInterfaceOrientationMask)application:(UIApplication *)application
     supportedInterfaceOrientationsForWindow:(UIWindow *)window {
   return [Orientation getOrientation];
@@ -296,6 +308,8 @@ using Runtime = facebook::jsi::Runtime;
           rt,
           facebook::jsi::PropNameID::forAscii(rt, "CommCoreModule"),
           facebook::jsi::Object::createFromHostObject(rt, nativeModule));
+      // The database was initialized on launch
+      nativeModule->warmUp();
     }
   };
   const auto installer =
@@ -329,13 +343,20 @@ using Runtime = facebook::jsi::Runtime;
 - (void)moveMessagesToDatabase {
   TemporaryMessageStorage *temporaryStorage =
       [[TemporaryMessageStorage alloc] init];
-  NSArray<NSString *> *messages = [temporaryStorage readAndClearMessages];
-  for (NSString *message in messages) {
-    std::string messageInfos = std::string([message UTF8String]);
-    comm::GlobalDBSingleton::instance.scheduleOrRun([messageInfos]() mutable {
-      comm::MessageOperationsUtilities::storeMessageInfos(messageInfos);
-    });
+  NSArray<NSData *> *messages = [temporaryStorage readAndClearMessageInfos];
+  if (!messages.count) {
+    return;
+  }
+  std::vector<std::string> messageInfos;
+  messageInfos.reserve(messages.count);
+  for (NSData *message in messages) {
+    messageInfos.emplace_back(
+        static_cast<const char *>(message.bytes), message.length);
   }
+  comm::GlobalDBSingleton::instance.scheduleOrRun(
+      [messageInfos = std::move(messageInfos)]() mutable {
+        comm::MessageOperationsUtilities::storeMessageInfos(messageInfos);
+      });
 }
 
 // Copied from
@@ -7,8 +7,9 @@
 
 namespace comm {
 
-void CommSecureStore::set(const std::string key, const std::string value)
-    const {
+void CommSecureStore::setInPlatform(
+    const std::string &key,
+    const std::string &value) const {
   NSString *nsKey =
       [NSString stringWithCString:key.c_str()
                          encoding:[NSString defaultCStringEncoding]];
@@ -18,7 +19,8 @@ void CommSecureStore::set(const std::string key, const std::string value)
   [[CommSecureStoreIOSWrapper sharedInstance] set:nsKey value:nsValue];
 }
 
-folly::Optional<std::string> CommSecureStore::get(const std::string key) const {
+folly::Optional<std::string>
+CommSecureStore::getFromPlatform(const std::string &key) const {
   NSString *nsKey =
       [NSString stringWithCString:key.c_str()
                          encoding:[NSString defaultCStringEncoding]];
@@ -11,9 +11,9 @@ GlobalDBSingleton::GlobalDBSingleton()
       tasksCancelled(false) {
 }
 
-void GlobalDBSingleton::scheduleOrRun(const taskType task) {
+void GlobalDBSingleton::scheduleOrRun(taskType task) {
   if (NSThread.isMainThread || this->multithreadingEnabled.load()) {
-    this->scheduleOrRunCommonImpl(task);
+    this->scheduleOrRunCommonImpl(std::move(task));
     return;
   }
 
@@ -22,9 +22,9 @@ void GlobalDBSingleton::scheduleOrRun(const taskType task) {
   });
 }
 
-void GlobalDBSingleton::scheduleOrRunCancellable(const taskType task) {
+void GlobalDBSingleton::scheduleOrRunCancellable(taskType task) {
   if (NSThread.isMainThread || this->multithreadingEnabled.load()) {
-    this->scheduleOrRunCancellableCommonImpl(task);
+    this->scheduleOrRunCancellableCommonImpl(std::move(task));
     return;
   }
 
@@ -34,11 +34,12 @@ void GlobalDBSingleton::scheduleOrRunCancellable(const taskType task) {
 }
 
 void GlobalDBSingleton::scheduleOrRunCancellable(
-    const taskType task,
+    taskType task,
     const std::shared_ptr<facebook::react::Promise> promise,
     const std::shared_ptr<facebook::react::CallInvoker> jsInvoker) {
   if (NSThread.isMainThread || this->multithreadingEnabled.load()) {
-    this->scheduleOrRunCancellableCommonImpl(task, promise, jsInvoker);
+    this->scheduleOrRunCancellableCommonImpl(
+        std::move(task), promise, jsInvoker);
     return;
   }
 
@@ -47,6 +48,40 @@ void GlobalDBSingleton::scheduleOrRunCancellable(
   });
 }
 
+void GlobalDBSingleton::scheduleOrRunCancellableRead(
+    taskType task,
+    const std::shared_ptr<facebook::react::Promise> promise,
+    const std::shared_ptr<facebook::react::CallInvoker> jsInvoker,
+    TaskPriority priority,
+    std::shared_ptr<CancellationToken> cancellationToken) {
+  if (NSThread.isMainThread || this->multithreadingEnabled.load()) {
+    this->scheduleOrRunCancellableReadCommonImpl(
+        std::move(task), promise, jsInvoker, priority, cancellationToken);
+    return;
+  }
+
+  dispatch_async(dispatch_get_main_queue(), ^{
+    this->scheduleOrRunCancellableReadCommonImpl(
+        task, promise, jsInvoker, priority, cancellationToken);
+  });
+}
+
+void GlobalDBSingleton::scheduleOrRunCancellableBatchedWrite(
+    taskType write,
+    const std::shared_ptr<facebook::react::Promise> promise,
+    const std::shared_ptr<facebook::react::CallInvoker> jsInvoker) {
+  if (NSThread.isMainThread || this->multithreadingEnabled.load()) {
+    this->scheduleOrRunCancellableBatchedWriteCommonImpl(
+        std::move(write), promise, jsInvoker);
+    return;
+  }
+
+  dispatch_async(dispatch_get_main_queue(), ^{
+    this->scheduleOrRunCancellableBatchedWriteCommonImpl(
+        write, promise, jsInvoker);
+  });
+}
+
 void GlobalDBSingleton::enableMultithreading() {
   if (NSThread.isMainThread) {
     this->enableMultithreadingCommonImpl();
@@ -4,10 +4,10 @@
 
 namespace comm {
 
-void Logger::log(const std::string str) {
+void Logger::write(const std::string &lines) {
   NSLog(
       @"COMM: %@",
-      [NSString stringWithCString:str.c_str()
+      [NSString stringWithCString:lines.c_str()
                          encoding:[NSString defaultCStringEncoding]]);
 };
 
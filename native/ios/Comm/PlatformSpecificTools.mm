@@ -7,12 +7,10 @@ namespace comm {
 void PlatformSpecificTools::generateSecureRandomBytes(
     crypto::OlmBuffer &buffer,
     size_t size) {
-  uint8_t randomBytes[size];
-
-  const int status = SecRandomCopyBytes(kSecRandomDefault, size, randomBytes);
-  if (status == errSecSuccess) {
-    buffer = crypto::OlmBuffer(randomBytes, randomBytes + size);
-  } else {
+  // Written in place, so that a reused buffer doesn't allocate
+  buffer.resize(size);
+  const int status = SecRandomCopyBytes(kSecRandomDefault, size, buffer.data());
+  if (status != errSecSuccess) {
     throw std::runtime_error(
         "SecRandomCopyBytes failed for some reason, error code: " +
         std::to_string(status));
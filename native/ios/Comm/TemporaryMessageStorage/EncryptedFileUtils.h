@@ -11,4 +11,22 @@ NSString *const encryptedDataSeparator = @"\n";
              error:(NSError **)err;
 + (NSArray<NSString *> *)readFromFileAtPath:(NSString *)path
                                       error:(NSError **)err;
+
+// Records are stored as a magic number, a 32-bit length and a checksum
+// followed by that many bytes of ciphertext, without base64 or separators.
+// Each record is appended with a single write to a file opened with
+// O_APPEND, and files of records are read through a memory map. Records that
+// were only partly written are skipped.
++ (BOOL)appendRecord:(NSData *)data
+        toFileAtPath:(NSString *)path
+               error:(NSError **)err;
++ (NSArray<NSData *> *)readRecordsFromFileAtPath:(NSString *)path
+                                           error:(NSError **)err;
+// Ciphertext of a single record, for storage other than files of records
++ (NSData *)encryptRecord:(NSData *)data error:(NSError **)err;
++ (NSData *)decryptRecord:(NSData *)data error:(NSError **)err;
+// Reads the key once for all the records. Records that can't be decrypted
+// are skipped, nil is returned only if there is no key.
++ (NSArray<NSData *> *)decryptRecords:(NSArray<NSData *> *)records
+                                error:(NSError **)err;
 @end
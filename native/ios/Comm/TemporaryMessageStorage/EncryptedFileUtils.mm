@@ -2,11 +2,62 @@
 #import "CommSecureStoreIOSWrapper.h"
 #import "Logger.h"
 #import <CommonCrypto/CommonCryptor.h>
+#import <cstring>
+#import <fcntl.h>
+#import <string>
+#import <sys/mman.h>
+#import <sys/stat.h>
+#import <unistd.h>
+
+// A record that was only partly written, because the disk filled up or the
+// process was killed, stays in the file. The magic number and the checksum
+// tell the reader where it ends, and the reader skips to the next magic
+// number, so that the records appended after it are still read.
+namespace {
+const uint32_t record_magic = 0x434d5231; // "CMR1"
+const uint32_t fnv_offset_basis = 2166136261U;
+const uint32_t fnv_prime = 16777619U;
+
+struct RecordHeader {
+  uint32_t magic;
+  uint32_t length;
+  uint32_t checksum;
+};
+
+// FNV-1a of the length and the bytes of a record
+uint32_t record_checksum(const uint8_t *data, uint32_t length) {
+  uint32_t hash = fnv_offset_basis;
+  for (size_t i = 0; i < sizeof(length); i++) {
+    hash = (hash ^ ((length >> (8 * i)) & 0xff)) * fnv_prime;
+  }
+  for (uint32_t i = 0; i < length; i++) {
+    hash = (hash ^ data[i]) * fnv_prime;
+  }
+  return hash;
+}
+
+// Offset of the first magic number at or after offset, or size if there is
+// none
+size_t find_record_magic(const uint8_t *bytes, size_t size, size_t offset) {
+  for (; offset + sizeof(record_magic) <= size; offset++) {
+    if (!std::memcmp(bytes + offset, &record_magic, sizeof(record_magic))) {
+      return offset;
+    }
+  }
+  return size;
+}
+} // namespace
 
 @interface EncryptedFileUtils ()
 + (NSData *)_runCryptor:(NSData *)binary
               operation:(CCOperation)operation
                   error:(NSError **)error;
++ (NSData *)_runCryptor:(NSData *)binary
+              operation:(CCOperation)operation
+                    key:(NSData *)key
+                  error:(NSError **)error;
++ (NSData *)_getEncryptionKey:(NSError **)error;
++ (NSError *)_errorFromErrno;
 + (NSData *)_encryptData:(NSString *)data error:(NSError **)error;
 + (NSString *)_decryptData:(NSString *)data error:(NSError **)error;
 @end
@@ -94,24 +145,199 @@
   return decryptedData;
 }
 
++ (BOOL)appendRecord:(NSData *)data
+        toFileAtPath:(NSString *)path
+               error:(NSError **)err {
+  NSData *key = [EncryptedFileUtils _getEncryptionKey:err];
+  if (!key) {
+    return NO;
+  }
+  NSData *encryptedData = [EncryptedFileUtils _runCryptor:data
+                                                operation:kCCEncrypt
+                                                      key:key
+                                                    error:err];
+  if (!encryptedData) {
+    return NO;
+  }
+  RecordHeader header;
+  header.magic = record_magic;
+  header.length = (uint32_t)encryptedData.length;
+  header.checksum = record_checksum(
+      static_cast<const uint8_t *>(encryptedData.bytes), header.length);
+  NSMutableData *record =
+      [NSMutableData dataWithCapacity:sizeof(header) + encryptedData.length];
+  [record appendBytes:&header length:sizeof(header)];
+  [record appendData:encryptedData];
+
+  int fd = open(
+      [path cStringUsingEncoding:NSUTF8StringEncoding],
+      O_WRONLY | O_APPEND | O_CREAT,
+      0644);
+  if (fd < 0) {
+    if (err) {
+      *err = [EncryptedFileUtils _errorFromErrno];
+    }
+    return NO;
+  }
+  ssize_t written = write(fd, record.bytes, record.length);
+  if (written != (ssize_t)record.length) {
+    if (err) {
+      *err = [EncryptedFileUtils _errorFromErrno];
+    }
+    close(fd);
+    return NO;
+  }
+  close(fd);
+  return YES;
+}
+
++ (NSArray<NSData *> *)readRecordsFromFileAtPath:(NSString *)path
+                                           error:(NSError **)err {
+  NSMutableArray<NSData *> *records = [NSMutableArray array];
+  int fd = open([path cStringUsingEncoding:NSUTF8StringEncoding], O_RDONLY);
+  if (fd < 0) {
+    if (err) {
+      *err = [EncryptedFileUtils _errorFromErrno];
+    }
+    return nil;
+  }
+  struct stat fileStat;
+  if (fstat(fd, &fileStat)) {
+    if (err) {
+      *err = [EncryptedFileUtils _errorFromErrno];
+    }
+    close(fd);
+    return nil;
+  }
+  size_t fileSize = (size_t)fileStat.st_size;
+  if (!fileSize) {
+    close(fd);
+    return records;
+  }
+  NSData *key = [EncryptedFileUtils _getEncryptionKey:err];
+  if (!key) {
+    close(fd);
+    return nil;
+  }
+  void *mapping = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    if (err) {
+      *err = [EncryptedFileUtils _errorFromErrno];
+    }
+    return nil;
+  }
+
+  const uint8_t *bytes = (const uint8_t *)mapping;
+  size_t offset = 0;
+  size_t skippedBytes = 0;
+  while (fileSize - offset >= sizeof(RecordHeader)) {
+    RecordHeader header;
+    memcpy(&header, bytes + offset, sizeof(header));
+    const size_t dataOffset = offset + sizeof(header);
+    if (header.magic != record_magic || !header.length ||
+        header.length > fileSize - dataOffset ||
+        record_checksum(bytes + dataOffset, header.length) !=
+            header.checksum) {
+      const size_t nextOffset = find_record_magic(bytes, fileSize, offset + 1);
+      skippedBytes += nextOffset - offset;
+      offset = nextOffset;
+      continue;
+    }
+    NSData *encryptedData =
+        [NSData dataWithBytesNoCopy:(void *)(bytes + dataOffset)
+                             length:header.length
+                       freeWhenDone:NO];
+    NSData *decryptedData = [EncryptedFileUtils _runCryptor:encryptedData
+                                                  operation:kCCDecrypt
+                                                        key:key
+                                                      error:nil];
+    if (decryptedData) {
+      [records addObject:decryptedData];
+    }
+    offset = dataOffset + header.length;
+  }
+  skippedBytes += fileSize - offset;
+  if (skippedBytes) {
+    comm::Logger::log(
+        "Skipped " + std::to_string(skippedBytes) +
+        " bytes of incomplete records in file at path: " +
+        std::string([path UTF8String]));
+  }
+  munmap(mapping, fileSize);
+  return records;
+}
+
++ (NSData *)encryptRecord:(NSData *)data error:(NSError **)err {
+  return [EncryptedFileUtils _runCryptor:data operation:kCCEncrypt error:err];
+}
+
++ (NSData *)decryptRecord:(NSData *)data error:(NSError **)err {
+  return [EncryptedFileUtils _runCryptor:data operation:kCCDecrypt error:err];
+}
+
++ (NSArray<NSData *> *)decryptRecords:(NSArray<NSData *> *)records
+                                error:(NSError **)err {
+  NSData *key = [EncryptedFileUtils _getEncryptionKey:err];
+  if (!key) {
+    return nil;
+  }
+  NSMutableArray<NSData *> *decryptedRecords =
+      [NSMutableArray arrayWithCapacity:records.count];
+  for (NSData *record in records) {
+    NSError *decryptErr = nil;
+    NSData *decryptedRecord = [EncryptedFileUtils _runCryptor:record
+                                                    operation:kCCDecrypt
+                                                          key:key
+                                                        error:&decryptErr];
+    if (!decryptedRecord) {
+      comm::Logger::log(
+          "Failed to decrypt record. Details: " +
+          std::string([decryptErr.localizedDescription UTF8String]));
+      continue;
+    }
+    [decryptedRecords addObject:decryptedRecord];
+  }
+  return decryptedRecords;
+}
+
 + (NSData *)_runCryptor:(NSData *)binary
               operation:(CCOperation)operation
                   error:(NSError **)err {
+  NSData *key = [EncryptedFileUtils _getEncryptionKey:err];
+  if (!key) {
+    return nil;
+  }
+  return [EncryptedFileUtils _runCryptor:binary
+                               operation:operation
+                                     key:key
+                                   error:err];
+}
+
++ (NSData *)_getEncryptionKey:(NSError **)err {
   NSString *keyString =
       [[CommSecureStoreIOSWrapper sharedInstance] get:@"comm.encryptionKey"];
   if (!keyString) {
-    *err = [NSError
-        errorWithDomain:@"app.comm"
-                   code:NSCoderValueNotFoundError
-               userInfo:@{
-                 NSLocalizedDescriptionKey : @"Encryption key not created yet"
-               }];
+    if (err) {
+      *err = [NSError
+          errorWithDomain:@"app.comm"
+                     code:NSCoderValueNotFoundError
+                 userInfo:@{
+                   NSLocalizedDescriptionKey : @"Encryption key not created yet"
+                 }];
+    }
     return nil;
   }
 
   NSUInteger AES256KeyByteCount = 32;
-  NSData *key = [[keyString substringToIndex:AES256KeyByteCount]
+  return [[keyString substringToIndex:AES256KeyByteCount]
       dataUsingEncoding:NSUTF8StringEncoding];
+}
+
++ (NSData *)_runCryptor:(NSData *)binary
+              operation:(CCOperation)operation
+                    key:(NSData *)key
+                  error:(NSError **)err {
   NSMutableData *resultBinary =
       [NSMutableData dataWithLength:binary.length + kCCBlockSizeAES128];
 
@@ -131,15 +357,27 @@
 
   resultBinary.length = processedBytes;
   if (ccStatus != kCCSuccess) {
-    *err = [NSError
-        errorWithDomain:@"app.comm"
-                   code:ccStatus
-               userInfo:@{
-                 NSLocalizedDescriptionKey : @"Cryptographic operation failed"
-               }];
+    if (err) {
+      *err = [NSError
+          errorWithDomain:@"app.comm"
+                     code:ccStatus
+                 userInfo:@{
+                   NSLocalizedDescriptionKey : @"Cryptographic operation failed"
+                 }];
+    }
     return nil;
   }
   return resultBinary;
 }
 
++ (NSError *)_errorFromErrno {
+  return [NSError errorWithDomain:@"app.comm"
+                             code:errno
+                         userInfo:@{
+                           NSLocalizedDescriptionKey : [NSString
+                               stringWithCString:strerror(errno)
+                                        encoding:NSUTF8StringEncoding]
+                         }];
+}
+
 @end
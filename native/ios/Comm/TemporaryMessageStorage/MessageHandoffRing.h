@@ -0,0 +1,18 @@
+#pragma once
+
+#import <Foundation/Foundation.h>
+
+// Bounded queue of records in a file mapped into both the NotificationService
+// and the app, so that notifications can be handed over without taking a
+// lock. Any number of threads in either process can push and drain at the
+// same time. Records that don't fit, because the queue is full or they are
+// too large, have to be stored some other way.
+@interface MessageHandoffRing : NSObject
+@property(readonly) NSString *path;
+
+// Returns nil if the file can't be mapped or holds an unknown layout
+- (instancetype)initAtPath:(NSString *)path;
+- (BOOL)tryPush:(NSData *)record;
+// Returns records in the order they were pushed
+- (NSArray<NSData *> *)drain;
+@end
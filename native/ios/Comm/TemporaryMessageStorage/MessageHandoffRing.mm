@@ -0,0 +1,349 @@
+#import "MessageHandoffRing.h"
+#import "Logger.h"
+#import <algorithm>
+#import <atomic>
+#import <chrono>
+#import <cstring>
+#import <fcntl.h>
+#import <string>
+#import <sys/mman.h>
+#import <sys/stat.h>
+#import <unistd.h>
+
+// The queue is a bounded MPMC queue of cells, position `p` of the queue
+// being cell `p % cellCount` in lap `p / cellCount`. A producer claims a
+// position by advancing enqueuePosition, and a consumer advances
+// dequeuePosition past a position once its cell is taken. Either side helps
+// advance a position that another thread took and didn't advance, so a
+// thread killed in between doesn't block the queue.
+//
+// Who owns a cell is told by its state, the lap of its last change and
+// what happened to the cell in that lap:
+// - free: nobody owns it, a producer can claim it for the current lap
+// - writing: the producer of that lap is copying its record into it
+// - published: it holds the record of that lap
+// - retired: a consumer gave up on its producer while it was writing
+// A producer writes into a cell only after moving it from free to writing,
+// and a consumer takes a record by moving its cell from published to free
+// for the next lap after copying it, so only one consumer returns each
+// record, and a consumer killed at any point leaves the record in the queue
+// or the cell free. States are stored as zero for free in lap 0, so that a
+// file of zeros, as created by ftruncate, is an empty queue that both
+// processes can start using without any further initialization.
+//
+// A producer that is killed after claiming a position would block the
+// queue, so a consumer gives up on a cell that stays claimed and
+// unpublished for abandoned_cell_timeout_ms from the time it first finds it
+// so. If the producer hadn't started writing, the cell is freed for the next
+// lap, and the producer fails to start if it was only frozen. If it had, the
+// cell is retired instead, and skipped by both sides in later laps until the
+// producer fails to publish and frees it, so that a frozen producer never
+// writes into a record of a later lap. A producer killed while writing
+// leaves its cell retired for good, which only makes the queue shorter. The
+// checksum of a record guards against a file that got corrupted.
+namespace {
+const uint64_t ring_format = 1;
+const uint64_t cell_count = 64;
+const size_t cell_size = 16 * 1024;
+// A producer that claimed a cell and didn't publish it for this long is
+// assumed to have been killed, so that its cell doesn't block the queue
+const int64_t abandoned_cell_timeout_ms = 10 * 1000;
+const uint64_t fnv_offset_basis = 14695981039346656037ULL;
+const uint64_t fnv_prime = 1099511628211ULL;
+
+static_assert(
+    std::atomic<uint64_t>::is_always_lock_free &&
+        std::atomic<uint32_t>::is_always_lock_free,
+    "Atomics shared between processes have to be lock-free");
+
+// Stored in the two lowest bits of the state of a cell, above them is the
+// lap of the state
+enum CellState : uint64_t {
+  cell_free = 0,
+  cell_writing = 1,
+  cell_published = 2,
+  cell_retired = 3,
+};
+
+struct alignas(64) RingHeader {
+  std::atomic<uint64_t> format;
+  alignas(64) std::atomic<uint64_t> enqueuePosition;
+  alignas(64) std::atomic<uint64_t> dequeuePosition;
+};
+
+struct RingCellHeader {
+  std::atomic<uint64_t> state;
+  std::atomic<uint64_t> checksum;
+  std::atomic<uint32_t> length;
+};
+
+struct alignas(64) RingCell {
+  RingCellHeader header;
+  uint8_t data[cell_size - sizeof(RingCellHeader)];
+};
+
+const size_t ring_size = sizeof(RingHeader) + cell_count * sizeof(RingCell);
+
+uint64_t cell_state(uint64_t lap, CellState kind) {
+  return (lap << 2) | kind;
+}
+
+uint64_t state_lap(uint64_t state) {
+  return state >> 2;
+}
+
+CellState state_kind(uint64_t state) {
+  return static_cast<CellState>(state & 3);
+}
+
+// Moves a shared position past the one that was read, unless another thread
+// already did, and updates the one that was read to the next one to look at
+void advance_position(std::atomic<uint64_t> &shared, uint64_t &position) {
+  if (shared.compare_exchange_strong(position, position + 1)) {
+    position++;
+  }
+}
+
+int64_t now_ms() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// FNV-1a of the length and the bytes of a record
+uint64_t record_checksum(const uint8_t *data, uint32_t length) {
+  uint64_t hash = fnv_offset_basis;
+  for (size_t i = 0; i < sizeof(length); i++) {
+    hash = (hash ^ ((length >> (8 * i)) & 0xff)) * fnv_prime;
+  }
+  for (uint32_t i = 0; i < length; i++) {
+    hash = (hash ^ data[i]) * fnv_prime;
+  }
+  return hash;
+}
+} // namespace
+
+@interface MessageHandoffRing () {
+  // The claimed cell that this process last found unpublished, and when it
+  // first found it so
+  uint64_t _stalledPosition;
+  int64_t _stalledSince;
+}
+@property(readonly) void *mapping;
+- (RingHeader *)_header;
+- (RingCell *)_cellAt:(uint64_t)position;
+- (NSData *)_tryPop:(BOOL *)isEmpty;
+- (BOOL)_isAbandoned:(uint64_t)position;
+@end
+
+@implementation MessageHandoffRing
+
+- (instancetype)initAtPath:(NSString *)path {
+  self = [super init];
+  if (!self) {
+    return self;
+  }
+  _path = path;
+  int fd = open(
+      [path cStringUsingEncoding:NSUTF8StringEncoding], O_RDWR | O_CREAT, 0644);
+  if (fd < 0) {
+    comm::Logger::log(
+        "Failed to open handoff ring. Details: " +
+        std::string(strerror(errno)));
+    return nil;
+  }
+  struct stat fileStat;
+  // Growing the file only appends zeros, so it is safe to do when the other
+  // process may be creating it at the same time
+  if (fstat(fd, &fileStat) ||
+      ((size_t)fileStat.st_size < ring_size && ftruncate(fd, ring_size))) {
+    comm::Logger::log(
+        "Failed to create handoff ring. Details: " +
+        std::string(strerror(errno)));
+    close(fd);
+    return nil;
+  }
+  void *mapping =
+      mmap(nullptr, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    comm::Logger::log(
+        "Failed to map handoff ring. Details: " +
+        std::string(strerror(errno)));
+    return nil;
+  }
+  _mapping = mapping;
+
+  uint64_t format = 0;
+  if (!self._header->format.compare_exchange_strong(format, ring_format) &&
+      format != ring_format) {
+    comm::Logger::log(
+        "Unknown handoff ring format: " + std::to_string(format));
+    return nil;
+  }
+  return self;
+}
+
+- (void)dealloc {
+  if (_mapping) {
+    munmap(_mapping, ring_size);
+  }
+}
+
+- (BOOL)tryPush:(NSData *)record {
+  if (!record.length || record.length > sizeof(RingCell::data)) {
+    return NO;
+  }
+  RingHeader *header = self._header;
+  uint64_t position = header->enqueuePosition.load();
+  RingCell *cell;
+  uint64_t lap;
+  uint64_t state;
+  while (true) {
+    cell = [self _cellAt:position];
+    lap = position / cell_count;
+    state = cell->header.state.load();
+    if (state_lap(state) > lap) {
+      // Another producer took the position and the cell moved on since
+      position = header->enqueuePosition.load();
+    } else if (state_kind(state) == cell_free) {
+      if (header->enqueuePosition.compare_exchange_weak(
+              position, position + 1)) {
+        break;
+      }
+    } else if (
+        state_lap(state) == lap || state_kind(state) == cell_retired) {
+      // Taken by another producer that didn't advance the position yet, or
+      // retired in an earlier lap
+      advance_position(header->enqueuePosition, position);
+    } else {
+      // The cell still holds a record from the previous lap
+      return NO;
+    }
+  }
+
+  // Fails if a consumer gave up on the position while the producer was
+  // frozen, or a producer of a later lap took the cell
+  if (!cell->header.state.compare_exchange_strong(
+          state, cell_state(lap, cell_writing))) {
+    return NO;
+  }
+  std::memcpy(cell->data, record.bytes, record.length);
+  cell->header.length.store(
+      (uint32_t)record.length, std::memory_order_relaxed);
+  cell->header.checksum.store(
+      record_checksum(
+          static_cast<const uint8_t *>(record.bytes),
+          (uint32_t)record.length),
+      std::memory_order_relaxed);
+  uint64_t writing = cell_state(lap, cell_writing);
+  if (cell->header.state.compare_exchange_strong(
+          writing, cell_state(lap, cell_published))) {
+    return YES;
+  }
+  // A consumer retired the cell while the producer was writing, nobody else
+  // uses it until the producer frees it
+  cell->header.state.store(cell_state(lap + 1, cell_free));
+  return NO;
+}
+
+- (NSArray<NSData *> *)drain {
+  NSMutableArray<NSData *> *records = [NSMutableArray array];
+  BOOL isEmpty = NO;
+  while (!isEmpty) {
+    NSData *record = [self _tryPop:&isEmpty];
+    if (record) {
+      [records addObject:record];
+    }
+  }
+  return records;
+}
+
+- (NSData *)_tryPop:(BOOL *)isEmpty {
+  RingHeader *header = self._header;
+  uint64_t position = header->dequeuePosition.load();
+  while (true) {
+    RingCell *cell = [self _cellAt:position];
+    uint64_t lap = position / cell_count;
+    // Loaded before the state, so that the state is at least as recent as
+    // the claim of the position
+    uint64_t enqueuePosition = header->enqueuePosition.load();
+    uint64_t state = cell->header.state.load();
+    if (enqueuePosition <= position) {
+      *isEmpty = YES;
+      return nil;
+    }
+    if (state == cell_state(lap, cell_published)) {
+      uint32_t length = cell->header.length.load(std::memory_order_relaxed);
+      uint64_t checksum =
+          cell->header.checksum.load(std::memory_order_relaxed);
+      NSData *record = [NSData
+          dataWithBytes:cell->data
+                 length:std::min<size_t>(length, sizeof(RingCell::data))];
+      // Only one consumer takes the record, the copies of the others are
+      // dropped
+      if (!cell->header.state.compare_exchange_strong(
+              state, cell_state(lap + 1, cell_free))) {
+        continue;
+      }
+      advance_position(header->dequeuePosition, position);
+      if (length > sizeof(RingCell::data) ||
+          record_checksum(static_cast<const uint8_t *>(record.bytes), length) !=
+              checksum) {
+        comm::Logger::log("Dropping corrupted handoff ring record");
+        return nil;
+      }
+      return record;
+    }
+    if (state_lap(state) > lap || state_kind(state) == cell_retired) {
+      // Taken by a consumer that didn't advance the position yet, retired at
+      // this position, or skipped by producers because it was retired
+      // earlier
+      advance_position(header->dequeuePosition, position);
+      continue;
+    }
+    if (state_lap(state) < lap && state_kind(state) != cell_free) {
+      // Can't happen while the records of earlier laps are taken in order
+      *isEmpty = YES;
+      return nil;
+    }
+    // Claimed by a producer that is still writing to the cell, unless that
+    // producer was killed
+    if (![self _isAbandoned:position]) {
+      *isEmpty = YES;
+      return nil;
+    }
+    uint64_t givenUp = state_kind(state) == cell_free
+        ? cell_state(lap + 1, cell_free)
+        : cell_state(lap, cell_retired);
+    if (cell->header.state.compare_exchange_strong(state, givenUp)) {
+      comm::Logger::log("Skipping abandoned handoff ring cell");
+      advance_position(header->dequeuePosition, position);
+      return nil;
+    }
+  }
+}
+
+- (BOOL)_isAbandoned:(uint64_t)position {
+  int64_t now = now_ms();
+  @synchronized(self) {
+    if (_stalledSince == 0 || _stalledPosition != position) {
+      _stalledPosition = position;
+      _stalledSince = now;
+      return NO;
+    }
+    return now - _stalledSince >= abandoned_cell_timeout_ms;
+  }
+}
+
+- (RingHeader *)_header {
+  return static_cast<RingHeader *>(self.mapping);
+}
+
+- (RingCell *)_cellAt:(uint64_t)position {
+  RingCell *cells = reinterpret_cast<RingCell *>(
+      static_cast<uint8_t *>(self.mapping) + sizeof(RingHeader));
+  return &cells[position % cell_count];
+}
+
+@end
@@ -1,12 +1,17 @@
 #pragma once
 
+#import "MessageHandoffRing.h"
 #import <Foundation/Foundation.h>
 
 @interface TemporaryMessageStorage : NSObject
 @property(readonly) NSURL *directoryURL;
 @property(readonly) NSString *directoryPath;
+@property(readonly) MessageHandoffRing *ring;
 
 - (instancetype)initAtDirectory:(NSString *)directoryName;
 - (void)writeMessage:(NSString *)message;
-- (NSArray<NSString *> *)readAndClearMessages;
+// Returns UTF-8 encoded messages in the order they were written, except that
+// the fallback files, written while the newest log is locked, are read after
+// all the logs
+- (NSArray<NSData *> *)readAndClearMessageInfos;
 @end
@@ -4,10 +4,27 @@
 #import "NonBlockingLock.h"
 #import <string>
 
+// Messages are pushed as encrypted records to a ring shared with the app,
+// kept next to the storage directory. When the ring is full, they are
+// appended to log files named log_<time> in the directory, and when the lock
+// of the newest one can't be acquired, to a fallback_<time>_<UUID> file of
+// their own. Files written by previous versions, named msg_<time> or just by
+// UUID, hold base64 lines and are read the way they used to be.
+//
+// The ring only overflows to the files once it is full, and it is drained
+// together with them, so its records are older than the ones in the files.
+static NSString *const logFilePrefix = @"log_";
+static NSString *const fallbackFilePrefix = @"fallback_";
+
 @interface TemporaryMessageStorage ()
+- (NSString *)_getCurrentLogName:(NSArray<NSString *> *)storageContent;
 - (NSString *)_createNewStorage;
 - (NSString *)_getLockName:(NSString *)fileName;
 - (NSString *)_getPath:(NSString *)fileName;
+- (NSArray<NSData *> *)_readAndRemoveFile:(NSString *)fileName
+                          currentLogName:(NSString *)currentLogName
+                          newStorageName:(NSString *)newStorageName;
+- (NSArray<NSData *> *)_drainRing;
 @end
 
 @implementation TemporaryMessageStorage
@@ -43,6 +60,9 @@
   }
   _directoryURL = directoryURL;
   _directoryPath = directoryPath;
+  NSString *ringName = [directoryName stringByAppendingPathExtension:@"ring"];
+  _ring = [[MessageHandoffRing alloc]
+      initAtPath:[groupURL URLByAppendingPathComponent:ringName].path];
   return self;
 }
 
@@ -55,12 +75,14 @@
     return;
   }
 
-  NSString *currentFileName = nil;
-  if (storageContent.count) {
-    currentFileName =
-        [storageContent sortedArrayUsingSelector:@selector(compare:)]
-            .lastObject;
-  } else if (!(currentFileName = [self _createNewStorage])) {
+  NSData *record = [message dataUsingEncoding:NSUTF8StringEncoding];
+  NSData *encryptedRecord = [EncryptedFileUtils encryptRecord:record error:nil];
+  if (encryptedRecord && [self.ring tryPush:encryptedRecord]) {
+    return;
+  }
+
+  NSString *currentFileName = [self _getCurrentLogName:storageContent];
+  if (!currentFileName && !(currentFileName = [self _createNewStorage])) {
     comm::Logger::log(
         "Failed to create new storage file. Details: " +
         std::string(strerror(errno)));
@@ -75,21 +97,25 @@
 
   @try {
     if (![lock tryAcquireLock:&lockError]) {
-      NSString *randomPath =
-          [self.directoryURL
-              URLByAppendingPathComponent:[NSUUID UUID].UUIDString]
-              .path;
-      [EncryptedFileUtils writeData:message toFileAtPath:randomPath error:nil];
+      NSString *fallbackName = [NSString
+          stringWithFormat:@"%@%lld_%@",
+                           fallbackFilePrefix,
+                           (int64_t)[NSDate date].timeIntervalSince1970,
+                           [NSUUID UUID].UUIDString];
+      NSString *fallbackPath = [self _getPath:fallbackName];
+      [EncryptedFileUtils appendRecord:record
+                          toFileAtPath:fallbackPath
+                                 error:nil];
       comm::Logger::log(
           "Failed to acquire lock. Details: " +
           std::string([lockError.localizedDescription UTF8String]) +
           " Persisting notification at path: " +
-          std::string([randomPath UTF8String]));
+          std::string([fallbackPath UTF8String]));
       return;
     }
-    [EncryptedFileUtils appendData:message
-                      toFileAtPath:currentFilePath
-                             error:&writeError];
+    [EncryptedFileUtils appendRecord:record
+                        toFileAtPath:currentFilePath
+                               error:&writeError];
   } @finally {
     [lock releaseLock:&lockError];
   }
@@ -101,8 +127,8 @@
   }
 }
 
-- (NSArray<NSString *> *)readAndClearMessages {
-  NSMutableArray<NSString *> *allMessages = [NSMutableArray array];
+- (NSArray<NSData *> *)readAndClearMessageInfos {
+  NSMutableArray<NSData *> *allMessages = [NSMutableArray array];
   NSArray<NSString *> *storageContents =
       [NSFileManager.defaultManager contentsOfDirectoryAtPath:self.directoryPath
                                                         error:nil];
@@ -111,57 +137,131 @@
     return allMessages;
   }
 
-  NSString *previousFileName =
-      [storageContents sortedArrayUsingSelector:@selector(compare:)].lastObject;
-  NSString *previousStoragePath = [self _getPath:previousFileName];
-
+  NSString *previousFileName = [self _getCurrentLogName:storageContents];
   NSString *newStorageName = [self _createNewStorage];
 
-  for (NSString *fileName in storageContents) {
-    NSString *path = [self _getPath:fileName];
-    NSError *fileReadErr = nil;
-    NSArray<NSString *> *fileMessages = nil;
-
-    if ([path isEqualToString:previousStoragePath]) {
-      NSError *lockErr = nil;
-      NSString *lockName = [self _getLockName:previousFileName];
-      NonBlockingLock *lock = [[NonBlockingLock alloc] initWithName:lockName];
-      @try {
-        BOOL lockAcquired = [lock tryAcquireLock:&lockErr];
-        fileMessages = [EncryptedFileUtils readFromFileAtPath:path
-                                                        error:&fileReadErr];
-        if (newStorageName && lockAcquired) {
-          [NSFileManager.defaultManager removeItemAtPath:path error:nil];
-        } else if (lockErr) {
-          comm::Logger::log(
-              "Failed to acquire lock. Details: " +
-              std::string([lockErr.localizedDescription UTF8String]));
-        }
-      } @finally {
-        [lock releaseLock:&lockErr];
-        [lock destroyLock:&lockErr];
-      }
+  // Files of the previous versions go first, then the ring, then the log
+  // files and the fallback files, each by the time in their names
+  NSMutableArray<NSString *> *legacyFiles = [NSMutableArray array];
+  NSMutableArray<NSString *> *logFiles = [NSMutableArray array];
+  NSMutableArray<NSString *> *fallbackFiles = [NSMutableArray array];
+  for (NSString *fileName in
+       [storageContents sortedArrayUsingSelector:@selector(compare:)]) {
+    if ([fileName hasPrefix:logFilePrefix]) {
+      [logFiles addObject:fileName];
+    } else if ([fileName hasPrefix:fallbackFilePrefix]) {
+      [fallbackFiles addObject:fileName];
     } else {
-      fileMessages = [EncryptedFileUtils readFromFileAtPath:path
-                                                      error:&fileReadErr];
-      [NSFileManager.defaultManager removeItemAtPath:path error:nil];
+      [legacyFiles addObject:fileName];
     }
+  }
 
-    if (!fileMessages) {
-      comm::Logger::log(
-          "Failed to read file at path: " + std::string([path UTF8String]) +
-          "Details: " +
-          std::string([fileReadErr.localizedDescription UTF8String]));
-    } else {
-      [allMessages addObjectsFromArray:fileMessages];
+  for (NSString *fileName in legacyFiles) {
+    [allMessages addObjectsFromArray:[self _readAndRemoveFile:fileName
+                                               currentLogName:previousFileName
+                                               newStorageName:newStorageName]];
+  }
+  [allMessages addObjectsFromArray:[self _drainRing]];
+  for (NSArray<NSString *> *files in @[ logFiles, fallbackFiles ]) {
+    for (NSString *fileName in files) {
+      [allMessages
+          addObjectsFromArray:[self _readAndRemoveFile:fileName
+                                        currentLogName:previousFileName
+                                        newStorageName:newStorageName]];
     }
   }
   return allMessages;
 }
 
+- (NSArray<NSData *> *)_readAndRemoveFile:(NSString *)fileName
+                          currentLogName:(NSString *)currentLogName
+                          newStorageName:(NSString *)newStorageName {
+  NSString *path = [self _getPath:fileName];
+  BOOL isRecordFile = [fileName hasPrefix:logFilePrefix] ||
+      [fileName hasPrefix:fallbackFilePrefix];
+  NSError *fileReadErr = nil;
+  NSArray<NSData *> *fileMessages = nil;
+
+  if ([fileName isEqualToString:currentLogName]) {
+    NSError *lockErr = nil;
+    NSString *lockName = [self _getLockName:currentLogName];
+    NonBlockingLock *lock = [[NonBlockingLock alloc] initWithName:lockName];
+    @try {
+      BOOL lockAcquired = [lock tryAcquireLock:&lockErr];
+      fileMessages =
+          [EncryptedFileUtils readRecordsFromFileAtPath:path
+                                                  error:&fileReadErr];
+      if (newStorageName && lockAcquired) {
+        [NSFileManager.defaultManager removeItemAtPath:path error:nil];
+      } else if (lockErr) {
+        comm::Logger::log(
+            "Failed to acquire lock. Details: " +
+            std::string([lockErr.localizedDescription UTF8String]));
+      }
+    } @finally {
+      [lock releaseLock:&lockErr];
+      [lock destroyLock:&lockErr];
+    }
+  } else if (isRecordFile) {
+    fileMessages = [EncryptedFileUtils readRecordsFromFileAtPath:path
+                                                           error:&fileReadErr];
+    [NSFileManager.defaultManager removeItemAtPath:path error:nil];
+  } else {
+    NSArray<NSString *> *legacyMessages =
+        [EncryptedFileUtils readFromFileAtPath:path error:&fileReadErr];
+    if (legacyMessages) {
+      NSMutableArray<NSData *> *legacyData =
+          [NSMutableArray arrayWithCapacity:legacyMessages.count];
+      for (NSString *message in legacyMessages) {
+        [legacyData addObject:[message dataUsingEncoding:NSUTF8StringEncoding]];
+      }
+      fileMessages = legacyData;
+    }
+    [NSFileManager.defaultManager removeItemAtPath:path error:nil];
+  }
+
+  if (!fileMessages) {
+    comm::Logger::log(
+        "Failed to read file at path: " + std::string([path UTF8String]) +
+        "Details: " +
+        std::string([fileReadErr.localizedDescription UTF8String]));
+    return @[];
+  }
+  return fileMessages;
+}
+
+- (NSArray<NSData *> *)_drainRing {
+  NSArray<NSData *> *encryptedRecords = [self.ring drain];
+  if (!encryptedRecords.count) {
+    return @[];
+  }
+  NSError *decryptErr = nil;
+  NSArray<NSData *> *records =
+      [EncryptedFileUtils decryptRecords:encryptedRecords error:&decryptErr];
+  if (!records) {
+    comm::Logger::log(
+        "Failed to decrypt messages from handoff ring. Details: " +
+        std::string([decryptErr.localizedDescription UTF8String]));
+    return @[];
+  }
+  return records;
+}
+
+- (NSString *)_getCurrentLogName:(NSArray<NSString *> *)storageContent {
+  NSString *currentLogName = nil;
+  for (NSString *fileName in storageContent) {
+    if ([fileName hasPrefix:logFilePrefix] &&
+        (!currentLogName || [fileName compare:currentLogName] > 0)) {
+      currentLogName = fileName;
+    }
+  }
+  return currentLogName;
+}
+
 - (NSString *)_createNewStorage {
   int64_t timestamp = (int64_t)[NSDate date].timeIntervalSince1970;
-  NSString *newStorageName = [NSString stringWithFormat:@"msg_%lld", timestamp];
+  NSString *newStorageName =
+      [NSString stringWithFormat:@"%@%lld", logFilePrefix, timestamp];
   NSString *newStoragePath =
       [self.directoryURL URLByAppendingPathComponent:newStorageName].path;
   const char *newStoragePathCstr =
@@ -1,10 +1,12 @@
 #import "TerminateApp.h"
+#import "Logger.h"
 
 #import <Foundation/Foundation.h>
 
 namespace comm {
 
 void TerminateApp::terminate() {
+  Logger::flush();
   exit(0);
 };
 
@@ -0,0 +1,65 @@
+#import "Trace.h"
+
+#import <os/signpost.h>
+#import <vector>
+
+namespace comm {
+
+namespace {
+
+os_log_t traceLog() {
+  static os_log_t log = os_log_create("app.comm", "CommCoreModule");
+  return log;
+}
+
+// os_signpost intervals are matched by their id, the ids of the sections
+// that a thread has begun are kept to end them in the opposite order
+thread_local std::vector<os_signpost_id_t> sectionIDs;
+
+os_signpost_id_t asyncSectionID(int32_t cookie) {
+  // OS_SIGNPOST_ID_NULL is 0
+  return static_cast<os_signpost_id_t>(cookie) + 1;
+}
+
+} // namespace
+
+bool Trace::isEnabled() {
+  return os_signpost_enabled(traceLog());
+}
+
+void Trace::beginSection(const std::string &name) {
+  os_log_t log = traceLog();
+  os_signpost_id_t sectionID = os_signpost_id_generate(log);
+  sectionIDs.push_back(sectionID);
+  os_signpost_interval_begin(
+      log, sectionID, "Section", "%{public}s", name.c_str());
+}
+
+void Trace::endSection() {
+  if (sectionIDs.empty()) {
+    return;
+  }
+  os_signpost_id_t sectionID = sectionIDs.back();
+  sectionIDs.pop_back();
+  os_signpost_interval_end(traceLog(), sectionID, "Section");
+}
+
+void Trace::beginAsyncSection(const std::string &name, int32_t cookie) {
+  os_signpost_interval_begin(
+      traceLog(),
+      asyncSectionID(cookie),
+      "AsyncSection",
+      "%{public}s",
+      name.c_str());
+}
+
+void Trace::endAsyncSection(const std::string &name, int32_t cookie) {
+  os_signpost_interval_end(
+      traceLog(),
+      asyncSectionID(cookie),
+      "AsyncSection",
+      "%{public}s",
+      name.c_str());
+}
+
+} // namespace comm
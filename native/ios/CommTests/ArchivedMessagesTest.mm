@@ -0,0 +1,122 @@
+#import "../../cpp/CommonCpp/DatabaseManagers/DatabaseManager.h"
+#import "../../cpp/CommonCpp/DatabaseManagers/InMemoryQueryExecutor.h"
+
+#import <XCTest/XCTest.h>
+
+#import <string>
+#import <vector>
+
+using namespace comm;
+
+@interface ArchivedMessagesTest : XCTestCase
+
+@end
+
+@implementation ArchivedMessagesTest
+
+const std::string ARCHIVE_TEST_PREFIX = "archive_test_";
+
+std::string archiveTestID(const std::string &kind, int index) {
+  return ARCHIVE_TEST_PREFIX + kind + std::to_string(index);
+}
+
+Message archiveTestMessage(
+    int index,
+    int thread,
+    const std::string &content,
+    int64_t time) {
+  return Message{
+      archiveTestID("message", index),
+      nullptr,
+      archiveTestID("thread", thread),
+      "user",
+      0,
+      nullptr,
+      std::make_unique<std::string>(content),
+      time};
+}
+
+// Archived messages answer the same reads as the others, and bringing one
+// back by writing it again keeps its media
+- (void)checkArchivedMessagesOf:(const DatabaseQueryExecutor &)executor {
+  // Everything is rolled back, leaving the database of the app as it was
+  executor.beginTransaction();
+  try {
+    std::vector<Message> messages;
+    messages.push_back(archiveTestMessage(0, 0, "archived alpha", 1000));
+    messages.push_back(archiveTestMessage(1, 0, "archived beta", 1001));
+    messages.push_back(archiveTestMessage(2, 0, "live gamma", 2000));
+    messages.push_back(archiveTestMessage(3, 1, "archived delta", 1000));
+    messages.push_back(archiveTestMessage(4, 1, "archived epsilon", 1001));
+    executor.replaceMessages(messages);
+    executor.replaceMediaBatch({Media{
+        archiveTestID("media", 0),
+        archiveTestID("message", 0),
+        archiveTestID("thread", 0),
+        "uri",
+        "photo",
+        "{}"}});
+    XCTAssert(executor.archiveMessages(1500) == 4);
+
+    auto found = executor.searchMessages("alpha", folly::none, 10, 0);
+    XCTAssert(found.size() == 1, @"archived message found by search");
+
+    executor.replaceMessage(
+        archiveTestMessage(0, 0, "archived alpha edited", 1000));
+    auto unarchived =
+        executor.getMessagesByIDs({archiveTestID("message", 0)});
+    XCTAssert(unarchived.size() == 1);
+    if (unarchived.size() == 1) {
+      XCTAssert(
+          unarchived[0].second.size() == 1, @"media kept when unarchived");
+    }
+    found = executor.searchMessages("alpha", folly::none, 10, 0);
+    XCTAssert(found.size() == 1, @"unarchived message found once");
+
+    // The latest message of the thread is archived, so the summary falls
+    // back to the archived one before it
+    executor.removeMessages({archiveTestID("message", 4)});
+    bool summaryFound = false;
+    for (const ThreadSummary &summary :
+         executor.getThreadSummariesByRecency()) {
+      if (summary.thread_id != archiveTestID("thread", 1)) {
+        continue;
+      }
+      summaryFound = true;
+      XCTAssert(summary.message_count == 1);
+      XCTAssert(
+          summary.last_message_id &&
+              *summary.last_message_id == archiveTestID("message", 3),
+          @"summary points at the remaining archived message");
+      XCTAssert(summary.last_message_time == 1000);
+    }
+    XCTAssert(summaryFound);
+
+    executor.rekeyMessagesBatch(
+        {{archiveTestID("message", 1), archiveTestID("rekeyed", 1)}});
+    XCTAssert(executor.getMessagesByIDs({archiveTestID("message", 1)})
+                  .empty());
+    found = executor.searchMessages("beta", folly::none, 10, 0);
+    XCTAssert(found.size() == 1);
+    if (found.size() == 1) {
+      XCTAssert(
+          found[0].first.id == archiveTestID("rekeyed", 1),
+          @"archived message rekeyed");
+    }
+  } catch (const std::exception &e) {
+    executor.rollbackTransaction();
+    XCTFail(@"Archived messages script failed: %s", e.what());
+    return;
+  }
+  executor.rollbackTransaction();
+}
+
+- (void)testArchivedMessagesInSQLite {
+  [self checkArchivedMessagesOf:DatabaseManager::getQueryExecutor()];
+}
+
+- (void)testArchivedMessagesInMemory {
+  [self checkArchivedMessagesOf:InMemoryQueryExecutor()];
+}
+
+@end
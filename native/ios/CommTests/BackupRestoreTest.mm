@@ -0,0 +1,144 @@
+#import "../../cpp/CommonCpp/DatabaseManagers/DatabaseManager.h"
+#import "../../cpp/CommonCpp/DatabaseManagers/SQLiteQueryExecutor.h"
+#import "../../cpp/CommonCpp/NativeModules/InternalModules/BackupRestoreTask.h"
+#import "../../cpp/CommonCpp/NativeModules/InternalModules/BackupSnapshotTask.h"
+
+#import <XCTest/XCTest.h>
+
+#import <memory>
+#import <string>
+#import <unordered_map>
+#import <vector>
+
+using namespace comm;
+
+@interface BackupRestoreTest : XCTestCase
+
+@end
+
+@implementation BackupRestoreTest
+
+const std::string BACKUP_RESTORE_TEST_THREAD = "backup_restore_test_thread";
+const int BACKUP_RESTORE_TEST_MESSAGES_COUNT = 15;
+// Messages below this one are in the compaction, the rest only in the logs
+const int BACKUP_RESTORE_TEST_COMPACTED_COUNT = 10;
+
+std::string backupRestoreTestMessageID(int index) {
+  return "backup_restore_test_message" + std::to_string(index);
+}
+
+std::string backupRestoreTestContent(int index) {
+  return "message " + std::to_string(index);
+}
+
+std::vector<Message> backupRestoreTestMessages(int from, int to) {
+  std::vector<Message> messages;
+  for (int index = from; index < to; index++) {
+    messages.push_back(Message{
+        backupRestoreTestMessageID(index),
+        nullptr,
+        BACKUP_RESTORE_TEST_THREAD,
+        "user",
+        0,
+        nullptr,
+        std::make_unique<std::string>(backupRestoreTestContent(index)),
+        1000 + index});
+  }
+  return messages;
+}
+
+std::vector<std::string> backupRestoreTestMessageIDs() {
+  std::vector<std::string> ids;
+  for (int index = 0; index < BACKUP_RESTORE_TEST_MESSAGES_COUNT; index++) {
+    ids.push_back(backupRestoreTestMessageID(index));
+  }
+  return ids;
+}
+
+- (void)tearDown {
+  DatabaseManager::getQueryExecutor().removeMessages(
+      backupRestoreTestMessageIDs());
+}
+
+// A compaction and the logs written after it, pulled back in chunks,
+// give the database as it was when the logs were taken
+- (void)testRestoreOfCompactionAndLogs {
+  const DatabaseQueryExecutor &executor = DatabaseManager::getQueryExecutor();
+  executor.replaceMessages(
+      backupRestoreTestMessages(0, BACKUP_RESTORE_TEST_COMPACTED_COUNT));
+
+  auto compactionChunks = std::make_shared<std::vector<std::string>>();
+  XCTestExpectation *snapshotDone =
+      [self expectationWithDescription:@"Snapshot made"];
+  auto snapshotError = std::make_shared<std::string>();
+  BackupSnapshotTask::run(
+      [compactionChunks](const std::string &chunk) {
+        compactionChunks->push_back(chunk);
+      },
+      [snapshotDone, snapshotError](const std::string &error) {
+        *snapshotError = error;
+        [snapshotDone fulfill];
+      });
+  [self waitForExpectations:@[ snapshotDone ] timeout:30];
+  XCTAssert(
+      snapshotError->empty(), @"Snapshot failed: %s", snapshotError->c_str());
+  XCTAssert(!compactionChunks->empty(), @"Snapshot has no chunks");
+
+  // Changes after the compaction only go to the logs
+  executor.replaceMessages(backupRestoreTestMessages(
+      BACKUP_RESTORE_TEST_COMPACTED_COUNT, BACKUP_RESTORE_TEST_MESSAGES_COUNT));
+  executor.removeMessages({backupRestoreTestMessageID(0)});
+  executor.recordBackupLog();
+  BackupLogs logs = executor.takeBackupLogs();
+  XCTAssertFalse(logs.compactionRequired);
+  XCTAssert(!logs.logs.empty(), @"No logs were recorded");
+
+  // Like a new device, which doesn't have any of the messages
+  executor.removeMessages(backupRestoreTestMessageIDs());
+
+  XCTestExpectation *restoreDone =
+      [self expectationWithDescription:@"Backup restored"];
+  auto restoreError = std::make_shared<std::string>();
+  std::shared_ptr<BackupRestoreTask> restore = BackupRestoreTask::start(
+      SQLiteQueryExecutor::encryptionKey,
+      [restoreDone, restoreError](const std::string &error) {
+        *restoreError = error;
+        [restoreDone fulfill];
+      });
+  for (const std::string &chunk : *compactionChunks) {
+    restore->onCompactionChunk(chunk);
+  }
+  for (const BackupLog &log : logs.logs) {
+    for (const std::string &chunk : log.chunks) {
+      restore->onLogChunk(chunk);
+    }
+  }
+  restore->finish();
+  [self waitForExpectations:@[ restoreDone ] timeout:30];
+  XCTAssert(
+      restoreError->empty(), @"Restore failed: %s", restoreError->c_str());
+
+  std::unordered_map<std::string, std::string> restored;
+  for (const auto &[message, media] :
+       executor.getMessagesByIDs(backupRestoreTestMessageIDs())) {
+    restored[message.id] = message.content ? *message.content : "";
+  }
+  // The first one was removed after the compaction
+  XCTAssert(
+      restored.size() == BACKUP_RESTORE_TEST_MESSAGES_COUNT - 1,
+      @"%zu messages are restored",
+      restored.size());
+  XCTAssert(
+      !restored.count(backupRestoreTestMessageID(0)),
+      @"Removed message is restored");
+  for (int index = 1; index < BACKUP_RESTORE_TEST_MESSAGES_COUNT; index++) {
+    const auto message = restored.find(backupRestoreTestMessageID(index));
+    XCTAssert(
+        message != restored.end() &&
+            message->second == backupRestoreTestContent(index),
+        @"Message %d isn't restored",
+        index);
+  }
+}
+
+@end
@@ -5,7 +5,9 @@
 
 #import <XCTest/XCTest.h>
 
+#import <atomic>
 #import <stdexcept>
+#import <thread>
 
 using namespace comm::crypto;
 
@@ -311,4 +313,165 @@ void testMessagesWrapper(
   }
 }
 
+- (void)testMoreSessionsThanLiveAfterRestore {
+  // More peers than the module keeps unpickled at once, so that sessions
+  // are both restored lazily and evicted while being used
+  try {
+    ModuleWithKeys moduleA = initializeModuleWithKeys(++currentId);
+    std::vector<ModuleWithKeys> peers;
+    for (size_t i = 0; i < 80; ++i) {
+      peers.push_back(initializeModuleWithKeys(++currentId));
+      sendMessage(moduleA, peers.back());
+    }
+
+    std::string pickleKey{Tools::generateRandomString(20)};
+    Persist pickled = moduleA.module->storeAsB64(pickleKey);
+    moduleA.module.reset(new CryptoModule(moduleA.module->id));
+    moduleA.module->restoreFromB64(pickleKey, pickled);
+
+    for (size_t round = 0; round < 2; ++round) {
+      for (ModuleWithKeys &peer : peers) {
+        XCTAssert(moduleA.module->hasSessionFor(peer.module->id));
+        sendMessage(peer, moduleA);
+        sendMessage(moduleA, peer);
+      }
+    }
+    XCTAssert(
+        moduleA.module->storeAsB64(pickleKey).sessions.size() == peers.size(),
+        @"all sessions persisted");
+  } catch (std::runtime_error &e) {
+    comm::Logger::log("testMoreSessions error: " + std::string(e.what()));
+    XCTAssert(false);
+  }
+}
+
+- (void)testStoreChangedSessionsOnly {
+  try {
+    ModuleWithKeys moduleA = initializeModuleWithKeys(++currentId);
+    ModuleWithKeys moduleB = initializeModuleWithKeys(++currentId);
+    ModuleWithKeys moduleC = initializeModuleWithKeys(++currentId);
+    sendMessage(moduleA, moduleB);
+    sendMessage(moduleA, moduleC);
+
+    std::string pickleKey{Tools::generateRandomString(20)};
+    Persist all = moduleA.module->storeChangedAsB64(pickleKey);
+    XCTAssert(!all.account.empty() && all.sessions.size() == 2);
+
+    Persist unchanged = moduleA.module->storeChangedAsB64(pickleKey);
+    XCTAssert(unchanged.account.empty() && unchanged.sessions.empty());
+
+    sendMessage(moduleC, moduleA);
+    Persist changed = moduleA.module->storeChangedAsB64(pickleKey);
+    XCTAssert(changed.account.empty() && changed.sessions.size() == 1);
+    XCTAssert(changed.sessions.count(moduleC.module->id));
+
+    // A Persist that failed to be written is stored again with the next one
+    moduleA.module->markUnstored(changed);
+    Persist retried = moduleA.module->storeChangedAsB64(pickleKey);
+    XCTAssert(retried.account.empty() && retried.sessions.size() == 1);
+    XCTAssert(retried.sessions.count(moduleC.module->id));
+    moduleA.module->markUnstored(all);
+    Persist retriedAll = moduleA.module->storeChangedAsB64(pickleKey);
+    XCTAssert(!retriedAll.account.empty() && retriedAll.sessions.size() == 2);
+  } catch (std::runtime_error &e) {
+    comm::Logger::log("testStoreChanged error: " + std::string(e.what()));
+    XCTAssert(false);
+  }
+}
+
+- (void)testBatchEncryptAndDecrypt {
+  try {
+    ModuleWithKeys sender = initializeModuleWithKeys(++currentId);
+    std::vector<ModuleWithKeys> devices;
+    std::vector<std::string> deviceIds;
+    for (size_t i = 0; i < 3; ++i) {
+      devices.push_back(initializeModuleWithKeys(++currentId));
+      sendMessage(sender, devices.back());
+      sendMessage(devices.back(), sender);
+      deviceIds.push_back(devices.back().module->id);
+    }
+
+    std::string message{Tools::generateRandomString(50)};
+    std::vector<EncryptedData> encryptedMessages =
+        sender.module->encrypt(deviceIds, message);
+    XCTAssert(encryptedMessages.size() == devices.size());
+    for (size_t i = 0; i < devices.size(); ++i) {
+      std::string decrypted = devices[i].module->decrypt(
+          sender.module->id, encryptedMessages[i], sender.keys.identityKeys);
+      XCTAssert(decrypted == message, @"fanned out message decrypted");
+    }
+
+    std::vector<std::string> backlog;
+    std::vector<EncryptedData> encryptedBacklog;
+    for (size_t i = 0; i < 5; ++i) {
+      backlog.push_back(Tools::generateRandomString(50));
+      encryptedBacklog.push_back(
+          devices[0].module->encrypt(sender.module->id, backlog.back()));
+    }
+    std::vector<std::string> decryptedBacklog = sender.module->decrypt(
+        devices[0].module->id, encryptedBacklog, devices[0].keys.identityKeys);
+    XCTAssert(decryptedBacklog == backlog, @"backlog decrypted in order");
+  } catch (std::runtime_error &e) {
+    comm::Logger::log("testBatch error: " + std::string(e.what()));
+    XCTAssert(false);
+  }
+}
+
+- (void)testSessionsOfDifferentPeersInParallel {
+  try {
+    ModuleWithKeys sender = initializeModuleWithKeys(++currentId);
+    std::vector<ModuleWithKeys> peers;
+    for (size_t i = 0; i < 4; ++i) {
+      peers.push_back(initializeModuleWithKeys(++currentId));
+      sendMessage(sender, peers.back());
+      sendMessage(peers.back(), sender);
+    }
+    std::string pickleKey{Tools::generateRandomString(20)};
+
+    // Every peer gets its own thread, while the account is used and stored
+    // on another one
+    std::vector<std::vector<std::string>> messages(peers.size());
+    std::vector<std::vector<EncryptedData>> encrypted(peers.size());
+    std::atomic<bool> failed{false};
+    auto runGuarded = [&failed](std::function<void()> work) {
+      try {
+        work();
+      } catch (std::runtime_error &e) {
+        comm::Logger::log("testParallel error: " + std::string(e.what()));
+        failed = true;
+      }
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < peers.size(); ++i) {
+      threads.emplace_back(runGuarded, [&, i]() {
+        for (size_t j = 0; j < 20; ++j) {
+          messages[i].push_back(Tools::generateRandomString(50));
+          encrypted[i].push_back(
+              sender.module->encrypt(peers[i].module->id, messages[i].back()));
+          sender.module->storeChangedAsB64(pickleKey);
+        }
+      });
+    }
+    threads.emplace_back(runGuarded, [&]() {
+      for (size_t j = 0; j < 5; ++j) {
+        sender.module->pregenerateOneTimeKeys();
+        sender.module->storeChangedAsB64(pickleKey);
+      }
+    });
+    for (std::thread &thread : threads) {
+      thread.join();
+    }
+    XCTAssert(!failed);
+
+    for (size_t i = 0; i < peers.size(); ++i) {
+      std::vector<std::string> decrypted = peers[i].module->decrypt(
+          sender.module->id, encrypted[i], sender.keys.identityKeys);
+      XCTAssert(decrypted == messages[i], @"messages of a peer in order");
+    }
+  } catch (std::runtime_error &e) {
+    comm::Logger::log("testParallel error: " + std::string(e.what()));
+    XCTAssert(false);
+  }
+}
+
 @end
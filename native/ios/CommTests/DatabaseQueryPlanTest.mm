@@ -0,0 +1,255 @@
+#import "../../cpp/CommonCpp/DatabaseManagers/DatabaseManager.h"
+#import "../../cpp/CommonCpp/DatabaseManagers/QueryProfiler.h"
+#import "../../cpp/CommonCpp/Tools/Logger.h"
+
+#import <XCTest/XCTest.h>
+
+#import <algorithm>
+#import <sstream>
+
+using namespace comm;
+
+@interface DatabaseQueryPlanTest : XCTestCase
+
+@end
+
+@implementation DatabaseQueryPlanTest
+
+const int SYNTHETIC_THREADS_COUNT = 100;
+const int SYNTHETIC_THREAD_MESSAGES_COUNT = 200;
+const std::string SYNTHETIC_ID_PREFIX = "query_plan_test_";
+
+struct RequiredIndex {
+  // Part of the SQL of the statements that have to use the index
+  std::string query;
+  std::string index;
+};
+
+// Indexes the storage queries are written for. A statement that stops using
+// one reads the whole table instead.
+const std::vector<RequiredIndex> REQUIRED_INDEXES{
+    {"FROM messages WHERE thread = ?1", "messages_idx_thread_time"},
+    {"FROM archived_messages WHERE thread = ?1",
+     "archived_messages_idx_thread_time"},
+    {"FROM media WHERE container = ?1", "media_idx_container"},
+    {"FROM thread_summary ORDER BY last_message_time",
+     "thread_summary_idx_last_message_time"},
+    {"FROM media_cache WHERE last_accessed", "media_cache_idx_last_accessed"},
+    {"FROM outbox WHERE in_flight = 0", "outbox_idx_in_flight_created_at"}};
+
+// Tables that grow with the history of the user
+const std::vector<std::string> LARGE_TABLES{
+    "messages", "archived_messages", "media", "threads", "thread_members"};
+
+// Statements that read a whole large table by design, as they touch most of
+// its rows or run in the background
+const std::vector<std::string> ALLOWED_SCANS{
+    // archiveMessages, by time across all threads
+    "WHERE time < ?1",
+    "WHERE type = 0 AND time < ?1",
+    // Compression during maintenance, from the newest rows down
+    "ORDER BY rowid DESC LIMIT ?2"};
+
+std::string syntheticID(const std::string &kind, int thread, int index) {
+  return SYNTHETIC_ID_PREFIX + kind + std::to_string(thread) + "_" +
+      std::to_string(index);
+}
+
+// Fills the database the way a long history does, many threads with many
+// messages, a part of them with media
+void writeSyntheticHistory() {
+  std::vector<Message> messages;
+  std::vector<Media> media;
+  for (int thread = 0; thread < SYNTHETIC_THREADS_COUNT; thread++) {
+    std::string threadID = syntheticID("thread", thread, 0);
+    for (int index = 0; index < SYNTHETIC_THREAD_MESSAGES_COUNT; index++) {
+      std::string messageID = syntheticID("message", thread, index);
+      messages.push_back(Message{
+          messageID,
+          nullptr,
+          threadID,
+          "user",
+          0,
+          nullptr,
+          std::make_unique<std::string>(
+              "synthetic message " + std::to_string(index)),
+          1000 + index});
+      if (index % 10 == 0) {
+        media.push_back(Media{
+            syntheticID("media", thread, index),
+            messageID,
+            threadID,
+            "uri",
+            "photo",
+            "{}"});
+      }
+    }
+  }
+  const DatabaseQueryExecutor &executor = DatabaseManager::getQueryExecutor();
+  executor.replaceMessages(messages);
+  executor.replaceMediaBatch(media);
+}
+
+// Runs the reads and writes the app issues, so that QueryProfiler records
+// their statements
+void runStorageQueries() {
+  const DatabaseQueryExecutor &executor = DatabaseManager::getQueryExecutor();
+  std::string threadID = syntheticID("thread", 0, 0);
+  std::vector<std::string> messageIDs;
+  for (int index = 0; index < 50; index++) {
+    messageIDs.push_back(syntheticID("message", 1, index));
+  }
+
+  executor.getThreadMessagesBefore(threadID, 1100, "", 20);
+  executor.getThreadMessagesInRange(threadID, 1000, 1050, 20);
+  executor.getMessagesOfThreads({threadID});
+  executor.getMessagesByIDs(messageIDs);
+  executor.getThreadMessageCounts({threadID});
+  executor.getThreadSummariesByRecency();
+  executor.searchMessages("synthetic", threadID, 20, 0);
+  executor.getAllThreads();
+  executor.getThreadMembers(threadID);
+
+  executor.archiveMessages(1010);
+  executor.getThreadMessagesBefore(threadID, 1100, "", 20);
+  executor.removeMediaForMessages(messageIDs);
+  executor.removeMessages(messageIDs);
+  executor.removeMessagesForThreads({syntheticID("thread", 2, 0)});
+  executor.rekeyMessagesBatch(
+      {{syntheticID("message", 3, 0), syntheticID("message", 3, 1000)}});
+  executor.rekeyMediaContainersBatch(
+      {{syntheticID("message", 3, 10), syntheticID("message", 3, 1010)}});
+
+  executor.recordMediaCacheEntry(MediaCacheEntry{
+      syntheticID("media", 4, 0), "/nonexistent/media_cache_entry", 100, 0});
+  executor.touchMediaCacheEntries({syntheticID("media", 4, 0)}, 1);
+  executor.evictMediaCache(0);
+
+  executor.addToOutbox({OutboxEntry{
+      syntheticID("message", 5, 0), syntheticID("thread", 5, 0), "", "{}", -1,
+      1000}});
+  executor.takeOutboxBatch(10);
+  executor.acknowledgeOutboxEntries(
+      {{syntheticID("message", 5, 0), syntheticID("message", 5, 1000)}});
+}
+
+bool isDefinition(const std::string &query) {
+  return query.rfind("CREATE ", 0) == 0 || query.rfind("DROP ", 0) == 0 ||
+      query.rfind("ALTER ", 0) == 0;
+}
+
+// A step that reads every row of a table, without an index to search it.
+// Older versions of SQLite print "SCAN TABLE" instead of "SCAN".
+std::string scannedTable(const std::string &step) {
+  if (step.find(" USING ") != std::string::npos) {
+    return "";
+  }
+  for (const std::string &prefix : {"SCAN TABLE ", "SCAN "}) {
+    if (step.rfind(prefix, 0) == 0) {
+      std::string table = step.substr(prefix.size());
+      return table.substr(0, table.find(' '));
+    }
+  }
+  return "";
+}
+
+std::string describePlan(const QueryPlan &plan) {
+  std::ostringstream description;
+  description << plan.query;
+  for (const std::string &step : plan.steps) {
+    description << "\n  " << step;
+  }
+  return description.str();
+}
+
+- (void)testStorageQueriesUseTheirIndexes {
+  const DatabaseQueryExecutor &executor = DatabaseManager::getQueryExecutor();
+  // Everything is rolled back, leaving the database of the app as it was
+  executor.beginTransaction();
+  std::vector<QueryPlan> plans;
+  std::vector<QueryProfile> profiles;
+  try {
+    writeSyntheticHistory();
+    QueryProfiler::reset();
+    runStorageQueries();
+    plans = executor.getQueryPlans();
+    profiles = QueryProfiler::getSnapshot();
+  } catch (const std::exception &e) {
+    executor.rollbackTransaction();
+    XCTFail(@"Storage queries failed: %s", e.what());
+    return;
+  }
+  executor.rollbackTransaction();
+
+  for (const QueryProfile &profile : profiles) {
+    std::ostringstream timing;
+    timing << profile.count << "x, " << profile.totalDurationUs << "us total, "
+           << profile.maxDurationUs << "us max: " << profile.query;
+    Logger::log(timing.str());
+  }
+
+  for (const RequiredIndex &required : REQUIRED_INDEXES) {
+    bool queried = false;
+    for (const QueryPlan &plan : plans) {
+      if (plan.query.find(required.query) == std::string::npos) {
+        continue;
+      }
+      queried = true;
+      bool indexed = false;
+      for (const std::string &step : plan.steps) {
+        indexed = indexed || step.find(required.index) != std::string::npos;
+      }
+      XCTAssert(
+          indexed,
+          @"%s doesn't use %s",
+          describePlan(plan).c_str(),
+          required.index.c_str());
+    }
+    XCTAssert(queried, @"Nothing queried %s", required.query.c_str());
+  }
+
+  for (const QueryPlan &plan : plans) {
+    if (isDefinition(plan.query)) {
+      continue;
+    }
+    XCTAssert(
+        plan.error.empty(),
+        @"%s can't be explained: %s",
+        plan.query.c_str(),
+        plan.error.c_str());
+    if (plan.query.find(" WHERE ") == std::string::npos) {
+      continue;
+    }
+    bool allowed = false;
+    for (const std::string &allowedScan : ALLOWED_SCANS) {
+      allowed = allowed || plan.query.find(allowedScan) != std::string::npos;
+    }
+    if (allowed) {
+      continue;
+    }
+    for (const std::string &step : plan.steps) {
+      std::string table = scannedTable(step);
+      XCTAssert(
+          std::find(LARGE_TABLES.begin(), LARGE_TABLES.end(), table) ==
+              LARGE_TABLES.end(),
+          @"%s scans %s",
+          describePlan(plan).c_str(),
+          table.c_str());
+    }
+  }
+}
+
+- (void)testThreadPagePerformance {
+  const DatabaseQueryExecutor &executor = DatabaseManager::getQueryExecutor();
+  executor.beginTransaction();
+  writeSyntheticHistory();
+  [self measureBlock:^{
+    for (int thread = 0; thread < SYNTHETIC_THREADS_COUNT; thread++) {
+      DatabaseManager::getQueryExecutor().getThreadMessagesBefore(
+          syntheticID("thread", thread, 0), 1100, "", 20);
+    }
+  }];
+  executor.rollbackTransaction();
+}
+
+@end
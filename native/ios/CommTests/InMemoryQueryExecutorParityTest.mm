@@ -0,0 +1,285 @@
+#import "../../cpp/CommonCpp/DatabaseManagers/DatabaseManager.h"
+#import "../../cpp/CommonCpp/DatabaseManagers/InMemoryQueryExecutor.h"
+
+#import <XCTest/XCTest.h>
+
+#import <algorithm>
+#import <sstream>
+#import <string>
+#import <vector>
+
+using namespace comm;
+
+@interface InMemoryQueryExecutorParityTest : XCTestCase
+
+@end
+
+@implementation InMemoryQueryExecutorParityTest
+
+const std::string PARITY_TEST_PREFIX = "parity_test_";
+const int PARITY_TEST_MESSAGES_COUNT = 30;
+const int PARITY_TEST_PAGE_SIZE = 7;
+
+std::string parityTestID(const std::string &kind, int index) {
+  return PARITY_TEST_PREFIX + kind + std::to_string(index);
+}
+
+std::string parityTestThreadID(int index) {
+  return parityTestID("thread", index);
+}
+
+std::string describeNullable(const std::unique_ptr<std::string> &value) {
+  return value ? "\"" + *value + "\"" : "null";
+}
+
+std::string describeMessages(
+    const std::vector<std::pair<Message, std::vector<Media>>> &messages) {
+  std::ostringstream description;
+  for (const auto &[message, media] : messages) {
+    description << message.id << " " << message.thread << " " << message.user
+                << " " << message.type << " "
+                << describeNullable(message.content) << " " << message.time;
+    std::vector<std::string> mediaIDs;
+    for (const Media &item : media) {
+      mediaIDs.push_back(item.id + "@" + item.container + ":" + item.uri);
+    }
+    std::sort(mediaIDs.begin(), mediaIDs.end());
+    for (const std::string &mediaID : mediaIDs) {
+      description << " " << mediaID;
+    }
+    description << "\n";
+  }
+  return description.str();
+}
+
+// Messages of reads whose order isn't specified
+std::string describeMessagesSorted(
+    std::vector<std::pair<Message, std::vector<Media>>> messages) {
+  std::sort(messages.begin(), messages.end(), [](const auto &a, const auto &b) {
+    return a.first.id < b.first.id;
+  });
+  return describeMessages(messages);
+}
+
+std::string describeThreads(std::vector<Thread> threads) {
+  std::sort(threads.begin(), threads.end(), [](const auto &a, const auto &b) {
+    return a.id < b.id;
+  });
+  std::ostringstream description;
+  for (const Thread &thread : threads) {
+    description << thread.id << " " << thread.type << " "
+                << describeNullable(thread.name) << " " << thread.color << " "
+                << thread.creation_time << " " << thread.members << " "
+                << thread.roles << " " << thread.current_user << " "
+                << thread.replies_count << "\n";
+  }
+  return description.str();
+}
+
+std::string describeMembers(std::vector<ThreadMember> members) {
+  std::sort(members.begin(), members.end(), [](const auto &a, const auto &b) {
+    return a.user_id < b.user_id;
+  });
+  std::ostringstream description;
+  for (const ThreadMember &member : members) {
+    description << member.thread_id << " " << member.user_id << " "
+                << describeNullable(member.role) << " " << member.is_sender
+                << "\n";
+  }
+  return description.str();
+}
+
+std::string describeCounts(const std::vector<int> &counts) {
+  std::ostringstream description;
+  for (int count : counts) {
+    description << count << " ";
+  }
+  return description.str();
+}
+
+std::string describeSummaries(const std::vector<ThreadSummary> &summaries) {
+  std::ostringstream description;
+  for (const ThreadSummary &summary : summaries) {
+    if (summary.thread_id.rfind(PARITY_TEST_PREFIX, 0) != 0) {
+      continue;
+    }
+    description << summary.thread_id << " " << summary.message_count << " "
+                << describeNullable(summary.last_message_id) << " "
+                << summary.last_message_time << " "
+                << summary.last_message_has_media << "\n";
+  }
+  return description.str();
+}
+
+Thread parityTestThread(int index, const std::string &members) {
+  return Thread{
+      parityTestThreadID(index),
+      3,
+      std::make_unique<std::string>("thread " + std::to_string(index)),
+      nullptr,
+      "ffffff",
+      100 + index,
+      nullptr,
+      nullptr,
+      nullptr,
+      members,
+      "{}",
+      "{}",
+      nullptr,
+      0};
+}
+
+// Every message of the first thread, newest first, a page at a time
+std::vector<std::string> readPages(const DatabaseQueryExecutor &executor) {
+  std::vector<std::string> pages;
+  int64_t beforeTime = INT64_MAX;
+  std::string beforeMessageID;
+  while (true) {
+    auto page = executor.getThreadMessagesBefore(
+        parityTestThreadID(0),
+        beforeTime,
+        beforeMessageID,
+        PARITY_TEST_PAGE_SIZE);
+    if (page.empty()) {
+      return pages;
+    }
+    pages.push_back(describeMessages(page));
+    beforeTime = page.back().first.time;
+    beforeMessageID = page.back().first.id;
+  }
+}
+
+std::vector<std::string> readAll(const DatabaseQueryExecutor &executor) {
+  std::vector<std::string> threadIDs{
+      parityTestThreadID(0), parityTestThreadID(1), parityTestThreadID(2)};
+  std::vector<std::string> messageIDs;
+  for (int index = 0; index < PARITY_TEST_MESSAGES_COUNT + 5; index++) {
+    messageIDs.push_back(parityTestID("message", index));
+  }
+  messageIDs.push_back(parityTestID("rekeyed", 0));
+
+  std::vector<std::string> results{
+      describeThreads(executor.getThreadsByIDs(threadIDs)),
+      describeMembers(executor.getThreadMembers(parityTestThreadID(0))),
+      describeCounts(executor.getThreadMemberCounts(threadIDs)),
+      describeMessagesSorted(executor.getMessagesByIDs(messageIDs)),
+      describeMessagesSorted(executor.getMessagesOfThreads(threadIDs)),
+      describeCounts(executor.getThreadMessageCounts(threadIDs)),
+      describeMessages(executor.getThreadMessagesInRange(
+          parityTestThreadID(0), 1003, 1010, 100)),
+      describeMessages(executor.getThreadMessagesInRange(
+          parityTestThreadID(0), 1003, 1010, 3)),
+      describeSummaries(executor.getThreadSummariesByRecency())};
+  for (const std::string &page : readPages(executor)) {
+    results.push_back(page);
+  }
+  return results;
+}
+
+// Writes the same rows to the executor and returns what every read gives,
+// after the writes and after they are changed. Everything is rolled back,
+// leaving the database of the app as it was.
+std::vector<std::string> runParityScript(const DatabaseQueryExecutor &executor) {
+  std::vector<std::string> results;
+  executor.beginTransaction();
+  try {
+    executor.replaceThreads(
+        {parityTestThread(
+             0,
+             "[{\"id\":\"user0\",\"role\":\"admin\",\"isSender\":true},"
+             "{\"id\":\"user1\",\"role\":null,\"isSender\":false}]"),
+         parityTestThread(1, "[{\"id\":\"user0\",\"isSender\":true}]"),
+         parityTestThread(2, "[]")});
+
+    std::vector<Message> messages;
+    std::vector<Media> media;
+    for (int index = 0; index < PARITY_TEST_MESSAGES_COUNT + 5; index++) {
+      // Pairs of messages share their time, so that pages are split by IDs
+      int thread = index < PARITY_TEST_MESSAGES_COUNT ? 0 : 1;
+      messages.push_back(Message{
+          parityTestID("message", index),
+          nullptr,
+          parityTestThreadID(thread),
+          "user" + std::to_string(index % 2),
+          0,
+          nullptr,
+          std::make_unique<std::string>("content " + std::to_string(index)),
+          1000 + index / 2});
+      if (index % 5 == 0) {
+        media.push_back(Media{
+            parityTestID("media", index),
+            parityTestID("message", index),
+            parityTestThreadID(thread),
+            "uri",
+            "photo",
+            "{}"});
+      }
+    }
+    executor.replaceMessages(messages);
+    executor.replaceMediaBatch(media);
+    for (std::string &result : readAll(executor)) {
+      results.push_back(std::move(result));
+    }
+
+    executor.replaceMessage(Message{
+        parityTestID("message", 1),
+        nullptr,
+        parityTestThreadID(0),
+        "user1",
+        0,
+        nullptr,
+        std::make_unique<std::string>("edited"),
+        1000});
+    executor.rekeyMessage(
+        parityTestID("message", 2), parityTestID("rekeyed", 0));
+    executor.rekeyMediaContainers(
+        parityTestID("message", 5), parityTestID("rekeyed", 0));
+    executor.removeMediaForMessage(parityTestID("message", 10));
+    executor.removeMessages(
+        {parityTestID("message", 3), parityTestID("message", 4)});
+    executor.removeMessagesForThreads({parityTestThreadID(1)});
+    executor.replaceThread(parityTestThread(
+        0, "[{\"id\":\"user1\",\"role\":\"member\",\"isSender\":true}]"));
+    executor.removeThreads({parityTestThreadID(2)});
+    for (std::string &result : readAll(executor)) {
+      results.push_back(std::move(result));
+    }
+  } catch (...) {
+    executor.rollbackTransaction();
+    throw;
+  }
+  executor.rollbackTransaction();
+  return results;
+}
+
+// The in-memory store is a baseline for the benchmarks, which only holds
+// as long as it serves the same rows as SQLite
+- (void)testInMemoryReadsMatchSQLite {
+  std::vector<std::string> sqliteResults;
+  std::vector<std::string> inMemoryResults;
+  try {
+    sqliteResults = runParityScript(DatabaseManager::getQueryExecutor());
+    inMemoryResults = runParityScript(InMemoryQueryExecutor());
+  } catch (const std::exception &e) {
+    XCTFail(@"Parity script failed: %s", e.what());
+    return;
+  }
+
+  XCTAssert(
+      sqliteResults.size() == inMemoryResults.size(),
+      @"SQLite gives %zu results, in-memory %zu",
+      sqliteResults.size(),
+      inMemoryResults.size());
+  for (size_t i = 0;
+       i < std::min(sqliteResults.size(), inMemoryResults.size());
+       i++) {
+    XCTAssert(
+        sqliteResults[i] == inMemoryResults[i],
+        @"Read %zu differs\nSQLite:\n%s\nIn-memory:\n%s",
+        i,
+        sqliteResults[i].c_str(),
+        inMemoryResults[i].c_str());
+  }
+}
+
+@end
@@ -19,6 +19,11 @@
   self.bestAttemptContent = [request.content mutableCopy];
   NSString *message = self.bestAttemptContent.userInfo[@"messageInfos"];
   if (message) {
+    // The database lives in the container of the app, out of reach of the
+    // extension. It was moved out of the app group because the system kills
+    // a suspended app that holds a lock on a shared file, so messages are
+    // handed off here and stored by the app in one transaction, see
+    // moveMessagesToDatabase in AppDelegate.
     TemporaryMessageStorage *temporaryStorage =
         [[TemporaryMessageStorage alloc] init];
     [temporaryStorage writeMessage:message];
@@ -16,6 +16,7 @@ import type {
 import type {
   ClientDBThreadInfo,
   ClientDBThreadStoreOperation,
+  ClientDBThreadSummary,
 } from 'lib/types/thread-types';
 
 type ClientDBStore = {
@@ -24,18 +25,240 @@ type ClientDBStore = {
   +threads: $ReadOnlyArray<ClientDBThreadInfo>,
 };
 
+type ClientDBStoreWithThreadSummaries = {
+  +messages: $ReadOnlyArray<ClientDBMessageInfo>,
+  +drafts: $ReadOnlyArray<ClientDBDraftInfo>,
+  +threads: $ReadOnlyArray<ClientDBThreadSummary>,
+};
+
+// Array-like views over rows kept in native memory. Every row is converted
+// lazily when it's accessed, so they only support length and index access.
+type ClientDBRowsView<T> = {
+  +length: number,
+  +[index: number]: T,
+};
+
+type ClientDBStoreView = {
+  +messages: ClientDBRowsView<ClientDBMessageInfo>,
+  +drafts: $ReadOnlyArray<ClientDBDraftInfo>,
+  +threads: ClientDBRowsView<ClientDBThreadInfo>,
+};
+
 type ClientPublicKeys = {
   +curve25519: string,
   +ed25519: string,
 };
 
+// The keys hold the same base64 bytes as the strings of ClientPublicKeys
+type ClientPublicKeyBuffers = {
+  +curve25519: ArrayBuffer,
+  +ed25519: ArrayBuffer,
+};
+
+// message is the olm message, base64 bytes as olm sends them
+type ClientEncryptedBuffer = {
+  +message: ArrayBuffer,
+  +messageType: number,
+};
+
+// histogram buckets are split at 0.1, 1, 5, 10, 50, 100 and 500 ms
+type ClientDBQueryProfile = {
+  +query: string,
+  +count: number,
+  +slowCount: number,
+  +totalDurationMs: number,
+  +maxDurationMs: number,
+  +rows: number,
+  +histogram: $ReadOnlyArray<number>,
+};
+
+// The stats of the threads of the same name are added up. overflowedTasks
+// counts tasks scheduled while the queue was at capacity. Wait times run from
+// scheduling a task to its start, run times from its start to its end.
+type ClientWorkerThreadStats = {
+  +name: string,
+  +threads: number,
+  +queueDepth: number,
+  +maxQueueDepth: number,
+  +scheduledTasks: number,
+  +overflowedTasks: number,
+  +rejectedTasks: number,
+  +completedTasks: number,
+  +totalWaitMs: number,
+  +maxWaitMs: number,
+  +totalRunMs: number,
+  +maxRunMs: number,
+};
+
+// durationMs includes migrationsDurationMs, which only covers setting up or
+// migrating the schema. encryptionDurationMs and encryptedRows are 0 unless
+// a plaintext database was encrypted during the startup.
+type ClientDBStartupMetrics = {
+  +durationMs: number,
+  +migrationsDurationMs: number,
+  +databaseVersion: number,
+  +appliedMigrations: number,
+  +upToDate: boolean,
+  +encryptionDurationMs: number,
+  +encryptedRows: number,
+};
+
+// A phase of the launch, timed on the monotonic clock from when the native
+// code was loaded. Each phase is returned once, with its first run.
+type ClientStartupPhase = {
+  +name: string,
+  +startMs: number,
+  +durationMs: number,
+};
+
+// Allocations attributed to a subsystem since the native code was loaded,
+// all zero unless the app was built with COMM_ALLOCATION_TRACKING
+type ClientAllocationStats = {
+  +tag: string,
+  +count: number,
+  +bytes: number,
+};
+
+// Sizes in bytes. The connection fields are of the writer connection.
+type ClientDBMemoryStats = {
+  +memoryUsed: number,
+  +memoryHighwater: number,
+  +largestAllocation: number,
+  +pageCacheOverflow: number,
+  +connectionCacheUsed: number,
+  +connectionSchemaUsed: number,
+  +connectionStatementsUsed: number,
+  +cachedStatements: number,
+  +messageCacheSize: number,
+};
+
+// A member of a thread, as mirrored from the members of ClientDBThreadInfo
+type ClientDBThreadMember = {
+  +threadID: string,
+  +userID: string,
+  +role: ?string,
+  +isSender: boolean,
+};
+
+type ClientDBThreadSummary = {
+  +threadID: string,
+  +messageCount: number,
+  +lastMessageID: string,
+  +lastMessageTime: string,
+  +lastMessageHasMedia: boolean,
+};
+
+// Changes written natively, e.g. by notification handlers, since the last
+// call. The rows are the current ones. If reloadRequired is set, more changed
+// than could be tracked and the stores have to be read again.
+type ClientDBChanges = {
+  +reloadRequired: boolean,
+  +messages: $ReadOnlyArray<ClientDBMessageInfo>,
+  +removedMessageIDs: $ReadOnlyArray<string>,
+  +threads: $ReadOnlyArray<ClientDBThreadInfo>,
+  +removedThreadIDs: $ReadOnlyArray<string>,
+};
+
+// A message waiting in the outbox until the server acknowledges it. The
+// payload is encrypted for targetUserID, if set, before it is sent, and
+// encryptionType is then the olm message type.
+type ClientDBOutboxEntry = {
+  +localID: string,
+  +threadID: string,
+  +targetUserID?: ?string,
+  +payload: string,
+  +encryptionType?: ?number,
+  +createdAt: string,
+};
+
+// Entries to send in one request. The failed ones couldn't be encrypted,
+// e.g. as there is no session with the peer yet, and stay queued.
+type ClientDBOutboxBatch = {
+  +entries: $ReadOnlyArray<ClientDBOutboxEntry>,
+  +failedLocalIDs: $ReadOnlyArray<string>,
+};
+
+type ClientDBOutboxAcknowledgement = {
+  +localID: string,
+  +serverID: string,
+};
+
 export interface Spec extends TurboModule {
   +getDraft: (key: string) => Promise<string>;
   +updateDraft: (key: string, text: string) => Promise<boolean>;
   +moveDraft: (oldKey: string, newKey: string) => Promise<boolean>;
-  +getClientDBStore: () => Promise<ClientDBStore>;
+  // protocolVersion is one of clientDBProtocolVersions. With typed, the
+  // numeric fields of messages and threads are numbers instead of strings.
+  // Passing requestID lets the read be stopped with cancelDBRequest.
+  +getClientDBStore: (
+    protocolVersion?: ?number,
+    requestID?: ?number,
+  ) => Promise<ClientDBStore>;
+  +getClientDBStoreWithThreadSummaries: () => Promise<
+    ClientDBStoreWithThreadSummaries,
+  >;
+  +getClientDBStoreView: () => Promise<ClientDBStoreView>;
+  +streamClientDBStore: (
+    onChunk: (chunk: ClientDBStore) => void,
+    chunkSize: number,
+  ) => Promise<void>;
   +removeAllDrafts: () => Promise<void>;
   +getAllMessagesSync: () => $ReadOnlyArray<ClientDBMessageInfo>;
+  +streamAllMessages: (
+    onChunk: (messages: $ReadOnlyArray<ClientDBMessageInfo>) => void,
+    chunkSize: number,
+  ) => Promise<void>;
+  +getThreadMessagesBefore: (
+    threadID: string,
+    beforeTime: number,
+    beforeMessageID: string,
+    pageSize: number,
+    protocolVersion?: ?number,
+    requestID?: ?number,
+  ) => Promise<$ReadOnlyArray<ClientDBMessageInfo>>;
+  +searchMessages: (
+    query: string,
+    threadID: ?string,
+    pageSize: number,
+    offset: number,
+    protocolVersion?: ?number,
+    requestID?: ?number,
+  ) => Promise<$ReadOnlyArray<ClientDBMessageInfo>>;
+  // Rejects the pending reads passed requestID with TASK_CANCELLED
+  +cancelDBRequest: (requestID: number) => void;
+  // Tells which thread the message list is scrolled through, null once none
+  // is shown, so that the next pages of getThreadMessagesBefore are read
+  // ahead
+  +reportMessageListScroll: (
+    threadID: ?string,
+    towardsOlder: boolean,
+  ) => void;
+  // Reads of single messages and windows of a thread, so that JS doesn't
+  // need to hold the whole store. The rows stay native until accessed.
+  +getThreadMessagesInRange: (
+    threadID: string,
+    fromTime: number,
+    toTime: number,
+    limit: number,
+  ) => Promise<ClientDBRowsView<ClientDBMessageInfo>>;
+  +getMessagesByIDs: (
+    ids: $ReadOnlyArray<string>,
+  ) => Promise<ClientDBRowsView<ClientDBMessageInfo>>;
+  +getThreadMessageCounts: (
+    threadIDs: $ReadOnlyArray<string>,
+  ) => Promise<$ReadOnlyArray<number>>;
+  +archiveMessages: (olderThan: number) => Promise<number>;
+  +vacuumDatabase: () => Promise<void>;
+  +addToOutbox: (
+    entries: $ReadOnlyArray<ClientDBOutboxEntry>,
+  ) => Promise<void>;
+  // Takes the oldest entries that aren't in flight. They stay in flight
+  // until they are acknowledged, or requeued once their send fails.
+  +dispatchOutbox: () => Promise<ClientDBOutboxBatch>;
+  +requeueOutbox: (localIDs: $ReadOnlyArray<string>) => Promise<void>;
+  +acknowledgeOutbox: (
+    acknowledgements: $ReadOnlyArray<ClientDBOutboxAcknowledgement>,
+  ) => Promise<void>;
   +processDraftStoreOperations: (
     operations: $ReadOnlyArray<ClientDBDraftStoreOperation>,
   ) => Promise<void>;
@@ -45,17 +268,63 @@ export interface Spec extends TurboModule {
   +processMessageStoreOperationsSync: (
     operations: $ReadOnlyArray<ClientDBMessageStoreOperation>,
   ) => void;
+  // Takes JSON.stringify of $ReadOnlyArray<ClientDBMessageStoreOperation>
+  // and decodes it on the database thread
+  +processSerializedMessageStoreOperations: (
+    operations: string,
+  ) => Promise<void>;
   +getAllThreadsSync: () => $ReadOnlyArray<ClientDBThreadInfo>;
+  +getThreadsByIDs: (
+    ids: $ReadOnlyArray<string>,
+  ) => Promise<$ReadOnlyArray<ClientDBThreadInfo>>;
+  +getThreadMembers: (
+    threadID: string,
+  ) => Promise<$ReadOnlyArray<ClientDBThreadMember>>;
+  +getThreadIDsForMember: (userID: string) => Promise<$ReadOnlyArray<string>>;
+  +getThreadMemberCounts: (
+    threadIDs: $ReadOnlyArray<string>,
+  ) => Promise<$ReadOnlyArray<number>>;
+  // Threads with the latest message first, threads without messages left out
+  +getThreadSummariesByRecency: () => Promise<
+    $ReadOnlyArray<ClientDBThreadSummary>,
+  >;
   +processThreadStoreOperations: (
     operations: $ReadOnlyArray<ClientDBThreadStoreOperation>,
   ) => Promise<void>;
   +processThreadStoreOperationsSync: (
     operations: $ReadOnlyArray<ClientDBThreadStoreOperation>,
   ) => void;
+  // Takes JSON.stringify of $ReadOnlyArray<ClientDBThreadStoreOperation>
+  // and decodes it on the database thread
+  +processSerializedThreadStoreOperations: (
+    operations: string,
+  ) => Promise<void>;
   +initializeCryptoAccount: (userId: string) => Promise<string>;
   +getUserPublicKey: () => Promise<ClientPublicKeys>;
   +getUserOneTimeKeys: () => Promise<string>;
+  +getUserPublicKeyBuffers: () => Promise<ClientPublicKeyBuffers>;
+  +getUserOneTimeKeyBuffers: () => Promise<$ReadOnlyArray<ArrayBuffer>>;
+  // Codegen doesn't know ArrayBuffer, the Object arguments are ArrayBuffers.
+  // theirIdentityKeys holds the JSON of the peer's identity keys, as its
+  // account gives them out before getUserPublicKey takes them apart.
+  +encryptBuffer: (
+    userID: string,
+    content: Object,
+  ) => Promise<ClientEncryptedBuffer>;
+  +decryptBuffer: (
+    userID: string,
+    message: Object,
+    messageType: number,
+    theirIdentityKeys: Object,
+  ) => Promise<ArrayBuffer>;
   +getCodeVersion: () => number;
+  +getDatabaseQueryProfile: () => $ReadOnlyArray<ClientDBQueryProfile>;
+  +getWorkerThreadsStats: () => $ReadOnlyArray<ClientWorkerThreadStats>;
+  +getDatabaseStartupMetrics: () => Promise<ClientDBStartupMetrics>;
+  +getStartupTimeline: () => $ReadOnlyArray<ClientStartupPhase>;
+  +getAllocationSnapshot: () => $ReadOnlyArray<ClientAllocationStats>;
+  +getDatabaseChanges: () => Promise<ClientDBChanges>;
+  +getDatabaseMemoryStats: () => Promise<ClientDBMemoryStats>;
   +setNotifyToken: (token: string) => Promise<void>;
   +clearNotifyToken: () => Promise<void>;
   +setCurrentUserID: (userID: string) => Promise<void>;
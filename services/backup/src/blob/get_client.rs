@@ -38,7 +38,13 @@ impl GetClient {
     let (blob_res_tx, blob_res_rx) =
       mpsc::channel(MPSC_CHANNEL_BUFFER_CAPACITY);
     let client_thread = async move {
-      let response = blob_client.get(proto::GetRequest { holder }).await?;
+      let response = blob_client
+        .get(proto::GetRequest {
+          holder,
+          offset: 0,
+          length: 0,
+        })
+        .await?;
       let mut inner_response = response.into_inner();
       loop {
         match inner_response.message().await? {
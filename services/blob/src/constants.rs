@@ -46,3 +46,10 @@ pub const LOG_LEVEL_ENV_VAR: &str =
 
 pub const BLOB_S3_BUCKET_NAME: &str = "commapp-blob";
 pub const S3_MULTIPART_UPLOAD_MINIMUM_CHUNK_SIZE: u64 = 5 * 1024 * 1024;
+pub const S3_MULTIPART_UPLOAD_MAXIMUM_PARTS: u32 = 10000;
+
+// Multipart Put constants
+
+/// The service holds every part in memory until its stream is over, so that
+/// it is uploaded as a single S3 part
+pub const MULTIPART_PUT_MAXIMUM_PART_SIZE: u64 = 64 * 1024 * 1024;
@@ -1,6 +1,6 @@
 use anyhow::{anyhow, Result};
 use aws_sdk_s3::{
-  model::{CompletedMultipartUpload, CompletedPart},
+  model::{CompletedMultipartUpload, CompletedPart, Part},
   output::CreateMultipartUploadOutput,
   types::ByteStream,
 };
@@ -66,6 +66,22 @@ impl S3Client {
     MultiPartUploadSession::start(&self.client, s3_path).await
   }
 
+  /// Takes over an upload session that has been started before, e.g. by
+  /// another request, without any of its parts
+  pub fn resume_upload_session(
+    &self,
+    s3_path: &S3Path,
+    upload_id: &str,
+  ) -> MultiPartUploadSession {
+    MultiPartUploadSession {
+      client: self.client.clone(),
+      bucket_name: String::from(&s3_path.bucket_name),
+      object_name: String::from(&s3_path.object_name),
+      upload_id: String::from(upload_id),
+      upload_parts: Vec::new(),
+    }
+  }
+
   /// Returns object metadata (e.g. file size) without downloading the object itself
   pub async fn get_object_metadata(
     &self,
@@ -168,10 +184,27 @@ impl MultiPartUploadSession {
     })
   }
 
+  pub fn upload_id(&self) -> &str {
+    &self.upload_id
+  }
+
   /// adds data part to the multipart upload
   pub async fn add_part(&mut self, part: Vec<u8>) -> Result<()> {
-    let stream = ByteStream::from(part);
     let part_number: i32 = self.upload_parts.len() as i32 + 1;
+    let e_tag = self.upload_part(part_number, part).await?;
+    self.add_uploaded_part(part_number, e_tag);
+    Ok(())
+  }
+
+  /// Uploads a part with the given number, without adding it to the parts
+  /// that this session finishes the upload with
+  /// - returns the ETag of the part
+  pub async fn upload_part(
+    &self,
+    part_number: i32,
+    part: Vec<u8>,
+  ) -> Result<String> {
+    let stream = ByteStream::from(part);
     let upload_result = self
       .client
       .upload_part()
@@ -183,12 +216,42 @@ impl MultiPartUploadSession {
       .send()
       .await?;
 
+    Ok(upload_result.e_tag.unwrap_or_default())
+  }
+
+  /// Adds a part that has been uploaded, e.g. by another session, to the
+  /// parts that the upload is finished with
+  pub fn add_uploaded_part(&mut self, part_number: i32, e_tag: String) {
     let completed_part = CompletedPart::builder()
-      .e_tag(upload_result.e_tag.unwrap_or_default())
+      .e_tag(e_tag)
       .part_number(part_number)
       .build();
     self.upload_parts.push(completed_part);
-    Ok(())
+  }
+
+  /// Lists all the parts that have been uploaded so far, in the order of
+  /// their numbers
+  pub async fn list_parts(&self) -> Result<Vec<Part>> {
+    let mut parts = Vec::new();
+    let mut marker: Option<String> = None;
+    loop {
+      let response = self
+        .client
+        .list_parts()
+        .bucket(&self.bucket_name)
+        .key(&self.object_name)
+        .upload_id(&self.upload_id)
+        .set_part_number_marker(marker)
+        .send()
+        .await?;
+      parts.extend_from_slice(response.parts().unwrap_or_default());
+      marker = match response.next_part_number_marker() {
+        Some(next_marker) if response.is_truncated() => {
+          Some(next_marker.to_string())
+        }
+        _ => return Ok(parts),
+      };
+    }
   }
 
   /// finishes the upload
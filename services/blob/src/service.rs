@@ -11,7 +11,8 @@ use tracing::{debug, error, info, instrument, trace, warn, Instrument};
 use crate::{
   constants::{
     BLOB_S3_BUCKET_NAME, GRPC_CHUNK_SIZE_LIMIT, GRPC_METADATA_SIZE_PER_MESSAGE,
-    MPSC_CHANNEL_BUFFER_CAPACITY, S3_MULTIPART_UPLOAD_MINIMUM_CHUNK_SIZE,
+    MPSC_CHANNEL_BUFFER_CAPACITY, MULTIPART_PUT_MAXIMUM_PART_SIZE,
+    S3_MULTIPART_UPLOAD_MAXIMUM_PARTS, S3_MULTIPART_UPLOAD_MINIMUM_CHUNK_SIZE,
   },
   database::{BlobItem, DatabaseClient, Error as DBError, ReverseIndexItem},
   s3::{MultiPartUploadSession, S3Client, S3Path},
@@ -97,6 +98,9 @@ impl BlobService for MyBlobService {
           Ok(blob::PutRequest {
             data: Some(blob::put_request::Data::DataChunk(new_data)),
           }) => put_handler.handle_data_chunk(new_data).await,
+          Ok(blob::PutRequest {
+            data: Some(blob::put_request::Data::Part(part)),
+          }) => put_handler.handle_part(part),
           unexpected => {
             error!("Received an unexpected Result: {:?}", unexpected);
             Err(Status::unknown("unknown error"))
@@ -124,6 +128,131 @@ impl BlobService for MyBlobService {
     Ok(Response::new(Box::pin(out_stream) as Self::PutStream))
   }
 
+  #[instrument(skip_all, fields(holder = %request.get_ref().holder))]
+  async fn start_multipart_put(
+    &self,
+    request: Request<blob::StartMultipartPutRequest>,
+  ) -> Result<Response<blob::StartMultipartPutResponse>, Status> {
+    info!("Start multipart put request: {:?}", request);
+    let message = request.into_inner();
+    if message.holder.is_empty() || message.blob_hash.is_empty() {
+      return Err(Status::invalid_argument(
+        "Holder and hash should be provided",
+      ));
+    }
+
+    match self.db.find_blob_item(&message.blob_hash).await {
+      Ok(Some(_)) => {
+        debug!("Blob found, assigning holder");
+        assign_holder_to_blob(&self.db, message.holder, message.blob_hash)
+          .await?;
+        return Ok(Response::new(blob::StartMultipartPutResponse {
+          data_exists: true,
+          upload_id: String::new(),
+        }));
+      }
+      Ok(None) => (),
+      Err(err) => return Err(handle_db_error(err)),
+    }
+
+    debug!("Blob not found, starting multipart upload");
+    let session = self
+      .s3
+      .start_upload_session(&blob_s3_path(&message.blob_hash))
+      .await
+      .map_err(|err| {
+        error!("Failed to create upload session: {:?}", err);
+        Status::aborted("Internal error")
+      })?;
+    Ok(Response::new(blob::StartMultipartPutResponse {
+      data_exists: false,
+      upload_id: session.upload_id().to_string(),
+    }))
+  }
+
+  #[instrument(skip_all, fields(holder = %request.get_ref().holder))]
+  async fn complete_multipart_put(
+    &self,
+    request: Request<blob::CompleteMultipartPutRequest>,
+  ) -> Result<Response<()>, Status> {
+    info!(
+      "Complete multipart put request with {} parts",
+      request.get_ref().parts.len()
+    );
+    let message = request.into_inner();
+    if message.holder.is_empty()
+      || message.blob_hash.is_empty()
+      || message.upload_id.is_empty()
+    {
+      return Err(Status::invalid_argument(
+        "Holder, hash and upload ID should be provided",
+      ));
+    }
+    let mut manifest = message.parts;
+    manifest.sort_by_key(|part| part.part_number);
+
+    let s3_path = blob_s3_path(&message.blob_hash);
+    let mut session =
+      self.s3.resume_upload_session(&s3_path, &message.upload_id);
+    let uploaded_parts = session.list_parts().await.map_err(|err| {
+      error!("Failed to list uploaded parts: {:?}", err);
+      Status::aborted("Internal error")
+    })?;
+
+    // The manifest guards against the parts that are missing, e.g. because
+    // their streams failed, or that have been uploaded twice with other data
+    if manifest.is_empty() || manifest.len() != uploaded_parts.len() {
+      warn!(
+        "{} parts uploaded, {} in the manifest",
+        uploaded_parts.len(),
+        manifest.len()
+      );
+      return Err(Status::failed_precondition(
+        "Uploaded parts don't match the manifest",
+      ));
+    }
+    for (listed, uploaded) in manifest.iter().zip(uploaded_parts) {
+      if listed.part_number as i32 != uploaded.part_number()
+        || listed.size as i64 != uploaded.size()
+      {
+        warn!(
+          "Part {} of {} bytes uploaded, part {} of {} bytes in the manifest",
+          uploaded.part_number(),
+          uploaded.size(),
+          listed.part_number,
+          listed.size
+        );
+        return Err(Status::failed_precondition(
+          "Uploaded parts don't match the manifest",
+        ));
+      }
+      session.add_uploaded_part(
+        uploaded.part_number(),
+        uploaded.e_tag().unwrap_or_default().to_string(),
+      );
+    }
+
+    session.finish_upload().await.map_err(|err| {
+      error!("Failed to finish upload session: {:?}", err);
+      Status::aborted("Internal error")
+    })?;
+
+    self
+      .db
+      .put_blob_item(BlobItem {
+        blob_hash: message.blob_hash.clone(),
+        s3_path,
+        created: Utc::now(),
+      })
+      .await
+      .map_err(handle_db_error)?;
+
+    assign_holder_to_blob(&self.db, message.holder, message.blob_hash).await?;
+
+    debug!("Multipart upload finished successfully");
+    Ok(Response::new(()))
+  }
+
   type GetStream =
     Pin<Box<dyn Stream<Item = Result<blob::GetResponse, Status>> + Send>>;
 
@@ -148,6 +277,14 @@ impl BlobService for MyBlobService {
         error!("Failed to get S3 object content length: {:?}", err);
         Status::aborted("server error")
       })?;
+    let start = message.offset;
+    if start > file_size {
+      return Err(Status::invalid_argument("offset out of range"));
+    }
+    let end = match message.length {
+      0 => file_size,
+      length => std::cmp::min(file_size, start.saturating_add(length)),
+    };
     let chunk_size: u64 =
       GRPC_CHUNK_SIZE_LIMIT - GRPC_METADATA_SIZE_PER_MESSAGE;
 
@@ -155,9 +292,9 @@ impl BlobService for MyBlobService {
     let s3 = self.s3.clone();
 
     let worker = async move {
-      let mut offset: u64 = 0;
-      while offset < file_size {
-        let next_size = std::cmp::min(chunk_size, file_size - offset);
+      let mut offset: u64 = start;
+      while offset < end {
+        let next_size = std::cmp::min(chunk_size, end - offset);
         let range = offset..(offset + next_size);
         trace!(?range, "Getting {} bytes of data", next_size);
 
@@ -248,6 +385,15 @@ type PutResult = Result<blob::PutResponse, Status>;
 enum PutAction {
   AssignHolder,
   UploadNewBlob(BlobItem),
+  UploadPart(PartUpload),
+}
+
+/// A part of a multipart put, which is uploaded as a single S3 part once
+/// the stream is over
+struct PartUpload {
+  s3_path: S3Path,
+  upload_id: String,
+  part_number: i32,
 }
 
 /// A helper for handling Put RPC requests
@@ -331,10 +477,7 @@ impl PutHandler {
         debug!("Blob not found, starting upload action");
         self.action = Some(PutAction::UploadNewBlob(BlobItem {
           blob_hash: blob_hash.to_string(),
-          s3_path: S3Path {
-            bucket_name: BLOB_S3_BUCKET_NAME.to_string(),
-            object_name: blob_hash.to_string(),
-          },
+          s3_path: blob_s3_path(blob_hash),
           created: Utc::now(),
         }));
         Ok(blob::PutResponse { data_exists: false })
@@ -346,12 +489,51 @@ impl PutHandler {
     }
   }
 
+  pub fn handle_part(&mut self, part: blob::PutPart) -> PutResult {
+    if self.action.is_some()
+      || self.holder.is_some()
+      || self.blob_hash.is_some()
+    {
+      self.should_close_stream = true;
+      warn!("Part sent after the stream has started");
+      return Err(Status::invalid_argument(
+        "Part should be sent instead of holder and hash",
+      ));
+    }
+    if part.upload_id.is_empty()
+      || part.blob_hash.is_empty()
+      || part.part_number < 1
+      || part.part_number > S3_MULTIPART_UPLOAD_MAXIMUM_PARTS
+    {
+      self.should_close_stream = true;
+      warn!("Invalid part: {:?}", part);
+      return Err(Status::invalid_argument("Invalid part"));
+    }
+    tracing::Span::current().record("blob_hash", &part.blob_hash);
+    self.action = Some(PutAction::UploadPart(PartUpload {
+      s3_path: blob_s3_path(&part.blob_hash),
+      upload_id: part.upload_id,
+      part_number: part.part_number as i32,
+    }));
+    Ok(blob::PutResponse { data_exists: false })
+  }
+
   pub async fn handle_data_chunk(
     &mut self,
     mut new_data: Vec<u8>,
   ) -> PutResult {
     let blob_item = match &self.action {
       Some(PutAction::UploadNewBlob(blob_item)) => blob_item,
+      Some(PutAction::UploadPart(_)) => {
+        trace!("Received {} bytes of part data", new_data.len());
+        self.current_chunk.append(&mut new_data);
+        if self.current_chunk.len() as u64 > MULTIPART_PUT_MAXIMUM_PART_SIZE {
+          self.should_close_stream = true;
+          warn!("Part exceeds the maximum size");
+          return Err(Status::invalid_argument("Part is too large"));
+        }
+        return Ok(blob::PutResponse { data_exists: false });
+      }
       _ => {
         self.should_close_stream = true;
         error!("Data chunk sent before upload action is started");
@@ -397,6 +579,9 @@ impl PutHandler {
   /// This consumes `self` so this put handler instance cannot be used
   /// after this is called.
   pub async fn finish(self) -> Result<(), Status> {
+    if let Some(PutAction::UploadPart(part)) = self.action {
+      return upload_part(&self.s3, part, self.current_chunk).await;
+    }
     if self.action.is_none() {
       debug!("No action to perform, finishing now");
       return Ok(());
@@ -415,6 +600,7 @@ impl PutHandler {
         return assign_holder_to_blob(&self.db, holder, blob_hash).await;
       }
       Some(PutAction::UploadNewBlob(blob_item)) => blob_item,
+      Some(PutAction::UploadPart(_)) => return Ok(()),
     };
 
     let mut uploader = self.uploader.ok_or_else(|| {
@@ -448,6 +634,31 @@ impl PutHandler {
   }
 }
 
+async fn upload_part(
+  s3: &S3Client,
+  part: PartUpload,
+  data: Vec<u8>,
+) -> Result<(), Status> {
+  if data.is_empty() {
+    warn!("Part {} has no data", part.part_number);
+    return Err(Status::invalid_argument("Part has no data"));
+  }
+  let session = s3.resume_upload_session(&part.s3_path, &part.upload_id);
+  if let Err(err) = session.upload_part(part.part_number, data).await {
+    error!("Failed to upload part {}: {:?}", part.part_number, err);
+    return Err(Status::aborted("Internal error"));
+  }
+  debug!("Part {} uploaded successfully", part.part_number);
+  Ok(())
+}
+
+fn blob_s3_path(blob_hash: &str) -> S3Path {
+  S3Path {
+    bucket_name: BLOB_S3_BUCKET_NAME.to_string(),
+    object_name: blob_hash.to_string(),
+  }
+}
+
 async fn assign_holder_to_blob(
   db: &DatabaseClient,
   holder: String,
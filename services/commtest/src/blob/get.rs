@@ -12,6 +12,8 @@ pub async fn run(
   let response = client
     .get(Request::new(GetRequest {
       holder: cloned_holder,
+      offset: 0,
+      length: 0,
     }))
     .await?;
   let mut inbound = response.into_inner();
@@ -1,4 +1,5 @@
 pub mod blob_utils;
 pub mod get;
+pub mod multipart_put;
 pub mod put;
 pub mod remove;
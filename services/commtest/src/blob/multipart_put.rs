@@ -0,0 +1,92 @@
+use crate::blob::blob_utils::{
+  proto::put_request::Data::*, proto::CompleteMultipartPutRequest,
+  proto::PartManifest, proto::PutPart, proto::PutRequest,
+  proto::StartMultipartPutRequest, BlobData, BlobServiceClient,
+};
+use crate::constants;
+use crate::tools::{generate_stable_nbytes, Error};
+use tonic::Request;
+
+/// Puts the blob in parts of `chunks_sizes` which are uploaded over
+/// concurrent streams
+pub async fn run(
+  client: &mut BlobServiceClient<tonic::transport::Channel>,
+  blob_data: &BlobData,
+) -> Result<bool, Error> {
+  println!("[{}] multipart put", blob_data.holder);
+
+  let start_response = client
+    .start_multipart_put(Request::new(StartMultipartPutRequest {
+      holder: blob_data.holder.clone(),
+      blob_hash: blob_data.hash.clone(),
+    }))
+    .await?
+    .into_inner();
+  if start_response.data_exists {
+    return Ok(true);
+  }
+
+  let mut handles = Vec::new();
+  for (index, part_size) in blob_data.chunks_sizes.iter().enumerate() {
+    let mut part_client = client.clone();
+    let part = PutPart {
+      upload_id: start_response.upload_id.clone(),
+      blob_hash: blob_data.hash.clone(),
+      part_number: index as u32 + 1,
+    };
+    let part_size = *part_size;
+    handles.push(tokio::spawn(async move {
+      put_part(&mut part_client, part, part_size).await
+    }));
+  }
+  for handle in handles {
+    handle.await.expect("part upload panicked")?;
+  }
+
+  println!("[{}] - sending manifest", blob_data.holder);
+  let parts = blob_data
+    .chunks_sizes
+    .iter()
+    .enumerate()
+    .map(|(index, part_size)| PartManifest {
+      part_number: index as u32 + 1,
+      size: *part_size as u64,
+    })
+    .collect();
+  client
+    .complete_multipart_put(Request::new(CompleteMultipartPutRequest {
+      holder: blob_data.holder.clone(),
+      blob_hash: blob_data.hash.clone(),
+      upload_id: start_response.upload_id,
+      parts,
+    }))
+    .await?;
+  Ok(false)
+}
+
+async fn put_part(
+  client: &mut BlobServiceClient<tonic::transport::Channel>,
+  part: PutPart,
+  part_size: usize,
+) -> Result<(), Error> {
+  println!("[{}] - sending part {}", part.blob_hash, part.part_number);
+  let outbound = async_stream::stream! {
+    yield PutRequest {
+      data: Some(Part(part)),
+    };
+    let mut remaining = part_size;
+    while remaining > 0 {
+      let chunk_size =
+        std::cmp::min(remaining, *constants::GRPC_CHUNK_SIZE_LIMIT);
+      yield PutRequest {
+        data: Some(DataChunk(generate_stable_nbytes(chunk_size, None))),
+      };
+      remaining -= chunk_size;
+    }
+  };
+
+  let response = client.put(Request::new(outbound)).await?;
+  let mut inbound = response.into_inner();
+  while let Some(_) = inbound.message().await? {}
+  Ok(())
+}
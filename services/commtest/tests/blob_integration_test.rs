@@ -1,7 +1,7 @@
 use bytesize::ByteSize;
 use commtest::blob::{
   blob_utils::{BlobData, BlobServiceClient},
-  get, put, remove,
+  get, multipart_put, put, remove,
 };
 use commtest::constants;
 use commtest::tools::Error;
@@ -43,11 +43,26 @@ async fn blob_integration_test() -> Result<(), Error> {
       ],
     },
   ];
+  // The sizes of its parts, all but the last have to be at least 5MB
+  let multipart_blob_data = BlobData {
+    holder: "test_holder004".to_string(),
+    hash: "test_hash004".to_string(),
+    chunks_sizes: vec![
+      ByteSize::mib(5).as_u64() as usize,
+      ByteSize::mib(6).as_u64() as usize,
+      ByteSize::b(100).as_u64() as usize,
+    ],
+  };
 
   for item in &blob_data {
     let data_exists: bool = put::run(&mut client, &item).await?;
     assert!(!data_exists, "test data should not exist");
   }
+  let data_exists: bool =
+    multipart_put::run(&mut client, &multipart_blob_data).await?;
+  assert!(!data_exists, "test data should not exist");
+  let blob_data: Vec<BlobData> =
+    blob_data.into_iter().chain([multipart_blob_data]).collect();
 
   for (i, blob_item) in blob_data.iter().enumerate() {
     let received_sizes = get::run(&mut client, &blob_item).await?;
@@ -0,0 +1,286 @@
+#include "BenchmarkReactors.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace comm {
+namespace network {
+namespace benchmark {
+
+uint64_t getMonotonicTimeUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void encodePayload(std::string &payload, size_t size) {
+  const uint64_t now = getMonotonicTimeUs();
+  payload.resize(std::max(size, sizeof(now)), 'x');
+  std::memcpy(&payload[0], &now, sizeof(now));
+}
+
+bool decodePayload(const std::string &payload, uint64_t &createdAtUs) {
+  if (payload.size() < sizeof(createdAtUs)) {
+    return false;
+  }
+  std::memcpy(&createdAtUs, payload.data(), sizeof(createdAtUs));
+  return true;
+}
+
+namespace {
+
+void recordLatency(BenchmarkStats &stats, uint64_t createdAtUs) {
+  const uint64_t now = getMonotonicTimeUs();
+  stats.latency.record(now > createdAtUs ? now - createdAtUs : 0);
+  stats.delivered++;
+}
+
+} // namespace
+
+PutReactor::PutReactor(
+    BenchmarkStats &stats,
+    const ServerReactorOptions &options)
+    : ServerBidiReactorBase(options.pipelineWindow, options.useArena),
+      stats(stats) {
+}
+
+std::unique_ptr<reactor::ServerBidiReactorStatus> PutReactor::handleRequest(
+    blob::PutRequest &request,
+    blob::PutResponse *response) {
+  if (!request.has_datachunk()) {
+    this->stats.invalidPayloads++;
+  }
+  response->set_dataexists(false);
+  return nullptr;
+}
+
+GetReactor::GetReactor(
+    const blob::GetRequest *request,
+    const ServerReactorOptions &options)
+    : ServerWriteReactorBase(
+          request,
+          options.writeQueueSize,
+          options.useArena) {
+}
+
+std::unique_ptr<grpc::Status>
+GetReactor::writeResponse(blob::GetResponse *response) {
+  if (this->written == this->request.length()) {
+    return std::make_unique<grpc::Status>(grpc::Status::OK);
+  }
+  this->written++;
+  encodePayload(*response->mutable_datachunk(), this->request.offset());
+  return nullptr;
+}
+
+SendLogReactor::SendLogReactor(
+    backup::SendLogResponse *response,
+    BenchmarkStats &stats,
+    const ServerReactorOptions &options)
+    : ServerReadReactorBase(response, options.useArena), stats(stats) {
+}
+
+std::unique_ptr<grpc::Status>
+SendLogReactor::readRequest(backup::SendLogRequest &request) {
+  uint64_t createdAtUs;
+  if (!request.has_logdata() ||
+      !decodePayload(request.logdata(), createdAtUs)) {
+    this->stats.invalidPayloads++;
+    return nullptr;
+  }
+  recordLatency(this->stats, createdAtUs);
+  return nullptr;
+}
+
+BlobBenchmarkService::BlobBenchmarkService(
+    const ServerReactorOptions &options)
+    : options(options) {
+}
+
+grpc::ServerBidiReactor<blob::PutRequest, blob::PutResponse> *
+BlobBenchmarkService::Put(grpc::CallbackServerContext *context) {
+  return new PutReactor(*this->stats.load(), this->options);
+}
+
+grpc::ServerWriteReactor<blob::GetResponse> *BlobBenchmarkService::Get(
+    grpc::CallbackServerContext *context,
+    const blob::GetRequest *request) {
+  GetReactor *reactor = new GetReactor(request, this->options);
+  reactor->start();
+  return reactor;
+}
+
+BackupBenchmarkService::BackupBenchmarkService(
+    const ServerReactorOptions &options)
+    : options(options) {
+}
+
+grpc::ServerReadReactor<backup::SendLogRequest> *
+BackupBenchmarkService::SendLog(
+    grpc::CallbackServerContext *context,
+    backup::SendLogResponse *response) {
+  return new SendLogReactor(response, *this->stats.load(), this->options);
+}
+
+void SendWindow::reset() {
+  const std::lock_guard<std::mutex> lock(this->mutex);
+  this->ready = false;
+}
+
+bool SendWindow::wait(const std::atomic<bool> &done) {
+  std::unique_lock<std::mutex> lock(this->mutex);
+  this->condition.wait(lock, [this, &done]() { return this->ready || done; });
+  return !done;
+}
+
+void SendWindow::notify() {
+  {
+    const std::lock_guard<std::mutex> lock(this->mutex);
+    this->ready = true;
+  }
+  this->condition.notify_all();
+}
+
+PutClientReactor::PutClientReactor(
+    BenchmarkStats &stats,
+    const reactor::ClientFlowControlOptions &flowControl,
+    bool useArena)
+    : ClientBidiReactorBase(flowControl, useArena), stats(stats) {
+}
+
+std::future<grpc::Status> PutClientReactor::getDoneFuture() {
+  return this->donePromise.get_future();
+}
+
+bool PutClientReactor::send(size_t payloadSize) {
+  blob::PutRequest request;
+  encodePayload(*request.mutable_datachunk(), payloadSize);
+  while (!this->done) {
+    this->window.reset();
+    // The response may be read before enqueueRequest returns
+    {
+      const std::lock_guard<std::mutex> lock(this->sentMutex);
+      this->sentAtUs.push_back(getMonotonicTimeUs());
+    }
+    if (this->enqueueRequest(std::move(request))) {
+      return true;
+    }
+    {
+      const std::lock_guard<std::mutex> lock(this->sentMutex);
+      this->sentAtUs.pop_back();
+    }
+    if (!this->window.wait(this->done)) {
+      return false;
+    }
+  }
+  return false;
+}
+
+void PutClientReactor::onReadyToSend() {
+  this->window.notify();
+}
+
+std::unique_ptr<grpc::Status>
+PutClientReactor::readResponse(blob::PutResponse &response) {
+  uint64_t sentAtUs;
+  {
+    const std::lock_guard<std::mutex> lock(this->sentMutex);
+    if (this->sentAtUs.empty()) {
+      this->stats.invalidPayloads++;
+      return nullptr;
+    }
+    sentAtUs = this->sentAtUs.front();
+    this->sentAtUs.pop_front();
+  }
+  recordLatency(this->stats, sentAtUs);
+  return nullptr;
+}
+
+void PutClientReactor::doneCallback() {
+  const grpc::Status status = this->getStatusHolder()->getStatus();
+  if (!status.ok()) {
+    this->stats.failedStreams++;
+  }
+  this->done = true;
+  this->window.notify();
+  this->donePromise.set_value(status);
+}
+
+GetClientReactor::GetClientReactor(
+    BenchmarkStats &stats,
+    size_t payloadSize,
+    size_t messages,
+    bool useArena)
+    : ClientReadReactorBase(useArena), stats(stats) {
+  this->request.set_offset(payloadSize);
+  this->request.set_length(messages);
+}
+
+std::future<grpc::Status> GetClientReactor::getDoneFuture() {
+  return this->donePromise.get_future();
+}
+
+std::unique_ptr<grpc::Status>
+GetClientReactor::readResponse(blob::GetResponse &response) {
+  uint64_t createdAtUs;
+  if (!decodePayload(response.datachunk(), createdAtUs)) {
+    this->stats.invalidPayloads++;
+    return nullptr;
+  }
+  recordLatency(this->stats, createdAtUs);
+  return nullptr;
+}
+
+void GetClientReactor::doneCallback() {
+  const grpc::Status status = this->getStatusHolder()->getStatus();
+  if (!status.ok()) {
+    this->stats.failedStreams++;
+  }
+  this->donePromise.set_value(status);
+}
+
+SendLogClientReactor::SendLogClientReactor(
+    BenchmarkStats &stats,
+    const reactor::ClientFlowControlOptions &flowControl,
+    bool useArena)
+    : ClientWriteReactorBase(flowControl, useArena), stats(stats) {
+}
+
+std::future<grpc::Status> SendLogClientReactor::getDoneFuture() {
+  return this->donePromise.get_future();
+}
+
+bool SendLogClientReactor::send(size_t payloadSize) {
+  backup::SendLogRequest request;
+  while (!this->done) {
+    this->window.reset();
+    // The time spent waiting for room is not part of the latency
+    encodePayload(*request.mutable_logdata(), payloadSize);
+    if (this->enqueueRequest(std::move(request))) {
+      return true;
+    }
+    if (!this->window.wait(this->done)) {
+      return false;
+    }
+  }
+  return false;
+}
+
+void SendLogClientReactor::onReadyToSend() {
+  this->window.notify();
+}
+
+void SendLogClientReactor::doneCallback() {
+  const grpc::Status status = this->getStatusHolder()->getStatus();
+  if (!status.ok()) {
+    this->stats.failedStreams++;
+  }
+  this->done = true;
+  this->window.notify();
+  this->donePromise.set_value(status);
+}
+
+} // namespace benchmark
+} // namespace network
+} // namespace comm
@@ -0,0 +1,225 @@
+#pragma once
+
+#include "LatencyHistogram.h"
+
+#include "backup.grpc.pb.h"
+#include "backup.pb.h"
+#include "blob.grpc.pb.h"
+#include "blob.pb.h"
+
+#include "ClientBidiReactorBase.h"
+#include "ClientReadReactorBase.h"
+#include "ClientWriteReactorBase.h"
+#include "ServerBidiReactorBase.h"
+#include "ServerReadReactorBase.h"
+#include "ServerWriteReactorBase.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <string>
+
+namespace comm {
+namespace network {
+namespace benchmark {
+
+// Shared by all the streams of a case
+struct BenchmarkStats {
+  // Messages that have reached the other side of their stream
+  std::atomic<uint64_t> delivered{0};
+  std::atomic<uint64_t> failedStreams{0};
+  std::atomic<uint64_t> invalidPayloads{0};
+  // In microseconds, from the moment a message is handed to its reactor to
+  // the moment the other side has read it, or for the bidi streams the
+  // moment its response has been read
+  LatencyHistogram latency;
+};
+
+// Settings of the server reactors, the same for every stream of a case
+struct ServerReactorOptions {
+  size_t pipelineWindow;
+  size_t writeQueueSize;
+  bool useArena;
+};
+
+uint64_t getMonotonicTimeUs();
+// The payload starts with the time at which it was created
+void encodePayload(std::string &payload, size_t size);
+// - returns false if the payload is too short to have the time
+bool decodePayload(const std::string &payload, uint64_t &createdAtUs);
+
+// blob Put, answers every chunk right away
+class PutReactor
+    : public reactor::ServerBidiReactorBase<
+          blob::PutRequest,
+          blob::PutResponse> {
+  BenchmarkStats &stats;
+
+public:
+  PutReactor(BenchmarkStats &stats, const ServerReactorOptions &options);
+
+  std::unique_ptr<reactor::ServerBidiReactorStatus>
+  handleRequest(blob::PutRequest &request, blob::PutResponse *response)
+      override;
+};
+
+// blob Get. The offset of the request is the size of the chunks and the
+// length is how many of them are streamed.
+class GetReactor
+    : public reactor::ServerWriteReactorBase<
+          blob::GetRequest,
+          blob::GetResponse> {
+  uint64_t written = 0;
+
+public:
+  GetReactor(
+      const blob::GetRequest *request,
+      const ServerReactorOptions &options);
+
+  std::unique_ptr<grpc::Status> writeResponse(blob::GetResponse *response)
+      override;
+};
+
+// backup SendLog, reads the chunks without storing them
+class SendLogReactor : public reactor::ServerReadReactorBase<
+                           backup::SendLogRequest,
+                           backup::SendLogResponse> {
+  BenchmarkStats &stats;
+
+public:
+  SendLogReactor(
+      backup::SendLogResponse *response,
+      BenchmarkStats &stats,
+      const ServerReactorOptions &options);
+
+  std::unique_ptr<grpc::Status> readRequest(backup::SendLogRequest &request)
+      override;
+};
+
+// Creates the reactors of the methods that the benchmark calls. The stats
+// have to be set before a case starts and stay alive until its streams are
+// done.
+class BlobBenchmarkService : public blob::BlobService::CallbackService {
+  const ServerReactorOptions options;
+
+public:
+  std::atomic<BenchmarkStats *> stats{nullptr};
+
+  explicit BlobBenchmarkService(const ServerReactorOptions &options);
+
+  grpc::ServerBidiReactor<blob::PutRequest, blob::PutResponse> *
+  Put(grpc::CallbackServerContext *context) override;
+  grpc::ServerWriteReactor<blob::GetResponse> *
+  Get(grpc::CallbackServerContext *context,
+      const blob::GetRequest *request) override;
+};
+
+class BackupBenchmarkService : public backup::BackupService::CallbackService {
+  const ServerReactorOptions options;
+
+public:
+  std::atomic<BenchmarkStats *> stats{nullptr};
+
+  explicit BackupBenchmarkService(const ServerReactorOptions &options);
+
+  grpc::ServerReadReactor<backup::SendLogRequest> *SendLog(
+      grpc::CallbackServerContext *context,
+      backup::SendLogResponse *response) override;
+};
+
+// Lets a producer thread wait for room in the send queue of its reactor
+class SendWindow {
+  std::mutex mutex;
+  std::condition_variable condition;
+  bool ready = false;
+
+public:
+  // Has to be called before the producer tries to queue the request
+  void reset();
+  // - returns false if the stream is done before it has room
+  bool wait(const std::atomic<bool> &done);
+  void notify();
+};
+
+// blob Put from the client side. Responses come in the order of the
+// requests, so every response is matched with the oldest time sent.
+class PutClientReactor
+    : public reactor::ClientBidiReactorBase<
+          blob::PutRequest,
+          blob::PutResponse> {
+  BenchmarkStats &stats;
+  std::mutex sentMutex;
+  std::deque<uint64_t> sentAtUs;
+  std::promise<grpc::Status> donePromise;
+
+public:
+  SendWindow window;
+  std::atomic<bool> done{false};
+
+  PutClientReactor(
+      BenchmarkStats &stats,
+      const reactor::ClientFlowControlOptions &flowControl,
+      bool useArena);
+
+  std::future<grpc::Status> getDoneFuture();
+  // Blocks while the send queue is full
+  // - returns false if the stream is done
+  bool send(size_t payloadSize);
+
+  void onReadyToSend() override;
+  std::unique_ptr<grpc::Status> readResponse(blob::PutResponse &response)
+      override;
+  void doneCallback() override;
+};
+
+class GetClientReactor
+    : public reactor::ClientReadReactorBase<
+          blob::GetRequest,
+          blob::GetResponse> {
+  BenchmarkStats &stats;
+  std::promise<grpc::Status> donePromise;
+
+public:
+  GetClientReactor(
+      BenchmarkStats &stats,
+      size_t payloadSize,
+      size_t messages,
+      bool useArena);
+
+  std::future<grpc::Status> getDoneFuture();
+
+  std::unique_ptr<grpc::Status> readResponse(blob::GetResponse &response)
+      override;
+  void doneCallback() override;
+};
+
+class SendLogClientReactor : public reactor::ClientWriteReactorBase<
+                                 backup::SendLogRequest,
+                                 backup::SendLogResponse> {
+  BenchmarkStats &stats;
+  std::promise<grpc::Status> donePromise;
+
+public:
+  SendWindow window;
+  std::atomic<bool> done{false};
+
+  SendLogClientReactor(
+      BenchmarkStats &stats,
+      const reactor::ClientFlowControlOptions &flowControl,
+      bool useArena);
+
+  std::future<grpc::Status> getDoneFuture();
+  // Blocks while the send queue is full
+  // - returns false if the stream is done
+  bool send(size_t payloadSize);
+
+  void onReadyToSend() override;
+  void doneCallback() override;
+};
+
+} // namespace benchmark
+} // namespace network
+} // namespace comm
@@ -0,0 +1,333 @@
+// Throughput benchmark of the base reactors. A server with reactors built on
+// ServerBidiReactorBase, ServerWriteReactorBase and ServerReadReactorBase
+// runs in the same process as the clients, which talk to it over an
+// in-process channel with reactors built on the client bases, so the results
+// don't depend on the network and are reproducible on one machine:
+// - bidi: blob Put, every chunk is answered, the latency is the round trip
+// - server-stream: blob Get, the server streams the chunks to the client
+// - client-stream: backup SendLog, the client streams the chunks to the server
+//
+// Every case is printed on its own line with its messages per second, the
+// latency percentiles and the allocations per message, which count the ones
+// of the client and the server together.
+//
+// Usage:
+//   comm-reactor-benchmark --payload-sizes=64,1024,16384 --streams=1,8,64
+//     --messages=100000 --pipeline-window=1 --write-queue-size=1
+
+#include "BenchmarkReactors.h"
+#include "ThreadPool.h"
+
+#include <boost/program_options.hpp>
+#include <glog/logging.h>
+#include <grpcpp/grpcpp.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+std::atomic<size_t> allocations{0};
+std::atomic<size_t> allocatedBytes{0};
+
+} // namespace
+
+void *operator new(size_t size) {
+  allocations++;
+  allocatedBytes += size;
+  if (void *pointer = std::malloc(size ? size : 1)) {
+    return pointer;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *pointer) noexcept {
+  std::free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept {
+  std::free(pointer);
+}
+
+using namespace comm::network;
+using namespace comm::network::benchmark;
+
+namespace {
+
+const std::vector<std::string> PATTERNS = {
+    "bidi",
+    "server-stream",
+    "client-stream"};
+
+struct BenchmarkOptions {
+  std::vector<std::string> patterns;
+  std::vector<size_t> payloadSizes;
+  std::vector<size_t> streams;
+  // Messages of a case, spread evenly over its streams
+  size_t messages;
+  ServerReactorOptions server;
+  reactor::ClientFlowControlOptions flowControl;
+  size_t requestThreads;
+  bool workStealing;
+};
+
+bool parseSizes(const std::string &list, std::vector<size_t> &sizes) {
+  std::stringstream stream(list);
+  std::string size;
+  while (std::getline(stream, size, ',')) {
+    char *end = nullptr;
+    sizes.push_back(std::strtoull(size.c_str(), &end, 10));
+    if (size.empty() || *end != '\0') {
+      return false;
+    }
+  }
+  return !sizes.empty();
+}
+
+bool parseOptions(int argc, char **argv, BenchmarkOptions &options) {
+  namespace po = boost::program_options;
+  std::string patterns;
+  std::string payloadSizes;
+  std::string streams;
+  po::options_description description{"Options"};
+  description.add_options()("help", "Print the options")(
+      "patterns",
+      po::value<std::string>(&patterns)->default_value(
+          "bidi,server-stream,client-stream"),
+      "Comma separated kinds of streams to measure")(
+      "payload-sizes",
+      po::value<std::string>(&payloadSizes)->default_value("64,1024,16384"),
+      "Comma separated bytes of every message")(
+      "streams",
+      po::value<std::string>(&streams)->default_value("1,8,64"),
+      "Comma separated numbers of streams open at the same time")(
+      "messages",
+      po::value<size_t>(&options.messages)->default_value(100000),
+      "Messages of every case, spread over its streams")(
+      "pipeline-window",
+      po::value<size_t>(&options.server.pipelineWindow)->default_value(1),
+      "Requests in flight on a bidi server reactor")(
+      "write-queue-size",
+      po::value<size_t>(&options.server.writeQueueSize)->default_value(1),
+      "Responses prepared ahead on a server write reactor")(
+      "use-arena",
+      po::bool_switch(&options.server.useArena),
+      "Allocate the messages of the reactors on arenas")(
+      "high-watermark",
+      po::value<size_t>(&options.flowControl.highWatermark)
+          ->default_value(1 << 20),
+      "Bytes queued on a client stream before its producer waits")(
+      "low-watermark",
+      po::value<size_t>(&options.flowControl.lowWatermark)
+          ->default_value(1 << 19),
+      "Bytes queued on a client stream when its producer resumes")(
+      "request-threads",
+      po::value<size_t>(&options.requestThreads)
+          ->default_value(tools::getNumberOfCores()),
+      "Threads of the thread pool that handle the requests")(
+      "work-stealing",
+      po::bool_switch(&options.workStealing),
+      "Run the thread pool on WorkStealingExecutor");
+  po::variables_map variables;
+  try {
+    po::store(po::parse_command_line(argc, argv, description), variables);
+    po::notify(variables);
+  } catch (const po::error &e) {
+    std::cerr << e.what() << std::endl << description;
+    return false;
+  }
+  if (variables.count("help")) {
+    std::cout << description;
+    return false;
+  }
+  std::stringstream stream(patterns);
+  std::string pattern;
+  while (std::getline(stream, pattern, ',')) {
+    if (std::find(PATTERNS.begin(), PATTERNS.end(), pattern) ==
+        PATTERNS.end()) {
+      std::cerr << "Unknown pattern " << pattern << std::endl << description;
+      return false;
+    }
+    options.patterns.push_back(pattern);
+  }
+  if (options.patterns.empty() ||
+      !parseSizes(payloadSizes, options.payloadSizes) ||
+      !parseSizes(streams, options.streams) ||
+      std::count(options.streams.begin(), options.streams.end(), 0) ||
+      !options.messages || !options.requestThreads) {
+    std::cerr << "Invalid options" << std::endl << description;
+    return false;
+  }
+  return true;
+}
+
+// Every producer queues its messages on its own stream, as fast as the flow
+// control lets it
+template <class Reactor>
+void runProducers(
+    const std::vector<std::unique_ptr<Reactor>> &reactors,
+    size_t messagesPerStream,
+    size_t payloadSize) {
+  std::vector<std::thread> producers;
+  for (const std::unique_ptr<Reactor> &reactor : reactors) {
+    producers.emplace_back([&reactor, messagesPerStream, payloadSize]() {
+      for (size_t i = 0; i < messagesPerStream; i++) {
+        if (!reactor->send(payloadSize)) {
+          break;
+        }
+      }
+      reactor->finishSending();
+    });
+  }
+  for (std::thread &producer : producers) {
+    producer.join();
+  }
+}
+
+template <class Reactor>
+void waitForStreams(const std::vector<std::unique_ptr<Reactor>> &reactors) {
+  for (const std::unique_ptr<Reactor> &reactor : reactors) {
+    reactor->getDoneFuture().wait();
+  }
+}
+
+void runCase(
+    const BenchmarkOptions &options,
+    const std::string &pattern,
+    size_t payloadSize,
+    size_t streams,
+    blob::BlobService::Stub &blobStub,
+    backup::BackupService::Stub &backupStub,
+    BenchmarkStats &stats) {
+  const size_t messagesPerStream =
+      std::max<size_t>(1, options.messages / streams);
+  if (pattern == "bidi") {
+    std::vector<std::unique_ptr<PutClientReactor>> reactors;
+    for (size_t i = 0; i < streams; i++) {
+      reactors.push_back(std::make_unique<PutClientReactor>(
+          stats, options.flowControl, options.server.useArena));
+      blobStub.async()->Put(&reactors.back()->context, reactors.back().get());
+      reactors.back()->start();
+    }
+    runProducers(reactors, messagesPerStream, payloadSize);
+    waitForStreams(reactors);
+  } else if (pattern == "server-stream") {
+    std::vector<std::unique_ptr<GetClientReactor>> reactors;
+    for (size_t i = 0; i < streams; i++) {
+      reactors.push_back(std::make_unique<GetClientReactor>(
+          stats, payloadSize, messagesPerStream, options.server.useArena));
+      blobStub.async()->Get(
+          &reactors.back()->context,
+          &reactors.back()->request,
+          reactors.back().get());
+      reactors.back()->start();
+    }
+    waitForStreams(reactors);
+  } else {
+    std::vector<std::unique_ptr<SendLogClientReactor>> reactors;
+    for (size_t i = 0; i < streams; i++) {
+      reactors.push_back(std::make_unique<SendLogClientReactor>(
+          stats, options.flowControl, options.server.useArena));
+      backupStub.async()->SendLog(
+          &reactors.back()->context,
+          &reactors.back()->response,
+          reactors.back().get());
+      reactors.back()->start();
+    }
+    runProducers(reactors, messagesPerStream, payloadSize);
+    waitForStreams(reactors);
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  FLAGS_logtostderr = true;
+  // Only the streams that fail are logged
+  FLAGS_minloglevel = 1;
+  google::InitGoogleLogging(argv[0]);
+
+  BenchmarkOptions options;
+  if (!parseOptions(argc, argv, options)) {
+    return 1;
+  }
+  ThreadPoolOptions threadPoolOptions;
+  threadPoolOptions.requestThreads = options.requestThreads;
+  threadPoolOptions.executor = options.workStealing
+      ? ThreadPoolExecutor::WORK_STEALING
+      : ThreadPoolExecutor::ASIO;
+  ThreadPool::configure(threadPoolOptions);
+
+  BlobBenchmarkService blobService(options.server);
+  BackupBenchmarkService backupService(options.server);
+  grpc::ServerBuilder builder;
+  builder.RegisterService(&blobService);
+  builder.RegisterService(&backupService);
+  std::unique_ptr<grpc::Server> server = builder.BuildAndStart();
+  std::shared_ptr<grpc::Channel> channel =
+      server->InProcessChannel(grpc::ChannelArguments());
+  blob::BlobService::Stub blobStub(channel);
+  backup::BackupService::Stub backupStub(channel);
+
+  bool failed = false;
+  for (const std::string &pattern : options.patterns) {
+    for (size_t payloadSize : options.payloadSizes) {
+      for (size_t streams : options.streams) {
+        BenchmarkStats stats;
+        blobService.stats = &stats;
+        backupService.stats = &stats;
+        const uint64_t expected =
+            std::max<size_t>(1, options.messages / streams) * streams;
+        const size_t allocationsBefore = allocations.load();
+        const size_t allocatedBytesBefore = allocatedBytes.load();
+        const auto start = std::chrono::steady_clock::now();
+
+        runCase(
+            options,
+            pattern,
+            payloadSize,
+            streams,
+            blobStub,
+            backupStub,
+            stats);
+
+        const double seconds = std::chrono::duration<double>(
+                                   std::chrono::steady_clock::now() - start)
+                                   .count();
+        const double messages = expected;
+        const bool caseFailed = stats.failedStreams ||
+            stats.invalidPayloads || stats.delivered != expected;
+        failed = failed || caseFailed;
+        std::printf(
+            "%-14s %6zu B %4zu streams %10.0f msgs/s %9.2f MB/s  "
+            "p50 %8.3f  p99 %8.3f  max %8.3f ms %8.1f allocs/msg "
+            "%10.1f B/msg%s\n",
+            pattern.c_str(),
+            payloadSize,
+            streams,
+            messages / seconds,
+            messages * payloadSize / seconds / 1e6,
+            stats.latency.getPercentile(50) / 1000.0,
+            stats.latency.getPercentile(99) / 1000.0,
+            stats.latency.getMax() / 1000.0,
+            (allocations.load() - allocationsBefore) / messages,
+            (allocatedBytes.load() - allocatedBytesBefore) / messages,
+            caseFailed ? "  FAILED" : "");
+      }
+    }
+  }
+  blobService.stats = nullptr;
+  backupService.stats = nullptr;
+  server->Shutdown();
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,96 @@
+#include "AdaptiveChunker.h"
+
+#include <algorithm>
+
+namespace comm {
+namespace network {
+
+namespace {
+// Weight of a new measurement in the smoothed ones
+const double measurement_weight = 0.25;
+
+double smooth(double current, double measurement) {
+  if (current == 0) {
+    return measurement;
+  }
+  return current + measurement_weight * (measurement - current);
+}
+
+double to_seconds(std::chrono::steady_clock::duration duration) {
+  return std::chrono::duration<double>(duration).count();
+}
+} // namespace
+
+AdaptiveChunker::AdaptiveChunker(
+    size_t minChunkSize,
+    size_t maxChunkSize,
+    std::chrono::steady_clock::duration targetChunkDuration)
+    : minChunkSize(std::max<size_t>(1, minChunkSize)),
+      maxChunkSize(std::max(this->minChunkSize, maxChunkSize)),
+      targetChunkDuration(targetChunkDuration),
+      chunkSize(std::min(
+          std::max(ADAPTIVE_CHUNK_SIZE_INITIAL, this->minChunkSize),
+          this->maxChunkSize)) {
+}
+
+size_t AdaptiveChunker::getChunkSize() const {
+  const std::lock_guard<std::mutex> lock(this->chunkerMutex);
+  return this->chunkSize;
+}
+
+void AdaptiveChunker::recordWrite(
+    size_t size,
+    std::chrono::steady_clock::duration elapsed) {
+  double seconds = to_seconds(elapsed);
+  if (!size || seconds <= 0) {
+    return;
+  }
+  const std::lock_guard<std::mutex> lock(this->chunkerMutex);
+  this->throughput = smooth(this->throughput, size / seconds);
+  this->updateChunkSize();
+}
+
+void AdaptiveChunker::recordRoundTrip(
+    std::chrono::steady_clock::duration roundTrip) {
+  double seconds = to_seconds(roundTrip);
+  if (seconds <= 0) {
+    return;
+  }
+  const std::lock_guard<std::mutex> lock(this->chunkerMutex);
+  this->roundTripSeconds = smooth(this->roundTripSeconds, seconds);
+  this->updateChunkSize();
+}
+
+// Has to be called with chunkerMutex locked
+void AdaptiveChunker::updateChunkSize() {
+  if (this->throughput == 0) {
+    return;
+  }
+  double seconds =
+      std::max(this->roundTripSeconds, to_seconds(this->targetChunkDuration));
+  double size = std::min(
+      std::max(this->throughput * seconds, (double)this->minChunkSize),
+      (double)this->maxChunkSize);
+  this->chunkSize = (size_t)size;
+}
+
+bool AdaptiveChunker::takeChunk(
+    std::string &data,
+    size_t &offset,
+    std::string &chunk) const {
+  if (offset >= data.size()) {
+    return false;
+  }
+  size_t size = std::min(this->getChunkSize(), data.size() - offset);
+  if (!offset && size == data.size()) {
+    chunk = std::move(data);
+    data.clear();
+    return true;
+  }
+  chunk.assign(data, offset, size);
+  offset += size;
+  return true;
+}
+
+} // namespace network
+} // namespace comm
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "GlobalConstants.h"
+
+#include <chrono>
+#include <mutex>
+#include <string>
+
+namespace comm {
+namespace network {
+
+// Picks the size of the chunks of a streamed upload or download, e.g. blob
+// `dataChunk` or backup `compactionChunk` and `logChunk`, from the throughput
+// and the round trip time observed for the previous chunks. A chunk should
+// take about as long to send as a round trip, but no less than
+// targetChunkDuration, so that high-latency links don't wait on many small
+// chunks and slow links don't get stuck on huge ones.
+//
+// It is thread-safe, so that the producer can pick sizes while the reactor
+// records its writes.
+class AdaptiveChunker {
+  const size_t minChunkSize;
+  const size_t maxChunkSize;
+  const std::chrono::steady_clock::duration targetChunkDuration;
+
+  mutable std::mutex chunkerMutex;
+  size_t chunkSize;
+  // Smoothed measurements, zero until the first one
+  double throughput = 0;
+  double roundTripSeconds = 0;
+
+  void updateChunkSize();
+
+public:
+  AdaptiveChunker(
+      size_t minChunkSize = ADAPTIVE_CHUNK_SIZE_MIN,
+      size_t maxChunkSize = ADAPTIVE_CHUNK_SIZE_MAX,
+      std::chrono::steady_clock::duration targetChunkDuration =
+          std::chrono::milliseconds(100));
+
+  size_t getChunkSize() const;
+  // - argument size - number of bytes that were written
+  // - argument elapsed - time from starting the write to its completion
+  void recordWrite(size_t size, std::chrono::steady_clock::duration elapsed);
+  void recordRoundTrip(std::chrono::steady_clock::duration roundTrip);
+
+  // Moves the next chunk of data, starting at offset, to chunk and advances
+  // the offset. The whole buffer is passed through without copying when it
+  // fits in a single chunk, so data shouldn't be used after that.
+  // - returns false if there was nothing left in data
+  bool takeChunk(std::string &data, size_t &offset, std::string &chunk) const;
+};
+
+} // namespace network
+} // namespace comm
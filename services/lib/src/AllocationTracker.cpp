@@ -0,0 +1,163 @@
+#include "AllocationTracker.h"
+#include "Metrics.h"
+
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace comm {
+namespace network {
+namespace allocation {
+
+namespace {
+
+const size_t ALLOCATION_SHARDS_COUNT = 16;
+
+const std::array<const char *, ALLOCATION_TAGS_COUNT> TAG_NAMES = {
+    "untagged",
+    "reactors",
+    "delivery_broker",
+};
+
+// Aligned so that the threads of different shards don't share a cache line
+struct alignas(64) AllocationShard {
+  std::array<std::atomic<uint64_t>, ALLOCATION_TAGS_COUNT> counts;
+  std::array<std::atomic<uint64_t>, ALLOCATION_TAGS_COUNT> bytes;
+};
+
+// Zero initialized before any code runs, operator new may be called by the
+// constructors of other static objects
+AllocationShard shards[ALLOCATION_SHARDS_COUNT];
+std::atomic<size_t> nextShard{0};
+std::atomic<AllocationSampler> sampler{nullptr};
+thread_local AllocationTag currentTag = AllocationTag::UNTAGGED;
+thread_local size_t currentShard = ALLOCATION_SHARDS_COUNT;
+
+} // namespace
+
+bool isAllocationTrackingEnabled() {
+#ifdef COMM_ALLOCATION_TRACKING
+  return true;
+#else
+  return false;
+#endif
+}
+
+void recordAllocation(size_t size) {
+  if (currentShard == ALLOCATION_SHARDS_COUNT) {
+    currentShard = nextShard.fetch_add(1, std::memory_order_relaxed) %
+        ALLOCATION_SHARDS_COUNT;
+  }
+  AllocationShard &shard = shards[currentShard];
+  const size_t tag = static_cast<size_t>(currentTag);
+  shard.counts[tag].fetch_add(1, std::memory_order_relaxed);
+  shard.bytes[tag].fetch_add(size, std::memory_order_relaxed);
+  const AllocationSampler currentSampler =
+      sampler.load(std::memory_order_relaxed);
+  if (currentSampler != nullptr) {
+    currentSampler(size);
+  }
+}
+
+void setAllocationSampler(AllocationSampler newSampler) {
+  sampler.store(newSampler, std::memory_order_relaxed);
+}
+
+std::vector<AllocationStats> getAllocationSnapshot() {
+  std::vector<AllocationStats> snapshot;
+  snapshot.reserve(ALLOCATION_TAGS_COUNT);
+  for (size_t tag = 0; tag < ALLOCATION_TAGS_COUNT; tag++) {
+    AllocationStats stats{TAG_NAMES[tag], 0, 0};
+    for (const AllocationShard &shard : shards) {
+      stats.count += shard.counts[tag].load(std::memory_order_relaxed);
+      stats.bytes += shard.bytes[tag].load(std::memory_order_relaxed);
+    }
+    snapshot.push_back(stats);
+  }
+  return snapshot;
+}
+
+void registerAllocationMetrics() {
+  metrics::MetricsRegistry &registry = metrics::MetricsRegistry::getInstance();
+  for (size_t tag = 0; tag < ALLOCATION_TAGS_COUNT; tag++) {
+    const std::string labels = "tag=\"" + std::string(TAG_NAMES[tag]) + "\"";
+    registry.registerCounterFunction(
+        "comm_allocations_total",
+        "Allocations made through operator new",
+        labels,
+        [tag]() {
+          uint64_t count = 0;
+          for (const AllocationShard &shard : shards) {
+            count += shard.counts[tag].load(std::memory_order_relaxed);
+          }
+          return static_cast<double>(count);
+        });
+    registry.registerCounterFunction(
+        "comm_allocated_bytes_total",
+        "Bytes allocated through operator new",
+        labels,
+        [tag]() {
+          uint64_t bytes = 0;
+          for (const AllocationShard &shard : shards) {
+            bytes += shard.bytes[tag].load(std::memory_order_relaxed);
+          }
+          return static_cast<double>(bytes);
+        });
+  }
+}
+
+ScopedAllocationTag::ScopedAllocationTag(AllocationTag tag)
+    : previousTag(currentTag) {
+  currentTag = tag;
+}
+
+ScopedAllocationTag::~ScopedAllocationTag() {
+  currentTag = this->previousTag;
+}
+
+} // namespace allocation
+} // namespace network
+} // namespace comm
+
+#ifdef COMM_ALLOCATION_TRACKING
+
+void *operator new(std::size_t size) {
+  comm::network::allocation::recordAllocation(size);
+  void *pointer = std::malloc(size ? size : 1);
+  if (pointer == nullptr) {
+    throw std::bad_alloc();
+  }
+  return pointer;
+}
+
+void *operator new[](std::size_t size) {
+  return operator new(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  comm::network::allocation::recordAllocation(size);
+  return std::malloc(size ? size : 1);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  return operator new(size, std::nothrow);
+}
+
+void operator delete(void *pointer) noexcept {
+  std::free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept {
+  std::free(pointer);
+}
+
+void operator delete(void *pointer, std::size_t) noexcept {
+  std::free(pointer);
+}
+
+void operator delete[](void *pointer, std::size_t) noexcept {
+  std::free(pointer);
+}
+
+#endif
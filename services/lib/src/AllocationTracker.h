@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace comm {
+namespace network {
+namespace allocation {
+
+// The code paths that allocations are attributed to, by the tag of the thread
+// that makes them
+enum class AllocationTag : uint8_t {
+  UNTAGGED = 0,
+  // The tasks of the server reactors and the callbacks of the client ones
+  REACTORS = 1,
+  DELIVERY_BROKER = 2,
+};
+
+const size_t ALLOCATION_TAGS_COUNT = 3;
+
+struct AllocationStats {
+  std::string tag;
+  // Allocations since the start of the process and the bytes they asked for.
+  // Frees aren't counted, these measure the churn rather than the memory in
+  // use.
+  uint64_t count;
+  uint64_t bytes;
+};
+
+// Only a build with COMM_ALLOCATION_TRACKING defined replaces the global
+// operator new with one that counts, in any other the counters stay at zero
+// and a tag costs a thread local store. The counters are sharded by thread,
+// so counting costs a relaxed atomic add on a line that the thread mostly
+// has to itself.
+bool isAllocationTrackingEnabled();
+// Called by operator new, it must not allocate
+void recordAllocation(size_t size);
+// One entry per tag, in the order of AllocationTag
+std::vector<AllocationStats> getAllocationSnapshot();
+// Called by operator new with the size of every allocation while it's set,
+// from the thread that allocates. It must not allocate either. nullptr
+// removes it.
+using AllocationSampler = void (*)(size_t size);
+void setAllocationSampler(AllocationSampler sampler);
+// Exports the counters as comm_allocations_total and
+// comm_allocated_bytes_total, labeled with the tag
+void registerAllocationMetrics();
+
+// Attributes the allocations of the thread to the tag until it goes out of
+// scope, scopes nest
+class ScopedAllocationTag {
+  const AllocationTag previousTag;
+
+public:
+  explicit ScopedAllocationTag(AllocationTag tag);
+  ~ScopedAllocationTag();
+
+  ScopedAllocationTag(const ScopedAllocationTag &) = delete;
+  void operator=(const ScopedAllocationTag &) = delete;
+};
+
+} // namespace allocation
+} // namespace network
+} // namespace comm
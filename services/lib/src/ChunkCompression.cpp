@@ -0,0 +1,98 @@
+#include "ChunkCompression.h"
+#include "GlobalConstants.h"
+
+#include <zstd.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace comm {
+namespace network {
+
+namespace {
+enum class ChunkEncoding : char {
+  RAW = 0,
+  ZSTD = 1,
+};
+
+// The beginning of a chunk is compressed quickly to tell whether it is
+// worth compressing the whole chunk
+const size_t compressibility_sample_size = 16 * 1024;
+const int compressibility_sample_level = 1;
+// Compressed data has to be at most this part of the original, otherwise the
+// time spent on decompressing it isn't worth it
+const double max_compression_ratio = 0.95;
+
+bool compress(
+    const char *data,
+    size_t size,
+    int level,
+    std::string &compressed) {
+  compressed.resize(ZSTD_compressBound(size) + 1);
+  size_t compressedSize = ZSTD_compress(
+      &compressed[1], compressed.size() - 1, data, size, level);
+  if (ZSTD_isError(compressedSize)) {
+    return false;
+  }
+  compressed.resize(compressedSize + 1);
+  return compressedSize <= size * max_compression_ratio;
+}
+} // namespace
+
+ChunkCompressor::ChunkCompressor(int level) : level(level) {
+}
+
+bool ChunkCompressor::isCompressible(const std::string &chunk) const {
+  if (chunk.size() < CHUNK_COMPRESSION_MIN_SIZE) {
+    return false;
+  }
+  if (chunk.size() <= compressibility_sample_size) {
+    return true;
+  }
+  std::string sample;
+  return compress(
+      chunk.data(),
+      compressibility_sample_size,
+      compressibility_sample_level,
+      sample);
+}
+
+void ChunkCompressor::encode(std::string &chunk) const {
+  std::string compressed;
+  if (this->isCompressible(chunk) &&
+      compress(chunk.data(), chunk.size(), this->level, compressed)) {
+    compressed[0] = (char)ChunkEncoding::ZSTD;
+    chunk = std::move(compressed);
+    return;
+  }
+  chunk.insert(chunk.begin(), (char)ChunkEncoding::RAW);
+}
+
+void ChunkCompressor::decode(std::string &chunk) {
+  if (chunk.empty()) {
+    throw std::runtime_error("chunk is missing its encoding");
+  }
+  if (chunk[0] == (char)ChunkEncoding::RAW) {
+    chunk.erase(chunk.begin());
+    return;
+  }
+  if (chunk[0] != (char)ChunkEncoding::ZSTD) {
+    throw std::runtime_error("unknown chunk encoding");
+  }
+  unsigned long long size =
+      ZSTD_getFrameContentSize(chunk.data() + 1, chunk.size() - 1);
+  if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN ||
+      size > GRPC_CHUNK_SIZE_LIMIT) {
+    throw std::runtime_error("invalid compressed chunk");
+  }
+  std::string decompressed(size, '\0');
+  size_t decompressedSize = ZSTD_decompress(
+      &decompressed[0], size, chunk.data() + 1, chunk.size() - 1);
+  if (ZSTD_isError(decompressedSize) || decompressedSize != size) {
+    throw std::runtime_error("invalid compressed chunk");
+  }
+  chunk = std::move(decompressed);
+}
+
+} // namespace network
+} // namespace comm
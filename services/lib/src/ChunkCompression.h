@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+
+namespace comm {
+namespace network {
+
+// Compression of the data chunks of blob and backup streams, e.g. blob
+// `dataChunk` or backup `compactionChunk` and `logChunk`.
+//
+// It is negotiated per request: the client asks for it in the metadata of the
+// call and the server agrees in its initial metadata (see
+// ChunkCompressionMetadata.h). Once both sides agree, every chunk of the
+// stream starts with a byte that tells whether the rest of it is compressed
+// with zstd or sent as it is, so that chunks which don't compress well are
+// skipped. Streams that haven't negotiated it are left untouched.
+class ChunkCompressor {
+  const int level;
+
+  bool isCompressible(const std::string &chunk) const;
+
+public:
+  // - argument level - zstd compression level, configured by the service
+  explicit ChunkCompressor(int level);
+
+  // Replaces chunk with its encoded version
+  void encode(std::string &chunk) const;
+  // Replaces an encoded chunk with the original data. Throws if the chunk is
+  // malformed or larger than GRPC_CHUNK_SIZE_LIMIT once decompressed.
+  static void decode(std::string &chunk);
+};
+
+} // namespace network
+} // namespace comm
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "GlobalConstants.h"
+
+#include <grpcpp/grpcpp.h>
+
+#include <string>
+
+namespace comm {
+namespace network {
+
+// Negotiation of chunk compression (see ChunkCompressor). These are defined
+// in the header, so that code which doesn't use them doesn't have to link
+// gRPC.
+inline void requestChunkCompression(grpc::ClientContext &context) {
+  context.AddMetadata(CHUNK_COMPRESSION_METADATA_KEY, CHUNK_COMPRESSION_ZSTD);
+}
+
+// Returns whether the client asked for compression, in which case the server
+// agrees to it. Has to be called before the initial metadata is sent.
+inline bool acceptChunkCompression(grpc::ServerContextBase &context) {
+  const auto &metadata = context.client_metadata();
+  auto it = metadata.find(CHUNK_COMPRESSION_METADATA_KEY);
+  if (it == metadata.end() ||
+      std::string(it->second.data(), it->second.size()) !=
+          CHUNK_COMPRESSION_ZSTD) {
+    return false;
+  }
+  context.AddInitialMetadata(
+      CHUNK_COMPRESSION_METADATA_KEY, CHUNK_COMPRESSION_ZSTD);
+  return true;
+}
+
+// Returns whether the server agreed to compression. Has to be called once the
+// initial metadata of the server has been received.
+inline bool isChunkCompressionAccepted(const grpc::ClientContext &context) {
+  const auto &metadata = context.GetServerInitialMetadata();
+  auto it = metadata.find(CHUNK_COMPRESSION_METADATA_KEY);
+  return it != metadata.end() &&
+      std::string(it->second.data(), it->second.size()) ==
+      CHUNK_COMPRESSION_ZSTD;
+}
+
+} // namespace network
+} // namespace comm
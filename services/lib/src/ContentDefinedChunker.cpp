@@ -0,0 +1,142 @@
+#include "ContentDefinedChunker.h"
+#include "GlobalConstants.h"
+
+#include <openssl/sha.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iomanip>
+#include <sstream>
+
+namespace comm {
+namespace network {
+
+namespace {
+// The gear table has to be the same for every client, so it is generated
+// from a fixed seed
+std::array<uint64_t, 256> make_gear_table() {
+  std::array<uint64_t, 256> table;
+  uint64_t state = 0x636f6d6d2d636463ull;
+  for (uint64_t &value : table) {
+    // splitmix64
+    state += 0x9e3779b97f4a7c15ull;
+    uint64_t z = state;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    value = z ^ (z >> 31);
+  }
+  return table;
+}
+
+const std::array<uint64_t, 256> &get_gear_table() {
+  static const std::array<uint64_t, 256> table = make_gear_table();
+  return table;
+}
+
+// A mask with one bit set for every halving of the chance of a boundary,
+// which is 1 / averageChunkSize without the adjustment. The hash is shifted
+// left with every byte, so its top bits depend on the most bytes.
+uint64_t make_mask(size_t averageChunkSize, int adjustment) {
+  int bits = adjustment;
+  while (averageChunkSize >>= 1) {
+    bits++;
+  }
+  bits = std::min(std::max(bits, 1), 63);
+  return ~0ull << (64 - bits);
+}
+
+std::string hash_chunk(const char *data, size_t size) {
+  unsigned char digest[SHA256_DIGEST_LENGTH];
+  SHA256(reinterpret_cast<const unsigned char *>(data), size, digest);
+  std::ostringstream hash;
+  hash << std::hex << std::setfill('0');
+  for (unsigned char byte : digest) {
+    hash << std::setw(2) << (int)byte;
+  }
+  return hash.str();
+}
+
+ContentChunkerOptions normalize_options(ContentChunkerOptions options) {
+  options.minChunkSize = std::max<size_t>(1, options.minChunkSize);
+  options.averageChunkSize =
+      std::max(options.minChunkSize, options.averageChunkSize);
+  options.maxChunkSize =
+      std::max(options.averageChunkSize, options.maxChunkSize);
+  return options;
+}
+} // namespace
+
+ContentDefinedChunker::ContentDefinedChunker(
+    const ContentChunkerOptions &options)
+    : options(normalize_options(options)),
+      smallChunkMask(make_mask(this->options.averageChunkSize, 2)),
+      largeChunkMask(make_mask(this->options.averageChunkSize, -2)) {
+}
+
+size_t
+ContentDefinedChunker::findBoundary(const char *data, size_t size) const {
+  if (size <= this->options.minChunkSize) {
+    return size;
+  }
+  const std::array<uint64_t, 256> &gear = get_gear_table();
+  size_t end = std::min(size, this->options.maxChunkSize);
+  size_t normalSize = std::min(end, this->options.averageChunkSize);
+  uint64_t hash = 0;
+  size_t i = this->options.minChunkSize;
+  for (; i < normalSize; i++) {
+    hash = (hash << 1) + gear[(unsigned char)data[i]];
+    if (!(hash & this->smallChunkMask)) {
+      return i + 1;
+    }
+  }
+  for (; i < end; i++) {
+    hash = (hash << 1) + gear[(unsigned char)data[i]];
+    if (!(hash & this->largeChunkMask)) {
+      return i + 1;
+    }
+  }
+  return end;
+}
+
+std::vector<ContentChunk>
+ContentDefinedChunker::split(const std::string &data) const {
+  std::vector<ContentChunk> chunks;
+  chunks.reserve(data.size() / this->options.averageChunkSize + 1);
+  size_t offset = 0;
+  while (offset < data.size()) {
+    size_t size =
+        this->findBoundary(data.data() + offset, data.size() - offset);
+    chunks.push_back({offset, size, hash_chunk(data.data() + offset, size)});
+    offset += size;
+  }
+  return chunks;
+}
+
+std::vector<ContentChunk> findMissingChunks(
+    const std::vector<ContentChunk> &chunks,
+    const std::unordered_set<std::string> &knownHashes) {
+  std::vector<ContentChunk> missingChunks;
+  std::unordered_set<std::string> addedHashes;
+  for (const ContentChunk &chunk : chunks) {
+    if (knownHashes.find(chunk.hash) == knownHashes.end() &&
+        addedHashes.insert(chunk.hash).second) {
+      missingChunks.push_back(chunk);
+    }
+  }
+  return missingChunks;
+}
+
+std::string joinChunkHashes(const std::vector<ContentChunk> &chunks) {
+  std::string hashes;
+  for (const ContentChunk &chunk : chunks) {
+    if (!hashes.empty()) {
+      hashes += ATTACHMENT_DELIMITER;
+    }
+    hashes += chunk.hash;
+  }
+  return hashes;
+}
+
+} // namespace network
+} // namespace comm
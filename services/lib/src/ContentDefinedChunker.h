@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace comm {
+namespace network {
+
+struct ContentChunk {
+  size_t offset;
+  size_t size;
+  // Hex encoded SHA-256 of the chunk's data
+  std::string hash;
+};
+
+struct ContentChunkerOptions {
+  size_t minChunkSize = 16 * 1024;
+  size_t averageChunkSize = 64 * 1024;
+  size_t maxChunkSize = 256 * 1024;
+};
+
+// Splits data, e.g. a backup compaction, at boundaries picked from its
+// content (FastCDC with a gear rolling hash), instead of at fixed offsets.
+// An edit only moves the boundaries around it, so successive compactions
+// that differ slightly share most of their chunks, and only the chunks with
+// unknown hashes have to be uploaded.
+//
+// Boundaries depend only on the data and the options, so every client has to
+// use the same options for the chunks to match.
+class ContentDefinedChunker {
+  const ContentChunkerOptions options;
+  // Boundaries are harder to find before the average size and easier after
+  // it, which keeps the sizes close to the average
+  const uint64_t smallChunkMask;
+  const uint64_t largeChunkMask;
+
+  size_t findBoundary(const char *data, size_t size) const;
+
+public:
+  explicit ContentDefinedChunker(
+      const ContentChunkerOptions &options = ContentChunkerOptions());
+
+  std::vector<ContentChunk> split(const std::string &data) const;
+};
+
+// Returns the chunks whose hashes are not known yet, in their order, with
+// repeated chunks only included once
+std::vector<ContentChunk> findMissingChunks(
+    const std::vector<ContentChunk> &chunks,
+    const std::unordered_set<std::string> &knownHashes);
+
+// Joins the hashes of the chunks with ATTACHMENT_DELIMITER, the same way
+// that attachment holders are sent
+std::string joinChunkHashes(const std::vector<ContentChunk> &chunks);
+
+} // namespace network
+} // namespace comm
@@ -1,32 +1,165 @@
 #include "DatabaseManagerBase.h"
 
+#include "DynamoDBRateLimiter.h"
+#include "GlobalConstants.h"
 #include "Item.h"
+#include "Logging.h"
+#include "Metrics.h"
+#include "TimingWheel.h"
 
 #include <aws/core/utils/Outcome.h>
+#include <aws/dynamodb/model/BatchGetItemResult.h>
 #include <aws/dynamodb/model/BatchWriteItemRequest.h>
 #include <aws/dynamodb/model/BatchWriteItemResult.h>
 #include <aws/dynamodb/model/DeleteItemRequest.h>
+#include <aws/dynamodb/model/GetItemResult.h>
 #include <glog/logging.h>
 
+#include <algorithm>
+#include <array>
 #include <chrono>
 #include <cmath>
+#include <iterator>
+#include <mutex>
+#include <random>
 #include <thread>
 
 namespace comm {
 namespace network {
 namespace database {
 
-void DatabaseManagerBase::innerPutItem(
-    std::shared_ptr<Item> item,
-    const Aws::DynamoDB::Model::PutItemRequest &request) {
-  const Aws::DynamoDB::Model::PutItemOutcome outcome =
-      getDynamoDBClient()->PutItem(request);
-  if (!outcome.IsSuccess()) {
-    throw std::runtime_error(outcome.GetError().GetMessage());
+namespace {
+const size_t DATABASE_OPERATIONS = 7;
+
+struct DatabaseMetrics {
+  std::array<metrics::Histogram *, DATABASE_OPERATIONS> durations;
+  std::array<metrics::Counter *, DATABASE_OPERATIONS> errors;
+
+  DatabaseMetrics() {
+    const std::array<std::string, DATABASE_OPERATIONS> operations = {
+        "put_item",
+        "get_item",
+        "batch_get_item",
+        "query",
+        "delete_item",
+        "batch_write_item",
+        "scan"};
+    metrics::MetricsRegistry &registry =
+        metrics::MetricsRegistry::getInstance();
+    for (size_t i = 0; i < DATABASE_OPERATIONS; i++) {
+      const std::string labels = "operation=\"" + operations[i] + "\"";
+      this->durations[i] = &registry.getHistogram(
+          "comm_dynamodb_request_duration_seconds",
+          "Duration of DynamoDB requests",
+          labels);
+      this->errors[i] = &registry.getCounter(
+          "comm_dynamodb_request_errors_total",
+          "DynamoDB requests that failed",
+          labels);
+    }
   }
+};
+
+DatabaseMetrics &get_database_metrics() {
+  static DatabaseMetrics databaseMetrics;
+  return databaseMetrics;
 }
 
-void DatabaseManagerBase::innerRemoveItem(const Item &item) {
+// Shared by all the hedged lookups, so that the hedges can't pile up on
+// a table that is slow for everyone
+struct HedgingBudget {
+  std::mutex mutex;
+  double hedges{0};
+  metrics::Counter *sent;
+  metrics::Counter *won;
+
+  HedgingBudget() {
+    metrics::MetricsRegistry &registry =
+        metrics::MetricsRegistry::getInstance();
+    this->sent = &registry.getCounter(
+        "comm_dynamodb_hedged_requests_total",
+        "Lookups that were sent a second time for being slow");
+    this->won = &registry.getCounter(
+        "comm_dynamodb_hedged_request_wins_total",
+        "Hedged lookups whose second request responded first");
+  }
+
+  void earn() {
+    const std::lock_guard<std::mutex> lock(this->mutex);
+    this->hedges = std::min(
+        this->hedges + DYNAMODB_HEDGE_BUDGET_RATIO,
+        DYNAMODB_HEDGE_BUDGET_BURST);
+  }
+
+  bool spend() {
+    const std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->hedges < 1) {
+      return false;
+    }
+    this->hedges--;
+    return true;
+  }
+};
+
+HedgingBudget &get_hedging_budget() {
+  static HedgingBudget budget;
+  return budget;
+}
+
+struct HedgedGetItem {
+  std::mutex mutex;
+  bool settled{false};
+  std::promise<Aws::DynamoDB::Model::GetItemOutcome> outcome;
+};
+
+// The first of the requests of a lookup to respond settles it
+void send_hedged_get_item(
+    std::shared_ptr<HedgedGetItem> context,
+    const Aws::DynamoDB::Model::GetItemRequest &request,
+    bool isHedge) {
+  const auto start = std::chrono::steady_clock::now();
+  getDynamoDBClient()->GetItemAsync(
+      request,
+      [context, isHedge, start](
+          const Aws::DynamoDB::DynamoDBClient *client,
+          const Aws::DynamoDB::Model::GetItemRequest &request,
+          const Aws::DynamoDB::Model::GetItemOutcome &outcome,
+          const std::shared_ptr<const Aws::Client::AsyncCallerContext>
+              &callerContext) {
+        recordDatabaseRequest(
+            DatabaseOperation::GET_ITEM, start, outcome.IsSuccess());
+        DynamoDBRateLimiter::getInstance(request.GetTableName())
+            .recordResponse(start, isThrottlingError(outcome));
+        {
+          const std::lock_guard<std::mutex> lock(context->mutex);
+          if (context->settled) {
+            return;
+          }
+          context->settled = true;
+        }
+        if (isHedge) {
+          get_hedging_budget().won->increment();
+        }
+        context->outcome.set_value(outcome);
+      });
+}
+
+struct BatchWriteContext {
+  std::string tableName;
+  size_t chunkSize;
+  size_t backoffFirstRetryDelay;
+  size_t maxBackoffTime;
+  std::vector<Aws::DynamoDB::Model::WriteRequest> writeRequests;
+  Callback callback;
+
+  std::mutex mutex;
+  size_t nextChunkStart{0};
+  size_t chunksInFlight{0};
+  bool finished{false};
+};
+
+Aws::DynamoDB::Model::DeleteItemRequest
+create_delete_item_request(const Item &item) {
   Aws::DynamoDB::Model::DeleteItemRequest request;
   request.SetTableName(item.getTableName());
   PrimaryKeyDescriptor pk = item.getPrimaryKeyDescriptor();
@@ -39,63 +172,551 @@ void DatabaseManagerBase::innerRemoveItem(const Item &item) {
         *pk.sortKey,
         Aws::DynamoDB::Model::AttributeValue(*primaryKeyValue.sortKey));
   }
+  return request;
+}
+
+// Chunks retried at the same time get different jitters, so that they don't
+// all hit the table again at once
+size_t get_backoff_delay(
+    size_t backoffFirstRetryDelay,
+    size_t maxBackoffTime,
+    size_t retry) {
+  thread_local std::minstd_rand generator{std::random_device{}()};
+  const size_t jitterMs =
+      std::uniform_int_distribution<size_t>{1, 99}(generator);
+  return std::min(
+      size_t(backoffFirstRetryDelay * std::pow(2, retry) + jitterMs),
+      maxBackoffTime);
+}
+
+// Moves the requests of a chunk into a batch request instead of copying them
+Aws::DynamoDB::Model::BatchWriteItemRequest create_chunk_request(
+    const std::string &tableName,
+    std::vector<Aws::DynamoDB::Model::WriteRequest> &writeRequests,
+    size_t chunkStart,
+    size_t chunkEnd) {
+  Aws::DynamoDB::Model::BatchWriteItemRequest request;
+  request.AddRequestItems(
+      tableName,
+      std::vector<Aws::DynamoDB::Model::WriteRequest>(
+          std::make_move_iterator(writeRequests.begin() + chunkStart),
+          std::make_move_iterator(writeRequests.begin() + chunkEnd)));
+  return request;
+}
+
+void write_chunk_async(
+    std::shared_ptr<BatchWriteContext> context,
+    const Aws::DynamoDB::Model::BatchWriteItemRequest &request,
+    size_t retry,
+    size_t lastDelayMs,
+    Callback callback);
 
+void send_chunk_async(
+    std::shared_ptr<BatchWriteContext> context,
+    const Aws::DynamoDB::Model::BatchWriteItemRequest &request,
+    size_t retry,
+    size_t lastDelayMs,
+    Callback callback) {
+  const auto start = std::chrono::steady_clock::now();
+  getDynamoDBClient()->BatchWriteItemAsync(
+      request,
+      [context, retry, lastDelayMs, callback, start](
+          const Aws::DynamoDB::DynamoDBClient *client,
+          const Aws::DynamoDB::Model::BatchWriteItemRequest &request,
+          const Aws::DynamoDB::Model::BatchWriteItemOutcome &outcome,
+          const std::shared_ptr<const Aws::Client::AsyncCallerContext>
+              &callerContext) {
+        recordDatabaseRequest(
+            DatabaseOperation::BATCH_WRITE_ITEM, start, outcome.IsSuccess());
+        const auto &unprocessedItems =
+            outcome.GetResult().GetUnprocessedItems();
+        DynamoDBRateLimiter::getInstance(context->tableName)
+            .recordResponse(
+                start,
+                outcome.IsSuccess() ? !unprocessedItems.empty()
+                                    : isThrottlingError(outcome));
+        std::unique_ptr<std::string> err = getOutcomeError(outcome);
+        if (err != nullptr) {
+          callback(std::move(err));
+          return;
+        }
+        if (unprocessedItems.empty()) {
+          callback(nullptr);
+          return;
+        }
+        if (lastDelayMs == context->maxBackoffTime) {
+          callback(std::make_unique<std::string>(
+              "InnerBatchWriteItem error: maximum wait time to put "
+              "unprocessed items to DynamoDB is exceeded."));
+          return;
+        }
+        const size_t delayMs = get_backoff_delay(
+            context->backoffFirstRetryDelay, context->maxBackoffTime, retry);
+        LOG_EVERY_MS(INFO, LOGGING_REPEATED_LINE_INTERVAL_MS)
+            << "Waiting for a backoff " << delayMs
+            << "ms delay before putting unprocessed items from batch write "
+               "to DynamoDB";
+        Aws::DynamoDB::Model::BatchWriteItemRequest retryRequest;
+        retryRequest.SetRequestItems(unprocessedItems);
+        TimingWheel::getInstance().schedule(
+            std::chrono::milliseconds(delayMs),
+            [context, retryRequest, retry, delayMs, callback]() {
+              write_chunk_async(
+                  context, retryRequest, retry + 1, delayMs, callback);
+            });
+      });
+}
+
+// Writes one chunk, retrying its unprocessed items with a backoff that is
+// waited for on a timer, so that no thread is blocked in the meantime
+void write_chunk_async(
+    std::shared_ptr<BatchWriteContext> context,
+    const Aws::DynamoDB::Model::BatchWriteItemRequest &request,
+    size_t retry,
+    size_t lastDelayMs,
+    Callback callback) {
+  sendWhenAllowed(
+      context->tableName, [context, request, retry, lastDelayMs, callback]() {
+        send_chunk_async(context, request, retry, lastDelayMs, callback);
+      });
+}
+
+void finish_chunk_async(
+    std::shared_ptr<BatchWriteContext> context,
+    std::unique_ptr<std::string> err);
+
+// Every chunk that finishes starts the next one, so that at most
+// maxParallelChunks are written at a time, and a chunk that waits for
+// a retry only holds up its own slot
+void write_next_chunk_async(std::shared_ptr<BatchWriteContext> context) {
+  Aws::DynamoDB::Model::BatchWriteItemRequest request;
+  {
+    const std::lock_guard<std::mutex> lock(context->mutex);
+    const size_t chunkStart = context->nextChunkStart;
+    if (context->finished || chunkStart >= context->writeRequests.size()) {
+      return;
+    }
+    const size_t chunkEnd = std::min(
+        context->writeRequests.size(), chunkStart + context->chunkSize);
+    context->nextChunkStart = chunkEnd;
+    context->chunksInFlight++;
+    request = create_chunk_request(
+        context->tableName, context->writeRequests, chunkStart, chunkEnd);
+  }
+  write_chunk_async(
+      context, request, 0, 0, [context](std::unique_ptr<std::string> err) {
+        finish_chunk_async(context, std::move(err));
+      });
+}
+
+void finish_chunk_async(
+    std::shared_ptr<BatchWriteContext> context,
+    std::unique_ptr<std::string> err) {
+  bool finished;
+  {
+    const std::lock_guard<std::mutex> lock(context->mutex);
+    context->chunksInFlight--;
+    if (context->finished) {
+      return;
+    }
+    finished = err != nullptr ||
+        (context->chunksInFlight == 0 &&
+         context->nextChunkStart >= context->writeRequests.size());
+    context->finished = finished;
+  }
+  if (finished) {
+    // The first error fails the whole batch, but chunks that are already
+    // being written are let to finish
+    context->callback(std::move(err));
+    return;
+  }
+  write_next_chunk_async(context);
+}
+} // namespace
+
+void recordDatabaseRequest(
+    DatabaseOperation operation,
+    std::chrono::steady_clock::time_point start,
+    bool success) {
+  DatabaseMetrics &databaseMetrics = get_database_metrics();
+  const size_t index = static_cast<size_t>(operation);
+  databaseMetrics.durations[index]->recordSince(start);
+  if (!success) {
+    databaseMetrics.errors[index]->increment();
+  }
+}
+
+uint64_t getDatabaseRequestPercentile(
+    DatabaseOperation operation,
+    double percentile,
+    size_t minCount) {
+  const metrics::Histogram &durations =
+      *get_database_metrics().durations[static_cast<size_t>(operation)];
+  if (durations.getCount() < minCount) {
+    return 0;
+  }
+  return durations.getPercentile(percentile);
+}
+
+const metrics::Histogram &
+getDatabaseRequestDurations(DatabaseOperation operation) {
+  return *get_database_metrics().durations[static_cast<size_t>(operation)];
+}
+
+Callback settlePromise(std::shared_ptr<std::promise<void>> promise) {
+  return [promise](std::unique_ptr<std::string> err) {
+    if (err != nullptr) {
+      promise->set_exception(
+          std::make_exception_ptr(std::runtime_error(*err)));
+      return;
+    }
+    promise->set_value();
+  };
+}
+
+void sendWhenAllowed(const std::string &tableName, std::function<void()> send) {
+  const std::chrono::steady_clock::duration delay =
+      DynamoDBRateLimiter::getInstance(tableName).reserve();
+  if (delay.count() <= 0) {
+    send();
+    return;
+  }
+  // Waited for on the thread of the TimingWheel rather than on the
+  // ThreadPool, so that it can't be starved by pool tasks that wait for a
+  // batch write
+  TimingWheel::getInstance().schedule(delay, std::move(send));
+}
+
+void DatabaseManagerBase::innerPutItem(
+    std::shared_ptr<Item> item,
+    const Aws::DynamoDB::Model::PutItemRequest &request) {
+  DynamoDBRateLimiter &limiter =
+      DynamoDBRateLimiter::getInstance(request.GetTableName());
+  limiter.acquire();
+  const auto start = std::chrono::steady_clock::now();
+  const Aws::DynamoDB::Model::PutItemOutcome outcome =
+      getDynamoDBClient()->PutItem(request);
+  recordDatabaseRequest(
+      DatabaseOperation::PUT_ITEM, start, outcome.IsSuccess());
+  limiter.recordResponse(start, isThrottlingError(outcome));
+  if (!outcome.IsSuccess()) {
+    throw std::runtime_error(outcome.GetError().GetMessage());
+  }
+}
+
+Aws::DynamoDB::Model::GetItemOutcome DatabaseManagerBase::innerGetItem(
+    const Aws::DynamoDB::Model::GetItemRequest &request,
+    const bool &hedge) {
+  DynamoDBRateLimiter &limiter =
+      DynamoDBRateLimiter::getInstance(request.GetTableName());
+  limiter.acquire();
+  const uint64_t hedgeDelayUs = hedge
+      ? getDatabaseRequestPercentile(
+            DatabaseOperation::GET_ITEM,
+            DYNAMODB_HEDGE_PERCENTILE,
+            DYNAMODB_HEDGE_MIN_REQUESTS)
+      : 0;
+  if (!hedgeDelayUs) {
+    const auto start = std::chrono::steady_clock::now();
+    Aws::DynamoDB::Model::GetItemOutcome outcome =
+        getDynamoDBClient()->GetItem(request);
+    recordDatabaseRequest(
+        DatabaseOperation::GET_ITEM, start, outcome.IsSuccess());
+    limiter.recordResponse(start, isThrottlingError(outcome));
+    return outcome;
+  }
+  HedgingBudget &budget = get_hedging_budget();
+  budget.earn();
+  std::shared_ptr<HedgedGetItem> context = std::make_shared<HedgedGetItem>();
+  std::future<Aws::DynamoDB::Model::GetItemOutcome> outcome =
+      context->outcome.get_future();
+  send_hedged_get_item(context, request, false);
+  if (outcome.wait_for(std::chrono::microseconds(hedgeDelayUs)) ==
+      std::future_status::ready) {
+    return outcome.get();
+  }
+  // A throttled table would only be slowed down further by the hedges
+  if (limiter.getRate() == 0 && budget.spend()) {
+    limiter.reserve();
+    budget.sent->increment();
+    send_hedged_get_item(context, request, true);
+  }
+  return outcome.get();
+}
+
+bool DatabaseManagerBase::innerRemoveItemIfExists(
+    Aws::DynamoDB::Model::DeleteItemRequest &request,
+    const std::string &partitionKey) {
+  setItemExistsCondition(request, partitionKey);
+  DynamoDBRateLimiter &limiter =
+      DynamoDBRateLimiter::getInstance(request.GetTableName());
+  limiter.acquire();
+  const auto start = std::chrono::steady_clock::now();
   const Aws::DynamoDB::Model::DeleteItemOutcome &outcome =
       getDynamoDBClient()->DeleteItem(request);
+  recordDatabaseRequest(
+      DatabaseOperation::DELETE_ITEM,
+      start,
+      outcome.IsSuccess() || isConditionalCheckFailure(outcome));
+  limiter.recordResponse(start, isThrottlingError(outcome));
+  if (isConditionalCheckFailure(outcome)) {
+    return false;
+  }
   if (!outcome.IsSuccess()) {
     throw std::runtime_error(outcome.GetError().GetMessage());
   }
+  return true;
 }
 
-void DatabaseManagerBase::innerBatchWriteItem(
+std::vector<AttributeValues> DatabaseManagerBase::innerBatchGetItems(
     const std::string &tableName,
+    const std::vector<AttributeValues> &keys,
     const size_t &chunkSize,
     const size_t &backoffFirstRetryDelay,
-    const size_t &maxBackoffTime,
-    std::vector<Aws::DynamoDB::Model::WriteRequest> &writeRequests) {
-  // Split write requests to chunks by chunkSize size and write
-  // them by batch
-  Aws::DynamoDB::Model::BatchWriteItemOutcome outcome;
-  std::vector<Aws::DynamoDB::Model::WriteRequest> writeRequestsChunk;
-  std::vector<Aws::DynamoDB::Model::WriteRequest>::iterator chunkPositionStart,
-      chunkPositionEnd;
-  for (size_t i = 0; i < writeRequests.size(); i += chunkSize) {
-    chunkPositionStart = writeRequests.begin() + i;
-    chunkPositionEnd =
-        writeRequests.begin() + std::min(writeRequests.size(), i + chunkSize);
-    writeRequestsChunk = std::vector<Aws::DynamoDB::Model::WriteRequest>(
-        chunkPositionStart, chunkPositionEnd);
-
-    Aws::DynamoDB::Model::BatchWriteItemRequest writeBatchRequest;
-    writeBatchRequest.AddRequestItems(tableName, writeRequestsChunk);
-    outcome = getDynamoDBClient()->BatchWriteItem(writeBatchRequest);
-    if (!outcome.IsSuccess()) {
-      throw std::runtime_error(outcome.GetError().GetMessage());
-    }
+    const size_t &maxBackoffTime) {
+  DynamoDBRateLimiter &limiter = DynamoDBRateLimiter::getInstance(tableName);
+  std::vector<AttributeValues> items;
+  for (size_t i = 0; i < keys.size(); i += chunkSize) {
+    Aws::DynamoDB::Model::KeysAndAttributes keysChunk;
+    keysChunk.SetKeys(std::vector<AttributeValues>(
+        keys.begin() + i, keys.begin() + std::min(keys.size(), i + chunkSize)));
+    Aws::DynamoDB::Model::BatchGetItemRequest request;
+    request.AddRequestItems(tableName, keysChunk);
 
-    size_t delayRetry, delayMs, jitterMs;
-    while (!outcome.GetResult().GetUnprocessedItems().empty()) {
+    size_t delayRetry = 0, delayMs = 0;
+    while (true) {
+      limiter.acquire();
+      const auto start = std::chrono::steady_clock::now();
+      const Aws::DynamoDB::Model::BatchGetItemOutcome outcome =
+          getDynamoDBClient()->BatchGetItem(request);
+      recordDatabaseRequest(
+          DatabaseOperation::BATCH_GET_ITEM, start, outcome.IsSuccess());
+      limiter.recordResponse(
+          start,
+          outcome.IsSuccess()
+              ? !outcome.GetResult().GetUnprocessedKeys().empty()
+              : isThrottlingError(outcome));
+      if (!outcome.IsSuccess()) {
+        throw std::runtime_error(outcome.GetError().GetMessage());
+      }
+      const auto &responses = outcome.GetResult().GetResponses();
+      const auto tableResponses = responses.find(tableName);
+      if (tableResponses != responses.end()) {
+        items.insert(
+            items.end(),
+            tableResponses->second.begin(),
+            tableResponses->second.end());
+      }
+      const auto &unprocessedKeys = outcome.GetResult().GetUnprocessedKeys();
+      if (unprocessedKeys.empty()) {
+        break;
+      }
       if (delayMs == maxBackoffTime) {
         throw std::runtime_error(
-            "InnerBatchWriteItem error: maximum wait time to put unprocessed "
-            "items to DynamoDB is exceeded.");
+            "InnerBatchGetItems error: maximum wait time to get unprocessed "
+            "keys from DynamoDB is exceeded.");
       }
-      jitterMs = std::rand() % 99 + 1;
+      delayMs =
+          get_backoff_delay(backoffFirstRetryDelay, maxBackoffTime, delayRetry);
       delayRetry++;
-      delayMs = std::min(
-          size_t(backoffFirstRetryDelay * std::pow(2, delayRetry) + jitterMs),
-          maxBackoffTime);
-      LOG(INFO) << "Waiting for a backoff " << delayMs
-                << "ms delay before putting unprocessed items from batch write "
-                   "to DynamoDB";
+      LOG_EVERY_MS(INFO, LOGGING_REPEATED_LINE_INTERVAL_MS)
+          << "Waiting for a backoff " << delayMs
+          << "ms delay before getting unprocessed keys from batch get from "
+             "DynamoDB";
       std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
-      writeBatchRequest.SetRequestItems(
-          outcome.GetResult().GetUnprocessedItems());
-      outcome = getDynamoDBClient()->BatchWriteItem(writeBatchRequest);
-      if (!outcome.IsSuccess()) {
-        throw std::runtime_error(outcome.GetError().GetMessage());
-      }
+      request.SetRequestItems(unprocessedKeys);
+    }
+  }
+  return items;
+}
+
+void DatabaseManagerBase::innerQueryPages(
+    Aws::DynamoDB::Model::QueryRequest &request,
+    std::function<bool(const Aws::Vector<AttributeValues> &)> onPage) {
+  DynamoDBRateLimiter &limiter =
+      DynamoDBRateLimiter::getInstance(request.GetTableName());
+  while (true) {
+    limiter.acquire();
+    const auto start = std::chrono::steady_clock::now();
+    const Aws::DynamoDB::Model::QueryOutcome outcome =
+        getDynamoDBClient()->Query(request);
+    recordDatabaseRequest(
+        DatabaseOperation::QUERY, start, outcome.IsSuccess());
+    limiter.recordResponse(start, isThrottlingError(outcome));
+    if (!outcome.IsSuccess()) {
+      throw std::runtime_error(outcome.GetError().GetMessage());
+    }
+    const AttributeValues &lastEvaluatedKey =
+        outcome.GetResult().GetLastEvaluatedKey();
+    if (!onPage(outcome.GetResult().GetItems()) || lastEvaluatedKey.empty()) {
+      return;
+    }
+    request.SetExclusiveStartKey(lastEvaluatedKey);
+  }
+}
+
+void DatabaseManagerBase::innerScanPages(
+    Aws::DynamoDB::Model::ScanRequest &request,
+    std::function<bool(const Aws::Vector<AttributeValues> &)> onPage) {
+  DynamoDBRateLimiter &limiter =
+      DynamoDBRateLimiter::getInstance(request.GetTableName());
+  while (true) {
+    limiter.acquire();
+    const auto start = std::chrono::steady_clock::now();
+    const Aws::DynamoDB::Model::ScanOutcome outcome =
+        getDynamoDBClient()->Scan(request);
+    recordDatabaseRequest(DatabaseOperation::SCAN, start, outcome.IsSuccess());
+    limiter.recordResponse(start, isThrottlingError(outcome));
+    if (!outcome.IsSuccess()) {
+      throw std::runtime_error(outcome.GetError().GetMessage());
+    }
+    const AttributeValues &lastEvaluatedKey =
+        outcome.GetResult().GetLastEvaluatedKey();
+    if (!onPage(outcome.GetResult().GetItems()) || lastEvaluatedKey.empty()) {
+      return;
     }
+    request.SetExclusiveStartKey(lastEvaluatedKey);
+  }
+}
+
+void DatabaseManagerBase::innerRemoveItem(const Item &item) {
+  DynamoDBRateLimiter &limiter =
+      DynamoDBRateLimiter::getInstance(item.getTableName());
+  limiter.acquire();
+  const auto start = std::chrono::steady_clock::now();
+  const Aws::DynamoDB::Model::DeleteItemOutcome &outcome =
+      getDynamoDBClient()->DeleteItem(create_delete_item_request(item));
+  recordDatabaseRequest(
+      DatabaseOperation::DELETE_ITEM, start, outcome.IsSuccess());
+  limiter.recordResponse(start, isThrottlingError(outcome));
+  if (!outcome.IsSuccess()) {
+    throw std::runtime_error(outcome.GetError().GetMessage());
+  }
+}
+
+void DatabaseManagerBase::innerBatchWriteItem(
+    const std::string &tableName,
+    const size_t &chunkSize,
+    const size_t &backoffFirstRetryDelay,
+    const size_t &maxBackoffTime,
+    std::vector<Aws::DynamoDB::Model::WriteRequest> &writeRequests,
+    const size_t &maxParallelChunks) {
+  // Written by the async variant, so that the backoffs are timers of the
+  // TimingWheel instead of sleeps, and the calling thread only waits for the
+  // outcome
+  std::shared_ptr<std::promise<void>> written =
+      std::make_shared<std::promise<void>>();
+  std::future<void> writtenFuture = written->get_future();
+  this->innerBatchWriteItemAsync(
+      tableName,
+      chunkSize,
+      backoffFirstRetryDelay,
+      maxBackoffTime,
+      writeRequests,
+      settlePromise(written),
+      maxParallelChunks);
+  writtenFuture.get();
+}
+
+void DatabaseManagerBase::innerPutItemAsync(
+    const Aws::DynamoDB::Model::PutItemRequest &request,
+    Callback callback) {
+  sendWhenAllowed(request.GetTableName(), [request, callback]() {
+    const auto start = std::chrono::steady_clock::now();
+    getDynamoDBClient()->PutItemAsync(
+        request,
+        [callback, start](
+            const Aws::DynamoDB::DynamoDBClient *client,
+            const Aws::DynamoDB::Model::PutItemRequest &request,
+            const Aws::DynamoDB::Model::PutItemOutcome &outcome,
+            const std::shared_ptr<const Aws::Client::AsyncCallerContext>
+                &context) {
+          recordDatabaseRequest(
+              DatabaseOperation::PUT_ITEM, start, outcome.IsSuccess());
+          DynamoDBRateLimiter::getInstance(request.GetTableName())
+              .recordResponse(start, isThrottlingError(outcome));
+          callback(getOutcomeError(outcome));
+        });
+  });
+}
+
+void DatabaseManagerBase::innerRemoveItemAsync(
+    const Item &item,
+    Callback callback) {
+  sendWhenAllowed(
+      item.getTableName(),
+      [request = create_delete_item_request(item), callback]() {
+        const auto start = std::chrono::steady_clock::now();
+        getDynamoDBClient()->DeleteItemAsync(
+            request,
+            [callback, start](
+                const Aws::DynamoDB::DynamoDBClient *client,
+                const Aws::DynamoDB::Model::DeleteItemRequest &request,
+                const Aws::DynamoDB::Model::DeleteItemOutcome &outcome,
+                const std::shared_ptr<const Aws::Client::AsyncCallerContext>
+                    &context) {
+              recordDatabaseRequest(
+                  DatabaseOperation::DELETE_ITEM, start, outcome.IsSuccess());
+              DynamoDBRateLimiter::getInstance(request.GetTableName())
+                  .recordResponse(start, isThrottlingError(outcome));
+              callback(getOutcomeError(outcome));
+            });
+      });
+}
+
+void DatabaseManagerBase::innerRemoveItemIfExistsAsync(
+    Aws::DynamoDB::Model::DeleteItemRequest &request,
+    const std::string &partitionKey,
+    Callback callback) {
+  setItemExistsCondition(request, partitionKey);
+  sendWhenAllowed(request.GetTableName(), [request, callback]() {
+    const auto start = std::chrono::steady_clock::now();
+    getDynamoDBClient()->DeleteItemAsync(
+        request,
+        [callback, start](
+            const Aws::DynamoDB::DynamoDBClient *client,
+            const Aws::DynamoDB::Model::DeleteItemRequest &request,
+            const Aws::DynamoDB::Model::DeleteItemOutcome &outcome,
+            const std::shared_ptr<const Aws::Client::AsyncCallerContext>
+                &context) {
+          const bool conditionFailed = isConditionalCheckFailure(outcome);
+          recordDatabaseRequest(
+              DatabaseOperation::DELETE_ITEM,
+              start,
+              outcome.IsSuccess() || conditionFailed);
+          DynamoDBRateLimiter::getInstance(request.GetTableName())
+              .recordResponse(start, isThrottlingError(outcome));
+          if (conditionFailed) {
+            callback(nullptr);
+            return;
+          }
+          callback(getOutcomeError(outcome));
+        });
+  });
+}
+
+void DatabaseManagerBase::innerBatchWriteItemAsync(
+    const std::string &tableName,
+    const size_t &chunkSize,
+    const size_t &backoffFirstRetryDelay,
+    const size_t &maxBackoffTime,
+    std::vector<Aws::DynamoDB::Model::WriteRequest> &writeRequests,
+    Callback callback,
+    const size_t &maxParallelChunks) {
+  if (writeRequests.empty()) {
+    callback(nullptr);
+    return;
+  }
+  std::shared_ptr<BatchWriteContext> context =
+      std::make_shared<BatchWriteContext>();
+  context->tableName = tableName;
+  context->chunkSize = chunkSize;
+  context->backoffFirstRetryDelay = backoffFirstRetryDelay;
+  context->maxBackoffTime = maxBackoffTime;
+  context->writeRequests = std::move(writeRequests);
+  context->callback = callback;
+  for (size_t i = 0; i < std::max(maxParallelChunks, size_t(1)); i++) {
+    write_next_chunk_async(context);
   }
 }
 
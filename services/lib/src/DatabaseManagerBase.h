@@ -1,18 +1,113 @@
 #pragma once
 
 #include "DatabaseEntitiesTools.h"
+#include "DynamoDBRateLimiter.h"
 #include "DynamoDBTools.h"
+#include "Metrics.h"
+#include "ThreadPool.h"
 
 #include <aws/core/Aws.h>
+#include <aws/dynamodb/DynamoDBErrors.h>
+#include <aws/dynamodb/model/BatchGetItemRequest.h>
+#include <aws/dynamodb/model/BatchWriteItemRequest.h>
+#include <aws/dynamodb/model/DeleteItemRequest.h>
 #include <aws/dynamodb/model/GetItemRequest.h>
 #include <aws/dynamodb/model/PutItemRequest.h>
+#include <aws/dynamodb/model/QueryRequest.h>
+#include <aws/dynamodb/model/ScanRequest.h>
 
+#include <chrono>
+#include <functional>
+#include <future>
 #include <memory>
+#include <string>
+#include <vector>
 
 namespace comm {
 namespace network {
 namespace database {
 
+template <typename T>
+using FindItemCallback =
+    std::function<void(std::shared_ptr<T>, std::unique_ptr<std::string>)>;
+
+template <typename Outcome>
+std::unique_ptr<std::string> getOutcomeError(const Outcome &outcome) {
+  if (outcome.IsSuccess()) {
+    return nullptr;
+  }
+  return std::make_unique<std::string>(outcome.GetError().GetMessage());
+}
+
+// True if the request failed only because its ConditionExpression didn't
+// hold
+template <typename Outcome>
+bool isConditionalCheckFailure(const Outcome &outcome) {
+  return !outcome.IsSuccess() &&
+      outcome.GetError().GetErrorType() ==
+      Aws::DynamoDB::DynamoDBErrors::CONDITIONAL_CHECK_FAILED;
+}
+
+// True if the table couldn't take the request at its current rate, see
+// DynamoDBRateLimiter
+template <typename Outcome>
+bool isThrottlingError(const Outcome &outcome) {
+  if (outcome.IsSuccess()) {
+    return false;
+  }
+  const Aws::DynamoDB::DynamoDBErrors errorType =
+      outcome.GetError().GetErrorType();
+  return errorType ==
+      Aws::DynamoDB::DynamoDBErrors::PROVISIONED_THROUGHPUT_EXCEEDED ||
+      errorType == Aws::DynamoDB::DynamoDBErrors::THROTTLING ||
+      errorType == Aws::DynamoDB::DynamoDBErrors::REQUEST_LIMIT_EXCEEDED;
+}
+
+// Makes the request apply only to an item that exists, which saves reading
+// the item first
+template <typename Request>
+void setItemExistsCondition(Request &request, const std::string &partitionKey) {
+  request.SetConditionExpression("attribute_exists(#partitionKey)");
+  request.AddExpressionAttributeNames("#partitionKey", partitionKey);
+}
+
+enum class DatabaseOperation {
+  PUT_ITEM = 0,
+  GET_ITEM = 1,
+  BATCH_GET_ITEM = 2,
+  QUERY = 3,
+  DELETE_ITEM = 4,
+  BATCH_WRITE_ITEM = 5,
+  SCAN = 6,
+};
+
+// Records the duration of a single DynamoDB request and whether it failed in
+// the metrics, every retry of a batch request counts as a request
+void recordDatabaseRequest(
+    DatabaseOperation operation,
+    std::chrono::steady_clock::time_point start,
+    bool success);
+
+// Calls send right away, or once the rate limit of the table lets the
+// request through, without blocking the calling thread
+void sendWhenAllowed(const std::string &tableName, std::function<void()> send);
+
+// - returns an upper bound of the percentile, from 0 to 100, of the durations
+// of the requests since the start, in microseconds, 0 if there are fewer than
+// minCount of them
+uint64_t getDatabaseRequestPercentile(
+    DatabaseOperation operation,
+    double percentile,
+    size_t minCount);
+
+// The durations of the requests since the start, for windowed statistics
+const metrics::Histogram &
+getDatabaseRequestDurations(DatabaseOperation operation);
+
+// Returns a callback that settles the promise, so that a synchronous caller
+// can wait for async operations
+Callback settlePromise(std::shared_ptr<std::promise<void>> promise);
+
 // this class should be thread-safe in case any shared resources appear
 class DatabaseManagerBase {
 protected:
@@ -20,26 +115,99 @@ protected:
       std::shared_ptr<Item> item,
       const Aws::DynamoDB::Model::PutItemRequest &request);
 
+  // With hedge, a lookup that is slower than most is sent a second time, and
+  // the first response is taken. It is meant for the lookups on the critical
+  // path, and is skipped while the table is throttled or the hedges are over
+  // their budget.
+  template <typename T>
+  std::shared_ptr<T> innerFindItem(
+      Aws::DynamoDB::Model::GetItemRequest &request,
+      const bool &hedge = false);
+  Aws::DynamoDB::Model::GetItemOutcome innerGetItem(
+      const Aws::DynamoDB::Model::GetItemRequest &request,
+      const bool &hedge);
+
+  // Keys are looked up chunkSize at a time, and they have to be unique.
+  // Items are returned in no particular order, and keys that aren't found
+  // are skipped.
+  std::vector<AttributeValues> innerBatchGetItems(
+      const std::string &tableName,
+      const std::vector<AttributeValues> &keys,
+      const size_t &chunkSize,
+      const size_t &backoffFirstRetryDelay,
+      const size_t &maxBackoffTime);
+
   template <typename T>
-  std::shared_ptr<T>
-  innerFindItem(Aws::DynamoDB::Model::GetItemRequest &request);
+  std::vector<std::shared_ptr<T>> innerBatchFindItems(
+      const std::vector<AttributeValues> &keys,
+      const size_t &chunkSize,
+      const size_t &backoffFirstRetryDelay,
+      const size_t &maxBackoffTime);
+
+  // Follows LastEvaluatedKey until the query is exhausted or onPage returns
+  // false, so that results aren't cut off at the 1 MB limit of a single page
+  void innerQueryPages(
+      Aws::DynamoDB::Model::QueryRequest &request,
+      std::function<bool(const Aws::Vector<AttributeValues> &)> onPage);
+  // Same as innerQueryPages, for the background jobs that have to go over
+  // the whole table
+  void innerScanPages(
+      Aws::DynamoDB::Model::ScanRequest &request,
+      std::function<bool(const Aws::Vector<AttributeValues> &)> onPage);
 
   void innerRemoveItem(const Item &item);
+  // Deletes the item in a single request, and returns false if there is no
+  // item with the key of the request
+  bool innerRemoveItemIfExists(
+      Aws::DynamoDB::Model::DeleteItemRequest &request,
+      const std::string &partitionKey);
+  // Takes the write requests out of writeRequests. With maxParallelChunks
+  // above 1 the chunks are written concurrently, each retried on its own.
   void innerBatchWriteItem(
       const std::string &tableName,
       const size_t &chunkSize,
       const size_t &backoffFirstRetryDelay,
       const size_t &maxBackoffTime,
-      std::vector<Aws::DynamoDB::Model::WriteRequest> &writeRequests);
+      std::vector<Aws::DynamoDB::Model::WriteRequest> &writeRequests,
+      const size_t &maxParallelChunks = 1);
+
+  // The async variants return right after sending the request, and call the
+  // callback with an error message, or nullptr on success, once the request
+  // completes. Callbacks are called on the threads of the DynamoDB client, so
+  // they shouldn't block.
+  void innerPutItemAsync(
+      const Aws::DynamoDB::Model::PutItemRequest &request,
+      Callback callback);
+
+  template <typename T>
+  void innerFindItemAsync(
+      Aws::DynamoDB::Model::GetItemRequest &request,
+      FindItemCallback<T> callback);
+
+  void innerRemoveItemAsync(const Item &item, Callback callback);
+  // Succeeds also when there is no item with the key of the request
+  void innerRemoveItemIfExistsAsync(
+      Aws::DynamoDB::Model::DeleteItemRequest &request,
+      const std::string &partitionKey,
+      Callback callback);
+  // Takes the write requests out of writeRequests
+  void innerBatchWriteItemAsync(
+      const std::string &tableName,
+      const size_t &chunkSize,
+      const size_t &backoffFirstRetryDelay,
+      const size_t &maxBackoffTime,
+      std::vector<Aws::DynamoDB::Model::WriteRequest> &writeRequests,
+      Callback callback,
+      const size_t &maxParallelChunks = 1);
 };
 
 template <typename T>
 std::shared_ptr<T> DatabaseManagerBase::innerFindItem(
-    Aws::DynamoDB::Model::GetItemRequest &request) {
-  std::shared_ptr<T> item = createItemByType<T>();
-  request.SetTableName(item->getTableName());
-  const Aws::DynamoDB::Model::GetItemOutcome &outcome =
-      getDynamoDBClient()->GetItem(request);
+    Aws::DynamoDB::Model::GetItemRequest &request,
+    const bool &hedge) {
+  request.SetTableName(T().getTableName());
+  const Aws::DynamoDB::Model::GetItemOutcome outcome =
+      this->innerGetItem(request, hedge);
   if (!outcome.IsSuccess()) {
     throw std::runtime_error(outcome.GetError().GetMessage());
   }
@@ -47,10 +215,74 @@ std::shared_ptr<T> DatabaseManagerBase::innerFindItem(
   if (!outcomeItem.size()) {
     return nullptr;
   }
+  std::shared_ptr<T> item = createItemByType<T>();
   item->assignItemFromDatabase(outcomeItem);
   return item;
 }
 
+template <typename T>
+std::vector<std::shared_ptr<T>> DatabaseManagerBase::innerBatchFindItems(
+    const std::vector<AttributeValues> &keys,
+    const size_t &chunkSize,
+    const size_t &backoffFirstRetryDelay,
+    const size_t &maxBackoffTime) {
+  std::vector<AttributeValues> foundItems = this->innerBatchGetItems(
+      T().getTableName(),
+      keys,
+      chunkSize,
+      backoffFirstRetryDelay,
+      maxBackoffTime);
+  std::vector<std::shared_ptr<T>> items;
+  items.reserve(foundItems.size());
+  for (const AttributeValues &foundItem : foundItems) {
+    std::shared_ptr<T> item = createItemByType<T>();
+    item->assignItemFromDatabase(foundItem);
+    items.push_back(std::move(item));
+  }
+  return items;
+}
+
+template <typename T>
+void DatabaseManagerBase::innerFindItemAsync(
+    Aws::DynamoDB::Model::GetItemRequest &request,
+    FindItemCallback<T> callback) {
+  request.SetTableName(T().getTableName());
+  sendWhenAllowed(request.GetTableName(), [request, callback]() {
+    const auto start = std::chrono::steady_clock::now();
+    getDynamoDBClient()->GetItemAsync(
+        request,
+        [callback, start](
+            const Aws::DynamoDB::DynamoDBClient *client,
+            const Aws::DynamoDB::Model::GetItemRequest &request,
+            const Aws::DynamoDB::Model::GetItemOutcome &outcome,
+            const std::shared_ptr<const Aws::Client::AsyncCallerContext>
+                &context) {
+          recordDatabaseRequest(
+              DatabaseOperation::GET_ITEM, start, outcome.IsSuccess());
+          DynamoDBRateLimiter::getInstance(request.GetTableName())
+              .recordResponse(start, isThrottlingError(outcome));
+          std::unique_ptr<std::string> err = getOutcomeError(outcome);
+          if (err != nullptr) {
+            callback(nullptr, std::move(err));
+            return;
+          }
+          const AttributeValues &outcomeItem = outcome.GetResult().GetItem();
+          if (!outcomeItem.size()) {
+            callback(nullptr, nullptr);
+            return;
+          }
+          std::shared_ptr<T> item = createItemByType<T>();
+          try {
+            item->assignItemFromDatabase(outcomeItem);
+          } catch (std::exception &e) {
+            callback(nullptr, std::make_unique<std::string>(e.what()));
+            return;
+          }
+          callback(item, nullptr);
+        });
+  });
+}
+
 } // namespace database
 } // namespace network
 } // namespace comm
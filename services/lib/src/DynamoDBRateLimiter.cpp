@@ -0,0 +1,170 @@
+#include "DynamoDBRateLimiter.h"
+
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+
+namespace comm {
+namespace network {
+namespace database {
+
+namespace {
+const std::chrono::seconds MEASUREMENT_WINDOW(1);
+
+std::string get_table_labels(const std::string &tableName) {
+  return "table=\"" + tableName + "\"";
+}
+} // namespace
+
+DynamoDBRateLimiter &
+DynamoDBRateLimiter::getInstance(const std::string &tableName) {
+  static std::mutex limitersMutex;
+  // Never removed, as the services use a few tables for their whole lifetime
+  static std::unordered_map<std::string, std::unique_ptr<DynamoDBRateLimiter>>
+      limiters;
+  const std::lock_guard<std::mutex> lock(limitersMutex);
+  std::unique_ptr<DynamoDBRateLimiter> &limiter = limiters[tableName];
+  if (limiter == nullptr) {
+    limiter = std::make_unique<DynamoDBRateLimiter>(tableName);
+    DynamoDBRateLimiter *instance = limiter.get();
+    metrics::MetricsRegistry::getInstance().registerGaugeFunction(
+        "comm_dynamodb_rate_limit",
+        "Requests per second a throttled table is limited to, 0 if it isn't",
+        get_table_labels(tableName),
+        [instance]() { return instance->getRate(); });
+  }
+  return *limiter;
+}
+
+DynamoDBRateLimiter::DynamoDBRateLimiter(
+    const std::string &tableName,
+    double minRate,
+    double decrease,
+    double increase,
+    std::chrono::steady_clock::duration idleTimeout)
+    : minRate(minRate),
+      decrease(decrease),
+      increase(increase),
+      idleTimeout(idleTimeout) {
+  metrics::MetricsRegistry &registry = metrics::MetricsRegistry::getInstance();
+  const std::string labels = get_table_labels(tableName);
+  this->throttles = &registry.getCounter(
+      "comm_dynamodb_throttled_requests_total",
+      "DynamoDB requests that were throttled, fully or in part",
+      labels);
+  this->delays = &registry.getHistogram(
+      "comm_dynamodb_rate_limit_delay_seconds",
+      "How long requests waited for the rate limit of a throttled table",
+      labels);
+}
+
+void DynamoDBRateLimiter::refill(std::chrono::steady_clock::time_point now) {
+  // Other threads may have read the clock a bit later, but taken the lock
+  // first
+  if (now <= this->lastRefill) {
+    return;
+  }
+  const double elapsed =
+      std::chrono::duration<double>(now - this->lastRefill).count();
+  this->lastRefill = now;
+  // Bursts are cut to a tenth of a second of requests
+  this->tokens = std::min(
+      this->tokens + elapsed * this->rate, std::max(1.0, this->rate / 10));
+}
+
+double DynamoDBRateLimiter::getMeasuredRate(
+    std::chrono::steady_clock::time_point now) const {
+  const double windowSeconds =
+      std::chrono::duration<double>(now - this->windowStart).count();
+  if (windowSeconds <= 0) {
+    return this->measuredRate;
+  }
+  return std::max(this->measuredRate, this->windowRequests / windowSeconds);
+}
+
+std::chrono::steady_clock::duration
+DynamoDBRateLimiter::reserve(std::chrono::steady_clock::time_point now) {
+  std::chrono::steady_clock::duration delay{0};
+  {
+    const std::lock_guard<std::mutex> lock(this->limiterMutex);
+    if (now - this->windowStart >= MEASUREMENT_WINDOW) {
+      this->measuredRate = this->windowRequests /
+          std::chrono::duration<double>(now - this->windowStart).count();
+      this->windowStart = now;
+      this->windowRequests = 0;
+    }
+    this->windowRequests++;
+    if (!this->limited) {
+      return delay;
+    }
+    this->refill(now);
+    this->tokens--;
+    if (this->tokens >= 0) {
+      return delay;
+    }
+    delay = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(-this->tokens / this->rate));
+  }
+  this->delays->record(
+      std::chrono::duration_cast<std::chrono::microseconds>(delay).count());
+  return delay;
+}
+
+void DynamoDBRateLimiter::acquire() {
+  const std::chrono::steady_clock::duration delay = this->reserve();
+  if (delay.count() > 0) {
+    std::this_thread::sleep_for(delay);
+  }
+}
+
+void DynamoDBRateLimiter::recordResponse(
+    std::chrono::steady_clock::time_point sentAt,
+    bool throttled,
+    std::chrono::steady_clock::time_point now) {
+  if (throttled) {
+    this->throttles->increment();
+  }
+  const std::lock_guard<std::mutex> lock(this->limiterMutex);
+  if (!throttled) {
+    if (!this->limited) {
+      return;
+    }
+    if (now - this->lastThrottle >= this->idleTimeout) {
+      this->limited = false;
+      return;
+    }
+    // About `increase` per second at the current rate
+    this->rate += this->increase / this->rate;
+    return;
+  }
+  this->lastThrottle = now;
+  if (!this->limited) {
+    // The table can't take the rate that was measured
+    this->limited = true;
+    this->rate = std::max(
+        this->minRate, this->getMeasuredRate(now) * this->decrease);
+    this->tokens = 0;
+    this->lastRefill = now;
+    this->lastDecrease = now;
+    return;
+  }
+  if (sentAt < this->lastDecrease) {
+    return;
+  }
+  this->rate = std::max(this->minRate, this->rate * this->decrease);
+  this->lastDecrease = now;
+}
+
+double DynamoDBRateLimiter::getRate() const {
+  const std::lock_guard<std::mutex> lock(this->limiterMutex);
+  return this->limited ? this->rate : 0;
+}
+
+const metrics::Histogram &DynamoDBRateLimiter::getDelays() const {
+  return *this->delays;
+}
+
+} // namespace database
+} // namespace network
+} // namespace comm
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "GlobalConstants.h"
+#include "Metrics.h"
+
+#include <chrono>
+#include <mutex>
+#include <string>
+
+namespace comm {
+namespace network {
+namespace database {
+
+// Limits the rate of the requests to a table once it starts throttling them,
+// for all the threads of the service at once, so that they back off together
+// instead of each retrying on its own. Throttling lowers the rate by
+// `decrease`, and every success raises it by about `increase` per second,
+// so the rate settles just under the capacity of the table. Requests aren't
+// limited until the first throttle, nor after idleTimeout without one.
+//
+// The rate, the throttles and the delays are exported as metrics with the
+// table label.
+class DynamoDBRateLimiter {
+  const double minRate;
+  const double decrease;
+  const double increase;
+  const std::chrono::steady_clock::duration idleTimeout;
+
+  mutable std::mutex limiterMutex;
+  bool limited = false;
+  // Requests per second, while limited
+  double rate = 0;
+  // Negative while requests are waiting for the tokens they took
+  double tokens = 0;
+  std::chrono::steady_clock::time_point lastRefill;
+  std::chrono::steady_clock::time_point lastThrottle;
+  // Throttles of the requests sent before it don't lower the rate again, as
+  // they were sent at the old rate
+  std::chrono::steady_clock::time_point lastDecrease;
+  // The rate of the requests is measured over windows of a second
+  std::chrono::steady_clock::time_point windowStart;
+  size_t windowRequests = 0;
+  double measuredRate = 0;
+
+  metrics::Counter *throttles;
+  metrics::Histogram *delays;
+
+  void refill(std::chrono::steady_clock::time_point now);
+  double getMeasuredRate(std::chrono::steady_clock::time_point now) const;
+
+public:
+  static DynamoDBRateLimiter &getInstance(const std::string &tableName);
+
+  DynamoDBRateLimiter(
+      const std::string &tableName,
+      double minRate = DYNAMODB_RATE_LIMIT_MIN,
+      double decrease = DYNAMODB_RATE_LIMIT_DECREASE,
+      double increase = DYNAMODB_RATE_LIMIT_INCREASE,
+      std::chrono::steady_clock::duration idleTimeout =
+          std::chrono::milliseconds(DYNAMODB_RATE_LIMIT_IDLE_MS));
+
+  // Takes the token of a request
+  // - returns how long the request has to wait before it is sent
+  std::chrono::steady_clock::duration
+  reserve(std::chrono::steady_clock::time_point now =
+              std::chrono::steady_clock::now());
+  // Takes the token of a request and waits for it on the calling thread
+  void acquire();
+  // - argument sentAt - when the request was sent
+  // - argument throttled - whether the table throttled the request, or any
+  // part of a batch request
+  void recordResponse(
+      std::chrono::steady_clock::time_point sentAt,
+      bool throttled,
+      std::chrono::steady_clock::time_point now =
+          std::chrono::steady_clock::now());
+  // - returns the rate in requests per second, or 0 while not limited
+  double getRate() const;
+  // How long the requests waited for their tokens
+  const metrics::Histogram &getDelays() const;
+
+  DynamoDBRateLimiter(DynamoDBRateLimiter const &) = delete;
+  void operator=(DynamoDBRateLimiter const &) = delete;
+};
+
+} // namespace database
+} // namespace network
+} // namespace comm
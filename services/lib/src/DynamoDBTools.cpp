@@ -2,17 +2,52 @@
 #include "GlobalConstants.h"
 #include "GlobalTools.h"
 
+#include <aws/core/utils/threading/Executor.h>
+
+#include <mutex>
+
 namespace comm {
 namespace network {
 
-std::unique_ptr<Aws::DynamoDB::DynamoDBClient> getDynamoDBClient() {
+namespace {
+std::mutex client_mutex;
+DynamoDBClientOptions client_options;
+std::shared_ptr<Aws::DynamoDB::DynamoDBClient> client;
+} // namespace
+
+void configureDynamoDBClient(const DynamoDBClientOptions &options) {
+  const std::lock_guard<std::mutex> lock(client_mutex);
+  client_options = options;
+  client.reset();
+}
+
+std::shared_ptr<Aws::DynamoDB::DynamoDBClient> getDynamoDBClient() {
+  const std::lock_guard<std::mutex> lock(client_mutex);
+  if (client != nullptr) {
+    return client;
+  }
   Aws::Client::ClientConfiguration config;
   config.region = AWS_REGION;
   if (tools::isSandbox()) {
     config.endpointOverride = Aws::String("localstack:4566");
     config.scheme = Aws::Http::Scheme::HTTP;
   }
-  return std::make_unique<Aws::DynamoDB::DynamoDBClient>(config);
+  config.maxConnections = client_options.maxConnections;
+  config.connectTimeoutMs = client_options.connectTimeoutMs;
+  config.requestTimeoutMs = client_options.requestTimeoutMs;
+  config.enableTcpKeepAlive = client_options.enableTcpKeepAlive;
+  config.tcpKeepAliveIntervalMs = client_options.tcpKeepAliveIntervalMs;
+  // The default executor starts a new thread for every async request
+  config.executor =
+      Aws::MakeShared<Aws::Utils::Threading::PooledThreadExecutor>(
+          "DynamoDBClient", client_options.maxConnections);
+  client = std::make_shared<Aws::DynamoDB::DynamoDBClient>(config);
+  return client;
+}
+
+void releaseDynamoDBClient() {
+  const std::lock_guard<std::mutex> lock(client_mutex);
+  client.reset();
 }
 
 } // namespace network
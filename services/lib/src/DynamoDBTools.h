@@ -8,7 +8,24 @@
 namespace comm {
 namespace network {
 
-std::unique_ptr<Aws::DynamoDB::DynamoDBClient> getDynamoDBClient();
+struct DynamoDBClientOptions {
+  unsigned maxConnections{64};
+  long connectTimeoutMs{1000};
+  long requestTimeoutMs{3000};
+  bool enableTcpKeepAlive{true};
+  unsigned long tcpKeepAliveIntervalMs{30000};
+};
+
+// Takes effect for the client created by the next call to getDynamoDBClient,
+// so it should be called once at startup, after Aws::InitAPI
+void configureDynamoDBClient(const DynamoDBClientOptions &options);
+
+// Returns the client shared by the whole process, which keeps its connection
+// pool and credentials between requests. It is safe to use from any thread.
+std::shared_ptr<Aws::DynamoDB::DynamoDBClient> getDynamoDBClient();
+
+// The client has to be released before Aws::ShutdownAPI
+void releaseDynamoDBClient();
 
 } // namespace network
 } // namespace comm
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 
 namespace comm {
@@ -20,12 +21,104 @@ namespace network {
 const size_t GRPC_CHUNK_SIZE_LIMIT = 4 * 1024 * 1024;
 const size_t GRPC_METADATA_SIZE_PER_MESSAGE = 5;
 
+// Bounds of the chunks picked by AdaptiveChunker. The upper one leaves room
+// for the other fields of a message and the grpc headers.
+const size_t ADAPTIVE_CHUNK_SIZE_MIN = 16 * 1024;
+const size_t ADAPTIVE_CHUNK_SIZE_INITIAL = 256 * 1024;
+const size_t ADAPTIVE_CHUNK_SIZE_MAX =
+    GRPC_CHUNK_SIZE_LIMIT - 64 * 1024 - GRPC_METADATA_SIZE_PER_MESSAGE;
+
 const std::string AWS_REGION = "us-east-2";
 
 const char ATTACHMENT_DELIMITER = ';';
 
+// Chunk compression (see ChunkCompressor)
+const std::string CHUNK_COMPRESSION_METADATA_KEY = "comm-chunk-compression";
+const std::string CHUNK_COMPRESSION_ZSTD = "zstd";
+const int CHUNK_COMPRESSION_DEFAULT_LEVEL = 3;
+// Smaller chunks are not worth compressing
+const size_t CHUNK_COMPRESSION_MIN_SIZE = 1024;
+
+// Multipart blob puts (see ClientMultipartPutReactorBase.h)
+// The blob service uploads every part as a single S3 part, so all the parts
+// but the last have to be at least as large as the S3 minimum, and no part
+// can be larger than the service is willing to hold in memory
+const uint64_t MULTIPART_PUT_PART_SIZE_MIN = 5 * 1024 * 1024;
+const uint64_t MULTIPART_PUT_PART_SIZE_DEFAULT = 16 * 1024 * 1024;
+const uint64_t MULTIPART_PUT_PART_SIZE_MAX = 64 * 1024 * 1024;
+const size_t MULTIPART_PUT_PARTS_MAX = 10000;
+
 // gRPC Server
 const std::string SERVER_LISTEN_ADDRESS = "0.0.0.0:50051";
+// Messages that finished reactors leave for the next ones, per message type
+// (see RecycledMessages in ReactorMessagePool.h). Larger messages are freed,
+// so that a few big ones don't keep their memory forever.
+const size_t REACTOR_RECYCLED_MESSAGES_SIZE = 1024;
+const size_t REACTOR_RECYCLED_MESSAGE_MAX_BYTES = 64 * 1024;
+
+// Metrics (see Metrics.h)
+// Upper bounds of the exported histogram buckets, in microseconds, they are
+// powers of 4 from 16us to about 67s
+const size_t METRICS_HISTOGRAM_FIRST_BOUND_US = 16;
+const size_t METRICS_HISTOGRAM_EXPORTED_BUCKETS = 12;
+// The scrape endpoint gives up on a client that doesn't send its request
+const size_t METRICS_SERVER_READ_TIMEOUT_MS = 5000;
+
+// Profiling (see Profiler.h), the defaults and limits of the parameters of
+// the /debug/pprof requests
+const size_t PROFILING_DEFAULT_SECONDS = 30;
+const size_t PROFILING_MAX_SECONDS = 300;
+const size_t PROFILING_DEFAULT_CPU_HZ = 100;
+// SIGPROF comes on the ticks of the kernel, usually 250 of them per second,
+// past that there would be fewer samples than the period in the profile
+// claims
+const size_t PROFILING_MAX_CPU_HZ = 250;
+// Allocations are sampled once every this many bytes on average
+const size_t PROFILING_DEFAULT_HEAP_INTERVAL_BYTES = 512 * 1024;
+// Samples past this number are dropped, the buffer takes about 400 bytes per
+// sample while a profile runs
+const size_t PROFILING_MAX_SAMPLES = 32 * 1024;
+const size_t PROFILING_MAX_FRAMES = 48;
+
+// Tracing (see Tracing.h)
+const std::string TRACING_OTLP_PATH = "/v1/traces";
+// Finished spans are exported at least this often, or once this many of them
+// have been collected
+const size_t TRACING_EXPORT_INTERVAL_MS = 1000;
+const size_t TRACING_EXPORT_BATCH_SIZE = 512;
+// Spans past this number are dropped while the collector is slow or down
+const size_t TRACING_MAX_QUEUED_SPANS = 8192;
+const size_t TRACING_EXPORT_TIMEOUT_MS = 3000;
+
+// DynamoDB rate limiting (see DynamoDBRateLimiter.h)
+// Lowest rate a throttled table is limited to, in requests per second
+const double DYNAMODB_RATE_LIMIT_MIN = 1;
+// By how much the rate of a table is lowered on a throttle, and raised every
+// second without one
+const double DYNAMODB_RATE_LIMIT_DECREASE = 0.7;
+const double DYNAMODB_RATE_LIMIT_INCREASE = 5;
+// The limit is lifted after this long without a throttle
+const size_t DYNAMODB_RATE_LIMIT_IDLE_MS = 60 * 1000;
+
+// DynamoDB hedged reads (see DatabaseManagerBase::innerFindItem)
+// A lookup that takes longer than this percentile of the lookups is sent again
+const double DYNAMODB_HEDGE_PERCENTILE = 95;
+// Percentiles of fewer lookups aren't trusted
+const size_t DYNAMODB_HEDGE_MIN_REQUESTS = 100;
+// Every hedged lookup earns this part of a hedge, so the hedges add at most
+// 5% to the reads. Unused hedges are kept up to the burst.
+const double DYNAMODB_HEDGE_BUDGET_RATIO = 0.05;
+const double DYNAMODB_HEDGE_BUDGET_BURST = 10;
+
+// Logging (see Logging.h)
+// A power of two. Lines past it are dropped while the output is slow.
+const size_t LOGGING_QUEUE_CAPACITY = 2048;
+// Longer lines are cut
+const size_t LOGGING_MAX_LINE_LENGTH = 1024;
+const size_t LOGGING_WRITE_INTERVAL_MS = 10;
+const size_t LOGGING_FLUSH_TIMEOUT_MS = 1000;
+// For the lines of retry loops and the like, see LOG_EVERY_MS
+const size_t LOGGING_REPEATED_LINE_INTERVAL_MS = 10000;
 
 } // namespace network
 } // namespace comm
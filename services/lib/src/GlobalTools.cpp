@@ -1,15 +1,16 @@
 #include "GlobalTools.h"
+#include "Logging.h"
 
 #include <glog/logging.h>
+#include <openssl/crypto.h>
+#include <openssl/rand.h>
 #include <openssl/sha.h>
-#include <boost/uuid/uuid.hpp>
-#include <boost/uuid/uuid_generators.hpp>
-#include <boost/uuid/uuid_io.hpp>
 
 #include <algorithm>
 #include <chrono>
+#include <cstring>
 #include <iomanip>
-#include <regex>
+#include <stdexcept>
 #include <string>
 #include <thread>
 
@@ -46,26 +47,97 @@ bool isSandbox() {
   return hasEnvFlag("COMM_SERVICES_SANDBOX");
 }
 
+namespace {
+
+const size_t RANDOM_BYTES_BUFFER_SIZE = 512;
+
+// Random bytes are taken from OpenSSL in bulk and handed out from a buffer of
+// the thread
+struct RandomBytesBuffer {
+  unsigned char bytes[RANDOM_BYTES_BUFFER_SIZE];
+  size_t position = RANDOM_BYTES_BUFFER_SIZE;
+};
+
+
+const size_t UUID_LENGTH = 36;
+
+struct CharacterTable {
+  bool contains[256] = {};
+
+  constexpr CharacterTable(const char *characters) {
+    for (; *characters; characters++) {
+      this->contains[static_cast<unsigned char>(*characters)] = true;
+    }
+  }
+};
+
+constexpr CharacterTable LOWERCASE_HEX_DIGITS("0123456789abcdef");
+
+} // namespace
+
+void fillRandomBytes(unsigned char *bytes, size_t size) {
+  thread_local RandomBytesBuffer buffer;
+  while (size) {
+    if (buffer.position == RANDOM_BYTES_BUFFER_SIZE) {
+      if (RAND_bytes(buffer.bytes, RANDOM_BYTES_BUFFER_SIZE) != 1) {
+        throw std::runtime_error("Error: can not generate random bytes");
+      }
+      buffer.position = 0;
+    }
+    const size_t count =
+        std::min(size, RANDOM_BYTES_BUFFER_SIZE - buffer.position);
+    std::memcpy(bytes, buffer.bytes + buffer.position, count);
+    // The bytes are handed out only once
+    OPENSSL_cleanse(buffer.bytes + buffer.position, count);
+    buffer.position += count;
+    bytes += count;
+    size -= count;
+  }
+}
+
 std::string generateUUID() {
-  thread_local boost::uuids::random_generator random_generator;
-  return boost::uuids::to_string(random_generator());
+  unsigned char bytes[16];
+  fillRandomBytes(bytes, sizeof(bytes));
+  // Version 4, variant 1
+  bytes[6] = (bytes[6] & 0x0f) | 0x40;
+  bytes[8] = (bytes[8] & 0x3f) | 0x80;
+  static const char HEX_DIGITS[] = "0123456789abcdef";
+  std::string uuid(UUID_LENGTH, '-');
+  size_t position = 0;
+  for (size_t i = 0; i < sizeof(bytes); i++) {
+    if (position == 8 || position == 13 || position == 18 || position == 23) {
+      position++;
+    }
+    uuid[position++] = HEX_DIGITS[bytes[i] >> 4];
+    uuid[position++] = HEX_DIGITS[bytes[i] & 0x0f];
+  }
+  return uuid;
 }
 
-bool validateUUIDv4(const std::string &uuid) {
-  const std::regex uuidV4RegexFormat(
-      "^[0-9a-f]{8}-[0-9a-f]{4}-4[0-9a-f]{3}-[89ab][0-9a-f]{3}-[0-9a-f]{12}$");
-  try {
-    return std::regex_match(uuid, uuidV4RegexFormat);
-  } catch (const std::exception &e) {
-    LOG(ERROR) << "Tools: "
-               << "Got an exception at `validateUUID`: " << e.what();
+bool validateUUID(const std::string &uuid) {
+  if (uuid.size() != UUID_LENGTH) {
     return false;
   }
+  for (size_t i = 0; i < UUID_LENGTH; i++) {
+    const unsigned char character = uuid[i];
+    if (i == 8 || i == 13 || i == 18 || i == 23) {
+      if (character != '-') {
+        return false;
+      }
+    } else if (!LOWERCASE_HEX_DIGITS.contains[character]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool validateUUIDv4(const std::string &uuid) {
+  return validateUUID(uuid) && uuid[14] == '4' &&
+      (uuid[19] == '8' || uuid[19] == '9' || uuid[19] == 'a' ||
+       uuid[19] == 'b');
 }
 
 void InitLogging(const std::string &programName) {
-  FLAGS_logtostderr = true;
-  FLAGS_colorlogtostderr = true;
   if (comm::network::tools::isSandbox()) {
     // Log levels INFO, WARNING, ERROR, FATAL are 0, 1, 2, 3, respectively
     FLAGS_minloglevel = 0;
@@ -73,6 +145,7 @@ void InitLogging(const std::string &programName) {
     FLAGS_minloglevel = 1;
   }
   google::InitGoogleLogging(programName.c_str());
+  logging::startAsyncLogging();
 }
 
 } // namespace tools
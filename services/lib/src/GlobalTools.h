@@ -19,8 +19,14 @@ std::string decorateTableName(const std::string &baseName);
 
 bool isSandbox();
 
+// Cryptographically secure, throws if OpenSSL can't provide the bytes
+void fillRandomBytes(unsigned char *bytes, size_t size);
+
 std::string generateUUID();
 
+// Lowercase hexadecimal UUID of any version, e.g. a session ID
+bool validateUUID(const std::string &uuid);
+
 bool validateUUIDv4(const std::string &uuid);
 
 void InitLogging(const std::string &programName);
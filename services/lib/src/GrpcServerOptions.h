@@ -0,0 +1,33 @@
+#pragma once
+
+#include "GlobalConstants.h"
+
+#include <cstddef>
+#include <string>
+
+namespace comm {
+namespace network {
+
+// Tuning of the gRPC server of a service, read from its config so that the
+// capacity of a node can be changed without a rebuild. Zero leaves the gRPC
+// default of any of the numbers.
+struct GrpcServerOptions {
+  std::string listenAddress{SERVER_LISTEN_ADDRESS};
+  // Completion queues and pollers of the sync API
+  unsigned completionQueues{0};
+  unsigned minPollers{0};
+  unsigned maxPollers{0};
+  // Resource quota of the server, new streams are refused once the buffers
+  // take maxMemoryBytes or the threads of the sync API reach maxThreads
+  size_t maxMemoryBytes{0};
+  unsigned maxThreads{0};
+  // Per connection
+  unsigned maxConcurrentStreams{0};
+  unsigned keepAliveIntervalMs{0};
+  unsigned keepAliveTimeoutMs{0};
+  size_t maxReceiveMessageSize{GRPC_CHUNK_SIZE_LIMIT};
+  size_t maxSendMessageSize{GRPC_CHUNK_SIZE_LIMIT};
+};
+
+} // namespace network
+} // namespace comm
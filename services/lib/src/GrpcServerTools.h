@@ -0,0 +1,68 @@
+#pragma once
+
+#include "GrpcServerOptions.h"
+
+#include <grpcpp/grpcpp.h>
+#include <grpcpp/resource_quota.h>
+
+namespace comm {
+namespace network {
+
+// Makes the builder listen on the address of the options, without
+// credentials, and applies the rest of them. Every C++ service should build
+// its server with it, so that they are all tuned the same way.
+inline void configureGrpcServerBuilder(
+    grpc::ServerBuilder &builder,
+    const GrpcServerOptions &options) {
+  builder.AddListeningPort(
+      options.listenAddress, grpc::InsecureServerCredentials());
+  if (options.completionQueues) {
+    builder.SetSyncServerOption(
+        grpc::ServerBuilder::SyncServerOption::NUM_CQS,
+        options.completionQueues);
+  }
+  if (options.minPollers) {
+    builder.SetSyncServerOption(
+        grpc::ServerBuilder::SyncServerOption::MIN_POLLERS,
+        options.minPollers);
+  }
+  if (options.maxPollers) {
+    builder.SetSyncServerOption(
+        grpc::ServerBuilder::SyncServerOption::MAX_POLLERS,
+        options.maxPollers);
+  }
+  if (options.maxMemoryBytes || options.maxThreads) {
+    grpc::ResourceQuota quota("comm-grpc-server");
+    if (options.maxMemoryBytes) {
+      quota.Resize(options.maxMemoryBytes);
+    }
+    if (options.maxThreads) {
+      quota.SetMaxThreads(options.maxThreads);
+    }
+    builder.SetResourceQuota(quota);
+  }
+  if (options.maxConcurrentStreams) {
+    builder.AddChannelArgument(
+        GRPC_ARG_MAX_CONCURRENT_STREAMS, options.maxConcurrentStreams);
+  }
+  if (options.keepAliveIntervalMs) {
+    builder.AddChannelArgument(
+        GRPC_ARG_KEEPALIVE_TIME_MS, options.keepAliveIntervalMs);
+    // So that idle streams, e.g. of the clients waiting for messages, are
+    // checked too
+    builder.AddChannelArgument(GRPC_ARG_KEEPALIVE_PERMIT_WITHOUT_CALLS, 1);
+  }
+  if (options.keepAliveTimeoutMs) {
+    builder.AddChannelArgument(
+        GRPC_ARG_KEEPALIVE_TIMEOUT_MS, options.keepAliveTimeoutMs);
+  }
+  if (options.maxReceiveMessageSize) {
+    builder.SetMaxReceiveMessageSize(options.maxReceiveMessageSize);
+  }
+  if (options.maxSendMessageSize) {
+    builder.SetMaxSendMessageSize(options.maxSendMessageSize);
+  }
+}
+
+} // namespace network
+} // namespace comm
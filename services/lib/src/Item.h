@@ -34,6 +34,16 @@ struct PrimaryKeyValue : PrimaryKeyBase {
   using PrimaryKeyBase::PrimaryKeyBase;
 };
 
+// AttributeValue hands out string values as copies, so assigning GetS() to
+// a member straight away copies the value a second time. Decoding through
+// this moves it into place instead, which matters for large fields like
+// message payloads.
+inline std::string getStringAttribute(
+    const AttributeValues &itemFromDB,
+    const std::string &field) {
+  return itemFromDB.at(field).GetS();
+}
+
 class Item {
   virtual void validate() const = 0;
 
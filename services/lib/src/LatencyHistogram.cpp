@@ -0,0 +1,83 @@
+#include "LatencyHistogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace comm {
+namespace network {
+
+size_t LatencyHistogram::getBucket(uint64_t value) {
+  if (value < SUB_BUCKETS) {
+    return value;
+  }
+  size_t exponent = 63;
+  while (!(value >> exponent)) {
+    exponent--;
+  }
+  if (exponent > MAX_EXPONENT) {
+    return BUCKETS - 1;
+  }
+  // The highest bit is implied by the exponent, the next ones pick the
+  // sub-bucket
+  const size_t shift = exponent - SUB_BUCKET_BITS + 1;
+  const size_t subBucket = (value >> shift) - SUB_BUCKETS / 2;
+  return SUB_BUCKETS + (shift - 1) * (SUB_BUCKETS / 2) + subBucket;
+}
+
+uint64_t LatencyHistogram::getBucketLimit(size_t bucket) {
+  if (bucket < SUB_BUCKETS) {
+    return bucket;
+  }
+  const size_t shift = (bucket - SUB_BUCKETS) / (SUB_BUCKETS / 2) + 1;
+  const uint64_t subBucket =
+      (bucket - SUB_BUCKETS) % (SUB_BUCKETS / 2) + SUB_BUCKETS / 2;
+  return ((subBucket + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t value) {
+  this->counts[getBucket(value)].fetch_add(1, std::memory_order_relaxed);
+  this->count.fetch_add(1, std::memory_order_relaxed);
+  this->sum.fetch_add(value, std::memory_order_relaxed);
+  uint64_t currentMax = this->max.load(std::memory_order_relaxed);
+  while (value > currentMax &&
+         !this->max.compare_exchange_weak(
+             currentMax, value, std::memory_order_relaxed)) {
+  }
+}
+
+uint64_t LatencyHistogram::getCount() const {
+  return this->count.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::getMax() const {
+  return this->max.load(std::memory_order_relaxed);
+}
+
+double LatencyHistogram::getMean() const {
+  const uint64_t count = this->getCount();
+  if (!count) {
+    return 0;
+  }
+  return static_cast<double>(this->sum.load(std::memory_order_relaxed)) /
+      count;
+}
+
+uint64_t LatencyHistogram::getPercentile(double percentile) const {
+  const uint64_t count = this->getCount();
+  if (!count) {
+    return 0;
+  }
+  const uint64_t rank = std::max<uint64_t>(
+      1, static_cast<uint64_t>(std::ceil(percentile / 100 * count)));
+  uint64_t seen = 0;
+  for (size_t bucket = 0; bucket < BUCKETS; bucket++) {
+    seen += this->counts[bucket].load(std::memory_order_relaxed);
+    if (seen >= rank && bucket != BUCKETS - 1) {
+      return std::min(getBucketLimit(bucket), this->getMax());
+    }
+  }
+  return this->getMax();
+}
+
+} // namespace network
+} // namespace comm
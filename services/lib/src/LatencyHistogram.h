@@ -0,0 +1,45 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace comm {
+namespace network {
+
+// Counts values in buckets whose width grows with the value, like an HDR
+// histogram: every power of two is split into SUB_BUCKETS / 2 buckets, so
+// that percentiles are accurate to about 3% at any scale. Values should be
+// recorded in microseconds. It is lock-free, any thread can record values.
+class LatencyHistogram {
+  static const size_t SUB_BUCKET_BITS = 6;
+  static const size_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+  // Covers values up to 2^40 microseconds, the larger ones go to the last
+  // bucket
+  static const size_t MAX_EXPONENT = 40;
+  static const size_t BUCKETS =
+      SUB_BUCKETS + (MAX_EXPONENT - SUB_BUCKET_BITS + 1) * (SUB_BUCKETS / 2);
+
+  std::array<std::atomic<uint64_t>, BUCKETS> counts{};
+  std::atomic<uint64_t> count{0};
+  std::atomic<uint64_t> sum{0};
+  std::atomic<uint64_t> max{0};
+
+  static size_t getBucket(uint64_t value);
+  // The largest value that lands in the bucket
+  static uint64_t getBucketLimit(size_t bucket);
+
+public:
+  void record(uint64_t value);
+  uint64_t getCount() const;
+  uint64_t getMax() const;
+  double getMean() const;
+  // - argument percentile - from 0 to 100
+  // - returns the value below which the percentile of the recorded values
+  // lies, 0 if nothing has been recorded
+  uint64_t getPercentile(double percentile) const;
+};
+
+} // namespace network
+} // namespace comm
@@ -0,0 +1,346 @@
+#include "Logging.h"
+#include "GlobalConstants.h"
+#include "Metrics.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace comm {
+namespace network {
+namespace logging {
+
+namespace {
+
+int64_t steadyNowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+metrics::Counter &getSuppressedLinesCounter() {
+  static metrics::Counter &counter =
+      metrics::MetricsRegistry::getInstance().getCounter(
+          "comm_log_lines_suppressed_total",
+          "Log lines suppressed by the rate limits of their call sites");
+  return counter;
+}
+
+struct LogRecord {
+  google::LogSeverity severity;
+  std::chrono::system_clock::time_point time;
+  // The base names that glog passes point into __FILE__ literals
+  const char *file;
+  int line;
+  size_t length;
+  char message[LOGGING_MAX_LINE_LENGTH];
+};
+
+// Bounded queue of many producers and one consumer, after the one of Dmitry
+// Vyukov. A slot is claimed by moving the enqueue position, its sequence
+// tells whether it's free to write, or to read once written.
+class LogQueue {
+  struct Slot {
+    std::atomic<size_t> sequence;
+    LogRecord record;
+  };
+
+  const std::unique_ptr<Slot[]> slots;
+  std::atomic<size_t> enqueuePosition{0};
+  std::atomic<size_t> dequeuePosition{0};
+
+public:
+  LogQueue() : slots(new Slot[LOGGING_QUEUE_CAPACITY]) {
+    for (size_t i = 0; i < LOGGING_QUEUE_CAPACITY; i++) {
+      this->slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  // Returns false if the queue is full
+  template <typename Fill> bool tryPush(Fill fill) {
+    size_t position = this->enqueuePosition.load(std::memory_order_relaxed);
+    Slot *slot;
+    while (true) {
+      slot = &this->slots[position & (LOGGING_QUEUE_CAPACITY - 1)];
+      const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+      const int64_t difference =
+          static_cast<int64_t>(sequence) - static_cast<int64_t>(position);
+      if (difference == 0) {
+        if (this->enqueuePosition.compare_exchange_weak(
+                position, position + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (difference < 0) {
+        return false;
+      } else {
+        position = this->enqueuePosition.load(std::memory_order_relaxed);
+      }
+    }
+    fill(slot->record);
+    slot->sequence.store(position + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Only called by the consumer, returns false if the queue is empty
+  template <typename Read> bool tryPop(Read read) {
+    const size_t position =
+        this->dequeuePosition.load(std::memory_order_relaxed);
+    Slot &slot = this->slots[position & (LOGGING_QUEUE_CAPACITY - 1)];
+    if (slot.sequence.load(std::memory_order_acquire) != position + 1) {
+      return false;
+    }
+    read(slot.record);
+    slot.sequence.store(
+        position + LOGGING_QUEUE_CAPACITY, std::memory_order_release);
+    this->dequeuePosition.store(position + 1, std::memory_order_release);
+    return true;
+  }
+
+  size_t getEnqueuePosition() const {
+    return this->enqueuePosition.load(std::memory_order_acquire);
+  }
+
+  size_t getDequeuePosition() const {
+    return this->dequeuePosition.load(std::memory_order_acquire);
+  }
+};
+
+void appendTime(std::string &out, std::chrono::system_clock::time_point time) {
+  const std::time_t seconds = std::chrono::system_clock::to_time_t(time);
+  const int64_t microseconds =
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          time.time_since_epoch())
+          .count() %
+      1000000;
+  std::tm utcTime;
+  gmtime_r(&seconds, &utcTime);
+  char buffer[32];
+  const size_t length =
+      std::strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &utcTime);
+  out.append(buffer, length);
+  std::snprintf(
+      buffer, sizeof(buffer), ".%06dZ", static_cast<int>(microseconds));
+  out += buffer;
+}
+
+void appendQuoted(std::string &out, const char *text, size_t length) {
+  out += '"';
+  for (size_t i = 0; i < length; i++) {
+    const char character = text[i];
+    if (character == '"' || character == '\\') {
+      out += '\\';
+      out += character;
+    } else if (character == '\n') {
+      out += "\\n";
+    } else if (character == '\t') {
+      out += "\\t";
+    } else if (static_cast<unsigned char>(character) < 0x20) {
+      out += ' ';
+    } else {
+      out += character;
+    }
+  }
+  out += '"';
+}
+
+void appendLine(std::string &out, const LogRecord &record) {
+  out += "time=";
+  appendTime(out, record.time);
+  out += " level=";
+  out += google::GetLogSeverityName(record.severity);
+  out += " caller=";
+  out += record.file;
+  out += ':';
+  out += std::to_string(record.line);
+  out += " msg=";
+  appendQuoted(out, record.message, record.length);
+  out += '\n';
+}
+
+class AsyncLogSink : public google::LogSink {
+  LogQueue queue;
+  std::atomic<uint64_t> droppedCount{0};
+  // The dequeue position of the queue once the lines are written
+  std::atomic<size_t> writtenPosition{0};
+  metrics::Counter &droppedLinesCounter;
+  metrics::Counter &writtenLinesCounter;
+
+  void run();
+  // Returns the number of lines written
+  size_t writeQueuedLines(std::string &buffer);
+
+public:
+  AsyncLogSink();
+  void send(
+      google::LogSeverity severity,
+      const char *fullFilename,
+      const char *baseFilename,
+      int line,
+      const struct ::tm *tmTime,
+      const char *message,
+      size_t messageLength) override;
+  void flush();
+};
+
+AsyncLogSink::AsyncLogSink()
+    : droppedLinesCounter(metrics::MetricsRegistry::getInstance().getCounter(
+          "comm_log_lines_dropped_total",
+          "Log lines dropped while the log queue was full")),
+      writtenLinesCounter(metrics::MetricsRegistry::getInstance().getCounter(
+          "comm_log_lines_written_total",
+          "Log lines written")) {
+  std::thread([this]() { this->run(); }).detach();
+}
+
+void AsyncLogSink::send(
+    google::LogSeverity severity,
+    const char *fullFilename,
+    const char *baseFilename,
+    int line,
+    const struct ::tm *tmTime,
+    const char *message,
+    size_t messageLength) {
+  const std::chrono::system_clock::time_point time =
+      std::chrono::system_clock::now();
+  const bool pushed = this->queue.tryPush([&](LogRecord &record) {
+    record.severity = severity;
+    record.time = time;
+    record.file = baseFilename;
+    record.line = line;
+    record.length = std::min(messageLength, LOGGING_MAX_LINE_LENGTH);
+    std::memcpy(record.message, message, record.length);
+  });
+  if (!pushed) {
+    this->droppedCount++;
+  }
+  if (severity == google::GLOG_FATAL) {
+    this->flush();
+  }
+}
+
+void AsyncLogSink::flush() {
+  const size_t position = this->queue.getEnqueuePosition();
+  const auto deadline = std::chrono::steady_clock::now() +
+      std::chrono::milliseconds(LOGGING_FLUSH_TIMEOUT_MS);
+  while (this->writtenPosition.load() < position &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+size_t AsyncLogSink::writeQueuedLines(std::string &buffer) {
+  buffer.clear();
+  size_t count = 0;
+  // Bounded, so that the buffer doesn't grow while lines keep coming
+  while (count < LOGGING_QUEUE_CAPACITY &&
+         this->queue.tryPop([&buffer](const LogRecord &record) {
+           appendLine(buffer, record);
+         })) {
+    count++;
+  }
+  const size_t position = this->queue.getDequeuePosition();
+  const uint64_t dropped = this->droppedCount.exchange(0);
+  if (dropped > 0) {
+    this->droppedLinesCounter.increment(dropped);
+    LogRecord record;
+    record.severity = google::GLOG_WARNING;
+    record.time = std::chrono::system_clock::now();
+    record.file = "Logging.cpp";
+    record.line = __LINE__;
+    const std::string message =
+        "Logging: dropped " + std::to_string(dropped) + " lines";
+    record.length = message.copy(record.message, LOGGING_MAX_LINE_LENGTH);
+    appendLine(buffer, record);
+    count++;
+  }
+  if (!buffer.empty()) {
+    std::fwrite(buffer.data(), 1, buffer.size(), stderr);
+    std::fflush(stderr);
+  }
+  this->writtenPosition = position;
+  return count;
+}
+
+void AsyncLogSink::run() {
+  std::string buffer;
+  while (true) {
+    const size_t count = this->writeQueuedLines(buffer);
+    this->writtenLinesCounter.increment(count);
+    if (count == 0) {
+      std::this_thread::sleep_for(
+          std::chrono::milliseconds(LOGGING_WRITE_INTERVAL_MS));
+    }
+  }
+}
+
+AsyncLogSink *getAsyncLogSink() {
+  // Never destroyed, the thread of the sink outlives the statics
+  static AsyncLogSink *sink = new AsyncLogSink();
+  return sink;
+}
+
+std::once_flag startedFlag;
+std::atomic<bool> started{false};
+
+} // namespace
+
+void startAsyncLogging() {
+  std::call_once(startedFlag, []() {
+    FLAGS_logtostderr = false;
+    FLAGS_alsologtostderr = false;
+    // glog writes nothing by itself anymore
+    FLAGS_stderrthreshold = google::NUM_SEVERITIES;
+    for (int severity = 0; severity < google::NUM_SEVERITIES; severity++) {
+      google::SetLogDestination(severity, "");
+    }
+    google::AddLogSink(getAsyncLogSink());
+    started = true;
+    std::atexit(flushLogs);
+  });
+}
+
+void flushLogs() {
+  if (started) {
+    getAsyncLogSink()->flush();
+  }
+}
+
+LogRateLimiter::LogRateLimiter(std::chrono::milliseconds interval)
+    : interval(interval) {
+}
+
+bool LogRateLimiter::tryAcquire(uint64_t &suppressed) {
+  const int64_t now = steadyNowNs();
+  int64_t nextLineAt = this->nextLineAt.load(std::memory_order_relaxed);
+  if (now < nextLineAt ||
+      !this->nextLineAt.compare_exchange_strong(
+          nextLineAt,
+          now +
+              std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  this->interval)
+                  .count(),
+          std::memory_order_relaxed)) {
+    this->suppressedCount++;
+    getSuppressedLinesCounter().increment();
+    return false;
+  }
+  suppressed = this->suppressedCount.exchange(0);
+  return true;
+}
+
+std::ostream &operator<<(std::ostream &stream, SuppressedLines lines) {
+  if (lines.count > 0) {
+    stream << "(" << lines.count << " similar lines suppressed) ";
+  }
+  return stream;
+}
+
+} // namespace logging
+} // namespace network
+} // namespace comm
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <glog/logging.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+namespace comm {
+namespace network {
+namespace logging {
+
+// Takes over the output of glog. The lines are handed to a thread of its own
+// through a lock-free queue, so logging never waits for the output, and are
+// written as logfmt, e.g.
+// time=2022-10-14T12:00:00.123456Z level=INFO caller=Tools.cpp:67 msg="..."
+// Lines past the capacity of the queue are dropped and counted. A FATAL line
+// waits for the lines before it to be written, as the process aborts then.
+void startAsyncLogging();
+
+// Waits until the lines logged so far have been written, for a limited time
+void flushLogs();
+
+// Lets one line through per interval, see LOG_EVERY_MS
+class LogRateLimiter {
+  const std::chrono::steady_clock::duration interval;
+  std::atomic<int64_t> nextLineAt{0};
+  std::atomic<uint64_t> suppressedCount{0};
+
+public:
+  explicit LogRateLimiter(std::chrono::milliseconds interval);
+  // If the line may be logged, returns true and the number of lines that
+  // were suppressed since the last one
+  bool tryAcquire(uint64_t &suppressed);
+};
+
+struct SuppressedLines {
+  uint64_t count;
+};
+
+std::ostream &operator<<(std::ostream &stream, SuppressedLines lines);
+
+} // namespace logging
+} // namespace network
+} // namespace comm
+
+// Like LOG, for the lines that may repeat on a hot path, e.g. in a retry
+// loop. Every call site logs at most once per interval, and the next line
+// that it logs tells how many were suppressed in between. The arguments
+// aren't evaluated for a suppressed line.
+#define LOG_EVERY_MS(severity, intervalMs)                                \
+  for (uint64_t commLogSuppressed = 0,                                    \
+                commLogPending =                                          \
+                    []() -> ::comm::network::logging::LogRateLimiter & {  \
+                      static ::comm::network::logging::LogRateLimiter     \
+                          limiter{std::chrono::milliseconds(intervalMs)}; \
+                      return limiter;                                     \
+                    }().tryAcquire(commLogSuppressed);                    \
+       commLogPending;                                                    \
+       commLogPending = 0)                                                \
+  LOG(severity) << ::comm::network::logging::SuppressedLines {            \
+    commLogSuppressed                                                     \
+  }
@@ -0,0 +1,117 @@
+#include "MappedFile.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+namespace comm {
+namespace network {
+
+namespace {
+std::runtime_error make_file_error(
+    const std::string &message,
+    const std::string &path,
+    int error) {
+  return std::runtime_error(
+      message + " " + path + ": " + std::strerror(error));
+}
+} // namespace
+
+MappedFile::MappedFile(const std::string &path) {
+  this->fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (this->fd < 0) {
+    throw make_file_error("couldn't open", path, errno);
+  }
+  struct stat info;
+  if (fstat(this->fd, &info) != 0) {
+    const int error = errno;
+    close(this->fd);
+    throw make_file_error("couldn't stat", path, error);
+  }
+  this->mappingSize = info.st_size;
+  try {
+    this->map(PROT_READ);
+  } catch (std::runtime_error &) {
+    close(this->fd);
+    throw;
+  }
+  // The uploads read the file once from the start to the end
+  if (this->mapping != nullptr) {
+    madvise(this->mapping, this->mappingSize, MADV_SEQUENTIAL);
+  }
+}
+
+MappedFile::MappedFile(const std::string &path, size_t size)
+    : mappingSize(size), writable(true) {
+  this->fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (this->fd < 0) {
+    throw make_file_error("couldn't create", path, errno);
+  }
+  try {
+    if (size > 0) {
+      // posix_fallocate returns the error instead of setting errno
+      const int error = posix_fallocate(this->fd, 0, size);
+      if (error != 0) {
+        throw make_file_error("couldn't allocate", path, error);
+      }
+    }
+    this->map(PROT_READ | PROT_WRITE);
+  } catch (std::runtime_error &) {
+    close(this->fd);
+    throw;
+  }
+}
+
+MappedFile::~MappedFile() {
+  if (this->mapping != nullptr) {
+    munmap(this->mapping, this->mappingSize);
+  }
+  close(this->fd);
+}
+
+void MappedFile::map(int protection) {
+  // Empty files can't be mapped
+  if (this->mappingSize == 0) {
+    return;
+  }
+  void *mapping = mmap(
+      nullptr, this->mappingSize, protection, MAP_SHARED, this->fd, 0);
+  if (mapping == MAP_FAILED) {
+    throw std::runtime_error(
+        std::string("couldn't map a file: ") + std::strerror(errno));
+  }
+  this->mapping = static_cast<char *>(mapping);
+}
+
+const char *MappedFile::data() const {
+  return this->mapping;
+}
+
+char *MappedFile::mutableData() {
+  if (!this->writable) {
+    throw std::runtime_error("the file is mapped for reading");
+  }
+  return this->mapping;
+}
+
+size_t MappedFile::size() const {
+  return this->mappingSize;
+}
+
+void MappedFile::flush() {
+  if (!this->writable || this->mapping == nullptr) {
+    return;
+  }
+  if (msync(this->mapping, this->mappingSize, MS_SYNC) != 0) {
+    throw std::runtime_error(
+        std::string("couldn't write a file back: ") + std::strerror(errno));
+  }
+}
+
+} // namespace network
+} // namespace comm
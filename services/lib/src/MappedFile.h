@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace comm {
+namespace network {
+
+// A local file mapped into memory, so that large uploads and downloads are
+// streamed between the file and the messages without holding the whole
+// payload in RAM. The pages are loaded and written back by the kernel.
+//
+// Both constructors throw std::runtime_error when the file can't be opened
+// or mapped.
+class MappedFile {
+  int fd = -1;
+  char *mapping = nullptr;
+  size_t mappingSize = 0;
+  bool writable = false;
+
+  void map(int protection);
+
+public:
+  // Maps an existing file for reading
+  explicit MappedFile(const std::string &path);
+  // Creates the file, or truncates an existing one, and allocates its
+  // blocks upfront, so that a full disk fails here instead of with a SIGBUS
+  // in the middle of the download. The file is mapped for writing.
+  MappedFile(const std::string &path, size_t size);
+  ~MappedFile();
+
+  MappedFile(MappedFile const &) = delete;
+  void operator=(MappedFile const &) = delete;
+
+  // nullptr for an empty file
+  const char *data() const;
+  // Throws for the files that are mapped for reading
+  char *mutableData();
+  size_t size() const;
+  // Writes the changes back to the file and waits for it
+  void flush();
+};
+
+} // namespace network
+} // namespace comm
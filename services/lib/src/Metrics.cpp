@@ -0,0 +1,287 @@
+#include "Metrics.h"
+#include "GlobalConstants.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+
+namespace comm {
+namespace network {
+namespace metrics {
+
+namespace {
+
+std::string formatValue(double value) {
+  char buffer[32];
+  std::snprintf(buffer, sizeof(buffer), "%.12g", value);
+  return buffer;
+}
+
+// Adds a label to the labels of a series
+std::string
+withLabel(const std::string &labels, const std::string &label) {
+  return "{" + (labels.empty() ? label : labels + "," + label) + "}";
+}
+
+std::string withLabels(const std::string &labels) {
+  return labels.empty() ? "" : "{" + labels + "}";
+}
+
+} // namespace
+
+void Counter::increment(uint64_t amount) {
+  this->value.fetch_add(amount, std::memory_order_relaxed);
+}
+
+uint64_t Counter::get() const {
+  return this->value.load(std::memory_order_relaxed);
+}
+
+void Gauge::set(int64_t value) {
+  this->value.store(value, std::memory_order_relaxed);
+}
+
+void Gauge::add(int64_t amount) {
+  this->value.fetch_add(amount, std::memory_order_relaxed);
+}
+
+int64_t Gauge::get() const {
+  return this->value.load(std::memory_order_relaxed);
+}
+
+size_t Histogram::getBucket(uint64_t value) {
+  if (value < SUB_BUCKETS) {
+    return value;
+  }
+  size_t exponent = 63;
+  while (!(value >> exponent)) {
+    exponent--;
+  }
+  if (exponent > MAX_EXPONENT) {
+    return BUCKETS - 1;
+  }
+  // The highest bit is implied by the exponent, the next ones pick the
+  // sub-bucket
+  const size_t shift = exponent - SUB_BUCKET_BITS + 1;
+  const size_t subBucket = (value >> shift) - SUB_BUCKETS / 2;
+  return SUB_BUCKETS + (shift - 1) * (SUB_BUCKETS / 2) + subBucket;
+}
+
+uint64_t Histogram::getBucketLimit(size_t bucket) {
+  if (bucket < SUB_BUCKETS) {
+    return bucket;
+  }
+  if (bucket == BUCKETS - 1) {
+    return UINT64_MAX;
+  }
+  const size_t shift = (bucket - SUB_BUCKETS) / (SUB_BUCKETS / 2) + 1;
+  const uint64_t subBucket =
+      (bucket - SUB_BUCKETS) % (SUB_BUCKETS / 2) + SUB_BUCKETS / 2;
+  return ((subBucket + 1) << shift) - 1;
+}
+
+void Histogram::record(uint64_t valueUs) {
+  this->counts[getBucket(valueUs)].fetch_add(1, std::memory_order_relaxed);
+  this->count.fetch_add(1, std::memory_order_relaxed);
+  this->sum.fetch_add(valueUs, std::memory_order_relaxed);
+}
+
+void Histogram::recordSince(std::chrono::steady_clock::time_point start) {
+  this->record(std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::steady_clock::now() - start)
+                   .count());
+}
+
+uint64_t Histogram::getCount() const {
+  return this->count.load(std::memory_order_relaxed);
+}
+
+uint64_t Histogram::getSumUs() const {
+  return this->sum.load(std::memory_order_relaxed);
+}
+
+uint64_t Histogram::getCountUpTo(uint64_t limitUs) const {
+  uint64_t count = 0;
+  for (size_t bucket = 0;
+       bucket < BUCKETS && getBucketLimit(bucket) <= limitUs;
+       bucket++) {
+    count += this->counts[bucket].load(std::memory_order_relaxed);
+  }
+  return count;
+}
+
+uint64_t Histogram::getPercentile(double percentile) const {
+  const uint64_t count = this->getCount();
+  if (!count) {
+    return 0;
+  }
+  const uint64_t rank = std::max<uint64_t>(
+      1, static_cast<uint64_t>(std::ceil(percentile / 100 * count)));
+  uint64_t seen = 0;
+  for (size_t bucket = 0; bucket < BUCKETS; bucket++) {
+    seen += this->counts[bucket].load(std::memory_order_relaxed);
+    if (seen >= rank) {
+      return getBucketLimit(bucket);
+    }
+  }
+  return getBucketLimit(BUCKETS - 1);
+}
+
+ScopedTimer::ScopedTimer(Histogram &histogram)
+    : histogram(histogram), start(std::chrono::steady_clock::now()) {
+}
+
+ScopedTimer::~ScopedTimer() {
+  this->histogram.recordSince(this->start);
+}
+
+LifetimeTracker::LifetimeTracker(const LifetimeMetrics &metrics)
+    : metrics(metrics), start(std::chrono::steady_clock::now()) {
+  this->metrics.alive.add(1);
+}
+
+LifetimeTracker::~LifetimeTracker() {
+  this->metrics.alive.add(-1);
+  this->metrics.lifetime.recordSince(this->start);
+}
+
+MetricsRegistry &MetricsRegistry::getInstance() {
+  // Never destroyed, the metrics are updated by threads that outlive the
+  // statics, like the one of the log sink
+  static MetricsRegistry *instance = new MetricsRegistry();
+  return *instance;
+}
+
+MetricsRegistry::Series &MetricsRegistry::getSeries(
+    const std::string &name,
+    const std::string &help,
+    MetricType type,
+    const std::string &labels) {
+  auto familyIterator = this->families.find(name);
+  if (familyIterator == this->families.end()) {
+    familyIterator =
+        this->families.emplace(name, Family{help, type, {}}).first;
+  }
+  Family &family = familyIterator->second;
+  if (family.type != type) {
+    throw std::runtime_error(
+        "metric " + name + " is already registered with another type");
+  }
+  for (std::unique_ptr<Series> &series : family.series) {
+    if (series->labels == labels) {
+      return *series;
+    }
+  }
+  family.series.push_back(std::make_unique<Series>());
+  family.series.back()->labels = labels;
+  return *family.series.back();
+}
+
+Counter &MetricsRegistry::getCounter(
+    const std::string &name,
+    const std::string &help,
+    const std::string &labels) {
+  const std::lock_guard<std::mutex> lock(this->registryMutex);
+  Series &series = this->getSeries(name, help, MetricType::COUNTER, labels);
+  if (series.counter == nullptr) {
+    series.counter = std::make_unique<Counter>();
+  }
+  return *series.counter;
+}
+
+Gauge &MetricsRegistry::getGauge(
+    const std::string &name,
+    const std::string &help,
+    const std::string &labels) {
+  const std::lock_guard<std::mutex> lock(this->registryMutex);
+  Series &series = this->getSeries(name, help, MetricType::GAUGE, labels);
+  if (series.gauge == nullptr) {
+    series.gauge = std::make_unique<Gauge>();
+  }
+  return *series.gauge;
+}
+
+Histogram &MetricsRegistry::getHistogram(
+    const std::string &name,
+    const std::string &help,
+    const std::string &labels) {
+  const std::lock_guard<std::mutex> lock(this->registryMutex);
+  Series &series = this->getSeries(name, help, MetricType::HISTOGRAM, labels);
+  if (series.histogram == nullptr) {
+    series.histogram = std::make_unique<Histogram>();
+  }
+  return *series.histogram;
+}
+
+void MetricsRegistry::registerGaugeFunction(
+    const std::string &name,
+    const std::string &help,
+    const std::string &labels,
+    std::function<double()> function) {
+  const std::lock_guard<std::mutex> lock(this->registryMutex);
+  this->getSeries(name, help, MetricType::GAUGE, labels).function =
+      std::move(function);
+}
+
+void MetricsRegistry::registerCounterFunction(
+    const std::string &name,
+    const std::string &help,
+    const std::string &labels,
+    std::function<double()> function) {
+  const std::lock_guard<std::mutex> lock(this->registryMutex);
+  this->getSeries(name, help, MetricType::COUNTER, labels).function =
+      std::move(function);
+}
+
+std::string MetricsRegistry::render() const {
+  static const char *typeNames[] = {"counter", "gauge", "histogram"};
+  const std::lock_guard<std::mutex> lock(this->registryMutex);
+  std::string output;
+  for (const auto &familyIterator : this->families) {
+    const std::string &name = familyIterator.first;
+    const Family &family = familyIterator.second;
+    output += "# HELP " + name + " " + family.help + "\n";
+    output += "# TYPE " + name + " " +
+        typeNames[static_cast<size_t>(family.type)] + "\n";
+    for (const std::unique_ptr<Series> &series : family.series) {
+      if (series->histogram != nullptr) {
+        const Histogram &histogram = *series->histogram;
+        uint64_t boundUs = METRICS_HISTOGRAM_FIRST_BOUND_US;
+        for (size_t i = 0; i < METRICS_HISTOGRAM_EXPORTED_BUCKETS; i++) {
+          output += name + "_bucket" +
+              withLabel(series->labels,
+                        "le=\"" + formatValue(boundUs / 1e6) + "\"") +
+              " " + std::to_string(histogram.getCountUpTo(boundUs - 1)) +
+              "\n";
+          boundUs *= 4;
+        }
+        const uint64_t count = histogram.getCount();
+        output += name + "_bucket" +
+            withLabel(series->labels, "le=\"+Inf\"") + " " +
+            std::to_string(count) + "\n";
+        output += name + "_sum" + withLabels(series->labels) + " " +
+            formatValue(histogram.getSumUs() / 1e6) + "\n";
+        output += name + "_count" + withLabels(series->labels) + " " +
+            std::to_string(count) + "\n";
+        continue;
+      }
+      std::string value;
+      if (series->function) {
+        value = formatValue(series->function());
+      } else if (series->counter != nullptr) {
+        value = std::to_string(series->counter->get());
+      } else if (series->gauge != nullptr) {
+        value = std::to_string(series->gauge->get());
+      } else {
+        continue;
+      }
+      output += name + withLabels(series->labels) + " " + value + "\n";
+    }
+  }
+  return output;
+}
+
+} // namespace metrics
+} // namespace network
+} // namespace comm
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace comm {
+namespace network {
+namespace metrics {
+
+class Counter {
+  std::atomic<uint64_t> value{0};
+
+public:
+  void increment(uint64_t amount = 1);
+  uint64_t get() const;
+};
+
+class Gauge {
+  std::atomic<int64_t> value{0};
+
+public:
+  void set(int64_t value);
+  void add(int64_t amount);
+  int64_t get() const;
+};
+
+// Durations are recorded in microseconds and exported in seconds. Like in an
+// HDR histogram, every power of two is split into SUB_BUCKETS / 2 buckets, so
+// percentiles are accurate to about 3% at any scale, while the export has
+// METRICS_HISTOGRAM_EXPORTED_BUCKETS buckets only.
+class Histogram {
+public:
+  static const size_t SUB_BUCKET_BITS = 6;
+  static const size_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+  // The larger values go to the last bucket
+  static const size_t MAX_EXPONENT = 40;
+  static const size_t BUCKETS =
+      SUB_BUCKETS + (MAX_EXPONENT - SUB_BUCKET_BITS + 1) * (SUB_BUCKETS / 2);
+
+private:
+  std::array<std::atomic<uint64_t>, BUCKETS> counts{};
+  std::atomic<uint64_t> count{0};
+  std::atomic<uint64_t> sum{0};
+
+  static size_t getBucket(uint64_t value);
+  // The largest value that lands in the bucket
+  static uint64_t getBucketLimit(size_t bucket);
+
+public:
+  void record(uint64_t valueUs);
+  void recordSince(std::chrono::steady_clock::time_point start);
+  uint64_t getCount() const;
+  uint64_t getSumUs() const;
+  // Number of the values that are at most limitUs, exact when limitUs + 1 is
+  // a power of two
+  uint64_t getCountUpTo(uint64_t limitUs) const;
+  // - argument percentile - from 0 to 100
+  // - returns an upper bound of the percentile, 0 if nothing was recorded
+  uint64_t getPercentile(double percentile) const;
+};
+
+// Records the time from its creation to its destruction
+class ScopedTimer {
+  Histogram &histogram;
+  const std::chrono::steady_clock::time_point start;
+
+public:
+  explicit ScopedTimer(Histogram &histogram);
+  ~ScopedTimer();
+};
+
+struct LifetimeMetrics {
+  Gauge &alive;
+  Histogram &lifetime;
+};
+
+// Counts the objects that are alive and records how long each of them has
+// lived, as a member of the object
+class LifetimeTracker {
+  const LifetimeMetrics &metrics;
+  const std::chrono::steady_clock::time_point start;
+
+public:
+  explicit LifetimeTracker(const LifetimeMetrics &metrics);
+  ~LifetimeTracker();
+
+  LifetimeTracker(LifetimeTracker const &) = delete;
+  void operator=(LifetimeTracker const &) = delete;
+};
+
+// Keeps every metric for the lifetime of the process, so the references that
+// it returns can be kept, e.g. in a static local, and updated without taking
+// its lock. Labels are given in the Prometheus format, e.g.
+// operation="put_item",table="messages", and the same name and labels always
+// return the same metric.
+class MetricsRegistry {
+  enum class MetricType {
+    COUNTER = 0,
+    GAUGE = 1,
+    HISTOGRAM = 2,
+  };
+
+  struct Series {
+    std::string labels;
+    std::unique_ptr<Counter> counter;
+    std::unique_ptr<Gauge> gauge;
+    std::unique_ptr<Histogram> histogram;
+    std::function<double()> function;
+  };
+
+  struct Family {
+    std::string help;
+    MetricType type;
+    std::vector<std::unique_ptr<Series>> series;
+  };
+
+  mutable std::mutex registryMutex;
+  // Ordered, so that the families are always exported in the same order
+  std::map<std::string, Family> families;
+
+  MetricsRegistry(){};
+  Series &getSeries(
+      const std::string &name,
+      const std::string &help,
+      MetricType type,
+      const std::string &labels);
+
+public:
+  static MetricsRegistry &getInstance();
+
+  Counter &getCounter(
+      const std::string &name,
+      const std::string &help,
+      const std::string &labels = "");
+  Gauge &getGauge(
+      const std::string &name,
+      const std::string &help,
+      const std::string &labels = "");
+  Histogram &getHistogram(
+      const std::string &name,
+      const std::string &help,
+      const std::string &labels = "");
+  // The function is called on every scrape, for values that are cheaper to
+  // read when they are needed than to keep up to date, e.g. queue sizes. It
+  // may be called on any thread and shouldn't block or use the registry,
+  // registering the same series again replaces it.
+  void registerGaugeFunction(
+      const std::string &name,
+      const std::string &help,
+      const std::string &labels,
+      std::function<double()> function);
+  void registerCounterFunction(
+      const std::string &name,
+      const std::string &help,
+      const std::string &labels,
+      std::function<double()> function);
+  // The Prometheus text exposition format
+  std::string render() const;
+
+  MetricsRegistry(MetricsRegistry const &) = delete;
+  void operator=(MetricsRegistry const &) = delete;
+};
+
+} // namespace metrics
+} // namespace network
+} // namespace comm
@@ -0,0 +1,229 @@
+#include "MetricsServer.h"
+#include "AllocationTracker.h"
+#include "GlobalConstants.h"
+#include "Metrics.h"
+#include "Profiler.h"
+
+#include <boost/asio.hpp>
+#include <glog/logging.h>
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+namespace comm {
+namespace network {
+namespace metrics {
+
+namespace {
+
+const size_t MAX_REQUEST_SIZE = 8 * 1024;
+const std::string PROFILING_PATH_PREFIX = "/debug/pprof/";
+const std::string METRICS_CONTENT_TYPE = "text/plain; version=0.0.4";
+// Longer values are rejected before std::stoull could overflow, none of the
+// limits of the parameters come near it
+const size_t MAX_QUERY_VALUE_DIGITS = 18;
+
+// Takes the numeric parameters of a query string, returns false if one of
+// them isn't a number or is too long to be one of ours
+bool parseQuery(
+    const std::string &query,
+    std::map<std::string, size_t> &parameters) {
+  std::istringstream stream(query);
+  std::string parameter;
+  while (std::getline(stream, parameter, '&')) {
+    const size_t separator = parameter.find('=');
+    const std::string value = parameter.substr(separator + 1);
+    if (separator == std::string::npos || value.empty() ||
+        value.size() > MAX_QUERY_VALUE_DIGITS ||
+        value.find_first_not_of("0123456789") != std::string::npos) {
+      return false;
+    }
+    parameters[parameter.substr(0, separator)] = std::stoull(value);
+  }
+  return true;
+}
+
+class MetricsConnection
+    : public std::enable_shared_from_this<MetricsConnection> {
+  boost::asio::ip::tcp::socket socket;
+  boost::asio::steady_timer timer;
+  boost::asio::streambuf request{MAX_REQUEST_SIZE};
+  std::string response;
+  const bool profiling;
+
+  void runProfile(const std::string &target);
+  void respond(
+      const std::string &status,
+      const std::string &body,
+      const std::string &contentType = METRICS_CONTENT_TYPE);
+
+public:
+  MetricsConnection(boost::asio::ip::tcp::socket socket, bool profiling);
+  void start();
+};
+
+MetricsConnection::MetricsConnection(
+    boost::asio::ip::tcp::socket socket,
+    bool profiling)
+    : socket(std::move(socket)),
+      timer(this->socket.get_executor()),
+      profiling(profiling) {
+}
+
+void MetricsConnection::start() {
+  std::shared_ptr<MetricsConnection> self = this->shared_from_this();
+  this->timer.expires_after(
+      std::chrono::milliseconds(METRICS_SERVER_READ_TIMEOUT_MS));
+  this->timer.async_wait([self](const boost::system::error_code &error) {
+    if (!error) {
+      boost::system::error_code ignored;
+      self->socket.close(ignored);
+    }
+  });
+  boost::asio::async_read_until(
+      this->socket,
+      this->request,
+      "\r\n\r\n",
+      [self](const boost::system::error_code &error, size_t size) {
+        self->timer.cancel();
+        if (error) {
+          return;
+        }
+        std::istream stream(&self->request);
+        std::string method;
+        std::string target;
+        stream >> method >> target;
+        if (method != "GET") {
+          self->respond("405 Method Not Allowed", "");
+          return;
+        }
+        if (self->profiling && target.rfind(PROFILING_PATH_PREFIX, 0) == 0) {
+          self->runProfile(target);
+          return;
+        }
+        self->respond("200 OK", MetricsRegistry::getInstance().render());
+      });
+}
+
+void MetricsConnection::runProfile(const std::string &target) {
+  const size_t queryStart = target.find('?');
+  const std::string path = target.substr(0, queryStart);
+  const bool cpu = path == PROFILING_PATH_PREFIX + "profile";
+  if (!cpu && path != PROFILING_PATH_PREFIX + "heap") {
+    this->respond("404 Not Found", "");
+    return;
+  }
+  std::map<std::string, size_t> parameters = {
+      {"seconds", PROFILING_DEFAULT_SECONDS},
+      {"hz", PROFILING_DEFAULT_CPU_HZ},
+      {"rate", PROFILING_DEFAULT_HEAP_INTERVAL_BYTES},
+  };
+  if (queryStart != std::string::npos &&
+      !parseQuery(target.substr(queryStart + 1), parameters)) {
+    this->respond("400 Bad Request", "The parameters have to be numbers\n");
+    return;
+  }
+  const size_t seconds = parameters["seconds"];
+  if (!seconds || seconds > PROFILING_MAX_SECONDS || !parameters["hz"] ||
+      parameters["hz"] > PROFILING_MAX_CPU_HZ || !parameters["rate"]) {
+    this->respond(
+        "400 Bad Request",
+        "seconds has to be between 1 and " +
+            std::to_string(PROFILING_MAX_SECONDS) +
+            ", hz between 1 and " + std::to_string(PROFILING_MAX_CPU_HZ) +
+            " and rate more than 0\n");
+    return;
+  }
+  if (!cpu && !allocation::isAllocationTrackingEnabled()) {
+    this->respond(
+        "501 Not Implemented",
+        "Heap profiles need a build with COMM_ALLOCATION_TRACKING\n");
+    return;
+  }
+  const bool started = cpu
+      ? profiling::startCpuProfile(parameters["hz"])
+      : profiling::startHeapProfile(parameters["rate"]);
+  if (!started) {
+    this->respond("409 Conflict", "A profile is already running\n");
+    return;
+  }
+  LOG(INFO) << "Profiling: running a " << (cpu ? "CPU" : "heap")
+            << " profile for " << seconds << " seconds";
+  std::shared_ptr<MetricsConnection> self = this->shared_from_this();
+  this->timer.expires_after(std::chrono::seconds(seconds));
+  this->timer.async_wait([self, cpu](const boost::system::error_code &) {
+    if (cpu) {
+      self->respond(
+          "200 OK", profiling::stopCpuProfile(), "application/octet-stream");
+    } else {
+      self->respond("200 OK", profiling::stopHeapProfile(), "text/plain");
+    }
+  });
+}
+
+void MetricsConnection::respond(
+    const std::string &status,
+    const std::string &body,
+    const std::string &contentType) {
+  this->response = "HTTP/1.1 " + status +
+      "\r\n"
+      "Content-Type: " +
+      contentType +
+      "\r\n"
+      "Content-Length: " +
+      std::to_string(body.size()) +
+      "\r\n"
+      "Connection: close\r\n\r\n" +
+      body;
+  std::shared_ptr<MetricsConnection> self = this->shared_from_this();
+  boost::asio::async_write(
+      this->socket,
+      boost::asio::buffer(this->response),
+      [self](const boost::system::error_code &error, size_t size) {
+        boost::system::error_code ignored;
+        self->socket.shutdown(
+            boost::asio::ip::tcp::socket::shutdown_both, ignored);
+      });
+}
+
+void accept(boost::asio::ip::tcp::acceptor &acceptor, bool profiling) {
+  acceptor.async_accept([&acceptor, profiling](
+                            const boost::system::error_code &error,
+                            boost::asio::ip::tcp::socket socket) {
+    if (!error) {
+      std::make_shared<MetricsConnection>(std::move(socket), profiling)
+          ->start();
+    } else {
+      LOG(WARNING) << "Metrics: failed to accept a connection: "
+                   << error.message();
+    }
+    accept(acceptor, profiling);
+  });
+}
+
+} // namespace
+
+void startMetricsServer(uint16_t port, bool profiling) {
+  static std::once_flag startedFlag;
+  std::call_once(startedFlag, [port, profiling]() {
+    // Both live as long as the process, like the thread that uses them
+    boost::asio::io_context *context = new boost::asio::io_context();
+    boost::asio::ip::tcp::acceptor *acceptor =
+        new boost::asio::ip::tcp::acceptor(
+            *context,
+            boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), port));
+    accept(*acceptor, profiling);
+    std::thread([context]() { context->run(); }).detach();
+    LOG(INFO) << "Metrics: serving on port " << port
+              << (profiling ? ", with profiling" : "");
+  });
+}
+
+} // namespace metrics
+} // namespace network
+} // namespace comm
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+
+namespace comm {
+namespace network {
+namespace metrics {
+
+// Serves MetricsRegistry::render over HTTP for Prometheus to scrape, on a
+// thread of its own. Every GET request is answered with the metrics,
+// whatever its path. Throws if the port can't be bound, starting it again
+// does nothing.
+//
+// With profiling, the paths of pprof's HTTP handler run a profile for the
+// window of the request and answer with it (see Profiler.h), e.g.
+// go tool pprof http://host:port/debug/pprof/profile?seconds=30
+// - /debug/pprof/profile, with seconds and hz, the CPU profile
+// - /debug/pprof/heap, with seconds and rate, the sampled allocations, only
+//   in a COMM_ALLOCATION_TRACKING build
+// A profile that is already running is answered with 409.
+void startMetricsServer(uint16_t port, bool profiling = false);
+
+} // namespace metrics
+} // namespace network
+} // namespace comm
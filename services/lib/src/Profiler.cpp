@@ -0,0 +1,290 @@
+#include "Profiler.h"
+#include "AllocationTracker.h"
+#include "GlobalConstants.h"
+
+#include <execinfo.h>
+#include <glog/logging.h>
+#include <signal.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace comm {
+namespace network {
+namespace profiling {
+
+namespace {
+
+// The frames of the signal handler and of the trampoline that called it
+const int CPU_SKIPPED_FRAMES = 2;
+// The frame of the allocation sampler
+const int HEAP_SKIPPED_FRAMES = 1;
+
+using Stack = std::vector<uintptr_t>;
+
+struct StackTotals {
+  uint64_t count = 0;
+  uint64_t weight = 0;
+};
+
+// Filled from a signal handler and from operator new, so recording a sample
+// neither allocates nor locks
+class SampleBuffer {
+  struct Sample {
+    uint64_t weight;
+    size_t depth;
+    void *frames[PROFILING_MAX_FRAMES];
+  };
+
+  std::unique_ptr<Sample[]> samples;
+  std::atomic<bool> recording{false};
+  // The records in progress, stop waits for them before it reads the samples
+  std::atomic<size_t> writers{0};
+  std::atomic<size_t> nextSample{0};
+
+public:
+  bool isRecording() const;
+  void start();
+  void record(uint64_t weight, void *const *frames, int depth);
+  // Sums the samples by stack
+  std::map<Stack, StackTotals> stop();
+};
+
+bool SampleBuffer::isRecording() const {
+  return this->recording.load(std::memory_order_relaxed);
+}
+
+void SampleBuffer::start() {
+  this->samples.reset(new Sample[PROFILING_MAX_SAMPLES]);
+  this->nextSample.store(0, std::memory_order_relaxed);
+  this->recording.store(true);
+}
+
+void SampleBuffer::record(uint64_t weight, void *const *frames, int depth) {
+  this->writers.fetch_add(1);
+  if (this->recording.load() && depth > 0) {
+    const size_t index =
+        this->nextSample.fetch_add(1, std::memory_order_relaxed);
+    if (index < PROFILING_MAX_SAMPLES) {
+      Sample &sample = this->samples[index];
+      sample.weight = weight;
+      sample.depth = std::min<size_t>(depth, PROFILING_MAX_FRAMES);
+      std::copy(frames, frames + sample.depth, sample.frames);
+    }
+  }
+  this->writers.fetch_sub(1);
+}
+
+std::map<Stack, StackTotals> SampleBuffer::stop() {
+  this->recording.store(false);
+  while (this->writers.load()) {
+    std::this_thread::yield();
+  }
+  const size_t recorded = this->nextSample.load(std::memory_order_relaxed);
+  const size_t kept = std::min(recorded, PROFILING_MAX_SAMPLES);
+  if (recorded > kept) {
+    LOG(WARNING) << "Profiling: dropped " << recorded - kept
+                 << " samples, the buffer was full";
+  }
+  std::map<Stack, StackTotals> stacks;
+  for (size_t i = 0; i < kept; i++) {
+    const Sample &sample = this->samples[i];
+    StackTotals &totals = stacks[Stack(
+        reinterpret_cast<const uintptr_t *>(sample.frames),
+        reinterpret_cast<const uintptr_t *>(sample.frames) + sample.depth)];
+    totals.count++;
+    totals.weight += sample.weight;
+  }
+  this->samples.reset();
+  return stacks;
+}
+
+std::string readMemoryMap() {
+  std::ifstream file("/proc/self/maps");
+  std::ostringstream memoryMap;
+  memoryMap << file.rdbuf();
+  return memoryMap.str();
+}
+
+// The first call of backtrace loads the unwinder, which can't be done from a
+// signal handler or from operator new
+void loadUnwinder() {
+  static std::once_flag loadedFlag;
+  std::call_once(loadedFlag, []() {
+    void *frame;
+    backtrace(&frame, 1);
+  });
+}
+
+SampleBuffer cpuSamples;
+std::atomic<bool> cpuProfileRunning{false};
+size_t cpuPeriodUs = 0;
+
+void handleProfilingSignal(int, siginfo_t *, void *) {
+  if (!cpuSamples.isRecording()) {
+    return;
+  }
+  const int savedErrno = errno;
+  void *frames[PROFILING_MAX_FRAMES + CPU_SKIPPED_FRAMES];
+  const int depth =
+      backtrace(frames, PROFILING_MAX_FRAMES + CPU_SKIPPED_FRAMES);
+  cpuSamples.record(
+      1, frames + CPU_SKIPPED_FRAMES, depth - CPU_SKIPPED_FRAMES);
+  errno = savedErrno;
+}
+
+void setProfilingTimer(size_t periodUs) {
+  itimerval timer = {};
+  timer.it_interval.tv_sec = periodUs / 1000000;
+  timer.it_interval.tv_usec = periodUs % 1000000;
+  timer.it_value = timer.it_interval;
+  setitimer(ITIMER_PROF, &timer, nullptr);
+}
+
+void appendWord(std::string &profile, uintptr_t word) {
+  profile.append(reinterpret_cast<const char *>(&word), sizeof(word));
+}
+
+SampleBuffer heapSamples;
+std::atomic<bool> heapProfileRunning{false};
+std::atomic<size_t> heapIntervalBytes{PROFILING_DEFAULT_HEAP_INTERVAL_BYTES};
+// 0 until the thread draws its first distance
+thread_local uint64_t randomState = 0;
+thread_local int64_t bytesUntilSample = 0;
+
+// Exponentially distributed, so that the sampled allocations are a Poisson
+// process over the allocated bytes, which is what pprof assumes when it
+// scales the samples back up
+int64_t drawSampleDistance() {
+  randomState ^= randomState >> 12;
+  randomState ^= randomState << 25;
+  randomState ^= randomState >> 27;
+  const uint64_t random = randomState * 2685821657736338717ULL;
+  const double uniform = (random >> 11) / 9007199254740992.0;
+  return static_cast<int64_t>(
+             -std::log(1 - uniform) *
+             heapIntervalBytes.load(std::memory_order_relaxed)) +
+      1;
+}
+
+void sampleAllocation(size_t size) {
+  if (!randomState) {
+    randomState = reinterpret_cast<uintptr_t>(&randomState) | 1;
+    bytesUntilSample = drawSampleDistance();
+  }
+  bytesUntilSample -= size;
+  if (bytesUntilSample > 0) {
+    return;
+  }
+  bytesUntilSample = drawSampleDistance();
+  void *frames[PROFILING_MAX_FRAMES + HEAP_SKIPPED_FRAMES];
+  const int depth =
+      backtrace(frames, PROFILING_MAX_FRAMES + HEAP_SKIPPED_FRAMES);
+  heapSamples.record(
+      size, frames + HEAP_SKIPPED_FRAMES, depth - HEAP_SKIPPED_FRAMES);
+}
+
+} // namespace
+
+bool startCpuProfile(size_t frequencyHz) {
+  if (cpuProfileRunning.exchange(true)) {
+    return false;
+  }
+  static std::once_flag handlerFlag;
+  std::call_once(handlerFlag, []() {
+    loadUnwinder();
+    struct sigaction action = {};
+    action.sa_sigaction = handleProfilingSignal;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, nullptr);
+  });
+  cpuPeriodUs = 1000000 / std::max<size_t>(frequencyHz, 1);
+  cpuSamples.start();
+  setProfilingTimer(cpuPeriodUs);
+  return true;
+}
+
+std::string stopCpuProfile() {
+  if (!cpuProfileRunning.load()) {
+    return "";
+  }
+  setProfilingTimer(0);
+  const std::map<Stack, StackTotals> stacks = cpuSamples.stop();
+  std::string profile;
+  // Header: its size in words, the format version and the sampling period
+  for (uintptr_t word : {0, 3, 0}) {
+    appendWord(profile, word);
+  }
+  appendWord(profile, cpuPeriodUs);
+  appendWord(profile, 0);
+  for (const auto &stack : stacks) {
+    appendWord(profile, stack.second.count);
+    appendWord(profile, stack.first.size());
+    for (uintptr_t frame : stack.first) {
+      appendWord(profile, frame);
+    }
+  }
+  for (uintptr_t word : {0, 1, 0}) {
+    appendWord(profile, word);
+  }
+  profile += readMemoryMap();
+  cpuProfileRunning.store(false);
+  return profile;
+}
+
+bool startHeapProfile(size_t intervalBytes) {
+  if (!allocation::isAllocationTrackingEnabled() ||
+      heapProfileRunning.exchange(true)) {
+    return false;
+  }
+  loadUnwinder();
+  heapIntervalBytes.store(
+      std::max<size_t>(intervalBytes, 1), std::memory_order_relaxed);
+  heapSamples.start();
+  allocation::setAllocationSampler(sampleAllocation);
+  return true;
+}
+
+std::string stopHeapProfile() {
+  if (!heapProfileRunning.load()) {
+    return "";
+  }
+  allocation::setAllocationSampler(nullptr);
+  const std::map<Stack, StackTotals> stacks = heapSamples.stop();
+  StackTotals allocated;
+  for (const auto &stack : stacks) {
+    allocated.count += stack.second.count;
+    allocated.weight += stack.second.weight;
+  }
+  std::ostringstream profile;
+  profile << "heap profile: 0: 0 [" << allocated.count << ": "
+          << allocated.weight << "] @ heap_v2/"
+          << heapIntervalBytes.load(std::memory_order_relaxed) << "\n";
+  for (const auto &stack : stacks) {
+    profile << "0: 0 [" << stack.second.count << ": " << stack.second.weight
+            << "] @";
+    for (uintptr_t frame : stack.first) {
+      profile << " 0x" << std::hex << frame << std::dec;
+    }
+    profile << "\n";
+  }
+  profile << "\nMAPPED_LIBRARIES:\n" << readMemoryMap();
+  heapProfileRunning.store(false);
+  return profile.str();
+}
+
+} // namespace profiling
+} // namespace network
+} // namespace comm
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace comm {
+namespace network {
+namespace profiling {
+
+// Sampling profilers that cost nothing while they aren't running, so they
+// can be started on a production process when it misbehaves. The profiles
+// are in the legacy formats of gperftools, which pprof reads, and end with
+// the memory map of the process so that pprof can symbolize them against the
+// binary. Only one profile of each kind runs at a time.
+
+// Samples the stacks of the threads that use CPU time, frequencyHz times per
+// second of it, with SIGPROF. Returns false if a CPU profile is already
+// running. The handler stays installed once it has been, as the default
+// action of a late SIGPROF is to terminate the process. Like with any
+// SIGPROF profiler, blocking calls that aren't restarted may fail with EINTR
+// while it runs.
+bool startCpuProfile(size_t frequencyHz);
+// Returns the profile in the binary CPU profile format
+std::string stopCpuProfile();
+
+// Samples an allocation once every intervalBytes on average, with the stack
+// that made it. Needs the operator new of a COMM_ALLOCATION_TRACKING build,
+// returns false without it or if a heap profile is already running.
+bool startHeapProfile(size_t intervalBytes);
+// Returns the profile in the text heap profile format. Frees aren't tracked,
+// so the in-use values are 0 and pprof has to be given
+// -sample_index=alloc_space or alloc_objects.
+std::string stopHeapProfile();
+
+} // namespace profiling
+} // namespace network
+} // namespace comm
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "GlobalConstants.h"
+
+#include <google/protobuf/arena.h>
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace comm {
+namespace network {
+namespace reactor {
+
+// Messages of the pools of finished reactors, shared by the reactors of all
+// the streams that use the same message type. A new reactor takes them
+// instead of allocating, so that reconnecting clients don't cost the
+// allocator the messages of every stream again. A message that is given
+// back is cleared, and freed instead if it has grown past
+// REACTOR_RECYCLED_MESSAGE_MAX_BYTES or there are enough of them already.
+template <class Message> class RecycledMessages {
+  std::mutex messagesMutex;
+  std::vector<Message *> messages;
+
+public:
+  static RecycledMessages &getInstance();
+
+  RecycledMessages() = default;
+
+  RecycledMessages(const RecycledMessages &) = delete;
+  RecycledMessages &operator=(const RecycledMessages &) = delete;
+
+  // - returns an empty message or nullptr if there isn't any
+  Message *take();
+  // Takes the ownership of the message
+  void give(Message *message);
+};
+
+template <class Message>
+RecycledMessages<Message> &RecycledMessages<Message>::getInstance() {
+  // Never destroyed, as the pools of the reactors may still give their
+  // messages back during the exit
+  static RecycledMessages<Message> *instance = new RecycledMessages<Message>();
+  return *instance;
+}
+
+template <class Message> Message *RecycledMessages<Message>::take() {
+  const std::lock_guard<std::mutex> lock(this->messagesMutex);
+  if (this->messages.empty()) {
+    return nullptr;
+  }
+  Message *message = this->messages.back();
+  this->messages.pop_back();
+  return message;
+}
+
+template <class Message>
+void RecycledMessages<Message>::give(Message *message) {
+  if (message->SpaceUsedLong() > REACTOR_RECYCLED_MESSAGE_MAX_BYTES) {
+    delete message;
+    return;
+  }
+  message->Clear();
+  {
+    const std::lock_guard<std::mutex> lock(this->messagesMutex);
+    if (this->messages.size() < REACTOR_RECYCLED_MESSAGES_SIZE) {
+      this->messages.push_back(message);
+      return;
+    }
+  }
+  delete message;
+}
+
+// Keeps the messages that a reactor reads from or writes to the wire, so
+// that they are reused in the next cycles instead of being allocated again.
+// A released message is cleared, which keeps the memory of its fields, e.g.
+// the buffer of a `bytes` field, so a stream of similar messages stops
+// allocating once its first messages have been handled.
+//
+// Without an arena, the messages are given to RecycledMessages when the pool
+// is destroyed. With an arena, the messages and everything they allocate
+// live in it and are freed all at once together with the pool. Messages of
+// an arena can't be moved to messages outside of it without a copy, so they
+// should be passed by a reference or a pointer.
+//
+// It is not thread-safe, reactors that use it from several threads have to
+// guard it themselves.
+template <class Message> class ReactorMessagePool {
+  std::unique_ptr<google::protobuf::Arena> arena;
+  std::vector<Message *> messages;
+  std::vector<Message *> freeMessages;
+
+public:
+  explicit ReactorMessagePool(bool useArena = false);
+  ~ReactorMessagePool();
+
+  ReactorMessagePool(const ReactorMessagePool &) = delete;
+  ReactorMessagePool &operator=(const ReactorMessagePool &) = delete;
+
+  // Returns an empty message that is owned by the pool
+  Message *acquire();
+  // The message can't be used after it is released
+  void release(Message *message);
+};
+
+template <class Message>
+ReactorMessagePool<Message>::ReactorMessagePool(bool useArena) {
+  if (useArena) {
+    this->arena = std::make_unique<google::protobuf::Arena>();
+  }
+}
+
+template <class Message> ReactorMessagePool<Message>::~ReactorMessagePool() {
+  if (this->arena != nullptr) {
+    return;
+  }
+  RecycledMessages<Message> &recycled =
+      RecycledMessages<Message>::getInstance();
+  for (Message *message : this->messages) {
+    recycled.give(message);
+  }
+}
+
+template <class Message> Message *ReactorMessagePool<Message>::acquire() {
+  if (!this->freeMessages.empty()) {
+    Message *message = this->freeMessages.back();
+    this->freeMessages.pop_back();
+    return message;
+  }
+  Message *message = nullptr;
+  if (this->arena == nullptr) {
+    message = RecycledMessages<Message>::getInstance().take();
+  }
+  if (message == nullptr) {
+    message =
+        google::protobuf::Arena::CreateMessage<Message>(this->arena.get());
+  }
+  this->messages.push_back(message);
+  return message;
+}
+
+template <class Message>
+void ReactorMessagePool<Message>::release(Message *message) {
+  message->Clear();
+  this->freeMessages.push_back(message);
+}
+
+} // namespace reactor
+} // namespace network
+} // namespace comm
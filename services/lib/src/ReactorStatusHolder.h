@@ -3,7 +3,6 @@
 #include <grpcpp/grpcpp.h>
 
 #include <atomic>
-#include <mutex>
 
 namespace comm {
 namespace network {
@@ -18,19 +17,45 @@ enum class ReactorState {
 
 class ReactorStatusHolder {
 private:
-  grpc::Status status = grpc::Status::OK;
-  std::mutex statusAccessMutex;
+  // A status isn't changed once it is set, every set adds a node, so that
+  // it can be read without a lock or a copy. The nodes live as long as the
+  // holder, a reactor sets its status a few times at most.
+  struct StatusNode {
+    const grpc::Status status;
+    const StatusNode *previous;
+  };
+  std::atomic<const StatusNode *> current = {nullptr};
 
 public:
   std::atomic<ReactorState> state = {ReactorState::NONE};
 
-  grpc::Status getStatus() {
-    const std::unique_lock<std::mutex> lock(this->statusAccessMutex);
-    return this->status;
+  ReactorStatusHolder() = default;
+  ReactorStatusHolder(ReactorStatusHolder const &) = delete;
+  void operator=(ReactorStatusHolder const &) = delete;
+
+  ~ReactorStatusHolder() {
+    const StatusNode *node = this->current.load(std::memory_order_acquire);
+    while (node != nullptr) {
+      const StatusNode *previous = node->previous;
+      delete node;
+      node = previous;
+    }
+  }
+
+  // The reference stays valid for the lifetime of the holder
+  const grpc::Status &getStatus() const {
+    const StatusNode *node = this->current.load(std::memory_order_acquire);
+    return node == nullptr ? grpc::Status::OK : node->status;
   }
   void setStatus(const grpc::Status &status) {
-    const std::unique_lock<std::mutex> lock(this->statusAccessMutex);
-    this->status = status;
+    StatusNode *node = new StatusNode{
+        status, this->current.load(std::memory_order_relaxed)};
+    while (!this->current.compare_exchange_weak(
+        node->previous,
+        node,
+        std::memory_order_release,
+        std::memory_order_relaxed)) {
+    }
   }
 };
 
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace comm {
+namespace network {
+
+// Move-only callable that keeps captures of up to STORAGE_SIZE bytes inline,
+// so that scheduling the usual reactor lambdas doesn't allocate. Larger
+// callables are moved to the heap.
+class SmallTask {
+  static const size_t STORAGE_SIZE = 64;
+
+  struct Operations {
+    void (*invoke)(void *storage);
+    void (*move)(void *from, void *to);
+    void (*destroy)(void *storage);
+  };
+
+  template <typename F> struct InlineOperations {
+    static void invoke(void *storage) {
+      (*static_cast<F *>(storage))();
+    }
+    static void move(void *from, void *to) {
+      new (to) F(std::move(*static_cast<F *>(from)));
+      static_cast<F *>(from)->~F();
+    }
+    static void destroy(void *storage) {
+      static_cast<F *>(storage)->~F();
+    }
+  };
+
+  template <typename F> struct HeapOperations {
+    static void invoke(void *storage) {
+      (**static_cast<F **>(storage))();
+    }
+    static void move(void *from, void *to) {
+      *static_cast<F **>(to) = *static_cast<F **>(from);
+    }
+    static void destroy(void *storage) {
+      delete *static_cast<F **>(storage);
+    }
+  };
+
+  template <typename F>
+  using IsInline = std::integral_constant<
+      bool,
+      sizeof(F) <= STORAGE_SIZE &&
+          alignof(F) <= alignof(std::max_align_t) &&
+          std::is_nothrow_move_constructible<F>::value>;
+
+  typename std::aligned_storage<STORAGE_SIZE, alignof(std::max_align_t)>::type
+      storage;
+  const Operations *operations = nullptr;
+
+  template <typename Function, typename F>
+  void assign(F &&function, std::true_type) {
+    static const Operations inlineOperations = {
+        InlineOperations<Function>::invoke,
+        InlineOperations<Function>::move,
+        InlineOperations<Function>::destroy};
+    new (&this->storage) Function(std::forward<F>(function));
+    this->operations = &inlineOperations;
+  }
+
+  template <typename Function, typename F>
+  void assign(F &&function, std::false_type) {
+    static const Operations heapOperations = {
+        HeapOperations<Function>::invoke,
+        HeapOperations<Function>::move,
+        HeapOperations<Function>::destroy};
+    *reinterpret_cast<Function **>(&this->storage) =
+        new Function(std::forward<F>(function));
+    this->operations = &heapOperations;
+  }
+
+  void reset() {
+    if (this->operations != nullptr) {
+      this->operations->destroy(&this->storage);
+      this->operations = nullptr;
+    }
+  }
+
+public:
+  SmallTask() {
+  }
+
+  template <
+      typename F,
+      typename = typename std::enable_if<!std::is_same<
+          typename std::decay<F>::type,
+          SmallTask>::value>::type>
+  SmallTask(F &&function) {
+    using Function = typename std::decay<F>::type;
+    this->assign<Function>(std::forward<F>(function), IsInline<Function>());
+  }
+
+  SmallTask(SmallTask &&other) noexcept {
+    *this = std::move(other);
+  }
+
+  SmallTask &operator=(SmallTask &&other) noexcept {
+    if (this == &other) {
+      return *this;
+    }
+    this->reset();
+    if (other.operations != nullptr) {
+      other.operations->move(&other.storage, &this->storage);
+      this->operations = other.operations;
+      other.operations = nullptr;
+    }
+    return *this;
+  }
+
+  SmallTask(const SmallTask &) = delete;
+  SmallTask &operator=(const SmallTask &) = delete;
+
+  ~SmallTask() {
+    this->reset();
+  }
+
+  explicit operator bool() const {
+    return this->operations != nullptr;
+  }
+
+  void operator()() {
+    this->operations->invoke(&this->storage);
+  }
+};
+
+} // namespace network
+} // namespace comm
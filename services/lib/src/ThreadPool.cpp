@@ -0,0 +1,66 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace comm {
+namespace network {
+
+ThreadPool::Lane::Lane(
+    size_t threads,
+    ThreadPoolExecutor executor,
+    const std::string &name)
+    : queueLatencyMetric(metrics::MetricsRegistry::getInstance().getHistogram(
+          "comm_thread_pool_queue_wait_seconds",
+          "Time that ThreadPool tasks wait in the queue of their lane",
+          "lane=\"" + name + "\"")) {
+  if (executor == ThreadPoolExecutor::WORK_STEALING) {
+    this->workStealingExecutor =
+        std::make_unique<WorkStealingExecutor>(threads);
+  } else {
+    this->pool = std::make_unique<boost::asio::thread_pool>(threads);
+  }
+}
+
+void ThreadPool::Lane::post(SmallTask task) {
+  if (this->workStealingExecutor != nullptr) {
+    this->workStealingExecutor->post(std::move(task));
+    return;
+  }
+  boost::asio::post(*this->pool, [task = std::move(task)]() mutable { task(); });
+}
+
+void ThreadPool::Lane::recordQueueLatency(
+    std::chrono::steady_clock::duration latency) {
+  this->queueLatencyMetric.record(
+      std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+}
+
+ThreadPoolOptions &ThreadPool::getOptions() {
+  static ThreadPoolOptions options;
+  return options;
+}
+
+void ThreadPool::configure(const ThreadPoolOptions &options) {
+  getOptions() = options;
+}
+
+ThreadPool::ThreadPool() {
+  const ThreadPoolOptions &options = getOptions();
+  this->lanes[static_cast<size_t>(ThreadPoolLane::REQUEST)] =
+      std::make_unique<Lane>(
+          std::max<size_t>(1, options.requestThreads),
+          options.executor,
+          "request");
+  this->lanes[static_cast<size_t>(ThreadPoolLane::CONTROL)] =
+      std::make_unique<Lane>(
+          std::max<size_t>(1, options.controlThreads),
+          options.executor,
+          "control");
+}
+
+ThreadPool::Lane &ThreadPool::getLane(ThreadPoolLane lane) const {
+  return *this->lanes[static_cast<size_t>(lane)];
+}
+
+} // namespace network
+} // namespace comm
@@ -1,12 +1,19 @@
 #pragma once
 
+#include "AllocationTracker.h"
 #include "GlobalTools.h"
+#include "Metrics.h"
+#include "SmallTask.h"
+#include "WorkStealingExecutor.h"
 
 #include <boost/asio.hpp>
 #include <boost/asio/thread_pool.hpp>
 
+#include <array>
 #include <atomic>
+#include <chrono>
 #include <memory>
+#include <string>
 
 typedef std::function<void()> Task;
 typedef std::function<void(std::unique_ptr<std::string>)> Callback;
@@ -14,34 +21,97 @@ typedef std::function<void(std::unique_ptr<std::string>)> Callback;
 namespace comm {
 namespace network {
 
+// Every lane has its own threads, so that a burst of slow tasks in one lane
+// doesn't hold up tasks in the others
+enum class ThreadPoolLane {
+  // Handling requests, which may block on the database for a long time
+  REQUEST = 0,
+  // Terminating and finishing reactors, which has to happen promptly even
+  // when every request thread is blocked
+  CONTROL = 1,
+};
+
+enum class ThreadPoolExecutor {
+  // One boost::asio::thread_pool per lane, with a queue shared by its threads
+  ASIO = 0,
+  // One WorkStealingExecutor per lane, with a queue per thread
+  WORK_STEALING = 1,
+};
+
+const size_t THREAD_POOL_LANES = 2;
+
+struct ThreadPoolOptions {
+  size_t requestThreads{tools::getNumberOfCores()};
+  size_t controlThreads{2};
+  ThreadPoolExecutor executor{ThreadPoolExecutor::ASIO};
+};
+
 class ThreadPool {
-  boost::asio::thread_pool pool =
-      boost::asio::thread_pool(tools::getNumberOfCores());
+  struct Lane {
+    std::unique_ptr<boost::asio::thread_pool> pool;
+    std::unique_ptr<WorkStealingExecutor> workStealingExecutor;
+    metrics::Histogram &queueLatencyMetric;
 
-  ThreadPool() {
-  }
+    Lane(size_t threads, ThreadPoolExecutor executor, const std::string &name);
+    void post(SmallTask task);
+    void recordQueueLatency(std::chrono::steady_clock::duration latency);
+  };
+
+  std::array<std::unique_ptr<Lane>, THREAD_POOL_LANES> lanes;
+
+  static ThreadPoolOptions &getOptions();
+
+  ThreadPool();
 
   virtual ~ThreadPool() {
   }
 
+  Lane &getLane(ThreadPoolLane lane) const;
+
 public:
+  // Takes effect only if it is called before the first getInstance, so it
+  // should be called once at startup. The services use the defaults, the
+  // benchmark compares the executors with it.
+  static void configure(const ThreadPoolOptions &options);
+
   static ThreadPool &getInstance() {
     static ThreadPool instance;
     return instance;
   }
 
-  void scheduleWithCallback(Task task, Callback callback) {
-    boost::asio::post(this->pool, [task, callback]() {
-      std::unique_ptr<std::string> err = nullptr;
-      try {
-        task();
-      } catch (std::exception &e) {
-        err = std::make_unique<std::string>(e.what());
-      }
-      callback(std::move(err));
-    });
-  }
+  // Task and callback are taken as they are instead of as std::function, so
+  // that small lambdas can be stored without allocating
+  template <typename TaskType, typename CallbackType>
+  void scheduleWithCallback(
+      TaskType task,
+      CallbackType callback,
+      ThreadPoolLane lane = ThreadPoolLane::REQUEST);
 };
 
+template <typename TaskType, typename CallbackType>
+void ThreadPool::scheduleWithCallback(
+    TaskType task,
+    CallbackType callback,
+    ThreadPoolLane lane) {
+  Lane *poolLane = &this->getLane(lane);
+  const auto scheduledAt = std::chrono::steady_clock::now();
+  poolLane->post([poolLane,
+                  scheduledAt,
+                  task = std::move(task),
+                  callback = std::move(callback)]() mutable {
+    const allocation::ScopedAllocationTag allocationTag(
+        allocation::AllocationTag::REACTORS);
+    poolLane->recordQueueLatency(
+        std::chrono::steady_clock::now() - scheduledAt);
+    std::unique_ptr<std::string> err = nullptr;
+    try {
+      task();
+    } catch (std::exception &e) {
+      err = std::make_unique<std::string>(e.what());
+    }
+    callback(std::move(err));
+  });
+}
+
 } // namespace network
 } // namespace comm
@@ -0,0 +1,197 @@
+#include "TimingWheel.h"
+#include "Metrics.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <exception>
+#include <limits>
+
+namespace comm {
+namespace network {
+
+namespace {
+const uint64_t SLOT_MASK = TIMING_WHEEL_SLOTS - 1;
+const uint64_t NO_WAKE_UP = std::numeric_limits<uint64_t>::max();
+
+// Ticks that the slots of a level span
+uint64_t level_span(size_t level) {
+  return uint64_t(1) << (TIMING_WHEEL_SLOT_BITS * level);
+}
+} // namespace
+
+TimingWheel &TimingWheel::getInstance() {
+  static TimingWheel instance;
+  static const bool gaugeRegistered = [] {
+    metrics::MetricsRegistry::getInstance().registerGaugeFunction(
+        "comm_timing_wheel_timers",
+        "Timers waiting on the shared TimingWheel",
+        "",
+        []() {
+          return static_cast<double>(
+              TimingWheel::getInstance().getPendingCount());
+        });
+    return true;
+  }();
+  (void)gaugeRegistered;
+  return instance;
+}
+
+TimingWheel::TimingWheel() : start(std::chrono::steady_clock::now()) {
+  this->thread = std::thread([this]() { this->run(); });
+}
+
+TimingWheel::~TimingWheel() {
+  {
+    const std::lock_guard<std::mutex> lock(this->wheelMutex);
+    this->stopping = true;
+  }
+  this->wheelCondition.notify_one();
+  this->thread.join();
+}
+
+TimingWheel::TimerID TimingWheel::schedule(
+    std::chrono::steady_clock::duration delay,
+    std::function<void()> callback) {
+  // Rounded up to the next tick, so that the timer doesn't fire early
+  const uint64_t dueTick =
+      this->getTick(std::chrono::steady_clock::now() + delay) + 1;
+  TimerID timerID;
+  bool wakeUp;
+  {
+    const std::lock_guard<std::mutex> lock(this->wheelMutex);
+    if (this->locations.empty()) {
+      // The thread doesn't service the ticks while the wheel is empty
+      this->currentTick = std::max(
+          this->currentTick,
+          this->getTick(std::chrono::steady_clock::now()));
+    }
+    timerID = this->nextTimerID++;
+    const uint64_t expiresAt = std::max(dueTick, this->currentTick + 1);
+    Slot scheduled;
+    scheduled.push_back(Timer{timerID, expiresAt, std::move(callback)});
+    this->place(scheduled, scheduled.begin());
+    // A timer that doesn't fit the lowest level is due after the tick that
+    // the thread sleeps until anyway
+    wakeUp = expiresAt < this->wakeUpTick;
+  }
+  if (wakeUp) {
+    this->wheelCondition.notify_one();
+  }
+  return timerID;
+}
+
+bool TimingWheel::cancel(TimerID timerID) {
+  const std::lock_guard<std::mutex> lock(this->wheelMutex);
+  const auto location = this->locations.find(timerID);
+  if (location == this->locations.end()) {
+    return false;
+  }
+  this->levels[location->second.level][location->second.slot].erase(
+      location->second.timer);
+  this->locations.erase(location);
+  return true;
+}
+
+size_t TimingWheel::getPendingCount() {
+  const std::lock_guard<std::mutex> lock(this->wheelMutex);
+  return this->locations.size();
+}
+
+uint64_t
+TimingWheel::getTick(std::chrono::steady_clock::time_point time) const {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             time - this->start)
+      .count();
+}
+
+void TimingWheel::place(Slot &source, Slot::iterator timer) {
+  const uint64_t ticksLeft = timer->expiresAt > this->currentTick
+      ? timer->expiresAt - this->currentTick
+      : 0;
+  // The lowest level that the deadline is in range of. The slot that it
+  // falls in comes up before the deadline does.
+  size_t level = 0;
+  while (level + 1 < TIMING_WHEEL_LEVELS &&
+         ticksLeft >= level_span(level + 1)) {
+    level++;
+  }
+  const size_t slot =
+      (timer->expiresAt >> (TIMING_WHEEL_SLOT_BITS * level)) & SLOT_MASK;
+  Slot &target = this->levels[level][slot];
+  target.splice(target.end(), source, timer);
+  this->locations[timer->id] = Location{level, slot, timer};
+}
+
+void TimingWheel::advance(std::vector<std::function<void()>> &dueCallbacks) {
+  const uint64_t tick = ++this->currentTick;
+  // Once the lower levels have gone around, the timers of the next slot of
+  // a level move down
+  for (size_t level = 1; level < TIMING_WHEEL_LEVELS; level++) {
+    if (tick & (level_span(level) - 1)) {
+      break;
+    }
+    Slot cascading;
+    cascading.splice(
+        cascading.end(),
+        this->levels[level]
+                    [(tick >> (TIMING_WHEEL_SLOT_BITS * level)) & SLOT_MASK]);
+    while (!cascading.empty()) {
+      this->place(cascading, cascading.begin());
+    }
+  }
+  Slot &due = this->levels[0][tick & SLOT_MASK];
+  while (!due.empty()) {
+    dueCallbacks.push_back(std::move(due.front().callback));
+    this->locations.erase(due.front().id);
+    due.pop_front();
+  }
+}
+
+uint64_t TimingWheel::findWakeUpTick() const {
+  if (this->locations.empty()) {
+    return NO_WAKE_UP;
+  }
+  // Up to the end of the round of the lowest level, where the timers of the
+  // level above move down
+  for (uint64_t tick = this->currentTick + 1;; tick++) {
+    if (!(tick & SLOT_MASK) || !this->levels[0][tick & SLOT_MASK].empty()) {
+      return tick;
+    }
+  }
+}
+
+void TimingWheel::run() {
+  std::unique_lock<std::mutex> lock(this->wheelMutex);
+  while (!this->stopping) {
+    const uint64_t nowTick = this->getTick(std::chrono::steady_clock::now());
+    std::vector<std::function<void()>> dueCallbacks;
+    while (this->currentTick < nowTick && !this->locations.empty()) {
+      this->advance(dueCallbacks);
+    }
+    this->currentTick = std::max(this->currentTick, nowTick);
+    if (!dueCallbacks.empty()) {
+      lock.unlock();
+      for (std::function<void()> &callback : dueCallbacks) {
+        try {
+          callback();
+        } catch (const std::exception &e) {
+          LOG(ERROR) << "TimingWheel: a timer callback failed: " << e.what();
+        }
+      }
+      lock.lock();
+      continue;
+    }
+    this->wakeUpTick = this->findWakeUpTick();
+    if (this->wakeUpTick == NO_WAKE_UP) {
+      this->wheelCondition.wait(lock);
+    } else {
+      this->wheelCondition.wait_until(
+          lock, this->start + std::chrono::milliseconds(this->wakeUpTick));
+    }
+    this->wakeUpTick = 0;
+  }
+}
+
+} // namespace network
+} // namespace comm
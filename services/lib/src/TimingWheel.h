@@ -0,0 +1,93 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace comm {
+namespace network {
+
+// Every level of the wheel has 2^TIMING_WHEEL_SLOT_BITS slots, and a slot
+// of a level spans all the slots of the level below. With millisecond ticks
+// the 4 levels reach about 49 days ahead, a later deadline waits at the top
+// level until it comes in range.
+const size_t TIMING_WHEEL_SLOT_BITS = 8;
+const size_t TIMING_WHEEL_SLOTS = size_t(1) << TIMING_WHEEL_SLOT_BITS;
+const size_t TIMING_WHEEL_LEVELS = 4;
+
+// Runs callbacks once their delay has passed, for the deadlines that would
+// otherwise take a sleeping thread or a timer of their own each: backoffs,
+// batch flushes, per-device expiries. Timers are kept in the slots of a
+// hierarchical timing wheel with millisecond ticks, so scheduling and
+// cancelling one costs O(1) whatever the number of pending timers. A timer
+// moves down a level whenever its slot comes up, and fires from the lowest
+// level. A single thread services the wheel, and sleeps until the next tick
+// that has something to do.
+//
+// A timer never fires early, and at most a tick late unless the callbacks
+// before it take longer. Callbacks run on the thread of the wheel one after
+// another, so they shouldn't block, and hand longer work to the ThreadPool.
+class TimingWheel {
+public:
+  typedef uint64_t TimerID;
+
+private:
+  struct Timer {
+    TimerID id;
+    uint64_t expiresAt;
+    std::function<void()> callback;
+  };
+  typedef std::list<Timer> Slot;
+  struct Location {
+    size_t level;
+    size_t slot;
+    Slot::iterator timer;
+  };
+
+  const std::chrono::steady_clock::time_point start;
+  std::mutex wheelMutex;
+  std::condition_variable wheelCondition;
+  std::array<std::array<Slot, TIMING_WHEEL_SLOTS>, TIMING_WHEEL_LEVELS> levels;
+  std::unordered_map<TimerID, Location> locations;
+  // Every tick up to this one has been serviced
+  uint64_t currentTick{0};
+  // The tick that the thread sleeps until, 0 while it's awake
+  uint64_t wakeUpTick{0};
+  TimerID nextTimerID{1};
+  bool stopping{false};
+  std::thread thread;
+
+  uint64_t getTick(std::chrono::steady_clock::time_point time) const;
+  void place(Slot &source, Slot::iterator timer);
+  void advance(std::vector<std::function<void()>> &dueCallbacks);
+  uint64_t findWakeUpTick() const;
+  void run();
+
+public:
+  static TimingWheel &getInstance();
+
+  TimingWheel();
+  // Pending timers are dropped without running
+  ~TimingWheel();
+
+  TimerID schedule(
+      std::chrono::steady_clock::duration delay,
+      std::function<void()> callback);
+  // Returns false if the callback has run already, or is running
+  bool cancel(TimerID timerID);
+  size_t getPendingCount();
+
+  TimingWheel(const TimingWheel &) = delete;
+  TimingWheel &operator=(const TimingWheel &) = delete;
+};
+
+} // namespace network
+} // namespace comm
@@ -0,0 +1,487 @@
+#include "Tracing.h"
+#include "GlobalConstants.h"
+#include "GlobalTools.h"
+
+#include <boost/asio.hpp>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <istream>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace comm {
+namespace network {
+namespace tracing {
+
+struct SpanData {
+  TraceContext context;
+  std::array<uint8_t, 8> parentSpanID{};
+  std::string name;
+  SpanKind kind;
+  uint64_t startTimeUnixNano;
+  uint64_t endTimeUnixNano;
+  // Keys with their OTLP AnyValue already in JSON
+  std::vector<std::pair<std::string, std::string>> attributes;
+  bool error = false;
+  std::string errorMessage;
+};
+
+namespace {
+
+uint64_t toUnixNano(std::chrono::system_clock::time_point time) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             time.time_since_epoch())
+      .count();
+}
+
+template <size_t N> bool isZero(const std::array<uint8_t, N> &bytes) {
+  for (uint8_t byte : bytes) {
+    if (byte) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <size_t N>
+void appendHex(std::string &out, const std::array<uint8_t, N> &bytes) {
+  static const char digits[] = "0123456789abcdef";
+  for (uint8_t byte : bytes) {
+    out += digits[byte >> 4];
+    out += digits[byte & 0xf];
+  }
+}
+
+int fromHexDigit(char digit) {
+  if (digit >= '0' && digit <= '9') {
+    return digit - '0';
+  }
+  if (digit >= 'a' && digit <= 'f') {
+    return digit - 'a' + 10;
+  }
+  return -1;
+}
+
+template <size_t N>
+bool parseHex(
+    const std::string &text,
+    size_t offset,
+    std::array<uint8_t, N> &bytes) {
+  for (size_t i = 0; i < N; i++) {
+    const int high = fromHexDigit(text[offset + 2 * i]);
+    const int low = fromHexDigit(text[offset + 2 * i + 1]);
+    if (high < 0 || low < 0) {
+      return false;
+    }
+    bytes[i] = static_cast<uint8_t>(high << 4 | low);
+  }
+  return true;
+}
+
+void appendJsonString(std::string &out, const std::string &value) {
+  out += '"';
+  for (char character : value) {
+    switch (character) {
+      case '"':
+        out += "\\\"";
+        break;
+      case '\\':
+        out += "\\\\";
+        break;
+      case '\n':
+        out += "\\n";
+        break;
+      case '\r':
+        out += "\\r";
+        break;
+      case '\t':
+        out += "\\t";
+        break;
+      default:
+        if (static_cast<unsigned char>(character) < 0x20) {
+          char escaped[7];
+          std::snprintf(escaped, sizeof(escaped), "\\u%04x", character);
+          out += escaped;
+        } else {
+          out += character;
+        }
+    }
+  }
+  out += '"';
+}
+
+void appendSpan(std::string &out, const SpanData &span) {
+  out += "{\"traceId\":\"";
+  appendHex(out, span.context.traceID);
+  out += "\",\"spanId\":\"";
+  appendHex(out, span.context.spanID);
+  out += '"';
+  if (!isZero(span.parentSpanID)) {
+    out += ",\"parentSpanId\":\"";
+    appendHex(out, span.parentSpanID);
+    out += '"';
+  }
+  out += ",\"name\":";
+  appendJsonString(out, span.name);
+  out += ",\"kind\":" + std::to_string(static_cast<int>(span.kind));
+  // 64-bit integers are strings in the OTLP JSON encoding
+  out += ",\"startTimeUnixNano\":\"" + std::to_string(span.startTimeUnixNano);
+  out += "\",\"endTimeUnixNano\":\"" + std::to_string(span.endTimeUnixNano);
+  out += "\",\"attributes\":[";
+  for (size_t i = 0; i < span.attributes.size(); i++) {
+    if (i) {
+      out += ',';
+    }
+    out += "{\"key\":";
+    appendJsonString(out, span.attributes[i].first);
+    out += ",\"value\":" + span.attributes[i].second + "}";
+  }
+  out += ']';
+  if (span.error) {
+    out += ",\"status\":{\"code\":2,\"message\":";
+    appendJsonString(out, span.errorMessage);
+    out += '}';
+  }
+  out += '}';
+}
+
+// Collects the finished spans and posts them to the collector in batches
+// from a thread of its own, so that recording a span never waits for the
+// network
+class SpanExporter {
+  std::mutex queueMutex;
+  std::condition_variable queueCondition;
+  std::vector<SpanData> queue;
+  size_t droppedCount = 0;
+  TracingOptions options;
+  std::once_flag startedFlag;
+
+  void run();
+  void exportSpans(const std::vector<SpanData> &spans);
+  bool post(const std::string &body, std::string &error);
+
+public:
+  std::atomic<bool> enabled{false};
+  std::atomic<double> sampleRatio{0};
+
+  void start(const TracingOptions &options);
+  void enqueue(SpanData &&span);
+};
+
+SpanExporter &getSpanExporter() {
+  // Never destroyed, the thread of the exporter outlives the statics
+  static SpanExporter *exporter = new SpanExporter();
+  return *exporter;
+}
+
+void SpanExporter::start(const TracingOptions &options) {
+  std::call_once(this->startedFlag, [this, &options]() {
+    this->options = options;
+    this->sampleRatio = options.sampleRatio;
+    this->enabled = true;
+    std::thread([this]() { this->run(); }).detach();
+    LOG(INFO) << "Tracing: exporting to " << options.collectorHost << ":"
+              << options.collectorPort << " with the sample ratio "
+              << options.sampleRatio;
+  });
+}
+
+void SpanExporter::enqueue(SpanData &&span) {
+  std::unique_lock<std::mutex> lock(this->queueMutex);
+  if (this->queue.size() >= TRACING_MAX_QUEUED_SPANS) {
+    this->droppedCount++;
+    return;
+  }
+  this->queue.push_back(std::move(span));
+  if (this->queue.size() == TRACING_EXPORT_BATCH_SIZE) {
+    lock.unlock();
+    this->queueCondition.notify_one();
+  }
+}
+
+void SpanExporter::run() {
+  std::vector<SpanData> batch;
+  while (true) {
+    size_t droppedCount;
+    {
+      std::unique_lock<std::mutex> lock(this->queueMutex);
+      this->queueCondition.wait_for(
+          lock,
+          std::chrono::milliseconds(TRACING_EXPORT_INTERVAL_MS),
+          [this]() {
+            return this->queue.size() >= TRACING_EXPORT_BATCH_SIZE;
+          });
+      batch.swap(this->queue);
+      droppedCount = this->droppedCount;
+      this->droppedCount = 0;
+    }
+    if (droppedCount) {
+      LOG(WARNING) << "Tracing: dropped " << droppedCount
+                   << " spans, the collector doesn't keep up";
+    }
+    for (size_t offset = 0; offset < batch.size();
+         offset += TRACING_EXPORT_BATCH_SIZE) {
+      const size_t end =
+          std::min(batch.size(), offset + TRACING_EXPORT_BATCH_SIZE);
+      this->exportSpans(std::vector<SpanData>(
+          std::make_move_iterator(batch.begin() + offset),
+          std::make_move_iterator(batch.begin() + end)));
+    }
+    batch.clear();
+  }
+}
+
+void SpanExporter::exportSpans(const std::vector<SpanData> &spans) {
+  if (spans.empty()) {
+    return;
+  }
+  std::string body = "{\"resourceSpans\":[{\"resource\":{\"attributes\":[{"
+                     "\"key\":\"service.name\",\"value\":{\"stringValue\":";
+  appendJsonString(body, this->options.serviceName);
+  body += "}}]},\"scopeSpans\":[{\"scope\":{\"name\":\"comm\"},\"spans\":[";
+  for (size_t i = 0; i < spans.size(); i++) {
+    if (i) {
+      body += ',';
+    }
+    appendSpan(body, spans[i]);
+  }
+  body += "]}]}]}";
+  std::string error;
+  if (!this->post(body, error)) {
+    LOG(WARNING) << "Tracing: failed to export " << spans.size()
+                 << " spans: " << error;
+  }
+}
+
+bool SpanExporter::post(const std::string &body, std::string &error) {
+  boost::asio::io_context context;
+  boost::asio::ip::tcp::resolver resolver(context);
+  boost::asio::ip::tcp::socket socket(context);
+  const std::string port = std::to_string(this->options.collectorPort);
+  const std::string request = "POST " + TRACING_OTLP_PATH +
+      " HTTP/1.1\r\n"
+      "Host: " +
+      this->options.collectorHost + ":" + port +
+      "\r\n"
+      "Content-Type: application/json\r\n"
+      "Content-Length: " +
+      std::to_string(body.size()) +
+      "\r\n"
+      "Connection: close\r\n\r\n" +
+      body;
+  boost::asio::streambuf response;
+  // Stays timed_out unless the status line has been read in time
+  boost::system::error_code result = boost::asio::error::timed_out;
+  resolver.async_resolve(
+      this->options.collectorHost,
+      port,
+      [&](const boost::system::error_code &resolveError,
+          boost::asio::ip::tcp::resolver::results_type endpoints) {
+        if (resolveError) {
+          result = resolveError;
+          return;
+        }
+        boost::asio::async_connect(
+            socket,
+            endpoints,
+            [&](const boost::system::error_code &connectError,
+                const boost::asio::ip::tcp::endpoint &endpoint) {
+              if (connectError) {
+                result = connectError;
+                return;
+              }
+              boost::asio::async_write(
+                  socket,
+                  boost::asio::buffer(request),
+                  [&](const boost::system::error_code &writeError,
+                      size_t size) {
+                    if (writeError) {
+                      result = writeError;
+                      return;
+                    }
+                    boost::asio::async_read_until(
+                        socket,
+                        response,
+                        "\r\n",
+                        [&](const boost::system::error_code &readError,
+                            size_t size) { result = readError; });
+                  });
+            });
+      });
+  // The handlers that haven't run by then are dropped with the context
+  context.run_for(std::chrono::milliseconds(TRACING_EXPORT_TIMEOUT_MS));
+  if (result) {
+    error = result.message();
+    return false;
+  }
+  std::istream stream(&response);
+  std::string version;
+  unsigned int status = 0;
+  stream >> version >> status;
+  if (status < 200 || status >= 300) {
+    error = "the collector responded with " + std::to_string(status);
+    return false;
+  }
+  return true;
+}
+
+bool shouldSample() {
+  const double sampleRatio = getSpanExporter().sampleRatio;
+  if (sampleRatio <= 0) {
+    return false;
+  }
+  if (sampleRatio >= 1) {
+    return true;
+  }
+  uint64_t random;
+  tools::fillRandomBytes(
+      reinterpret_cast<unsigned char *>(&random), sizeof(random));
+  // The top 53 bits make a uniform double in [0, 1)
+  return (random >> 11) * (1.0 / (1ull << 53)) < sampleRatio;
+}
+
+} // namespace
+
+bool TraceContext::isValid() const {
+  return !isZero(this->traceID) && !isZero(this->spanID);
+}
+
+std::string TraceContext::toTraceparent() const {
+  if (!this->isValid()) {
+    return "";
+  }
+  std::string traceparent = "00-";
+  appendHex(traceparent, this->traceID);
+  traceparent += '-';
+  appendHex(traceparent, this->spanID);
+  traceparent += this->sampled ? "-01" : "-00";
+  return traceparent;
+}
+
+TraceContext TraceContext::fromTraceparent(const std::string &traceparent) {
+  // version-traceID-spanID-flags, the later versions may append fields
+  TraceContext context;
+  if (traceparent.size() < 55 || traceparent.compare(0, 3, "00-") ||
+      traceparent[35] != '-' || traceparent[52] != '-' ||
+      (traceparent.size() > 55 && traceparent[55] != '-')) {
+    return TraceContext();
+  }
+  std::array<uint8_t, 1> flags;
+  if (!parseHex(traceparent, 3, context.traceID) ||
+      !parseHex(traceparent, 36, context.spanID) ||
+      !parseHex(traceparent, 53, flags) || !context.isValid()) {
+    return TraceContext();
+  }
+  context.sampled = flags[0] & 1;
+  return context;
+}
+
+void configureTracing(const TracingOptions &options) {
+  getSpanExporter().start(options);
+}
+
+Span::Span(const std::string &name, SpanKind kind) {
+  TraceContext root;
+  if (shouldSample()) {
+    tools::fillRandomBytes(root.traceID.data(), root.traceID.size());
+    root.sampled = true;
+  }
+  this->start(name, root, kind, std::chrono::system_clock::now());
+}
+
+Span::Span(const std::string &name, const TraceContext &parent, SpanKind kind)
+    : Span(name, parent, kind, std::chrono::system_clock::now()) {
+}
+
+Span::Span(
+    const std::string &name,
+    const TraceContext &parent,
+    SpanKind kind,
+    std::chrono::system_clock::time_point startTime) {
+  if (parent.isValid()) {
+    this->start(name, parent, kind, startTime);
+  }
+}
+
+Span::Span(Span &&other)
+    : context(other.context), data(std::move(other.data)) {
+}
+
+Span::~Span() {
+  this->end();
+}
+
+void Span::start(
+    const std::string &name,
+    const TraceContext &parent,
+    SpanKind kind,
+    std::chrono::system_clock::time_point startTime) {
+  if (isZero(parent.traceID) || !parent.sampled) {
+    return;
+  }
+  this->context.traceID = parent.traceID;
+  this->context.sampled = true;
+  do {
+    tools::fillRandomBytes(
+        this->context.spanID.data(), this->context.spanID.size());
+  } while (isZero(this->context.spanID));
+  if (!getSpanExporter().enabled) {
+    // The context is still passed on for the services that record
+    return;
+  }
+  this->data = std::make_unique<SpanData>();
+  this->data->context = this->context;
+  this->data->parentSpanID = parent.spanID;
+  this->data->name = name;
+  this->data->kind = kind;
+  this->data->startTimeUnixNano = toUnixNano(startTime);
+}
+
+const TraceContext &Span::getContext() const {
+  return this->context;
+}
+
+void Span::setAttribute(const std::string &key, const std::string &value) {
+  if (this->data == nullptr) {
+    return;
+  }
+  std::string anyValue = "{\"stringValue\":";
+  appendJsonString(anyValue, value);
+  anyValue += '}';
+  this->data->attributes.emplace_back(key, std::move(anyValue));
+}
+
+void Span::setAttribute(const std::string &key, int64_t value) {
+  if (this->data == nullptr) {
+    return;
+  }
+  this->data->attributes.emplace_back(
+      key, "{\"intValue\":\"" + std::to_string(value) + "\"}");
+}
+
+void Span::setError(const std::string &message) {
+  if (this->data == nullptr) {
+    return;
+  }
+  this->data->error = true;
+  this->data->errorMessage = message;
+}
+
+void Span::end() {
+  if (this->data == nullptr) {
+    return;
+  }
+  this->data->endTimeUnixNano = toUnixNano(std::chrono::system_clock::now());
+  getSpanExporter().enqueue(std::move(*this->data));
+  this->data.reset();
+}
+
+} // namespace tracing
+} // namespace network
+} // namespace comm
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace comm {
+namespace network {
+namespace tracing {
+
+// The values are the ones of OTLP
+enum class SpanKind {
+  INTERNAL = 1,
+  SERVER = 2,
+  CLIENT = 3,
+  PRODUCER = 4,
+  CONSUMER = 5,
+};
+
+// Identifies a span across the services, it is passed between them in the
+// W3C traceparent format
+struct TraceContext {
+  std::array<uint8_t, 16> traceID{};
+  std::array<uint8_t, 8> spanID{};
+  bool sampled = false;
+
+  bool isValid() const;
+  // Returns an empty string for a context that isn't valid
+  std::string toTraceparent() const;
+  // Returns a context that isn't valid if the traceparent can't be parsed
+  static TraceContext fromTraceparent(const std::string &traceparent);
+};
+
+struct TracingOptions {
+  std::string serviceName;
+  // Spans are posted to http://collectorHost:collectorPort/v1/traces
+  std::string collectorHost;
+  uint16_t collectorPort;
+  // Share of the new traces that are recorded, from 0 to 1
+  double sampleRatio;
+};
+
+// Starts the exporter, nothing is recorded before that
+void configureTracing(const TracingOptions &options);
+
+struct SpanData;
+
+// A span is recorded when it ends, at the latest when it is destroyed. A span
+// whose trace isn't sampled costs close to nothing and has a context that
+// isn't valid, so it isn't passed on either.
+class Span {
+  TraceContext context;
+  std::unique_ptr<SpanData> data;
+
+  void start(
+      const std::string &name,
+      const TraceContext &parent,
+      SpanKind kind,
+      std::chrono::system_clock::time_point startTime);
+
+public:
+  // Starts a new trace, which is sampled with the configured ratio
+  explicit Span(const std::string &name, SpanKind kind = SpanKind::INTERNAL);
+  Span(
+      const std::string &name,
+      const TraceContext &parent,
+      SpanKind kind = SpanKind::INTERNAL);
+  // For the stages that are only known to have started once they are over,
+  // like the time that a message has waited in a queue
+  Span(
+      const std::string &name,
+      const TraceContext &parent,
+      SpanKind kind,
+      std::chrono::system_clock::time_point startTime);
+  Span(Span &&other);
+  ~Span();
+
+  const TraceContext &getContext() const;
+  void setAttribute(const std::string &key, const std::string &value);
+  void setAttribute(const std::string &key, int64_t value);
+  void setError(const std::string &message);
+  void end();
+
+  Span(Span const &) = delete;
+  void operator=(Span const &) = delete;
+};
+
+} // namespace tracing
+} // namespace network
+} // namespace comm
@@ -0,0 +1,89 @@
+#include "TrafficTrace.h"
+
+#include <cstdlib>
+#include <sstream>
+
+namespace comm {
+namespace network {
+namespace trace {
+
+namespace {
+
+const char FIELD_SEPARATOR = '\t';
+const char PEER_SEPARATOR = ',';
+const char SIZE_SEPARATOR = ':';
+const std::string NO_PEERS = "-";
+
+bool parseNumber(const std::string &text, uint64_t &number) {
+  if (text.empty() ||
+      text.find_first_not_of("0123456789") != std::string::npos) {
+    return false;
+  }
+  char *end = nullptr;
+  number = std::strtoull(text.c_str(), &end, 10);
+  return *end == '\0';
+}
+
+} // namespace
+
+std::string formatTraceRecord(const TraceRecord &record) {
+  std::string peers;
+  for (const std::pair<std::string, uint64_t> &peer : record.peers) {
+    if (!peers.empty()) {
+      peers += PEER_SEPARATOR;
+    }
+    peers += peer.first + SIZE_SEPARATOR + std::to_string(peer.second);
+  }
+  std::string line = std::to_string(record.offsetUs);
+  for (const std::string &field :
+       {record.event,
+        record.device,
+        peers.empty() ? NO_PEERS : peers,
+        std::to_string(record.count),
+        std::to_string(record.bytes),
+        std::to_string(record.durationUs)}) {
+    line += FIELD_SEPARATOR;
+    line += field;
+  }
+  return line;
+}
+
+bool parseTraceRecord(const std::string &line, TraceRecord &record) {
+  std::vector<std::string> fields;
+  std::stringstream stream(line);
+  std::string field;
+  while (std::getline(stream, field, FIELD_SEPARATOR)) {
+    fields.push_back(field);
+  }
+  if (fields.size() != 7 || fields[1].empty() || fields[2].empty() ||
+      !parseNumber(fields[0], record.offsetUs) ||
+      !parseNumber(fields[4], record.count) ||
+      !parseNumber(fields[5], record.bytes) ||
+      !parseNumber(fields[6], record.durationUs)) {
+    return false;
+  }
+  record.event = fields[1];
+  record.device = fields[2];
+  record.peers.clear();
+  if (fields[3] == NO_PEERS) {
+    return true;
+  }
+  std::stringstream peers(fields[3]);
+  std::string peer;
+  while (std::getline(peers, peer, PEER_SEPARATOR)) {
+    // Device IDs have a colon after their type, so the size is after the
+    // last one
+    const size_t separator = peer.rfind(SIZE_SEPARATOR);
+    uint64_t size;
+    if (separator == std::string::npos || !separator ||
+        !parseNumber(peer.substr(separator + 1), size)) {
+      return false;
+    }
+    record.peers.emplace_back(peer.substr(0, separator), size);
+  }
+  return true;
+}
+
+} // namespace trace
+} // namespace network
+} // namespace comm
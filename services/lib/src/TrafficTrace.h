@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace comm {
+namespace network {
+namespace trace {
+
+// The calls and the broker traffic that a service records in a traffic
+// trace, and a replay tool drives again
+const std::string EVENT_SESSION_SIGNATURE = "session_signature";
+const std::string EVENT_NEW_SESSION = "new_session";
+const std::string EVENT_GET_SESSION = "get_session";
+const std::string EVENT_BIND_DEVICE = "bind_device";
+const std::string EVENT_UNBIND_DEVICE = "unbind_device";
+const std::string EVENT_SEND_MESSAGES = "send_messages";
+const std::string EVENT_DATABASE_MESSAGES = "database_messages";
+const std::string EVENT_TAKE_MESSAGES = "take_messages";
+const std::string EVENT_AMQP_PUBLISH = "amqp_publish";
+const std::string EVENT_AMQP_RECEIVE = "amqp_receive";
+
+// There are no device IDs, user IDs or payloads in a trace. Devices are
+// pseudonyms that only stay the same within one trace, and the messages
+// leave only their sizes.
+struct TraceRecord {
+  // Microseconds from the start of the trace to the start of the event
+  uint64_t offsetUs = 0;
+  std::string event;
+  std::string device;
+  // The recipients of the messages that the device sent, with the size of
+  // every payload
+  std::vector<std::pair<std::string, uint64_t>> peers;
+  // Messages of the event and the bytes of their payloads
+  uint64_t count = 0;
+  uint64_t bytes = 0;
+  uint64_t durationUs = 0;
+};
+
+// A record is a line of tab separated fields, in the order of TraceRecord,
+// with the peers as comma separated device:size pairs, or - if there are
+// none. The line has no newline at its end.
+std::string formatTraceRecord(const TraceRecord &record);
+// - returns false if the line isn't a valid record
+bool parseTraceRecord(const std::string &line, TraceRecord &record);
+
+} // namespace trace
+} // namespace network
+} // namespace comm
@@ -0,0 +1,140 @@
+#include "WorkStealingExecutor.h"
+
+#include <algorithm>
+
+namespace comm {
+namespace network {
+
+namespace {
+const size_t initial_queue_capacity = 64;
+
+// Lets post() find the queue of the worker that it is called from
+thread_local const WorkStealingExecutor *current_executor = nullptr;
+thread_local size_t current_worker = 0;
+} // namespace
+
+void WorkStealingExecutor::TaskQueue::grow() {
+  std::vector<SmallTask> grown(
+      std::max(initial_queue_capacity, this->tasks.size() * 2));
+  for (size_t i = 0; i < this->size; i++) {
+    grown[i] = std::move(this->tasks[(this->head + i) % this->tasks.size()]);
+  }
+  this->tasks = std::move(grown);
+  this->head = 0;
+}
+
+void WorkStealingExecutor::TaskQueue::pushBack(SmallTask task) {
+  if (this->size == this->tasks.size()) {
+    this->grow();
+  }
+  this->tasks[(this->head + this->size) % this->tasks.size()] =
+      std::move(task);
+  this->size++;
+}
+
+bool WorkStealingExecutor::TaskQueue::popFront(SmallTask &task) {
+  if (!this->size) {
+    return false;
+  }
+  task = std::move(this->tasks[this->head]);
+  this->head = (this->head + 1) % this->tasks.size();
+  this->size--;
+  return true;
+}
+
+bool WorkStealingExecutor::TaskQueue::popBack(SmallTask &task) {
+  if (!this->size) {
+    return false;
+  }
+  this->size--;
+  task =
+      std::move(this->tasks[(this->head + this->size) % this->tasks.size()]);
+  return true;
+}
+
+WorkStealingExecutor::WorkStealingExecutor(size_t threads) {
+  threads = std::max<size_t>(1, threads);
+  for (size_t i = 0; i < threads; i++) {
+    this->workers.push_back(std::make_unique<Worker>());
+  }
+  for (size_t i = 0; i < threads; i++) {
+    this->workers[i]->thread = std::thread([this, i]() { this->run(i); });
+  }
+}
+
+WorkStealingExecutor::~WorkStealingExecutor() {
+  {
+    const std::lock_guard<std::mutex> lock(this->sleepMutex);
+    this->stopping = true;
+  }
+  this->wakeUp.notify_all();
+  for (std::unique_ptr<Worker> &worker : this->workers) {
+    worker->thread.join();
+  }
+}
+
+void WorkStealingExecutor::post(SmallTask task) {
+  size_t workerIndex = current_executor == this
+      ? current_worker
+      : this->nextWorker.fetch_add(1, std::memory_order_relaxed) %
+          this->workers.size();
+  Worker &worker = *this->workers[workerIndex];
+  // Counted before it is queued, so that pendingTasks never drops below the
+  // number of tasks that can be taken
+  this->pendingTasks.fetch_add(1);
+  {
+    const std::lock_guard<std::mutex> lock(worker.mutex);
+    worker.queue.pushBack(std::move(task));
+  }
+  // A worker that is about to sleep counts itself before it checks
+  // pendingTasks, so it either sees this task or gets woken up
+  if (this->sleepingWorkers.load()) {
+    {
+      const std::lock_guard<std::mutex> lock(this->sleepMutex);
+    }
+    this->wakeUp.notify_one();
+  }
+}
+
+bool WorkStealingExecutor::takeTask(size_t workerIndex, SmallTask &task) {
+  {
+    Worker &worker = *this->workers[workerIndex];
+    const std::lock_guard<std::mutex> lock(worker.mutex);
+    if (worker.queue.popFront(task)) {
+      return true;
+    }
+  }
+  for (size_t i = 1; i < this->workers.size(); i++) {
+    Worker &victim = *this->workers[(workerIndex + i) % this->workers.size()];
+    const std::lock_guard<std::mutex> lock(victim.mutex);
+    if (victim.queue.popBack(task)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void WorkStealingExecutor::run(size_t workerIndex) {
+  current_executor = this;
+  current_worker = workerIndex;
+  SmallTask task;
+  while (true) {
+    if (this->takeTask(workerIndex, task)) {
+      this->pendingTasks.fetch_sub(1);
+      task();
+      task = SmallTask();
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(this->sleepMutex);
+    this->sleepingWorkers.fetch_add(1);
+    this->wakeUp.wait(
+        lock, [this]() { return this->stopping || this->pendingTasks.load(); });
+    this->sleepingWorkers.fetch_sub(1);
+    if (this->stopping) {
+      return;
+    }
+  }
+}
+
+} // namespace network
+} // namespace comm
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "SmallTask.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace comm {
+namespace network {
+
+// Runs tasks on a fixed set of threads, each with its own queue. Tasks
+// posted from a worker go to its own queue and the others are spread over
+// the queues in turns. A worker runs its own tasks in order and, once its
+// queue is empty, takes the newest task from another one, so that a worker
+// stuck on a slow task doesn't hold up the tasks queued behind it.
+//
+// The queues reuse their storage and SmallTask keeps small captures inline,
+// so posting a task doesn't allocate once the queues have grown.
+class WorkStealingExecutor {
+  class TaskQueue {
+    std::vector<SmallTask> tasks;
+    size_t head = 0;
+    size_t size = 0;
+
+    void grow();
+
+  public:
+    void pushBack(SmallTask task);
+    bool popFront(SmallTask &task);
+    bool popBack(SmallTask &task);
+  };
+
+  struct Worker {
+    std::mutex mutex;
+    TaskQueue queue;
+    std::thread thread;
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::atomic<size_t> nextWorker{0};
+  std::atomic<size_t> pendingTasks{0};
+  std::atomic<size_t> sleepingWorkers{0};
+  std::mutex sleepMutex;
+  std::condition_variable wakeUp;
+  bool stopping = false;
+
+  void run(size_t workerIndex);
+  bool takeTask(size_t workerIndex, SmallTask &task);
+
+public:
+  explicit WorkStealingExecutor(size_t threads);
+  // Tasks that haven't started yet are dropped
+  ~WorkStealingExecutor();
+
+  WorkStealingExecutor(const WorkStealingExecutor &) = delete;
+  WorkStealingExecutor &operator=(const WorkStealingExecutor &) = delete;
+
+  void post(SmallTask task);
+};
+
+} // namespace network
+} // namespace comm
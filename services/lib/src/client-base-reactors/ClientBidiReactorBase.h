@@ -1,10 +1,15 @@
 #pragma once
 
+#include "AllocationTracker.h"
 #include "BaseReactor.h"
+#include "ClientSendQueue.h"
+#include "ReactorMessagePool.h"
 
 #include <glog/logging.h>
 #include <grpcpp/grpcpp.h>
 
+#include <memory>
+
 namespace comm {
 namespace network {
 namespace reactor {
@@ -14,20 +19,37 @@ namespace reactor {
 //   - write a request to the server
 //   - read a response from the server
 // - terminate the connection
+//
+// The request and the response are reused in every cycle, optionally
+// allocated on an arena (see ReactorMessagePool).
+//
+// When it is created with ClientFlowControlOptions, writes and reads don't
+// take turns. Producers queue requests with enqueueRequest, from any thread,
+// and call finishSending after the last one, while every response that
+// arrives is passed to readResponse. The queue is bounded by its high
+// watermark, so a producer that outruns the network gets false from
+// enqueueRequest and should wait for onReadyToSend before it queues more.
 template <class Request, class Response>
 class ClientBidiReactorBase : public grpc::ClientBidiReactor<Request, Response>,
                               public BaseReactor {
   std::shared_ptr<ReactorStatusHolder> statusHolder =
       std::make_shared<ReactorStatusHolder>();
+  ReactorMessagePool<Request> requests;
+  ReactorMessagePool<Response> responses;
+  Request *request;
   std::shared_ptr<Response> response = nullptr;
+  std::unique_ptr<ClientSendQueue<Request>> sendQueue;
   void nextWrite();
-
-protected:
-  Request request;
+  void sendNext();
 
 public:
   grpc::ClientContext context;
 
+  explicit ClientBidiReactorBase(bool useArena = false);
+  ClientBidiReactorBase(
+      const ClientFlowControlOptions &flowControl,
+      bool useArena = false);
+
   // this should be called explicitly right after the reactor is created
   void start();
 
@@ -37,6 +59,25 @@ public:
   void terminateCallback() override{};
   std::shared_ptr<ReactorStatusHolder> getStatusHolder() override;
 
+  // these methods are only used with flow control
+  // - returns whether the request has been queued, it is not if the queue is
+  // full or the stream doesn't accept more requests
+  bool enqueueRequest(Request &&request);
+  // writes are done once the queued requests have been written
+  void finishSending();
+  size_t getQueuedBytes();
+  // Called when the queue has gone down to its low watermark after being
+  // full. It may be called on a gRPC thread, so it shouldn't block.
+  virtual void onReadyToSend(){};
+  // - argument response - response from the server that was read during the
+  // current cycle, it is reused once this method returns
+  // - returns status - if the connection is about to be
+  // continued, nullptr should be returned. Any other returned value will
+  // terminate the connection with a given status
+  virtual std::unique_ptr<grpc::Status> readResponse(Response &response) {
+    return nullptr;
+  }
+
   // these methods come from gRPC
   // https://github.com/grpc/grpc/blob/v1.39.x/include/grpcpp/impl/codegen/client_callback.h#L237
   void OnWriteDone(bool ok) override;
@@ -46,21 +87,94 @@ public:
 
   // - argument request - request that's about to be prepared for the next cycle
   // - argument previousResponse - response received during the previous cycle
-  // (may be nullptr)
+  // (may be nullptr), it is owned by the reactor and reused in the next cycle
   // - returns status - if the connection is about to be
   // continued, nullptr should be returned. Any other returned value will
   // terminate the connection with a given status
+  // It is not called with flow control, so only the reactors without it
+  // override it
   virtual std::unique_ptr<grpc::Status> prepareRequest(
       Request &request,
-      std::shared_ptr<Response> previousResponse) = 0;
+      std::shared_ptr<Response> previousResponse) {
+    return std::make_unique<grpc::Status>(
+        grpc::StatusCode::INTERNAL,
+        "reactor without a send queue doesn't implement prepareRequest");
+  }
 };
 
+template <class Request, class Response>
+ClientBidiReactorBase<Request, Response>::ClientBidiReactorBase(bool useArena)
+    : requests(useArena), responses(useArena) {
+  this->request = this->requests.acquire();
+}
+
+template <class Request, class Response>
+ClientBidiReactorBase<Request, Response>::ClientBidiReactorBase(
+    const ClientFlowControlOptions &flowControl,
+    bool useArena)
+    : ClientBidiReactorBase(useArena) {
+  this->sendQueue =
+      std::make_unique<ClientSendQueue<Request>>(flowControl, useArena);
+}
+
+// Has to be called after the reactor has started
+template <class Request, class Response>
+void ClientBidiReactorBase<Request, Response>::sendNext() {
+  bool moreQueued = false;
+  Request *request = this->sendQueue->startWrite(moreQueued);
+  if (request != nullptr) {
+    grpc::WriteOptions options;
+    if (moreQueued) {
+      options.set_buffer_hint();
+    }
+    this->StartWrite(request, options);
+    return;
+  }
+  // The server may still be sending responses, so the connection is over
+  // only once it closes its side
+  if (this->sendQueue->takeWritesDone()) {
+    this->StartWritesDone();
+  }
+}
+
+template <class Request, class Response>
+bool ClientBidiReactorBase<Request, Response>::enqueueRequest(
+    Request &&request) {
+  if (this->sendQueue == nullptr ||
+      !this->sendQueue->push(std::move(request))) {
+    return false;
+  }
+  if (this->statusHolder->state != ReactorState::NONE) {
+    this->sendNext();
+  }
+  return true;
+}
+
+template <class Request, class Response>
+void ClientBidiReactorBase<Request, Response>::finishSending() {
+  if (this->sendQueue == nullptr) {
+    return;
+  }
+  this->sendQueue->close(false);
+  if (this->statusHolder->state != ReactorState::NONE) {
+    this->sendNext();
+  }
+}
+
+template <class Request, class Response>
+size_t ClientBidiReactorBase<Request, Response>::getQueuedBytes() {
+  if (this->sendQueue == nullptr) {
+    return 0;
+  }
+  return this->sendQueue->getQueuedBytes();
+}
+
 template <class Request, class Response>
 void ClientBidiReactorBase<Request, Response>::nextWrite() {
-  this->request = Request();
+  this->request->Clear();
   try {
     std::unique_ptr<grpc::Status> status =
-        this->prepareRequest(this->request, this->response);
+        this->prepareRequest(*this->request, this->response);
     if (status != nullptr) {
       this->terminate(*status);
       return;
@@ -69,7 +183,7 @@ void ClientBidiReactorBase<Request, Response>::nextWrite() {
     this->terminate(grpc::Status(grpc::StatusCode::INTERNAL, e.what()));
     return;
   }
-  this->StartWrite(&this->request);
+  this->StartWrite(this->request);
 }
 
 template <class Request, class Response>
@@ -78,20 +192,48 @@ void ClientBidiReactorBase<Request, Response>::start() {
     return;
   }
   this->statusHolder->state = ReactorState::RUNNING;
-  this->nextWrite();
+  if (this->sendQueue == nullptr) {
+    this->nextWrite();
+    this->StartCall();
+    return;
+  }
+  // The pool owns the response
+  this->response = std::shared_ptr<Response>(
+      this->responses.acquire(), [](Response *response) {});
+  this->StartRead(this->response.get());
+  this->sendNext();
   this->StartCall();
 }
 
 template <class Request, class Response>
 void ClientBidiReactorBase<Request, Response>::OnWriteDone(bool ok) {
+  const allocation::ScopedAllocationTag allocationTag(
+      allocation::AllocationTag::REACTORS);
+  if (this->sendQueue != nullptr) {
+    bool ready = this->sendQueue->finishWrite();
+    if (!ok) {
+      this->sendQueue->close(true);
+      this->terminate(grpc::Status(grpc::StatusCode::UNKNOWN, "write error"));
+      return;
+    }
+    if (ready) {
+      this->onReadyToSend();
+    }
+    this->sendNext();
+    return;
+  }
   if (this->response == nullptr) {
-    this->response = std::make_shared<Response>();
+    // The pool owns the response
+    this->response = std::shared_ptr<Response>(
+        this->responses.acquire(), [](Response *response) {});
   }
-  this->StartRead(&(*this->response));
+  this->StartRead(this->response.get());
 }
 
 template <class Request, class Response>
 void ClientBidiReactorBase<Request, Response>::OnReadDone(bool ok) {
+  const allocation::ScopedAllocationTag allocationTag(
+      allocation::AllocationTag::REACTORS);
   if (!ok) {
     // Ending a connection on the other side results in the `ok` flag being set
     // to false. It makes it impossible to detect a failure based just on the
@@ -99,7 +241,22 @@ void ClientBidiReactorBase<Request, Response>::OnReadDone(bool ok) {
     this->terminate(grpc::Status::OK);
     return;
   }
-  this->nextWrite();
+  if (this->sendQueue == nullptr) {
+    this->nextWrite();
+    return;
+  }
+  try {
+    std::unique_ptr<grpc::Status> status =
+        this->readResponse(*this->response);
+    if (status != nullptr) {
+      this->terminate(*status);
+      return;
+    }
+  } catch (std::runtime_error &e) {
+    this->terminate(grpc::Status(grpc::StatusCode::INTERNAL, e.what()));
+    return;
+  }
+  this->StartRead(this->response.get());
 }
 
 template <class Request, class Response>
@@ -111,18 +268,29 @@ void ClientBidiReactorBase<Request, Response>::terminate(
   if (!this->statusHolder->getStatus().ok()) {
     LOG(ERROR) << this->statusHolder->getStatus().error_message();
   }
-  if (this->statusHolder->state != ReactorState::RUNNING) {
-    return;
+  if (this->statusHolder->state == ReactorState::RUNNING) {
+    this->terminateCallback();
+    try {
+      this->validate();
+    } catch (std::runtime_error &e) {
+      this->statusHolder->setStatus(
+          grpc::Status(grpc::StatusCode::INTERNAL, e.what()));
+    }
+    if (this->sendQueue == nullptr) {
+      this->StartWritesDone();
+      this->statusHolder->state = ReactorState::TERMINATED;
+      return;
+    }
+    this->statusHolder->state = ReactorState::TERMINATED;
+    this->sendQueue->close(true);
   }
-  this->terminateCallback();
-  try {
-    this->validate();
-  } catch (std::runtime_error &e) {
-    this->statusHolder->setStatus(
-        grpc::Status(grpc::StatusCode::INTERNAL, e.what()));
+  // With flow control, writes are done only once the write that is in
+  // progress has finished
+  if (this->sendQueue != nullptr &&
+      this->statusHolder->state == ReactorState::TERMINATED &&
+      this->sendQueue->takeWritesDone()) {
+    this->StartWritesDone();
   }
-  this->StartWritesDone();
-  this->statusHolder->state = ReactorState::TERMINATED;
 }
 
 template <class Request, class Response>
@@ -0,0 +1,171 @@
+#pragma once
+
+#include "ClientReadReactorBase.h"
+#include "ClientWriteReactorBase.h"
+#include "GlobalConstants.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+namespace comm {
+namespace network {
+namespace reactor {
+
+// Uploads a local file, which is memory-mapped, so that every chunk is taken
+// from the mapping as the request for it is prepared, and the file is never
+// read into memory as a whole.
+//
+// The derived class puts the chunk into the request in setChunk, e.g. with
+// set_datachunk(data, size). The memory belongs to the mapping, which lives
+// as long as the reactor. The requests that go before the data, e.g. the
+// holder and the hash of blob Put, are filled in prepareHeader.
+template <class Request, class Response>
+class ClientFileWriteReactorBase
+    : public ClientWriteReactorBase<Request, Response> {
+  size_t headers = 0;
+  bool headersDone = false;
+
+protected:
+  MappedFile file;
+  const size_t chunkSize;
+  size_t offset = 0;
+
+public:
+  ClientFileWriteReactorBase(
+      const std::string &path,
+      size_t chunkSize = ADAPTIVE_CHUNK_SIZE_INITIAL,
+      bool useArena = false);
+
+  std::unique_ptr<grpc::Status> prepareRequest(Request &request) override;
+
+  // Called for the requests before the first chunk, until it returns false
+  // - argument index - number of the request, starting from 0
+  // - returns whether the request has been filled and should be sent
+  virtual bool prepareHeader(Request &request, size_t index) {
+    return false;
+  };
+  virtual void setChunk(Request &request, const char *data, size_t size) = 0;
+};
+
+template <class Request, class Response>
+ClientFileWriteReactorBase<Request, Response>::ClientFileWriteReactorBase(
+    const std::string &path,
+    size_t chunkSize,
+    bool useArena)
+    : ClientWriteReactorBase<Request, Response>(useArena),
+      file(path),
+      chunkSize(std::max<size_t>(1, chunkSize)) {
+}
+
+template <class Request, class Response>
+std::unique_ptr<grpc::Status>
+ClientFileWriteReactorBase<Request, Response>::prepareRequest(
+    Request &request) {
+  if (!this->headersDone) {
+    if (this->prepareHeader(request, this->headers)) {
+      this->headers++;
+      return nullptr;
+    }
+    this->headersDone = true;
+  }
+  if (this->offset == this->file.size()) {
+    return std::make_unique<grpc::Status>(grpc::Status::OK);
+  }
+  const size_t size =
+      std::min(this->chunkSize, this->file.size() - this->offset);
+  this->setChunk(request, this->file.data() + this->offset, size);
+  this->offset += size;
+  return nullptr;
+}
+
+// Downloads into a local file of a known size, which is created, allocated
+// upfront and memory-mapped, so that every chunk is copied from the response
+// straight to its place in the file, and the data is never held in memory as
+// a whole.
+//
+// The derived class gets the data out of the responses in getChunk. Chunk is
+// the type of the bytes field, absl::Cord for the fields with
+// [ctype = CORD]. The download fails if the server sends more or less data
+// than the size, otherwise the file is written back before the reactor is
+// done.
+template <class Request, class Response, class Chunk = std::string>
+class ClientFileReadReactorBase
+    : public ClientReadReactorBase<Request, Response> {
+  void writeChunk(const std::string &chunk);
+  template <class Cord> void writeChunk(const Cord &chunk);
+
+protected:
+  MappedFile file;
+  size_t received = 0;
+
+public:
+  ClientFileReadReactorBase(
+      const std::string &path,
+      size_t size,
+      bool useArena = false);
+
+  std::unique_ptr<grpc::Status> readResponse(Response &response) override;
+  void validate() override;
+
+  virtual const Chunk &getChunk(const Response &response) = 0;
+};
+
+template <class Request, class Response, class Chunk>
+ClientFileReadReactorBase<Request, Response, Chunk>::
+    ClientFileReadReactorBase(
+    const std::string &path,
+    size_t size,
+    bool useArena)
+    : ClientReadReactorBase<Request, Response>(useArena), file(path, size) {
+}
+
+template <class Request, class Response, class Chunk>
+void ClientFileReadReactorBase<Request, Response, Chunk>::writeChunk(
+    const std::string &chunk) {
+  std::memcpy(
+      this->file.mutableData() + this->received, chunk.data(), chunk.size());
+  this->received += chunk.size();
+}
+
+template <class Request, class Response, class Chunk>
+template <class Cord>
+void ClientFileReadReactorBase<Request, Response, Chunk>::writeChunk(
+    const Cord &chunk) {
+  for (const auto &piece : chunk.Chunks()) {
+    std::memcpy(
+        this->file.mutableData() + this->received, piece.data(), piece.size());
+    this->received += piece.size();
+  }
+}
+
+template <class Request, class Response, class Chunk>
+std::unique_ptr<grpc::Status>
+ClientFileReadReactorBase<Request, Response, Chunk>::readResponse(
+    Response &response) {
+  const Chunk &chunk = this->getChunk(response);
+  if (chunk.size() > this->file.size() - this->received) {
+    throw std::runtime_error("received more data than expected");
+  }
+  this->writeChunk(chunk);
+  return nullptr;
+}
+
+template <class Request, class Response, class Chunk>
+void ClientFileReadReactorBase<Request, Response, Chunk>::validate() {
+  // A failed call keeps its own status
+  if (!this->getStatusHolder()->getStatus().ok()) {
+    return;
+  }
+  if (this->received != this->file.size()) {
+    throw std::runtime_error("received less data than expected");
+  }
+  this->file.flush();
+}
+
+} // namespace reactor
+} // namespace network
+} // namespace comm
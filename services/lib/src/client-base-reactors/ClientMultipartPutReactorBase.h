@@ -0,0 +1,231 @@
+#pragma once
+
+#include "ClientBidiReactorBase.h"
+#include "GlobalConstants.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace comm {
+namespace network {
+namespace reactor {
+
+// Keeps track of a multipart blob put, whose parts are uploaded by separate
+// Put streams in parallel, so that a large blob isn't limited by the
+// throughput of a single stream. The parts are numbered from 1 in the order
+// of their data. A part whose stream fails is uploaded again as a whole.
+//
+// The data isn't copied, it has to outlive the upload, e.g. a MappedFile.
+class ClientMultipartUpload {
+  struct Part {
+    uint64_t offset;
+    uint64_t size;
+    bool uploading;
+    bool uploaded;
+  };
+
+  std::mutex uploadMutex;
+  std::vector<Part> parts;
+  const char *const data;
+
+public:
+  struct ManifestEntry {
+    uint32_t partNumber;
+    uint64_t size;
+  };
+
+  // The part size is raised when needed, so that it fits the limits of the
+  // blob service and the blob doesn't have more than MULTIPART_PUT_PARTS_MAX
+  // parts. Throws if the blob is too large for any part size.
+  ClientMultipartUpload(
+      const char *data,
+      uint64_t size,
+      uint64_t partSize = MULTIPART_PUT_PART_SIZE_DEFAULT);
+
+  // Picks a part that is neither uploaded nor being uploaded
+  // - returns false if there is no such part
+  bool startPart(
+      size_t &index,
+      uint32_t &partNumber,
+      const char *&partData,
+      uint64_t &partSize);
+  // A part that isn't uploaded can be started again afterwards
+  void finishPart(size_t index, bool uploaded);
+  bool isComplete();
+  // The parts for CompleteMultipartPut, should only be taken once the upload
+  // is complete
+  std::vector<ManifestEntry> getManifest();
+};
+
+inline ClientMultipartUpload::ClientMultipartUpload(
+    const char *data,
+    uint64_t size,
+    uint64_t partSize)
+    : data(data) {
+  const uint64_t sizeForMaxParts =
+      (size + MULTIPART_PUT_PARTS_MAX - 1) / MULTIPART_PUT_PARTS_MAX;
+  partSize = std::max({partSize, MULTIPART_PUT_PART_SIZE_MIN, sizeForMaxParts});
+  partSize = std::min(partSize, MULTIPART_PUT_PART_SIZE_MAX);
+  if (sizeForMaxParts > partSize) {
+    throw std::runtime_error("blob is too large for a multipart put");
+  }
+  for (uint64_t offset = 0; offset < size; offset += partSize) {
+    this->parts.push_back(
+        {offset, std::min(partSize, size - offset), false, false});
+  }
+}
+
+inline bool ClientMultipartUpload::startPart(
+    size_t &index,
+    uint32_t &partNumber,
+    const char *&partData,
+    uint64_t &partSize) {
+  const std::lock_guard<std::mutex> lock(this->uploadMutex);
+  for (size_t i = 0; i < this->parts.size(); i++) {
+    Part &part = this->parts[i];
+    if (part.uploading || part.uploaded) {
+      continue;
+    }
+    part.uploading = true;
+    index = i;
+    partNumber = i + 1;
+    partData = this->data + part.offset;
+    partSize = part.size;
+    return true;
+  }
+  return false;
+}
+
+inline void ClientMultipartUpload::finishPart(size_t index, bool uploaded) {
+  const std::lock_guard<std::mutex> lock(this->uploadMutex);
+  Part &part = this->parts.at(index);
+  part.uploading = false;
+  part.uploaded = part.uploaded || uploaded;
+}
+
+inline bool ClientMultipartUpload::isComplete() {
+  const std::lock_guard<std::mutex> lock(this->uploadMutex);
+  for (const Part &part : this->parts) {
+    if (!part.uploaded) {
+      return false;
+    }
+  }
+  return true;
+}
+
+inline std::vector<ClientMultipartUpload::ManifestEntry>
+ClientMultipartUpload::getManifest() {
+  const std::lock_guard<std::mutex> lock(this->uploadMutex);
+  std::vector<ManifestEntry> manifest;
+  for (size_t i = 0; i < this->parts.size(); i++) {
+    manifest.push_back({static_cast<uint32_t>(i + 1), this->parts[i].size});
+  }
+  return manifest;
+}
+
+// This is how this type of reactor works:
+// - send the request that names the part to the server, e.g. PutPart
+// - send the data of the part in N chunks
+// - terminate the connection
+//
+// Every request is answered by the server before the next one is sent. The
+// parallel streams of the other parts keep the link busy meanwhile. The
+// derived class fills the first request in preparePart and puts the chunks
+// into the next ones in setChunk, e.g. with set_datachunk(data, size). A
+// multipart put is usually uploaded by a few reactors at a time. Each of
+// them starts the next part, or the same one again after a failure, in its
+// onPartDone, and the last one sends the manifest once the upload is
+// complete.
+template <class Request, class Response>
+class ClientMultipartPutReactorBase
+    : public ClientBidiReactorBase<Request, Response> {
+  bool partSent = false;
+
+protected:
+  std::shared_ptr<ClientMultipartUpload> upload;
+  const size_t partIndex;
+  const uint32_t partNumber;
+  const char *const partData;
+  const uint64_t partSize;
+  const size_t chunkSize;
+  uint64_t offset = 0;
+
+public:
+  ClientMultipartPutReactorBase(
+      std::shared_ptr<ClientMultipartUpload> upload,
+      size_t partIndex,
+      uint32_t partNumber,
+      const char *partData,
+      uint64_t partSize,
+      size_t chunkSize = ADAPTIVE_CHUNK_SIZE_INITIAL,
+      bool useArena = false);
+
+  std::unique_ptr<grpc::Status> prepareRequest(
+      Request &request,
+      std::shared_ptr<Response> previousResponse) override;
+  void doneCallback() override;
+
+  virtual void preparePart(Request &request) = 0;
+  virtual void setChunk(Request &request, const char *data, size_t size) = 0;
+  // Called when the stream of the part is over, successfully or not
+  virtual void onPartDone(){};
+};
+
+template <class Request, class Response>
+ClientMultipartPutReactorBase<Request, Response>::
+    ClientMultipartPutReactorBase(
+        std::shared_ptr<ClientMultipartUpload> upload,
+        size_t partIndex,
+        uint32_t partNumber,
+        const char *partData,
+        uint64_t partSize,
+        size_t chunkSize,
+        bool useArena)
+    : ClientBidiReactorBase<Request, Response>(useArena),
+      upload(std::move(upload)),
+      partIndex(partIndex),
+      partNumber(partNumber),
+      partData(partData),
+      partSize(partSize),
+      chunkSize(std::max<size_t>(1, chunkSize)) {
+}
+
+template <class Request, class Response>
+std::unique_ptr<grpc::Status>
+ClientMultipartPutReactorBase<Request, Response>::prepareRequest(
+    Request &request,
+    std::shared_ptr<Response> previousResponse) {
+  if (!this->partSent) {
+    this->preparePart(request);
+    this->partSent = true;
+    return nullptr;
+  }
+  if (this->offset == this->partSize) {
+    return std::make_unique<grpc::Status>(grpc::Status::OK);
+  }
+  const uint64_t size =
+      std::min<uint64_t>(this->chunkSize, this->partSize - this->offset);
+  this->setChunk(request, this->partData + this->offset, size);
+  this->offset += size;
+  return nullptr;
+}
+
+template <class Request, class Response>
+void ClientMultipartPutReactorBase<Request, Response>::doneCallback() {
+  // The server uploads the part once the stream is over, so the part is only
+  // there if the whole call succeeded
+  this->upload->finishPart(
+      this->partIndex,
+      this->offset == this->partSize &&
+          this->getStatusHolder()->getStatus().ok());
+  this->onPartDone();
+}
+
+} // namespace reactor
+} // namespace network
+} // namespace comm
@@ -0,0 +1,204 @@
+#pragma once
+
+#include "ClientReadReactorBase.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace comm {
+namespace network {
+namespace reactor {
+
+// Keeps track of a download that is split into ranges, which are fetched by
+// separate calls in parallel, e.g. blob Get with an offset and a length.
+// A range whose call fails keeps the data that it has received, so fetching
+// it again resumes where it stopped.
+class ClientRangeDownload {
+  struct Range {
+    uint64_t offset;
+    uint64_t length;
+    uint64_t received;
+    bool fetching;
+  };
+
+  std::mutex downloadMutex;
+  std::vector<Range> ranges;
+  std::string data;
+
+  // Takes the place of the chunk in the range
+  // - returns where the chunk goes in the data
+  uint64_t reserveChunk(size_t index, uint64_t size);
+
+public:
+  ClientRangeDownload(uint64_t size, uint64_t rangeSize);
+
+  // Picks a range that is neither complete nor being fetched
+  // - argument offset, length - the part of the range that is still missing
+  // - returns false if there is no such range
+  bool startRange(size_t &index, uint64_t &offset, uint64_t &length);
+  // Throws if the chunk doesn't fit in the range
+  void appendChunk(size_t index, const std::string &chunk);
+  // The same for the chunks that are cords, e.g. the bytes fields with
+  // [ctype = CORD], which are copied piece by piece instead of being
+  // flattened first
+  template <class Cord> void appendChunk(size_t index, const Cord &chunk);
+  // A range that isn't complete can be started again afterwards
+  void finishRange(size_t index);
+  bool isComplete();
+  // Should only be called once the download is complete
+  std::string takeData();
+};
+
+inline ClientRangeDownload::ClientRangeDownload(
+    uint64_t size,
+    uint64_t rangeSize) {
+  rangeSize = std::max<uint64_t>(1, rangeSize);
+  for (uint64_t offset = 0; offset < size; offset += rangeSize) {
+    this->ranges.push_back(
+        {offset, std::min(rangeSize, size - offset), 0, false});
+  }
+  this->data.resize(size);
+}
+
+inline bool ClientRangeDownload::startRange(
+    size_t &index,
+    uint64_t &offset,
+    uint64_t &length) {
+  const std::lock_guard<std::mutex> lock(this->downloadMutex);
+  for (size_t i = 0; i < this->ranges.size(); i++) {
+    Range &range = this->ranges[i];
+    if (range.fetching || range.received == range.length) {
+      continue;
+    }
+    range.fetching = true;
+    index = i;
+    offset = range.offset + range.received;
+    length = range.length - range.received;
+    return true;
+  }
+  return false;
+}
+
+inline uint64_t
+ClientRangeDownload::reserveChunk(size_t index, uint64_t size) {
+  const std::lock_guard<std::mutex> lock(this->downloadMutex);
+  Range &range = this->ranges.at(index);
+  if (size > range.length - range.received) {
+    throw std::runtime_error("received more data than requested");
+  }
+  const uint64_t position = range.offset + range.received;
+  range.received += size;
+  return position;
+}
+
+inline void
+ClientRangeDownload::appendChunk(size_t index, const std::string &chunk) {
+  const uint64_t position = this->reserveChunk(index, chunk.size());
+  // Ranges don't overlap and the buffer is never reallocated, so the copy
+  // doesn't have to hold up the other ranges
+  std::memcpy(&this->data[position], chunk.data(), chunk.size());
+}
+
+template <class Cord>
+void ClientRangeDownload::appendChunk(size_t index, const Cord &chunk) {
+  uint64_t position = this->reserveChunk(index, chunk.size());
+  for (const auto &piece : chunk.Chunks()) {
+    std::memcpy(&this->data[position], piece.data(), piece.size());
+    position += piece.size();
+  }
+}
+
+inline void ClientRangeDownload::finishRange(size_t index) {
+  const std::lock_guard<std::mutex> lock(this->downloadMutex);
+  this->ranges.at(index).fetching = false;
+}
+
+inline bool ClientRangeDownload::isComplete() {
+  const std::lock_guard<std::mutex> lock(this->downloadMutex);
+  for (const Range &range : this->ranges) {
+    if (range.fetching || range.received != range.length) {
+      return false;
+    }
+  }
+  return true;
+}
+
+inline std::string ClientRangeDownload::takeData() {
+  const std::lock_guard<std::mutex> lock(this->downloadMutex);
+  return std::move(this->data);
+}
+
+// This is how this type of reactor works:
+// - send a request for one range of a ClientRangeDownload to the server
+// - read N chunks of the range from the server
+// - terminate the connection
+//
+// The derived class fills the request with the offset and the length that it
+// is created with, and gets the data out of the responses in getChunk. A
+// download is usually fetched by a few reactors at a time. Each of them
+// starts the next range, or the same one again after a failure, in its
+// onRangeDone. Chunk is the type of the bytes field, absl::Cord for the
+// fields with [ctype = CORD].
+template <class Request, class Response, class Chunk = std::string>
+class ClientRangeReadReactorBase
+    : public ClientReadReactorBase<Request, Response> {
+protected:
+  std::shared_ptr<ClientRangeDownload> download;
+  const size_t rangeIndex;
+  const uint64_t offset;
+  const uint64_t length;
+
+public:
+  ClientRangeReadReactorBase(
+      std::shared_ptr<ClientRangeDownload> download,
+      size_t rangeIndex,
+      uint64_t offset,
+      uint64_t length,
+      bool useArena = false);
+
+  std::unique_ptr<grpc::Status> readResponse(Response &response) override;
+  void doneCallback() override;
+
+  virtual const Chunk &getChunk(const Response &response) = 0;
+  // Called when the call for the range is over, successfully or not
+  virtual void onRangeDone(){};
+};
+
+template <class Request, class Response, class Chunk>
+ClientRangeReadReactorBase<Request, Response, Chunk>::
+    ClientRangeReadReactorBase(
+    std::shared_ptr<ClientRangeDownload> download,
+    size_t rangeIndex,
+    uint64_t offset,
+    uint64_t length,
+    bool useArena)
+    : ClientReadReactorBase<Request, Response>(useArena),
+      download(std::move(download)),
+      rangeIndex(rangeIndex),
+      offset(offset),
+      length(length) {
+}
+
+template <class Request, class Response, class Chunk>
+std::unique_ptr<grpc::Status>
+ClientRangeReadReactorBase<Request, Response, Chunk>::readResponse(
+    Response &response) {
+  this->download->appendChunk(this->rangeIndex, this->getChunk(response));
+  return nullptr;
+}
+
+template <class Request, class Response, class Chunk>
+void ClientRangeReadReactorBase<Request, Response, Chunk>::doneCallback() {
+  this->download->finishRange(this->rangeIndex);
+  this->onRangeDone();
+}
+
+} // namespace reactor
+} // namespace network
+} // namespace comm
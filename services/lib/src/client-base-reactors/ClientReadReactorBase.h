@@ -1,6 +1,8 @@
 #pragma once
 
+#include "AllocationTracker.h"
 #include "BaseReactor.h"
+#include "ReactorMessagePool.h"
 
 #include <glog/logging.h>
 #include <grpcpp/grpcpp.h>
@@ -13,17 +15,23 @@ namespace reactor {
 // - send a request to the server
 // - read N responses from the server
 // - terminate the connection
+//
+// The response is reused in every cycle, optionally allocated on an arena
+// (see ReactorMessagePool).
 template <class Request, class Response>
 class ClientReadReactorBase : public grpc::ClientReadReactor<Response>,
                               public BaseReactor {
   std::shared_ptr<ReactorStatusHolder> statusHolder =
       std::make_shared<ReactorStatusHolder>();
-  Response response;
+  ReactorMessagePool<Response> responses;
+  Response *response;
 
 public:
   Request request;
   grpc::ClientContext context;
 
+  explicit ClientReadReactorBase(bool useArena = false);
+
   // this should be called explicitly right after the reactor is created
   void start();
 
@@ -40,19 +48,25 @@ public:
   void OnDone(const grpc::Status &status) override;
 
   // - argument response - response from the server that was read during the
-  // current cycle
+  // current cycle, it is reused once this method returns
   // - returns status - if the connection is about to be
   // continued, nullptr should be returned. Any other returned value will
   // terminate the connection with a given status
   virtual std::unique_ptr<grpc::Status> readResponse(Response &response) = 0;
 };
 
+template <class Request, class Response>
+ClientReadReactorBase<Request, Response>::ClientReadReactorBase(bool useArena)
+    : responses(useArena) {
+  this->response = this->responses.acquire();
+}
+
 template <class Request, class Response>
 void ClientReadReactorBase<Request, Response>::start() {
   if (this->statusHolder->state != ReactorState::NONE) {
     return;
   }
-  this->StartRead(&this->response);
+  this->StartRead(this->response);
   if (this->statusHolder->state != ReactorState::RUNNING) {
     this->StartCall();
     this->statusHolder->state = ReactorState::RUNNING;
@@ -61,6 +75,8 @@ void ClientReadReactorBase<Request, Response>::start() {
 
 template <class Request, class Response>
 void ClientReadReactorBase<Request, Response>::OnReadDone(bool ok) {
+  const allocation::ScopedAllocationTag allocationTag(
+      allocation::AllocationTag::REACTORS);
   if (!ok) {
     // Ending a connection on the other side results in the `ok` flag being set
     // to false. It makes it impossible to detect a failure based just on the
@@ -69,15 +85,17 @@ void ClientReadReactorBase<Request, Response>::OnReadDone(bool ok) {
     return;
   }
   try {
-    std::unique_ptr<grpc::Status> status = this->readResponse(this->response);
+    std::unique_ptr<grpc::Status> status =
+        this->readResponse(*this->response);
     if (status != nullptr) {
       this->terminate(*status);
       return;
     }
   } catch (std::runtime_error &e) {
     this->terminate(grpc::Status(grpc::StatusCode::INTERNAL, e.what()));
+    return;
   }
-  this->StartRead(&this->response);
+  this->StartRead(this->response);
 }
 
 template <class Request, class Response>
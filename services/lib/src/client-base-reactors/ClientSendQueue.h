@@ -0,0 +1,164 @@
+#pragma once
+
+#include "ReactorMessagePool.h"
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+
+namespace comm {
+namespace network {
+namespace reactor {
+
+// Sizes are in bytes of the serialized requests. The queue accepts requests
+// as long as it holds less than highWatermark bytes. Once it has reached it,
+// the producer is told that it can send again when the queue drops to
+// lowWatermark bytes.
+struct ClientFlowControlOptions {
+  size_t highWatermark;
+  size_t lowWatermark;
+};
+
+// Requests that a producer has queued for a client reactor, but that haven't
+// been written yet. Requests are written one at a time, in the order in which
+// they were queued. It is thread-safe, so that producers can queue requests
+// from their own threads while gRPC writes them.
+template <class Request> class ClientSendQueue {
+  struct QueuedRequest {
+    Request *request;
+    size_t size;
+  };
+
+  const size_t highWatermark;
+  const size_t lowWatermark;
+
+  std::mutex queueMutex;
+  ReactorMessagePool<Request> requests;
+  std::deque<QueuedRequest> queue;
+  size_t queuedBytes = 0;
+  bool full = false;
+  bool writing = false;
+  // Set when no more requests are going to be queued
+  bool closed = false;
+  bool drainTaken = false;
+  bool writesDoneTaken = false;
+
+  bool isDrained() const;
+
+public:
+  ClientSendQueue(const ClientFlowControlOptions &options, bool useArena);
+
+  // Returns false if the queue is full or closed. With an arena, the request
+  // is copied to it, otherwise its contents are moved.
+  bool push(Request &&request);
+  // Returns the request that should be written next, or nullptr if a write
+  // is in progress or there's nothing to write. The request stays valid until
+  // finishWrite is called.
+  Request *startWrite(bool &moreQueued);
+  // Returns true if the queue has just dropped to the low watermark after
+  // being full
+  bool finishWrite();
+  // With discard set, the requests that are not being written are dropped
+  void close(bool discard);
+  // Return true once, the first time that the queue is closed and everything
+  // in it has been written. takeDrained is meant for finishing the stream and
+  // takeWritesDone for starting WritesDone.
+  bool takeDrained();
+  bool takeWritesDone();
+  size_t getQueuedBytes();
+};
+
+template <class Request>
+ClientSendQueue<Request>::ClientSendQueue(
+    const ClientFlowControlOptions &options,
+    bool useArena)
+    : highWatermark(options.highWatermark),
+      lowWatermark(std::min(options.lowWatermark, options.highWatermark)),
+      requests(useArena) {
+}
+
+template <class Request> bool ClientSendQueue<Request>::isDrained() const {
+  return this->closed && this->queue.empty() && !this->writing;
+}
+
+template <class Request>
+bool ClientSendQueue<Request>::push(Request &&request) {
+  size_t size = request.ByteSizeLong();
+  const std::lock_guard<std::mutex> lock(this->queueMutex);
+  if (this->closed || this->full) {
+    return false;
+  }
+  Request *queuedRequest = this->requests.acquire();
+  queuedRequest->Swap(&request);
+  this->queue.push_back({queuedRequest, size});
+  // A request may go over the high watermark, otherwise requests larger than
+  // it would never be sent
+  this->queuedBytes += size;
+  this->full = this->queuedBytes >= this->highWatermark;
+  return true;
+}
+
+template <class Request>
+Request *ClientSendQueue<Request>::startWrite(bool &moreQueued) {
+  const std::lock_guard<std::mutex> lock(this->queueMutex);
+  if (this->writing || this->queue.empty()) {
+    return nullptr;
+  }
+  this->writing = true;
+  moreQueued = this->queue.size() > 1;
+  return this->queue.front().request;
+}
+
+template <class Request> bool ClientSendQueue<Request>::finishWrite() {
+  const std::lock_guard<std::mutex> lock(this->queueMutex);
+  this->queuedBytes -= this->queue.front().size;
+  this->requests.release(this->queue.front().request);
+  this->queue.pop_front();
+  this->writing = false;
+  if (!this->full || this->queuedBytes > this->lowWatermark) {
+    return false;
+  }
+  this->full = false;
+  return !this->closed;
+}
+
+template <class Request> void ClientSendQueue<Request>::close(bool discard) {
+  const std::lock_guard<std::mutex> lock(this->queueMutex);
+  this->closed = true;
+  if (!discard) {
+    return;
+  }
+  // The request that is being written has to stay until its write is done
+  while (this->queue.size() > (this->writing ? 1 : 0)) {
+    this->queuedBytes -= this->queue.back().size;
+    this->requests.release(this->queue.back().request);
+    this->queue.pop_back();
+  }
+}
+
+template <class Request> bool ClientSendQueue<Request>::takeDrained() {
+  const std::lock_guard<std::mutex> lock(this->queueMutex);
+  if (this->drainTaken || !this->isDrained()) {
+    return false;
+  }
+  this->drainTaken = true;
+  return true;
+}
+
+template <class Request> bool ClientSendQueue<Request>::takeWritesDone() {
+  const std::lock_guard<std::mutex> lock(this->queueMutex);
+  if (this->writesDoneTaken || !this->isDrained()) {
+    return false;
+  }
+  this->writesDoneTaken = true;
+  return true;
+}
+
+template <class Request> size_t ClientSendQueue<Request>::getQueuedBytes() {
+  const std::lock_guard<std::mutex> lock(this->queueMutex);
+  return this->queuedBytes;
+}
+
+} // namespace reactor
+} // namespace network
+} // namespace comm
@@ -1,10 +1,15 @@
 #pragma once
 
+#include "AllocationTracker.h"
 #include "BaseReactor.h"
+#include "ClientSendQueue.h"
+#include "ReactorMessagePool.h"
 
 #include <glog/logging.h>
 #include <grpcpp/grpcpp.h>
 
+#include <memory>
+
 namespace comm {
 namespace network {
 namespace reactor {
@@ -12,20 +17,38 @@ namespace reactor {
 // This is how this type of reactor works:
 // - write N requests to the server
 // - terminate the connection
+//
+// The request is cleared and reused in every cycle, optionally allocated on
+// an arena (see ReactorMessagePool).
+//
+// When it is created with ClientFlowControlOptions, requests are not
+// prepared by the reactor. Instead, producers queue them with enqueueRequest,
+// from any thread, and call finishSending after the last one. The queue is
+// bounded by its high watermark, so a producer that outruns the network gets
+// false from enqueueRequest and should wait for onReadyToSend before it
+// queues more.
 template <class Request, class Response>
 class ClientWriteReactorBase : public grpc::ClientWriteReactor<Request>,
                                public BaseReactor {
   std::shared_ptr<ReactorStatusHolder> statusHolder =
       std::make_shared<ReactorStatusHolder>();
-  Request request;
+  ReactorMessagePool<Request> requests;
+  Request *request;
   bool initialized = false;
+  std::unique_ptr<ClientSendQueue<Request>> sendQueue;
 
   void nextWrite();
+  void sendNext();
 
 public:
   Response response;
   grpc::ClientContext context;
 
+  explicit ClientWriteReactorBase(bool useArena = false);
+  ClientWriteReactorBase(
+      const ClientFlowControlOptions &flowControl,
+      bool useArena = false);
+
   // this should be called explicitly right after the reactor is created
   void start();
 
@@ -35,6 +58,17 @@ public:
   void terminateCallback() override{};
   std::shared_ptr<ReactorStatusHolder> getStatusHolder() override;
 
+  // these methods are only used with flow control
+  // - returns whether the request has been queued, it is not if the queue is
+  // full or the stream doesn't accept more requests
+  bool enqueueRequest(Request &&request);
+  // the stream is finished once the queued requests have been written
+  void finishSending();
+  size_t getQueuedBytes();
+  // Called when the queue has gone down to its low watermark after being
+  // full. It may be called on a gRPC thread, so it shouldn't block.
+  virtual void onReadyToSend(){};
+
   // these methods come from gRPC
   // https://github.com/grpc/grpc/blob/v1.39.x/include/grpcpp/impl/codegen/client_callback.h#L237
   void OnWriteDone(bool ok) override;
@@ -46,22 +80,96 @@ public:
   // - returns status - if the connection is about to be
   // continued, nullptr should be returned. Any other returned value will
   // terminate the connection with a given status
-  virtual std::unique_ptr<grpc::Status> prepareRequest(Request &request) = 0;
+  // It is not called with flow control, so only the reactors without it
+  // override it
+  virtual std::unique_ptr<grpc::Status> prepareRequest(Request &request) {
+    return std::make_unique<grpc::Status>(
+        grpc::StatusCode::INTERNAL,
+        "reactor without a send queue doesn't implement prepareRequest");
+  }
 };
 
+template <class Request, class Response>
+ClientWriteReactorBase<Request, Response>::ClientWriteReactorBase(
+    bool useArena)
+    : requests(useArena) {
+  this->request = this->requests.acquire();
+}
+
+template <class Request, class Response>
+ClientWriteReactorBase<Request, Response>::ClientWriteReactorBase(
+    const ClientFlowControlOptions &flowControl,
+    bool useArena)
+    : ClientWriteReactorBase(useArena) {
+  this->sendQueue =
+      std::make_unique<ClientSendQueue<Request>>(flowControl, useArena);
+}
+
+// Has to be called after the reactor has started
+template <class Request, class Response>
+void ClientWriteReactorBase<Request, Response>::sendNext() {
+  bool moreQueued = false;
+  Request *request = this->sendQueue->startWrite(moreQueued);
+  if (request != nullptr) {
+    grpc::WriteOptions options;
+    if (moreQueued) {
+      options.set_buffer_hint();
+    }
+    this->StartWrite(request, options);
+    return;
+  }
+  if (this->sendQueue->takeDrained()) {
+    this->terminate(grpc::Status::OK);
+  }
+}
+
+template <class Request, class Response>
+bool ClientWriteReactorBase<Request, Response>::enqueueRequest(
+    Request &&request) {
+  if (this->sendQueue == nullptr ||
+      !this->sendQueue->push(std::move(request))) {
+    return false;
+  }
+  if (this->statusHolder->state != ReactorState::NONE) {
+    this->sendNext();
+  }
+  return true;
+}
+
+template <class Request, class Response>
+void ClientWriteReactorBase<Request, Response>::finishSending() {
+  if (this->sendQueue == nullptr) {
+    return;
+  }
+  this->sendQueue->close(false);
+  if (this->statusHolder->state != ReactorState::NONE) {
+    this->sendNext();
+  }
+}
+
+template <class Request, class Response>
+size_t ClientWriteReactorBase<Request, Response>::getQueuedBytes() {
+  if (this->sendQueue == nullptr) {
+    return 0;
+  }
+  return this->sendQueue->getQueuedBytes();
+}
+
 template <class Request, class Response>
 void ClientWriteReactorBase<Request, Response>::nextWrite() {
-  this->request = Request();
+  this->request->Clear();
   try {
-    std::unique_ptr<grpc::Status> status = this->prepareRequest(this->request);
+    std::unique_ptr<grpc::Status> status =
+        this->prepareRequest(*this->request);
     if (status != nullptr) {
       this->terminate(*status);
       return;
     }
   } catch (std::runtime_error &e) {
     this->terminate(grpc::Status(grpc::StatusCode::INTERNAL, e.what()));
+    return;
   }
-  this->StartWrite(&this->request);
+  this->StartWrite(this->request);
   if (!this->initialized) {
     this->StartCall();
     this->initialized = true;
@@ -70,20 +178,39 @@ void ClientWriteReactorBase<Request, Response>::nextWrite() {
 
 template <class Request, class Response>
 void ClientWriteReactorBase<Request, Response>::start() {
-  throw std::runtime_error("this class has not been tested");
   if (this->statusHolder->state != ReactorState::NONE) {
     return;
   }
   this->statusHolder->state = ReactorState::RUNNING;
-  this->nextWrite();
+  if (this->sendQueue == nullptr) {
+    this->nextWrite();
+    return;
+  }
+  this->StartCall();
+  this->initialized = true;
+  this->sendNext();
 }
 
 template <class Request, class Response>
 void ClientWriteReactorBase<Request, Response>::OnWriteDone(bool ok) {
+  const allocation::ScopedAllocationTag allocationTag(
+      allocation::AllocationTag::REACTORS);
+  if (this->sendQueue != nullptr) {
+    bool ready = this->sendQueue->finishWrite();
+    if (!ok) {
+      this->sendQueue->close(true);
+    } else if (ready) {
+      this->onReadyToSend();
+    }
+  }
   if (!ok) {
     this->terminate(grpc::Status(grpc::StatusCode::UNKNOWN, "write error"));
     return;
   }
+  if (this->sendQueue != nullptr) {
+    this->sendNext();
+    return;
+  }
   this->nextWrite();
 }
 
@@ -96,18 +223,28 @@ void ClientWriteReactorBase<Request, Response>::terminate(
   if (!this->statusHolder->getStatus().ok()) {
     LOG(ERROR) << this->statusHolder->getStatus().error_message();
   }
-  if (this->statusHolder->state != ReactorState::RUNNING) {
-    return;
+  if (this->statusHolder->state == ReactorState::RUNNING) {
+    this->terminateCallback();
+    try {
+      this->validate();
+    } catch (std::runtime_error &e) {
+      this->statusHolder->setStatus(
+          grpc::Status(grpc::StatusCode::INTERNAL, e.what()));
+    }
+    this->statusHolder->state = ReactorState::TERMINATED;
+    if (this->sendQueue == nullptr) {
+      this->StartWritesDone();
+      return;
+    }
+    this->sendQueue->close(true);
   }
-  this->terminateCallback();
-  try {
-    this->validate();
-  } catch (std::runtime_error &e) {
-    this->statusHolder->setStatus(
-        grpc::Status(grpc::StatusCode::INTERNAL, e.what()));
+  // With flow control, writes are done only once the write that is in
+  // progress has finished
+  if (this->sendQueue != nullptr &&
+      this->statusHolder->state == ReactorState::TERMINATED &&
+      this->sendQueue->takeWritesDone()) {
+    this->StartWritesDone();
   }
-  this->statusHolder->state = ReactorState::TERMINATED;
-  this->StartWritesDone();
 }
 
 template <class Request, class Response>
@@ -1,12 +1,18 @@
 #pragma once
 
+#include "AllocationTracker.h"
 #include "BaseReactor.h"
+#include "ReactorMessagePool.h"
+#include "ServerReactorMetrics.h"
 #include "ThreadPool.h"
 
 #include <grpcpp/grpcpp.h>
 
+#include <algorithm>
 #include <atomic>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 
@@ -29,26 +35,66 @@ struct ServerBidiReactorStatus {
 //   - read a request from the client
 //   - write a response to the client
 // - terminate the connection
+//
+// With a pipeline window larger than 1, the next request is read while the
+// previous ones are still being handled or their responses written, as long
+// as no more than pipelineWindow requests are waiting for a response.
+// Requests are still handled one at a time and responses are written in the
+// order of the requests. Responses that have others queued behind them are
+// written with a buffer hint, so that gRPC can send them together in fewer
+// frames.
+//
+// Requests and responses are taken from pools and reused once they have been
+// handled and written, optionally allocated on an arena (see
+// ReactorMessagePool).
 template <class Request, class Response>
 class ServerBidiReactorBase : public grpc::ServerBidiReactor<Request, Response>,
                               public BaseReactor {
+  // Declared first, so that it is destroyed last
+  metrics::LifetimeTracker lifetimeTracker{
+      getServerReactorMetrics(ServerReactorType::BIDI)};
   std::shared_ptr<ReactorStatusHolder> statusHolder =
       std::make_shared<ReactorStatusHolder>();
 
   std::atomic<int> ongoingPoolTaskCounter{0};
 
-  Request request;
-  Response response;
+  const size_t pipelineWindow;
+  // Guards everything below, except for the buffers that gRPC reads into and
+  // writes from while their operation is in progress
+  std::mutex pipelineMutex;
+  ReactorMessagePool<Request> requests;
+  ReactorMessagePool<Response> responses;
+  Request *request;
+  std::deque<Request *> pendingRequests;
+  std::deque<Response *> pendingResponses;
+  bool reading = false;
+  // Whether a pool task is handling requests, and whether it is in the
+  // middle of one
+  bool handling = false;
+  bool handlingRequest = false;
+  bool writing = false;
+  // Set when the connection is terminated while a write is in progress, so
+  // that finishing waits for the responses that are already queued
+  bool finishPending = false;
+  // Sent with the status if it has sendLastResponse set
+  Response *response = nullptr;
 
   void beginPoolTask();
   void finishPoolTask();
+  size_t countOutstandingRequests() const;
+  void startNextRead();
+  void startNextWrite();
+  void handleRequests();
+  void finish();
 
 protected:
   ServerBidiReactorStatus status;
   bool readingAborted = false;
 
 public:
-  ServerBidiReactorBase();
+  explicit ServerBidiReactorBase(
+      size_t pipelineWindow = 1,
+      bool useArena = false);
 
   // these methods come from the BaseReactor(go there for more information)
   void terminate(const grpc::Status &status) override;
@@ -68,20 +114,27 @@ public:
   void setStatus(const ServerBidiReactorStatus &status);
 
   // - argument request - request that was sent by the client and received by
-  // the server in the current cycle
+  // the server in the current cycle, it is reused once this method returns
   // - argument response - response that will be sent to the client in the
   // current cycle
   // - returns status - if the connection is about to be
   // continued, nullptr should be returned. Any other returned value will
   // terminate the connection with a given status
   virtual std::unique_ptr<ServerBidiReactorStatus>
-  handleRequest(Request request, Response *response) = 0;
+  handleRequest(Request &request, Response *response) = 0;
 };
 
 template <class Request, class Response>
-ServerBidiReactorBase<Request, Response>::ServerBidiReactorBase() {
+ServerBidiReactorBase<Request, Response>::ServerBidiReactorBase(
+    size_t pipelineWindow,
+    bool useArena)
+    : pipelineWindow(std::max<size_t>(1, pipelineWindow)),
+      requests(useArena),
+      responses(useArena) {
   this->statusHolder->state = ReactorState::RUNNING;
-  this->StartRead(&this->request);
+  this->reading = true;
+  this->request = this->requests.acquire();
+  this->StartRead(this->request);
 }
 
 template <class Request, class Response>
@@ -98,7 +151,8 @@ void ServerBidiReactorBase<Request, Response>::OnDone() {
         this->statusHolder->state = ReactorState::DONE;
         this->doneCallback();
       },
-      [this](std::unique_ptr<std::string> err) { this->finishPoolTask(); });
+      [this](std::unique_ptr<std::string> err) { this->finishPoolTask(); },
+      ThreadPoolLane::CONTROL);
 }
 
 template <class Request, class Response>
@@ -116,19 +170,17 @@ void ServerBidiReactorBase<Request, Response>::terminate(
           this->setStatus(ServerBidiReactorStatus(
               grpc::Status(grpc::StatusCode::INTERNAL, std::string(*err))));
         }
-        if (this->statusHolder->state != ReactorState::RUNNING) {
-          this->finishPoolTask();
-          return;
+        {
+          const std::lock_guard<std::mutex> lock(this->pipelineMutex);
+          if (this->writing) {
+            this->finishPending = true;
+          } else {
+            this->finish();
+          }
         }
-        if (this->getStatus().sendLastResponse) {
-          this->StartWriteAndFinish(
-              &this->response, grpc::WriteOptions(), this->getStatus().status);
-        } else {
-          this->Finish(this->getStatus().status);
-        }
-        this->statusHolder->state = ReactorState::TERMINATED;
         this->finishPoolTask();
-      });
+      },
+      ThreadPoolLane::CONTROL);
 }
 
 template <class Request, class Response>
@@ -145,26 +197,38 @@ void ServerBidiReactorBase<Request, Response>::setStatus(
 
 template <class Request, class Response>
 void ServerBidiReactorBase<Request, Response>::OnReadDone(bool ok) {
+  const allocation::ScopedAllocationTag allocationTag(
+      allocation::AllocationTag::REACTORS);
   if (!ok) {
-    this->readingAborted = true;
+    bool drained;
+    {
+      const std::lock_guard<std::mutex> lock(this->pipelineMutex);
+      this->reading = false;
+      this->readingAborted = true;
+      drained = !this->countOutstandingRequests();
+    }
     // Ending a connection on the other side results in the `ok` flag being set
     // to false. It makes it impossible to detect a failure based just on the
-    // flag. We should manually check if the data we received is valid
-    this->terminate(ServerBidiReactorStatus(grpc::Status::OK));
+    // flag. We should manually check if the data we received is valid.
+    // Requests that are still in the pipeline get their responses first.
+    if (drained) {
+      this->terminate(ServerBidiReactorStatus(grpc::Status::OK));
+    }
     return;
   }
+  {
+    const std::lock_guard<std::mutex> lock(this->pipelineMutex);
+    this->reading = false;
+    this->pendingRequests.push_back(this->request);
+    this->startNextRead();
+    if (this->handling) {
+      return;
+    }
+    this->handling = true;
+  }
   this->beginPoolTask();
   ThreadPool::getInstance().scheduleWithCallback(
-      [this]() {
-        this->response = Response();
-        std::unique_ptr<ServerBidiReactorStatus> status =
-            this->handleRequest(this->request, &this->response);
-        if (status != nullptr) {
-          this->terminate(*status);
-          return;
-        }
-        this->StartWrite(&this->response);
-      },
+      [this]() { this->handleRequests(); },
       [this](std::unique_ptr<std::string> err) {
         if (err != nullptr) {
           this->terminate(ServerBidiReactorStatus(
@@ -176,12 +240,40 @@ void ServerBidiReactorBase<Request, Response>::OnReadDone(bool ok) {
 
 template <class Request, class Response>
 void ServerBidiReactorBase<Request, Response>::OnWriteDone(bool ok) {
+  const allocation::ScopedAllocationTag allocationTag(
+      allocation::AllocationTag::REACTORS);
   if (!ok) {
+    {
+      const std::lock_guard<std::mutex> lock(this->pipelineMutex);
+      for (Response *response : this->pendingResponses) {
+        this->responses.release(response);
+      }
+      this->pendingResponses.clear();
+      this->writing = false;
+    }
     this->terminate(ServerBidiReactorStatus(
         grpc::Status(grpc::StatusCode::ABORTED, "write failed")));
     return;
   }
-  this->StartRead(&this->request);
+  bool drained;
+  {
+    const std::lock_guard<std::mutex> lock(this->pipelineMutex);
+    this->responses.release(this->pendingResponses.front());
+    this->pendingResponses.pop_front();
+    this->writing = false;
+    this->startNextWrite();
+    if (this->finishPending) {
+      if (!this->writing) {
+        this->finish();
+      }
+      return;
+    }
+    this->startNextRead();
+    drained = this->readingAborted && !this->countOutstandingRequests();
+  }
+  if (drained) {
+    this->terminate(ServerBidiReactorStatus(grpc::Status::OK));
+  }
 }
 
 template <class Request, class Response>
@@ -190,6 +282,97 @@ ServerBidiReactorBase<Request, Response>::getStatusHolder() {
   return this->statusHolder;
 }
 
+template <class Request, class Response>
+size_t
+ServerBidiReactorBase<Request, Response>::countOutstandingRequests() const {
+  return this->pendingRequests.size() + (this->handlingRequest ? 1 : 0) +
+      this->pendingResponses.size();
+}
+
+// gRPC never runs reactions inline from the calls that start operations, so
+// they are started with pipelineMutex locked. This way nothing is started
+// once the reactor has finished.
+template <class Request, class Response>
+void ServerBidiReactorBase<Request, Response>::startNextRead() {
+  if (this->reading || this->readingAborted || this->finishPending ||
+      this->statusHolder->state != ReactorState::RUNNING ||
+      this->countOutstandingRequests() >= this->pipelineWindow) {
+    return;
+  }
+  this->reading = true;
+  this->request = this->requests.acquire();
+  this->StartRead(this->request);
+}
+
+template <class Request, class Response>
+void ServerBidiReactorBase<Request, Response>::startNextWrite() {
+  if (this->writing || this->pendingResponses.empty() ||
+      this->statusHolder->state != ReactorState::RUNNING) {
+    return;
+  }
+  this->writing = true;
+  grpc::WriteOptions options;
+  if (this->pendingResponses.size() > 1) {
+    options.set_buffer_hint();
+  }
+  this->StartWrite(this->pendingResponses.front(), options);
+}
+
+template <class Request, class Response>
+void ServerBidiReactorBase<Request, Response>::handleRequests() {
+  while (true) {
+    Request *currentRequest;
+    Response *currentResponse;
+    {
+      const std::lock_guard<std::mutex> lock(this->pipelineMutex);
+      if (this->pendingRequests.empty() || this->finishPending ||
+          this->statusHolder->state != ReactorState::RUNNING) {
+        this->handling = false;
+        return;
+      }
+      currentRequest = this->pendingRequests.front();
+      this->pendingRequests.pop_front();
+      currentResponse = this->responses.acquire();
+      this->handlingRequest = true;
+    }
+    std::unique_ptr<ServerBidiReactorStatus> status =
+        this->handleRequest(*currentRequest, currentResponse);
+    if (status != nullptr) {
+      {
+        const std::lock_guard<std::mutex> lock(this->pipelineMutex);
+        this->requests.release(currentRequest);
+        this->response = currentResponse;
+      }
+      this->terminate(*status);
+      return;
+    }
+    const std::lock_guard<std::mutex> lock(this->pipelineMutex);
+    this->requests.release(currentRequest);
+    this->handlingRequest = false;
+    this->pendingResponses.push_back(currentResponse);
+    this->startNextWrite();
+  }
+}
+
+// Has to be called with pipelineMutex locked
+template <class Request, class Response>
+void ServerBidiReactorBase<Request, Response>::finish() {
+  ReactorState running = ReactorState::RUNNING;
+  if (!this->statusHolder->state.compare_exchange_strong(
+          running, ReactorState::TERMINATED)) {
+    return;
+  }
+  if (this->getStatus().sendLastResponse) {
+    if (this->response == nullptr) {
+      this->response = this->responses.acquire();
+    }
+    this->StartWriteAndFinish(
+        this->response, grpc::WriteOptions(), this->getStatus().status);
+  } else {
+    this->Finish(this->getStatus().status);
+  }
+}
+
 template <class Request, class Response>
 void ServerBidiReactorBase<Request, Response>::beginPoolTask() {
   this->ongoingPoolTaskCounter++;
@@ -197,8 +380,9 @@ void ServerBidiReactorBase<Request, Response>::beginPoolTask() {
 
 template <class Request, class Response>
 void ServerBidiReactorBase<Request, Response>::finishPoolTask() {
-  this->ongoingPoolTaskCounter--;
-  if (!this->ongoingPoolTaskCounter.load() &&
+  // Pipelined reactors finish tasks on several threads at once, so only the
+  // thread that finishes the last one may delete the reactor
+  if (this->ongoingPoolTaskCounter.fetch_sub(1) == 1 &&
       this->statusHolder->state == ReactorState::DONE) {
     // This looks weird but apparently it is okay to do this. More
     // information:
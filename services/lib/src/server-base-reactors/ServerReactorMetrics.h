@@ -0,0 +1,42 @@
+#pragma once
+
+#include "Metrics.h"
+
+#include <array>
+#include <string>
+
+namespace comm {
+namespace network {
+namespace reactor {
+
+enum class ServerReactorType {
+  BIDI = 0,
+  READ = 1,
+  WRITE = 2,
+};
+
+// The reactors of a type share their metrics, which are looked up once
+inline const metrics::LifetimeMetrics &
+getServerReactorMetrics(ServerReactorType type) {
+  static const auto createMetrics = [](const std::string &type) {
+    metrics::MetricsRegistry &registry =
+        metrics::MetricsRegistry::getInstance();
+    const std::string labels = "type=\"" + type + "\"";
+    return metrics::LifetimeMetrics{
+        registry.getGauge(
+            "comm_grpc_server_reactors",
+            "Server reactors that haven't been deleted yet",
+            labels),
+        registry.getHistogram(
+            "comm_grpc_server_reactor_lifetime_seconds",
+            "Time from the creation of a server reactor to its deletion",
+            labels)};
+  };
+  static const std::array<metrics::LifetimeMetrics, 3> reactorMetrics = {
+      {createMetrics("bidi"), createMetrics("read"), createMetrics("write")}};
+  return reactorMetrics[static_cast<size_t>(type)];
+}
+
+} // namespace reactor
+} // namespace network
+} // namespace comm
@@ -1,6 +1,9 @@
 #pragma once
 
+#include "AllocationTracker.h"
 #include "BaseReactor.h"
+#include "ReactorMessagePool.h"
+#include "ServerReactorMetrics.h"
 #include "ThreadPool.h"
 
 #include <glog/logging.h>
@@ -19,14 +22,21 @@ namespace reactor {
 // - read N requests from the client
 // - write a final response to the client (may be empty)
 // - terminate the connection
+//
+// The request is reused in every cycle, optionally allocated on an arena (see
+// ReactorMessagePool).
 template <class Request, class Response>
 class ServerReadReactorBase : public grpc::ServerReadReactor<Request>,
                               public BaseReactor {
+  // Declared first, so that it is destroyed last
+  metrics::LifetimeTracker lifetimeTracker{
+      getServerReactorMetrics(ServerReactorType::READ)};
   std::shared_ptr<ReactorStatusHolder> statusHolder =
       std::make_shared<ReactorStatusHolder>();
 
   std::atomic<int> ongoingPoolTaskCounter{0};
-  Request request;
+  ReactorMessagePool<Request> requests;
+  Request *request;
 
   void beginPoolTask();
   void finishPoolTask();
@@ -35,7 +45,7 @@ protected:
   Response *response;
 
 public:
-  ServerReadReactorBase(Response *response);
+  ServerReadReactorBase(Response *response, bool useArena = false);
 
   // these methods come from the BaseReactor(go there for more information)
   void validate() override{};
@@ -49,23 +59,28 @@ public:
   void terminate(const grpc::Status &status) override;
   void OnDone() override;
 
-  // - argument request - data read from the client in the current cycle
+  // - argument request - data read from the client in the current cycle, it
+  // is reused once this method returns
   // - returns status - if the connection is about to be
   // continued, nullptr should be returned. Any other returned value will
   // terminate the connection with a given status
-  virtual std::unique_ptr<grpc::Status> readRequest(Request request) = 0;
+  virtual std::unique_ptr<grpc::Status> readRequest(Request &request) = 0;
 };
 
 template <class Request, class Response>
 ServerReadReactorBase<Request, Response>::ServerReadReactorBase(
-    Response *response)
-    : response(response) {
+    Response *response,
+    bool useArena)
+    : requests(useArena), response(response) {
   this->statusHolder->state = ReactorState::RUNNING;
-  this->StartRead(&this->request);
+  this->request = this->requests.acquire();
+  this->StartRead(this->request);
 }
 
 template <class Request, class Response>
 void ServerReadReactorBase<Request, Response>::OnReadDone(bool ok) {
+  const allocation::ScopedAllocationTag allocationTag(
+      allocation::AllocationTag::REACTORS);
   if (!ok) {
     // Ending a connection on the other side results in the `ok` flag being set
     // to false. It makes it impossible to detect a failure based just on the
@@ -76,12 +91,13 @@ void ServerReadReactorBase<Request, Response>::OnReadDone(bool ok) {
   this->beginPoolTask();
   ThreadPool::getInstance().scheduleWithCallback(
       [this]() {
-        std::unique_ptr<grpc::Status> status = this->readRequest(this->request);
+        std::unique_ptr<grpc::Status> status =
+            this->readRequest(*this->request);
         if (status != nullptr) {
           this->terminate(*status);
           return;
         }
-        this->StartRead(&this->request);
+        this->StartRead(this->request);
       },
       [this](std::unique_ptr<std::string> err) {
         if (err != nullptr) {
@@ -114,7 +130,8 @@ void ServerReadReactorBase<Request, Response>::terminate(
           this->statusHolder->state = ReactorState::TERMINATED;
         }
         this->finishPoolTask();
-      });
+      },
+      ThreadPoolLane::CONTROL);
 }
 
 template <class Request, class Response>
@@ -125,7 +142,8 @@ void ServerReadReactorBase<Request, Response>::OnDone() {
         this->statusHolder->state = ReactorState::DONE;
         this->doneCallback();
       },
-      [this](std::unique_ptr<std::string> err) { this->finishPoolTask(); });
+      [this](std::unique_ptr<std::string> err) { this->finishPoolTask(); },
+      ThreadPoolLane::CONTROL);
 }
 
 template <class Request, class Response>
@@ -1,13 +1,19 @@
 #pragma once
 
+#include "AllocationTracker.h"
 #include "BaseReactor.h"
+#include "ReactorMessagePool.h"
+#include "ServerReactorMetrics.h"
 #include "ThreadPool.h"
 
 #include <glog/logging.h>
 #include <grpcpp/grpcpp.h>
 
+#include <algorithm>
 #include <atomic>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 
@@ -19,17 +25,43 @@ namespace reactor {
 // - read a request from the client
 // - write N responses to the client
 // - terminate the connection
+//
+// With a write queue larger than 1, responses are prepared while the previous
+// ones are still being written, as long as no more than writeQueueSize of
+// them are waiting. Responses that have others queued behind them are written
+// with a buffer hint, so that gRPC can send them together in fewer frames.
+// gRPC allows a single write at a time, so a client that doesn't keep up
+// with the stream stops the reactor from preparing more responses.
+//
+// Responses are taken from a pool and reused once they have been written,
+// optionally allocated on an arena (see ReactorMessagePool).
 template <class Request, class Response>
 class ServerWriteReactorBase : public grpc::ServerWriteReactor<Response>,
                                public BaseReactor {
+  // Declared first, so that it is destroyed last
+  metrics::LifetimeTracker lifetimeTracker{
+      getServerReactorMetrics(ServerReactorType::WRITE)};
   std::shared_ptr<ReactorStatusHolder> statusHolder =
       std::make_shared<ReactorStatusHolder>();
 
   std::atomic<int> ongoingPoolTaskCounter{0};
-  Response response;
   bool initialized = false;
 
+  const size_t writeQueueSize;
+  // Guards everything below, except for the response that gRPC is writing
+  std::mutex writeMutex;
+  ReactorMessagePool<Response> responses;
+  std::deque<Response *> pendingResponses;
+  bool preparing = false;
+  bool writing = false;
+  // Set when the connection is terminated, so that finishing waits for the
+  // responses that are already queued
+  bool finishPending = false;
+
   void nextWrite();
+  void prepareResponses();
+  void startNextWrite();
+  void finish();
   void beginPoolTask();
   void finishPoolTask();
 
@@ -38,7 +70,10 @@ protected:
   const Request &request;
 
 public:
-  ServerWriteReactorBase(const Request *request);
+  ServerWriteReactorBase(
+      const Request *request,
+      size_t writeQueueSize = 1,
+      bool useArena = false);
 
   // this should be called explicitly right after the reactor is created
   void start();
@@ -82,18 +117,27 @@ void ServerWriteReactorBase<Request, Response>::terminate(
         if (!this->statusHolder->getStatus().ok()) {
           LOG(ERROR) << this->statusHolder->getStatus().error_message();
         }
-        if (this->statusHolder->state == ReactorState::RUNNING) {
-          this->Finish(this->statusHolder->getStatus());
-          this->statusHolder->state = ReactorState::TERMINATED;
+        {
+          const std::lock_guard<std::mutex> lock(this->writeMutex);
+          if (this->writing) {
+            this->finishPending = true;
+          } else {
+            this->finish();
+          }
         }
         this->finishPoolTask();
-      });
+      },
+      ThreadPoolLane::CONTROL);
 }
 
 template <class Request, class Response>
 ServerWriteReactorBase<Request, Response>::ServerWriteReactorBase(
-    const Request *request)
-    : request(*request) {
+    const Request *request,
+    size_t writeQueueSize,
+    bool useArena)
+    : writeQueueSize(std::max<size_t>(1, writeQueueSize)),
+      responses(useArena),
+      request(*request) {
   // we cannot call this->start() here because it's going to call it on
   // the base class, not derived leading to the runtime error of calling
   // a pure virtual function
@@ -103,22 +147,18 @@ ServerWriteReactorBase<Request, Response>::ServerWriteReactorBase(
 
 template <class Request, class Response>
 void ServerWriteReactorBase<Request, Response>::nextWrite() {
+  {
+    const std::lock_guard<std::mutex> lock(this->writeMutex);
+    if (this->preparing || this->finishPending ||
+        this->statusHolder->state != ReactorState::RUNNING ||
+        this->pendingResponses.size() >= this->writeQueueSize) {
+      return;
+    }
+    this->preparing = true;
+  }
   this->beginPoolTask();
   ThreadPool::getInstance().scheduleWithCallback(
-      [this]() {
-        if (!this->initialized) {
-          this->initialize();
-          this->initialized = true;
-        }
-        this->response = Response();
-        std::unique_ptr<grpc::Status> status =
-            this->writeResponse(&this->response);
-        if (status != nullptr) {
-          this->terminate(*status);
-          return;
-        }
-        this->StartWrite(&this->response);
-      },
+      [this]() { this->prepareResponses(); },
       [this](std::unique_ptr<std::string> err) {
         if (err != nullptr) {
           this->terminate(grpc::Status(grpc::StatusCode::INTERNAL, *err));
@@ -127,6 +167,65 @@ void ServerWriteReactorBase<Request, Response>::nextWrite() {
       });
 }
 
+template <class Request, class Response>
+void ServerWriteReactorBase<Request, Response>::prepareResponses() {
+  if (!this->initialized) {
+    this->initialize();
+    this->initialized = true;
+  }
+  while (true) {
+    Response *response;
+    {
+      const std::lock_guard<std::mutex> lock(this->writeMutex);
+      response = this->responses.acquire();
+    }
+    std::unique_ptr<grpc::Status> status = this->writeResponse(response);
+    if (status != nullptr) {
+      {
+        const std::lock_guard<std::mutex> lock(this->writeMutex);
+        this->responses.release(response);
+      }
+      this->terminate(*status);
+      return;
+    }
+    const std::lock_guard<std::mutex> lock(this->writeMutex);
+    this->pendingResponses.push_back(response);
+    this->startNextWrite();
+    if (this->finishPending ||
+        this->statusHolder->state != ReactorState::RUNNING ||
+        this->pendingResponses.size() >= this->writeQueueSize) {
+      this->preparing = false;
+      return;
+    }
+  }
+}
+
+// Has to be called with writeMutex locked. gRPC never runs reactions inline
+// from StartWrite, so it is safe to start the write here.
+template <class Request, class Response>
+void ServerWriteReactorBase<Request, Response>::startNextWrite() {
+  if (this->writing || this->pendingResponses.empty() ||
+      this->statusHolder->state != ReactorState::RUNNING) {
+    return;
+  }
+  this->writing = true;
+  grpc::WriteOptions options;
+  if (this->pendingResponses.size() > 1) {
+    options.set_buffer_hint();
+  }
+  this->StartWrite(this->pendingResponses.front(), options);
+}
+
+// Has to be called with writeMutex locked
+template <class Request, class Response>
+void ServerWriteReactorBase<Request, Response>::finish() {
+  ReactorState running = ReactorState::RUNNING;
+  if (this->statusHolder->state.compare_exchange_strong(
+          running, ReactorState::TERMINATED)) {
+    this->Finish(this->statusHolder->getStatus());
+  }
+}
+
 template <class Request, class Response>
 void ServerWriteReactorBase<Request, Response>::start() {
   this->statusHolder->state = ReactorState::RUNNING;
@@ -138,7 +237,8 @@ void ServerWriteReactorBase<Request, Response>::OnDone() {
   this->beginPoolTask();
   ThreadPool::getInstance().scheduleWithCallback(
       [this]() { this->doneCallback(); },
-      [this](std::unique_ptr<std::string> err) { this->finishPoolTask(); });
+      [this](std::unique_ptr<std::string> err) { this->finishPoolTask(); },
+      ThreadPoolLane::CONTROL);
 }
 
 template <class Request, class Response>
@@ -149,10 +249,31 @@ ServerWriteReactorBase<Request, Response>::getStatusHolder() {
 
 template <class Request, class Response>
 void ServerWriteReactorBase<Request, Response>::OnWriteDone(bool ok) {
+  const allocation::ScopedAllocationTag allocationTag(
+      allocation::AllocationTag::REACTORS);
   if (!ok) {
+    {
+      const std::lock_guard<std::mutex> lock(this->writeMutex);
+      for (Response *response : this->pendingResponses) {
+        this->responses.release(response);
+      }
+      this->pendingResponses.clear();
+      this->writing = false;
+    }
     this->terminate(grpc::Status(grpc::StatusCode::INTERNAL, "writing error"));
     return;
   }
+  {
+    const std::lock_guard<std::mutex> lock(this->writeMutex);
+    this->responses.release(this->pendingResponses.front());
+    this->pendingResponses.pop_front();
+    this->writing = false;
+    this->startNextWrite();
+    if (this->finishPending && !this->writing) {
+      this->finish();
+      return;
+    }
+  }
   this->nextWrite();
 }
 
@@ -163,8 +284,8 @@ void ServerWriteReactorBase<Request, Response>::beginPoolTask() {
 
 template <class Request, class Response>
 void ServerWriteReactorBase<Request, Response>::finishPoolTask() {
-  this->ongoingPoolTaskCounter--;
-  if (!this->ongoingPoolTaskCounter.load() &&
+  // Only the thread that finishes the last task may delete the reactor
+  if (this->ongoingPoolTaskCounter.fetch_sub(1) == 1 &&
       this->statusHolder->state == ReactorState::DONE) {
     // This looks weird but apparently it is okay to do this. More
     // information:
@@ -149,6 +149,57 @@ resource "aws_dynamodb_table" "tunnelbroker-messages" {
     type = "S"
   }
 
+  attribute {
+    name = "CreatedAt"
+    type = "S"
+  }
+
+  global_secondary_index {
+    name            = "ToDeviceID-CreatedAt-index"
+    hash_key        = "ToDeviceID"
+    range_key       = "CreatedAt"
+    write_capacity  = 10
+    read_capacity   = 10
+    projection_type = "ALL"
+  }
+
+  ttl {
+    attribute_name = "Expire"
+    enabled        = true
+  }
+}
+
+resource "aws_dynamodb_table" "tunnelbroker-messages-cold" {
+  name           = "tunnelbroker-messages-cold"
+  hash_key       = "ToDeviceID"
+  range_key      = "MessageID"
+  write_capacity = 2
+  read_capacity  = 2
+
+  attribute {
+    name = "MessageID"
+    type = "S"
+  }
+
+  attribute {
+    name = "ToDeviceID"
+    type = "S"
+  }
+
+  attribute {
+    name = "CreatedAt"
+    type = "S"
+  }
+
+  global_secondary_index {
+    name            = "ToDeviceID-CreatedAt-index"
+    hash_key        = "ToDeviceID"
+    range_key       = "CreatedAt"
+    write_capacity  = 2
+    read_capacity   = 2
+    projection_type = "ALL"
+  }
+
   ttl {
     attribute_name = "Expire"
     enabled        = true
@@ -1,5 +1,6 @@
 use cxx_build::CFG;
 use glob::glob;
+use std::env;
 use std::fs;
 use std::path::Path;
 
@@ -27,13 +28,18 @@ fn main() {
   add_import_path("src/libcpp/src/DeliveryBroker");
   add_import_path("src/libcpp/src/Tools");
 
-  cxx_build::bridge("src/cxx_bridge.rs")
+  let mut build = cxx_build::bridge("src/cxx_bridge.rs");
+  build
     .files(get_cpp_sources("../lib/src"))
     .files(get_cpp_sources("src/libcpp/src"))
     .file(Path::new("src/libcpp/Tunnelbroker.cpp"))
     .flag_if_supported("-std=c++17")
-    .flag_if_supported("-w")
-    .compile("tunnelbroker");
+    .flag_if_supported("-w");
+  // Counts the allocations by subsystem, see lib/src/AllocationTracker.h
+  if env::var_os("COMM_ALLOCATION_TRACKING").is_some() {
+    build.define("COMM_ALLOCATION_TRACKING", None);
+  }
+  build.compile("tunnelbroker");
 
   println!("cargo:rustc-link-lib=boost_program_options");
   println!("cargo:rustc-link-lib=boost_system");
@@ -46,7 +52,9 @@ fn main() {
   println!("cargo:rustc-link-lib=uv");
   println!("cargo:rustc-link-lib=aws-cpp-sdk-core");
   println!("cargo:rustc-link-lib=aws-cpp-sdk-dynamodb");
+  println!("cargo:rustc-link-lib=zstd");
 
+  println!("cargo:rerun-if-env-changed=COMM_ALLOCATION_TRACKING");
   println!("cargo:rerun-if-changed=src/main.rs");
   println!("cargo:rerun-if-changed=src/libcpp/Tunnelbroker.h");
   println!("cargo:rerun-if-changed=src/libcpp/Tunnelbroker.cpp");
@@ -54,4 +62,7 @@ fn main() {
   println!("cargo:rerun-if-changed=../../shared/protos/tunnelbroker.proto");
   tonic_build::compile_protos("../../shared/protos/tunnelbroker.proto")
     .expect("Failed to compile protobuf file");
+  println!("cargo:rerun-if-changed=../../shared/protos/blob.proto");
+  tonic_build::compile_protos("../../shared/protos/blob.proto")
+    .expect("Failed to compile Blob protobuf file");
 }
@@ -0,0 +1,147 @@
+#include "MessagesStreamReactor.h"
+
+#include <chrono>
+#include <cstdlib>
+
+namespace comm {
+namespace network {
+namespace loadtest {
+
+namespace {
+
+uint64_t getMonotonicTimeUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+} // namespace
+
+MessagesStreamReactor::MessagesStreamReactor(
+    const std::string &deviceID,
+    const std::string &sessionID,
+    size_t node,
+    LoadTestStats &stats,
+    const reactor::ClientFlowControlOptions &flowControl)
+    : ClientBidiReactorBase(flowControl),
+      deviceID(deviceID),
+      node(node),
+      stats(stats) {
+  // gRPC only accepts lowercase keys, tunnelbroker reads the sessionID header
+  // case-insensitively
+  this->context.AddMetadata("sessionid", sessionID);
+}
+
+std::string MessagesStreamReactor::encodePayload(size_t node, size_t size) {
+  std::string payload =
+      std::to_string(getMonotonicTimeUs()) + ":" + std::to_string(node) + ":";
+  if (payload.size() < size) {
+    payload.resize(size, 'x');
+  }
+  return payload;
+}
+
+bool MessagesStreamReactor::decodePayload(
+    const std::string &payload,
+    uint64_t &sentAtUs,
+    size_t &node) {
+  const char *start = payload.c_str();
+  char *end = nullptr;
+  sentAtUs = std::strtoull(start, &end, 10);
+  if (end == start || *end != ':') {
+    return false;
+  }
+  start = end + 1;
+  node = std::strtoull(start, &end, 10);
+  return end != start && *end == ':';
+}
+
+const std::string &MessagesStreamReactor::getDeviceID() const {
+  return this->deviceID;
+}
+
+bool MessagesStreamReactor::isReady() const {
+  return this->ready.load();
+}
+
+std::future<grpc::Status> MessagesStreamReactor::getDoneFuture() {
+  return this->donePromise.get_future();
+}
+
+bool MessagesStreamReactor::sendMessages(
+    const std::vector<const std::string *> &toDeviceIDs,
+    size_t payloadSize) {
+  std::vector<std::pair<const std::string *, size_t>> messages;
+  messages.reserve(toDeviceIDs.size());
+  for (const std::string *toDeviceID : toDeviceIDs) {
+    messages.emplace_back(toDeviceID, payloadSize);
+  }
+  return this->sendMessages(messages);
+}
+
+bool MessagesStreamReactor::sendMessages(
+    const std::vector<std::pair<const std::string *, size_t>> &messages) {
+  tunnelbroker::MessageToTunnelbroker request;
+  tunnelbroker::MessagesToSend *messagesToSend =
+      request.mutable_messagestosend();
+  for (const std::pair<const std::string *, size_t> &toSend : messages) {
+    tunnelbroker::MessageToTunnelbrokerStruct *message =
+        messagesToSend->add_messages();
+    message->set_todeviceid(*toSend.first);
+    message->set_payload(encodePayload(this->node, toSend.second));
+  }
+  return this->enqueueRequest(std::move(request));
+}
+
+void MessagesStreamReactor::OnReadInitialMetadataDone(bool ok) {
+  if (ok) {
+    this->ready.store(true);
+  }
+}
+
+std::unique_ptr<grpc::Status> MessagesStreamReactor::readResponse(
+    tunnelbroker::MessageToClient &response) {
+  if (response.has_processedmessages()) {
+    this->stats.confirmed.fetch_add(
+        response.processedmessages().messageid_size());
+    return nullptr;
+  }
+  if (!response.has_messagestodeliver()) {
+    return nullptr;
+  }
+  const uint64_t now = getMonotonicTimeUs();
+  tunnelbroker::MessageToTunnelbroker processed;
+  for (const tunnelbroker::MessageToClientStruct &message :
+       response.messagestodeliver().messages()) {
+    processed.mutable_processedmessages()->add_messageid(message.messageid());
+    uint64_t sentAtUs;
+    size_t senderNode;
+    if (!decodePayload(message.payload(), sentAtUs, senderNode)) {
+      this->stats.invalidPayloads++;
+      continue;
+    }
+    this->stats.delivered++;
+    LatencyHistogram &latency = senderNode == this->node
+        ? this->stats.sameNodeLatency
+        : this->stats.crossNodeLatency;
+    latency.record(now > sentAtUs ? now - sentAtUs : 0);
+  }
+  // The messages stay in the database until they are processed. If the
+  // stream is full they are delivered again on the next connection, which
+  // the test doesn't make.
+  this->enqueueRequest(std::move(processed));
+  return nullptr;
+}
+
+void MessagesStreamReactor::doneCallback() {
+  const grpc::Status status = this->getStatusHolder()->getStatus();
+  // The test cancels the streams when it's over
+  if (!status.ok() && status.error_code() != grpc::StatusCode::CANCELLED) {
+    this->stats.failedStreams++;
+  }
+  this->donePromise.set_value(status);
+}
+
+} // namespace loadtest
+} // namespace network
+} // namespace comm
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "LatencyHistogram.h"
+
+#include "tunnelbroker.grpc.pb.h"
+#include "tunnelbroker.pb.h"
+
+#include "ClientBidiReactorBase.h"
+
+#include <atomic>
+#include <cstdint>
+#include <future>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace comm {
+namespace network {
+namespace loadtest {
+
+// Shared by all the streams of a test
+struct LoadTestStats {
+  // Messages that have been queued on the streams
+  std::atomic<uint64_t> sent{0};
+  // Messages that tunnelbroker has answered with their IDs
+  std::atomic<uint64_t> confirmed{0};
+  std::atomic<uint64_t> delivered{0};
+  // Messages that were due, but weren't sent because the stream was full
+  std::atomic<uint64_t> throttled{0};
+  std::atomic<uint64_t> invalidPayloads{0};
+  std::atomic<uint64_t> failedStreams{0};
+  // End-to-end latency in microseconds, split by whether the sender was
+  // connected to the same tunnelbroker node as the receiver or the message
+  // went through AMQP to another one
+  LatencyHistogram sameNodeLatency;
+  LatencyHistogram crossNodeLatency;
+};
+
+// The MessagesStream of one device. The payload of every message carries the
+// time it was sent and the node of the sender, so the latency is measured
+// when it is delivered to another stream of the same test.
+class MessagesStreamReactor
+    : public reactor::ClientBidiReactorBase<
+          tunnelbroker::MessageToTunnelbroker,
+          tunnelbroker::MessageToClient> {
+  const std::string deviceID;
+  const size_t node;
+  LoadTestStats &stats;
+  std::atomic<bool> ready{false};
+  std::promise<grpc::Status> donePromise;
+
+public:
+  MessagesStreamReactor(
+      const std::string &deviceID,
+      const std::string &sessionID,
+      size_t node,
+      LoadTestStats &stats,
+      const reactor::ClientFlowControlOptions &flowControl);
+
+  static std::string encodePayload(size_t node, size_t size);
+  // - returns false if the payload doesn't come from the load test
+  static bool decodePayload(
+      const std::string &payload,
+      uint64_t &sentAtUs,
+      size_t &node);
+
+  const std::string &getDeviceID() const;
+  // Tunnelbroker answers with the headers once the device is bound to the
+  // queue of its node, messages sent to the device before can only be read
+  // from the database
+  bool isReady() const;
+  std::future<grpc::Status> getDoneFuture();
+  // Sends one message to every device in one request
+  // - returns false if the stream is full
+  bool sendMessages(
+      const std::vector<const std::string *> &toDeviceIDs,
+      size_t payloadSize);
+  // The same with a payload size for every device
+  bool sendMessages(
+      const std::vector<std::pair<const std::string *, size_t>> &messages);
+
+  void OnReadInitialMetadataDone(bool ok) override;
+  std::unique_ptr<grpc::Status>
+  readResponse(tunnelbroker::MessageToClient &response) override;
+  void doneCallback() override;
+};
+
+} // namespace loadtest
+} // namespace network
+} // namespace comm
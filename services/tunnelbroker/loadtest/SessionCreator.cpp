@@ -0,0 +1,115 @@
+#include "SessionCreator.h"
+
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace comm {
+namespace network {
+namespace loadtest {
+
+namespace {
+
+const int RSA_KEY_BITS = 2048;
+// Has to be kept in sync with DEVICEID_CHAR_LENGTH in
+// services/tunnelbroker/src/libcpp/src/Constants.h
+const size_t DEVICE_ID_CHAR_LENGTH = 64;
+const std::string DEVICE_APP_VERSION = "loadtest";
+const std::string DEVICE_OS = "loadtest";
+
+} // namespace
+
+SessionCreator::SessionCreator() : key(nullptr, EVP_PKEY_free) {
+  std::unique_ptr<EVP_PKEY_CTX, decltype(&EVP_PKEY_CTX_free)> context(
+      EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, nullptr), EVP_PKEY_CTX_free);
+  EVP_PKEY *key = nullptr;
+  if (context == nullptr || EVP_PKEY_keygen_init(context.get()) <= 0 ||
+      EVP_PKEY_CTX_set_rsa_keygen_bits(context.get(), RSA_KEY_BITS) <= 0 ||
+      EVP_PKEY_keygen(context.get(), &key) <= 0) {
+    throw std::runtime_error("failed to generate the device key");
+  }
+  this->key.reset(key);
+
+  std::unique_ptr<BIO, decltype(&BIO_free)> bio(
+      BIO_new(BIO_s_mem()), BIO_free);
+  if (bio == nullptr || !PEM_write_bio_PUBKEY(bio.get(), this->key.get())) {
+    throw std::runtime_error("failed to write the public key");
+  }
+  char *data = nullptr;
+  const long size = BIO_get_mem_data(bio.get(), &data);
+  this->publicKeyPEM.assign(data, size);
+}
+
+std::string SessionCreator::sign(const std::string &data) const {
+  std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> context(
+      EVP_MD_CTX_new(), EVP_MD_CTX_free);
+  size_t size = 0;
+  if (context == nullptr ||
+      EVP_DigestSignInit(
+          context.get(), nullptr, EVP_sha256(), nullptr, this->key.get()) <=
+          0 ||
+      EVP_DigestSignUpdate(context.get(), data.data(), data.size()) <= 0 ||
+      EVP_DigestSignFinal(context.get(), nullptr, &size) <= 0) {
+    throw std::runtime_error("failed to sign the session request");
+  }
+  std::vector<unsigned char> signature(size);
+  if (EVP_DigestSignFinal(context.get(), signature.data(), &size) <= 0) {
+    throw std::runtime_error("failed to sign the session request");
+  }
+  std::string encoded(4 * ((size + 2) / 3), '\0');
+  const int encodedSize = EVP_EncodeBlock(
+      reinterpret_cast<unsigned char *>(&encoded[0]), signature.data(), size);
+  encoded.resize(encodedSize);
+  return encoded;
+}
+
+std::string SessionCreator::generateDeviceID() {
+  static const std::string characters =
+      "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+  thread_local std::mt19937_64 generator{std::random_device{}()};
+  std::uniform_int_distribution<size_t> distribution(
+      0, characters.size() - 1);
+  std::string deviceID = "web:";
+  for (size_t i = 0; i < DEVICE_ID_CHAR_LENGTH; i++) {
+    deviceID.push_back(characters[distribution(generator)]);
+  }
+  return deviceID;
+}
+
+std::string SessionCreator::createSession(
+    tunnelbroker::TunnelbrokerService::Stub &stub,
+    const std::string &deviceID) const {
+  tunnelbroker::SessionSignatureRequest signatureRequest;
+  tunnelbroker::SessionSignatureResponse signatureResponse;
+  signatureRequest.set_deviceid(deviceID);
+  grpc::ClientContext signatureContext;
+  grpc::Status status = stub.SessionSignature(
+      &signatureContext, signatureRequest, &signatureResponse);
+  if (!status.ok()) {
+    throw std::runtime_error(
+        "SessionSignature failed: " + status.error_message());
+  }
+
+  tunnelbroker::NewSessionRequest sessionRequest;
+  tunnelbroker::NewSessionResponse sessionResponse;
+  sessionRequest.set_deviceid(deviceID);
+  sessionRequest.set_publickey(this->publicKeyPEM);
+  sessionRequest.set_signature(this->sign(signatureResponse.tosign()));
+  sessionRequest.set_devicetype(tunnelbroker::NewSessionRequest::WEB);
+  sessionRequest.set_deviceappversion(DEVICE_APP_VERSION);
+  sessionRequest.set_deviceos(DEVICE_OS);
+  grpc::ClientContext sessionContext;
+  status =
+      stub.NewSession(&sessionContext, sessionRequest, &sessionResponse);
+  if (!status.ok()) {
+    throw std::runtime_error("NewSession failed: " + status.error_message());
+  }
+  return sessionResponse.sessionid();
+}
+
+} // namespace loadtest
+} // namespace network
+} // namespace comm
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "tunnelbroker.grpc.pb.h"
+
+#include <openssl/evp.h>
+
+#include <memory>
+#include <string>
+
+namespace comm {
+namespace network {
+namespace loadtest {
+
+// Creates tunnelbroker sessions the way the clients do: it asks for the
+// string to sign with SessionSignature and proves the ownership of the
+// public key in NewSession. All the devices share one key, generating an RSA
+// key per device would take longer than the test.
+class SessionCreator {
+  std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)> key;
+  std::string publicKeyPEM;
+
+  std::string sign(const std::string &data) const;
+
+public:
+  SessionCreator();
+
+  // Device IDs are of the web type, which unlike mobile doesn't need a
+  // notification token
+  static std::string generateDeviceID();
+  // Throws if any of the calls fails
+  // - returns sessionID
+  std::string createSession(
+      tunnelbroker::TunnelbrokerService::Stub &stub,
+      const std::string &deviceID) const;
+};
+
+} // namespace loadtest
+} // namespace network
+} // namespace comm
@@ -0,0 +1,235 @@
+#include "TraceReplay.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+namespace comm {
+namespace network {
+namespace loadtest {
+
+namespace {
+
+const size_t PROGRESS_INTERVAL_MS = 1000;
+
+double getElapsedMs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+} // namespace
+
+TraceReplay::TraceReplay(
+    const ReplayOptions &options,
+    const std::vector<std::unique_ptr<tunnelbroker::TunnelbrokerService::Stub>>
+        &stubs,
+    LoadTestStats &stats)
+    : options(options), stubs(stubs), stats(stats) {
+}
+
+size_t TraceReplay::getDeviceIndex(const std::string &pseudonym) {
+  const auto found = this->devicesByPseudonym.find(pseudonym);
+  if (found != this->devicesByPseudonym.end()) {
+    return found->second;
+  }
+  const size_t index = this->devices.size();
+  ReplayDevice device;
+  device.node = index % this->options.nodes;
+  device.channel =
+      (index / this->options.nodes) % this->options.channelsPerAddress;
+  this->devices.push_back(std::move(device));
+  this->devicesByPseudonym[pseudonym] = index;
+  return index;
+}
+
+tunnelbroker::TunnelbrokerService::Stub &
+TraceReplay::getStub(const ReplayDevice &device) const {
+  return *this->stubs
+              [device.node * this->options.channelsPerAddress +
+               device.channel];
+}
+
+void TraceReplay::load(const std::string &path) {
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    throw std::runtime_error("Can not open trace " + path);
+  }
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    trace::TraceRecord record;
+    if (!trace::parseTraceRecord(line, record)) {
+      this->invalidLines++;
+      continue;
+    }
+    this->getDeviceIndex(record.device);
+    for (const std::pair<std::string, uint64_t> &peer : record.peers) {
+      this->getDeviceIndex(peer.first);
+    }
+    this->records.push_back(std::move(record));
+  }
+  // The capture queues the events when they end, long calls come late
+  std::stable_sort(
+      this->records.begin(),
+      this->records.end(),
+      [](const trace::TraceRecord &a, const trace::TraceRecord &b) {
+        return a.offsetUs < b.offsetUs;
+      });
+}
+
+size_t TraceReplay::createSessions() {
+  std::atomic<size_t> next{0};
+  std::atomic<size_t> created{0};
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < this->options.setupConcurrency; i++) {
+    threads.emplace_back([&]() {
+      for (size_t index = next++; index < this->devices.size();
+           index = next++) {
+        ReplayDevice &device = this->devices[index];
+        device.deviceID = SessionCreator::generateDeviceID();
+        const auto start = std::chrono::steady_clock::now();
+        try {
+          device.sessionID = this->creator.createSession(
+              this->getStub(device), device.deviceID);
+        } catch (const std::runtime_error &e) {
+          std::cerr << "Failed to create a session: " << e.what()
+                    << std::endl;
+          continue;
+        }
+        this->setupLatency.record(getElapsedMs(start) * 1000);
+        created++;
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  return created.load();
+}
+
+void TraceReplay::openStream(ReplayDevice &device) {
+  device.stream = std::make_unique<MessagesStreamReactor>(
+      device.deviceID,
+      device.sessionID,
+      device.node,
+      this->stats,
+      this->options.flowControl);
+  MessagesStreamReactor &stream = *device.stream;
+  this->done.push_back(stream.getDoneFuture());
+  this->getStub(device).async()->MessagesStream(&stream.context, &stream);
+  stream.start();
+}
+
+void TraceReplay::closeStream(ReplayDevice &device) {
+  device.stream->finishSending();
+  device.stream->context.TryCancel();
+  this->closedStreams.push_back(std::move(device.stream));
+}
+
+void TraceReplay::sendMessages(
+    ReplayDevice &device,
+    const trace::TraceRecord &record) {
+  std::vector<std::pair<const std::string *, size_t>> messages;
+  messages.reserve(record.peers.size());
+  for (const std::pair<std::string, uint64_t> &peer : record.peers) {
+    const ReplayDevice &toDevice =
+        this->devices[this->devicesByPseudonym.at(peer.first)];
+    messages.emplace_back(&toDevice.deviceID, peer.second);
+  }
+  if (messages.empty()) {
+    return;
+  }
+  if (!device.stream) {
+    this->openStream(device);
+  }
+  if (device.stream->sendMessages(messages)) {
+    this->stats.sent += messages.size();
+  } else {
+    this->stats.throttled += messages.size();
+  }
+}
+
+void TraceReplay::run() {
+  if (this->records.empty()) {
+    return;
+  }
+  const uint64_t firstOffsetUs = this->records.front().offsetUs;
+  const auto start = std::chrono::steady_clock::now();
+  double nextProgressMs = PROGRESS_INTERVAL_MS;
+  for (const trace::TraceRecord &record : this->records) {
+    const auto due = start +
+        std::chrono::microseconds(static_cast<uint64_t>(
+            (record.offsetUs - firstOffsetUs) / this->options.speedup));
+    std::this_thread::sleep_until(due);
+    this->events[record.event]++;
+    ReplayDevice &device =
+        this->devices[this->devicesByPseudonym.at(record.device)];
+    if (device.sessionID.empty()) {
+      continue;
+    }
+    if (record.event == trace::EVENT_NEW_SESSION) {
+      const auto sessionStart = std::chrono::steady_clock::now();
+      try {
+        this->creator.createSession(this->getStub(device), device.deviceID);
+        this->newSessionLatency.record(getElapsedMs(sessionStart) * 1000);
+      } catch (const std::runtime_error &e) {
+        std::cerr << "Failed to create a session: " << e.what() << std::endl;
+      }
+    } else if (record.event == trace::EVENT_BIND_DEVICE) {
+      if (!device.stream) {
+        this->openStream(device);
+      }
+    } else if (record.event == trace::EVENT_UNBIND_DEVICE) {
+      if (device.stream) {
+        this->closeStream(device);
+      }
+    } else if (record.event == trace::EVENT_SEND_MESSAGES) {
+      this->sendMessages(device, record);
+    }
+    const double elapsedMs = getElapsedMs(start);
+    if (elapsedMs >= nextProgressMs) {
+      nextProgressMs += PROGRESS_INTERVAL_MS;
+      std::printf(
+          "%6.1fs sent %lu confirmed %lu delivered %lu throttled %lu\n",
+          elapsedMs / 1000,
+          static_cast<unsigned long>(this->stats.sent.load()),
+          static_cast<unsigned long>(this->stats.confirmed.load()),
+          static_cast<unsigned long>(this->stats.delivered.load()),
+          static_cast<unsigned long>(this->stats.throttled.load()));
+    }
+  }
+}
+
+void TraceReplay::finish() {
+  for (ReplayDevice &device : this->devices) {
+    if (device.stream) {
+      this->closeStream(device);
+    }
+  }
+  for (std::future<grpc::Status> &status : this->done) {
+    status.wait();
+  }
+}
+
+size_t TraceReplay::getDeviceCount() const {
+  return this->devices.size();
+}
+
+uint64_t TraceReplay::getTraceDurationUs() const {
+  if (this->records.empty()) {
+    return 0;
+  }
+  return this->records.back().offsetUs - this->records.front().offsetUs;
+}
+
+} // namespace loadtest
+} // namespace network
+} // namespace comm
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "LatencyHistogram.h"
+#include "MessagesStreamReactor.h"
+#include "SessionCreator.h"
+#include "TrafficTrace.h"
+
+#include "tunnelbroker.grpc.pb.h"
+
+#include <future>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace comm {
+namespace network {
+namespace loadtest {
+
+struct ReplayOptions {
+  // Nodes in the order of the stubs, every node has channelsPerAddress of
+  // them
+  size_t nodes;
+  size_t channelsPerAddress;
+  // 2 replays the trace twice as fast as it was captured
+  double speedup;
+  size_t setupConcurrency;
+  reactor::ClientFlowControlOptions flowControl;
+};
+
+// Replays a traffic trace captured by tunnelbroker, see TrafficCapture.h.
+// Every pseudonym of the trace becomes a device of the replay with a session
+// created up front, the devices are spread over the nodes. The calls are
+// then made at the offsets of the trace:
+// - new_session creates another session for the device and measures it
+// - bind_device opens a MessagesStream, unbind_device closes it
+// - send_messages sends messages of the recorded sizes to the same peers,
+//   from a stream that is opened first if the device isn't bound
+// The other events are results of these calls, they are only counted.
+class TraceReplay {
+  struct ReplayDevice {
+    std::string deviceID;
+    std::string sessionID;
+    size_t node;
+    size_t channel;
+    std::unique_ptr<MessagesStreamReactor> stream;
+  };
+
+  const ReplayOptions options;
+  const std::vector<std::unique_ptr<tunnelbroker::TunnelbrokerService::Stub>>
+      &stubs;
+  LoadTestStats &stats;
+  const SessionCreator creator;
+  std::vector<trace::TraceRecord> records;
+  std::vector<ReplayDevice> devices;
+  std::unordered_map<std::string, size_t> devicesByPseudonym;
+  // The streams that have been closed stay alive until they are done
+  std::vector<std::unique_ptr<MessagesStreamReactor>> closedStreams;
+  std::vector<std::future<grpc::Status>> done;
+
+  size_t getDeviceIndex(const std::string &pseudonym);
+  tunnelbroker::TunnelbrokerService::Stub &
+  getStub(const ReplayDevice &device) const;
+  void openStream(ReplayDevice &device);
+  void closeStream(ReplayDevice &device);
+  void sendMessages(ReplayDevice &device, const trace::TraceRecord &record);
+
+public:
+  LatencyHistogram setupLatency;
+  LatencyHistogram newSessionLatency;
+  uint64_t invalidLines = 0;
+  // Events of the trace by their name, with the ones that aren't replayed
+  std::map<std::string, uint64_t> events;
+
+  TraceReplay(
+      const ReplayOptions &options,
+      const std::vector<
+          std::unique_ptr<tunnelbroker::TunnelbrokerService::Stub>> &stubs,
+      LoadTestStats &stats);
+
+  // Throws if the file can't be read
+  void load(const std::string &path);
+  // - returns the number of devices that have a session
+  size_t createSessions();
+  // Blocks until the last event of the trace has been replayed
+  void run();
+  // Closes the streams that are still open and waits for all of them
+  void finish();
+
+  size_t getDeviceCount() const;
+  // Microseconds from the first event of the trace to the last one
+  uint64_t getTraceDurationUs() const;
+};
+
+} // namespace loadtest
+} // namespace network
+} // namespace comm
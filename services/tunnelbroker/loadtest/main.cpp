@@ -0,0 +1,445 @@
+// Load generator for tunnelbroker. It creates sessions for a number of
+// devices, opens a MessagesStream for each of them and makes every device
+// send messages at a fixed rate to random other devices of the test. Reports
+// the session setup time and the end-to-end delivery latency percentiles.
+//
+// With several addresses the devices are spread over them, so against a
+// cluster of tunnelbroker nodes most messages go through AMQP, their latency
+// is reported separately from the ones delivered by the same node.
+//
+// With a trace captured by tunnelbroker the test replays it instead of
+// sending at a fixed rate, see TraceReplay.h.
+//
+// Usage:
+//   tunnelbroker-loadtest --addresses=localhost:50051 --devices=1000
+//     --rate=1 --duration=60 --payload-size=256
+//   tunnelbroker-loadtest --addresses=localhost:50051
+//     --replay=tunnelbroker-traffic.tsv --speedup=2
+
+#include "MessagesStreamReactor.h"
+#include "SessionCreator.h"
+#include "TraceReplay.h"
+
+#include <boost/program_options.hpp>
+#include <glog/logging.h>
+#include <grpcpp/grpcpp.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace comm::network;
+using namespace comm::network::loadtest;
+
+namespace {
+
+const size_t SEND_TICK_MS = 10;
+const size_t PROGRESS_INTERVAL_MS = 1000;
+
+struct LoadTestOptions {
+  std::vector<std::string> addresses;
+  size_t devices;
+  // Messages per second sent by every device
+  double rate;
+  size_t durationSeconds;
+  size_t payloadSize;
+  // Messages sent in one MessagesToSend at most
+  size_t batchSize;
+  size_t setupConcurrency;
+  size_t channelsPerAddress;
+  size_t readyTimeoutSeconds;
+  size_t drainTimeoutSeconds;
+  size_t streamBufferBytes;
+  // Replaces the generated traffic if it isn't empty
+  std::string replayPath;
+  double speedup;
+};
+
+struct Device {
+  std::string deviceID;
+  std::string sessionID;
+  size_t node;
+  size_t channel;
+};
+
+bool parseOptions(int argc, char **argv, LoadTestOptions &options) {
+  namespace po = boost::program_options;
+  std::string addresses;
+  po::options_description description{"Options"};
+  description.add_options()("help", "Print the options")(
+      "addresses",
+      po::value<std::string>(&addresses)->default_value("localhost:50051"),
+      "Comma separated tunnelbroker nodes, the devices are spread over them")(
+      "devices",
+      po::value<size_t>(&options.devices)->default_value(100),
+      "Number of devices, each of them has its own stream")(
+      "rate",
+      po::value<double>(&options.rate)->default_value(1),
+      "Messages sent per second by every device")(
+      "duration",
+      po::value<size_t>(&options.durationSeconds)->default_value(30),
+      "Seconds of sending")(
+      "payload-size",
+      po::value<size_t>(&options.payloadSize)->default_value(256),
+      "Bytes of every message payload")(
+      "batch-size",
+      po::value<size_t>(&options.batchSize)->default_value(16),
+      "Messages sent in a single MessagesToSend at most")(
+      "setup-concurrency",
+      po::value<size_t>(&options.setupConcurrency)->default_value(32),
+      "Sessions created at the same time")(
+      "channels-per-address",
+      po::value<size_t>(&options.channelsPerAddress)->default_value(4),
+      "HTTP/2 connections to every node, the streams are spread over them")(
+      "ready-timeout",
+      po::value<size_t>(&options.readyTimeoutSeconds)->default_value(30),
+      "Seconds to wait for all streams to open")(
+      "drain-timeout",
+      po::value<size_t>(&options.drainTimeoutSeconds)->default_value(30),
+      "Seconds to wait for the messages in flight after sending stops")(
+      "stream-buffer",
+      po::value<size_t>(&options.streamBufferBytes)->default_value(1 << 20),
+      "Bytes queued on a stream before its messages are throttled")(
+      "replay",
+      po::value<std::string>(&options.replayPath)->default_value(""),
+      "Traffic trace captured by tunnelbroker to replay, the devices, rate, "
+      "duration and payload size options are then ignored")(
+      "speedup",
+      po::value<double>(&options.speedup)->default_value(1),
+      "How many times faster than captured the trace is replayed");
+  po::variables_map variables;
+  try {
+    po::store(po::parse_command_line(argc, argv, description), variables);
+    po::notify(variables);
+  } catch (const po::error &e) {
+    std::cerr << e.what() << std::endl << description;
+    return false;
+  }
+  if (variables.count("help")) {
+    std::cout << description;
+    return false;
+  }
+  std::stringstream stream(addresses);
+  std::string address;
+  while (std::getline(stream, address, ',')) {
+    if (!address.empty()) {
+      options.addresses.push_back(address);
+    }
+  }
+  if (options.addresses.empty() || options.devices < 2 ||
+      !options.batchSize || !options.setupConcurrency ||
+      !options.channelsPerAddress || !(options.speedup > 0)) {
+    std::cerr << "Invalid options" << std::endl << description;
+    return false;
+  }
+  return true;
+}
+
+double getElapsedMs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+void printLatency(const std::string &name, const LatencyHistogram &latency) {
+  std::printf(
+      "%-28s %10lu msgs  p50 %9.3f  p90 %9.3f  p99 %9.3f  p99.9 %9.3f  "
+      "max %9.3f ms\n",
+      name.c_str(),
+      static_cast<unsigned long>(latency.getCount()),
+      latency.getPercentile(50) / 1000.0,
+      latency.getPercentile(90) / 1000.0,
+      latency.getPercentile(99) / 1000.0,
+      latency.getPercentile(99.9) / 1000.0,
+      latency.getMax() / 1000.0);
+}
+
+void createSessions(
+    const LoadTestOptions &options,
+    const std::vector<std::unique_ptr<
+        tunnelbroker::TunnelbrokerService::Stub>> &stubs,
+    std::vector<Device> &devices,
+    LatencyHistogram &setupLatency) {
+  const SessionCreator creator;
+  std::vector<Device> created(options.devices);
+  std::vector<bool> succeeded(options.devices, false);
+  std::atomic<size_t> next{0};
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < options.setupConcurrency; i++) {
+    threads.emplace_back([&]() {
+      for (size_t index = next++; index < options.devices; index = next++) {
+        Device &device = created[index];
+        device.node = index % options.addresses.size();
+        device.channel = (index / options.addresses.size()) %
+            options.channelsPerAddress;
+        device.deviceID = SessionCreator::generateDeviceID();
+        const size_t stub =
+            device.node * options.channelsPerAddress + device.channel;
+        const auto start = std::chrono::steady_clock::now();
+        try {
+          device.sessionID =
+              creator.createSession(*stubs[stub], device.deviceID);
+        } catch (const std::runtime_error &e) {
+          std::cerr << "Failed to create a session: " << e.what()
+                    << std::endl;
+          continue;
+        }
+        setupLatency.record(getElapsedMs(start) * 1000);
+        succeeded[index] = true;
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  for (size_t i = 0; i < options.devices; i++) {
+    if (succeeded[i]) {
+      devices.push_back(std::move(created[i]));
+    }
+  }
+}
+
+// Every device sends rate messages per second, the devices are spread over
+// the second so that they don't all send in the same tick
+void sendMessages(
+    const LoadTestOptions &options,
+    const std::vector<std::unique_ptr<MessagesStreamReactor>> &streams,
+    LoadTestStats &stats) {
+  std::mt19937_64 generator{std::random_device{}()};
+  std::uniform_int_distribution<size_t> peers(0, streams.size() - 2);
+  std::vector<uint64_t> scheduled(streams.size(), 0);
+  std::vector<const std::string *> toDeviceIDs;
+  const auto start = std::chrono::steady_clock::now();
+  const double durationMs = options.durationSeconds * 1000.0;
+  double nextProgressMs = PROGRESS_INTERVAL_MS;
+  for (double elapsedMs = 0; elapsedMs < durationMs;
+       elapsedMs = getElapsedMs(start)) {
+    for (size_t i = 0; i < streams.size(); i++) {
+      const uint64_t due = static_cast<uint64_t>(
+          options.rate * elapsedMs / 1000 +
+          static_cast<double>(i) / streams.size());
+      while (scheduled[i] < due) {
+        const size_t count =
+            std::min<uint64_t>(options.batchSize, due - scheduled[i]);
+        toDeviceIDs.clear();
+        for (size_t j = 0; j < count; j++) {
+          // Skips the sender
+          size_t peer = peers(generator);
+          peer += peer >= i;
+          toDeviceIDs.push_back(&streams[peer]->getDeviceID());
+        }
+        if (streams[i]->sendMessages(toDeviceIDs, options.payloadSize)) {
+          stats.sent += count;
+        } else {
+          stats.throttled += count;
+        }
+        scheduled[i] += count;
+      }
+    }
+    if (elapsedMs >= nextProgressMs) {
+      nextProgressMs += PROGRESS_INTERVAL_MS;
+      std::printf(
+          "%6.1fs sent %lu confirmed %lu delivered %lu throttled %lu\n",
+          elapsedMs / 1000,
+          static_cast<unsigned long>(stats.sent.load()),
+          static_cast<unsigned long>(stats.confirmed.load()),
+          static_cast<unsigned long>(stats.delivered.load()),
+          static_cast<unsigned long>(stats.throttled.load()));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(SEND_TICK_MS));
+  }
+}
+
+void waitForDelivery(const LoadTestOptions &options, LoadTestStats &stats) {
+  const double drainTimeoutMs = options.drainTimeoutSeconds * 1000.0;
+  const auto start = std::chrono::steady_clock::now();
+  while (stats.delivered.load() < stats.sent.load() &&
+         getElapsedMs(start) < drainTimeoutMs) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(SEND_TICK_MS));
+  }
+}
+
+void printStats(const LoadTestStats &stats, double sendingMs) {
+  const uint64_t sent = stats.sent.load();
+  const uint64_t delivered = stats.delivered.load();
+  std::printf("\n");
+  std::printf(
+      "Sent %lu, confirmed %lu, delivered %lu, lost %lu, throttled %lu\n",
+      static_cast<unsigned long>(sent),
+      static_cast<unsigned long>(stats.confirmed.load()),
+      static_cast<unsigned long>(delivered),
+      static_cast<unsigned long>(sent > delivered ? sent - delivered : 0),
+      static_cast<unsigned long>(stats.throttled.load()));
+  std::printf(
+      "Throughput %.1f msgs/s, %lu failed streams, %lu invalid payloads\n",
+      sendingMs > 0 ? sent * 1000 / sendingMs : 0,
+      static_cast<unsigned long>(stats.failedStreams.load()),
+      static_cast<unsigned long>(stats.invalidPayloads.load()));
+}
+
+// Messages sent to devices that are never bound in the trace stay in the
+// database, the drain timeout ends the wait for them
+int replayTrace(
+    const LoadTestOptions &options,
+    const std::vector<std::unique_ptr<
+        tunnelbroker::TunnelbrokerService::Stub>> &stubs) {
+  LoadTestStats stats;
+  const ReplayOptions replayOptions{
+      options.addresses.size(),
+      options.channelsPerAddress,
+      options.speedup,
+      options.setupConcurrency,
+      {options.streamBufferBytes, options.streamBufferBytes / 2}};
+  TraceReplay replay(replayOptions, stubs, stats);
+  try {
+    replay.load(options.replayPath);
+  } catch (const std::runtime_error &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  std::printf(
+      "Loaded %lu devices and %.3f s of traffic, %lu invalid lines\n",
+      static_cast<unsigned long>(replay.getDeviceCount()),
+      replay.getTraceDurationUs() / 1e6,
+      static_cast<unsigned long>(replay.invalidLines));
+
+  auto start = std::chrono::steady_clock::now();
+  const size_t created = replay.createSessions();
+  std::printf(
+      "Created %lu of %lu sessions in %.3f ms\n",
+      static_cast<unsigned long>(created),
+      static_cast<unsigned long>(replay.getDeviceCount()),
+      getElapsedMs(start));
+
+  start = std::chrono::steady_clock::now();
+  replay.run();
+  const double sendingMs = getElapsedMs(start);
+  waitForDelivery(options, stats);
+  // The reactors log the cancellation as an error, once per stream
+  FLAGS_minloglevel = 3;
+  replay.finish();
+
+  printStats(stats, sendingMs);
+  for (const auto &[event, count] : replay.events) {
+    std::printf(
+        "%-28s %10lu events\n",
+        event.c_str(),
+        static_cast<unsigned long>(count));
+  }
+  printLatency("session setup", replay.setupLatency);
+  printLatency("new session", replay.newSessionLatency);
+  printLatency("delivery, same node", stats.sameNodeLatency);
+  printLatency("delivery, cross node", stats.crossNodeLatency);
+  return 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  LoadTestOptions options;
+  if (!parseOptions(argc, argv, options)) {
+    return 1;
+  }
+  FLAGS_logtostderr = true;
+  // Log levels INFO, WARNING, ERROR, FATAL are 0, 1, 2, 3, respectively
+  FLAGS_minloglevel = 1;
+  google::InitGoogleLogging(argv[0]);
+
+  // Separate subchannel pools make gRPC open a connection per channel
+  std::vector<std::unique_ptr<tunnelbroker::TunnelbrokerService::Stub>> stubs;
+  for (const std::string &address : options.addresses) {
+    for (size_t i = 0; i < options.channelsPerAddress; i++) {
+      grpc::ChannelArguments arguments;
+      arguments.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+      stubs.push_back(tunnelbroker::TunnelbrokerService::NewStub(
+          grpc::CreateCustomChannel(
+              address, grpc::InsecureChannelCredentials(), arguments)));
+    }
+  }
+  if (!options.replayPath.empty()) {
+    return replayTrace(options, stubs);
+  }
+
+  LatencyHistogram setupLatency;
+  std::vector<Device> devices;
+  auto start = std::chrono::steady_clock::now();
+  createSessions(options, stubs, devices, setupLatency);
+  std::printf(
+      "Created %lu of %lu sessions in %.3f ms\n",
+      static_cast<unsigned long>(devices.size()),
+      static_cast<unsigned long>(options.devices),
+      getElapsedMs(start));
+  if (devices.size() < 2) {
+    std::cerr << "At least two sessions are needed" << std::endl;
+    return 1;
+  }
+
+  LoadTestStats stats;
+  const reactor::ClientFlowControlOptions flowControl{
+      options.streamBufferBytes, options.streamBufferBytes / 2};
+  std::vector<std::unique_ptr<MessagesStreamReactor>> streams;
+  std::vector<std::future<grpc::Status>> done;
+  start = std::chrono::steady_clock::now();
+  for (const Device &device : devices) {
+    streams.push_back(std::make_unique<MessagesStreamReactor>(
+        device.deviceID,
+        device.sessionID,
+        device.node,
+        stats,
+        flowControl));
+    MessagesStreamReactor &stream = *streams.back();
+    done.push_back(stream.getDoneFuture());
+    const size_t stub =
+        device.node * options.channelsPerAddress + device.channel;
+    stubs[stub]->async()->MessagesStream(&stream.context, &stream);
+    stream.start();
+  }
+  size_t ready = 0;
+  const double readyTimeoutMs = options.readyTimeoutSeconds * 1000.0;
+  while (getElapsedMs(start) < readyTimeoutMs) {
+    ready = std::count_if(
+        streams.begin(),
+        streams.end(),
+        [](const std::unique_ptr<MessagesStreamReactor> &stream) {
+          return stream->isReady();
+        });
+    if (ready == streams.size()) {
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(SEND_TICK_MS));
+  }
+  std::printf(
+      "Opened %lu of %lu streams in %.3f ms\n",
+      static_cast<unsigned long>(ready),
+      static_cast<unsigned long>(streams.size()),
+      getElapsedMs(start));
+
+  start = std::chrono::steady_clock::now();
+  sendMessages(options, streams, stats);
+  const double sendingMs = getElapsedMs(start);
+
+  waitForDelivery(options, stats);
+  // Tunnelbroker keeps the stream open after the client is done writing. The
+  // reactors log the cancellation as an error, once per stream.
+  FLAGS_minloglevel = 3;
+  for (std::unique_ptr<MessagesStreamReactor> &stream : streams) {
+    stream->finishSending();
+    stream->context.TryCancel();
+  }
+  for (std::future<grpc::Status> &status : done) {
+    status.wait();
+  }
+
+  printStats(stats, sendingMs);
+  printLatency("session setup", setupLatency);
+  printLatency("delivery, same node", stats.sameNodeLatency);
+  printLatency("delivery, cross node", stats.crossNodeLatency);
+  return 0;
+}
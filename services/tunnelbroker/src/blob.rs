@@ -0,0 +1,127 @@
+use crate::constants::{BLOB_PUT_CHANNEL_CAPACITY, BLOB_PUT_CHUNK_SIZE};
+use crate::cxx_bridge::ffi::{getConfigParameter, MessageItem};
+use anyhow::{anyhow, Result};
+use futures::future::join_all;
+use lazy_static::lazy_static;
+use tokio::sync::mpsc;
+use tokio_stream::wrappers::ReceiverStream;
+use tonic::transport::{Channel, Endpoint};
+use tracing::error;
+
+mod proto {
+  tonic::include_proto!("blob");
+}
+use proto::blob_service_client::BlobServiceClient;
+use proto::put_request::Data as PutRequestData;
+use proto::{PutRequest, PutResponse};
+
+struct BlobConfig {
+  service_url: String,
+  payload_offload_threshold: usize,
+}
+
+lazy_static! {
+  static ref CONFIG: BlobConfig = BlobConfig {
+    service_url: getConfigParameter("blob.service_url")
+      .expect("Error getting `blob.service_url` config parameter"),
+    payload_offload_threshold: getConfigParameter(
+      "blob.payload_offload_threshold"
+    )
+    .expect("Error getting `blob.payload_offload_threshold` config parameter")
+    .parse()
+    .expect("`blob.payload_offload_threshold` should be a number"),
+  };
+  // Connected on the first put and shared by all of them
+  static ref BLOB_CHANNEL: Channel = Endpoint::from_shared(
+    CONFIG.service_url.clone()
+  )
+  .expect("`blob.service_url` should be a valid URL")
+  .connect_lazy();
+}
+
+/// The holder of an offloaded payload, a receiver gets the payload with it
+/// and removes it once every message with that hash has been processed.
+/// Resending the same payload to a device doesn't upload it again.
+fn payload_holder(to_device_id: &str, blob_hash: &str) -> String {
+  format!("tunnelbroker:{}:{}", to_device_id, blob_hash)
+}
+
+fn payload_hash(payload: &str) -> String {
+  openssl::sha::sha256(payload.as_bytes())
+    .iter()
+    .map(|byte| format!("{:02x}", byte))
+    .collect()
+}
+
+async fn next_response(
+  responses: &mut tonic::Streaming<PutResponse>,
+) -> Result<PutResponse> {
+  responses
+    .message()
+    .await?
+    .ok_or_else(|| anyhow!("Blob put stream closed"))
+}
+
+async fn put_blob(
+  holder: String,
+  blob_hash: String,
+  data: &[u8],
+) -> Result<()> {
+  let (tx, rx) = mpsc::channel(BLOB_PUT_CHANNEL_CAPACITY);
+  tx.send(PutRequest {
+    data: Some(PutRequestData::Holder(holder)),
+  })
+  .await?;
+  tx.send(PutRequest {
+    data: Some(PutRequestData::BlobHash(blob_hash)),
+  })
+  .await?;
+  let mut client = BlobServiceClient::new(BLOB_CHANNEL.clone());
+  let mut responses = client.put(ReceiverStream::new(rx)).await?.into_inner();
+  // Every request is answered, the one of the hash tells whether the data
+  // has to be sent
+  next_response(&mut responses).await?;
+  if !next_response(&mut responses).await?.data_exists {
+    for chunk in data.chunks(BLOB_PUT_CHUNK_SIZE) {
+      tx.send(PutRequest {
+        data: Some(PutRequestData::DataChunk(chunk.to_vec())),
+      })
+      .await?;
+      next_response(&mut responses).await?;
+    }
+  }
+  // The blob is stored once the stream is over, which fails if it isn't
+  drop(tx);
+  while responses.message().await?.is_some() {}
+  Ok(())
+}
+
+/// Puts the payloads above `blob.payload_offload_threshold` in the blob
+/// service, so that the database items and the AMQP frames of the messages
+/// stay small. Such a message is sent with an empty payload and the hash of
+/// the payload in `blobHashes`. A payload that can't be put is sent inline.
+pub async fn offload_payloads(messages: &mut [MessageItem]) {
+  let threshold = CONFIG.payload_offload_threshold;
+  if threshold == 0 {
+    return;
+  }
+  let offloads = messages
+    .iter_mut()
+    .filter(|message| message.payload.len() > threshold)
+    .map(|message| async move {
+      let blob_hash = payload_hash(&message.payload);
+      let holder = payload_holder(&message.toDeviceID, &blob_hash);
+      match put_blob(holder, blob_hash.clone(), message.payload.as_bytes())
+        .await
+      {
+        Ok(()) => {
+          message.payload = String::new();
+          message.blobHashes = blob_hash;
+        }
+        Err(err) => {
+          error!("Failed to offload a message payload: {}", err);
+        }
+      }
+    });
+  join_all(offloads).await;
+}
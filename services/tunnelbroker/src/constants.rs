@@ -1,6 +1,14 @@
-use tokio::time::Duration;
-
 pub const GRPC_TX_QUEUE_SIZE: usize = 32;
 pub const GRPC_SERVER_PORT: u64 = 50051;
-pub const GRPC_KEEP_ALIVE_PING_INTERVAL: Duration = Duration::from_secs(3);
-pub const GRPC_KEEP_ALIVE_PING_TIMEOUT: Duration = Duration::from_secs(10);
+pub const DELIVERY_BROKER_TAKE_BATCH_SIZE: usize = 32;
+// Offloaded payloads are put in chunks well below the gRPC message limit
+pub const BLOB_PUT_CHUNK_SIZE: usize = 1024 * 1024;
+pub const BLOB_PUT_CHANNEL_CAPACITY: usize = 4;
+// Deferred work asks to be admitted again this often, and is rejected once it
+// has been deferred for longer
+pub const ADMISSION_DEFER_RETRY_MS: u64 = 100;
+pub const ADMISSION_MAX_DEFER_MS: u64 = 2000;
+// A drain spreads the reconnects of the devices over this time, and gives up
+// on the streams that haven't ended after the timeout
+pub const DRAIN_RECONNECT_SPREAD_MS: u64 = 10 * 1000;
+pub const DRAIN_STREAMS_TIMEOUT_MS: u64 = 20 * 1000;
@@ -1,3 +1,6 @@
+use std::sync::Arc;
+use tokio::sync::Notify;
+
 #[cxx::bridge]
 pub mod ffi {
   enum GRPCStatusCodes {
@@ -47,6 +50,42 @@ pub mod ffi {
     payload: String,
     blobHashes: String,
     deliveryTag: u64,
+    // The traceparent of a traced message from the DeliveryBroker
+    traceContext: String,
+    // Only set on the messages that are sent
+    isBulk: bool,
+  }
+  // The grpc.* options of the config, 0 leaves the default of tonic
+  struct GrpcServerConfig {
+    maxConcurrentStreams: u32,
+    keepAliveIntervalMs: u64,
+    keepAliveTimeoutMs: u64,
+  }
+  // The priorities of comm::network::admission::WorkPriority
+  enum AdmissionPriority {
+    Interactive,
+    Bulk,
+    Connection,
+  }
+  enum AdmissionDecision {
+    Admit,
+    // Asked again after a while
+    Defer,
+    // Answered with UNAVAILABLE, which the clients retry
+    Reject,
+  }
+  struct DevicePresence {
+    isOnline: bool,
+    // The tunnelbroker instance that holds the stream of an online device
+    brokerID: String,
+    // False shortly after the instance has connected to AMQP, when a device
+    // that isn't online may still have a stream to another instance
+    isComplete: bool,
+  }
+
+  extern "Rust" {
+    type DeliveryBrokerWaker;
+    fn wake(self: &DeliveryBrokerWaker);
   }
 
   unsafe extern "C++" {
@@ -54,6 +93,7 @@ pub mod ffi {
     pub fn initialize();
     pub fn getConfigParameter(parameter: &str) -> Result<String>;
     pub fn isSandbox() -> Result<bool>;
+    pub fn getGrpcServerConfig() -> Result<GrpcServerConfig>;
     pub fn sessionSignatureHandler(deviceID: &str) -> SessionSignatureResult;
     pub fn getSavedNonceToSign(deviceID: &str) -> Result<String>;
     pub fn newSessionHandler(
@@ -65,6 +105,9 @@ pub mod ffi {
       notifyToken: &str,
     ) -> NewSessionResult;
     pub fn getSessionItem(sessionID: &str) -> Result<SessionItem>;
+    pub fn getDevicePresence(deviceID: &str) -> DevicePresence;
+    // Cheap, the load is only measured every now and then
+    pub fn admitWork(priority: AdmissionPriority) -> AdmissionDecision;
     pub fn updateSessionItemIsOnline(
       sessionID: &str,
       isOnline: bool,
@@ -74,14 +117,49 @@ pub mod ffi {
       newNotifToken: &str,
     ) -> Result<()>;
     pub fn getMessagesFromDatabase(deviceID: &str) -> Result<Vec<MessageItem>>;
-    pub fn sendMessages(messages: &Vec<MessageItem>) -> Result<Vec<String>>;
-    pub fn eraseMessagesFromAMQP(deviceID: &str) -> Result<()>;
+    // Takes the messages, so that their payloads are dropped on the Rust side
+    // as soon as they are copied
+    pub fn sendMessages(messages: Vec<MessageItem>) -> Result<Vec<String>>;
+    pub fn markMessagesDelivered(
+      deviceID: &str,
+      messagesIDs: &[String],
+    ) -> Result<()>;
+    pub fn bindDeviceToAMQP(deviceID: &str) -> Result<()>;
+    pub fn unbindDeviceFromAMQP(deviceID: &str) -> Result<()>;
     pub fn ackMessageFromAMQP(deliveryTag: u64) -> Result<()>;
-    pub fn waitMessageFromDeliveryBroker(deviceID: &str)
-      -> Result<MessageItem>;
-    pub fn removeMessages(
+    // The last step of a drain, see server::drain
+    pub fn finishDrain() -> Result<()>;
+    pub fn startListeningDeliveryBroker(
+      deviceID: &str,
+      waker: Box<DeliveryBrokerWaker>,
+    ) -> Result<u64>;
+    pub fn stopListeningDeliveryBroker(
       deviceID: &str,
-      messagesIDs: &Vec<String>,
+      listenerID: u64,
     ) -> Result<()>;
+    pub fn takeMessagesFromDeliveryBroker(
+      deviceID: &str,
+      maxCount: usize,
+    ) -> Result<Vec<MessageItem>>;
+    pub fn traceMessagesWritten(
+      messages: &[MessageItem],
+      writeStartedAtUnixNano: u64,
+    );
+    pub fn removeMessages(deviceID: &str, messagesIDs: &[String])
+      -> Result<()>;
+  }
+}
+
+// Passed to the DeliveryBroker, which wakes up the stream of the device
+// from an AMQP consumer thread when new messages arrive for it
+pub struct DeliveryBrokerWaker {
+  pub notify: Arc<Notify>,
+}
+
+impl DeliveryBrokerWaker {
+  fn wake(&self) {
+    // Stores a permit if nobody waits yet, so a message that arrives between
+    // taking the messages and waiting isn't missed
+    self.notify.notify_one();
   }
 }
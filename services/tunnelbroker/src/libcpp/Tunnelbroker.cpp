@@ -1,21 +1,58 @@
 #include "Tunnelbroker.h"
+#include "AdmissionController.h"
+#include "AllocationTracker.h"
 #include "AmqpManager.h"
 #include "AwsTools.h"
 #include "ConfigManager.h"
+#include "Constants.h"
 #include "DatabaseManager.h"
 #include "DeliveryBroker.h"
+#include "DynamoDBTools.h"
 #include "GlobalTools.h"
+#include "MessageArchiver.h"
+#include "MessageRemover.h"
+#include "MetricsServer.h"
+#include "PresenceTracker.h"
 #include "Tools.h"
+#include "Tracing.h"
+#include "TrafficCapture.h"
 
 #include "rust/cxx.h"
 #include "tunnelbroker/src/cxx_bridge.rs.h"
 
 #include <glog/logging.h>
 
+#include <chrono>
+#include <future>
+#include <optional>
+#include <unordered_set>
+#include <vector>
+
 void initialize() {
   comm::network::tools::InitLogging("tunnelbroker");
   comm::network::config::ConfigManager::getInstance().load();
+  const comm::network::config::ConfigSnapshot &config =
+      comm::network::config::ConfigManager::getInstance().getSnapshot();
+  if (config.metricsPort) {
+    comm::network::metrics::startMetricsServer(
+        config.metricsPort, config.metricsProfiling);
+  }
+  if (config.tracingOptions.sampleRatio > 0) {
+    comm::network::tracing::configureTracing(config.tracingOptions);
+  }
+  if (comm::network::allocation::isAllocationTrackingEnabled()) {
+    comm::network::allocation::registerAllocationMetrics();
+  }
+  if (config.captureOptions.durationSeconds) {
+    comm::network::capture::TrafficCapture::getInstance().start(
+        config.captureOptions);
+  }
+  comm::network::admission::AdmissionController::getInstance().setEnabled(
+      config.admissionEnabled);
   Aws::InitAPI({});
+  comm::network::configureDynamoDBClient(
+      comm::network::config::ConfigManager::getInstance()
+          .getDynamoDBClientOptions());
   // List of AWS DynamoDB tables to check if they are created and can be
   // accessed before any AWS API methods
   const std::list<std::string> tablesList = {
@@ -29,15 +66,38 @@ void initialize() {
               OPTION_DYNAMODB_SESSIONS_PUBLIC_KEY_TABLE),
       comm::network::config::ConfigManager::getInstance().getParameter(
           comm::network::config::ConfigManager::
-              OPTION_DYNAMODB_MESSAGES_TABLE)};
+              OPTION_DYNAMODB_MESSAGES_TABLE),
+      comm::network::config::ConfigManager::getInstance().getParameter(
+          comm::network::config::ConfigManager::
+              OPTION_DYNAMODB_MESSAGES_COLD_TABLE)};
+  const std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::now() +
+      std::chrono::milliseconds(comm::network::STARTUP_TIMEOUT_MS);
+  // The tables are checked and AMQP connects at the same time
+  comm::network::AmqpManager::getInstance().init();
+  std::vector<std::future<bool>> tablesAvailable;
   for (const std::string &table : tablesList) {
-    if (!comm::network::database::DatabaseManager::getInstance()
-             .isTableAvailable(table)) {
+    tablesAvailable.push_back(
+        comm::network::database::DatabaseManager::getInstance()
+            .isTableAvailableAsync(table));
+  }
+  auto tableIt = tablesList.begin();
+  for (std::future<bool> &tableAvailable : tablesAvailable) {
+    if (tableAvailable.wait_until(deadline) != std::future_status::ready) {
       throw std::runtime_error(
-          "Error: AWS DynamoDB table '" + table + "' is not available");
+          "Error: AWS DynamoDB table '" + *tableIt +
+          "' wasn't checked in time");
     }
-  };
-  comm::network::AmqpManager::getInstance().init();
+    if (!tableAvailable.get()) {
+      throw std::runtime_error(
+          "Error: AWS DynamoDB table '" + *tableIt + "' is not available");
+    }
+    tableIt++;
+  }
+  if (!comm::network::AmqpManager::getInstance().waitUntilReady(deadline)) {
+    throw std::runtime_error("Error: AMQP connection isn't ready in time");
+  }
+  comm::network::database::MessageArchiver::getInstance().start();
 }
 
 rust::String getConfigParameter(rust::Str parameter) {
@@ -50,6 +110,17 @@ bool isSandbox() {
   return comm::network::tools::isSandbox();
 }
 
+GrpcServerConfig getGrpcServerConfig() {
+  const comm::network::GrpcServerOptions &options =
+      comm::network::config::ConfigManager::getInstance()
+          .getSnapshot()
+          .grpcServerOptions;
+  return GrpcServerConfig{
+      .maxConcurrentStreams = options.maxConcurrentStreams,
+      .keepAliveIntervalMs = options.keepAliveIntervalMs,
+      .keepAliveTimeoutMs = options.keepAliveTimeoutMs};
+}
+
 SessionSignatureResult sessionSignatureHandler(rust::Str deviceID) {
   const std::string requestedDeviceID(deviceID);
   if (!comm::network::tools::validateDeviceID(requestedDeviceID)) {
@@ -59,6 +130,8 @@ SessionSignatureResult sessionSignatureHandler(rust::Str deviceID) {
             .errorText =
                 "Format validation failed for deviceID: " + requestedDeviceID}};
   }
+  const comm::network::capture::CapturedCall capturedCall(
+      comm::network::trace::EVENT_SESSION_SIGNATURE, requestedDeviceID);
   const std::string toSign = comm::network::tools::generateRandomString(
       comm::network::SIGNATURE_REQUEST_LENGTH);
   std::shared_ptr<comm::network::database::SessionSignItem> SessionSignItem =
@@ -99,6 +172,8 @@ NewSessionResult newSessionHandler(
             .statusCode = GRPCStatusCodes::InvalidArgument,
             .errorText = "Format validation failed for deviceID"}};
   }
+  const comm::network::capture::CapturedCall capturedCall(
+      comm::network::trace::EVENT_NEW_SESSION, stringDeviceID);
   const std::string stringPublicKey{publicKey};
   const std::string newSessionID = comm::network::tools::generateUUID();
   try {
@@ -116,9 +191,6 @@ NewSessionResult newSessionHandler(
               .statusCode = GRPCStatusCodes::PermissionDenied,
               .errorText = "The public key doesn't match for deviceID"}};
     }
-    comm::network::database::DatabaseManager::getInstance()
-        .removeSessionSignItem(stringDeviceID);
-
     deviceSessionItem =
         std::make_shared<comm::network::database::DeviceSessionItem>(
             newSessionID,
@@ -128,8 +200,24 @@ NewSessionResult newSessionHandler(
             deviceType,
             std::string{deviceAppVersion},
             std::string{deviceOS});
-    comm::network::database::DatabaseManager::getInstance().putSessionItem(
-        *deviceSessionItem);
+    // Both writes are independent, so they are sent at the same time
+    std::shared_ptr<std::promise<void>> sessionSignItemRemoved =
+        std::make_shared<std::promise<void>>();
+    std::shared_ptr<std::promise<void>> sessionItemPut =
+        std::make_shared<std::promise<void>>();
+    std::future<void> sessionSignItemRemovedFuture =
+        sessionSignItemRemoved->get_future();
+    std::future<void> sessionItemPutFuture = sessionItemPut->get_future();
+    comm::network::database::DatabaseManager::getInstance()
+        .removeSessionSignItemAsync(
+            stringDeviceID,
+            comm::network::database::settlePromise(sessionSignItemRemoved));
+    comm::network::database::DatabaseManager::getInstance()
+        .putSessionItemAsync(
+            *deviceSessionItem,
+            comm::network::database::settlePromise(sessionItemPut));
+    sessionSignItemRemovedFuture.get();
+    sessionItemPutFuture.get();
   } catch (std::runtime_error &e) {
     LOG(ERROR) << "gRPC: "
                << "Error while processing 'NewSession' request: " << e.what();
@@ -143,6 +231,8 @@ NewSessionResult newSessionHandler(
 }
 
 SessionItem getSessionItem(rust::Str sessionID) {
+  const std::chrono::steady_clock::time_point startedAt =
+      std::chrono::steady_clock::now();
   const std::string stringSessionID = std::string{sessionID};
   if (!comm::network::tools::validateSessionID(stringSessionID)) {
     throw std::invalid_argument("Invalid format for 'sessionID'");
@@ -154,6 +244,17 @@ SessionItem getSessionItem(rust::Str sessionID) {
     throw std::invalid_argument(
         "No sessions found for 'sessionID': " + stringSessionID);
   }
+  // The state may not have been written yet
+  const std::optional<bool> isOnline =
+      comm::network::database::PresenceTracker::getInstance().get(
+          stringSessionID);
+  // The device is only known once the session has been found
+  comm::network::capture::TrafficCapture::getInstance().record(
+      comm::network::trace::EVENT_GET_SESSION,
+      sessionItem->getDeviceID(),
+      startedAt,
+      0,
+      0);
   return SessionItem{
       .deviceID = sessionItem->getDeviceID(),
       .publicKey = sessionItem->getPubKey(),
@@ -161,12 +262,46 @@ SessionItem getSessionItem(rust::Str sessionID) {
       .deviceType = static_cast<int>(sessionItem->getDeviceType()),
       .appVersion = sessionItem->getAppVersion(),
       .deviceOS = sessionItem->getDeviceOs(),
-      .isOnline = sessionItem->getIsOnline()};
+      .isOnline = isOnline.value_or(sessionItem->getIsOnline())};
+}
+
+DevicePresence getDevicePresence(rust::Str deviceID) {
+  // Checked before the lookup, so that a device missed by an incomplete
+  // directory isn't reported as certainly offline
+  const bool isComplete =
+      comm::network::AmqpManager::getInstance().isPresenceDirectoryComplete();
+  const std::optional<std::string> brokerID =
+      comm::network::AmqpManager::getInstance().findDeviceBroker(
+          std::string{deviceID});
+  return DevicePresence{
+      .isOnline = brokerID.has_value(),
+      .brokerID = brokerID.value_or(""),
+      .isComplete = isComplete};
+}
+
+AdmissionDecision admitWork(AdmissionPriority priority) {
+  comm::network::admission::WorkPriority workPriority =
+      comm::network::admission::WorkPriority::INTERACTIVE;
+  if (priority == AdmissionPriority::Bulk) {
+    workPriority = comm::network::admission::WorkPriority::BULK;
+  } else if (priority == AdmissionPriority::Connection) {
+    workPriority = comm::network::admission::WorkPriority::CONNECTION;
+  }
+  const comm::network::admission::Admission admission =
+      comm::network::admission::AdmissionController::getInstance().admit(
+          workPriority);
+  if (admission == comm::network::admission::Admission::DEFER) {
+    return AdmissionDecision::Defer;
+  }
+  if (admission == comm::network::admission::Admission::REJECT) {
+    return AdmissionDecision::Reject;
+  }
+  return AdmissionDecision::Admit;
 }
 
 void updateSessionItemIsOnline(rust::Str sessionID, bool isOnline) {
-  comm::network::database::DatabaseManager::getInstance()
-      .updateSessionItemIsOnline(std::string{sessionID}, isOnline);
+  comm::network::database::PresenceTracker::getInstance().update(
+      std::string{sessionID}, isOnline);
 }
 
 void updateSessionItemDeviceToken(
@@ -178,53 +313,240 @@ void updateSessionItemDeviceToken(
 }
 
 rust::Vec<MessageItem> getMessagesFromDatabase(rust::Str deviceID) {
-  std::vector<std::shared_ptr<comm::network::database::MessageItem>>
-      messagesFromDatabase =
-          comm::network::database::DatabaseManager::getInstance()
-              .findMessageItemsByReceiver(std::string{deviceID});
   rust::Vec<MessageItem> result;
-  for (auto &messageFromDatabase : messagesFromDatabase) {
-    result.push_back(MessageItem{
-        .messageID = messageFromDatabase->getMessageID(),
-        .fromDeviceID = messageFromDatabase->getFromDeviceID(),
-        .payload = messageFromDatabase->getPayload(),
-        .blobHashes = messageFromDatabase->getBlobHashes(),
-    });
-  }
+  const std::string stringDeviceID{deviceID};
+  comm::network::capture::CapturedCall capturedCall(
+      comm::network::trace::EVENT_DATABASE_MESSAGES, stringDeviceID);
+  comm::network::database::MessageRemover &messageRemover =
+      comm::network::database::MessageRemover::getInstance();
+  const auto addMessages =
+      [&result, &capturedCall, &messageRemover, &stringDeviceID](
+          std::vector<comm::network::database::MessageItem> &messages) {
+        result.reserve(result.size() + messages.size());
+        if (capturedCall.isActive()) {
+          capturedCall.count += messages.size();
+          for (const auto &messageFromDatabase : messages) {
+            capturedCall.bytes += messageFromDatabase.getPayload().size();
+          }
+        }
+        // Every payload is moved out and freed once it has been copied to
+        // Rust, so that a page isn't held twice
+        for (auto &messageFromDatabase : messages) {
+          // Acknowledged already, it just hasn't been removed yet
+          if (messageRemover.isRemoving(
+                  stringDeviceID, messageFromDatabase.getMessageID())) {
+            continue;
+          }
+          result.push_back(MessageItem{
+              .messageID = messageFromDatabase.takeMessageID(),
+              .fromDeviceID = messageFromDatabase.takeFromDeviceID(),
+              .payload = messageFromDatabase.takePayload(),
+              .blobHashes = messageFromDatabase.takeBlobHashes(),
+          });
+        }
+        return true;
+      };
+  // The archived messages are older than all the others, so they go first.
+  // Their acks have to remove them from the cold table.
+  comm::network::database::DatabaseManager::getInstance()
+      .findArchivedMessageItemsByReceiver(
+          stringDeviceID,
+          comm::network::MESSAGES_PAGE_SIZE,
+          [&addMessages, &messageRemover, &stringDeviceID](
+              std::vector<comm::network::database::MessageItem> &messages) {
+            std::vector<std::string> messageIDs;
+            messageIDs.reserve(messages.size());
+            for (const auto &messageFromDatabase : messages) {
+              messageIDs.push_back(messageFromDatabase.getMessageID());
+            }
+            messageRemover.trackArchived(stringDeviceID, messageIDs);
+            return addMessages(messages);
+          });
+  comm::network::database::DatabaseManager::getInstance()
+      .findMessageItemsByReceiver(
+          stringDeviceID, comm::network::MESSAGES_PAGE_SIZE, addMessages);
   return result;
 }
 
-void eraseMessagesFromAMQP(rust::Str deviceID) {
-  comm::network::DeliveryBroker::getInstance().erase(std::string{deviceID});
+void markMessagesDelivered(
+    rust::Str deviceID,
+    rust::Slice<const rust::String> messagesIDs) {
+  std::vector<std::string> messageIDs;
+  messageIDs.reserve(messagesIDs.size());
+  for (const rust::String &messageID : messagesIDs) {
+    messageIDs.push_back(std::string{messageID});
+  }
+  comm::network::DeliveryBroker::getInstance().markDelivered(
+      std::string{deviceID}, messageIDs);
+}
+
+void bindDeviceToAMQP(rust::Str deviceID) {
+  const std::string stringDeviceID{deviceID};
+  const comm::network::capture::CapturedCall capturedCall(
+      comm::network::trace::EVENT_BIND_DEVICE, stringDeviceID);
+  std::future<bool> bound =
+      comm::network::AmqpManager::getInstance().addDeviceStream(
+          stringDeviceID);
+  if (bound.wait_for(std::chrono::milliseconds(
+          comm::network::AMQP_BIND_TIMEOUT_MS)) !=
+          std::future_status::ready ||
+      !bound.get()) {
+    comm::network::AmqpManager::getInstance().removeDeviceStream(
+        stringDeviceID);
+    throw std::runtime_error(
+        "Failed to bind device " + stringDeviceID + " in AMQP");
+  }
+}
+
+void unbindDeviceFromAMQP(rust::Str deviceID) {
+  const std::string stringDeviceID{deviceID};
+  const comm::network::capture::CapturedCall capturedCall(
+      comm::network::trace::EVENT_UNBIND_DEVICE, stringDeviceID);
+  comm::network::AmqpManager::getInstance().removeDeviceStream(
+      stringDeviceID);
+  comm::network::database::MessageRemover::getInstance().forgetArchived(
+      stringDeviceID);
 }
 
 void ackMessageFromAMQP(uint64_t deliveryTag) {
   comm::network::AmqpManager::getInstance().ack(deliveryTag);
 }
 
-MessageItem waitMessageFromDeliveryBroker(rust::Str deviceID) {
-  const auto message =
-      comm::network::DeliveryBroker::getInstance().pop(std::string{deviceID});
-  return MessageItem{
-      .messageID = message.messageID,
-      .fromDeviceID = message.fromDeviceID,
-      .payload = message.payload,
-      .deliveryTag = message.deliveryTag};
+void finishDrain() {
+  // The streams have ended, so no more acks come in
+  if (!comm::network::database::MessageRemover::getInstance().flush()) {
+    LOG(WARNING) << "Some acknowledged messages couldn't be removed";
+  }
+  comm::network::AmqpManager &amqpManager =
+      comm::network::AmqpManager::getInstance();
+  // The acks are still sent if some messages weren't pushed in time, they
+  // are in the database too
+  if (!amqpManager.stopConsuming(
+          std::chrono::steady_clock::now() +
+          std::chrono::milliseconds(
+              comm::network::AMQP_DRAIN_CONSUMER_TIMEOUT_MS))) {
+    LOG(WARNING) << "AMQP: The consumer didn't stop in time";
+  }
+  if (!amqpManager.closeConsumeChannel(
+          std::chrono::steady_clock::now() +
+          std::chrono::milliseconds(
+              comm::network::AMQP_DRAIN_CLOSE_TIMEOUT_MS))) {
+    throw std::runtime_error(
+        "Failed to close the AMQP consume channel, the last acks may be lost");
+  }
+}
+
+uint64_t startListeningDeliveryBroker(
+    rust::Str deviceID,
+    rust::Box<DeliveryBrokerWaker> waker) {
+  // std::function has to be copyable
+  std::shared_ptr<rust::Box<DeliveryBrokerWaker>> sharedWaker =
+      std::make_shared<rust::Box<DeliveryBrokerWaker>>(std::move(waker));
+  return comm::network::DeliveryBroker::getInstance().addListener(
+      std::string{deviceID}, [sharedWaker]() { (*sharedWaker)->wake(); });
+}
+
+void stopListeningDeliveryBroker(rust::Str deviceID, uint64_t listenerID) {
+  comm::network::DeliveryBroker::getInstance().removeListener(
+      std::string{deviceID}, listenerID);
+}
+
+rust::Vec<MessageItem>
+takeMessagesFromDeliveryBroker(rust::Str deviceID, size_t maxCount) {
+  rust::Vec<MessageItem> result;
+  const std::string stringDeviceID{deviceID};
+  comm::network::capture::CapturedCall capturedCall(
+      comm::network::trace::EVENT_TAKE_MESSAGES, stringDeviceID);
+  std::vector<comm::network::DeliveryBrokerMessage> messages =
+      comm::network::DeliveryBroker::getInstance().takeMessages(
+          stringDeviceID, maxCount);
+  capturedCall.count = messages.size();
+  // The copies of the messages that the device got from the database are
+  // only acknowledged
+  for (const uint64_t deliveryTag :
+       comm::network::DeliveryBroker::getInstance().removeDelivered(
+           stringDeviceID, messages)) {
+    comm::network::AmqpManager::getInstance().ack(deliveryTag);
+  }
+  for (auto &message : messages) {
+    capturedCall.bytes += message.payload.size();
+    // The time in the queue is only known now, it ends the span
+    const comm::network::tracing::Span queueSpan(
+        "deliveryBroker.queue",
+        comm::network::tracing::TraceContext::fromTraceparent(
+            message.traceContext),
+        comm::network::tracing::SpanKind::INTERNAL,
+        message.queuedAt);
+    result.push_back(MessageItem{
+        .messageID = message.messageID,
+        .fromDeviceID = message.fromDeviceID,
+        .payload = message.payload,
+        .blobHashes = message.blobHashes,
+        .deliveryTag = message.deliveryTag,
+        .traceContext = queueSpan.getContext().toTraceparent()});
+  }
+  // Messages were dropped from the full queue while the device was
+  // connected, they are only in the database now
+  if (comm::network::DeliveryBroker::getInstance().takeResync(
+          stringDeviceID)) {
+    std::unordered_set<std::string> takenIDs;
+    for (const MessageItem &message : result) {
+      takenIDs.insert(std::string{message.messageID});
+    }
+    std::vector<std::string> readIDs;
+    for (MessageItem &message : getMessagesFromDatabase(deviceID)) {
+      if (takenIDs.count(std::string{message.messageID})) {
+        continue;
+      }
+      readIDs.push_back(std::string{message.messageID});
+      result.push_back(std::move(message));
+    }
+    LOG(INFO) << "Read " << readIDs.size() << " messages of device "
+              << stringDeviceID << " from the database after its queue "
+              << "overflowed";
+    // Their copies that are still in AMQP are acknowledged without being
+    // delivered again
+    comm::network::DeliveryBroker::getInstance().markDelivered(
+        stringDeviceID, readIDs);
+  }
+  return result;
+}
+
+void traceMessagesWritten(
+    rust::Slice<const MessageItem> messages,
+    uint64_t writeStartedAtUnixNano) {
+  const std::chrono::system_clock::time_point writeStartedAt(
+      std::chrono::duration_cast<std::chrono::system_clock::duration>(
+          std::chrono::nanoseconds(writeStartedAtUnixNano)));
+  for (const MessageItem &message : messages) {
+    if (message.traceContext.empty()) {
+      continue;
+    }
+    comm::network::tracing::Span writeSpan(
+        "tunnelbroker.writeToClient",
+        comm::network::tracing::TraceContext::fromTraceparent(
+            std::string{message.traceContext}),
+        comm::network::tracing::SpanKind::SERVER,
+        writeStartedAt);
+    writeSpan.setAttribute(
+        "messaging.message.id", std::string{message.messageID});
+  }
 }
 
 void removeMessages(
     rust::Str deviceID,
-    const rust::Vec<rust::String> &messagesIDs) {
+    rust::Slice<const rust::String> messagesIDs) {
   std::vector<std::string> vectorOfmessagesIDs;
+  vectorOfmessagesIDs.reserve(messagesIDs.size());
   std::string stringDeviceID = std::string{deviceID};
-  for (auto id : messagesIDs) {
+  for (const rust::String &id : messagesIDs) {
     vectorOfmessagesIDs.push_back(std::string{id});
   };
-  comm::network::database::DatabaseManager::getInstance()
-      .removeMessageItemsByIDsForDeviceID(vectorOfmessagesIDs, stringDeviceID);
+  comm::network::database::MessageRemover::getInstance().remove(
+      stringDeviceID, vectorOfmessagesIDs);
 
   // If messages queue for `deviceID` is empty we don't need to store
-  // `folly::MPMCQueue` for it and need to free memory to fix possible
+  // a queue for it and need to free memory to fix possible
   // 'ghost' queues in DeliveryBroker.
   // We call `deleteQueueIfEmpty()` for this purpose here after removing
   // messages.
@@ -232,25 +554,88 @@ void removeMessages(
       .deleteQueueIfEmpty(stringDeviceID);
 }
 
-rust::Vec<rust::String> sendMessages(const rust::Vec<MessageItem> &messages) {
+rust::Vec<rust::String> sendMessages(rust::Vec<MessageItem> messages) {
+  // Blocks until the messages are stored, the sends that pile up are a sign
+  // of overload
+  const comm::network::admission::AdmissionController::SendInProgress
+      sendInProgress(
+          comm::network::admission::AdmissionController::getInstance());
+  // The root of the traces of the messages, the recipients continue them
+  comm::network::tracing::Span sendSpan(
+      "tunnelbroker.sendMessages", comm::network::tracing::SpanKind::SERVER);
+  sendSpan.setAttribute(
+      "messaging.batch.message_count", static_cast<int64_t>(messages.size()));
+  comm::network::capture::CapturedCall capturedCall(
+      comm::network::trace::EVENT_SEND_MESSAGES,
+      messages.empty() ? std::string() : std::string{messages[0].fromDeviceID});
   std::vector<comm::network::database::MessageItem> vectorOfMessages;
+  vectorOfMessages.reserve(messages.size());
   rust::Vec<rust::String> messagesIDs;
-  for (auto &message : messages) {
+  messagesIDs.reserve(messages.size());
+  if (capturedCall.isActive()) {
+    capturedCall.count = messages.size();
+    for (const MessageItem &message : messages) {
+      capturedCall.bytes += message.payload.size();
+      capturedCall.peers.emplace_back(
+          std::string{message.toDeviceID}, message.payload.size());
+    }
+  }
+  for (MessageItem &message : messages) {
     std::string messageID = comm::network::tools::generateUUID();
-    vectorOfMessages.push_back(comm::network::database::MessageItem{
-        comm::network::database::MessageItem{
-            messageID,
-            std::string{message.fromDeviceID},
-            std::string{message.toDeviceID},
-            std::string{message.payload},
-            std::string{message.blobHashes},
-        }});
     messagesIDs.push_back(rust::String{messageID});
+    vectorOfMessages.emplace_back(
+        std::move(messageID),
+        std::string{message.fromDeviceID},
+        std::string{message.toDeviceID},
+        std::string{message.payload},
+        std::string{message.blobHashes});
+    vectorOfMessages.back().setBulk(message.isBulk);
+    // The payload is only needed on this side from now on
+    message.payload = rust::String{};
   };
-  comm::network::database::DatabaseManager::getInstance()
-      .putMessageItemsByBatch(vectorOfMessages);
-  for (auto message : vectorOfMessages) {
-    comm::network::AmqpManager::getInstance().send(&message);
+  // The messages are stored before they are published. If the broker got
+  // them first and storing failed, the sender would retry with new IDs and
+  // the recipients would get the messages twice.
+  {
+    comm::network::tracing::Span storeSpan(
+        "dynamodb.putMessageItemsByBatch",
+        sendSpan.getContext(),
+        comm::network::tracing::SpanKind::CLIENT);
+    try {
+      comm::network::database::DatabaseManager::getInstance()
+          .putMessageItemsByBatch(vectorOfMessages);
+    } catch (const std::exception &e) {
+      storeSpan.setError(e.what());
+      throw;
+    }
+  }
+  // Lasts until the broker confirms the messages
+  const std::chrono::steady_clock::time_point publishStartedAt =
+      std::chrono::steady_clock::now();
+  comm::network::tracing::Span publishSpan(
+      "amqp.publish",
+      sendSpan.getContext(),
+      comm::network::tracing::SpanKind::PRODUCER);
+  std::future<bool> confirmed =
+      comm::network::AmqpManager::getInstance().sendBatch(
+          vectorOfMessages, publishSpan.getContext());
+  // The messages are in the database, so the ones that the broker hasn't
+  // confirmed are delivered from there
+  if (confirmed.wait_for(std::chrono::milliseconds(
+          comm::network::AMQP_PUBLISH_CONFIRM_TIMEOUT_MS)) !=
+          std::future_status::ready ||
+      !confirmed.get()) {
+    LOG(ERROR) << "AMQP: Publishing of " << vectorOfMessages.size()
+               << " messages wasn't confirmed";
+    publishSpan.setError("The broker didn't confirm the messages");
+  }
+  if (capturedCall.isActive() && !messages.empty()) {
+    comm::network::capture::TrafficCapture::getInstance().record(
+        comm::network::trace::EVENT_AMQP_PUBLISH,
+        std::string{messages[0].fromDeviceID},
+        publishStartedAt,
+        capturedCall.count,
+        capturedCall.bytes);
   }
   return messagesIDs;
 }
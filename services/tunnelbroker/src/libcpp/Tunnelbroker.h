@@ -6,6 +6,7 @@
 void initialize();
 rust::String getConfigParameter(rust::Str parameter);
 bool isSandbox();
+GrpcServerConfig getGrpcServerConfig();
 SessionSignatureResult sessionSignatureHandler(rust::Str deviceID);
 rust::String getSavedNonceToSign(rust::Str deviceID);
 NewSessionResult newSessionHandler(
@@ -16,13 +17,28 @@ NewSessionResult newSessionHandler(
     rust::Str deviceOS,
     rust::Str notifyToken);
 SessionItem getSessionItem(rust::Str sessionID);
+DevicePresence getDevicePresence(rust::Str deviceID);
+AdmissionDecision admitWork(AdmissionPriority priority);
 void updateSessionItemIsOnline(rust::Str sessionID, bool isOnline);
 void updateSessionItemDeviceToken(rust::Str sessionID, rust::Str newNotifToken);
 rust::Vec<MessageItem> getMessagesFromDatabase(rust::Str deviceID);
-rust::Vec<rust::String> sendMessages(const rust::Vec<MessageItem> &messages);
-void eraseMessagesFromAMQP(rust::Str deviceID);
+rust::Vec<rust::String> sendMessages(rust::Vec<MessageItem> messages);
+void markMessagesDelivered(
+    rust::Str deviceID,
+    rust::Slice<const rust::String> messagesIDs);
+void bindDeviceToAMQP(rust::Str deviceID);
+void unbindDeviceFromAMQP(rust::Str deviceID);
 void ackMessageFromAMQP(uint64_t deliveryTag);
-MessageItem waitMessageFromDeliveryBroker(rust::Str deviceID);
+void finishDrain();
+uint64_t startListeningDeliveryBroker(
+    rust::Str deviceID,
+    rust::Box<DeliveryBrokerWaker> waker);
+void stopListeningDeliveryBroker(rust::Str deviceID, uint64_t listenerID);
+rust::Vec<MessageItem>
+takeMessagesFromDeliveryBroker(rust::Str deviceID, size_t maxCount);
+void traceMessagesWritten(
+    rust::Slice<const MessageItem> messages,
+    uint64_t writeStartedAtUnixNano);
 void removeMessages(
     rust::Str deviceID,
-    const rust::Vec<rust::String> &messagesIDs);
+    rust::Slice<const rust::String> messagesIDs);
@@ -0,0 +1,65 @@
+#include "AmqpAckCoalescer.h"
+#include "Constants.h"
+
+#include <iterator>
+
+namespace comm {
+namespace network {
+
+bool AmqpAckCoalescer::add(uint64_t deliveryTag) {
+  const std::lock_guard<std::mutex> lock(this->coalescerMutex);
+  if (deliveryTag <= this->contiguousTag ||
+      !this->outOfOrderTags.emplace(deliveryTag, false).second) {
+    return false;
+  }
+  this->pendingCount++;
+  auto tagIterator = this->outOfOrderTags.begin();
+  while (tagIterator != this->outOfOrderTags.end() &&
+         tagIterator->first == this->contiguousTag + 1) {
+    this->contiguousTag++;
+    if (!tagIterator->second) {
+      this->unsentTag = this->contiguousTag;
+    }
+    tagIterator = this->outOfOrderTags.erase(tagIterator);
+  }
+  // Forgetting a tag only means that the multiple acks stop before it
+  while (this->outOfOrderTags.size() > AMQP_ACK_MAX_TRACKED &&
+         this->outOfOrderTags.rbegin()->second) {
+    this->outOfOrderTags.erase(std::prev(this->outOfOrderTags.end()));
+  }
+  return this->pendingCount >= AMQP_ACK_FLUSH_COUNT;
+}
+
+std::vector<AmqpAck> AmqpAckCoalescer::flush(bool outOfOrder) {
+  const std::lock_guard<std::mutex> lock(this->coalescerMutex);
+  std::vector<AmqpAck> acks;
+  if (this->unsentTag > this->sentTag) {
+    acks.push_back({this->unsentTag, this->unsentTag > this->sentTag + 1});
+  }
+  this->sentTag = this->contiguousTag;
+  if (outOfOrder) {
+    for (auto &tag : this->outOfOrderTags) {
+      if (!tag.second) {
+        acks.push_back({tag.first, false});
+        tag.second = true;
+      }
+    }
+  }
+  this->pendingCount = 0;
+  for (const auto &tag : this->outOfOrderTags) {
+    this->pendingCount += tag.second ? 0 : 1;
+  }
+  return acks;
+}
+
+void AmqpAckCoalescer::reset() {
+  const std::lock_guard<std::mutex> lock(this->coalescerMutex);
+  this->contiguousTag = 0;
+  this->unsentTag = 0;
+  this->sentTag = 0;
+  this->outOfOrderTags.clear();
+  this->pendingCount = 0;
+}
+
+} // namespace network
+} // namespace comm
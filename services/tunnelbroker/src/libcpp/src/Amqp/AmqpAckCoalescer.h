@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace comm {
+namespace network {
+
+struct AmqpAck {
+  uint64_t deliveryTag;
+  // Acknowledges every message up to deliveryTag
+  bool multiple;
+};
+
+// Collects the acknowledgements of the messages that were delivered on a
+// channel, so that they are sent with the `multiple` flag in one frame.
+// Delivery tags of a channel go up by one from 1, and messages are
+// acknowledged in any order, so a multiple ack may only cover the tags up to
+// the first one that is still being delivered. Acks past it are sent one by
+// one when the coalescer is flushed with outOfOrder.
+class AmqpAckCoalescer {
+  std::mutex coalescerMutex;
+  // Every tag up to it has been acknowledged
+  uint64_t contiguousTag = 0;
+  // The last tag up to contiguousTag that hasn't been sent on its own, a
+  // single multiple ack has to name a message that is still unacknowledged
+  uint64_t unsentTag = 0;
+  // Every tag up to it has been sent
+  uint64_t sentTag = 0;
+  // Acknowledged tags past contiguousTag and whether they were sent
+  std::map<uint64_t, bool> outOfOrderTags;
+  size_t pendingCount = 0;
+
+public:
+  // Returns true if enough acks are pending to flush
+  bool add(uint64_t deliveryTag);
+  std::vector<AmqpAck> flush(bool outOfOrder);
+  // Should be called when the channel changes, the pending acks are dropped
+  void reset();
+};
+
+} // namespace network
+} // namespace comm
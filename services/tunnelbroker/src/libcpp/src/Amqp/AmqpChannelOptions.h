@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace comm {
+namespace network {
+
+struct AmqpChannelOptions {
+  // Every publish channel has a connection of its own
+  size_t publishChannels;
+  // Unacknowledged messages that the broker sends to the consume channel,
+  // 0 means no limit. Messages wait unacknowledged in the DeliveryBroker until
+  // their device confirms them, so a low limit stalls the consumption for all
+  // the devices while a few of them are slow.
+  uint16_t prefetchCount;
+  // Threads that the messages from the consume channel are handled on, the
+  // connection thread only hands them over
+  size_t consumerShards;
+  // Messages to a device that a batch publishes in one envelope, 0 means
+  // that the messages are published one by one with AMQP headers, which the
+  // instances from before the envelopes can read
+  size_t envelopeMessagesMax;
+};
+
+} // namespace network
+} // namespace comm
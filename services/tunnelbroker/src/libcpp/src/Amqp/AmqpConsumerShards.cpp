@@ -0,0 +1,98 @@
+#include "AmqpConsumerShards.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <exception>
+
+namespace comm {
+namespace network {
+
+AmqpConsumerShards::AmqpConsumerShards(size_t count) {
+  count = std::max<size_t>(1, count);
+  for (size_t i = 0; i < count; i++) {
+    this->shards.push_back(std::make_unique<Shard>());
+  }
+  for (std::unique_ptr<Shard> &shard : this->shards) {
+    Shard *shardPointer = shard.get();
+    shard->thread = std::thread([shardPointer]() { runShard(*shardPointer); });
+  }
+}
+
+AmqpConsumerShards::~AmqpConsumerShards() {
+  for (std::unique_ptr<Shard> &shard : this->shards) {
+    {
+      const std::lock_guard<std::mutex> lock(shard->queueMutex);
+      shard->stopping = true;
+      shard->tasks.clear();
+    }
+    shard->queueCondition.notify_one();
+  }
+  for (std::unique_ptr<Shard> &shard : this->shards) {
+    shard->thread.join();
+  }
+}
+
+void AmqpConsumerShards::runShard(Shard &shard) {
+  while (true) {
+    Task task;
+    {
+      std::unique_lock<std::mutex> lock(shard.queueMutex);
+      shard.running = false;
+      if (shard.tasks.empty()) {
+        shard.idleCondition.notify_all();
+      }
+      shard.queueCondition.wait(
+          lock, [&shard]() { return shard.stopping || !shard.tasks.empty(); });
+      if (shard.stopping) {
+        return;
+      }
+      task = std::move(shard.tasks.front());
+      shard.tasks.pop_front();
+      shard.running = true;
+    }
+    try {
+      task();
+    } catch (const std::exception &e) {
+      LOG(ERROR) << "AMQP: Consumer shard task exception: " << e.what();
+    }
+  }
+}
+
+size_t AmqpConsumerShards::getCount() const {
+  return this->shards.size();
+}
+
+void AmqpConsumerShards::dispatch(const std::string &key, Task task) {
+  Shard &shard =
+      *this->shards[std::hash<std::string>{}(key) % this->shards.size()];
+  {
+    const std::lock_guard<std::mutex> lock(shard.queueMutex);
+    shard.tasks.push_back(std::move(task));
+  }
+  shard.queueCondition.notify_one();
+}
+
+void AmqpConsumerShards::clear() {
+  for (std::unique_ptr<Shard> &shard : this->shards) {
+    const std::lock_guard<std::mutex> lock(shard->queueMutex);
+    shard->tasks.clear();
+    shard->idleCondition.notify_all();
+  }
+}
+
+bool AmqpConsumerShards::waitUntilIdle(
+    std::chrono::steady_clock::time_point deadline) {
+  for (std::unique_ptr<Shard> &shard : this->shards) {
+    std::unique_lock<std::mutex> lock(shard->queueMutex);
+    if (!shard->idleCondition.wait_until(lock, deadline, [&shard]() {
+          return !shard->running && shard->tasks.empty();
+        })) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace network
+} // namespace comm
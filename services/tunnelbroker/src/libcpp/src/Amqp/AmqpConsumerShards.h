@@ -0,0 +1,61 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace comm {
+namespace network {
+
+// Handles the received messages on worker threads, the shards, so that the
+// handling isn't limited to the thread of the connection. The tasks of a key,
+// the deviceID of the recipient, always run on the same shard in the order
+// they were dispatched, the tasks of different keys run in parallel. The
+// queues aren't bounded, the prefetch count of the channel limits them.
+class AmqpConsumerShards {
+public:
+  using Task = std::function<void()>;
+
+private:
+  struct Shard {
+    std::mutex queueMutex;
+    std::condition_variable queueCondition;
+    std::deque<Task> tasks;
+    bool running = false;
+    // Notified when the shard runs out of tasks
+    std::condition_variable idleCondition;
+    bool stopping = false;
+    std::thread thread;
+  };
+
+  std::vector<std::unique_ptr<Shard>> shards;
+
+  static void runShard(Shard &shard);
+
+public:
+  explicit AmqpConsumerShards(size_t count);
+  // Waits for the running tasks, the queued ones are dropped
+  ~AmqpConsumerShards();
+
+  size_t getCount() const;
+  void dispatch(const std::string &key, Task task);
+  // Drops the tasks that haven't started yet, e.g. the ones of a channel that
+  // is gone, whose delivery tags are no longer valid
+  void clear();
+  // Waits for the queued and the running tasks of every shard, returns false
+  // if some are still left by the deadline
+  bool waitUntilIdle(std::chrono::steady_clock::time_point deadline);
+
+  AmqpConsumerShards(AmqpConsumerShards const &) = delete;
+  void operator=(AmqpConsumerShards const &) = delete;
+};
+
+} // namespace network
+} // namespace comm
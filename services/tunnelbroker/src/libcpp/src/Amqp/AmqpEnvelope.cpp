@@ -0,0 +1,156 @@
+#include "AmqpEnvelope.h"
+#include "Constants.h"
+
+#include <stdexcept>
+#include <unordered_map>
+
+namespace comm {
+namespace network {
+
+namespace {
+
+const uint8_t ENVELOPE_FLAG_BULK = 1;
+
+void writeLength(std::string &body, uint64_t length, size_t bytes) {
+  for (size_t i = bytes; i > 0; i--) {
+    body.push_back(static_cast<char>((length >> (8 * (i - 1))) & 0xff));
+  }
+}
+
+void writeField(std::string &body, const std::string &field) {
+  if (field.size() > UINT16_MAX) {
+    throw std::runtime_error("AMQP envelope field is too long");
+  }
+  writeLength(body, field.size(), 2);
+  body.append(field);
+}
+
+class EnvelopeReader {
+  const char *position;
+  const char *const end;
+
+public:
+  EnvelopeReader(const char *data, size_t size)
+      : position(data), end(data + size) {
+  }
+
+  bool atEnd() const {
+    return this->position == this->end;
+  }
+
+  const char *skip(size_t size) {
+    if (static_cast<size_t>(this->end - this->position) < size) {
+      throw std::runtime_error("AMQP envelope is cut off");
+    }
+    const char *data = this->position;
+    this->position += size;
+    return data;
+  }
+
+  uint64_t readLength(size_t bytes) {
+    const char *data = this->skip(bytes);
+    uint64_t length = 0;
+    for (size_t i = 0; i < bytes; i++) {
+      length = (length << 8) | static_cast<uint8_t>(data[i]);
+    }
+    return length;
+  }
+
+  std::string readField() {
+    const size_t size = this->readLength(2);
+    return std::string(this->skip(size), size);
+  }
+};
+
+} // namespace
+
+AmqpEnvelopeWriter::AmqpEnvelopeWriter() {
+  this->body.push_back(static_cast<char>(AMQP_ENVELOPE_VERSION));
+}
+
+void AmqpEnvelopeWriter::add(
+    const database::MessageItem &message,
+    const std::string &traceparent) {
+  const std::string &payload = message.getPayload();
+  if (payload.size() > UINT32_MAX) {
+    throw std::runtime_error("AMQP envelope payload is too long");
+  }
+  std::string header;
+  header.push_back(
+      static_cast<char>(message.isBulk() ? ENVELOPE_FLAG_BULK : 0));
+  writeField(header, message.getMessageID());
+  writeField(header, message.getFromDeviceID());
+  writeField(header, message.getToDeviceID());
+  writeField(header, traceparent);
+  writeField(header, message.getBlobHashes());
+  this->body.reserve(this->body.size() + 8 + header.size() + payload.size());
+  writeLength(this->body, header.size(), 4);
+  this->body.append(header);
+  writeLength(this->body, payload.size(), 4);
+  this->body.append(payload);
+  this->count++;
+}
+
+size_t AmqpEnvelopeWriter::getCount() const {
+  return this->count;
+}
+
+const std::string &AmqpEnvelopeWriter::getBody() const {
+  return this->body;
+}
+
+std::vector<AmqpEnvelopeMessage>
+readAmqpEnvelope(const char *body, size_t bodySize) {
+  EnvelopeReader reader(body, bodySize);
+  const uint64_t version = reader.readLength(1);
+  if (version != AMQP_ENVELOPE_VERSION) {
+    throw std::runtime_error(
+        "Unknown AMQP envelope version " + std::to_string(version));
+  }
+  std::vector<AmqpEnvelopeMessage> messages;
+  while (!reader.atEnd()) {
+    const size_t headerSize = reader.readLength(4);
+    EnvelopeReader header(reader.skip(headerSize), headerSize);
+    AmqpEnvelopeMessage message;
+    message.bulk = header.readLength(1) & ENVELOPE_FLAG_BULK;
+    message.messageID = header.readField();
+    message.fromDeviceID = header.readField();
+    message.toDeviceID = header.readField();
+    message.traceparent = header.readField();
+    message.blobHashes = header.readField();
+    const size_t payloadSize = reader.readLength(4);
+    message.payload.assign(reader.skip(payloadSize), payloadSize);
+    messages.push_back(std::move(message));
+  }
+  return messages;
+}
+
+std::vector<std::vector<const database::MessageItem *>> packAmqpEnvelopes(
+    const std::vector<database::MessageItem> &messages,
+    size_t messagesMax) {
+  std::vector<std::vector<const database::MessageItem *>> envelopes;
+  std::vector<size_t> payloadSizes;
+  // The envelope of every recipient that still has room
+  std::unordered_map<std::string, size_t> openEnvelopes;
+  for (const database::MessageItem &message : messages) {
+    auto openIterator = openEnvelopes.find(message.getToDeviceID());
+    if (openIterator == openEnvelopes.end()) {
+      openIterator =
+          openEnvelopes.emplace(message.getToDeviceID(), envelopes.size())
+              .first;
+      envelopes.emplace_back();
+      payloadSizes.push_back(0);
+    }
+    const size_t index = openIterator->second;
+    envelopes[index].push_back(&message);
+    payloadSizes[index] += message.getPayload().size();
+    if (envelopes[index].size() >= messagesMax ||
+        payloadSizes[index] >= AMQP_ENVELOPE_PAYLOAD_SIZE_MAX) {
+      openEnvelopes.erase(openIterator);
+    }
+  }
+  return envelopes;
+}
+
+} // namespace network
+} // namespace comm
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "MessageItem.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace comm {
+namespace network {
+
+// A message as it is carried by an envelope
+struct AmqpEnvelopeMessage {
+  std::string messageID;
+  std::string fromDeviceID;
+  std::string toDeviceID;
+  std::string payload;
+  // W3C trace context of the publish, empty if it isn't traced
+  std::string traceparent;
+  std::string blobHashes;
+  bool bulk = false;
+};
+
+// Writes the body of a message with the content type
+// AMQP_ENVELOPE_CONTENT_TYPE, which carries one or more messages without any
+// AMQP headers:
+// - version, 1 byte
+// - for every message:
+//   - length of the header, 4 bytes
+//   - header: flags, 1 byte, then messageID, fromDeviceID, toDeviceID,
+//     traceparent and blobHashes, each with a length of 2 bytes
+//   - length of the payload, 4 bytes, then the payload
+//
+// Lengths are big-endian. A reader skips what it doesn't know at the end of
+// a header, so a later version may add fields there.
+class AmqpEnvelopeWriter {
+  std::string body;
+  size_t count = 0;
+
+public:
+  AmqpEnvelopeWriter();
+  // Throws if a field doesn't fit its length
+  void add(
+      const database::MessageItem &message,
+      const std::string &traceparent);
+  size_t getCount() const;
+  const std::string &getBody() const;
+};
+
+// Throws if the body is malformed or of an unknown version
+std::vector<AmqpEnvelopeMessage>
+readAmqpEnvelope(const char *body, size_t bodySize);
+
+// Groups the messages into envelopes that are published together. A message
+// is routed by its recipient, so an envelope only has messages of a single
+// recipient, in their order. An envelope gets at most messagesMax messages,
+// and no more once its payloads reach AMQP_ENVELOPE_PAYLOAD_SIZE_MAX.
+std::vector<std::vector<const database::MessageItem *>> packAmqpEnvelopes(
+    const std::vector<database::MessageItem> &messages,
+    size_t messagesMax);
+
+} // namespace network
+} // namespace comm
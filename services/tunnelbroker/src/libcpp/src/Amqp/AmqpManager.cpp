@@ -2,17 +2,82 @@
 #include "ConfigManager.h"
 #include "Constants.h"
 #include "DeliveryBroker.h"
+#include "GlobalConstants.h"
 #include "GlobalTools.h"
+#include "Logging.h"
+#include "Metrics.h"
+#include "TrafficCapture.h"
 
 #include <glog/logging.h>
 
 #include <uv.h>
+#include <algorithm>
 #include <chrono>
 #include <thread>
 
 namespace comm {
 namespace network {
 
+namespace {
+
+struct AmqpMetrics {
+  metrics::Counter &published;
+  metrics::Counter &publishFailures;
+  metrics::Histogram &publishConfirmation;
+  metrics::Counter &acks;
+  metrics::Counter &ackFrames;
+  metrics::Counter &buffered;
+};
+
+AmqpMetrics &getAmqpMetrics() {
+  static AmqpMetrics amqpMetrics = [] {
+    metrics::MetricsRegistry &registry =
+        metrics::MetricsRegistry::getInstance();
+    return AmqpMetrics{
+        registry.getCounter(
+            "comm_amqp_published_messages_total",
+            "Messages published to the broker"),
+        registry.getCounter(
+            "comm_amqp_publish_failures_total",
+            "Messages that the broker rejected, lost or that couldn't be "
+            "published"),
+        registry.getHistogram(
+            "comm_amqp_publish_confirm_seconds",
+            "Time from publishing a message to the broker settling it"),
+        registry.getCounter(
+            "comm_amqp_acks_total", "Deliveries acknowledged by the streams"),
+        registry.getCounter(
+            "comm_amqp_ack_frames_total",
+            "Acknowledgements sent to the broker after coalescing"),
+        registry.getCounter(
+            "comm_amqp_buffered_messages_total",
+            "Messages kept until a publish channel was ready")};
+  }();
+  return amqpMetrics;
+}
+
+} // namespace
+
+AmqpBatchConfirmation::AmqpBatchConfirmation(size_t count)
+    : pendingCount(count) {
+  if (!count) {
+    this->promise.set_value(true);
+  }
+}
+
+std::future<bool> AmqpBatchConfirmation::getFuture() {
+  return this->promise.get_future();
+}
+
+void AmqpBatchConfirmation::confirm(bool confirmed) {
+  if (!confirmed) {
+    this->failed = true;
+  }
+  if (this->pendingCount.fetch_sub(1) == 1) {
+    this->promise.set_value(!this->failed);
+  }
+}
+
 AmqpManager &AmqpManager::getInstance() {
   static AmqpManager instance;
   return instance;
@@ -34,53 +99,157 @@ void AmqpManager::connectInternal() {
   const std::string fanoutExchangeName =
       config::ConfigManager::getInstance().getParameter(
           config::ConfigManager::OPTION_AMQP_FANOUT_EXCHANGE);
+  const std::string directExchangeName =
+      config::ConfigManager::getInstance().getParameter(
+          config::ConfigManager::OPTION_AMQP_DIRECT_EXCHANGE);
+  this->queueName = tunnelbrokerID;
+  this->directExchangeName = directExchangeName;
+  const AmqpChannelOptions channelOptions =
+      config::ConfigManager::getInstance().getAmqpChannelOptions();
   LOG(INFO) << "AMQP: Connecting to " << amqpUri;
   uv_loop_t *localUvLoop = uv_default_loop();
   AMQP::LibUvHandler uvHandler(localUvLoop);
   AMQP::TcpConnection tcpConnection(&uvHandler, AMQP::Address(amqpUri));
   this->amqpChannel = std::make_unique<AMQP::TcpChannel>(&tcpConnection);
+  // Delivery tags start over on a new channel
+  this->ackCoalescer.reset();
+  if (this->consumerShards == nullptr) {
+    this->consumerShards =
+        std::make_unique<AmqpConsumerShards>(channelOptions.consumerShards);
+  }
+  // The messages of the previous channel are redelivered on this one
+  this->consumerShards->clear();
+  {
+    std::scoped_lock lock{this->packedDeliveriesMutex};
+    this->packedDeliveries.clear();
+  }
+  uv_timer_t ackFlushTimer;
+  uv_timer_init(localUvLoop, &ackFlushTimer);
+  ackFlushTimer.data = this;
+  uv_timer_start(
+      &ackFlushTimer,
+      [](uv_timer_t *timer) {
+        static_cast<AmqpManager *>(timer->data)->flushAcks(true);
+      },
+      AMQP_ACK_FLUSH_INTERVAL_MS,
+      AMQP_ACK_FLUSH_INTERVAL_MS);
+  // Announcements made while there was no connection are lost
+  this->presenceDirectory.reset(std::chrono::steady_clock::now());
+  uv_timer_t presenceHeartbeatTimer;
+  uv_timer_init(localUvLoop, &presenceHeartbeatTimer);
+  presenceHeartbeatTimer.data = this;
+  uv_timer_start(
+      &presenceHeartbeatTimer,
+      [](uv_timer_t *timer) {
+        static_cast<AmqpManager *>(timer->data)->sendPresenceHeartbeat();
+      },
+      AMQP_PRESENCE_HEARTBEAT_INTERVAL_MS,
+      AMQP_PRESENCE_HEARTBEAT_INTERVAL_MS);
+  struct PublishChannelsReopening {
+    AmqpManager *manager;
+    AMQP::LibUvHandler *uvHandler;
+    std::string amqpUri;
+  } publishChannelsReopening{this, &uvHandler, amqpUri};
+  uv_timer_t publishChannelsTimer;
+  uv_timer_init(localUvLoop, &publishChannelsTimer);
+  publishChannelsTimer.data = &publishChannelsReopening;
+  uv_timer_start(
+      &publishChannelsTimer,
+      [](uv_timer_t *timer) {
+        PublishChannelsReopening *reopening =
+            static_cast<PublishChannelsReopening *>(timer->data);
+        reopening->manager->reopenFailedPublishChannels(
+            *reopening->uvHandler, reopening->amqpUri);
+      },
+      AMQP_RECONNECT_ATTEMPT_INTERVAL_MS,
+      AMQP_RECONNECT_ATTEMPT_INTERVAL_MS);
   this->amqpChannel->onReady([this]() {
     LOG(INFO) << "AMQP: Channel is ready";
     this->amqpReady = true;
     this->reconnectAttempt = 0;
+    this->notifyReadinessChanged();
   });
-  this->amqpChannel->onError([this](const char *message) {
-    LOG(ERROR) << "AMQP: Channel error: " << message;
-    this->amqpReady = false;
+  // Publishes are handed to the loop, as the confirms change the state of
+  // the reliable channels there
+  uv_async_t loopTasksAsync;
+  uv_async_init(localUvLoop, &loopTasksAsync, [](uv_async_t *async) {
+    static_cast<AmqpManager *>(async->data)->runLoopTasks();
   });
+  loopTasksAsync.data = this;
+  {
+    std::scoped_lock lock{this->loopTasksMutex};
+    this->loopTasksAsync = &loopTasksAsync;
+  }
+  this->amqpChannel->onError(
+      [this,
+       &ackFlushTimer,
+       &presenceHeartbeatTimer,
+       &publishChannelsTimer,
+       &loopTasksAsync](const char *message) {
+        LOG(ERROR) << "AMQP: Channel error: " << message;
+        this->amqpReady = false;
+        this->notifyReadinessChanged();
+        {
+          std::scoped_lock lock{this->loopTasksMutex};
+          this->loopTasksAsync = nullptr;
+        }
+        // The loop only ends once the handles are closed
+        for (uv_handle_t *handle :
+             {reinterpret_cast<uv_handle_t *>(&ackFlushTimer),
+              reinterpret_cast<uv_handle_t *>(&presenceHeartbeatTimer),
+              reinterpret_cast<uv_handle_t *>(&publishChannelsTimer),
+              reinterpret_cast<uv_handle_t *>(&loopTasksAsync)}) {
+          if (!uv_is_closing(handle)) {
+            uv_close(handle, nullptr);
+          }
+        }
+      });
+
+  std::vector<std::shared_ptr<AmqpPublishChannel>> publishChannels;
+  for (size_t i = 0; i < channelOptions.publishChannels; i++) {
+    std::shared_ptr<AmqpPublishChannel> publishChannel =
+        std::make_shared<AmqpPublishChannel>();
+    this->openPublishChannel(*publishChannel, uvHandler, amqpUri);
+    publishChannels.push_back(publishChannel);
+  }
+  {
+    std::scoped_lock lock{this->publishChannelsMutex};
+    this->publishChannels = std::move(publishChannels);
+  }
 
+  if (channelOptions.prefetchCount) {
+    this->amqpChannel->setQos(channelOptions.prefetchCount);
+  }
   AMQP::Table arguments;
   arguments["x-message-ttl"] = (uint64_t)AMQP_MESSAGE_TTL;
   arguments["x-expires"] = (uint64_t)AMQP_QUEUE_TTL;
   this->amqpChannel->declareExchange(fanoutExchangeName, AMQP::fanout);
+  this->amqpChannel->declareExchange(directExchangeName, AMQP::direct);
   this->amqpChannel->declareQueue(tunnelbrokerID, AMQP::durable, arguments)
       .onSuccess([this, tunnelbrokerID, fanoutExchangeName](
                      const std::string &name,
                      uint32_t messagecount,
                      uint32_t consumercount) {
         LOG(INFO) << "AMQP: Queue " << name << " created";
+        // Instances that still publish to the fanout exchange reach this one
+        // too, the others route to the bindings of the devices
         this->amqpChannel->bindQueue(fanoutExchangeName, tunnelbrokerID, "")
             .onError([this, tunnelbrokerID, fanoutExchangeName](
                          const char *message) {
               LOG(ERROR) << "AMQP: Failed to bind queue:  " << tunnelbrokerID
                          << " to exchange: " << fanoutExchangeName;
             });
-        this->amqpChannel->consume(tunnelbrokerID)
-            .onReceived([](const AMQP::Message &message,
-                           uint64_t deliveryTag,
-                           bool redelivered) {
-              try {
-                AMQP::Table headers = message.headers();
-                const std::string payload(message.body(), message.bodySize());
-                const std::string messageID(headers[AMQP_HEADER_MESSAGEID]);
-                const std::string toDeviceID(headers[AMQP_HEADER_TO_DEVICEID]);
-                const std::string fromDeviceID(
-                    headers[AMQP_HEADER_FROM_DEVICEID]);
-                DeliveryBroker::getInstance().push(
-                    messageID, deliveryTag, toDeviceID, fromDeviceID, payload);
-              } catch (const std::exception &e) {
-                LOG(ERROR) << "AMQP: Message parsing exception: " << e.what();
-              }
+        // After a reconnect during a drain
+        if (this->draining) {
+          return;
+        }
+        // The consumer tag is the name of the queue, for stopConsuming
+        this->amqpChannel->consume(tunnelbrokerID, tunnelbrokerID)
+            .onReceived([this](
+                            const AMQP::Message &message,
+                            uint64_t deliveryTag,
+                            bool redelivered) {
+              this->onMessageReceived(message, deliveryTag, redelivered);
             })
             .onError([](const char *message) {
               LOG(ERROR) << "AMQP: Error on message consume:  " << message;
@@ -89,7 +258,53 @@ void AmqpManager::connectInternal() {
       .onError([](const char *message) {
         LOG(ERROR) << "AMQP: Queue creation error: " + std::string(message);
       });
+  // Announcements are only of interest while the instance runs, so the
+  // queue goes away with the connection
+  this->amqpChannel->declareExchange(AMQP_PRESENCE_EXCHANGE_NAME, AMQP::fanout);
+  this->amqpChannel->declareQueue(AMQP::exclusive | AMQP::autodelete)
+      .onSuccess([this](
+                     const std::string &name,
+                     uint32_t messagecount,
+                     uint32_t consumercount) {
+        this->amqpChannel->bindQueue(AMQP_PRESENCE_EXCHANGE_NAME, name, "")
+            .onError([](const char *message) {
+              LOG(ERROR) << "AMQP: Failed to bind presence queue: " << message;
+            });
+        this->amqpChannel->consume(name, AMQP::noack)
+            .onReceived([this](
+                            const AMQP::Message &message,
+                            uint64_t deliveryTag,
+                            bool redelivered) {
+              this->onPresenceReceived(message);
+            })
+            .onError([](const char *message) {
+              LOG(ERROR) << "AMQP: Error on presence consume: " << message;
+            });
+      })
+      .onError([](const char *message) {
+        LOG(ERROR) << "AMQP: Presence queue creation error: " << message;
+      });
   uv_run(localUvLoop, UV_RUN_DEFAULT);
+
+  // The connections can't be used once the loop is over, the publishes that
+  // are still handed to it fail
+  {
+    std::scoped_lock lock{this->loopTasksMutex};
+    this->loopTasksAsync = nullptr;
+  }
+  std::vector<std::shared_ptr<AmqpPublishChannel>> closedChannels;
+  {
+    std::scoped_lock lock{this->publishChannelsMutex};
+    closedChannels = std::move(this->publishChannels);
+    this->publishChannels.clear();
+  }
+  for (std::shared_ptr<AmqpPublishChannel> &publishChannel : closedChannels) {
+    publishChannel->ready = false;
+    publishChannel->reliable.reset();
+    publishChannel->channel.reset();
+    publishChannel->connection.reset();
+  }
+  this->runLoopTasks();
 };
 
 void AmqpManager::connect() {
@@ -107,45 +322,691 @@ void AmqpManager::connect() {
              << AMQP_RECONNECT_MAX_ATTEMPTS << " attempts";
 }
 
+void AmqpManager::notifyReadinessChanged() {
+  // Taking the mutex orders the change before the check of a waiter that is
+  // about to wait
+  { std::scoped_lock lock{this->readinessMutex}; }
+  this->readinessCondition.notify_all();
+}
+
+void AmqpManager::openPublishChannel(
+    AmqpPublishChannel &publishChannel,
+    AMQP::LibUvHandler &uvHandler,
+    const std::string &amqpUri) {
+  publishChannel.ready = false;
+  publishChannel.reliable.reset();
+  publishChannel.channel.reset();
+  publishChannel.connection.reset();
+  // Errors that closing the previous connection reports are of no interest
+  publishChannel.failed = false;
+  publishChannel.connection = std::make_unique<AMQP::TcpConnection>(
+      &uvHandler, AMQP::Address(amqpUri));
+  publishChannel.channel =
+      std::make_unique<AMQP::TcpChannel>(publishChannel.connection.get());
+  publishChannel.reliable =
+      std::make_unique<AMQP::Reliable<>>(*publishChannel.channel);
+  AmqpPublishChannel *channel = &publishChannel;
+  publishChannel.channel->onReady(
+      [this, channel]() { this->onPublishChannelReady(*channel); });
+  publishChannel.channel->onError([this, channel](const char *message) {
+    LOG(ERROR) << "AMQP: Publish channel error: " << message;
+    channel->ready = false;
+    channel->failed = true;
+    this->notifyReadinessChanged();
+  });
+  publishChannel.channel->declareExchange(
+      this->directExchangeName, AMQP::direct);
+}
+
+void AmqpManager::reopenFailedPublishChannels(
+    AMQP::LibUvHandler &uvHandler,
+    const std::string &amqpUri) {
+  std::vector<std::shared_ptr<AmqpPublishChannel>> failedChannels;
+  {
+    std::scoped_lock lock{this->publishChannelsMutex};
+    for (const std::shared_ptr<AmqpPublishChannel> &publishChannel :
+         this->publishChannels) {
+      if (publishChannel->failed) {
+        failedChannels.push_back(publishChannel);
+      }
+    }
+  }
+  for (const std::shared_ptr<AmqpPublishChannel> &publishChannel :
+       failedChannels) {
+    LOG(INFO) << "AMQP: Reopening a publish channel";
+    this->openPublishChannel(*publishChannel, uvHandler, amqpUri);
+  }
+}
+
+std::shared_ptr<AmqpPublishChannel> AmqpManager::findPublishChannel() {
+  std::scoped_lock lock{this->publishChannelsMutex};
+  for (size_t i = 0; i < this->publishChannels.size(); i++) {
+    std::shared_ptr<AmqpPublishChannel> publishChannel =
+        this->publishChannels
+            [this->nextPublishChannel++ % this->publishChannels.size()];
+    if (publishChannel->ready) {
+      return publishChannel;
+    }
+  }
+  return nullptr;
+}
+
+std::shared_ptr<AmqpPublishChannel> AmqpManager::getPublishChannel() {
+  std::shared_ptr<AmqpPublishChannel> publishChannel =
+      this->findPublishChannel();
+  if (publishChannel != nullptr) {
+    return publishChannel;
+  }
+  LOG_EVERY_MS(INFO, LOGGING_REPEATED_LINE_INTERVAL_MS)
+      << "AMQP: No publish channel is ready, waiting";
+  std::unique_lock<std::mutex> lock{this->readinessMutex};
+  if (!this->readinessCondition.wait_for(
+          lock,
+          std::chrono::milliseconds(AMQP_PUBLISH_CHANNEL_WAIT_MS),
+          [this, &publishChannel]() {
+            publishChannel = this->findPublishChannel();
+            return publishChannel != nullptr;
+          })) {
+    throw std::runtime_error("No AMQP publish channel is ready");
+  }
+  return publishChannel;
+}
+
+bool AmqpManager::bufferIfNotReady(
+    const std::vector<database::MessageItem> &messages,
+    std::shared_ptr<AmqpBatchConfirmation> confirmation,
+    const tracing::TraceContext &traceContext) {
+  std::scoped_lock lock{this->outgoingMutex};
+  if (this->findPublishChannel() != nullptr ||
+      this->outgoingMessages.size() + messages.size() >
+          AMQP_OUTGOING_BUFFER_CAPACITY) {
+    return false;
+  }
+  for (const database::MessageItem &message : messages) {
+    this->outgoingMessages.push_back({message, confirmation, traceContext});
+  }
+  getAmqpMetrics().buffered.increment(messages.size());
+  return true;
+}
+
+void AmqpManager::onPublishChannelReady(AmqpPublishChannel &publishChannel) {
+  {
+    std::scoped_lock lock{this->outgoingMutex};
+    publishChannel.ready = true;
+    if (!this->outgoingMessages.empty()) {
+      LOG(INFO) << "AMQP: Publishing " << this->outgoingMessages.size()
+                << " buffered messages";
+    }
+    const std::string &exchange =
+        config::ConfigManager::getInstance().getSnapshot().amqpDirectExchange;
+    for (AmqpOutgoingMessage &outgoing : this->outgoingMessages) {
+      std::shared_ptr<AmqpPendingPublish> pending;
+      try {
+        pending = this->preparePublish(
+            {&outgoing.message}, outgoing.confirmation, outgoing.traceContext);
+        this->publish(publishChannel, exchange, pending);
+      } catch (std::runtime_error &e) {
+        LOG(ERROR) << "AMQP: Error while publishing message:  " << e.what();
+        getAmqpMetrics().publishFailures.increment();
+        if (outgoing.confirmation != nullptr) {
+          outgoing.confirmation->confirm(false);
+        }
+      }
+    }
+    this->outgoingMessages.clear();
+  }
+  this->notifyReadinessChanged();
+}
+
+bool AmqpManager::runOnLoop(std::function<void()> task) {
+  std::scoped_lock lock{this->loopTasksMutex};
+  if (this->loopTasksAsync == nullptr) {
+    return false;
+  }
+  this->loopTasks.push_back(std::move(task));
+  uv_async_send(this->loopTasksAsync);
+  return true;
+}
+
+void AmqpManager::runLoopTasks() {
+  std::vector<std::function<void()>> tasks;
+  {
+    std::scoped_lock lock{this->loopTasksMutex};
+    tasks.swap(this->loopTasks);
+  }
+  for (std::function<void()> &task : tasks) {
+    task();
+  }
+}
+
+std::shared_ptr<AmqpPendingPublish> AmqpManager::preparePublish(
+    const std::vector<const database::MessageItem *> &messages,
+    std::shared_ptr<AmqpBatchConfirmation> confirmation,
+    const tracing::TraceContext &traceContext) {
+  const std::string traceparent =
+      traceContext.isValid() ? traceContext.toTraceparent() : "";
+  const database::MessageItem &firstMessage = *messages.front();
+  std::shared_ptr<AmqpPendingPublish> pending =
+      std::make_shared<AmqpPendingPublish>();
+  pending->routingKey = firstMessage.getToDeviceID();
+  pending->count = messages.size();
+  pending->confirmation = confirmation;
+  pending->description = (messages.size() > 1 ? "Envelope of message "
+                                              : "Message ") +
+      firstMessage.getMessageID();
+  if (config::ConfigManager::getInstance()
+          .getSnapshot()
+          .amqpChannelOptions.envelopeMessagesMax ||
+      messages.size() > 1) {
+    AmqpEnvelopeWriter writer;
+    for (const database::MessageItem *message : messages) {
+      writer.add(*message, traceparent);
+    }
+    pending->body = writer.getBody();
+    pending->contentType = AMQP_ENVELOPE_CONTENT_TYPE;
+  } else {
+    pending->body = firstMessage.getPayload();
+    AMQP::Table &headers = pending->headers;
+    headers[AMQP_HEADER_MESSAGEID] = firstMessage.getMessageID();
+    headers[AMQP_HEADER_FROM_DEVICEID] = firstMessage.getFromDeviceID();
+    headers[AMQP_HEADER_TO_DEVICEID] = firstMessage.getToDeviceID();
+    if (!traceparent.empty()) {
+      headers[AMQP_HEADER_TRACEPARENT] = traceparent;
+    }
+    if (firstMessage.isBulk()) {
+      headers[AMQP_HEADER_PRIORITY] = AMQP_PRIORITY_BULK;
+    }
+    if (!firstMessage.getBlobHashes().empty()) {
+      headers[AMQP_HEADER_BLOB_HASHES] = firstMessage.getBlobHashes();
+    }
+  }
+  pending->preparedAt = std::chrono::steady_clock::now();
+  return pending;
+}
+
+void AmqpManager::publish(
+    AmqpPublishChannel &publishChannel,
+    const std::string &exchange,
+    std::shared_ptr<AmqpPendingPublish> pending) {
+  if (publishChannel.reliable == nullptr) {
+    throw std::runtime_error("AMQP channel is closed");
+  }
+  AMQP::Envelope env(pending->body.data(), pending->body.size());
+  if (pending->contentType.empty()) {
+    env.setHeaders(pending->headers);
+  } else {
+    env.setContentType(pending->contentType);
+  }
+  // Set delivery mode to: Durable (2)
+  env.setDeliveryMode(2);
+
+  // A message that is lost may be reported by more than one callback
+  std::shared_ptr<std::atomic<bool>> reported =
+      std::make_shared<std::atomic<bool>>(false);
+  auto report = [pending, reported](bool confirmed) {
+    if (reported->exchange(true)) {
+      return;
+    }
+    AmqpMetrics &amqpMetrics = getAmqpMetrics();
+    amqpMetrics.publishConfirmation.recordSince(pending->preparedAt);
+    if (!confirmed) {
+      amqpMetrics.publishFailures.increment(pending->count);
+    }
+    if (pending->confirmation != nullptr) {
+      // The confirm of an envelope settles all of its messages
+      for (size_t i = 0; i < pending->count; i++) {
+        pending->confirmation->confirm(confirmed);
+      }
+    }
+  };
+  const std::string description = pending->description;
+  publishChannel.reliable->publish(exchange, pending->routingKey, env)
+      .onAck([report]() { report(true); })
+      .onNack([report, description]() {
+        LOG(ERROR) << "AMQP: " << description << " was rejected";
+        report(false);
+      })
+      .onLost([report, description]() {
+        LOG(ERROR) << "AMQP: " << description << " was lost";
+        report(false);
+      })
+      .onError([report](const char *message) { report(false); });
+  getAmqpMetrics().published.increment(pending->count);
+}
+
 bool AmqpManager::send(const database::MessageItem *message) {
-  waitUntilReady();
+  if (this->bufferIfNotReady({*message}, nullptr, tracing::TraceContext())) {
+    return true;
+  }
   try {
-    const std::string messagePayload = message->getPayload();
-    AMQP::Envelope env(messagePayload.c_str(), messagePayload.size());
-    AMQP::Table headers;
-    headers[AMQP_HEADER_MESSAGEID] = message->getMessageID();
-    headers[AMQP_HEADER_FROM_DEVICEID] = message->getFromDeviceID();
-    headers[AMQP_HEADER_TO_DEVICEID] = message->getToDeviceID();
-    // Set delivery mode to: Durable (2)
-    env.setDeliveryMode(2);
-    env.setHeaders(std::move(headers));
-
-    std::scoped_lock lock{this->channelMutex};
-    this->amqpChannel->publish(
-        config::ConfigManager::getInstance().getParameter(
-            config::ConfigManager::OPTION_AMQP_FANOUT_EXCHANGE),
-        "",
-        env);
+    const std::string exchange =
+        config::ConfigManager::getInstance().getSnapshot().amqpDirectExchange;
+    std::shared_ptr<AmqpPendingPublish> pending =
+        this->preparePublish({message}, nullptr, tracing::TraceContext());
+    std::shared_ptr<AmqpPublishChannel> publishChannel =
+        this->getPublishChannel();
+    const bool scheduled =
+        this->runOnLoop([this, publishChannel, exchange, pending]() {
+          try {
+            this->publish(*publishChannel, exchange, pending);
+          } catch (std::runtime_error &e) {
+            LOG(ERROR) << "AMQP: Error while publishing message:  "
+                       << e.what();
+            getAmqpMetrics().publishFailures.increment();
+          }
+        });
+    if (!scheduled) {
+      throw std::runtime_error("AMQP connection is closed");
+    }
   } catch (std::runtime_error &e) {
     LOG(ERROR) << "AMQP: Error while publishing message:  " << e.what();
+    getAmqpMetrics().publishFailures.increment();
     return false;
   }
   return true;
 };
 
+std::future<bool> AmqpManager::sendBatch(
+    const std::vector<database::MessageItem> &messages,
+    const tracing::TraceContext &traceContext) {
+  std::shared_ptr<AmqpBatchConfirmation> confirmation =
+      std::make_shared<AmqpBatchConfirmation>(messages.size());
+  std::future<bool> confirmed = confirmation->getFuture();
+  if (this->bufferIfNotReady(messages, confirmation, traceContext)) {
+    return confirmed;
+  }
+  bool scheduled = false;
+  try {
+    const config::ConfigSnapshot &config =
+        config::ConfigManager::getInstance().getSnapshot();
+    const std::string exchange = config.amqpDirectExchange;
+    // Encoded here, so that the loop only writes them out
+    std::vector<std::shared_ptr<AmqpPendingPublish>> pendings;
+    for (const std::vector<const database::MessageItem *> &envelope :
+         packAmqpEnvelopes(
+             messages,
+             std::max<size_t>(
+                 1, config.amqpChannelOptions.envelopeMessagesMax))) {
+      pendings.push_back(
+          this->preparePublish(envelope, confirmation, traceContext));
+    }
+    std::shared_ptr<AmqpPublishChannel> publishChannel =
+        this->getPublishChannel();
+    scheduled = this->runOnLoop([this, publishChannel, exchange, pendings]() {
+      for (const std::shared_ptr<AmqpPendingPublish> &pending : pendings) {
+        try {
+          this->publish(*publishChannel, exchange, pending);
+        } catch (std::runtime_error &e) {
+          LOG(ERROR) << "AMQP: Error while publishing message:  " << e.what();
+          getAmqpMetrics().publishFailures.increment(pending->count);
+          for (size_t i = 0; i < pending->count; i++) {
+            pending->confirmation->confirm(false);
+          }
+        }
+      }
+    });
+  } catch (std::runtime_error &e) {
+    LOG(ERROR) << "AMQP: Error while publishing message:  " << e.what();
+  }
+  // None of the messages are going to be confirmed
+  if (!scheduled) {
+    getAmqpMetrics().publishFailures.increment(messages.size());
+    for (size_t i = 0; i < messages.size(); i++) {
+      confirmation->confirm(false);
+    }
+  }
+  return confirmed;
+}
+
 void AmqpManager::ack(uint64_t deliveryTag) {
-  waitUntilReady();
+  // Messages read from the database weren't delivered by AMQP, and a zero
+  // tag would acknowledge everything
+  if (!this->amqpReady || !deliveryTag) {
+    return;
+  }
+  getAmqpMetrics().acks.increment();
+  {
+    std::scoped_lock lock{this->packedDeliveriesMutex};
+    auto packedIterator = this->packedDeliveries.find(deliveryTag);
+    if (packedIterator != this->packedDeliveries.end()) {
+      if (--packedIterator->second) {
+        return;
+      }
+      this->packedDeliveries.erase(packedIterator);
+    }
+  }
+  if (this->ackCoalescer.add(deliveryTag)) {
+    this->flushAcks(false);
+  }
+}
+
+void AmqpManager::flushAcks(bool outOfOrder) {
   std::scoped_lock lock{this->channelMutex};
-  this->amqpChannel->ack(deliveryTag);
+  if (!this->amqpReady) {
+    return;
+  }
+  for (const AmqpAck &ack : this->ackCoalescer.flush(outOfOrder)) {
+    this->amqpChannel->ack(
+        ack.deliveryTag, ack.multiple ? AMQP::multiple : 0);
+    getAmqpMetrics().ackFrames.increment();
+  }
 }
 
-void AmqpManager::waitUntilReady() {
-  while (!this->amqpReady) {
-    LOG(INFO) << "AMQP: Connection is not ready, waiting";
-    std::this_thread::sleep_for(
-        std::chrono::milliseconds(AMQP_RECONNECT_ATTEMPT_INTERVAL_MS));
+std::future<bool> AmqpManager::addDeviceStream(const std::string &deviceID) {
+  std::shared_ptr<std::promise<bool>> bound =
+      std::make_shared<std::promise<bool>>();
+  std::future<bool> result = bound->get_future();
+  // Waiting under the lock would hold up the streams of every other device
+  this->waitUntilReady(
+      std::chrono::steady_clock::now() +
+      std::chrono::milliseconds(AMQP_BIND_TIMEOUT_MS));
+  // Counting and binding under the same lock keeps the bindings in the order
+  // of the streams coming and going
+  std::scoped_lock lock{this->deviceStreamsMutex};
+  if (this->deviceStreams[deviceID]++) {
+    bound->set_value(true);
+    return result;
+  }
+  // The stream is still counted, removeDeviceStream is called for it
+  if (!this->amqpReady) {
+    LOG(ERROR) << "AMQP: Connection is not ready to bind device " << deviceID;
+    bound->set_value(false);
+    return result;
+  }
+  std::shared_ptr<std::atomic<bool>> settled =
+      std::make_shared<std::atomic<bool>>(false);
+  std::scoped_lock channelLock{this->channelMutex};
+  this->publishPresence(AMQP_PRESENCE_EVENT_ONLINE, {deviceID});
+  this->amqpChannel
+      ->bindQueue(this->directExchangeName, this->queueName, deviceID)
+      .onSuccess([bound, settled]() {
+        if (!settled->exchange(true)) {
+          bound->set_value(true);
+        }
+      })
+      .onError([bound, settled, deviceID](const char *message) {
+        LOG(ERROR) << "AMQP: Failed to bind device " << deviceID << ": "
+                   << message;
+        if (!settled->exchange(true)) {
+          bound->set_value(false);
+        }
+      });
+  return result;
+}
+
+void AmqpManager::removeDeviceStream(const std::string &deviceID) {
+  std::scoped_lock lock{this->deviceStreamsMutex};
+  auto deviceStreamsIterator = this->deviceStreams.find(deviceID);
+  if (deviceStreamsIterator == this->deviceStreams.end() ||
+      --deviceStreamsIterator->second) {
+    return;
+  }
+  this->deviceStreams.erase(deviceStreamsIterator);
+  // Without a connection the binding stays, the instance then gets the
+  // messages of the device until it connects somewhere else
+  if (!this->amqpReady) {
+    return;
+  }
+  std::scoped_lock channelLock{this->channelMutex};
+  this->publishPresence(AMQP_PRESENCE_EVENT_OFFLINE, {deviceID});
+  this->amqpChannel
+      ->unbindQueue(this->directExchangeName, this->queueName, deviceID)
+      .onError([deviceID](const char *message) {
+        LOG(ERROR) << "AMQP: Failed to unbind device " << deviceID << ": "
+                   << message;
+      });
+}
+
+void AmqpManager::publishPresence(
+    const std::string &event,
+    const std::vector<std::string> &deviceIDs) {
+  std::string body;
+  for (const std::string &deviceID : deviceIDs) {
+    body += deviceID;
+    body += '\n';
+  }
+  AMQP::Envelope env(body.c_str(), body.size());
+  AMQP::Table headers;
+  headers[AMQP_HEADER_PRESENCE_BROKERID] = this->queueName;
+  headers[AMQP_HEADER_PRESENCE_EVENT] = event;
+  env.setHeaders(std::move(headers));
+  this->amqpChannel->publish(AMQP_PRESENCE_EXCHANGE_NAME, "", env);
+}
+
+void AmqpManager::sendPresenceHeartbeat() {
+  // Nothing can be announced without a connection
+  if (!this->amqpReady) {
+    return;
+  }
+  std::scoped_lock lock{this->deviceStreamsMutex, this->channelMutex};
+  std::vector<std::string> deviceIDs;
+  deviceIDs.reserve(this->deviceStreams.size());
+  for (const auto &[deviceID, streams] : this->deviceStreams) {
+    deviceIDs.push_back(deviceID);
+  }
+  this->publishPresence(AMQP_PRESENCE_EVENT_HEARTBEAT, deviceIDs);
+}
+
+void AmqpManager::onMessageReceived(
+    const AMQP::Message &message,
+    uint64_t deliveryTag,
+    bool redelivered) {
+  std::shared_ptr<AmqpIncomingMessage> incoming =
+      std::make_shared<AmqpIncomingMessage>();
+  incoming->body.assign(message.body(), message.bodySize());
+  incoming->envelope = message.contentType() == AMQP_ENVELOPE_CONTENT_TYPE;
+  incoming->deliveryTag = deliveryTag;
+  incoming->redelivered = redelivered;
+  // Messages are routed by their recipient, only the ones from the fanout
+  // exchange don't have it as the routing key
+  std::string key = message.routingkey();
+  if (!incoming->envelope) {
+    incoming->headers = message.headers();
+    if (key.empty() && incoming->headers.contains(AMQP_HEADER_TO_DEVICEID)) {
+      key = std::string(incoming->headers[AMQP_HEADER_TO_DEVICEID]);
+    }
+  }
+  this->consumerShards->dispatch(
+      key, [this, incoming]() { this->handleIncomingMessage(*incoming); });
+}
+
+void AmqpManager::handleIncomingMessage(AmqpIncomingMessage &incoming) {
+  const uint64_t deliveryTag = incoming.deliveryTag;
+  const bool redelivered = incoming.redelivered;
+  try {
+    if (!incoming.envelope) {
+      // Published with headers, by an instance from before the envelopes or
+      // with them turned off
+      AMQP::Table &headers = incoming.headers;
+      AmqpEnvelopeMessage received;
+      received.payload = std::move(incoming.body);
+      received.messageID = std::string(headers[AMQP_HEADER_MESSAGEID]);
+      received.toDeviceID = std::string(headers[AMQP_HEADER_TO_DEVICEID]);
+      received.fromDeviceID = std::string(headers[AMQP_HEADER_FROM_DEVICEID]);
+      // Only the traced messages have the header
+      if (headers.contains(AMQP_HEADER_TRACEPARENT)) {
+        received.traceparent = std::string(headers[AMQP_HEADER_TRACEPARENT]);
+      }
+      received.bulk = headers.contains(AMQP_HEADER_PRIORITY) &&
+          std::string(headers[AMQP_HEADER_PRIORITY]) == AMQP_PRIORITY_BULK;
+      if (headers.contains(AMQP_HEADER_BLOB_HASHES)) {
+        received.blobHashes = std::string(headers[AMQP_HEADER_BLOB_HASHES]);
+      }
+      this->pushReceivedMessage(received, deliveryTag, redelivered);
+      return;
+    }
+    std::vector<AmqpEnvelopeMessage> messages =
+        readAmqpEnvelope(incoming.body.data(), incoming.body.size());
+    if (messages.empty()) {
+      this->ack(deliveryTag);
+      return;
+    }
+    // Has to be in place before any of the messages can be acknowledged
+    if (messages.size() > 1) {
+      std::scoped_lock lock{this->packedDeliveriesMutex};
+      this->packedDeliveries[deliveryTag] = messages.size();
+    }
+    for (AmqpEnvelopeMessage &received : messages) {
+      this->pushReceivedMessage(received, deliveryTag, redelivered);
+    }
+  } catch (const std::exception &e) {
+    LOG(ERROR) << "AMQP: Message parsing exception: " << e.what();
+  }
+}
+
+void AmqpManager::pushReceivedMessage(
+    AmqpEnvelopeMessage &message,
+    uint64_t deliveryTag,
+    bool redelivered) {
+  tracing::Span receiveSpan(
+      "amqp.receive",
+      tracing::TraceContext::fromTraceparent(message.traceparent),
+      tracing::SpanKind::CONSUMER);
+  receiveSpan.setAttribute("messaging.message.id", message.messageID);
+  receiveSpan.setAttribute(
+      "messaging.rabbitmq.redelivered", static_cast<int64_t>(redelivered));
+  capture::CapturedCall capturedCall(
+      trace::EVENT_AMQP_RECEIVE, message.toDeviceID);
+  capturedCall.count = 1;
+  capturedCall.bytes = message.payload.size();
+  const DeliveryBrokerPushResult result = DeliveryBroker::getInstance().push(
+      message.messageID,
+      deliveryTag,
+      message.toDeviceID,
+      message.fromDeviceID,
+      std::move(message.payload),
+      receiveSpan.getContext().toTraceparent(),
+      message.bulk ? DeliveryBrokerPriority::BULK
+                   : DeliveryBrokerPriority::INTERACTIVE,
+      message.blobHashes);
+  // The message is already stored in the database and it is delivered from
+  // there when the device reconnects, or it already has been
+  if (result == DeliveryBrokerPushResult::DROPPED ||
+      result == DeliveryBrokerPushResult::DUPLICATE) {
+    this->ack(deliveryTag);
+  }
+}
+
+void AmqpManager::onPresenceReceived(const AMQP::Message &message) {
+  try {
+    AMQP::Table headers = message.headers();
+    const std::string brokerID(headers[AMQP_HEADER_PRESENCE_BROKERID]);
+    const std::string event(headers[AMQP_HEADER_PRESENCE_EVENT]);
+    std::vector<std::string> deviceIDs;
+    const char *body = message.body();
+    const char *const bodyEnd = body + message.bodySize();
+    while (body < bodyEnd) {
+      const char *lineEnd = std::find(body, bodyEnd, '\n');
+      deviceIDs.emplace_back(body, lineEnd);
+      body = lineEnd + 1;
+    }
+    const std::chrono::steady_clock::time_point now =
+        std::chrono::steady_clock::now();
+    if (event == AMQP_PRESENCE_EVENT_ONLINE) {
+      this->presenceDirectory.setOnline(brokerID, deviceIDs, now);
+    } else if (event == AMQP_PRESENCE_EVENT_OFFLINE) {
+      this->presenceDirectory.setOffline(brokerID, deviceIDs);
+    } else if (event == AMQP_PRESENCE_EVENT_HEARTBEAT) {
+      this->presenceDirectory.onHeartbeat(brokerID, deviceIDs, now);
+    }
+  } catch (const std::exception &e) {
+    LOG(ERROR) << "AMQP: Presence parsing exception: " << e.what();
   }
 }
 
+std::optional<std::string>
+AmqpManager::findDeviceBroker(const std::string &deviceID) {
+  return this->presenceDirectory.findBroker(
+      deviceID, std::chrono::steady_clock::now());
+}
+
+bool AmqpManager::isPresenceDirectoryComplete() {
+  return this->presenceDirectory.isComplete(std::chrono::steady_clock::now());
+}
+
+const metrics::Histogram &AmqpManager::getPublishConfirmations() const {
+  return getAmqpMetrics().publishConfirmation;
+}
+
+bool AmqpManager::stopConsuming(
+    std::chrono::steady_clock::time_point deadline) {
+  this->draining = true;
+  std::shared_ptr<std::promise<bool>> cancelled =
+      std::make_shared<std::promise<bool>>();
+  std::future<bool> result = cancelled->get_future();
+  {
+    std::scoped_lock lock{this->channelMutex};
+    if (!this->amqpReady) {
+      // Nothing is received without a connection
+      cancelled->set_value(true);
+    } else {
+      std::shared_ptr<std::atomic<bool>> settled =
+          std::make_shared<std::atomic<bool>>(false);
+      this->amqpChannel->cancel(this->queueName)
+          .onSuccess([cancelled, settled](const std::string &consumerTag) {
+            if (!settled->exchange(true)) {
+              cancelled->set_value(true);
+            }
+          })
+          .onError([cancelled, settled](const char *message) {
+            LOG(ERROR) << "AMQP: Failed to cancel the consumer: " << message;
+            if (!settled->exchange(true)) {
+              cancelled->set_value(false);
+            }
+          });
+    }
+  }
+  // Messages may still arrive until the broker has confirmed the cancel
+  if (result.wait_until(deadline) != std::future_status::ready ||
+      !result.get()) {
+    return false;
+  }
+  return this->consumerShards == nullptr ||
+      this->consumerShards->waitUntilIdle(deadline);
+}
+
+bool AmqpManager::closeConsumeChannel(
+    std::chrono::steady_clock::time_point deadline) {
+  this->flushAcks(true);
+  std::shared_ptr<std::promise<bool>> closed =
+      std::make_shared<std::promise<bool>>();
+  std::future<bool> result = closed->get_future();
+  {
+    std::scoped_lock lock{this->channelMutex};
+    if (!this->amqpReady) {
+      return false;
+    }
+    // Acks that come later would be sent on a closed channel
+    this->amqpReady = false;
+    std::shared_ptr<std::atomic<bool>> settled =
+        std::make_shared<std::atomic<bool>>(false);
+    // The broker handles the frames of a channel in order, so the close is
+    // confirmed after the acks that were sent before it
+    this->amqpChannel->close()
+        .onSuccess([closed, settled]() {
+          if (!settled->exchange(true)) {
+            closed->set_value(true);
+          }
+        })
+        .onError([closed, settled](const char *message) {
+          LOG(ERROR) << "AMQP: Failed to close the consume channel: "
+                     << message;
+          if (!settled->exchange(true)) {
+            closed->set_value(false);
+          }
+        });
+  }
+  this->notifyReadinessChanged();
+  return result.wait_until(deadline) == std::future_status::ready &&
+      result.get();
+}
+
+bool AmqpManager::waitUntilReady(
+    std::chrono::steady_clock::time_point deadline) {
+  std::unique_lock<std::mutex> lock{this->readinessMutex};
+  return this->readinessCondition.wait_until(
+      lock, deadline, [this]() { return this->amqpReady.load(); });
+}
+
 } // namespace network
 } // namespace comm
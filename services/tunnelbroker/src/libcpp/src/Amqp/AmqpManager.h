@@ -1,35 +1,243 @@
 #pragma once
 
+#include "AmqpAckCoalescer.h"
+#include "AmqpConsumerShards.h"
+#include "AmqpEnvelope.h"
+#include "AmqpPresenceDirectory.h"
 #include "DatabaseManager.h"
+#include "Metrics.h"
+#include "Tracing.h"
 
 #include <amqpcpp.h>
 #include <amqpcpp/libuv.h>
+#include <amqpcpp/reliable.h>
+#include <uv.h>
 
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace comm {
 namespace network {
 
+// Collects the publisher confirms of a batch of messages. The future becomes
+// true once the broker has confirmed all of them, or false as soon as all of
+// them are settled and any was rejected or lost.
+class AmqpBatchConfirmation {
+  std::atomic<size_t> pendingCount;
+  std::atomic<bool> failed{false};
+  std::promise<bool> promise;
+
+public:
+  explicit AmqpBatchConfirmation(size_t count);
+  std::future<bool> getFuture();
+  // Has to be called exactly once per message
+  void confirm(bool confirmed);
+};
+
+// A channel for publishing that doesn't share its connection with the other
+// channels, so that publishers on different channels don't wait for each
+// other. The channel is in the confirm mode, every publish has to go through
+// reliable so that the delivery tags of the confirms match. Apart from
+// ready, it is only used on the loop thread, which handles the confirms.
+struct AmqpPublishChannel {
+  std::unique_ptr<AMQP::TcpConnection> connection;
+  std::unique_ptr<AMQP::TcpChannel> channel;
+  std::unique_ptr<AMQP::Reliable<>> reliable;
+  std::atomic<bool> ready{false};
+  // Set once the channel or its connection fails, it is then opened again
+  bool failed = false;
+};
+
+// A message waiting for a publish channel to be ready
+struct AmqpOutgoingMessage {
+  database::MessageItem message;
+  std::shared_ptr<AmqpBatchConfirmation> confirmation;
+  tracing::TraceContext traceContext;
+};
+
+// A message, or an envelope of messages to the same device, that is encoded
+// on the thread of the sender and published on the loop thread
+struct AmqpPendingPublish {
+  std::string routingKey;
+  std::string body;
+  // Empty for a message with headers
+  std::string contentType;
+  AMQP::Table headers;
+  size_t count;
+  std::string description;
+  std::shared_ptr<AmqpBatchConfirmation> confirmation;
+  std::chrono::steady_clock::time_point preparedAt;
+};
+
+// A message from the consume channel, which is read on a consumer shard
+struct AmqpIncomingMessage {
+  std::string body;
+  bool envelope;
+  // Only kept for the messages that aren't envelopes
+  AMQP::Table headers;
+  uint64_t deliveryTag;
+  bool redelivered;
+};
+
 class AmqpManager {
   AmqpManager(){};
 
+  // Guards the consume channel
   std::mutex channelMutex;
+  // Work handed to the loop thread, which owns the publish channels. The
+  // handle is only set while the loop runs.
+  std::mutex loopTasksMutex;
+  std::vector<std::function<void()>> loopTasks;
+  uv_async_t *loopTasksAsync = nullptr;
   std::once_flag initOnceFlag;
   std::unique_ptr<AMQP::TcpChannel> amqpChannel;
+  AmqpAckCoalescer ackCoalescer;
+  // Deliveries of envelopes with more than one message, with the number of
+  // their messages that haven't been acknowledged yet. A delivery is only
+  // acknowledged once all of its messages are.
+  std::mutex packedDeliveriesMutex;
+  std::unordered_map<uint64_t, size_t> packedDeliveries;
+  // Created on the first connection and kept for the next ones
+  std::unique_ptr<AmqpConsumerShards> consumerShards;
+  // Guards the list, the channels themselves are used on the loop
+  std::mutex publishChannelsMutex;
+  std::vector<std::shared_ptr<AmqpPublishChannel>> publishChannels;
+  std::atomic<size_t> nextPublishChannel{0};
   std::atomic<bool> amqpReady;
+  // Set once the instance drains, a new connection doesn't consume then
+  std::atomic<bool> draining{false};
+  // Notified whenever the consume channel or a publish channel gets ready
+  std::mutex readinessMutex;
+  std::condition_variable readinessCondition;
+  // Guards the buffer and the publish channels getting ready, so that no
+  // message is buffered after the buffer has been flushed
+  std::mutex outgoingMutex;
+  std::vector<AmqpOutgoingMessage> outgoingMessages;
+  std::string queueName;
+  std::string directExchangeName;
+  // Number of streams of every device that is connected to this instance,
+  // guards the bindings of the devices too
+  std::mutex deviceStreamsMutex;
+  std::unordered_map<std::string, size_t> deviceStreams;
   std::atomic<std::size_t> reconnectAttempt;
+  AmqpPresenceDirectory presenceDirectory{
+      std::chrono::milliseconds(AMQP_PRESENCE_TTL_MS)};
   void connectInternal();
   void connect();
-  void waitUntilReady();
+  void notifyReadinessChanged();
+  // Has to be called with the deviceStreamsMutex and channelMutex locked, so
+  // that the announcements go out in the order of the streams
+  void publishPresence(
+      const std::string &event,
+      const std::vector<std::string> &deviceIDs);
+  void sendPresenceHeartbeat();
+  void onPresenceReceived(const AMQP::Message &message);
+  // Runs on the loop, only copies the message and hands it to the shard of
+  // its recipient
+  void onMessageReceived(
+      const AMQP::Message &message,
+      uint64_t deliveryTag,
+      bool redelivered);
+  void handleIncomingMessage(AmqpIncomingMessage &incoming);
+  void pushReceivedMessage(
+      AmqpEnvelopeMessage &message,
+      uint64_t deliveryTag,
+      bool redelivered);
+  // Acks past a message that is still being delivered are only sent with
+  // outOfOrder, which the flush timer of the loop sets
+  void flushAcks(bool outOfOrder);
+  // Runs on the loop, replaces the connection of the channel if it has one
+  void openPublishChannel(
+      AmqpPublishChannel &publishChannel,
+      AMQP::LibUvHandler &uvHandler,
+      const std::string &amqpUri);
+  // Runs on the loop, reopens the publish channels that failed, so that a
+  // broken connection doesn't take its channel out of the rotation for good
+  void reopenFailedPublishChannels(
+      AMQP::LibUvHandler &uvHandler,
+      const std::string &amqpUri);
+  // Picks the ready publish channels in turns, returns nullptr if none is
+  // ready
+  std::shared_ptr<AmqpPublishChannel> findPublishChannel();
+  // Like findPublishChannel, but waits until a channel is ready, for at most
+  // AMQP_PUBLISH_CHANNEL_WAIT_MS. Throws if none is by then.
+  std::shared_ptr<AmqpPublishChannel> getPublishChannel();
+  // Returns false if a publish channel is ready, or if the buffer has no
+  // room for the messages
+  bool bufferIfNotReady(
+      const std::vector<database::MessageItem> &messages,
+      std::shared_ptr<AmqpBatchConfirmation> confirmation,
+      const tracing::TraceContext &traceContext);
+  // Marks the channel as ready and publishes the buffered messages on it,
+  // before any message that is sent after. Runs on the loop.
+  void onPublishChannelReady(AmqpPublishChannel &publishChannel);
+  // Returns false if the loop isn't running, the task is dropped then
+  bool runOnLoop(std::function<void()> task);
+  void runLoopTasks();
+  // A valid traceContext is passed on with the messages. The messages, which
+  // have to be to the same device, are encoded in one envelope, or with
+  // headers if the envelopes are turned off and it is a single message.
+  std::shared_ptr<AmqpPendingPublish> preparePublish(
+      const std::vector<const database::MessageItem *> &messages,
+      std::shared_ptr<AmqpBatchConfirmation> confirmation,
+      const tracing::TraceContext &traceContext);
+  // Runs on the loop
+  void publish(
+      AmqpPublishChannel &publishChannel,
+      const std::string &exchange,
+      std::shared_ptr<AmqpPendingPublish> pending);
 
 public:
   static AmqpManager &getInstance();
+  // Connects on a thread of its own and returns at once
   void init();
+  // Returns false if the connection isn't ready by the deadline
+  bool waitUntilReady(std::chrono::steady_clock::time_point deadline);
   bool send(const database::MessageItem *message);
+  // Hands all the messages to the loop to be published on one channel and
+  // doesn't wait for the broker, the returned future tells whether it has
+  // confirmed them. The messages to the same device are packed into envelopes, see
+  // packAmqpEnvelopes. While no channel is ready the messages are buffered
+  // and published one by one, see AMQP_OUTGOING_BUFFER_CAPACITY.
+  std::future<bool> sendBatch(
+      const std::vector<database::MessageItem> &messages,
+      const tracing::TraceContext &traceContext = tracing::TraceContext());
+  // The ack is sent with the ones that come after it, at the latest after
+  // AMQP_ACK_FLUSH_INTERVAL_MS. It is dropped while the connection is down,
+  // the broker redelivers the message on the next one anyway. The delivery of
+  // an envelope is acknowledged once every message in it has been.
   void ack(uint64_t deliveryTag);
+  // The queue of this instance is bound with the deviceID while the device
+  // has a stream to it, so the messages for the device are routed here. The
+  // returned future becomes true once the binding is active, or false if
+  // the connection isn't ready within AMQP_BIND_TIMEOUT_MS.
+  std::future<bool> addDeviceStream(const std::string &deviceID);
+  void removeDeviceStream(const std::string &deviceID);
+  // The instance that holds the stream of the device, from the announcements
+  // of the instances. Nothing if the device is offline, which is only
+  // certain once the directory is complete.
+  std::optional<std::string> findDeviceBroker(const std::string &deviceID);
+  bool isPresenceDirectoryComplete();
+  // The time from publishing messages to the broker settling them
+  const metrics::Histogram &getPublishConfirmations() const;
+  // Drains the instance once its streams have ended. Cancels the consumer of
+  // the queue of this instance and waits for the messages that it has
+  // received to be pushed to DeliveryBroker. The ones that no stream takes
+  // aren't acknowledged, the devices get them from the database. Returns
+  // false if that isn't done by the deadline.
+  bool stopConsuming(std::chrono::steady_clock::time_point deadline);
+  // Sends the pending acks and closes the consume channel, returns true once
+  // the broker has confirmed it, and with that the acks
+  bool closeConsumeChannel(std::chrono::steady_clock::time_point deadline);
 
   AmqpManager(AmqpManager const &) = delete;
   void operator=(AmqpManager const &) = delete;
@@ -0,0 +1,80 @@
+#include "AmqpPresenceDirectory.h"
+
+#include <unordered_set>
+
+namespace comm {
+namespace network {
+
+AmqpPresenceDirectory::AmqpPresenceDirectory(std::chrono::milliseconds ttl)
+    : ttl(ttl), completeAt(std::chrono::steady_clock::now() + ttl) {
+}
+
+void AmqpPresenceDirectory::setOnline(
+    const std::string &brokerID,
+    const std::vector<std::string> &deviceIDs,
+    std::chrono::steady_clock::time_point now) {
+  const std::lock_guard<std::mutex> lock(this->directoryMutex);
+  for (const std::string &deviceID : deviceIDs) {
+    this->devices[deviceID] = Entry{brokerID, now + this->ttl};
+  }
+}
+
+void AmqpPresenceDirectory::setOffline(
+    const std::string &brokerID,
+    const std::vector<std::string> &deviceIDs) {
+  const std::lock_guard<std::mutex> lock(this->directoryMutex);
+  for (const std::string &deviceID : deviceIDs) {
+    const auto found = this->devices.find(deviceID);
+    if (found != this->devices.end() && found->second.brokerID == brokerID) {
+      this->devices.erase(found);
+    }
+  }
+}
+
+void AmqpPresenceDirectory::onHeartbeat(
+    const std::string &brokerID,
+    const std::vector<std::string> &deviceIDs,
+    std::chrono::steady_clock::time_point now) {
+  const std::unordered_set<std::string> listed(
+      deviceIDs.begin(), deviceIDs.end());
+  const std::lock_guard<std::mutex> lock(this->directoryMutex);
+  // Every heartbeat goes over the whole directory, which also drops the
+  // devices of the instances that went away
+  for (auto it = this->devices.begin(); it != this->devices.end();) {
+    if (it->second.expiresAt <= now ||
+        (it->second.brokerID == brokerID && !listed.count(it->first))) {
+      it = this->devices.erase(it);
+    } else {
+      it++;
+    }
+  }
+  for (const std::string &deviceID : deviceIDs) {
+    this->devices[deviceID] = Entry{brokerID, now + this->ttl};
+  }
+}
+
+void AmqpPresenceDirectory::reset(std::chrono::steady_clock::time_point now) {
+  const std::lock_guard<std::mutex> lock(this->directoryMutex);
+  this->devices.clear();
+  this->completeAt = now + this->ttl;
+}
+
+bool AmqpPresenceDirectory::isComplete(
+    std::chrono::steady_clock::time_point now) {
+  const std::lock_guard<std::mutex> lock(this->directoryMutex);
+  return now >= this->completeAt;
+}
+
+std::optional<std::string> AmqpPresenceDirectory::findBroker(
+    const std::string &deviceID,
+    std::chrono::steady_clock::time_point now) {
+  const std::lock_guard<std::mutex> lock(this->directoryMutex);
+  const auto found = this->devices.find(deviceID);
+  if (found == this->devices.end() || found->second.expiresAt <= now) {
+    return std::nullopt;
+  }
+  return found->second.brokerID;
+}
+
+} // namespace network
+} // namespace comm
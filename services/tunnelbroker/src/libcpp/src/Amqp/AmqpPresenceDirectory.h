@@ -0,0 +1,60 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace comm {
+namespace network {
+
+// Which instance holds the stream of every online device, as the instances
+// tell each other over AMQP. An instance announces the devices whose first
+// stream starts and whose last stream ends, and sends the full list of its
+// devices in a heartbeat. A device that no heartbeat mentions within the ttl
+// is taken as offline, which covers the announcements that got lost and the
+// instances that went away.
+class AmqpPresenceDirectory {
+  struct Entry {
+    std::string brokerID;
+    std::chrono::steady_clock::time_point expiresAt;
+  };
+
+  const std::chrono::milliseconds ttl;
+  std::mutex directoryMutex;
+  std::unordered_map<std::string, Entry> devices;
+  // The directory may miss devices until the heartbeats of all instances
+  // have come in once
+  std::chrono::steady_clock::time_point completeAt;
+
+public:
+  explicit AmqpPresenceDirectory(std::chrono::milliseconds ttl);
+
+  void setOnline(
+      const std::string &brokerID,
+      const std::vector<std::string> &deviceIDs,
+      std::chrono::steady_clock::time_point now);
+  // Devices that have moved to another instance meanwhile stay there
+  void setOffline(
+      const std::string &brokerID,
+      const std::vector<std::string> &deviceIDs);
+  // The devices of the broker that aren't listed are dropped
+  void onHeartbeat(
+      const std::string &brokerID,
+      const std::vector<std::string> &deviceIDs,
+      std::chrono::steady_clock::time_point now);
+  // Should be called when the announcements start coming in, e.g. on a new
+  // connection
+  void reset(std::chrono::steady_clock::time_point now);
+  bool isComplete(std::chrono::steady_clock::time_point now);
+  // Returns the instance that holds the stream of the device, or nothing if
+  // the device is offline
+  std::optional<std::string> findBroker(
+      const std::string &deviceID,
+      std::chrono::steady_clock::time_point now);
+};
+
+} // namespace network
+} // namespace comm
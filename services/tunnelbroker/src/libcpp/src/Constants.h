@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <cstdlib>
 #include <regex>
 #include <string>
@@ -7,16 +8,56 @@
 namespace comm {
 namespace network {
 
+// How long startup waits for the tables and the AMQP connection
+const size_t STARTUP_TIMEOUT_MS = 30 * 1000;
+
 // AWS DynamoDB
 const size_t DYNAMODB_MAX_BATCH_ITEMS = 25;
+const size_t DYNAMODB_MAX_BATCH_GET_ITEMS = 100;
 const size_t DYNAMODB_BACKOFF_FIRST_RETRY_DELAY = 50;
 const size_t DYNAMODB_MAX_BACKOFF_TIME = 10000; // 10 seconds
+const size_t DYNAMODB_MAX_PARALLEL_BATCH_CHUNKS = 4;
 
 const std::string DEVICE_SESSIONS_TABLE_NAME = "tunnelbroker-device-sessions";
 const std::string DEVICE_SESSIONS_VERIFICATION_MESSAGES_TABLE_NAME =
     "tunnelbroker-verification-messages";
 const std::string DEVICE_PUBLIC_KEY_TABLE_NAME = "tunnelbroker-public-keys";
 const std::string MESSAGES_TABLE_NAME = "tunnelbroker-messages";
+// Index of the messages table by receiver and creation time, which has to
+// be kept in sync with services/terraform
+const std::string MESSAGES_TABLE_CREATED_AT_INDEX_NAME =
+    "ToDeviceID-CreatedAt-index";
+const size_t MESSAGES_PAGE_SIZE = 100;
+// Messages that stay undelivered for longer than MESSAGES_HOT_TIER_AGE_MS are
+// moved to the cold table, which is only read when a device connects, so that
+// the partitions of the messages table stay small. It has the same keys and
+// index as the messages table.
+const std::string MESSAGES_COLD_TABLE_NAME = "tunnelbroker-messages-cold";
+const size_t MESSAGES_HOT_TIER_AGE_MS = 7 * 24 * 60 * 60 * 1000; // 7 days
+const size_t MESSAGES_ARCHIVE_INTERVAL_MS = 60 * 60 * 1000;       // 1 hour
+// Only the instance that holds the lease runs an archive pass, the lease is
+// an item of the cold table under a key that isn't a valid deviceID
+const std::string MESSAGES_ARCHIVE_LEASE_KEY = "archive-lease";
+// Acknowledged messages are removed in the background, see MessageRemover.
+// The acks wait for the removals once MESSAGES_REMOVAL_CAPACITY of them are
+// pending.
+const size_t MESSAGES_REMOVAL_FLUSH_INTERVAL_MS = 200;
+const size_t MESSAGES_REMOVAL_MAX_ATTEMPTS = 5;
+const size_t MESSAGES_REMOVAL_CAPACITY = 100 * 1000;
+
+// Caches of rarely changing items in DatabaseManager
+const size_t SESSION_ITEMS_CACHE_SIZE = 10000;
+const size_t SESSION_ITEMS_CACHE_TTL_MS = 60 * 1000; // 1 minute
+const size_t PUBLIC_KEY_ITEMS_CACHE_SIZE = 10000;
+const size_t PUBLIC_KEY_ITEMS_CACHE_TTL_MS = 10 * 60 * 1000; // 10 minutes
+// Nonces of the session signatures, kept for all of SESSION_SIGN_RECORD_TTL
+const size_t SESSION_SIGN_ITEMS_CACHE_SIZE = 10000;
+
+// Online states of the sessions are written at most this often, see
+// PresenceTracker
+const size_t PRESENCE_FLUSH_INTERVAL_MS = 1000;
+const size_t PRESENCE_STORED_STATES_SIZE = 10000;
+const size_t PRESENCE_STORED_STATES_TTL_MS = 60 * 1000; // 1 minute
 
 // Sessions
 const size_t SIGNATURE_REQUEST_LENGTH = 64;
@@ -28,6 +69,9 @@ const std::regex SESSION_ID_FORMAT_REGEX(
 
 // AMQP (RabbitMQ)
 const std::string AMQP_FANOUT_EXCHANGE_NAME = "allBrokers";
+// Messages are routed by their recipient deviceID, every instance binds its
+// queue with the IDs of the devices that have a stream to it
+const std::string AMQP_DIRECT_EXCHANGE_NAME = "deviceBrokers";
 // Message broker queue message TTL
 const size_t AMQP_MESSAGE_TTL = 300 * 1000; // 5 min
 // queue TTL in case of no consumers (tunnelbroker is down)
@@ -36,9 +80,62 @@ const size_t AMQP_QUEUE_TTL = 24 * 3600 * 1000; // 24 hours
 const std::string AMQP_HEADER_FROM_DEVICEID = "fromDeviceID";
 const std::string AMQP_HEADER_TO_DEVICEID = "toDeviceID";
 const std::string AMQP_HEADER_MESSAGEID = "messageID";
+// W3C trace context of the publish, only set on the sampled messages
+const std::string AMQP_HEADER_TRACEPARENT = "traceparent";
+// Set to AMQP_PRIORITY_BULK on the bulk messages only
+const std::string AMQP_HEADER_PRIORITY = "priority";
+const std::string AMQP_PRIORITY_BULK = "bulk";
+// Only set on the messages whose payload is in the blob service
+const std::string AMQP_HEADER_BLOB_HASHES = "blobHashes";
+// Messages are published in a binary body of this content type instead of
+// the headers above, see AmqpEnvelopeWriter. The messages of a batch to the
+// same device are packed into one body, up to the amqp.envelope_messages_max
+// option and until their payloads reach AMQP_ENVELOPE_PAYLOAD_SIZE_MAX.
+const std::string AMQP_ENVELOPE_CONTENT_TYPE =
+    "application/vnd.comm.tunnelbroker-envelope";
+const uint8_t AMQP_ENVELOPE_VERSION = 1;
+const size_t AMQP_ENVELOPE_MESSAGES_MAX = 64;
+const size_t AMQP_ENVELOPE_PAYLOAD_SIZE_MAX = 128 * 1024;
+// Instances tell each other which devices have a stream to them, see
+// AmqpPresenceDirectory. The body lists the deviceIDs, one per line.
+const std::string AMQP_PRESENCE_EXCHANGE_NAME = "brokerPresence";
+const std::string AMQP_HEADER_PRESENCE_BROKERID = "brokerID";
+const std::string AMQP_HEADER_PRESENCE_EVENT = "presenceEvent";
+const std::string AMQP_PRESENCE_EVENT_ONLINE = "online";
+const std::string AMQP_PRESENCE_EVENT_OFFLINE = "offline";
+const std::string AMQP_PRESENCE_EVENT_HEARTBEAT = "heartbeat";
+const size_t AMQP_PRESENCE_HEARTBEAT_INTERVAL_MS = 10 * 1000;
+// A device is taken as offline once no heartbeat has mentioned it for this
+// long
+const size_t AMQP_PRESENCE_TTL_MS = 3 * AMQP_PRESENCE_HEARTBEAT_INTERVAL_MS;
 
 const size_t AMQP_RECONNECT_ATTEMPT_INTERVAL_MS = 3000;
 const size_t AMQP_RECONNECT_MAX_ATTEMPTS = 10;
+const size_t AMQP_PUBLISH_CHANNELS = 4;
+const size_t AMQP_PREFETCH_COUNT = 0;
+// Threads that the received messages are handed to, see AmqpConsumerShards
+const size_t AMQP_CONSUMER_SHARDS = 4;
+// Acknowledgements are sent at least this often, or once this many of them
+// have been collected
+const size_t AMQP_ACK_FLUSH_INTERVAL_MS = 50;
+const size_t AMQP_ACK_FLUSH_COUNT = 64;
+// Acknowledgements past a message that hasn't been acknowledged yet are
+// remembered up to this number, to be covered by a single one later
+const size_t AMQP_ACK_MAX_TRACKED = 10000;
+// How long a new stream waits for the binding of its device
+const size_t AMQP_BIND_TIMEOUT_MS = 5000;
+// How long sendMessages waits for the broker to confirm a batch of messages
+const size_t AMQP_PUBLISH_CONFIRM_TIMEOUT_MS = 10 * 1000;
+// Messages sent while no publish channel is ready are kept up to this number
+// and published once one is, the senders past it wait for the channel
+const size_t AMQP_OUTGOING_BUFFER_CAPACITY = 10000;
+// How long those senders wait for a publish channel before they fail
+const size_t AMQP_PUBLISH_CHANNEL_WAIT_MS = 5000;
+// How long a drain waits for the messages that were received before the
+// consumer was cancelled to reach DeliveryBroker, and for the broker to
+// confirm that the consume channel is closed after the last acks
+const size_t AMQP_DRAIN_CONSUMER_TIMEOUT_MS = 5000;
+const size_t AMQP_DRAIN_CLOSE_TIMEOUT_MS = 5000;
 
 // DeviceID
 // DEVICEID_CHAR_LENGTH has to be kept in sync with deviceIDCharLength
@@ -55,6 +152,12 @@ const std::regex DEVICEID_FORMAT_REGEX(
     "}$");
 const size_t DEVICE_ONLINE_PING_INTERVAL_MS = 3000;
 
+// DynamoDB client
+const size_t DYNAMODB_MAX_CONNECTIONS = 64;
+const size_t DYNAMODB_CONNECT_TIMEOUT_MS = 1000;
+const size_t DYNAMODB_REQUEST_TIMEOUT_MS = 3000;
+const size_t DYNAMODB_TCP_KEEPALIVE_INTERVAL_MS = 30 * 1000;
+
 // Config
 const std::string CONFIG_FILE_DIRECTORY_ENV_VARIABLE =
     "TUNNELBROKER_CONFIG_FILE_DIRECTORY";
@@ -64,6 +167,88 @@ const std::string CONFIG_FILE_NAME = "tunnelbroker.ini";
 
 // DeliveryBroker
 const size_t DELIVERY_BROKER_MAX_QUEUE_SIZE = 100;
+// Messages that don't fit in the queue of a device with a live consumer wait
+// in its overflow, the ones that don't fit there either are only delivered
+// from the database
+const size_t DELIVERY_BROKER_MAX_OVERFLOW_SIZE = 1000;
+// A consumer that hasn't waited for messages for this long isn't live
+const size_t DELIVERY_BROKER_CONSUMER_LIVENESS_MS = 30 * 1000;
+// Messages that a device queue keeps without allocating, the ones past them
+// take nodes from the slabs that are shared by all the queues
+const size_t DELIVERY_BROKER_INLINE_QUEUE_SIZE = 4;
+const size_t DELIVERY_BROKER_SLAB_SIZE = 64;
+// Empty queues without a consumer are evicted after this time, the check runs
+// at most once per interval
+const size_t DELIVERY_BROKER_IDLE_QUEUE_TTL_MS = 5 * 60 * 1000;
+const size_t DELIVERY_BROKER_EVICTION_INTERVAL_MS = 60 * 1000;
+// While both kinds are waiting, this many interactive messages are taken from
+// a device queue for every bulk one, so that the bulk ones still move
+const size_t DELIVERY_BROKER_INTERACTIVE_WEIGHT = 4;
+// IDs of the messages delivered to a device from the database are kept for
+// skipping their copies from AMQP, which only come in right after the device
+// connects. With larger backlogs the oldest IDs are forgotten and the client
+// skips the copies.
+const size_t DELIVERY_BROKER_DELIVERED_IDS_SIZE = 10000;
+const size_t DELIVERY_BROKER_DELIVERED_IDS_TTL_MS = 2 * 60 * 1000;
+// gRPC server, the defaults of the grpc.* config options
+// Streams a single connection may open, 0 for no limit
+const size_t GRPC_MAX_CONCURRENT_STREAMS = 0;
+const size_t GRPC_KEEP_ALIVE_PING_INTERVAL_MS = 3000;
+const size_t GRPC_KEEP_ALIVE_PING_TIMEOUT_MS = 10000;
+
+// Blob service, the defaults of the blob.* config options
+const std::string BLOB_SERVICE_URL = "http://localhost:50053";
+// Payloads larger than this are put in the blob service and only their hash
+// is sent along, 0 disables it
+const size_t BLOB_PAYLOAD_OFFLOAD_THRESHOLD = 64 * 1024;
+
+// Metrics
+// Port of the scrape endpoint, 0 disables it
+const size_t TUNNELBROKER_METRICS_PORT = 0;
+// Whether the endpoint also serves CPU and heap profiles on the paths of
+// pprof, 0 disables it
+const size_t TUNNELBROKER_METRICS_PROFILING = 0;
+
+// Tracing
+// Share of the sendMessages calls that are traced, 0 disables the tracing
+const double TRACING_SAMPLE_RATIO = 0;
+// OTLP/HTTP receiver of an OpenTelemetry collector
+const std::string TRACING_COLLECTOR_HOST = "127.0.0.1";
+const size_t TRACING_COLLECTOR_PORT = 4318;
+
+// Traffic capture, the defaults of the capture.* config options
+const std::string CAPTURE_PATH = "/tmp/tunnelbroker-traffic.tsv";
+// 0 disables the capture
+const size_t CAPTURE_DURATION_SECONDS = 0;
+const size_t CAPTURE_MAX_EVENTS = 10 * 1000 * 1000;
+// How often the recorded events are written to the file
+const size_t CAPTURE_FLUSH_INTERVAL_MS = 1000;
+
+// Admission control (see AdmissionController.h)
+// Whether the low priority work is shed under overload, 0 admits everything
+const size_t TUNNELBROKER_ADMISSION_ENABLED = 1;
+// The load signals are read by the first request after this interval
+const size_t ADMISSION_EVALUATION_INTERVAL_MS = 500;
+// An overload level is only left after the signals have stayed under it for
+// this long
+const size_t ADMISSION_RECOVERY_MS = 5000;
+// Messages waiting in the DeliveryBroker queues
+const size_t ADMISSION_QUEUED_MESSAGES_ELEVATED = 100 * 1000;
+const size_t ADMISSION_QUEUED_MESSAGES_CRITICAL = 500 * 1000;
+// sendMessages calls that are waiting for the database or the broker
+const size_t ADMISSION_SENDS_IN_PROGRESS_ELEVATED = 256;
+const size_t ADMISSION_SENDS_IN_PROGRESS_CRITICAL = 1024;
+// Operations that take longer are slow, the limits are one less than powers
+// of two, which the histograms count exactly
+const size_t ADMISSION_SLOW_DATABASE_WRITE_US = (1 << 18) - 1;
+const size_t ADMISSION_SLOW_PUBLISH_CONFIRM_US = (1 << 18) - 1;
+const size_t ADMISSION_SLOW_RATE_LIMIT_WAIT_US = (1 << 16) - 1;
+// Shares of the operations of an evaluation interval that were slow, an
+// interval with fewer operations doesn't count
+const double ADMISSION_SLOW_SHARE_ELEVATED = 0.1;
+const double ADMISSION_SLOW_SHARE_CRITICAL = 0.5;
+const size_t ADMISSION_MIN_INTERVAL_OPERATIONS = 20;
+
 // Database messages TTL
 const size_t MESSAGE_RECORD_TTL = 300 * 24 * 60 * 60; // 300 days
 
@@ -1,9 +1,12 @@
 #include "DatabaseManager.h"
+#include "ConfigManager.h"
 #include "DynamoDBTools.h"
 #include "GlobalTools.h"
 
 #include <glog/logging.h>
 
+#include <algorithm>
+
 namespace comm {
 namespace network {
 namespace database {
@@ -23,7 +26,26 @@ bool DatabaseManager::isTableAvailable(const std::string &tableName) {
   return result.IsSuccess();
 }
 
-void DatabaseManager::putSessionItem(const DeviceSessionItem &item) {
+std::future<bool>
+DatabaseManager::isTableAvailableAsync(const std::string &tableName) {
+  Aws::DynamoDB::Model::DescribeTableRequest request;
+  request.SetTableName(tableName);
+  std::shared_ptr<std::promise<bool>> available =
+      std::make_shared<std::promise<bool>>();
+  std::future<bool> result = available->get_future();
+  getDynamoDBClient()->DescribeTableAsync(
+      request,
+      [available](
+          const Aws::DynamoDB::DynamoDBClient *client,
+          const Aws::DynamoDB::Model::DescribeTableRequest &request,
+          const Aws::DynamoDB::Model::DescribeTableOutcome &outcome,
+          const std::shared_ptr<const Aws::Client::AsyncCallerContext>
+              &context) { available->set_value(outcome.IsSuccess()); });
+  return result;
+}
+
+Aws::DynamoDB::Model::PutItemRequest
+DatabaseManager::createPutSessionItemRequest(const DeviceSessionItem &item) {
   Aws::DynamoDB::Model::PutItemRequest request;
   request.SetTableName(item.getTableName());
   request.AddItem(
@@ -55,37 +77,93 @@ void DatabaseManager::putSessionItem(const DeviceSessionItem &item) {
   request.AddItem(
       DeviceSessionItem::FIELD_IS_ONLINE,
       Aws::DynamoDB::Model::AttributeValue().SetBool(false));
-  this->innerPutItem(std::make_shared<DeviceSessionItem>(item), request);
+  return request;
+}
+
+// The cached copies are dropped once the writes are over, so that a find
+// running in the meantime can't cache the item from before the write
+void DatabaseManager::putSessionItem(const DeviceSessionItem &item) {
+  this->innerPutItem(
+      std::make_shared<DeviceSessionItem>(item),
+      this->createPutSessionItemRequest(item));
+  this->sessionItemsCache.invalidate(item.getSessionID());
+}
+
+void DatabaseManager::putSessionItemAsync(
+    const DeviceSessionItem &item,
+    Callback callback) {
+  const std::string sessionID = item.getSessionID();
+  this->innerPutItemAsync(
+      this->createPutSessionItemRequest(item),
+      [this, sessionID, callback](std::unique_ptr<std::string> error) {
+        if (error == nullptr) {
+          this->sessionItemsCache.invalidate(sessionID);
+        }
+        callback(std::move(error));
+      });
 }
 
 std::shared_ptr<DeviceSessionItem>
 DatabaseManager::findSessionItem(const std::string &sessionID) {
+  std::shared_ptr<DeviceSessionItem> item =
+      this->sessionItemsCache.get(sessionID);
+  if (item != nullptr) {
+    return item;
+  }
   Aws::DynamoDB::Model::GetItemRequest request;
   request.AddKey(
       DeviceSessionItem::FIELD_SESSION_ID,
       Aws::DynamoDB::Model::AttributeValue(sessionID));
-  return this->innerFindItem<DeviceSessionItem>(request);
+  item = this->innerFindItem<DeviceSessionItem>(request, true);
+  if (item != nullptr) {
+    this->sessionItemsCache.put(sessionID, *item);
+  }
+  return item;
 }
 
-void DatabaseManager::removeSessionItem(const std::string &sessionID) {
-  std::shared_ptr<DeviceSessionItem> item = this->findSessionItem(sessionID);
-  if (item == nullptr) {
-    return;
+std::vector<std::shared_ptr<DeviceSessionItem>>
+DatabaseManager::findSessionItems(const std::vector<std::string> &sessionIDs) {
+  std::vector<std::shared_ptr<DeviceSessionItem>> items;
+  std::vector<AttributeValues> keys;
+  for (const std::string &sessionID : sessionIDs) {
+    std::shared_ptr<DeviceSessionItem> item =
+        this->sessionItemsCache.get(sessionID);
+    if (item != nullptr) {
+      items.push_back(item);
+      continue;
+    }
+    AttributeValues key;
+    key.emplace(DeviceSessionItem::FIELD_SESSION_ID, sessionID);
+    keys.push_back(key);
   }
-  this->innerRemoveItem(*item);
+  for (std::shared_ptr<DeviceSessionItem> &item :
+       this->innerBatchFindItems<DeviceSessionItem>(
+           keys,
+           DYNAMODB_MAX_BATCH_GET_ITEMS,
+           DYNAMODB_BACKOFF_FIRST_RETRY_DELAY,
+           DYNAMODB_MAX_BACKOFF_TIME)) {
+    this->sessionItemsCache.put(item->getSessionID(), *item);
+    items.push_back(item);
+  }
+  return items;
 }
 
-void DatabaseManager::updateSessionItemIsOnline(
+void DatabaseManager::removeSessionItem(const std::string &sessionID) {
+  Aws::DynamoDB::Model::DeleteItemRequest request;
+  request.SetTableName(DeviceSessionItem().getTableName());
+  request.AddKey(
+      DeviceSessionItem::FIELD_SESSION_ID,
+      Aws::DynamoDB::Model::AttributeValue(sessionID));
+  this->innerRemoveItemIfExists(request, DeviceSessionItem::FIELD_SESSION_ID);
+  this->sessionItemsCache.invalidate(sessionID);
+}
+
+Aws::DynamoDB::Model::UpdateItemRequest
+DatabaseManager::createUpdateSessionItemIsOnlineRequest(
     const std::string &sessionID,
     bool isOnline) {
-  std::shared_ptr<DeviceSessionItem> item = this->findSessionItem(sessionID);
-  if (item == nullptr) {
-    LOG(ERROR) << "Can't find for update sessionItem for sessionID: "
-               << sessionID;
-    return;
-  }
   Aws::DynamoDB::Model::UpdateItemRequest request;
-  request.SetTableName(item->getTableName());
+  request.SetTableName(DeviceSessionItem().getTableName());
 
   Aws::DynamoDB::Model::AttributeValue attributeKeyValue;
   attributeKeyValue.SetS(sessionID);
@@ -95,6 +173,7 @@ void DatabaseManager::updateSessionItemIsOnline(
   Aws::Map<Aws::String, Aws::String> expressionAttributeNames;
   expressionAttributeNames["#a"] = DeviceSessionItem::FIELD_IS_ONLINE;
   request.SetExpressionAttributeNames(expressionAttributeNames);
+  setItemExistsCondition(request, DeviceSessionItem::FIELD_SESSION_ID);
 
   Aws::DynamoDB::Model::AttributeValue attributeUpdatedValue;
   attributeUpdatedValue.SetBool(isOnline);
@@ -102,27 +181,63 @@ void DatabaseManager::updateSessionItemIsOnline(
       expressionAttributeValue;
   expressionAttributeValue[":valueA"] = attributeUpdatedValue;
   request.SetExpressionAttributeValues(expressionAttributeValue);
+  return request;
+}
 
+void DatabaseManager::updateSessionItemIsOnline(
+    const std::string &sessionID,
+    bool isOnline) {
   const Aws::DynamoDB::Model::UpdateItemOutcome &result =
-      getDynamoDBClient()->UpdateItem(request);
+      getDynamoDBClient()->UpdateItem(
+          this->createUpdateSessionItemIsOnlineRequest(sessionID, isOnline));
+  if (isConditionalCheckFailure(result)) {
+    this->sessionItemsCache.invalidate(sessionID);
+    LOG(ERROR) << "Can't find for update sessionItem for sessionID: "
+               << sessionID;
+    return;
+  }
   if (!result.IsSuccess()) {
+    this->sessionItemsCache.invalidate(sessionID);
     LOG(ERROR) << "Error updating device online status at "
                   "`updateSessionItemIsOnline`: "
                << result.GetError().GetMessage();
+    return;
   }
+  this->sessionItemsCache.update(
+      sessionID,
+      [isOnline](DeviceSessionItem &item) { item.setIsOnline(isOnline); });
+}
+
+void DatabaseManager::updateSessionItemIsOnlineAsync(
+    const std::string &sessionID,
+    bool isOnline,
+    Callback callback) {
+  getDynamoDBClient()->UpdateItemAsync(
+      this->createUpdateSessionItemIsOnlineRequest(sessionID, isOnline),
+      [this, sessionID, isOnline, callback](
+          const Aws::DynamoDB::DynamoDBClient *client,
+          const Aws::DynamoDB::Model::UpdateItemRequest &request,
+          const Aws::DynamoDB::Model::UpdateItemOutcome &outcome,
+          const std::shared_ptr<const Aws::Client::AsyncCallerContext>
+              &context) {
+        if (!outcome.IsSuccess()) {
+          this->sessionItemsCache.invalidate(sessionID);
+          callback(getOutcomeError(outcome));
+          return;
+        }
+        this->sessionItemsCache.update(
+            sessionID, [isOnline](DeviceSessionItem &item) {
+              item.setIsOnline(isOnline);
+            });
+        callback(nullptr);
+      });
 }
 
 bool DatabaseManager::updateSessionItemDeviceToken(
     const std::string &sessionID,
     const std::string &newDeviceToken) {
-  std::shared_ptr<DeviceSessionItem> item = this->findSessionItem(sessionID);
-  if (item == nullptr) {
-    LOG(ERROR) << "Can't find for update sessionItem for sessionID: "
-               << sessionID;
-    return false;
-  }
   Aws::DynamoDB::Model::UpdateItemRequest request;
-  request.SetTableName(item->getTableName());
+  request.SetTableName(DeviceSessionItem().getTableName());
 
   Aws::DynamoDB::Model::AttributeValue attributeKeyValue;
   attributeKeyValue.SetS(sessionID);
@@ -132,6 +247,7 @@ bool DatabaseManager::updateSessionItemDeviceToken(
   Aws::Map<Aws::String, Aws::String> expressionAttributeNames;
   expressionAttributeNames["#a"] = DeviceSessionItem::FIELD_NOTIFY_TOKEN;
   request.SetExpressionAttributeNames(expressionAttributeNames);
+  setItemExistsCondition(request, DeviceSessionItem::FIELD_SESSION_ID);
 
   Aws::DynamoDB::Model::AttributeValue attributeUpdatedValue;
   attributeUpdatedValue.SetS(newDeviceToken);
@@ -142,12 +258,23 @@ bool DatabaseManager::updateSessionItemDeviceToken(
 
   const Aws::DynamoDB::Model::UpdateItemOutcome &result =
       getDynamoDBClient()->UpdateItem(request);
+  if (isConditionalCheckFailure(result)) {
+    this->sessionItemsCache.invalidate(sessionID);
+    LOG(ERROR) << "Can't find for update sessionItem for sessionID: "
+               << sessionID;
+    return false;
+  }
   if (!result.IsSuccess()) {
+    this->sessionItemsCache.invalidate(sessionID);
     LOG(ERROR)
         << "Error updating device token at updateSessionItemDeviceToken: "
         << result.GetError().GetMessage();
     return false;
   }
+  this->sessionItemsCache.update(
+      sessionID, [&newDeviceToken](DeviceSessionItem &item) {
+        item.setNotifyToken(newDeviceToken);
+      });
   return true;
 }
 
@@ -164,24 +291,109 @@ void DatabaseManager::putSessionSignItem(const SessionSignItem &item) {
       SessionSignItem::FIELD_EXPIRE,
       Aws::DynamoDB::Model::AttributeValue(std::to_string(
           static_cast<size_t>(std::time(0)) + SESSION_SIGN_RECORD_TTL)));
-  this->innerPutItem(std::make_shared<SessionSignItem>(item), request);
+  const std::string deviceID = item.getDeviceID();
+  this->sessionSignItemsCache.put(deviceID, item);
+  std::shared_ptr<SessionSignItemWrite> write =
+      std::make_shared<SessionSignItemWrite>();
+  {
+    const std::lock_guard<std::mutex> lock(this->sessionSignItemWritesMutex);
+    this->sessionSignItemWrites[deviceID] = write;
+  }
+  this->innerPutItemAsync(
+      request, [this, deviceID, write](std::unique_ptr<std::string> error) {
+        if (error != nullptr) {
+          // The nonce is still read from this instance
+          LOG(ERROR) << "Error writing the session signature of " << deviceID
+                     << ": " << *error;
+        }
+        std::vector<std::function<void()>> continuations;
+        {
+          const std::lock_guard<std::mutex> lock(
+              this->sessionSignItemWritesMutex);
+          // Nothing is added to the continuations once the write is out of
+          // the map
+          continuations = std::move(write->continuations);
+          const auto found = this->sessionSignItemWrites.find(deviceID);
+          if (found != this->sessionSignItemWrites.end() &&
+              found->second == write) {
+            this->sessionSignItemWrites.erase(found);
+          }
+        }
+        write->written.set_value();
+        for (std::function<void()> &continuation : continuations) {
+          continuation();
+        }
+      });
 }
 
 std::shared_ptr<SessionSignItem>
 DatabaseManager::findSessionSignItem(const std::string &deviceID) {
+  std::shared_ptr<SessionSignItem> item =
+      this->sessionSignItemsCache.get(deviceID);
+  if (item != nullptr) {
+    return item;
+  }
   Aws::DynamoDB::Model::GetItemRequest request;
   request.AddKey(
       SessionSignItem::FIELD_DEVICE_ID,
       Aws::DynamoDB::Model::AttributeValue(deviceID));
-  return this->innerFindItem<SessionSignItem>(request);
+  return this->innerFindItem<SessionSignItem>(request, true);
 }
 
-void DatabaseManager::removeSessionSignItem(const std::string &deviceID) {
-  std::shared_ptr<SessionSignItem> item = this->findSessionSignItem(deviceID);
-  if (item == nullptr) {
-    return;
+void DatabaseManager::waitForSessionSignItemWrite(const std::string &deviceID) {
+  std::shared_ptr<SessionSignItemWrite> write;
+  {
+    const std::lock_guard<std::mutex> lock(this->sessionSignItemWritesMutex);
+    const auto found = this->sessionSignItemWrites.find(deviceID);
+    if (found == this->sessionSignItemWrites.end()) {
+      return;
+    }
+    write = found->second;
   }
-  this->innerRemoveItem(*item);
+  write->done.wait();
+}
+
+void DatabaseManager::afterSessionSignItemWrite(
+    const std::string &deviceID,
+    std::function<void()> continuation) {
+  {
+    const std::lock_guard<std::mutex> lock(this->sessionSignItemWritesMutex);
+    const auto found = this->sessionSignItemWrites.find(deviceID);
+    if (found != this->sessionSignItemWrites.end()) {
+      found->second->continuations.push_back(std::move(continuation));
+      return;
+    }
+  }
+  continuation();
+}
+
+void DatabaseManager::removeSessionSignItem(const std::string &deviceID) {
+  this->sessionSignItemsCache.invalidate(deviceID);
+  this->waitForSessionSignItemWrite(deviceID);
+  Aws::DynamoDB::Model::DeleteItemRequest request;
+  request.SetTableName(SessionSignItem().getTableName());
+  request.AddKey(
+      SessionSignItem::FIELD_DEVICE_ID,
+      Aws::DynamoDB::Model::AttributeValue(deviceID));
+  this->innerRemoveItemIfExists(request, SessionSignItem::FIELD_DEVICE_ID);
+}
+
+void DatabaseManager::removeSessionSignItemAsync(
+    const std::string &deviceID,
+    Callback callback) {
+  this->sessionSignItemsCache.invalidate(deviceID);
+  Aws::DynamoDB::Model::DeleteItemRequest request;
+  request.SetTableName(SessionSignItem().getTableName());
+  request.AddKey(
+      SessionSignItem::FIELD_DEVICE_ID,
+      Aws::DynamoDB::Model::AttributeValue(deviceID));
+  // The write is nearly always over by the time the signed nonce comes back,
+  // otherwise the removal is sent once it is, without blocking the caller
+  this->afterSessionSignItemWrite(
+      deviceID, [this, request, callback]() mutable {
+        this->innerRemoveItemIfExistsAsync(
+            request, SessionSignItem::FIELD_DEVICE_ID, callback);
+      });
 }
 
 void DatabaseManager::putPublicKeyItem(const PublicKeyItem &item) {
@@ -194,23 +406,61 @@ void DatabaseManager::putPublicKeyItem(const PublicKeyItem &item) {
       PublicKeyItem::FIELD_PUBLIC_KEY,
       Aws::DynamoDB::Model::AttributeValue(item.getPublicKey()));
   this->innerPutItem(std::make_shared<PublicKeyItem>(item), request);
+  this->publicKeyItemsCache.invalidate(item.getDeviceID());
 }
 
 std::shared_ptr<PublicKeyItem>
 DatabaseManager::findPublicKeyItem(const std::string &deviceID) {
+  std::shared_ptr<PublicKeyItem> item = this->publicKeyItemsCache.get(deviceID);
+  if (item != nullptr) {
+    return item;
+  }
   Aws::DynamoDB::Model::GetItemRequest request;
   request.AddKey(
       PublicKeyItem::FIELD_DEVICE_ID,
       Aws::DynamoDB::Model::AttributeValue(deviceID));
-  return this->innerFindItem<PublicKeyItem>(request);
+  item = this->innerFindItem<PublicKeyItem>(request, true);
+  if (item != nullptr) {
+    this->publicKeyItemsCache.put(deviceID, *item);
+  }
+  return item;
 }
 
-void DatabaseManager::removePublicKeyItem(const std::string &deviceID) {
-  std::shared_ptr<PublicKeyItem> item = this->findPublicKeyItem(deviceID);
-  if (item == nullptr) {
-    return;
+std::vector<std::shared_ptr<PublicKeyItem>>
+DatabaseManager::findPublicKeyItems(const std::vector<std::string> &deviceIDs) {
+  std::vector<std::shared_ptr<PublicKeyItem>> items;
+  std::vector<AttributeValues> keys;
+  for (const std::string &deviceID : deviceIDs) {
+    std::shared_ptr<PublicKeyItem> item =
+        this->publicKeyItemsCache.get(deviceID);
+    if (item != nullptr) {
+      items.push_back(item);
+      continue;
+    }
+    AttributeValues key;
+    key.emplace(PublicKeyItem::FIELD_DEVICE_ID, deviceID);
+    keys.push_back(key);
   }
-  this->innerRemoveItem(*item);
+  for (std::shared_ptr<PublicKeyItem> &item :
+       this->innerBatchFindItems<PublicKeyItem>(
+           keys,
+           DYNAMODB_MAX_BATCH_GET_ITEMS,
+           DYNAMODB_BACKOFF_FIRST_RETRY_DELAY,
+           DYNAMODB_MAX_BACKOFF_TIME)) {
+    this->publicKeyItemsCache.put(item->getDeviceID(), *item);
+    items.push_back(item);
+  }
+  return items;
+}
+
+void DatabaseManager::removePublicKeyItem(const std::string &deviceID) {
+  Aws::DynamoDB::Model::DeleteItemRequest request;
+  request.SetTableName(PublicKeyItem().getTableName());
+  request.AddKey(
+      PublicKeyItem::FIELD_DEVICE_ID,
+      Aws::DynamoDB::Model::AttributeValue(deviceID));
+  this->innerRemoveItemIfExists(request, PublicKeyItem::FIELD_DEVICE_ID);
+  this->publicKeyItemsCache.invalidate(deviceID);
 }
 
 template <class T>
@@ -252,21 +502,25 @@ void DatabaseManager::putMessageItem(const MessageItem &item) {
 
 void DatabaseManager::putMessageItemsByBatch(
     const std::vector<MessageItem> &messageItems) {
+  if (messageItems.empty()) {
+    return;
+  }
   std::vector<Aws::DynamoDB::Model::WriteRequest> writeRequests;
-  for (MessageItem messageItem : messageItems) {
+  writeRequests.reserve(messageItems.size());
+  for (const MessageItem &messageItem : messageItems) {
     Aws::DynamoDB::Model::PutRequest putRequest;
-    putRequest =
-        this->populatePutRequestFromMessageItem(putRequest, messageItem);
+    this->populatePutRequestFromMessageItem(putRequest, messageItem);
     Aws::DynamoDB::Model::WriteRequest writeRequest;
-    writeRequest.SetPutRequest(putRequest);
-    writeRequests.push_back(writeRequest);
+    writeRequest.SetPutRequest(std::move(putRequest));
+    writeRequests.push_back(std::move(writeRequest));
   }
   this->innerBatchWriteItem(
       messageItems[0].getTableName(),
       DYNAMODB_MAX_BATCH_ITEMS,
       DYNAMODB_BACKOFF_FIRST_RETRY_DELAY,
       DYNAMODB_MAX_BACKOFF_TIME,
-      writeRequests);
+      writeRequests,
+      DYNAMODB_MAX_PARALLEL_BATCH_CHUNKS);
 }
 
 std::shared_ptr<MessageItem> DatabaseManager::findMessageItem(
@@ -285,45 +539,280 @@ std::shared_ptr<MessageItem> DatabaseManager::findMessageItem(
 std::vector<std::shared_ptr<MessageItem>>
 DatabaseManager::findMessageItemsByReceiver(const std::string &toDeviceID) {
   std::vector<std::shared_ptr<MessageItem>> result;
+  this->findMessageItemsByReceiver(
+      toDeviceID,
+      MESSAGES_PAGE_SIZE,
+      [&result](std::vector<MessageItem> &messages) {
+        for (MessageItem &message : messages) {
+          result.push_back(std::make_shared<MessageItem>(std::move(message)));
+        }
+        return true;
+      });
+  return result;
+}
 
+void DatabaseManager::queryMessageItemsByReceiver(
+    const std::string &tableName,
+    const std::string &toDeviceID,
+    const uint64_t &createdAfter,
+    const size_t &pageSize,
+    std::function<bool(std::vector<MessageItem> &)> onPage) {
   Aws::DynamoDB::Model::QueryRequest req;
-  req.SetTableName(MessageItem().getTableName());
-  req.SetKeyConditionExpression(
-      MessageItem::FIELD_TO_DEVICE_ID + " = :valueToMatch");
-
+  req.SetTableName(tableName);
+  req.SetIndexName(MESSAGES_TABLE_CREATED_AT_INDEX_NAME);
   AttributeValues attributeValues;
   attributeValues.emplace(":valueToMatch", toDeviceID);
+  if (createdAfter > 0) {
+    // CreatedAt is a string, the timestamps in ms have the same number of
+    // digits so they compare the same way as numbers
+    req.SetKeyConditionExpression(
+        MessageItem::FIELD_TO_DEVICE_ID + " = :valueToMatch AND " +
+        MessageItem::FIELD_CREATED_AT + " > :createdAfter");
+    attributeValues.emplace(":createdAfter", std::to_string(createdAfter));
+  } else {
+    req.SetKeyConditionExpression(
+        MessageItem::FIELD_TO_DEVICE_ID + " = :valueToMatch");
+  }
+  req.SetScanIndexForward(true);
+  req.SetLimit(pageSize);
 
   req.SetExpressionAttributeValues(attributeValues);
-  const Aws::DynamoDB::Model::QueryOutcome &outcome =
-      getDynamoDBClient()->Query(req);
+  std::vector<MessageItem> page;
+  this->innerQueryPages(
+      req, [&page, &onPage](const Aws::Vector<AttributeValues> &items) {
+        page.clear();
+        page.reserve(items.size());
+        for (const AttributeValues &item : items) {
+          page.emplace_back(item);
+        }
+        return page.empty() || onPage(page);
+      });
+}
+
+void DatabaseManager::findMessageItemsByReceiver(
+    const std::string &toDeviceID,
+    const size_t &pageSize,
+    std::function<bool(std::vector<MessageItem> &)> onPage) {
+  this->queryMessageItemsByReceiver(
+      MessageItem().getTableName(), toDeviceID, 0, pageSize, onPage);
+}
+
+void DatabaseManager::findMessageItemsByReceiverSince(
+    const std::string &toDeviceID,
+    const uint64_t &createdAfter,
+    const size_t &pageSize,
+    std::function<bool(std::vector<MessageItem> &)> onPage) {
+  this->queryMessageItemsByReceiver(
+      MessageItem().getTableName(),
+      toDeviceID,
+      createdAfter,
+      pageSize,
+      onPage);
+}
+
+std::vector<MessageItem> DatabaseManager::findOldestMessageItemsByReceiver(
+    const std::string &toDeviceID,
+    const size_t &count) {
+  std::vector<MessageItem> result;
+  if (count == 0) {
+    return result;
+  }
+  result.reserve(count);
+  this->findMessageItemsByReceiver(
+      toDeviceID,
+      std::min(count, MESSAGES_PAGE_SIZE),
+      [&result, &count](std::vector<MessageItem> &messages) {
+        for (MessageItem &message : messages) {
+          if (result.size() == count) {
+            break;
+          }
+          result.push_back(std::move(message));
+        }
+        return result.size() < count;
+      });
+  return result;
+}
+
+void DatabaseManager::findArchivedMessageItemsByReceiver(
+    const std::string &toDeviceID,
+    const size_t &pageSize,
+    std::function<bool(std::vector<MessageItem> &)> onPage) {
+  this->queryMessageItemsByReceiver(
+      config::ConfigManager::getInstance()
+          .getSnapshot()
+          .dynamoDBMessagesColdTable,
+      toDeviceID,
+      0,
+      pageSize,
+      onPage);
+}
+
+bool DatabaseManager::acquireMessagesArchiveLease(
+    const std::string &owner,
+    const uint64_t &now,
+    const uint64_t &duration) {
+  Aws::DynamoDB::Model::PutItemRequest request;
+  request.SetTableName(config::ConfigManager::getInstance()
+                           .getSnapshot()
+                           .dynamoDBMessagesColdTable);
+  // The lease has no CreatedAt, so that it stays out of the index the
+  // archived messages are read from
+  request.AddItem(
+      MessageItem::FIELD_TO_DEVICE_ID,
+      Aws::DynamoDB::Model::AttributeValue(MESSAGES_ARCHIVE_LEASE_KEY));
+  request.AddItem(
+      MessageItem::FIELD_MESSAGE_ID,
+      Aws::DynamoDB::Model::AttributeValue(MESSAGES_ARCHIVE_LEASE_KEY));
+  request.AddItem("Owner", Aws::DynamoDB::Model::AttributeValue(owner));
+  Aws::DynamoDB::Model::AttributeValue expiresAt;
+  expiresAt.SetN(std::to_string(now + duration));
+  request.AddItem("LeaseExpiresAt", expiresAt);
+  request.SetConditionExpression(
+      "attribute_not_exists(#partitionKey) OR #expiresAt <= :now OR "
+      "#owner = :owner");
+  request.AddExpressionAttributeNames(
+      "#partitionKey", MessageItem::FIELD_TO_DEVICE_ID);
+  request.AddExpressionAttributeNames("#expiresAt", "LeaseExpiresAt");
+  request.AddExpressionAttributeNames("#owner", "Owner");
+  Aws::DynamoDB::Model::AttributeValue nowValue;
+  nowValue.SetN(std::to_string(now));
+  request.AddExpressionAttributeValues(":now", nowValue);
+  request.AddExpressionAttributeValues(
+      ":owner", Aws::DynamoDB::Model::AttributeValue(owner));
+
+  DynamoDBRateLimiter &limiter =
+      DynamoDBRateLimiter::getInstance(request.GetTableName());
+  limiter.acquire();
+  const auto start = std::chrono::steady_clock::now();
+  const Aws::DynamoDB::Model::PutItemOutcome outcome =
+      getDynamoDBClient()->PutItem(request);
+  recordDatabaseRequest(
+      DatabaseOperation::PUT_ITEM,
+      start,
+      outcome.IsSuccess() || isConditionalCheckFailure(outcome));
+  limiter.recordResponse(start, isThrottlingError(outcome));
+  if (isConditionalCheckFailure(outcome)) {
+    return false;
+  }
   if (!outcome.IsSuccess()) {
     throw std::runtime_error(outcome.GetError().GetMessage());
   }
-  const Aws::Vector<AttributeValues> &items = outcome.GetResult().GetItems();
-  for (auto &item : items) {
-    result.push_back(std::make_shared<MessageItem>(item));
-  }
+  return true;
+}
 
-  return result;
+size_t DatabaseManager::archiveMessageItems(const uint64_t &createdBefore) {
+  const std::string coldTableName = config::ConfigManager::getInstance()
+                                        .getSnapshot()
+                                        .dynamoDBMessagesColdTable;
+  Aws::DynamoDB::Model::ScanRequest req;
+  req.SetTableName(MessageItem().getTableName());
+  // CreatedAt is a string, the timestamps in ms have the same number of
+  // digits so they compare the same way as numbers
+  req.SetFilterExpression(MessageItem::FIELD_CREATED_AT + " < :createdBefore");
+  req.SetLimit(MESSAGES_PAGE_SIZE);
+
+  AttributeValues attributeValues;
+  attributeValues.emplace(":createdBefore", std::to_string(createdBefore));
+
+  req.SetExpressionAttributeValues(attributeValues);
+  size_t archived = 0;
+  this->innerScanPages(
+      req,
+      [this, &coldTableName, &archived](
+          const Aws::Vector<AttributeValues> &items) {
+        if (items.empty()) {
+          return true;
+        }
+        std::vector<Aws::DynamoDB::Model::WriteRequest> putRequests;
+        std::vector<Aws::DynamoDB::Model::WriteRequest> deleteRequests;
+        putRequests.reserve(items.size());
+        deleteRequests.reserve(items.size());
+        for (const AttributeValues &item : items) {
+          // Copied as they are, so the messages keep their Expire
+          Aws::DynamoDB::Model::PutRequest putRequest;
+          putRequest.SetItem(item);
+          Aws::DynamoDB::Model::WriteRequest putWriteRequest;
+          putWriteRequest.SetPutRequest(std::move(putRequest));
+          putRequests.push_back(std::move(putWriteRequest));
+
+          Aws::DynamoDB::Model::DeleteRequest deleteRequest;
+          deleteRequest.AddKey(
+              MessageItem::FIELD_TO_DEVICE_ID,
+              item.at(MessageItem::FIELD_TO_DEVICE_ID));
+          deleteRequest.AddKey(
+              MessageItem::FIELD_MESSAGE_ID,
+              item.at(MessageItem::FIELD_MESSAGE_ID));
+          Aws::DynamoDB::Model::WriteRequest deleteWriteRequest;
+          deleteWriteRequest.SetDeleteRequest(std::move(deleteRequest));
+          deleteRequests.push_back(std::move(deleteWriteRequest));
+        }
+        // The copies are written before the messages are deleted, so that
+        // a failed page is only archived again on the next run. A message
+        // that is acknowledged in between stays in the cold table and is
+        // delivered once more.
+        this->innerBatchWriteItem(
+            coldTableName,
+            DYNAMODB_MAX_BATCH_ITEMS,
+            DYNAMODB_BACKOFF_FIRST_RETRY_DELAY,
+            DYNAMODB_MAX_BACKOFF_TIME,
+            putRequests);
+        this->innerBatchWriteItem(
+            MessageItem().getTableName(),
+            DYNAMODB_MAX_BATCH_ITEMS,
+            DYNAMODB_BACKOFF_FIRST_RETRY_DELAY,
+            DYNAMODB_MAX_BACKOFF_TIME,
+            deleteRequests);
+        archived += items.size();
+        return true;
+      });
+  return archived;
 }
 
 void DatabaseManager::removeMessageItem(
     const std::string &toDeviceID,
     const std::string &messageID) {
-  std::shared_ptr<MessageItem> item =
-      this->findMessageItem(toDeviceID, messageID);
-  if (item == nullptr) {
-    return;
-  }
-  this->innerRemoveItem(*item);
+  Aws::DynamoDB::Model::DeleteItemRequest request;
+  request.SetTableName(MessageItem().getTableName());
+  request.AddKey(
+      MessageItem::FIELD_TO_DEVICE_ID,
+      Aws::DynamoDB::Model::AttributeValue(toDeviceID));
+  request.AddKey(
+      MessageItem::FIELD_MESSAGE_ID,
+      Aws::DynamoDB::Model::AttributeValue(messageID));
+  this->innerRemoveItemIfExists(request, MessageItem::FIELD_TO_DEVICE_ID);
 }
 
 void DatabaseManager::removeMessageItemsByIDsForDeviceID(
     std::vector<std::string> &messageIDs,
     const std::string &toDeviceID) {
-  std::vector<Aws::DynamoDB::Model::WriteRequest> writeRequests;
+  std::vector<std::pair<std::string, std::string>> messageKeys;
+  messageKeys.reserve(messageIDs.size());
   for (std::string &messageID : messageIDs) {
+    messageKeys.emplace_back(toDeviceID, messageID);
+  }
+  this->removeMessageItems(messageKeys);
+}
+
+void DatabaseManager::removeMessageItems(
+    const std::vector<std::pair<std::string, std::string>> &messageKeys) {
+  this->innerRemoveMessageItems(MessageItem().getTableName(), messageKeys);
+}
+
+void DatabaseManager::removeArchivedMessageItems(
+    const std::vector<std::pair<std::string, std::string>> &messageKeys) {
+  this->innerRemoveMessageItems(
+      config::ConfigManager::getInstance()
+          .getSnapshot()
+          .dynamoDBMessagesColdTable,
+      messageKeys);
+}
+
+void DatabaseManager::innerRemoveMessageItems(
+    const std::string &tableName,
+    const std::vector<std::pair<std::string, std::string>> &messageKeys) {
+  std::vector<Aws::DynamoDB::Model::WriteRequest> writeRequests;
+  writeRequests.reserve(messageKeys.size());
+  for (const auto &[toDeviceID, messageID] : messageKeys) {
     Aws::DynamoDB::Model::DeleteRequest deleteRequest;
     deleteRequest.AddKey(
         MessageItem::FIELD_TO_DEVICE_ID,
@@ -333,14 +822,23 @@ void DatabaseManager::removeMessageItemsByIDsForDeviceID(
         Aws::DynamoDB::Model::AttributeValue(messageID));
     Aws::DynamoDB::Model::WriteRequest currentWriteRequest;
     currentWriteRequest.SetDeleteRequest(deleteRequest);
-    writeRequests.push_back(currentWriteRequest);
+    writeRequests.push_back(std::move(currentWriteRequest));
   }
   this->innerBatchWriteItem(
-      MessageItem().getTableName(),
+      tableName,
       DYNAMODB_MAX_BATCH_ITEMS,
       DYNAMODB_BACKOFF_FIRST_RETRY_DELAY,
       DYNAMODB_MAX_BACKOFF_TIME,
-      writeRequests);
+      writeRequests,
+      DYNAMODB_MAX_PARALLEL_BATCH_CHUNKS);
+}
+
+ItemCacheStats DatabaseManager::getSessionItemsCacheStats() const {
+  return this->sessionItemsCache.getStats();
+}
+
+ItemCacheStats DatabaseManager::getPublicKeyItemsCacheStats() const {
+  return this->publicKeyItemsCache.getStats();
 }
 
 } // namespace database
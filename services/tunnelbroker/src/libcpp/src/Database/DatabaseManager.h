@@ -5,6 +5,7 @@
 #include "DatabaseEntitiesTools.h"
 #include "DatabaseManagerBase.h"
 #include "DeviceSessionItem.h"
+#include "ItemCache.h"
 #include "MessageItem.h"
 #include "PublicKeyItem.h"
 #include "SessionSignItem.h"
@@ -19,11 +20,18 @@
 #include <aws/dynamodb/model/GetItemRequest.h>
 #include <aws/dynamodb/model/PutItemRequest.h>
 #include <aws/dynamodb/model/QueryRequest.h>
+#include <aws/dynamodb/model/ScanRequest.h>
 #include <aws/dynamodb/model/UpdateItemRequest.h>
 #include <aws/dynamodb/model/UpdateItemResult.h>
 
+#include <functional>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace comm {
 namespace network {
@@ -31,43 +39,158 @@ namespace database {
 
 class DatabaseManager : public DatabaseManagerBase {
 private:
+  // Sessions and public keys are read on every connection but rarely change,
+  // so they are cached. Everything that writes them through this class
+  // updates or drops the cached copy once the write succeeds, and other
+  // tunnelbroker instances' writes are seen once the copy expires.
+  ItemCache<DeviceSessionItem> sessionItemsCache{
+      SESSION_ITEMS_CACHE_SIZE,
+      std::chrono::milliseconds(SESSION_ITEMS_CACHE_TTL_MS)};
+  ItemCache<PublicKeyItem> publicKeyItemsCache{
+      PUBLIC_KEY_ITEMS_CACHE_SIZE,
+      std::chrono::milliseconds(PUBLIC_KEY_ITEMS_CACHE_TTL_MS)};
+  // A client asks for the nonce of its session signature and sends it back
+  // over the same connection, so nearly always the nonce is read by the
+  // instance that made it. The nonces are kept here and their DynamoDB
+  // copies, for the requests that land on another instance, are written in
+  // the background.
+  ItemCache<SessionSignItem> sessionSignItemsCache{
+      SESSION_SIGN_ITEMS_CACHE_SIZE,
+      std::chrono::seconds(SESSION_SIGN_RECORD_TTL)};
+  // A background write of a nonce, and the removals that wait for it
+  struct SessionSignItemWrite {
+    std::promise<void> written;
+    std::shared_future<void> done{written.get_future()};
+    // Guarded by sessionSignItemWritesMutex
+    std::vector<std::function<void()>> continuations;
+  };
+  // The background writes of the nonces by deviceID, a nonce is only removed
+  // from DynamoDB once its write is over, so that the write can't bring it
+  // back
+  std::mutex sessionSignItemWritesMutex;
+  std::unordered_map<std::string, std::shared_ptr<SessionSignItemWrite>>
+      sessionSignItemWrites;
+
   template <class T>
   T populatePutRequestFromMessageItem(T &putRequest, const MessageItem &item);
+  void waitForSessionSignItemWrite(const std::string &deviceID);
+  // Runs continuation once the background write of the nonce of the device
+  // is over, on the thread that finishes it, or right away if there is none
+  void afterSessionSignItemWrite(
+      const std::string &deviceID,
+      std::function<void()> continuation);
+  // With createdAfter above 0 only the messages created after it are read
+  void queryMessageItemsByReceiver(
+      const std::string &tableName,
+      const std::string &toDeviceID,
+      const uint64_t &createdAfter,
+      const size_t &pageSize,
+      std::function<bool(std::vector<MessageItem> &)> onPage);
+  void innerRemoveMessageItems(
+      const std::string &tableName,
+      const std::vector<std::pair<std::string, std::string>> &messageKeys);
+  Aws::DynamoDB::Model::PutItemRequest
+  createPutSessionItemRequest(const DeviceSessionItem &item);
+  Aws::DynamoDB::Model::UpdateItemRequest
+  createUpdateSessionItemIsOnlineRequest(
+      const std::string &sessionID,
+      bool isOnline);
 
 public:
   static DatabaseManager &getInstance();
   bool isTableAvailable(const std::string &tableName);
+  std::future<bool> isTableAvailableAsync(const std::string &tableName);
 
   void putSessionItem(const DeviceSessionItem &item);
+  void putSessionItemAsync(const DeviceSessionItem &item, Callback callback);
   std::shared_ptr<DeviceSessionItem>
   findSessionItem(const std::string &deviceID);
+  std::vector<std::shared_ptr<DeviceSessionItem>>
+  findSessionItems(const std::vector<std::string> &sessionIDs);
   void removeSessionItem(const std::string &sessionID);
   void updateSessionItemIsOnline(const std::string &sessionID, bool isOnline);
+  // Fails for a session that doesn't exist
+  void updateSessionItemIsOnlineAsync(
+      const std::string &sessionID,
+      bool isOnline,
+      Callback callback);
   bool updateSessionItemDeviceToken(
       const std::string &sessionID,
       const std::string &newDeviceToken);
 
+  // Returns before the item is written to DynamoDB
   void putSessionSignItem(const SessionSignItem &item);
   std::shared_ptr<SessionSignItem>
   findSessionSignItem(const std::string &deviceID);
   void removeSessionSignItem(const std::string &deviceID);
+  void
+  removeSessionSignItemAsync(const std::string &deviceID, Callback callback);
 
   void putPublicKeyItem(const PublicKeyItem &item);
   std::shared_ptr<PublicKeyItem> findPublicKeyItem(const std::string &deviceID);
+  std::vector<std::shared_ptr<PublicKeyItem>>
+  findPublicKeyItems(const std::vector<std::string> &deviceIDs);
   void removePublicKeyItem(const std::string &deviceID);
 
   void putMessageItem(const MessageItem &item);
   void putMessageItemsByBatch(const std::vector<MessageItem> &messageItems);
   std::shared_ptr<MessageItem>
   findMessageItem(const std::string &toDeviceID, const std::string &messageID);
+  // Oldest first
   std::vector<std::shared_ptr<MessageItem>>
   findMessageItemsByReceiver(const std::string &toDeviceID);
+  // Calls onPage with up to pageSize messages at a time, oldest first, until
+  // all are read or onPage returns false
+  void findMessageItemsByReceiver(
+      const std::string &toDeviceID,
+      const size_t &pageSize,
+      std::function<bool(std::vector<MessageItem> &)> onPage);
+  // Same as findMessageItemsByReceiver for the messages created after
+  // createdAfter, a timestamp in ms, so that a backlog can be read in parts
+  void findMessageItemsByReceiverSince(
+      const std::string &toDeviceID,
+      const uint64_t &createdAfter,
+      const size_t &pageSize,
+      std::function<bool(std::vector<MessageItem> &)> onPage);
+  // Up to count messages, oldest first
+  std::vector<MessageItem> findOldestMessageItemsByReceiver(
+      const std::string &toDeviceID,
+      const size_t &count);
+  // Same as findMessageItemsByReceiver for the messages that were archived,
+  // which are older than all the ones in the messages table
+  void findArchivedMessageItemsByReceiver(
+      const std::string &toDeviceID,
+      const size_t &pageSize,
+      std::function<bool(std::vector<MessageItem> &)> onPage);
+  // Takes the archive lease for owner until now + duration, timestamps in
+  // ms. An owner can renew its own lease before it ends.
+  // - returns false if another owner holds the lease
+  bool acquireMessagesArchiveLease(
+      const std::string &owner,
+      const uint64_t &now,
+      const uint64_t &duration);
+  // Moves the messages created before createdBefore, a timestamp in ms, to
+  // the cold table
+  // - returns the number of the messages that were moved
+  size_t archiveMessageItems(const uint64_t &createdBefore);
   void removeMessageItem(
       const std::string &toDeviceID,
       const std::string &messageID);
   void removeMessageItemsByIDsForDeviceID(
       std::vector<std::string> &messageIDs,
       const std::string &toDeviceID);
+  // Removes the messages of any devices in batches, throws if one can't be
+  // written
+  // - argument messageKeys - pairs of a toDeviceID and a messageID
+  void removeMessageItems(
+      const std::vector<std::pair<std::string, std::string>> &messageKeys);
+  // Same as removeMessageItems for the messages that were read from the cold
+  // table
+  void removeArchivedMessageItems(
+      const std::vector<std::pair<std::string, std::string>> &messageKeys);
+
+  ItemCacheStats getSessionItemsCacheStats() const;
+  ItemCacheStats getPublicKeyItemsCacheStats() const;
 };
 
 } // namespace database
@@ -55,16 +55,20 @@ void DeviceSessionItem::validate() const {
 void DeviceSessionItem::assignItemFromDatabase(
     const AttributeValues &itemFromDB) {
   try {
-    this->sessionID = itemFromDB.at(DeviceSessionItem::FIELD_SESSION_ID).GetS();
-    this->deviceID = itemFromDB.at(DeviceSessionItem::FIELD_DEVICE_ID).GetS();
-    this->pubKey = itemFromDB.at(DeviceSessionItem::FIELD_PUBKEY).GetS();
+    this->sessionID =
+        getStringAttribute(itemFromDB, DeviceSessionItem::FIELD_SESSION_ID);
+    this->deviceID =
+        getStringAttribute(itemFromDB, DeviceSessionItem::FIELD_DEVICE_ID);
+    this->pubKey =
+        getStringAttribute(itemFromDB, DeviceSessionItem::FIELD_PUBKEY);
     this->notifyToken =
-        itemFromDB.at(DeviceSessionItem::FIELD_NOTIFY_TOKEN).GetS();
+        getStringAttribute(itemFromDB, DeviceSessionItem::FIELD_NOTIFY_TOKEN);
     this->deviceType =
         std::stoul(itemFromDB.at(DeviceSessionItem::FIELD_DEVICE_TYPE).GetS());
     this->appVersion =
-        itemFromDB.at(DeviceSessionItem::FIELD_APP_VERSION).GetS();
-    this->deviceOs = itemFromDB.at(DeviceSessionItem::FIELD_DEVICE_OS).GetS();
+        getStringAttribute(itemFromDB, DeviceSessionItem::FIELD_APP_VERSION);
+    this->deviceOs =
+        getStringAttribute(itemFromDB, DeviceSessionItem::FIELD_DEVICE_OS);
     this->isOnline =
         itemFromDB.at(DeviceSessionItem::FIELD_IS_ONLINE).GetBool();
   } catch (std::logic_error &e) {
@@ -75,8 +79,9 @@ void DeviceSessionItem::assignItemFromDatabase(
 }
 
 std::string DeviceSessionItem::getTableName() const {
-  return config::ConfigManager::getInstance().getParameter(
-      config::ConfigManager::OPTION_DYNAMODB_SESSIONS_TABLE);
+  return config::ConfigManager::getInstance()
+      .getSnapshot()
+      .dynamoDBSessionsTable;
 }
 
 PrimaryKeyDescriptor DeviceSessionItem::getPrimaryKeyDescriptor() const {
@@ -119,6 +124,14 @@ bool DeviceSessionItem::getIsOnline() const {
   return this->isOnline;
 }
 
+void DeviceSessionItem::setNotifyToken(const std::string &notifyToken) {
+  this->notifyToken = notifyToken;
+}
+
+void DeviceSessionItem::setIsOnline(bool isOnline) {
+  this->isOnline = isOnline;
+}
+
 } // namespace database
 } // namespace network
 } // namespace comm
@@ -44,6 +44,8 @@ public:
   std::string getAppVersion() const;
   std::string getDeviceOs() const;
   bool getIsOnline() const;
+  void setNotifyToken(const std::string &notifyToken);
+  void setIsOnline(bool isOnline);
 
   DeviceSessionItem() {
   }
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace comm {
+namespace network {
+namespace database {
+
+struct ItemCacheStats {
+  uint64_t hits;
+  uint64_t misses;
+};
+
+// Thread-safe cache of items by key, which drops the least recently used
+// item once maxSize is reached and ignores items older than ttl. Items are
+// copied in and out, so that callers can't change what is cached.
+template <typename T> class ItemCache {
+  struct Entry {
+    std::string key;
+    T item;
+    std::chrono::steady_clock::time_point expiresAt;
+  };
+
+  const size_t maxSize;
+  const std::chrono::milliseconds ttl;
+  std::mutex mutex;
+  // Most recently used first
+  std::list<Entry> entries;
+  std::unordered_map<std::string, typename std::list<Entry>::iterator> index;
+  std::atomic<uint64_t> hits{0};
+  std::atomic<uint64_t> misses{0};
+
+public:
+  ItemCache(size_t maxSize, std::chrono::milliseconds ttl)
+      : maxSize(maxSize), ttl(ttl) {
+  }
+
+  // Returns nullptr if the item isn't cached or has expired
+  std::shared_ptr<T> get(const std::string &key) {
+    const std::lock_guard<std::mutex> lock(this->mutex);
+    const auto found = this->index.find(key);
+    if (found == this->index.end()) {
+      this->misses++;
+      return nullptr;
+    }
+    if (found->second->expiresAt <= std::chrono::steady_clock::now()) {
+      this->entries.erase(found->second);
+      this->index.erase(found);
+      this->misses++;
+      return nullptr;
+    }
+    this->entries.splice(this->entries.begin(), this->entries, found->second);
+    this->hits++;
+    return std::make_shared<T>(found->second->item);
+  }
+
+  void put(const std::string &key, const T &item) {
+    if (!this->maxSize) {
+      return;
+    }
+    const std::lock_guard<std::mutex> lock(this->mutex);
+    const auto found = this->index.find(key);
+    if (found != this->index.end()) {
+      this->entries.erase(found->second);
+      this->index.erase(found);
+    } else if (this->entries.size() >= this->maxSize) {
+      this->index.erase(this->entries.back().key);
+      this->entries.pop_back();
+    }
+    this->entries.push_front(
+        Entry{key, item, std::chrono::steady_clock::now() + this->ttl});
+    this->index[key] = this->entries.begin();
+  }
+
+  // Changes the cached item in place, if there is one, without extending its
+  // lifetime
+  void update(const std::string &key, std::function<void(T &)> change) {
+    const std::lock_guard<std::mutex> lock(this->mutex);
+    const auto found = this->index.find(key);
+    if (found != this->index.end()) {
+      change(found->second->item);
+    }
+  }
+
+  void invalidate(const std::string &key) {
+    const std::lock_guard<std::mutex> lock(this->mutex);
+    const auto found = this->index.find(key);
+    if (found != this->index.end()) {
+      this->entries.erase(found->second);
+      this->index.erase(found);
+    }
+  }
+
+  ItemCacheStats getStats() const {
+    return ItemCacheStats{this->hits.load(), this->misses.load()};
+  }
+};
+
+} // namespace database
+} // namespace network
+} // namespace comm
@@ -0,0 +1,83 @@
+#include "MessageArchiver.h"
+#include "ConfigManager.h"
+#include "Constants.h"
+#include "DatabaseManager.h"
+#include "GlobalTools.h"
+
+#include <glog/logging.h>
+
+#include <random>
+#include <thread>
+
+namespace comm {
+namespace network {
+namespace database {
+
+MessageArchiver &MessageArchiver::getInstance() {
+  static MessageArchiver instance(
+      [](const uint64_t &createdBefore) {
+        return DatabaseManager::getInstance().archiveMessageItems(
+            createdBefore);
+      },
+      [](const uint64_t &now, const uint64_t &duration) {
+        return DatabaseManager::getInstance().acquireMessagesArchiveLease(
+            config::ConfigManager::getInstance().getSnapshot().tunnelbrokerID,
+            now,
+            duration);
+      },
+      std::chrono::milliseconds(MESSAGES_ARCHIVE_INTERVAL_MS),
+      std::chrono::milliseconds(MESSAGES_HOT_TIER_AGE_MS));
+  return instance;
+}
+
+MessageArchiver::MessageArchiver(
+    ArchiveFunction archiveMessages,
+    LeaseFunction acquireLease,
+    std::chrono::milliseconds interval,
+    std::chrono::milliseconds maxAge)
+    : archiveMessages(std::move(archiveMessages)),
+      acquireLease(std::move(acquireLease)),
+      interval(interval),
+      maxAge(maxAge) {
+  this->archived = &metrics::MetricsRegistry::getInstance().getCounter(
+      "comm_archived_messages_total",
+      "Undelivered messages moved to the cold table");
+}
+
+void MessageArchiver::start() {
+  std::call_once(this->archiveThreadStarted, [this]() {
+    std::thread archiveThread([this]() { this->runArchiveThread(); });
+    archiveThread.detach();
+  });
+}
+
+void MessageArchiver::archive(const uint64_t &now) {
+  const uint64_t maxAgeMs = this->maxAge.count();
+  if (now <= maxAgeMs) {
+    return;
+  }
+  try {
+    if (!this->acquireLease(now, this->interval.count())) {
+      return;
+    }
+    const size_t archivedCount = this->archiveMessages(now - maxAgeMs);
+    this->archived->increment(archivedCount);
+  } catch (const std::exception &e) {
+    LOG(ERROR) << "Error archiving messages: " << e.what();
+  }
+}
+
+void MessageArchiver::runArchiveThread() {
+  std::random_device randomDevice;
+  std::uniform_int_distribution<int64_t> offset(0, this->interval.count());
+  std::this_thread::sleep_for(
+      std::chrono::milliseconds(offset(randomDevice)));
+  while (true) {
+    this->archive(tools::getCurrentTimestamp());
+    std::this_thread::sleep_for(this->interval);
+  }
+}
+
+} // namespace database
+} // namespace network
+} // namespace comm
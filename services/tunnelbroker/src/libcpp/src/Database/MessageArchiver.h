@@ -0,0 +1,61 @@
+#pragma once
+
+#include "Metrics.h"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+
+namespace comm {
+namespace network {
+namespace database {
+
+// Moves the messages that stay undelivered for longer than maxAge out of the
+// messages table, every interval on a thread of the archiver. Every instance
+// tries a pass at its own random point of the interval, and only the one
+// that takes the lease for the interval goes over the table. Moving a
+// message that is already in the cold table again doesn't change it.
+class MessageArchiver {
+public:
+  // - argument createdBefore - timestamp in ms
+  // - returns the number of the messages that were moved
+  using ArchiveFunction = std::function<size_t(const uint64_t &createdBefore)>;
+  // - argument now - timestamp in ms
+  // - returns false if another instance holds the lease until after now +
+  // duration
+  using LeaseFunction =
+      std::function<bool(const uint64_t &now, const uint64_t &duration)>;
+
+private:
+  const ArchiveFunction archiveMessages;
+  const LeaseFunction acquireLease;
+  const std::chrono::milliseconds interval;
+  const std::chrono::milliseconds maxAge;
+  metrics::Counter *archived;
+  std::once_flag archiveThreadStarted;
+
+  void runArchiveThread();
+
+public:
+  static MessageArchiver &getInstance();
+
+  MessageArchiver(
+      ArchiveFunction archiveMessages,
+      LeaseFunction acquireLease,
+      std::chrono::milliseconds interval,
+      std::chrono::milliseconds maxAge);
+
+  void start();
+  // A single pass if the lease is taken, errors are logged and left to the
+  // next one
+  // - argument now - timestamp in ms
+  void archive(const uint64_t &now);
+
+  MessageArchiver(MessageArchiver const &) = delete;
+  void operator=(MessageArchiver const &) = delete;
+};
+
+} // namespace database
+} // namespace network
+} // namespace comm
@@ -2,6 +2,7 @@
 #include "ConfigManager.h"
 #include "Tools.h"
 
+#include <utility>
 #include <vector>
 
 namespace comm {
@@ -17,16 +18,16 @@ const std::string MessageItem::FIELD_EXPIRE = "Expire";
 const std::string MessageItem::FIELD_CREATED_AT = "CreatedAt";
 
 MessageItem::MessageItem(
-    const std::string messageID,
-    const std::string fromDeviceID,
-    const std::string toDeviceID,
-    const std::string payload,
-    const std::string blobHashes)
-    : messageID(messageID),
-      fromDeviceID(fromDeviceID),
-      toDeviceID(toDeviceID),
-      payload(payload),
-      blobHashes(blobHashes) {
+    std::string messageID,
+    std::string fromDeviceID,
+    std::string toDeviceID,
+    std::string payload,
+    std::string blobHashes)
+    : messageID(std::move(messageID)),
+      fromDeviceID(std::move(fromDeviceID)),
+      toDeviceID(std::move(toDeviceID)),
+      payload(std::move(payload)),
+      blobHashes(std::move(blobHashes)) {
   this->validate();
 }
 
@@ -46,12 +47,15 @@ void MessageItem::validate() const {
 
 void MessageItem::assignItemFromDatabase(const AttributeValues &itemFromDB) {
   try {
-    this->messageID = itemFromDB.at(MessageItem::FIELD_MESSAGE_ID).GetS();
+    this->messageID =
+        getStringAttribute(itemFromDB, MessageItem::FIELD_MESSAGE_ID);
     this->fromDeviceID =
-        itemFromDB.at(MessageItem::FIELD_FROM_DEVICE_ID).GetS();
-    this->toDeviceID = itemFromDB.at(MessageItem::FIELD_TO_DEVICE_ID).GetS();
-    this->payload = itemFromDB.at(MessageItem::FIELD_PAYLOAD).GetS();
-    this->blobHashes = itemFromDB.at(MessageItem::FIELD_BLOB_HASHES).GetS();
+        getStringAttribute(itemFromDB, MessageItem::FIELD_FROM_DEVICE_ID);
+    this->toDeviceID =
+        getStringAttribute(itemFromDB, MessageItem::FIELD_TO_DEVICE_ID);
+    this->payload = getStringAttribute(itemFromDB, MessageItem::FIELD_PAYLOAD);
+    this->blobHashes =
+        getStringAttribute(itemFromDB, MessageItem::FIELD_BLOB_HASHES);
     this->expire = std::stoull(itemFromDB.at(MessageItem::FIELD_EXPIRE).GetS());
     this->createdAt =
         std::stoull(itemFromDB.at(MessageItem::FIELD_CREATED_AT).GetS());
@@ -63,8 +67,9 @@ void MessageItem::assignItemFromDatabase(const AttributeValues &itemFromDB) {
 }
 
 std::string MessageItem::getTableName() const {
-  return config::ConfigManager::getInstance().getParameter(
-      config::ConfigManager::OPTION_DYNAMODB_MESSAGES_TABLE);
+  return config::ConfigManager::getInstance()
+      .getSnapshot()
+      .dynamoDBMessagesTable;
 }
 
 PrimaryKeyDescriptor MessageItem::getPrimaryKeyDescriptor() const {
@@ -76,26 +81,42 @@ PrimaryKeyValue MessageItem::getPrimaryKeyValue() const {
   return PrimaryKeyValue(this->toDeviceID, this->messageID);
 }
 
-std::string MessageItem::getMessageID() const {
+const std::string &MessageItem::getMessageID() const {
   return this->messageID;
 }
 
-std::string MessageItem::getFromDeviceID() const {
+const std::string &MessageItem::getFromDeviceID() const {
   return this->fromDeviceID;
 }
 
-std::string MessageItem::getToDeviceID() const {
+const std::string &MessageItem::getToDeviceID() const {
   return this->toDeviceID;
 }
 
-std::string MessageItem::getPayload() const {
+const std::string &MessageItem::getPayload() const {
   return this->payload;
 }
 
-std::string MessageItem::getBlobHashes() const {
+const std::string &MessageItem::getBlobHashes() const {
   return this->blobHashes;
 }
 
+std::string MessageItem::takeMessageID() {
+  return std::move(this->messageID);
+}
+
+std::string MessageItem::takeFromDeviceID() {
+  return std::move(this->fromDeviceID);
+}
+
+std::string MessageItem::takePayload() {
+  return std::move(this->payload);
+}
+
+std::string MessageItem::takeBlobHashes() {
+  return std::move(this->blobHashes);
+}
+
 uint64_t MessageItem::getExpire() const {
   return this->expire;
 }
@@ -104,6 +125,14 @@ uint64_t MessageItem::getCreatedAt() const {
   return this->createdAt;
 }
 
+bool MessageItem::isBulk() const {
+  return this->bulk;
+}
+
+void MessageItem::setBulk(bool bulk) {
+  this->bulk = bulk;
+}
+
 } // namespace database
 } // namespace network
 } // namespace comm
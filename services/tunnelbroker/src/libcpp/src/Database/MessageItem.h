@@ -16,6 +16,8 @@ class MessageItem : public Item {
   std::string blobHashes;
   uint64_t expire;
   uint64_t createdAt;
+  // Not stored, it only orders the delivery to a device that is online
+  bool bulk = false;
 
   void validate() const override;
 
@@ -31,22 +33,30 @@ public:
   PrimaryKeyDescriptor getPrimaryKeyDescriptor() const override;
   PrimaryKeyValue getPrimaryKeyValue() const override;
   std::string getTableName() const override;
-  std::string getMessageID() const;
-  std::string getFromDeviceID() const;
-  std::string getToDeviceID() const;
-  std::string getPayload() const;
-  std::string getBlobHashes() const;
+  const std::string &getMessageID() const;
+  const std::string &getFromDeviceID() const;
+  const std::string &getToDeviceID() const;
+  const std::string &getPayload() const;
+  const std::string &getBlobHashes() const;
+  // Move the fields out of an item that is handed over and dropped, e.g. to
+  // Rust, so that its payload isn't held twice
+  std::string takeMessageID();
+  std::string takeFromDeviceID();
+  std::string takePayload();
+  std::string takeBlobHashes();
   uint64_t getExpire() const;
   uint64_t getCreatedAt() const;
+  bool isBulk() const;
+  void setBulk(bool bulk);
 
   MessageItem() {
   }
   MessageItem(
-      const std::string messageID,
-      const std::string fromDeviceID,
-      const std::string toDeviceID,
-      const std::string payload,
-      const std::string blobHashes);
+      std::string messageID,
+      std::string fromDeviceID,
+      std::string toDeviceID,
+      std::string payload,
+      std::string blobHashes);
   MessageItem(const AttributeValues &itemFromDB);
   void assignItemFromDatabase(const AttributeValues &itemFromDB) override;
 };
@@ -0,0 +1,235 @@
+#include "MessageRemover.h"
+#include "Constants.h"
+#include "DatabaseManager.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <iterator>
+#include <thread>
+
+namespace comm {
+namespace network {
+namespace database {
+
+MessageRemover &MessageRemover::getInstance() {
+  static MessageRemover instance = [] {
+    metrics::MetricsRegistry::getInstance().registerGaugeFunction(
+        "comm_pending_message_removals",
+        "Acknowledged messages waiting to be removed from the database",
+        "",
+        []() {
+          return static_cast<double>(
+              MessageRemover::getInstance().getPendingCount());
+        });
+    return MessageRemover(
+        [](const std::vector<std::pair<std::string, std::string>>
+               &messageKeys,
+           const std::vector<std::pair<std::string, std::string>>
+               &archivedMessageKeys) {
+          if (!messageKeys.empty()) {
+            DatabaseManager::getInstance().removeMessageItems(messageKeys);
+          }
+          if (!archivedMessageKeys.empty()) {
+            DatabaseManager::getInstance().removeArchivedMessageItems(
+                archivedMessageKeys);
+          }
+        },
+        std::chrono::milliseconds(MESSAGES_REMOVAL_FLUSH_INTERVAL_MS),
+        DYNAMODB_MAX_BATCH_ITEMS,
+        MESSAGES_REMOVAL_MAX_ATTEMPTS,
+        MESSAGES_REMOVAL_CAPACITY);
+  }();
+  return instance;
+}
+
+MessageRemover::MessageRemover(
+    RemoveFunction removeMessages,
+    std::chrono::milliseconds flushInterval,
+    size_t batchSize,
+    size_t maxAttempts,
+    size_t capacity)
+    : removeMessages(std::move(removeMessages)),
+      flushInterval(flushInterval),
+      batchSize(std::max<size_t>(batchSize, 1)),
+      maxAttempts(std::max<size_t>(maxAttempts, 1)),
+      capacity(capacity) {
+  metrics::MetricsRegistry &registry = metrics::MetricsRegistry::getInstance();
+  this->removed = &registry.getCounter(
+      "comm_removed_messages_total",
+      "Acknowledged messages removed from the database");
+  this->failed = &registry.getCounter(
+      "comm_message_removal_failures_total",
+      "Acknowledged messages that couldn't be removed and are left to expire");
+}
+
+void MessageRemover::remove(
+    const std::string &toDeviceID,
+    const std::vector<std::string> &messageIDs) {
+  if (this->flushInterval.count() > 0) {
+    std::call_once(this->flushThreadStarted, [this]() {
+      std::thread flushThread([this]() { this->runFlushThread(); });
+      flushThread.detach();
+    });
+  }
+  bool wakeUp;
+  bool overCapacity;
+  {
+    const std::lock_guard<std::mutex> lock(this->removerMutex);
+    const bool wasEmpty = this->pendingRemovals.empty();
+    std::unordered_set<std::string> &removing =
+        this->removingMessages[toDeviceID];
+    const auto archived = this->archivedMessages.find(toDeviceID);
+    for (const std::string &messageID : messageIDs) {
+      // An ack that is sent again is removed once
+      if (removing.insert(messageID).second) {
+        const bool isArchived = archived != this->archivedMessages.end() &&
+            archived->second.erase(messageID);
+        this->pendingRemovals.push_back(
+            PendingRemoval{toDeviceID, messageID, isArchived, 0});
+      }
+    }
+    if (removing.empty()) {
+      this->removingMessages.erase(toDeviceID);
+    }
+    if (archived != this->archivedMessages.end() && archived->second.empty()) {
+      this->archivedMessages.erase(archived);
+    }
+    // The flush thread waits for the first message, and then for a full
+    // batch
+    wakeUp = (wasEmpty && !this->pendingRemovals.empty()) ||
+        this->pendingRemovals.size() >= this->batchSize;
+    overCapacity = this->pendingRemovals.size() >= this->capacity;
+  }
+  if (overCapacity) {
+    this->flushBatches(false);
+  } else if (wakeUp) {
+    this->pendingCondition.notify_one();
+  }
+}
+
+bool MessageRemover::isRemoving(
+    const std::string &toDeviceID,
+    const std::string &messageID) {
+  const std::lock_guard<std::mutex> lock(this->removerMutex);
+  const auto removing = this->removingMessages.find(toDeviceID);
+  return removing != this->removingMessages.end() &&
+      removing->second.count(messageID);
+}
+
+void MessageRemover::trackArchived(
+    const std::string &toDeviceID,
+    const std::vector<std::string> &messageIDs) {
+  if (messageIDs.empty()) {
+    return;
+  }
+  const std::lock_guard<std::mutex> lock(this->removerMutex);
+  this->archivedMessages[toDeviceID].insert(
+      messageIDs.begin(), messageIDs.end());
+}
+
+void MessageRemover::forgetArchived(const std::string &toDeviceID) {
+  const std::lock_guard<std::mutex> lock(this->removerMutex);
+  this->archivedMessages.erase(toDeviceID);
+}
+
+bool MessageRemover::flush() {
+  return this->flushBatches(false);
+}
+
+size_t MessageRemover::getPendingCount() {
+  const std::lock_guard<std::mutex> lock(this->removerMutex);
+  return this->pendingRemovals.size();
+}
+
+bool MessageRemover::flushBatches(bool fullBatchesOnly) {
+  while (true) {
+    std::vector<PendingRemoval> batch;
+    {
+      const std::lock_guard<std::mutex> lock(this->removerMutex);
+      const size_t pendingCount = this->pendingRemovals.size();
+      if (!pendingCount ||
+          (fullBatchesOnly && pendingCount < this->batchSize)) {
+        return true;
+      }
+      const size_t count = std::min(pendingCount, this->batchSize);
+      batch.reserve(count);
+      std::move(
+          this->pendingRemovals.begin(),
+          this->pendingRemovals.begin() + count,
+          std::back_inserter(batch));
+      this->pendingRemovals.erase(
+          this->pendingRemovals.begin(),
+          this->pendingRemovals.begin() + count);
+    }
+    std::vector<std::pair<std::string, std::string>> messageKeys;
+    std::vector<std::pair<std::string, std::string>> archivedMessageKeys;
+    messageKeys.reserve(batch.size());
+    for (const PendingRemoval &removal : batch) {
+      (removal.archived ? archivedMessageKeys : messageKeys)
+          .emplace_back(removal.toDeviceID, removal.messageID);
+    }
+    try {
+      this->removeMessages(messageKeys, archivedMessageKeys);
+    } catch (const std::exception &e) {
+      LOG(ERROR) << "Error removing " << batch.size()
+                 << " acknowledged messages: " << e.what();
+      size_t dropped = 0;
+      {
+        const std::lock_guard<std::mutex> lock(this->removerMutex);
+        for (PendingRemoval &removal : batch) {
+          if (++removal.attempts < this->maxAttempts) {
+            this->pendingRemovals.push_back(std::move(removal));
+          } else {
+            this->forget(removal);
+            dropped++;
+          }
+        }
+      }
+      this->failed->increment(dropped);
+      return false;
+    }
+    {
+      const std::lock_guard<std::mutex> lock(this->removerMutex);
+      for (const PendingRemoval &removal : batch) {
+        this->forget(removal);
+      }
+    }
+    this->removed->increment(batch.size());
+  }
+}
+
+void MessageRemover::forget(const PendingRemoval &removal) {
+  const auto removing = this->removingMessages.find(removal.toDeviceID);
+  if (removing == this->removingMessages.end()) {
+    return;
+  }
+  removing->second.erase(removal.messageID);
+  if (removing->second.empty()) {
+    this->removingMessages.erase(removing);
+  }
+}
+
+void MessageRemover::runFlushThread() {
+  std::unique_lock<std::mutex> lock(this->removerMutex);
+  while (true) {
+    this->pendingCondition.wait(
+        lock, [this]() { return !this->pendingRemovals.empty(); });
+    // A full batch is removed at once, the rest waits for more messages up
+    // to the interval
+    const bool batchFull = this->pendingCondition.wait_for(
+        lock, this->flushInterval, [this]() {
+          return this->pendingRemovals.size() >= this->batchSize;
+        });
+    lock.unlock();
+    if (!this->flushBatches(batchFull)) {
+      // The failed batches are attempted again after the interval
+      std::this_thread::sleep_for(this->flushInterval);
+    }
+    lock.lock();
+  }
+}
+
+} // namespace database
+} // namespace network
+} // namespace comm
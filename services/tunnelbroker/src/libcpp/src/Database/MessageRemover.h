@@ -0,0 +1,111 @@
+#pragma once
+
+#include "Metrics.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace comm {
+namespace network {
+namespace database {
+
+// Removes the messages that the devices have acknowledged on a thread of the
+// remover, so that an ack doesn't wait for DynamoDB. The messages of all the
+// devices are collected and removed in batches of batchSize, as soon as a
+// batch is full or at the latest after the flush interval. A batch that
+// fails is attempted again with the next flush, up to maxAttempts times,
+// then its messages are left to expire. Reads of the messages of a device
+// skip the ones that are still waiting to be removed.
+// Only the messages that were read from the cold table, see trackArchived,
+// are removed from it, so that the acks don't write to the cold table.
+class MessageRemover {
+public:
+  // - argument messageKeys - pairs of a toDeviceID and a messageID, throws if
+  // they can't be removed
+  // - argument archivedMessageKeys - the same for the messages that were read
+  // from the cold table
+  using RemoveFunction = std::function<void(
+      const std::vector<std::pair<std::string, std::string>> &messageKeys,
+      const std::vector<std::pair<std::string, std::string>>
+          &archivedMessageKeys)>;
+
+private:
+  struct PendingRemoval {
+    std::string toDeviceID;
+    std::string messageID;
+    bool archived;
+    size_t attempts;
+  };
+
+  const RemoveFunction removeMessages;
+  const std::chrono::milliseconds flushInterval;
+  const size_t batchSize;
+  const size_t maxAttempts;
+  const size_t capacity;
+  std::mutex removerMutex;
+  std::condition_variable pendingCondition;
+  std::deque<PendingRemoval> pendingRemovals;
+  // The messages of every device that are pending or being removed
+  std::unordered_map<std::string, std::unordered_set<std::string>>
+      removingMessages;
+  // The messages of every device that were read from the cold table and
+  // aren't acknowledged yet
+  std::unordered_map<std::string, std::unordered_set<std::string>>
+      archivedMessages;
+  metrics::Counter *removed;
+  metrics::Counter *failed;
+  std::once_flag flushThreadStarted;
+
+  void runFlushThread();
+  // Returns false if a batch failed
+  bool flushBatches(bool fullBatchesOnly);
+  // Has to be called with the removerMutex locked
+  void forget(const PendingRemoval &removal);
+
+public:
+  static MessageRemover &getInstance();
+
+  MessageRemover(
+      RemoveFunction removeMessages,
+      std::chrono::milliseconds flushInterval,
+      size_t batchSize,
+      size_t maxAttempts,
+      size_t capacity);
+
+  // Returns at once, unless the remover has capacity messages pending, then
+  // it removes them before it returns. With a zero interval the caller has
+  // to flush.
+  void remove(
+      const std::string &toDeviceID,
+      const std::vector<std::string> &messageIDs);
+  bool isRemoving(const std::string &toDeviceID, const std::string &messageID);
+  // The acks of these messages remove them from the cold table. A message
+  // that was archived after it was read from the messages table stays in
+  // the cold table, and is tracked when it is read from there on the next
+  // connection.
+  void trackArchived(
+      const std::string &toDeviceID,
+      const std::vector<std::string> &messageIDs);
+  // Called when the stream of the device ends, its messages that weren't
+  // acknowledged are read from the cold table again on the next connection
+  void forgetArchived(const std::string &toDeviceID);
+  // Removes all the pending messages, returns false if a batch failed
+  bool flush();
+  size_t getPendingCount();
+
+  MessageRemover(MessageRemover const &) = delete;
+  void operator=(MessageRemover const &) = delete;
+};
+
+} // namespace database
+} // namespace network
+} // namespace comm
@@ -0,0 +1,144 @@
+#include "PresenceTracker.h"
+#include "Constants.h"
+#include "DatabaseManager.h"
+
+#include <glog/logging.h>
+
+#include <thread>
+#include <vector>
+
+namespace comm {
+namespace network {
+namespace database {
+
+PresenceTracker &PresenceTracker::getInstance() {
+  static PresenceTracker instance(
+      [](const std::string &sessionID, bool isOnline, Callback callback) {
+        DatabaseManager::getInstance().updateSessionItemIsOnlineAsync(
+            sessionID, isOnline, callback);
+      },
+      std::chrono::milliseconds(PRESENCE_FLUSH_INTERVAL_MS),
+      PRESENCE_STORED_STATES_SIZE,
+      std::chrono::milliseconds(PRESENCE_STORED_STATES_TTL_MS));
+  return instance;
+}
+
+PresenceTracker::PresenceTracker(
+    StoreFunction store,
+    std::chrono::milliseconds flushInterval,
+    size_t storedStatesSize,
+    std::chrono::milliseconds storedStatesTTL)
+    : store(std::move(store)),
+      flushInterval(flushInterval),
+      storedStates(storedStatesSize, storedStatesTTL) {
+}
+
+void PresenceTracker::update(const std::string &sessionID, bool isOnline) {
+  if (this->flushInterval.count() > 0) {
+    std::call_once(this->flushThreadStarted, [this]() {
+      std::thread flushThread([this]() { this->runFlushThread(); });
+      flushThread.detach();
+    });
+  }
+  {
+    const std::lock_guard<std::mutex> lock(this->trackerMutex);
+    const std::shared_ptr<bool> stored = this->storedStates.get(sessionID);
+    if (stored != nullptr && *stored == isOnline) {
+      // Changed back to the stored state before the change was written
+      this->pendingStates.erase(sessionID);
+      return;
+    }
+    this->pendingStates[sessionID] = isOnline;
+  }
+  this->pendingCondition.notify_one();
+}
+
+std::optional<bool> PresenceTracker::get(const std::string &sessionID) {
+  const std::lock_guard<std::mutex> lock(this->trackerMutex);
+  const auto pending = this->pendingStates.find(sessionID);
+  if (pending != this->pendingStates.end()) {
+    return pending->second;
+  }
+  const auto inFlight = this->inFlightStates.find(sessionID);
+  if (inFlight != this->inFlightStates.end()) {
+    return inFlight->second;
+  }
+  const std::shared_ptr<bool> stored = this->storedStates.get(sessionID);
+  if (stored != nullptr) {
+    return *stored;
+  }
+  return std::nullopt;
+}
+
+void PresenceTracker::flush() {
+  std::vector<std::pair<std::string, bool>> states;
+  {
+    const std::lock_guard<std::mutex> lock(this->trackerMutex);
+    for (auto it = this->pendingStates.begin();
+         it != this->pendingStates.end();) {
+      // Waits for the write in flight, the next flush writes the state
+      if (this->inFlightStates.count(it->first)) {
+        it++;
+        continue;
+      }
+      // What is stored is unknown until the write completes
+      this->storedStates.invalidate(it->first);
+      this->inFlightStates[it->first] = it->second;
+      states.push_back(*it);
+      it = this->pendingStates.erase(it);
+    }
+  }
+  for (const auto &[sessionID, isOnline] : states) {
+    this->store(
+        sessionID,
+        isOnline,
+        [this, sessionID = sessionID, isOnline = isOnline](
+            std::unique_ptr<std::string> error) {
+          this->onStored(sessionID, isOnline, std::move(error));
+        });
+  }
+}
+
+void PresenceTracker::onStored(
+    const std::string &sessionID,
+    bool isOnline,
+    std::unique_ptr<std::string> error) {
+  bool pending;
+  {
+    const std::lock_guard<std::mutex> lock(this->trackerMutex);
+    this->inFlightStates.erase(sessionID);
+    if (error == nullptr) {
+      this->storedStates.put(sessionID, isOnline);
+    }
+    const auto newer = this->pendingStates.find(sessionID);
+    pending = newer != this->pendingStates.end();
+    if (pending && error == nullptr && newer->second == isOnline) {
+      this->pendingStates.erase(newer);
+      pending = false;
+    }
+  }
+  if (error != nullptr) {
+    LOG(ERROR) << "Error updating device online status of session "
+               << sessionID << ": " << *error;
+  }
+  if (pending) {
+    this->pendingCondition.notify_one();
+  }
+}
+
+void PresenceTracker::runFlushThread() {
+  std::unique_lock<std::mutex> lock(this->trackerMutex);
+  while (true) {
+    this->pendingCondition.wait(
+        lock, [this]() { return !this->pendingStates.empty(); });
+    // The changes that come in meanwhile are written together
+    lock.unlock();
+    std::this_thread::sleep_for(this->flushInterval);
+    this->flush();
+    lock.lock();
+  }
+}
+
+} // namespace database
+} // namespace network
+} // namespace comm
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "DatabaseManagerBase.h"
+#include "ItemCache.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+namespace comm {
+namespace network {
+namespace database {
+
+// Online states of the sessions, written to the database at most once per
+// flush interval. Clients that connect and disconnect over and over in the
+// interval only cost the write of their last state, and none if it is the
+// state that is already stored.
+//
+// A session is served by one instance, so the states it has written are
+// known up to the TTL of the cache. Only one write of a session is in flight
+// at a time, so that the writes can't be reordered.
+class PresenceTracker {
+public:
+  using StoreFunction = std::function<void(
+      const std::string &sessionID,
+      bool isOnline,
+      Callback callback)>;
+
+private:
+  const StoreFunction store;
+  const std::chrono::milliseconds flushInterval;
+  std::mutex trackerMutex;
+  std::condition_variable pendingCondition;
+  // Latest states that haven't been written yet
+  std::unordered_map<std::string, bool> pendingStates;
+  std::unordered_map<std::string, bool> inFlightStates;
+  ItemCache<bool> storedStates;
+  std::once_flag flushThreadStarted;
+
+  void runFlushThread();
+  void onStored(
+      const std::string &sessionID,
+      bool isOnline,
+      std::unique_ptr<std::string> error);
+
+public:
+  static PresenceTracker &getInstance();
+
+  PresenceTracker(
+      StoreFunction store,
+      std::chrono::milliseconds flushInterval,
+      size_t storedStatesSize,
+      std::chrono::milliseconds storedStatesTTL);
+
+  // Writes the state with the next flush, which happens on a thread of the
+  // tracker within the flush interval. With a zero interval the caller has
+  // to flush.
+  void update(const std::string &sessionID, bool isOnline);
+  // The last state of the session, if it is known without reading the
+  // database
+  std::optional<bool> get(const std::string &sessionID);
+  // Starts writing the pending states
+  void flush();
+
+  PresenceTracker(PresenceTracker const &) = delete;
+  void operator=(PresenceTracker const &) = delete;
+};
+
+} // namespace database
+} // namespace network
+} // namespace comm
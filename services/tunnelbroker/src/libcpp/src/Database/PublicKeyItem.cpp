@@ -29,8 +29,10 @@ void PublicKeyItem::validate() const {
 
 void PublicKeyItem::assignItemFromDatabase(const AttributeValues &itemFromDB) {
   try {
-    this->publicKey = itemFromDB.at(PublicKeyItem::FIELD_PUBLIC_KEY).GetS();
-    this->deviceID = itemFromDB.at(PublicKeyItem::FIELD_DEVICE_ID).GetS();
+    this->publicKey =
+        getStringAttribute(itemFromDB, PublicKeyItem::FIELD_PUBLIC_KEY);
+    this->deviceID =
+        getStringAttribute(itemFromDB, PublicKeyItem::FIELD_DEVICE_ID);
   } catch (const std::exception &e) {
     throw std::runtime_error(
         "Got an exception at PublicKeyItem: " + std::string(e.what()));
@@ -39,8 +41,9 @@ void PublicKeyItem::assignItemFromDatabase(const AttributeValues &itemFromDB) {
 }
 
 std::string PublicKeyItem::getTableName() const {
-  return config::ConfigManager::getInstance().getParameter(
-      config::ConfigManager::OPTION_DYNAMODB_SESSIONS_PUBLIC_KEY_TABLE);
+  return config::ConfigManager::getInstance()
+      .getSnapshot()
+      .dynamoDBSessionsPublicKeyTable;
 }
 
 PrimaryKeyDescriptor PublicKeyItem::getPrimaryKeyDescriptor() const {
@@ -32,9 +32,10 @@ void SessionSignItem::validate() const {
 void SessionSignItem::assignItemFromDatabase(
     const AttributeValues &itemFromDB) {
   try {
-    this->sign =
-        itemFromDB.at(SessionSignItem::FIELD_SESSION_VERIFICATION).GetS();
-    this->deviceID = itemFromDB.at(SessionSignItem::FIELD_DEVICE_ID).GetS();
+    this->sign = getStringAttribute(
+        itemFromDB, SessionSignItem::FIELD_SESSION_VERIFICATION);
+    this->deviceID =
+        getStringAttribute(itemFromDB, SessionSignItem::FIELD_DEVICE_ID);
   } catch (const std::exception &e) {
     throw std::runtime_error(
         "Got an exception at SessionSignItem: " + std::string(e.what()));
@@ -43,8 +44,9 @@ void SessionSignItem::assignItemFromDatabase(
 }
 
 std::string SessionSignItem::getTableName() const {
-  return config::ConfigManager::getInstance().getParameter(
-      config::ConfigManager::OPTION_DYNAMODB_SESSIONS_VERIFICATION_TABLE);
+  return config::ConfigManager::getInstance()
+      .getSnapshot()
+      .dynamoDBSessionsVerificationTable;
 }
 
 PrimaryKeyDescriptor SessionSignItem::getPrimaryKeyDescriptor() const {
@@ -1,59 +1,193 @@
 #include "DeliveryBroker.h"
+#include "AllocationTracker.h"
+#include "AmqpManager.h"
+#include "GlobalConstants.h"
+#include "GlobalTools.h"
+#include "Logging.h"
+#include "Metrics.h"
 
 #include <glog/logging.h>
 
+#include <algorithm>
+
 namespace comm {
 namespace network {
 
+DeliveryBroker::DeliveryBroker() {
+  metrics::MetricsRegistry &registry = metrics::MetricsRegistry::getInstance();
+  registry.registerGaugeFunction(
+      "comm_delivery_broker_queues", "Device queues", "", [this]() {
+        return static_cast<double>(this->getQueuesCount());
+      });
+  registry.registerGaugeFunction(
+      "comm_delivery_broker_queued_messages",
+      "Messages waiting in the device queues",
+      "",
+      [this]() {
+        size_t maxDepth;
+        DeliveryBrokerQueueStats stats = this->getTotalQueueStats(maxDepth);
+        return static_cast<double>(stats.queued + stats.overflowed);
+      });
+  registry.registerGaugeFunction(
+      "comm_delivery_broker_max_queue_depth",
+      "Messages waiting in the longest device queue",
+      "",
+      [this]() {
+        size_t maxDepth;
+        this->getTotalQueueStats(maxDepth);
+        return static_cast<double>(maxDepth);
+      });
+  registry.registerCounterFunction(
+      "comm_delivery_broker_overflowed_messages_total",
+      "Messages that didn't fit in their queue and waited in its overflow",
+      "",
+      [this]() { return static_cast<double>(this->getOverflowedTotal()); });
+  registry.registerCounterFunction(
+      "comm_delivery_broker_dropped_messages_total",
+      "Messages that were only left for delivery from the database",
+      "",
+      [this]() { return static_cast<double>(this->getDroppedTotal()); });
+  registry.registerCounterFunction(
+      "comm_delivery_broker_duplicate_messages_total",
+      "Copies of the messages that were already delivered from the database",
+      "",
+      [this]() { return static_cast<double>(this->getDuplicatesTotal()); });
+}
+
 DeliveryBroker &DeliveryBroker::getInstance() {
   static DeliveryBroker instance;
   return instance;
 };
 
-void DeliveryBroker::push(
+std::shared_ptr<DeliveryBrokerDeviceQueue>
+DeliveryBroker::getOrCreateQueue(const std::string &deviceID) {
+  auto deviceQueueIterator = this->messagesMap.find(deviceID);
+  if (deviceQueueIterator != this->messagesMap.end()) {
+    return deviceQueueIterator->second;
+  }
+  // Returns the queue that is already there if somebody has just inserted it
+  return this->messagesMap
+      .insert(deviceID, std::make_shared<DeliveryBrokerDeviceQueue>())
+      .first->second;
+}
+
+void DeliveryBroker::evictIdleQueuesPeriodically() {
+  const uint64_t now = tools::getCurrentTimestamp();
+  uint64_t lastEviction = this->lastEvictionTimestamp;
+  if (now < lastEviction + DELIVERY_BROKER_EVICTION_INTERVAL_MS ||
+      !this->lastEvictionTimestamp.compare_exchange_strong(
+          lastEviction, now)) {
+    return;
+  }
+  const size_t evictedCount = this->evictIdleQueues(
+      DELIVERY_BROKER_IDLE_QUEUE_TTL_MS, DELIVERY_BROKER_IDLE_QUEUE_TTL_MS);
+  if (evictedCount) {
+    LOG(INFO) << "DeliveryBroker: Evicted " << evictedCount
+              << " idle device queues";
+  }
+}
+
+bool DeliveryBroker::isDelivered(
+    const std::string &deviceID,
+    const std::string &messageID) {
+  auto deliveredIterator = this->deliveredMap.find(deviceID);
+  if (deliveredIterator == this->deliveredMap.end()) {
+    return false;
+  }
+  DeliveredMessages &delivered = *deliveredIterator->second;
+  const std::lock_guard<std::mutex> lock(delivered.mutex);
+  return delivered.expirationTimestamp > tools::getCurrentTimestamp() &&
+      delivered.ids.count(messageID);
+}
+
+DeliveryBrokerPushResult DeliveryBroker::push(
     const std::string messageID,
     const uint64_t deliveryTag,
     const std::string toDeviceID,
     const std::string fromDeviceID,
-    const std::string payload) {
+    const std::string payload,
+    const std::string traceContext,
+    const DeliveryBrokerPriority priority,
+    const std::string blobHashes) {
+  const allocation::ScopedAllocationTag allocationTag(
+      allocation::AllocationTag::DELIVERY_BROKER);
   try {
-    if (this->messagesMap.find(toDeviceID) == this->messagesMap.end()) {
-      this->messagesMap.insert(
-          toDeviceID,
-          std::make_unique<DeliveryBrokerQueue>(
-              DELIVERY_BROKER_MAX_QUEUE_SIZE));
+    if (this->isDelivered(toDeviceID, messageID)) {
+      this->duplicatesTotal++;
+      return DeliveryBrokerPushResult::DUPLICATE;
+    }
+    DeliveryBrokerMessage message{
+        .messageID = messageID,
+        .deliveryTag = deliveryTag,
+        .fromDeviceID = fromDeviceID,
+        .payload = payload,
+        .blobHashes = blobHashes,
+        .traceContext = traceContext,
+        .priority = priority};
+    if (!traceContext.empty()) {
+      message.queuedAt = std::chrono::system_clock::now();
+    }
+    DeliveryBrokerPushResult result;
+    auto listenerIterator = this->listenersMap.find(toDeviceID);
+    std::shared_ptr<Listener> listener;
+    if (listenerIterator != this->listenersMap.end()) {
+      listener = listenerIterator->second;
+    }
+    // A queue is closed right before it is removed from the map, so the next
+    // lookup gets a new one
+    while (!this->getOrCreateQueue(toDeviceID)
+                ->push(std::move(message), listener != nullptr, result)) {
+    }
+    // A dropped message wakes up the consumer too, so that it reads it from
+    // the database once it has drained the queue
+    if (listener != nullptr) {
+      listener->callback();
+    }
+    if (result == DeliveryBrokerPushResult::OVERFLOWED) {
+      this->overflowedTotal++;
+    } else if (result == DeliveryBrokerPushResult::DROPPED) {
+      this->droppedTotal++;
+      LOG_EVERY_MS(WARNING, LOGGING_REPEATED_LINE_INTERVAL_MS)
+          << "DeliveryBroker push: "
+          << "Queue of device " << toDeviceID
+          << " is full, the message " << messageID
+          << " is left for the delivery from the database";
     }
-    this->messagesMap.find(toDeviceID)
-        ->second->blockingWrite(DeliveryBrokerMessage{
-            .messageID = messageID,
-            .deliveryTag = deliveryTag,
-            .fromDeviceID = fromDeviceID,
-            .payload = payload});
+    return result;
   } catch (const std::exception &e) {
     LOG(ERROR) << "DeliveryBroker push: "
                << "Got an exception " << e.what();
   }
+  return DeliveryBrokerPushResult::DROPPED;
 };
 
 bool DeliveryBroker::isEmpty(const std::string deviceID) {
-  if (this->messagesMap.find(deviceID) == this->messagesMap.end()) {
+  auto deviceQueueIterator = this->messagesMap.find(deviceID);
+  if (deviceQueueIterator == this->messagesMap.end()) {
     return true;
   };
-  return this->messagesMap.find(deviceID)->second->isEmpty();
+  return deviceQueueIterator->second->isEmpty();
 };
 
+bool DeliveryBroker::takeResync(const std::string deviceID) {
+  auto deviceQueueIterator = this->messagesMap.find(deviceID);
+  if (deviceQueueIterator == this->messagesMap.end()) {
+    return false;
+  }
+  return deviceQueueIterator->second->takeResync();
+}
+
 DeliveryBrokerMessage DeliveryBroker::pop(const std::string deviceID) {
+  const allocation::ScopedAllocationTag allocationTag(
+      allocation::AllocationTag::DELIVERY_BROKER);
   try {
+    this->evictIdleQueuesPeriodically();
     // If we don't already have a queue, insert it for the blocking read purpose
-    // in case we listen first before the insert happens.
-    if (this->messagesMap.find(deviceID) == this->messagesMap.end()) {
-      this->messagesMap.insert(
-          deviceID,
-          std::make_unique<DeliveryBrokerQueue>(
-              DELIVERY_BROKER_MAX_QUEUE_SIZE));
-    }
+    // in case we listen first before the insert happens. If the queue is
+    // erased while we wait, we wait on the one that replaces it.
     DeliveryBrokerMessage receievedMessage;
-    this->messagesMap.find(deviceID)->second->blockingRead(receievedMessage);
+    while (!this->getOrCreateQueue(deviceID)->pop(receievedMessage)) {
+    }
     return receievedMessage;
   } catch (const std::exception &e) {
     LOG(ERROR) << "DeliveryBroker pop: "
@@ -62,15 +196,229 @@ DeliveryBrokerMessage DeliveryBroker::pop(const std::string deviceID) {
   return {};
 };
 
+std::vector<DeliveryBrokerMessage> DeliveryBroker::popBatch(
+    const std::string deviceID,
+    size_t maxCount,
+    std::chrono::milliseconds maxWait) {
+  const allocation::ScopedAllocationTag allocationTag(
+      allocation::AllocationTag::DELIVERY_BROKER);
+  std::vector<DeliveryBrokerMessage> messages;
+  try {
+    this->evictIdleQueuesPeriodically();
+    const std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + maxWait;
+    // If the queue is erased while we wait, we wait on the one that replaces
+    // it until the same deadline
+    while (!this->getOrCreateQueue(deviceID)->popBatch(
+        messages, maxCount, deadline)) {
+    }
+  } catch (const std::exception &e) {
+    LOG(ERROR) << "DeliveryBroker popBatch: "
+               << "Got an exception " << e.what();
+  }
+  return messages;
+}
+
+std::vector<DeliveryBrokerMessage>
+DeliveryBroker::takeMessages(const std::string deviceID, size_t maxCount) {
+  return this->popBatch(deviceID, maxCount, std::chrono::milliseconds(0));
+}
+
+uint64_t DeliveryBroker::addListener(
+    const std::string deviceID,
+    std::function<void()> callback) {
+  const uint64_t listenerID = ++this->lastListenerID;
+  this->listenersMap.insert_or_assign(
+      deviceID,
+      std::make_shared<Listener>(Listener{listenerID, std::move(callback)}));
+  return listenerID;
+}
+
+void DeliveryBroker::removeListener(
+    const std::string deviceID,
+    uint64_t listenerID) {
+  auto listenerIterator = this->listenersMap.find(deviceID);
+  if (listenerIterator == this->listenersMap.end() ||
+      listenerIterator->second->listenerID != listenerID) {
+    return;
+  }
+  this->listenersMap.erase_if_equal(deviceID, listenerIterator->second);
+}
+
 void DeliveryBroker::erase(const std::string deviceID) {
-  this->messagesMap.erase(deviceID);
+  const allocation::ScopedAllocationTag allocationTag(
+      allocation::AllocationTag::DELIVERY_BROKER);
+  auto deviceQueueIterator = this->messagesMap.find(deviceID);
+  if (deviceQueueIterator == this->messagesMap.end()) {
+    return;
+  }
+  std::shared_ptr<DeliveryBrokerDeviceQueue> deviceQueue =
+      deviceQueueIterator->second;
+  deviceQueue->close();
+  this->messagesMap.erase_if_equal(deviceID, deviceQueue);
 };
 
+void DeliveryBroker::markDelivered(
+    const std::string deviceID,
+    const std::vector<std::string> &messageIDs) {
+  const allocation::ScopedAllocationTag allocationTag(
+      allocation::AllocationTag::DELIVERY_BROKER);
+  if (messageIDs.empty()) {
+    return;
+  }
+  auto deliveredIterator = this->deliveredMap.find(deviceID);
+  std::shared_ptr<DeliveredMessages> delivered =
+      deliveredIterator != this->deliveredMap.end()
+      ? deliveredIterator->second
+      : this->deliveredMap
+            .insert(deviceID, std::make_shared<DeliveredMessages>())
+            .first->second;
+  const std::lock_guard<std::mutex> lock(delivered->mutex);
+  for (const std::string &messageID : messageIDs) {
+    if (delivered->ids.insert(messageID).second) {
+      delivered->order.push_back(messageID);
+    }
+  }
+  while (delivered->order.size() > DELIVERY_BROKER_DELIVERED_IDS_SIZE) {
+    delivered->ids.erase(delivered->order.front());
+    delivered->order.pop_front();
+  }
+  delivered->expirationTimestamp =
+      tools::getCurrentTimestamp() + DELIVERY_BROKER_DELIVERED_IDS_TTL_MS;
+}
+
+std::vector<uint64_t> DeliveryBroker::removeDelivered(
+    const std::string deviceID,
+    std::vector<DeliveryBrokerMessage> &messages) {
+  const allocation::ScopedAllocationTag allocationTag(
+      allocation::AllocationTag::DELIVERY_BROKER);
+  std::vector<uint64_t> deliveryTags;
+  if (this->deliveredMap.find(deviceID) == this->deliveredMap.end()) {
+    return deliveryTags;
+  }
+  auto duplicates = std::stable_partition(
+      messages.begin(),
+      messages.end(),
+      [this, &deviceID](const DeliveryBrokerMessage &message) {
+        return !this->isDelivered(deviceID, message.messageID);
+      });
+  for (auto it = duplicates; it != messages.end(); it++) {
+    deliveryTags.push_back(it->deliveryTag);
+  }
+  this->duplicatesTotal += deliveryTags.size();
+  messages.erase(duplicates, messages.end());
+  return deliveryTags;
+}
+
 void DeliveryBroker::deleteQueueIfEmpty(const std::string clientDeviceID) {
-  if (DeliveryBroker::getInstance().isEmpty(clientDeviceID)) {
-    DeliveryBroker::getInstance().erase(clientDeviceID);
+  auto deviceQueueIterator = this->messagesMap.find(clientDeviceID);
+  if (deviceQueueIterator == this->messagesMap.end()) {
+    return;
+  }
+  std::shared_ptr<DeliveryBrokerDeviceQueue> deviceQueue =
+      deviceQueueIterator->second;
+  // A queue that somebody waits for isn't deleted, otherwise the consumer
+  // would miss the messages that go to the queue that replaces it
+  if (deviceQueue->closeIfIdle(0)) {
+    this->messagesMap.erase_if_equal(clientDeviceID, deviceQueue);
   }
 };
 
+size_t
+DeliveryBroker::evictIdleQueues(uint64_t idleTime, uint64_t abandonedTime) {
+  size_t evictedCount = 0;
+  size_t droppedCount = 0;
+  std::vector<uint64_t> droppedDeliveryTags;
+  for (auto deviceQueueIterator = this->messagesMap.begin();
+       deviceQueueIterator != this->messagesMap.end();
+       ++deviceQueueIterator) {
+    const std::shared_ptr<DeliveryBrokerDeviceQueue> &deviceQueue =
+        deviceQueueIterator->second;
+    bool evicted = deviceQueue->closeIfIdle(idleTime);
+    // A connected device takes its messages when its listener is called
+    if (!evicted &&
+        this->listenersMap.find(deviceQueueIterator->first) ==
+            this->listenersMap.end()) {
+      const size_t queueDroppedCount =
+          deviceQueue->closeIfAbandoned(abandonedTime, droppedDeliveryTags);
+      droppedCount += queueDroppedCount;
+      evicted = queueDroppedCount > 0;
+    }
+    if (evicted) {
+      this->messagesMap.erase_if_equal(
+          deviceQueueIterator->first, deviceQueue);
+      evictedCount++;
+    }
+  }
+  if (droppedCount) {
+    this->droppedTotal += droppedCount;
+    LOG(INFO) << "DeliveryBroker: Dropped " << droppedCount
+              << " messages from the queues without a consumer, they are "
+              << "left for the delivery from the database";
+  }
+  for (const uint64_t deliveryTag : droppedDeliveryTags) {
+    AmqpManager::getInstance().ack(deliveryTag);
+  }
+  const uint64_t now = tools::getCurrentTimestamp();
+  for (auto deliveredIterator = this->deliveredMap.begin();
+       deliveredIterator != this->deliveredMap.end();
+       ++deliveredIterator) {
+    std::unique_lock<std::mutex> lock(deliveredIterator->second->mutex);
+    const bool expired =
+        deliveredIterator->second->expirationTimestamp <= now;
+    lock.unlock();
+    if (expired) {
+      this->deliveredMap.erase_if_equal(
+          deliveredIterator->first, deliveredIterator->second);
+    }
+  }
+  return evictedCount;
+}
+
+DeliveryBrokerQueueStats
+DeliveryBroker::getQueueStats(const std::string deviceID) {
+  auto deviceQueueIterator = this->messagesMap.find(deviceID);
+  if (deviceQueueIterator == this->messagesMap.end()) {
+    return {};
+  }
+  DeliveryBrokerQueueStats stats = deviceQueueIterator->second->getStats();
+  stats.consumerLive = stats.consumerLive ||
+      this->listenersMap.find(deviceID) != this->listenersMap.end();
+  return stats;
+}
+
+size_t DeliveryBroker::getQueuesCount() {
+  return this->messagesMap.size();
+}
+
+uint64_t DeliveryBroker::getOverflowedTotal() const {
+  return this->overflowedTotal;
+}
+
+uint64_t DeliveryBroker::getDroppedTotal() const {
+  return this->droppedTotal;
+}
+
+uint64_t DeliveryBroker::getDuplicatesTotal() const {
+  return this->duplicatesTotal;
+}
+
+DeliveryBrokerQueueStats
+DeliveryBroker::getTotalQueueStats(size_t &maxDepth) {
+  DeliveryBrokerQueueStats total;
+  maxDepth = 0;
+  for (auto deviceQueueIterator = this->messagesMap.begin();
+       deviceQueueIterator != this->messagesMap.end();
+       ++deviceQueueIterator) {
+    DeliveryBrokerQueueStats stats = deviceQueueIterator->second->getStats();
+    total.queued += stats.queued;
+    total.overflowed += stats.overflowed;
+    maxDepth = std::max(maxDepth, stats.queued + stats.overflowed);
+  }
+  total.overflowedTotal = this->overflowedTotal;
+  total.droppedTotal = this->droppedTotal;
+  return total;
+}
+
 } // namespace network
 } // namespace comm
@@ -2,31 +2,141 @@
 
 #include "Constants.h"
 #include "DeliveryBrokerEntites.h"
+#include "DeliveryBrokerQueue.h"
 
 #include <folly/concurrency/ConcurrentHashMap.h>
 
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_set>
+#include <vector>
 
 namespace comm {
 namespace network {
 
+// push is called from the AMQP loop, so it never blocks. A device whose
+// queue is full keeps further messages in an overflow while its consumer is
+// live, otherwise they are dropped and only delivered from the database. A
+// live consumer whose overflow is full too is told by takeResync to read the
+// dropped messages from the database once it has drained its queue.
+//
+// Queues are created when they are first used and evicted once they have
+// been empty and without a consumer for DELIVERY_BROKER_IDLE_QUEUE_TTL_MS. A
+// queue whose messages nobody has taken for as long is evicted too, its
+// messages are dropped like the ones that don't fit.
+//
+// A consumer either blocks in pop, or registers a listener and takes the
+// messages with takeMessages whenever the listener is called, so it doesn't
+// need a thread of its own while it waits.
+//
+// A device that connects gets its backlog from the database, while copies of
+// the same messages may still be waiting in AMQP. The backlog is marked as
+// delivered, and the copies are acknowledged without being delivered again.
 class DeliveryBroker {
+  struct Listener {
+    uint64_t listenerID;
+    std::function<void()> callback;
+  };
 
-  folly::ConcurrentHashMap<std::string, std::unique_ptr<DeliveryBrokerQueue>>
+  // IDs of the messages that were delivered to a device from the database,
+  // the oldest first
+  struct DeliveredMessages {
+    std::mutex mutex;
+    std::deque<std::string> order;
+    std::unordered_set<std::string> ids;
+    uint64_t expirationTimestamp = 0;
+  };
+
+  folly::ConcurrentHashMap<
+      std::string,
+      std::shared_ptr<DeliveryBrokerDeviceQueue>>
       messagesMap;
+  std::atomic<uint64_t> overflowedTotal{0};
+  std::atomic<uint64_t> droppedTotal{0};
+  std::atomic<uint64_t> lastEvictionTimestamp{0};
+  folly::ConcurrentHashMap<std::string, std::shared_ptr<Listener>>
+      listenersMap;
+  std::atomic<uint64_t> lastListenerID{0};
+  folly::ConcurrentHashMap<std::string, std::shared_ptr<DeliveredMessages>>
+      deliveredMap;
+  std::atomic<uint64_t> duplicatesTotal{0};
+
+  // Registers the queue depths with the metrics
+  DeliveryBroker();
+  std::shared_ptr<DeliveryBrokerDeviceQueue>
+  getOrCreateQueue(const std::string &deviceID);
+  void evictIdleQueuesPeriodically();
+  bool isDelivered(const std::string &deviceID, const std::string &messageID);
 
 public:
   static DeliveryBroker &getInstance();
-  void push(
+  DeliveryBrokerPushResult push(
       const std::string messageID,
       const uint64_t deliveryTag,
       const std::string toDeviceID,
       const std::string fromDeviceID,
-      const std::string payload);
+      const std::string payload,
+      const std::string traceContext = "",
+      const DeliveryBrokerPriority priority =
+          DeliveryBrokerPriority::INTERACTIVE,
+      const std::string blobHashes = "");
   bool isEmpty(const std::string deviceID);
+  // Returns true once after messages for a live consumer were dropped and
+  // its queue has been drained since, the consumer then has to read the
+  // messages of the device from the database
+  bool takeResync(const std::string deviceID);
   DeliveryBrokerMessage pop(const std::string deviceID);
+  // Waits up to maxWait for a message, then returns the queued ones, at most
+  // maxCount, so that a backlog goes out in a single MessagesToDeliver
+  std::vector<DeliveryBrokerMessage> popBatch(
+      const std::string deviceID,
+      size_t maxCount,
+      std::chrono::milliseconds maxWait);
+  // Doesn't block, returns at most maxCount messages
+  std::vector<DeliveryBrokerMessage>
+  takeMessages(const std::string deviceID, size_t maxCount);
+  // The callback is called after messages are pushed for the device, it runs
+  // on an AMQP consumer shard so it should only wake up the consumer. A
+  // device has a single listener, a new one replaces the previous one.
+  // - returns listenerID - for removing the listener
+  uint64_t
+  addListener(const std::string deviceID, std::function<void()> callback);
+  // Does nothing if the listener has already been replaced
+  void removeListener(const std::string deviceID, uint64_t listenerID);
   void erase(const std::string deviceID);
+  // Copies of the messages that come in from AMQP afterwards are pushed as
+  // DUPLICATE, for DELIVERY_BROKER_DELIVERED_IDS_TTL_MS
+  void markDelivered(
+      const std::string deviceID,
+      const std::vector<std::string> &messageIDs);
+  // Takes the copies of the delivered messages out of messages, for the ones
+  // that were queued before they were marked
+  // - returns the delivery tags of the copies, for acknowledging them
+  std::vector<uint64_t> removeDelivered(
+      const std::string deviceID,
+      std::vector<DeliveryBrokerMessage> &messages);
   void deleteQueueIfEmpty(const std::string clientDeviceID);
+  // Evicts the empty queues that haven't been used for idleTime, and the ones
+  // without a listener whose messages haven't been taken for abandonedTime.
+  // The dropped messages are acknowledged in AMQP. Also forgets the expired
+  // delivered messages. Returns the number of evicted queues.
+  size_t evictIdleQueues(uint64_t idleTime, uint64_t abandonedTime);
+  DeliveryBrokerQueueStats getQueueStats(const std::string deviceID);
+  size_t getQueuesCount();
+  uint64_t getOverflowedTotal() const;
+  uint64_t getDroppedTotal() const;
+  uint64_t getDuplicatesTotal() const;
+  // Sums and the maximum of the queued and overflowed messages over all the
+  // queues, walks the whole map
+  DeliveryBrokerQueueStats getTotalQueueStats(size_t &maxDepth);
+
+  DeliveryBroker(DeliveryBroker const &) = delete;
+  void operator=(DeliveryBroker const &) = delete;
 };
 
 } // namespace network
@@ -1,22 +1,52 @@
 #pragma once
 
-#include <folly/MPMCQueue.h>
-
+#include <chrono>
+#include <cstdint>
 #include <string>
-#include <vector>
 
 namespace comm {
 namespace network {
 
+// Bulk messages, e.g. the ones of a sync, are delivered after the interactive
+// ones that wait for the same device
+enum class DeliveryBrokerPriority {
+  INTERACTIVE = 0,
+  BULK = 1,
+};
+
 struct DeliveryBrokerMessage {
   std::string messageID;
   uint64_t deliveryTag;
   std::string fromDeviceID;
   std::string payload;
-  std::vector<std::string> blobHashes;
+  // Same as the one of MessageItem, set if the payload is in the blob
+  // service
+  std::string blobHashes;
+  // The traceparent of a traced message, and when it was queued
+  std::string traceContext;
+  std::chrono::system_clock::time_point queuedAt;
+  DeliveryBrokerPriority priority = DeliveryBrokerPriority::INTERACTIVE;
 };
 
-typedef folly::MPMCQueue<DeliveryBrokerMessage> DeliveryBrokerQueue;
+enum class DeliveryBrokerPushResult {
+  QUEUED,
+  OVERFLOWED,
+  // The message is left for the delivery from the database, so it can be
+  // acknowledged in AMQP. A live consumer reads it from there once its queue
+  // is drained, see DeliveryBroker::takeResync.
+  DROPPED,
+  // A copy of a message that was already delivered from the database, it
+  // can be acknowledged in AMQP too
+  DUPLICATE,
+};
+
+struct DeliveryBrokerQueueStats {
+  size_t queued = 0;
+  size_t overflowed = 0;
+  uint64_t overflowedTotal = 0;
+  uint64_t droppedTotal = 0;
+  bool consumerLive = false;
+};
 
 } // namespace network
 } // namespace comm
@@ -0,0 +1,324 @@
+#include "DeliveryBrokerQueue.h"
+#include "GlobalTools.h"
+
+#include <algorithm>
+
+namespace comm {
+namespace network {
+
+DeliveryBrokerMessageSlab &DeliveryBrokerMessageSlab::getInstance() {
+  static DeliveryBrokerMessageSlab instance;
+  return instance;
+}
+
+DeliveryBrokerMessageNode *
+DeliveryBrokerMessageSlab::acquire(DeliveryBrokerMessage &&message) {
+  DeliveryBrokerMessageNode *node;
+  {
+    const std::lock_guard<std::mutex> lock(this->slabMutex);
+    if (this->freeNodes == nullptr) {
+      this->slabs.push_back(std::make_unique<DeliveryBrokerMessageNode[]>(
+          DELIVERY_BROKER_SLAB_SIZE));
+      DeliveryBrokerMessageNode *slab = this->slabs.back().get();
+      for (size_t i = 0; i < DELIVERY_BROKER_SLAB_SIZE; i++) {
+        slab[i].next = this->freeNodes;
+        this->freeNodes = &slab[i];
+      }
+    }
+    node = this->freeNodes;
+    this->freeNodes = node->next;
+  }
+  node->message = std::move(message);
+  node->next = nullptr;
+  return node;
+}
+
+void DeliveryBrokerMessageSlab::release(DeliveryBrokerMessageNode *node) {
+  // Released nodes don't keep the memory of the payloads
+  node->message = DeliveryBrokerMessage();
+  const std::lock_guard<std::mutex> lock(this->slabMutex);
+  node->next = this->freeNodes;
+  this->freeNodes = node;
+}
+
+size_t DeliveryBrokerMessageSlab::getSlabsCount() {
+  const std::lock_guard<std::mutex> lock(this->slabMutex);
+  return this->slabs.size();
+}
+
+DeliveryBrokerDeviceQueue::DeliveryBrokerDeviceQueue()
+    : createdTimestamp(tools::getCurrentTimestamp()),
+      lastActivityTimestamp(createdTimestamp) {
+}
+
+DeliveryBrokerDeviceQueue::~DeliveryBrokerDeviceQueue() {
+  this->clear();
+}
+
+size_t DeliveryBrokerDeviceQueue::size() const {
+  return this->inlineCount + this->nodesCount + this->bulkCount;
+}
+
+// The interactive messages are in the nodes only when the inline part is full
+bool DeliveryBrokerDeviceQueue::hasMessages() const {
+  return this->inlineCount > 0 || this->bulkHead != nullptr;
+}
+
+bool DeliveryBrokerDeviceQueue::isConsumerLive(uint64_t now) const {
+  return this->waitingConsumers ||
+      now < this->lastPopTimestamp + DELIVERY_BROKER_CONSUMER_LIVENESS_MS;
+}
+
+// Has to be called with queueMutex locked on a queue that isn't empty
+void DeliveryBrokerDeviceQueue::takeFront(DeliveryBrokerMessage &message) {
+  message = std::move(this->inlineMessages[this->inlineHead]);
+  this->inlineMessages[this->inlineHead] = DeliveryBrokerMessage();
+  this->inlineHead = (this->inlineHead + 1) % DELIVERY_BROKER_INLINE_QUEUE_SIZE;
+  this->inlineCount--;
+  if (this->nodesHead == nullptr) {
+    return;
+  }
+  // The oldest message from the nodes takes the free inline slot, so that the
+  // inline messages stay the oldest ones
+  DeliveryBrokerMessageNode *node = this->nodesHead;
+  this->nodesHead = node->next;
+  if (this->nodesHead == nullptr) {
+    this->nodesTail = nullptr;
+  }
+  this->nodesCount--;
+  this->inlineMessages
+      [(this->inlineHead + this->inlineCount) %
+       DELIVERY_BROKER_INLINE_QUEUE_SIZE] = std::move(node->message);
+  this->inlineCount++;
+  DeliveryBrokerMessageSlab::getInstance().release(node);
+}
+
+// Has to be called with queueMutex locked on a queue with bulk messages
+void DeliveryBrokerDeviceQueue::takeBulkFront(DeliveryBrokerMessage &message) {
+  DeliveryBrokerMessageNode *node = this->bulkHead;
+  this->bulkHead = node->next;
+  if (this->bulkHead == nullptr) {
+    this->bulkTail = nullptr;
+  }
+  this->bulkCount--;
+  message = std::move(node->message);
+  DeliveryBrokerMessageSlab::getInstance().release(node);
+}
+
+// Has to be called with queueMutex locked on a queue that isn't empty
+void DeliveryBrokerDeviceQueue::takeNext(DeliveryBrokerMessage &message) {
+  if (this->bulkHead != nullptr &&
+      (this->inlineCount == 0 ||
+       this->interactiveStreak >= DELIVERY_BROKER_INTERACTIVE_WEIGHT)) {
+    this->takeBulkFront(message);
+    this->interactiveStreak = 0;
+    return;
+  }
+  this->takeFront(message);
+  // Only counts while there are bulk messages that wait
+  this->interactiveStreak =
+      this->bulkHead != nullptr ? this->interactiveStreak + 1 : 0;
+}
+
+// Has to be called with queueMutex locked, or from the destructor
+void DeliveryBrokerDeviceQueue::clear() {
+  for (DeliveryBrokerMessageNode *head : {this->nodesHead, this->bulkHead}) {
+    while (head != nullptr) {
+      DeliveryBrokerMessageNode *node = head;
+      head = node->next;
+      DeliveryBrokerMessageSlab::getInstance().release(node);
+    }
+  }
+  this->nodesHead = nullptr;
+  this->nodesTail = nullptr;
+  this->nodesCount = 0;
+  this->bulkHead = nullptr;
+  this->bulkTail = nullptr;
+  this->bulkCount = 0;
+  this->interactiveStreak = 0;
+  this->inlineMessages.fill(DeliveryBrokerMessage());
+  this->inlineHead = 0;
+  this->inlineCount = 0;
+}
+
+// Has to be called with queueMutex locked
+void DeliveryBrokerDeviceQueue::recordPop() {
+  this->lastPopTimestamp = tools::getCurrentTimestamp();
+  this->lastActivityTimestamp = this->lastPopTimestamp;
+}
+
+bool DeliveryBrokerDeviceQueue::push(
+    DeliveryBrokerMessage &&message,
+    bool consumerListening,
+    DeliveryBrokerPushResult &result) {
+  const uint64_t now = tools::getCurrentTimestamp();
+  {
+    const std::lock_guard<std::mutex> lock(this->queueMutex);
+    if (this->closed) {
+      return false;
+    }
+    this->lastActivityTimestamp = now;
+    const size_t overflowCapacity =
+        DELIVERY_BROKER_MAX_QUEUE_SIZE + DELIVERY_BROKER_MAX_OVERFLOW_SIZE;
+    if (this->size() < DELIVERY_BROKER_MAX_QUEUE_SIZE) {
+      result = DeliveryBrokerPushResult::QUEUED;
+    } else if (
+        this->size() < overflowCapacity &&
+        (consumerListening || this->isConsumerLive(now))) {
+      result = DeliveryBrokerPushResult::OVERFLOWED;
+      this->overflowedTotal++;
+    } else {
+      result = DeliveryBrokerPushResult::DROPPED;
+      this->droppedTotal++;
+      this->resyncPending =
+          this->resyncPending || consumerListening || this->isConsumerLive(now);
+      return true;
+    }
+    if (message.priority == DeliveryBrokerPriority::BULK) {
+      DeliveryBrokerMessageNode *node =
+          DeliveryBrokerMessageSlab::getInstance().acquire(std::move(message));
+      if (this->bulkTail == nullptr) {
+        this->bulkHead = node;
+      } else {
+        this->bulkTail->next = node;
+      }
+      this->bulkTail = node;
+      this->bulkCount++;
+    } else if (
+        this->nodesHead == nullptr &&
+        this->inlineCount < DELIVERY_BROKER_INLINE_QUEUE_SIZE) {
+      this->inlineMessages
+          [(this->inlineHead + this->inlineCount) %
+           DELIVERY_BROKER_INLINE_QUEUE_SIZE] = std::move(message);
+      this->inlineCount++;
+    } else {
+      DeliveryBrokerMessageNode *node =
+          DeliveryBrokerMessageSlab::getInstance().acquire(std::move(message));
+      if (this->nodesTail == nullptr) {
+        this->nodesHead = node;
+      } else {
+        this->nodesTail->next = node;
+      }
+      this->nodesTail = node;
+      this->nodesCount++;
+    }
+  }
+  this->queueCondition.notify_one();
+  return true;
+}
+
+bool DeliveryBrokerDeviceQueue::pop(DeliveryBrokerMessage &message) {
+  std::unique_lock<std::mutex> lock(this->queueMutex);
+  this->waitingConsumers++;
+  this->queueCondition.wait(
+      lock, [this] { return this->closed || this->hasMessages(); });
+  this->waitingConsumers--;
+  if (this->closed) {
+    return false;
+  }
+  this->takeNext(message);
+  this->recordPop();
+  return true;
+}
+
+bool DeliveryBrokerDeviceQueue::popBatch(
+    std::vector<DeliveryBrokerMessage> &messages,
+    size_t maxCount,
+    std::chrono::steady_clock::time_point deadline) {
+  std::unique_lock<std::mutex> lock(this->queueMutex);
+  this->waitingConsumers++;
+  this->queueCondition.wait_until(
+      lock, deadline, [this] { return this->closed || this->hasMessages(); });
+  this->waitingConsumers--;
+  // Even a poll that finds nothing shows that the consumer is live
+  this->recordPop();
+  if (this->closed) {
+    return false;
+  }
+  while (messages.size() < maxCount && this->hasMessages()) {
+    messages.emplace_back();
+    this->takeNext(messages.back());
+  }
+  return true;
+}
+
+bool DeliveryBrokerDeviceQueue::isEmpty() {
+  const std::lock_guard<std::mutex> lock(this->queueMutex);
+  return this->size() == 0;
+}
+
+bool DeliveryBrokerDeviceQueue::takeResync() {
+  const std::lock_guard<std::mutex> lock(this->queueMutex);
+  if (!this->resyncPending || this->size() != 0) {
+    return false;
+  }
+  this->resyncPending = false;
+  return true;
+}
+
+DeliveryBrokerQueueStats DeliveryBrokerDeviceQueue::getStats() {
+  const std::lock_guard<std::mutex> lock(this->queueMutex);
+  DeliveryBrokerQueueStats stats;
+  stats.queued = std::min(this->size(), DELIVERY_BROKER_MAX_QUEUE_SIZE);
+  stats.overflowed = this->size() - stats.queued;
+  stats.overflowedTotal = this->overflowedTotal;
+  stats.droppedTotal = this->droppedTotal;
+  stats.consumerLive = this->isConsumerLive(tools::getCurrentTimestamp());
+  return stats;
+}
+
+void DeliveryBrokerDeviceQueue::close() {
+  {
+    const std::lock_guard<std::mutex> lock(this->queueMutex);
+    this->closed = true;
+    this->clear();
+  }
+  this->queueCondition.notify_all();
+}
+
+bool DeliveryBrokerDeviceQueue::closeIfIdle(uint64_t idleTime) {
+  const std::lock_guard<std::mutex> lock(this->queueMutex);
+  const uint64_t now = tools::getCurrentTimestamp();
+  if (this->closed || this->size() != 0 || this->waitingConsumers ||
+      now < this->lastActivityTimestamp + idleTime ||
+      (this->resyncPending && this->isConsumerLive(now))) {
+    return false;
+  }
+  this->closed = true;
+  return true;
+}
+
+size_t DeliveryBrokerDeviceQueue::closeIfAbandoned(
+    uint64_t idleTime,
+    std::vector<uint64_t> &deliveryTags) {
+  const std::lock_guard<std::mutex> lock(this->queueMutex);
+  const uint64_t now = tools::getCurrentTimestamp();
+  // Pushes don't count, a queue that keeps getting messages for a device
+  // that never connects would stay forever
+  const uint64_t lastConsumerTimestamp =
+      std::max(this->lastPopTimestamp, this->createdTimestamp);
+  if (this->closed || this->size() == 0 || this->waitingConsumers ||
+      now < lastConsumerTimestamp + idleTime) {
+    return 0;
+  }
+  const size_t droppedCount = this->size();
+  for (size_t i = 0; i < this->inlineCount; i++) {
+    deliveryTags.push_back(
+        this->inlineMessages[(this->inlineHead + i) %
+                             DELIVERY_BROKER_INLINE_QUEUE_SIZE]
+            .deliveryTag);
+  }
+  for (DeliveryBrokerMessageNode *head : {this->nodesHead, this->bulkHead}) {
+    for (DeliveryBrokerMessageNode *node = head; node != nullptr;
+         node = node->next) {
+      deliveryTags.push_back(node->message.deliveryTag);
+    }
+  }
+  this->droppedTotal += droppedCount;
+  this->closed = true;
+  this->clear();
+  return droppedCount;
+}
+
+} // namespace network
+} // namespace comm
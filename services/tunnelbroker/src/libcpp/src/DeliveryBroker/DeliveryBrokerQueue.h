@@ -0,0 +1,132 @@
+#pragma once
+
+#include "Constants.h"
+#include "DeliveryBrokerEntites.h"
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace comm {
+namespace network {
+
+struct DeliveryBrokerMessageNode {
+  DeliveryBrokerMessage message;
+  DeliveryBrokerMessageNode *next = nullptr;
+};
+
+// Nodes for the messages that don't fit in the inline part of the device
+// queues. They are allocated in slabs of DELIVERY_BROKER_SLAB_SIZE and kept
+// on a free list when they are released, so a burst to one device reuses the
+// memory that was left by the others.
+class DeliveryBrokerMessageSlab {
+  std::mutex slabMutex;
+  std::vector<std::unique_ptr<DeliveryBrokerMessageNode[]>> slabs;
+  DeliveryBrokerMessageNode *freeNodes = nullptr;
+
+public:
+  static DeliveryBrokerMessageSlab &getInstance();
+  DeliveryBrokerMessageNode *acquire(DeliveryBrokerMessage &&message);
+  void release(DeliveryBrokerMessageNode *node);
+  size_t getSlabsCount();
+};
+
+// Messages waiting for one device, in order. The first
+// DELIVERY_BROKER_INLINE_QUEUE_SIZE of them are stored in the queue itself,
+// the rest in nodes from DeliveryBrokerMessageSlab, so an idle device costs a
+// few hundred bytes instead of a preallocated buffer for the whole capacity.
+//
+// Bulk messages wait in a queue of their own, which always takes nodes as the
+// bulk messages come in bursts. The interactive ones are taken first, but
+// every DELIVERY_BROKER_INTERACTIVE_WEIGHT of them let a bulk one through.
+// Both count towards the capacity.
+//
+// The queue holds DELIVERY_BROKER_MAX_QUEUE_SIZE messages, and on top of that
+// DELIVERY_BROKER_MAX_OVERFLOW_SIZE while its consumer is live. A closed queue
+// isn't used anymore, callers should look it up in the broker again.
+class DeliveryBrokerDeviceQueue {
+  std::mutex queueMutex;
+  std::condition_variable queueCondition;
+  // Older than the messages in the nodes
+  std::array<DeliveryBrokerMessage, DELIVERY_BROKER_INLINE_QUEUE_SIZE>
+      inlineMessages;
+  size_t inlineHead = 0;
+  size_t inlineCount = 0;
+  DeliveryBrokerMessageNode *nodesHead = nullptr;
+  DeliveryBrokerMessageNode *nodesTail = nullptr;
+  size_t nodesCount = 0;
+  DeliveryBrokerMessageNode *bulkHead = nullptr;
+  DeliveryBrokerMessageNode *bulkTail = nullptr;
+  size_t bulkCount = 0;
+  // Interactive messages taken since the last bulk one
+  size_t interactiveStreak = 0;
+  size_t waitingConsumers = 0;
+  const uint64_t createdTimestamp;
+  uint64_t lastPopTimestamp = 0;
+  uint64_t lastActivityTimestamp;
+  uint64_t overflowedTotal = 0;
+  uint64_t droppedTotal = 0;
+  // Messages were dropped while the consumer was live, so it has to read
+  // them from the database once it has taken the rest
+  bool resyncPending = false;
+  bool closed = false;
+
+  size_t size() const;
+  bool hasMessages() const;
+  bool isConsumerLive(uint64_t now) const;
+  void takeFront(DeliveryBrokerMessage &message);
+  void takeBulkFront(DeliveryBrokerMessage &message);
+  void takeNext(DeliveryBrokerMessage &message);
+  void recordPop();
+  void clear();
+
+public:
+  DeliveryBrokerDeviceQueue();
+  ~DeliveryBrokerDeviceQueue();
+
+  DeliveryBrokerDeviceQueue(const DeliveryBrokerDeviceQueue &) = delete;
+  DeliveryBrokerDeviceQueue &
+  operator=(const DeliveryBrokerDeviceQueue &) = delete;
+
+  // Never blocks, returns false if the queue is closed
+  // - argument consumerListening - the consumer is notified about the new
+  // messages, so it is live even though it doesn't wait in pop
+  bool push(
+      DeliveryBrokerMessage &&message,
+      bool consumerListening,
+      DeliveryBrokerPushResult &result);
+  // Blocks until there is a message, returns false if the queue gets closed
+  bool pop(DeliveryBrokerMessage &message);
+  // Waits until deadline for the first message, then takes the messages that
+  // are queued, up to maxCount. Returns false if the queue gets closed.
+  bool popBatch(
+      std::vector<DeliveryBrokerMessage> &messages,
+      size_t maxCount,
+      std::chrono::steady_clock::time_point deadline);
+  bool isEmpty();
+  // Returns true once if messages were dropped while the consumer was live
+  // and the queue has been drained since
+  bool takeResync();
+  DeliveryBrokerQueueStats getStats();
+  // Closes the queue and wakes up its consumers
+  void close();
+  // Closes the queue if it is empty, nobody waits for it and it hasn't been
+  // used for idleTime. A queue whose live consumer still has to read the
+  // dropped messages from the database stays open.
+  bool closeIfIdle(uint64_t idleTime);
+  // Closes the queue if it has messages, but nobody has taken any of them for
+  // idleTime. They are in the database, the device gets them from there once
+  // it connects.
+  // - argument deliveryTags - gets the tags of the dropped messages, for
+  // acknowledging them in AMQP
+  // - returns the number of the dropped messages, 0 if the queue stays open
+  size_t
+  closeIfAbandoned(uint64_t idleTime, std::vector<uint64_t> &deliveryTags);
+};
+
+} // namespace network
+} // namespace comm
@@ -0,0 +1,264 @@
+#include "AdmissionController.h"
+#include "AmqpManager.h"
+#include "ConfigManager.h"
+#include "DatabaseManagerBase.h"
+#include "DeliveryBroker.h"
+#include "DynamoDBRateLimiter.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+
+namespace comm {
+namespace network {
+namespace admission {
+
+namespace {
+
+const std::array<std::string, WORK_PRIORITIES_COUNT> PRIORITY_NAMES = {
+    "interactive",
+    "bulk",
+    "connection",
+};
+
+const std::array<std::string, 3> LEVEL_NAMES = {
+    "normal",
+    "elevated",
+    "critical",
+};
+
+OverloadLevel classifyValue(double value, double elevated, double critical) {
+  if (value >= critical) {
+    return OverloadLevel::CRITICAL;
+  }
+  if (value >= elevated) {
+    return OverloadLevel::ELEVATED;
+  }
+  return OverloadLevel::NORMAL;
+}
+
+// Only called by the controller with its evaluationMutex locked, which
+// guards the windows
+LoadSignals readTunnelbrokerSignals() {
+  static SlowShareWindow rateLimitWaits(
+      database::DynamoDBRateLimiter::getInstance(
+          config::ConfigManager::getInstance()
+              .getSnapshot()
+              .dynamoDBMessagesTable)
+          .getDelays(),
+      ADMISSION_SLOW_RATE_LIMIT_WAIT_US);
+  static SlowShareWindow databaseWrites(
+      database::getDatabaseRequestDurations(
+          database::DatabaseOperation::BATCH_WRITE_ITEM),
+      ADMISSION_SLOW_DATABASE_WRITE_US);
+  static SlowShareWindow publishConfirms(
+      AmqpManager::getInstance().getPublishConfirmations(),
+      ADMISSION_SLOW_PUBLISH_CONFIRM_US);
+  LoadSignals signals;
+  size_t maxDepth;
+  const DeliveryBrokerQueueStats queueStats =
+      DeliveryBroker::getInstance().getTotalQueueStats(maxDepth);
+  signals.queuedMessages = queueStats.queued + queueStats.overflowed;
+  signals.slowRateLimitWaits = rateLimitWaits.take();
+  signals.slowDatabaseWrites = databaseWrites.take();
+  signals.slowPublishConfirms = publishConfirms.take();
+  // Doesn't wait with a deadline that has passed
+  signals.amqpReady = AmqpManager::getInstance().waitUntilReady(
+      std::chrono::steady_clock::now());
+  return signals;
+}
+
+} // namespace
+
+Admission decideAdmission(OverloadLevel level, WorkPriority priority) {
+  if (priority == WorkPriority::INTERACTIVE ||
+      level == OverloadLevel::NORMAL) {
+    return Admission::ADMIT;
+  }
+  if (level == OverloadLevel::CRITICAL) {
+    return Admission::REJECT;
+  }
+  return priority == WorkPriority::BULK ? Admission::DEFER : Admission::ADMIT;
+}
+
+OverloadDetector::OverloadDetector(
+    std::chrono::steady_clock::duration recoveryTime)
+    : recoveryTime(recoveryTime) {
+}
+
+OverloadLevel OverloadDetector::classify(const LoadSignals &signals) {
+  const std::array<OverloadLevel, 6> levels = {
+      classifyValue(
+          signals.queuedMessages,
+          ADMISSION_QUEUED_MESSAGES_ELEVATED,
+          ADMISSION_QUEUED_MESSAGES_CRITICAL),
+      classifyValue(
+          signals.sendsInProgress,
+          ADMISSION_SENDS_IN_PROGRESS_ELEVATED,
+          ADMISSION_SENDS_IN_PROGRESS_CRITICAL),
+      classifyValue(
+          signals.slowRateLimitWaits,
+          ADMISSION_SLOW_SHARE_ELEVATED,
+          ADMISSION_SLOW_SHARE_CRITICAL),
+      classifyValue(
+          signals.slowDatabaseWrites,
+          ADMISSION_SLOW_SHARE_ELEVATED,
+          ADMISSION_SLOW_SHARE_CRITICAL),
+      classifyValue(
+          signals.slowPublishConfirms,
+          ADMISSION_SLOW_SHARE_ELEVATED,
+          ADMISSION_SLOW_SHARE_CRITICAL),
+      signals.amqpReady ? OverloadLevel::NORMAL : OverloadLevel::ELEVATED,
+  };
+  return *std::max_element(levels.begin(), levels.end());
+}
+
+OverloadLevel OverloadDetector::update(
+    const LoadSignals &signals,
+    std::chrono::steady_clock::time_point now) {
+  const OverloadLevel measured = classify(signals);
+  if (measured >= this->level) {
+    this->level = measured;
+    this->recovering = false;
+    return this->level;
+  }
+  if (!this->recovering) {
+    this->recovering = true;
+    this->recoveringSince = now;
+  } else if (now - this->recoveringSince >= this->recoveryTime) {
+    this->level =
+        static_cast<OverloadLevel>(static_cast<int>(this->level) - 1);
+    // A further step down needs another recoveryTime
+    this->recovering = measured < this->level;
+    this->recoveringSince = now;
+  }
+  return this->level;
+}
+
+SlowShareWindow::SlowShareWindow(
+    const metrics::Histogram &histogram,
+    uint64_t limitUs)
+    : histogram(histogram),
+      limitUs(limitUs),
+      lastCount(histogram.getCount()),
+      lastFastCount(histogram.getCountUpTo(limitUs)) {
+}
+
+double SlowShareWindow::take() {
+  const uint64_t count = this->histogram.getCount();
+  const uint64_t fastCount = this->histogram.getCountUpTo(this->limitUs);
+  // The buckets and the total are read one after the other, so a value
+  // recorded in between may only be in one of them
+  const uint64_t windowCount = count - std::min(count, this->lastCount);
+  const uint64_t windowFastCount =
+      fastCount - std::min(fastCount, this->lastFastCount);
+  this->lastCount = count;
+  this->lastFastCount = fastCount;
+  if (windowCount < ADMISSION_MIN_INTERVAL_OPERATIONS) {
+    return 0;
+  }
+  return static_cast<double>(
+             windowCount - std::min(windowCount, windowFastCount)) /
+      windowCount;
+}
+
+AdmissionController &AdmissionController::getInstance() {
+  static AdmissionController instance = [] {
+    metrics::MetricsRegistry::getInstance().registerGaugeFunction(
+        "comm_admission_overload_level",
+        "0 while the load is normal, 1 while bulk messages are deferred and "
+        "2 while new connections are rejected too",
+        "",
+        []() {
+          return static_cast<double>(
+              AdmissionController::getInstance().getLevel());
+        });
+    return AdmissionController(readTunnelbrokerSignals);
+  }();
+  return instance;
+}
+
+AdmissionController::AdmissionController(
+    std::function<LoadSignals()> readSignals,
+    std::chrono::steady_clock::duration evaluationInterval,
+    std::chrono::steady_clock::duration recoveryTime)
+    : readSignals(std::move(readSignals)),
+      evaluationInterval(evaluationInterval),
+      detector(recoveryTime) {
+  metrics::MetricsRegistry &registry = metrics::MetricsRegistry::getInstance();
+  for (size_t i = 0; i < WORK_PRIORITIES_COUNT; i++) {
+    const std::string labels = "priority=\"" + PRIORITY_NAMES[i] + "\"";
+    this->deferred[i] = &registry.getCounter(
+        "comm_admission_deferred_total",
+        "Work that was deferred for the overload, once per check",
+        labels);
+    this->rejected[i] = &registry.getCounter(
+        "comm_admission_rejected_total",
+        "Work that was rejected for the overload",
+        labels);
+  }
+}
+
+void AdmissionController::evaluate(std::chrono::steady_clock::time_point now) {
+  std::unique_lock<std::mutex> lock(this->evaluationMutex, std::try_to_lock);
+  if (!lock.owns_lock() ||
+      now - this->lastEvaluation < this->evaluationInterval) {
+    return;
+  }
+  this->lastEvaluation = now;
+  LoadSignals signals = this->readSignals();
+  signals.sendsInProgress = this->sendsInProgress.load();
+  const OverloadLevel previous = this->level.load();
+  const OverloadLevel current = this->detector.update(signals, now);
+  if (current == previous) {
+    return;
+  }
+  this->level.store(current);
+  LOG(WARNING) << "Admission: the overload level went from "
+               << LEVEL_NAMES[static_cast<size_t>(previous)] << " to "
+               << LEVEL_NAMES[static_cast<size_t>(current)]
+               << ", queued messages: " << signals.queuedMessages
+               << ", sends in progress: " << signals.sendsInProgress
+               << ", slow rate limit waits: " << signals.slowRateLimitWaits
+               << ", slow database writes: " << signals.slowDatabaseWrites
+               << ", slow publish confirms: " << signals.slowPublishConfirms
+               << ", AMQP ready: " << signals.amqpReady;
+}
+
+void AdmissionController::setEnabled(bool enabled) {
+  this->enabled.store(enabled);
+}
+
+Admission AdmissionController::admit(
+    WorkPriority priority,
+    std::chrono::steady_clock::time_point now) {
+  if (!this->enabled.load(std::memory_order_relaxed)) {
+    return Admission::ADMIT;
+  }
+  this->evaluate(now);
+  const Admission admission = decideAdmission(this->getLevel(), priority);
+  if (admission == Admission::DEFER) {
+    this->deferred[static_cast<size_t>(priority)]->increment();
+  } else if (admission == Admission::REJECT) {
+    this->rejected[static_cast<size_t>(priority)]->increment();
+  }
+  return admission;
+}
+
+OverloadLevel AdmissionController::getLevel() const {
+  return this->level.load(std::memory_order_relaxed);
+}
+
+AdmissionController::SendInProgress::SendInProgress(
+    AdmissionController &controller)
+    : controller(controller) {
+  this->controller.sendsInProgress.fetch_add(1, std::memory_order_relaxed);
+}
+
+AdmissionController::SendInProgress::~SendInProgress() {
+  this->controller.sendsInProgress.fetch_sub(1, std::memory_order_relaxed);
+}
+
+} // namespace admission
+} // namespace network
+} // namespace comm
@@ -0,0 +1,153 @@
+#pragma once
+
+#include "Constants.h"
+#include "Metrics.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+
+namespace comm {
+namespace network {
+namespace admission {
+
+enum class OverloadLevel {
+  NORMAL = 0,
+  // Bulk messages are deferred
+  ELEVATED = 1,
+  // Bulk messages, new streams and new sessions are rejected
+  CRITICAL = 2,
+};
+
+// The interactive messages of the devices that are connected are always
+// admitted, shedding the rest is what keeps them fast
+enum class WorkPriority {
+  INTERACTIVE = 0,
+  // A batch of messages that are all bulk
+  BULK = 1,
+  // A new session or stream, which reads and writes the database before the
+  // device sends anything
+  CONNECTION = 2,
+};
+
+const size_t WORK_PRIORITIES_COUNT = 3;
+
+enum class Admission {
+  ADMIT = 0,
+  // Asked again after a while, the caller waits without holding a thread
+  DEFER = 1,
+  // Answered with a retryable status
+  REJECT = 2,
+};
+
+struct LoadSignals {
+  size_t queuedMessages = 0;
+  size_t sendsInProgress = 0;
+  // Shares of the operations of the last interval that were slow, from 0 to 1
+  double slowRateLimitWaits = 0;
+  double slowDatabaseWrites = 0;
+  double slowPublishConfirms = 0;
+  // While the broker isn't ready the messages are only stored
+  bool amqpReady = true;
+};
+
+Admission decideAdmission(OverloadLevel level, WorkPriority priority);
+
+// Every signal gives a level by its thresholds in Constants.h and the
+// highest one wins. The level rises at once and steps down once the signals
+// have stayed under it for recoveryTime, so that it doesn't flap.
+class OverloadDetector {
+  const std::chrono::steady_clock::duration recoveryTime;
+  OverloadLevel level = OverloadLevel::NORMAL;
+  bool recovering = false;
+  std::chrono::steady_clock::time_point recoveringSince;
+
+public:
+  explicit OverloadDetector(
+      std::chrono::steady_clock::duration recoveryTime =
+          std::chrono::milliseconds(ADMISSION_RECOVERY_MS));
+  static OverloadLevel classify(const LoadSignals &signals);
+  OverloadLevel update(
+      const LoadSignals &signals,
+      std::chrono::steady_clock::time_point now);
+};
+
+// The share of the values recorded in a histogram since the last take that
+// were above limitUs
+class SlowShareWindow {
+  const metrics::Histogram &histogram;
+  const uint64_t limitUs;
+  uint64_t lastCount = 0;
+  uint64_t lastFastCount = 0;
+
+public:
+  SlowShareWindow(const metrics::Histogram &histogram, uint64_t limitUs);
+  double take();
+};
+
+// Detects overload from the depth of the DeliveryBroker queues, the sends
+// that are in progress, the waits for the rate limit of the messages table
+// and the latency of DynamoDB and of the broker, and sheds the low priority
+// work while it lasts instead of letting every request slow down. The
+// signals are read by the request that comes after
+// ADMISSION_EVALUATION_INTERVAL_MS, the others only read the level.
+//
+// The level is exported as comm_admission_overload_level, and the work that
+// isn't admitted is counted by priority in
+// comm_admission_deferred_total and comm_admission_rejected_total.
+class AdmissionController {
+  const std::function<LoadSignals()> readSignals;
+  const std::chrono::steady_clock::duration evaluationInterval;
+  std::atomic<bool> enabled{true};
+  std::atomic<OverloadLevel> level{OverloadLevel::NORMAL};
+  std::atomic<size_t> sendsInProgress{0};
+  // Guards the detector, a request that finds it locked doesn't wait
+  std::mutex evaluationMutex;
+  OverloadDetector detector;
+  std::chrono::steady_clock::time_point lastEvaluation;
+  std::array<metrics::Counter *, WORK_PRIORITIES_COUNT> deferred;
+  std::array<metrics::Counter *, WORK_PRIORITIES_COUNT> rejected;
+
+  void evaluate(std::chrono::steady_clock::time_point now);
+
+public:
+  static AdmissionController &getInstance();
+
+  // - argument readSignals - reads the signals except sendsInProgress, which
+  // the controller counts itself
+  AdmissionController(
+      std::function<LoadSignals()> readSignals,
+      std::chrono::steady_clock::duration evaluationInterval =
+          std::chrono::milliseconds(ADMISSION_EVALUATION_INTERVAL_MS),
+      std::chrono::steady_clock::duration recoveryTime =
+          std::chrono::milliseconds(ADMISSION_RECOVERY_MS));
+  AdmissionController(const AdmissionController &) = delete;
+  void operator=(const AdmissionController &) = delete;
+
+  // A disabled controller admits everything
+  void setEnabled(bool enabled);
+  Admission admit(
+      WorkPriority priority,
+      std::chrono::steady_clock::time_point now =
+          std::chrono::steady_clock::now());
+  OverloadLevel getLevel() const;
+
+  // Counts a send as in progress while it lives
+  class SendInProgress {
+    AdmissionController &controller;
+
+  public:
+    explicit SendInProgress(AdmissionController &controller);
+    ~SendInProgress();
+    SendInProgress(const SendInProgress &) = delete;
+    void operator=(const SendInProgress &) = delete;
+  };
+};
+
+} // namespace admission
+} // namespace network
+} // namespace comm
@@ -15,6 +15,16 @@ const std::string ConfigManager::OPTION_DEFAULT_KEYSERVER_ID =
 const std::string ConfigManager::OPTION_AMQP_URI = "amqp.uri";
 const std::string ConfigManager::OPTION_AMQP_FANOUT_EXCHANGE =
     "amqp.fanout_exchange_name";
+const std::string ConfigManager::OPTION_AMQP_DIRECT_EXCHANGE =
+    "amqp.direct_exchange_name";
+const std::string ConfigManager::OPTION_AMQP_PUBLISH_CHANNELS =
+    "amqp.publish_channels";
+const std::string ConfigManager::OPTION_AMQP_PREFETCH_COUNT =
+    "amqp.prefetch_count";
+const std::string ConfigManager::OPTION_AMQP_CONSUMER_SHARDS =
+    "amqp.consumer_shards";
+const std::string ConfigManager::OPTION_AMQP_ENVELOPE_MESSAGES_MAX =
+    "amqp.envelope_messages_max";
 const std::string ConfigManager::OPTION_DYNAMODB_SESSIONS_TABLE =
     "dynamodb.sessions_table_name";
 const std::string ConfigManager::OPTION_DYNAMODB_SESSIONS_VERIFICATION_TABLE =
@@ -23,6 +33,41 @@ const std::string ConfigManager::OPTION_DYNAMODB_SESSIONS_PUBLIC_KEY_TABLE =
     "dynamodb.sessions_public_key_table_name";
 const std::string ConfigManager::OPTION_DYNAMODB_MESSAGES_TABLE =
     "dynamodb.messages_table_name";
+const std::string ConfigManager::OPTION_DYNAMODB_MESSAGES_COLD_TABLE =
+    "dynamodb.messages_cold_table_name";
+const std::string ConfigManager::OPTION_DYNAMODB_MAX_CONNECTIONS =
+    "dynamodb.max_connections";
+const std::string ConfigManager::OPTION_DYNAMODB_CONNECT_TIMEOUT_MS =
+    "dynamodb.connect_timeout_ms";
+const std::string ConfigManager::OPTION_DYNAMODB_REQUEST_TIMEOUT_MS =
+    "dynamodb.request_timeout_ms";
+const std::string ConfigManager::OPTION_DYNAMODB_TCP_KEEPALIVE_INTERVAL_MS =
+    "dynamodb.tcp_keepalive_interval_ms";
+const std::string ConfigManager::OPTION_GRPC_MAX_CONCURRENT_STREAMS =
+    "grpc.max_concurrent_streams";
+const std::string ConfigManager::OPTION_GRPC_KEEPALIVE_INTERVAL_MS =
+    "grpc.keepalive_interval_ms";
+const std::string ConfigManager::OPTION_GRPC_KEEPALIVE_TIMEOUT_MS =
+    "grpc.keepalive_timeout_ms";
+const std::string ConfigManager::OPTION_BLOB_SERVICE_URL = "blob.service_url";
+const std::string ConfigManager::OPTION_BLOB_PAYLOAD_OFFLOAD_THRESHOLD =
+    "blob.payload_offload_threshold";
+const std::string ConfigManager::OPTION_METRICS_PORT = "metrics.port";
+const std::string ConfigManager::OPTION_METRICS_PROFILING =
+    "metrics.profiling";
+const std::string ConfigManager::OPTION_TRACING_SAMPLE_RATIO =
+    "tracing.sample_ratio";
+const std::string ConfigManager::OPTION_TRACING_COLLECTOR_HOST =
+    "tracing.collector_host";
+const std::string ConfigManager::OPTION_TRACING_COLLECTOR_PORT =
+    "tracing.collector_port";
+const std::string ConfigManager::OPTION_CAPTURE_PATH = "capture.path";
+const std::string ConfigManager::OPTION_CAPTURE_DURATION_SECONDS =
+    "capture.duration_seconds";
+const std::string ConfigManager::OPTION_CAPTURE_MAX_EVENTS =
+    "capture.max_events";
+const std::string ConfigManager::OPTION_ADMISSION_ENABLED =
+    "admission.enabled";
 const std::string ConfigManager::OPTION_NOTIFS_APNS_P12_CERT_PATH =
     "notifications.apns_cert_path";
 const std::string ConfigManager::OPTION_NOTIFS_APNS_P12_CERT_PASSWORD =
@@ -38,6 +83,7 @@ ConfigManager &ConfigManager::getInstance() {
 }
 
 void ConfigManager::load() {
+  const std::lock_guard<std::mutex> lock(this->loadMutex);
   char const *configFileDirectoryFromEnvironment =
       std::getenv(CONFIG_FILE_DIRECTORY_ENV_VARIABLE.c_str());
   std::string configFilePath = DEFAULT_CONFIG_FILE_DIRECTORY;
@@ -46,6 +92,7 @@ void ConfigManager::load() {
     configFilePath = std::string{configFileDirectoryFromEnvironment};
   }
   loadConfigFile(configFilePath + "/" + CONFIG_FILE_NAME);
+  this->publishSnapshot();
 }
 
 void ConfigManager::loadConfigFile(const std::string configFilePath) {
@@ -75,6 +122,35 @@ void ConfigManager::loadConfigFile(const std::string configFilePath) {
         boost::program_options::value<std::string>()->default_value(
             AMQP_FANOUT_EXCHANGE_NAME),
         "AMQP Fanout exchange name");
+    description.add_options()(
+        this->OPTION_AMQP_DIRECT_EXCHANGE.c_str(),
+        boost::program_options::value<std::string>()->default_value(
+            AMQP_DIRECT_EXCHANGE_NAME),
+        "AMQP Direct exchange name, messages are routed by their deviceID");
+    description.add_options()(
+        this->OPTION_AMQP_PUBLISH_CHANNELS.c_str(),
+        boost::program_options::value<std::string>()->default_value(
+            std::to_string(AMQP_PUBLISH_CHANNELS)),
+        "Number of AMQP channels for publishing, each on its own connection");
+    description.add_options()(
+        this->OPTION_AMQP_PREFETCH_COUNT.c_str(),
+        boost::program_options::value<std::string>()->default_value(
+            std::to_string(AMQP_PREFETCH_COUNT)),
+        "Maximum number of unacknowledged messages on the AMQP consume "
+        "channel, or 0 for no limit");
+    description.add_options()(
+        this->OPTION_AMQP_CONSUMER_SHARDS.c_str(),
+        boost::program_options::value<std::string>()->default_value(
+            std::to_string(AMQP_CONSUMER_SHARDS)),
+        "Number of threads that handle the received AMQP messages, the "
+        "messages to a device are always handled by the same one");
+    description.add_options()(
+        this->OPTION_AMQP_ENVELOPE_MESSAGES_MAX.c_str(),
+        boost::program_options::value<std::string>()->default_value(
+            std::to_string(AMQP_ENVELOPE_MESSAGES_MAX)),
+        "Maximum number of messages to a device that are published together "
+        "in one envelope, or 0 to publish every message with AMQP headers "
+        "for the instances that can't read envelopes");
     description.add_options()(
         this->OPTION_DYNAMODB_SESSIONS_TABLE.c_str(),
         boost::program_options::value<std::string>()->default_value(
@@ -95,6 +171,113 @@ void ConfigManager::loadConfigFile(const std::string configFilePath) {
         boost::program_options::value<std::string>()->default_value(
             MESSAGES_TABLE_NAME),
         "DynamoDB table name for messages");
+    description.add_options()(
+        this->OPTION_DYNAMODB_MESSAGES_COLD_TABLE.c_str(),
+        boost::program_options::value<std::string>()->default_value(
+            MESSAGES_COLD_TABLE_NAME),
+        "DynamoDB table name for archived messages");
+    description.add_options()(
+        this->OPTION_DYNAMODB_MAX_CONNECTIONS.c_str(),
+        boost::program_options::value<std::string>()->default_value(
+            std::to_string(DYNAMODB_MAX_CONNECTIONS)),
+        "Maximum number of pooled DynamoDB client connections");
+    description.add_options()(
+        this->OPTION_DYNAMODB_CONNECT_TIMEOUT_MS.c_str(),
+        boost::program_options::value<std::string>()->default_value(
+            std::to_string(DYNAMODB_CONNECT_TIMEOUT_MS)),
+        "DynamoDB connection timeout in milliseconds");
+    description.add_options()(
+        this->OPTION_DYNAMODB_REQUEST_TIMEOUT_MS.c_str(),
+        boost::program_options::value<std::string>()->default_value(
+            std::to_string(DYNAMODB_REQUEST_TIMEOUT_MS)),
+        "DynamoDB request timeout in milliseconds");
+    description.add_options()(
+        this->OPTION_DYNAMODB_TCP_KEEPALIVE_INTERVAL_MS.c_str(),
+        boost::program_options::value<std::string>()->default_value(
+            std::to_string(DYNAMODB_TCP_KEEPALIVE_INTERVAL_MS)),
+        "Interval of TCP keep-alive probes on idle DynamoDB connections in "
+        "milliseconds, or 0 to disable them");
+    description.add_options()(
+        this->OPTION_GRPC_MAX_CONCURRENT_STREAMS.c_str(),
+        boost::program_options::value<std::string>()->default_value(
+            std::to_string(GRPC_MAX_CONCURRENT_STREAMS)),
+        "Maximum number of concurrent streams of a single gRPC connection, "
+        "or 0 for no limit");
+    description.add_options()(
+        this->OPTION_GRPC_KEEPALIVE_INTERVAL_MS.c_str(),
+        boost::program_options::value<std::string>()->default_value(
+            std::to_string(GRPC_KEEP_ALIVE_PING_INTERVAL_MS)),
+        "Interval of the HTTP/2 keep-alive pings of gRPC connections in "
+        "milliseconds, or 0 to disable them");
+    description.add_options()(
+        this->OPTION_GRPC_KEEPALIVE_TIMEOUT_MS.c_str(),
+        boost::program_options::value<std::string>()->default_value(
+            std::to_string(GRPC_KEEP_ALIVE_PING_TIMEOUT_MS)),
+        "How long a gRPC connection may take to answer a keep-alive ping "
+        "in milliseconds");
+    description.add_options()(
+        this->OPTION_BLOB_SERVICE_URL.c_str(),
+        boost::program_options::value<std::string>()->default_value(
+            BLOB_SERVICE_URL),
+        "URL of the blob service that holds the large message payloads");
+    description.add_options()(
+        this->OPTION_BLOB_PAYLOAD_OFFLOAD_THRESHOLD.c_str(),
+        boost::program_options::value<std::string>()->default_value(
+            std::to_string(BLOB_PAYLOAD_OFFLOAD_THRESHOLD)),
+        "Size in bytes above which message payloads are put in the blob "
+        "service instead of being sent inline, or 0 to disable it");
+    description.add_options()(
+        this->OPTION_METRICS_PORT.c_str(),
+        boost::program_options::value<std::string>()->default_value(
+            std::to_string(TUNNELBROKER_METRICS_PORT)),
+        "Port of the HTTP endpoint that serves the metrics in the Prometheus "
+        "text format, or 0 to disable it");
+    description.add_options()(
+        this->OPTION_METRICS_PROFILING.c_str(),
+        boost::program_options::value<std::string>()->default_value(
+            std::to_string(TUNNELBROKER_METRICS_PROFILING)),
+        "1 to let the metrics endpoint run CPU and heap profiles for pprof "
+        "on /debug/pprof/profile and /debug/pprof/heap, or 0 to disable it");
+    description.add_options()(
+        this->OPTION_TRACING_SAMPLE_RATIO.c_str(),
+        boost::program_options::value<std::string>()->default_value(
+            std::to_string(TRACING_SAMPLE_RATIO)),
+        "Share of the sent messages that are traced, from 0 to 1, 0 disables "
+        "the tracing");
+    description.add_options()(
+        this->OPTION_TRACING_COLLECTOR_HOST.c_str(),
+        boost::program_options::value<std::string>()->default_value(
+            TRACING_COLLECTOR_HOST),
+        "Host of the OpenTelemetry collector that receives the spans over "
+        "OTLP/HTTP");
+    description.add_options()(
+        this->OPTION_TRACING_COLLECTOR_PORT.c_str(),
+        boost::program_options::value<std::string>()->default_value(
+            std::to_string(TRACING_COLLECTOR_PORT)),
+        "Port of the OTLP/HTTP receiver of the OpenTelemetry collector");
+    description.add_options()(
+        this->OPTION_CAPTURE_PATH.c_str(),
+        boost::program_options::value<std::string>()->default_value(
+            CAPTURE_PATH),
+        "File that the anonymized traffic trace is written to");
+    description.add_options()(
+        this->OPTION_CAPTURE_DURATION_SECONDS.c_str(),
+        boost::program_options::value<std::string>()->default_value(
+            std::to_string(CAPTURE_DURATION_SECONDS)),
+        "Seconds of traffic that are captured from the start, or 0 to "
+        "disable the capture");
+    description.add_options()(
+        this->OPTION_CAPTURE_MAX_EVENTS.c_str(),
+        boost::program_options::value<std::string>()->default_value(
+            std::to_string(CAPTURE_MAX_EVENTS)),
+        "Number of events after which the capture stops early, or 0 for no "
+        "limit");
+    description.add_options()(
+        this->OPTION_ADMISSION_ENABLED.c_str(),
+        boost::program_options::value<std::string>()->default_value(
+            std::to_string(TUNNELBROKER_ADMISSION_ENABLED)),
+        "1 to defer and reject the low priority work while the service is "
+        "overloaded, or 0 to admit everything");
 
     description.add_options()(
         this->OPTION_NOTIFS_APNS_P12_CERT_PATH.c_str(),
@@ -116,16 +299,65 @@ void ConfigManager::loadConfigFile(const std::string configFilePath) {
     boost::program_options::parsed_options parsedDescription =
         boost::program_options::parse_config_file(
             fileStream, description, true);
-    boost::program_options::store(parsedDescription, this->variablesMap);
-    boost::program_options::notify(this->variablesMap);
+    // A reload starts from an empty map, store doesn't replace the values
+    // that are already there
+    boost::program_options::variables_map variablesMap;
+    boost::program_options::store(parsedDescription, variablesMap);
+    boost::program_options::notify(variablesMap);
     fileStream.close();
+    const std::lock_guard<std::mutex> lock(this->variablesMapMutex);
+    this->variablesMap = std::move(variablesMap);
   } catch (const std::exception &e) {
     throw std::runtime_error(
         "Got an exception at ConfigManager: " + std::string(e.what()));
   }
 }
 
+void ConfigManager::publishSnapshot() {
+  std::unique_ptr<ConfigSnapshot> snapshot =
+      std::make_unique<ConfigSnapshot>();
+  snapshot->tunnelbrokerID = this->getParameter(this->OPTION_TUNNELBROKER_ID);
+  snapshot->defaultKeyserverID =
+      this->getParameter(this->OPTION_DEFAULT_KEYSERVER_ID);
+  snapshot->amqpFanoutExchange =
+      this->getParameter(this->OPTION_AMQP_FANOUT_EXCHANGE);
+  snapshot->amqpDirectExchange =
+      this->getParameter(this->OPTION_AMQP_DIRECT_EXCHANGE);
+  snapshot->dynamoDBSessionsTable =
+      this->getParameter(this->OPTION_DYNAMODB_SESSIONS_TABLE);
+  snapshot->dynamoDBSessionsVerificationTable =
+      this->getParameter(this->OPTION_DYNAMODB_SESSIONS_VERIFICATION_TABLE);
+  snapshot->dynamoDBSessionsPublicKeyTable =
+      this->getParameter(this->OPTION_DYNAMODB_SESSIONS_PUBLIC_KEY_TABLE);
+  snapshot->dynamoDBMessagesTable =
+      this->getParameter(this->OPTION_DYNAMODB_MESSAGES_TABLE);
+  snapshot->dynamoDBMessagesColdTable =
+      this->getParameter(this->OPTION_DYNAMODB_MESSAGES_COLD_TABLE);
+  snapshot->dynamoDBClientOptions = this->getDynamoDBClientOptions();
+  snapshot->amqpChannelOptions = this->getAmqpChannelOptions();
+  snapshot->grpcServerOptions = this->getGrpcServerOptions();
+  snapshot->metricsPort = this->getMetricsPort();
+  snapshot->metricsProfiling =
+      this->getNumericParameter(this->OPTION_METRICS_PROFILING) != 0;
+  snapshot->tracingOptions = this->getTracingOptions();
+  snapshot->captureOptions = this->getCaptureOptions();
+  snapshot->admissionEnabled =
+      this->getNumericParameter(this->OPTION_ADMISSION_ENABLED) != 0;
+  this->snapshot.store(snapshot.get(), std::memory_order_release);
+  this->snapshots.push_back(std::move(snapshot));
+}
+
+const ConfigSnapshot &ConfigManager::getSnapshot() const {
+  const ConfigSnapshot *snapshot =
+      this->snapshot.load(std::memory_order_acquire);
+  if (snapshot == nullptr) {
+    throw std::runtime_error("ConfigManager Error: config is not loaded.");
+  }
+  return *snapshot;
+}
+
 std::string ConfigManager::getParameter(std::string param) {
+  const std::lock_guard<std::mutex> lock(this->variablesMapMutex);
   if (!this->variablesMap.count(param) &&
       !this->variablesMap[param].defaulted()) {
     throw std::runtime_error(
@@ -141,6 +373,138 @@ std::string ConfigManager::getParameter(std::string param) {
   return parameterValue;
 }
 
+size_t ConfigManager::getNumericParameter(std::string param) {
+  const std::string parameterValue = this->getParameter(param);
+  if (parameterValue.find_first_not_of("0123456789") == std::string::npos) {
+    try {
+      return std::stoul(parameterValue);
+    } catch (const std::out_of_range &) {
+    }
+  }
+  throw std::runtime_error(
+      "ConfigManager Error: config parameter " + param +
+      " has to be a non-negative integer.");
+}
+
+DynamoDBClientOptions ConfigManager::getDynamoDBClientOptions() {
+  DynamoDBClientOptions options;
+  options.maxConnections =
+      this->getNumericParameter(this->OPTION_DYNAMODB_MAX_CONNECTIONS);
+  options.connectTimeoutMs =
+      this->getNumericParameter(this->OPTION_DYNAMODB_CONNECT_TIMEOUT_MS);
+  options.requestTimeoutMs =
+      this->getNumericParameter(this->OPTION_DYNAMODB_REQUEST_TIMEOUT_MS);
+  options.tcpKeepAliveIntervalMs = this->getNumericParameter(
+      this->OPTION_DYNAMODB_TCP_KEEPALIVE_INTERVAL_MS);
+  options.enableTcpKeepAlive = options.tcpKeepAliveIntervalMs != 0;
+  return options;
+}
+
+AmqpChannelOptions ConfigManager::getAmqpChannelOptions() {
+  AmqpChannelOptions options;
+  options.publishChannels =
+      this->getNumericParameter(this->OPTION_AMQP_PUBLISH_CHANNELS);
+  if (!options.publishChannels) {
+    throw std::runtime_error(
+        "ConfigManager Error: config parameter " +
+        this->OPTION_AMQP_PUBLISH_CHANNELS + " has to be at least 1.");
+  }
+  const size_t prefetchCount =
+      this->getNumericParameter(this->OPTION_AMQP_PREFETCH_COUNT);
+  if (prefetchCount > UINT16_MAX) {
+    throw std::runtime_error(
+        "ConfigManager Error: config parameter " +
+        this->OPTION_AMQP_PREFETCH_COUNT + " can not exceed " +
+        std::to_string(UINT16_MAX) + ".");
+  }
+  options.prefetchCount = prefetchCount;
+  options.consumerShards =
+      this->getNumericParameter(this->OPTION_AMQP_CONSUMER_SHARDS);
+  if (!options.consumerShards) {
+    throw std::runtime_error(
+        "ConfigManager Error: config parameter " +
+        this->OPTION_AMQP_CONSUMER_SHARDS + " has to be at least 1.");
+  }
+  options.envelopeMessagesMax =
+      this->getNumericParameter(this->OPTION_AMQP_ENVELOPE_MESSAGES_MAX);
+  return options;
+}
+
+GrpcServerOptions ConfigManager::getGrpcServerOptions() {
+  GrpcServerOptions options;
+  for (const std::string &option :
+       {this->OPTION_GRPC_MAX_CONCURRENT_STREAMS,
+        this->OPTION_GRPC_KEEPALIVE_INTERVAL_MS,
+        this->OPTION_GRPC_KEEPALIVE_TIMEOUT_MS}) {
+    if (this->getNumericParameter(option) > UINT32_MAX) {
+      throw std::runtime_error(
+          "ConfigManager Error: config parameter " + option +
+          " can not exceed " + std::to_string(UINT32_MAX) + ".");
+    }
+  }
+  options.maxConcurrentStreams =
+      this->getNumericParameter(this->OPTION_GRPC_MAX_CONCURRENT_STREAMS);
+  options.keepAliveIntervalMs =
+      this->getNumericParameter(this->OPTION_GRPC_KEEPALIVE_INTERVAL_MS);
+  options.keepAliveTimeoutMs =
+      this->getNumericParameter(this->OPTION_GRPC_KEEPALIVE_TIMEOUT_MS);
+  return options;
+}
+
+uint16_t ConfigManager::getMetricsPort() {
+  const size_t metricsPort =
+      this->getNumericParameter(this->OPTION_METRICS_PORT);
+  if (metricsPort > UINT16_MAX) {
+    throw std::runtime_error(
+        "ConfigManager Error: config parameter " + this->OPTION_METRICS_PORT +
+        " can not exceed " + std::to_string(UINT16_MAX) + ".");
+  }
+  return metricsPort;
+}
+
+tracing::TracingOptions ConfigManager::getTracingOptions() {
+  tracing::TracingOptions options;
+  options.serviceName = "tunnelbroker";
+  const std::string sampleRatio =
+      this->getParameter(this->OPTION_TRACING_SAMPLE_RATIO);
+  try {
+    size_t parsedLength;
+    options.sampleRatio = std::stod(sampleRatio, &parsedLength);
+    if (parsedLength != sampleRatio.size()) {
+      throw std::invalid_argument(sampleRatio);
+    }
+  } catch (const std::logic_error &) {
+    options.sampleRatio = -1;
+  }
+  if (!(options.sampleRatio >= 0 && options.sampleRatio <= 1)) {
+    throw std::runtime_error(
+        "ConfigManager Error: config parameter " +
+        this->OPTION_TRACING_SAMPLE_RATIO + " has to be between 0 and 1.");
+  }
+  options.collectorHost =
+      this->getParameter(this->OPTION_TRACING_COLLECTOR_HOST);
+  const size_t collectorPort =
+      this->getNumericParameter(this->OPTION_TRACING_COLLECTOR_PORT);
+  if (!collectorPort || collectorPort > UINT16_MAX) {
+    throw std::runtime_error(
+        "ConfigManager Error: config parameter " +
+        this->OPTION_TRACING_COLLECTOR_PORT + " has to be between 1 and " +
+        std::to_string(UINT16_MAX) + ".");
+  }
+  options.collectorPort = collectorPort;
+  return options;
+}
+
+capture::CaptureOptions ConfigManager::getCaptureOptions() {
+  capture::CaptureOptions options;
+  options.path = this->getParameter(this->OPTION_CAPTURE_PATH);
+  options.durationSeconds =
+      this->getNumericParameter(this->OPTION_CAPTURE_DURATION_SECONDS);
+  options.maxEvents =
+      this->getNumericParameter(this->OPTION_CAPTURE_MAX_EVENTS);
+  return options;
+}
+
 } // namespace config
 } // namespace network
 } // namespace comm
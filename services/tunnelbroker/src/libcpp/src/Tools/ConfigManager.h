@@ -1,27 +1,93 @@
 #pragma once
 
+#include "AmqpChannelOptions.h"
+#include "DynamoDBTools.h"
+#include "GrpcServerOptions.h"
+#include "TrafficCapture.h"
+#include "Tracing.h"
+
 #include <boost/program_options.hpp>
 
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
 namespace comm {
 namespace network {
 namespace config {
 
+// The parameters that are read on every request, resolved when the config is
+// loaded
+struct ConfigSnapshot {
+  std::string tunnelbrokerID;
+  std::string defaultKeyserverID;
+  std::string amqpFanoutExchange;
+  std::string amqpDirectExchange;
+  std::string dynamoDBSessionsTable;
+  std::string dynamoDBSessionsVerificationTable;
+  std::string dynamoDBSessionsPublicKeyTable;
+  std::string dynamoDBMessagesTable;
+  std::string dynamoDBMessagesColdTable;
+  DynamoDBClientOptions dynamoDBClientOptions;
+  AmqpChannelOptions amqpChannelOptions;
+  GrpcServerOptions grpcServerOptions;
+  // 0 when the metrics endpoint is disabled
+  uint16_t metricsPort;
+  bool metricsProfiling;
+  tracing::TracingOptions tracingOptions;
+  capture::CaptureOptions captureOptions;
+  bool admissionEnabled;
+};
+
 class ConfigManager {
 private:
+  // Serializes the loads, which replace the map and publish a new snapshot
+  std::mutex loadMutex;
+  std::mutex variablesMapMutex;
   boost::program_options::variables_map variablesMap;
+  std::atomic<const ConfigSnapshot *> snapshot{nullptr};
+  // Snapshots are never freed, so a reference that a reader got before a
+  // reload stays valid
+  std::vector<std::unique_ptr<const ConfigSnapshot>> snapshots;
   void loadConfigFile(const std::string configFilePath);
+  size_t getNumericParameter(std::string param);
+  void publishSnapshot();
 
 public:
   static const std::string OPTION_TUNNELBROKER_ID;
   static const std::string OPTION_DEFAULT_KEYSERVER_ID;
   static const std::string OPTION_AMQP_URI;
   static const std::string OPTION_AMQP_FANOUT_EXCHANGE;
+  static const std::string OPTION_AMQP_DIRECT_EXCHANGE;
+  static const std::string OPTION_AMQP_PUBLISH_CHANNELS;
+  static const std::string OPTION_AMQP_PREFETCH_COUNT;
+  static const std::string OPTION_AMQP_CONSUMER_SHARDS;
+  static const std::string OPTION_AMQP_ENVELOPE_MESSAGES_MAX;
   static const std::string OPTION_DYNAMODB_SESSIONS_TABLE;
   static const std::string OPTION_DYNAMODB_SESSIONS_VERIFICATION_TABLE;
   static const std::string OPTION_DYNAMODB_SESSIONS_PUBLIC_KEY_TABLE;
   static const std::string OPTION_DYNAMODB_MESSAGES_TABLE;
+  static const std::string OPTION_DYNAMODB_MESSAGES_COLD_TABLE;
+  static const std::string OPTION_DYNAMODB_MAX_CONNECTIONS;
+  static const std::string OPTION_DYNAMODB_CONNECT_TIMEOUT_MS;
+  static const std::string OPTION_DYNAMODB_REQUEST_TIMEOUT_MS;
+  static const std::string OPTION_DYNAMODB_TCP_KEEPALIVE_INTERVAL_MS;
+  static const std::string OPTION_GRPC_MAX_CONCURRENT_STREAMS;
+  static const std::string OPTION_GRPC_KEEPALIVE_INTERVAL_MS;
+  static const std::string OPTION_GRPC_KEEPALIVE_TIMEOUT_MS;
+  static const std::string OPTION_BLOB_SERVICE_URL;
+  static const std::string OPTION_BLOB_PAYLOAD_OFFLOAD_THRESHOLD;
+  static const std::string OPTION_METRICS_PORT;
+  static const std::string OPTION_METRICS_PROFILING;
+  static const std::string OPTION_TRACING_SAMPLE_RATIO;
+  static const std::string OPTION_TRACING_COLLECTOR_HOST;
+  static const std::string OPTION_TRACING_COLLECTOR_PORT;
+  static const std::string OPTION_CAPTURE_PATH;
+  static const std::string OPTION_CAPTURE_DURATION_SECONDS;
+  static const std::string OPTION_CAPTURE_MAX_EVENTS;
+  static const std::string OPTION_ADMISSION_ENABLED;
   static const std::string OPTION_NOTIFS_APNS_P12_CERT_PATH;
   static const std::string OPTION_NOTIFS_APNS_P12_CERT_PASSWORD;
   static const std::string OPTION_NOTIFS_APNS_TOPIC;
@@ -30,6 +96,14 @@ public:
   static ConfigManager &getInstance();
   void load();
   std::string getParameter(std::string param);
+  // Lock-free, throws if the config hasn't been loaded yet
+  const ConfigSnapshot &getSnapshot() const;
+  DynamoDBClientOptions getDynamoDBClientOptions();
+  AmqpChannelOptions getAmqpChannelOptions();
+  GrpcServerOptions getGrpcServerOptions();
+  uint16_t getMetricsPort();
+  tracing::TracingOptions getTracingOptions();
+  capture::CaptureOptions getCaptureOptions();
 };
 
 } // namespace config
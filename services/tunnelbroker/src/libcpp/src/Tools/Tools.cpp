@@ -1,54 +1,94 @@
 #include "Tools.h"
 #include "ConfigManager.h"
 #include "Constants.h"
+#include "GlobalTools.h"
 
 #include <glog/logging.h>
 
-#include <chrono>
-#include <random>
-#include <regex>
-
 namespace comm {
 namespace network {
 namespace tools {
 
 std::string generateRandomString(std::size_t length) {
-  const std::string CHARACTERS =
+  static const char CHARACTERS[] =
       "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
-  thread_local std::random_device generator;
-  std::uniform_int_distribution<> distribution(0, CHARACTERS.size() - 1);
-  std::string random_string;
-  for (std::size_t i = 0; i < length; ++i) {
-    random_string += CHARACTERS[distribution(generator)];
+  const size_t charactersCount = sizeof(CHARACTERS) - 1;
+  // Bytes from the last incomplete range are skipped, so that every
+  // character is equally likely
+  const size_t bytesLimit = 256 - 256 % charactersCount;
+  std::string randomString(length, '\0');
+  unsigned char bytes[64];
+  size_t position = 0;
+  while (position < length) {
+    fillRandomBytes(bytes, sizeof(bytes));
+    for (size_t i = 0; i < sizeof(bytes) && position < length; i++) {
+      if (bytes[i] < bytesLimit) {
+        randomString[position++] = CHARACTERS[bytes[i] % charactersCount];
+      }
+    }
+  }
+  return randomString;
+}
+
+namespace {
+
+struct CharacterTable {
+  bool contains[256] = {};
+
+  constexpr CharacterTable(const char *characters) {
+    for (; *characters; characters++) {
+      this->contains[static_cast<unsigned char>(*characters)] = true;
+    }
   }
-  return random_string;
+};
+
+constexpr CharacterTable DEVICEID_CHARACTERS(
+    "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz");
+const std::string DEVICEID_KEYSERVER_PREFIX = "ks:";
+// The other prefixes of DEVICEID_FORMAT_REGEX
+const std::string DEVICEID_PREFIXES[] = {"mobile:", "web:"};
+
+bool hasPrefix(const std::string &value, const std::string &prefix) {
+  return value.compare(0, prefix.size(), prefix) == 0;
 }
 
-bool validateDeviceID(std::string deviceID) {
+} // namespace
+
+bool validateDeviceID(const std::string &deviceID) {
   try {
-    static const std::regex deviceIDKeyserverRegexp("^ks:.*");
-    if (std::regex_match(deviceID, deviceIDKeyserverRegexp)) {
+    if (hasPrefix(deviceID, DEVICEID_KEYSERVER_PREFIX)) {
       return (
           deviceID ==
-          config::ConfigManager::getInstance().getParameter(
-              config::ConfigManager::OPTION_DEFAULT_KEYSERVER_ID));
+          config::ConfigManager::getInstance()
+              .getSnapshot()
+              .defaultKeyserverID);
     }
-    return std::regex_match(deviceID, DEVICEID_FORMAT_REGEX);
   } catch (const std::exception &e) {
     LOG(ERROR) << "Tools: "
                << "Got an exception at `validateDeviceID`: " << e.what();
     return false;
   }
+  for (const std::string &prefix : DEVICEID_PREFIXES) {
+    if (!hasPrefix(deviceID, prefix)) {
+      continue;
+    }
+    if (deviceID.size() != prefix.size() + DEVICEID_CHAR_LENGTH) {
+      return false;
+    }
+    for (size_t i = prefix.size(); i < deviceID.size(); i++) {
+      if (!DEVICEID_CHARACTERS
+               .contains[static_cast<unsigned char>(deviceID[i])]) {
+        return false;
+      }
+    }
+    return true;
+  }
+  return false;
 }
 
-bool validateSessionID(std::string sessionID) {
-  try {
-    return std::regex_match(sessionID, SESSION_ID_FORMAT_REGEX);
-  } catch (const std::exception &e) {
-    LOG(ERROR) << "Tools: "
-               << "Got an exception at `validateSessionId`: " << e.what();
-    return false;
-  }
+bool validateSessionID(const std::string &sessionID) {
+  // SESSION_ID_FORMAT_REGEX is a lowercase UUID of any version
+  return validateUUID(sessionID);
 }
 
 void checkIfNotEmpty(std::string fieldName, std::string stringToCheck) {
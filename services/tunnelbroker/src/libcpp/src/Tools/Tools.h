@@ -8,8 +8,8 @@ namespace network {
 namespace tools {
 
 std::string generateRandomString(std::size_t length);
-bool validateDeviceID(std::string deviceID);
-bool validateSessionID(std::string sessionID);
+bool validateDeviceID(const std::string &deviceID);
+bool validateSessionID(const std::string &sessionID);
 void checkIfNotEmpty(std::string fieldName, std::string stringToCheck);
 void checkIfNotZero(std::string fieldName, uint64_t numberToCheck);
 
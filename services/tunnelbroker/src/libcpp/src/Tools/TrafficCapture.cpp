@@ -0,0 +1,192 @@
+#include "TrafficCapture.h"
+#include "Constants.h"
+#include "GlobalTools.h"
+
+#include <glog/logging.h>
+#include <openssl/sha.h>
+
+#include <stdexcept>
+
+namespace comm {
+namespace network {
+namespace capture {
+
+namespace {
+
+// Enough to tell apart the devices of a trace
+const size_t PSEUDONYM_BYTES = 8;
+
+uint64_t toMicroseconds(std::chrono::steady_clock::duration duration) {
+  if (duration.count() < 0) {
+    return 0;
+  }
+  return std::chrono::duration_cast<std::chrono::microseconds>(duration)
+      .count();
+}
+
+} // namespace
+
+TrafficCapture &TrafficCapture::getInstance() {
+  static TrafficCapture instance;
+  return instance;
+}
+
+TrafficCapture::~TrafficCapture() {
+  this->stop();
+}
+
+void TrafficCapture::start(const CaptureOptions &options) {
+  const std::lock_guard<std::mutex> lock(this->captureMutex);
+  if (this->writer.joinable()) {
+    throw std::runtime_error("Traffic capture has already been started");
+  }
+  this->file.open(options.path, std::ofstream::out | std::ofstream::trunc);
+  if (!this->file.is_open()) {
+    throw std::runtime_error(
+        "Traffic capture can not open file " + options.path);
+  }
+  this->file << "# tunnelbroker traffic trace, started at "
+             << tools::getCurrentTimestamp() << " ms" << std::endl;
+  tools::fillRandomBytes(this->salt.data(), this->salt.size());
+  this->maxEvents = options.maxEvents;
+  this->recordedEvents = 0;
+  this->stopping = false;
+  this->startedAt = std::chrono::steady_clock::now();
+  this->stopAt =
+      this->startedAt + std::chrono::seconds(options.durationSeconds);
+  this->capturing.store(true);
+  this->writer = std::thread([this]() { this->runWriter(); });
+  LOG(INFO) << "Capturing the traffic to " << options.path << " for "
+            << options.durationSeconds << " s";
+}
+
+void TrafficCapture::stop() {
+  {
+    const std::lock_guard<std::mutex> lock(this->captureMutex);
+    this->stopping = true;
+  }
+  this->writeCondition.notify_all();
+  if (this->writer.joinable()) {
+    this->writer.join();
+  }
+}
+
+bool TrafficCapture::isCapturing() const {
+  // Acquires what start has set up for the recording
+  return this->capturing.load();
+}
+
+void TrafficCapture::runWriter() {
+  std::vector<trace::TraceRecord> records;
+  std::unique_lock<std::mutex> lock(this->captureMutex);
+  bool finished = false;
+  while (!finished) {
+    this->writeCondition.wait_for(
+        lock,
+        std::chrono::milliseconds(CAPTURE_FLUSH_INTERVAL_MS),
+        [this]() { return this->stopping || !this->capturing.load(); });
+    finished = this->stopping || !this->capturing.load() ||
+        std::chrono::steady_clock::now() >= this->stopAt;
+    // Events are queued with the lock held and only while capturing, so
+    // these are the last ones once it is off
+    if (finished) {
+      this->capturing.store(false);
+    }
+    records.swap(this->pendingRecords);
+    lock.unlock();
+    for (const trace::TraceRecord &record : records) {
+      this->file << trace::formatTraceRecord(record) << '\n';
+    }
+    this->file.flush();
+    records.clear();
+    lock.lock();
+  }
+  this->file.close();
+  LOG(INFO) << "Traffic capture finished with " << this->recordedEvents
+            << " events";
+}
+
+std::string TrafficCapture::anonymize(const std::string &deviceID) const {
+  std::string salted(this->salt.begin(), this->salt.end());
+  salted += deviceID;
+  std::array<unsigned char, SHA256_DIGEST_LENGTH> digest;
+  SHA256(
+      reinterpret_cast<const unsigned char *>(salted.data()),
+      salted.size(),
+      digest.data());
+  static const char HEX[] = "0123456789abcdef";
+  const size_t separator = deviceID.find(tools::ID_SEPARATOR);
+  std::string pseudonym = separator == std::string::npos
+      ? "unknown"
+      : deviceID.substr(0, separator);
+  pseudonym += tools::ID_SEPARATOR;
+  for (size_t i = 0; i < PSEUDONYM_BYTES; i++) {
+    pseudonym += HEX[digest[i] >> 4];
+    pseudonym += HEX[digest[i] & 0xf];
+  }
+  return pseudonym;
+}
+
+void TrafficCapture::record(
+    const std::string &event,
+    const std::string &deviceID,
+    std::chrono::steady_clock::time_point eventStartedAt,
+    uint64_t count,
+    uint64_t bytes,
+    const std::vector<std::pair<std::string, uint64_t>> &peers) {
+  if (!this->isCapturing()) {
+    return;
+  }
+  trace::TraceRecord record;
+  record.offsetUs = toMicroseconds(eventStartedAt - this->startedAt);
+  record.event = event;
+  record.device = this->anonymize(deviceID);
+  record.peers.reserve(peers.size());
+  for (const std::pair<std::string, uint64_t> &peer : peers) {
+    record.peers.emplace_back(this->anonymize(peer.first), peer.second);
+  }
+  record.count = count;
+  record.bytes = bytes;
+  record.durationUs =
+      toMicroseconds(std::chrono::steady_clock::now() - eventStartedAt);
+  const std::lock_guard<std::mutex> lock(this->captureMutex);
+  if (!this->isCapturing()) {
+    return;
+  }
+  this->pendingRecords.push_back(std::move(record));
+  if (++this->recordedEvents == this->maxEvents) {
+    this->capturing.store(false);
+    this->writeCondition.notify_all();
+  }
+}
+
+CapturedCall::CapturedCall(
+    const std::string &event,
+    const std::string &deviceID,
+    TrafficCapture &capture)
+    : capture(capture),
+      active(capture.isCapturing()),
+      event(this->active ? event : std::string()),
+      deviceID(this->active ? deviceID : std::string()),
+      startedAt(std::chrono::steady_clock::now()) {
+}
+
+CapturedCall::~CapturedCall() {
+  if (this->active) {
+    this->capture.record(
+        this->event,
+        this->deviceID,
+        this->startedAt,
+        this->count,
+        this->bytes,
+        this->peers);
+  }
+}
+
+bool CapturedCall::isActive() const {
+  return this->active;
+}
+
+} // namespace capture
+} // namespace network
+} // namespace comm
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "TrafficTrace.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace comm {
+namespace network {
+namespace capture {
+
+struct CaptureOptions {
+  // The trace is written to this file, see TrafficTrace.h for its format
+  std::string path;
+  // 0 disables the capture
+  size_t durationSeconds;
+  // The capture stops early once it has recorded this many events, 0 for no
+  // limit
+  size_t maxEvents;
+};
+
+// Records the timing and the sizes of the calls to tunnelbroker and of its
+// AMQP traffic for a while, so that the traffic of production can be
+// replayed against a test cluster by the load test. Device IDs are replaced
+// with pseudonyms that are hashed with a salt of the capture, the salt isn't
+// written anywhere.
+//
+// Recording only takes a lock to queue the event, a thread of the capture
+// writes the events to the file. While nothing is being captured, recording
+// costs an atomic load.
+class TrafficCapture {
+  std::atomic<bool> capturing{false};
+  std::array<unsigned char, 32> salt{};
+  std::chrono::steady_clock::time_point startedAt;
+  std::chrono::steady_clock::time_point stopAt;
+  size_t maxEvents = 0;
+
+  std::mutex captureMutex;
+  std::condition_variable writeCondition;
+  std::vector<trace::TraceRecord> pendingRecords;
+  size_t recordedEvents = 0;
+  bool stopping = false;
+  std::ofstream file;
+  std::thread writer;
+
+  void runWriter();
+
+public:
+  static TrafficCapture &getInstance();
+
+  TrafficCapture() = default;
+  ~TrafficCapture();
+  TrafficCapture(const TrafficCapture &) = delete;
+  void operator=(const TrafficCapture &) = delete;
+
+  // Throws if the file can't be opened or a capture has already been started
+  void start(const CaptureOptions &options);
+  // Writes the events that have been recorded so far and closes the file
+  void stop();
+  bool isCapturing() const;
+  // The type of the device is kept, e.g. mobile:3f1c9a0b7d2e4f68
+  std::string anonymize(const std::string &deviceID) const;
+  // - argument peers - the recipients and the sizes of the messages, with
+  // their device IDs
+  void record(
+      const std::string &event,
+      const std::string &deviceID,
+      std::chrono::steady_clock::time_point eventStartedAt,
+      uint64_t count,
+      uint64_t bytes,
+      const std::vector<std::pair<std::string, uint64_t>> &peers = {});
+};
+
+// Records a call with its duration when it goes out of scope. The fields are
+// only worth filling in if the capture is active.
+class CapturedCall {
+  TrafficCapture &capture;
+  const bool active;
+  const std::string event;
+  const std::string deviceID;
+  const std::chrono::steady_clock::time_point startedAt;
+
+public:
+  uint64_t count = 0;
+  uint64_t bytes = 0;
+  std::vector<std::pair<std::string, uint64_t>> peers;
+
+  CapturedCall(
+      const std::string &event,
+      const std::string &deviceID,
+      TrafficCapture &capture = TrafficCapture::getInstance());
+  ~CapturedCall();
+
+  bool isActive() const;
+};
+
+} // namespace capture
+} // namespace network
+} // namespace comm
@@ -0,0 +1,88 @@
+#include "AdaptiveChunker.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <string>
+
+using namespace comm::network;
+
+namespace {
+const size_t TEST_MIN_CHUNK_SIZE = 1024;
+const size_t TEST_MAX_CHUNK_SIZE = 64 * 1024;
+} // namespace
+
+class AdaptiveChunkerTest : public testing::Test {
+protected:
+  AdaptiveChunker chunker{
+      TEST_MIN_CHUNK_SIZE,
+      TEST_MAX_CHUNK_SIZE,
+      std::chrono::milliseconds(100)};
+};
+
+TEST_F(AdaptiveChunkerTest, StartsWithinItsBounds) {
+  EXPECT_EQ(this->chunker.getChunkSize(), TEST_MAX_CHUNK_SIZE);
+  AdaptiveChunker defaultChunker;
+  EXPECT_EQ(defaultChunker.getChunkSize(), ADAPTIVE_CHUNK_SIZE_INITIAL);
+}
+
+TEST_F(AdaptiveChunkerTest, ChunkTakesTheTargetDurationToSend) {
+  // 100 KB/s for 100 ms
+  this->chunker.recordWrite(10 * 1024, std::chrono::milliseconds(100));
+  EXPECT_EQ(this->chunker.getChunkSize(), 10 * 1024);
+}
+
+TEST_F(AdaptiveChunkerTest, LongRoundTripMakesChunksLarger) {
+  this->chunker.recordWrite(10 * 1024, std::chrono::milliseconds(100));
+  this->chunker.recordRoundTrip(std::chrono::milliseconds(300));
+  EXPECT_EQ(this->chunker.getChunkSize(), 30 * 1024);
+}
+
+TEST_F(AdaptiveChunkerTest, ChunkSizeIsClamped) {
+  this->chunker.recordWrite(1, std::chrono::seconds(1));
+  EXPECT_EQ(this->chunker.getChunkSize(), TEST_MIN_CHUNK_SIZE);
+  AdaptiveChunker fastChunker(
+      TEST_MIN_CHUNK_SIZE, TEST_MAX_CHUNK_SIZE, std::chrono::milliseconds(100));
+  fastChunker.recordWrite(1024 * 1024, std::chrono::milliseconds(1));
+  EXPECT_EQ(fastChunker.getChunkSize(), TEST_MAX_CHUNK_SIZE);
+}
+
+TEST_F(AdaptiveChunkerTest, MeasurementsAreSmoothed) {
+  this->chunker.recordWrite(10 * 1024, std::chrono::milliseconds(100));
+  this->chunker.recordWrite(50 * 1024, std::chrono::milliseconds(100));
+  // A quarter of the way from 100 KB/s to 500 KB/s
+  EXPECT_EQ(this->chunker.getChunkSize(), 20 * 1024);
+}
+
+TEST_F(AdaptiveChunkerTest, EmptyMeasurementsAreIgnored) {
+  this->chunker.recordWrite(0, std::chrono::milliseconds(100));
+  this->chunker.recordWrite(1024, std::chrono::milliseconds(0));
+  this->chunker.recordRoundTrip(std::chrono::milliseconds(0));
+  EXPECT_EQ(this->chunker.getChunkSize(), TEST_MAX_CHUNK_SIZE);
+}
+
+TEST_F(AdaptiveChunkerTest, DataIsSplitIntoChunksOfTheCurrentSize) {
+  this->chunker.recordWrite(10 * 1024, std::chrono::milliseconds(100));
+  std::string data(25 * 1024, 'a');
+  data[20 * 1024] = 'b';
+  size_t offset = 0;
+  std::string chunk;
+  ASSERT_TRUE(this->chunker.takeChunk(data, offset, chunk));
+  EXPECT_EQ(chunk.size(), 10 * 1024);
+  ASSERT_TRUE(this->chunker.takeChunk(data, offset, chunk));
+  EXPECT_EQ(chunk.size(), 10 * 1024);
+  ASSERT_TRUE(this->chunker.takeChunk(data, offset, chunk));
+  EXPECT_EQ(chunk.size(), 5 * 1024);
+  EXPECT_EQ(chunk[0], 'b');
+  EXPECT_FALSE(this->chunker.takeChunk(data, offset, chunk));
+}
+
+TEST_F(AdaptiveChunkerTest, DataThatFitsIsTakenWhole) {
+  std::string data(1024, 'a');
+  size_t offset = 0;
+  std::string chunk;
+  ASSERT_TRUE(this->chunker.takeChunk(data, offset, chunk));
+  EXPECT_EQ(chunk, std::string(1024, 'a'));
+  EXPECT_TRUE(data.empty());
+  EXPECT_FALSE(this->chunker.takeChunk(data, offset, chunk));
+}
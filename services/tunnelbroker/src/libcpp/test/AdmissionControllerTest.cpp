@@ -0,0 +1,116 @@
+#include "AdmissionController.h"
+#include "Constants.h"
+#include "Metrics.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+using namespace comm::network;
+using namespace comm::network::admission;
+
+TEST(AdmissionControllerTest, OnlyLowPriorityWorkIsShed) {
+  EXPECT_EQ(
+      decideAdmission(OverloadLevel::NORMAL, WorkPriority::BULK),
+      Admission::ADMIT);
+  EXPECT_EQ(
+      decideAdmission(OverloadLevel::ELEVATED, WorkPriority::BULK),
+      Admission::DEFER);
+  EXPECT_EQ(
+      decideAdmission(OverloadLevel::ELEVATED, WorkPriority::CONNECTION),
+      Admission::ADMIT);
+  EXPECT_EQ(
+      decideAdmission(OverloadLevel::CRITICAL, WorkPriority::BULK),
+      Admission::REJECT);
+  EXPECT_EQ(
+      decideAdmission(OverloadLevel::CRITICAL, WorkPriority::CONNECTION),
+      Admission::REJECT);
+  EXPECT_EQ(
+      decideAdmission(OverloadLevel::CRITICAL, WorkPriority::INTERACTIVE),
+      Admission::ADMIT);
+}
+
+TEST(AdmissionControllerTest, TheHighestSignalGivesTheLevel) {
+  LoadSignals signals;
+  EXPECT_EQ(OverloadDetector::classify(signals), OverloadLevel::NORMAL);
+  signals.amqpReady = false;
+  EXPECT_EQ(OverloadDetector::classify(signals), OverloadLevel::ELEVATED);
+  signals.slowDatabaseWrites = ADMISSION_SLOW_SHARE_CRITICAL;
+  EXPECT_EQ(OverloadDetector::classify(signals), OverloadLevel::CRITICAL);
+  signals = LoadSignals();
+  signals.queuedMessages = ADMISSION_QUEUED_MESSAGES_ELEVATED;
+  EXPECT_EQ(OverloadDetector::classify(signals), OverloadLevel::ELEVATED);
+  signals.sendsInProgress = ADMISSION_SENDS_IN_PROGRESS_CRITICAL;
+  EXPECT_EQ(OverloadDetector::classify(signals), OverloadLevel::CRITICAL);
+}
+
+TEST(AdmissionControllerTest, LevelStepsDownAfterTheRecoveryTime) {
+  OverloadDetector detector(std::chrono::seconds(1));
+  const std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  LoadSignals overloaded;
+  overloaded.slowPublishConfirms = 1;
+  const LoadSignals normal;
+  EXPECT_EQ(detector.update(overloaded, start), OverloadLevel::CRITICAL);
+  EXPECT_EQ(detector.update(normal, start), OverloadLevel::CRITICAL);
+  EXPECT_EQ(
+      detector.update(normal, start + std::chrono::milliseconds(900)),
+      OverloadLevel::CRITICAL);
+  EXPECT_EQ(
+      detector.update(normal, start + std::chrono::seconds(1)),
+      OverloadLevel::ELEVATED);
+  EXPECT_EQ(
+      detector.update(normal, start + std::chrono::milliseconds(1500)),
+      OverloadLevel::ELEVATED);
+  EXPECT_EQ(
+      detector.update(normal, start + std::chrono::seconds(2)),
+      OverloadLevel::NORMAL);
+  // Rising doesn't wait
+  EXPECT_EQ(
+      detector.update(overloaded, start + std::chrono::seconds(2)),
+      OverloadLevel::CRITICAL);
+}
+
+TEST(AdmissionControllerTest, SlowShareIsTheShareOfTheInterval) {
+  metrics::Histogram histogram;
+  histogram.record(100000);
+  SlowShareWindow window(histogram, 1023);
+  for (size_t i = 0; i < ADMISSION_MIN_INTERVAL_OPERATIONS - 1; i++) {
+    histogram.record(100000);
+  }
+  // Too few operations to count
+  EXPECT_EQ(window.take(), 0);
+  for (size_t i = 0; i < ADMISSION_MIN_INTERVAL_OPERATIONS; i++) {
+    histogram.record(i % 2 ? 100 : 100000);
+  }
+  EXPECT_DOUBLE_EQ(window.take(), 0.5);
+  EXPECT_EQ(window.take(), 0);
+}
+
+TEST(AdmissionControllerTest, SendsInProgressAreCounted) {
+  LoadSignals signals;
+  AdmissionController controller(
+      [&signals]() { return signals; },
+      std::chrono::milliseconds(0),
+      std::chrono::milliseconds(0));
+  EXPECT_EQ(controller.admit(WorkPriority::BULK), Admission::ADMIT);
+  std::vector<std::unique_ptr<AdmissionController::SendInProgress>> sends;
+  for (size_t i = 0; i < ADMISSION_SENDS_IN_PROGRESS_CRITICAL; i++) {
+    sends.push_back(
+        std::make_unique<AdmissionController::SendInProgress>(controller));
+  }
+  EXPECT_EQ(controller.admit(WorkPriority::BULK), Admission::REJECT);
+  EXPECT_EQ(controller.admit(WorkPriority::INTERACTIVE), Admission::ADMIT);
+  EXPECT_EQ(controller.getLevel(), OverloadLevel::CRITICAL);
+  controller.setEnabled(false);
+  EXPECT_EQ(controller.admit(WorkPriority::CONNECTION), Admission::ADMIT);
+  controller.setEnabled(true);
+  sends.clear();
+  // Recovering starts, then the level steps down on every evaluation
+  controller.admit(WorkPriority::BULK);
+  EXPECT_EQ(controller.admit(WorkPriority::BULK), Admission::DEFER);
+  controller.admit(WorkPriority::BULK);
+  EXPECT_EQ(controller.admit(WorkPriority::BULK), Admission::ADMIT);
+}
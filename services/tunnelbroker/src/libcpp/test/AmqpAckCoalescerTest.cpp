@@ -0,0 +1,105 @@
+#include "AmqpAckCoalescer.h"
+#include "Constants.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+using namespace comm::network;
+
+class AmqpAckCoalescerTest : public testing::Test {};
+
+TEST(AmqpAckCoalescerTest, ContiguousAcksAreSentAsOneMultipleAck) {
+  AmqpAckCoalescer coalescer;
+  for (uint64_t tag = 1; tag <= 10; tag++) {
+    EXPECT_FALSE(coalescer.add(tag));
+  }
+  const std::vector<AmqpAck> acks = coalescer.flush(false);
+  ASSERT_EQ(acks.size(), 1);
+  EXPECT_EQ(acks[0].deliveryTag, 10);
+  EXPECT_TRUE(acks[0].multiple);
+  EXPECT_TRUE(coalescer.flush(true).empty())
+      << "Acks that were sent should not be sent again";
+}
+
+TEST(AmqpAckCoalescerTest, MultipleAckStopsBeforeUnacknowledgedTag) {
+  AmqpAckCoalescer coalescer;
+  coalescer.add(1);
+  coalescer.add(2);
+  coalescer.add(4);
+  std::vector<AmqpAck> acks = coalescer.flush(false);
+  ASSERT_EQ(acks.size(), 1);
+  EXPECT_EQ(acks[0].deliveryTag, 2);
+  EXPECT_TRUE(acks[0].multiple);
+
+  coalescer.add(3);
+  acks = coalescer.flush(false);
+  ASSERT_EQ(acks.size(), 1);
+  EXPECT_EQ(acks[0].deliveryTag, 4);
+  EXPECT_TRUE(acks[0].multiple);
+}
+
+TEST(AmqpAckCoalescerTest, OutOfOrderAcksAreSentOnlyOnce) {
+  AmqpAckCoalescer coalescer;
+  coalescer.add(1);
+  coalescer.add(3);
+  coalescer.add(4);
+  std::vector<AmqpAck> acks = coalescer.flush(true);
+  ASSERT_EQ(acks.size(), 3);
+  EXPECT_EQ(acks[0].deliveryTag, 1);
+  EXPECT_FALSE(acks[0].multiple);
+  EXPECT_EQ(acks[1].deliveryTag, 3);
+  EXPECT_FALSE(acks[1].multiple);
+  EXPECT_EQ(acks[2].deliveryTag, 4);
+  EXPECT_FALSE(acks[2].multiple);
+
+  // Tags 3 and 4 are already acknowledged, so the gap is filled by a single
+  // ack of tag 2
+  coalescer.add(2);
+  acks = coalescer.flush(true);
+  ASSERT_EQ(acks.size(), 1);
+  EXPECT_EQ(acks[0].deliveryTag, 2);
+  EXPECT_FALSE(acks[0].multiple);
+
+  coalescer.add(5);
+  coalescer.add(6);
+  acks = coalescer.flush(false);
+  ASSERT_EQ(acks.size(), 1);
+  EXPECT_EQ(acks[0].deliveryTag, 6);
+  EXPECT_TRUE(acks[0].multiple);
+}
+
+TEST(AmqpAckCoalescerTest, AddReturnsTrueOnceFlushCountIsReached) {
+  AmqpAckCoalescer coalescer;
+  for (uint64_t tag = 1; tag < AMQP_ACK_FLUSH_COUNT; tag++) {
+    EXPECT_FALSE(coalescer.add(tag));
+  }
+  EXPECT_TRUE(coalescer.add(AMQP_ACK_FLUSH_COUNT));
+  coalescer.flush(false);
+  EXPECT_FALSE(coalescer.add(AMQP_ACK_FLUSH_COUNT + 1));
+}
+
+TEST(AmqpAckCoalescerTest, DuplicateAcksAreIgnored) {
+  AmqpAckCoalescer coalescer;
+  coalescer.add(1);
+  coalescer.add(1);
+  coalescer.add(3);
+  coalescer.add(3);
+  const std::vector<AmqpAck> acks = coalescer.flush(true);
+  ASSERT_EQ(acks.size(), 2);
+  EXPECT_EQ(acks[0].deliveryTag, 1);
+  EXPECT_EQ(acks[1].deliveryTag, 3);
+}
+
+TEST(AmqpAckCoalescerTest, ResetDropsPendingAcks) {
+  AmqpAckCoalescer coalescer;
+  coalescer.add(1);
+  coalescer.add(2);
+  coalescer.reset();
+  EXPECT_TRUE(coalescer.flush(true).empty());
+  coalescer.add(1);
+  const std::vector<AmqpAck> acks = coalescer.flush(false);
+  ASSERT_EQ(acks.size(), 1);
+  EXPECT_EQ(acks[0].deliveryTag, 1);
+  EXPECT_FALSE(acks[0].multiple);
+}
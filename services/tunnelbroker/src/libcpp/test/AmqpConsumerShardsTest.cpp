@@ -0,0 +1,93 @@
+#include "AmqpConsumerShards.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace comm::network;
+
+class AmqpConsumerShardsTest : public testing::Test {};
+
+TEST(AmqpConsumerShardsTest, TasksOfAKeyRunInOrder) {
+  const size_t keysCount = 16;
+  const size_t tasksCount = 1000;
+  std::mutex orderMutex;
+  std::unordered_map<std::string, std::vector<size_t>> order;
+  std::promise<void> done;
+  std::atomic<size_t> remaining{keysCount * tasksCount};
+  {
+    AmqpConsumerShards shards(4);
+    for (size_t i = 0; i < tasksCount; i++) {
+      for (size_t key = 0; key < keysCount; key++) {
+        const std::string deviceID = "device" + std::to_string(key);
+        shards.dispatch(deviceID, [&, deviceID, i]() {
+          {
+            const std::lock_guard<std::mutex> lock(orderMutex);
+            order[deviceID].push_back(i);
+          }
+          if (remaining.fetch_sub(1) == 1) {
+            done.set_value();
+          }
+        });
+      }
+    }
+    ASSERT_EQ(
+        done.get_future().wait_for(std::chrono::seconds(10)),
+        std::future_status::ready);
+  }
+  ASSERT_EQ(order.size(), keysCount);
+  for (const auto &[deviceID, indexes] : order) {
+    ASSERT_EQ(indexes.size(), tasksCount);
+    for (size_t i = 0; i < tasksCount; i++) {
+      EXPECT_EQ(indexes[i], i) << "Tasks of " << deviceID << " reordered";
+    }
+  }
+}
+
+TEST(AmqpConsumerShardsTest, ClearDropsQueuedTasks) {
+  AmqpConsumerShards shards(1);
+  std::promise<void> started;
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  std::atomic<size_t> ran{0};
+  shards.dispatch("device", [&]() {
+    started.set_value();
+    released.wait();
+  });
+  started.get_future().wait();
+  for (size_t i = 0; i < 10; i++) {
+    shards.dispatch("device", [&]() { ran++; });
+  }
+  shards.clear();
+  std::promise<void> afterClear;
+  shards.dispatch("device", [&]() { afterClear.set_value(); });
+  release.set_value();
+  afterClear.get_future().wait();
+  EXPECT_EQ(ran, 0) << "Tasks queued before clear should not run";
+}
+
+TEST(AmqpConsumerShardsTest, WaitUntilIdleWaitsForTheRunningTasks) {
+  AmqpConsumerShards shards(2);
+  EXPECT_TRUE(shards.waitUntilIdle(std::chrono::steady_clock::now()));
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  std::atomic<size_t> ran{0};
+  for (size_t i = 0; i < 10; i++) {
+    shards.dispatch("device" + std::to_string(i), [&]() {
+      released.wait();
+      ran++;
+    });
+  }
+  EXPECT_FALSE(shards.waitUntilIdle(
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(50)));
+  release.set_value();
+  EXPECT_TRUE(shards.waitUntilIdle(
+      std::chrono::steady_clock::now() + std::chrono::seconds(10)));
+  EXPECT_EQ(ran, 10);
+}
@@ -0,0 +1,98 @@
+#include "AmqpEnvelope.h"
+#include "Constants.h"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace comm::network;
+
+class AmqpEnvelopeTest : public testing::Test {};
+
+TEST(AmqpEnvelopeTest, MessagesAreReadAsTheyWereWritten) {
+  database::MessageItem first{
+      "message1", "web:sender", "mobile:receiver", "payload1", ""};
+  database::MessageItem second{
+      "message2", "web:sender", "mobile:receiver", "", "blobHash"};
+  second.setBulk(true);
+  AmqpEnvelopeWriter writer;
+  writer.add(first, "");
+  writer.add(second, "00-traceID-spanID-01");
+  EXPECT_EQ(writer.getCount(), 2);
+
+  const std::vector<AmqpEnvelopeMessage> messages =
+      readAmqpEnvelope(writer.getBody().data(), writer.getBody().size());
+  ASSERT_EQ(messages.size(), 2);
+  EXPECT_EQ(messages[0].messageID, "message1");
+  EXPECT_EQ(messages[0].fromDeviceID, "web:sender");
+  EXPECT_EQ(messages[0].toDeviceID, "mobile:receiver");
+  EXPECT_EQ(messages[0].payload, "payload1");
+  EXPECT_TRUE(messages[0].traceparent.empty());
+  EXPECT_TRUE(messages[0].blobHashes.empty());
+  EXPECT_FALSE(messages[0].bulk);
+  EXPECT_EQ(messages[1].messageID, "message2");
+  EXPECT_TRUE(messages[1].payload.empty());
+  EXPECT_EQ(messages[1].traceparent, "00-traceID-spanID-01");
+  EXPECT_EQ(messages[1].blobHashes, "blobHash");
+  EXPECT_TRUE(messages[1].bulk);
+}
+
+TEST(AmqpEnvelopeTest, PayloadWithAnyBytesIsKept) {
+  const std::string payload("\0\xff\n\x01payload", 11);
+  const database::MessageItem message{
+      "message", "web:sender", "mobile:receiver", payload, ""};
+  AmqpEnvelopeWriter writer;
+  writer.add(message, "");
+  const std::vector<AmqpEnvelopeMessage> messages =
+      readAmqpEnvelope(writer.getBody().data(), writer.getBody().size());
+  ASSERT_EQ(messages.size(), 1);
+  EXPECT_EQ(messages[0].payload, payload);
+}
+
+TEST(AmqpEnvelopeTest, MalformedEnvelopesThrow) {
+  const database::MessageItem message{
+      "message", "web:sender", "mobile:receiver", "payload", ""};
+  AmqpEnvelopeWriter writer;
+  writer.add(message, "");
+  const std::string body = writer.getBody();
+  EXPECT_THROW(readAmqpEnvelope(body.data(), 0), std::runtime_error);
+  EXPECT_THROW(
+      readAmqpEnvelope(body.data(), body.size() - 1), std::runtime_error)
+      << "A cut off envelope should not be read";
+  std::string otherVersion = body;
+  otherVersion[0] = static_cast<char>(AMQP_ENVELOPE_VERSION + 1);
+  EXPECT_THROW(
+      readAmqpEnvelope(otherVersion.data(), otherVersion.size()),
+      std::runtime_error);
+}
+
+TEST(AmqpEnvelopeTest, MessagesArePackedByReceiverInOrder) {
+  const std::vector<database::MessageItem> messages{
+      {"message1", "web:sender", "mobile:first", "payload", ""},
+      {"message2", "web:sender", "mobile:second", "payload", ""},
+      {"message3", "web:sender", "mobile:first", "payload", ""},
+      {"message4", "web:sender", "mobile:first", "payload", ""},
+      {"message5", "web:sender", "mobile:second", "payload", ""}};
+  const std::vector<std::vector<const database::MessageItem *>> envelopes =
+      packAmqpEnvelopes(messages, 2);
+  ASSERT_EQ(envelopes.size(), 3);
+  ASSERT_EQ(envelopes[0].size(), 2);
+  EXPECT_EQ(envelopes[0][0], &messages[0]);
+  EXPECT_EQ(envelopes[0][1], &messages[2]);
+  ASSERT_EQ(envelopes[1].size(), 2);
+  EXPECT_EQ(envelopes[1][0], &messages[1]);
+  EXPECT_EQ(envelopes[1][1], &messages[4]);
+  ASSERT_EQ(envelopes[2].size(), 1)
+      << "A full envelope should be followed by a new one";
+  EXPECT_EQ(envelopes[2][0], &messages[3]);
+}
+
+TEST(AmqpEnvelopeTest, LargePayloadsAreNotPackedTogether) {
+  const std::string payload(AMQP_ENVELOPE_PAYLOAD_SIZE_MAX, 'a');
+  const std::vector<database::MessageItem> messages{
+      {"message1", "web:sender", "mobile:receiver", payload, ""},
+      {"message2", "web:sender", "mobile:receiver", payload, ""}};
+  EXPECT_EQ(packAmqpEnvelopes(messages, AMQP_ENVELOPE_MESSAGES_MAX).size(), 2);
+}
@@ -37,6 +37,8 @@ TEST_F(AmqpManagerTest, SentAndPopedMessagesAreSameOnStaticData) {
       "6d37StvXBzfJoZVU79UeOF2bFvb3DNoArEOe";
   const database::MessageItem messageItem{
       messageID, fromDeviceID, toDeviceID, payload, ""};
+  // Messages are only routed to the instance that the device is connected to
+  ASSERT_TRUE(AmqpManager::getInstance().addDeviceStream(toDeviceID).get());
   // To properly test multi-thread delivery we should send in another thread
   std::thread sendThread([&messageItem]() {
     EXPECT_EQ(AmqpManager::getInstance().send(&messageItem), true);
@@ -48,6 +50,7 @@ TEST_F(AmqpManagerTest, SentAndPopedMessagesAreSameOnStaticData) {
   EXPECT_EQ(fromDeviceID, receivedMessage.fromDeviceID);
   EXPECT_EQ(payload, receivedMessage.payload);
   AmqpManager::getInstance().ack(receivedMessage.deliveryTag);
+  AmqpManager::getInstance().removeDeviceStream(toDeviceID);
 }
 
 TEST_F(AmqpManagerTest, SentAndPopedMessagesAreSameOnGeneratedData) {
@@ -59,6 +62,7 @@ TEST_F(AmqpManagerTest, SentAndPopedMessagesAreSameOnGeneratedData) {
   const std::string payload = tools::generateRandomString(512);
   const database::MessageItem messageItem{
       messageID, fromDeviceID, toDeviceID, payload, ""};
+  ASSERT_TRUE(AmqpManager::getInstance().addDeviceStream(toDeviceID).get());
   // To properly test multi-thread delivery we should send in another thread
   std::thread sendThread([&messageItem]() {
     EXPECT_EQ(AmqpManager::getInstance().send(&messageItem), true);
@@ -79,6 +83,7 @@ TEST_F(AmqpManagerTest, SentAndPopedMessagesAreSameOnGeneratedData) {
       << "\" differs from what was got from amqp message "
       << receivedMessage.payload;
   AmqpManager::getInstance().ack(receivedMessage.deliveryTag);
+  AmqpManager::getInstance().removeDeviceStream(toDeviceID);
 }
 
 TEST_F(AmqpManagerTest, MultipleThreadsMessagesSendingStressTest) {
@@ -87,6 +92,8 @@ TEST_F(AmqpManagerTest, MultipleThreadsMessagesSendingStressTest) {
   const std::string toDeviceID =
       "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
 
+  ASSERT_TRUE(AmqpManager::getInstance().addDeviceStream(toDeviceID).get());
+
   std::vector<std::thread> sendingThreads;
   for (size_t i = 0; i < THREADS_NUMBER; ++i) {
     sendingThreads.push_back(std::thread([toDeviceID, MESSAGES_NUMBER]() {
@@ -112,4 +119,5 @@ TEST_F(AmqpManagerTest, MultipleThreadsMessagesSendingStressTest) {
   }
   EXPECT_TRUE(DeliveryBroker::getInstance().isEmpty(toDeviceID));
   EXPECT_EQ(receivedMessage.size(), MESSAGES_NUMBER * THREADS_NUMBER);
+  AmqpManager::getInstance().removeDeviceStream(toDeviceID);
 }
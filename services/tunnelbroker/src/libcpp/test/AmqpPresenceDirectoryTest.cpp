@@ -0,0 +1,59 @@
+#include "AmqpPresenceDirectory.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <string>
+
+using namespace comm::network;
+
+class AmqpPresenceDirectoryTest : public testing::Test {
+protected:
+  const std::chrono::milliseconds ttl{1000};
+  const std::chrono::steady_clock::time_point now =
+      std::chrono::steady_clock::now();
+  AmqpPresenceDirectory directory{ttl};
+};
+
+TEST_F(AmqpPresenceDirectoryTest, DeviceIsOnlineAtItsBroker) {
+  this->directory.setOnline("broker1", {"device1"}, this->now);
+  EXPECT_EQ(this->directory.findBroker("device1", this->now), "broker1");
+  this->directory.setOffline("broker1", {"device1"});
+  EXPECT_EQ(this->directory.findBroker("device1", this->now), std::nullopt);
+}
+
+TEST_F(AmqpPresenceDirectoryTest, OfflineFromPreviousBrokerIsIgnored) {
+  this->directory.setOnline("broker1", {"device1"}, this->now);
+  this->directory.setOnline("broker2", {"device1"}, this->now);
+  this->directory.setOffline("broker1", {"device1"});
+  EXPECT_EQ(this->directory.findBroker("device1", this->now), "broker2")
+      << "A device that moved to another broker should stay online there";
+}
+
+TEST_F(AmqpPresenceDirectoryTest, HeartbeatReplacesDevicesOfBroker) {
+  this->directory.setOnline("broker1", {"device1", "device2"}, this->now);
+  this->directory.setOnline("broker2", {"device3"}, this->now);
+  this->directory.onHeartbeat("broker1", {"device2", "device4"}, this->now);
+  EXPECT_EQ(this->directory.findBroker("device1", this->now), std::nullopt);
+  EXPECT_EQ(this->directory.findBroker("device2", this->now), "broker1");
+  EXPECT_EQ(this->directory.findBroker("device3", this->now), "broker2");
+  EXPECT_EQ(this->directory.findBroker("device4", this->now), "broker1");
+}
+
+TEST_F(AmqpPresenceDirectoryTest, DevicesExpireWithoutHeartbeat) {
+  this->directory.setOnline("broker1", {"device1"}, this->now);
+  this->directory.onHeartbeat("broker2", {"device2"}, this->now + this->ttl);
+  EXPECT_EQ(
+      this->directory.findBroker("device1", this->now + this->ttl),
+      std::nullopt)
+      << "Devices of a broker that went away should expire";
+  EXPECT_EQ(
+      this->directory.findBroker("device2", this->now + this->ttl),
+      "broker2");
+}
+
+TEST_F(AmqpPresenceDirectoryTest, DirectoryIsCompleteAfterTTL) {
+  this->directory.reset(this->now);
+  EXPECT_FALSE(this->directory.isComplete(this->now));
+  EXPECT_TRUE(this->directory.isComplete(this->now + this->ttl));
+}
@@ -0,0 +1,100 @@
+#include "ChunkCompression.h"
+#include "GlobalConstants.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <stdexcept>
+#include <string>
+
+using namespace comm::network;
+
+namespace {
+
+std::string repetitiveData(size_t size) {
+  std::string data;
+  while (data.size() < size) {
+    data += "the same line of a log, over and over again\n";
+  }
+  data.resize(size);
+  return data;
+}
+
+std::string randomData(size_t size) {
+  std::mt19937 generator(42);
+  std::uniform_int_distribution<int> byte(0, 255);
+  std::string data(size, '\0');
+  for (char &c : data) {
+    c = static_cast<char>(byte(generator));
+  }
+  return data;
+}
+
+} // namespace
+
+class ChunkCompressionTest : public testing::Test {
+protected:
+  ChunkCompressor compressor{CHUNK_COMPRESSION_DEFAULT_LEVEL};
+
+  std::string roundTrip(const std::string &data, size_t &encodedSize) {
+    std::string chunk = data;
+    this->compressor.encode(chunk);
+    encodedSize = chunk.size();
+    ChunkCompressor::decode(chunk);
+    return chunk;
+  }
+};
+
+TEST_F(ChunkCompressionTest, CompressibleChunkIsCompressed) {
+  const std::string data = repetitiveData(64 * 1024);
+  size_t encodedSize;
+  EXPECT_EQ(this->roundTrip(data, encodedSize), data);
+  EXPECT_LT(encodedSize, data.size() / 10);
+}
+
+TEST_F(ChunkCompressionTest, LargeCompressibleChunkIsCompressed) {
+  // Past the sample that tells whether a chunk is worth compressing
+  const std::string data = repetitiveData(1024 * 1024);
+  size_t encodedSize;
+  EXPECT_EQ(this->roundTrip(data, encodedSize), data);
+  EXPECT_LT(encodedSize, data.size() / 10);
+}
+
+TEST_F(ChunkCompressionTest, IncompressibleChunkIsSentAsItIs) {
+  const std::string data = randomData(64 * 1024);
+  size_t encodedSize;
+  EXPECT_EQ(this->roundTrip(data, encodedSize), data);
+  EXPECT_EQ(encodedSize, data.size() + 1);
+}
+
+TEST_F(ChunkCompressionTest, SmallChunkIsSentAsItIs) {
+  const std::string data = repetitiveData(CHUNK_COMPRESSION_MIN_SIZE - 1);
+  size_t encodedSize;
+  EXPECT_EQ(this->roundTrip(data, encodedSize), data);
+  EXPECT_EQ(encodedSize, data.size() + 1);
+}
+
+TEST_F(ChunkCompressionTest, EmptyChunkRoundTrips) {
+  size_t encodedSize;
+  EXPECT_EQ(this->roundTrip("", encodedSize), "");
+  EXPECT_EQ(encodedSize, 1);
+}
+
+TEST_F(ChunkCompressionTest, MalformedChunksAreRejected) {
+  std::string empty;
+  EXPECT_THROW(ChunkCompressor::decode(empty), std::runtime_error);
+  std::string unknownEncoding = std::string(1, 7) + "data";
+  EXPECT_THROW(ChunkCompressor::decode(unknownEncoding), std::runtime_error);
+  std::string corrupted = repetitiveData(64 * 1024);
+  this->compressor.encode(corrupted);
+  corrupted.resize(corrupted.size() / 2);
+  EXPECT_THROW(ChunkCompressor::decode(corrupted), std::runtime_error);
+}
+
+TEST_F(ChunkCompressionTest, ChunkLargerThanTheLimitIsRejected) {
+  // More than the decoder accepts, so that a small chunk can't make the
+  // receiver allocate without bounds
+  std::string chunk = repetitiveData(GRPC_CHUNK_SIZE_LIMIT + 1);
+  this->compressor.encode(chunk);
+  EXPECT_THROW(ChunkCompressor::decode(chunk), std::runtime_error);
+}
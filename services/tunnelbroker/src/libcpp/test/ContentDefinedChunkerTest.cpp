@@ -0,0 +1,115 @@
+#include "ContentDefinedChunker.h"
+#include "GlobalConstants.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+using namespace comm::network;
+
+namespace {
+
+const size_t TEST_DATA_SIZE = 4 * 1024 * 1024;
+
+std::string randomData(size_t size, unsigned seed) {
+  std::mt19937 generator(seed);
+  std::uniform_int_distribution<int> byte(0, 255);
+  std::string data(size, '\0');
+  for (char &c : data) {
+    c = static_cast<char>(byte(generator));
+  }
+  return data;
+}
+
+std::unordered_set<std::string>
+hashesOf(const std::vector<ContentChunk> &chunks) {
+  std::unordered_set<std::string> hashes;
+  for (const ContentChunk &chunk : chunks) {
+    hashes.insert(chunk.hash);
+  }
+  return hashes;
+}
+
+} // namespace
+
+class ContentDefinedChunkerTest : public testing::Test {
+protected:
+  ContentDefinedChunker chunker;
+};
+
+TEST_F(ContentDefinedChunkerTest, ChunksCoverTheDataWithinTheirBounds) {
+  const std::string data = randomData(TEST_DATA_SIZE, 1);
+  const ContentChunkerOptions options;
+  const std::vector<ContentChunk> chunks = this->chunker.split(data);
+  ASSERT_FALSE(chunks.empty());
+  size_t offset = 0;
+  for (size_t i = 0; i < chunks.size(); i++) {
+    EXPECT_EQ(chunks[i].offset, offset);
+    EXPECT_LE(chunks[i].size, options.maxChunkSize);
+    if (i + 1 < chunks.size()) {
+      EXPECT_GE(chunks[i].size, options.minChunkSize);
+    }
+    EXPECT_EQ(chunks[i].hash.size(), 64);
+    offset += chunks[i].size;
+  }
+  EXPECT_EQ(offset, data.size());
+  // Normalized chunking keeps the sizes close to the average
+  const size_t averageSize = data.size() / chunks.size();
+  EXPECT_GT(averageSize, options.averageChunkSize / 2);
+  EXPECT_LT(averageSize, options.averageChunkSize * 2);
+}
+
+TEST_F(ContentDefinedChunkerTest, SameDataGivesSameChunks) {
+  const std::string data = randomData(1024 * 1024, 2);
+  const std::vector<ContentChunk> chunks = this->chunker.split(data);
+  const std::vector<ContentChunk> again = this->chunker.split(data);
+  ASSERT_EQ(chunks.size(), again.size());
+  for (size_t i = 0; i < chunks.size(); i++) {
+    EXPECT_EQ(chunks[i].offset, again[i].offset);
+    EXPECT_EQ(chunks[i].hash, again[i].hash);
+  }
+}
+
+TEST_F(ContentDefinedChunkerTest, EditsOnlyChangeTheChunksAroundThem) {
+  const std::string data = randomData(TEST_DATA_SIZE, 3);
+  std::string edited = data;
+  edited.insert(TEST_DATA_SIZE / 3, "inserted in the middle of a chunk");
+  edited.erase(2 * TEST_DATA_SIZE / 3, 100);
+
+  const std::vector<ContentChunk> chunks = this->chunker.split(data);
+  const std::vector<ContentChunk> editedChunks = this->chunker.split(edited);
+  const std::vector<ContentChunk> missingChunks =
+      findMissingChunks(editedChunks, hashesOf(chunks));
+  // Each edit changes the chunk it falls in, and at most the next one
+  EXPECT_GE(missingChunks.size(), 2);
+  EXPECT_LE(missingChunks.size(), 4);
+}
+
+TEST_F(ContentDefinedChunkerTest, SmallDataIsOneChunk) {
+  const std::vector<ContentChunk> chunks = this->chunker.split("small");
+  ASSERT_EQ(chunks.size(), 1);
+  EXPECT_EQ(chunks[0].offset, 0);
+  EXPECT_EQ(chunks[0].size, 5);
+  EXPECT_TRUE(this->chunker.split("").empty());
+}
+
+TEST(ContentDefinedChunkerToolsTest, MissingChunksAreListedOnce) {
+  const std::vector<ContentChunk> chunks{
+      {0, 1, "a"}, {1, 1, "b"}, {2, 1, "a"}, {3, 1, "c"}};
+  const std::vector<ContentChunk> missingChunks =
+      findMissingChunks(chunks, {"b"});
+  ASSERT_EQ(missingChunks.size(), 2);
+  EXPECT_EQ(missingChunks[0].hash, "a");
+  EXPECT_EQ(missingChunks[0].offset, 0);
+  EXPECT_EQ(missingChunks[1].hash, "c");
+}
+
+TEST(ContentDefinedChunkerToolsTest, HashesAreJoinedLikeHolders) {
+  EXPECT_EQ(joinChunkHashes({}), "");
+  EXPECT_EQ(
+      joinChunkHashes({{0, 1, "a"}, {1, 1, "b"}}),
+      std::string("a") + ATTACHMENT_DELIMITER + "b");
+}
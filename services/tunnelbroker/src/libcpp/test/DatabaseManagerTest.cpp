@@ -1,12 +1,14 @@
 #include "DatabaseManager.h"
 #include "ConfigManager.h"
 #include "Constants.h"
+#include "DynamoDBTools.h"
 #include "GlobalTools.h"
 #include "Tools.h"
 
 #include <gtest/gtest.h>
 
 #include <ctime>
+#include <future>
 #include <memory>
 #include <string>
 
@@ -20,10 +22,32 @@ protected:
   }
 
   virtual void TearDown() {
+    releaseDynamoDBClient();
     Aws::ShutdownAPI({});
   }
 };
 
+TEST_F(DatabaseManagerTest, DynamoDBClientIsSharedUntilReleased) {
+  const auto client = getDynamoDBClient();
+  EXPECT_EQ(client, getDynamoDBClient())
+      << "DynamoDB client is created again instead of being shared";
+  releaseDynamoDBClient();
+  EXPECT_NE(client, getDynamoDBClient())
+      << "DynamoDB client is not created again after it is released";
+}
+
+TEST_F(DatabaseManagerTest, TablesAreCheckedAtTheSameTime) {
+  std::future<bool> existing =
+      database::DatabaseManager::getInstance().isTableAvailableAsync(
+          config::ConfigManager::getInstance().getParameter(
+              config::ConfigManager::OPTION_DYNAMODB_MESSAGES_TABLE));
+  std::future<bool> missing =
+      database::DatabaseManager::getInstance().isTableAvailableAsync(
+          "tunnelbroker-missing-table");
+  EXPECT_TRUE(existing.get());
+  EXPECT_FALSE(missing.get());
+}
+
 TEST_F(DatabaseManagerTest, PutAndFoundMessageItemsStaticDataIsSame) {
   const database::MessageItem item(
       "bc0c1aa2-bf09-11ec-9d64-0242ac120002",
@@ -278,6 +302,42 @@ TEST_F(DatabaseManagerTest, UpdateNotifTokenInDeviceSessionItem) {
       item.getSessionID());
 }
 
+TEST_F(DatabaseManagerTest, FoundDeviceSessionItemIsCachedAndUpdated) {
+  const database::DeviceSessionItem item(
+      tools::generateUUID(),
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH),
+      tools::generateRandomString(451),
+      tools::generateRandomString(64),
+      database::DeviceSessionItem::DeviceTypes::MOBILE,
+      "ios:1.1.1",
+      "iOS 99.99.99");
+  database::DatabaseManager::getInstance().putSessionItem(item);
+  EXPECT_NE(
+      database::DatabaseManager::getInstance().findSessionItem(
+          item.getSessionID()),
+      nullptr);
+  const database::ItemCacheStats statsBefore =
+      database::DatabaseManager::getInstance().getSessionItemsCacheStats();
+  database::DatabaseManager::getInstance().updateSessionItemIsOnline(
+      item.getSessionID(), true);
+  std::shared_ptr<database::DeviceSessionItem> foundItem =
+      database::DatabaseManager::getInstance().findSessionItem(
+          item.getSessionID());
+  const database::ItemCacheStats statsAfter =
+      database::DatabaseManager::getInstance().getSessionItemsCacheStats();
+  EXPECT_EQ(statsAfter.hits, statsBefore.hits + 1)
+      << "Session item is not found in the cache";
+  EXPECT_EQ(foundItem->getIsOnline(), true)
+      << "Cached session item is not updated";
+  database::DatabaseManager::getInstance().removeSessionItem(
+      item.getSessionID());
+  EXPECT_EQ(
+      database::DatabaseManager::getInstance().findSessionItem(
+          item.getSessionID()),
+      nullptr)
+      << "Removed session item is still cached";
+}
+
 TEST_F(DatabaseManagerTest, PutAndFoundSessionSignItemStaticDataIsSame) {
   const database::SessionSignItem item(
       "bB3OSLdKlY60KPBpw6VoGKX7Lmw3SA07FmNhnqnclvVeaxXueAQ0dpQSpiQTtlGn",
@@ -319,6 +379,21 @@ TEST_F(DatabaseManagerTest, PutAndFoundSessionSignItemGeneratedDataIsSame) {
       item.getDeviceID());
 }
 
+TEST_F(DatabaseManagerTest, RemovedSessionSignItemIsNotWrittenBack) {
+  const database::SessionSignItem item(
+      tools::generateRandomString(SIGNATURE_REQUEST_LENGTH),
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH));
+  // Removed right away, while the background write may still be going on
+  database::DatabaseManager::getInstance().putSessionSignItem(item);
+  database::DatabaseManager::getInstance().removeSessionSignItem(
+      item.getDeviceID());
+  EXPECT_EQ(
+      database::DatabaseManager::getInstance().findSessionSignItem(
+          item.getDeviceID()),
+      nullptr)
+      << "Removed session signature item is still found";
+}
+
 TEST_F(DatabaseManagerTest, PutAndFoundPublicKeyItemsStaticDataIsSame) {
   const database::PublicKeyItem item(
       "mobile:"
@@ -362,6 +437,31 @@ TEST_F(DatabaseManagerTest, PutAndFoundPublicKeyItemsGeneratedDataIsSame) {
       item.getDeviceID());
 }
 
+TEST_F(DatabaseManagerTest, BatchFoundPublicKeyItemsCountIsSame) {
+  // More than fit into a single BatchGetItem request
+  const size_t itemsSize = DYNAMODB_MAX_BATCH_GET_ITEMS + 5;
+  std::vector<std::string> deviceIDs;
+  for (size_t i = 0; i < itemsSize; ++i) {
+    const database::PublicKeyItem item(
+        "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH),
+        tools::generateRandomString(451));
+    database::DatabaseManager::getInstance().putPublicKeyItem(item);
+    deviceIDs.push_back(item.getDeviceID());
+  }
+  std::vector<std::string> requestedDeviceIDs = deviceIDs;
+  requestedDeviceIDs.push_back(
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH));
+  std::vector<std::shared_ptr<database::PublicKeyItem>> foundItems =
+      database::DatabaseManager::getInstance().findPublicKeyItems(
+          requestedDeviceIDs);
+  EXPECT_EQ(foundItems.size(), itemsSize)
+      << "Items count found by batch is not equal to the count of items put, "
+         "or an item that was never put is found";
+  for (const std::string &deviceID : deviceIDs) {
+    database::DatabaseManager::getInstance().removePublicKeyItem(deviceID);
+  }
+}
+
 TEST_F(DatabaseManagerTest, PutAndFoundByReceiverMessageItemsDataIsSame) {
   const std::string receiverID =
       "mobile:"
@@ -402,6 +502,81 @@ TEST_F(DatabaseManagerTest, PutAndFoundByReceiverMessageItemsDataIsSame) {
       item.getToDeviceID(), item.getMessageID());
 }
 
+TEST_F(DatabaseManagerTest, FoundByReceiverMessageItemsInPagesAreOrdered) {
+  const std::string receiverID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  const size_t itemsSize = 7;
+  const size_t pageSize = 2;
+  for (size_t i = 0; i < itemsSize; ++i) {
+    const database::MessageItem item(
+        tools::generateUUID(),
+        "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH),
+        receiverID,
+        tools::generateRandomString(256),
+        tools::generateRandomString(256));
+    database::DatabaseManager::getInstance().putMessageItem(item);
+  }
+  std::vector<database::MessageItem> foundItems;
+  database::DatabaseManager::getInstance().findMessageItemsByReceiver(
+      receiverID, pageSize, [&](std::vector<database::MessageItem> &page) {
+        EXPECT_LE(page.size(), pageSize);
+        foundItems.insert(foundItems.end(), page.begin(), page.end());
+        return true;
+      });
+  EXPECT_EQ(foundItems.size(), itemsSize);
+  for (size_t i = 1; i < foundItems.size(); ++i) {
+    EXPECT_LE(foundItems[i - 1].getCreatedAt(), foundItems[i].getCreatedAt())
+        << "Messages found by receiverID are not ordered by creation time";
+  }
+  for (const database::MessageItem &item : foundItems) {
+    database::DatabaseManager::getInstance().removeMessageItem(
+        item.getToDeviceID(), item.getMessageID());
+  }
+}
+
+TEST_F(DatabaseManagerTest, FoundOldestAndSinceMessageItemsAreBounded) {
+  const std::string receiverID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  const size_t itemsSize = 5;
+  for (size_t i = 0; i < itemsSize; ++i) {
+    const database::MessageItem item(
+        tools::generateUUID(),
+        "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH),
+        receiverID,
+        tools::generateRandomString(256),
+        tools::generateRandomString(256));
+    database::DatabaseManager::getInstance().putMessageItem(item);
+  }
+  const std::vector<database::MessageItem> oldestItems =
+      database::DatabaseManager::getInstance()
+          .findOldestMessageItemsByReceiver(receiverID, 2);
+  ASSERT_EQ(oldestItems.size(), 2);
+  const std::vector<std::shared_ptr<database::MessageItem>> allItems =
+      database::DatabaseManager::getInstance().findMessageItemsByReceiver(
+          receiverID);
+  ASSERT_EQ(allItems.size(), itemsSize);
+  EXPECT_EQ(oldestItems[0].getMessageID(), allItems[0]->getMessageID());
+  EXPECT_EQ(oldestItems[1].getMessageID(), allItems[1]->getMessageID());
+
+  std::vector<database::MessageItem> newerItems;
+  database::DatabaseManager::getInstance().findMessageItemsByReceiverSince(
+      receiverID,
+      oldestItems[1].getCreatedAt(),
+      MESSAGES_PAGE_SIZE,
+      [&](std::vector<database::MessageItem> &page) {
+        newerItems.insert(newerItems.end(), page.begin(), page.end());
+        return true;
+      });
+  for (const database::MessageItem &item : newerItems) {
+    EXPECT_GT(item.getCreatedAt(), oldestItems[1].getCreatedAt())
+        << "Message found since a timestamp is not newer than it";
+  }
+  for (const std::shared_ptr<database::MessageItem> &item : allItems) {
+    database::DatabaseManager::getInstance().removeMessageItem(
+        item->getToDeviceID(), item->getMessageID());
+  }
+}
+
 TEST_F(DatabaseManagerTest, RemoveMessageItemsInBatch) {
   const size_t randomStringSize = 256;
   const std::string receiverID =
@@ -456,3 +631,97 @@ TEST_F(DatabaseManagerTest, RemoveMessageItemsInBatch) {
       messageThirdToNotRemove.getToDeviceID(),
       messageThirdToNotRemove.getMessageID());
 }
+
+TEST_F(DatabaseManagerTest, ArchivedMessageItemsAreFoundAndRemoved) {
+  const std::string receiverID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  const database::MessageItem item(
+      tools::generateUUID(),
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH),
+      receiverID,
+      tools::generateRandomString(256),
+      tools::generateRandomString(256));
+  database::DatabaseManager::getInstance().putMessageItem(item);
+  EXPECT_GE(
+      database::DatabaseManager::getInstance().archiveMessageItems(
+          tools::getCurrentTimestamp() + 1),
+      1);
+  EXPECT_TRUE(database::DatabaseManager::getInstance()
+                  .findMessageItemsByReceiver(receiverID)
+                  .empty())
+      << "Archived message is still in the messages table";
+
+  std::vector<database::MessageItem> archivedItems;
+  database::DatabaseManager::getInstance().findArchivedMessageItemsByReceiver(
+      receiverID,
+      MESSAGES_PAGE_SIZE,
+      [&](std::vector<database::MessageItem> &page) {
+        archivedItems.insert(archivedItems.end(), page.begin(), page.end());
+        return true;
+      });
+  ASSERT_EQ(archivedItems.size(), 1);
+  EXPECT_EQ(archivedItems[0].getMessageID(), item.getMessageID());
+  EXPECT_EQ(archivedItems[0].getPayload(), item.getPayload());
+
+  database::DatabaseManager::getInstance().removeArchivedMessageItems(
+      {{receiverID, item.getMessageID()}});
+  archivedItems.clear();
+  database::DatabaseManager::getInstance().findArchivedMessageItemsByReceiver(
+      receiverID,
+      MESSAGES_PAGE_SIZE,
+      [&](std::vector<database::MessageItem> &page) {
+        archivedItems.insert(archivedItems.end(), page.begin(), page.end());
+        return true;
+      });
+  EXPECT_TRUE(archivedItems.empty())
+      << "Acknowledged message is not removed from the cold table";
+}
+
+TEST_F(DatabaseManagerTest, ArchivedMessageItemIsKeptByMessagesRemoval) {
+  const std::string receiverID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  const database::MessageItem item(
+      tools::generateUUID(),
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH),
+      receiverID,
+      tools::generateRandomString(256),
+      tools::generateRandomString(256));
+  database::DatabaseManager::getInstance().putMessageItem(item);
+  database::DatabaseManager::getInstance().archiveMessageItems(
+      tools::getCurrentTimestamp() + 1);
+  database::DatabaseManager::getInstance().removeMessageItem(
+      receiverID, item.getMessageID());
+
+  std::vector<database::MessageItem> archivedItems;
+  database::DatabaseManager::getInstance().findArchivedMessageItemsByReceiver(
+      receiverID,
+      MESSAGES_PAGE_SIZE,
+      [&](std::vector<database::MessageItem> &page) {
+        archivedItems.insert(archivedItems.end(), page.begin(), page.end());
+        return true;
+      });
+  EXPECT_EQ(archivedItems.size(), 1)
+      << "Removal from the messages table reached the cold table";
+  database::DatabaseManager::getInstance().removeArchivedMessageItems(
+      {{receiverID, item.getMessageID()}});
+}
+
+TEST_F(DatabaseManagerTest, MessagesArchiveLeaseHasASingleOwner) {
+  const std::string firstOwner = tools::generateUUID();
+  const std::string secondOwner = tools::generateUUID();
+  // Ends in the past, so that the lease left by the test is over for any
+  // instance that archives the test tables
+  const uint64_t now = 1000 * 1000;
+  EXPECT_TRUE(
+      database::DatabaseManager::getInstance().acquireMessagesArchiveLease(
+          firstOwner, now, 1000));
+  EXPECT_FALSE(
+      database::DatabaseManager::getInstance().acquireMessagesArchiveLease(
+          secondOwner, now + 500, 1000));
+  EXPECT_TRUE(
+      database::DatabaseManager::getInstance().acquireMessagesArchiveLease(
+          firstOwner, now + 500, 1000));
+  EXPECT_TRUE(
+      database::DatabaseManager::getInstance().acquireMessagesArchiveLease(
+          secondOwner, now + 1500, 1000));
+}
@@ -132,3 +132,329 @@ TEST(DeliveryBrokerTest, ShouldBeEmptyAfterErase) {
   DeliveryBroker::getInstance().erase(deviceID);
   EXPECT_EQ(DeliveryBroker::getInstance().isEmpty(deviceID), true);
 }
+
+TEST(DeliveryBrokerTest, ShouldDropWithoutBlockingWhenQueueIsFull) {
+  const std::string deviceID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  const std::string fromDeviceID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  for (size_t i = 0; i < DELIVERY_BROKER_MAX_QUEUE_SIZE; i++) {
+    EXPECT_EQ(
+        DeliveryBroker::getInstance().push(
+            tools::generateUUID(),
+            i,
+            deviceID,
+            fromDeviceID,
+            tools::generateRandomString(64)),
+        DeliveryBrokerPushResult::QUEUED);
+  }
+  // Nobody has read from the queue, so there is no point in keeping more
+  EXPECT_EQ(
+      DeliveryBroker::getInstance().push(
+          tools::generateUUID(),
+          DELIVERY_BROKER_MAX_QUEUE_SIZE,
+          deviceID,
+          fromDeviceID,
+          tools::generateRandomString(64)),
+      DeliveryBrokerPushResult::DROPPED);
+  const DeliveryBrokerQueueStats stats =
+      DeliveryBroker::getInstance().getQueueStats(deviceID);
+  EXPECT_EQ(stats.queued, DELIVERY_BROKER_MAX_QUEUE_SIZE);
+  EXPECT_EQ(stats.overflowed, 0);
+  EXPECT_EQ(stats.droppedTotal, 1);
+  EXPECT_EQ(stats.consumerLive, false);
+  DeliveryBroker::getInstance().erase(deviceID);
+}
+
+TEST(DeliveryBrokerTest, ShouldOverflowInOrderForLiveConsumer) {
+  const std::string deviceID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  const std::string fromDeviceID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  DeliveryBroker::getInstance().push(
+      tools::generateUUID(), 0, deviceID, fromDeviceID, "");
+  DeliveryBroker::getInstance().pop(deviceID);
+  const size_t messagesCount = DELIVERY_BROKER_MAX_QUEUE_SIZE + 10;
+  for (size_t i = 0; i < messagesCount; i++) {
+    EXPECT_NE(
+        DeliveryBroker::getInstance().push(
+            tools::generateUUID(), i, deviceID, fromDeviceID, ""),
+        DeliveryBrokerPushResult::DROPPED);
+  }
+  EXPECT_EQ(
+      DeliveryBroker::getInstance().getQueueStats(deviceID).overflowed, 10);
+  for (size_t i = 0; i < messagesCount; i++) {
+    EXPECT_EQ(DeliveryBroker::getInstance().pop(deviceID).deliveryTag, i);
+  }
+  EXPECT_EQ(DeliveryBroker::getInstance().isEmpty(deviceID), true);
+  DeliveryBroker::getInstance().erase(deviceID);
+}
+
+TEST(DeliveryBrokerTest, ShouldKeepOrderAcrossInlineAndSlabMessages) {
+  const std::string deviceID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  const std::string fromDeviceID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  uint64_t pushedTag = 0;
+  uint64_t poppedTag = 0;
+  for (size_t round = 0; round < 10; round++) {
+    for (size_t i = 0; i < DELIVERY_BROKER_INLINE_QUEUE_SIZE * 3; i++) {
+      DeliveryBroker::getInstance().push(
+          tools::generateUUID(), pushedTag++, deviceID, fromDeviceID, "");
+    }
+    for (size_t i = 0; i < DELIVERY_BROKER_INLINE_QUEUE_SIZE * 2; i++) {
+      EXPECT_EQ(
+          DeliveryBroker::getInstance().pop(deviceID).deliveryTag,
+          poppedTag++);
+    }
+  }
+  while (poppedTag < pushedTag) {
+    EXPECT_EQ(
+        DeliveryBroker::getInstance().pop(deviceID).deliveryTag, poppedTag++);
+  }
+  EXPECT_EQ(DeliveryBroker::getInstance().isEmpty(deviceID), true);
+  DeliveryBroker::getInstance().erase(deviceID);
+}
+
+TEST(DeliveryBrokerTest, ShouldEvictOnlyIdleQueues) {
+  const std::string idleDeviceID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  const std::string busyDeviceID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  const std::string fromDeviceID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  DeliveryBroker::getInstance().push(
+      tools::generateUUID(), 0, idleDeviceID, fromDeviceID, "");
+  DeliveryBroker::getInstance().pop(idleDeviceID);
+  DeliveryBroker::getInstance().push(
+      tools::generateUUID(), 0, busyDeviceID, fromDeviceID, "");
+  // Queues left by the other tests may be evicted too
+  EXPECT_GE(
+      DeliveryBroker::getInstance().evictIdleQueues(
+          0, DELIVERY_BROKER_IDLE_QUEUE_TTL_MS),
+      1);
+  EXPECT_EQ(
+      DeliveryBroker::getInstance().evictIdleQueues(
+          0, DELIVERY_BROKER_IDLE_QUEUE_TTL_MS),
+      0);
+  EXPECT_EQ(DeliveryBroker::getInstance().isEmpty(busyDeviceID), false);
+  DeliveryBroker::getInstance().erase(busyDeviceID);
+}
+
+TEST(DeliveryBrokerTest, ShouldEvictQueuesWithoutConsumer) {
+  const std::string abandonedDeviceID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  const std::string listenedDeviceID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  const std::string fromDeviceID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  const size_t messagesCount = DELIVERY_BROKER_INLINE_QUEUE_SIZE * 3;
+  for (size_t i = 0; i < messagesCount; i++) {
+    DeliveryBroker::getInstance().push(
+        tools::generateUUID(), 0, abandonedDeviceID, fromDeviceID, "");
+    DeliveryBroker::getInstance().push(
+        tools::generateUUID(), 0, listenedDeviceID, fromDeviceID, "");
+  }
+  const uint64_t listenerID =
+      DeliveryBroker::getInstance().addListener(listenedDeviceID, []() {});
+  const uint64_t droppedTotal = DeliveryBroker::getInstance().getDroppedTotal();
+  // Queues left by the other tests may be evicted too
+  EXPECT_GE(
+      DeliveryBroker::getInstance().evictIdleQueues(
+          DELIVERY_BROKER_IDLE_QUEUE_TTL_MS, 0),
+      1);
+  EXPECT_GE(
+      DeliveryBroker::getInstance().getDroppedTotal(),
+      droppedTotal + messagesCount);
+  EXPECT_EQ(DeliveryBroker::getInstance().isEmpty(abandonedDeviceID), true);
+  EXPECT_EQ(DeliveryBroker::getInstance().isEmpty(listenedDeviceID), false);
+  DeliveryBroker::getInstance().removeListener(listenedDeviceID, listenerID);
+  DeliveryBroker::getInstance().erase(listenedDeviceID);
+}
+
+TEST(DeliveryBrokerTest, ShouldNotifyListenerAndTakeMessages) {
+  const std::string deviceID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  const std::string fromDeviceID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  size_t notificationsCount = 0;
+  const uint64_t listenerID = DeliveryBroker::getInstance().addListener(
+      deviceID, [&notificationsCount]() { notificationsCount++; });
+  EXPECT_EQ(DeliveryBroker::getInstance().takeMessages(deviceID, 10).size(), 0);
+  for (uint64_t i = 0; i < 3; i++) {
+    DeliveryBroker::getInstance().push(
+        tools::generateUUID(), i, deviceID, fromDeviceID, "");
+  }
+  EXPECT_EQ(notificationsCount, 3);
+  std::vector<DeliveryBrokerMessage> messages =
+      DeliveryBroker::getInstance().takeMessages(deviceID, 2);
+  EXPECT_EQ(messages.size(), 2);
+  EXPECT_EQ(messages[0].deliveryTag, 0);
+  EXPECT_EQ(messages[1].deliveryTag, 1);
+  messages = DeliveryBroker::getInstance().takeMessages(deviceID, 2);
+  EXPECT_EQ(messages.size(), 1);
+  EXPECT_EQ(messages[0].deliveryTag, 2);
+  DeliveryBroker::getInstance().removeListener(deviceID, listenerID);
+  DeliveryBroker::getInstance().push(
+      tools::generateUUID(), 3, deviceID, fromDeviceID, "");
+  EXPECT_EQ(notificationsCount, 3);
+  DeliveryBroker::getInstance().erase(deviceID);
+}
+
+TEST(DeliveryBrokerTest, ShouldPopQueuedMessagesInBatch) {
+  const std::string deviceID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  const std::string fromDeviceID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  EXPECT_EQ(
+      DeliveryBroker::getInstance()
+          .popBatch(deviceID, 10, std::chrono::milliseconds(10))
+          .size(),
+      0);
+  for (uint64_t i = 0; i < 15; i++) {
+    DeliveryBroker::getInstance().push(
+        tools::generateUUID(), i, deviceID, fromDeviceID, "");
+  }
+  std::vector<DeliveryBrokerMessage> messages =
+      DeliveryBroker::getInstance().popBatch(
+          deviceID, 10, std::chrono::milliseconds(10));
+  EXPECT_EQ(messages.size(), 10);
+  messages = DeliveryBroker::getInstance().popBatch(
+      deviceID, 10, std::chrono::milliseconds(10));
+  EXPECT_EQ(messages.size(), 5);
+  EXPECT_EQ(messages.front().deliveryTag, 10);
+  EXPECT_EQ(messages.back().deliveryTag, 14);
+  DeliveryBroker::getInstance().erase(deviceID);
+}
+
+TEST(DeliveryBrokerTest, ShouldKeepTraceContextOfQueuedMessages) {
+  const std::string deviceID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  const std::string fromDeviceID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  const std::string traceContext =
+      "00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01";
+  DeliveryBroker::getInstance().push(
+      tools::generateUUID(), 0, deviceID, fromDeviceID, "", traceContext);
+  DeliveryBroker::getInstance().push(
+      tools::generateUUID(), 1, deviceID, fromDeviceID, "");
+  std::vector<DeliveryBrokerMessage> messages =
+      DeliveryBroker::getInstance().takeMessages(deviceID, 10);
+  ASSERT_EQ(messages.size(), 2);
+  EXPECT_EQ(messages[0].traceContext, traceContext);
+  EXPECT_NE(
+      messages[0].queuedAt, std::chrono::system_clock::time_point());
+  EXPECT_TRUE(messages[1].traceContext.empty());
+  DeliveryBroker::getInstance().erase(deviceID);
+}
+
+TEST(DeliveryBrokerTest, ShouldSkipCopiesOfDeliveredMessages) {
+  const std::string deviceID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  const std::string fromDeviceID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  const std::string queuedMessageID = tools::generateUUID();
+  const std::string lateMessageID = tools::generateUUID();
+  const std::string newMessageID = tools::generateUUID();
+  DeliveryBroker::getInstance().push(
+      queuedMessageID, 0, deviceID, fromDeviceID, "");
+  DeliveryBroker::getInstance().markDelivered(
+      deviceID, {queuedMessageID, lateMessageID});
+  EXPECT_EQ(
+      DeliveryBroker::getInstance().push(
+          lateMessageID, 1, deviceID, fromDeviceID, ""),
+      DeliveryBrokerPushResult::DUPLICATE);
+  EXPECT_EQ(
+      DeliveryBroker::getInstance().push(
+          newMessageID, 2, deviceID, fromDeviceID, ""),
+      DeliveryBrokerPushResult::QUEUED);
+  std::vector<DeliveryBrokerMessage> messages =
+      DeliveryBroker::getInstance().takeMessages(deviceID, 10);
+  ASSERT_EQ(messages.size(), 2);
+  const std::vector<uint64_t> duplicateTags =
+      DeliveryBroker::getInstance().removeDelivered(deviceID, messages);
+  ASSERT_EQ(duplicateTags.size(), 1);
+  EXPECT_EQ(duplicateTags[0], 0)
+      << "The copy that was queued before the backlog was delivered should be "
+         "left for acknowledging";
+  ASSERT_EQ(messages.size(), 1);
+  EXPECT_EQ(messages[0].messageID, newMessageID);
+  DeliveryBroker::getInstance().erase(deviceID);
+}
+
+TEST(DeliveryBrokerTest, ShouldLetInteractiveMessagesPassBulkOnes) {
+  const std::string deviceID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  const std::string fromDeviceID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  const uint64_t bulkCount = 6;
+  const uint64_t interactiveCount = DELIVERY_BROKER_INTERACTIVE_WEIGHT + 2;
+  for (uint64_t i = 0; i < bulkCount; i++) {
+    DeliveryBroker::getInstance().push(
+        tools::generateUUID(),
+        i,
+        deviceID,
+        fromDeviceID,
+        "",
+        "",
+        DeliveryBrokerPriority::BULK);
+  }
+  for (uint64_t i = 0; i < interactiveCount; i++) {
+    DeliveryBroker::getInstance().push(
+        tools::generateUUID(), bulkCount + i, deviceID, fromDeviceID, "");
+  }
+  std::vector<DeliveryBrokerMessage> messages =
+      DeliveryBroker::getInstance().takeMessages(deviceID, 100);
+  ASSERT_EQ(messages.size(), bulkCount + interactiveCount);
+  std::vector<uint64_t> deliveryTags;
+  for (const DeliveryBrokerMessage &message : messages) {
+    deliveryTags.push_back(message.deliveryTag);
+  }
+  std::vector<uint64_t> expectedTags;
+  for (uint64_t i = 0; i < DELIVERY_BROKER_INTERACTIVE_WEIGHT; i++) {
+    expectedTags.push_back(bulkCount + i);
+  }
+  expectedTags.push_back(0);
+  for (uint64_t i = DELIVERY_BROKER_INTERACTIVE_WEIGHT; i < interactiveCount;
+       i++) {
+    expectedTags.push_back(bulkCount + i);
+  }
+  for (uint64_t i = 1; i < bulkCount; i++) {
+    expectedTags.push_back(i);
+  }
+  EXPECT_EQ(deliveryTags, expectedTags)
+      << "Interactive messages should go first, letting a bulk one through "
+         "every DELIVERY_BROKER_INTERACTIVE_WEIGHT of them";
+  DeliveryBroker::getInstance().erase(deviceID);
+}
+
+TEST(DeliveryBrokerTest, ShouldResyncLiveConsumerAfterDrop) {
+  const std::string deviceID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  const std::string fromDeviceID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  DeliveryBroker::getInstance().push(
+      tools::generateUUID(), 0, deviceID, fromDeviceID, "");
+  DeliveryBroker::getInstance().pop(deviceID);
+  const size_t capacity =
+      DELIVERY_BROKER_MAX_QUEUE_SIZE + DELIVERY_BROKER_MAX_OVERFLOW_SIZE;
+  for (size_t i = 0; i < capacity; i++) {
+    DeliveryBroker::getInstance().push(
+        tools::generateUUID(), i, deviceID, fromDeviceID, "");
+  }
+  EXPECT_EQ(
+      DeliveryBroker::getInstance().push(
+          tools::generateUUID(), capacity, deviceID, fromDeviceID, ""),
+      DeliveryBrokerPushResult::DROPPED);
+  EXPECT_FALSE(DeliveryBroker::getInstance().takeResync(deviceID))
+      << "The queued messages go first";
+  DeliveryBroker::getInstance().deleteQueueIfEmpty(deviceID);
+  EXPECT_EQ(
+      DeliveryBroker::getInstance().takeMessages(deviceID, capacity).size(),
+      capacity);
+  DeliveryBroker::getInstance().deleteQueueIfEmpty(deviceID);
+  EXPECT_TRUE(DeliveryBroker::getInstance().takeResync(deviceID))
+      << "The drained queue has to be kept until the consumer resyncs";
+  EXPECT_FALSE(DeliveryBroker::getInstance().takeResync(deviceID));
+  DeliveryBroker::getInstance().erase(deviceID);
+}
@@ -0,0 +1,63 @@
+#include "MessageArchiver.h"
+
+#include <gtest/gtest.h>
+
+#include <stdexcept>
+#include <vector>
+
+using namespace comm::network;
+
+TEST(MessageArchiverTest, ArchivesMessagesOlderThanMaxAge) {
+  std::vector<uint64_t> cutoffs;
+  database::MessageArchiver archiver(
+      [&cutoffs](const uint64_t &createdBefore) {
+        cutoffs.push_back(createdBefore);
+        return size_t{3};
+      },
+      [](const uint64_t &now, const uint64_t &duration) { return true; },
+      std::chrono::milliseconds(1000),
+      std::chrono::milliseconds(500));
+  archiver.archive(10000);
+  archiver.archive(20000);
+  ASSERT_EQ(cutoffs.size(), 2);
+  EXPECT_EQ(cutoffs[0], 9500);
+  EXPECT_EQ(cutoffs[1], 19500);
+}
+
+TEST(MessageArchiverTest, FailedPassIsLeftToTheNextOne) {
+  size_t passes = 0;
+  database::MessageArchiver archiver(
+      [&passes](const uint64_t &createdBefore) -> size_t {
+        if (passes++ == 0) {
+          throw std::runtime_error("throttled");
+        }
+        return 0;
+      },
+      [](const uint64_t &now, const uint64_t &duration) { return true; },
+      std::chrono::milliseconds(1000),
+      std::chrono::milliseconds(500));
+  EXPECT_NO_THROW(archiver.archive(10000));
+  archiver.archive(20000);
+  EXPECT_EQ(passes, 2);
+}
+
+TEST(MessageArchiverTest, PassIsSkippedWithoutTheLease) {
+  size_t passes = 0;
+  std::vector<uint64_t> leaseEnds;
+  database::MessageArchiver archiver(
+      [&passes](const uint64_t &createdBefore) -> size_t {
+        passes++;
+        return 0;
+      },
+      [&leaseEnds](const uint64_t &now, const uint64_t &duration) {
+        leaseEnds.push_back(now + duration);
+        return leaseEnds.size() == 1;
+      },
+      std::chrono::milliseconds(1000),
+      std::chrono::milliseconds(500));
+  archiver.archive(10000);
+  archiver.archive(10500);
+  EXPECT_EQ(passes, 1);
+  ASSERT_EQ(leaseEnds.size(), 2);
+  EXPECT_EQ(leaseEnds[0], 11000);
+}
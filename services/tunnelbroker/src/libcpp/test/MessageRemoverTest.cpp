@@ -0,0 +1,113 @@
+#include "MessageRemover.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace comm::network;
+
+class MessageRemoverTest : public testing::Test {
+protected:
+  using MessageKeys = std::vector<std::pair<std::string, std::string>>;
+  std::mutex batchesMutex;
+  std::vector<MessageKeys> batches;
+  std::vector<MessageKeys> archivedBatches;
+  bool failing = false;
+  std::unique_ptr<database::MessageRemover> remover;
+
+  void createRemover(std::chrono::milliseconds flushInterval) {
+    this->remover = std::make_unique<database::MessageRemover>(
+        [this](
+            const MessageKeys &messageKeys,
+            const MessageKeys &archivedMessageKeys) {
+          const std::lock_guard<std::mutex> lock(this->batchesMutex);
+          if (this->failing) {
+            throw std::runtime_error("The table is throttled");
+          }
+          this->batches.push_back(messageKeys);
+          this->archivedBatches.push_back(archivedMessageKeys);
+        },
+        flushInterval,
+        3,
+        2,
+        100);
+  }
+
+  virtual void SetUp() {
+    this->createRemover(std::chrono::milliseconds(0));
+  }
+};
+
+TEST_F(MessageRemoverTest, AcksOfAllDevicesAreRemovedInFullBatches) {
+  this->remover->remove("device1", {"message1"});
+  this->remover->remove("device2", {"message2", "message3"});
+  this->remover->remove("device1", {"message4"});
+  EXPECT_TRUE(this->batches.empty()) << "The ack shouldn't wait for the write";
+  EXPECT_TRUE(this->remover->isRemoving("device1", "message4"));
+  EXPECT_FALSE(this->remover->isRemoving("device2", "message4"));
+  EXPECT_TRUE(this->remover->flush());
+  ASSERT_EQ(this->batches.size(), 2);
+  EXPECT_EQ(
+      this->batches[0],
+      MessageKeys(
+          {{"device1", "message1"},
+           {"device2", "message2"},
+           {"device2", "message3"}}));
+  EXPECT_EQ(this->batches[1], MessageKeys({{"device1", "message4"}}));
+  EXPECT_FALSE(this->remover->isRemoving("device1", "message4"));
+  EXPECT_EQ(this->remover->getPendingCount(), 0);
+}
+
+TEST_F(MessageRemoverTest, RepeatedAckIsRemovedOnce) {
+  this->remover->remove("device", {"message"});
+  this->remover->remove("device", {"message"});
+  EXPECT_EQ(this->remover->getPendingCount(), 1);
+}
+
+TEST_F(MessageRemoverTest, FailedBatchIsAttemptedAgain) {
+  this->remover->remove("device", {"message"});
+  this->failing = true;
+  EXPECT_FALSE(this->remover->flush());
+  EXPECT_TRUE(this->remover->isRemoving("device", "message"));
+  this->failing = false;
+  EXPECT_TRUE(this->remover->flush());
+  ASSERT_EQ(this->batches.size(), 1);
+  EXPECT_EQ(this->batches[0], MessageKeys({{"device", "message"}}));
+}
+
+TEST_F(MessageRemoverTest, BatchIsDroppedAfterMaxAttempts) {
+  this->remover->remove("device", {"message"});
+  this->failing = true;
+  EXPECT_FALSE(this->remover->flush());
+  EXPECT_FALSE(this->remover->flush());
+  EXPECT_FALSE(this->remover->isRemoving("device", "message"));
+  EXPECT_EQ(this->remover->getPendingCount(), 0);
+}
+
+TEST_F(MessageRemoverTest, OnlyTrackedArchivedMessagesAreRemovedFromColdTable) {
+  this->remover->trackArchived("device", {"archived1", "archived2"});
+  this->remover->remove("device", {"archived1", "message"});
+  this->remover->remove("otherDevice", {"archived2"});
+  EXPECT_TRUE(this->remover->flush());
+  ASSERT_EQ(this->batches.size(), 1);
+  EXPECT_EQ(
+      this->batches[0],
+      MessageKeys({{"device", "message"}, {"otherDevice", "archived2"}}));
+  EXPECT_EQ(this->archivedBatches[0], MessageKeys({{"device", "archived1"}}));
+}
+
+TEST_F(MessageRemoverTest, ArchivedMessagesAreForgottenWhenStreamEnds) {
+  this->remover->trackArchived("device", {"archived"});
+  this->remover->forgetArchived("device");
+  this->remover->remove("device", {"archived"});
+  EXPECT_TRUE(this->remover->flush());
+  ASSERT_EQ(this->batches.size(), 1);
+  EXPECT_EQ(this->batches[0], MessageKeys({{"device", "archived"}}));
+  EXPECT_TRUE(this->archivedBatches[0].empty());
+}
@@ -0,0 +1,65 @@
+#include "MetricsServer.h"
+
+#include <boost/asio.hpp>
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <string>
+
+using namespace comm::network;
+
+namespace {
+
+const uint16_t TEST_METRICS_PORT = 19464;
+
+std::string get(const std::string &target) {
+  boost::asio::io_context context;
+  boost::asio::ip::tcp::socket socket(context);
+  socket.connect(boost::asio::ip::tcp::endpoint(
+      boost::asio::ip::address_v4::loopback(), TEST_METRICS_PORT));
+  const std::string request =
+      "GET " + target + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  boost::asio::write(socket, boost::asio::buffer(request));
+  std::string response;
+  boost::system::error_code error;
+  boost::asio::read(socket, boost::asio::dynamic_buffer(response), error);
+  return response;
+}
+
+} // namespace
+
+class MetricsServerTest : public testing::Test {
+protected:
+  static void SetUpTestSuite() {
+    metrics::startMetricsServer(TEST_METRICS_PORT, true);
+  }
+};
+
+TEST_F(MetricsServerTest, ServesTheMetrics) {
+  EXPECT_EQ(get("/metrics").rfind("HTTP/1.1 200 OK\r\n", 0), 0);
+}
+
+TEST_F(MetricsServerTest, RejectsParametersThatAreNotNumbers) {
+  EXPECT_EQ(
+      get("/debug/pprof/profile?seconds=ten").rfind("HTTP/1.1 400", 0), 0);
+  EXPECT_EQ(get("/debug/pprof/profile?seconds=").rfind("HTTP/1.1 400", 0), 0);
+}
+
+TEST_F(MetricsServerTest, RejectsParametersThatOverflow) {
+  EXPECT_EQ(
+      get("/debug/pprof/profile?seconds=99999999999999999999")
+          .rfind("HTTP/1.1 400", 0),
+      0);
+  EXPECT_EQ(
+      get("/debug/pprof/heap?rate=184467440737095516160")
+          .rfind("HTTP/1.1 400", 0),
+      0);
+  // The server is still up
+  EXPECT_EQ(get("/metrics").rfind("HTTP/1.1 200 OK\r\n", 0), 0);
+}
+
+TEST_F(MetricsServerTest, RejectsParametersOutOfTheirRange) {
+  EXPECT_EQ(
+      get("/debug/pprof/profile?seconds=100000").rfind("HTTP/1.1 400", 0), 0);
+  EXPECT_EQ(get("/debug/pprof/profile?hz=0").rfind("HTTP/1.1 400", 0), 0);
+}
@@ -0,0 +1,86 @@
+#include "PresenceTracker.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace comm::network;
+
+class PresenceTrackerTest : public testing::Test {
+protected:
+  struct Write {
+    std::string sessionID;
+    bool isOnline;
+    Callback callback;
+  };
+  std::vector<Write> writes;
+  std::unique_ptr<database::PresenceTracker> tracker;
+
+  virtual void SetUp() {
+    this->tracker = std::make_unique<database::PresenceTracker>(
+        [this](const std::string &sessionID, bool isOnline, Callback callback) {
+          this->writes.push_back(Write{sessionID, isOnline, callback});
+        },
+        std::chrono::milliseconds(0),
+        100,
+        std::chrono::milliseconds(60 * 1000));
+  }
+
+  void completeWrites() {
+    std::vector<Write> completed;
+    completed.swap(this->writes);
+    for (Write &write : completed) {
+      write.callback(nullptr);
+    }
+  }
+};
+
+TEST_F(PresenceTrackerTest, ChangesInOneIntervalAreWrittenOnce) {
+  this->tracker->update("session", true);
+  this->tracker->update("session", false);
+  this->tracker->update("session", true);
+  EXPECT_EQ(this->tracker->get("session"), true);
+  this->tracker->flush();
+  ASSERT_EQ(this->writes.size(), 1);
+  EXPECT_EQ(this->writes[0].sessionID, "session");
+  EXPECT_TRUE(this->writes[0].isOnline);
+}
+
+TEST_F(PresenceTrackerTest, ChangeBackToStoredStateIsNotWritten) {
+  this->tracker->update("session", true);
+  this->tracker->flush();
+  this->completeWrites();
+  this->tracker->update("session", false);
+  this->tracker->update("session", true);
+  this->tracker->flush();
+  EXPECT_TRUE(this->writes.empty())
+      << "The stored state should not be written again";
+  EXPECT_EQ(this->tracker->get("session"), true);
+}
+
+TEST_F(PresenceTrackerTest, ChangeDuringWriteIsWrittenAfterIt) {
+  this->tracker->update("session", true);
+  this->tracker->flush();
+  this->tracker->update("session", false);
+  this->tracker->flush();
+  ASSERT_EQ(this->writes.size(), 1)
+      << "A second write of the session should wait for the first one";
+  EXPECT_EQ(this->tracker->get("session"), false);
+  this->completeWrites();
+  this->tracker->flush();
+  ASSERT_EQ(this->writes.size(), 1);
+  EXPECT_FALSE(this->writes[0].isOnline);
+}
+
+TEST_F(PresenceTrackerTest, FailedWriteForgetsStoredState) {
+  this->tracker->update("session", true);
+  this->tracker->flush();
+  this->writes[0].callback(std::make_unique<std::string>("error"));
+  this->writes.clear();
+  EXPECT_EQ(this->tracker->get("session"), std::nullopt);
+  this->tracker->update("session", true);
+  this->tracker->flush();
+  EXPECT_EQ(this->writes.size(), 1);
+}
@@ -0,0 +1,82 @@
+#include "AllocationTracker.h"
+#include "Profiler.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+
+using namespace comm::network;
+
+namespace {
+
+uintptr_t readWord(const std::string &profile, size_t &offset) {
+  uintptr_t word = 0;
+  if (offset + sizeof(word) <= profile.size()) {
+    std::memcpy(&word, profile.data() + offset, sizeof(word));
+  }
+  offset += sizeof(word);
+  return word;
+}
+
+} // namespace
+
+TEST(ProfilerTest, CpuProfileHasTheSamplesOfTheBusyThread) {
+  ASSERT_TRUE(profiling::startCpuProfile(250));
+  EXPECT_FALSE(profiling::startCpuProfile(250));
+  const std::clock_t start = std::clock();
+  volatile uint64_t sum = 0;
+  while (std::clock() - start < CLOCKS_PER_SEC / 5) {
+    sum = sum + 1;
+  }
+  const std::string profile = profiling::stopCpuProfile();
+
+  size_t offset = 0;
+  EXPECT_EQ(readWord(profile, offset), 0);
+  EXPECT_EQ(readWord(profile, offset), 3);
+  EXPECT_EQ(readWord(profile, offset), 0);
+  EXPECT_EQ(readWord(profile, offset), 4000);
+  EXPECT_EQ(readWord(profile, offset), 0);
+  uint64_t samples = 0;
+  while (offset < profile.size()) {
+    const uintptr_t count = readWord(profile, offset);
+    const uintptr_t depth = readWord(profile, offset);
+    if (!count) {
+      // The trailer
+      EXPECT_EQ(depth, 1);
+      EXPECT_EQ(readWord(profile, offset), 0);
+      break;
+    }
+    EXPECT_GT(depth, 0);
+    samples += count;
+    offset += depth * sizeof(uintptr_t);
+  }
+  EXPECT_GT(samples, 0);
+  ASSERT_LT(offset, profile.size());
+  EXPECT_NE(profile.find("/", offset), std::string::npos);
+  EXPECT_TRUE(profiling::startCpuProfile(250));
+  profiling::stopCpuProfile();
+}
+
+TEST(ProfilerTest, HeapProfileHasTheSampledAllocations) {
+  if (!allocation::isAllocationTrackingEnabled()) {
+    EXPECT_FALSE(profiling::startHeapProfile(1024));
+    GTEST_SKIP() << "Needs a build with COMM_ALLOCATION_TRACKING";
+  }
+  ASSERT_TRUE(profiling::startHeapProfile(1024));
+  EXPECT_FALSE(profiling::startHeapProfile(1024));
+  for (size_t i = 0; i < 1000; i++) {
+    std::unique_ptr<char[]> buffer(new char[4096]);
+    buffer[0] = 0;
+  }
+  const std::string profile = profiling::stopHeapProfile();
+
+  EXPECT_EQ(profile.rfind("heap profile: 0: 0 [", 0), 0);
+  EXPECT_NE(profile.find("@ heap_v2/1024\n"), std::string::npos);
+  EXPECT_NE(profile.find("\n0: 0 ["), std::string::npos);
+  EXPECT_NE(profile.find("] @ 0x"), std::string::npos);
+  EXPECT_NE(profile.find("\nMAPPED_LIBRARIES:\n"), std::string::npos);
+}
@@ -0,0 +1,81 @@
+#include "TimingWheel.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <vector>
+
+using namespace comm::network;
+
+TEST(TimingWheelTest, TimersFireInTheOrderOfTheirDeadlines) {
+  TimingWheel wheel;
+  std::mutex firedMutex;
+  std::vector<int> fired;
+  std::promise<void> allFired;
+  for (int delayMs : {30, 10, 20}) {
+    wheel.schedule(std::chrono::milliseconds(delayMs), [&, delayMs]() {
+      const std::lock_guard<std::mutex> lock(firedMutex);
+      fired.push_back(delayMs);
+      if (fired.size() == 3) {
+        allFired.set_value();
+      }
+    });
+  }
+  ASSERT_EQ(
+      allFired.get_future().wait_for(std::chrono::seconds(5)),
+      std::future_status::ready);
+  EXPECT_EQ(fired, std::vector<int>({10, 20, 30}));
+  EXPECT_EQ(wheel.getPendingCount(), 0);
+}
+
+TEST(TimingWheelTest, CancelledTimerDoesntFire) {
+  TimingWheel wheel;
+  std::atomic<bool> cancelledFired{false};
+  std::promise<void> fired;
+  const TimingWheel::TimerID cancelled = wheel.schedule(
+      std::chrono::milliseconds(10), [&]() { cancelledFired = true; });
+  const TimingWheel::TimerID kept = wheel.schedule(
+      std::chrono::milliseconds(20), [&]() { fired.set_value(); });
+  EXPECT_TRUE(wheel.cancel(cancelled));
+  EXPECT_FALSE(wheel.cancel(cancelled));
+  ASSERT_EQ(
+      fired.get_future().wait_for(std::chrono::seconds(5)),
+      std::future_status::ready);
+  EXPECT_FALSE(cancelledFired);
+  EXPECT_FALSE(wheel.cancel(kept)) << "The timer has fired already";
+}
+
+TEST(TimingWheelTest, TimerPastTheLowestLevelFiresOnTime) {
+  TimingWheel wheel;
+  const auto delay = std::chrono::milliseconds(TIMING_WHEEL_SLOTS + 50);
+  const auto scheduledAt = std::chrono::steady_clock::now();
+  std::promise<std::chrono::steady_clock::time_point> fired;
+  wheel.schedule(
+      delay, [&]() { fired.set_value(std::chrono::steady_clock::now()); });
+  std::future<std::chrono::steady_clock::time_point> firedAt =
+      fired.get_future();
+  ASSERT_EQ(
+      firedAt.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+  EXPECT_GE(firedAt.get() - scheduledAt, delay);
+}
+
+TEST(TimingWheelTest, ThousandsOfTimersFire) {
+  const int timersCount = 10000;
+  TimingWheel wheel;
+  std::atomic<int> firedCount{0};
+  std::promise<void> allFired;
+  for (int i = 0; i < timersCount; i++) {
+    wheel.schedule(std::chrono::milliseconds(i % 300), [&]() {
+      if (++firedCount == timersCount) {
+        allFired.set_value();
+      }
+    });
+  }
+  ASSERT_EQ(
+      allFired.get_future().wait_for(std::chrono::seconds(5)),
+      std::future_status::ready);
+  EXPECT_EQ(wheel.getPendingCount(), 0);
+}
@@ -0,0 +1,98 @@
+#include "Constants.h"
+#include "GlobalTools.h"
+#include "Tools.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <regex>
+#include <string>
+#include <vector>
+
+using namespace comm::network;
+
+// Compares the validators with the regex formats that they replace. The
+// timings are only printed, they aren't checked.
+class ToolsBenchmarkTest : public testing::Test {
+protected:
+  const size_t iterations = 20000;
+
+  void compare(
+      const std::string &name,
+      const std::vector<std::string> &inputs,
+      const std::function<bool(const std::string &)> &validator,
+      const std::regex &format) {
+    using namespace std::chrono;
+    size_t validatorMatches = 0;
+    size_t regexMatches = 0;
+    steady_clock::time_point start = steady_clock::now();
+    for (size_t i = 0; i < this->iterations; i++) {
+      validatorMatches += validator(inputs[i % inputs.size()]);
+    }
+    const auto validatorTime = steady_clock::now() - start;
+    start = steady_clock::now();
+    for (size_t i = 0; i < this->iterations; i++) {
+      regexMatches += std::regex_match(inputs[i % inputs.size()], format);
+    }
+    const auto regexTime = steady_clock::now() - start;
+    EXPECT_EQ(validatorMatches, regexMatches)
+        << name << " validator doesn't agree with its regex";
+    std::cout << name << ": " << this->iterations << " checks, validator "
+              << duration_cast<microseconds>(validatorTime).count()
+              << " us, regex "
+              << duration_cast<microseconds>(regexTime).count() << " us"
+              << std::endl;
+  }
+};
+
+TEST_F(ToolsBenchmarkTest, DeviceIDValidatorAgainstRegex) {
+  const std::string suffix =
+      tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  const std::vector<std::string> inputs = {
+      "mobile:" + suffix,
+      "web:" + suffix,
+      "mobile:" + suffix.substr(1),
+      "desktop:" + suffix,
+      "web:" + suffix.substr(1) + "-",
+  };
+  this->compare(
+      "DeviceID",
+      inputs,
+      [](const std::string &deviceID) {
+        return tools::validateDeviceID(deviceID);
+      },
+      DEVICEID_FORMAT_REGEX);
+}
+
+TEST_F(ToolsBenchmarkTest, SessionIDValidatorAgainstRegex) {
+  const std::string sessionID = tools::generateUUID();
+  const std::vector<std::string> inputs = {
+      sessionID,
+      "bc0c1aa2-bf09-11ec-9d64-0242ac120002",
+      sessionID.substr(1),
+      "BC0C1AA2-BF09-11EC-9D64-0242AC120002",
+      "bc0c1aa29bf09-11ec-9d64-0242ac120002",
+  };
+  this->compare(
+      "SessionID",
+      inputs,
+      [](const std::string &sessionID) {
+        return tools::validateSessionID(sessionID);
+      },
+      SESSION_ID_FORMAT_REGEX);
+}
+
+TEST_F(ToolsBenchmarkTest, UUIDv4ValidatorAgainstRegex) {
+  const std::vector<std::string> inputs = {
+      tools::generateUUID(),
+      "9bfdd6ea-25de-418f-aa2e-869c78073d81",
+      "bc0c1aa2-bf09-11ec-9d64-0242ac120002",
+      "58g8141b-8e5b-48f4-b3a1-e5e495c65f93",
+      "58f8141b-8e5b-48f4-c3a1-e5e495c65f93",
+  };
+  const std::regex uuidV4Format(
+      "^[0-9a-f]{8}-[0-9a-f]{4}-4[0-9a-f]{3}-[89ab][0-9a-f]{3}-[0-9a-f]{12}$");
+  this->compare("UUIDv4", inputs, tools::validateUUIDv4, uuidV4Format);
+}
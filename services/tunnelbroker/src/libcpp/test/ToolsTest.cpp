@@ -1,10 +1,17 @@
 #include "Tools.h"
+#include "AllocationTracker.h"
 #include "Constants.h"
 #include "GlobalTools.h"
+#include "Logging.h"
+#include "Tracing.h"
 
 #include <gtest/gtest.h>
 
+#include <chrono>
+#include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 
 using namespace comm::network;
 
@@ -96,3 +103,107 @@ TEST(ToolsTest, ValidateSessionIDReturnsFalseOnInvalidSessionID) {
       << "Invalid sessionID \"" << invalidSessionID
       << "\" is valid by the function";
 }
+
+TEST(ToolsTest, ValidateDeviceIDReturnsTrueOnWebDeviceID) {
+  const std::string validDeviceID =
+      "web:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  EXPECT_EQ(tools::validateDeviceID(validDeviceID), true)
+      << "Valid web deviceID \"" << validDeviceID
+      << "\" is invalid by the function";
+}
+
+TEST(ToolsTest, ValidateDeviceIDReturnsFalseOnInvalidDeviceIDLength) {
+  const std::string shortDeviceID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH - 1);
+  EXPECT_EQ(tools::validateDeviceID(shortDeviceID), false)
+      << "Short deviceID \"" << shortDeviceID << "\" is valid by the function";
+  const std::string longDeviceID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH + 1);
+  EXPECT_EQ(tools::validateDeviceID(longDeviceID), false)
+      << "Long deviceID \"" << longDeviceID << "\" is valid by the function";
+}
+
+TEST(ToolsTest, ValidateDeviceIDReturnsFalseOnNonAlphanumericCharacter) {
+  std::string invalidDeviceID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  invalidDeviceID[10] = '\xc3';
+  EXPECT_EQ(tools::validateDeviceID(invalidDeviceID), false)
+      << "DeviceID with a non-ASCII character is valid by the function";
+}
+
+TEST(ToolsTest, ValidateUUIDv4ReturnsFalseOnOtherUUIDVersion) {
+  const std::string versionOneUUID = "bc0c1aa2-bf09-11ec-9d64-0242ac120002";
+  EXPECT_EQ(tools::validateUUIDv4(versionOneUUID), false)
+      << "Version 1 UUID \"" << versionOneUUID
+      << "\" is valid by the function";
+  const std::string badVariantUUID = "58f8141b-8e5b-48f4-c3a1-e5e495c65f93";
+  EXPECT_EQ(tools::validateUUIDv4(badVariantUUID), false)
+      << "UUID with a wrong variant \"" << badVariantUUID
+      << "\" is valid by the function";
+}
+
+TEST(ToolsTest, TraceparentRoundTrips) {
+  const std::string traceparent =
+      "00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01";
+  const tracing::TraceContext context =
+      tracing::TraceContext::fromTraceparent(traceparent);
+  EXPECT_TRUE(context.isValid());
+  EXPECT_TRUE(context.sampled);
+  EXPECT_EQ(context.toTraceparent(), traceparent);
+}
+
+TEST(ToolsTest, InvalidTraceparentsAreRejected) {
+  for (const std::string &traceparent :
+       {"",
+        "00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7",
+        "00-00000000000000000000000000000000-00f067aa0ba902b7-01",
+        "00-4bf92f3577b34da6a3ce929d0e0e4736-0000000000000000-01",
+        "00-4BF92F3577B34DA6A3CE929D0E0E4736-00f067aa0ba902b7-01"}) {
+    EXPECT_FALSE(tracing::TraceContext::fromTraceparent(traceparent).isValid())
+        << "Traceparent \"" << traceparent << "\" should be rejected";
+  }
+}
+
+TEST(ToolsTest, UnsampledSpansArePassedOnAsInvalid) {
+  const tracing::Span span("test");
+  EXPECT_FALSE(span.getContext().isValid());
+  EXPECT_TRUE(span.getContext().toTraceparent().empty());
+}
+
+TEST(ToolsTest, LogRateLimiterCountsSuppressedLines) {
+  logging::LogRateLimiter limiter(std::chrono::milliseconds(20));
+  uint64_t suppressed = 0;
+  EXPECT_TRUE(limiter.tryAcquire(suppressed));
+  EXPECT_EQ(suppressed, 0);
+  EXPECT_FALSE(limiter.tryAcquire(suppressed));
+  EXPECT_FALSE(limiter.tryAcquire(suppressed));
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  EXPECT_TRUE(limiter.tryAcquire(suppressed));
+  EXPECT_EQ(suppressed, 2);
+}
+
+TEST(ToolsTest, AllocationsAreCountedForTheTagOfTheScope) {
+  if (!allocation::isAllocationTrackingEnabled()) {
+    GTEST_SKIP() << "Built without COMM_ALLOCATION_TRACKING";
+  }
+  const size_t tag =
+      static_cast<size_t>(allocation::AllocationTag::DELIVERY_BROKER);
+  const std::vector<allocation::AllocationStats> before =
+      allocation::getAllocationSnapshot();
+  {
+    const allocation::ScopedAllocationTag allocationTag(
+        allocation::AllocationTag::DELIVERY_BROKER);
+    {
+      const allocation::ScopedAllocationTag innerTag(
+          allocation::AllocationTag::REACTORS);
+      std::make_unique<char[]>(100);
+    }
+    std::make_unique<char[]>(1000);
+  }
+  const std::vector<allocation::AllocationStats> after =
+      allocation::getAllocationSnapshot();
+  ASSERT_EQ(after.size(), allocation::ALLOCATION_TAGS_COUNT);
+  EXPECT_EQ(after[tag].tag, "delivery_broker");
+  EXPECT_EQ(after[tag].count - before[tag].count, 1);
+  EXPECT_EQ(after[tag].bytes - before[tag].bytes, 1000);
+}
@@ -0,0 +1,118 @@
+#include "TrafficCapture.h"
+#include "TrafficTrace.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace comm::network;
+
+class TrafficCaptureTest : public testing::Test {
+protected:
+  const std::string path = "/tmp/tunnelbroker-traffic-capture-test.tsv";
+
+  void TearDown() override {
+    std::remove(this->path.c_str());
+  }
+
+  std::vector<std::string> readLines() const {
+    std::ifstream file(this->path);
+    std::vector<std::string> lines;
+    std::string line;
+    while (std::getline(file, line)) {
+      lines.push_back(line);
+    }
+    return lines;
+  }
+};
+
+TEST_F(TrafficCaptureTest, RecordsAreWrittenWithPseudonyms) {
+  const std::string sender = "mobile:sender";
+  const std::string receiver = "web:receiver";
+  capture::TrafficCapture capture;
+  capture.start({this->path, 60, 0});
+  {
+    capture::CapturedCall call(trace::EVENT_SEND_MESSAGES, sender, capture);
+    ASSERT_TRUE(call.isActive());
+    call.count = 2;
+    call.bytes = 300;
+    call.peers = {{receiver, 100}, {receiver, 200}};
+  }
+  capture.record(
+      trace::EVENT_BIND_DEVICE,
+      receiver,
+      std::chrono::steady_clock::now(),
+      0,
+      0);
+  capture.stop();
+  EXPECT_FALSE(capture.isCapturing());
+
+  const std::vector<std::string> lines = this->readLines();
+  ASSERT_EQ(lines.size(), 3);
+  EXPECT_EQ(lines[0][0], '#');
+  for (const std::string &line : lines) {
+    EXPECT_EQ(line.find("sender"), std::string::npos) << line;
+    EXPECT_EQ(line.find("receiver"), std::string::npos) << line;
+  }
+  trace::TraceRecord sent;
+  ASSERT_TRUE(trace::parseTraceRecord(lines[1], sent));
+  EXPECT_EQ(sent.event, trace::EVENT_SEND_MESSAGES);
+  EXPECT_EQ(sent.device.rfind("mobile:", 0), 0);
+  EXPECT_EQ(sent.count, 2);
+  EXPECT_EQ(sent.bytes, 300);
+  ASSERT_EQ(sent.peers.size(), 2);
+  EXPECT_EQ(sent.peers[0].second, 100);
+  EXPECT_EQ(sent.peers[1].second, 200);
+  EXPECT_EQ(sent.peers[0].first, sent.peers[1].first);
+  trace::TraceRecord bound;
+  ASSERT_TRUE(trace::parseTraceRecord(lines[2], bound));
+  EXPECT_EQ(bound.event, trace::EVENT_BIND_DEVICE);
+  EXPECT_EQ(bound.device, sent.peers[0].first);
+  EXPECT_TRUE(bound.peers.empty());
+}
+
+TEST_F(TrafficCaptureTest, CaptureStopsAfterMaxEvents) {
+  capture::TrafficCapture capture;
+  capture.start({this->path, 60, 2});
+  for (size_t i = 0; i < 5; i++) {
+    capture::CapturedCall call(
+        trace::EVENT_GET_SESSION, "web:device", capture);
+  }
+  EXPECT_FALSE(capture.isCapturing());
+  capture.stop();
+  EXPECT_EQ(this->readLines().size(), 3);
+}
+
+TEST_F(TrafficCaptureTest, CallsAreNotRecordedWithoutCapture) {
+  capture::TrafficCapture capture;
+  const capture::CapturedCall call(
+      trace::EVENT_GET_SESSION, "web:device", capture);
+  EXPECT_FALSE(call.isActive());
+}
+
+TEST_F(TrafficCaptureTest, RecordsAreParsedAsTheyWereFormatted) {
+  trace::TraceRecord record;
+  record.offsetUs = 1500;
+  record.event = trace::EVENT_SEND_MESSAGES;
+  record.device = "mobile:0123456789abcdef";
+  record.peers = {{"web:fedcba9876543210", 42}};
+  record.count = 1;
+  record.bytes = 42;
+  record.durationUs = 250;
+  trace::TraceRecord parsed;
+  ASSERT_TRUE(
+      trace::parseTraceRecord(trace::formatTraceRecord(record), parsed));
+  EXPECT_EQ(parsed.offsetUs, record.offsetUs);
+  EXPECT_EQ(parsed.event, record.event);
+  EXPECT_EQ(parsed.device, record.device);
+  EXPECT_EQ(parsed.peers, record.peers);
+  EXPECT_EQ(parsed.count, record.count);
+  EXPECT_EQ(parsed.bytes, record.bytes);
+  EXPECT_EQ(parsed.durationUs, record.durationUs);
+  EXPECT_FALSE(trace::parseTraceRecord("1\tsend_messages\tdevice", parsed));
+}
@@ -0,0 +1,118 @@
+#include "ConfigManager.h"
+#include "Constants.h"
+#include "DatabaseManager.h"
+#include "DynamoDBTools.h"
+#include "GlobalTools.h"
+#include "Tools.h"
+
+#include <benchmark/benchmark.h>
+
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace comm::network;
+
+namespace {
+
+// The DynamoDB benchmarks run against localstack, like DatabaseManagerTest
+bool initializeDatabase(benchmark::State &state) {
+  static std::once_flag initOnceFlag;
+  static std::string error;
+  std::call_once(initOnceFlag, []() {
+    try {
+      config::ConfigManager::getInstance().load();
+      Aws::InitAPI({});
+    } catch (const std::exception &e) {
+      error = e.what();
+    }
+  });
+  if (!error.empty()) {
+    state.SkipWithError(error.c_str());
+    return false;
+  }
+  return true;
+}
+
+database::MessageItem createMessageItem(size_t payloadSize) {
+  return database::MessageItem(
+      tools::generateUUID(),
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH),
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH),
+      tools::generateRandomString(payloadSize),
+      "");
+}
+
+} // namespace
+
+static void BM_MessageItemFromAttributeValues(benchmark::State &state) {
+  if (!initializeDatabase(state)) {
+    return;
+  }
+  const database::MessageItem item = createMessageItem(state.range(0));
+  database::AttributeValues attributes;
+  attributes[database::MessageItem::FIELD_MESSAGE_ID] =
+      Aws::DynamoDB::Model::AttributeValue(item.getMessageID());
+  attributes[database::MessageItem::FIELD_FROM_DEVICE_ID] =
+      Aws::DynamoDB::Model::AttributeValue(item.getFromDeviceID());
+  attributes[database::MessageItem::FIELD_TO_DEVICE_ID] =
+      Aws::DynamoDB::Model::AttributeValue(item.getToDeviceID());
+  attributes[database::MessageItem::FIELD_PAYLOAD] =
+      Aws::DynamoDB::Model::AttributeValue(item.getPayload());
+  attributes[database::MessageItem::FIELD_BLOB_HASHES] =
+      Aws::DynamoDB::Model::AttributeValue(item.getBlobHashes());
+  attributes[database::MessageItem::FIELD_EXPIRE] =
+      Aws::DynamoDB::Model::AttributeValue(
+          std::to_string(tools::getCurrentTimestamp() + MESSAGE_RECORD_TTL));
+  attributes[database::MessageItem::FIELD_CREATED_AT] =
+      Aws::DynamoDB::Model::AttributeValue(
+          std::to_string(tools::getCurrentTimestamp()));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(database::MessageItem(attributes));
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_MessageItemFromAttributeValues)->Arg(64)->Arg(4096);
+
+static void BM_DatabaseManagerPutFindMessageItem(benchmark::State &state) {
+  if (!initializeDatabase(state)) {
+    return;
+  }
+  const database::MessageItem item = createMessageItem(state.range(0));
+  for (auto _ : state) {
+    database::DatabaseManager::getInstance().putMessageItem(item);
+    benchmark::DoNotOptimize(
+        database::DatabaseManager::getInstance().findMessageItem(
+            item.getToDeviceID(), item.getMessageID()));
+  }
+  database::DatabaseManager::getInstance().removeMessageItem(
+      item.getToDeviceID(), item.getMessageID());
+}
+BENCHMARK(BM_DatabaseManagerPutFindMessageItem)
+    ->Arg(512)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+static void BM_DatabaseManagerPutMessageItemsByBatch(benchmark::State &state) {
+  if (!initializeDatabase(state)) {
+    return;
+  }
+  std::vector<database::MessageItem> items;
+  for (int64_t i = 0; i < state.range(0); i++) {
+    items.push_back(createMessageItem(512));
+  }
+  for (auto _ : state) {
+    database::DatabaseManager::getInstance().putMessageItemsByBatch(items);
+  }
+  for (const database::MessageItem &item : items) {
+    database::DatabaseManager::getInstance().removeMessageItem(
+        item.getToDeviceID(), item.getMessageID());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_DatabaseManagerPutMessageItemsByBatch)
+    ->Arg(DYNAMODB_MAX_BATCH_ITEMS)
+    ->Arg(4 * DYNAMODB_MAX_BATCH_ITEMS)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
@@ -0,0 +1,89 @@
+#include "Constants.h"
+#include "DeliveryBroker.h"
+#include "GlobalTools.h"
+#include "Tools.h"
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+using namespace comm::network;
+
+namespace {
+
+const size_t MAX_DEVICES = 4096;
+
+const std::vector<std::string> &getDeviceIDs() {
+  static const std::vector<std::string> deviceIDs = []() {
+    std::vector<std::string> deviceIDs;
+    for (size_t i = 0; i < MAX_DEVICES; i++) {
+      deviceIDs.push_back(
+          "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH));
+    }
+    return deviceIDs;
+  }();
+  return deviceIDs;
+}
+
+// Spreads the threads of a benchmark over the devices
+size_t getThreadOffset() {
+  static std::atomic<size_t> lastThread{0};
+  thread_local const size_t thread = lastThread++;
+  return thread * 7919;
+}
+
+} // namespace
+
+// Every producer pushes to the devices in turns and drains the device right
+// away, so the queues don't fill up
+static void BM_DeliveryBrokerPushTake(benchmark::State &state) {
+  const std::vector<std::string> &deviceIDs = getDeviceIDs();
+  const size_t devicesCount = state.range(0);
+  const std::string fromDeviceID = deviceIDs[0];
+  const std::string payload = tools::generateRandomString(512);
+  const std::string messageID = tools::generateUUID();
+  size_t deviceIndex = getThreadOffset();
+  uint64_t deliveryTag = 0;
+  for (auto _ : state) {
+    const std::string &toDeviceID = deviceIDs[deviceIndex++ % devicesCount];
+    DeliveryBroker::getInstance().push(
+        messageID, ++deliveryTag, toDeviceID, fromDeviceID, payload);
+    benchmark::DoNotOptimize(
+        DeliveryBroker::getInstance().takeMessages(toDeviceID, 1));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_DeliveryBrokerPushTake)
+    ->RangeMultiplier(8)
+    ->Range(1, MAX_DEVICES)
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+
+// A backlog of a device is pushed and then taken out in one batch
+static void BM_DeliveryBrokerPushPopBatch(benchmark::State &state) {
+  const std::vector<std::string> &deviceIDs = getDeviceIDs();
+  const size_t batchSize = state.range(0);
+  const std::string &toDeviceID =
+      deviceIDs[getThreadOffset() % deviceIDs.size()];
+  const std::string payload = tools::generateRandomString(512);
+  const std::string messageID = tools::generateUUID();
+  uint64_t deliveryTag = 0;
+  for (auto _ : state) {
+    for (size_t i = 0; i < batchSize; i++) {
+      DeliveryBroker::getInstance().push(
+          messageID, ++deliveryTag, toDeviceID, deviceIDs[0], payload);
+    }
+    benchmark::DoNotOptimize(DeliveryBroker::getInstance().popBatch(
+        toDeviceID, batchSize, std::chrono::milliseconds(0)));
+  }
+  state.SetItemsProcessed(state.iterations() * batchSize);
+}
+BENCHMARK(BM_DeliveryBrokerPushPopBatch)
+    ->Arg(DELIVERY_BROKER_INLINE_QUEUE_SIZE)
+    // DELIVERY_BROKER_TAKE_BATCH_SIZE of the server
+    ->Arg(32)
+    ->Arg(DELIVERY_BROKER_MAX_QUEUE_SIZE)
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
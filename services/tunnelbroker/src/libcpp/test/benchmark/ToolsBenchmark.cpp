@@ -0,0 +1,52 @@
+#include "Constants.h"
+#include "GlobalTools.h"
+#include "Tools.h"
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+
+using namespace comm::network;
+
+static void BM_ValidateDeviceID(benchmark::State &state) {
+  const std::string deviceID =
+      "mobile:" + tools::generateRandomString(DEVICEID_CHAR_LENGTH);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(tools::validateDeviceID(deviceID));
+  }
+}
+BENCHMARK(BM_ValidateDeviceID);
+
+static void BM_ValidateSessionID(benchmark::State &state) {
+  const std::string sessionID = tools::generateUUID();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(tools::validateSessionID(sessionID));
+  }
+}
+BENCHMARK(BM_ValidateSessionID);
+
+static void BM_ValidateUUIDv4(benchmark::State &state) {
+  const std::string uuid = tools::generateUUID();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(tools::validateUUIDv4(uuid));
+  }
+}
+BENCHMARK(BM_ValidateUUIDv4);
+
+static void BM_GenerateRandomString(benchmark::State &state) {
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(tools::generateRandomString(state.range(0)));
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_GenerateRandomString)
+    ->Arg(SIGNATURE_REQUEST_LENGTH)
+    ->Arg(512)
+    ->ThreadRange(1, 8);
+
+static void BM_GenerateUUID(benchmark::State &state) {
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(tools::generateUUID());
+  }
+}
+BENCHMARK(BM_GenerateUUID)->ThreadRange(1, 8);
@@ -1,3 +1,4 @@
+pub mod blob;
 pub mod constants;
 pub mod cxx_bridge;
 pub mod notifications;
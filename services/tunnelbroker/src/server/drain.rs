@@ -0,0 +1,156 @@
+use crate::constants;
+use crate::cxx_bridge::ffi::finishDrain;
+use std::collections::hash_map::RandomState;
+use std::hash::{BuildHasher, Hash, Hasher};
+use std::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
+use std::sync::Arc;
+use tokio::signal::unix::{signal, SignalKind};
+use tokio::sync::Notify;
+use tokio::time::Duration;
+use tonic::Status;
+use tracing::{error, info};
+
+// Drains the instance once it is told to stop, e.g. by a rolling deploy, so
+// that its devices move to the other instances over
+// DRAIN_RECONNECT_SPREAD_MS instead of all at once:
+// - the server stops accepting connections and new sessions and streams are
+//   rejected, so that the devices connect to the other instances
+// - every stream delivers what DeliveryBroker holds for its device and ends
+//   with UNAVAILABLE, at a time picked at random within the spread
+// - once the streams have ended, the acknowledged messages that are left are
+//   removed, the AMQP consumer is cancelled and the last acks are sent before
+//   the consume channel is closed
+// The messages that aren't delivered are in the database, the devices get
+// them from there on their next stream.
+#[derive(Debug, Default)]
+pub struct Drain {
+  draining: AtomicBool,
+  started: Notify,
+  streams: AtomicUsize,
+  stream_ended: Notify,
+}
+
+// Counts a stream as connected while it lives
+pub struct StreamGuard {
+  drain: Arc<Drain>,
+}
+
+impl Drop for StreamGuard {
+  fn drop(&mut self) {
+    self.drain.streams.fetch_sub(1, Ordering::SeqCst);
+    self.drain.stream_ended.notify_waiters();
+  }
+}
+
+impl Drain {
+  pub fn is_draining(&self) -> bool {
+    self.draining.load(Ordering::SeqCst)
+  }
+
+  pub fn check_accepting(&self) -> Result<(), Status> {
+    if self.is_draining() {
+      return Err(Status::unavailable(
+        "Tunnelbroker is draining, connect to another instance",
+      ));
+    }
+    Ok(())
+  }
+
+  pub fn register_stream(self: &Arc<Self>) -> StreamGuard {
+    self.streams.fetch_add(1, Ordering::SeqCst);
+    StreamGuard {
+      drain: self.clone(),
+    }
+  }
+
+  pub fn start(&self) {
+    if !self.draining.swap(true, Ordering::SeqCst) {
+      info!(
+        "Draining, {} streams are connected",
+        self.streams.load(Ordering::SeqCst)
+      );
+      self.started.notify_waiters();
+    }
+  }
+
+  pub async fn wait_until_draining(&self) {
+    // Created before the check, so that it gets the notification of a start
+    // that comes in between
+    let started = self.started.notified();
+    if self.is_draining() {
+      return;
+    }
+    started.await;
+  }
+
+  // Resolves once the stream should hand its device off to another instance
+  pub async fn handoff(&self, session_id: &str) {
+    self.wait_until_draining().await;
+    tokio::time::sleep(reconnect_delay(session_id)).await;
+  }
+
+  // Resolves once the drain has started and every stream has ended, or
+  // after DRAIN_STREAMS_TIMEOUT_MS
+  pub async fn wait_for_streams(&self) {
+    self.wait_until_draining().await;
+    let wait = async {
+      loop {
+        let stream_ended = self.stream_ended.notified();
+        if self.streams.load(Ordering::SeqCst) == 0 {
+          return;
+        }
+        stream_ended.await;
+      }
+    };
+    if tokio::time::timeout(
+      Duration::from_millis(constants::DRAIN_STREAMS_TIMEOUT_MS),
+      wait,
+    )
+    .await
+    .is_err()
+    {
+      error!(
+        "Drain: {} streams haven't ended in time",
+        self.streams.load(Ordering::SeqCst)
+      );
+    }
+  }
+
+  // Blocks while DynamoDB and the broker confirm it, so it doesn't run on the
+  // threads of the runtime
+  pub async fn finish(&self) {
+    match tokio::task::spawn_blocking(finishDrain).await {
+      Ok(Err(err)) => error!("Drain: {}", err.what()),
+      Err(err) => error!("Drain: task failed: {}", err),
+      Ok(Ok(())) => info!("Drained"),
+    }
+  }
+}
+
+pub fn handoff_status() -> Status {
+  Status::unavailable("Tunnelbroker is draining, reconnect to another instance")
+}
+
+// Starts the drain on SIGTERM, which is what stops a pod, or on SIGINT
+pub async fn start_on_signal(drain: Arc<Drain>) {
+  let mut terminate = match signal(SignalKind::terminate()) {
+    Ok(terminate) => terminate,
+    Err(err) => {
+      error!("Failed to listen for SIGTERM: {}", err);
+      return std::future::pending().await;
+    }
+  };
+  tokio::select! {
+    _ = terminate.recv() => {},
+    _ = tokio::signal::ctrl_c() => {},
+  }
+  drain.start();
+}
+
+fn reconnect_delay(session_id: &str) -> Duration {
+  // The keys of RandomState are random, so the delays of the streams are
+  // spread evenly whatever their session IDs are
+  let mut hasher = RandomState::new().build_hasher();
+  session_id.hash(&mut hasher);
+  Duration::from_millis(hasher.finish() % constants::DRAIN_RECONNECT_SPREAD_MS)
+}
@@ -1,32 +1,74 @@
 use crate::cxx_bridge::ffi::MessageItem;
 
+use super::blob;
 use super::constants;
 use super::cxx_bridge::ffi::{
-  ackMessageFromAMQP, eraseMessagesFromAMQP, getMessagesFromDatabase,
-  getSavedNonceToSign, getSessionItem, newSessionHandler, removeMessages,
-  sendMessages, sessionSignatureHandler, updateSessionItemDeviceToken,
-  updateSessionItemIsOnline, waitMessageFromDeliveryBroker, GRPCStatusCodes,
+  ackMessageFromAMQP, admitWork, bindDeviceToAMQP, getGrpcServerConfig,
+  getMessagesFromDatabase, getSavedNonceToSign, getSessionItem,
+  markMessagesDelivered, newSessionHandler, removeMessages, sendMessages,
+  sessionSignatureHandler, startListeningDeliveryBroker,
+  stopListeningDeliveryBroker, takeMessagesFromDeliveryBroker,
+  traceMessagesWritten, unbindDeviceFromAMQP, updateSessionItemDeviceToken,
+  updateSessionItemIsOnline, AdmissionDecision, AdmissionPriority,
+  GRPCStatusCodes,
 };
+use super::cxx_bridge::DeliveryBrokerWaker;
 use anyhow::Result;
 use futures::Stream;
 use std::pin::Pin;
-use tokio::sync::mpsc;
+use std::sync::Arc;
+use tokio::sync::{mpsc, Notify};
+use tokio::time::Duration;
 use tokio_stream::{wrappers::ReceiverStream, StreamExt};
 use tonic::{transport::Server, Request, Response, Status, Streaming};
 use tracing::{debug, error};
 use tunnelbroker::message_to_tunnelbroker::Data::{
   MessagesToSend, NewNotifyToken, ProcessedMessages,
 };
+use tunnelbroker::message_to_tunnelbroker_struct::MessagePriority;
 use tunnelbroker::tunnelbroker_service_server::{
   TunnelbrokerService, TunnelbrokerServiceServer,
 };
+mod drain;
 mod tools;
 mod tunnelbroker {
   tonic::include_proto!("tunnelbroker");
 }
 
 #[derive(Debug, Default)]
-struct TunnelbrokerServiceHandlers {}
+struct TunnelbrokerServiceHandlers {
+  drain: Arc<drain::Drain>,
+}
+
+// Stops routing the messages of the device to this instance when its stream
+// ends
+struct AmqpDeviceBindingGuard {
+  device_id: String,
+}
+
+impl Drop for AmqpDeviceBindingGuard {
+  fn drop(&mut self) {
+    if let Err(err) = unbindDeviceFromAMQP(&self.device_id) {
+      error!("Error on unbinding device from AMQP: {}", err.what());
+    }
+  }
+}
+
+// Stops the DeliveryBroker notifications when the stream of the device ends
+struct DeliveryBrokerListenerGuard {
+  device_id: String,
+  listener_id: u64,
+}
+
+impl Drop for DeliveryBrokerListenerGuard {
+  fn drop(&mut self) {
+    if let Err(err) =
+      stopListeningDeliveryBroker(&self.device_id, self.listener_id)
+    {
+      error!("Error on stopping DeliveryBroker listener: {}", err.what());
+    }
+  }
+}
 
 #[tonic::async_trait]
 impl TunnelbrokerService for TunnelbrokerServiceHandlers {
@@ -34,6 +76,8 @@ impl TunnelbrokerService for TunnelbrokerServiceHandlers {
     &self,
     request: Request<tunnelbroker::SessionSignatureRequest>,
   ) -> Result<Response<tunnelbroker::SessionSignatureResponse>, Status> {
+    self.drain.check_accepting()?;
+    tools::wait_for_admission(AdmissionPriority::Connection).await?;
     let result = sessionSignatureHandler(&request.into_inner().device_id);
     if result.grpcStatus.statusCode != GRPCStatusCodes::Ok {
       return Err(tools::create_tonic_status(
@@ -50,6 +94,8 @@ impl TunnelbrokerService for TunnelbrokerServiceHandlers {
     &self,
     request: Request<tunnelbroker::NewSessionRequest>,
   ) -> Result<Response<tunnelbroker::NewSessionResponse>, Status> {
+    self.drain.check_accepting()?;
+    tools::wait_for_admission(AdmissionPriority::Connection).await?;
     let inner_request = request.into_inner();
     let notify_token = inner_request.notify_token.unwrap_or(String::new());
     if !tunnelbroker::new_session_request::DeviceTypes::is_valid(
@@ -121,6 +167,10 @@ impl TunnelbrokerService for TunnelbrokerServiceHandlers {
     &self,
     request: Request<Streaming<tunnelbroker::MessageToTunnelbroker>>,
   ) -> Result<Response<Self::MessagesStreamStream>, Status> {
+    self.drain.check_accepting()?;
+    // Under overload the devices that are connected keep their streams, new
+    // ones are rejected before they read the database
+    tools::wait_for_admission(AdmissionPriority::Connection).await?;
     let session_id = match request.metadata().get("sessionID") {
       Some(metadata_session_id) => metadata_session_id
         .to_str()
@@ -184,6 +234,15 @@ impl TunnelbrokerService for TunnelbrokerServiceHandlers {
       };
     }
 
+    // Messages for the device are routed to this instance from now on, the
+    // ones that were sent before are read from the database below
+    if let Err(err) = bindDeviceToAMQP(&session_item.deviceID) {
+      return Err(Status::internal(err.what()));
+    }
+    let amqp_binding_guard = AmqpDeviceBindingGuard {
+      device_id: session_item.deviceID.clone(),
+    };
+
     // When a client connects to the bidirectional messages stream, first we check
     // if there are undelivered messages in the database
     let messages_from_database =
@@ -192,16 +251,24 @@ impl TunnelbrokerService for TunnelbrokerServiceHandlers {
         Err(err) => return Err(Status::internal(err.what())),
       };
     if messages_from_database.len() > 0 {
-      if let Err(err) = eraseMessagesFromAMQP(&session_item.deviceID) {
+      // Their copies that are still in AMQP are acknowledged without being
+      // delivered again
+      let delivered_ids: Vec<String> = messages_from_database
+        .iter()
+        .map(|message| message.messageID.clone())
+        .collect();
+      if let Err(err) =
+        markMessagesDelivered(&session_item.deviceID, &delivered_ids)
+      {
         return Err(Status::internal(err.what()));
       };
       let mut messages_to_response = vec![];
-      for message in &messages_from_database {
+      for message in messages_from_database {
         messages_to_response.push(tunnelbroker::MessageToClientStruct {
-          message_id: message.messageID.clone(),
-          from_device_id: message.fromDeviceID.clone(),
-          payload: message.payload.clone(),
-          blob_hashes: vec![message.blobHashes.clone()],
+          message_id: message.messageID,
+          from_device_id: message.fromDeviceID,
+          payload: message.payload,
+          blob_hashes: vec![message.blobHashes],
         });
       }
       let result_from_writer = tx_writer(
@@ -225,24 +292,81 @@ impl TunnelbrokerService for TunnelbrokerServiceHandlers {
     }
 
     // Spawning asynchronous Tokio task to deliver new messages
-    // to the client from delivery broker
+    // to the client from delivery broker. It doesn't take a thread while it
+    // waits, DeliveryBroker wakes it up when messages arrive.
+    let notify = Arc::new(Notify::new());
+    let listener_id = match startListeningDeliveryBroker(
+      &session_item.deviceID,
+      Box::new(DeliveryBrokerWaker {
+        notify: notify.clone(),
+      }),
+    ) {
+      Ok(listener_id) => listener_id,
+      Err(err) => return Err(Status::internal(err.what())),
+    };
     tokio::spawn({
       let device_id = session_item.deviceID.clone();
       let session_id = session_id.clone();
       let tx = tx.clone();
+      let stream_guard = self.drain.register_stream();
+      let drain = self.drain.clone();
       async move {
+        let _amqp_binding_guard = amqp_binding_guard;
+        let _listener_guard = DeliveryBrokerListenerGuard {
+          device_id: device_id.clone(),
+          listener_id,
+        };
+        let _stream_guard = stream_guard;
+        let handoff = drain.handoff(&session_id);
+        tokio::pin!(handoff);
+        let mut handing_off = false;
         loop {
-          let message_to_deliver =
-            match waitMessageFromDeliveryBroker(&device_id) {
-              Ok(message_item) => message_item,
-              Err(err) => {
-                error!(
-                  "Error on waiting messages from DeliveryBroker: {}",
-                  err.what()
-                );
-                return;
+          let mut messages_to_deliver = match takeMessagesFromDeliveryBroker(
+            &device_id,
+            constants::DELIVERY_BROKER_TAKE_BATCH_SIZE,
+          ) {
+            Ok(messages) => messages,
+            Err(err) => {
+              error!(
+                "Error on taking messages from DeliveryBroker: {}",
+                err.what()
+              );
+              return;
+            }
+          };
+          if messages_to_deliver.is_empty() {
+            if handing_off {
+              // Everything that DeliveryBroker held for the device has been
+              // delivered, the device reconnects to another instance
+              if let Err(err) =
+                tx_writer(&session_id, &tx, Err(drain::handoff_status())).await
+              {
+                debug!("Error on writing the handoff status: {}", err);
               }
-            };
+              return;
+            }
+            // The wait is cancelled when the client disconnects
+            tokio::select! {
+              _ = notify.notified() => continue,
+              _ = tx.closed() => return,
+              _ = &mut handoff => {
+                handing_off = true;
+                continue;
+              }
+            }
+          }
+          let mut messages_to_response = vec![];
+          // The IDs, trace contexts and delivery tags are still needed after
+          // the write, the payloads are moved into the response
+          for message in &mut messages_to_deliver {
+            messages_to_response.push(tunnelbroker::MessageToClientStruct {
+              message_id: message.messageID.clone(),
+              from_device_id: message.fromDeviceID.clone(),
+              payload: std::mem::take(&mut message.payload),
+              blob_hashes: vec![std::mem::take(&mut message.blobHashes)],
+            });
+          }
+          let write_started_at = tools::unix_time_nanos();
           let writer_result = tx_writer(
             &session_id,
             &tx,
@@ -250,12 +374,7 @@ impl TunnelbrokerService for TunnelbrokerServiceHandlers {
               data: Some(
                 tunnelbroker::message_to_client::Data::MessagesToDeliver(
                   tunnelbroker::MessagesToDeliver {
-                    messages: vec![tunnelbroker::MessageToClientStruct {
-                      message_id: message_to_deliver.messageID,
-                      from_device_id: message_to_deliver.fromDeviceID,
-                      payload: message_to_deliver.payload,
-                      blob_hashes: vec![message_to_deliver.blobHashes],
-                    }],
+                    messages: messages_to_response,
                   },
                 ),
               ),
@@ -265,10 +384,13 @@ impl TunnelbrokerService for TunnelbrokerServiceHandlers {
             debug!("Error on writing to the stream: {}", err);
             return;
           };
-          if let Err(err) = ackMessageFromAMQP(message_to_deliver.deliveryTag) {
-            debug!("Error on message acknowledgement in AMQP queue: {}", err);
-            return;
-          };
+          traceMessagesWritten(&messages_to_deliver, write_started_at);
+          for message in &messages_to_deliver {
+            if let Err(err) = ackMessageFromAMQP(message.deliveryTag) {
+              debug!("Error on message acknowledgement in AMQP queue: {}", err);
+              return;
+            };
+          }
         }
       }
     });
@@ -318,9 +440,29 @@ impl TunnelbrokerService for TunnelbrokerServiceHandlers {
                   payload: message.payload,
                   blobHashes: String::new(),
                   deliveryTag: 0,
+                  traceContext: String::new(),
+                  isBulk: message.priority == MessagePriority::Bulk as i32,
                 });
               }
-              let messages_ids = match sendMessages(&messages_vec) {
+              // A batch is only shed if it is all bulk, as the IDs in
+              // ProcessedMessages are those of the whole batch. The status
+              // ends the stream, and the client sends the batch again on
+              // the next one.
+              let priority =
+                if messages_vec.iter().all(|message| message.isBulk) {
+                  AdmissionPriority::Bulk
+                } else {
+                  AdmissionPriority::Interactive
+                };
+              if let Err(status) = tools::wait_for_admission(priority).await {
+                if let Err(err) = tx_writer(&session_id, &tx, Err(status)).await
+                {
+                  debug!("Failed to write the overload status: {}", err);
+                }
+                break;
+              }
+              blob::offload_payloads(&mut messages_vec).await;
+              let messages_ids = match sendMessages(messages_vec) {
                 Err(err) => {
                   error!("Error on sending messages: {}", err.what());
                   return;
@@ -378,13 +520,30 @@ impl TunnelbrokerService for TunnelbrokerServiceHandlers {
 
 pub async fn run_grpc_server() -> Result<()> {
   let addr = format!("[::1]:{}", constants::GRPC_SERVER_PORT).parse()?;
-  Server::builder()
-    .http2_keepalive_interval(Some(constants::GRPC_KEEP_ALIVE_PING_INTERVAL))
-    .http2_keepalive_timeout(Some(constants::GRPC_KEEP_ALIVE_PING_TIMEOUT))
+  let config = getGrpcServerConfig()?;
+  let optional_ms = |ms: u64| (ms > 0).then(|| Duration::from_millis(ms));
+  let drain = Arc::new(drain::Drain::default());
+  // Once the drain starts the server stops taking connections and tells the
+  // clients to open new streams elsewhere, the streams that are open keep
+  // going until they hand off
+  let server = Server::builder()
+    .max_concurrent_streams(
+      (config.maxConcurrentStreams > 0).then(|| config.maxConcurrentStreams),
+    )
+    .http2_keepalive_interval(optional_ms(config.keepAliveIntervalMs))
+    .http2_keepalive_timeout(optional_ms(config.keepAliveTimeoutMs))
     .add_service(TunnelbrokerServiceServer::new(
-      TunnelbrokerServiceHandlers::default(),
+      TunnelbrokerServiceHandlers {
+        drain: drain.clone(),
+      },
     ))
-    .serve(addr)
-    .await?;
+    .serve_with_shutdown(addr, drain::start_on_signal(drain.clone()));
+  tokio::select! {
+    result = server => result?,
+    _ = drain.wait_for_streams() => {},
+  }
+  if drain.is_draining() {
+    drain.finish().await;
+  }
   Ok(())
 }
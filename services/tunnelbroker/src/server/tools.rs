@@ -1,7 +1,12 @@
-use crate::server::GRPCStatusCodes;
+use crate::constants;
+use crate::server::{
+  admitWork, AdmissionDecision, AdmissionPriority, GRPCStatusCodes,
+};
 use openssl::pkey::PKey;
 use openssl::sign::Verifier;
 use openssl::{error::ErrorStack, hash::MessageDigest};
+use std::time::{Instant, SystemTime, UNIX_EPOCH};
+use tokio::time::Duration;
 use tonic::{Code, Status};
 
 pub fn create_tonic_status(code: GRPCStatusCodes, text: &str) -> Status {
@@ -28,6 +33,41 @@ pub fn create_tonic_status(code: GRPCStatusCodes, text: &str) -> Status {
   Status::new(status, text)
 }
 
+// Waits while the work is deferred, without holding a thread, and returns a
+// retryable status once it is rejected or has been deferred for too long
+pub async fn wait_for_admission(
+  priority: AdmissionPriority,
+) -> Result<(), Status> {
+  let deferred_at = Instant::now();
+  loop {
+    match admitWork(priority) {
+      AdmissionDecision::Admit => return Ok(()),
+      AdmissionDecision::Defer
+        if deferred_at.elapsed()
+          < Duration::from_millis(constants::ADMISSION_MAX_DEFER_MS) =>
+      {
+        tokio::time::sleep(Duration::from_millis(
+          constants::ADMISSION_DEFER_RETRY_MS,
+        ))
+        .await
+      }
+      _ => {
+        return Err(Status::unavailable(
+          "Tunnelbroker is overloaded, try again later",
+        ))
+      }
+    }
+  }
+}
+
+// Times the spans that are recorded from C++
+pub fn unix_time_nanos() -> u64 {
+  SystemTime::now()
+    .duration_since(UNIX_EPOCH)
+    .map(|duration| duration.as_nanos() as u64)
+    .unwrap_or(0)
+}
+
 pub fn verify_signed_string(
   public_key_pem: &str,
   string_to_be_signed: &str,